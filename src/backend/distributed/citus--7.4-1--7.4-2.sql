@@ -0,0 +1,12 @@
+/* citus--7.4-1--7.4-2 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_remote_connection_stats(OUT hostname text, OUT port int, OUT connection_count_to_node int)
+	RETURNS SETOF RECORD
+	LANGUAGE C STRICT
+	AS 'MODULE_PATHNAME', $$citus_remote_connection_stats$$;
+COMMENT ON FUNCTION citus_remote_connection_stats(OUT hostname text, OUT port int, OUT connection_count_to_node int)
+	IS 'returns the number of connections that the backends of this node hold to each worker node';
+
+RESET search_path;
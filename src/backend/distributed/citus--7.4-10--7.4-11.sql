@@ -0,0 +1,13 @@
+/* citus--7.4-10--7.4-11 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION master_split_shard(shard_id bigint, split_count integer default 2)
+RETURNS bigint[]
+LANGUAGE C STRICT VOLATILE
+AS 'MODULE_PATHNAME', $$master_split_shard$$;
+
+COMMENT ON FUNCTION master_split_shard(bigint, integer)
+	IS 'splits a shard and its co-located shards into shards with equal hash ranges';
+
+RESET search_path;
@@ -0,0 +1,15 @@
+/* citus--7.4-11--7.4-12 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION master_repair_node_placements(node_name text,
+											  node_port integer,
+											  max_concurrent_repairs integer default 4)
+RETURNS integer
+LANGUAGE C STRICT VOLATILE
+AS 'MODULE_PATHNAME', $$master_repair_node_placements$$;
+
+COMMENT ON FUNCTION master_repair_node_placements(text, integer, integer)
+	IS 'repairs the inactive shard placements on a node from healthy placements';
+
+RESET search_path;
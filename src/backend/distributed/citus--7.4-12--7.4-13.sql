@@ -0,0 +1,25 @@
+/* citus--7.4-12--7.4-13 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_table_sizes(logicalrelids regclass[],
+								  OUT logicalrelid regclass,
+								  OUT table_size bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS 'MODULE_PATHNAME', $$citus_table_sizes$$;
+
+COMMENT ON FUNCTION citus_table_sizes(regclass[])
+	IS 'get disk space used by the given distributed tables, excluding indexes';
+
+CREATE FUNCTION citus_total_relation_sizes(logicalrelids regclass[],
+										   OUT logicalrelid regclass,
+										   OUT total_relation_size bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS 'MODULE_PATHNAME', $$citus_total_relation_sizes$$;
+
+COMMENT ON FUNCTION citus_total_relation_sizes(regclass[])
+	IS 'get total disk space used by the given distributed tables';
+
+RESET search_path;
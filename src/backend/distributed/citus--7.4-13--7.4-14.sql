@@ -0,0 +1,22 @@
+/* citus--7.4-13--7.4-14 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION master_mark_shard_cold(shard_id bigint, tablespace_name name)
+RETURNS void
+LANGUAGE C STRICT VOLATILE
+AS 'MODULE_PATHNAME', $$master_mark_shard_cold$$;
+
+COMMENT ON FUNCTION master_mark_shard_cold(bigint, name)
+	IS 'moves an append shard to the given tablespace and stops appends to it';
+
+CREATE FUNCTION master_mark_shard_hot(shard_id bigint,
+									  tablespace_name name default 'pg_default')
+RETURNS void
+LANGUAGE C STRICT VOLATILE
+AS 'MODULE_PATHNAME', $$master_mark_shard_hot$$;
+
+COMMENT ON FUNCTION master_mark_shard_hot(bigint, name)
+	IS 'moves a cold shard to the given tablespace and allows appends to it again';
+
+RESET search_path;
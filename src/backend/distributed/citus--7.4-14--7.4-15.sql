@@ -0,0 +1,34 @@
+/* citus--7.4-14--7.4-15 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_stat_statements(OUT queryid bigint, OUT userid oid, OUT dbid oid,
+                                      OUT query text, OUT executor text,
+                                      OUT calls bigint, OUT shards bigint,
+                                      OUT planning_time double precision,
+                                      OUT subplan_time double precision,
+                                      OUT remote_time double precision,
+                                      OUT merge_time double precision,
+                                      OUT total_time double precision,
+                                      OUT bytes_received bigint,
+                                      OUT intermediate_result_bytes bigint)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_stat_statements$$;
+COMMENT ON FUNCTION citus_stat_statements()
+    IS 'returns execution statistics of distributed statements';
+
+CREATE VIEW citus_stat_statements AS
+SELECT * FROM citus_stat_statements();
+
+GRANT SELECT ON citus_stat_statements TO public;
+
+CREATE FUNCTION citus_stat_statements_reset()
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_stat_statements_reset$$;
+COMMENT ON FUNCTION citus_stat_statements_reset()
+    IS 'discards all statistics in citus_stat_statements';
+REVOKE ALL ON FUNCTION citus_stat_statements_reset() FROM PUBLIC;
+
+RESET search_path;
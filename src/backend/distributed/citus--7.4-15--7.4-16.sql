@@ -0,0 +1,42 @@
+/* citus--7.4-15--7.4-16 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_shard_access_stats(OUT shardid bigint, OUT reads bigint,
+                                         OUT writes bigint,
+                                         OUT execution_time double precision)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_shard_access_stats$$;
+COMMENT ON FUNCTION citus_shard_access_stats()
+    IS 'returns the reads and writes of shards by the router executor on this node';
+
+CREATE FUNCTION citus_dist_shard_access_stats(OUT shardid bigint, OUT reads bigint,
+                                              OUT writes bigint,
+                                              OUT execution_time double precision)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_dist_shard_access_stats$$;
+COMMENT ON FUNCTION citus_dist_shard_access_stats()
+    IS 'returns the reads and writes of shards by the router executor on all nodes with metadata';
+
+CREATE VIEW citus_shard_access AS
+SELECT shard.logicalrelid AS table_name,
+       access.shardid,
+       access.reads,
+       access.writes,
+       access.execution_time
+FROM citus_dist_shard_access_stats() access
+     JOIN pg_dist_shard shard ON (access.shardid = shard.shardid);
+
+GRANT SELECT ON citus_shard_access TO public;
+
+CREATE FUNCTION citus_shard_access_stats_reset()
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_shard_access_stats_reset$$;
+COMMENT ON FUNCTION citus_shard_access_stats_reset()
+    IS 'discards the shard access counters of this node';
+REVOKE ALL ON FUNCTION citus_shard_access_stats_reset() FROM PUBLIC;
+
+RESET search_path;
@@ -0,0 +1,47 @@
+/* citus--7.4-16--7.4-17 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_worker_wait_events(OUT pid integer, OUT nodename text,
+                                         OUT nodeport integer, OUT wait_event text,
+                                         OUT wait_start timestamptz)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_worker_wait_events$$;
+COMMENT ON FUNCTION citus_worker_wait_events()
+    IS 'returns the worker node on which each backend of this node is waiting';
+
+CREATE VIEW citus_stat_worker_waits AS
+SELECT activity.pid,
+       activity.datname,
+       activity.usename,
+       activity.state,
+       activity.query,
+       waits.nodename,
+       waits.nodeport,
+       waits.wait_event AS worker_wait_event,
+       waits.wait_start
+FROM pg_stat_activity activity
+     JOIN citus_worker_wait_events() waits ON (activity.pid = waits.pid);
+
+GRANT SELECT ON citus_stat_worker_waits TO public;
+
+CREATE FUNCTION citus_worker_latency_histogram(OUT nodename text, OUT nodeport integer,
+                                               OUT wait_event text,
+                                               OUT max_latency double precision,
+                                               OUT wait_count bigint)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_worker_latency_histogram$$;
+COMMENT ON FUNCTION citus_worker_latency_histogram()
+    IS 'returns the number of waits on each worker node by latency in milliseconds';
+
+CREATE FUNCTION citus_worker_latency_histogram_reset()
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_worker_latency_histogram_reset$$;
+COMMENT ON FUNCTION citus_worker_latency_histogram_reset()
+    IS 'discards the latency histograms of all worker nodes';
+REVOKE ALL ON FUNCTION citus_worker_latency_histogram_reset() FROM PUBLIC;
+
+RESET search_path;
@@ -0,0 +1,27 @@
+/* citus--7.4-17--7.4-18 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_job_cache_entries(OUT kind text, OUT directory text,
+                                        OUT job_id bigint, OUT result_id text,
+                                        OUT file_count bigint, OUT total_bytes bigint)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_job_cache_entries$$;
+COMMENT ON FUNCTION citus_job_cache_entries()
+    IS 'returns the disk space used by each job and intermediate result in the job cache of this node';
+
+CREATE VIEW citus_job_cache_usage AS
+SELECT kind, directory, job_id, result_id, file_count, total_bytes
+FROM citus_job_cache_entries();
+
+GRANT SELECT ON citus_job_cache_usage TO public;
+
+CREATE FUNCTION citus_job_cache_reserved_size()
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_job_cache_reserved_size$$;
+COMMENT ON FUNCTION citus_job_cache_reserved_size()
+    IS 'returns the number of bytes accounted to the job cache quota of this node';
+
+RESET search_path;
@@ -0,0 +1,39 @@
+/* citus--7.4-18--7.4-19 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION task_tracker_tasks(OUT job_id bigint, OUT task_id integer,
+                                   OUT task_status text, OUT queued_at timestamptz,
+                                   OUT queue_time double precision,
+                                   OUT run_time double precision,
+                                   OUT backend_pid integer, OUT retries integer,
+                                   OUT database_name text)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$task_tracker_tasks$$;
+COMMENT ON FUNCTION task_tracker_tasks()
+    IS 'returns the tasks tracked by the task tracker of this node';
+
+CREATE VIEW citus_task_tracker_tasks AS
+SELECT job_id, task_id, task_status, queued_at, queue_time, run_time,
+       backend_pid, retries, database_name
+FROM task_tracker_tasks();
+
+GRANT SELECT ON citus_task_tracker_tasks TO public;
+
+CREATE FUNCTION task_tracker_stats(OUT assigned_tasks bigint, OUT started_tasks bigint,
+                                   OUT succeeded_tasks bigint, OUT failed_tasks bigint,
+                                   OUT permanently_failed_tasks bigint,
+                                   OUT canceled_tasks bigint,
+                                   OUT total_queue_time double precision,
+                                   OUT total_run_time double precision,
+                                   OUT queued_tasks bigint, OUT running_tasks bigint,
+                                   OUT max_running_tasks integer,
+                                   OUT stats_since timestamptz)
+    RETURNS record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$task_tracker_stats$$;
+COMMENT ON FUNCTION task_tracker_stats()
+    IS 'returns the number of tasks the task tracker of this node ran since the server started';
+
+RESET search_path;
@@ -0,0 +1,38 @@
+/* citus--7.4-19--7.4-20 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_maintenance_daemon_stats(OUT databaseid oid, OUT pid integer,
+                                               OUT cycles bigint,
+                                               OUT last_cycle_time double precision,
+                                               OUT max_cycle_time double precision,
+                                               OUT last_cycle_start timestamptz,
+                                               OUT deadlock_checks bigint,
+                                               OUT last_deadlock_check_time double precision,
+                                               OUT max_deadlock_check_time double precision,
+                                               OUT total_deadlock_check_time double precision,
+                                               OUT last_wait_edges integer,
+                                               OUT total_wait_edges bigint,
+                                               OUT deadlocks_found bigint,
+                                               OUT deadlock_check_lag double precision,
+                                               OUT recoveries bigint,
+                                               OUT last_recovery_time double precision,
+                                               OUT total_recovery_time double precision,
+                                               OUT recovered_transactions bigint,
+                                               OUT statistics_refreshes bigint,
+                                               OUT last_statistics_refresh_time double precision,
+                                               OUT refreshed_shards bigint)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_maintenance_daemon_stats$$;
+COMMENT ON FUNCTION citus_maintenance_daemon_stats()
+    IS 'returns the workload metrics of the maintenance daemons on this node';
+
+CREATE VIEW citus_stat_maintenance_daemon AS
+SELECT database.datname, stats.*
+FROM citus_maintenance_daemon_stats() stats
+     LEFT JOIN pg_database database ON (database.oid = stats.databaseid);
+
+GRANT SELECT ON citus_stat_maintenance_daemon TO public;
+
+RESET search_path;
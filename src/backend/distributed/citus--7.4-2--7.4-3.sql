@@ -0,0 +1,12 @@
+/* citus--7.4-2--7.4-3 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION task_tracker_job_status(job_id bigint, OUT task_id integer, OUT task_status integer)
+	RETURNS SETOF RECORD
+	LANGUAGE C STRICT
+	AS 'MODULE_PATHNAME', $$task_tracker_job_status$$;
+COMMENT ON FUNCTION task_tracker_job_status(job_id bigint, OUT task_id integer, OUT task_status integer)
+	IS 'check the execution statuses of all assigned tasks of a job';
+
+RESET search_path;
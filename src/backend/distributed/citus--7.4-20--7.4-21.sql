@@ -0,0 +1,31 @@
+/* citus--7.4-20--7.4-21 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_planner_stats(OUT stage text, OUT calls bigint,
+                                    OUT total_time double precision,
+                                    OUT max_time double precision,
+                                    OUT stats_since timestamptz)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_planner_stats$$;
+COMMENT ON FUNCTION citus_planner_stats()
+    IS 'returns the calls and time of the stages of distributed planning on this node';
+
+CREATE FUNCTION citus_planner_stats_reset()
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_planner_stats_reset$$;
+COMMENT ON FUNCTION citus_planner_stats_reset()
+    IS 'resets the counters of citus_stat_planner';
+REVOKE ALL ON FUNCTION citus_planner_stats_reset() FROM PUBLIC;
+
+CREATE VIEW citus_stat_planner AS
+SELECT stage, calls, total_time, max_time,
+       CASE WHEN calls > 0 THEN total_time / calls END AS mean_time,
+       stats_since
+FROM citus_planner_stats();
+
+GRANT SELECT ON citus_stat_planner TO public;
+
+RESET search_path;
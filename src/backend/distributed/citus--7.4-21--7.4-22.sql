@@ -0,0 +1,30 @@
+/* citus--7.4-21--7.4-22 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_query_trace_events(OUT trace_id bigint, OUT pid integer,
+                                         OUT event text, OUT phase text,
+                                         OUT event_time timestamptz,
+                                         OUT detail bigint, OUT label text)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_query_trace_events$$;
+COMMENT ON FUNCTION citus_query_trace_events()
+    IS 'returns the events of traced statements in the ring buffer of this node';
+
+CREATE FUNCTION citus_query_trace_json(trace_id bigint DEFAULT NULL)
+    RETURNS json
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$citus_query_trace_json$$;
+COMMENT ON FUNCTION citus_query_trace_json(bigint)
+    IS 'returns the events of traced statements in the chrome://tracing format';
+
+CREATE FUNCTION citus_query_trace_reset()
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_query_trace_reset$$;
+COMMENT ON FUNCTION citus_query_trace_reset()
+    IS 'removes all events from the query trace ring buffer';
+REVOKE ALL ON FUNCTION citus_query_trace_reset() FROM PUBLIC;
+
+RESET search_path;
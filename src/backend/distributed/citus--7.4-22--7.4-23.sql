@@ -0,0 +1,70 @@
+/* citus--7.4-22--7.4-23 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_backend_transactions(OUT database_id oid, OUT process_id int,
+                                           OUT initiator_node_identifier int4,
+                                           OUT transaction_number int8,
+                                           OUT transaction_stamp timestamptz,
+                                           OUT transaction_originator bool)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_backend_transactions$$;
+COMMENT ON FUNCTION citus_backend_transactions()
+    IS 'returns distributed transaction ids of active distributed transactions and whether the backend started them';
+
+CREATE FUNCTION citus_cluster_activity(OUT node_name text, OUT node_port int,
+                                       OUT initiator_node_identifier int4,
+                                       OUT transaction_number int8,
+                                       OUT transaction_stamp timestamptz,
+                                       OUT transaction_originator bool,
+                                       OUT pid int, OUT usename text,
+                                       OUT application_name text, OUT state text,
+                                       OUT wait_event_type text, OUT wait_event text,
+                                       OUT query_start timestamptz,
+                                       OUT query_duration interval, OUT query text)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_cluster_activity$$;
+COMMENT ON FUNCTION citus_cluster_activity()
+    IS 'returns the activity of backends in distributed transactions on all nodes';
+
+-- match each backend that started a distributed transaction to the backends
+-- that run parts of it, on the distributed transaction id
+CREATE VIEW citus_dist_stat_activity AS
+WITH activity AS (
+    SELECT * FROM citus_cluster_activity()
+)
+SELECT client.initiator_node_identifier,
+       client.transaction_number,
+       client.transaction_stamp,
+       client.node_name AS query_node_name,
+       client.node_port AS query_node_port,
+       client.pid,
+       client.usename,
+       client.application_name,
+       client.state,
+       client.wait_event_type,
+       client.wait_event,
+       client.query_start,
+       client.query_duration,
+       client.query,
+       worker.node_name AS worker_node_name,
+       worker.node_port AS worker_node_port,
+       worker.pid AS worker_pid,
+       worker.state AS worker_state,
+       worker.wait_event_type AS worker_wait_event_type,
+       worker.wait_event AS worker_wait_event,
+       worker.query_duration AS worker_query_duration,
+       worker.query AS worker_query
+FROM activity client
+     LEFT JOIN activity worker ON (
+        worker.initiator_node_identifier = client.initiator_node_identifier AND
+        worker.transaction_number = client.transaction_number AND
+        worker.transaction_stamp = client.transaction_stamp AND
+        NOT worker.transaction_originator)
+WHERE client.transaction_originator;
+
+GRANT SELECT ON citus_dist_stat_activity TO public;
+
+RESET search_path;
@@ -0,0 +1,54 @@
+/* citus--7.4-24--7.4-25 */
+
+CREATE TABLE citus.pg_dist_shard_zone_map(
+    logicalrelid regclass NOT NULL,
+    shardid bigint NOT NULL,
+    attnum int2 NOT NULL,
+    atttypid oid NOT NULL,
+    bloomfiltersize int NOT NULL,
+    minvalue text,
+    maxvalue text,
+    bloomfilter bytea,
+    PRIMARY KEY (shardid, attnum)
+);
+ALTER TABLE citus.pg_dist_shard_zone_map SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.pg_dist_shard_zone_map TO public;
+
+CREATE INDEX pg_dist_shard_zone_map_logicalrelid_index
+  ON pg_catalog.pg_dist_shard_zone_map USING btree(logicalrelid);
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_bloom_filter_agg_sfunc(internal, anyelement, integer)
+    RETURNS internal
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$citus_bloom_filter_agg_sfunc$$;
+COMMENT ON FUNCTION citus_bloom_filter_agg_sfunc(internal, anyelement, integer)
+    IS 'transition function for citus_bloom_filter_agg';
+
+CREATE FUNCTION citus_bloom_filter_agg_ffunc(internal)
+    RETURNS bytea
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$citus_bloom_filter_agg_ffunc$$;
+COMMENT ON FUNCTION citus_bloom_filter_agg_ffunc(internal)
+    IS 'finalizer for citus_bloom_filter_agg';
+
+CREATE AGGREGATE citus_bloom_filter_agg(anyelement, integer) (
+    STYPE = internal,
+    SFUNC = citus_bloom_filter_agg_sfunc,
+    FINALFUNC = citus_bloom_filter_agg_ffunc
+);
+COMMENT ON AGGREGATE citus_bloom_filter_agg(anyelement, integer)
+    IS 'build a bloom filter of the given size in bytes over the hashes of the non-null input values';
+
+CREATE FUNCTION update_shard_zone_maps(table_name regclass,
+                                       column_names text[],
+                                       bloom_filter_size integer DEFAULT 0)
+    RETURNS integer
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$update_shard_zone_maps$$;
+COMMENT ON FUNCTION update_shard_zone_maps(table_name regclass, column_names text[],
+                                           bloom_filter_size integer)
+    IS 'record the min/max values and optionally bloom filters of the given columns in each shard of a table';
+
+RESET search_path;
@@ -0,0 +1,28 @@
+/* citus--7.4-25--7.4-26 */
+
+CREATE TABLE citus.pg_dist_retention_policy(
+    logicalrelid regclass NOT NULL PRIMARY KEY,
+    retentionperiod interval NOT NULL
+);
+ALTER TABLE citus.pg_dist_retention_policy SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.pg_dist_retention_policy TO public;
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION master_set_retention_policy(table_name regclass,
+                                            retention_period interval)
+    RETURNS void
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$master_set_retention_policy$$;
+COMMENT ON FUNCTION master_set_retention_policy(table_name regclass,
+                                                retention_period interval)
+    IS 'set how long the shards of a time-partitioned table are kept, or remove the policy when the period is NULL';
+
+CREATE FUNCTION master_drop_expired_shards(table_name regclass)
+    RETURNS integer
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_drop_expired_shards$$;
+COMMENT ON FUNCTION master_drop_expired_shards(table_name regclass)
+    IS 'drop the shards of a table whose rows are all older than its retention period';
+
+RESET search_path;
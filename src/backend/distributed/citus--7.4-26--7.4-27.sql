@@ -0,0 +1,30 @@
+/* citus--7.4-26--7.4-27 */
+
+SET search_path = 'pg_catalog';
+
+DROP FUNCTION create_intermediate_result(text, text);
+CREATE FUNCTION create_intermediate_result(result_id text, query text,
+                                           session_lifetime boolean default false)
+    RETURNS bigint
+    LANGUAGE C STRICT VOLATILE
+    AS 'MODULE_PATHNAME', $$create_intermediate_result$$;
+COMMENT ON FUNCTION create_intermediate_result(text,text,boolean)
+    IS 'execute a query and write its results to local result file';
+
+DROP FUNCTION broadcast_intermediate_result(text, text);
+CREATE FUNCTION broadcast_intermediate_result(result_id text, query text,
+                                              session_lifetime boolean default false)
+    RETURNS bigint
+    LANGUAGE C STRICT VOLATILE
+    AS 'MODULE_PATHNAME', $$broadcast_intermediate_result$$;
+COMMENT ON FUNCTION broadcast_intermediate_result(text,text,boolean)
+    IS 'execute a query and write its results to an result file on all workers';
+
+CREATE FUNCTION drop_intermediate_result(result_id text)
+    RETURNS boolean
+    LANGUAGE C STRICT VOLATILE
+    AS 'MODULE_PATHNAME', $$drop_intermediate_result$$;
+COMMENT ON FUNCTION drop_intermediate_result(text)
+    IS 'drop an intermediate result that was created for the duration of the session';
+
+RESET search_path;
@@ -0,0 +1,22 @@
+/* citus--7.4-27--7.4-28 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_link_partition_file(bigint, integer, integer, integer)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_link_partition_file$$;
+COMMENT ON FUNCTION worker_link_partition_file(bigint, integer, integer, integer)
+    IS 'make partition file of a map task on this node available to an upstream task';
+
+CREATE FUNCTION worker_partition_file_sizes(job_id bigint, task_ids integer[],
+                                            OUT task_id integer,
+                                            OUT partition_id integer,
+                                            OUT file_size bigint)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_partition_file_sizes$$;
+COMMENT ON FUNCTION worker_partition_file_sizes(bigint, integer[])
+    IS 'return sizes of the partition files written by map tasks on this node';
+
+RESET search_path;
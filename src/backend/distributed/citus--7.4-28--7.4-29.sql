@@ -0,0 +1,16 @@
+/* citus--7.4-28--7.4-29 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION master_allocate_sequence_range(sequence_id regclass,
+                                               range_size bigint,
+                                               OUT first_value bigint,
+                                               OUT last_value bigint,
+                                               OUT increment_by bigint)
+    RETURNS record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_allocate_sequence_range$$;
+COMMENT ON FUNCTION master_allocate_sequence_range(regclass, bigint)
+    IS 'take a range of values of a sequence for use on a metadata worker';
+
+RESET search_path;
@@ -0,0 +1,42 @@
+/* citus--7.4-29--7.4-30 */
+
+CREATE TABLE citus.pg_dist_rollup(
+    rollupid regclass NOT NULL PRIMARY KEY,
+    sourceid regclass NOT NULL,
+    sequenceid regclass NOT NULL,
+    lastaggregatedid bigint NOT NULL,
+    aggregatequery text NOT NULL
+);
+ALTER TABLE citus.pg_dist_rollup SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.pg_dist_rollup TO public;
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION master_create_rollup(rollup_table regclass,
+                                     source_table regclass,
+                                     sequence_column text,
+                                     aggregate_query text)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_create_rollup$$;
+COMMENT ON FUNCTION master_create_rollup(rollup_table regclass,
+                                         source_table regclass,
+                                         sequence_column text,
+                                         aggregate_query text)
+    IS 'incrementally aggregate new rows of a distributed table into a colocated rollup table';
+
+CREATE FUNCTION master_drop_rollup(rollup_table regclass)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_drop_rollup$$;
+COMMENT ON FUNCTION master_drop_rollup(rollup_table regclass)
+    IS 'stop incrementally aggregating into a rollup table';
+
+CREATE FUNCTION master_run_rollup(rollup_table regclass)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_run_rollup$$;
+COMMENT ON FUNCTION master_run_rollup(rollup_table regclass)
+    IS 'aggregate the new rows of the source table of a rollup table right away';
+
+RESET search_path;
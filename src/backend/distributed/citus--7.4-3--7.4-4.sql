@@ -0,0 +1,23 @@
+/* citus--7.4-3--7.4-4 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_range_partition_table(bigint, integer, text, text, oid, anyarray,
+                                             integer[], text[], integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_range_partition_table$$;
+COMMENT ON FUNCTION worker_range_partition_table(bigint, integer, text, text, oid,
+                                                 anyarray, integer[], text[], integer[])
+    IS 'range partition query results and push partitions to merge task nodes';
+
+CREATE FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid, integer,
+                                            integer[], text[], integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_hash_partition_table$$;
+COMMENT ON FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid,
+                                                integer, integer[], text[], integer[])
+    IS 'hash partition query results and push partitions to merge task nodes';
+
+RESET search_path;
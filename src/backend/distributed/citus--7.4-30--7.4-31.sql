@@ -0,0 +1,12 @@
+/* citus--7.4-30--7.4-31 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_cached_partition_table(bigint, integer, text, text)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_cached_partition_table$$;
+COMMENT ON FUNCTION worker_cached_partition_table(bigint, integer, text, text)
+    IS 'partition query results, or reuse the cached partitions of the same query';
+
+RESET search_path;
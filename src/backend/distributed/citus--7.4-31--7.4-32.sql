@@ -0,0 +1,12 @@
+/* citus--7.4-31--7.4-32 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION master_update_column_statistics(table_name regclass)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_update_column_statistics$$;
+COMMENT ON FUNCTION master_update_column_statistics(table_name regclass)
+    IS 'merge the column statistics of the shards into the coordinator''s catalog';
+
+RESET search_path;
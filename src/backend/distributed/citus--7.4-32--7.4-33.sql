@@ -0,0 +1,16 @@
+/* citus--7.4-32--7.4-33 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_tenant_admission_stats(OUT colocation_id int, OUT shard_index bigint,
+											 OUT active_queries int, OUT waiting_queries int,
+											 OUT admitted_queries bigint)
+	RETURNS SETOF RECORD
+	LANGUAGE C STRICT
+	AS 'MODULE_PATHNAME', $$citus_tenant_admission_stats$$;
+COMMENT ON FUNCTION citus_tenant_admission_stats(OUT colocation_id int, OUT shard_index bigint,
+												 OUT active_queries int, OUT waiting_queries int,
+												 OUT admitted_queries bigint)
+	IS 'returns the running, waiting and admitted queries of each tenant under the tenant limits';
+
+RESET search_path;
@@ -0,0 +1,19 @@
+/* citus--7.4-33--7.4-34 */
+
+CREATE TABLE citus.pg_dist_metadata_prewarm(
+    logicalrelid regclass NOT NULL PRIMARY KEY,
+    lastusedtime timestamptz NOT NULL
+);
+ALTER TABLE citus.pg_dist_metadata_prewarm SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.pg_dist_metadata_prewarm TO public;
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_prewarm_metadata_cache()
+	RETURNS int
+	LANGUAGE C STRICT
+	AS 'MODULE_PATHNAME', $$citus_prewarm_metadata_cache$$;
+COMMENT ON FUNCTION citus_prewarm_metadata_cache()
+	IS 'loads the metadata of the recently used distributed tables into the shared metadata cache';
+
+RESET search_path;
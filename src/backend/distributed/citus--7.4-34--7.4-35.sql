@@ -0,0 +1,83 @@
+/* citus--7.4-34--7.4-35 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_tenant_admission_waits(OUT waiting_pid int, OUT blocking_pid int,
+											 OUT colocation_id int, OUT shard_index bigint)
+	RETURNS SETOF RECORD
+	LANGUAGE C STRICT
+	AS 'MODULE_PATHNAME', $$citus_tenant_admission_waits$$;
+COMMENT ON FUNCTION citus_tenant_admission_waits(OUT waiting_pid int, OUT blocking_pid int,
+												 OUT colocation_id int, OUT shard_index bigint)
+	IS 'returns the backends that wait for admission to a tenant, and the backends holding its admissions';
+
+RESET search_path;
+
+-- waits for tenant admission are not lock waits, but block the session as well
+CREATE OR REPLACE FUNCTION pg_catalog.citus_blocking_pids(pBlockedPid integer)
+RETURNS int4[] AS $$
+  DECLARE
+    mLocalBlockingPids int4[];
+    mRemoteBlockingPids int4[];
+    mLocalTransactionNum int8;
+  BEGIN
+    SELECT pg_catalog.old_pg_blocking_pids(pBlockedPid) INTO mLocalBlockingPids;
+
+    IF (array_length(mLocalBlockingPids, 1) > 0) THEN
+      RETURN mLocalBlockingPids;
+    END IF;
+
+    -- pg says we're not blocked locally; check whether we're blocked globally.
+    SELECT transaction_number INTO mLocalTransactionNum
+      FROM get_all_active_transactions() WHERE process_id = pBlockedPid;
+
+    SELECT array_agg(process_id) INTO mRemoteBlockingPids FROM (
+      WITH activeTransactions AS (
+        SELECT process_id, transaction_number FROM get_all_active_transactions()
+      ), blockingTransactions AS (
+        SELECT blocking_transaction_num AS txn_num FROM dump_global_wait_edges()
+        WHERE waiting_transaction_num = mLocalTransactionNum
+      )
+      SELECT activeTransactions.process_id FROM activeTransactions, blockingTransactions
+      WHERE activeTransactions.transaction_number = blockingTransactions.txn_num
+    ) AS sub;
+
+    IF (array_length(mRemoteBlockingPids, 1) > 0) THEN
+      RETURN mRemoteBlockingPids;
+    END IF;
+
+    -- check whether we're waiting for admission to a tenant
+    SELECT array_agg(blocking_pid) INTO mRemoteBlockingPids
+      FROM pg_catalog.citus_tenant_admission_waits() WHERE waiting_pid = pBlockedPid;
+
+    RETURN mRemoteBlockingPids;
+  END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION pg_catalog.citus_isolation_test_session_is_blocked(pBlockedPid integer, pInterestingPids integer[])
+RETURNS boolean AS $$
+  DECLARE
+    mBlockedTransactionNum int8;
+  BEGIN
+    IF pg_catalog.old_pg_isolation_test_session_is_blocked(pBlockedPid, pInterestingPids) THEN
+      RETURN true;
+    END IF;
+
+    -- waits for tenant admission are not lock waits, check them separately
+    IF EXISTS (
+      SELECT 1 FROM pg_catalog.citus_tenant_admission_waits()
+        WHERE waiting_pid = pBlockedPid AND blocking_pid = ANY(pInterestingPids)
+    ) THEN
+      RETURN true;
+    END IF;
+
+    -- pg says we're not blocked locally; check whether we're blocked globally.
+    SELECT transaction_number INTO mBlockedTransactionNum
+      FROM get_all_active_transactions() WHERE process_id = pBlockedPid;
+
+    RETURN EXISTS (
+      SELECT 1 FROM dump_global_wait_edges()
+        WHERE waiting_transaction_num = mBlockedTransactionNum
+    );
+  END;
+$$ LANGUAGE plpgsql;
@@ -0,0 +1,12 @@
+/* citus--7.4-4--7.4-5 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_read_merge_files(job_id bigint, task_id integer)
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE
+    AS 'MODULE_PATHNAME', $$worker_read_merge_files$$;
+COMMENT ON FUNCTION worker_read_merge_files(bigint, integer)
+    IS 'read the files fetched for a merge task as a set of records';
+
+RESET search_path;
@@ -0,0 +1,50 @@
+/* citus--7.4-5--7.4-6 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_partial_agg_sfunc(internal, oid, anyelement)
+    RETURNS internal
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$worker_partial_agg_sfunc$$;
+COMMENT ON FUNCTION worker_partial_agg_sfunc(internal, oid, anyelement)
+    IS 'transition function for worker_partial_agg';
+
+CREATE FUNCTION worker_partial_agg_ffunc(internal)
+    RETURNS text
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$worker_partial_agg_ffunc$$;
+COMMENT ON FUNCTION worker_partial_agg_ffunc(internal)
+    IS 'finalizer for worker_partial_agg';
+
+CREATE AGGREGATE worker_partial_agg(oid, anyelement) (
+    STYPE = internal,
+    SFUNC = worker_partial_agg_sfunc,
+    FINALFUNC = worker_partial_agg_ffunc
+);
+COMMENT ON AGGREGATE worker_partial_agg(oid, anyelement)
+    IS 'compute the transition state of an aggregate as text';
+
+CREATE FUNCTION coord_combine_agg_sfunc(internal, oid, text, anyelement)
+    RETURNS internal
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$coord_combine_agg_sfunc$$;
+COMMENT ON FUNCTION coord_combine_agg_sfunc(internal, oid, text, anyelement)
+    IS 'transition function for coord_combine_agg';
+
+CREATE FUNCTION coord_combine_agg_ffunc(internal, oid, text, anyelement)
+    RETURNS anyelement
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$coord_combine_agg_ffunc$$;
+COMMENT ON FUNCTION coord_combine_agg_ffunc(internal, oid, text, anyelement)
+    IS 'finalizer for coord_combine_agg';
+
+CREATE AGGREGATE coord_combine_agg(oid, text, anyelement) (
+    STYPE = internal,
+    SFUNC = coord_combine_agg_sfunc,
+    FINALFUNC = coord_combine_agg_ffunc,
+    FINALFUNC_EXTRA
+);
+COMMENT ON AGGREGATE coord_combine_agg(oid, text, anyelement)
+    IS 'combine aggregate transition states computed by worker_partial_agg';
+
+RESET search_path;
@@ -0,0 +1,17 @@
+/* citus--7.4-6--7.4-7 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid, integer,
+                                            integer[], text[], integer[], integer,
+                                            bigint, integer[], text[], integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_hash_partition_table$$;
+COMMENT ON FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid,
+                                                integer, integer[], text[], integer[],
+                                                integer, bigint, integer[], text[],
+                                                integer[])
+    IS 'hash partition query results and build or probe join key bloom filters';
+
+RESET search_path;
@@ -0,0 +1,23 @@
+/* citus--7.4-7--7.4-8 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_partition_query_result(result_prefix text, query text,
+                                              partition_column_index integer,
+                                              split_points integer[],
+                                              binary_format boolean)
+    RETURNS bigint
+    LANGUAGE C STRICT VOLATILE
+    AS 'MODULE_PATHNAME', $$worker_partition_query_result$$;
+COMMENT ON FUNCTION worker_partition_query_result(text, text, integer, integer[], boolean)
+    IS 'execute a query and write its results to a local result file for each hash range';
+
+CREATE FUNCTION fetch_intermediate_results(result_ids text[], node_name text,
+                                           node_port integer)
+    RETURNS bigint
+    LANGUAGE C STRICT VOLATILE
+    AS 'MODULE_PATHNAME', $$fetch_intermediate_results$$;
+COMMENT ON FUNCTION fetch_intermediate_results(text[], text, integer)
+    IS 'fetch intermediate result files from the given node';
+
+RESET search_path;
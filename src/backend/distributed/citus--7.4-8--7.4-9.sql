@@ -0,0 +1,36 @@
+/* citus--7.4-8--7.4-9 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_copy_progress(OUT pid integer, OUT shardid bigint,
+                                    OUT rows_sent bigint, OUT bytes_sent bigint,
+                                    OUT buffered_bytes bigint,
+                                    OUT back_pressure_count bigint)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_copy_progress$$;
+COMMENT ON FUNCTION citus_copy_progress()
+    IS 'returns the rows and bytes that ongoing COPY commands sent to each shard';
+
+CREATE VIEW citus_stat_copy_progress AS
+SELECT progress.pid,
+       shard.logicalrelid AS table_name,
+       progress.shardid,
+       placement.nodename,
+       placement.nodeport,
+       progress.rows_sent,
+       progress.bytes_sent,
+       progress.buffered_bytes,
+       progress.back_pressure_count,
+       round((progress.rows_sent /
+              nullif(extract(epoch FROM now() - activity.query_start), 0))::numeric,
+             1) AS rows_per_second
+FROM citus_copy_progress() progress
+     JOIN pg_dist_shard shard ON (progress.shardid = shard.shardid)
+     LEFT JOIN pg_dist_shard_placement placement ON (
+       progress.shardid = placement.shardid AND placement.shardstate = 1)
+     LEFT JOIN pg_stat_activity activity ON (progress.pid = activity.pid);
+
+GRANT SELECT ON citus_stat_copy_progress TO public;
+
+RESET search_path;
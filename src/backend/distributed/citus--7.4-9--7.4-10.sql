@@ -0,0 +1,37 @@
+/* citus--7.4-9--7.4-10 */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION get_rebalance_table_shards_plan(
+	relation regclass default NULL,
+	threshold float4 default 0.1,
+	max_shard_moves int default 1000000,
+	excluded_shard_list bigint[] default '{}')
+RETURNS TABLE (table_name regclass,
+			   shardid bigint,
+			   shard_size bigint,
+			   sourcename text,
+			   sourceport int,
+			   targetname text,
+			   targetport int)
+LANGUAGE C VOLATILE
+AS 'MODULE_PATHNAME', $$get_rebalance_table_shards_plan$$;
+
+COMMENT ON FUNCTION get_rebalance_table_shards_plan(regclass, float4, int, bigint[])
+	IS 'returns the shard moves that rebalance_table_shards would execute';
+
+CREATE FUNCTION rebalance_table_shards(
+	relation regclass default NULL,
+	threshold float4 default 0.1,
+	max_shard_moves int default 1000000,
+	excluded_shard_list bigint[] default '{}',
+	shard_transfer_mode citus.shard_transfer_mode default 'auto')
+RETURNS void
+LANGUAGE C VOLATILE
+AS 'MODULE_PATHNAME', $$rebalance_table_shards$$;
+
+COMMENT ON FUNCTION rebalance_table_shards(regclass, float4, int, bigint[],
+										   citus.shard_transfer_mode)
+	IS 'moves shards to balance their size and query load across the workers';
+
+RESET search_path;
@@ -0,0 +1,253 @@
+/*-------------------------------------------------------------------------
+ *
+ * create_distributed_function.c
+ *	  Routines for marking functions as distributed by one of their arguments,
+ *	  such that calls of the function are delegated to the node that has the
+ *	  shard of the argument value.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_proc.h"
+#include "distributed/colocation_utils.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/pg_dist_function.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/worker_manager.h"
+#include "fmgr.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+
+
+static int FunctionDistributionArgIndex(Oid functionId, char *distributionArgName,
+										Oid *distributionArgType);
+static void DeleteDistFunctionRow(Relation pgDistFunction, Oid functionId);
+
+
+PG_FUNCTION_INFO_V1(create_distributed_function);
+
+
+/*
+ * create_distributed_function records in pg_dist_function that calls of the
+ * given function are to be delegated to the node that has the shard of the
+ * value of the given argument in the shards of the given table. The function
+ * must exist on all nodes, and the nodes need the metadata of the table to run
+ * the queries in the function locally. If the function was distributed before,
+ * its metadata is replaced.
+ */
+Datum
+create_distributed_function(PG_FUNCTION_ARGS)
+{
+	Oid functionId = PG_GETARG_OID(0);
+	char *distributionArgName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	Oid colocatedTableId = PG_GETARG_OID(2);
+	int distributionArgIndex = 0;
+	Oid distributionArgType = InvalidOid;
+	Var *distributionColumn = NULL;
+	uint32 colocationId = INVALID_COLOCATION_ID;
+	Relation pgDistFunction = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_pg_dist_function];
+	bool isNulls[Natts_pg_dist_function];
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+
+	if (!pg_proc_ownercheck(functionId, GetUserId()))
+	{
+		aclcheck_error(ACLCHECK_NOT_OWNER, ACL_KIND_PROC, get_func_name(functionId));
+	}
+
+	if (!IsDistributedTable(colocatedTableId) ||
+		PartitionMethod(colocatedTableId) != DISTRIBUTE_BY_HASH)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("cannot colocate function \"%s\" with table \"%s\"",
+							   get_func_name(functionId),
+							   get_rel_name(colocatedTableId)),
+						errdetail("Functions can only be colocated with hash "
+								  "distributed tables.")));
+	}
+
+	distributionArgIndex = FunctionDistributionArgIndex(functionId,
+														 distributionArgName,
+														 &distributionArgType);
+	distributionColumn = DistPartitionKey(colocatedTableId);
+
+	if (distributionArgType != distributionColumn->vartype)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+						errmsg("cannot colocate function \"%s\" with table \"%s\"",
+							   get_func_name(functionId),
+							   get_rel_name(colocatedTableId)),
+						errdetail("The type of argument \"%s\" is %s, while the "
+								  "distribution column is of type %s.",
+								  distributionArgName,
+								  format_type_be(distributionArgType),
+								  format_type_be(distributionColumn->vartype))));
+	}
+
+	colocationId = TableColocationId(colocatedTableId);
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_pg_dist_function_funcid - 1] = ObjectIdGetDatum(functionId);
+	values[Anum_pg_dist_function_distribution_argument_index - 1] =
+		Int32GetDatum(distributionArgIndex);
+	values[Anum_pg_dist_function_colocationid - 1] = UInt32GetDatum(colocationId);
+
+	pgDistFunction = heap_open(DistFunctionRelationId(), RowExclusiveLock);
+
+	DeleteDistFunctionRow(pgDistFunction, functionId);
+
+	tupleDescriptor = RelationGetDescr(pgDistFunction);
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	CatalogTupleInsert(pgDistFunction, heapTuple);
+
+	/* calls of the function are planned differently from now on */
+	CitusInvalidateRelcacheByRelid(DistFunctionRelationId());
+
+	CommandCounterIncrement();
+	heap_close(pgDistFunction, NoLock);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * FunctionDistributionArgIndex returns the zero-based position among the input
+ * arguments of the argument of the function with the given name, which can
+ * also be given as $n for the n-th argument, and sets its type.
+ */
+static int
+FunctionDistributionArgIndex(Oid functionId, char *distributionArgName,
+							 Oid *distributionArgType)
+{
+	HeapTuple procedureTuple = NULL;
+	Oid *argumentTypes = NULL;
+	char **argumentNames = NULL;
+	char *argumentModes = NULL;
+	int argumentCount = 0;
+	int argumentIndex = 0;
+	int distributionArgIndex = -1;
+
+	procedureTuple = SearchSysCache1(PROCOID, ObjectIdGetDatum(functionId));
+	if (!HeapTupleIsValid(procedureTuple))
+	{
+		elog(ERROR, "cache lookup failed for function %u", functionId);
+	}
+
+	argumentCount = get_func_arg_info(procedureTuple, &argumentTypes, &argumentNames,
+									  &argumentModes);
+
+	ReleaseSysCache(procedureTuple);
+
+	if (distributionArgName[0] == '$')
+	{
+		int argumentNumber = pg_atoi(distributionArgName + 1, sizeof(int32), 0);
+
+		if (argumentNumber >= 1 && argumentNumber <= argumentCount)
+		{
+			distributionArgIndex = argumentNumber - 1;
+		}
+	}
+	else if (argumentNames != NULL)
+	{
+		for (argumentIndex = 0; argumentIndex < argumentCount; argumentIndex++)
+		{
+			if (argumentNames[argumentIndex] != NULL &&
+				strcmp(argumentNames[argumentIndex], distributionArgName) == 0)
+			{
+				distributionArgIndex = argumentIndex;
+				break;
+			}
+		}
+	}
+
+	if (distributionArgIndex < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_PARAMETER),
+						errmsg("function \"%s\" has no argument \"%s\"",
+							   get_func_name(functionId), distributionArgName)));
+	}
+
+	if (argumentModes != NULL && argumentModes[distributionArgIndex] != PROARGMODE_IN &&
+		argumentModes[distributionArgIndex] != PROARGMODE_INOUT)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("distribution argument \"%s\" of function \"%s\" is "
+							   "not an input argument", distributionArgName,
+							   get_func_name(functionId))));
+	}
+
+	*distributionArgType = argumentTypes[distributionArgIndex];
+
+	/*
+	 * Calls only pass the input arguments, so the index among the arguments
+	 * of a call does not count preceding output arguments.
+	 */
+	if (argumentModes != NULL)
+	{
+		int inputArgIndex = 0;
+
+		for (argumentIndex = 0; argumentIndex < distributionArgIndex; argumentIndex++)
+		{
+			if (argumentModes[argumentIndex] == PROARGMODE_IN ||
+				argumentModes[argumentIndex] == PROARGMODE_INOUT ||
+				argumentModes[argumentIndex] == PROARGMODE_VARIADIC)
+			{
+				inputArgIndex++;
+			}
+		}
+
+		distributionArgIndex = inputArgIndex;
+	}
+
+	return distributionArgIndex;
+}
+
+
+/*
+ * DeleteDistFunctionRow removes the pg_dist_function row of the given function,
+ * if there is one.
+ */
+static void
+DeleteDistFunctionRow(Relation pgDistFunction, Oid functionId)
+{
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_function_funcid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(functionId));
+
+	scanDescriptor = systable_beginscan(pgDistFunction, DistFunctionFuncidIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(pgDistFunction, &heapTuple->t_self);
+	}
+
+	systable_endscan(scanDescriptor);
+}
@@ -40,6 +40,7 @@
 #include "distributed/multi_logical_planner.h"
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_utility.h"
+#include "distributed/parallel_local_copy.h"
 #include "distributed/pg_dist_colocation.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/reference_table_utils.h"
@@ -74,7 +75,8 @@ int ReplicationModel = REPLICATION_MODEL_COORDINATOR;
 /* local function forward declarations */
 static char AppropriateReplicationModel(char distributionMethod, bool viaDeprecatedAPI);
 static void CreateHashDistributedTableShards(Oid relationId, Oid colocatedTableId,
-											 bool localTableEmpty);
+											 bool localTableEmpty,
+											 bool deferIndexCreation);
 static uint32 ColocationIdForNewTable(Oid relationId, Var *distributionColumn,
 									  char distributionMethod, char replicationModel,
 									  char *colocateWithTableName, bool viaDeprecatedAPI);
@@ -313,6 +315,7 @@ CreateDistributedTable(Oid relationId, Var *distributionColumn, char distributio
 	uint32 colocationId = INVALID_COLOCATION_ID;
 	Oid colocatedTableId = InvalidOid;
 	bool localTableEmpty = false;
+	bool deferIndexCreation = false;
 
 	Relation colocatedRelation = NULL;
 
@@ -333,6 +336,17 @@ CreateDistributedTable(Oid relationId, Var *distributionColumn, char distributio
 	localTableEmpty = LocalTableEmpty(relationId);
 	colocatedTableId = ColocatedTableId(colocationId);
 
+	/*
+	 * If we copy existing rows into the shards, we create the indexes of the
+	 * shards after the copy. Partitions are created along with the indexes of
+	 * the parent, so we leave partitioning hierarchies alone.
+	 */
+	if (!localTableEmpty && RegularTable(relationId) &&
+		!PartitionedTable(relationId) && !PartitionTable(relationId))
+	{
+		deferIndexCreation = true;
+	}
+
 	/* create an entry for distributed table in pg_dist_partition */
 	InsertIntoPgDistPartition(relationId, distributionMethod, distributionColumn,
 							  colocationId, replicationModel);
@@ -362,11 +376,12 @@ CreateDistributedTable(Oid relationId, Var *distributionColumn, char distributio
 	/* create shards for hash distributed and reference tables */
 	if (distributionMethod == DISTRIBUTE_BY_HASH)
 	{
-		CreateHashDistributedTableShards(relationId, colocatedTableId, localTableEmpty);
+		CreateHashDistributedTableShards(relationId, colocatedTableId, localTableEmpty,
+										 deferIndexCreation);
 	}
 	else if (distributionMethod == DISTRIBUTE_BY_NONE)
 	{
-		CreateReferenceTableShard(relationId);
+		CreateReferenceTableShard(relationId, deferIndexCreation);
 	}
 
 
@@ -398,6 +413,11 @@ CreateDistributedTable(Oid relationId, Var *distributionColumn, char distributio
 		{
 			CopyLocalDataIntoShards(relationId);
 		}
+
+		if (deferIndexCreation)
+		{
+			CreateShardIndexesOnWorkers(relationId);
+		}
 	}
 
 	if (colocatedRelation != NULL)
@@ -460,7 +480,7 @@ AppropriateReplicationModel(char distributionMethod, bool viaDeprecatedAPI)
  */
 static void
 CreateHashDistributedTableShards(Oid relationId, Oid colocatedTableId,
-								 bool localTableEmpty)
+								 bool localTableEmpty, bool deferIndexCreation)
 {
 	bool useExclusiveConnection = false;
 
@@ -479,7 +499,8 @@ CreateHashDistributedTableShards(Oid relationId, Oid colocatedTableId,
 
 	if (colocatedTableId != InvalidOid)
 	{
-		CreateColocatedShards(relationId, colocatedTableId, useExclusiveConnection);
+		CreateColocatedShards(relationId, colocatedTableId, useExclusiveConnection,
+							  deferIndexCreation);
 	}
 	else
 	{
@@ -490,7 +511,7 @@ CreateHashDistributedTableShards(Oid relationId, Oid colocatedTableId,
 		 * here.
 		 */
 		CreateShardsWithRoundRobinPolicy(relationId, ShardCount, ShardReplicationFactor,
-										 useExclusiveConnection);
+										 useExclusiveConnection, deferIndexCreation);
 	}
 }
 
@@ -1154,12 +1175,16 @@ RegularTable(Oid relationId)
  * continue to read from the local table until the current transaction commits,
  * after which new SELECTs will be handled as distributed queries.
  *
+ * When citus.parallel_local_copy_workers is set, parallel workers read and
+ * serialize the rows instead, and we only pass them on to the shards.
+ *
  * After copying local data into the distributed table, the local data remains
  * in place and should be truncated at a later time.
  */
 static void
 CopyLocalDataIntoShards(Oid distributedRelationId)
 {
+	CitusCopyDestReceiver *citusCopyDest = NULL;
 	DestReceiver *copyDest = NULL;
 	List *columnNameList = NIL;
 	Relation distributedRelation = NULL;
@@ -1175,6 +1200,7 @@ CopyLocalDataIntoShards(Oid distributedRelationId)
 	MemoryContext oldContext = NULL;
 	TupleTableSlot *slot = NULL;
 	uint64 rowsCopied = 0;
+	bool copiedInParallel = false;
 
 	/* take an ExclusiveLock to block all operations except SELECT */
 	distributedRelation = heap_open(distributedRelationId, ExclusiveLock);
@@ -1218,21 +1244,30 @@ CopyLocalDataIntoShards(Oid distributedRelationId)
 	econtext = GetPerTupleExprContext(estate);
 	econtext->ecxt_scantuple = slot;
 
-	copyDest =
-		(DestReceiver *) CreateCitusCopyDestReceiver(distributedRelationId,
-													 columnNameList,
-													 partitionColumnIndex,
-													 estate, stopOnFailure);
+	citusCopyDest = CreateCitusCopyDestReceiver(distributedRelationId, columnNameList,
+												partitionColumnIndex, estate,
+												stopOnFailure);
+	copyDest = (DestReceiver *) citusCopyDest;
+
+	/* rows serialized by parallel workers cannot be inserted into local shards */
+	citusCopyDest->serializedRowInput = (ParallelLocalCopyWorkers > 0);
 
 	/* initialise state for writing to shards, we'll open connections on demand */
 	copyDest->rStartup(copyDest, 0, tupleDescriptor);
 
+	if (citusCopyDest->serializedRowInput)
+	{
+		copiedInParallel = ParallelCopyLocalDataIntoShards(distributedRelation,
+														   citusCopyDest, &rowsCopied);
+	}
+
 	/* begin reading from local table */
 	scan = heap_beginscan(distributedRelation, GetActiveSnapshot(), 0, NULL);
 
 	oldContext = MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
 
-	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	while (!copiedInParallel &&
+		   (tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
 	{
 		/* materialize tuple and send it to a shard */
 		ExecStoreTuple(tuple, slot, InvalidBuffer, false);
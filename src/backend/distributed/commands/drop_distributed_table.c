@@ -14,6 +14,9 @@
 #include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_sync.h"
+#include "distributed/rollup_tables.h"
+#include "distributed/shard_retention.h"
+#include "distributed/shard_zone_maps.h"
 #include "distributed/worker_transaction.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
@@ -44,6 +47,9 @@ master_drop_distributed_table_metadata(PG_FUNCTION_ARGS)
 	CheckTableSchemaNameForDrop(relationId, &schemaName, &tableName);
 
 	DeletePartitionRow(relationId);
+	DeleteShardZoneMapRows(relationId);
+	DeleteRetentionPolicy(relationId);
+	DeleteRollups(relationId);
 
 	shouldSyncMetadata = ShouldSyncTableMetadata(relationId);
 	if (shouldSyncMetadata)
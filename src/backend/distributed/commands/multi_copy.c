@@ -45,6 +45,7 @@
  */
 
 #include "postgres.h"
+#include "funcapi.h"
 #include "libpq-fe.h"
 #include "miscadmin.h"
 
@@ -52,23 +53,31 @@
 #include <netinet/in.h> /* for htons */
 #include <string.h>
 
+#include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/htup.h"
 #include "access/sdir.h"
+#include "access/xact.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_index.h"
 #include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
+#include "distributed/local_executor.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_copy.h"
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/multi_progress.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/placement_connection.h"
+#include "distributed/relay_utility.h"
 #include "distributed/remote_commands.h"
 #include "distributed/resource_lock.h"
+#include "distributed/result_cache.h"
 #include "distributed/shard_pruning.h"
+#include "distributed/shard_statistics.h"
 #include "distributed/version_compat.h"
 #include "executor/executor.h"
 #include "libpq/pqformat.h"
@@ -77,6 +86,7 @@
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
+#include "utils/relcache.h"
 #include "utils/syscache.h"
 #include "utils/memutils.h"
 
@@ -84,19 +94,55 @@
 /* constant used in binary protocol */
 static const char BinarySignature[11] = "PGCOPY\n\377\r\n\0";
 
+/*
+ * LocalShardCopy holds the state for copying rows into a shard placement on
+ * the local node, into which we insert directly instead of over a connection.
+ */
+typedef struct LocalShardCopy
+{
+	Relation shardRelation;
+	EState *executorState;
+	ResultRelInfo *resultRelInfo;
+	TupleTableSlot *tupleTableSlot;
+	BulkInsertState bulkInsertState;
+	CommandId commandId;
+
+	/* input column for each column of the shard, -1 for dropped columns */
+	int *inputColumnIndexes;
+} LocalShardCopy;
+
+/* size up to which we buffer rows of a shard before sending them as one message */
+#define COPY_DATA_BUFFER_SIZE (64 * 1024)
+
+/* with shared connections, size of a COPY batch and limit across all shards */
+#define SHARED_COPY_BATCH_SIZE (1024 * 1024)
+#define SHARED_COPY_BUFFER_LIMIT (16 * 1024 * 1024)
+
+/* Config variables managed via guc.c */
+bool EnableSharedCopyConnections = false; /* COPY shards over shared connections */
+bool EnableCopyPassthrough = false; /* pass unparsed COPY fields on to shards */
+bool TrackCopyProgress = false; /* show COPY progress in citus_stat_copy_progress */
+int AppendCopyShardCount = 1; /* number of append shards to fill at the same time */
+
 /* use a global connection to the master node in order to skip passing it around */
 static MultiConnection *masterConnection = NULL;
 
 
 /* Local functions forward declarations */
 static void CopyFromWorkerNode(CopyStmt *copyStatement, char *completionTag);
-static void CopyToExistingShards(CopyStmt *copyStatement, char *completionTag);
+static CopyConflictAction ExtractCopyConflictAction(CopyStmt *copyStatement);
+static void CopyToExistingShards(CopyStmt *copyStatement, char *completionTag,
+								 CopyConflictAction conflictAction);
+static void SetCopyConflictColumns(CitusCopyDestReceiver *copyDest, Relation relation,
+								   List *copiedColumnList);
+static bool ColumnNameListMember(List *columnNameList, char *columnName);
+static bool CanPassthroughCopyFields(CopyStmt *copyStatement, List *columnNameList);
 static void CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId);
 static char MasterPartitionMethod(RangeVar *relation);
 static void RemoveMasterOptions(CopyStmt *copyStatement);
 static void OpenCopyConnections(CopyStmt *copyStatement,
 								ShardConnections *shardConnections, bool stopOnFailure,
-								bool useBinaryCopyFormat);
+								bool useBinaryCopyFormat, bool copyToResult);
 
 static bool BinaryOutputFunctionDefined(Oid typeId);
 static List * MasterShardPlacementList(uint64 shardId);
@@ -107,13 +153,41 @@ static void SendCopyBinaryFooters(CopyOutState copyOutState, int64 shardId,
 								  List *connectionList);
 static StringInfo ConstructCopyStatement(CopyStmt *copyStatement, int64 shardId,
 										 bool useBinaryCopyFormat);
+static char * CopyUpsertResultId(int64 shardId);
+static StringInfo ConstructCopyUpsertCommand(CitusCopyDestReceiver *copyDest,
+											 int64 shardId);
+static void UpsertCopiedRows(CitusCopyDestReceiver *copyDest,
+							 List *shardConnectionsList);
 static void SendCopyDataToAll(StringInfo dataBuffer, int64 shardId, List *connectionList);
+static void FlushCopyDataBuffer(ShardConnections *shardConnections);
+static void CopyShardBatch(CitusCopyDestReceiver *copyDest,
+						   ShardConnections *shardConnections);
+static void CopyLargestShardBatches(CitusCopyDestReceiver *copyDest);
+static ShardConnections * CopyShardIntervalConnections(CitusCopyDestReceiver *copyDest,
+														ShardInterval *shardInterval);
+static ShardConnections * CopyShardConnections(CitusCopyDestReceiver *copyDest,
+											   Datum partitionColumnValue);
+static CopyShardProgress * NextCopyShardProgress(CitusCopyDestReceiver *copyDest,
+												 int64 shardId);
+static void UpdateCopyShardProgress(ShardConnections *shardConnections);
+static uint64 CopyBackPressureCount(List *connectionList);
+static void SendFullCopyDataBuffers(CitusCopyDestReceiver *copyDest,
+									ShardConnections *shardConnections,
+									int bufferedLength);
+static LocalShardCopy * StartLocalShardCopy(CitusCopyDestReceiver *copyDest,
+											int64 shardId);
+static int InputColumnIndex(CitusCopyDestReceiver *copyDest, char *columnName);
+static void InsertLocalShardRow(LocalShardCopy *localShardCopy, Datum *columnValues,
+								bool *columnNulls, CopyCoercionData *columnCoercionPaths);
+static void FinishLocalShardCopy(LocalShardCopy *localShardCopy);
 static void SendCopyDataToPlacement(StringInfo dataBuffer, int64 shardId,
 									MultiConnection *connection);
 static void ReportCopyError(MultiConnection *connection, PGresult *result);
 static uint32 AvailableColumnCount(TupleDesc tupleDescriptor);
 static int64 StartCopyToNewShard(ShardConnections *shardConnections,
 								 CopyStmt *copyStatement, bool useBinaryCopyFormat);
+static void FinishCopyToNewShard(ShardConnections *shardConnections,
+								 CopyOutState copyOutState);
 static int64 MasterCreateEmptyShard(char *relationName);
 static int64 CreateEmptyShard(char *relationName);
 static int64 RemoteCreateEmptyShard(char *relationName);
@@ -151,6 +225,7 @@ static void CitusCopyDestReceiverDestroy(DestReceiver *destReceiver);
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(citus_text_send_as_jsonb);
+PG_FUNCTION_INFO_V1(citus_copy_progress);
 
 
 /*
@@ -162,6 +237,7 @@ void
 CitusCopyFrom(CopyStmt *copyStatement, char *completionTag)
 {
 	bool isCopyFromWorker = false;
+	CopyConflictAction conflictAction = COPY_CONFLICT_ERROR;
 
 	BeginOrContinueCoordinatedTransaction();
 
@@ -186,10 +262,20 @@ CitusCopyFrom(CopyStmt *copyStatement, char *completionTag)
 		}
 	}
 
+	/* the on_conflict option is ours, PostgreSQL does not recognize it */
+	conflictAction = ExtractCopyConflictAction(copyStatement);
+
 	masterConnection = NULL; /* reset, might still be set after error */
 	isCopyFromWorker = IsCopyFromWorker(copyStatement);
 	if (isCopyFromWorker)
 	{
+		if (conflictAction != COPY_CONFLICT_ERROR)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("COPY with on_conflict is not supported for "
+								   "append-partitioned tables")));
+		}
+
 		CopyFromWorkerNode(copyStatement, completionTag);
 	}
 	else
@@ -200,10 +286,17 @@ CitusCopyFrom(CopyStmt *copyStatement, char *completionTag)
 		if (partitionMethod == DISTRIBUTE_BY_HASH || partitionMethod ==
 			DISTRIBUTE_BY_RANGE || partitionMethod == DISTRIBUTE_BY_NONE)
 		{
-			CopyToExistingShards(copyStatement, completionTag);
+			CopyToExistingShards(copyStatement, completionTag, conflictAction);
 		}
 		else if (partitionMethod == DISTRIBUTE_BY_APPEND)
 		{
+			if (conflictAction != COPY_CONFLICT_ERROR)
+			{
+				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+								errmsg("COPY with on_conflict is not supported for "
+									   "append-partitioned tables")));
+			}
+
 			CopyToNewShards(copyStatement, completionTag, relationId);
 		}
 		else
@@ -237,6 +330,54 @@ IsCopyFromWorker(CopyStmt *copyStatement)
 }
 
 
+/*
+ * ExtractCopyConflictAction removes the on_conflict option from the options of
+ * the COPY statement and returns the action it specifies. Rows are upserted
+ * when the option is set to update, and rows with an existing primary key are
+ * skipped when it is set to nothing.
+ */
+static CopyConflictAction
+ExtractCopyConflictAction(CopyStmt *copyStatement)
+{
+	CopyConflictAction conflictAction = COPY_CONFLICT_ERROR;
+	List *newOptionList = NIL;
+	ListCell *optionCell = NULL;
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+		char *actionName = NULL;
+
+		if (strncmp(option->defname, "on_conflict", NAMEDATALEN) != 0)
+		{
+			newOptionList = lappend(newOptionList, option);
+			continue;
+		}
+
+		actionName = defGetString(option);
+		if (pg_strcasecmp(actionName, "update") == 0)
+		{
+			conflictAction = COPY_CONFLICT_DO_UPDATE;
+		}
+		else if (pg_strcasecmp(actionName, "nothing") == 0)
+		{
+			conflictAction = COPY_CONFLICT_DO_NOTHING;
+		}
+		else
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("COPY on_conflict \"%s\" not recognized",
+								   actionName),
+							errhint("Valid actions are update and nothing.")));
+		}
+	}
+
+	copyStatement->options = newOptionList;
+
+	return conflictAction;
+}
+
+
 /*
  * CopyFromWorkerNode implements the COPY table_name FROM ... from worker nodes
  * for append-partitioned tables.
@@ -292,7 +433,8 @@ CopyFromWorkerNode(CopyStmt *copyStatement, char *completionTag)
  * rows.
  */
 static void
-CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
+CopyToExistingShards(CopyStmt *copyStatement, char *completionTag,
+					 CopyConflictAction conflictAction)
 {
 	Oid tableId = RangeVarGetRelid(copyStatement->relation, NoLock, false);
 
@@ -318,6 +460,7 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 
 	char partitionMethod = 0;
 	bool stopOnFailure = false;
+	bool passthroughFields = false;
 
 	CopyState copyState = NULL;
 	uint64 processedRowCount = 0;
@@ -368,9 +511,55 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 		stopOnFailure = true;
 	}
 
+	/*
+	 * When all columns are copied, we can pass the fields of each row on to the
+	 * shards without parsing them, except for the partition column. Workers
+	 * still parse and check the values when they apply the COPY. The remote
+	 * COPY then lists the columns in the order of the fields.
+	 */
+	passthroughFields = EnableCopyPassthrough &&
+						CanPassthroughCopyFields(copyStatement, columnNameList);
+	if (passthroughFields && copyStatement->attlist != NIL)
+	{
+		ListCell *attributeCell = NULL;
+
+		columnNameList = NIL;
+		foreach(attributeCell, copyStatement->attlist)
+		{
+			char *columnName = strVal(lfirst(attributeCell));
+
+			columnNameList = lappend(columnNameList, columnName);
+		}
+	}
+
 	/* set up the destination for the COPY */
 	copyDest = CreateCitusCopyDestReceiver(tableId, columnNameList, partitionColumnIndex,
 										   executorState, stopOnFailure);
+	copyDest->rawFieldInput = passthroughFields;
+
+	if (conflictAction != COPY_CONFLICT_ERROR)
+	{
+		List *copiedColumnList = columnNameList;
+
+		if (copyStatement->attlist != NIL)
+		{
+			ListCell *attributeCell = NULL;
+
+			copiedColumnList = NIL;
+			foreach(attributeCell, copyStatement->attlist)
+			{
+				copiedColumnList = lappend(copiedColumnList,
+										   strVal(lfirst(attributeCell)));
+			}
+		}
+
+		copyDest->conflictAction = conflictAction;
+		SetCopyConflictColumns(copyDest, distributedRelation, copiedColumnList);
+
+		/* upserts are applied to all placements, or fail */
+		copyDest->stopOnFailure = true;
+	}
+
 	dest = (DestReceiver *) copyDest;
 	dest->rStartup(dest, 0, tupleDescriptor);
 
@@ -437,6 +626,43 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 
 		oldContext = MemoryContextSwitchTo(executorTupleContext);
 
+		if (passthroughFields)
+		{
+			char **fieldArray = NULL;
+			int fieldCount = 0;
+			int expectedFieldCount = list_length(columnNameList);
+
+			/* split a row from the input into fields */
+			nextRowFound = NextCopyFromRawFields(copyState, &fieldArray, &fieldCount);
+			if (!nextRowFound)
+			{
+				MemoryContextSwitchTo(oldContext);
+				break;
+			}
+
+			if (fieldCount > expectedFieldCount)
+			{
+				ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+								errmsg("extra data after last expected column")));
+			}
+			else if (fieldCount < expectedFieldCount)
+			{
+				char *columnName = (char *) list_nth(columnNameList, fieldCount);
+
+				ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+								errmsg("missing data for column \"%s\"", columnName)));
+			}
+
+			CHECK_FOR_INTERRUPTS();
+
+			MemoryContextSwitchTo(oldContext);
+
+			CitusCopyDestReceiverReceiveRawFields(copyDest, fieldArray, fieldCount);
+
+			processedRowCount += 1;
+			continue;
+		}
+
 		/* parse a row from the input */
 		nextRowFound = NextCopyFrom(copyState, executorExpressionContext,
 									columnValues, columnNulls, NULL);
@@ -481,9 +707,170 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 }
 
 
+/*
+ * SetCopyConflictColumns sets the primary key columns of the relation as the
+ * columns that identify conflicting rows in an upserting COPY, and the other
+ * copied columns as the columns that are updated on conflict. The primary key
+ * columns themselves need to be copied, since rows are matched on them.
+ */
+static void
+SetCopyConflictColumns(CitusCopyDestReceiver *copyDest, Relation relation,
+					   List *copiedColumnList)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	Oid primaryKeyIndexId = InvalidOid;
+	HeapTuple indexTuple = NULL;
+	Form_pg_index indexForm = NULL;
+	List *conflictColumnList = NIL;
+	List *updateColumnList = NIL;
+	ListCell *columnNameCell = NULL;
+	int keyIndex = 0;
+
+	/* rd_pkindex is only set once the index list of the relation is built */
+	list_free(RelationGetIndexList(relation));
+
+	primaryKeyIndexId = relation->rd_pkindex;
+	if (!OidIsValid(primaryKeyIndexId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("COPY with on_conflict requires a primary key on "
+							   "table \"%s\"", RelationGetRelationName(relation))));
+	}
+
+	indexTuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(primaryKeyIndexId));
+	if (!HeapTupleIsValid(indexTuple))
+	{
+		elog(ERROR, "cache lookup failed for index %u", primaryKeyIndexId);
+	}
+
+	indexForm = (Form_pg_index) GETSTRUCT(indexTuple);
+	for (keyIndex = 0; keyIndex < indexForm->indnatts; keyIndex++)
+	{
+		AttrNumber attributeNumber = indexForm->indkey.values[keyIndex];
+		Form_pg_attribute keyColumn = TupleDescAttr(tupleDescriptor,
+													attributeNumber - 1);
+		char *columnName = pstrdup(NameStr(keyColumn->attname));
+
+		if (!ColumnNameListMember(copiedColumnList, columnName))
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("COPY with on_conflict requires primary key "
+								   "column \"%s\" to be copied", columnName)));
+		}
+
+		conflictColumnList = lappend(conflictColumnList, columnName);
+	}
+
+	ReleaseSysCache(indexTuple);
+
+	foreach(columnNameCell, copiedColumnList)
+	{
+		char *columnName = (char *) lfirst(columnNameCell);
+
+		if (!ColumnNameListMember(conflictColumnList, columnName))
+		{
+			updateColumnList = lappend(updateColumnList, columnName);
+		}
+	}
+
+	copyDest->conflictColumnList = conflictColumnList;
+	copyDest->updateColumnList = updateColumnList;
+}
+
+
+/*
+ * ColumnNameListMember returns whether the given column name appears in the
+ * list of column names.
+ */
+static bool
+ColumnNameListMember(List *columnNameList, char *columnName)
+{
+	ListCell *columnNameCell = NULL;
+
+	foreach(columnNameCell, columnNameList)
+	{
+		if (strncmp((char *) lfirst(columnNameCell), columnName, NAMEDATALEN) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * CanPassthroughCopyFields returns whether the rows of the given COPY statement
+ * can be split into fields and passed on to the shards without parsing them.
+ * This requires all columns in columnNameList to be copied, in any order, in a
+ * text format, and no options that change the values of fields after splitting
+ * the rows. Columns that are not copied would get their defaults on the
+ * workers, so we parse such rows on the coordinator.
+ */
+static bool
+CanPassthroughCopyFields(CopyStmt *copyStatement, List *columnNameList)
+{
+	ListCell *optionCell = NULL;
+	ListCell *columnNameCell = NULL;
+
+	if (copyStatement->attlist != NIL)
+	{
+		if (list_length(copyStatement->attlist) != list_length(columnNameList))
+		{
+			return false;
+		}
+
+		/* with as many names as columns, no column is missing if none repeats */
+		foreach(columnNameCell, columnNameList)
+		{
+			char *columnName = (char *) lfirst(columnNameCell);
+			ListCell *attributeCell = NULL;
+			bool columnFound = false;
+
+			foreach(attributeCell, copyStatement->attlist)
+			{
+				if (strcmp(strVal(lfirst(attributeCell)), columnName) == 0)
+				{
+					columnFound = true;
+					break;
+				}
+			}
+
+			if (!columnFound)
+			{
+				return false;
+			}
+		}
+	}
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *defel = (DefElem *) lfirst(optionCell);
+
+		if (strncmp(defel->defname, "format", NAMEDATALEN) == 0 &&
+			strncmp(defGetString(defel), "binary", NAMEDATALEN) == 0)
+		{
+			return false;
+		}
+		else if (strncmp(defel->defname, "force_not_null", NAMEDATALEN) == 0 ||
+				 strncmp(defel->defname, "force_null", NAMEDATALEN) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * CopyToNewShards implements the COPY table_name FROM ... for append-partitioned
  * tables where we create new shards into which to copy rows.
+ *
+ * We fill citus.append_copy_shard_count shards at the same time. Rows are sent
+ * to them in blocks of COPY_DATA_BUFFER_SIZE bytes in turn, and since new shards
+ * are placed on the workers round-robin, the shards are usually filled on
+ * different workers in parallel.
  */
 static void
 CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
@@ -506,13 +893,16 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 
 	ErrorContextCallback errorCallback;
 
-	int64 currentShardId = INVALID_SHARD_ID;
 	uint64 shardMaxSizeInBytes = (int64) ShardMaxSize * 1024L;
-	uint64 copiedDataSizeInBytes = 0;
 	uint64 processedRowCount = 0;
 
-	ShardConnections *shardConnections =
-		(ShardConnections *) palloc0(sizeof(ShardConnections));
+	/* state of the shards that we currently copy into */
+	int shardCount = AppendCopyShardCount;
+	ShardConnections *shardConnectionsArray =
+		(ShardConnections *) palloc0(shardCount * sizeof(ShardConnections));
+	uint64 *copiedDataSizeArray = (uint64 *) palloc0(shardCount * sizeof(uint64));
+	int shardIndex = 0;
+	uint64 blockDataSizeInBytes = 0;
 
 	/* initialize copy state to read from COPY data source */
 #if (PG_VERSION_NUM >= 100000)
@@ -558,6 +948,7 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 		bool nextRowFound = false;
 		MemoryContext oldContext = NULL;
 		uint64 messageBufferSize = 0;
+		ShardConnections *shardConnections = &shardConnectionsArray[shardIndex];
 
 		ResetPerTupleExprContext(executorState);
 
@@ -585,20 +976,19 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 
 		/*
 		 * If copied data size is zero, this means either this is the first
-		 * line in the copy or we just filled the previous shard up to its
-		 * capacity. Either way, we need to create a new shard and
+		 * row for this shard slot or we just filled the previous shard in it
+		 * up to its capacity. Either way, we need to create a new shard and
 		 * start copying new rows into it.
 		 */
-		if (copiedDataSizeInBytes == 0)
+		if (copiedDataSizeArray[shardIndex] == 0)
 		{
 			/* create shard and open connections to shard placements */
-			currentShardId = StartCopyToNewShard(shardConnections, copyStatement,
-												 copyOutState->binary);
+			StartCopyToNewShard(shardConnections, copyStatement, copyOutState->binary);
 
 			/* send copy binary headers to shard placements */
 			if (copyOutState->binary)
 			{
-				SendCopyBinaryHeaders(copyOutState, currentShardId,
+				SendCopyBinaryHeaders(copyOutState, shardConnections->shardId,
 									  shardConnections->connectionList);
 			}
 		}
@@ -607,52 +997,42 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 		resetStringInfo(copyOutState->fe_msgbuf);
 		AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
 						  copyOutState, columnOutputFunctions, NULL);
-		SendCopyDataToAll(copyOutState->fe_msgbuf, currentShardId,
+		SendCopyDataToAll(copyOutState->fe_msgbuf, shardConnections->shardId,
 						  shardConnections->connectionList);
 
 		messageBufferSize = copyOutState->fe_msgbuf->len;
-		copiedDataSizeInBytes = copiedDataSizeInBytes + messageBufferSize;
+		copiedDataSizeArray[shardIndex] += messageBufferSize;
+		blockDataSizeInBytes += messageBufferSize;
 
-		/*
-		 * If we filled up this shard to its capacity, send copy binary footers
-		 * to shard placements, and update shard statistics.
-		 */
-		if (copiedDataSizeInBytes > shardMaxSizeInBytes)
+		/* if we filled up this shard to its capacity, finish the COPY into it */
+		if (copiedDataSizeArray[shardIndex] > shardMaxSizeInBytes)
 		{
-			Assert(currentShardId != INVALID_SHARD_ID);
-
-			if (copyOutState->binary)
-			{
-				SendCopyBinaryFooters(copyOutState, currentShardId,
-									  shardConnections->connectionList);
-			}
+			FinishCopyToNewShard(shardConnections, copyOutState);
 
-			EndRemoteCopy(currentShardId, shardConnections->connectionList, true);
-			MasterUpdateShardStatistics(shardConnections->shardId);
+			copiedDataSizeArray[shardIndex] = 0;
+		}
 
-			copiedDataSizeInBytes = 0;
-			currentShardId = INVALID_SHARD_ID;
+		/* move on to the next shard once we sent a block of rows to this one */
+		if (copiedDataSizeArray[shardIndex] == 0 ||
+			blockDataSizeInBytes >= COPY_DATA_BUFFER_SIZE)
+		{
+			shardIndex = (shardIndex + 1) % shardCount;
+			blockDataSizeInBytes = 0;
 		}
 
 		processedRowCount += 1;
 	}
 
 	/*
-	 * For the last shard, send copy binary footers to shard placements,
-	 * and update shard statistics. If no row is send, there is no shard
-	 * to finalize the copy command.
+	 * Finish the COPY into the shards that we were still filling. If no row
+	 * was sent in a slot, there is no shard to finalize for it.
 	 */
-	if (copiedDataSizeInBytes > 0)
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
 	{
-		Assert(currentShardId != INVALID_SHARD_ID);
-
-		if (copyOutState->binary)
+		if (copiedDataSizeArray[shardIndex] > 0)
 		{
-			SendCopyBinaryFooters(copyOutState, currentShardId,
-								  shardConnections->connectionList);
+			FinishCopyToNewShard(&shardConnectionsArray[shardIndex], copyOutState);
 		}
-		EndRemoteCopy(currentShardId, shardConnections->connectionList, true);
-		MasterUpdateShardStatistics(shardConnections->shardId);
 	}
 
 	EndCopyFrom(copyState);
@@ -787,11 +1167,12 @@ RemoveMasterOptions(CopyStmt *copyStatement)
  * OpenCopyConnections opens a connection for each placement of a shard and
  * starts a COPY transaction if necessary. If a connection cannot be opened,
  * then the shard placement is marked as inactive and the COPY continues with the remaining
- * shard placements.
+ * shard placements. If copyToResult is true, the rows are copied into an intermediate
+ * result on each placement rather than into the shard itself.
  */
 static void
 OpenCopyConnections(CopyStmt *copyStatement, ShardConnections *shardConnections,
-					bool stopOnFailure, bool useBinaryCopyFormat)
+					bool stopOnFailure, bool useBinaryCopyFormat, bool copyToResult)
 {
 	List *finalizedPlacementList = NIL;
 	int failedPlacementCount = 0;
@@ -825,8 +1206,10 @@ OpenCopyConnections(CopyStmt *copyStatement, ShardConnections *shardConnections,
 		/*
 		 * Make sure we use a separate connection per placement for hash-distributed
 		 * tables in order to allow multi-shard modifications in the same transaction.
+		 * When shards share connections, we COPY one shard at a time instead.
 		 */
-		if (placement->partitionMethod == DISTRIBUTE_BY_HASH)
+		if (placement->partitionMethod == DISTRIBUTE_BY_HASH &&
+			!EnableSharedCopyConnections)
 		{
 			connectionFlags |= CONNECTION_PER_PLACEMENT;
 		}
@@ -858,8 +1241,18 @@ OpenCopyConnections(CopyStmt *copyStatement, ShardConnections *shardConnections,
 		ClaimConnectionExclusively(connection);
 		RemoteTransactionBeginIfNecessary(connection);
 
-		copyCommand = ConstructCopyStatement(copyStatement, shardConnections->shardId,
-											 useBinaryCopyFormat);
+		if (copyToResult)
+		{
+			/* upserted rows are first copied into an intermediate result */
+			copyCommand = makeStringInfo();
+			appendStringInfo(copyCommand, "COPY %s FROM STDIN WITH (format result)",
+							 quote_identifier(CopyUpsertResultId(shardId)));
+		}
+		else
+		{
+			copyCommand = ConstructCopyStatement(copyStatement, shardId,
+												 useBinaryCopyFormat);
+		}
 
 		if (!SendRemoteCommand(connection, copyCommand->data))
 		{
@@ -1143,86 +1536,354 @@ ConstructCopyStatement(CopyStmt *copyStatement, int64 shardId, bool useBinaryCop
 
 
 /*
- * SendCopyDataToAll sends copy data to all connections in a list.
+ * CopyUpsertResultId returns the name of the intermediate result into which an
+ * upserting COPY copies the rows of the given shard.
  */
-static void
-SendCopyDataToAll(StringInfo dataBuffer, int64 shardId, List *connectionList)
+static char *
+CopyUpsertResultId(int64 shardId)
 {
-	ListCell *connectionCell = NULL;
-	foreach(connectionCell, connectionList)
-	{
-		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
-		SendCopyDataToPlacement(dataBuffer, shardId, connection);
-	}
-}
+	StringInfo resultId = makeStringInfo();
 
+	appendStringInfo(resultId, "citus_copy_upsert_" INT64_FORMAT, shardId);
 
-/*
- * SendCopyDataToPlacement sends serialized COPY data to a specific shard placement
- * over the given connection.
- */
-static void
-SendCopyDataToPlacement(StringInfo dataBuffer, int64 shardId, MultiConnection *connection)
-{
-	if (!PutRemoteCopyData(connection, dataBuffer->data, dataBuffer->len))
-	{
-		ereport(ERROR, (errcode(ERRCODE_IO_ERROR),
-						errmsg("failed to COPY to shard " INT64_FORMAT " on %s:%d",
-							   shardId, connection->hostname, connection->port),
-						errdetail("failed to send %d bytes %s", dataBuffer->len,
-								  dataBuffer->data)));
-	}
+	return resultId->data;
 }
 
 
 /*
- * EndRemoteCopy ends the COPY input on all connections, and unclaims connections.
- * If stopOnFailure is true, then EndRemoteCopy reports an error on failure,
- * otherwise it reports a warning or continues.
+ * ConstructCopyUpsertCommand constructs the command that inserts the rows from
+ * the intermediate result of the given shard into the shard, with the primary
+ * key as the ON CONFLICT target. When a key was copied more than once, only the
+ * last row with that key is inserted, as if the rows were upserted one by one.
  */
-void
-EndRemoteCopy(int64 shardId, List *connectionList, bool stopOnFailure)
+static StringInfo
+ConstructCopyUpsertCommand(CitusCopyDestReceiver *copyDest, int64 shardId)
 {
-	ListCell *connectionCell = NULL;
+	CopyStmt *copyStatement = copyDest->copyStatement;
+	Oid relationId = copyDest->distributedRelationId;
+	char *resultId = CopyUpsertResultId(shardId);
+	char *resultFormat = copyDest->copyOutState->binary ? "binary" : "text";
+	char *shardName = pstrdup(copyStatement->relation->relname);
+	char *shardQualifiedName = NULL;
+	StringInfo command = makeStringInfo();
+	StringInfo columnList = makeStringInfo();
+	StringInfo columnDefinitionList = makeStringInfo();
+	StringInfo keyList = makeStringInfo();
+	ListCell *columnNameCell = NULL;
 
-	foreach(connectionCell, connectionList)
+	AppendShardIdToName(&shardName, shardId);
+	shardQualifiedName = quote_qualified_identifier(copyStatement->relation->schemaname,
+													shardName);
+
+	foreach(columnNameCell, copyDest->columnNameList)
 	{
-		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
-		PGresult *result = NULL;
-		bool raiseInterrupts = true;
+		char *columnName = (char *) lfirst(columnNameCell);
+		AttrNumber attributeNumber = get_attnum(relationId, columnName);
+		Oid columnTypeId = get_atttype(relationId, attributeNumber);
 
-		/* end the COPY input */
-		if (!PutRemoteCopyEnd(connection, NULL))
+		if (columnList->len > 0)
 		{
-			if (!stopOnFailure)
-			{
-				continue;
-			}
+			appendStringInfoString(columnList, ", ");
+			appendStringInfoString(columnDefinitionList, ", ");
+		}
 
-			ereport(ERROR, (errcode(ERRCODE_IO_ERROR),
-							errmsg("failed to COPY to shard " INT64_FORMAT " on %s:%d",
-								   shardId, connection->hostname, connection->port)));
+		appendStringInfoString(columnList, quote_identifier(columnName));
+		appendStringInfo(columnDefinitionList, "%s %s", quote_identifier(columnName),
+						 format_type_be_qualified(columnTypeId));
+	}
 
-			continue;
-		}
+	foreach(columnNameCell, copyDest->conflictColumnList)
+	{
+		char *columnName = (char *) lfirst(columnNameCell);
 
-		/* check whether there were any COPY errors */
-		result = GetRemoteCommandResult(connection, raiseInterrupts);
-		if (PQresultStatus(result) != PGRES_COMMAND_OK && stopOnFailure)
+		if (keyList->len > 0)
 		{
-			ReportCopyError(connection, result);
+			appendStringInfoString(keyList, ", ");
 		}
 
-		PQclear(result);
-		ForgetResults(connection);
-		UnclaimConnection(connection);
+		appendStringInfoString(keyList, quote_identifier(columnName));
 	}
-}
 
+	appendStringInfo(command, "INSERT INTO %s AS citus_table_alias (%s) ",
+					 shardQualifiedName, columnList->data);
 
-/*
- * ReportCopyError tries to report a useful error message for the user from
- * the remote COPY error messages.
+	if (copyDest->conflictAction == COPY_CONFLICT_DO_NOTHING ||
+		copyDest->updateColumnList == NIL)
+	{
+		appendStringInfo(command,
+						 "SELECT %s FROM pg_catalog.read_intermediate_result(%s, %s) "
+						 "AS citus_copy_result (%s) ON CONFLICT (%s) DO NOTHING",
+						 columnList->data, quote_literal_cstr(resultId),
+						 quote_literal_cstr(resultFormat), columnDefinitionList->data,
+						 keyList->data);
+
+		return command;
+	}
+
+	/* keep the last row per key, since a row cannot be updated twice */
+	appendStringInfo(command,
+					 "SELECT DISTINCT ON (%s) %s "
+					 "FROM ROWS FROM (pg_catalog.read_intermediate_result(%s, %s) "
+					 "AS (%s)) WITH ORDINALITY AS citus_copy_result (%s, "
+					 "citus_row_number) ORDER BY %s, citus_row_number DESC "
+					 "ON CONFLICT (%s) DO UPDATE SET ",
+					 keyList->data, columnList->data, quote_literal_cstr(resultId),
+					 quote_literal_cstr(resultFormat), columnDefinitionList->data,
+					 columnList->data, keyList->data, keyList->data);
+
+	foreach(columnNameCell, copyDest->updateColumnList)
+	{
+		char *columnName = quote_identifier((char *) lfirst(columnNameCell));
+
+		if (columnNameCell != list_head(copyDest->updateColumnList))
+		{
+			appendStringInfoString(command, ", ");
+		}
+
+		appendStringInfo(command, "%s = EXCLUDED.%s", columnName, columnName);
+	}
+
+	return command;
+}
+
+
+/*
+ * UpsertCopiedRows inserts the rows that an upserting COPY copied into the
+ * intermediate results of the shards into the shards themselves. The upserts
+ * are sent to all placements before waiting for any of them, such that the
+ * shards are upserted in parallel.
+ */
+static void
+UpsertCopiedRows(CitusCopyDestReceiver *copyDest, List *shardConnectionsList)
+{
+	List *connectionList = NIL;
+	ListCell *shardConnectionsCell = NULL;
+	ListCell *connectionCell = NULL;
+
+	foreach(shardConnectionsCell, shardConnectionsList)
+	{
+		ShardConnections *shardConnections =
+			(ShardConnections *) lfirst(shardConnectionsCell);
+		StringInfo upsertCommand =
+			ConstructCopyUpsertCommand(copyDest, shardConnections->shardId);
+
+		foreach(connectionCell, shardConnections->connectionList)
+		{
+			MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+			if (!SendRemoteCommand(connection, upsertCommand->data))
+			{
+				ReportConnectionError(connection, ERROR);
+			}
+
+			ClaimConnectionExclusively(connection);
+			connectionList = lappend(connectionList, connection);
+		}
+	}
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		bool raiseInterrupts = true;
+		PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+
+		if (PQresultStatus(result) != PGRES_COMMAND_OK)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+		UnclaimConnection(connection);
+	}
+}
+
+
+/*
+ * SendCopyDataToAll sends copy data to all connections in a list.
+ */
+static void
+SendCopyDataToAll(StringInfo dataBuffer, int64 shardId, List *connectionList)
+{
+	ListCell *connectionCell = NULL;
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		SendCopyDataToPlacement(dataBuffer, shardId, connection);
+	}
+}
+
+
+/*
+ * FlushCopyDataBuffer sends the rows buffered for the given shard to all of its
+ * placements, and empties the buffer.
+ */
+static void
+FlushCopyDataBuffer(ShardConnections *shardConnections)
+{
+	StringInfo copyDataBuffer = shardConnections->copyDataBuffer;
+	List *connectionList = shardConnections->connectionList;
+	CopyShardProgress *copyProgress = shardConnections->copyProgress;
+	uint64 backPressureCount = 0;
+
+	if (copyDataBuffer == NULL || copyDataBuffer->len == 0)
+	{
+		return;
+	}
+
+	backPressureCount = CopyBackPressureCount(connectionList);
+
+	SendCopyDataToAll(copyDataBuffer, shardConnections->shardId, connectionList);
+
+	if (copyProgress != NULL)
+	{
+		copyProgress->bytesSent += copyDataBuffer->len;
+		copyProgress->backPressureCount +=
+			CopyBackPressureCount(connectionList) - backPressureCount;
+	}
+
+	resetStringInfo(copyDataBuffer);
+	UpdateCopyShardProgress(shardConnections);
+}
+
+
+/*
+ * CopyShardBatch sends the rows buffered for the given shard in a COPY command
+ * of their own. The placements' connections are shared with other shards; we
+ * release them once the COPY ends, so at most one COPY runs on each of them.
+ */
+static void
+CopyShardBatch(CitusCopyDestReceiver *copyDest, ShardConnections *shardConnections)
+{
+	CopyOutState copyOutState = copyDest->copyOutState;
+	int64 shardId = shardConnections->shardId;
+	int batchLength = shardConnections->copyDataBuffer->len;
+
+	if (batchLength == 0)
+	{
+		return;
+	}
+
+	OpenCopyConnections(copyDest->copyStatement, shardConnections,
+						copyDest->stopOnFailure, copyOutState->binary, false);
+
+	if (copyOutState->binary)
+	{
+		SendCopyBinaryHeaders(copyOutState, shardId, shardConnections->connectionList);
+	}
+
+	FlushCopyDataBuffer(shardConnections);
+
+	if (copyOutState->binary)
+	{
+		SendCopyBinaryFooters(copyOutState, shardId, shardConnections->connectionList);
+	}
+
+	EndRemoteCopy(shardId, shardConnections->connectionList, true);
+
+	shardConnections->connectionList = NIL;
+	copyDest->bufferedCopyDataBytes -= batchLength;
+}
+
+
+/*
+ * CopyLargestShardBatches sends the batches of the shards that buffer the most
+ * rows, until the rows buffered across all shards are within the limit.
+ */
+static void
+CopyLargestShardBatches(CitusCopyDestReceiver *copyDest)
+{
+	while (copyDest->bufferedCopyDataBytes > SHARED_COPY_BUFFER_LIMIT)
+	{
+		List *shardConnectionsList = ShardConnectionList(copyDest->shardConnectionHash);
+		ShardConnections *largestShardConnections = NULL;
+		ListCell *shardConnectionsCell = NULL;
+
+		foreach(shardConnectionsCell, shardConnectionsList)
+		{
+			ShardConnections *shardConnections =
+				(ShardConnections *) lfirst(shardConnectionsCell);
+
+			if (largestShardConnections == NULL ||
+				shardConnections->copyDataBuffer->len >
+				largestShardConnections->copyDataBuffer->len)
+			{
+				largestShardConnections = shardConnections;
+			}
+		}
+
+		CopyShardBatch(copyDest, largestShardConnections);
+		list_free(shardConnectionsList);
+	}
+}
+
+
+/*
+ * SendCopyDataToPlacement sends serialized COPY data to a specific shard placement
+ * over the given connection.
+ */
+static void
+SendCopyDataToPlacement(StringInfo dataBuffer, int64 shardId, MultiConnection *connection)
+{
+	if (!PutRemoteCopyData(connection, dataBuffer->data, dataBuffer->len))
+	{
+		ereport(ERROR, (errcode(ERRCODE_IO_ERROR),
+						errmsg("failed to COPY to shard " INT64_FORMAT " on %s:%d",
+							   shardId, connection->hostname, connection->port),
+						errdetail("failed to send %d bytes %s", dataBuffer->len,
+								  dataBuffer->data)));
+	}
+}
+
+
+/*
+ * EndRemoteCopy ends the COPY input on all connections, and unclaims connections.
+ * If stopOnFailure is true, then EndRemoteCopy reports an error on failure,
+ * otherwise it reports a warning or continues.
+ */
+void
+EndRemoteCopy(int64 shardId, List *connectionList, bool stopOnFailure)
+{
+	ListCell *connectionCell = NULL;
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		PGresult *result = NULL;
+		bool raiseInterrupts = true;
+
+		/* end the COPY input */
+		if (!PutRemoteCopyEnd(connection, NULL))
+		{
+			if (!stopOnFailure)
+			{
+				continue;
+			}
+
+			ereport(ERROR, (errcode(ERRCODE_IO_ERROR),
+							errmsg("failed to COPY to shard " INT64_FORMAT " on %s:%d",
+								   shardId, connection->hostname, connection->port)));
+
+			continue;
+		}
+
+		/* check whether there were any COPY errors */
+		result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (PQresultStatus(result) != PGRES_COMMAND_OK && stopOnFailure)
+		{
+			ReportCopyError(connection, result);
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+		UnclaimConnection(connection);
+	}
+}
+
+
+/*
+ * ReportCopyError tries to report a useful error message for the user from
+ * the remote COPY error messages.
  */
 static void
 ReportCopyError(MultiConnection *connection, PGresult *result)
@@ -1495,6 +2156,91 @@ citus_text_send_as_jsonb(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * citus_copy_progress returns a row for each shard into which a COPY that
+ * tracks its progress is currently copying, with the number of rows and bytes
+ * sent to the shard so far.
+ */
+Datum
+citus_copy_progress(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	List *attachedDSMSegments = NIL;
+	List *monitorList = NIL;
+	ListCell *monitorCell = NULL;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	monitorList = ProgressMonitorList(COPY_PROGRESS_MAGIC_NUMBER, &attachedDSMSegments);
+
+	foreach(monitorCell, monitorList)
+	{
+		ProgressMonitorData *monitor = (ProgressMonitorData *) lfirst(monitorCell);
+		CopyShardProgress *copyProgressArray = (CopyShardProgress *) monitor->steps;
+		int stepIndex = 0;
+
+		for (stepIndex = 0; stepIndex < monitor->stepCount; stepIndex++)
+		{
+			CopyShardProgress *copyProgress = &copyProgressArray[stepIndex];
+			Datum values[6];
+			bool nulls[6];
+
+			/* steps are taken in order, the remaining shards were not copied into */
+			if (copyProgress->shardId == INVALID_SHARD_ID)
+			{
+				break;
+			}
+
+			memset(values, 0, sizeof(values));
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = Int32GetDatum((int32) monitor->processId);
+			values[1] = Int64GetDatum(copyProgress->shardId);
+			values[2] = Int64GetDatum(copyProgress->rowsSent);
+			values[3] = Int64GetDatum(copyProgress->bytesSent);
+			values[4] = Int64GetDatum(copyProgress->bufferedBytes);
+			values[5] = Int64GetDatum(copyProgress->backPressureCount);
+
+			tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+		}
+	}
+
+	DetachFromDSMSegments(attachedDSMSegments);
+
+	tuplestore_donestoring(tupleStore);
+
+	return (Datum) 0;
+}
+
+
 /*
  * AppendCopyRowData serializes one row using the column output functions,
  * and appends the data to the row output state object's message buffer.
@@ -1720,12 +2466,37 @@ StartCopyToNewShard(ShardConnections *shardConnections, CopyStmt *copyStatement,
 
 	/* connect to shards placements and start transactions */
 	OpenCopyConnections(copyStatement, shardConnections, stopOnFailure,
-						useBinaryCopyFormat);
+						useBinaryCopyFormat, false);
 
 	return shardId;
 }
 
 
+/*
+ * FinishCopyToNewShard sends copy binary footers to the placements of a shard
+ * created by StartCopyToNewShard, ends the COPY on them, and updates the shard
+ * statistics.
+ */
+static void
+FinishCopyToNewShard(ShardConnections *shardConnections, CopyOutState copyOutState)
+{
+	int64 shardId = shardConnections->shardId;
+
+	Assert(shardId != INVALID_SHARD_ID);
+
+	if (copyOutState->binary)
+	{
+		SendCopyBinaryFooters(copyOutState, shardId, shardConnections->connectionList);
+	}
+
+	EndRemoteCopy(shardId, shardConnections->connectionList, true);
+	MasterUpdateShardStatistics(shardId);
+
+	shardConnections->shardId = INVALID_SHARD_ID;
+	shardConnections->connectionList = NIL;
+}
+
+
 /*
  * MasterCreateEmptyShard dispatches the create empty shard call between local or
  * remote master node according to the master connection state.
@@ -1812,7 +2583,11 @@ RemoteCreateEmptyShard(char *relationName)
 static void
 MasterUpdateShardStatistics(uint64 shardId)
 {
-	if (masterConnection == NULL)
+	if (masterConnection == NULL && DeferShardStatistics)
+	{
+		MarkShardStatisticsStale(shardId);
+	}
+	else if (masterConnection == NULL)
 	{
 		UpdateShardStatistics(shardId);
 	}
@@ -2067,6 +2842,7 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	CopyStmt *copyStatement = NULL;
 
 	List *shardIntervalList = NULL;
+	ListCell *shardIntervalCell = NULL;
 
 	CopyOutState copyOutState = NULL;
 	const char *delimiterCharacter = "\t";
@@ -2128,6 +2904,14 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	 */
 	LockShardListResources(shardIntervalList, RowExclusiveLock);
 
+	/* cached results of the shards no longer reflect their contents */
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+
+		InvalidateCachedShardResults(shardInterval->shardId);
+	}
+
 	/* keep the table metadata to avoid looking it up for every tuple */
 	copyDest->tableMetadata = cacheEntry;
 
@@ -2144,12 +2928,14 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	copyOutState->delim = (char *) delimiterCharacter;
 	copyOutState->null_print = (char *) nullPrintCharacter;
 	copyOutState->null_print_client = (char *) nullPrintCharacter;
-	copyOutState->binary = CanUseBinaryCopyFormat(inputTupleDescriptor);
+	copyOutState->binary = !copyDest->rawFieldInput &&
+						   CanUseBinaryCopyFormat(inputTupleDescriptor);
 	copyOutState->fe_msgbuf = makeStringInfo();
 	copyOutState->rowcontext = GetPerTupleMemoryContext(copyDest->executorState);
 	copyDest->copyOutState = copyOutState;
 
-	/* prepare functions to call on received tuples */
+	/* prepare functions to call on received tuples, raw fields need none */
+	if (!copyDest->rawFieldInput)
 	{
 		TupleDesc destTupleDescriptor = distributedRelation->rd_att;
 		int columnCount = inputTupleDescriptor->natts;
@@ -2192,14 +2978,61 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	copyDest->copyStatement = copyStatement;
 
 	copyDest->shardConnectionHash = CreateShardConnectionHash(TopTransactionContext);
-}
+	/* upserts need the intermediate result and the shard on the same connection */
+	copyDest->sharedConnections = EnableSharedCopyConnections &&
+								  copyDest->conflictAction == COPY_CONFLICT_ERROR;
+	copyDest->bufferedCopyDataBytes = 0;
+
+	/* reserve a progress step for each shard that we might copy into */
+	copyDest->progressMonitor = NULL;
+	copyDest->progressStepsUsed = 0;
+	if (TrackCopyProgress)
+	{
+		int shardCount = list_length(shardIntervalList);
+		ProgressMonitorData *monitor =
+			CreateProgressMonitor(COPY_PROGRESS_MAGIC_NUMBER, shardCount,
+								  sizeof(CopyShardProgress), tableId);
+
+		if (monitor != NULL)
+		{
+			memset(monitor->steps, 0, shardCount * sizeof(CopyShardProgress));
+			copyDest->progressMonitor = monitor;
+		}
+	}
 
+	/* raw fields are in the order of the column names, find the partition column */
+	if (copyDest->rawFieldInput &&
+		copyDest->partitionColumnIndex != INVALID_PARTITION_COLUMN_INDEX)
+	{
+		Form_pg_attribute partitionColumn =
+			TupleDescAttr(inputTupleDescriptor, copyDest->partitionColumnIndex);
+		char *partitionColumnName = NameStr(partitionColumn->attname);
+		Oid inputFunctionId = InvalidOid;
 
-/*
- * CitusCopyDestReceiverReceive implements the receiveSlot function of
- * CitusCopyDestReceiver. It takes a TupleTableSlot and sends the contents to
- * the appropriate shard placement(s).
- */
+		copyDest->partitionFieldIndex = 0;
+		foreach(columnNameCell, columnNameList)
+		{
+			if (strcmp((char *) lfirst(columnNameCell), partitionColumnName) == 0)
+			{
+				break;
+			}
+
+			copyDest->partitionFieldIndex++;
+		}
+
+		getTypeInputInfo(partitionColumn->atttypid, &inputFunctionId,
+						 &copyDest->partitionTypeIOParam);
+		fmgr_info(inputFunctionId, &copyDest->partitionInputFunction);
+		copyDest->partitionTypeMod = partitionColumn->atttypmod;
+	}
+}
+
+
+/*
+ * CitusCopyDestReceiverReceive implements the receiveSlot function of
+ * CitusCopyDestReceiver. It takes a TupleTableSlot and sends the contents to
+ * the appropriate shard placement(s).
+ */
 static bool
 CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 {
@@ -2207,24 +3040,19 @@ CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 
 	int partitionColumnIndex = copyDest->partitionColumnIndex;
 	TupleDesc tupleDescriptor = copyDest->tupleDescriptor;
-	CopyStmt *copyStatement = copyDest->copyStatement;
 
-	HTAB *shardConnectionHash = copyDest->shardConnectionHash;
 	CopyOutState copyOutState = copyDest->copyOutState;
 	FmgrInfo *columnOutputFunctions = copyDest->columnOutputFunctions;
 	CopyCoercionData *columnCoercionPaths = copyDest->columnCoercionPaths;
 
-	bool stopOnFailure = copyDest->stopOnFailure;
-
 	Datum *columnValues = NULL;
 	bool *columnNulls = NULL;
 
 	Datum partitionColumnValue = 0;
-	ShardInterval *shardInterval = NULL;
-	int64 shardId = 0;
 
-	bool shardConnectionsFound = false;
 	ShardConnections *shardConnections = NULL;
+	StringInfo rowOutputBuffer = NULL;
+	int bufferedLength = 0;
 
 	EState *executorState = copyDest->executorState;
 	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
@@ -2248,16 +3076,7 @@ CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 
 		if (columnNulls[partitionColumnIndex])
 		{
-			Oid relationId = copyDest->distributedRelationId;
-			char *relationName = get_rel_name(relationId);
-			Oid schemaOid = get_rel_namespace(relationId);
-			char *schemaName = get_namespace_name(schemaOid);
-			char *qualifiedTableName = quote_qualified_identifier(schemaName,
-																  relationName);
-
-			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
-							errmsg("the partition column of table %s cannot be NULL",
-								   qualifiedTableName)));
+			ReportNullPartitionColumn(copyDest->distributedRelationId);
 		}
 
 		/* find the partition column value */
@@ -2267,13 +3086,207 @@ CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 		partitionColumnValue = CoerceColumnValue(partitionColumnValue, coercePath);
 	}
 
+	/* connections hash is kept in memory context */
+	MemoryContextSwitchTo(copyDest->memoryContext);
+
+	shardConnections = CopyShardConnections(copyDest, partitionColumnValue);
+
+	if (shardConnections->localShardCopy != NULL)
+	{
+		/* the placement is on the local node, insert the row directly */
+		InsertLocalShardRow(shardConnections->localShardCopy, columnValues,
+							columnNulls, columnCoercionPaths);
+	}
+	else
+	{
+		/*
+		 * Serialize the row into the shard's buffer, and replicate the buffered
+		 * rows to the shard placements once there are enough of them. Sending
+		 * the rows in one message saves us a PQputCopyData() call and message
+		 * header per row.
+		 */
+		rowOutputBuffer = copyOutState->fe_msgbuf;
+		bufferedLength = shardConnections->copyDataBuffer->len;
+		copyOutState->fe_msgbuf = shardConnections->copyDataBuffer;
+		AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
+						  copyOutState, columnOutputFunctions, columnCoercionPaths);
+		copyOutState->fe_msgbuf = rowOutputBuffer;
+
+		SendFullCopyDataBuffers(copyDest, shardConnections, bufferedLength);
+	}
+
+	if (shardConnections->copyProgress != NULL)
+	{
+		shardConnections->copyProgress->rowsSent++;
+		UpdateCopyShardProgress(shardConnections);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	copyDest->tuplesSent++;
+
 	/*
-	 * Find the shard interval and id for the partition column value for
-	 * non-reference tables.
-	 *
-	 * For reference table, this function blindly returns the tables single
-	 * shard.
+	 * Release per tuple memory allocated in this function. If we're writing
+	 * the results of an INSERT ... SELECT then the SELECT execution will use
+	 * its own executor state and reset the per tuple expression context
+	 * separately.
 	 */
+	ResetPerTupleExprContext(executorState);
+
+	return true;
+}
+
+
+/*
+ * CitusCopyDestReceiverReceiveRawFields sends a row that was split into text
+ * fields, one for each column in the column name list, to the appropriate shard
+ * placement(s). Only the partition column is parsed, to find the shard. The
+ * other fields are escaped and passed on in text format, such that the
+ * workers parse them instead of the coordinator.
+ */
+void
+CitusCopyDestReceiverReceiveRawFields(CitusCopyDestReceiver *copyDest,
+									  char **fieldArray, int fieldCount)
+{
+	CopyOutState copyOutState = copyDest->copyOutState;
+	Datum partitionColumnValue = 0;
+	ShardConnections *shardConnections = NULL;
+	StringInfo rowOutputBuffer = NULL;
+	int bufferedLength = 0;
+	int fieldIndex = 0;
+
+	EState *executorState = copyDest->executorState;
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+	MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+	Assert(copyDest->rawFieldInput && !copyOutState->binary);
+
+	if (copyDest->partitionColumnIndex != INVALID_PARTITION_COLUMN_INDEX)
+	{
+		char *partitionField = fieldArray[copyDest->partitionFieldIndex];
+
+		if (partitionField == NULL)
+		{
+			ReportNullPartitionColumn(copyDest->distributedRelationId);
+		}
+
+		partitionColumnValue = InputFunctionCall(&copyDest->partitionInputFunction,
+												 partitionField,
+												 copyDest->partitionTypeIOParam,
+												 copyDest->partitionTypeMod);
+	}
+
+	/* connections hash is kept in memory context */
+	MemoryContextSwitchTo(copyDest->memoryContext);
+
+	shardConnections = CopyShardConnections(copyDest, partitionColumnValue);
+
+	rowOutputBuffer = copyOutState->fe_msgbuf;
+	bufferedLength = shardConnections->copyDataBuffer->len;
+	copyOutState->fe_msgbuf = shardConnections->copyDataBuffer;
+
+	for (fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+	{
+		if (fieldIndex > 0)
+		{
+			CopySendChar(copyOutState, copyOutState->delim[0]);
+		}
+
+		if (fieldArray[fieldIndex] != NULL)
+		{
+			CopyAttributeOutText(copyOutState, fieldArray[fieldIndex]);
+		}
+		else
+		{
+			CopySendString(copyOutState, copyOutState->null_print_client);
+		}
+	}
+
+	/* append default line termination string depending on the platform */
+#ifndef WIN32
+	CopySendChar(copyOutState, '\n');
+#else
+	CopySendString(copyOutState, "\r\n");
+#endif
+
+	copyOutState->fe_msgbuf = rowOutputBuffer;
+
+	SendFullCopyDataBuffers(copyDest, shardConnections, bufferedLength);
+
+	if (shardConnections->copyProgress != NULL)
+	{
+		shardConnections->copyProgress->rowsSent++;
+		UpdateCopyShardProgress(shardConnections);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	copyDest->tuplesSent++;
+
+	ResetPerTupleExprContext(executorState);
+}
+
+
+/*
+ * CitusCopyDestReceiverReceiveSerializedRow sends a row that was already
+ * serialized in the format of the COPY into the shard with the given index in
+ * the sorted shard interval array of the table. Rows are serialized by other
+ * processes when copying local data in parallel, see parallel_local_copy.c.
+ */
+void
+CitusCopyDestReceiverReceiveSerializedRow(CitusCopyDestReceiver *copyDest,
+										  int shardIndex, const char *rowData,
+										  int rowLength)
+{
+	DistTableCacheEntry *cacheEntry = copyDest->tableMetadata;
+	ShardInterval *shardInterval = NULL;
+	ShardConnections *shardConnections = NULL;
+	int bufferedLength = 0;
+	MemoryContext oldContext = NULL;
+
+	Assert(copyDest->serializedRowInput);
+
+	if (shardIndex < 0 || shardIndex >= cacheEntry->shardIntervalArrayLength)
+	{
+		ereport(ERROR, (errmsg("could not find shard with index %d", shardIndex)));
+	}
+
+	shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+
+	/* connections hash is kept in memory context */
+	oldContext = MemoryContextSwitchTo(copyDest->memoryContext);
+
+	shardConnections = CopyShardIntervalConnections(copyDest, shardInterval);
+
+	bufferedLength = shardConnections->copyDataBuffer->len;
+	appendBinaryStringInfo(shardConnections->copyDataBuffer, rowData, rowLength);
+
+	SendFullCopyDataBuffers(copyDest, shardConnections, bufferedLength);
+
+	if (shardConnections->copyProgress != NULL)
+	{
+		shardConnections->copyProgress->rowsSent++;
+		UpdateCopyShardProgress(shardConnections);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	copyDest->tuplesSent++;
+}
+
+
+/*
+ * CopyShardConnections finds the shard for the given partition column value,
+ * and returns the connections of its placements. When a shard is first seen,
+ * we start a COPY on its placements, unless shards share connections or the
+ * shard is copied locally. For reference tables, we always return the table's
+ * single shard.
+ */
+static ShardConnections *
+CopyShardConnections(CitusCopyDestReceiver *copyDest, Datum partitionColumnValue)
+{
+	ShardInterval *shardInterval = NULL;
+
 	shardInterval = FindShardInterval(partitionColumnValue, copyDest->tableMetadata);
 	if (shardInterval == NULL)
 	{
@@ -2282,47 +3295,410 @@ CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 							   "value")));
 	}
 
-	shardId = shardInterval->shardId;
+	return CopyShardIntervalConnections(copyDest, shardInterval);
+}
 
-	/* connections hash is kept in memory context */
-	MemoryContextSwitchTo(copyDest->memoryContext);
+
+/*
+ * CopyShardIntervalConnections returns the connections of the placements of the
+ * given shard, and starts a COPY on them when the shard is first seen.
+ */
+static ShardConnections *
+CopyShardIntervalConnections(CitusCopyDestReceiver *copyDest,
+							 ShardInterval *shardInterval)
+{
+	CopyOutState copyOutState = copyDest->copyOutState;
+	ShardConnections *shardConnections = NULL;
+	bool shardConnectionsFound = false;
+	int64 shardId = shardInterval->shardId;
 
 	/* get existing connections to the shard placements, if any */
-	shardConnections = GetShardHashConnections(shardConnectionHash, shardId,
+	shardConnections = GetShardHashConnections(copyDest->shardConnectionHash, shardId,
 											   &shardConnectionsFound);
 	if (!shardConnectionsFound)
 	{
-		/* open connections and initiate COPY on shard placements */
-		OpenCopyConnections(copyStatement, shardConnections, stopOnFailure,
-							copyOutState->binary);
+		shardConnections->localShardCopy = StartLocalShardCopy(copyDest, shardId);
 
-		/* send copy binary headers to shard placements */
-		if (copyOutState->binary)
+		/* with shared connections, we only connect to send a batch of rows */
+		if (shardConnections->localShardCopy == NULL && !copyDest->sharedConnections)
 		{
-			SendCopyBinaryHeaders(copyOutState, shardId,
-								  shardConnections->connectionList);
+			/* open connections and initiate COPY on shard placements */
+			OpenCopyConnections(copyDest->copyStatement, shardConnections,
+								copyDest->stopOnFailure, copyOutState->binary,
+								copyDest->conflictAction != COPY_CONFLICT_ERROR);
+
+			/* send copy binary headers to shard placements */
+			if (copyOutState->binary)
+			{
+				SendCopyBinaryHeaders(copyOutState, shardId,
+									  shardConnections->connectionList);
+			}
 		}
+
+		shardConnections->copyDataBuffer = makeStringInfo();
+		shardConnections->copyProgress = NextCopyShardProgress(copyDest, shardId);
 	}
 
-	/* replicate row to shard placements */
-	resetStringInfo(copyOutState->fe_msgbuf);
-	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-					  copyOutState, columnOutputFunctions, columnCoercionPaths);
-	SendCopyDataToAll(copyOutState->fe_msgbuf, shardId, shardConnections->connectionList);
+	return shardConnections;
+}
 
-	MemoryContextSwitchTo(oldContext);
 
-	copyDest->tuplesSent++;
+/*
+ * NextCopyShardProgress returns the next unused progress step of the COPY for
+ * the given shard, or NULL if we do not track the progress of the COPY.
+ */
+static CopyShardProgress *
+NextCopyShardProgress(CitusCopyDestReceiver *copyDest, int64 shardId)
+{
+	ProgressMonitorData *monitor = copyDest->progressMonitor;
+	CopyShardProgress *copyProgress = NULL;
+
+	if (monitor == NULL || copyDest->progressStepsUsed >= monitor->stepCount)
+	{
+		return NULL;
+	}
+
+	copyProgress = ((CopyShardProgress *) monitor->steps) + copyDest->progressStepsUsed;
+	copyProgress->shardId = shardId;
+	copyDest->progressStepsUsed++;
+
+	return copyProgress;
+}
+
+
+/*
+ * UpdateCopyShardProgress records how many bytes are buffered for the given
+ * shard.
+ */
+static void
+UpdateCopyShardProgress(ShardConnections *shardConnections)
+{
+	CopyShardProgress *copyProgress = shardConnections->copyProgress;
+
+	if (copyProgress != NULL)
+	{
+		copyProgress->bufferedBytes = shardConnections->copyDataBuffer->len;
+	}
+}
+
+
+/*
+ * CopyBackPressureCount returns how often sending COPY data over the given
+ * connections had to wait for a worker to catch up.
+ */
+static uint64
+CopyBackPressureCount(List *connectionList)
+{
+	ListCell *connectionCell = NULL;
+	uint64 backPressureCount = 0;
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		backPressureCount += connection->copyBackPressureCount;
+	}
+
+	return backPressureCount;
+}
+
+
+/*
+ * SendFullCopyDataBuffers is called after a row was appended to the buffer of
+ * the given shard, which held bufferedLength bytes before. It sends the
+ * buffered rows to the shard placements once there are enough of them.
+ */
+static void
+SendFullCopyDataBuffers(CitusCopyDestReceiver *copyDest,
+						ShardConnections *shardConnections, int bufferedLength)
+{
+	if (copyDest->sharedConnections)
+	{
+		copyDest->bufferedCopyDataBytes +=
+			shardConnections->copyDataBuffer->len - bufferedLength;
+
+		if (shardConnections->copyDataBuffer->len >= SHARED_COPY_BATCH_SIZE)
+		{
+			CopyShardBatch(copyDest, shardConnections);
+		}
+
+		CopyLargestShardBatches(copyDest);
+	}
+	else if (shardConnections->copyDataBuffer->len >= COPY_DATA_BUFFER_SIZE)
+	{
+		FlushCopyDataBuffer(shardConnections);
+	}
+}
+
+
+/*
+ * ReportNullPartitionColumn errors out because a row that is copied into the
+ * given distributed table has no value for its partition column.
+ */
+void
+ReportNullPartitionColumn(Oid relationId)
+{
+	char *relationName = get_rel_name(relationId);
+	Oid schemaOid = get_rel_namespace(relationId);
+	char *schemaName = get_namespace_name(schemaOid);
+	char *qualifiedTableName = quote_qualified_identifier(schemaName, relationName);
+
+	ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					errmsg("the partition column of table %s cannot be NULL",
+						   qualifiedTableName)));
+}
+
+
+/*
+ * StartLocalShardCopy prepares to insert rows directly into the given shard if
+ * citus.enable_local_execution is set and the only placement of the shard is
+ * on the local node, such as on an MX worker. Otherwise, it returns NULL and
+ * the rows are sent over a connection.
+ *
+ * We only copy locally if the placement was not accessed over a connection in
+ * the same transaction, and if inserting into the shard table involves no
+ * more than checking its constraints and updating its indexes. Other shards
+ * need triggers, partition routing, or column defaults that COPY on the
+ * worker takes care of. Rows that arrive as raw fields are sent as they are,
+ * and upserted rows go through an intermediate result on the worker.
+ */
+static LocalShardCopy *
+StartLocalShardCopy(CitusCopyDestReceiver *copyDest, int64 shardId)
+{
+	Oid relationId = copyDest->distributedRelationId;
+	List *placementList = NIL;
+	ShardPlacement *placement = NULL;
+	char *shardName = NULL;
+	Oid shardRelationId = InvalidOid;
+	Relation shardRelation = NULL;
+	TupleDesc shardTupleDescriptor = NULL;
+	int *inputColumnIndexes = NULL;
+	int columnIndex = 0;
+	LocalShardCopy *localShardCopy = NULL;
+	EState *executorState = NULL;
+	ResultRelInfo *resultRelInfo = NULL;
+	RangeTblEntry *rangeTableEntry = NULL;
+
+	if (!EnableLocalExecution || copyDest->rawFieldInput ||
+		copyDest->serializedRowInput ||
+		copyDest->conflictAction != COPY_CONFLICT_ERROR ||
+		PartitionedTable(relationId) || PartitionTable(relationId))
+	{
+		return NULL;
+	}
+
+	placementList = MasterShardPlacementList(shardId);
+	if (list_length(placementList) != 1)
+	{
+		return NULL;
+	}
+
+	placement = (ShardPlacement *) linitial(placementList);
+	if (placement->groupId != GetLocalGroupId() || !CanModifyPlacementLocally(placement))
+	{
+		return NULL;
+	}
+
+	shardName = get_rel_name(relationId);
+	AppendShardIdToName(&shardName, shardId);
+	shardRelationId = get_relname_relid(shardName, get_rel_namespace(relationId));
+	if (!OidIsValid(shardRelationId))
+	{
+		return NULL;
+	}
+
+	shardRelation = heap_open(shardRelationId, RowExclusiveLock);
+	if (shardRelation->rd_rel->relkind != RELKIND_RELATION ||
+		shardRelation->rd_rel->relhastriggers)
+	{
+		heap_close(shardRelation, RowExclusiveLock);
+		return NULL;
+	}
+
+	/* every column of the shard needs a value from the input */
+	shardTupleDescriptor = RelationGetDescr(shardRelation);
+	inputColumnIndexes = palloc0(shardTupleDescriptor->natts * sizeof(int));
+	for (columnIndex = 0; columnIndex < shardTupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute shardColumn = TupleDescAttr(shardTupleDescriptor, columnIndex);
+
+		if (shardColumn->attisdropped)
+		{
+			inputColumnIndexes[columnIndex] = -1;
+			continue;
+		}
+
+		inputColumnIndexes[columnIndex] =
+			InputColumnIndex(copyDest, NameStr(shardColumn->attname));
+		if (inputColumnIndexes[columnIndex] == -1)
+		{
+			heap_close(shardRelation, RowExclusiveLock);
+			return NULL;
+		}
+	}
+
+	/* set up the executor state to check constraints and update indexes */
+	executorState = CreateExecutorState();
+
+	rangeTableEntry = makeNode(RangeTblEntry);
+	rangeTableEntry->rtekind = RTE_RELATION;
+	rangeTableEntry->relid = shardRelationId;
+	rangeTableEntry->relkind = RELKIND_RELATION;
+	rangeTableEntry->requiredPerms = ACL_INSERT;
+	executorState->es_range_table = list_make1(rangeTableEntry);
+
+	resultRelInfo = makeNode(ResultRelInfo);
+#if (PG_VERSION_NUM >= 100000)
+	InitResultRelInfo(resultRelInfo, shardRelation, 1, NULL, 0);
+#else
+	InitResultRelInfo(resultRelInfo, shardRelation, 1, 0);
+#endif
+	ExecOpenIndices(resultRelInfo, false);
+
+	executorState->es_result_relations = resultRelInfo;
+	executorState->es_num_result_relations = 1;
+	executorState->es_result_relation_info = resultRelInfo;
+
+	localShardCopy = (LocalShardCopy *) palloc0(sizeof(LocalShardCopy));
+	localShardCopy->shardRelation = shardRelation;
+	localShardCopy->executorState = executorState;
+	localShardCopy->resultRelInfo = resultRelInfo;
+	localShardCopy->tupleTableSlot = MakeSingleTupleTableSlot(shardTupleDescriptor);
+	localShardCopy->bulkInsertState = GetBulkInsertState();
+	localShardCopy->commandId = GetCurrentCommandId(true);
+	localShardCopy->inputColumnIndexes = inputColumnIndexes;
+
+	/* connections in the same transaction would not see the rows */
+	RecordPlacementLocalModification(placement);
+
+	return localShardCopy;
+}
+
+
+/*
+ * InputColumnIndex returns the index of the column with the given name in the
+ * tuples that the receiver gets, or -1 if the column is not copied. The
+ * non-dropped columns of these tuples are in the order of the column names.
+ */
+static int
+InputColumnIndex(CitusCopyDestReceiver *copyDest, char *columnName)
+{
+	TupleDesc inputTupleDescriptor = copyDest->tupleDescriptor;
+	int inputColumnIndex = 0;
+	ListCell *columnNameCell = NULL;
+
+	foreach(columnNameCell, copyDest->columnNameList)
+	{
+		while (inputColumnIndex < inputTupleDescriptor->natts &&
+			   TupleDescAttr(inputTupleDescriptor, inputColumnIndex)->attisdropped)
+		{
+			inputColumnIndex++;
+		}
+
+		if (inputColumnIndex >= inputTupleDescriptor->natts)
+		{
+			break;
+		}
+
+		if (strcmp((char *) lfirst(columnNameCell), columnName) == 0)
+		{
+			return inputColumnIndex;
+		}
+
+		inputColumnIndex++;
+	}
+
+	return -1;
+}
+
+
+/*
+ * InsertLocalShardRow inserts a row that the receiver got into the local shard,
+ * after checking the constraints of the shard, and updates its indexes.
+ */
+static void
+InsertLocalShardRow(LocalShardCopy *localShardCopy, Datum *columnValues,
+					bool *columnNulls, CopyCoercionData *columnCoercionPaths)
+{
+	Relation shardRelation = localShardCopy->shardRelation;
+	TupleDesc shardTupleDescriptor = RelationGetDescr(shardRelation);
+	int columnCount = shardTupleDescriptor->natts;
+	EState *executorState = localShardCopy->executorState;
+	ResultRelInfo *resultRelInfo = localShardCopy->resultRelInfo;
+	TupleTableSlot *tupleTableSlot = localShardCopy->tupleTableSlot;
+	Datum *shardValues = NULL;
+	bool *shardNulls = NULL;
+	HeapTuple shardTuple = NULL;
+	int columnIndex = 0;
+
+	MemoryContext oldContext =
+		MemoryContextSwitchTo(GetPerTupleMemoryContext(executorState));
+
+	shardValues = palloc0(columnCount * sizeof(Datum));
+	shardNulls = palloc0(columnCount * sizeof(bool));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		int inputColumnIndex = localShardCopy->inputColumnIndexes[columnIndex];
+
+		if (inputColumnIndex == -1)
+		{
+			shardNulls[columnIndex] = true;
+			continue;
+		}
+
+		shardValues[columnIndex] = columnValues[inputColumnIndex];
+		shardNulls[columnIndex] = columnNulls[inputColumnIndex];
+
+		if (!shardNulls[columnIndex] && columnCoercionPaths != NULL)
+		{
+			shardValues[columnIndex] =
+				CoerceColumnValue(shardValues[columnIndex],
+								  &columnCoercionPaths[inputColumnIndex]);
+		}
+	}
+
+	shardTuple = heap_form_tuple(shardTupleDescriptor, shardValues, shardNulls);
+	ExecStoreTuple(shardTuple, tupleTableSlot, InvalidBuffer, false);
+
+	if (shardTupleDescriptor->constr != NULL)
+	{
+		ExecConstraints(resultRelInfo, tupleTableSlot, executorState);
+	}
+
+	heap_insert(shardRelation, shardTuple, localShardCopy->commandId, 0,
+				localShardCopy->bulkInsertState);
+
+	if (resultRelInfo->ri_NumIndices > 0)
+	{
+		List *recheckIndexList = ExecInsertIndexTuples(tupleTableSlot,
+													   &(shardTuple->t_self),
+													   executorState, false, NULL,
+													   NIL);
+
+		list_free(recheckIndexList);
+	}
+
+	ExecClearTuple(tupleTableSlot);
+	MemoryContextSwitchTo(oldContext);
 
-	/*
-	 * Release per tuple memory allocated in this function. If we're writing
-	 * the results of an INSERT ... SELECT then the SELECT execution will use
-	 * its own executor state and reset the per tuple expression context
-	 * separately.
-	 */
 	ResetPerTupleExprContext(executorState);
+}
 
-	return true;
+
+/*
+ * FinishLocalShardCopy releases the resources used for copying into a local
+ * shard. We keep the lock on the shard until the end of the transaction.
+ */
+static void
+FinishLocalShardCopy(LocalShardCopy *localShardCopy)
+{
+	FreeBulkInsertState(localShardCopy->bulkInsertState);
+	ExecCloseIndices(localShardCopy->resultRelInfo);
+	ExecDropSingleTupleTableSlot(localShardCopy->tupleTableSlot);
+	FreeExecutorState(localShardCopy->executorState);
+
+	heap_close(localShardCopy->shardRelation, NoLock);
 }
 
 
@@ -2348,6 +3724,23 @@ CitusCopyDestReceiverShutdown(DestReceiver *destReceiver)
 		ShardConnections *shardConnections = (ShardConnections *) lfirst(
 			shardConnectionsCell);
 
+		/* rows of local shards were already inserted */
+		if (shardConnections->localShardCopy != NULL)
+		{
+			FinishLocalShardCopy(shardConnections->localShardCopy);
+			continue;
+		}
+
+		/* with shared connections, the last batch is a COPY of its own */
+		if (copyDest->sharedConnections)
+		{
+			CopyShardBatch(copyDest, shardConnections);
+			continue;
+		}
+
+		/* send the rows that are still buffered */
+		FlushCopyDataBuffer(shardConnections);
+
 		/* send copy binary footers to all shard placements */
 		if (copyOutState->binary)
 		{
@@ -2359,6 +3752,17 @@ CitusCopyDestReceiverShutdown(DestReceiver *destReceiver)
 		EndRemoteCopy(shardConnections->shardId, shardConnections->connectionList, true);
 	}
 
+	if (copyDest->conflictAction != COPY_CONFLICT_ERROR)
+	{
+		UpsertCopiedRows(copyDest, shardConnectionsList);
+	}
+
+	if (copyDest->progressMonitor != NULL)
+	{
+		FinalizeCurrentProgressMonitor();
+		copyDest->progressMonitor = NULL;
+	}
+
 	heap_close(distributedRelation, NoLock);
 }
 
@@ -0,0 +1,612 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_copy_to.c
+ *   Routines for exporting distributed tables by running COPY ... TO STDOUT
+ *   on all shards concurrently.
+ *
+ * COPY distributed_table TO STDOUT is normally rewritten into a SELECT, which
+ * collects all rows on the coordinator and serializes them again. When
+ * citus.parallel_copy_to is set, the coordinator instead sends a COPY ... TO
+ * STDOUT command for every shard over its own connection, and passes the
+ * CopyData messages that the workers send on to the client without parsing
+ * them. Since text and CSV COPY send every row in a single message, rows of
+ * different shards can either be sent in shard order, in which case the
+ * workers of later shards wait for the coordinator to read their output, or
+ * interleaved in the order in which they arrive.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/heapam.h"
+#include "catalog/namespace.h"
+#include "commands/defrem.h"
+#include "distributed/connection_management.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/multi_partitioning_utils.h"
+#include "distributed/multi_router_executor.h"
+#include "distributed/parallel_copy_to.h"
+#include "distributed/placement_connection.h"
+#include "distributed/relay_utility.h"
+#include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
+#include "libpq/libpq.h"
+#include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
+#include "storage/latch.h"
+#include "tcop/dest.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/rel.h"
+
+
+/* ShardCopyToStream is the state of the COPY ... TO STDOUT of a single shard */
+typedef struct ShardCopyToStream
+{
+	uint64 shardId;
+	MultiConnection *connection;
+
+	/* whether the worker started sending data, and whether it finished */
+	bool copyStarted;
+	bool copyFinished;
+} ShardCopyToStream;
+
+
+/* Config variables managed via guc.c */
+int ParallelCopyTo = PARALLEL_COPY_TO_OFF;
+
+
+/* local function forward declarations */
+static bool CopyToOptionSupported(DefElem *option);
+static StringInfo ConstructShardCopyToCommand(CopyStmt *copyStatement, uint64 shardId);
+static void AppendCopyToOptions(StringInfo command, List *optionList);
+static int CopyToColumnCount(CopyStmt *copyStatement, Oid relationId);
+static void SendCopyOutResponse(int columnCount);
+static void SendCopyOutDone(void);
+static bool ReceiveShardCopyToData(ShardCopyToStream *copyStream,
+								   uint64 *processedRowCount);
+static void WaitForShardCopyToStreams(List *copyStreamList);
+
+
+/*
+ * CanParallelCopyTo returns whether the given COPY distributed_table TO
+ * command can be executed by CitusCopyTo, which requires the rows to be sent
+ * to the client in text or CSV format in the encoding of the database.
+ */
+bool
+CanParallelCopyTo(CopyStmt *copyStatement)
+{
+	Oid relationId = InvalidOid;
+	ListCell *optionCell = NULL;
+
+	if (ParallelCopyTo == PARALLEL_COPY_TO_OFF)
+	{
+		return false;
+	}
+
+	if (copyStatement->is_from || copyStatement->relation == NULL ||
+		copyStatement->filename != NULL || copyStatement->is_program)
+	{
+		return false;
+	}
+
+	/* we write CopyData messages directly to the client */
+	if (whereToSendOutput != DestRemote || PG_PROTOCOL_MAJOR(FrontendProtocol) < 3)
+	{
+		return false;
+	}
+
+	/* workers send the rows in the encoding of the database */
+	if (pg_get_client_encoding() != GetDatabaseEncoding())
+	{
+		return false;
+	}
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (!CopyToOptionSupported(option))
+		{
+			return false;
+		}
+	}
+
+	/* the shards of partitioned tables cannot be copied as a whole */
+	relationId = RangeVarGetRelid(copyStatement->relation, NoLock, false);
+	if (PartitionedTable(relationId))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * CopyToOptionSupported returns whether the shard COPY commands can be run
+ * with the given option, such that concatenating their output gives the
+ * output of a COPY of the whole table. Binary output and CSV headers are
+ * written once per COPY, and therefore not supported.
+ */
+static bool
+CopyToOptionSupported(DefElem *option)
+{
+	char *optionName = option->defname;
+
+	if (strcmp(optionName, "format") == 0)
+	{
+		char *format = defGetString(option);
+
+		return strcmp(format, "text") == 0 || strcmp(format, "csv") == 0;
+	}
+	else if (strcmp(optionName, "header") == 0)
+	{
+		return !defGetBoolean(option);
+	}
+	else if (strcmp(optionName, "delimiter") == 0 ||
+			 strcmp(optionName, "null") == 0 ||
+			 strcmp(optionName, "quote") == 0 ||
+			 strcmp(optionName, "escape") == 0 ||
+			 strcmp(optionName, "force_quote") == 0)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * CitusCopyTo runs COPY ... TO STDOUT on all shards of the distributed table
+ * concurrently and sends the rows to the client as they arrive, in shard order
+ * or interleaved depending on citus.parallel_copy_to. The shard commands are
+ * sent over the placement connections of the current transaction, such that
+ * they see the transaction's own modifications.
+ */
+void
+CitusCopyTo(CopyStmt *copyStatement, char *completionTag)
+{
+	Oid relationId = RangeVarGetRelid(copyStatement->relation, NoLock, false);
+	List *shardIntervalList = LoadShardIntervalList(relationId);
+	List *copyStreamList = NIL;
+	List *connectionList = NIL;
+	ListCell *shardIntervalCell = NULL;
+	ListCell *copyStreamCell = NULL;
+	uint64 processedRowCount = 0;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		List *placementList = FinalizedShardPlacementList(shardId);
+		ShardPlacement *placement = NULL;
+		ShardPlacementAccess *placementAccess = NULL;
+		MultiConnection *connection = NULL;
+		ShardCopyToStream *copyStream = NULL;
+
+		if (placementList == NIL)
+		{
+			ereport(ERROR, (errmsg("could not find any active placements for shard "
+								   UINT64_FORMAT, shardId)));
+		}
+
+		placement = (ShardPlacement *) linitial(placementList);
+		placementAccess = CreatePlacementAccess(placement, PLACEMENT_ACCESS_SELECT);
+
+		/* claiming the connection makes the next shard use a different one */
+		connection = StartPlacementListConnection(CONNECTION_PER_PLACEMENT,
+												  list_make1(placementAccess), NULL);
+		ClaimConnectionExclusively(connection);
+
+		copyStream = (ShardCopyToStream *) palloc0(sizeof(ShardCopyToStream));
+		copyStream->shardId = shardId;
+		copyStream->connection = connection;
+
+		copyStreamList = lappend(copyStreamList, copyStream);
+		connectionList = lappend(connectionList, connection);
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+
+	foreach(copyStreamCell, copyStreamList)
+	{
+		ShardCopyToStream *copyStream = (ShardCopyToStream *) lfirst(copyStreamCell);
+		MultiConnection *connection = copyStream->connection;
+		StringInfo copyCommand = NULL;
+
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+
+		RemoteTransactionBeginIfNecessary(connection);
+
+		copyCommand = ConstructShardCopyToCommand(copyStatement, copyStream->shardId);
+		if (!SendRemoteCommand(connection, copyCommand->data))
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	SendCopyOutResponse(CopyToColumnCount(copyStatement, relationId));
+
+	if (ParallelCopyTo == PARALLEL_COPY_TO_SHARD_ORDER)
+	{
+		foreach(copyStreamCell, copyStreamList)
+		{
+			ShardCopyToStream *copyStream = (ShardCopyToStream *) lfirst(copyStreamCell);
+
+			while (!copyStream->copyFinished)
+			{
+				if (!ReceiveShardCopyToData(copyStream, &processedRowCount))
+				{
+					WaitForShardCopyToStreams(list_make1(copyStream));
+				}
+			}
+		}
+	}
+	else
+	{
+		List *activeStreamList = copyStreamList;
+
+		while (activeStreamList != NIL)
+		{
+			List *remainingStreamList = NIL;
+			bool receivedData = false;
+
+			foreach(copyStreamCell, activeStreamList)
+			{
+				ShardCopyToStream *copyStream =
+					(ShardCopyToStream *) lfirst(copyStreamCell);
+
+				if (ReceiveShardCopyToData(copyStream, &processedRowCount))
+				{
+					receivedData = true;
+				}
+
+				if (!copyStream->copyFinished)
+				{
+					remainingStreamList = lappend(remainingStreamList, copyStream);
+				}
+			}
+
+			activeStreamList = remainingStreamList;
+
+			if (!receivedData && activeStreamList != NIL)
+			{
+				WaitForShardCopyToStreams(activeStreamList);
+			}
+		}
+	}
+
+	SendCopyOutDone();
+
+	foreach(copyStreamCell, copyStreamList)
+	{
+		ShardCopyToStream *copyStream = (ShardCopyToStream *) lfirst(copyStreamCell);
+
+		UnclaimConnection(copyStream->connection);
+	}
+
+	if (completionTag != NULL)
+	{
+		snprintf(completionTag, COMPLETION_TAG_BUFSIZE,
+				 "COPY " UINT64_FORMAT, processedRowCount);
+	}
+}
+
+
+/*
+ * ConstructShardCopyToCommand returns the COPY ... TO STDOUT command for the
+ * given shard, with the column list and options of the original command.
+ */
+static StringInfo
+ConstructShardCopyToCommand(CopyStmt *copyStatement, uint64 shardId)
+{
+	StringInfo command = makeStringInfo();
+	char *schemaName = copyStatement->relation->schemaname;
+	char *shardName = pstrdup(copyStatement->relation->relname);
+
+	AppendShardIdToName(&shardName, shardId);
+
+	appendStringInfo(command, "COPY %s ",
+					 quote_qualified_identifier(schemaName, shardName));
+
+	if (copyStatement->attlist != NIL)
+	{
+		ListCell *columnNameCell = NULL;
+		bool appendedFirstName = false;
+
+		foreach(columnNameCell, copyStatement->attlist)
+		{
+			char *columnName = strVal(lfirst(columnNameCell));
+
+			appendStringInfoString(command, appendedFirstName ? ", " : "(");
+			appendStringInfoString(command, quote_identifier(columnName));
+			appendedFirstName = true;
+		}
+
+		appendStringInfoString(command, ") ");
+	}
+
+	appendStringInfoString(command, "TO STDOUT");
+
+	AppendCopyToOptions(command, copyStatement->options);
+
+	return command;
+}
+
+
+/*
+ * AppendCopyToOptions appends the given options, which CopyToOptionSupported
+ * accepted, to the COPY command.
+ */
+static void
+AppendCopyToOptions(StringInfo command, List *optionList)
+{
+	ListCell *optionCell = NULL;
+	bool appendedFirstOption = false;
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		/* a header is never written by the shard commands */
+		if (strcmp(option->defname, "header") == 0)
+		{
+			continue;
+		}
+
+		appendStringInfoString(command, appendedFirstOption ? ", " : " WITH (");
+		appendedFirstOption = true;
+
+		if (strcmp(option->defname, "force_quote") == 0)
+		{
+			appendStringInfoString(command, "force_quote ");
+
+			if (option->arg != NULL && IsA(option->arg, A_Star))
+			{
+				appendStringInfoString(command, "*");
+			}
+			else
+			{
+				ListCell *columnNameCell = NULL;
+				bool appendedFirstName = false;
+
+				foreach(columnNameCell, (List *) option->arg)
+				{
+					char *columnName = strVal(lfirst(columnNameCell));
+
+					appendStringInfoString(command, appendedFirstName ? ", " : "(");
+					appendStringInfoString(command, quote_identifier(columnName));
+					appendedFirstName = true;
+				}
+
+				appendStringInfoString(command, ")");
+			}
+		}
+		else
+		{
+			appendStringInfo(command, "%s %s", option->defname,
+							 quote_literal_cstr(defGetString(option)));
+		}
+	}
+
+	if (appendedFirstOption)
+	{
+		appendStringInfoString(command, ")");
+	}
+}
+
+
+/*
+ * CopyToColumnCount returns the number of columns in the output of the COPY
+ * command.
+ */
+static int
+CopyToColumnCount(CopyStmt *copyStatement, Oid relationId)
+{
+	Relation relation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	int columnCount = 0;
+	int columnIndex = 0;
+
+	if (copyStatement->attlist != NIL)
+	{
+		return list_length(copyStatement->attlist);
+	}
+
+	relation = heap_open(relationId, AccessShareLock);
+	tupleDescriptor = RelationGetDescr(relation);
+
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		if (!TupleDescAttr(tupleDescriptor, columnIndex)->attisdropped)
+		{
+			columnCount++;
+		}
+	}
+
+	heap_close(relation, NoLock);
+
+	return columnCount;
+}
+
+
+/*
+ * SendCopyOutResponse tells the client that text formatted COPY data with the
+ * given number of columns follows.
+ */
+static void
+SendCopyOutResponse(int columnCount)
+{
+	StringInfoData copyOutResponse = { NULL, 0, 0, 0 };
+	const char copyFormat = 0; /* text copy format */
+	int columnIndex = 0;
+
+	pq_beginmessage(&copyOutResponse, 'H');
+	pq_sendbyte(&copyOutResponse, copyFormat);
+	pq_sendint(&copyOutResponse, columnCount, 2);
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		pq_sendint(&copyOutResponse, copyFormat, 2);
+	}
+	pq_endmessage(&copyOutResponse);
+}
+
+
+/* SendCopyOutDone tells the client that the COPY data is complete. */
+static void
+SendCopyOutDone(void)
+{
+	StringInfoData copyDone = { NULL, 0, 0, 0 };
+
+	pq_beginmessage(&copyDone, 'c');
+	pq_endmessage(&copyDone);
+}
+
+
+/*
+ * ReceiveShardCopyToData passes the rows that arrived on the connection of the
+ * given shard on to the client without waiting for more, and returns whether
+ * any progress was made. Once the worker finished the COPY, its row count is
+ * added to *processedRowCount and the stream is marked as finished.
+ */
+static bool
+ReceiveShardCopyToData(ShardCopyToStream *copyStream, uint64 *processedRowCount)
+{
+	MultiConnection *connection = copyStream->connection;
+	PGconn *pgConn = connection->pgConn;
+	PGresult *result = NULL;
+	bool madeProgress = false;
+
+	if (PQconsumeInput(pgConn) == 0)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	if (!copyStream->copyStarted)
+	{
+		if (PQisBusy(pgConn))
+		{
+			return false;
+		}
+
+		result = PQgetResult(pgConn);
+		if (PQresultStatus(result) != PGRES_COPY_OUT)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+		copyStream->copyStarted = true;
+		madeProgress = true;
+	}
+
+	while (true)
+	{
+		char *receiveBuffer = NULL;
+		const int asynchronous = 1;
+		int receiveLength = PQgetCopyData(pgConn, &receiveBuffer, asynchronous);
+
+		if (receiveLength > 0)
+		{
+			pq_putmessage('d', receiveBuffer, receiveLength);
+			PQfreemem(receiveBuffer);
+
+			madeProgress = true;
+		}
+		else if (receiveLength == 0)
+		{
+			/* no complete row available yet */
+			break;
+		}
+		else if (receiveLength == -1)
+		{
+			bool raiseInterrupts = true;
+			char *rowCountString = NULL;
+
+			result = GetRemoteCommandResult(connection, raiseInterrupts);
+			if (PQresultStatus(result) != PGRES_COMMAND_OK)
+			{
+				ReportResultError(connection, result, ERROR);
+			}
+
+			rowCountString = PQcmdTuples(result);
+			if (rowCountString != NULL && rowCountString[0] != '\0')
+			{
+				*processedRowCount += pg_strtouint64(rowCountString, NULL, 10);
+			}
+
+			PQclear(result);
+			ForgetResults(connection);
+
+			copyStream->copyFinished = true;
+			madeProgress = true;
+			break;
+		}
+		else
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	return madeProgress;
+}
+
+
+/*
+ * WaitForShardCopyToStreams waits until the connection of one of the given
+ * shard copy streams becomes readable.
+ */
+static void
+WaitForShardCopyToStreams(List *copyStreamList)
+{
+	WaitEventSet *waitEventSet = NULL;
+	ListCell *copyStreamCell = NULL;
+	WaitEvent event;
+	int eventCount = 0;
+	long timeout = -1;
+
+	/* make room for the signal latch and postmaster death events */
+	waitEventSet = CreateWaitEventSet(CurrentMemoryContext,
+									  list_length(copyStreamList) + 2);
+
+	foreach(copyStreamCell, copyStreamList)
+	{
+		ShardCopyToStream *copyStream = (ShardCopyToStream *) lfirst(copyStreamCell);
+		int sock = PQsocket(copyStream->connection->pgConn);
+
+		AddWaitEventToSet(waitEventSet, WL_SOCKET_READABLE, sock, NULL, NULL);
+	}
+
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+#if (PG_VERSION_NUM >= 100000)
+	eventCount = WaitEventSetWait(waitEventSet, timeout, &event, 1,
+								  WAIT_EVENT_CLIENT_READ);
+#else
+	eventCount = WaitEventSetWait(waitEventSet, timeout, &event, 1);
+#endif
+
+	FreeWaitEventSet(waitEventSet);
+
+	if (eventCount > 0 && (event.events & WL_POSTMASTER_DEATH))
+	{
+		ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+	}
+
+	if (eventCount > 0 && (event.events & WL_LATCH_SET))
+	{
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+}
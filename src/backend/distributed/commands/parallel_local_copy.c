@@ -0,0 +1,483 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_local_copy.c
+ *   Routines for copying the data of a local table into the shards of the
+ *   distributed table using parallel workers.
+ *
+ * When a table that has data is distributed, the coordinator reads the local
+ * table and sends each row to the placements of its shard. The COPY commands
+ * on the placements already run concurrently, which leaves a single backend
+ * reading, routing and serializing all rows. When citus.parallel_local_copy_
+ * workers is set, parallel workers instead read ranges of blocks of the table,
+ * find the shard of each row, and serialize the row in the format of the COPY.
+ * The leader only passes the serialized rows on to the shard connections,
+ * which remain part of its distributed transaction.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/heapam.h"
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_copy.h"
+#include "distributed/parallel_local_copy.h"
+#include "distributed/shardinterval_utils.h"
+#include "executor/tuptable.h"
+#include "port/atomics.h"
+#include "storage/bufmgr.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+
+/* keys for the entries in the table of contents of the parallel context */
+#define PARALLEL_KEY_LOCAL_COPY_STATE UINT64CONST(1)
+#define PARALLEL_KEY_LOCAL_COPY_QUEUES UINT64CONST(2)
+
+/* size of the queue through which each worker sends rows to the leader */
+#define LOCAL_COPY_QUEUE_SIZE (1024 * 1024)
+
+/* number of blocks a worker reads at a time */
+#define LOCAL_COPY_CHUNK_BLOCKS 64
+
+/* workers send rows to the leader in messages of about this size */
+#define LOCAL_COPY_MESSAGE_SIZE (64 * 1024)
+
+
+/*
+ * ParallelLocalCopyState is the state that the leader shares with the workers.
+ * Workers claim LOCAL_COPY_CHUNK_BLOCKS blocks at a time by advancing
+ * nextBlockNumber, until all blocks of the table are claimed.
+ */
+typedef struct ParallelLocalCopyState
+{
+	Oid relationId;
+	int partitionColumnIndex;
+	bool binary;
+	BlockNumber blockCount;
+	pg_atomic_uint64 nextBlockNumber;
+} ParallelLocalCopyState;
+
+
+/* config variable managed via guc.c */
+int ParallelLocalCopyWorkers = 0;
+
+
+static ParallelContext * CreateLocalCopyParallelContext(int workerCount);
+static uint64 CopySerializedRows(CitusCopyDestReceiver *copyDest, char *messageData,
+								 Size messageSize);
+static bool CopyLocalBlocks(Relation relation, ParallelLocalCopyState *copyState,
+							BlockNumber startBlockNumber, BlockNumber blockCount,
+							CopyOutState copyOutState, FmgrInfo *columnOutputFunctions,
+							shm_mq_handle *queueHandle);
+static bool SendLocalCopyMessage(shm_mq_handle *queueHandle, StringInfo message);
+
+
+/*
+ * ParallelCopyLocalDataIntoShards copies the rows of the given local table into
+ * its shards through the given CitusCopyDestReceiver, which should already be
+ * started, using up to citus.parallel_local_copy_workers parallel workers to
+ * read and serialize the rows. The function returns false without copying any
+ * rows if no workers could be launched, in which case the caller should copy
+ * the rows itself.
+ */
+bool
+ParallelCopyLocalDataIntoShards(Relation distributedRelation,
+								CitusCopyDestReceiver *copyDest, uint64 *rowsCopied)
+{
+	BlockNumber blockCount = RelationGetNumberOfBlocks(distributedRelation);
+	int chunkCount = (blockCount + LOCAL_COPY_CHUNK_BLOCKS - 1) /
+					 LOCAL_COPY_CHUNK_BLOCKS;
+	int workerCount = Min(ParallelLocalCopyWorkers, chunkCount);
+	ParallelContext *parallelContext = NULL;
+	ParallelLocalCopyState *copyState = NULL;
+	char *queueSpace = NULL;
+	shm_mq_handle **queueHandles = NULL;
+	bool *queueDetached = NULL;
+	int activeWorkerCount = 0;
+	int workerIndex = 0;
+
+	Assert(copyDest->serializedRowInput);
+
+	if (workerCount <= 0)
+	{
+		return false;
+	}
+
+	EnterParallelMode();
+
+	parallelContext = CreateLocalCopyParallelContext(workerCount);
+
+	shm_toc_estimate_chunk(&parallelContext->estimator,
+						   sizeof(ParallelLocalCopyState));
+	shm_toc_estimate_chunk(&parallelContext->estimator,
+						   mul_size(LOCAL_COPY_QUEUE_SIZE, workerCount));
+	shm_toc_estimate_keys(&parallelContext->estimator, 2);
+
+	InitializeParallelDSM(parallelContext);
+
+	copyState = shm_toc_allocate(parallelContext->toc, sizeof(ParallelLocalCopyState));
+	copyState->relationId = RelationGetRelid(distributedRelation);
+	copyState->partitionColumnIndex = copyDest->partitionColumnIndex;
+	copyState->binary = copyDest->copyOutState->binary;
+	copyState->blockCount = blockCount;
+	pg_atomic_init_u64(&copyState->nextBlockNumber, 0);
+	shm_toc_insert(parallelContext->toc, PARALLEL_KEY_LOCAL_COPY_STATE, copyState);
+
+	queueSpace = shm_toc_allocate(parallelContext->toc,
+								  mul_size(LOCAL_COPY_QUEUE_SIZE, workerCount));
+	shm_toc_insert(parallelContext->toc, PARALLEL_KEY_LOCAL_COPY_QUEUES, queueSpace);
+
+	queueHandles = palloc0(workerCount * sizeof(shm_mq_handle *));
+	queueDetached = palloc0(workerCount * sizeof(bool));
+
+	for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		shm_mq *queue = shm_mq_create(queueSpace + workerIndex * LOCAL_COPY_QUEUE_SIZE,
+									  LOCAL_COPY_QUEUE_SIZE);
+
+		shm_mq_set_receiver(queue, MyProc);
+		queueHandles[workerIndex] = shm_mq_attach(queue, parallelContext->seg, NULL);
+	}
+
+	LaunchParallelWorkers(parallelContext);
+
+	if (parallelContext->nworkers_launched == 0)
+	{
+		DestroyParallelContext(parallelContext);
+		ExitParallelMode();
+
+		return false;
+	}
+
+	/* find out when workers exit before attaching to their queue */
+	activeWorkerCount = parallelContext->nworkers_launched;
+	for (workerIndex = 0; workerIndex < activeWorkerCount; workerIndex++)
+	{
+		shm_mq_set_handle(queueHandles[workerIndex],
+						  parallelContext->worker[workerIndex].bgwhandle);
+	}
+
+	while (activeWorkerCount > 0)
+	{
+		bool receivedMessage = false;
+
+		for (workerIndex = 0; workerIndex < parallelContext->nworkers_launched;
+			 workerIndex++)
+		{
+			Size messageSize = 0;
+			void *messageData = NULL;
+			shm_mq_result result = SHM_MQ_WOULD_BLOCK;
+
+			if (queueDetached[workerIndex])
+			{
+				continue;
+			}
+
+			result = shm_mq_receive(queueHandles[workerIndex], &messageSize,
+									&messageData, true);
+			if (result == SHM_MQ_SUCCESS)
+			{
+				if (*rowsCopied == 0)
+				{
+					ereport(NOTICE, (errmsg("Copying data from local table...")));
+				}
+
+				*rowsCopied += CopySerializedRows(copyDest, (char *) messageData,
+												  messageSize);
+				receivedMessage = true;
+			}
+			else if (result == SHM_MQ_DETACHED)
+			{
+				/* the worker is done, or it failed and reports an error */
+				queueDetached[workerIndex] = true;
+				activeWorkerCount--;
+			}
+		}
+
+		if (!receivedMessage && activeWorkerCount > 0)
+		{
+			int waitFlags = WL_LATCH_SET | WL_POSTMASTER_DEATH;
+			int rc = 0;
+
+#if (PG_VERSION_NUM >= 100000)
+			rc = WaitLatch(MyLatch, waitFlags, 0, PG_WAIT_IPC);
+#else
+			rc = WaitLatch(MyLatch, waitFlags, 0);
+#endif
+
+			if (rc & WL_POSTMASTER_DEATH)
+			{
+				proc_exit(1);
+			}
+
+			ResetLatch(MyLatch);
+		}
+
+		/* errors of the workers are thrown here */
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	WaitForParallelWorkersToFinish(parallelContext);
+	DestroyParallelContext(parallelContext);
+	ExitParallelMode();
+
+	return true;
+}
+
+
+/*
+ * CreateLocalCopyParallelContext creates a parallel context for the given
+ * number of workers that run ParallelLocalCopyWorkerMain.
+ */
+static ParallelContext *
+CreateLocalCopyParallelContext(int workerCount)
+{
+#if (PG_VERSION_NUM >= 110000)
+	bool serializableOkay = false;
+
+	return CreateParallelContext("citus", "ParallelLocalCopyWorkerMain", workerCount,
+								 serializableOkay);
+#elif (PG_VERSION_NUM >= 100000)
+	return CreateParallelContext("citus", "ParallelLocalCopyWorkerMain", workerCount);
+#else
+	return CreateParallelContextForExternalFunction("citus",
+													"ParallelLocalCopyWorkerMain",
+													workerCount);
+#endif
+}
+
+
+/*
+ * CopySerializedRows passes the rows in a message of a worker on to the shards
+ * they belong to, and returns the number of rows in the message. Each row is
+ * preceded by the index of its shard and its length.
+ */
+static uint64
+CopySerializedRows(CitusCopyDestReceiver *copyDest, char *messageData,
+				   Size messageSize)
+{
+	Size messageOffset = 0;
+	uint64 rowCount = 0;
+
+	while (messageOffset < messageSize)
+	{
+		int32 shardIndex = 0;
+		int32 rowLength = 0;
+
+		memcpy(&shardIndex, messageData + messageOffset, sizeof(int32));
+		messageOffset += sizeof(int32);
+		memcpy(&rowLength, messageData + messageOffset, sizeof(int32));
+		messageOffset += sizeof(int32);
+
+		CitusCopyDestReceiverReceiveSerializedRow(copyDest, shardIndex,
+												  messageData + messageOffset,
+												  rowLength);
+
+		messageOffset += rowLength;
+		rowCount++;
+	}
+
+	return rowCount;
+}
+
+
+/*
+ * ParallelLocalCopyWorkerMain is the entry point of the parallel workers that
+ * read the local table. Each worker claims ranges of blocks of the table, and
+ * sends the rows in them to the leader until all blocks are claimed.
+ */
+void
+ParallelLocalCopyWorkerMain(dsm_segment *segment, shm_toc *toc)
+{
+	ParallelLocalCopyState *copyState = NULL;
+	char *queueSpace = NULL;
+	shm_mq *queue = NULL;
+	shm_mq_handle *queueHandle = NULL;
+	Relation relation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	CopyOutState copyOutState = NULL;
+	FmgrInfo *columnOutputFunctions = NULL;
+
+#if (PG_VERSION_NUM >= 100000)
+	copyState = shm_toc_lookup(toc, PARALLEL_KEY_LOCAL_COPY_STATE, false);
+	queueSpace = shm_toc_lookup(toc, PARALLEL_KEY_LOCAL_COPY_QUEUES, false);
+#else
+	copyState = shm_toc_lookup(toc, PARALLEL_KEY_LOCAL_COPY_STATE);
+	queueSpace = shm_toc_lookup(toc, PARALLEL_KEY_LOCAL_COPY_QUEUES);
+#endif
+
+	queue = (shm_mq *) (queueSpace + ParallelWorkerNumber * LOCAL_COPY_QUEUE_SIZE);
+	shm_mq_set_sender(queue, MyProc);
+	queueHandle = shm_mq_attach(queue, segment, NULL);
+
+	/* the leader holds an ExclusiveLock, which our lock group shares */
+	relation = heap_open(copyState->relationId, AccessShareLock);
+	tupleDescriptor = RelationGetDescr(relation);
+
+	/* serialise rows the same way as the leader would */
+	copyOutState = (CopyOutState) palloc0(sizeof(CopyOutStateData));
+	copyOutState->delim = "\t";
+	copyOutState->null_print = "\\N";
+	copyOutState->null_print_client = "\\N";
+	copyOutState->binary = copyState->binary;
+	copyOutState->fe_msgbuf = makeStringInfo();
+	copyOutState->rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+													 "Parallel Local Copy Row",
+													 ALLOCSET_DEFAULT_SIZES);
+
+	columnOutputFunctions = ColumnOutputFunctions(tupleDescriptor, copyState->binary);
+
+	while (true)
+	{
+		uint64 startBlockNumber = pg_atomic_fetch_add_u64(&copyState->nextBlockNumber,
+														  LOCAL_COPY_CHUNK_BLOCKS);
+		BlockNumber blockCount = 0;
+
+		if (startBlockNumber >= copyState->blockCount)
+		{
+			break;
+		}
+
+		blockCount = Min(LOCAL_COPY_CHUNK_BLOCKS,
+						 copyState->blockCount - startBlockNumber);
+
+		if (!CopyLocalBlocks(relation, copyState, (BlockNumber) startBlockNumber,
+							 blockCount, copyOutState, columnOutputFunctions,
+							 queueHandle))
+		{
+			/* the leader went away, there is no point in reading further */
+			break;
+		}
+	}
+
+	/* send the remaining rows */
+	if (copyOutState->fe_msgbuf->len > 0)
+	{
+		SendLocalCopyMessage(queueHandle, copyOutState->fe_msgbuf);
+	}
+
+	heap_close(relation, AccessShareLock);
+}
+
+
+/*
+ * CopyLocalBlocks serializes the rows in the given range of blocks of the
+ * table, and sends them to the leader. The function returns false if the
+ * leader detached from the queue.
+ */
+static bool
+CopyLocalBlocks(Relation relation, ParallelLocalCopyState *copyState,
+				BlockNumber startBlockNumber, BlockNumber blockCount,
+				CopyOutState copyOutState, FmgrInfo *columnOutputFunctions,
+				shm_mq_handle *queueHandle)
+{
+	Oid relationId = copyState->relationId;
+	int partitionColumnIndex = copyState->partitionColumnIndex;
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+	TupleTableSlot *slot = MakeSingleTupleTableSlot(tupleDescriptor);
+	StringInfo message = copyOutState->fe_msgbuf;
+	HeapScanDesc scan = NULL;
+	HeapTuple tuple = NULL;
+	bool allowStrategy = true;
+	bool allowSyncScan = false;
+	bool leaderAttached = true;
+
+	/* synchronized scans would not respect the scan limits */
+	scan = heap_beginscan_strat(relation, GetActiveSnapshot(), 0, NULL,
+								allowStrategy, allowSyncScan);
+	heap_setscanlimits(scan, startBlockNumber, blockCount);
+
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Datum partitionColumnValue = 0;
+		ShardInterval *shardInterval = NULL;
+		int32 shardIndex = 0;
+		int32 rowLength = 0;
+		int rowLengthOffset = 0;
+		MemoryContext oldContext = MemoryContextSwitchTo(copyOutState->rowcontext);
+
+		ExecStoreTuple(tuple, slot, InvalidBuffer, false);
+		slot_getallattrs(slot);
+
+		if (partitionColumnIndex != INVALID_PARTITION_COLUMN_INDEX)
+		{
+			if (slot->tts_isnull[partitionColumnIndex])
+			{
+				ReportNullPartitionColumn(relationId);
+			}
+
+			partitionColumnValue = slot->tts_values[partitionColumnIndex];
+		}
+
+		shardInterval = FindShardInterval(partitionColumnValue, cacheEntry);
+		if (shardInterval == NULL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+							errmsg("could not find shard for partition column "
+								   "value")));
+		}
+
+		MemoryContextSwitchTo(oldContext);
+
+		/* precede the row with its shard index and length */
+		shardIndex = shardInterval->shardIndex;
+		appendBinaryStringInfo(message, (char *) &shardIndex, sizeof(int32));
+		rowLengthOffset = message->len;
+		appendBinaryStringInfo(message, (char *) &rowLength, sizeof(int32));
+
+		AppendCopyRowData(slot->tts_values, slot->tts_isnull, tupleDescriptor,
+						  copyOutState, columnOutputFunctions, NULL);
+
+		rowLength = message->len - rowLengthOffset - sizeof(int32);
+		memcpy(message->data + rowLengthOffset, &rowLength, sizeof(int32));
+
+		MemoryContextReset(copyOutState->rowcontext);
+
+		if (message->len >= LOCAL_COPY_MESSAGE_SIZE)
+		{
+			leaderAttached = SendLocalCopyMessage(queueHandle, message);
+			if (!leaderAttached)
+			{
+				break;
+			}
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	heap_endscan(scan);
+	ExecDropSingleTupleTableSlot(slot);
+
+	return leaderAttached;
+}
+
+
+/*
+ * SendLocalCopyMessage sends the given rows to the leader, waiting for space in
+ * the queue if necessary, and empties the message. It returns false if the
+ * leader detached from the queue.
+ */
+static bool
+SendLocalCopyMessage(shm_mq_handle *queueHandle, StringInfo message)
+{
+	bool noWait = false;
+	shm_mq_result result = shm_mq_send(queueHandle, message->len, message->data,
+									   noWait);
+
+	resetStringInfo(message);
+
+	return result != SHM_MQ_DETACHED;
+}
@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "distributed/job_cache_usage.h"
 #include "distributed/relay_utility.h"
 #include "distributed/transmit.h"
 #include "distributed/worker_protocol.h"
@@ -25,11 +26,9 @@
 
 
 /* Local functions forward declarations */
-static void SendCopyInStart(void);
 static void SendCopyOutStart(void);
 static void SendCopyDone(void);
-static void SendCopyData(StringInfo fileBuffer);
-static bool ReceiveCopyData(StringInfo copyData);
+static void SendCopyData(const char *data, int length);
 
 
 /*
@@ -45,6 +44,7 @@ RedirectCopyDataToRegularFile(const char *filename)
 	File fileDesc = -1;
 	const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
 	const int fileMode = (S_IRUSR | S_IWUSR);
+	bool jobCacheFile = CacheDirectoryElement(filename);
 
 	fileDesc = FileOpenForTransmit(filename, fileFlags, fileMode);
 
@@ -56,11 +56,17 @@ RedirectCopyDataToRegularFile(const char *filename)
 		/* if received data has contents, append to regular file */
 		if (copyData->len > 0)
 		{
+			int appended = 0;
+
+			if (jobCacheFile)
+			{
+				ReserveJobCacheSpace(copyData->len);
+			}
+
 #if (PG_VERSION_NUM >= 100000)
-			int appended = FileWrite(fileDesc, copyData->data, copyData->len,
-									 PG_WAIT_IO);
+			appended = FileWrite(fileDesc, copyData->data, copyData->len, PG_WAIT_IO);
 #else
-			int appended = FileWrite(fileDesc, copyData->data, copyData->len);
+			appended = FileWrite(fileDesc, copyData->data, copyData->len);
 #endif
 
 			if (appended != copyData->len)
@@ -88,48 +94,56 @@ void
 SendRegularFile(const char *filename)
 {
 	File fileDesc = -1;
-	StringInfo fileBuffer = NULL;
+	char *fileBuffer = NULL;
 	int readBytes = -1;
-	const uint32 fileBufferSize = 32768; /* 32 KB */
 	const int fileFlags = (O_RDONLY | PG_BINARY);
 	const int fileMode = 0;
 
 	/* we currently do not check if the caller has permissions for this file */
 	fileDesc = FileOpenForTransmit(filename, fileFlags, fileMode);
 
+#if defined(USE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+
+	/* the file is read once from start to end, let the kernel read ahead */
+	(void) posix_fadvise(FileGetRawDesc(fileDesc), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
 	/*
-	 * We read file's contents into buffers of 32 KB. This buffer size is twice
-	 * as large as Hadoop's default buffer size, and may later be configurable.
+	 * We read the file's contents into a large buffer and send each chunk as
+	 * a single CopyData message straight from that buffer. Large messages
+	 * mean fewer read and write calls on both nodes, since the receiving node
+	 * appends each message to its file with a single write.
 	 */
-	fileBuffer = makeStringInfo();
-	enlargeStringInfo(fileBuffer, fileBufferSize);
+	fileBuffer = palloc(TRANSMIT_BUFFER_SIZE);
 
 	SendCopyOutStart();
 
 #if (PG_VERSION_NUM >= 100000)
-	readBytes = FileRead(fileDesc, fileBuffer->data, fileBufferSize, PG_WAIT_IO);
+	readBytes = FileRead(fileDesc, fileBuffer, TRANSMIT_BUFFER_SIZE, PG_WAIT_IO);
 #else
-	readBytes = FileRead(fileDesc, fileBuffer->data, fileBufferSize);
+	readBytes = FileRead(fileDesc, fileBuffer, TRANSMIT_BUFFER_SIZE);
 #endif
 
 	while (readBytes > 0)
 	{
-		fileBuffer->len = readBytes;
+		SendCopyData(fileBuffer, readBytes);
 
-		SendCopyData(fileBuffer);
-
-		resetStringInfo(fileBuffer);
 #if (PG_VERSION_NUM >= 100000)
-		readBytes = FileRead(fileDesc, fileBuffer->data, fileBufferSize,
-							 PG_WAIT_IO);
+		readBytes = FileRead(fileDesc, fileBuffer, TRANSMIT_BUFFER_SIZE, PG_WAIT_IO);
 #else
-		readBytes = FileRead(fileDesc, fileBuffer->data, fileBufferSize);
+		readBytes = FileRead(fileDesc, fileBuffer, TRANSMIT_BUFFER_SIZE);
 #endif
 	}
 
+	if (readBytes < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read file \"%s\": %m", filename)));
+	}
+
 	SendCopyDone();
 
-	FreeStringInfo(fileBuffer);
+	pfree(fileBuffer);
 	FileClose(fileDesc);
 }
 
@@ -182,7 +196,7 @@ FileOpenForTransmit(const char *filename, int fileFlags, int fileMode)
  * SendCopyInStart sends the start copy in message to initiate receiving data
  * from stdin. The frontend should now send copy data.
  */
-static void
+void
 SendCopyInStart(void)
 {
 	StringInfoData copyInStart = { NULL, 0, 0, 0 };
@@ -239,15 +253,14 @@ SendCopyDone(void)
 }
 
 
-/* Sends the copy data message to stdout. */
+/*
+ * Sends the copy data message to stdout. The data is passed to the frontend
+ * buffer directly instead of being copied into a message buffer first.
+ */
 static void
-SendCopyData(StringInfo fileBuffer)
+SendCopyData(const char *data, int length)
 {
-	StringInfoData copyData = { NULL, 0, 0, 0 };
-
-	pq_beginmessage(&copyData, 'd');
-	pq_sendbytes(&copyData, fileBuffer->data, fileBuffer->len);
-	pq_endmessage(&copyData);
+	pq_putmessage('d', data, length);
 }
 
 
@@ -259,7 +272,7 @@ SendCopyData(StringInfo fileBuffer)
  * If the received message does not conform to the copy protocol, the function
  * mirrors copy.c's error behavior.
  */
-static bool
+bool
 ReceiveCopyData(StringInfo copyData)
 {
 	int messageType = 0;
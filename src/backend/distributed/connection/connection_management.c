@@ -18,20 +18,31 @@
 #include "libpq-fe.h"
 
 #include "miscadmin.h"
+#include "pgstat.h"
 
 #include "access/hash.h"
 #include "commands/dbcommands.h"
 #include "distributed/connection_management.h"
+#include "distributed/connection_wait_stats.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/node_health.h"
 #include "distributed/hash_helpers.h"
 #include "distributed/placement_connection.h"
+#include "distributed/query_trace.h"
+#include "distributed/remote_commands.h"
+#include "distributed/shared_connection_stats.h"
 #include "mb/pg_wchar.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 
 
 int NodeConnectionTimeout = 5000;
 int CitusSSLMode = CITUS_SSL_MODE_PREFER;
+bool EnableConnectionPrewarming = false;
+int NodeConnectionKeepaliveInterval = 0; /* in seconds, 0 for the libpq default */
 HTAB *ConnectionHash = NULL;
 MemoryContext ConnectionContext = NULL;
 
@@ -39,8 +50,25 @@ MemoryContext ConnectionContext = NULL;
 static uint32 ConnectionHashHash(const void *key, Size keysize);
 static int ConnectionHashCompare(const void *a, const void *b, Size keysize);
 static MultiConnection * StartConnectionEstablishment(ConnectionHashKey *key);
+static void WaitForConnectionEstablishment(MultiConnection *connection);
 static void AfterXactHostConnectionHandling(ConnectionHashEntry *entry, bool isCommit);
 static MultiConnection * FindAvailableConnection(dlist_head *connections, uint32 flags);
+static bool ReserveSharedConnection(uint32 flags, const char *hostname, int32 port);
+static bool BackendHasConnectionToNode(const char *hostname, int32 port);
+static void ReleaseSharedConnection(MultiConnection *connection);
+static void ReleaseSharedConnectionsOnExit(int code, Datum arg);
+static void AdvancePrewarmingConnections(void);
+static void StopPrewarmingConnection(MultiConnection *connection);
+
+
+/* whether ReleaseSharedConnectionsOnExit is registered in this backend */
+static bool SharedConnectionExitCallbackRegistered = false;
+
+/* whether this backend started prewarming its connections to the workers */
+static bool ConnectionsPrewarmed = false;
+
+/* number of connections that are still being established by prewarming */
+static int PrewarmingConnectionCount = 0;
 
 
 /*
@@ -155,7 +183,14 @@ GetNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port, co
  * following flags influence connection establishment behaviour:
  * - SESSION_LIFESPAN - the connection should persist after transaction end
  * - FORCE_NEW_CONNECTION - a new connection is required
+ * - OPTIONAL_CONNECTION - return NULL rather than waiting when the shared
+ *   connection limit of the node is reached
+ * - IGNORE_NODE_HEALTH - attempt the connection even if the node is known to
+ *   be unreachable
  *
+ * When citus.max_shared_pool_size is set, opening a new connection requires
+ * a slot in the node's shared connection counter. If none is available, we
+ * wait for another backend to close one of its connections to the node.
  * The returned connection has only been initiated, not fully
  * established. That's useful to allow parallel connection establishment. If
  * that's not desired use the Get* variant.
@@ -168,6 +203,7 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 	ConnectionHashEntry *entry = NULL;
 	MultiConnection *connection;
 	bool found;
+	bool counterIncremented = false;
 
 	/* do some minimal input checks */
 	strlcpy(key.hostname, hostname, MAX_NODE_LENGTH);
@@ -201,6 +237,12 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 		CurrentCoordinatedTransactionState = COORD_TRANS_IDLE;
 	}
 
+	/* make progress on prewarming connections, they may be among the cached ones */
+	if (PrewarmingConnectionCount > 0)
+	{
+		AdvancePrewarmingConnections();
+	}
+
 	/*
 	 * Lookup relevant hash entry. We always enter. If only a cached
 	 * connection is desired, and there's none, we'll simply leave the
@@ -227,15 +269,54 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 				connection->sessionLifespan = true;
 			}
 
+			RecordQueryTraceNodeEvent(QUERY_TRACE_CONNECTION_ACQUIRED,
+									  connection->hostname, connection->port, 0);
+
 			return connection;
 		}
 	}
 
+	/*
+	 * A connection attempt to a node that recently failed to connect would
+	 * likely time out as well, so we return a failed connection right away.
+	 */
+	if (!(flags & IGNORE_NODE_HEALTH) && NodeIsKnownUnreachable(hostname, port))
+	{
+		connection = MemoryContextAllocZero(ConnectionContext, sizeof(MultiConnection));
+
+		strlcpy(connection->hostname, key.hostname, MAX_NODE_LENGTH);
+		connection->port = key.port;
+		strlcpy(connection->database, key.database, NAMEDATALEN);
+		strlcpy(connection->user, key.user, NAMEDATALEN);
+
+		connection->pgConn = NULL;
+		connection->connectionStart = GetCurrentTimestamp();
+		connection->unreachableNodeSkipped = true;
+
+		dlist_push_tail(entry->connections, &connection->connectionNode);
+		ResetShardPlacementAssociation(connection);
+
+		return connection;
+	}
+
 	/*
 	 * Either no caching desired, or no pre-established, non-claimed,
-	 * connection present. Initiate connection establishment.
+	 * connection present. Initiate connection establishment, once the
+	 * shared connection limit allows for another connection.
 	 */
+	if (SharedConnectionLimitEnabled())
+	{
+		if (!ReserveSharedConnection(flags, hostname, port))
+		{
+			/* optional connection, and the node has no slots left */
+			return NULL;
+		}
+
+		counterIncremented = true;
+	}
+
 	connection = StartConnectionEstablishment(&key);
+	connection->sharedConnectionCounterIncremented = counterIncremented;
 
 	dlist_push_tail(entry->connections, &connection->connectionNode);
 	ResetShardPlacementAssociation(connection);
@@ -266,6 +347,12 @@ FindAvailableConnection(dlist_head *connections, uint32 flags)
 			continue;
 		}
 
+		/* the caller finishes establishing the connection from here on */
+		if (connection->prewarming)
+		{
+			StopPrewarmingConnection(connection);
+		}
+
 		return connection;
 	}
 
@@ -273,6 +360,108 @@ FindAvailableConnection(dlist_head *connections, uint32 flags)
 }
 
 
+/*
+ * ReserveSharedConnection reserves a slot in the shared connection counter of
+ * the given node for a new connection, and returns whether it did. Optional
+ * connections only get a slot if one is available. Other connections wait
+ * for a slot, unless this backend already holds a connection to the node;
+ * in that case other backends may be waiting for this backend to release it,
+ * so we exceed the limit rather than waiting for ourselves.
+ */
+static bool
+ReserveSharedConnection(uint32 flags, const char *hostname, int32 port)
+{
+	/* make sure slots are released even if the backend exits unexpectedly */
+	if (!SharedConnectionExitCallbackRegistered)
+	{
+		before_shmem_exit(ReleaseSharedConnectionsOnExit, (Datum) 0);
+		SharedConnectionExitCallbackRegistered = true;
+	}
+
+	if (flags & OPTIONAL_CONNECTION)
+	{
+		return TryToIncrementSharedConnectionCounter(hostname, port);
+	}
+	else if (BackendHasConnectionToNode(hostname, port))
+	{
+		IncrementSharedConnectionCounter(hostname, port);
+	}
+	else
+	{
+		WaitLoopForSharedConnection(hostname, port);
+	}
+
+	return true;
+}
+
+
+/*
+ * BackendHasConnectionToNode returns whether this backend holds a connection
+ * to the given node, for any user and database.
+ */
+static bool
+BackendHasConnectionToNode(const char *hostname, int32 port)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry = NULL;
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		if (strncmp(entry->key.hostname, hostname, MAX_NODE_LENGTH) == 0 &&
+			entry->key.port == port && !dlist_is_empty(entry->connections))
+		{
+			hash_seq_term(&status);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ReleaseSharedConnection releases the slot that the connection holds in the
+ * shared connection counter of its node, if any.
+ */
+static void
+ReleaseSharedConnection(MultiConnection *connection)
+{
+	if (connection->sharedConnectionCounterIncremented)
+	{
+		DecrementSharedConnectionCounter(connection->hostname, connection->port);
+		connection->sharedConnectionCounterIncremented = false;
+	}
+}
+
+
+/*
+ * ReleaseSharedConnectionsOnExit releases the shared connection slots of all
+ * connections of the exiting backend, since AfterXactConnectionHandling is
+ * not called when a backend exits in the middle of a transaction.
+ */
+static void
+ReleaseSharedConnectionsOnExit(int code, Datum arg)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry = NULL;
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			ReleaseSharedConnection(connection);
+		}
+	}
+}
+
+
 /*
  * CloseNodeConnectionsAfterTransaction sets the sessionLifespan flag of the connections
  * to a particular node as false. This is mainly used when a worker leaves the cluster.
@@ -306,6 +495,32 @@ CloseNodeConnectionsAfterTransaction(char *nodeName, int nodePort)
 }
 
 
+/*
+ * CloseAllConnections closes all connections of the backend. It must only be
+ * called between transactions, when none of the connections is in use.
+ */
+void
+CloseAllConnections(void)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry;
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_mutable_iter iter;
+
+		dlist_foreach_modify(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			CloseConnection(connection);
+		}
+	}
+}
+
+
 /*
  * Close a previously established connection.
  */
@@ -335,6 +550,11 @@ CloseConnection(MultiConnection *connection)
 		CloseRemoteTransaction(connection);
 		CloseShardPlacementAssociation(connection);
 
+		/* allow other backends to open a connection to the node */
+		ReleaseSharedConnection(connection);
+
+		ResetPreparedStatements(connection);
+
 		/* we leave the per-host entry alive */
 		pfree(connection);
 	}
@@ -379,6 +599,185 @@ ShutdownConnection(MultiConnection *connection)
 }
 
 
+/*
+ * PrewarmNodeConnections starts establishing session lifespan connections to
+ * all readable worker nodes on the first distributed query of a backend when
+ * citus.prewarm_connections is enabled, and makes progress on the ones that
+ * are still being established on later calls.
+ *
+ * The connections are established in the background: we do not wait for
+ * them, but advance them whenever their sockets are ready, such that a node
+ * that does not respond does not slow down queries that do not need it. A
+ * query that needs a connection to a node picks up the prewarmed connection
+ * from the connection cache and finishes establishing it, if that has not
+ * happened yet. Subsequent queries on the backend thereby skip the TCP, SSL
+ * and authentication round trips of each first access to a node, which is
+ * what short queries on fresh backends, e.g. after a pooler reconnects, spend
+ * most of their time on.
+ */
+void
+PrewarmNodeConnections(void)
+{
+	List *workerNodeList = NIL;
+	ListCell *workerNodeCell = NULL;
+
+	if (PrewarmingConnectionCount > 0)
+	{
+		AdvancePrewarmingConnections();
+	}
+
+	if (!EnableConnectionPrewarming || ConnectionsPrewarmed)
+	{
+		return;
+	}
+
+	ConnectionsPrewarmed = true;
+
+	workerNodeList = ActiveReadableNodeList();
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		uint32 connectionFlags = SESSION_LIFESPAN | OPTIONAL_CONNECTION;
+		MultiConnection *connection = NULL;
+
+		connection = StartNodeConnection(connectionFlags, workerNode->workerName,
+										 workerNode->workerPort);
+		if (connection == NULL || connection->pgConn == NULL ||
+			PQstatus(connection->pgConn) != CONNECTION_STARTED)
+		{
+			/* cached, skipped, or failed right away */
+			continue;
+		}
+
+		connection->prewarming = true;
+		connection->prewarmPollMode = PGRES_POLLING_WRITING;
+		PrewarmingConnectionCount++;
+	}
+
+	if (PrewarmingConnectionCount > 0)
+	{
+		AdvancePrewarmingConnections();
+	}
+}
+
+
+/*
+ * AdvancePrewarmingConnections calls PQconnectPoll for the prewarming
+ * connections whose sockets are ready, without waiting for the others.
+ */
+static void
+AdvancePrewarmingConnections(void)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry = NULL;
+	WaitEventSet *waitEventSet = NULL;
+	WaitEvent *events = NULL;
+	int eventCount = 0;
+	int eventIndex = 0;
+	int socketCount = 0;
+
+	waitEventSet = CreateWaitEventSet(CurrentMemoryContext, PrewarmingConnectionCount);
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+			int socket = -1;
+			uint32 eventMask = 0;
+
+			if (!connection->prewarming)
+			{
+				continue;
+			}
+
+			socket = PQsocket(connection->pgConn);
+			if (PQstatus(connection->pgConn) == CONNECTION_BAD || socket < 0 ||
+				socketCount == PrewarmingConnectionCount)
+			{
+				RecordConnectionEstablishmentResult(connection);
+				StopPrewarmingConnection(connection);
+				continue;
+			}
+
+			if (connection->prewarmPollMode == PGRES_POLLING_READING)
+			{
+				eventMask = WL_SOCKET_READABLE;
+			}
+			else
+			{
+				eventMask = WL_SOCKET_WRITEABLE;
+			}
+
+			AddWaitEventToSet(waitEventSet, eventMask, socket, NULL, connection);
+			socketCount++;
+		}
+	}
+
+	if (socketCount == 0)
+	{
+		FreeWaitEventSet(waitEventSet);
+		return;
+	}
+
+	events = palloc0(socketCount * sizeof(WaitEvent));
+
+	/* only check which sockets are ready, do not wait */
+#if (PG_VERSION_NUM >= 100000)
+	eventCount = WaitEventSetWait(waitEventSet, 0, events, socketCount,
+								  WAIT_EVENT_CLIENT_READ);
+#else
+	eventCount = WaitEventSetWait(waitEventSet, 0, events, socketCount);
+#endif
+
+	for (eventIndex = 0; eventIndex < eventCount; eventIndex++)
+	{
+		MultiConnection *connection = (MultiConnection *) events[eventIndex].user_data;
+		PostgresPollingStatusType pollMode = PQconnectPoll(connection->pgConn);
+
+		if (pollMode == PGRES_POLLING_OK)
+		{
+			RecordConnectionEstablished(connection);
+			RecordConnectionEstablishmentResult(connection);
+			StopPrewarmingConnection(connection);
+		}
+		else if (pollMode == PGRES_POLLING_FAILED)
+		{
+			RecordConnectionEstablishmentResult(connection);
+			StopPrewarmingConnection(connection);
+		}
+		else
+		{
+			connection->prewarmPollMode = pollMode;
+		}
+	}
+
+	FreeWaitEventSet(waitEventSet);
+	pfree(events);
+}
+
+
+/*
+ * StopPrewarmingConnection marks the given connection as no longer being
+ * established in the background.
+ */
+static void
+StopPrewarmingConnection(MultiConnection *connection)
+{
+	connection->prewarming = false;
+
+	if (PrewarmingConnectionCount > 0)
+	{
+		PrewarmingConnectionCount--;
+	}
+}
+
+
 /*
  * FinishConnectionListEstablishment is a wrapper around FinishConnectionEstablishment.
  * The function iterates over the multiConnectionList and finishes the connection
@@ -402,11 +801,35 @@ FinishConnectionListEstablishment(List *multiConnectionList)
 
 /*
  * Synchronously finish connection establishment of an individual connection.
+ * While waiting, the backend shows up in citus_stat_worker_waits.
  *
  * TODO: Replace with variant waiting for multiple connections.
  */
 void
 FinishConnectionEstablishment(MultiConnection *connection)
+{
+	if (PQstatus(connection->pgConn) != CONNECTION_OK)
+	{
+		ConnectionWaitStart(connection, CONNECTION_WAIT_CONNECT);
+		WaitForConnectionEstablishment(connection);
+		ConnectionWaitEnd();
+	}
+
+	if (connection->pgConn != NULL && PQstatus(connection->pgConn) == CONNECTION_OK)
+	{
+		RecordConnectionEstablished(connection);
+	}
+
+	RecordConnectionEstablishmentResult(connection);
+}
+
+
+/*
+ * WaitForConnectionEstablishment polls the given connection until it is
+ * established, failed, or timed out.
+ */
+static void
+WaitForConnectionEstablishment(MultiConnection *connection)
 {
 	static int checkIntervalMS = 200;
 
@@ -474,7 +897,13 @@ FinishConnectionEstablishment(MultiConnection *connection)
 			 * interrupts in time, even if the platform doesn't interrupt
 			 * poll() after signal arrival.
 			 */
+#if (PG_VERSION_NUM >= 100000)
+			pgstat_report_wait_start(PG_WAIT_EXTENSION);
+#endif
 			pollResult = poll(&pollFileDescriptor, 1, checkIntervalMS);
+#if (PG_VERSION_NUM >= 100000)
+			pgstat_report_wait_end();
+#endif
 #else /* !HAVE_POLL */
 			fd_set readFileDescriptorSet;
 			fd_set writeFileDescriptorSet;
@@ -496,9 +925,15 @@ FinishConnectionEstablishment(MultiConnection *connection)
 				FD_SET(selectFileDescriptor, &writeFileDescriptorSet);
 			}
 
+#if (PG_VERSION_NUM >= 100000)
+			pgstat_report_wait_start(PG_WAIT_EXTENSION);
+#endif
 			pollResult = (select) (selectFileDescriptor + 1, &readFileDescriptorSet,
 								   &writeFileDescriptorSet, &exceptionFileDescriptorSet,
 								   &selectTimeout);
+#if (PG_VERSION_NUM >= 100000)
+			pgstat_report_wait_end();
+#endif
 #endif /* HAVE_POLL */
 
 			if (pollResult == 0)
@@ -633,19 +1068,37 @@ StartConnectionEstablishment(ConnectionHashKey *key)
 	MultiConnection *connection = NULL;
 	const char *sslmode = CitusSSLModeString();
 
+	char keepaliveString[12];
+
+	/* the trailing slots are filled in below when keepalives are configured */
 	const char *keywords[] = {
 		"host", "port", "dbname", "user", "sslmode",
 		"client_encoding", "fallback_application_name",
-		NULL
+		NULL, NULL, NULL
 	};
 	const char *values[] = {
 		key->hostname, nodePortString, key->database, key->user, sslmode,
-		clientEncoding, "citus", NULL
+		clientEncoding, "citus", NULL, NULL, NULL
 	};
 
 	connection = MemoryContextAllocZero(ConnectionContext, sizeof(MultiConnection));
 	sprintf(nodePortString, "%d", key->port);
 
+	/*
+	 * Send TCP keepalives on idle connections, such that session lifespan
+	 * connections are not dropped by firewalls and NATs between queries, and
+	 * dead peers are detected.
+	 */
+	if (NodeConnectionKeepaliveInterval > 0)
+	{
+		sprintf(keepaliveString, "%d", NodeConnectionKeepaliveInterval);
+
+		keywords[7] = "keepalives_idle";
+		values[7] = keepaliveString;
+		keywords[8] = "keepalives_interval";
+		values[8] = keepaliveString;
+	}
+
 	strlcpy(connection->hostname, key->hostname, MAX_NODE_LENGTH);
 	connection->port = key->port;
 	strlcpy(connection->database, key->database, NAMEDATALEN);
@@ -738,17 +1191,32 @@ AfterXactHostConnectionHandling(ConnectionHashEntry *entry, bool isCommit)
 		}
 
 		/*
-		 * Preserve session lifespan connections if they are still healthy.
+		 * Preserve session lifespan connections if they are still healthy,
+		 * or still being established by prewarming.
 		 */
+		if (connection->prewarming && connection->sessionLifespan &&
+			PQstatus(connection->pgConn) != CONNECTION_BAD)
+		{
+			continue;
+		}
+
 		if (!connection->sessionLifespan ||
 			PQstatus(connection->pgConn) != CONNECTION_OK ||
 			PQtransactionStatus(connection->pgConn) != PQTRANS_IDLE)
 		{
+			if (connection->prewarming)
+			{
+				StopPrewarmingConnection(connection);
+			}
+
 			ShutdownConnection(connection);
 
 			/* unlink from list */
 			dlist_delete(iter.cur);
 
+			ReleaseSharedConnection(connection);
+			ResetPreparedStatements(connection);
+
 			pfree(connection);
 		}
 		else
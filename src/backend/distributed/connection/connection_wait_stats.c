@@ -0,0 +1,684 @@
+/*-------------------------------------------------------------------------
+ *
+ * connection_wait_stats.c
+ *   Tracks on which worker node each backend is waiting, and keeps
+ *   histograms of how long connection establishment, sending queries,
+ *   waiting for results and flushing COPY data take for each worker node.
+ *
+ *   The wait events that PostgreSQL reports in pg_stat_activity cannot be
+ *   tied to a worker node, so each backend additionally publishes the node
+ *   and kind of its current wait in a shared array, which can be joined with
+ *   pg_stat_activity through citus_stat_worker_waits. Slow connection setup
+ *   or connect storms show up in the latency histograms of the nodes, which
+ *   are kept in a shared hash.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/hash.h"
+#include "distributed/connection_wait_stats.h"
+#include "distributed/hash_helpers.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/query_trace.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/tuplestore.h"
+
+
+/*
+ * Number of buckets in a latency histogram. Bucket i counts the waits that
+ * took less than 2^i milliseconds, except for the last bucket, which counts
+ * all longer waits.
+ */
+#define LATENCY_HISTOGRAM_BUCKET_COUNT 16
+
+
+/*
+ * ConnectionWaitStatsControlData is the header of the shared memory segment,
+ * holding the lock that protects the hash of latency histograms.
+ */
+typedef struct ConnectionWaitStatsControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+} ConnectionWaitStatsControlData;
+
+
+/* current wait of a backend on a worker node */
+typedef struct BackendConnectionWait
+{
+	slock_t mutex;
+	int pid;
+	ConnectionWaitEvent waitEvent;
+	char hostname[MAX_NODE_LENGTH];
+	int32 port;
+	TimestampTz waitStart;
+} BackendConnectionWait;
+
+
+/* hash key of the latency histograms */
+typedef struct ConnectionLatencyHashKey
+{
+	char hostname[MAX_NODE_LENGTH];
+	int32 port;
+} ConnectionLatencyHashKey;
+
+
+/* hash entry holding the latency histograms of a worker node */
+typedef struct ConnectionLatencyHashEntry
+{
+	ConnectionLatencyHashKey key;
+
+	/* protects the counters, the entry itself is protected by the lock */
+	slock_t mutex;
+
+	uint64 histogram[CONNECTION_WAIT_EVENT_COUNT][LATENCY_HISTOGRAM_BUCKET_COUNT];
+} ConnectionLatencyHashEntry;
+
+
+/* names of the wait events as shown by the UDFs */
+static const char *ConnectionWaitEventNames[] = {
+	"None", "Connect", "Send", "Result", "CopyFlush"
+};
+
+
+/* config variable to enable the tracking */
+bool TrackConnectionLatency = true;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ConnectionWaitStatsControlData *ConnectionWaitStatsControl = NULL;
+
+/* array of the current waits, indexed by pgprocno */
+static BackendConnectionWait *BackendConnectionWaitArray = NULL;
+
+/* hash of (hostname, port) -> latency histograms */
+static HTAB *ConnectionLatencyHash = NULL;
+
+
+static size_t ConnectionWaitStatsShmemSize(void);
+static void ConnectionWaitStatsShmemInit(void);
+static BackendConnectionWait * MyBackendConnectionWait(void);
+static int LatencyHistogramBucket(double latencyMillis);
+static uint32 ConnectionLatencyHashHash(const void *key, Size keysize);
+static int ConnectionLatencyHashCompare(const void *a, const void *b, Size keysize);
+static Tuplestorestate * SetupReturnTupleStore(FunctionCallInfo fcinfo,
+											   TupleDesc *tupleDescriptor);
+
+
+PG_FUNCTION_INFO_V1(citus_worker_wait_events);
+PG_FUNCTION_INFO_V1(citus_worker_latency_histogram);
+PG_FUNCTION_INFO_V1(citus_worker_latency_histogram_reset);
+
+
+/*
+ * citus_worker_wait_events returns the worker node on which each backend of
+ * this node is currently waiting, along with the kind of wait and when it
+ * started.
+ */
+Datum
+citus_worker_wait_events(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	int backendIndex = 0;
+
+	Datum values[5];
+	bool isNulls[5];
+
+	CheckCitusVersion(ERROR);
+
+	tupleStore = SetupReturnTupleStore(fcinfo, &tupleDescriptor);
+
+	for (backendIndex = 0; backendIndex < MaxBackends; backendIndex++)
+	{
+		BackendConnectionWait *backendWait = &BackendConnectionWaitArray[backendIndex];
+		BackendConnectionWait currentWait;
+
+		SpinLockAcquire(&backendWait->mutex);
+		memcpy(&currentWait, backendWait, sizeof(BackendConnectionWait));
+		SpinLockRelease(&backendWait->mutex);
+
+		if (currentWait.waitEvent == CONNECTION_WAIT_NONE)
+		{
+			continue;
+		}
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int32GetDatum(currentWait.pid);
+		values[1] = PointerGetDatum(cstring_to_text(currentWait.hostname));
+		values[2] = Int32GetDatum(currentWait.port);
+		values[3] = PointerGetDatum(
+			cstring_to_text(ConnectionWaitEventNames[currentWait.waitEvent]));
+		values[4] = TimestampTzGetDatum(currentWait.waitStart);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+	}
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * citus_worker_latency_histogram returns the non-empty buckets of the latency
+ * histograms of each worker node and kind of wait. The upper bound of the
+ * bucket for the longest waits is NULL.
+ */
+Datum
+citus_worker_latency_histogram(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	HASH_SEQ_STATUS status;
+	ConnectionLatencyHashEntry *latencyEntry = NULL;
+
+	Datum values[5];
+	bool isNulls[5];
+
+	CheckCitusVersion(ERROR);
+
+	tupleStore = SetupReturnTupleStore(fcinfo, &tupleDescriptor);
+
+	LWLockAcquire(&ConnectionWaitStatsControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, ConnectionLatencyHash);
+	latencyEntry = (ConnectionLatencyHashEntry *) hash_seq_search(&status);
+	while (latencyEntry != NULL)
+	{
+		uint64 histogram[CONNECTION_WAIT_EVENT_COUNT][LATENCY_HISTOGRAM_BUCKET_COUNT];
+		int waitEvent = 0;
+
+		SpinLockAcquire(&latencyEntry->mutex);
+		memcpy(histogram, latencyEntry->histogram, sizeof(histogram));
+		SpinLockRelease(&latencyEntry->mutex);
+
+		for (waitEvent = CONNECTION_WAIT_CONNECT; waitEvent < CONNECTION_WAIT_EVENT_COUNT;
+			 waitEvent++)
+		{
+			int bucketIndex = 0;
+
+			for (bucketIndex = 0; bucketIndex < LATENCY_HISTOGRAM_BUCKET_COUNT;
+				 bucketIndex++)
+			{
+				uint64 waitCount = histogram[waitEvent][bucketIndex];
+
+				if (waitCount == 0)
+				{
+					continue;
+				}
+
+				memset(values, 0, sizeof(values));
+				memset(isNulls, false, sizeof(isNulls));
+
+				values[0] = PointerGetDatum(cstring_to_text(latencyEntry->key.hostname));
+				values[1] = Int32GetDatum(latencyEntry->key.port);
+				values[2] = PointerGetDatum(
+					cstring_to_text(ConnectionWaitEventNames[waitEvent]));
+
+				if (bucketIndex < LATENCY_HISTOGRAM_BUCKET_COUNT - 1)
+				{
+					values[3] = Float8GetDatum((double) (1 << bucketIndex));
+				}
+				else
+				{
+					isNulls[3] = true;
+				}
+
+				values[4] = Int64GetDatum(waitCount);
+
+				tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+			}
+		}
+
+		latencyEntry = (ConnectionLatencyHashEntry *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&ConnectionWaitStatsControl->lock);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * citus_worker_latency_histogram_reset discards the latency histograms of
+ * all worker nodes.
+ */
+Datum
+citus_worker_latency_histogram_reset(PG_FUNCTION_ARGS)
+{
+	CheckCitusVersion(ERROR);
+
+	LWLockAcquire(&ConnectionWaitStatsControl->lock, LW_EXCLUSIVE);
+	hash_delete_all(ConnectionLatencyHash);
+	LWLockRelease(&ConnectionWaitStatsControl->lock);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * SetupReturnTupleStore checks whether the caller of the given set-returning
+ * function accepts a tuple store, and sets up the tuple store in which the
+ * function returns its result.
+ */
+static Tuplestorestate *
+SetupReturnTupleStore(FunctionCallInfo fcinfo, TupleDesc *tupleDescriptor)
+{
+	ReturnSetInfo *returnSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext perQueryContext = NULL;
+	MemoryContext oldContext = NULL;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (returnSetInfo == NULL || !IsA(returnSetInfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context " \
+						"that cannot accept a set")));
+	}
+
+	if (!(returnSetInfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+	}
+
+	/* build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	perQueryContext = returnSetInfo->econtext->ecxt_per_query_memory;
+
+	oldContext = MemoryContextSwitchTo(perQueryContext);
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	returnSetInfo->returnMode = SFRM_Materialize;
+	returnSetInfo->setResult = tupleStore;
+	returnSetInfo->setDesc = *tupleDescriptor;
+
+	MemoryContextSwitchTo(oldContext);
+
+	return tupleStore;
+}
+
+
+/*
+ * ConnectionWaitStart publishes that the backend starts waiting on the node
+ * of the given connection, and returns the time at which the wait started.
+ * It returns 0 if latency tracking is disabled.
+ */
+TimestampTz
+ConnectionWaitStart(MultiConnection *connection, ConnectionWaitEvent waitEvent)
+{
+	BackendConnectionWait *backendWait = NULL;
+	TimestampTz waitStart = 0;
+
+	if (!TrackConnectionLatency)
+	{
+		return 0;
+	}
+
+	waitStart = GetCurrentTimestamp();
+
+	backendWait = MyBackendConnectionWait();
+	if (backendWait != NULL)
+	{
+		SpinLockAcquire(&backendWait->mutex);
+
+		backendWait->pid = MyProcPid;
+		backendWait->waitEvent = waitEvent;
+		strlcpy(backendWait->hostname, connection->hostname, MAX_NODE_LENGTH);
+		backendWait->port = connection->port;
+		backendWait->waitStart = waitStart;
+
+		SpinLockRelease(&backendWait->mutex);
+	}
+
+	return waitStart;
+}
+
+
+/*
+ * ConnectionWaitEnd publishes that the backend is no longer waiting on a
+ * worker node.
+ */
+void
+ConnectionWaitEnd(void)
+{
+	BackendConnectionWait *backendWait = MyBackendConnectionWait();
+
+	if (backendWait == NULL || backendWait->waitEvent == CONNECTION_WAIT_NONE)
+	{
+		return;
+	}
+
+	SpinLockAcquire(&backendWait->mutex);
+	backendWait->waitEvent = CONNECTION_WAIT_NONE;
+	SpinLockRelease(&backendWait->mutex);
+}
+
+
+/*
+ * ResetConnectionWaitState clears the current wait of the backend after an
+ * error interrupted it.
+ */
+void
+ResetConnectionWaitState(void)
+{
+	ConnectionWaitEnd();
+}
+
+
+/*
+ * RecordConnectionLatency adds a wait on the node of the given connection,
+ * which started at startTime, to the latency histogram of the node. Waits
+ * are not recorded if they started while tracking was disabled, or if the
+ * histograms of too many nodes are tracked already.
+ */
+void
+RecordConnectionLatency(MultiConnection *connection, ConnectionWaitEvent waitEvent,
+						TimestampTz startTime)
+{
+	ConnectionLatencyHashKey latencyKey;
+	ConnectionLatencyHashEntry *latencyEntry = NULL;
+	bool entryFound = false;
+	long seconds = 0;
+	int microseconds = 0;
+	double latencyMillis = 0.0;
+	int bucketIndex = 0;
+
+	if (!TrackConnectionLatency || startTime == 0 || ConnectionLatencyHash == NULL)
+	{
+		return;
+	}
+
+	TimestampDifference(startTime, GetCurrentTimestamp(), &seconds, &microseconds);
+	latencyMillis = seconds * 1000.0 + microseconds / 1000.0;
+	bucketIndex = LatencyHistogramBucket(latencyMillis);
+
+	memset(&latencyKey, 0, sizeof(ConnectionLatencyHashKey));
+	strlcpy(latencyKey.hostname, connection->hostname, MAX_NODE_LENGTH);
+	latencyKey.port = connection->port;
+
+	LWLockAcquire(&ConnectionWaitStatsControl->lock, LW_SHARED);
+
+	latencyEntry = (ConnectionLatencyHashEntry *) hash_search(ConnectionLatencyHash,
+															  &latencyKey, HASH_FIND,
+															  &entryFound);
+	if (!entryFound)
+	{
+		/* we need an exclusive lock to add the entry */
+		LWLockRelease(&ConnectionWaitStatsControl->lock);
+		LWLockAcquire(&ConnectionWaitStatsControl->lock, LW_EXCLUSIVE);
+
+		latencyEntry = (ConnectionLatencyHashEntry *) hash_search(ConnectionLatencyHash,
+																  &latencyKey,
+																  HASH_ENTER_NULL,
+																  &entryFound);
+		if (latencyEntry == NULL)
+		{
+			/* out of shared memory for more nodes, skip the wait */
+			LWLockRelease(&ConnectionWaitStatsControl->lock);
+			return;
+		}
+
+		if (!entryFound)
+		{
+			memset(((char *) latencyEntry) + sizeof(ConnectionLatencyHashKey), 0,
+				   sizeof(ConnectionLatencyHashEntry) -
+				   sizeof(ConnectionLatencyHashKey));
+			SpinLockInit(&latencyEntry->mutex);
+		}
+	}
+
+	SpinLockAcquire(&latencyEntry->mutex);
+	latencyEntry->histogram[waitEvent][bucketIndex]++;
+	SpinLockRelease(&latencyEntry->mutex);
+
+	LWLockRelease(&ConnectionWaitStatsControl->lock);
+}
+
+
+/*
+ * RecordConnectionEstablished adds the time it took to establish the given
+ * connection to the latency histogram of its node, unless that was already
+ * done for the connection.
+ */
+void
+RecordConnectionEstablished(MultiConnection *connection)
+{
+	if (connection->connectionLatencyRecorded)
+	{
+		return;
+	}
+
+	connection->connectionLatencyRecorded = true;
+
+	/* detail 1 tells a newly established connection apart from a cached one */
+	RecordQueryTraceNodeEvent(QUERY_TRACE_CONNECTION_ACQUIRED, connection->hostname,
+							  connection->port, 1);
+
+	RecordConnectionLatency(connection, CONNECTION_WAIT_CONNECT,
+							connection->connectionStart);
+}
+
+
+/*
+ * MyBackendConnectionWait returns the entry of the current backend in the
+ * array of waits, or NULL if the backend does not have one.
+ */
+static BackendConnectionWait *
+MyBackendConnectionWait(void)
+{
+	if (BackendConnectionWaitArray == NULL || MyProc == NULL ||
+		MyProc->pgprocno >= MaxBackends)
+	{
+		return NULL;
+	}
+
+	return &BackendConnectionWaitArray[MyProc->pgprocno];
+}
+
+
+/*
+ * LatencyHistogramBucket returns the index of the histogram bucket for a
+ * wait of the given number of milliseconds.
+ */
+static int
+LatencyHistogramBucket(double latencyMillis)
+{
+	int bucketIndex = 0;
+
+	while (bucketIndex < LATENCY_HISTOGRAM_BUCKET_COUNT - 1 &&
+		   latencyMillis >= (double) (1 << bucketIndex))
+	{
+		bucketIndex++;
+	}
+
+	return bucketIndex;
+}
+
+
+/*
+ * InitializeConnectionWaitStats requests the necessary shared memory
+ * from Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeConnectionWaitStats(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(ConnectionWaitStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = ConnectionWaitStatsShmemInit;
+}
+
+
+/*
+ * ConnectionWaitStatsShmemSize computes how much shared memory is required.
+ */
+static size_t
+ConnectionWaitStatsShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, sizeof(ConnectionWaitStatsControlData));
+	size = add_size(size, mul_size(sizeof(BackendConnectionWait), MaxBackends));
+
+	hashSize = hash_estimate_size(MaxWorkerNodesTracked,
+								  sizeof(ConnectionLatencyHashEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * ConnectionWaitStatsShmemInit initializes the shared memory used for the
+ * current waits of the backends and the latency histograms.
+ */
+static void
+ConnectionWaitStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ConnectionWaitStatsControl =
+		(ConnectionWaitStatsControlData *) ShmemInitStruct(
+			"Connection Wait Stats Data",
+			sizeof(ConnectionWaitStatsControlData),
+			&alreadyInitialized);
+
+	BackendConnectionWaitArray =
+		(BackendConnectionWait *) ShmemInitStruct(
+			"Backend Connection Waits",
+			mul_size(sizeof(BackendConnectionWait), MaxBackends),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		int backendIndex = 0;
+
+		/* start by zeroing out all the memory */
+		memset(ConnectionWaitStatsControl, 0, sizeof(ConnectionWaitStatsControlData));
+		memset(BackendConnectionWaitArray, 0,
+			   mul_size(sizeof(BackendConnectionWait), MaxBackends));
+
+#if (PG_VERSION_NUM >= 100000)
+		ConnectionWaitStatsControl->trancheId = LWLockNewTrancheId();
+		ConnectionWaitStatsControl->lockTrancheName = "Connection Wait Stats";
+		LWLockRegisterTranche(ConnectionWaitStatsControl->trancheId,
+							  ConnectionWaitStatsControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &ConnectionWaitStatsControl->lockTranche;
+
+			ConnectionWaitStatsControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &ConnectionWaitStatsControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Connection Wait Stats";
+			LWLockRegisterTranche(ConnectionWaitStatsControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&ConnectionWaitStatsControl->lock,
+						 ConnectionWaitStatsControl->trancheId);
+
+		for (backendIndex = 0; backendIndex < MaxBackends; backendIndex++)
+		{
+			SpinLockInit(&BackendConnectionWaitArray[backendIndex].mutex);
+		}
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(ConnectionLatencyHashKey);
+	hashInfo.entrysize = sizeof(ConnectionLatencyHashEntry);
+	hashInfo.hash = ConnectionLatencyHashHash;
+	hashInfo.match = ConnectionLatencyHashCompare;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
+
+	ConnectionLatencyHash = ShmemInitHash("Connection Latency Hash",
+										  MaxWorkerNodesTracked, MaxWorkerNodesTracked,
+										  &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/* ConnectionLatencyHashHash hashes the hostname and port of a worker node */
+static uint32
+ConnectionLatencyHashHash(const void *key, Size keysize)
+{
+	ConnectionLatencyHashKey *entry = (ConnectionLatencyHashKey *) key;
+	uint32 hash = 0;
+
+	hash = string_hash(entry->hostname, NAMEDATALEN);
+	hash = hash_combine(hash, hash_uint32(entry->port));
+
+	return hash;
+}
+
+
+/* ConnectionLatencyHashCompare compares the hostname and port of worker nodes */
+static int
+ConnectionLatencyHashCompare(const void *a, const void *b, Size keysize)
+{
+	ConnectionLatencyHashKey *ca = (ConnectionLatencyHashKey *) a;
+	ConnectionLatencyHashKey *cb = (ConnectionLatencyHashKey *) b;
+
+	if (strncmp(ca->hostname, cb->hostname, MAX_NODE_LENGTH) != 0 ||
+		ca->port != cb->port)
+	{
+		return 1;
+	}
+	else
+	{
+		return 0;
+	}
+}
@@ -0,0 +1,640 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_fanout.c
+ *   Routines for running lists of commands on many nodes at once.
+ *
+ * Commands that go to all nodes, such as metadata changes and propagated DDL,
+ * used to be sent to one node after the other, or over connections to all
+ * nodes that were established one after the other. On large clusters, that
+ * time is mostly spent waiting for round trips. The fan-out in this file keeps
+ * up to citus.max_node_command_concurrency nodes in progress: connections to
+ * these nodes are established concurrently, each node gets its next command
+ * as soon as its previous command finished, without waiting for the other
+ * nodes, and the next node is started whenever a node is done. Results are
+ * handed to a callback as they arrive.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "pgstat.h"
+
+#include "libpq-fe.h"
+
+#include "distributed/connection_management.h"
+#include "distributed/connection_wait_stats.h"
+#include "distributed/node_fanout.h"
+#include "distributed/node_health.h"
+#include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
+#include "distributed/transaction_management.h"
+#include "miscadmin.h"
+#include "storage/latch.h"
+#include "utils/timestamp.h"
+
+
+/* interval in which connection timeouts are checked while waiting */
+#define NODE_FANOUT_CHECK_INTERVAL_MS 200
+
+
+/* Config variables managed via guc.c */
+int MaxNodeCommandConcurrency = 32;
+
+
+/* NodeFanout holds the settings of a fan-out that apply to all nodes */
+typedef struct NodeFanout
+{
+	uint32 connectionFlags;
+	char *userName;
+	bool useTransaction;
+	NodeCommandResultCallback resultCallback;
+	void *callbackContext;
+} NodeFanout;
+
+
+/* local function forward declarations */
+static void StartNodeCommandList(NodeFanout *fanout, NodeCommandList *nodeCommandList);
+static void AdvanceNodeConnection(NodeFanout *fanout, NodeCommandList *nodeCommandList);
+static void StartNodeCommands(NodeFanout *fanout, NodeCommandList *nodeCommandList);
+static void SendNextNodeCommand(NodeFanout *fanout, NodeCommandList *nodeCommandList);
+static void FlushNodeCommand(NodeFanout *fanout, NodeCommandList *nodeCommandList);
+static void ReceiveNodeCommandResults(NodeFanout *fanout,
+									  NodeCommandList *nodeCommandList);
+static void FailNodeCommandList(NodeFanout *fanout, NodeCommandList *nodeCommandList);
+static void FinishNodeCommandList(NodeFanout *fanout, NodeCommandList *nodeCommandList);
+static uint32 NodeCommandEventMask(NodeCommandList *nodeCommandList);
+static WaitEventSet * BuildNodeFanoutWaitEventSet(NodeCommandList **activeArray,
+												  int activeCount);
+
+
+/*
+ * MakeNodeCommandList creates a node command list that runs the given commands
+ * on the given node, without parameters.
+ */
+NodeCommandList *
+MakeNodeCommandList(char *nodeName, int32 nodePort, List *commandList)
+{
+	NodeCommandList *nodeCommandList = palloc0(sizeof(NodeCommandList));
+
+	nodeCommandList->nodeName = nodeName;
+	nodeCommandList->nodePort = nodePort;
+	nodeCommandList->commandList = commandList;
+	nodeCommandList->state = NODE_COMMAND_PENDING;
+
+	return nodeCommandList;
+}
+
+
+/*
+ * ExecuteNodeCommandLists runs the commands of the given node command lists,
+ * with up to citus.max_node_command_concurrency nodes in progress at a time,
+ * and returns once all nodes are done. Whether the commands succeeded on a
+ * node is recorded in its node command list, and the result callback, if
+ * any, is called for each result as soon as it arrives.
+ *
+ * Connections are opened with the given flags as the given user. If
+ * useTransaction is set, the connections take part in the coordinated
+ * transaction, if any, and failures on them are critical. Otherwise,
+ * connections that are opened with FORCE_NEW_CONNECTION are closed as soon as
+ * their node is done, such that there are never more connections than nodes
+ * in progress.
+ */
+void
+ExecuteNodeCommandLists(List *nodeCommandListList, uint32 connectionFlags,
+						char *userName, bool useTransaction,
+						NodeCommandResultCallback resultCallback,
+						void *callbackContext)
+{
+	int nodeCount = list_length(nodeCommandListList);
+	int maxActiveCount = MaxNodeCommandConcurrency;
+	int activeCount = 0;
+	int nodeIndex = 0;
+	ListCell *nextNodeCell = list_head(nodeCommandListList);
+	NodeCommandList **activeArray = NULL;
+	WaitEvent *events = NULL;
+	WaitEventSet *waitEventSet = NULL;
+	NodeFanout fanout;
+
+	if (nodeCount == 0)
+	{
+		return;
+	}
+
+	fanout.connectionFlags = connectionFlags;
+	fanout.userName = userName;
+	fanout.useTransaction = useTransaction;
+	fanout.resultCallback = resultCallback;
+	fanout.callbackContext = callbackContext;
+
+	/* leave room for the latch, postmaster death and pgwin32_signal_event */
+	if (maxActiveCount > FD_SETSIZE - 3)
+	{
+		maxActiveCount = FD_SETSIZE - 3;
+	}
+
+	if (maxActiveCount > nodeCount)
+	{
+		maxActiveCount = nodeCount;
+	}
+
+	activeArray = palloc0(maxActiveCount * sizeof(NodeCommandList *));
+	events = palloc0((maxActiveCount + 2) * sizeof(WaitEvent));
+
+	PG_TRY();
+	{
+		bool rebuildWaitEventSet = true;
+
+		while (nextNodeCell != NULL || activeCount > 0)
+		{
+			int eventCount = 0;
+			int eventIndex = 0;
+			int activeIndex = 0;
+			int remainingCount = 0;
+			TimestampTz currentTime = 0;
+
+			/* remove the nodes that are done from the window */
+			for (activeIndex = 0; activeIndex < activeCount; activeIndex++)
+			{
+				if (activeArray[activeIndex]->state != NODE_COMMAND_FINISHED)
+				{
+					activeArray[remainingCount++] = activeArray[activeIndex];
+				}
+			}
+
+			activeCount = remainingCount;
+
+			/* start nodes until the window is full */
+			while (nextNodeCell != NULL && activeCount < maxActiveCount)
+			{
+				NodeCommandList *nodeCommandList =
+					(NodeCommandList *) lfirst(nextNodeCell);
+
+				nextNodeCell = lnext(nextNodeCell);
+
+				nodeCommandList->nodeIndex = nodeIndex++;
+				StartNodeCommandList(&fanout, nodeCommandList);
+
+				/* nodes may be done right away, e.g. when the connection failed */
+				if (nodeCommandList->state != NODE_COMMAND_FINISHED)
+				{
+					activeArray[activeCount++] = nodeCommandList;
+					rebuildWaitEventSet = true;
+				}
+			}
+
+			if (activeCount == 0)
+			{
+				continue;
+			}
+
+			/* we cannot remove wait events, so we rebuild the set when nodes change */
+			if (rebuildWaitEventSet)
+			{
+				if (waitEventSet != NULL)
+				{
+					FreeWaitEventSet(waitEventSet);
+					waitEventSet = NULL;
+				}
+
+				waitEventSet = BuildNodeFanoutWaitEventSet(activeArray, activeCount);
+				rebuildWaitEventSet = false;
+			}
+
+#if (PG_VERSION_NUM >= 100000)
+			eventCount = WaitEventSetWait(waitEventSet, NODE_FANOUT_CHECK_INTERVAL_MS,
+										  events, activeCount + 2,
+										  WAIT_EVENT_CLIENT_READ);
+#else
+			eventCount = WaitEventSetWait(waitEventSet, NODE_FANOUT_CHECK_INTERVAL_MS,
+										  events, activeCount + 2);
+#endif
+
+			for (eventIndex = 0; eventIndex < eventCount; eventIndex++)
+			{
+				WaitEvent *event = &events[eventIndex];
+				NodeCommandList *nodeCommandList = NULL;
+
+				if (event->events & WL_POSTMASTER_DEATH)
+				{
+					ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+				}
+
+				if (event->events & WL_LATCH_SET)
+				{
+					ResetLatch(MyLatch);
+					CHECK_FOR_INTERRUPTS();
+					continue;
+				}
+
+				nodeCommandList = (NodeCommandList *) event->user_data;
+
+				if (nodeCommandList->state == NODE_COMMAND_CONNECTING)
+				{
+					AdvanceNodeConnection(&fanout, nodeCommandList);
+
+					/* libpq may use a different socket after each step */
+					rebuildWaitEventSet = true;
+				}
+				else
+				{
+					ReceiveNodeCommandResults(&fanout, nodeCommandList);
+				}
+
+				if (nodeCommandList->state == NODE_COMMAND_FINISHED)
+				{
+					rebuildWaitEventSet = true;
+				}
+				else if (!rebuildWaitEventSet)
+				{
+					ModifyWaitEvent(waitEventSet, event->pos,
+									NodeCommandEventMask(nodeCommandList), NULL);
+				}
+			}
+
+			/* give up on connections that take too long to establish */
+			currentTime = GetCurrentTimestamp();
+
+			for (activeIndex = 0; activeIndex < activeCount; activeIndex++)
+			{
+				NodeCommandList *nodeCommandList = activeArray[activeIndex];
+				MultiConnection *connection = nodeCommandList->connection;
+
+				if (nodeCommandList->state == NODE_COMMAND_CONNECTING &&
+					TimestampDifferenceExceeds(connection->connectionStart, currentTime,
+											   NodeConnectionTimeout))
+				{
+					ereport(WARNING, (errmsg("could not establish connection after %u ms",
+											 NodeConnectionTimeout)));
+
+					RecordConnectionEstablishmentResult(connection);
+					FailNodeCommandList(&fanout, nodeCommandList);
+
+					rebuildWaitEventSet = true;
+				}
+			}
+		}
+
+		if (waitEventSet != NULL)
+		{
+			FreeWaitEventSet(waitEventSet);
+			waitEventSet = NULL;
+		}
+	}
+	PG_CATCH();
+	{
+		/* make sure the epoll file descriptor is always closed */
+		if (waitEventSet != NULL)
+		{
+			FreeWaitEventSet(waitEventSet);
+			waitEventSet = NULL;
+		}
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pfree(activeArray);
+	pfree(events);
+}
+
+
+/*
+ * StartNodeCommandList starts establishing the connection to the node of the
+ * given node command list, or sends the first command right away if there is
+ * an established connection to reuse.
+ */
+static void
+StartNodeCommandList(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	MultiConnection *connection = NULL;
+
+	nodeCommandList->commandIndex = 0;
+	nodeCommandList->connectionEstablished = false;
+	nodeCommandList->success = true;
+
+	connection = StartNodeUserDatabaseConnection(fanout->connectionFlags,
+												 nodeCommandList->nodeName,
+												 nodeCommandList->nodePort,
+												 fanout->userName, NULL);
+	nodeCommandList->connection = connection;
+
+	if (connection == NULL)
+	{
+		/* optional connections may not be available, nothing to report */
+		nodeCommandList->success = false;
+		nodeCommandList->state = NODE_COMMAND_FINISHED;
+		return;
+	}
+
+	if (fanout->useTransaction)
+	{
+		MarkRemoteTransactionCritical(connection);
+	}
+
+	if (connection->pgConn == NULL || PQstatus(connection->pgConn) == CONNECTION_BAD)
+	{
+		RecordConnectionEstablishmentResult(connection);
+		FailNodeCommandList(fanout, nodeCommandList);
+		return;
+	}
+
+	if (PQstatus(connection->pgConn) == CONNECTION_OK)
+	{
+		StartNodeCommands(fanout, nodeCommandList);
+		return;
+	}
+
+	nodeCommandList->state = NODE_COMMAND_CONNECTING;
+	nodeCommandList->pollMode = PGRES_POLLING_WRITING;
+}
+
+
+/*
+ * AdvanceNodeConnection continues establishing the connection of the given node
+ * command list after its socket became ready, and sends the first command once
+ * the connection is established.
+ */
+static void
+AdvanceNodeConnection(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	MultiConnection *connection = nodeCommandList->connection;
+	PostgresPollingStatusType pollMode = PQconnectPoll(connection->pgConn);
+
+	if (pollMode == PGRES_POLLING_OK)
+	{
+		RecordConnectionEstablished(connection);
+		RecordConnectionEstablishmentResult(connection);
+
+		StartNodeCommands(fanout, nodeCommandList);
+	}
+	else if (pollMode == PGRES_POLLING_FAILED)
+	{
+		RecordConnectionEstablishmentResult(connection);
+
+		FailNodeCommandList(fanout, nodeCommandList);
+	}
+	else
+	{
+		nodeCommandList->pollMode = pollMode;
+	}
+}
+
+
+/*
+ * StartNodeCommands begins the remote transaction on the established
+ * connection of the given node command list if necessary, or otherwise sends
+ * its first command.
+ */
+static void
+StartNodeCommands(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	MultiConnection *connection = nodeCommandList->connection;
+
+	nodeCommandList->connectionEstablished = true;
+
+	if (fanout->useTransaction && InCoordinatedTransaction() &&
+		RemoteTransactionNeedsBegin(connection))
+	{
+		StartRemoteTransactionBegin(connection);
+		if (connection->remoteTransaction.transactionFailed)
+		{
+			FailNodeCommandList(fanout, nodeCommandList);
+			return;
+		}
+
+		nodeCommandList->state = NODE_COMMAND_BEGINNING;
+		FlushNodeCommand(fanout, nodeCommandList);
+		return;
+	}
+
+	SendNextNodeCommand(fanout, nodeCommandList);
+}
+
+
+/*
+ * SendNextNodeCommand sends the next command of the given node command list,
+ * or finishes the node command list if all commands ran or one of them failed.
+ */
+static void
+SendNextNodeCommand(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	MultiConnection *connection = nodeCommandList->connection;
+	char *command = NULL;
+	int querySent = 0;
+
+	if (!nodeCommandList->success ||
+		nodeCommandList->commandIndex >= list_length(nodeCommandList->commandList))
+	{
+		FinishNodeCommandList(fanout, nodeCommandList);
+		return;
+	}
+
+	command = (char *) list_nth(nodeCommandList->commandList,
+								nodeCommandList->commandIndex);
+
+	if (nodeCommandList->parameterCount > 0)
+	{
+		querySent = SendRemoteCommandParams(connection, command,
+											nodeCommandList->parameterCount,
+											nodeCommandList->parameterTypes,
+											nodeCommandList->parameterValues, false);
+	}
+	else
+	{
+		querySent = SendRemoteCommand(connection, command);
+	}
+
+	if (querySent == 0)
+	{
+		FailNodeCommandList(fanout, nodeCommandList);
+		return;
+	}
+
+	nodeCommandList->state = NODE_COMMAND_RUNNING;
+	FlushNodeCommand(fanout, nodeCommandList);
+}
+
+
+/*
+ * FlushNodeCommand sends as much of the pending command of the given node
+ * command list as the socket accepts, and records whether the node next waits
+ * for its socket to become writable or readable.
+ */
+static void
+FlushNodeCommand(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	int flushStatus = PQflush(nodeCommandList->connection->pgConn);
+
+	if (flushStatus == -1)
+	{
+		FailNodeCommandList(fanout, nodeCommandList);
+	}
+	else if (flushStatus == 1)
+	{
+		nodeCommandList->pollMode = PGRES_POLLING_WRITING;
+	}
+	else
+	{
+		nodeCommandList->pollMode = PGRES_POLLING_READING;
+	}
+}
+
+
+/*
+ * ReceiveNodeCommandResults consumes the input on the connection of the given
+ * node command list, hands complete results to the result callback, and sends
+ * the next command once the current command finished.
+ */
+static void
+ReceiveNodeCommandResults(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	MultiConnection *connection = nodeCommandList->connection;
+	PGconn *pgConn = connection->pgConn;
+
+	if (nodeCommandList->pollMode == PGRES_POLLING_WRITING)
+	{
+		FlushNodeCommand(fanout, nodeCommandList);
+		if (nodeCommandList->state == NODE_COMMAND_FINISHED)
+		{
+			return;
+		}
+	}
+
+	if (PQconsumeInput(pgConn) == 0)
+	{
+		FailNodeCommandList(fanout, nodeCommandList);
+		return;
+	}
+
+	if (PQisBusy(pgConn))
+	{
+		return;
+	}
+
+	if (nodeCommandList->state == NODE_COMMAND_BEGINNING)
+	{
+		FinishRemoteTransactionBegin(connection);
+		if (connection->remoteTransaction.transactionFailed)
+		{
+			FailNodeCommandList(fanout, nodeCommandList);
+			return;
+		}
+
+		SendNextNodeCommand(fanout, nodeCommandList);
+		return;
+	}
+
+	while (!PQisBusy(pgConn))
+	{
+		PGresult *result = PQgetResult(pgConn);
+
+		if (result == NULL)
+		{
+			/* the current command finished */
+			nodeCommandList->commandIndex++;
+
+			SendNextNodeCommand(fanout, nodeCommandList);
+			return;
+		}
+
+		if (!IsResponseOK(result))
+		{
+			nodeCommandList->success = false;
+		}
+
+		if (fanout->resultCallback != NULL)
+		{
+			fanout->resultCallback(nodeCommandList, result, fanout->callbackContext);
+		}
+
+		PQclear(result);
+	}
+}
+
+
+/*
+ * FailNodeCommandList marks the commands of the given node command list as
+ * failed after a connection failure, lets the result callback report the
+ * failure, and finishes the node command list.
+ */
+static void
+FailNodeCommandList(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	nodeCommandList->success = false;
+
+	if (fanout->resultCallback != NULL)
+	{
+		fanout->resultCallback(nodeCommandList, NULL, fanout->callbackContext);
+	}
+
+	FinishNodeCommandList(fanout, nodeCommandList);
+}
+
+
+/*
+ * FinishNodeCommandList marks the given node command list as done, and closes
+ * its connection if it was opened for the fan-out only.
+ */
+static void
+FinishNodeCommandList(NodeFanout *fanout, NodeCommandList *nodeCommandList)
+{
+	nodeCommandList->state = NODE_COMMAND_FINISHED;
+
+	if (!fanout->useTransaction && (fanout->connectionFlags & FORCE_NEW_CONNECTION))
+	{
+		CloseConnection(nodeCommandList->connection);
+		nodeCommandList->connection = NULL;
+	}
+}
+
+
+/*
+ * NodeCommandEventMask returns the socket events that the given node command
+ * list waits for.
+ */
+static uint32
+NodeCommandEventMask(NodeCommandList *nodeCommandList)
+{
+	if (nodeCommandList->pollMode == PGRES_POLLING_WRITING)
+	{
+		/* responses may arrive while a long command is still being sent */
+		if (nodeCommandList->state == NODE_COMMAND_CONNECTING)
+		{
+			return WL_SOCKET_WRITEABLE;
+		}
+
+		return WL_SOCKET_WRITEABLE | WL_SOCKET_READABLE;
+	}
+
+	return WL_SOCKET_READABLE;
+}
+
+
+/*
+ * BuildNodeFanoutWaitEventSet creates a WaitEventSet for the sockets of the
+ * given node command lists in progress, followed by the signal latch and
+ * postmaster death.
+ */
+static WaitEventSet *
+BuildNodeFanoutWaitEventSet(NodeCommandList **activeArray, int activeCount)
+{
+	WaitEventSet *waitEventSet = CreateWaitEventSet(CurrentMemoryContext,
+													activeCount + 2);
+	int activeIndex = 0;
+
+	for (activeIndex = 0; activeIndex < activeCount; activeIndex++)
+	{
+		NodeCommandList *nodeCommandList = activeArray[activeIndex];
+		int socket = PQsocket(nodeCommandList->connection->pgConn);
+
+		AddWaitEventToSet(waitEventSet, NodeCommandEventMask(nodeCommandList), socket,
+						  NULL, (void *) nodeCommandList);
+	}
+
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+	return waitEventSet;
+}
@@ -0,0 +1,533 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_health.c
+ *   Keeps track of worker nodes that could not be connected to, across all
+ *   backends of the coordinator, when citus.unreachable_node_retry_interval
+ *   is set.
+ *
+ *   Without it, every connection attempt to a node that is down waits up to
+ *   citus.node_connection_timeout before the executor fails over to another
+ *   placement, and this repeats for every query. Instead, a failed connection
+ *   attempt marks the node as unreachable in shared memory. Until the retry
+ *   interval has passed, new connections to the node fail immediately without
+ *   contacting it, such that executors use the other placements right away.
+ *   After the interval, the next connection attempt tries the node again.
+ *   The maintenance daemon also probes unreachable nodes every
+ *   citus.node_health_check_interval, and marks them reachable as soon as a
+ *   connection succeeds.
+ *
+ *   Failures where the node asked for a password are not counted, since the
+ *   node is reachable and they only concern a single user.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+
+#include "access/hash.h"
+#include "distributed/connection_management.h"
+#include "distributed/hash_helpers.h"
+#include "distributed/node_health.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * NodeHealthControlData is the header of the shared memory segment, holding
+ * the lock that protects the hash of node health entries.
+ */
+typedef struct NodeHealthControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+} NodeHealthControlData;
+
+
+/* hash key of the node health entries */
+typedef struct NodeHealthHashKey
+{
+	char hostname[MAX_NODE_LENGTH];
+	int32 port;
+} NodeHealthHashKey;
+
+
+/* hash entry of the node health entries */
+typedef struct NodeHealthHashEntry
+{
+	NodeHealthHashKey key;
+
+	/* number of failed connection attempts since the last successful one */
+	int consecutiveFailureCount;
+
+	/* time of the last failed connection attempt */
+	TimestampTz lastFailureTime;
+} NodeHealthHashEntry;
+
+
+/* Config variables managed via guc.c */
+int UnreachableNodeRetryInterval = 0; /* in milliseconds, 0 to disable */
+int NodeHealthCheckInterval = 10000; /* in milliseconds, -1 to disable */
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static NodeHealthControlData *NodeHealthControl = NULL;
+
+/* hash of (hostname, port) -> connection failures across all backends */
+static HTAB *NodeHealthHash = NULL;
+
+
+static size_t NodeHealthShmemSize(void);
+static void NodeHealthShmemInit(void);
+static void BuildNodeHealthHashKey(NodeHealthHashKey *key, const char *hostname,
+								   int port);
+static void RecordNodeReachable(const char *hostname, int port);
+static void RecordNodeUnreachable(const char *hostname, int port);
+static uint32 NodeHealthHashHash(const void *key, Size keysize);
+static int NodeHealthHashCompare(const void *a, const void *b, Size keysize);
+
+
+/*
+ * NodeHealthTrackingEnabled returns whether connection failures are tracked
+ * to skip unreachable nodes.
+ */
+bool
+NodeHealthTrackingEnabled(void)
+{
+	return UnreachableNodeRetryInterval > 0;
+}
+
+
+/*
+ * NodeIsKnownUnreachable returns whether a connection attempt to the given
+ * node failed within the last citus.unreachable_node_retry_interval, without
+ * a successful one since.
+ */
+bool
+NodeIsKnownUnreachable(const char *hostname, int port)
+{
+	NodeHealthHashKey nodeKey;
+	NodeHealthHashEntry *healthEntry = NULL;
+	bool entryFound = false;
+	bool nodeIsUnreachable = false;
+
+	if (!NodeHealthTrackingEnabled())
+	{
+		return false;
+	}
+
+	BuildNodeHealthHashKey(&nodeKey, hostname, port);
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_SHARED);
+
+	healthEntry = (NodeHealthHashEntry *) hash_search(NodeHealthHash, &nodeKey,
+													  HASH_FIND, &entryFound);
+	if (entryFound && healthEntry->consecutiveFailureCount > 0 &&
+		!TimestampDifferenceExceeds(healthEntry->lastFailureTime, GetCurrentTimestamp(),
+									UnreachableNodeRetryInterval))
+	{
+		nodeIsUnreachable = true;
+	}
+
+	LWLockRelease(&NodeHealthControl->lock);
+
+	return nodeIsUnreachable;
+}
+
+
+/*
+ * NodeConnectionFailureCount returns the number of failed connection attempts
+ * to the given node since the last successful one.
+ */
+int
+NodeConnectionFailureCount(const char *hostname, int port)
+{
+	NodeHealthHashKey nodeKey;
+	NodeHealthHashEntry *healthEntry = NULL;
+	bool entryFound = false;
+	int failureCount = 0;
+
+	if (!NodeHealthTrackingEnabled())
+	{
+		return 0;
+	}
+
+	BuildNodeHealthHashKey(&nodeKey, hostname, port);
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_SHARED);
+
+	healthEntry = (NodeHealthHashEntry *) hash_search(NodeHealthHash, &nodeKey,
+													  HASH_FIND, &entryFound);
+	if (entryFound)
+	{
+		failureCount = healthEntry->consecutiveFailureCount;
+	}
+
+	LWLockRelease(&NodeHealthControl->lock);
+
+	return failureCount;
+}
+
+
+/*
+ * RecordConnectionEstablishmentResult marks the node of the given connection
+ * as reachable if the connection was established, and as unreachable if the
+ * connection attempt failed. Connections that were not attempted since their
+ * node was known to be unreachable are ignored, such that the node is tried
+ * again once the retry interval has passed.
+ */
+void
+RecordConnectionEstablishmentResult(MultiConnection *connection)
+{
+	if (!NodeHealthTrackingEnabled() || connection->unreachableNodeSkipped)
+	{
+		return;
+	}
+
+	if (PQstatus(connection->pgConn) == CONNECTION_OK)
+	{
+		RecordNodeReachable(connection->hostname, connection->port);
+	}
+	else
+	{
+		RecordConnectionEstablishmentFailure(connection);
+	}
+}
+
+
+/*
+ * RecordConnectionEstablishmentFailure marks the node of the given connection
+ * as unreachable after connection establishment failed or timed out, unless
+ * the node asked for a password.
+ */
+void
+RecordConnectionEstablishmentFailure(MultiConnection *connection)
+{
+	PGconn *pgConn = connection->pgConn;
+
+	if (!NodeHealthTrackingEnabled() || connection->unreachableNodeSkipped)
+	{
+		return;
+	}
+
+	if (pgConn != NULL &&
+		(PQconnectionNeedsPassword(pgConn) || PQconnectionUsedPassword(pgConn)))
+	{
+		return;
+	}
+
+	RecordNodeUnreachable(connection->hostname, connection->port);
+}
+
+
+/*
+ * ProbeUnreachableNodes tries to connect to each node that is marked as
+ * unreachable, which marks the node as reachable if the connection succeeds.
+ * The function returns the number of nodes that are reachable again.
+ */
+int
+ProbeUnreachableNodes(void)
+{
+	HASH_SEQ_STATUS status;
+	NodeHealthHashEntry *healthEntry = NULL;
+	NodeHealthHashKey *nodeKeyArray = NULL;
+	int nodeCount = 0;
+	int nodeIndex = 0;
+	int reachableNodeCount = 0;
+
+	if (!NodeHealthTrackingEnabled())
+	{
+		return 0;
+	}
+
+	/* copy the nodes first, since connecting takes a while */
+	LWLockAcquire(&NodeHealthControl->lock, LW_SHARED);
+
+	nodeKeyArray = palloc0((hash_get_num_entries(NodeHealthHash) + 1) *
+						   sizeof(NodeHealthHashKey));
+
+	hash_seq_init(&status, NodeHealthHash);
+	while ((healthEntry = (NodeHealthHashEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (healthEntry->consecutiveFailureCount > 0)
+		{
+			nodeKeyArray[nodeCount++] = healthEntry->key;
+		}
+	}
+
+	LWLockRelease(&NodeHealthControl->lock);
+
+	for (nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++)
+	{
+		NodeHealthHashKey *nodeKey = &nodeKeyArray[nodeIndex];
+		uint32 connectionFlags = FORCE_NEW_CONNECTION | IGNORE_NODE_HEALTH |
+								 OPTIONAL_CONNECTION;
+		MultiConnection *connection =
+			StartNodeUserDatabaseConnection(connectionFlags, nodeKey->hostname,
+											nodeKey->port, NULL, NULL);
+
+		/* the node has no connection slots left, so it is not worth a probe */
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		/* records the outcome of the probe */
+		FinishConnectionEstablishment(connection);
+
+		if (PQstatus(connection->pgConn) == CONNECTION_OK)
+		{
+			ereport(LOG, (errmsg("worker node %s:%d is reachable again",
+								 nodeKey->hostname, nodeKey->port)));
+
+			reachableNodeCount++;
+		}
+
+		CloseConnection(connection);
+	}
+
+	pfree(nodeKeyArray);
+
+	return reachableNodeCount;
+}
+
+
+/*
+ * RecordNodeReachable clears the connection failures of the given node. The
+ * exclusive lock is only taken if there are failures to clear, since this is
+ * called for every connection.
+ */
+static void
+RecordNodeReachable(const char *hostname, int port)
+{
+	NodeHealthHashKey nodeKey;
+	NodeHealthHashEntry *healthEntry = NULL;
+	bool entryFound = false;
+	bool hasFailures = false;
+
+	BuildNodeHealthHashKey(&nodeKey, hostname, port);
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_SHARED);
+
+	healthEntry = (NodeHealthHashEntry *) hash_search(NodeHealthHash, &nodeKey,
+													  HASH_FIND, &entryFound);
+	hasFailures = entryFound && healthEntry->consecutiveFailureCount > 0;
+
+	LWLockRelease(&NodeHealthControl->lock);
+
+	if (!hasFailures)
+	{
+		return;
+	}
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_EXCLUSIVE);
+
+	healthEntry = (NodeHealthHashEntry *) hash_search(NodeHealthHash, &nodeKey,
+													  HASH_FIND, &entryFound);
+	if (entryFound)
+	{
+		healthEntry->consecutiveFailureCount = 0;
+	}
+
+	LWLockRelease(&NodeHealthControl->lock);
+}
+
+
+/*
+ * RecordNodeUnreachable records a failed connection attempt to the given node.
+ */
+static void
+RecordNodeUnreachable(const char *hostname, int port)
+{
+	NodeHealthHashKey nodeKey;
+	NodeHealthHashEntry *healthEntry = NULL;
+	bool entryFound = false;
+
+	BuildNodeHealthHashKey(&nodeKey, hostname, port);
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_EXCLUSIVE);
+
+	healthEntry = (NodeHealthHashEntry *) hash_search(NodeHealthHash, &nodeKey,
+													  HASH_ENTER_NULL, &entryFound);
+
+	/* out of shared memory for the hash, the node is then not skipped */
+	if (healthEntry != NULL)
+	{
+		if (!entryFound)
+		{
+			healthEntry->consecutiveFailureCount = 0;
+		}
+
+		if (healthEntry->consecutiveFailureCount == 0)
+		{
+			ereport(LOG, (errmsg("skipping connections to worker node %s:%d for "
+								 "%d ms after failing to connect to it",
+								 hostname, port, UnreachableNodeRetryInterval)));
+		}
+
+		healthEntry->consecutiveFailureCount++;
+		healthEntry->lastFailureTime = GetCurrentTimestamp();
+	}
+
+	LWLockRelease(&NodeHealthControl->lock);
+}
+
+
+/*
+ * BuildNodeHealthHashKey fills the hash key for the given worker node.
+ */
+static void
+BuildNodeHealthHashKey(NodeHealthHashKey *key, const char *hostname, int port)
+{
+	memset(key, 0, sizeof(NodeHealthHashKey));
+
+	strlcpy(key->hostname, hostname, MAX_NODE_LENGTH);
+	key->port = port;
+}
+
+
+/*
+ * InitializeNodeHealth requests the necessary shared memory from Postgres and
+ * sets up the shared memory startup hook.
+ */
+void
+InitializeNodeHealth(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(NodeHealthShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = NodeHealthShmemInit;
+}
+
+
+/*
+ * NodeHealthShmemSize computes how much shared memory is required.
+ */
+static size_t
+NodeHealthShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, sizeof(NodeHealthControlData));
+
+	hashSize = hash_estimate_size(MaxWorkerNodesTracked, sizeof(NodeHealthHashEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * NodeHealthShmemInit initializes the shared memory used for keeping track of
+ * unreachable nodes across backends.
+ */
+static void
+NodeHealthShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	NodeHealthControl =
+		(NodeHealthControlData *) ShmemInitStruct("Node Health Data",
+												  sizeof(NodeHealthControlData),
+												  &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out all the memory */
+		memset(NodeHealthControl, 0, sizeof(NodeHealthControlData));
+
+#if (PG_VERSION_NUM >= 100000)
+		NodeHealthControl->trancheId = LWLockNewTrancheId();
+		NodeHealthControl->lockTrancheName = "Node Health Tracking";
+		LWLockRegisterTranche(NodeHealthControl->trancheId,
+							  NodeHealthControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &NodeHealthControl->lockTranche;
+
+			NodeHealthControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &NodeHealthControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Node Health Tracking";
+			LWLockRegisterTranche(NodeHealthControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&NodeHealthControl->lock, NodeHealthControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(NodeHealthHashKey);
+	hashInfo.entrysize = sizeof(NodeHealthHashEntry);
+	hashInfo.hash = NodeHealthHashHash;
+	hashInfo.match = NodeHealthHashCompare;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
+
+	NodeHealthHash = ShmemInitHash("Node Health Hash",
+								   MaxWorkerNodesTracked, MaxWorkerNodesTracked,
+								   &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/* NodeHealthHashHash hashes the hostname and port of a worker node */
+static uint32
+NodeHealthHashHash(const void *key, Size keysize)
+{
+	NodeHealthHashKey *entry = (NodeHealthHashKey *) key;
+	uint32 hash = 0;
+
+	hash = string_hash(entry->hostname, NAMEDATALEN);
+	hash = hash_combine(hash, hash_uint32(entry->port));
+
+	return hash;
+}
+
+
+/* NodeHealthHashCompare compares the hostname and port of worker nodes */
+static int
+NodeHealthHashCompare(const void *a, const void *b, Size keysize)
+{
+	NodeHealthHashKey *ca = (NodeHealthHashKey *) a;
+	NodeHealthHashKey *cb = (NodeHealthHashKey *) b;
+
+	if (strncmp(ca->hostname, cb->hostname, MAX_NODE_LENGTH) != 0 ||
+		ca->port != cb->port)
+	{
+		return 1;
+	}
+	else
+	{
+		return 0;
+	}
+}
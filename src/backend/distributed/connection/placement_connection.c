@@ -98,6 +98,12 @@ typedef struct ConnectionPlacementHashEntry
 	/* are any other connections reading from the placements? */
 	bool hasSecondaryConnections;
 
+	/* was the placement read by the backend itself, without a connection? */
+	bool accessedLocally;
+
+	/* was the placement modified by the backend itself? */
+	bool modifiedLocally;
+
 	/* entry for the set of co-located placements */
 	struct ColocatedPlacementsHashEntry *colocatedEntry;
 
@@ -152,6 +158,12 @@ typedef struct ColocatedPlacementsHashEntry
 
 	/* are any other connections reading from the placements? */
 	bool hasSecondaryConnections;
+
+	/* were any of the placements read by the backend itself? */
+	bool accessedLocally;
+
+	/* were any of the placements modified by the backend itself? */
+	bool modifiedLocally;
 }  ColocatedPlacementsHashEntry;
 
 static HTAB *ColocatedPlacementsHash;
@@ -185,6 +197,10 @@ static HTAB *ConnectionShardHash;
 static MultiConnection * FindPlacementListConnection(int flags, List *placementAccessList,
 													 const char *userName,
 													 List **placementEntryList);
+static void AssignPlacementListToConnection(List *placementAccessList,
+											List *placementEntryList,
+											MultiConnection *chosenConnection,
+											const char *userName);
 static ConnectionPlacementHashEntry * FindOrCreatePlacementEntry(
 	ShardPlacement *placement);
 static bool CanUseExistingConnection(uint32 flags, const char *userName,
@@ -285,9 +301,7 @@ StartPlacementListConnection(uint32 flags, List *placementAccessList,
 							 const char *userName)
 {
 	char *freeUserName = NULL;
-	ListCell *placementAccessCell = NULL;
 	List *placementEntryList = NIL;
-	ListCell *placementEntryCell = NULL;
 	MultiConnection *chosenConnection = NULL;
 
 	if (userName == NULL)
@@ -338,6 +352,277 @@ StartPlacementListConnection(uint32 flags, List *placementAccessList,
 	 * Now that a connection has been chosen, initialise or update the connection
 	 * references for all placements.
 	 */
+	AssignPlacementListToConnection(placementAccessList, placementEntryList,
+									chosenConnection, userName);
+
+	if (freeUserName)
+	{
+		pfree(freeUserName);
+	}
+
+	return chosenConnection;
+}
+
+
+/*
+ * GetConnectionIfPlacementAccessedInXact returns the connection over which the
+ * given placements were accessed in the current transaction, or NULL if they
+ * have not been accessed yet. It errors out if the accesses cannot be
+ * performed over a single connection, in the same way as
+ * StartPlacementListConnection does.
+ */
+MultiConnection *
+GetConnectionIfPlacementAccessedInXact(int flags, List *placementAccessList,
+									   const char *userName)
+{
+	MultiConnection *connection = NULL;
+	char *freeUserName = NULL;
+	List *placementEntryList = NIL;
+
+	if (userName == NULL)
+	{
+		userName = freeUserName = CurrentUserName();
+	}
+
+	connection = FindPlacementListConnection(flags, placementAccessList, userName,
+											 &placementEntryList);
+
+	if (freeUserName != NULL)
+	{
+		pfree(freeUserName);
+	}
+
+	return connection;
+}
+
+
+/*
+ * RecordPlacementListAccess registers that the placement accesses in
+ * placementAccessList are performed over the given connection, such that
+ * subsequent commands in the transaction use the same connection for those
+ * placements. This is meant for executors that pick connections themselves
+ * rather than through StartPlacementListConnection. Such executors should
+ * call GetConnectionIfPlacementAccessedInXact first, since this function
+ * does not check whether the accesses conflict with earlier ones.
+ */
+void
+RecordPlacementListAccess(List *placementAccessList, MultiConnection *connection,
+						  const char *userName)
+{
+	char *freeUserName = NULL;
+	ListCell *placementAccessCell = NULL;
+	List *recordedAccessList = NIL;
+	List *placementEntryList = NIL;
+
+	if (userName == NULL)
+	{
+		userName = freeUserName = CurrentUserName();
+	}
+
+	foreach(placementAccessCell, placementAccessList)
+	{
+		ShardPlacementAccess *placementAccess =
+			(ShardPlacementAccess *) lfirst(placementAccessCell);
+		ShardPlacement *placement = placementAccess->placement;
+		ConnectionPlacementHashEntry *placementEntry = NULL;
+
+		/* dummy placements of SELECTs that prune to 0 shards are not tracked */
+		if (placement->shardId == INVALID_SHARD_ID)
+		{
+			continue;
+		}
+
+		placementEntry = FindOrCreatePlacementEntry(placement);
+
+		recordedAccessList = lappend(recordedAccessList, placementAccess);
+		placementEntryList = lappend(placementEntryList, placementEntry);
+	}
+
+	AssignPlacementListToConnection(recordedAccessList, placementEntryList,
+									connection, userName);
+
+	if (freeUserName != NULL)
+	{
+		pfree(freeUserName);
+	}
+}
+
+
+/*
+ * PlacementAccessedInXact returns whether the given placement, or a placement
+ * that is co-located with it, was accessed over a connection in the current
+ * transaction, in which case the remote transaction may hold locks on it.
+ */
+bool
+PlacementAccessedInXact(ShardPlacement *placement)
+{
+	ConnectionPlacementHashKey placementKey;
+	ConnectionPlacementHashEntry *placementEntry = NULL;
+	bool found = false;
+
+	placementKey.placementId = placement->placementId;
+
+	placementEntry = hash_search(ConnectionPlacementHash, &placementKey, HASH_FIND,
+								 &found);
+	if (found && (placementEntry->primaryConnection->connection != NULL ||
+				  placementEntry->hasSecondaryConnections))
+	{
+		return true;
+	}
+
+	if (placement->partitionMethod == DISTRIBUTE_BY_HASH ||
+		placement->partitionMethod == DISTRIBUTE_BY_NONE)
+	{
+		ColocatedPlacementsHashKey colocatedKey;
+		ColocatedPlacementsHashEntry *colocatedEntry = NULL;
+
+		strcpy(colocatedKey.nodeName, placement->nodeName);
+		colocatedKey.nodePort = placement->nodePort;
+		colocatedKey.colocationGroupId = placement->colocationGroupId;
+		colocatedKey.representativeValue = placement->representativeValue;
+
+		colocatedEntry = hash_search(ColocatedPlacementsHash, &colocatedKey,
+									 HASH_FIND, &found);
+		if (found && (colocatedEntry->primaryConnection->connection != NULL ||
+					  colocatedEntry->hasSecondaryConnections))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * CanReadPlacementListLocally returns whether the placements in the given
+ * access list can be read by the backend itself rather than over a
+ * connection. That is not the case if any of the placements, or the
+ * placements co-located with them, were modified over a connection in the
+ * current transaction, since those changes are not visible locally.
+ */
+bool
+CanReadPlacementListLocally(List *placementAccessList)
+{
+	ListCell *placementAccessCell = NULL;
+
+	foreach(placementAccessCell, placementAccessList)
+	{
+		ShardPlacementAccess *placementAccess =
+			(ShardPlacementAccess *) lfirst(placementAccessCell);
+		ShardPlacement *placement = placementAccess->placement;
+		ConnectionPlacementHashEntry *placementEntry = NULL;
+		ConnectionReference *placementConnection = NULL;
+
+		if (placement->shardId == INVALID_SHARD_ID)
+		{
+			return false;
+		}
+
+		placementEntry = FindOrCreatePlacementEntry(placement);
+		placementConnection = placementEntry->primaryConnection;
+
+		if (placementConnection->hadDML || placementConnection->hadDDL)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * RecordPlacementListLocalAccess registers that the placements in the given
+ * access list were read by the backend itself, such that DDL commands on the
+ * placements in the same transaction are not sent over a connection.
+ */
+void
+RecordPlacementListLocalAccess(List *placementAccessList)
+{
+	ListCell *placementAccessCell = NULL;
+
+	foreach(placementAccessCell, placementAccessList)
+	{
+		ShardPlacementAccess *placementAccess =
+			(ShardPlacementAccess *) lfirst(placementAccessCell);
+		ShardPlacement *placement = placementAccess->placement;
+		ConnectionPlacementHashEntry *placementEntry = NULL;
+
+		Assert(placementAccess->accessType == PLACEMENT_ACCESS_SELECT);
+
+		placementEntry = FindOrCreatePlacementEntry(placement);
+		placementEntry->accessedLocally = true;
+
+		if (placementEntry->colocatedEntry != NULL)
+		{
+			placementEntry->colocatedEntry->accessedLocally = true;
+		}
+	}
+}
+
+
+/*
+ * CanModifyPlacementLocally returns whether the given placement can be modified
+ * by the backend itself rather than over a connection. That is only the case if
+ * neither the placement nor the placements co-located with it were accessed over
+ * a connection in the current transaction. Such a connection might not see the
+ * local changes, or hold locks that conflict with them.
+ */
+bool
+CanModifyPlacementLocally(ShardPlacement *placement)
+{
+	ConnectionPlacementHashEntry *placementEntry = FindOrCreatePlacementEntry(placement);
+	ColocatedPlacementsHashEntry *colocatedEntry = placementEntry->colocatedEntry;
+
+	if (placementEntry->primaryConnection->connection != NULL ||
+		placementEntry->hasSecondaryConnections)
+	{
+		return false;
+	}
+
+	if (colocatedEntry != NULL && colocatedEntry->hasSecondaryConnections)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * RecordPlacementLocalModification registers that the given placement was
+ * modified by the backend itself, such that later accesses to the placement
+ * in the same transaction are not sent over a connection, which would not see
+ * the changes.
+ */
+void
+RecordPlacementLocalModification(ShardPlacement *placement)
+{
+	ConnectionPlacementHashEntry *placementEntry = FindOrCreatePlacementEntry(placement);
+
+	placementEntry->modifiedLocally = true;
+
+	if (placementEntry->colocatedEntry != NULL)
+	{
+		placementEntry->colocatedEntry->modifiedLocally = true;
+	}
+}
+
+
+/*
+ * AssignPlacementListToConnection records that the given connection is used to
+ * perform the placement accesses in placementAccessList. placementEntryList
+ * contains the placement entries returned by FindPlacementListConnection, in
+ * the same order as placementAccessList.
+ */
+static void
+AssignPlacementListToConnection(List *placementAccessList, List *placementEntryList,
+								MultiConnection *chosenConnection, const char *userName)
+{
+	ListCell *placementAccessCell = NULL;
+	ListCell *placementEntryCell = NULL;
+
 	forboth(placementAccessCell, placementAccessList,
 			placementEntryCell, placementEntryList)
 	{
@@ -419,13 +704,6 @@ StartPlacementListConnection(uint32 flags, List *placementAccessList,
 			placementConnection->hadDML = true;
 		}
 	}
-
-	if (freeUserName)
-	{
-		pfree(freeUserName);
-	}
-
-	return chosenConnection;
 }
 
 
@@ -492,6 +770,33 @@ FindPlacementListConnection(int flags, List *placementAccessList, const char *us
 		colocatedEntry = placementEntry->colocatedEntry;
 		placementConnection = placementEntry->primaryConnection;
 
+		/*
+		 * A placement that was read locally holds a lock in this backend that
+		 * conflicts with DDL, so running DDL over a connection would create a
+		 * self-deadlock.
+		 */
+		if (accessType == PLACEMENT_ACCESS_DDL &&
+			(placementEntry->accessedLocally ||
+			 (colocatedEntry != NULL && colocatedEntry->accessedLocally)))
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_ACTIVE_SQL_TRANSACTION),
+					 errmsg("cannot perform DDL on placement " UINT64_FORMAT
+							", which has been read locally in the same transaction",
+							placement->placementId)));
+		}
+
+		/* changes made by the backend itself are not visible to connections */
+		if (placementEntry->modifiedLocally ||
+			(colocatedEntry != NULL && colocatedEntry->modifiedLocally))
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_ACTIVE_SQL_TRANSACTION),
+					 errmsg("cannot access placement " UINT64_FORMAT " over a "
+							"connection, since it has been modified locally in the "
+							"same transaction", placement->placementId)));
+		}
+
 		/* note: the Asserts below are primarily for clarifying the conditions */
 
 		if (placementConnection->connection == NULL)
@@ -674,6 +979,8 @@ FindOrCreatePlacementEntry(ShardPlacement *placement)
 		placementEntry->failed = false;
 		placementEntry->primaryConnection = NULL;
 		placementEntry->hasSecondaryConnections = false;
+		placementEntry->accessedLocally = false;
+		placementEntry->modifiedLocally = false;
 		placementEntry->colocatedEntry = NULL;
 
 		if (placement->partitionMethod == DISTRIBUTE_BY_HASH ||
@@ -712,6 +1019,8 @@ FindOrCreatePlacementEntry(ShardPlacement *placement)
 				colocatedEntry->primaryConnection = connectionReference;
 
 				colocatedEntry->hasSecondaryConnections = false;
+				colocatedEntry->accessedLocally = false;
+				colocatedEntry->modifiedLocally = false;
 			}
 
 			/*
@@ -752,9 +1061,11 @@ CanUseExistingConnection(uint32 flags, const char *userName,
 		/* if already closed connection obviously not usable */
 		return false;
 	}
-	else if (connection->claimedExclusively)
+	else if (connection->claimedExclusively &&
+			 !((flags & SHARE_MODIFYING_CONNECTION) &&
+			   (connectionReference->hadDDL || connectionReference->hadDML)))
 	{
-		/* already used */
+		/* already used, and the caller cannot share it */
 		return false;
 	}
 	else if (flags & FORCE_NEW_CONNECTION)
@@ -13,11 +13,17 @@
 
 #include "libpq-fe.h"
 
+#include "access/hash.h"
 #include "distributed/connection_management.h"
+#include "distributed/connection_wait_stats.h"
+#include "distributed/node_health.h"
+#include "distributed/query_trace.h"
 #include "distributed/remote_commands.h"
 #include "lib/stringinfo.h"
 #include "miscadmin.h"
 #include "storage/latch.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
 #include "utils/palloc.h"
 
 
@@ -27,11 +33,41 @@
 /* GUC, determining whether statements sent to remote nodes are logged */
 bool LogRemoteCommands = false;
 
+/* GUC, maximum number of statements prepared on a remote connection */
+int MaxPreparedStatementsPerConnection = 0;
 
-static bool FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts);
+/*
+ * Counter that is incremented when the shards may have changed in a way that
+ * makes statements prepared on the workers fail, for instance when a column
+ * changed its type. Connections prepare their statements anew after it
+ * changed.
+ */
+static uint64 PreparedStatementGeneration = 0;
+
+
+/*
+ * PreparedStatementEntry maps the text and parameter types of a command to
+ * the name of the statement prepared for it on a connection.
+ */
+typedef struct PreparedStatementEntry
+{
+	char *statementKey;
+	char statementName[NAMEDATALEN];
+} PreparedStatementEntry;
+
+
+static bool FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts,
+							   ConnectionWaitEvent waitEvent);
+static bool FlushPendingCopyData(MultiConnection *connection, bool raiseInterrupts);
+static List * ConnectionsWithPendingCopyData(MultiConnection *connection);
 static WaitEventSet * BuildWaitEventSet(MultiConnection **allConnections,
 										int totalConnectionCount,
 										int pendingConnectionsStartIndex);
+static char * PreparedStatementName(MultiConnection *connection, const char *command,
+									int parameterCount, const Oid *parameterTypes);
+static uint32 PreparedStatementKeyHash(const void *key, Size keySize);
+static int PreparedStatementKeyCompare(const void *leftKey, const void *rightKey,
+									   Size keySize);
 
 
 /* simple helpers */
@@ -244,6 +280,14 @@ ReportConnectionError(MultiConnection *connection, int elevel)
 	char *nodeName = connection->hostname;
 	int nodePort = connection->port;
 
+	if (connection->unreachableNodeSkipped)
+	{
+		ereport(elevel, (errmsg("connection error: %s:%d", nodeName, nodePort),
+						 errdetail("the node could not be connected to within the "
+								   "last %d ms", UnreachableNodeRetryInterval)));
+		return;
+	}
+
 	ereport(elevel, (errmsg("connection error: %s:%d", nodeName, nodePort),
 					 errdetail("%s", pchomp(PQerrorMessage(connection->pgConn)))));
 }
@@ -352,8 +396,6 @@ void
 ExecuteCriticalRemoteCommand(MultiConnection *connection, const char *command)
 {
 	int querySent = 0;
-	PGresult *result = NULL;
-	bool raiseInterrupts = true;
 
 	querySent = SendRemoteCommand(connection, command);
 	if (querySent == 0)
@@ -361,14 +403,36 @@ ExecuteCriticalRemoteCommand(MultiConnection *connection, const char *command)
 		ReportConnectionError(connection, ERROR);
 	}
 
-	result = GetRemoteCommandResult(connection, raiseInterrupts);
-	if (!IsResponseOK(result))
+	FinishCriticalRemoteCommand(connection);
+}
+
+
+/*
+ * FinishCriticalRemoteCommand reads all results of a critical command that was
+ * sent over the given connection using SendRemoteCommand. Since the command may
+ * consist of multiple statements, we check all results, and error out if any
+ * of the statements failed.
+ */
+void
+FinishCriticalRemoteCommand(MultiConnection *connection)
+{
+	bool raiseInterrupts = true;
+
+	while (true)
 	{
-		ReportResultError(connection, result, ERROR);
-	}
+		PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (result == NULL)
+		{
+			break;
+		}
 
-	PQclear(result);
-	ForgetResults(connection);
+		if (!IsResponseOK(result))
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+	}
 }
 
 
@@ -413,14 +477,16 @@ ExecuteOptionalRemoteCommand(MultiConnection *connection, const char *command,
  * and accepts a MultiConnection instead of a plain PGconn. It makes sure it can
  * send commands asynchronously without blocking (at the potential expense of
  * an additional memory allocation). The command string can only include a single
- * command since PQsendQueryParams() supports only that.
+ * command since PQsendQueryParams() supports only that. If binaryResults is
+ * true, the results are requested in binary format.
  */
 int
 SendRemoteCommandParams(MultiConnection *connection, const char *command,
 						int parameterCount, const Oid *parameterTypes,
-						const char *const *parameterValues)
+						const char *const *parameterValues, bool binaryResults)
 {
 	PGconn *pgConn = connection->pgConn;
+	int resultFormat = binaryResults ? 1 : 0;
 	int rc = 0;
 
 	LogRemoteCommand(connection, command);
@@ -437,12 +503,258 @@ SendRemoteCommandParams(MultiConnection *connection, const char *command,
 	Assert(PQisnonblocking(pgConn));
 
 	rc = PQsendQueryParams(pgConn, command, parameterCount, parameterTypes,
-						   parameterValues, NULL, NULL, 0);
+						   parameterValues, NULL, NULL, resultFormat);
+	if (rc == 1)
+	{
+		RecordQueryTraceNodeEvent(QUERY_TRACE_QUERY_SENT, connection->hostname,
+								  connection->port, 0);
+	}
+
+	return rc;
+}
+
+
+/*
+ * SendRemoteCommandPrepared is like SendRemoteCommandParams, but executes a
+ * statement that is prepared on the connection the first time the command is
+ * sent with the same parameter types, such that the worker does not have to
+ * parse and plan the command every time. If the statement cannot be prepared,
+ * for instance because the connection reached
+ * citus.max_prepared_statements_per_connection, the command is sent as is.
+ */
+int
+SendRemoteCommandPrepared(MultiConnection *connection, const char *command,
+						  int parameterCount, const Oid *parameterTypes,
+						  const char *const *parameterValues, bool binaryResults)
+{
+	PGconn *pgConn = connection->pgConn;
+	int resultFormat = binaryResults ? 1 : 0;
+	char *statementName = NULL;
+	int rc = 0;
+
+	statementName = PreparedStatementName(connection, command, parameterCount,
+										  parameterTypes);
+	if (statementName == NULL)
+	{
+		return SendRemoteCommandParams(connection, command, parameterCount,
+									   parameterTypes, parameterValues, binaryResults);
+	}
+
+	LogRemoteCommand(connection, command);
+
+	rc = PQsendQueryPrepared(pgConn, statementName, parameterCount, parameterValues,
+							 NULL, NULL, resultFormat);
+	if (rc == 1)
+	{
+		RecordQueryTraceNodeEvent(QUERY_TRACE_QUERY_SENT, connection->hostname,
+								  connection->port, 0);
+	}
 
 	return rc;
 }
 
 
+/*
+ * PreparedStatementName returns the name of the statement prepared for the
+ * given command and parameter types on the connection. If there is none yet,
+ * the statement is prepared, which takes a round trip. NULL is returned if
+ * the statement could not be prepared, in which case sending the command
+ * itself reports the problem.
+ */
+static char *
+PreparedStatementName(MultiConnection *connection, const char *command,
+					  int parameterCount, const Oid *parameterTypes)
+{
+	PGconn *pgConn = connection->pgConn;
+	PreparedStatementEntry *statementEntry = NULL;
+	StringInfo statementKey = makeStringInfo();
+	char *statementKeyData = NULL;
+	char statementName[NAMEDATALEN];
+	PGresult *result = NULL;
+	bool raiseInterrupts = true;
+	bool statementPrepared = false;
+	bool found = false;
+	int parameterIndex = 0;
+
+	if (MaxPreparedStatementsPerConnection <= 0 ||
+		!pgConn || PQstatus(pgConn) != CONNECTION_OK)
+	{
+		return NULL;
+	}
+
+	/* forget statements that were prepared before the last invalidation */
+	if (connection->preparedStatementHash != NULL &&
+		connection->preparedStatementGeneration != PreparedStatementGeneration)
+	{
+		ResetPreparedStatements(connection);
+	}
+
+	if (connection->preparedStatementHash == NULL)
+	{
+		HASHCTL info;
+		int hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+		connection->preparedStatementContext =
+			AllocSetContextCreate(ConnectionContext, "Prepared Statement Context",
+								  ALLOCSET_DEFAULT_MINSIZE,
+								  ALLOCSET_DEFAULT_INITSIZE,
+								  ALLOCSET_DEFAULT_MAXSIZE);
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(char *);
+		info.entrysize = sizeof(PreparedStatementEntry);
+		info.hash = PreparedStatementKeyHash;
+		info.match = PreparedStatementKeyCompare;
+		info.hcxt = connection->preparedStatementContext;
+
+		connection->preparedStatementHash =
+			hash_create("Prepared Statement Hash", 32, &info, hashFlags);
+		connection->preparedStatementGeneration = PreparedStatementGeneration;
+	}
+
+	/* the same command with other parameter types needs another statement */
+	appendStringInfoString(statementKey, command);
+	for (parameterIndex = 0; parameterIndex < parameterCount; parameterIndex++)
+	{
+		appendStringInfo(statementKey, "|%u", parameterTypes[parameterIndex]);
+	}
+
+	statementKeyData = statementKey->data;
+	statementEntry = hash_search(connection->preparedStatementHash, &statementKeyData,
+								 HASH_FIND, &found);
+	if (found)
+	{
+		return statementEntry->statementName;
+	}
+
+	if (hash_get_num_entries(connection->preparedStatementHash) >=
+		MaxPreparedStatementsPerConnection)
+	{
+		return NULL;
+	}
+
+	/* statement names are never reused, even after an invalidation */
+	snprintf(statementName, NAMEDATALEN, "citus_statement_" UINT64_FORMAT,
+			 ++connection->preparedStatementCounter);
+
+	if (PQsendPrepare(pgConn, statementName, command, parameterCount,
+					  parameterTypes) == 0)
+	{
+		return NULL;
+	}
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	statementPrepared = (PQresultStatus(result) == PGRES_COMMAND_OK);
+	PQclear(result);
+	ForgetResults(connection);
+
+	if (!statementPrepared)
+	{
+		return NULL;
+	}
+
+	statementKeyData = MemoryContextStrdup(connection->preparedStatementContext,
+										   statementKey->data);
+	statementEntry = hash_search(connection->preparedStatementHash, &statementKeyData,
+								 HASH_ENTER, &found);
+	strlcpy(statementEntry->statementName, statementName, NAMEDATALEN);
+
+	return statementEntry->statementName;
+}
+
+
+/*
+ * PreparedStatementKeyHash hashes the string that the key points to.
+ */
+static uint32
+PreparedStatementKeyHash(const void *key, Size keySize)
+{
+	const char *statementKey = *((const char **) key);
+
+	return hash_any((const unsigned char *) statementKey, strlen(statementKey));
+}
+
+
+/*
+ * PreparedStatementKeyCompare compares the strings that the keys point to.
+ */
+static int
+PreparedStatementKeyCompare(const void *leftKey, const void *rightKey, Size keySize)
+{
+	const char *leftStatementKey = *((const char **) leftKey);
+	const char *rightStatementKey = *((const char **) rightKey);
+
+	return strcmp(leftStatementKey, rightStatementKey);
+}
+
+
+/*
+ * InvalidatePreparedStatements makes all connections prepare their statements
+ * anew before they are executed next. It is called after distributed DDL
+ * commands, since changing the result type of a statement makes the workers
+ * refuse to execute it.
+ */
+void
+InvalidatePreparedStatements(void)
+{
+	PreparedStatementGeneration++;
+}
+
+
+/*
+ * ResetPreparedStatements forgets the statements prepared on the connection.
+ * The statements are not deallocated on the worker, which would take a round
+ * trip, and they are gone once the connection is closed.
+ */
+void
+ResetPreparedStatements(MultiConnection *connection)
+{
+	if (connection->preparedStatementContext != NULL)
+	{
+		MemoryContextDelete(connection->preparedStatementContext);
+	}
+
+	connection->preparedStatementContext = NULL;
+	connection->preparedStatementHash = NULL;
+}
+
+
+/*
+ * ParallelWorkersCommand returns the command that sets max_parallel_workers_per_gather
+ * to the given number of parallel workers on the connection, or the command that
+ * resets it if the number is 0. It returns NULL if the connection already has
+ * the setting. The caller records the setting in the connection once the command
+ * succeeded, and should only send it outside of transaction blocks, since the
+ * setting would be undone if the remote transaction aborts.
+ */
+char *
+ParallelWorkersCommand(MultiConnection *connection, int parallelWorkerCount)
+{
+	StringInfo parallelWorkersCommand = NULL;
+
+	if (connection->parallelWorkerCount == parallelWorkerCount)
+	{
+		return NULL;
+	}
+
+	parallelWorkersCommand = makeStringInfo();
+
+	if (parallelWorkerCount > 0)
+	{
+		appendStringInfo(parallelWorkersCommand,
+						 "SET max_parallel_workers_per_gather TO %d",
+						 parallelWorkerCount);
+	}
+	else
+	{
+		appendStringInfoString(parallelWorkersCommand,
+							   "RESET max_parallel_workers_per_gather");
+	}
+
+	return parallelWorkersCommand->data;
+}
+
+
 /*
  * SendRemoteCommand is a PQsendQuery wrapper that logs remote commands, and
  * accepts a MultiConnection instead of a plain PGconn. It makes sure it can
@@ -470,6 +782,11 @@ SendRemoteCommand(MultiConnection *connection, const char *command)
 	Assert(PQisnonblocking(pgConn));
 
 	rc = PQsendQuery(pgConn, command);
+	if (rc == 1)
+	{
+		RecordQueryTraceNodeEvent(QUERY_TRACE_QUERY_SENT, connection->hostname,
+								  connection->port, 0);
+	}
 
 	return rc;
 }
@@ -539,7 +856,7 @@ GetRemoteCommandResult(MultiConnection *connection, bool raiseInterrupts)
 		return PQgetResult(connection->pgConn);
 	}
 
-	if (!FinishConnectionIO(connection, raiseInterrupts))
+	if (!FinishConnectionIO(connection, raiseInterrupts, CONNECTION_WAIT_RESULT))
 	{
 		/* some error(s) happened while doing the I/O, signal the callers */
 		if (PQstatus(pgConn) == CONNECTION_BAD)
@@ -595,13 +912,29 @@ PutRemoteCopyData(MultiConnection *connection, const char *buffer, int nbytes)
 	 * providing back pressure based on experimentation that showed
 	 * throughput get worse at 4MB and lower due to the number of CPU
 	 * cycles spent in networking system calls.
+	 *
+	 * Usually the worker keeps up and the buffer is already empty by then.
+	 * Otherwise, we keep sending to all connections with pending COPY data
+	 * while we wait, such that a slow worker does not stall the others.
 	 */
 
 	connection->copyBytesWrittenSinceLastFlush += nbytes;
 	if (connection->copyBytesWrittenSinceLastFlush > MAX_PUT_COPY_DATA_BUFFER_SIZE)
 	{
+		int sendStatus = PQflush(pgConn);
+
 		connection->copyBytesWrittenSinceLastFlush = 0;
-		return FinishConnectionIO(connection, allowInterrupts);
+
+		if (sendStatus == -1)
+		{
+			return false;
+		}
+		else if (sendStatus == 1)
+		{
+			connection->copyBackPressureCount++;
+
+			return FlushPendingCopyData(connection, allowInterrupts);
+		}
 	}
 
 	return true;
@@ -638,7 +971,85 @@ PutRemoteCopyEnd(MultiConnection *connection, const char *errormsg)
 
 	connection->copyBytesWrittenSinceLastFlush = 0;
 
-	return FinishConnectionIO(connection, allowInterrupts);
+	return FinishConnectionIO(connection, allowInterrupts, CONNECTION_WAIT_COPY_FLUSH);
+}
+
+
+/*
+ * GetRemoteCopyData is a wrapper around PQgetCopyData() that waits for the
+ * next row of a COPY ... TO STDOUT to arrive, while accepting interrupts as
+ * described for GetRemoteCommandResult(). The row is returned in buffer, which
+ * the caller frees with PQfreemem().
+ *
+ * Returns the length of the row, -1 when the COPY is done, or -2 if it failed.
+ */
+int
+GetRemoteCopyData(MultiConnection *connection, char **buffer, bool raiseInterrupts)
+{
+	PGconn *pgConn = connection->pgConn;
+	int socket = PQsocket(pgConn);
+	const int asynchronous = 1;
+	TimestampTz waitStart = 0;
+	int receiveLength = 0;
+
+	while (true)
+	{
+		int waitFlags = WL_POSTMASTER_DEATH | WL_LATCH_SET | WL_SOCKET_READABLE;
+		int rc = 0;
+
+		receiveLength = PQgetCopyData(pgConn, buffer, asynchronous);
+		if (receiveLength != 0)
+		{
+			break;
+		}
+
+		if (waitStart == 0)
+		{
+			waitStart = ConnectionWaitStart(connection, CONNECTION_WAIT_RESULT);
+		}
+
+#if (PG_VERSION_NUM >= 100000)
+		rc = WaitLatchOrSocket(MyLatch, waitFlags, socket, 0, PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatchOrSocket(MyLatch, waitFlags, socket, 0);
+#endif
+
+		if (rc & WL_POSTMASTER_DEATH)
+		{
+			ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+		}
+
+		if (rc & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+
+			if (raiseInterrupts)
+			{
+				CHECK_FOR_INTERRUPTS();
+			}
+
+			if (InterruptHoldoffCount > 0 && (QueryCancelPending || ProcDiePending))
+			{
+				connection->remoteTransaction.transactionFailed = true;
+				receiveLength = -2;
+				break;
+			}
+		}
+
+		if (PQconsumeInput(pgConn) == 0)
+		{
+			receiveLength = -2;
+			break;
+		}
+	}
+
+	if (waitStart != 0)
+	{
+		RecordConnectionLatency(connection, CONNECTION_WAIT_RESULT, waitStart);
+		ConnectionWaitEnd();
+	}
+
+	return receiveLength;
 }
 
 
@@ -649,13 +1060,22 @@ PutRemoteCopyEnd(MultiConnection *connection, const char *errormsg)
  * See GetRemoteCommandResult() for documentation of interrupt handling
  * behaviour.
  *
+ * While waiting, the backend shows up in citus_stat_worker_waits with the
+ * given wait event, and the duration of the wait is added to the latency
+ * histograms of the node. When waiting for a result, the time spent waiting
+ * for the query to be sent is counted separately.
+ *
  * Returns true if IO was successfully completed, false otherwise.
  */
 static bool
-FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts)
+FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts,
+				   ConnectionWaitEvent waitEvent)
 {
 	PGconn *pgConn = connection->pgConn;
 	int socket = PQsocket(pgConn);
+	ConnectionWaitEvent currentWaitEvent = CONNECTION_WAIT_NONE;
+	TimestampTz waitStart = 0;
+	bool ioFinished = false;
 
 	Assert(pgConn);
 	Assert(PQisnonblocking(pgConn));
@@ -672,13 +1092,15 @@ FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts)
 		int rc = 0;
 		int waitFlags = WL_POSTMASTER_DEATH | WL_LATCH_SET;
 
+		ConnectionWaitEvent nextWaitEvent = waitEvent;
+
 		/* try to send all pending data */
 		sendStatus = PQflush(pgConn);
 
 		/* if sending failed, there's nothing more we can do */
 		if (sendStatus == -1)
 		{
-			return false;
+			break;
 		}
 		else if (sendStatus == 1)
 		{
@@ -688,7 +1110,7 @@ FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts)
 		/* if reading fails, there's not much we can do */
 		if (PQconsumeInput(pgConn) == 0)
 		{
-			return false;
+			break;
 		}
 		if (PQisBusy(pgConn))
 		{
@@ -698,7 +1120,25 @@ FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts)
 		if ((waitFlags & (WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE)) == 0)
 		{
 			/* no IO necessary anymore, we're done */
-			return true;
+			ioFinished = true;
+			break;
+		}
+
+		/* the result cannot arrive before the query is sent */
+		if (waitEvent == CONNECTION_WAIT_RESULT && sendStatus == 1)
+		{
+			nextWaitEvent = CONNECTION_WAIT_SEND;
+		}
+
+		if (nextWaitEvent != currentWaitEvent)
+		{
+			if (currentWaitEvent != CONNECTION_WAIT_NONE)
+			{
+				RecordConnectionLatency(connection, currentWaitEvent, waitStart);
+			}
+
+			waitStart = ConnectionWaitStart(connection, nextWaitEvent);
+			currentWaitEvent = nextWaitEvent;
 		}
 
 #if (PG_VERSION_NUM >= 100000)
@@ -735,7 +1175,224 @@ FinishConnectionIO(MultiConnection *connection, bool raiseInterrupts)
 		}
 	}
 
-	return false;
+	if (currentWaitEvent != CONNECTION_WAIT_NONE)
+	{
+		RecordConnectionLatency(connection, currentWaitEvent, waitStart);
+		ConnectionWaitEnd();
+	}
+
+	return ioFinished;
+}
+
+
+/*
+ * FlushPendingCopyData blocks until libpq sent all data that is buffered for
+ * the given connection. While waiting, it also sends the data buffered for
+ * other connections that are in the middle of a COPY, such that these do not
+ * sit idle behind a slow connection.
+ *
+ * Returns true if the data of the given connection was sent, false otherwise.
+ */
+static bool
+FlushPendingCopyData(MultiConnection *connection, bool raiseInterrupts)
+{
+	List *connectionList = ConnectionsWithPendingCopyData(connection);
+	int totalConnectionCount = list_length(connectionList);
+	int pendingConnectionsStartIndex = 0;
+	int connectionIndex = 0;
+	ListCell *connectionCell = NULL;
+	bool connectionFlushed = false;
+
+	MultiConnection **allConnections =
+		palloc(totalConnectionCount * sizeof(MultiConnection *));
+	WaitEvent *events = palloc((totalConnectionCount + 2) * sizeof(WaitEvent));
+	WaitEventSet *waitEventSet = NULL;
+	TimestampTz waitStart = 0;
+
+	foreach(connectionCell, connectionList)
+	{
+		allConnections[connectionIndex] = (MultiConnection *) lfirst(connectionCell);
+		connectionIndex++;
+	}
+
+	if (raiseInterrupts)
+	{
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	waitStart = ConnectionWaitStart(connection, CONNECTION_WAIT_COPY_FLUSH);
+
+	PG_TRY();
+	{
+		bool rebuildWaitEventSet = true;
+		bool flushDone = false;
+
+		while (!flushDone)
+		{
+			int eventIndex = 0;
+			int eventCount = 0;
+			long timeout = -1;
+			int pendingConnectionCount = totalConnectionCount -
+										 pendingConnectionsStartIndex;
+
+			/* we cannot disable wait events, so we rebuild the set instead */
+			if (rebuildWaitEventSet)
+			{
+				if (waitEventSet != NULL)
+				{
+					FreeWaitEventSet(waitEventSet);
+				}
+
+				waitEventSet = BuildWaitEventSet(allConnections, totalConnectionCount,
+												 pendingConnectionsStartIndex);
+
+				rebuildWaitEventSet = false;
+			}
+
+#if (PG_VERSION_NUM >= 100000)
+			eventCount = WaitEventSetWait(waitEventSet, timeout, events,
+										  pendingConnectionCount + 2,
+										  WAIT_EVENT_CLIENT_WRITE);
+#else
+			eventCount = WaitEventSetWait(waitEventSet, timeout, events,
+										  pendingConnectionCount + 2);
+#endif
+
+			for (; eventIndex < eventCount; eventIndex++)
+			{
+				WaitEvent *event = &events[eventIndex];
+				MultiConnection *pendingConnection = NULL;
+				int sendStatus = 0;
+
+				if (event->events & WL_POSTMASTER_DEATH)
+				{
+					ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+				}
+
+				if (event->events & WL_LATCH_SET)
+				{
+					ResetLatch(MyLatch);
+
+					if (raiseInterrupts)
+					{
+						CHECK_FOR_INTERRUPTS();
+					}
+
+					/* see FinishConnectionIO() */
+					if (InterruptHoldoffCount > 0 && (QueryCancelPending ||
+													  ProcDiePending))
+					{
+						connection->remoteTransaction.transactionFailed = true;
+						flushDone = true;
+						break;
+					}
+
+					continue;
+				}
+
+				pendingConnection = (MultiConnection *) event->user_data;
+
+				/* read what the server sent, so that it can accept more data */
+				if ((event->events & WL_SOCKET_READABLE) &&
+					PQconsumeInput(pendingConnection->pgConn) == 0)
+				{
+					sendStatus = -1;
+				}
+				else
+				{
+					sendStatus = PQflush(pendingConnection->pgConn);
+				}
+
+				if (sendStatus == 1)
+				{
+					/* there is still data left to send */
+					continue;
+				}
+
+				if (pendingConnection == connection)
+				{
+					connectionFlushed = (sendStatus == 0);
+					flushDone = true;
+					break;
+				}
+
+				/*
+				 * Another connection sent all its data, or failed. In the latter
+				 * case, the next call that uses the connection reports the error.
+				 */
+				if (sendStatus == 0)
+				{
+					pendingConnection->copyBytesWrittenSinceLastFlush = 0;
+				}
+
+				/* event index + pendingConnectionsStartIndex = connection index */
+				connectionIndex = event->pos + pendingConnectionsStartIndex;
+				allConnections[connectionIndex] =
+					allConnections[pendingConnectionsStartIndex];
+				allConnections[pendingConnectionsStartIndex] = pendingConnection;
+				pendingConnectionsStartIndex++;
+
+				/* the positions of the remaining events are no longer valid */
+				rebuildWaitEventSet = true;
+				break;
+			}
+		}
+
+		FreeWaitEventSet(waitEventSet);
+		waitEventSet = NULL;
+	}
+	PG_CATCH();
+	{
+		if (waitEventSet != NULL)
+		{
+			FreeWaitEventSet(waitEventSet);
+		}
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	RecordConnectionLatency(connection, CONNECTION_WAIT_COPY_FLUSH, waitStart);
+	ConnectionWaitEnd();
+
+	pfree(allConnections);
+	pfree(events);
+
+	return connectionFlushed;
+}
+
+
+/*
+ * ConnectionsWithPendingCopyData returns the given connection, followed by all
+ * other open connections to which COPY data was sent since they last flushed.
+ */
+static List *
+ConnectionsWithPendingCopyData(MultiConnection *connection)
+{
+	List *connectionList = list_make1(connection);
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry = NULL;
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *otherConnection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			if (otherConnection != connection &&
+				otherConnection->copyBytesWrittenSinceLastFlush > 0 &&
+				PQstatus(otherConnection->pgConn) == CONNECTION_OK)
+			{
+				connectionList = lappend(connectionList, otherConnection);
+			}
+		}
+	}
+
+	return connectionList;
 }
 
 
@@ -0,0 +1,549 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.c
+ *   Keeps track of the number of connections to each worker node across
+ *   all backends of the coordinator, to enforce citus.max_shared_pool_size.
+ *
+ *   Connections cannot be handed off between backends, so each backend still
+ *   owns its connections. Instead, the backends agree on how many connections
+ *   each of them may open: a backend first reserves a slot in the shared
+ *   counter of a worker node, and releases it once the connection is closed.
+ *   If no slot is available, the backend waits until another backend closes
+ *   one of its connections to the same worker node.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/hash.h"
+#include "access/htup_details.h"
+#include "distributed/hash_helpers.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#if (PG_VERSION_NUM >= 100000)
+#include "storage/condition_variable.h"
+#endif
+
+
+/*
+ * Number of milliseconds to sleep between checks for an available connection
+ * slot on PostgreSQL versions without condition variables.
+ */
+#define SHARED_CONNECTION_POLL_INTERVAL 10
+
+
+/*
+ * SharedConnectionStatsControlData is the header of the shared memory
+ * segment, holding the lock that protects the hash of connection counters.
+ */
+typedef struct SharedConnectionStatsControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+
+#if (PG_VERSION_NUM >= 100000)
+
+	/* signalled whenever a connection slot is released */
+	ConditionVariable connectionReleasedCV;
+#endif
+} SharedConnectionStatsControlData;
+
+
+/* hash key of the shared connection counters */
+typedef struct SharedConnStatsHashKey
+{
+	char hostname[MAX_NODE_LENGTH];
+	int32 port;
+} SharedConnStatsHashKey;
+
+
+/* hash entry of the shared connection counters */
+typedef struct SharedConnStatsHashEntry
+{
+	SharedConnStatsHashKey key;
+
+	/* number of connections to the node across all backends */
+	int connectionCount;
+} SharedConnStatsHashEntry;
+
+
+/* config variable for the maximum number of connections to a worker */
+int MaxSharedPoolSize = DISABLE_SHARED_CONNECTION_LIMIT;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static SharedConnectionStatsControlData *SharedConnectionStatsControl = NULL;
+
+/* hash of (hostname, port) -> number of connections across all backends */
+static HTAB *SharedConnStatsHash = NULL;
+
+
+static size_t SharedConnectionStatsShmemSize(void);
+static void SharedConnectionStatsShmemInit(void);
+static void BuildSharedConnStatsHashKey(SharedConnStatsHashKey *key,
+										const char *hostname, int port);
+static bool IncrementSharedConnectionCounterInternal(const char *hostname, int port,
+													 bool force);
+static uint32 SharedConnStatsHashHash(const void *key, Size keysize);
+static int SharedConnStatsHashCompare(const void *a, const void *b, Size keysize);
+
+
+PG_FUNCTION_INFO_V1(citus_remote_connection_stats);
+
+
+/*
+ * citus_remote_connection_stats returns the number of connections that all
+ * backends of this node currently hold to each of the worker nodes.
+ */
+Datum
+citus_remote_connection_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *returnSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext perQueryContext = NULL;
+	MemoryContext oldContext = NULL;
+	HASH_SEQ_STATUS status;
+	SharedConnStatsHashEntry *connectionEntry = NULL;
+
+	Datum values[3];
+	bool isNulls[3];
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (returnSetInfo == NULL || !IsA(returnSetInfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context " \
+						"that cannot accept a set")));
+	}
+
+	if (!(returnSetInfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+	}
+
+	/* build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	perQueryContext = returnSetInfo->econtext->ecxt_per_query_memory;
+
+	oldContext = MemoryContextSwitchTo(perQueryContext);
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	returnSetInfo->returnMode = SFRM_Materialize;
+	returnSetInfo->setResult = tupleStore;
+	returnSetInfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&SharedConnectionStatsControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, SharedConnStatsHash);
+	connectionEntry = (SharedConnStatsHashEntry *) hash_seq_search(&status);
+	while (connectionEntry != NULL)
+	{
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = PointerGetDatum(cstring_to_text(connectionEntry->key.hostname));
+		values[1] = Int32GetDatum(connectionEntry->key.port);
+		values[2] = Int32GetDatum(connectionEntry->connectionCount);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+		connectionEntry = (SharedConnStatsHashEntry *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&SharedConnectionStatsControl->lock);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * SharedConnectionLimitEnabled returns whether connections to the worker
+ * nodes are limited by citus.max_shared_pool_size.
+ */
+bool
+SharedConnectionLimitEnabled(void)
+{
+	return MaxSharedPoolSize != DISABLE_SHARED_CONNECTION_LIMIT;
+}
+
+
+/*
+ * TryToIncrementSharedConnectionCounter reserves a connection slot for the
+ * given worker node if one is available, and returns whether it did so.
+ */
+bool
+TryToIncrementSharedConnectionCounter(const char *hostname, int port)
+{
+	bool force = false;
+
+	return IncrementSharedConnectionCounterInternal(hostname, port, force);
+}
+
+
+/*
+ * WaitLoopForSharedConnection reserves a connection slot for the given worker
+ * node, waiting for other backends to release one if all slots are taken.
+ * The wait can be cancelled by the user.
+ */
+void
+WaitLoopForSharedConnection(const char *hostname, int port)
+{
+	if (TryToIncrementSharedConnectionCounter(hostname, port))
+	{
+		return;
+	}
+
+	ereport(DEBUG1, (errmsg("waiting for a connection slot to %s:%d, "
+							"citus.max_shared_pool_size is %d",
+							hostname, port, MaxSharedPoolSize)));
+
+#if (PG_VERSION_NUM >= 100000)
+	ConditionVariablePrepareToSleep(&SharedConnectionStatsControl->connectionReleasedCV);
+
+	while (!TryToIncrementSharedConnectionCounter(hostname, port))
+	{
+		ConditionVariableSleep(&SharedConnectionStatsControl->connectionReleasedCV,
+							   PG_WAIT_EXTENSION);
+	}
+
+	ConditionVariableCancelSleep();
+#else
+	while (!TryToIncrementSharedConnectionCounter(hostname, port))
+	{
+		int latchFlags = WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH;
+		int rc = WaitLatch(MyLatch, latchFlags, SHARED_CONNECTION_POLL_INTERVAL);
+
+		if (rc & WL_POSTMASTER_DEATH)
+		{
+			proc_exit(1);
+		}
+
+		if (rc & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+#endif
+}
+
+
+/*
+ * SharedConnectionCount returns the number of connections that the backends
+ * of this node currently hold to the given worker node.
+ */
+int
+SharedConnectionCount(const char *hostname, int port)
+{
+	SharedConnStatsHashKey connKey;
+	SharedConnStatsHashEntry *connectionEntry = NULL;
+	bool entryFound = false;
+	int connectionCount = 0;
+
+	BuildSharedConnStatsHashKey(&connKey, hostname, port);
+
+	LWLockAcquire(&SharedConnectionStatsControl->lock, LW_SHARED);
+
+	connectionEntry = (SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash,
+															   &connKey, HASH_FIND,
+															   &entryFound);
+	if (entryFound)
+	{
+		connectionCount = connectionEntry->connectionCount;
+	}
+
+	LWLockRelease(&SharedConnectionStatsControl->lock);
+
+	return connectionCount;
+}
+
+
+/*
+ * IncrementSharedConnectionCounter reserves a connection slot for the given
+ * worker node, even if that exceeds citus.max_shared_pool_size. It is used
+ * by backends that already hold a connection to the node, which could
+ * otherwise end up waiting for themselves.
+ */
+void
+IncrementSharedConnectionCounter(const char *hostname, int port)
+{
+	bool force = true;
+
+	IncrementSharedConnectionCounterInternal(hostname, port, force);
+}
+
+
+/*
+ * DecrementSharedConnectionCounter releases a connection slot of the given
+ * worker node, and wakes up backends that are waiting for one.
+ */
+void
+DecrementSharedConnectionCounter(const char *hostname, int port)
+{
+	SharedConnStatsHashKey connKey;
+	SharedConnStatsHashEntry *connectionEntry = NULL;
+	bool entryFound = false;
+
+	BuildSharedConnStatsHashKey(&connKey, hostname, port);
+
+	LWLockAcquire(&SharedConnectionStatsControl->lock, LW_EXCLUSIVE);
+
+	connectionEntry = (SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash,
+															   &connKey, HASH_FIND,
+															   &entryFound);
+	if (entryFound && connectionEntry->connectionCount > 0)
+	{
+		connectionEntry->connectionCount--;
+	}
+
+	LWLockRelease(&SharedConnectionStatsControl->lock);
+
+#if (PG_VERSION_NUM >= 100000)
+	ConditionVariableBroadcast(&SharedConnectionStatsControl->connectionReleasedCV);
+#endif
+}
+
+
+/*
+ * IncrementSharedConnectionCounterInternal increments the connection counter
+ * of the given worker node, unless that would exceed the shared limit and
+ * force is false. The function returns whether the counter was incremented.
+ */
+static bool
+IncrementSharedConnectionCounterInternal(const char *hostname, int port, bool force)
+{
+	SharedConnStatsHashKey connKey;
+	SharedConnStatsHashEntry *connectionEntry = NULL;
+	bool entryFound = false;
+	bool counterIncremented = false;
+
+	BuildSharedConnStatsHashKey(&connKey, hostname, port);
+
+	LWLockAcquire(&SharedConnectionStatsControl->lock, LW_EXCLUSIVE);
+
+	connectionEntry = (SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash,
+															   &connKey, HASH_ENTER_NULL,
+															   &entryFound);
+
+	/*
+	 * Out of shared memory for the hash, which can only happen with more
+	 * than citus.max_worker_nodes_tracked nodes. We do not want to block
+	 * connections to the node in that case, so we let them through untracked.
+	 */
+	if (connectionEntry == NULL)
+	{
+		LWLockRelease(&SharedConnectionStatsControl->lock);
+
+		ereport(DEBUG1, (errmsg("could not track the connection count to %s:%d",
+								hostname, port)));
+
+		return true;
+	}
+
+	if (!entryFound)
+	{
+		connectionEntry->connectionCount = 0;
+	}
+
+	if (force || !SharedConnectionLimitEnabled() ||
+		connectionEntry->connectionCount < MaxSharedPoolSize)
+	{
+		connectionEntry->connectionCount++;
+		counterIncremented = true;
+	}
+
+	LWLockRelease(&SharedConnectionStatsControl->lock);
+
+	return counterIncremented;
+}
+
+
+/*
+ * BuildSharedConnStatsHashKey fills the hash key for the given worker node.
+ */
+static void
+BuildSharedConnStatsHashKey(SharedConnStatsHashKey *key, const char *hostname,
+							int port)
+{
+	memset(key, 0, sizeof(SharedConnStatsHashKey));
+
+	strlcpy(key->hostname, hostname, MAX_NODE_LENGTH);
+	key->port = port;
+}
+
+
+/*
+ * InitializeSharedConnectionStats requests the necessary shared memory
+ * from Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeSharedConnectionStats(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(SharedConnectionStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedConnectionStatsShmemInit;
+}
+
+
+/*
+ * SharedConnectionStatsShmemSize computes how much shared memory is required.
+ */
+static size_t
+SharedConnectionStatsShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, sizeof(SharedConnectionStatsControlData));
+
+	/* we cannot connect to more nodes than we track */
+	hashSize = hash_estimate_size(MaxWorkerNodesTracked,
+								  sizeof(SharedConnStatsHashEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * SharedConnectionStatsShmemInit initializes the shared memory used for
+ * keeping track of the connection counters across backends.
+ */
+static void
+SharedConnectionStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedConnectionStatsControl =
+		(SharedConnectionStatsControlData *) ShmemInitStruct(
+			"Shared Connection Stats Data",
+			sizeof(SharedConnectionStatsControlData),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out all the memory */
+		memset(SharedConnectionStatsControl, 0,
+			   sizeof(SharedConnectionStatsControlData));
+
+#if (PG_VERSION_NUM >= 100000)
+		SharedConnectionStatsControl->trancheId = LWLockNewTrancheId();
+		SharedConnectionStatsControl->lockTrancheName = "Shared Connection Tracking";
+		LWLockRegisterTranche(SharedConnectionStatsControl->trancheId,
+							  SharedConnectionStatsControl->lockTrancheName);
+
+		ConditionVariableInit(&SharedConnectionStatsControl->connectionReleasedCV);
+#else
+		{
+			LWLockTranche *tranche = &SharedConnectionStatsControl->lockTranche;
+
+			SharedConnectionStatsControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &SharedConnectionStatsControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Shared Connection Tracking";
+			LWLockRegisterTranche(SharedConnectionStatsControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&SharedConnectionStatsControl->lock,
+						 SharedConnectionStatsControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(SharedConnStatsHashKey);
+	hashInfo.entrysize = sizeof(SharedConnStatsHashEntry);
+	hashInfo.hash = SharedConnStatsHashHash;
+	hashInfo.match = SharedConnStatsHashCompare;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
+
+	SharedConnStatsHash = ShmemInitHash("Shared Conn. Stats Hash",
+										MaxWorkerNodesTracked, MaxWorkerNodesTracked,
+										&hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/* SharedConnStatsHashHash hashes the hostname and port of a worker node */
+static uint32
+SharedConnStatsHashHash(const void *key, Size keysize)
+{
+	SharedConnStatsHashKey *entry = (SharedConnStatsHashKey *) key;
+	uint32 hash = 0;
+
+	hash = string_hash(entry->hostname, NAMEDATALEN);
+	hash = hash_combine(hash, hash_uint32(entry->port));
+
+	return hash;
+}
+
+
+/* SharedConnStatsHashCompare compares the hostname and port of worker nodes */
+static int
+SharedConnStatsHashCompare(const void *a, const void *b, Size keysize)
+{
+	SharedConnStatsHashKey *ca = (SharedConnStatsHashKey *) a;
+	SharedConnStatsHashKey *cb = (SharedConnStatsHashKey *) b;
+
+	if (strncmp(ca->hostname, cb->hostname, MAX_NODE_LENGTH) != 0 ||
+		ca->port != cb->port)
+	{
+		return 1;
+	}
+	else
+	{
+		return 0;
+	}
+}
@@ -0,0 +1,2294 @@
+/*-------------------------------------------------------------------------
+ *
+ * adaptive_executor.c
+ *
+ * The adaptive executor executes a list of tasks (queries on shards) over
+ * a pool of connections per worker node. It is meant to replace both the
+ * real-time executor, which opens one connection per task, and the parallel
+ * part of the router executor, which uses one connection per placement
+ * group.
+ *
+ * The executor keeps a queue of pending tasks for every worker. Each
+ * connection (session) in a worker pool picks up the next task from the
+ * queue once it finishes its current one. Already-open connections in the
+ * connection cache are used first. Additional connections are only opened
+ * when tasks have been waiting for longer than citus.executor_slow_start_interval,
+ * in which case the number of connections in the pool is doubled, up to
+ * citus.max_adaptive_executor_pool_size. The effect is that a query on
+ * many shards on a fast cluster completes over few connections, while slow
+ * queries still get parallelism.
+ *
+ * Placements that were already accessed in the current transaction are
+ * assigned to the connection that accessed them, such that multi-shard
+ * modifications can be executed in parallel inside transaction blocks
+ * without violating read-your-own-writes semantics.
+ *
+ * All connections are driven by a single event loop that uses a
+ * WaitEventSet, which is only rebuilt when the set of connections changes.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/xact.h"
+#include "distributed/adaptive_executor.h"
+#include "distributed/citus_custom_scan.h"
+#include "distributed/connection_management.h"
+#include "distributed/connection_wait_stats.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_partitioning_utils.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/multi_router_executor.h"
+#include "distributed/multi_server_executor.h"
+#include "distributed/node_health.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/placement_connection.h"
+#include "distributed/query_stats.h"
+#include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
+#include "distributed/resource_lock.h"
+#include "distributed/subplan_execution.h"
+#include "distributed/task_execution_stats.h"
+#include "distributed/tenant_admission.h"
+#include "distributed/transaction_management.h"
+#include "distributed/worker_manager.h"
+#include "lib/ilist.h"
+#include "storage/latch.h"
+#include "utils/int8.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+
+/* GUC, determining the maximum number of connections per worker in a pool */
+int MaxAdaptiveExecutorPoolSize = 16;
+
+/* GUC, number of milliseconds to wait before opening additional connections */
+int ExecutorSlowStartInterval = 10;
+
+
+/*
+ * TupleDestination describes the tuple store into which the rows returned by
+ * a group of tasks are written.
+ */
+typedef struct TupleDestination
+{
+	Tuplestorestate *tupleStore;
+	AttInMetadata *attributeInputMetadata;
+
+	/* size of data received, used to enforce max_intermediate_result_size */
+	DistributedExecutionStats *executionStats;
+} TupleDestination;
+
+
+/*
+ * DistributedExecution represents the execution of a list of tasks over
+ * pools of connections to the worker nodes.
+ */
+typedef struct DistributedExecution
+{
+	/* the command type of the tasks (SELECT, UPDATE, DELETE, or UTILITY for DDL) */
+	CmdType operation;
+
+	/* list of tasks to execute */
+	List *tasksToExecute;
+
+	/* maximum number of connections per worker node */
+	int maxPoolSize;
+
+	/* command sent on every session before its first task, NULL if none */
+	char *sessionSetupCommand;
+
+	/* destination of the results of each task, NULL if results are discarded */
+	List *tupleDestinationList;
+
+	/* parameters of the query, if any */
+	ParamListInfo paramListInfo;
+
+	/* list of WorkerPool structs, one per worker node */
+	List *workerList;
+
+	/* list of all WorkerSession structs across pools */
+	List *sessionList;
+
+	/* whether the wait event set needs to be rebuilt before the next wait */
+	bool connectionSetChanged;
+
+	/* wait event set containing the sockets of all live sessions */
+	WaitEventSet *waitEventSet;
+
+	/* array of events returned by WaitEventSetWait */
+	WaitEvent *events;
+	int eventSetSize;
+
+	/* number of tasks that did not finish on all placements yet */
+	int unfinishedTaskCount;
+
+	/* number of rows modified (or returned) by the tasks */
+	uint64 rowsProcessed;
+
+	/* placements that missed a modification and have to be marked inactive */
+	List *failedPlacementList;
+
+	/* state for building tuples from text results */
+	char **columnArray;
+	MemoryContext ioContext;
+} DistributedExecution;
+
+
+/*
+ * WorkerPool represents a pool of sessions on the same worker node.
+ */
+typedef struct WorkerPool
+{
+	/* distributed execution in which the pool participates */
+	DistributedExecution *distributedExecution;
+
+	/* worker node on which the sessions are opened */
+	char *nodeName;
+	int nodePort;
+
+	/* list of WorkerSession structs */
+	List *sessionList;
+
+	/* placement executions that can run on any session in the pool */
+	dlist_head pendingTaskQueue;
+	int pendingTaskCount;
+
+	/* time at which the last batch of connections was opened */
+	TimestampTz lastConnectionOpenTime;
+
+	/*
+	 * Set when citus.max_shared_pool_size prevented opening an additional
+	 * connection. We then only retry when existing sessions make progress.
+	 */
+	bool sharedPoolExhausted;
+
+	/* set when no connection to the worker could be established */
+	bool failed;
+} WorkerPool;
+
+
+/* states of a WorkerSession's connection */
+typedef enum WorkerSessionState
+{
+	SESSION_CONNECTING,
+	SESSION_CONNECTED,
+	SESSION_FAILED
+} WorkerSessionState;
+
+
+struct TaskPlacementExecution;
+
+
+/*
+ * WorkerSession represents a connection in a worker pool.
+ */
+typedef struct WorkerSession
+{
+	/* the connection, which is claimed exclusively by the execution */
+	MultiConnection *connection;
+
+	/* the pool the session belongs to */
+	WorkerPool *workerPool;
+
+	/* state of the connection */
+	WorkerSessionState sessionState;
+
+	/* placement executions that have to be run on this session */
+	dlist_head readyTaskQueue;
+
+	/* placement execution that is currently running, if any */
+	struct TaskPlacementExecution *currentTask;
+
+	/* whether the command of currentTask has been sent */
+	bool commandSent;
+
+	/* progress of the execution's session setup command on the session */
+	bool setupCommandSent;
+	bool setupCommandDone;
+
+	/* events we are currently waiting for and position in the wait event set */
+	int waitFlags;
+	int waitEventSetIndex;
+} WorkerSession;
+
+
+/* states of a placement execution */
+typedef enum TaskPlacementExecutionState
+{
+	PLACEMENT_EXECUTION_NOT_READY,
+	PLACEMENT_EXECUTION_READY,
+	PLACEMENT_EXECUTION_RUNNING,
+	PLACEMENT_EXECUTION_FINISHED,
+	PLACEMENT_EXECUTION_FAILED
+} TaskPlacementExecutionState;
+
+
+/*
+ * ShardCommandExecution represents the execution of a task on all of its
+ * placements.
+ */
+typedef struct ShardCommandExecution
+{
+	/* the task that is executed */
+	Task *task;
+
+	/* where results of the placement that serves the task are stored, or NULL */
+	TupleDestination *tupleDestination;
+
+	/* executions of the task on each of its placements */
+	struct TaskPlacementExecution **placementExecutions;
+	int placementExecutionCount;
+
+	/* number of placements on which the task finished or failed */
+	int finishedPlacementCount;
+
+	/* set once a modification succeeded on one of the placements */
+	bool modifiedFirstPlacement;
+
+	/* number of rows affected on the first placement that was modified */
+	uint64 affectedRowCount;
+} ShardCommandExecution;
+
+
+/*
+ * TaskPlacementExecution represents the execution of a task on a single
+ * placement.
+ */
+typedef struct TaskPlacementExecution
+{
+	/* the task execution this placement execution is part of */
+	ShardCommandExecution *shardCommandExecution;
+
+	/* the placement on which the task is executed */
+	ShardPlacement *shardPlacement;
+
+	/* placement accesses performed by the task on this placement */
+	List *placementAccessList;
+
+	/* pool of the worker node on which the placement is */
+	WorkerPool *workerPool;
+
+	/* session that has to be used, if the placement was accessed before */
+	WorkerSession *assignedSession;
+
+	/* current state of the placement execution */
+	TaskPlacementExecutionState executionState;
+
+	/* index of the placement in the task's placement list */
+	int placementExecutionIndex;
+
+	/* set when the remote command returned an error */
+	bool commandFailed;
+
+	/* set when rows of the placement were written to the tuple destination */
+	bool storedRows;
+
+	/* number of rows that the command returned or modified */
+	uint64 rowsProcessed;
+
+	/* number of bytes of the rows that were stored */
+	uint64 bytesReceived;
+
+	/* when the execution became ready and when its command was sent */
+	TimestampTz readyTime;
+	TimestampTz queryStartTime;
+
+	/* membership in the pending or ready task queue */
+	dlist_node taskQueueNode;
+} TaskPlacementExecution;
+
+
+/* local function forward declarations */
+static DistributedExecution * CreateDistributedExecution(CmdType operation,
+														 List *taskList,
+														 List *tupleDestinationList,
+														 ParamListInfo paramListInfo);
+static TupleDestination * CreateTupleDestination(Tuplestorestate *tupleStore,
+												 TupleDesc tupleDescriptor);
+static void StartDistributedExecution(DistributedExecution *execution);
+static void RunDistributedExecution(DistributedExecution *execution);
+static void MarkFailedPlacementsInactive(DistributedExecution *execution);
+static void FinishDistributedExecution(DistributedExecution *execution);
+static void AssignTasksToConnectionsOrWorkerPool(DistributedExecution *execution);
+static List * PlacementAccessListForTask(Task *task, ShardPlacement *placement,
+										 CmdType operation);
+static WorkerPool * FindOrCreateWorkerPool(DistributedExecution *execution,
+										   char *nodeName, int nodePort);
+static WorkerSession * FindOrCreateWorkerSession(WorkerPool *workerPool,
+												 MultiConnection *connection);
+static void ManageWorkerPool(WorkerPool *workerPool);
+static int WaitingTaskCount(WorkerPool *workerPool, int *liveSessionCount);
+static long NextEventTimeout(DistributedExecution *execution);
+static long MillisecondsUntil(TimestampTz startTime, int intervalMillis);
+static void RebuildWaitEventSet(DistributedExecution *execution);
+static void UpdateConnectionWaitFlags(WorkerSession *session, int waitFlags);
+static void ConnectionStateMachine(WorkerSession *session);
+static void TransactionStateMachine(WorkerSession *session);
+static bool CheckConnectionReady(WorkerSession *session);
+static TaskPlacementExecution * PopPlacementExecution(WorkerSession *session);
+static bool StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
+											 WorkerSession *session);
+static bool SendPlacementExecutionCommand(WorkerSession *session);
+static bool ReceiveSessionSetupResults(WorkerSession *session);
+static bool ReceiveResults(WorkerSession *session);
+static uint64 StoreResultRows(DistributedExecution *execution,
+							  TupleDestination *tupleDestination, PGresult *result);
+static void EnqueuePlacementExecution(TaskPlacementExecution *placementExecution);
+static void PlacementExecutionDone(TaskPlacementExecution *placementExecution,
+								   bool succeeded);
+static void PlacementExecutionFailed(TaskPlacementExecution *placementExecution);
+static void PlacementExecutionFinished(TaskPlacementExecution *placementExecution);
+static void WorkerSessionFailed(WorkerSession *session);
+static void WorkerPoolFailed(WorkerPool *workerPool);
+
+
+/*
+ * AdaptiveExecutorExecScan executes the tasks of the distributed plan using
+ * the adaptive executor, stores the results (if any) in the tuple store of
+ * the scan state and returns tuples one by one from the tuple store.
+ */
+TupleTableSlot *
+AdaptiveExecutorExecScan(CustomScanState *node)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+	TupleTableSlot *resultSlot = NULL;
+
+	if (!scanState->finishedRemoteScan)
+	{
+		DistributedPlan *distributedPlan = scanState->distributedPlan;
+		EState *executorState = scanState->customScanState.ss.ps.state;
+		ParamListInfo paramListInfo = executorState->es_param_list_info;
+		Job *workerJob = distributedPlan->workerJob;
+		List *taskList = workerJob->taskList;
+		CmdType operation = distributedPlan->operation;
+		bool hasReturning = distributedPlan->hasReturning;
+		List *tupleDestinationList = NIL;
+		DistributedExecution *execution = NULL;
+		CitusScanState *previousScanState = NULL;
+
+		QueryStatsRemoteExecutionStart(scanState);
+
+		if (operation == CMD_SELECT)
+		{
+			/* we are taking locks on partitions of partitioned tables */
+			LockPartitionsInRelationList(distributedPlan->relationIdList,
+										 AccessShareLock);
+
+			ExecuteSubPlans(distributedPlan);
+
+			/* selects always store their results */
+			hasReturning = true;
+		}
+
+		if (hasReturning)
+		{
+			TupleDesc tupleDescriptor =
+				scanState->customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+			TupleDestination *tupleDestination = NULL;
+			bool randomAccess = true;
+			bool interTransactions = false;
+			int taskIndex = 0;
+
+			scanState->tuplestorestate =
+				tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+
+			tupleDestination = CreateTupleDestination(scanState->tuplestorestate,
+													  tupleDescriptor);
+
+			/* all tasks write into the tuple store of the scan state */
+			for (taskIndex = 0; taskIndex < list_length(taskList); taskIndex++)
+			{
+				tupleDestinationList = lappend(tupleDestinationList, tupleDestination);
+			}
+		}
+
+		execution = CreateDistributedExecution(operation, taskList, tupleDestinationList,
+											   paramListInfo);
+
+		/* router queries count towards the limits of their tenant */
+		if (list_length(taskList) == 1)
+		{
+			scanState->tenantAdmission = AdmitTenantQuery((Task *) linitial(taskList));
+		}
+
+		previousScanState = BeginTaskStatsCollection(scanState);
+
+		StartDistributedExecution(execution);
+		RunDistributedExecution(execution);
+		FinishDistributedExecution(execution);
+
+		EndTaskStatsCollection(previousScanState);
+
+		ReleaseTenantAdmission(scanState->tenantAdmission);
+		scanState->tenantAdmission = NULL;
+
+		QueryStatsRemoteExecutionEnd();
+
+		if (operation != CMD_SELECT)
+		{
+			executorState->es_processed = execution->rowsProcessed;
+
+			if (list_length(taskList) > 1 || IsTransactionBlock())
+			{
+				XactModificationLevel = XACT_MODIFICATION_DATA;
+			}
+		}
+
+		scanState->finishedRemoteScan = true;
+	}
+
+	resultSlot = ReturnTupleFromTuplestore(scanState);
+
+	return resultSlot;
+}
+
+
+/*
+ * ExecuteTaskListsIntoTupleStores executes the tasks of all given task lists
+ * in a single distributed execution, such that tasks of different lists run
+ * concurrently over the same worker pools. The rows returned by the tasks of
+ * each list are written into the tuple store of that list, which is created
+ * if it does not exist yet.
+ *
+ * This is used to execute subplans that do not depend on each other at the
+ * same time, rather than paying for the latency of each of them in turn.
+ */
+void
+ExecuteTaskListsIntoTupleStores(List *taskListResultList)
+{
+	List *taskList = NIL;
+	List *tupleDestinationList = NIL;
+	ListCell *taskListResultCell = NULL;
+	DistributedExecution *execution = NULL;
+
+	foreach(taskListResultCell, taskListResultList)
+	{
+		TaskListResult *taskListResult = (TaskListResult *) lfirst(taskListResultCell);
+		TupleDestination *tupleDestination = NULL;
+		ListCell *taskCell = NULL;
+
+		if (taskListResult->tupleStore == NULL)
+		{
+			bool randomAccess = true;
+			bool interTransactions = false;
+
+			taskListResult->tupleStore =
+				tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+		}
+
+		tupleDestination = CreateTupleDestination(taskListResult->tupleStore,
+												  taskListResult->tupleDescriptor);
+
+		foreach(taskCell, taskListResult->taskList)
+		{
+			Task *task = (Task *) lfirst(taskCell);
+
+			taskList = lappend(taskList, task);
+			tupleDestinationList = lappend(tupleDestinationList, tupleDestination);
+		}
+	}
+
+	execution = CreateDistributedExecution(CMD_SELECT, taskList, tupleDestinationList,
+										   NULL);
+
+	StartDistributedExecution(execution);
+	RunDistributedExecution(execution);
+	FinishDistributedExecution(execution);
+}
+
+
+/*
+ * ExecuteUtilityTaskListWithoutResults executes the DDL tasks in the given list
+ * over pools of at most poolSize connections per worker node, such that every
+ * worker runs up to poolSize commands, for instance index builds, at a time.
+ * The commands run in the coordinated transaction, except when the commit
+ * protocol was set to bare for commands that cannot run in a transaction
+ * block, such as CREATE INDEX CONCURRENTLY or VACUUM.
+ *
+ * If sessionSetupCommand is not NULL, it is run on every connection before
+ * the first task, for instance to configure settings of the worker session.
+ *
+ * Locks on the shards are expected to be taken by the caller.
+ */
+void
+ExecuteUtilityTaskListWithoutResults(List *taskList, int poolSize,
+									 char *sessionSetupCommand)
+{
+	DistributedExecution *execution = NULL;
+
+	execution = CreateDistributedExecution(CMD_UTILITY, taskList, NIL, NULL);
+	execution->maxPoolSize = poolSize;
+	execution->sessionSetupCommand = sessionSetupCommand;
+
+	StartDistributedExecution(execution);
+	RunDistributedExecution(execution);
+	FinishDistributedExecution(execution);
+
+	XactModificationLevel = XACT_MODIFICATION_DATA;
+}
+
+
+/*
+ * CreateTupleDestination creates a destination for rows that are written into
+ * the given tuple store. Each destination keeps its own statistics, such that
+ * max_intermediate_result_size applies to every tuple store separately.
+ */
+static TupleDestination *
+CreateTupleDestination(Tuplestorestate *tupleStore, TupleDesc tupleDescriptor)
+{
+	TupleDestination *tupleDestination =
+		(TupleDestination *) palloc0(sizeof(TupleDestination));
+
+	tupleDestination->tupleStore = tupleStore;
+	tupleDestination->attributeInputMetadata = TupleDescGetAttInMetadata(tupleDescriptor);
+	tupleDestination->executionStats =
+		(DistributedExecutionStats *) palloc0(sizeof(DistributedExecutionStats));
+
+	return tupleDestination;
+}
+
+
+/*
+ * CreateDistributedExecution creates a distributed execution for the given
+ * list of tasks. The results of each task are written to the corresponding
+ * element of tupleDestinationList, or discarded if the list is empty.
+ */
+static DistributedExecution *
+CreateDistributedExecution(CmdType operation, List *taskList, List *tupleDestinationList,
+						   ParamListInfo paramListInfo)
+{
+	DistributedExecution *execution =
+		(DistributedExecution *) palloc0(sizeof(DistributedExecution));
+	ListCell *tupleDestinationCell = NULL;
+	int maxColumnCount = 0;
+
+	execution->operation = operation;
+	execution->tasksToExecute = taskList;
+	execution->maxPoolSize = MaxAdaptiveExecutorPoolSize;
+	execution->sessionSetupCommand = NULL;
+	execution->tupleDestinationList = tupleDestinationList;
+	execution->paramListInfo = paramListInfo;
+
+	execution->workerList = NIL;
+	execution->sessionList = NIL;
+	execution->connectionSetChanged = true;
+	execution->waitEventSet = NULL;
+	execution->events = NULL;
+	execution->eventSetSize = 0;
+
+	execution->unfinishedTaskCount = list_length(taskList);
+	execution->rowsProcessed = 0;
+	execution->failedPlacementList = NIL;
+
+	/* the column array is shared by all destinations, so size it for the widest */
+	foreach(tupleDestinationCell, tupleDestinationList)
+	{
+		TupleDestination *tupleDestination =
+			(TupleDestination *) lfirst(tupleDestinationCell);
+		int columnCount = tupleDestination->attributeInputMetadata->tupdesc->natts;
+
+		maxColumnCount = Max(maxColumnCount, columnCount);
+	}
+
+	if (tupleDestinationList != NIL)
+	{
+		execution->columnArray = (char **) palloc0(maxColumnCount * sizeof(char *));
+		execution->ioContext = AllocSetContextCreate(CurrentMemoryContext,
+													 "AdaptiveExecutor",
+													 ALLOCSET_DEFAULT_MINSIZE,
+													 ALLOCSET_DEFAULT_INITSIZE,
+													 ALLOCSET_DEFAULT_MAXSIZE);
+	}
+
+	return execution;
+}
+
+
+/*
+ * StartDistributedExecution acquires the locks that are needed to run the
+ * tasks and sets up the coordinated transaction for modifications.
+ */
+static void
+StartDistributedExecution(DistributedExecution *execution)
+{
+	List *taskList = execution->tasksToExecute;
+	Task *firstTask = NULL;
+	ShardInterval *firstShardInterval = NULL;
+
+	if (execution->operation == CMD_SELECT || taskList == NIL)
+	{
+		return;
+	}
+
+	if (execution->operation == CMD_UTILITY)
+	{
+		/* DDL commands obtained the appropriate locks in ProcessUtility */
+		BeginOrContinueCoordinatedTransaction();
+
+		if (MultiShardCommitProtocol == COMMIT_PROTOCOL_2PC)
+		{
+			CoordinatedTransactionUse2PC();
+		}
+
+		return;
+	}
+
+	/*
+	 * All tasks operate on the same relation, so it is enough to lock the
+	 * partitions of the first task's anchor relation.
+	 */
+	firstTask = (Task *) linitial(taskList);
+	firstShardInterval = LoadShardInterval(firstTask->anchorShardId);
+	if (PartitionedTable(firstShardInterval->relationId))
+	{
+		LockPartitionRelations(firstShardInterval->relationId, RowExclusiveLock);
+	}
+
+	if (list_length(taskList) > 1)
+	{
+		/* prevent concurrent multi-shard commands from deadlocking */
+		AcquireExecutorMultiShardLocks(taskList);
+
+		BeginOrContinueCoordinatedTransaction();
+
+		if (MultiShardCommitProtocol == COMMIT_PROTOCOL_2PC)
+		{
+			CoordinatedTransactionUse2PC();
+		}
+	}
+	else
+	{
+		/* prevent replicas of the same shard from diverging */
+		AcquireExecutorShardLock(firstTask, execution->operation);
+
+		if (IsTransactionBlock())
+		{
+			BeginOrContinueCoordinatedTransaction();
+		}
+	}
+
+	/* modifications of reference tables are always done using 2PC */
+	if (firstTask->replicationModel == REPLICATION_MODEL_2PC)
+	{
+		BeginOrContinueCoordinatedTransaction();
+		CoordinatedTransactionUse2PC();
+	}
+}
+
+
+/*
+ * RunDistributedExecution runs the event loop that drives all the sessions of
+ * the execution until all tasks are finished.
+ */
+static void
+RunDistributedExecution(DistributedExecution *execution)
+{
+	AssignTasksToConnectionsOrWorkerPool(execution);
+
+	PG_TRY();
+	{
+		while (execution->unfinishedTaskCount > 0)
+		{
+			ListCell *workerCell = NULL;
+			ListCell *sessionCell = NULL;
+			long timeout = 0;
+			int eventCount = 0;
+			int eventIndex = 0;
+
+			/* let idle sessions pick up newly queued tasks */
+			foreach(sessionCell, execution->sessionList)
+			{
+				WorkerSession *session = (WorkerSession *) lfirst(sessionCell);
+
+				if (session->sessionState != SESSION_FAILED &&
+					PQstatus(session->connection->pgConn) == CONNECTION_BAD)
+				{
+					WorkerSessionFailed(session);
+				}
+				else if (session->sessionState == SESSION_CONNECTED &&
+						 session->currentTask == NULL)
+				{
+					TransactionStateMachine(session);
+				}
+			}
+
+			if (execution->unfinishedTaskCount == 0)
+			{
+				break;
+			}
+
+			/* open new connections where tasks are waiting */
+			foreach(workerCell, execution->workerList)
+			{
+				WorkerPool *workerPool = (WorkerPool *) lfirst(workerCell);
+
+				ManageWorkerPool(workerPool);
+			}
+
+			if (execution->connectionSetChanged)
+			{
+				RebuildWaitEventSet(execution);
+			}
+
+			timeout = NextEventTimeout(execution);
+
+			/* wait for I/O events */
+#if (PG_VERSION_NUM >= 100000)
+			eventCount = WaitEventSetWait(execution->waitEventSet, timeout,
+										  execution->events, execution->eventSetSize,
+										  WAIT_EVENT_CLIENT_READ);
+#else
+			eventCount = WaitEventSetWait(execution->waitEventSet, timeout,
+										  execution->events, execution->eventSetSize);
+#endif
+
+			/* process I/O events */
+			for (; eventIndex < eventCount; eventIndex++)
+			{
+				WaitEvent *event = &execution->events[eventIndex];
+				WorkerSession *session = NULL;
+
+				if (event->events & WL_POSTMASTER_DEATH)
+				{
+					ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+				}
+
+				if (event->events & WL_LATCH_SET)
+				{
+					ResetLatch(MyLatch);
+
+					/* abort in case of cancellation */
+					CHECK_FOR_INTERRUPTS();
+
+					continue;
+				}
+
+				session = (WorkerSession *) event->user_data;
+
+				ConnectionStateMachine(session);
+			}
+
+			/* fail connections that did not come up in time */
+			foreach(sessionCell, execution->sessionList)
+			{
+				WorkerSession *session = (WorkerSession *) lfirst(sessionCell);
+				MultiConnection *connection = session->connection;
+
+				if (session->sessionState == SESSION_CONNECTING &&
+					MillisecondsUntil(connection->connectionStart,
+									  NodeConnectionTimeout) == 0)
+				{
+					RecordConnectionEstablishmentFailure(connection);
+					WorkerSessionFailed(session);
+				}
+			}
+		}
+	}
+	PG_CATCH();
+	{
+		/* make sure the epoll file descriptor is always closed */
+		FinishDistributedExecution(execution);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	/* if some placements failed, ensure future statements don't access them */
+	if (execution->operation != CMD_SELECT)
+	{
+		MarkFailedPlacementsInactive(execution);
+	}
+}
+
+
+/*
+ * MarkFailedPlacementsInactive marks the placements that missed a modification
+ * of the execution as inactive, as well as the placements whose remote
+ * transaction failed earlier in the transaction. Placements that failed
+ * before a connection was made to them are not known to the placement
+ * connection logic, so they are marked here directly.
+ */
+static void
+MarkFailedPlacementsInactive(DistributedExecution *execution)
+{
+	ListCell *placementCell = NULL;
+
+	foreach(placementCell, execution->failedPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+		if (placement->shardState == FILE_FINALIZED)
+		{
+			UpdateShardPlacementState(placement->placementId, FILE_INACTIVE);
+		}
+	}
+
+	MarkFailedShardPlacements();
+}
+
+
+/*
+ * FinishDistributedExecution releases the wait event set and the connections
+ * claimed by the execution. Connections remain open in the connection cache,
+ * such that they can be reused by subsequent commands.
+ */
+static void
+FinishDistributedExecution(DistributedExecution *execution)
+{
+	ListCell *sessionCell = NULL;
+
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+
+	foreach(sessionCell, execution->sessionList)
+	{
+		WorkerSession *session = (WorkerSession *) lfirst(sessionCell);
+		MultiConnection *connection = session->connection;
+
+		if (connection->claimedExclusively)
+		{
+			UnclaimConnection(connection);
+		}
+	}
+}
+
+
+/*
+ * AssignTasksToConnectionsOrWorkerPool creates a placement execution for every
+ * placement of every task. Placements that were accessed earlier in the
+ * transaction are assigned to the connection that accessed them, all other
+ * placement executions go into the queue of the worker pool.
+ *
+ * All placement lookups are done before claiming any connection, since the
+ * placement connection logic does not allow using claimed connections.
+ */
+static void
+AssignTasksToConnectionsOrWorkerPool(DistributedExecution *execution)
+{
+	CmdType operation = execution->operation;
+	List *taskList = execution->tasksToExecute;
+	List *tupleDestinationList = execution->tupleDestinationList;
+	ListCell *taskCell = NULL;
+	ListCell *tupleDestinationCell = list_head(tupleDestinationList);
+	ListCell *sessionCell = NULL;
+	List *readyPlacementExecutionList = NIL;
+	ListCell *placementExecutionCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		ShardCommandExecution *shardCommandExecution = NULL;
+		List *placementList = task->taskPlacementList;
+		ListCell *placementCell = NULL;
+		int placementExecutionCount = list_length(placementList);
+		int placementExecutionIndex = 0;
+
+		shardCommandExecution =
+			(ShardCommandExecution *) palloc0(sizeof(ShardCommandExecution));
+		shardCommandExecution->task = task;
+		shardCommandExecution->tupleDestination = NULL;
+		if (tupleDestinationCell != NULL)
+		{
+			shardCommandExecution->tupleDestination =
+				(TupleDestination *) lfirst(tupleDestinationCell);
+			tupleDestinationCell = lnext(tupleDestinationCell);
+		}
+
+		shardCommandExecution->placementExecutions =
+			(TaskPlacementExecution **) palloc0(placementExecutionCount *
+												sizeof(TaskPlacementExecution *));
+		shardCommandExecution->placementExecutionCount = placementExecutionCount;
+
+		foreach(placementCell, placementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+			TaskPlacementExecution *placementExecution = NULL;
+			MultiConnection *connection = NULL;
+			WorkerPool *workerPool = NULL;
+			List *placementAccessList = NIL;
+
+			placementAccessList = PlacementAccessListForTask(task, placement, operation);
+
+			workerPool = FindOrCreateWorkerPool(execution, placement->nodeName,
+												placement->nodePort);
+
+			placementExecution =
+				(TaskPlacementExecution *) palloc0(sizeof(TaskPlacementExecution));
+			placementExecution->shardCommandExecution = shardCommandExecution;
+			placementExecution->shardPlacement = placement;
+			placementExecution->placementAccessList = placementAccessList;
+			placementExecution->workerPool = workerPool;
+			placementExecution->assignedSession = NULL;
+			placementExecution->executionState = PLACEMENT_EXECUTION_NOT_READY;
+			placementExecution->placementExecutionIndex = placementExecutionIndex;
+
+			/* use the connection that accessed the placement before, if any */
+			connection = GetConnectionIfPlacementAccessedInXact(0, placementAccessList,
+																NULL);
+			if (connection != NULL)
+			{
+				placementExecution->assignedSession =
+					FindOrCreateWorkerSession(workerPool, connection);
+			}
+
+			shardCommandExecution->placementExecutions[placementExecutionIndex] =
+				placementExecution;
+
+			/* a task first runs on its first placement */
+			if (placementExecutionIndex == 0)
+			{
+				readyPlacementExecutionList = lappend(readyPlacementExecutionList,
+													  placementExecution);
+			}
+
+			placementExecutionIndex++;
+		}
+
+		if (placementExecutionCount == 0)
+		{
+			ereport(ERROR, (errmsg("no active placements were found for shard "
+								   UINT64_FORMAT, task->anchorShardId)));
+		}
+	}
+
+	/* now that all lookups are done, claim the assigned connections */
+	foreach(sessionCell, execution->sessionList)
+	{
+		WorkerSession *session = (WorkerSession *) lfirst(sessionCell);
+
+		ClaimConnectionExclusively(session->connection);
+	}
+
+	foreach(placementExecutionCell, readyPlacementExecutionList)
+	{
+		TaskPlacementExecution *placementExecution =
+			(TaskPlacementExecution *) lfirst(placementExecutionCell);
+
+		EnqueuePlacementExecution(placementExecution);
+	}
+}
+
+
+/*
+ * PlacementAccessListForTask returns the list of placement accesses that
+ * the task performs when it runs on the given placement.
+ */
+static List *
+PlacementAccessListForTask(Task *task, ShardPlacement *placement, CmdType operation)
+{
+	List *relationShardList = task->relationShardList;
+	List *placementAccessList = NIL;
+
+	/* create placement accesses for placements that appear in a subselect */
+	if (list_length(relationShardList) > 0)
+	{
+		placementAccessList = BuildPlacementSelectList(placement->groupId,
+													   relationShardList);
+	}
+
+	if (operation == CMD_UTILITY)
+	{
+		/* create placement access for the placement that we're altering */
+		ShardPlacementAccess *placementDDL =
+			CreatePlacementAccess(placement, PLACEMENT_ACCESS_DDL);
+
+		placementAccessList = lappend(placementAccessList, placementDDL);
+	}
+	else if (operation != CMD_SELECT)
+	{
+		/* create placement access for the placement that we're modifying */
+		ShardPlacementAccess *placementModification =
+			CreatePlacementAccess(placement, PLACEMENT_ACCESS_DML);
+
+		placementAccessList = lappend(placementAccessList, placementModification);
+	}
+	else if (placementAccessList == NIL)
+	{
+		ShardPlacementAccess *placementAccess =
+			CreatePlacementAccess(placement, PLACEMENT_ACCESS_SELECT);
+
+		placementAccessList = list_make1(placementAccess);
+	}
+
+	return placementAccessList;
+}
+
+
+/*
+ * FindOrCreateWorkerPool gets the pool of connections for the given worker
+ * node, or creates a new one.
+ */
+static WorkerPool *
+FindOrCreateWorkerPool(DistributedExecution *execution, char *nodeName, int nodePort)
+{
+	WorkerPool *workerPool = NULL;
+	ListCell *workerCell = NULL;
+
+	foreach(workerCell, execution->workerList)
+	{
+		workerPool = (WorkerPool *) lfirst(workerCell);
+
+		if (strncmp(nodeName, workerPool->nodeName, WORKER_LENGTH) == 0 &&
+			nodePort == workerPool->nodePort)
+		{
+			return workerPool;
+		}
+	}
+
+	workerPool = (WorkerPool *) palloc0(sizeof(WorkerPool));
+	workerPool->distributedExecution = execution;
+	workerPool->nodeName = pstrdup(nodeName);
+	workerPool->nodePort = nodePort;
+	workerPool->sessionList = NIL;
+	workerPool->pendingTaskCount = 0;
+	workerPool->lastConnectionOpenTime = 0;
+	workerPool->sharedPoolExhausted = false;
+	workerPool->failed = false;
+	dlist_init(&workerPool->pendingTaskQueue);
+
+	execution->workerList = lappend(execution->workerList, workerPool);
+
+	return workerPool;
+}
+
+
+/*
+ * FindOrCreateWorkerSession returns the session in the pool that uses the
+ * given connection, or creates a new one.
+ */
+static WorkerSession *
+FindOrCreateWorkerSession(WorkerPool *workerPool, MultiConnection *connection)
+{
+	DistributedExecution *execution = workerPool->distributedExecution;
+	WorkerSession *session = NULL;
+	ListCell *sessionCell = NULL;
+
+	foreach(sessionCell, workerPool->sessionList)
+	{
+		session = (WorkerSession *) lfirst(sessionCell);
+
+		if (session->connection == connection)
+		{
+			return session;
+		}
+	}
+
+	session = (WorkerSession *) palloc0(sizeof(WorkerSession));
+	session->connection = connection;
+	session->workerPool = workerPool;
+	session->currentTask = NULL;
+	session->commandSent = false;
+	session->waitEventSetIndex = -1;
+	dlist_init(&session->readyTaskQueue);
+
+	if (PQstatus(connection->pgConn) == CONNECTION_OK)
+	{
+		/* reusing an established connection */
+		session->sessionState = SESSION_CONNECTED;
+		session->waitFlags = WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE;
+	}
+	else
+	{
+		/* libpq wants us to wait for the socket to become writeable first */
+		session->sessionState = SESSION_CONNECTING;
+		session->waitFlags = WL_SOCKET_WRITEABLE;
+	}
+
+	workerPool->sessionList = lappend(workerPool->sessionList, session);
+	execution->sessionList = lappend(execution->sessionList, session);
+	execution->connectionSetChanged = true;
+
+	return session;
+}
+
+
+/*
+ * ManageWorkerPool opens new connections to the worker node if there are
+ * tasks waiting for an idle connection.
+ *
+ * The first connection is opened immediately, which returns an unused
+ * connection from the connection cache, if there is one. Subsequently, the
+ * number of connections is doubled each time tasks have been waiting for
+ * citus.executor_slow_start_interval since the previous batch of connections
+ * was opened.
+ */
+static void
+ManageWorkerPool(WorkerPool *workerPool)
+{
+	int liveSessionCount = 0;
+	int waitingTaskCount = 0;
+	int newConnectionCount = 0;
+	int connectionIndex = 0;
+	TimestampTz now = 0;
+
+	waitingTaskCount = WaitingTaskCount(workerPool, &liveSessionCount);
+	if (waitingTaskCount <= 0)
+	{
+		return;
+	}
+
+	newConnectionCount = Min(waitingTaskCount,
+							 workerPool->distributedExecution->maxPoolSize -
+							 liveSessionCount);
+	if (newConnectionCount <= 0)
+	{
+		return;
+	}
+
+	now = GetCurrentTimestamp();
+
+	if (liveSessionCount > 0 && ExecutorSlowStartInterval > 0)
+	{
+		if (!TimestampDifferenceExceeds(workerPool->lastConnectionOpenTime, now,
+										ExecutorSlowStartInterval))
+		{
+			/* tasks have not been waiting long enough */
+			return;
+		}
+
+		/* double the number of connections */
+		newConnectionCount = Min(newConnectionCount, liveSessionCount);
+	}
+	else if (ExecutorSlowStartInterval > 0)
+	{
+		newConnectionCount = 1;
+	}
+
+	for (connectionIndex = 0; connectionIndex < newConnectionCount; connectionIndex++)
+	{
+		MultiConnection *connection = NULL;
+		WorkerSession *session = NULL;
+		int connectionFlags = 0;
+
+		/*
+		 * Keep the first connection to each worker open after the transaction
+		 * ends, such that the next command can reuse it.
+		 */
+		if (liveSessionCount == 0 && connectionIndex == 0)
+		{
+			connectionFlags |= SESSION_LIFESPAN;
+		}
+		else
+		{
+			/*
+			 * Additional connections are not required to make progress, so
+			 * do not wait for a slot when citus.max_shared_pool_size is
+			 * reached.
+			 */
+			connectionFlags |= OPTIONAL_CONNECTION;
+		}
+
+		connection = StartNodeUserDatabaseConnection(connectionFlags,
+													 workerPool->nodeName,
+													 workerPool->nodePort,
+													 NULL, NULL);
+		if (connection == NULL)
+		{
+			/* the worker has no connection slots left, use existing sessions */
+			workerPool->sharedPoolExhausted = true;
+			break;
+		}
+
+		workerPool->sharedPoolExhausted = false;
+		ClaimConnectionExclusively(connection);
+
+		session = FindOrCreateWorkerSession(workerPool, connection);
+		if (PQstatus(connection->pgConn) == CONNECTION_BAD)
+		{
+			/* connection establishment could not even be started */
+			RecordConnectionEstablishmentFailure(connection);
+			WorkerSessionFailed(session);
+			break;
+		}
+	}
+
+	workerPool->lastConnectionOpenTime = now;
+}
+
+
+/*
+ * WaitingTaskCount returns the number of placement executions in the pool's
+ * queue that cannot be picked up by a session that is idle or still
+ * connecting, and sets liveSessionCount to the number of sessions in the
+ * pool that did not fail.
+ */
+static int
+WaitingTaskCount(WorkerPool *workerPool, int *liveSessionCount)
+{
+	ListCell *sessionCell = NULL;
+	int availableSessionCount = 0;
+
+	*liveSessionCount = 0;
+
+	if (workerPool->failed)
+	{
+		return 0;
+	}
+
+	foreach(sessionCell, workerPool->sessionList)
+	{
+		WorkerSession *session = (WorkerSession *) lfirst(sessionCell);
+
+		if (session->sessionState == SESSION_FAILED)
+		{
+			continue;
+		}
+
+		(*liveSessionCount)++;
+
+		/* connecting sessions will pick up a pending task once they are ready */
+		if (session->currentTask == NULL && dlist_is_empty(&session->readyTaskQueue))
+		{
+			availableSessionCount++;
+		}
+	}
+
+	return workerPool->pendingTaskCount - availableSessionCount;
+}
+
+
+/*
+ * NextEventTimeout returns the number of milliseconds until the execution
+ * needs to act without I/O happening, which is when the next batch of
+ * connections may be opened or a connection attempt times out. It returns
+ * -1 if there is no such deadline.
+ */
+static long
+NextEventTimeout(DistributedExecution *execution)
+{
+	long timeout = -1;
+	ListCell *workerCell = NULL;
+	ListCell *sessionCell = NULL;
+
+	foreach(workerCell, execution->workerList)
+	{
+		WorkerPool *workerPool = (WorkerPool *) lfirst(workerCell);
+		int liveSessionCount = 0;
+		long poolTimeout = 0;
+
+		if (WaitingTaskCount(workerPool, &liveSessionCount) <= 0 ||
+			liveSessionCount >= MaxAdaptiveExecutorPoolSize ||
+			workerPool->sharedPoolExhausted)
+		{
+			continue;
+		}
+
+		poolTimeout = MillisecondsUntil(workerPool->lastConnectionOpenTime,
+										ExecutorSlowStartInterval);
+		if (timeout == -1 || poolTimeout < timeout)
+		{
+			timeout = poolTimeout;
+		}
+	}
+
+	foreach(sessionCell, execution->sessionList)
+	{
+		WorkerSession *session = (WorkerSession *) lfirst(sessionCell);
+		long connectTimeout = 0;
+
+		if (session->sessionState != SESSION_CONNECTING)
+		{
+			continue;
+		}
+
+		connectTimeout = MillisecondsUntil(session->connection->connectionStart,
+										   NodeConnectionTimeout);
+		if (timeout == -1 || connectTimeout < timeout)
+		{
+			timeout = connectTimeout;
+		}
+	}
+
+	return timeout;
+}
+
+
+/*
+ * MillisecondsUntil returns the number of milliseconds until intervalMillis
+ * milliseconds have passed since startTime, or 0 if they have already passed.
+ */
+static long
+MillisecondsUntil(TimestampTz startTime, int intervalMillis)
+{
+	TimestampTz deadline = TimestampTzPlusMilliseconds(startTime, intervalMillis);
+	long seconds = 0;
+	int microseconds = 0;
+
+	TimestampDifference(GetCurrentTimestamp(), deadline, &seconds, &microseconds);
+
+	return seconds * 1000L + (microseconds + 999) / 1000;
+}
+
+
+/*
+ * RebuildWaitEventSet recreates the wait event set with the sockets of all
+ * sessions that did not fail. We cannot remove events from a WaitEventSet,
+ * so the set is rebuilt whenever sessions are added or fail.
+ */
+static void
+RebuildWaitEventSet(DistributedExecution *execution)
+{
+	ListCell *sessionCell = NULL;
+	int sessionCount = list_length(execution->sessionList);
+
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+
+	/* allocate sessions + 2 for the signal latch and postmaster death */
+	/* (CreateWaitEventSet makes room for pgwin32_signal_event automatically) */
+	execution->eventSetSize = sessionCount + 2;
+	execution->waitEventSet = CreateWaitEventSet(CurrentMemoryContext,
+												 execution->eventSetSize);
+
+	if (execution->events != NULL)
+	{
+		pfree(execution->events);
+	}
+
+	execution->events = palloc0(execution->eventSetSize * sizeof(WaitEvent));
+
+	foreach(sessionCell, execution->sessionList)
+	{
+		WorkerSession *session = (WorkerSession *) lfirst(sessionCell);
+		MultiConnection *connection = session->connection;
+		int socket = 0;
+
+		session->waitEventSetIndex = -1;
+
+		if (session->sessionState == SESSION_FAILED)
+		{
+			continue;
+		}
+
+		socket = PQsocket(connection->pgConn);
+		if (socket == -1)
+		{
+			continue;
+		}
+
+		session->waitEventSetIndex = AddWaitEventToSet(execution->waitEventSet,
+													   session->waitFlags, socket,
+													   NULL, (void *) session);
+	}
+
+	AddWaitEventToSet(execution->waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET,
+					  NULL, NULL);
+	AddWaitEventToSet(execution->waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch,
+					  NULL);
+
+	execution->connectionSetChanged = false;
+}
+
+
+/*
+ * UpdateConnectionWaitFlags changes the events that we wait for on the socket
+ * of the session.
+ */
+static void
+UpdateConnectionWaitFlags(WorkerSession *session, int waitFlags)
+{
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+
+	if (session->waitFlags == waitFlags)
+	{
+		return;
+	}
+
+	session->waitFlags = waitFlags;
+
+	if (!execution->connectionSetChanged && session->waitEventSetIndex >= 0)
+	{
+		ModifyWaitEvent(execution->waitEventSet, session->waitEventSetIndex,
+						waitFlags, NULL);
+	}
+}
+
+
+/*
+ * ConnectionStateMachine advances connection establishment of the session,
+ * and hands off to TransactionStateMachine once the connection is ready.
+ */
+static void
+ConnectionStateMachine(WorkerSession *session)
+{
+	MultiConnection *connection = session->connection;
+
+	if (session->sessionState == SESSION_CONNECTING)
+	{
+		DistributedExecution *execution = session->workerPool->distributedExecution;
+		PostgresPollingStatusType pollMode = PQconnectPoll(connection->pgConn);
+
+		/*
+		 * PQconnectPoll may close the socket and open a new one, for instance
+		 * when falling back to the next address of a host, which can reuse the
+		 * same file descriptor number. The socket can then no longer be
+		 * modified in the wait event set, so we rebuild it instead.
+		 */
+		execution->connectionSetChanged = true;
+
+		if (pollMode == PGRES_POLLING_FAILED)
+		{
+			RecordConnectionEstablishmentFailure(connection);
+			WorkerSessionFailed(session);
+			return;
+		}
+		else if (pollMode == PGRES_POLLING_READING)
+		{
+			UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE);
+			return;
+		}
+		else if (pollMode == PGRES_POLLING_WRITING)
+		{
+			UpdateConnectionWaitFlags(session, WL_SOCKET_WRITEABLE);
+			return;
+		}
+
+		RecordConnectionEstablished(connection);
+		RecordConnectionEstablishmentResult(connection);
+
+		session->sessionState = SESSION_CONNECTED;
+	}
+
+	if (session->sessionState == SESSION_CONNECTED)
+	{
+		if (PQstatus(connection->pgConn) == CONNECTION_BAD)
+		{
+			WorkerSessionFailed(session);
+			return;
+		}
+
+		TransactionStateMachine(session);
+	}
+}
+
+
+/*
+ * TransactionStateMachine opens a remote transaction on the session if
+ * necessary, sends the commands of placement executions assigned to the
+ * session and processes their results until the session has to wait for I/O.
+ */
+static void
+TransactionStateMachine(WorkerSession *session)
+{
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+	MultiConnection *connection = session->connection;
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+
+	while (session->sessionState == SESSION_CONNECTED)
+	{
+		TaskPlacementExecution *placementExecution = session->currentTask;
+
+		if (transaction->transactionState == REMOTE_TRANS_STARTING)
+		{
+			/* waiting for BEGIN to finish */
+			if (!CheckConnectionReady(session))
+			{
+				return;
+			}
+
+			FinishRemoteTransactionBegin(connection);
+
+			if (transaction->transactionFailed)
+			{
+				WorkerSessionFailed(session);
+				return;
+			}
+
+			continue;
+		}
+
+		if (execution->sessionSetupCommand != NULL && !session->setupCommandDone)
+		{
+			if (!session->setupCommandSent)
+			{
+				int querySent = SendRemoteCommand(connection,
+												  execution->sessionSetupCommand);
+				if (querySent == 0)
+				{
+					WorkerSessionFailed(session);
+					return;
+				}
+
+				session->setupCommandSent = true;
+				UpdateConnectionWaitFlags(session,
+										  WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+				continue;
+			}
+
+			if (!CheckConnectionReady(session))
+			{
+				return;
+			}
+
+			if (!ReceiveSessionSetupResults(session))
+			{
+				/* waiting for more results */
+				UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE);
+				return;
+			}
+
+			session->setupCommandDone = true;
+			continue;
+		}
+
+		if (placementExecution == NULL)
+		{
+			placementExecution = PopPlacementExecution(session);
+			if (placementExecution == NULL)
+			{
+				/* idle, only watch for the connection being closed */
+				UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE);
+				return;
+			}
+
+			/* a remote transaction that failed cannot run any more commands */
+			if (InCoordinatedTransaction() && transaction->transactionFailed)
+			{
+				PlacementExecutionFailed(placementExecution);
+				continue;
+			}
+
+			if (!StartPlacementExecutionOnSession(placementExecution, session))
+			{
+				WorkerSessionFailed(session);
+				return;
+			}
+
+			continue;
+		}
+
+		if (!session->commandSent)
+		{
+			if (!SendPlacementExecutionCommand(session))
+			{
+				WorkerSessionFailed(session);
+				return;
+			}
+
+			continue;
+		}
+
+		if (!CheckConnectionReady(session))
+		{
+			return;
+		}
+
+		if (!ReceiveResults(session))
+		{
+			/* waiting for more results */
+			UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE);
+			return;
+		}
+
+		session->currentTask = NULL;
+		session->commandSent = false;
+
+		PlacementExecutionDone(placementExecution, !placementExecution->commandFailed);
+	}
+}
+
+
+/*
+ * CheckConnectionReady flushes outgoing data and consumes incoming data on
+ * the session's connection. It returns true if a result can be read without
+ * blocking. Otherwise, it updates the wait flags of the session and returns
+ * false. Failed sessions are marked as such.
+ */
+static bool
+CheckConnectionReady(WorkerSession *session)
+{
+	MultiConnection *connection = session->connection;
+	int sendStatus = PQflush(connection->pgConn);
+
+	if (sendStatus == -1)
+	{
+		WorkerSessionFailed(session);
+		return false;
+	}
+	else if (sendStatus == 1)
+	{
+		/* still have data to send */
+		UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+		return false;
+	}
+
+	if (PQconsumeInput(connection->pgConn) == 0)
+	{
+		WorkerSessionFailed(session);
+		return false;
+	}
+
+	if (PQisBusy(connection->pgConn))
+	{
+		UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * PopPlacementExecution returns the next placement execution that the
+ * session should run. Placement executions that are assigned to the session
+ * take precedence over those in the pool's queue.
+ */
+static TaskPlacementExecution *
+PopPlacementExecution(WorkerSession *session)
+{
+	WorkerPool *workerPool = session->workerPool;
+	dlist_node *taskQueueNode = NULL;
+
+	if (!dlist_is_empty(&session->readyTaskQueue))
+	{
+		taskQueueNode = dlist_pop_head_node(&session->readyTaskQueue);
+	}
+	else if (!dlist_is_empty(&workerPool->pendingTaskQueue))
+	{
+		taskQueueNode = dlist_pop_head_node(&workerPool->pendingTaskQueue);
+		workerPool->pendingTaskCount--;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	return dlist_container(TaskPlacementExecution, taskQueueNode, taskQueueNode);
+}
+
+
+/*
+ * StartPlacementExecutionOnSession assigns the placement execution to the
+ * session, registers the placement accesses with the connection and begins
+ * a remote transaction if necessary.
+ */
+static bool
+StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
+								 WorkerSession *session)
+{
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+	MultiConnection *connection = session->connection;
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+	Task *task = placementExecution->shardCommandExecution->task;
+
+	session->currentTask = placementExecution;
+	session->commandSent = false;
+	placementExecution->executionState = PLACEMENT_EXECUTION_RUNNING;
+
+	/* subsequent commands on these placements should use the same connection */
+	RecordPlacementListAccess(placementExecution->placementAccessList, connection,
+							  NULL);
+
+	if (execution->operation != CMD_SELECT)
+	{
+		/*
+		 * If we're expanding the set nodes that participate in the distributed
+		 * transaction, conform to MultiShardCommitProtocol.
+		 */
+		if (MultiShardCommitProtocol == COMMIT_PROTOCOL_2PC &&
+			InCoordinatedTransaction() &&
+			XactModificationLevel == XACT_MODIFICATION_DATA &&
+			transaction->transactionState == REMOTE_TRANS_INVALID)
+		{
+			CoordinatedTransactionUse2PC();
+		}
+
+		if (task->replicationModel == REPLICATION_MODEL_2PC ||
+			execution->operation == CMD_UTILITY)
+		{
+			MarkRemoteTransactionCritical(connection);
+		}
+	}
+
+	/* the special bare mode (e.g. for CREATE INDEX CONCURRENTLY) skips BEGIN */
+	if (InCoordinatedTransaction() && RemoteTransactionNeedsBegin(connection) &&
+		MultiShardCommitProtocol > COMMIT_PROTOCOL_BARE)
+	{
+		StartRemoteTransactionBegin(connection);
+
+		if (transaction->transactionFailed)
+		{
+			return false;
+		}
+
+		UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+	}
+
+	return true;
+}
+
+
+/*
+ * SendPlacementExecutionCommand sends the query of the session's current
+ * placement execution in single-row mode.
+ */
+static bool
+SendPlacementExecutionCommand(WorkerSession *session)
+{
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+	ParamListInfo paramListInfo = execution->paramListInfo;
+	MultiConnection *connection = session->connection;
+	TaskPlacementExecution *placementExecution = session->currentTask;
+	char *queryString = placementExecution->shardCommandExecution->task->queryString;
+	int querySent = 0;
+
+	if (paramListInfo != NULL)
+	{
+		int parameterCount = paramListInfo->numParams;
+		Oid *parameterTypes = NULL;
+		const char **parameterValues = NULL;
+
+		ExtractParametersFromParamListInfo(paramListInfo, &parameterTypes,
+										   &parameterValues);
+
+		querySent = SendRemoteCommandParams(connection, queryString, parameterCount,
+											parameterTypes, parameterValues, false);
+	}
+	else
+	{
+		querySent = SendRemoteCommand(connection, queryString);
+	}
+
+	if (querySent == 0 || PQsetSingleRowMode(connection->pgConn) == 0)
+	{
+		return false;
+	}
+
+	session->commandSent = true;
+
+	if (CollectingTaskStats())
+	{
+		placementExecution->queryStartTime = GetCurrentTimestamp();
+	}
+
+	UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+
+	return true;
+}
+
+
+/*
+ * ReceiveSessionSetupResults reads the results of the session setup command
+ * as long as they can be read without blocking. It returns true once all
+ * results have been received, and errors out if the command failed.
+ */
+static bool
+ReceiveSessionSetupResults(WorkerSession *session)
+{
+	MultiConnection *connection = session->connection;
+
+	while (!PQisBusy(connection->pgConn))
+	{
+		PGresult *result = PQgetResult(connection->pgConn);
+
+		if (result == NULL)
+		{
+			/* no more results */
+			return true;
+		}
+
+		if (!IsResponseOK(result))
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+	}
+
+	return false;
+}
+
+
+/*
+ * ReceiveResults reads the results of the session's current placement
+ * execution as long as they can be read without blocking. It returns true
+ * once all results have been received.
+ */
+static bool
+ReceiveResults(WorkerSession *session)
+{
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+	MultiConnection *connection = session->connection;
+	TaskPlacementExecution *placementExecution = session->currentTask;
+	ShardCommandExecution *shardCommandExecution =
+		placementExecution->shardCommandExecution;
+	TupleDestination *tupleDestination = shardCommandExecution->tupleDestination;
+	Task *task = shardCommandExecution->task;
+	bool storeRows = false;
+	bool failOnError = false;
+
+	/*
+	 * SELECTs run on one placement at a time, so the rows of whichever placement
+	 * serves the task are stored. Modifications only run on the remaining
+	 * placements after the first one succeeded, and we only store what it
+	 * returned.
+	 */
+	if (tupleDestination != NULL)
+	{
+		storeRows = execution->operation == CMD_SELECT ||
+					!shardCommandExecution->modifiedFirstPlacement;
+	}
+
+	/*
+	 * Modifications of other placements continue after an error, as long as
+	 * one placement can still be modified. The failed placements are then
+	 * marked as inactive at the end of the execution. DDL commands and
+	 * modifications of reference tables fail as a whole.
+	 */
+	if (execution->operation == CMD_UTILITY ||
+		task->replicationModel == REPLICATION_MODEL_2PC)
+	{
+		failOnError = true;
+	}
+	else if (execution->operation != CMD_SELECT)
+	{
+		failOnError = !shardCommandExecution->modifiedFirstPlacement &&
+					  placementExecution->placementExecutionIndex + 1 >=
+					  shardCommandExecution->placementExecutionCount;
+	}
+
+	while (!PQisBusy(connection->pgConn))
+	{
+		PGresult *result = PQgetResult(connection->pgConn);
+		ExecStatusType resultStatus = PGRES_COMMAND_OK;
+
+		if (result == NULL)
+		{
+			/* no more results */
+			return true;
+		}
+
+		resultStatus = PQresultStatus(result);
+		if (resultStatus == PGRES_COMMAND_OK)
+		{
+			char *affectedTupleString = PQcmdTuples(result);
+			int64 affectedTupleCount = 0;
+
+			if (*affectedTupleString != '\0')
+			{
+				scanint8(affectedTupleString, false, &affectedTupleCount);
+				Assert(affectedTupleCount >= 0);
+			}
+
+			placementExecution->rowsProcessed += affectedTupleCount;
+		}
+		else if (resultStatus == PGRES_TUPLES_OK || resultStatus == PGRES_SINGLE_TUPLE)
+		{
+			if (storeRows)
+			{
+				placementExecution->bytesReceived +=
+					StoreResultRows(execution, tupleDestination, result);
+
+				if (PQntuples(result) > 0)
+				{
+					placementExecution->storedRows = true;
+				}
+			}
+
+			placementExecution->rowsProcessed += PQntuples(result);
+		}
+		else
+		{
+			char *sqlStateString = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+			int category = 0;
+			bool isConstraintViolation = false;
+
+			MarkRemoteTransactionFailed(connection, false);
+
+			/*
+			 * If the error code is in constraint violation class, we want to
+			 * fail fast because we must get the same error from all shard
+			 * placements.
+			 */
+			category = ERRCODE_TO_CATEGORY(ERRCODE_INTEGRITY_CONSTRAINT_VIOLATION);
+			isConstraintViolation = SqlStateMatchesCategory(sqlStateString, category);
+
+			if (isConstraintViolation || failOnError)
+			{
+				ReportResultError(connection, result, ERROR);
+			}
+			else
+			{
+				ReportResultError(connection, result, WARNING);
+			}
+
+			placementExecution->commandFailed = true;
+		}
+
+		PQclear(result);
+	}
+
+	return false;
+}
+
+
+/*
+ * StoreResultRows converts the rows in the result to tuples and stores them
+ * in the tuple store of the given destination. It returns the number of bytes
+ * of the rows.
+ */
+static uint64
+StoreResultRows(DistributedExecution *execution, TupleDestination *tupleDestination,
+				PGresult *result)
+{
+	DistributedExecutionStats *executionStats = tupleDestination->executionStats;
+	char **columnArray = execution->columnArray;
+	int rowCount = PQntuples(result);
+	int columnCount = PQnfields(result);
+	int rowIndex = 0;
+	uint64 bytesReceived = 0;
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		HeapTuple heapTuple = NULL;
+		MemoryContext oldContext = NULL;
+		int columnIndex = 0;
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			if (PQgetisnull(result, rowIndex, columnIndex))
+			{
+				columnArray[columnIndex] = NULL;
+			}
+			else
+			{
+				int columnLength = PQgetlength(result, rowIndex, columnIndex);
+
+				columnArray[columnIndex] = PQgetvalue(result, rowIndex, columnIndex);
+
+				if (SubPlanLevel > 0)
+				{
+					executionStats->totalIntermediateResultSize += columnLength;
+				}
+
+				QueryStatsAddBytesReceived(columnLength);
+				bytesReceived += columnLength;
+			}
+		}
+
+		/*
+		 * Switch to a temporary memory context that we reset after each tuple. This
+		 * protects us from any memory leaks that might be present in I/O functions
+		 * called by BuildTupleFromCStrings.
+		 */
+		oldContext = MemoryContextSwitchTo(execution->ioContext);
+
+		heapTuple = BuildTupleFromCStrings(tupleDestination->attributeInputMetadata,
+										   columnArray);
+
+		MemoryContextSwitchTo(oldContext);
+
+		tuplestore_puttuple(tupleDestination->tupleStore, heapTuple);
+		MemoryContextReset(execution->ioContext);
+	}
+
+	if (CheckIfSizeLimitIsExceeded(executionStats))
+	{
+		ErrorSizeLimitIsExceeded();
+	}
+
+	return bytesReceived;
+}
+
+
+/*
+ * EnqueuePlacementExecution makes the placement execution ready to run by
+ * adding it either to the queue of its assigned session or to the queue of
+ * its worker pool.
+ */
+static void
+EnqueuePlacementExecution(TaskPlacementExecution *placementExecution)
+{
+	WorkerSession *assignedSession = placementExecution->assignedSession;
+	WorkerPool *workerPool = placementExecution->workerPool;
+
+	placementExecution->executionState = PLACEMENT_EXECUTION_READY;
+
+	if (CollectingTaskStats())
+	{
+		placementExecution->readyTime = GetCurrentTimestamp();
+	}
+
+	if (assignedSession != NULL)
+	{
+		if (assignedSession->sessionState == SESSION_FAILED)
+		{
+			PlacementExecutionFailed(placementExecution);
+			return;
+		}
+
+		dlist_push_tail(&assignedSession->readyTaskQueue,
+						&placementExecution->taskQueueNode);
+	}
+	else
+	{
+		if (workerPool->failed)
+		{
+			PlacementExecutionFailed(placementExecution);
+			return;
+		}
+
+		dlist_push_tail(&workerPool->pendingTaskQueue,
+						&placementExecution->taskQueueNode);
+		workerPool->pendingTaskCount++;
+	}
+}
+
+
+/*
+ * PlacementExecutionDone is called when the command of a placement execution
+ * finished. For modifications, the first placement is modified before
+ * the other placements, which are then modified in parallel.
+ */
+static void
+PlacementExecutionDone(TaskPlacementExecution *placementExecution, bool succeeded)
+{
+	ShardCommandExecution *shardCommandExecution =
+		placementExecution->shardCommandExecution;
+	DistributedExecution *execution = placementExecution->workerPool->distributedExecution;
+	Task *task = shardCommandExecution->task;
+	int placementExecutionCount = shardCommandExecution->placementExecutionCount;
+	int placementIndex = 0;
+
+	if (!succeeded)
+	{
+		PlacementExecutionFailed(placementExecution);
+		return;
+	}
+
+	placementExecution->executionState = PLACEMENT_EXECUTION_FINISHED;
+
+	/* other placements of modifications repeat the work of the first one */
+	if (execution->operation == CMD_SELECT ||
+		!shardCommandExecution->modifiedFirstPlacement)
+	{
+		RecordTaskExecutionStats(task, placementExecution->placementExecutionIndex,
+								 placementExecution->readyTime,
+								 placementExecution->queryStartTime,
+								 placementExecution->rowsProcessed,
+								 placementExecution->bytesReceived);
+	}
+
+	if (execution->operation == CMD_SELECT)
+	{
+		execution->unfinishedTaskCount--;
+		return;
+	}
+
+	if (!shardCommandExecution->modifiedFirstPlacement)
+	{
+		shardCommandExecution->modifiedFirstPlacement = true;
+		shardCommandExecution->affectedRowCount = placementExecution->rowsProcessed;
+		execution->rowsProcessed += placementExecution->rowsProcessed;
+
+		/*
+		 * Now that the first placement is modified, modify the others. The
+		 * placements before it already failed.
+		 */
+		for (placementIndex = placementExecution->placementExecutionIndex + 1;
+			 placementIndex < placementExecutionCount; placementIndex++)
+		{
+			EnqueuePlacementExecution(
+				shardCommandExecution->placementExecutions[placementIndex]);
+		}
+	}
+	else if (placementExecution->rowsProcessed != shardCommandExecution->affectedRowCount)
+	{
+		ShardPlacement *placement = placementExecution->shardPlacement;
+
+		/* warn the user if shard placements have diverged */
+		ereport(WARNING,
+				(errmsg("modified "UINT64_FORMAT " tuples of shard "
+						UINT64_FORMAT ", but expected to modify "UINT64_FORMAT,
+						placementExecution->rowsProcessed, task->anchorShardId,
+						shardCommandExecution->affectedRowCount),
+				 errdetail("modified placement on %s:%d",
+						   placement->nodeName, placement->nodePort)));
+	}
+
+	PlacementExecutionFinished(placementExecution);
+}
+
+
+/*
+ * PlacementExecutionFailed handles a failed placement execution. SELECTs are
+ * retried on the next placement if no rows have been stored yet. When the
+ * first placement of a modification fails, the next placement takes its
+ * place. Modifications of other placements just fail, and the placements are
+ * marked as inactive at the end of the execution, like the router executor
+ * does. Only when no placement could be modified, we error out.
+ */
+static void
+PlacementExecutionFailed(TaskPlacementExecution *placementExecution)
+{
+	ShardCommandExecution *shardCommandExecution =
+		placementExecution->shardCommandExecution;
+	DistributedExecution *execution = placementExecution->workerPool->distributedExecution;
+	int nextPlacementIndex = placementExecution->placementExecutionIndex + 1;
+
+	placementExecution->executionState = PLACEMENT_EXECUTION_FAILED;
+
+	if (execution->operation == CMD_UTILITY)
+	{
+		ereport(ERROR, (errmsg("could not modify any active placements")));
+	}
+
+	/* we cannot take back rows that were already stored */
+	if (placementExecution->storedRows)
+	{
+		ereport(ERROR, (errmsg("could not receive query results")));
+	}
+
+	if (execution->operation == CMD_SELECT)
+	{
+		if (nextPlacementIndex >= shardCommandExecution->placementExecutionCount)
+		{
+			ereport(ERROR, (errmsg("could not receive query results")));
+		}
+
+		EnqueuePlacementExecution(
+			shardCommandExecution->placementExecutions[nextPlacementIndex]);
+		return;
+	}
+
+	execution->failedPlacementList = lappend(execution->failedPlacementList,
+											 placementExecution->shardPlacement);
+
+	if (!shardCommandExecution->modifiedFirstPlacement)
+	{
+		if (nextPlacementIndex >= shardCommandExecution->placementExecutionCount)
+		{
+			ereport(ERROR, (errmsg("could not modify any active placements")));
+		}
+
+		EnqueuePlacementExecution(
+			shardCommandExecution->placementExecutions[nextPlacementIndex]);
+	}
+
+	PlacementExecutionFinished(placementExecution);
+}
+
+
+/*
+ * PlacementExecutionFinished counts the placement execution of a modification
+ * as finished, whether it succeeded or not, and counts the task as finished
+ * once all of its placements are.
+ */
+static void
+PlacementExecutionFinished(TaskPlacementExecution *placementExecution)
+{
+	ShardCommandExecution *shardCommandExecution =
+		placementExecution->shardCommandExecution;
+	DistributedExecution *execution = placementExecution->workerPool->distributedExecution;
+
+	shardCommandExecution->finishedPlacementCount++;
+	if (shardCommandExecution->finishedPlacementCount ==
+		shardCommandExecution->placementExecutionCount)
+	{
+		execution->unfinishedTaskCount--;
+	}
+}
+
+
+/*
+ * WorkerSessionFailed marks the session as failed and fails the placement
+ * executions that depended on it. If the pool has no more live sessions,
+ * the worker pool is considered failed as well.
+ */
+static void
+WorkerSessionFailed(WorkerSession *session)
+{
+	WorkerPool *workerPool = session->workerPool;
+	DistributedExecution *execution = workerPool->distributedExecution;
+	MultiConnection *connection = session->connection;
+	TaskPlacementExecution *currentTask = session->currentTask;
+	ListCell *sessionCell = NULL;
+	bool hasLiveSessions = false;
+
+	if (session->sessionState == SESSION_FAILED)
+	{
+		return;
+	}
+
+	session->sessionState = SESSION_FAILED;
+	session->currentTask = NULL;
+	execution->connectionSetChanged = true;
+
+	/*
+	 * DDL commands cannot proceed after a connection failure. Critical
+	 * connections, such as those modifying reference tables, error out in
+	 * MarkRemoteTransactionFailed.
+	 */
+	ReportConnectionError(connection,
+						  execution->operation == CMD_UTILITY ? ERROR : WARNING);
+	MarkRemoteTransactionFailed(connection, true);
+
+	if (currentTask != NULL)
+	{
+		PlacementExecutionFailed(currentTask);
+	}
+
+	while (!dlist_is_empty(&session->readyTaskQueue))
+	{
+		dlist_node *taskQueueNode = dlist_pop_head_node(&session->readyTaskQueue);
+		TaskPlacementExecution *placementExecution =
+			dlist_container(TaskPlacementExecution, taskQueueNode, taskQueueNode);
+
+		PlacementExecutionFailed(placementExecution);
+	}
+
+	foreach(sessionCell, workerPool->sessionList)
+	{
+		WorkerSession *otherSession = (WorkerSession *) lfirst(sessionCell);
+
+		if (otherSession->sessionState != SESSION_FAILED)
+		{
+			hasLiveSessions = true;
+			break;
+		}
+	}
+
+	if (!hasLiveSessions)
+	{
+		WorkerPoolFailed(workerPool);
+	}
+}
+
+
+/*
+ * WorkerPoolFailed marks the worker pool as failed and fails all placement
+ * executions that were waiting in the pool's queue.
+ */
+static void
+WorkerPoolFailed(WorkerPool *workerPool)
+{
+	workerPool->failed = true;
+
+	while (!dlist_is_empty(&workerPool->pendingTaskQueue))
+	{
+		dlist_node *taskQueueNode = dlist_pop_head_node(&workerPool->pendingTaskQueue);
+		TaskPlacementExecution *placementExecution =
+			dlist_container(TaskPlacementExecution, taskQueueNode, taskQueueNode);
+
+		workerPool->pendingTaskCount--;
+
+		PlacementExecutionFailed(placementExecution);
+	}
+}
@@ -12,12 +12,15 @@
 #include "miscadmin.h"
 
 #include "commands/copy.h"
+#include "distributed/adaptive_executor.h"
 #include "distributed/citus_custom_scan.h"
 #include "distributed/insert_select_executor.h"
 #include "distributed/insert_select_planner.h"
+#include "distributed/intermediate_result_scan.h"
 #include "distributed/multi_server_executor.h"
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_router_planner.h"
+#include "distributed/planner_stats.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/worker_protocol.h"
 #include "executor/executor.h"
@@ -31,6 +34,7 @@ static Node * RealTimeCreateScan(CustomScan *scan);
 static Node * TaskTrackerCreateScan(CustomScan *scan);
 static Node * RouterCreateScan(CustomScan *scan);
 static Node * CoordinatorInsertSelectCreateScan(CustomScan *scan);
+static Node * AdaptiveExecutorCreateScan(CustomScan *scan);
 static Node * DelayedErrorCreateScan(CustomScan *scan);
 
 /* functions that are common to different scans */
@@ -60,6 +64,11 @@ CustomScanMethods CoordinatorInsertSelectCustomScanMethods = {
 	CoordinatorInsertSelectCreateScan
 };
 
+CustomScanMethods AdaptiveExecutorCustomScanMethods = {
+	"Citus Adaptive",
+	AdaptiveExecutorCreateScan
+};
+
 CustomScanMethods DelayedErrorCustomScanMethods = {
 	"Citus Delayed Error",
 	DelayedErrorCreateScan
@@ -98,18 +107,18 @@ static CustomExecMethods RouterSequentialModifyCustomExecMethods = {
 
 static CustomExecMethods RouterMultiModifyCustomExecMethods = {
 	.CustomName = "RouterMultiModifyScan",
-	.BeginCustomScan = CitusModifyBeginScan,
+	.BeginCustomScan = RouterMultiModifyBeginScan,
 	.ExecCustomScan = RouterMultiModifyExecScan,
-	.EndCustomScan = CitusEndScan,
+	.EndCustomScan = RouterMultiModifyEndScan,
 	.ReScanCustomScan = CitusReScan,
 	.ExplainCustomScan = CitusExplainScan
 };
 
 static CustomExecMethods RouterSelectCustomExecMethods = {
 	.CustomName = "RouterSelectScan",
-	.BeginCustomScan = CitusSelectBeginScan,
+	.BeginCustomScan = RouterSelectBeginScan,
 	.ExecCustomScan = RouterSelectExecScan,
-	.EndCustomScan = CitusEndScan,
+	.EndCustomScan = RouterSelectEndScan,
 	.ReScanCustomScan = CitusReScan,
 	.ExplainCustomScan = CitusExplainScan
 };
@@ -123,6 +132,24 @@ static CustomExecMethods CoordinatorInsertSelectCustomExecMethods = {
 	.ExplainCustomScan = CoordinatorInsertSelectExplainScan
 };
 
+static CustomExecMethods AdaptiveExecutorCustomExecMethods = {
+	.CustomName = "AdaptiveExecutorScan",
+	.BeginCustomScan = CitusSelectBeginScan,
+	.ExecCustomScan = AdaptiveExecutorExecScan,
+	.EndCustomScan = CitusEndScan,
+	.ReScanCustomScan = CitusReScan,
+	.ExplainCustomScan = CitusExplainScan
+};
+
+static CustomExecMethods AdaptiveExecutorModifyCustomExecMethods = {
+	.CustomName = "AdaptiveExecutorModifyScan",
+	.BeginCustomScan = CitusModifyBeginScan,
+	.ExecCustomScan = AdaptiveExecutorExecScan,
+	.EndCustomScan = CitusEndScan,
+	.ReScanCustomScan = CitusReScan,
+	.ExplainCustomScan = CitusExplainScan
+};
+
 
 /*
  * Let PostgreSQL know about Citus' custom scan nodes.
@@ -134,7 +161,9 @@ RegisterCitusCustomScanMethods(void)
 	RegisterCustomScanMethods(&TaskTrackerCustomScanMethods);
 	RegisterCustomScanMethods(&RouterCustomScanMethods);
 	RegisterCustomScanMethods(&CoordinatorInsertSelectCustomScanMethods);
+	RegisterCustomScanMethods(&AdaptiveExecutorCustomScanMethods);
 	RegisterCustomScanMethods(&DelayedErrorCustomScanMethods);
+	RegisterCustomScanMethods(&IntermediateResultCustomScanMethods);
 }
 
 
@@ -149,6 +178,7 @@ RealTimeCreateScan(CustomScan *scan)
 	scanState->executorType = MULTI_EXECUTOR_REAL_TIME;
 	scanState->customScanState.ss.ps.type = T_CustomScanState;
 	scanState->distributedPlan = GetDistributedPlan(scan);
+	RecordDistributedPlanExecution(scanState->distributedPlan->planId);
 
 	scanState->customScanState.methods = &RealTimeCustomExecMethods;
 
@@ -167,6 +197,7 @@ TaskTrackerCreateScan(CustomScan *scan)
 	scanState->executorType = MULTI_EXECUTOR_TASK_TRACKER;
 	scanState->customScanState.ss.ps.type = T_CustomScanState;
 	scanState->distributedPlan = GetDistributedPlan(scan);
+	RecordDistributedPlanExecution(scanState->distributedPlan->planId);
 
 	scanState->customScanState.methods = &TaskTrackerCustomExecMethods;
 
@@ -189,6 +220,7 @@ RouterCreateScan(CustomScan *scan)
 	scanState->executorType = MULTI_EXECUTOR_ROUTER;
 	scanState->customScanState.ss.ps.type = T_CustomScanState;
 	scanState->distributedPlan = GetDistributedPlan(scan);
+	RecordDistributedPlanExecution(scanState->distributedPlan->planId);
 
 	distributedPlan = scanState->distributedPlan;
 	workerJob = distributedPlan->workerJob;
@@ -245,6 +277,7 @@ CoordinatorInsertSelectCreateScan(CustomScan *scan)
 	scanState->executorType = MULTI_EXECUTOR_COORDINATOR_INSERT_SELECT;
 	scanState->customScanState.ss.ps.type = T_CustomScanState;
 	scanState->distributedPlan = GetDistributedPlan(scan);
+	RecordDistributedPlanExecution(scanState->distributedPlan->planId);
 
 	scanState->customScanState.methods = &CoordinatorInsertSelectCustomExecMethods;
 
@@ -252,6 +285,44 @@ CoordinatorInsertSelectCreateScan(CustomScan *scan)
 }
 
 
+/*
+ * AdaptiveExecutorCreateScan creates the scan state for queries that are
+ * executed by the adaptive executor.
+ */
+static Node *
+AdaptiveExecutorCreateScan(CustomScan *scan)
+{
+	CitusScanState *scanState = palloc0(sizeof(CitusScanState));
+	DistributedPlan *distributedPlan = NULL;
+
+	scanState->executorType = MULTI_EXECUTOR_ADAPTIVE;
+	scanState->customScanState.ss.ps.type = T_CustomScanState;
+	scanState->distributedPlan = GetDistributedPlan(scan);
+	RecordDistributedPlanExecution(scanState->distributedPlan->planId);
+
+	distributedPlan = scanState->distributedPlan;
+
+	if (!IsModifyDistributedPlan(distributedPlan))
+	{
+		scanState->customScanState.methods = &AdaptiveExecutorCustomExecMethods;
+	}
+	else if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
+	{
+		/*
+		 * Multi shard update deletes while multi_shard_modify_mode equals
+		 * to 'sequential' are executed by the router executor.
+		 */
+		scanState->customScanState.methods = &RouterSequentialModifyCustomExecMethods;
+	}
+	else
+	{
+		scanState->customScanState.methods = &AdaptiveExecutorModifyCustomExecMethods;
+	}
+
+	return (Node *) scanState;
+}
+
+
 /*
  * DelayedErrorCreateScan is only called if we could not plan for the given
  * query. This is the case when a plan is not ready for execution because
@@ -274,12 +345,18 @@ DelayedErrorCreateScan(CustomScan *scan)
 
 
 /*
- * CitusSelectBeginScan is an empty function for BeginCustomScan callback.
+ * CitusSelectBeginScan is the BeginCustomScan callback of SELECT queries. It
+ * prunes shards for router queries that deferred pruning to the executor, as
+ * the adaptive executor also runs those, and points the placements of the
+ * tasks to the nodes that the transaction reads from.
  */
 static void
 CitusSelectBeginScan(CustomScanState *node, EState *estate, int eflags)
 {
-	/* just an empty function */
+	CitusScanState *scanState = (CitusScanState *) node;
+
+	PruneDeferredRouterSelect(scanState);
+	ResolveReadPlacementNodes(scanState);
 }
 
 
@@ -9,14 +9,25 @@
  */
 
 #include "postgres.h"
+#include "libpq-fe.h"
 
+#include "distributed/citus_ruleutils.h"
+#include "distributed/connection_management.h"
+#include "distributed/deparse_shard_query.h"
 #include "distributed/insert_select_executor.h"
 #include "distributed/insert_select_planner.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
 #include "distributed/multi_copy.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/multi_router_executor.h"
 #include "distributed/distributed_planner.h"
+#include "distributed/placement_connection.h"
+#include "distributed/query_stats.h"
+#include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
 #include "distributed/resource_lock.h"
 #include "distributed/transaction_management.h"
 #include "executor/executor.h"
@@ -29,13 +40,35 @@
 #include "parser/parsetree.h"
 #include "tcop/pquery.h"
 #include "tcop/tcopprot.h"
+#include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/portal.h"
 #include "utils/snapmgr.h"
 
 
+/* config variable managed via guc.c */
+bool EnableRepartitionedInsertSelect = false;
+
+/* number of repartitioned INSERT ... SELECTs, to give their results unique names */
+static uint64 RepartitionedInsertSelectCount = 0;
+
+
 static void ExecuteSelectIntoRelation(Oid targetRelationId, List *insertTargetList,
 									  Query *selectQuery, EState *executorState);
+static int InsertPartitionColumnIndex(Oid targetRelationId, List *insertTargetList);
+static void ExecuteRepartitionedInsertSelect(DistributedPlan *distributedPlan,
+											 EState *executorState);
+static List * PartitionSourceShards(List *sourceShardList, Query *selectQuery,
+									int partitionColumnIndex, List *targetShardList,
+									const char *resultPrefix);
+static void ExecuteCommandsOnPlacements(List *placementList, List *commandList);
+static List * FetchPartitionsTaskList(List *targetShardList, List *sourcePlacementList,
+									  const char *resultPrefix);
+static List * InsertPartitionsTaskList(List *targetShardList, List *insertTargetList,
+									   Query *selectQuery, int sourceShardCount,
+									   const char *resultPrefix);
+static Task * RepartitionTask(uint64 shardId, int taskId, char *queryString);
+static bool CanUseBinaryResultFormat(List *targetList);
 
 
 /*
@@ -58,8 +91,6 @@ CoordinatorInsertSelectExecScan(CustomScanState *node)
 		List *insertTargetList = distributedPlan->insertTargetList;
 		Oid targetRelationId = distributedPlan->targetRelationId;
 
-		ereport(DEBUG1, (errmsg("Collecting INSERT ... SELECT results on coordinator")));
-
 		/*
 		 * If we are dealing with partitioned table, we also need to lock its
 		 * partitions. Here we only lock targetRelation, we acquire necessary
@@ -70,8 +101,22 @@ CoordinatorInsertSelectExecScan(CustomScanState *node)
 			LockPartitionRelations(targetRelationId, RowExclusiveLock);
 		}
 
-		ExecuteSelectIntoRelation(targetRelationId, insertTargetList, selectQuery,
-								  executorState);
+		QueryStatsRemoteExecutionStart(scanState);
+
+		if (IsRepartitionedInsertSelect(distributedPlan))
+		{
+			ExecuteRepartitionedInsertSelect(distributedPlan, executorState);
+		}
+		else
+		{
+			ereport(DEBUG1, (errmsg("Collecting INSERT ... SELECT results on "
+									"coordinator")));
+
+			ExecuteSelectIntoRelation(targetRelationId, insertTargetList, selectQuery,
+									  executorState);
+		}
+
+		QueryStatsRemoteExecutionEnd();
 
 		scanState->finishedRemoteScan = true;
 	}
@@ -141,3 +186,587 @@ ExecuteSelectIntoRelation(Oid targetRelationId, List *insertTargetList,
 
 	XactModificationLevel = XACT_MODIFICATION_DATA;
 }
+
+
+/*
+ * IsRepartitionedInsertSelect returns whether the given INSERT ... SELECT via
+ * the coordinator is executed by repartitioning the results of the SELECT on
+ * the workers, instead of pulling them to the coordinator. We do so when
+ * citus.enable_repartitioned_insert_select is enabled, the target table is
+ * hash-distributed, and the SELECT is a simple scan of a distributed table
+ * that can run on each shard separately.
+ */
+bool
+IsRepartitionedInsertSelect(DistributedPlan *distributedPlan)
+{
+	Query *selectQuery = distributedPlan->insertSelectSubquery;
+	Oid targetRelationId = distributedPlan->targetRelationId;
+	DistTableCacheEntry *targetCacheEntry = NULL;
+	RangeTblEntry *sourceRte = NULL;
+	TargetEntry *partitionTargetEntry = NULL;
+	Var *partitionColumn = NULL;
+	ListCell *targetEntryCell = NULL;
+	int partitionColumnIndex = -1;
+
+	if (!EnableRepartitionedInsertSelect || selectQuery == NULL)
+	{
+		return false;
+	}
+
+	if (PartitionMethod(targetRelationId) != DISTRIBUTE_BY_HASH)
+	{
+		return false;
+	}
+
+	targetCacheEntry = DistributedTableCacheEntry(targetRelationId);
+	if (targetCacheEntry->shardIntervalArrayLength == 0 ||
+		!targetCacheEntry->hasUniformHashDistribution)
+	{
+		return false;
+	}
+
+	/* the SELECT needs to return the same rows when run on each shard */
+	if (selectQuery->commandType != CMD_SELECT || selectQuery->cteList != NIL ||
+		selectQuery->setOperations != NULL || selectQuery->hasAggs ||
+		selectQuery->groupClause != NIL || selectQuery->havingQual != NULL ||
+		selectQuery->hasWindowFuncs || selectQuery->distinctClause != NIL ||
+		selectQuery->sortClause != NIL || selectQuery->limitCount != NULL ||
+		selectQuery->limitOffset != NULL || selectQuery->hasSubLinks ||
+		selectQuery->hasForUpdate || selectQuery->rowMarks != NIL)
+	{
+		return false;
+	}
+
+	if (list_length(selectQuery->rtable) != 1 ||
+		list_length(selectQuery->jointree->fromlist) != 1 ||
+		!IsA(linitial(selectQuery->jointree->fromlist), RangeTblRef))
+	{
+		return false;
+	}
+
+	sourceRte = (RangeTblEntry *) linitial(selectQuery->rtable);
+	if (sourceRte->rtekind != RTE_RELATION || !IsDistributedTable(sourceRte->relid))
+	{
+		return false;
+	}
+
+	foreach(targetEntryCell, selectQuery->targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+
+		if (targetEntry->resjunk)
+		{
+			return false;
+		}
+	}
+
+	partitionColumnIndex = InsertPartitionColumnIndex(targetRelationId,
+													  distributedPlan->insertTargetList);
+	if (partitionColumnIndex < 0 ||
+		partitionColumnIndex >= list_length(selectQuery->targetList))
+	{
+		return false;
+	}
+
+	/* workers hash the values with the hash function of their type */
+	partitionColumn = PartitionColumn(targetRelationId, 0);
+	partitionTargetEntry = list_nth(selectQuery->targetList, partitionColumnIndex);
+	if (exprType((Node *) partitionTargetEntry->expr) != partitionColumn->vartype)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * InsertPartitionColumnIndex returns the position of the partition column of the
+ * target relation in the INSERT target list, or -1 if it is not inserted into.
+ */
+static int
+InsertPartitionColumnIndex(Oid targetRelationId, List *insertTargetList)
+{
+	Var *partitionColumn = PartitionColumn(targetRelationId, 0);
+	ListCell *insertTargetCell = NULL;
+	int insertTargetIndex = 0;
+
+	if (partitionColumn == NULL)
+	{
+		return -1;
+	}
+
+	foreach(insertTargetCell, insertTargetList)
+	{
+		TargetEntry *insertTargetEntry = (TargetEntry *) lfirst(insertTargetCell);
+		AttrNumber attrNumber = get_attnum(targetRelationId, insertTargetEntry->resname);
+
+		if (attrNumber == partitionColumn->varattno)
+		{
+			return insertTargetIndex;
+		}
+
+		insertTargetIndex++;
+	}
+
+	return -1;
+}
+
+
+/*
+ * ExecuteRepartitionedInsertSelect executes an INSERT ... SELECT for which
+ * IsRepartitionedInsertSelect returned true without pulling any rows to the
+ * coordinator. We first run the SELECT on a placement of each source shard,
+ * and write its results into a local intermediate result for each target shard.
+ * The placements of a target shard then fetch their results from the other
+ * nodes, and insert them into the shard. All steps run in the distributed
+ * transaction, so the results are removed when it ends.
+ */
+static void
+ExecuteRepartitionedInsertSelect(DistributedPlan *distributedPlan,
+								 EState *executorState)
+{
+	Query *selectQuery = copyObject(distributedPlan->insertSelectSubquery);
+	Oid targetRelationId = distributedPlan->targetRelationId;
+	List *insertTargetList = distributedPlan->insertTargetList;
+	ParamListInfo paramListInfo = executorState->es_param_list_info;
+	RangeTblEntry *sourceRte = (RangeTblEntry *) linitial(selectQuery->rtable);
+	List *sourceShardList = NIL;
+	List *targetShardList = NIL;
+	List *sourcePlacementList = NIL;
+	List *fetchTaskList = NIL;
+	List *insertTaskList = NIL;
+	int partitionColumnIndex = -1;
+	StringInfo resultPrefix = makeStringInfo();
+
+	ereport(DEBUG1, (errmsg("repartitioning INSERT ... SELECT results on workers")));
+
+	/* workers cannot see the parameters of the coordinator */
+	selectQuery = (Query *) ResolveExternalParams((Node *) selectQuery, paramListInfo);
+
+	partitionColumnIndex = InsertPartitionColumnIndex(targetRelationId, insertTargetList);
+
+	appendStringInfo(resultPrefix, "repartitioned_results_" UINT64_FORMAT,
+					 RepartitionedInsertSelectCount++);
+
+	sourceShardList = LoadShardIntervalList(sourceRte->relid);
+	if (sourceShardList == NIL)
+	{
+		executorState->es_processed = 0;
+		return;
+	}
+
+	targetShardList = LoadShardIntervalList(targetRelationId);
+
+	/* prevent the placements of the target shards from changing */
+	LockShardListMetadata(targetShardList, ShareLock);
+
+	sourcePlacementList = PartitionSourceShards(sourceShardList, selectQuery,
+												partitionColumnIndex, targetShardList,
+												resultPrefix->data);
+
+	fetchTaskList = FetchPartitionsTaskList(targetShardList, sourcePlacementList,
+											resultPrefix->data);
+	ExecuteModifyTasksWithoutResults(fetchTaskList);
+
+	insertTaskList = InsertPartitionsTaskList(targetShardList, insertTargetList,
+											  selectQuery, list_length(sourceShardList),
+											  resultPrefix->data);
+	executorState->es_processed = ExecuteModifyTasksWithoutResults(insertTaskList);
+
+	XactModificationLevel = XACT_MODIFICATION_DATA;
+}
+
+
+/*
+ * PartitionSourceShards runs the SELECT on a placement of each source shard,
+ * and writes its results into the intermediate results <prefix>_<source shard
+ * index>_<target shard index>. The function returns the placements on which the
+ * SELECT ran, in the order of the source shards.
+ */
+static List *
+PartitionSourceShards(List *sourceShardList, Query *selectQuery,
+					  int partitionColumnIndex, List *targetShardList,
+					  const char *resultPrefix)
+{
+	List *placementList = NIL;
+	List *commandList = NIL;
+	ListCell *sourceShardCell = NULL;
+	ListCell *targetShardCell = NULL;
+	StringInfo splitPointString = makeStringInfo();
+	bool binaryFormat = CanUseBinaryResultFormat(selectQuery->targetList);
+	int shardIndex = 0;
+
+	/* the target shards are given by their lowest hash values */
+	appendStringInfoChar(splitPointString, '{');
+
+	foreach(targetShardCell, targetShardList)
+	{
+		ShardInterval *targetShard = (ShardInterval *) lfirst(targetShardCell);
+
+		appendStringInfo(splitPointString, "%s%d",
+						 (targetShardCell != list_head(targetShardList)) ? "," : "",
+						 DatumGetInt32(targetShard->minValue));
+	}
+
+	appendStringInfoChar(splitPointString, '}');
+
+	foreach(sourceShardCell, sourceShardList)
+	{
+		ShardInterval *sourceShard = (ShardInterval *) lfirst(sourceShardCell);
+		uint64 shardId = sourceShard->shardId;
+		Query *shardQuery = copyObject(selectQuery);
+		RelationShard *relationShard = CitusMakeNode(RelationShard);
+		List *shardPlacementList = FinalizedShardPlacementList(shardId);
+		StringInfo shardQueryString = makeStringInfo();
+		StringInfo shardResultPrefix = makeStringInfo();
+		StringInfo partitionCommand = makeStringInfo();
+
+		if (shardPlacementList == NIL)
+		{
+			ereport(ERROR, (errmsg("could not find any shard placements for the shard "
+								   UINT64_FORMAT, shardId)));
+		}
+
+		relationShard->relationId = sourceShard->relationId;
+		relationShard->shardId = shardId;
+
+		UpdateRelationToShardNames((Node *) shardQuery, list_make1(relationShard));
+		pg_get_query_def(shardQuery, shardQueryString);
+
+		appendStringInfo(shardResultPrefix, "%s_%d", resultPrefix, shardIndex);
+
+		appendStringInfo(partitionCommand,
+						 "SELECT worker_partition_query_result(%s, %s, %d, %s, %s)",
+						 quote_literal_cstr(shardResultPrefix->data),
+						 quote_literal_cstr(shardQueryString->data),
+						 partitionColumnIndex,
+						 quote_literal_cstr(splitPointString->data),
+						 binaryFormat ? "true" : "false");
+
+		placementList = lappend(placementList, linitial(shardPlacementList));
+		commandList = lappend(commandList, partitionCommand->data);
+
+		shardIndex++;
+	}
+
+	ExecuteCommandsOnPlacements(placementList, commandList);
+
+	return placementList;
+}
+
+
+/*
+ * ExecuteCommandsOnPlacements runs each command in the distributed transaction
+ * over a connection to the corresponding placement. Commands on different
+ * connections run in parallel, and commands that share a connection run one
+ * after another.
+ */
+static void
+ExecuteCommandsOnPlacements(List *placementList, List *commandList)
+{
+	List *connectionList = NIL;
+	List *claimedConnectionList = NIL;
+	ListCell *placementCell = NULL;
+	int commandCount = list_length(commandList);
+	bool *commandDone = (bool *) palloc0(commandCount * sizeof(bool));
+	bool *commandSent = (bool *) palloc0(commandCount * sizeof(bool));
+	bool commandsPending = true;
+
+	BeginOrContinueCoordinatedTransaction();
+
+	foreach(placementCell, placementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+		MultiConnection *connection = StartPlacementConnection(0, placement, NULL);
+
+		if (!connection->claimedExclusively)
+		{
+			ClaimConnectionExclusively(connection);
+			claimedConnectionList = lappend(claimedConnectionList, connection);
+		}
+
+		connectionList = lappend(connectionList, connection);
+	}
+
+	FinishConnectionListEstablishment(claimedConnectionList);
+	RemoteTransactionsBeginIfNecessary(claimedConnectionList);
+
+	while (commandsPending)
+	{
+		List *busyConnectionList = NIL;
+		ListCell *connectionCell = NULL;
+		ListCell *commandCell = NULL;
+		int commandIndex = 0;
+
+		commandsPending = false;
+
+		/* send the next command over each connection */
+		forboth(connectionCell, connectionList, commandCell, commandList)
+		{
+			MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+			char *command = (char *) lfirst(commandCell);
+
+			commandSent[commandIndex] = false;
+
+			if (!commandDone[commandIndex] &&
+				!list_member_ptr(busyConnectionList, connection))
+			{
+				if (!SendRemoteCommand(connection, command))
+				{
+					ReportConnectionError(connection, ERROR);
+				}
+
+				busyConnectionList = lappend(busyConnectionList, connection);
+				commandSent[commandIndex] = true;
+			}
+
+			commandIndex++;
+		}
+
+		commandIndex = 0;
+
+		foreach(connectionCell, connectionList)
+		{
+			MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+			bool raiseInterrupts = true;
+			PGresult *result = NULL;
+
+			if (commandSent[commandIndex])
+			{
+				result = GetRemoteCommandResult(connection, raiseInterrupts);
+				if (!IsResponseOK(result))
+				{
+					ReportResultError(connection, result, ERROR);
+				}
+
+				PQclear(result);
+				ForgetResults(connection);
+
+				commandDone[commandIndex] = true;
+			}
+			else if (!commandDone[commandIndex])
+			{
+				commandsPending = true;
+			}
+
+			commandIndex++;
+		}
+	}
+
+	foreach(placementCell, claimedConnectionList)
+	{
+		UnclaimConnection((MultiConnection *) lfirst(placementCell));
+	}
+}
+
+
+/*
+ * FetchPartitionsTaskList returns a task for each target shard that fetches
+ * the results for the shard from the nodes on which the source shards were
+ * partitioned. Results that were written on the node of a target placement
+ * are not fetched again.
+ */
+static List *
+FetchPartitionsTaskList(List *targetShardList, List *sourcePlacementList,
+						const char *resultPrefix)
+{
+	List *taskList = NIL;
+	ListCell *targetShardCell = NULL;
+	int shardIndex = 0;
+
+	foreach(targetShardCell, targetShardList)
+	{
+		ShardInterval *targetShard = (ShardInterval *) lfirst(targetShardCell);
+		List *nodePlacementList = NIL;
+		ListCell *sourcePlacementCell = NULL;
+		ListCell *nodePlacementCell = NULL;
+		StringInfo fetchQuery = makeStringInfo();
+
+		/* find the distinct nodes on which the source shards were partitioned */
+		foreach(sourcePlacementCell, sourcePlacementList)
+		{
+			ShardPlacement *sourcePlacement = lfirst(sourcePlacementCell);
+			bool nodeFound = false;
+
+			foreach(nodePlacementCell, nodePlacementList)
+			{
+				ShardPlacement *nodePlacement = lfirst(nodePlacementCell);
+
+				if (nodePlacement->nodePort == sourcePlacement->nodePort &&
+					strcmp(nodePlacement->nodeName, sourcePlacement->nodeName) == 0)
+				{
+					nodeFound = true;
+					break;
+				}
+			}
+
+			if (!nodeFound)
+			{
+				nodePlacementList = lappend(nodePlacementList, sourcePlacement);
+			}
+		}
+
+		appendStringInfoString(fetchQuery, "SELECT ");
+
+		foreach(nodePlacementCell, nodePlacementList)
+		{
+			ShardPlacement *nodePlacement = lfirst(nodePlacementCell);
+			int sourceShardIndex = 0;
+			bool firstResult = true;
+
+			if (nodePlacementCell != list_head(nodePlacementList))
+			{
+				appendStringInfoString(fetchQuery, " + ");
+			}
+
+			appendStringInfoString(fetchQuery, "fetch_intermediate_results(ARRAY[");
+
+			foreach(sourcePlacementCell, sourcePlacementList)
+			{
+				ShardPlacement *sourcePlacement = lfirst(sourcePlacementCell);
+				StringInfo resultId = NULL;
+
+				if (sourcePlacement->nodePort == nodePlacement->nodePort &&
+					strcmp(sourcePlacement->nodeName, nodePlacement->nodeName) == 0)
+				{
+					resultId = makeStringInfo();
+					appendStringInfo(resultId, "%s_%d_%d", resultPrefix,
+									 sourceShardIndex, shardIndex);
+
+					appendStringInfo(fetchQuery, "%s%s", firstResult ? "" : ",",
+									 quote_literal_cstr(resultId->data));
+					firstResult = false;
+				}
+
+				sourceShardIndex++;
+			}
+
+			appendStringInfo(fetchQuery, "]::text[], %s, %d)",
+							 quote_literal_cstr(nodePlacement->nodeName),
+							 nodePlacement->nodePort);
+		}
+
+		taskList = lappend(taskList, RepartitionTask(targetShard->shardId,
+													 shardIndex + 1,
+													 fetchQuery->data));
+		shardIndex++;
+	}
+
+	return taskList;
+}
+
+
+/*
+ * InsertPartitionsTaskList returns a task for each target shard that inserts
+ * the results of all source shards for the shard into it.
+ */
+static List *
+InsertPartitionsTaskList(List *targetShardList, List *insertTargetList,
+						 Query *selectQuery, int sourceShardCount,
+						 const char *resultPrefix)
+{
+	List *taskList = NIL;
+	ListCell *targetShardCell = NULL;
+	StringInfo columnNames = makeStringInfo();
+	StringInfo columnDefinitions = makeStringInfo();
+	ListCell *insertTargetCell = NULL;
+	ListCell *selectTargetCell = NULL;
+	bool binaryFormat = CanUseBinaryResultFormat(selectQuery->targetList);
+	int shardIndex = 0;
+
+	/* results contain the columns in the order of the INSERT target list */
+	forboth(insertTargetCell, insertTargetList, selectTargetCell, selectQuery->targetList)
+	{
+		TargetEntry *insertTargetEntry = (TargetEntry *) lfirst(insertTargetCell);
+		TargetEntry *selectTargetEntry = (TargetEntry *) lfirst(selectTargetCell);
+		Node *selectExpression = (Node *) selectTargetEntry->expr;
+		const char *columnName = quote_identifier(insertTargetEntry->resname);
+		const char *separator = (insertTargetCell == list_head(insertTargetList)) ?
+								"" : ", ";
+
+		appendStringInfo(columnNames, "%s%s", separator, columnName);
+		appendStringInfo(columnDefinitions, "%s%s %s", separator, columnName,
+						 format_type_with_typemod(exprType(selectExpression),
+												  exprTypmod(selectExpression)));
+	}
+
+	foreach(targetShardCell, targetShardList)
+	{
+		ShardInterval *targetShard = (ShardInterval *) lfirst(targetShardCell);
+		StringInfo insertQuery = makeStringInfo();
+		int sourceShardIndex = 0;
+
+		appendStringInfo(insertQuery, "INSERT INTO %s (%s) ",
+						 ConstructQualifiedShardName(targetShard), columnNames->data);
+
+		for (sourceShardIndex = 0; sourceShardIndex < sourceShardCount;
+			 sourceShardIndex++)
+		{
+			StringInfo resultId = makeStringInfo();
+
+			appendStringInfo(resultId, "%s_%d_%d", resultPrefix, sourceShardIndex,
+							 shardIndex);
+
+			appendStringInfo(insertQuery,
+							 "%sSELECT %s FROM read_intermediate_result(%s, %s) "
+							 "AS intermediate_result(%s)",
+							 (sourceShardIndex > 0) ? " UNION ALL " : "",
+							 columnNames->data, quote_literal_cstr(resultId->data),
+							 binaryFormat ? "'binary'" : "'text'",
+							 columnDefinitions->data);
+		}
+
+		taskList = lappend(taskList, RepartitionTask(targetShard->shardId,
+													 shardIndex + 1,
+													 insertQuery->data));
+		shardIndex++;
+	}
+
+	return taskList;
+}
+
+
+/*
+ * RepartitionTask returns a task that runs the given query on all placements of
+ * the given target shard.
+ */
+static Task *
+RepartitionTask(uint64 shardId, int taskId, char *queryString)
+{
+	Task *task = CitusMakeNode(Task);
+
+	task->jobId = INVALID_JOB_ID;
+	task->taskId = taskId;
+	task->taskType = MODIFY_TASK;
+	task->queryString = queryString;
+	task->dependedTaskList = NULL;
+	task->replicationModel = REPLICATION_MODEL_INVALID;
+	task->anchorShardId = shardId;
+	task->taskPlacementList = FinalizedShardPlacementList(shardId);
+
+	return task;
+}
+
+
+/*
+ * CanUseBinaryResultFormat returns whether all columns of the given target list
+ * can be written to and read from the intermediate results in binary format.
+ */
+static bool
+CanUseBinaryResultFormat(List *targetList)
+{
+	ListCell *targetEntryCell = NULL;
+
+	foreach(targetEntryCell, targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+
+		if (!CanUseBinaryCopyFormatForType(exprType((Node *) targetEntry->expr)))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
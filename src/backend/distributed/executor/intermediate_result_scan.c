@@ -0,0 +1,358 @@
+/*-------------------------------------------------------------------------
+ *
+ * intermediate_result_scan.c
+ *
+ * Custom scan that reads an intermediate result row by row.
+ *
+ * A read_intermediate_result call in the FROM clause is planned as a function
+ * scan, which materializes all rows of the result in a tuplestore before
+ * returning the first one. For large results that means writing them to disk
+ * a second time. When the arguments of the call are constants, the planner
+ * replaces the function scan by an IntermediateResultScan, which parses the
+ * rows from the result as they are requested.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "distributed/intermediate_result_scan.h"
+#include "distributed/intermediate_results.h"
+#include "executor/executor.h"
+#include "nodes/extensible.h"
+#include "nodes/makefuncs.h"
+#include "nodes/relation.h"
+#include "optimizer/restrictinfo.h"
+#include "optimizer/var.h"
+#include "utils/memutils.h"
+
+
+/*
+ * IntermediateResultScanState is the execution state of an intermediate
+ * result scan.
+ */
+typedef struct IntermediateResultScanState
+{
+	CustomScanState customScanState;
+	char *resultId;
+	char *copyFormat;
+	IntermediateResultStream *stream;
+} IntermediateResultScanState;
+
+
+/* Config variable managed via guc.c */
+bool EnableIntermediateResultStreaming = true;
+
+
+/* local function forward declarations */
+static bool IsSimpleColumnReferenceList(List *expressionList, Index relationId);
+static Plan * PlanIntermediateResultPath(PlannerInfo *root, RelOptInfo *rel,
+										 CustomPath *bestPath, List *tlist,
+										 List *clauses, List *customPlans);
+static Node * IntermediateResultCreateScan(CustomScan *scan);
+static void IntermediateResultBeginScan(CustomScanState *node, EState *estate,
+										int eflags);
+static TupleTableSlot * IntermediateResultExecScan(CustomScanState *node);
+static TupleTableSlot * IntermediateResultNext(ScanState *scanState);
+static bool IntermediateResultRecheck(ScanState *scanState, TupleTableSlot *slot);
+static void IntermediateResultEndScan(CustomScanState *node);
+static void IntermediateResultReScan(CustomScanState *node);
+
+
+static CustomPathMethods IntermediateResultCustomPathMethods = {
+	"Citus Intermediate Result",
+	PlanIntermediateResultPath
+};
+
+CustomScanMethods IntermediateResultCustomScanMethods = {
+	"Citus Intermediate Result",
+	IntermediateResultCreateScan
+};
+
+static CustomExecMethods IntermediateResultCustomExecMethods = {
+	.CustomName = "IntermediateResultScan",
+	.BeginCustomScan = IntermediateResultBeginScan,
+	.ExecCustomScan = IntermediateResultExecScan,
+	.EndCustomScan = IntermediateResultEndScan,
+	.ReScanCustomScan = IntermediateResultReScan
+};
+
+
+/*
+ * UseIntermediateResultScan replaces the function scan path of the given
+ * read_intermediate_result call by a path that reads the result row by row,
+ * keeping the row count and costs of the function scan. Calls that need
+ * more than plain columns of the result are left alone.
+ */
+void
+UseIntermediateResultScan(RelOptInfo *relOptInfo, RangeTblEntry *rangeTableEntry,
+						  char *resultId, char *copyFormat)
+{
+	Path *functionScanPath = NULL;
+	CustomPath *customPath = NULL;
+	List *restrictionClauses = NIL;
+
+	if (!EnableIntermediateResultStreaming)
+	{
+		return;
+	}
+
+	if (rangeTableEntry->funcordinality || list_length(relOptInfo->pathlist) != 1)
+	{
+		return;
+	}
+
+	functionScanPath = (Path *) linitial(relOptInfo->pathlist);
+	if (functionScanPath->param_info != NULL)
+	{
+		/* the call depends on other relations */
+		return;
+	}
+
+	restrictionClauses = extract_actual_clauses(relOptInfo->baserestrictinfo, false);
+
+	if (!IsSimpleColumnReferenceList(relOptInfo->reltarget->exprs, relOptInfo->relid) ||
+		!IsSimpleColumnReferenceList(restrictionClauses, relOptInfo->relid))
+	{
+		/* whole-row references and placeholders need a function scan */
+		return;
+	}
+
+	customPath = makeNode(CustomPath);
+	customPath->path.pathtype = T_CustomScan;
+	customPath->path.parent = relOptInfo;
+	customPath->path.pathtarget = relOptInfo->reltarget;
+	customPath->path.param_info = NULL;
+#if (PG_VERSION_NUM >= 100000)
+	customPath->path.parallel_aware = false;
+#endif
+	customPath->path.parallel_safe = false;
+	customPath->path.parallel_workers = 0;
+	customPath->path.rows = functionScanPath->rows;
+	customPath->path.startup_cost = functionScanPath->startup_cost;
+	customPath->path.total_cost = functionScanPath->total_cost;
+	customPath->path.pathkeys = NIL;
+	customPath->flags = 0;
+	customPath->custom_private = list_make2(makeString(resultId),
+											makeString(copyFormat));
+	customPath->methods = &IntermediateResultCustomPathMethods;
+
+	relOptInfo->pathlist = list_make1(customPath);
+	relOptInfo->partial_pathlist = NIL;
+}
+
+
+/*
+ * IsSimpleColumnReferenceList returns whether all variables in the given
+ * expressions refer to a column of the relation with the given range table
+ * index.
+ */
+static bool
+IsSimpleColumnReferenceList(List *expressionList, Index relationId)
+{
+	List *varList = pull_var_clause((Node *) expressionList,
+									PVC_RECURSE_AGGREGATES |
+									PVC_RECURSE_WINDOWFUNCS |
+									PVC_INCLUDE_PLACEHOLDERS);
+	ListCell *varCell = NULL;
+
+	foreach(varCell, varList)
+	{
+		Var *column = (Var *) lfirst(varCell);
+
+		if (!IsA(column, Var) || column->varno != relationId || column->varattno <= 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * PlanIntermediateResultPath creates the custom scan for an intermediate
+ * result path. The scan does not have a relation of its own, so its scan
+ * tuple is described by a target list with all columns of the result.
+ */
+static Plan *
+PlanIntermediateResultPath(PlannerInfo *root, RelOptInfo *rel, CustomPath *bestPath,
+						   List *tlist, List *clauses, List *customPlans)
+{
+	CustomScan *customScan = makeNode(CustomScan);
+	RangeTblEntry *rangeTableEntry = planner_rt_fetch(rel->relid, root);
+	RangeTblFunction *rangeTableFunction =
+		(RangeTblFunction *) linitial(rangeTableEntry->functions);
+	List *scanTargetList = NIL;
+	ListCell *typeCell = NULL;
+	ListCell *typmodCell = NULL;
+	ListCell *collationCell = NULL;
+	AttrNumber columnNumber = 1;
+
+	forthree(typeCell, rangeTableFunction->funccoltypes,
+			 typmodCell, rangeTableFunction->funccoltypmods,
+			 collationCell, rangeTableFunction->funccolcollations)
+	{
+		Var *column = makeVar(rel->relid, columnNumber, lfirst_oid(typeCell),
+							  lfirst_int(typmodCell), lfirst_oid(collationCell), 0);
+		TargetEntry *targetEntry = makeTargetEntry((Expr *) column, columnNumber,
+												   NULL, false);
+
+		scanTargetList = lappend(scanTargetList, targetEntry);
+		columnNumber++;
+	}
+
+	customScan->scan.plan.targetlist = tlist;
+	customScan->scan.plan.qual = extract_actual_clauses(clauses, false);
+	customScan->scan.scanrelid = 0;
+	customScan->flags = bestPath->flags;
+	customScan->custom_scan_tlist = scanTargetList;
+	customScan->custom_private = bestPath->custom_private;
+	customScan->methods = &IntermediateResultCustomScanMethods;
+
+	return (Plan *) customScan;
+}
+
+
+/*
+ * IntermediateResultCreateScan creates the scan state of an intermediate
+ * result scan.
+ */
+static Node *
+IntermediateResultCreateScan(CustomScan *scan)
+{
+	IntermediateResultScanState *scanState =
+		palloc0(sizeof(IntermediateResultScanState));
+
+	scanState->customScanState.ss.ps.type = T_CustomScanState;
+	scanState->customScanState.methods = &IntermediateResultCustomExecMethods;
+	scanState->resultId = strVal(linitial(scan->custom_private));
+	scanState->copyFormat = strVal(lsecond(scan->custom_private));
+
+	return (Node *) scanState;
+}
+
+
+/*
+ * IntermediateResultBeginScan starts reading the intermediate result.
+ */
+static void
+IntermediateResultBeginScan(CustomScanState *node, EState *estate, int eflags)
+{
+	IntermediateResultScanState *scanState = (IntermediateResultScanState *) node;
+	TupleDesc tupleDescriptor = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+	{
+		/* the result may not exist when only explaining the query */
+		return;
+	}
+
+	scanState->stream = BeginIntermediateResultStream(scanState->resultId,
+													  scanState->copyFormat,
+													  tupleDescriptor);
+}
+
+
+/*
+ * IntermediateResultExecScan returns the next row of the intermediate result
+ * that passes the quals of the scan.
+ */
+static TupleTableSlot *
+IntermediateResultExecScan(CustomScanState *node)
+{
+	return ExecScan(&node->ss, (ExecScanAccessMtd) IntermediateResultNext,
+					(ExecScanRecheckMtd) IntermediateResultRecheck);
+}
+
+
+/*
+ * IntermediateResultNext parses the next row of the intermediate result into
+ * the scan tuple, or returns an empty slot when all rows were read.
+ */
+static TupleTableSlot *
+IntermediateResultNext(ScanState *scanState)
+{
+	IntermediateResultScanState *resultScanState =
+		(IntermediateResultScanState *) scanState;
+	TupleTableSlot *scanSlot = scanState->ss_ScanTupleSlot;
+	ExprContext *econtext = scanState->ps.ps_ExprContext;
+	MemoryContext oldContext = NULL;
+	bool rowFound = false;
+
+	ExecClearTuple(scanSlot);
+
+	/* the per-tuple memory is reset by ExecScan for every row */
+	oldContext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+	rowFound = NextIntermediateResultRow(resultScanState->stream, econtext,
+										 scanSlot->tts_values, scanSlot->tts_isnull);
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (rowFound)
+	{
+		ExecStoreVirtualTuple(scanSlot);
+	}
+
+	return scanSlot;
+}
+
+
+/*
+ * IntermediateResultRecheck is called for EvalPlanQual rechecks, which never
+ * involve intermediate results since they cannot be locked.
+ */
+static bool
+IntermediateResultRecheck(ScanState *scanState, TupleTableSlot *slot)
+{
+	return true;
+}
+
+
+/*
+ * IntermediateResultEndScan stops reading the intermediate result.
+ */
+static void
+IntermediateResultEndScan(CustomScanState *node)
+{
+	IntermediateResultScanState *scanState = (IntermediateResultScanState *) node;
+
+	if (scanState->stream != NULL)
+	{
+		EndIntermediateResultStream(scanState->stream);
+		scanState->stream = NULL;
+	}
+
+	ExecClearTuple(node->ss.ss_ScanTupleSlot);
+}
+
+
+/*
+ * IntermediateResultReScan starts reading the intermediate result again from
+ * the start, for instance when the scan is on the inner side of a nested loop.
+ */
+static void
+IntermediateResultReScan(CustomScanState *node)
+{
+	IntermediateResultScanState *scanState = (IntermediateResultScanState *) node;
+	TupleDesc tupleDescriptor = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	EState *executorState = node->ss.ps.state;
+	MemoryContext oldContext = NULL;
+
+	if (scanState->stream != NULL)
+	{
+		EndIntermediateResultStream(scanState->stream);
+	}
+
+	oldContext = MemoryContextSwitchTo(executorState->es_query_cxt);
+
+	scanState->stream = BeginIntermediateResultStream(scanState->resultId,
+													  scanState->copyFormat,
+													  tupleDescriptor);
+
+	MemoryContextSwitchTo(oldContext);
+
+	ExecScanReScan(&node->ss);
+}
@@ -7,6 +7,7 @@
  *
  *-------------------------------------------------------------------------
  */
+#include <arpa/inet.h> /* for htonl */
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -18,29 +19,174 @@
 
 #include "catalog/pg_enum.h"
 #include "commands/copy.h"
+#include "common/pg_lzcompress.h"
 #include "distributed/connection_management.h"
 #include "distributed/intermediate_results.h"
+#include "distributed/job_cache_usage.h"
 #include "distributed/master_metadata_utility.h"
+#include "distributed/memory_results.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_copy.h"
 #include "distributed/multi_executor.h"
+#include "distributed/query_stats.h"
 #include "distributed/remote_commands.h"
 #include "distributed/transmit.h"
 #include "distributed/transaction_identifier.h"
+#include "distributed/version_compat.h"
 #include "distributed/worker_protocol.h"
 #include "nodes/makefuncs.h"
 #include "nodes/parsenodes.h"
 #include "nodes/primnodes.h"
 #include "storage/fd.h"
+#include "storage/ipc.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
+#include "utils/typcache.h"
 
 
+/* GUC, compression method for intermediate result files and their broadcast */
+int IntermediateResultCompression = INTERMEDIATE_RESULT_COMPRESSION_NONE;
+
 static bool CreatedResultsDirectory = false;
 
+/*
+ * Results with a session lifetime are stored under a key that identifies the
+ * coordinator backend that created them, such that workers can keep the
+ * results of different sessions apart. The prefix contains a character that
+ * result IDs cannot contain, so other results are never mistaken for them.
+ */
+#define SESSION_RESULT_KEY_PREFIX "session."
+
+
+/*
+ * SessionResultEntry maps the ID of a result with a session lifetime onto the
+ * key under which it is stored.
+ */
+typedef struct SessionResultEntry
+{
+	char resultId[NAMEDATALEN];
+	char storageKey[NAMEDATALEN];
+
+	/* whether the result was (re)created in the current transaction */
+	bool createdInTransaction;
+} SessionResultEntry;
+
+
+/* results with a session lifetime that this backend created, by result ID */
+static HTAB *SessionResultHash = NULL;
+
+/* files of session results stored by this backend, removed when it exits */
+static List *SessionResultFileList = NIL;
+static bool SessionResultExitCallbackRegistered = false;
+
+/*
+ * Compressed results start with a magic that begins with a NUL byte, which
+ * neither a text nor a binary COPY file can start with. The magic is followed
+ * by blocks that each consist of the uncompressed length and the stored
+ * length in network byte order, followed by the stored data. Blocks that do
+ * not compress are stored as is, in which case both lengths are equal.
+ */
+static const char CompressedResultMagic[] = { '\0', 'C', 'I', 'T', 'U', 'S', 'Z', '1' };
+#define COMPRESSED_RESULT_MAGIC_LENGTH sizeof(CompressedResultMagic)
+#define COMPRESSED_BLOCK_HEADER_LENGTH (2 * sizeof(uint32))
+
+/* minimum number of uncompressed bytes that are compressed as one block */
+#define COMPRESSED_BLOCK_SIZE (64 * 1024)
+
+
+/*
+ * IntermediateResultWriter stores an intermediate result on the local node.
+ * Results are buffered in memory while they are smaller than
+ * citus.max_memory_intermediate_result_size, in which case they end up in a
+ * memory-resident result. Larger results are written to a file.
+ */
+typedef struct IntermediateResultWriter
+{
+	char *fileName;
+
+	/* whether the result outlives the transaction */
+	bool sessionResult;
+
+	/* data buffered in memory, or NULL once the result went to a file */
+	StringInfo memoryBuffer;
+	File fileDesc;
+} IntermediateResultWriter;
+
+
+/*
+ * IntermediateResultReader keeps the state for reading a memory-resident
+ * result, or the uncompressed data of a compressed result file.
+ */
+typedef struct IntermediateResultReader
+{
+	/* name of the result for error messages */
+	const char *resultName;
+
+	/* the result file, or NULL when reading a memory-resident result */
+	FILE *file;
+	MemoryResult *memoryResult;
+	Size memoryOffset;
+
+	/* whether the result is compressed */
+	bool compressed;
+
+	/* uncompressed data of the current block and how much of it was read */
+	StringInfo rawBlock;
+	int rawBlockOffset;
+
+	/* data of the current block as stored in the result */
+	StringInfo storedBlock;
+} IntermediateResultReader;
+
+#if (PG_VERSION_NUM >= 100000)
+
+/* reader used by the COPY data source callback */
+static IntermediateResultReader *CurrentResultReader = NULL;
+#endif
+
+
+/*
+ * IntermediateResultStream parses the rows of an intermediate result one at a
+ * time, such that they can be returned without materializing the result.
+ */
+struct IntermediateResultStream
+{
+	char *resultId;
+
+	/* COPY state that parses the result data */
+	CopyState copyState;
+
+	/* reader for memory-resident and compressed results, NULL otherwise */
+	IntermediateResultReader *reader;
+
+	/* temporary file with the uncompressed data on PostgreSQL 9.6, or -1 */
+	File rawFile;
+
+	/* number of rows returned so far, and whether all rows were returned */
+	uint64 rowCount;
+	bool atEnd;
+};
+
+
+/*
+ * IntermediateResultStatsEntry holds the number of rows of an intermediate
+ * result, once it is known because the result was written or fully read by
+ * the current backend.
+ */
+typedef struct IntermediateResultStatsEntry
+{
+	char resultId[NAMEDATALEN];
+	uint64 rowCount;
+} IntermediateResultStatsEntry;
+
+
+/* row counts of the results of the current transaction, by result ID */
+static HTAB *IntermediateResultStatsHash = NULL;
+
 
 /* CopyDestReceiver can be used to stream results into a distributed table */
 typedef struct RemoteFileDestReceiver
@@ -65,42 +211,138 @@ typedef struct RemoteFileDestReceiver
 
 	/* whether to write to a local file */
 	bool writeLocalFile;
-	File fileDesc;
+	IntermediateResultWriter *localWriter;
 
 	/* state on how to copy out data types */
 	CopyOutState copyOutState;
 	FmgrInfo *columnOutputFunctions;
 
+	/* whether to compress the data, and the buffers used for compression */
+	bool compressResult;
+	StringInfo uncompressedBlock;
+	StringInfo compressedBlock;
+
 	/* number of tuples sent */
 	uint64 tuplesSent;
 } RemoteFileDestReceiver;
 
 
+/*
+ * PartitionedResultDestReceiver writes the tuples it receives into a set of
+ * local intermediate result files, one for each hash range. The ranges are
+ * given by their lowest hash values, such that the ranges correspond to the
+ * shards of a hash-distributed table.
+ */
+typedef struct PartitionedResultDestReceiver
+{
+	/* public DestReceiver interface */
+	DestReceiver pub;
+
+	/* result <resultPrefix>_<index> contains the rows of range <index> */
+	char *resultPrefix;
+
+	/* column whose hash value determines the range of a row */
+	int partitionColumnIndex;
+	FmgrInfo *hashFunction;
+
+	/* sorted lowest hash values of the ranges */
+	int32 *splitPointArray;
+	int splitPointCount;
+
+	/* descriptor of the tuples that are written */
+	TupleDesc tupleDescriptor;
+
+	/* EState for per-tuple memory allocation */
+	EState *executorState;
+
+	/* MemoryContext for DestReceiver session */
+	MemoryContext memoryContext;
+
+	/* writer for each range */
+	IntermediateResultWriter **writerArray;
+
+	/* state on how to copy out data types */
+	bool binaryFormat;
+	CopyOutState copyOutState;
+	FmgrInfo *columnOutputFunctions;
+
+	/* number of tuples written */
+	uint64 tuplesSent;
+} PartitionedResultDestReceiver;
+
+
 static void RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 										  TupleDesc inputTupleDescriptor);
 static StringInfo ConstructCopyResultStatement(const char *resultId);
-static void WriteToLocalFile(StringInfo copyData, File fileDesc);
 static bool RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest);
+static void SendResultData(RemoteFileDestReceiver *resultDest, StringInfo data);
+static void SendCompressedBlock(RemoteFileDestReceiver *resultDest);
+static void SendStoredResultData(RemoteFileDestReceiver *resultDest, StringInfo data);
 static void BroadcastCopyData(StringInfo dataBuffer, List *connectionList);
 static void SendCopyDataOverConnection(StringInfo dataBuffer,
 									   MultiConnection *connection);
 static void RemoteFileDestReceiverShutdown(DestReceiver *destReceiver);
 static void RemoteFileDestReceiverDestroy(DestReceiver *destReceiver);
-
+static void PartitionedResultDestReceiverStartup(DestReceiver *dest, int operation,
+												 TupleDesc inputTupleDescriptor);
+static bool PartitionedResultDestReceiverReceive(TupleTableSlot *slot,
+												 DestReceiver *dest);
+static int HashRangeIndex(PartitionedResultDestReceiver *resultDest, int32 hashValue);
+static void PartitionedResultDestReceiverShutdown(DestReceiver *destReceiver);
+static void PartitionedResultDestReceiverDestroy(DestReceiver *destReceiver);
+
+static IntermediateResultWriter * StartIntermediateResultWriter(const char *resultId,
+																 bool allowMemoryResult);
+static void WriteIntermediateResultData(IntermediateResultWriter *writer,
+										const char *data, int length);
+static void FinishIntermediateResultWriter(IntermediateResultWriter *writer);
+static void SpillIntermediateResultToFile(IntermediateResultWriter *writer);
+static void WriteToLocalFile(File fileDesc, const char *data, int length);
 static char * CreateIntermediateResultsDirectory(void);
 static char * IntermediateResultsDirectory(void);
 static char * QueryResultFileName(const char *resultId);
+static bool IsSessionResultKey(const char *resultId);
+static char * RegisterSessionResult(const char *resultId);
+static char * SessionResultsDirectory(void);
+static void CreateSessionResultsDirectory(void);
+static void RememberSessionResultFile(const char *fileName);
+static void RemoveSessionResultFilesOnExit(int code, Datum arg);
+static void RemoveSessionResult(SessionResultEntry *sessionEntry);
+static bool IsCompressedResultData(const char *data, Size size);
+static void ReadMemoryResultIntoTupleStore(MemoryResult *memoryResult,
+										   char *resultName, char *copyFormat,
+										   TupleDesc tupleDescriptor,
+										   Tuplestorestate *tupstore);
+static void ReadResultIntoTupleStore(IntermediateResultReader *reader,
+									 char *copyFormat, TupleDesc tupleDescriptor,
+									 Tuplestorestate *tupstore);
+static IntermediateResultReader * CreateCompressedFileReader(char *fileName);
+static IntermediateResultReader * CreateMemoryResultReader(MemoryResult *memoryResult,
+														   char *resultName);
+static bool ReadNextCompressedBlock(IntermediateResultReader *reader);
+static bool StoredResultDataAtEnd(IntermediateResultReader *reader);
+static void ReadStoredResultData(IntermediateResultReader *reader, char *buffer,
+								 int length);
+static File CopyResultToTemporaryFile(IntermediateResultReader *reader);
+#if (PG_VERSION_NUM >= 100000)
+static int ReadIntermediateResultData(void *outbuf, int minread, int maxread);
+#endif
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(read_intermediate_result);
 PG_FUNCTION_INFO_V1(broadcast_intermediate_result);
 PG_FUNCTION_INFO_V1(create_intermediate_result);
+PG_FUNCTION_INFO_V1(worker_partition_query_result);
+PG_FUNCTION_INFO_V1(fetch_intermediate_results);
+PG_FUNCTION_INFO_V1(drop_intermediate_result);
 
 
 /*
  * broadcast_intermediate_result executes a query and streams the results
- * into a file on all workers.
+ * into a file on all workers. Results with a session lifetime are kept on the
+ * workers for as long as the connections that they were sent over, which the
+ * session keeps open until it ends.
  */
 Datum
 broadcast_intermediate_result(PG_FUNCTION_ARGS)
@@ -109,6 +351,7 @@ broadcast_intermediate_result(PG_FUNCTION_ARGS)
 	char *resultIdString = text_to_cstring(resultIdText);
 	text *queryText = PG_GETARG_TEXT_P(1);
 	char *queryString = text_to_cstring(queryText);
+	bool sessionLifetime = PG_GETARG_BOOL(2);
 	EState *estate = NULL;
 	List *nodeList = NIL;
 	bool writeLocalFile = false;
@@ -117,6 +360,11 @@ broadcast_intermediate_result(PG_FUNCTION_ARGS)
 
 	CheckCitusVersion(ERROR);
 
+	if (sessionLifetime)
+	{
+		resultIdString = RegisterSessionResult(resultIdString);
+	}
+
 	nodeList = ActivePrimaryNodeList();
 	estate = CreateExecutorState();
 	resultDest = (RemoteFileDestReceiver *) CreateRemoteFileDestReceiver(resultIdString,
@@ -126,6 +374,19 @@ broadcast_intermediate_result(PG_FUNCTION_ARGS)
 	ExecuteQueryStringIntoDestReceiver(queryString, paramListInfo,
 									   (DestReceiver *) resultDest);
 
+	if (sessionLifetime)
+	{
+		ListCell *connectionCell = NULL;
+
+		/* the workers remove the result when these connections close */
+		foreach(connectionCell, resultDest->connectionList)
+		{
+			MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+			connection->sessionLifespan = true;
+		}
+	}
+
 	FreeExecutorState(estate);
 
 	PG_RETURN_INT64(resultDest->tuplesSent);
@@ -134,7 +395,9 @@ broadcast_intermediate_result(PG_FUNCTION_ARGS)
 
 /*
  * create_intermediate_result executes a query and writes the results
- * into a local file.
+ * into a local file. Results with a session lifetime are kept until the
+ * session ends or drop_intermediate_result is called, instead of until the
+ * end of the transaction.
  */
 Datum
 create_intermediate_result(PG_FUNCTION_ARGS)
@@ -143,6 +406,7 @@ create_intermediate_result(PG_FUNCTION_ARGS)
 	char *resultIdString = text_to_cstring(resultIdText);
 	text *queryText = PG_GETARG_TEXT_P(1);
 	char *queryString = text_to_cstring(queryText);
+	bool sessionLifetime = PG_GETARG_BOOL(2);
 	EState *estate = NULL;
 	List *nodeList = NIL;
 	bool writeLocalFile = true;
@@ -151,6 +415,11 @@ create_intermediate_result(PG_FUNCTION_ARGS)
 
 	CheckCitusVersion(ERROR);
 
+	if (sessionLifetime)
+	{
+		resultIdString = RegisterSessionResult(resultIdString);
+	}
+
 	estate = CreateExecutorState();
 	resultDest = (RemoteFileDestReceiver *) CreateRemoteFileDestReceiver(resultIdString,
 																		 estate, nodeList,
@@ -165,6 +434,141 @@ create_intermediate_result(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * worker_partition_query_result executes a query and writes its results into
+ * one local intermediate result for each hash range. The ranges are given by
+ * their lowest hash values, and the hash value of a row is that of the column
+ * at the given index. The results <result_prefix>_<range index> are always
+ * created as files, such that other nodes can fetch them.
+ */
+Datum
+worker_partition_query_result(PG_FUNCTION_ARGS)
+{
+	text *resultPrefixText = PG_GETARG_TEXT_P(0);
+	text *queryText = PG_GETARG_TEXT_P(1);
+	int partitionColumnIndex = PG_GETARG_INT32(2);
+	ArrayType *splitPointObject = PG_GETARG_ARRAYTYPE_P(3);
+	bool binaryFormat = PG_GETARG_BOOL(4);
+	char *queryString = text_to_cstring(queryText);
+	PartitionedResultDestReceiver *resultDest = NULL;
+	Datum *splitPointDatumArray = NULL;
+	int splitPointCount = 0;
+	int splitPointIndex = 0;
+	EState *estate = NULL;
+	ParamListInfo paramListInfo = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	if (ARR_ELEMTYPE(splitPointObject) != INT4OID)
+	{
+		ereport(ERROR, (errmsg("split points must be of type integer")));
+	}
+
+	splitPointDatumArray = DeconstructArrayObject(splitPointObject);
+	splitPointCount = ArrayObjectCount(splitPointObject);
+	if (splitPointCount == 0)
+	{
+		ereport(ERROR, (errmsg("at least one split point is required")));
+	}
+
+	estate = CreateExecutorState();
+
+	resultDest = (PartitionedResultDestReceiver *) palloc0(
+		sizeof(PartitionedResultDestReceiver));
+	resultDest->pub.receiveSlot = PartitionedResultDestReceiverReceive;
+	resultDest->pub.rStartup = PartitionedResultDestReceiverStartup;
+	resultDest->pub.rShutdown = PartitionedResultDestReceiverShutdown;
+	resultDest->pub.rDestroy = PartitionedResultDestReceiverDestroy;
+	resultDest->pub.mydest = DestCopyOut;
+
+	resultDest->resultPrefix = text_to_cstring(resultPrefixText);
+	resultDest->partitionColumnIndex = partitionColumnIndex;
+	resultDest->splitPointCount = splitPointCount;
+	resultDest->splitPointArray = (int32 *) palloc(splitPointCount * sizeof(int32));
+	resultDest->binaryFormat = binaryFormat;
+	resultDest->executorState = estate;
+	resultDest->memoryContext = CurrentMemoryContext;
+
+	for (splitPointIndex = 0; splitPointIndex < splitPointCount; splitPointIndex++)
+	{
+		int32 splitPoint = DatumGetInt32(splitPointDatumArray[splitPointIndex]);
+
+		if (splitPointIndex > 0 &&
+			splitPoint <= resultDest->splitPointArray[splitPointIndex - 1])
+		{
+			ereport(ERROR, (errmsg("split points must be sorted and unique")));
+		}
+
+		resultDest->splitPointArray[splitPointIndex] = splitPoint;
+	}
+
+	ExecuteQueryStringIntoDestReceiver(queryString, paramListInfo,
+									   (DestReceiver *) resultDest);
+
+	FreeExecutorState(estate);
+
+	PG_RETURN_INT64(resultDest->tuplesSent);
+}
+
+
+/*
+ * fetch_intermediate_results fetches the intermediate results with the given
+ * IDs from the given node into the intermediate results directory of the
+ * current distributed transaction, and returns the number of bytes fetched.
+ * Results that were created on this node already exist in the directory, and
+ * are not fetched again.
+ *
+ * The results are fetched over a superuser connection, but only from the
+ * directory of the current user and distributed transaction.
+ */
+Datum
+fetch_intermediate_results(PG_FUNCTION_ARGS)
+{
+	ArrayType *resultIdObject = PG_GETARG_ARRAYTYPE_P(0);
+	text *nodeNameText = PG_GETARG_TEXT_P(1);
+	int32 nodePort = PG_GETARG_INT32(2);
+	char *nodeName = text_to_cstring(nodeNameText);
+	Datum *resultIdArray = NULL;
+	int resultCount = 0;
+	int resultIndex = 0;
+	int64 totalBytesFetched = 0;
+
+	CheckCitusVersion(ERROR);
+
+	resultIdArray = DeconstructArrayObject(resultIdObject);
+	resultCount = ArrayObjectCount(resultIdObject);
+
+	CreateIntermediateResultsDirectory();
+
+	for (resultIndex = 0; resultIndex < resultCount; resultIndex++)
+	{
+		char *resultId = TextDatumGetCString(resultIdArray[resultIndex]);
+		StringInfo resultFileName = makeStringInfo();
+		struct stat fileStat;
+
+		appendStringInfoString(resultFileName, QueryResultFileName(resultId));
+
+		if (stat(resultFileName->data, &fileStat) != 0)
+		{
+			/* we made sure the file name is sanitized, safe to fetch as superuser */
+			FetchRegularFileAsSuperUser(nodeName, nodePort, resultFileName,
+										resultFileName);
+
+			if (stat(resultFileName->data, &fileStat) != 0)
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not stat file \"%s\": %m",
+									   resultFileName->data)));
+			}
+
+			totalBytesFetched += fileStat.st_size;
+		}
+	}
+
+	PG_RETURN_INT64(totalBytesFetched);
+}
+
+
 /*
  * CreateRemoteFileDestReceiver creates a DestReceiver that streams results
  * to a set of worker nodes.
@@ -231,6 +635,17 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 	resultDest->columnOutputFunctions = ColumnOutputFunctions(inputTupleDescriptor,
 															  copyOutState->binary);
 
+	if (IntermediateResultCompression == INTERMEDIATE_RESULT_COMPRESSION_PGLZ)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(resultDest->memoryContext);
+
+		resultDest->compressResult = true;
+		resultDest->uncompressedBlock = makeStringInfo();
+		resultDest->compressedBlock = makeStringInfo();
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
 	/*
 	 * Make sure that this transaction has a distributed transaction ID.
 	 *
@@ -246,18 +661,11 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 
 	if (resultDest->writeLocalFile)
 	{
-		const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
-		const int fileMode = (S_IRUSR | S_IWUSR);
-		const char *fileName = NULL;
-
-		/* make sure the directory exists */
-		CreateIntermediateResultsDirectory();
-
-		fileName = QueryResultFileName(resultId);
+		MemoryContext oldContext = MemoryContextSwitchTo(resultDest->memoryContext);
 
-		elog(DEBUG1, "writing to local file \"%s\"", fileName);
+		resultDest->localWriter = StartIntermediateResultWriter(resultId, true);
 
-		resultDest->fileDesc = FileOpenForTransmit(fileName, fileFlags, fileMode);
+		MemoryContextSwitchTo(oldContext);
 	}
 
 	foreach(initialNodeCell, initialNodeList)
@@ -309,20 +717,26 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 		PQclear(result);
 	}
 
+	resultDest->connectionList = connectionList;
+
+	if (resultDest->compressResult)
+	{
+		StringInfoData magicData;
+
+		initStringInfo(&magicData);
+		AppendCompressedResultMagic(&magicData);
+
+		SendStoredResultData(resultDest, &magicData);
+		pfree(magicData.data);
+	}
+
 	if (copyOutState->binary)
 	{
 		/* send headers when using binary encoding */
 		resetStringInfo(copyOutState->fe_msgbuf);
 		AppendCopyBinaryHeaders(copyOutState);
-		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
-
-		if (resultDest->writeLocalFile)
-		{
-			WriteToLocalFile(copyOutState->fe_msgbuf, resultDest->fileDesc);
-		}
+		SendResultData(resultDest, copyOutState->fe_msgbuf);
 	}
-
-	resultDest->connectionList = connectionList;
 }
 
 
@@ -354,7 +768,6 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 
 	TupleDesc tupleDescriptor = resultDest->tupleDescriptor;
 
-	List *connectionList = resultDest->connectionList;
 	CopyOutState copyOutState = resultDest->copyOutState;
 	FmgrInfo *columnOutputFunctions = resultDest->columnOutputFunctions;
 
@@ -377,14 +790,10 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
 					  copyOutState, columnOutputFunctions, NULL);
 
-	/* send row to nodes */
-	BroadcastCopyData(copyData, connectionList);
+	/* send row to nodes and write it to the local file (if applicable) */
+	SendResultData(resultDest, copyData);
 
-	/* write to local file (if applicable) */
-	if (resultDest->writeLocalFile)
-	{
-		WriteToLocalFile(copyOutState->fe_msgbuf, resultDest->fileDesc);
-	}
+	QueryStatsAddIntermediateResultBytes(copyData->len);
 
 	MemoryContextSwitchTo(oldContext);
 
@@ -397,20 +806,115 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 
 
 /*
- * WriteToLocalResultsFile writes the bytes in a StringInfo to a local file.
+ * SendResultData sends a piece of the COPY data stream to the nodes and writes
+ * it to the local file (if applicable). When compressing, the data is buffered
+ * until there is enough of it to compress a block.
  */
 static void
-WriteToLocalFile(StringInfo copyData, File fileDesc)
+SendResultData(RemoteFileDestReceiver *resultDest, StringInfo data)
 {
-#if (PG_VERSION_NUM >= 100000)
-	int bytesWritten = FileWrite(fileDesc, copyData->data, copyData->len, PG_WAIT_IO);
-#else
-	int bytesWritten = FileWrite(fileDesc, copyData->data, copyData->len);
-#endif
-	if (bytesWritten < 0)
+	if (resultDest->compressResult)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not append to file: %m")));
+		StringInfo uncompressedBlock = resultDest->uncompressedBlock;
+
+		appendBinaryStringInfo(uncompressedBlock, data->data, data->len);
+
+		if (uncompressedBlock->len >= COMPRESSED_BLOCK_SIZE)
+		{
+			SendCompressedBlock(resultDest);
+		}
+	}
+	else
+	{
+		SendStoredResultData(resultDest, data);
+	}
+}
+
+
+/*
+ * SendCompressedBlock compresses the buffered data and sends it as a block.
+ * If the data does not compress, it is stored uncompressed.
+ */
+static void
+SendCompressedBlock(RemoteFileDestReceiver *resultDest)
+{
+	StringInfo uncompressedBlock = resultDest->uncompressedBlock;
+	StringInfo compressedBlock = resultDest->compressedBlock;
+
+	if (uncompressedBlock->len == 0)
+	{
+		return;
+	}
+
+	resetStringInfo(compressedBlock);
+	AppendCompressedBlock(compressedBlock, uncompressedBlock->data,
+						  uncompressedBlock->len);
+
+	SendStoredResultData(resultDest, compressedBlock);
+
+	resetStringInfo(uncompressedBlock);
+}
+
+
+/*
+ * AppendCompressedResultMagic appends the magic that compressed results and
+ * partition files start with to the given buffer.
+ */
+void
+AppendCompressedResultMagic(StringInfo buffer)
+{
+	appendBinaryStringInfo(buffer, CompressedResultMagic,
+						   COMPRESSED_RESULT_MAGIC_LENGTH);
+}
+
+
+/*
+ * AppendCompressedBlock compresses the given data and appends it as a block
+ * to the given buffer. If the data does not compress, it is stored as is.
+ */
+void
+AppendCompressedBlock(StringInfo buffer, const char *data, int32 rawLength)
+{
+	int32 storedLength = 0;
+	uint32 networkLength = 0;
+	char *blockData = NULL;
+	char *storedData = NULL;
+
+	enlargeStringInfo(buffer, COMPRESSED_BLOCK_HEADER_LENGTH +
+					  PGLZ_MAX_OUTPUT(rawLength));
+	blockData = buffer->data + buffer->len;
+	storedData = blockData + COMPRESSED_BLOCK_HEADER_LENGTH;
+
+	storedLength = pglz_compress(data, rawLength, storedData, PGLZ_strategy_default);
+	if (storedLength < 0)
+	{
+		memcpy(storedData, data, rawLength);
+		storedLength = rawLength;
+	}
+
+	networkLength = htonl((uint32) rawLength);
+	memcpy(blockData, &networkLength, sizeof(uint32));
+
+	networkLength = htonl((uint32) storedLength);
+	memcpy(blockData + sizeof(uint32), &networkLength, sizeof(uint32));
+
+	buffer->len += COMPRESSED_BLOCK_HEADER_LENGTH + storedLength;
+	buffer->data[buffer->len] = '\0';
+}
+
+
+/*
+ * SendStoredResultData sends data as it should be stored in the result file
+ * to all nodes and writes it to the local file (if applicable).
+ */
+static void
+SendStoredResultData(RemoteFileDestReceiver *resultDest, StringInfo data)
+{
+	BroadcastCopyData(data, resultDest->connectionList);
+
+	if (resultDest->writeLocalFile)
+	{
+		WriteIntermediateResultData(resultDest->localWriter, data->data, data->len);
 	}
 }
 
@@ -433,12 +937,13 @@ RemoteFileDestReceiverShutdown(DestReceiver *destReceiver)
 		/* send footers when using binary encoding */
 		resetStringInfo(copyOutState->fe_msgbuf);
 		AppendCopyBinaryFooters(copyOutState);
-		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
+		SendResultData(resultDest, copyOutState->fe_msgbuf);
+	}
 
-		if (resultDest->writeLocalFile)
-		{
-			WriteToLocalFile(copyOutState->fe_msgbuf, resultDest->fileDesc);
-		}
+	if (resultDest->compressResult)
+	{
+		/* send the remaining buffered data */
+		SendCompressedBlock(resultDest);
 	}
 
 	/* close the COPY input */
@@ -446,7 +951,9 @@ RemoteFileDestReceiverShutdown(DestReceiver *destReceiver)
 
 	if (resultDest->writeLocalFile)
 	{
-		FileClose(resultDest->fileDesc);
+		FinishIntermediateResultWriter(resultDest->localWriter);
+
+		RecordIntermediateResultRowCount(resultDest->resultId, resultDest->tuplesSent);
 	}
 }
 
@@ -504,24 +1011,431 @@ RemoteFileDestReceiverDestroy(DestReceiver *destReceiver)
 
 
 /*
- * ReceiveQueryResultViaCopy is called when a COPY "resultid" FROM
- * STDIN WITH (format result) command is received from the client.
- * The command is followed by the raw copy data stream, which is
- * redirected to a file.
- *
- * File names are automatically prefixed with the user OID. Users
- * are only allowed to read query results from their own directory.
+ * PartitionedResultDestReceiverStartup implements the rStartup interface of
+ * PartitionedResultDestReceiver. It looks up the hash function of the partition
+ * column and starts writing a result for each hash range.
  */
-void
-ReceiveQueryResultViaCopy(const char *resultId)
+static void
+PartitionedResultDestReceiverStartup(DestReceiver *dest, int operation,
+									 TupleDesc inputTupleDescriptor)
 {
-	const char *resultFileName = NULL;
-
-	CreateIntermediateResultsDirectory();
+	PartitionedResultDestReceiver *resultDest = (PartitionedResultDestReceiver *) dest;
+	int partitionColumnIndex = resultDest->partitionColumnIndex;
+	int splitPointCount = resultDest->splitPointCount;
+	int rangeIndex = 0;
+	Oid partitionColumnType = InvalidOid;
+	TypeCacheEntry *typeEntry = NULL;
+	CopyOutState copyOutState = NULL;
+	const char *delimiterCharacter = "\t";
+	const char *nullPrintCharacter = "\\N";
+	MemoryContext oldContext = NULL;
 
-	resultFileName = QueryResultFileName(resultId);
+	if (partitionColumnIndex < 0 || partitionColumnIndex >= inputTupleDescriptor->natts)
+	{
+		ereport(ERROR, (errmsg("partition column index %d is out of range",
+							   partitionColumnIndex)));
+	}
+
+	oldContext = MemoryContextSwitchTo(resultDest->memoryContext);
+
+	resultDest->tupleDescriptor = inputTupleDescriptor;
+
+	partitionColumnType = TupleDescAttr(inputTupleDescriptor,
+										partitionColumnIndex)->atttypid;
+	typeEntry = lookup_type_cache(partitionColumnType, TYPECACHE_HASH_PROC_FINFO);
+	if (!OidIsValid(typeEntry->hash_proc_finfo.fn_oid))
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
+						errmsg("could not identify a hash function for type %s",
+							   format_type_be(partitionColumnType))));
+	}
+
+	resultDest->hashFunction = (FmgrInfo *) palloc0(sizeof(FmgrInfo));
+	fmgr_info_copy(resultDest->hashFunction, &(typeEntry->hash_proc_finfo),
+				   CurrentMemoryContext);
+
+	/* define how tuples will be serialised, like RemoteFileDestReceiver does */
+	copyOutState = (CopyOutState) palloc0(sizeof(CopyOutStateData));
+	copyOutState->delim = (char *) delimiterCharacter;
+	copyOutState->null_print = (char *) nullPrintCharacter;
+	copyOutState->null_print_client = (char *) nullPrintCharacter;
+	copyOutState->binary = resultDest->binaryFormat;
+	copyOutState->fe_msgbuf = makeStringInfo();
+	copyOutState->rowcontext = GetPerTupleMemoryContext(resultDest->executorState);
+	resultDest->copyOutState = copyOutState;
+
+	resultDest->columnOutputFunctions = ColumnOutputFunctions(inputTupleDescriptor,
+															  copyOutState->binary);
+
+	/* results need to be files, since other nodes fetch them */
+	resultDest->writerArray = (IntermediateResultWriter **)
+							  palloc0(splitPointCount *
+									  sizeof(IntermediateResultWriter *));
+
+	if (copyOutState->binary)
+	{
+		AppendCopyBinaryHeaders(copyOutState);
+	}
+
+	for (rangeIndex = 0; rangeIndex < splitPointCount; rangeIndex++)
+	{
+		StringInfo resultId = makeStringInfo();
+		IntermediateResultWriter *writer = NULL;
+
+		appendStringInfo(resultId, "%s_%d", resultDest->resultPrefix, rangeIndex);
+
+		writer = StartIntermediateResultWriter(resultId->data, false);
+		WriteIntermediateResultData(writer, copyOutState->fe_msgbuf->data,
+									copyOutState->fe_msgbuf->len);
+
+		resultDest->writerArray[rangeIndex] = writer;
+	}
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * PartitionedResultDestReceiverReceive implements the receiveSlot function of
+ * PartitionedResultDestReceiver. It writes the tuple into the result of the
+ * hash range that contains the hash value of its partition column.
+ */
+static bool
+PartitionedResultDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
+{
+	PartitionedResultDestReceiver *resultDest = (PartitionedResultDestReceiver *) dest;
+	int partitionColumnIndex = resultDest->partitionColumnIndex;
+	CopyOutState copyOutState = resultDest->copyOutState;
+	StringInfo copyData = copyOutState->fe_msgbuf;
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
+	int32 hashValue = 0;
+	int rangeIndex = 0;
+
+	EState *executorState = resultDest->executorState;
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+	MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+	slot_getallattrs(slot);
+
+	columnValues = slot->tts_values;
+	columnNulls = slot->tts_isnull;
+
+	if (columnNulls[partitionColumnIndex])
+	{
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("the partition column value cannot be NULL")));
+	}
+
+	hashValue = DatumGetInt32(FunctionCall1(resultDest->hashFunction,
+											columnValues[partitionColumnIndex]));
+	rangeIndex = HashRangeIndex(resultDest, hashValue);
+
+	resetStringInfo(copyData);
+
+	/* construct row in COPY format */
+	AppendCopyRowData(columnValues, columnNulls, resultDest->tupleDescriptor,
+					  copyOutState, resultDest->columnOutputFunctions, NULL);
+
+	WriteIntermediateResultData(resultDest->writerArray[rangeIndex], copyData->data,
+								copyData->len);
+
+	MemoryContextSwitchTo(oldContext);
+
+	resultDest->tuplesSent++;
+
+	ResetPerTupleExprContext(executorState);
+
+	return true;
+}
+
+
+/*
+ * HashRangeIndex returns the index of the last hash range whose lowest hash
+ * value is not larger than the given hash value.
+ */
+static int
+HashRangeIndex(PartitionedResultDestReceiver *resultDest, int32 hashValue)
+{
+	int32 *splitPointArray = resultDest->splitPointArray;
+	int lowerBoundIndex = 0;
+	int upperBoundIndex = resultDest->splitPointCount;
+
+	if (hashValue < splitPointArray[0])
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+						errmsg("cannot find hash range"),
+						errdetail("Hash value %d is lower than the first split point.",
+								  hashValue)));
+	}
+
+	/* find the first range that starts after the hash value */
+	while (lowerBoundIndex < upperBoundIndex)
+	{
+		int middleIndex = lowerBoundIndex + (upperBoundIndex - lowerBoundIndex) / 2;
+
+		if (splitPointArray[middleIndex] <= hashValue)
+		{
+			lowerBoundIndex = middleIndex + 1;
+		}
+		else
+		{
+			upperBoundIndex = middleIndex;
+		}
+	}
+
+	return lowerBoundIndex - 1;
+}
+
+
+/*
+ * PartitionedResultDestReceiverShutdown implements the rShutdown interface of
+ * PartitionedResultDestReceiver. It finishes the results of all hash ranges.
+ */
+static void
+PartitionedResultDestReceiverShutdown(DestReceiver *destReceiver)
+{
+	PartitionedResultDestReceiver *resultDest =
+		(PartitionedResultDestReceiver *) destReceiver;
+	CopyOutState copyOutState = resultDest->copyOutState;
+	int rangeIndex = 0;
+
+	resetStringInfo(copyOutState->fe_msgbuf);
+
+	if (copyOutState->binary)
+	{
+		/* write footers when using binary encoding */
+		AppendCopyBinaryFooters(copyOutState);
+	}
+
+	for (rangeIndex = 0; rangeIndex < resultDest->splitPointCount; rangeIndex++)
+	{
+		IntermediateResultWriter *writer = resultDest->writerArray[rangeIndex];
+
+		WriteIntermediateResultData(writer, copyOutState->fe_msgbuf->data,
+									copyOutState->fe_msgbuf->len);
+		FinishIntermediateResultWriter(writer);
+	}
+}
+
+
+/*
+ * PartitionedResultDestReceiverDestroy frees memory allocated as part of the
+ * PartitionedResultDestReceiver.
+ */
+static void
+PartitionedResultDestReceiverDestroy(DestReceiver *destReceiver)
+{
+	PartitionedResultDestReceiver *resultDest =
+		(PartitionedResultDestReceiver *) destReceiver;
+
+	if (resultDest->copyOutState)
+	{
+		pfree(resultDest->copyOutState);
+	}
+
+	if (resultDest->columnOutputFunctions)
+	{
+		pfree(resultDest->columnOutputFunctions);
+	}
+
+	pfree(resultDest);
+}
+
+
+/*
+ * ReceiveQueryResultViaCopy is called when a COPY "resultid" FROM
+ * STDIN WITH (format result) command is received from the client.
+ * The command is followed by the raw copy data stream, which is
+ * stored in memory if it is small enough, and redirected to a file
+ * otherwise.
+ *
+ * File names are automatically prefixed with the user OID. Users
+ * are only allowed to read query results from their own directory.
+ */
+void
+ReceiveQueryResultViaCopy(const char *resultId)
+{
+	IntermediateResultWriter *writer = StartIntermediateResultWriter(resultId, true);
+	StringInfo copyData = makeStringInfo();
+	bool copyDone = false;
+
+	SendCopyInStart();
+
+	copyDone = ReceiveCopyData(copyData);
+	while (!copyDone)
+	{
+		WriteIntermediateResultData(writer, copyData->data, copyData->len);
+
+		resetStringInfo(copyData);
+		copyDone = ReceiveCopyData(copyData);
+	}
+
+	FreeStringInfo(copyData);
+	FinishIntermediateResultWriter(writer);
+}
+
+
+/*
+ * StartIntermediateResultWriter starts storing the intermediate result with
+ * the given ID on the local node. Data is buffered in memory when results may
+ * be memory-resident, and written to the result file otherwise. Callers pass
+ * allowMemoryResult as false for results that other backends need to read.
+ */
+static IntermediateResultWriter *
+StartIntermediateResultWriter(const char *resultId, bool allowMemoryResult)
+{
+	IntermediateResultWriter *writer =
+		(IntermediateResultWriter *) palloc0(sizeof(IntermediateResultWriter));
+
+	writer->fileName = QueryResultFileName(resultId);
+	writer->sessionResult = IsSessionResultKey(resultId);
+	writer->fileDesc = -1;
+
+	/* memory-resident results are released at the end of the transaction */
+	if (allowMemoryResult && !writer->sessionResult && MemoryResultsEnabled())
+	{
+		writer->memoryBuffer = makeStringInfo();
+	}
+	else
+	{
+		SpillIntermediateResultToFile(writer);
+	}
+
+	return writer;
+}
+
+
+/*
+ * WriteIntermediateResultData appends data to the intermediate result. Once
+ * the buffered data would exceed citus.max_memory_intermediate_result_size,
+ * it is written to the result file along with all subsequent data.
+ */
+static void
+WriteIntermediateResultData(IntermediateResultWriter *writer, const char *data,
+							int length)
+{
+	StringInfo memoryBuffer = writer->memoryBuffer;
+
+	if (length == 0)
+	{
+		return;
+	}
+
+	if (memoryBuffer != NULL)
+	{
+		int64 maxMemorySize = MaxMemoryIntermediateResultSize * 1024L;
+
+		if ((int64) memoryBuffer->len + length <= maxMemorySize)
+		{
+			appendBinaryStringInfo(memoryBuffer, data, length);
+			return;
+		}
+
+		SpillIntermediateResultToFile(writer);
+	}
+
+	WriteToLocalFile(writer->fileDesc, data, length);
+}
+
+
+/*
+ * FinishIntermediateResultWriter makes the intermediate result available to
+ * readers, either as a memory-resident result or by closing the result file.
+ */
+static void
+FinishIntermediateResultWriter(IntermediateResultWriter *writer)
+{
+	StringInfo memoryBuffer = writer->memoryBuffer;
+
+	if (memoryBuffer != NULL)
+	{
+		if (StoreMemoryResult(writer->fileName, memoryBuffer->data, memoryBuffer->len))
+		{
+			ereport(DEBUG4, (errmsg("keeping intermediate result \"%s\" in memory",
+									writer->fileName)));
+
+			pfree(memoryBuffer->data);
+			pfree(memoryBuffer);
+			writer->memoryBuffer = NULL;
+
+			return;
+		}
+
+		/* could not keep the result in memory, fall back to a file */
+		SpillIntermediateResultToFile(writer);
+	}
+
+	FileClose(writer->fileDesc);
+	writer->fileDesc = -1;
+}
+
+
+/*
+ * SpillIntermediateResultToFile creates the result file and moves the data
+ * that was buffered in memory to it.
+ */
+static void
+SpillIntermediateResultToFile(IntermediateResultWriter *writer)
+{
+	const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
+	const int fileMode = (S_IRUSR | S_IWUSR);
+	StringInfo memoryBuffer = writer->memoryBuffer;
+
+	/* make sure the directory exists */
+	if (writer->sessionResult)
+	{
+		CreateSessionResultsDirectory();
+		RememberSessionResultFile(writer->fileName);
+	}
+	else
+	{
+		CreateIntermediateResultsDirectory();
+	}
+
+	/* an earlier result with the same ID must not shadow the file */
+	RemoveMemoryResult(writer->fileName);
+
+	elog(DEBUG1, "writing to local file \"%s\"", writer->fileName);
+
+	writer->fileDesc = FileOpenForTransmit(writer->fileName, fileFlags, fileMode);
+
+	if (memoryBuffer != NULL)
+	{
+		WriteToLocalFile(writer->fileDesc, memoryBuffer->data, memoryBuffer->len);
+
+		pfree(memoryBuffer->data);
+		pfree(memoryBuffer);
+		writer->memoryBuffer = NULL;
+	}
+}
+
+
+/*
+ * WriteToLocalFile appends the given bytes to a local file.
+ */
+static void
+WriteToLocalFile(File fileDesc, const char *data, int length)
+{
+	int bytesWritten = 0;
+
+	if (length == 0)
+	{
+		return;
+	}
 
-	RedirectCopyDataToRegularFile(resultFileName);
+	ReserveJobCacheSpace(length);
+
+#if (PG_VERSION_NUM >= 100000)
+	bytesWritten = FileWrite(fileDesc, (char *) data, length, PG_WAIT_IO);
+#else
+	bytesWritten = FileWrite(fileDesc, (char *) data, length);
+#endif
+	if (bytesWritten != length)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not append to file: %m")));
+	}
 }
 
 
@@ -563,15 +1477,21 @@ CreateIntermediateResultsDirectory(void)
 /*
  * QueryResultFileName returns the file name in which to store
  * an intermediate result with the given key in the per transaction
- * result directory.
+ * result directory, or in the session result directory for keys of
+ * results with a session lifetime.
  */
 static char *
 QueryResultFileName(const char *resultId)
 {
 	StringInfo resultFileName = makeStringInfo();
-	const char *resultDirectory = IntermediateResultsDirectory();
+	const char *resultDirectory = NULL;
 	char *checkChar = (char *) resultId;
 
+	if (IsSessionResultKey(resultId))
+	{
+		checkChar += strlen(SESSION_RESULT_KEY_PREFIX);
+	}
+
 	for (; *checkChar; checkChar++)
 	{
 		if (!((*checkChar >= 'a' && *checkChar <= 'z') ||
@@ -587,6 +1507,15 @@ QueryResultFileName(const char *resultId)
 		}
 	}
 
+	if (IsSessionResultKey(resultId))
+	{
+		resultDirectory = SessionResultsDirectory();
+	}
+	else
+	{
+		resultDirectory = IntermediateResultsDirectory();
+	}
+
 	appendStringInfo(resultFileName, "%s/%s.data",
 					 resultDirectory, resultId);
 
@@ -636,11 +1565,17 @@ IntermediateResultsDirectory(void)
 
 /*
  * RemoveIntermediateResultsDirectory removes the intermediate result directory
- * for the current distributed transaction, if any was created.
+ * for the current distributed transaction, if any was created, and releases
+ * the memory-resident results of the current backend.
  */
 void
 RemoveIntermediateResultsDirectory(void)
 {
+	ReleaseMemoryResults();
+
+	/* the hash is freed along with the transaction context */
+	IntermediateResultStatsHash = NULL;
+
 	if (CreatedResultsDirectory)
 	{
 		StringInfo resultsDirectory = makeStringInfo();
@@ -654,17 +1589,303 @@ RemoveIntermediateResultsDirectory(void)
 
 
 /*
- * IntermediateResultSize returns the file size of the intermediate result
- * or -1 if the file does not exist.
+ * drop_intermediate_result removes a result with a session lifetime that was
+ * created by the current session, and returns whether there was one. The
+ * copies of a broadcast result stay on the workers until the session ends,
+ * but can no longer be referred to.
  */
-int64
-IntermediateResultSize(char *resultId)
+Datum
+drop_intermediate_result(PG_FUNCTION_ARGS)
 {
-	char *resultFileName = NULL;
-	struct stat fileStat;
-	int statOK = 0;
-
+	text *resultIdText = PG_GETARG_TEXT_P(0);
+	char *resultIdString = text_to_cstring(resultIdText);
+	SessionResultEntry *sessionEntry = NULL;
+	char resultKey[NAMEDATALEN];
+	bool found = false;
+
+	CheckCitusVersion(ERROR);
+
+	if (SessionResultHash == NULL || strlen(resultIdString) >= NAMEDATALEN)
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	memset(resultKey, 0, NAMEDATALEN);
+	strlcpy(resultKey, resultIdString, NAMEDATALEN);
+
+	sessionEntry = hash_search(SessionResultHash, resultKey, HASH_FIND, &found);
+	if (!found)
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	RemoveSessionResult(sessionEntry);
+
+	PG_RETURN_BOOL(true);
+}
+
+
+/*
+ * RegisterSessionResult makes the given result ID refer to a result with a
+ * session lifetime, and returns the key under which the result is stored.
+ */
+static char *
+RegisterSessionResult(const char *resultId)
+{
+	SessionResultEntry *sessionEntry = NULL;
+	StringInfo storageKey = makeStringInfo();
+	char resultKey[NAMEDATALEN];
+	bool found = false;
+
+	appendStringInfo(storageKey, SESSION_RESULT_KEY_PREFIX "%d_%d_%s",
+					 GetLocalGroupId(), MyProcPid, resultId);
+
+	if (storageKey->len >= NAMEDATALEN)
+	{
+		ereport(ERROR, (errcode(ERRCODE_NAME_TOO_LONG),
+						errmsg("result key \"%s\" is too long for a result with a "
+							   "session lifetime", resultId)));
+	}
+
+	/* check the characters of the result ID before registering it */
+	QueryResultFileName(resultId);
+
+	if (SessionResultHash == NULL)
+	{
+		HASHCTL info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = NAMEDATALEN;
+		info.entrysize = sizeof(SessionResultEntry);
+		info.hcxt = TopMemoryContext;
+
+		SessionResultHash = hash_create("Session Intermediate Result Hash", 32, &info,
+										HASH_ELEM | HASH_CONTEXT);
+	}
+
+	memset(resultKey, 0, NAMEDATALEN);
+	strlcpy(resultKey, resultId, NAMEDATALEN);
+
+	sessionEntry = hash_search(SessionResultHash, resultKey, HASH_ENTER, &found);
+	strlcpy(sessionEntry->storageKey, storageKey->data, NAMEDATALEN);
+	sessionEntry->createdInTransaction = true;
+
+	return pstrdup(sessionEntry->storageKey);
+}
+
+
+/*
+ * SessionIntermediateResultKey returns the key under which the result with
+ * the given ID is stored if it has a session lifetime, or NULL otherwise.
+ */
+char *
+SessionIntermediateResultKey(const char *resultId)
+{
+	SessionResultEntry *sessionEntry = NULL;
+	char resultKey[NAMEDATALEN];
+	bool found = false;
+
+	if (SessionResultHash == NULL || strlen(resultId) >= NAMEDATALEN)
+	{
+		return NULL;
+	}
+
+	memset(resultKey, 0, NAMEDATALEN);
+	strlcpy(resultKey, resultId, NAMEDATALEN);
+
+	sessionEntry = hash_search(SessionResultHash, resultKey, HASH_FIND, &found);
+	if (!found)
+	{
+		return NULL;
+	}
+
+	return pstrdup(sessionEntry->storageKey);
+}
+
+
+/*
+ * HasSessionIntermediateResults returns whether the current session created
+ * results with a session lifetime that were not dropped.
+ */
+bool
+HasSessionIntermediateResults(void)
+{
+	return SessionResultHash != NULL && hash_get_num_entries(SessionResultHash) > 0;
+}
+
+
+/*
+ * FinishSessionIntermediateResults is called at the end of a transaction.
+ * Results with a session lifetime that were created by an aborted transaction
+ * are dropped, including earlier results with the same ID since the abort
+ * may have left them half overwritten.
+ */
+void
+FinishSessionIntermediateResults(bool isCommit)
+{
+	HASH_SEQ_STATUS status;
+	SessionResultEntry *sessionEntry = NULL;
+
+	if (SessionResultHash == NULL)
+	{
+		return;
+	}
+
+	hash_seq_init(&status, SessionResultHash);
+	while ((sessionEntry = (SessionResultEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (!sessionEntry->createdInTransaction)
+		{
+			continue;
+		}
+
+		if (isCommit)
+		{
+			sessionEntry->createdInTransaction = false;
+		}
+		else
+		{
+			RemoveSessionResult(sessionEntry);
+		}
+	}
+}
+
+
+/*
+ * RemoveSessionResult removes the local file of a result with a session
+ * lifetime and forgets about the result.
+ */
+static void
+RemoveSessionResult(SessionResultEntry *sessionEntry)
+{
+	char *resultFileName = QueryResultFileName(sessionEntry->storageKey);
+
+	if (unlink(resultFileName) != 0 && errno != ENOENT)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+						  errmsg("could not remove file \"%s\": %m", resultFileName)));
+	}
+
+	hash_search(SessionResultHash, sessionEntry->resultId, HASH_REMOVE, NULL);
+}
+
+
+/*
+ * IsSessionResultKey returns whether the given result key refers to a result
+ * with a session lifetime.
+ */
+static bool
+IsSessionResultKey(const char *resultId)
+{
+	return strncmp(resultId, SESSION_RESULT_KEY_PREFIX,
+				   strlen(SESSION_RESULT_KEY_PREFIX)) == 0;
+}
+
+
+/*
+ * SessionResultsDirectory returns the directory of the results with a
+ * session lifetime, which has the form:
+ * base/pgsql_job_cache/<user id>_sessions/
+ */
+static char *
+SessionResultsDirectory(void)
+{
+	StringInfo resultDirectory = makeStringInfo();
+
+	appendStringInfo(resultDirectory, "base/" PG_JOB_CACHE_DIR "/%u_sessions",
+					 GetUserId());
+
+	return resultDirectory->data;
+}
+
+
+/*
+ * CreateSessionResultsDirectory creates the directory of the results with a
+ * session lifetime if it does not exist.
+ */
+static void
+CreateSessionResultsDirectory(void)
+{
+	char *resultDirectory = SessionResultsDirectory();
+
+	if (mkdir(resultDirectory, S_IRWXU) != 0 && errno != EEXIST)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not create intermediate results directory "
+							   "\"%s\": %m", resultDirectory)));
+	}
+}
+
+
+/*
+ * RememberSessionResultFile makes sure that the given file of a result with a
+ * session lifetime is removed when the backend exits.
+ */
+static void
+RememberSessionResultFile(const char *fileName)
+{
+	MemoryContext oldContext = NULL;
+	ListCell *fileCell = NULL;
+
+	foreach(fileCell, SessionResultFileList)
+	{
+		if (strcmp((char *) lfirst(fileCell), fileName) == 0)
+		{
+			return;
+		}
+	}
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+	SessionResultFileList = lappend(SessionResultFileList, pstrdup(fileName));
+	MemoryContextSwitchTo(oldContext);
+
+	if (!SessionResultExitCallbackRegistered)
+	{
+		before_shmem_exit(RemoveSessionResultFilesOnExit, (Datum) 0);
+		SessionResultExitCallbackRegistered = true;
+	}
+}
+
+
+/*
+ * RemoveSessionResultFilesOnExit removes the files of the results with a
+ * session lifetime that the backend stored.
+ */
+static void
+RemoveSessionResultFilesOnExit(int code, Datum arg)
+{
+	ListCell *fileCell = NULL;
+
+	foreach(fileCell, SessionResultFileList)
+	{
+		char *fileName = (char *) lfirst(fileCell);
+
+		/* the file may have been removed already */
+		unlink(fileName);
+	}
+}
+
+
+/*
+ * IntermediateResultSize returns the size of the intermediate result or -1
+ * if the result does not exist.
+ */
+int64
+IntermediateResultSize(char *resultId)
+{
+	char *resultFileName = NULL;
+	struct stat fileStat;
+	int statOK = 0;
+	int64 memoryResultSize = -1;
+
 	resultFileName = QueryResultFileName(resultId);
+
+	memoryResultSize = MemoryResultSize(resultFileName);
+	if (memoryResultSize >= 0)
+	{
+		return memoryResultSize;
+	}
+
 	statOK = stat(resultFileName, &fileStat);
 	if (statOK < 0)
 	{
@@ -702,6 +1923,7 @@ read_intermediate_result(PG_FUNCTION_ARGS)
 	char *copyFormatLabel = DatumGetCString(copyFormatLabelDatum);
 
 	char *resultFileName = NULL;
+	MemoryResult *memoryResult = NULL;
 	struct stat fileStat;
 	int statOK = 0;
 
@@ -712,11 +1934,17 @@ read_intermediate_result(PG_FUNCTION_ARGS)
 	CheckCitusVersion(ERROR);
 
 	resultFileName = QueryResultFileName(resultIdString);
-	statOK = stat(resultFileName, &fileStat);
-	if (statOK != 0)
+
+	/* small results may be kept in memory instead of a file */
+	memoryResult = OpenMemoryResult(resultFileName);
+	if (memoryResult == NULL)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("result \"%s\" does not exist", resultIdString)));
+		statOK = stat(resultFileName, &fileStat);
+		if (statOK != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("result \"%s\" does not exist", resultIdString)));
+		}
 	}
 
 	/* check to see if query supports us returning a tuplestore */
@@ -773,9 +2001,700 @@ read_intermediate_result(PG_FUNCTION_ARGS)
 	rsinfo->setDesc = tupleDescriptor;
 	MemoryContextSwitchTo(oldcontext);
 
-	ReadFileIntoTupleStore(resultFileName, copyFormatLabel, tupleDescriptor, tupstore);
+	if (memoryResult != NULL)
+	{
+		ReadMemoryResultIntoTupleStore(memoryResult, resultFileName, copyFormatLabel,
+									   tupleDescriptor, tupstore);
+		CloseMemoryResult(memoryResult);
+	}
+	else if (IsCompressedResultFile(resultFileName))
+	{
+		ReadCompressedFileIntoTupleStore(resultFileName, copyFormatLabel,
+										 tupleDescriptor, tupstore);
+	}
+	else
+	{
+		ReadFileIntoTupleStore(resultFileName, copyFormatLabel, tupleDescriptor,
+							   tupstore);
+	}
 
 	tuplestore_donestoring(tupstore);
 
 	return (Datum) 0;
 }
+
+
+/*
+ * IsCompressedResultFile returns whether the result file starts with the magic
+ * of compressed results.
+ */
+bool
+IsCompressedResultFile(const char *fileName)
+{
+	char magic[COMPRESSED_RESULT_MAGIC_LENGTH];
+	size_t bytesRead = 0;
+	FILE *file = AllocateFile(fileName, PG_BINARY_R);
+
+	if (file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	bytesRead = fread(magic, 1, COMPRESSED_RESULT_MAGIC_LENGTH, file);
+
+	FreeFile(file);
+
+	return IsCompressedResultData(magic, bytesRead);
+}
+
+
+/*
+ * IsCompressedResultData returns whether the given result data starts with the
+ * magic of compressed results.
+ */
+static bool
+IsCompressedResultData(const char *data, Size size)
+{
+	return size >= COMPRESSED_RESULT_MAGIC_LENGTH &&
+		   memcmp(data, CompressedResultMagic, COMPRESSED_RESULT_MAGIC_LENGTH) == 0;
+}
+
+
+/*
+ * ReadCompressedFileIntoTupleStore decompresses a compressed result file and
+ * parses the records in it according to the given tuple descriptor into the
+ * tuple store.
+ */
+void
+ReadCompressedFileIntoTupleStore(char *fileName, char *copyFormat,
+								 TupleDesc tupleDescriptor, Tuplestorestate *tupstore)
+{
+	IntermediateResultReader *reader = CreateCompressedFileReader(fileName);
+
+	ReadResultIntoTupleStore(reader, copyFormat, tupleDescriptor, tupstore);
+
+	FreeFile(reader->file);
+}
+
+
+/*
+ * CreateCompressedFileReader opens a compressed result file for reading its
+ * uncompressed data.
+ */
+static IntermediateResultReader *
+CreateCompressedFileReader(char *fileName)
+{
+	IntermediateResultReader *reader =
+		(IntermediateResultReader *) palloc0(sizeof(IntermediateResultReader));
+	char magic[COMPRESSED_RESULT_MAGIC_LENGTH];
+
+	reader->resultName = fileName;
+	reader->compressed = true;
+	reader->file = AllocateFile(fileName, PG_BINARY_R);
+	if (reader->file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	ReadStoredResultData(reader, magic, COMPRESSED_RESULT_MAGIC_LENGTH);
+
+	return reader;
+}
+
+
+/*
+ * ReadMemoryResultIntoTupleStore parses the records in a memory-resident
+ * result, which may be compressed, according to the given tuple descriptor
+ * into the tuple store.
+ */
+static void
+ReadMemoryResultIntoTupleStore(MemoryResult *memoryResult, char *resultName,
+							   char *copyFormat, TupleDesc tupleDescriptor,
+							   Tuplestorestate *tupstore)
+{
+	IntermediateResultReader *reader = CreateMemoryResultReader(memoryResult,
+																resultName);
+
+	ReadResultIntoTupleStore(reader, copyFormat, tupleDescriptor, tupstore);
+}
+
+
+/*
+ * CreateMemoryResultReader creates a reader for the data of a memory-resident
+ * result, which may be compressed.
+ */
+static IntermediateResultReader *
+CreateMemoryResultReader(MemoryResult *memoryResult, char *resultName)
+{
+	IntermediateResultReader *reader =
+		(IntermediateResultReader *) palloc0(sizeof(IntermediateResultReader));
+
+	reader->resultName = resultName;
+	reader->memoryResult = memoryResult;
+	reader->memoryOffset = 0;
+
+	if (IsCompressedResultData(memoryResult->data, memoryResult->size))
+	{
+		reader->compressed = true;
+		reader->memoryOffset = COMPRESSED_RESULT_MAGIC_LENGTH;
+	}
+
+	return reader;
+}
+
+
+/*
+ * ReadResultIntoTupleStore parses the uncompressed data of the result that is
+ * read by the given reader into the tuple store.
+ *
+ * On PostgreSQL 10 and above, COPY reads the uncompressed data directly from
+ * memory. Older versions of COPY can only read from files, so the data is
+ * written to a temporary file first.
+ */
+static void
+ReadResultIntoTupleStore(IntermediateResultReader *reader, char *copyFormat,
+						 TupleDesc tupleDescriptor, Tuplestorestate *tupstore)
+{
+#if (PG_VERSION_NUM >= 100000)
+	Assert(CurrentResultReader == NULL);
+	CurrentResultReader = reader;
+
+	PG_TRY();
+	{
+		ReadCopyDataIntoTupleStore(ReadIntermediateResultData, copyFormat,
+								   tupleDescriptor, tupstore);
+	}
+	PG_CATCH();
+	{
+		CurrentResultReader = NULL;
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	CurrentResultReader = NULL;
+#else
+	File rawFile = CopyResultToTemporaryFile(reader);
+
+	ReadFileIntoTupleStore(FilePathName(rawFile), copyFormat, tupleDescriptor,
+						   tupstore);
+
+	/* temporary files are removed when they are closed */
+	FileClose(rawFile);
+#endif
+}
+
+
+/*
+ * BeginIntermediateResultStream starts reading the intermediate result with
+ * the given ID, whose rows are parsed according to the given tuple descriptor
+ * from the given COPY format.
+ */
+IntermediateResultStream *
+BeginIntermediateResultStream(char *resultId, char *copyFormat,
+							  TupleDesc tupleDescriptor)
+{
+	IntermediateResultStream *stream =
+		(IntermediateResultStream *) palloc0(sizeof(IntermediateResultStream));
+	char *resultFileName = QueryResultFileName(resultId);
+	MemoryResult *memoryResult = NULL;
+	IntermediateResultReader *reader = NULL;
+
+	stream->resultId = pstrdup(resultId);
+	stream->rawFile = -1;
+
+	/* small results may be kept in memory instead of a file */
+	memoryResult = OpenMemoryResult(resultFileName);
+	if (memoryResult != NULL)
+	{
+		reader = CreateMemoryResultReader(memoryResult, resultFileName);
+	}
+	else
+	{
+		struct stat fileStat;
+
+		if (stat(resultFileName, &fileStat) != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("result \"%s\" does not exist", resultId)));
+		}
+
+		if (IsCompressedResultFile(resultFileName))
+		{
+			reader = CreateCompressedFileReader(resultFileName);
+		}
+	}
+
+	if (reader == NULL)
+	{
+		stream->copyState = BeginFileCopy(resultFileName, copyFormat, tupleDescriptor);
+
+		return stream;
+	}
+
+#if (PG_VERSION_NUM >= 100000)
+	stream->reader = reader;
+
+	/* rows are parsed in a short-lived context, so allocate the blocks here */
+	if (reader->compressed)
+	{
+		reader->rawBlock = makeStringInfo();
+		reader->storedBlock = makeStringInfo();
+	}
+
+	/* binary COPY reads the header of the data right away */
+	Assert(CurrentResultReader == NULL);
+	CurrentResultReader = reader;
+
+	PG_TRY();
+	{
+		stream->copyState = BeginDataSourceCopy(ReadIntermediateResultData, copyFormat,
+												tupleDescriptor);
+	}
+	PG_CATCH();
+	{
+		CurrentResultReader = NULL;
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	CurrentResultReader = NULL;
+#else
+	stream->rawFile = CopyResultToTemporaryFile(reader);
+	stream->copyState = BeginFileCopy(FilePathName(stream->rawFile), copyFormat,
+									  tupleDescriptor);
+
+	if (reader->file != NULL)
+	{
+		FreeFile(reader->file);
+	}
+
+	if (memoryResult != NULL)
+	{
+		CloseMemoryResult(memoryResult);
+	}
+#endif
+
+	return stream;
+}
+
+
+/*
+ * NextIntermediateResultRow parses the next row of the intermediate result
+ * into the given arrays, which are allocated in the current memory context.
+ * It returns false when all rows were read.
+ */
+bool
+NextIntermediateResultRow(IntermediateResultStream *stream, ExprContext *econtext,
+						  Datum *columnValues, bool *columnNulls)
+{
+	bool rowFound = false;
+
+	if (stream->atEnd)
+	{
+		return false;
+	}
+
+#if (PG_VERSION_NUM >= 100000)
+	if (stream->reader != NULL)
+	{
+		/* other streams may be read in between, so set the reader each time */
+		Assert(CurrentResultReader == NULL);
+		CurrentResultReader = stream->reader;
+
+		PG_TRY();
+		{
+			rowFound = NextCopyFrom(stream->copyState, econtext, columnValues,
+									columnNulls, NULL);
+		}
+		PG_CATCH();
+		{
+			CurrentResultReader = NULL;
+
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+
+		CurrentResultReader = NULL;
+	}
+	else
+#endif
+	{
+		rowFound = NextCopyFrom(stream->copyState, econtext, columnValues, columnNulls,
+								NULL);
+	}
+
+	if (!rowFound)
+	{
+		stream->atEnd = true;
+
+		/* the actual row count improves the estimates of later statements */
+		RecordIntermediateResultRowCount(stream->resultId, stream->rowCount);
+
+		return false;
+	}
+
+	stream->rowCount++;
+
+	return true;
+}
+
+
+/*
+ * EndIntermediateResultStream ends reading an intermediate result and
+ * releases the files and memory-resident results that were opened for it.
+ */
+void
+EndIntermediateResultStream(IntermediateResultStream *stream)
+{
+	IntermediateResultReader *reader = stream->reader;
+
+	EndCopyFrom(stream->copyState);
+
+	if (reader != NULL)
+	{
+		if (reader->file != NULL)
+		{
+			FreeFile(reader->file);
+		}
+
+		if (reader->memoryResult != NULL)
+		{
+			CloseMemoryResult(reader->memoryResult);
+		}
+	}
+
+	if (stream->rawFile >= 0)
+	{
+		/* temporary files are removed when they are closed */
+		FileClose(stream->rawFile);
+	}
+
+	pfree(stream);
+}
+
+
+/*
+ * RecordIntermediateResultRowCount remembers the number of rows of the given
+ * intermediate result until the end of the transaction.
+ */
+void
+RecordIntermediateResultRowCount(const char *resultId, uint64 rowCount)
+{
+	IntermediateResultStatsEntry *statsEntry = NULL;
+	char resultKey[NAMEDATALEN];
+	bool found = false;
+
+	if (strlen(resultId) >= NAMEDATALEN)
+	{
+		return;
+	}
+
+	if (IntermediateResultStatsHash == NULL)
+	{
+		HASHCTL info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = NAMEDATALEN;
+		info.entrysize = sizeof(IntermediateResultStatsEntry);
+		info.hcxt = TopTransactionContext;
+
+		IntermediateResultStatsHash = hash_create("Intermediate Result Stats Hash", 32,
+												  &info, HASH_ELEM | HASH_CONTEXT);
+	}
+
+	memset(resultKey, 0, NAMEDATALEN);
+	strlcpy(resultKey, resultId, NAMEDATALEN);
+
+	statsEntry = hash_search(IntermediateResultStatsHash, resultKey, HASH_ENTER, &found);
+	statsEntry->rowCount = rowCount;
+}
+
+
+/*
+ * IntermediateResultRowCount returns whether the number of rows of the given
+ * intermediate result is known, and if so sets rowCount to it.
+ */
+bool
+IntermediateResultRowCount(const char *resultId, uint64 *rowCount)
+{
+	IntermediateResultStatsEntry *statsEntry = NULL;
+	char resultKey[NAMEDATALEN];
+	bool found = false;
+
+	if (IntermediateResultStatsHash == NULL || strlen(resultId) >= NAMEDATALEN)
+	{
+		return false;
+	}
+
+	memset(resultKey, 0, NAMEDATALEN);
+	strlcpy(resultKey, resultId, NAMEDATALEN);
+
+	statsEntry = hash_search(IntermediateResultStatsHash, resultKey, HASH_FIND, &found);
+	if (!found)
+	{
+		return false;
+	}
+
+	*rowCount = statsEntry->rowCount;
+
+	return true;
+}
+
+
+/*
+ * ReadNextCompressedBlock reads the next block of the compressed result and
+ * decompresses it. It returns false when the end of the result is reached.
+ */
+static bool
+ReadNextCompressedBlock(IntermediateResultReader *reader)
+{
+	StringInfo rawBlock = NULL;
+	StringInfo storedBlock = NULL;
+	uint32 blockHeader[2];
+	int32 rawLength = 0;
+	int32 storedLength = 0;
+
+	if (StoredResultDataAtEnd(reader))
+	{
+		return false;
+	}
+
+	if (reader->rawBlock == NULL)
+	{
+		reader->rawBlock = makeStringInfo();
+		reader->storedBlock = makeStringInfo();
+	}
+
+	rawBlock = reader->rawBlock;
+	storedBlock = reader->storedBlock;
+
+	ReadStoredResultData(reader, (char *) blockHeader, COMPRESSED_BLOCK_HEADER_LENGTH);
+
+	rawLength = (int32) ntohl(blockHeader[0]);
+	storedLength = (int32) ntohl(blockHeader[1]);
+
+	if (rawLength < 0 || storedLength < 0 || storedLength > rawLength ||
+		!AllocSizeIsValid(rawLength))
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("invalid block in intermediate result file \"%s\"",
+							   reader->resultName)));
+	}
+
+	resetStringInfo(rawBlock);
+	enlargeStringInfo(rawBlock, rawLength);
+	reader->rawBlockOffset = 0;
+
+	if (storedLength == rawLength)
+	{
+		/* the block did not compress and was stored as is */
+		ReadStoredResultData(reader, rawBlock->data, rawLength);
+	}
+	else
+	{
+		int32 decompressedLength = 0;
+
+		resetStringInfo(storedBlock);
+		enlargeStringInfo(storedBlock, storedLength);
+		ReadStoredResultData(reader, storedBlock->data, storedLength);
+
+		decompressedLength = pglz_decompress(storedBlock->data, storedLength,
+											 rawBlock->data, rawLength);
+		if (decompressedLength != rawLength)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("could not decompress intermediate result file "
+								   "\"%s\"", reader->resultName)));
+		}
+	}
+
+	rawBlock->len = rawLength;
+	rawBlock->data[rawLength] = '\0';
+
+	return true;
+}
+
+
+/*
+ * StoredResultDataAtEnd returns whether all stored data of the result was
+ * read.
+ */
+static bool
+StoredResultDataAtEnd(IntermediateResultReader *reader)
+{
+	int c = 0;
+
+	if (reader->file == NULL)
+	{
+		return reader->memoryOffset >= reader->memoryResult->size;
+	}
+
+	c = getc(reader->file);
+	if (c == EOF)
+	{
+		return true;
+	}
+
+	ungetc(c, reader->file);
+
+	return false;
+}
+
+
+/*
+ * ReadStoredResultData reads exactly length bytes of stored result data into
+ * the buffer and errors out if the result ends prematurely.
+ */
+static void
+ReadStoredResultData(IntermediateResultReader *reader, char *buffer, int length)
+{
+	if (reader->file == NULL)
+	{
+		MemoryResult *memoryResult = reader->memoryResult;
+
+		if (memoryResult->size - reader->memoryOffset < (Size) length)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("unexpected end of intermediate result \"%s\"",
+								   reader->resultName)));
+		}
+
+		memcpy(buffer, memoryResult->data + reader->memoryOffset, length);
+		reader->memoryOffset += length;
+	}
+	else
+	{
+		size_t bytesRead = fread(buffer, 1, length, reader->file);
+
+		if (bytesRead != (size_t) length)
+		{
+			if (ferror(reader->file))
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not read file \"%s\": %m",
+									   reader->resultName)));
+			}
+
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("unexpected end of intermediate result file "
+								   "\"%s\"", reader->resultName)));
+		}
+	}
+}
+
+
+#if (PG_VERSION_NUM >= 100000)
+
+/*
+ * ReadIntermediateResultData implements the COPY data source callback for
+ * memory-resident results and compressed result files. It copies between
+ * minread and maxread bytes of uncompressed data into outbuf and returns the
+ * number of bytes copied, which is only less than minread at the end of the
+ * result.
+ */
+static int
+ReadIntermediateResultData(void *outbuf, int minread, int maxread)
+{
+	IntermediateResultReader *reader = CurrentResultReader;
+	char *outputBuffer = (char *) outbuf;
+	int bytesCopied = 0;
+
+	if (!reader->compressed)
+	{
+		MemoryResult *memoryResult = reader->memoryResult;
+		Size bytesAvailable = memoryResult->size - reader->memoryOffset;
+
+		bytesCopied = (int) Min(bytesAvailable, (Size) maxread);
+
+		memcpy(outputBuffer, memoryResult->data + reader->memoryOffset, bytesCopied);
+		reader->memoryOffset += bytesCopied;
+
+		return bytesCopied;
+	}
+
+	while (bytesCopied < minread)
+	{
+		StringInfo rawBlock = reader->rawBlock;
+		int bytesAvailable = 0;
+		int bytesToCopy = 0;
+
+		if (rawBlock != NULL)
+		{
+			bytesAvailable = rawBlock->len - reader->rawBlockOffset;
+		}
+
+		if (bytesAvailable == 0)
+		{
+			if (!ReadNextCompressedBlock(reader))
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		bytesToCopy = Min(bytesAvailable, maxread - bytesCopied);
+
+		memcpy(outputBuffer + bytesCopied, rawBlock->data + reader->rawBlockOffset,
+			   bytesToCopy);
+
+		reader->rawBlockOffset += bytesToCopy;
+		bytesCopied += bytesToCopy;
+	}
+
+	return bytesCopied;
+}
+
+
+#endif
+
+
+/*
+ * DecompressResultFile writes the uncompressed data of the given compressed
+ * file to a temporary file, which is removed when it is closed, such that it
+ * can be read by COPY.
+ */
+File
+DecompressResultFile(char *fileName)
+{
+	IntermediateResultReader *reader = CreateCompressedFileReader(fileName);
+	File rawFile = CopyResultToTemporaryFile(reader);
+
+	FreeFile(reader->file);
+
+	return rawFile;
+}
+
+
+/*
+ * CopyResultToTemporaryFile writes the uncompressed data of the result that
+ * is read by the given reader to a temporary file, for COPY commands that
+ * can only read from files, such as those on PostgreSQL 9.6.
+ */
+static File
+CopyResultToTemporaryFile(IntermediateResultReader *reader)
+{
+	File rawFile = OpenTemporaryFile(false);
+
+	if (!reader->compressed)
+	{
+		MemoryResult *memoryResult = reader->memoryResult;
+
+		WriteToLocalFile(rawFile, memoryResult->data, memoryResult->size);
+	}
+	else
+	{
+		while (ReadNextCompressedBlock(reader))
+		{
+			StringInfo rawBlock = reader->rawBlock;
+
+			WriteToLocalFile(rawFile, rawBlock->data, rawBlock->len);
+		}
+	}
+
+	return rawFile;
+}
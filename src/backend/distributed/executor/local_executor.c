@@ -0,0 +1,190 @@
+/*-------------------------------------------------------------------------
+ *
+ * local_executor.c
+ *
+ * Executes router SELECT tasks whose placements are all on the local node
+ * in the backend itself. The shard query is planned and executed like any
+ * other query, which avoids a loopback connection and an additional backend
+ * on the local node. COPY inserts into local shards in a similar way, see
+ * StartLocalShardCopy() in multi_copy.c.
+ *
+ * Since the local execution is part of the local transaction, it does not
+ * see changes made over connections in the same transaction. We therefore
+ * only read locally if none of the placements were modified over a
+ * connection, and record the local reads in the placement connection
+ * management, such that conflicting DDL is not sent over a connection.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "distributed/local_executor.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_router_executor.h"
+#include "distributed/placement_connection.h"
+#include "distributed/worker_protocol.h"
+#include "executor/tstoreReceiver.h"
+#include "nodes/params.h"
+#include "tcop/dest.h"
+#include "tcop/tcopprot.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+
+/* config variable managed via guc.c */
+bool EnableLocalExecution = false;
+
+
+static Query * ParseLocalTaskQuery(char *queryString, ParamListInfo paramListInfo);
+
+
+/*
+ * LocalTaskPlacementAccessList returns the accesses to the local placements
+ * of the shards read by the given router SELECT task if the task can be
+ * executed locally, and NIL otherwise. The task can only be executed locally
+ * if all of its shards have a placement on the local node, and none of them
+ * were modified over a connection in the current transaction.
+ */
+List *
+LocalTaskPlacementAccessList(DistributedPlan *distributedPlan, Task *task)
+{
+	List *relationShardList = task->relationShardList;
+	List *placementAccessList = NIL;
+	ListCell *taskPlacementCell = NULL;
+	bool hasLocalPlacement = false;
+	int localGroupId = 0;
+
+	if (!EnableLocalExecution)
+	{
+		return NIL;
+	}
+
+	/* intermediate results are only sent to the workers over connections */
+	if (distributedPlan->subPlanList != NIL)
+	{
+		return NIL;
+	}
+
+	/* SELECTs that prune to 0 shards use a dummy placement */
+	if (relationShardList == NIL)
+	{
+		return NIL;
+	}
+
+	localGroupId = GetLocalGroupId();
+
+	foreach(taskPlacementCell, task->taskPlacementList)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
+
+		if (taskPlacement->groupId == localGroupId)
+		{
+			hasLocalPlacement = true;
+			break;
+		}
+	}
+
+	if (!hasLocalPlacement)
+	{
+		return NIL;
+	}
+
+	placementAccessList = BuildPlacementSelectList(localGroupId, relationShardList);
+	if (list_length(placementAccessList) != list_length(relationShardList))
+	{
+		return NIL;
+	}
+
+	if (!CanReadPlacementListLocally(placementAccessList))
+	{
+		return NIL;
+	}
+
+	return placementAccessList;
+}
+
+
+/*
+ * ExecuteLocalSelectTask plans and executes the query of the given task in
+ * the current backend, and stores the results in the tuple store of the scan
+ * state.
+ */
+void
+ExecuteLocalSelectTask(CitusScanState *scanState, Task *task)
+{
+	ParamListInfo paramListInfo =
+		scanState->customScanState.ss.ps.state->es_param_list_info;
+	DestReceiver *tupleStoreDest = CreateDestReceiver(DestTuplestore);
+	Query *localQuery = NULL;
+	PlannedStmt *localPlan = NULL;
+	int cursorOptions = 0;
+	bool randomAccess = true;
+	bool interTransactions = false;
+	bool detoast = false;
+
+	Assert(scanState->tuplestorestate == NULL);
+	scanState->tuplestorestate =
+		tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+
+	SetTuplestoreDestReceiverParams(tupleStoreDest, scanState->tuplestorestate,
+									CurrentMemoryContext, detoast);
+
+	localQuery = ParseLocalTaskQuery(task->queryString, paramListInfo);
+	localPlan = pg_plan_query(localQuery, cursorOptions, paramListInfo);
+
+	ExecutePlanIntoDestReceiver(localPlan, paramListInfo, tupleStoreDest);
+}
+
+
+/*
+ * ParseLocalTaskQuery parses and analyzes the query string of a task, using
+ * the types of the parameters that are sent along with the query. Since the
+ * query runs on the local node, the type OIDs are always valid.
+ */
+static Query *
+ParseLocalTaskQuery(char *queryString, ParamListInfo paramListInfo)
+{
+	Oid *parameterTypes = NULL;
+	int parameterCount = 0;
+	List *queryTreeList = NIL;
+
+	if (paramListInfo != NULL && paramListInfo->numParams > 0)
+	{
+		int parameterIndex = 0;
+
+		parameterCount = paramListInfo->numParams;
+		parameterTypes = (Oid *) palloc0(parameterCount * sizeof(Oid));
+
+		for (parameterIndex = 0; parameterIndex < parameterCount; parameterIndex++)
+		{
+			parameterTypes[parameterIndex] =
+				paramListInfo->params[parameterIndex].ptype;
+		}
+	}
+
+#if (PG_VERSION_NUM >= 100000)
+	{
+		RawStmt *rawStmt = (RawStmt *) ParseTreeRawStmt(queryString);
+
+		queryTreeList = pg_analyze_and_rewrite(rawStmt, queryString, parameterTypes,
+											   parameterCount, NULL);
+	}
+#else
+	{
+		Node *queryTreeNode = ParseTreeNode(queryString);
+
+		queryTreeList = pg_analyze_and_rewrite(queryTreeNode, queryString,
+											   parameterTypes, parameterCount);
+	}
+#endif
+
+	if (list_length(queryTreeList) != 1)
+	{
+		ereport(ERROR, (errmsg("can only execute a single query")));
+	}
+
+	return (Query *) linitial(queryTreeList);
+}
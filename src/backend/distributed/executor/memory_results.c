@@ -0,0 +1,484 @@
+/*-------------------------------------------------------------------------
+ *
+ * memory_results.c
+ *   Keeps small intermediate results in dynamic shared memory segments
+ *   instead of files, such that storing and reading them does not incur
+ *   any file system calls.
+ *
+ *   The backend that stores a result creates a segment for it and keeps it
+ *   mapped until the end of the transaction. The segments are registered in
+ *   a shared hash under the name of the result file, such that other
+ *   backends of the same distributed transaction can find and attach them.
+ *   When a result does not fit in the shared hash, the caller falls back to
+ *   writing a file.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/memory_results.h"
+#include "nodes/pg_list.h"
+#include "storage/dsm_impl.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/*
+ * MemoryResultsControlData is the header of the shared memory segment,
+ * holding the lock that protects the hash of memory-resident results.
+ */
+typedef struct MemoryResultsControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+} MemoryResultsControlData;
+
+
+/* hash entry of a memory-resident result */
+typedef struct MemoryResultHashEntry
+{
+	char resultKey[MEMORY_RESULT_KEY_LENGTH];
+
+	/* segment holding the result and the size of the result */
+	dsm_handle segmentHandle;
+	Size resultSize;
+} MemoryResultHashEntry;
+
+
+/* memory-resident result created by the current backend */
+typedef struct OwnedMemoryResult
+{
+	char *resultKey;
+	dsm_segment *segment;
+} OwnedMemoryResult;
+
+
+/* config variable for the maximum size of a memory-resident result in kB */
+int MaxMemoryIntermediateResultSize = 64;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static MemoryResultsControlData *MemoryResultsControl = NULL;
+
+/* hash of result key -> segment holding the result */
+static HTAB *MemoryResultHash = NULL;
+
+/* results created by this backend in the current transaction */
+static List *OwnedMemoryResultList = NIL;
+
+
+static size_t MemoryResultsShmemSize(void);
+static void MemoryResultsShmemInit(void);
+static bool BuildMemoryResultKey(char *key, const char *resultKey);
+
+
+/*
+ * MemoryResultsEnabled returns whether small intermediate results should be
+ * kept in memory. Reading them requires a COPY that can read from a callback,
+ * which is only available on PostgreSQL 10 and above.
+ */
+bool
+MemoryResultsEnabled(void)
+{
+#if (PG_VERSION_NUM >= 100000)
+	return MaxMemoryIntermediateResultSize > 0 &&
+		   dynamic_shared_memory_type != DSHMEM_TYPE_NONE &&
+		   IsUnderPostmaster;
+#else
+	return false;
+#endif
+}
+
+
+/*
+ * StoreMemoryResult copies the given data into a new dynamic shared memory
+ * segment and registers it under the given key, replacing any earlier result
+ * with the same key. The segment stays mapped until ReleaseMemoryResults is
+ * called at the end of the transaction. The function returns false if the
+ * result could not be kept in memory, in which case the caller should store
+ * it in a file instead.
+ */
+bool
+StoreMemoryResult(const char *resultKey, const char *data, Size size)
+{
+	char key[MEMORY_RESULT_KEY_LENGTH];
+	dsm_segment *segment = NULL;
+	MemoryResultHashEntry *resultEntry = NULL;
+	OwnedMemoryResult *ownedResult = NULL;
+	MemoryContext oldContext = NULL;
+	bool entryFound = false;
+
+	if (!BuildMemoryResultKey(key, resultKey))
+	{
+		return false;
+	}
+
+	/* dynamic shared memory segments cannot be empty */
+	segment = dsm_create(Max(size, 1), DSM_CREATE_NULL_IF_MAXSEGMENTS);
+	if (segment == NULL)
+	{
+		return false;
+	}
+
+	memcpy(dsm_segment_address(segment), data, size);
+
+	/* keep the segment mapped beyond the current resource owner */
+	dsm_pin_mapping(segment);
+
+	LWLockAcquire(&MemoryResultsControl->lock, LW_EXCLUSIVE);
+
+	resultEntry = (MemoryResultHashEntry *) hash_search(MemoryResultHash, key,
+														HASH_ENTER_NULL, &entryFound);
+	if (resultEntry == NULL)
+	{
+		LWLockRelease(&MemoryResultsControl->lock);
+
+		ereport(DEBUG1, (errmsg("could not keep intermediate result \"%s\" "
+								"in memory", resultKey)));
+
+		dsm_detach(segment);
+
+		return false;
+	}
+
+	resultEntry->segmentHandle = dsm_segment_handle(segment);
+	resultEntry->resultSize = size;
+
+	LWLockRelease(&MemoryResultsControl->lock);
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	ownedResult = (OwnedMemoryResult *) palloc0(sizeof(OwnedMemoryResult));
+	ownedResult->resultKey = pstrdup(key);
+	ownedResult->segment = segment;
+
+	OwnedMemoryResultList = lappend(OwnedMemoryResultList, ownedResult);
+
+	MemoryContextSwitchTo(oldContext);
+
+	return true;
+}
+
+
+/*
+ * OpenMemoryResult maps the memory-resident result with the given key into
+ * the address space of the current backend, or returns NULL if there is no
+ * such result. Results opened by this function should be closed using
+ * CloseMemoryResult.
+ */
+MemoryResult *
+OpenMemoryResult(const char *resultKey)
+{
+	char key[MEMORY_RESULT_KEY_LENGTH];
+	MemoryResultHashEntry *resultEntry = NULL;
+	MemoryResult *memoryResult = NULL;
+	dsm_segment *segment = NULL;
+	dsm_handle segmentHandle = 0;
+	Size resultSize = 0;
+	bool attached = false;
+	bool entryFound = false;
+
+	if (!BuildMemoryResultKey(key, resultKey))
+	{
+		return NULL;
+	}
+
+	/*
+	 * Hold the lock while attaching, such that the owner cannot remove the
+	 * segment in the meantime.
+	 */
+	LWLockAcquire(&MemoryResultsControl->lock, LW_SHARED);
+
+	resultEntry = (MemoryResultHashEntry *) hash_search(MemoryResultHash, key,
+														HASH_FIND, &entryFound);
+	if (!entryFound)
+	{
+		LWLockRelease(&MemoryResultsControl->lock);
+
+		return NULL;
+	}
+
+	segmentHandle = resultEntry->segmentHandle;
+	resultSize = resultEntry->resultSize;
+
+	/* the result may have been created by this backend */
+	segment = dsm_find_mapping(segmentHandle);
+	if (segment == NULL)
+	{
+		segment = dsm_attach(segmentHandle);
+		attached = true;
+	}
+
+	LWLockRelease(&MemoryResultsControl->lock);
+
+	if (segment == NULL)
+	{
+		ereport(ERROR, (errmsg("could not attach to intermediate result \"%s\"",
+							   resultKey)));
+	}
+
+	memoryResult = (MemoryResult *) palloc0(sizeof(MemoryResult));
+	memoryResult->segment = segment;
+	memoryResult->attached = attached;
+	memoryResult->data = (char *) dsm_segment_address(segment);
+	memoryResult->size = resultSize;
+
+	return memoryResult;
+}
+
+
+/*
+ * CloseMemoryResult unmaps a result that was opened using OpenMemoryResult,
+ * unless it is owned by the current backend.
+ */
+void
+CloseMemoryResult(MemoryResult *memoryResult)
+{
+	if (memoryResult->attached)
+	{
+		dsm_detach(memoryResult->segment);
+	}
+
+	pfree(memoryResult);
+}
+
+
+/*
+ * MemoryResultSize returns the size of the memory-resident result with the
+ * given key, or -1 if there is no such result.
+ */
+int64
+MemoryResultSize(const char *resultKey)
+{
+	char key[MEMORY_RESULT_KEY_LENGTH];
+	MemoryResultHashEntry *resultEntry = NULL;
+	bool entryFound = false;
+	int64 resultSize = -1;
+
+	if (!BuildMemoryResultKey(key, resultKey))
+	{
+		return -1;
+	}
+
+	LWLockAcquire(&MemoryResultsControl->lock, LW_SHARED);
+
+	resultEntry = (MemoryResultHashEntry *) hash_search(MemoryResultHash, key,
+														HASH_FIND, &entryFound);
+	if (entryFound)
+	{
+		resultSize = (int64) resultEntry->resultSize;
+	}
+
+	LWLockRelease(&MemoryResultsControl->lock);
+
+	return resultSize;
+}
+
+
+/*
+ * RemoveMemoryResult unregisters the memory-resident result with the given
+ * key, if any, such that a result that is subsequently written to a file
+ * under the same name is not shadowed by it. Segments owned by the current
+ * backend stay mapped until ReleaseMemoryResults is called.
+ */
+void
+RemoveMemoryResult(const char *resultKey)
+{
+	char key[MEMORY_RESULT_KEY_LENGTH];
+	bool entryFound = false;
+
+	if (!BuildMemoryResultKey(key, resultKey))
+	{
+		return;
+	}
+
+	LWLockAcquire(&MemoryResultsControl->lock, LW_EXCLUSIVE);
+
+	hash_search(MemoryResultHash, key, HASH_REMOVE, &entryFound);
+
+	LWLockRelease(&MemoryResultsControl->lock);
+}
+
+
+/*
+ * ReleaseMemoryResults unregisters and unmaps all results that the current
+ * backend created. Segments are destroyed once no other backend has them
+ * mapped. It is called at the end of every transaction.
+ */
+void
+ReleaseMemoryResults(void)
+{
+	ListCell *ownedResultCell = NULL;
+
+	if (OwnedMemoryResultList == NIL)
+	{
+		return;
+	}
+
+	LWLockAcquire(&MemoryResultsControl->lock, LW_EXCLUSIVE);
+
+	foreach(ownedResultCell, OwnedMemoryResultList)
+	{
+		OwnedMemoryResult *ownedResult = (OwnedMemoryResult *) lfirst(ownedResultCell);
+		dsm_handle segmentHandle = dsm_segment_handle(ownedResult->segment);
+		MemoryResultHashEntry *resultEntry = NULL;
+		bool entryFound = false;
+
+		/* the result may have been replaced by a newer one in the meantime */
+		resultEntry = (MemoryResultHashEntry *) hash_search(MemoryResultHash,
+															ownedResult->resultKey,
+															HASH_FIND, &entryFound);
+		if (entryFound && resultEntry->segmentHandle == segmentHandle)
+		{
+			hash_search(MemoryResultHash, ownedResult->resultKey, HASH_REMOVE,
+						&entryFound);
+		}
+	}
+
+	LWLockRelease(&MemoryResultsControl->lock);
+
+	foreach(ownedResultCell, OwnedMemoryResultList)
+	{
+		OwnedMemoryResult *ownedResult = (OwnedMemoryResult *) lfirst(ownedResultCell);
+
+		dsm_detach(ownedResult->segment);
+
+		pfree(ownedResult->resultKey);
+		pfree(ownedResult);
+	}
+
+	list_free(OwnedMemoryResultList);
+	OwnedMemoryResultList = NIL;
+}
+
+
+/*
+ * BuildMemoryResultKey fills the zero-padded hash key for the given result
+ * key. It returns false if the result key is too long to be used.
+ */
+static bool
+BuildMemoryResultKey(char *key, const char *resultKey)
+{
+	if (strlen(resultKey) >= MEMORY_RESULT_KEY_LENGTH)
+	{
+		return false;
+	}
+
+	memset(key, 0, MEMORY_RESULT_KEY_LENGTH);
+	strlcpy(key, resultKey, MEMORY_RESULT_KEY_LENGTH);
+
+	return true;
+}
+
+
+/*
+ * InitializeMemoryResults requests the necessary shared memory from Postgres
+ * and sets up the shared memory startup hook.
+ */
+void
+InitializeMemoryResults(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(MemoryResultsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = MemoryResultsShmemInit;
+}
+
+
+/*
+ * MemoryResultsShmemSize computes how much shared memory is required.
+ */
+static size_t
+MemoryResultsShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, sizeof(MemoryResultsControlData));
+
+	hashSize = hash_estimate_size(MAX_MEMORY_RESULTS, sizeof(MemoryResultHashEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * MemoryResultsShmemInit initializes the shared memory used for keeping track
+ * of the memory-resident results across backends.
+ */
+static void
+MemoryResultsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	MemoryResultsControl =
+		(MemoryResultsControlData *) ShmemInitStruct("Memory Results Data",
+													  sizeof(MemoryResultsControlData),
+													  &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out all the memory */
+		memset(MemoryResultsControl, 0, sizeof(MemoryResultsControlData));
+
+#if (PG_VERSION_NUM >= 100000)
+		MemoryResultsControl->trancheId = LWLockNewTrancheId();
+		MemoryResultsControl->lockTrancheName = "Memory Intermediate Results";
+		LWLockRegisterTranche(MemoryResultsControl->trancheId,
+							  MemoryResultsControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &MemoryResultsControl->lockTranche;
+
+			MemoryResultsControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &MemoryResultsControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Memory Intermediate Results";
+			LWLockRegisterTranche(MemoryResultsControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&MemoryResultsControl->lock, MemoryResultsControl->trancheId);
+	}
+
+	/* result keys are NUL-terminated strings, which dynahash hashes by default */
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = MEMORY_RESULT_KEY_LENGTH;
+	hashInfo.entrysize = sizeof(MemoryResultHashEntry);
+	hashFlags = HASH_ELEM;
+
+	MemoryResultHash = ShmemInitHash("Memory Results Hash",
+									 MAX_MEMORY_RESULTS, MAX_MEMORY_RESULTS,
+									 &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
@@ -16,15 +16,23 @@
 #include "fmgr.h"
 #include "libpq-fe.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 
 #include "commands/dbcommands.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/connection_management.h"
+#include "distributed/connection_wait_stats.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/node_health.h"
 #include "distributed/placement_connection.h"
 #include "distributed/remote_commands.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/transaction_management.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
 
 #include <errno.h>
 #include <unistd.h>
@@ -43,10 +51,21 @@ static MultiConnection *ClientConnectionArray[MAX_CONNECTION_COUNT];
  */
 static PostgresPollingStatusType ClientPollingStatusArray[MAX_CONNECTION_COUNT];
 
+/*
+ * ClientConnectionGeneration is incremented whenever a connection is removed
+ * from the pool, such that wait event sets holding its socket get rebuilt.
+ */
+static uint64 ClientConnectionGeneration = 0;
+
 
 /* Local functions forward declarations */
 static bool ClientConnectionReady(MultiConnection *connection,
 								  PostgresPollingStatusType pollingStatus);
+static void UpdateWaitEventSet(WaitInfo *waitInfo);
+static void RebuildWaitEventSet(WaitInfo *waitInfo);
+static void AddConnectionToWaitEventSet(WaitInfo *waitInfo, int32 connectionId,
+										int waitFlags);
+static bool ForwardStatementTimeout(MultiConnection *connection);
 
 
 /* AllocateConnectionId returns a connection id from the connection pool. */
@@ -166,6 +185,7 @@ MultiClientConnectStart(const char *nodeName, uint32 nodePort, const char *nodeD
 	}
 	else
 	{
+		RecordConnectionEstablishmentFailure(connection);
 		ReportConnectionError(connection, WARNING);
 		CloseConnection(connection);
 
@@ -216,6 +236,7 @@ MultiClientPlacementConnectStart(List *placementAccessList, const char *userName
 	}
 	else
 	{
+		RecordConnectionEstablishmentFailure(connection);
 		ReportConnectionError(connection, WARNING);
 
 		connectionId = INVALID_CONNECTION_ID;
@@ -240,6 +261,9 @@ MultiClientConnectPoll(int32 connectionId)
 	pollingStatus = ClientPollingStatusArray[connectionId];
 	if (pollingStatus == PGRES_POLLING_OK)
 	{
+		RecordConnectionEstablished(connection);
+		RecordConnectionEstablishmentResult(connection);
+
 		connectStatus = CLIENT_CONNECTION_READY;
 	}
 	else if (pollingStatus == PGRES_POLLING_READING)
@@ -270,6 +294,7 @@ MultiClientConnectPoll(int32 connectionId)
 	}
 	else if (pollingStatus == PGRES_POLLING_FAILED)
 	{
+		RecordConnectionEstablishmentFailure(connection);
 		ReportConnectionError(connection, WARNING);
 
 		connectStatus = CLIENT_CONNECTION_BAD;
@@ -302,6 +327,7 @@ MultiClientDisconnect(int32 connectionId)
 
 	ClientConnectionArray[connectionId] = NULL;
 	ClientPollingStatusArray[connectionId] = InvalidPollingStatus;
+	ClientConnectionGeneration++;
 }
 
 
@@ -336,6 +362,7 @@ MultiClientReleaseConnection(int32 connectionId)
 
 	ClientConnectionArray[connectionId] = NULL;
 	ClientPollingStatusArray[connectionId] = InvalidPollingStatus;
+	ClientConnectionGeneration++;
 }
 
 
@@ -441,6 +468,169 @@ MultiClientCancel(int32 connectionId)
 }
 
 
+/*
+ * MultiClientCancelList cancels the running queries on the given connections.
+ * PQcancel blocks until the worker has received the request, and libpq has no
+ * way of sending a cancel request without blocking. We therefore first get
+ * the cancel objects of all connections and then send the requests back to
+ * back. Every request has been delivered when we return, such that a late
+ * cancel request cannot hit a later query on the connection.
+ */
+void
+MultiClientCancelList(List *connectionIdList)
+{
+	int cancelCount = list_length(connectionIdList);
+	PGcancel **cancelObjectArray = NULL;
+	ListCell *connectionIdCell = NULL;
+	int cancelIndex = 0;
+	char errorBuffer[STRING_BUFFER_SIZE];
+
+	if (cancelCount == 0)
+	{
+		return;
+	}
+
+	cancelObjectArray = palloc0(cancelCount * sizeof(PGcancel *));
+
+	foreach(connectionIdCell, connectionIdList)
+	{
+		int32 connectionId = lfirst_int(connectionIdCell);
+		MultiConnection *connection = ClientConnectionArray[connectionId];
+
+		Assert(connection != NULL);
+
+		cancelObjectArray[cancelIndex++] = PQgetCancel(connection->pgConn);
+	}
+
+	for (cancelIndex = 0; cancelIndex < cancelCount; cancelIndex++)
+	{
+		PGcancel *cancelObject = cancelObjectArray[cancelIndex];
+		int cancelSent = PQcancel(cancelObject, errorBuffer, sizeof(errorBuffer));
+
+		if (cancelSent == 0)
+		{
+			ereport(WARNING, (errmsg("could not issue cancel request"),
+							  errdetail("Client error: %s", errorBuffer)));
+		}
+
+		PQfreeCancel(cancelObject);
+	}
+
+	pfree(cancelObjectArray);
+}
+
+
+/*
+ * MultiClientTaskSettingsCommand returns the command that applies the settings
+ * of a task with the given number of parallel workers to the given connection,
+ * or NULL if the connection already has them.
+ *
+ * The time that is left of the statement_timeout of the current statement
+ * becomes the statement_timeout of the connection. Workers thereby stop tasks
+ * at the same time the coordinator gives up on the statement, even if the
+ * cancel requests of the coordinator never arrive. We only forward the timeout
+ * on connections that are closed at the end of the statement, which is the
+ * case outside of coordinated transactions, such that the setting never
+ * affects later commands. Within transactions, tasks rely on the cancel
+ * requests of the coordinator.
+ *
+ * The parallel workers suggested by the planner become the connection's
+ * max_parallel_workers_per_gather, such that large shards are scanned in
+ * parallel on the worker. The setting is tracked on the connection, and reset
+ * for tasks that have no suggestion.
+ */
+char *
+MultiClientTaskSettingsCommand(int32 connectionId, int parallelWorkerCount)
+{
+	MultiConnection *connection = NULL;
+	StringInfo settingsCommand = NULL;
+	char *parallelWorkersCommand = NULL;
+
+	Assert(connectionId != INVALID_CONNECTION_ID);
+	connection = ClientConnectionArray[connectionId];
+	Assert(connection != NULL);
+
+	/* settings of a transaction block are undone if it aborts */
+	if (PQtransactionStatus(connection->pgConn) != PQTRANS_IDLE)
+	{
+		return NULL;
+	}
+
+	settingsCommand = makeStringInfo();
+
+	if (ForwardStatementTimeout(connection))
+	{
+		TimestampTz deadline = 0;
+		long secondsLeft = 0;
+		int microsecondsLeft = 0;
+		int64 millisecondsLeft = 0;
+
+		deadline = TimestampTzPlusMilliseconds(GetCurrentStatementStartTimestamp(),
+											   StatementTimeout);
+		TimestampDifference(GetCurrentTimestamp(), deadline, &secondsLeft,
+							&microsecondsLeft);
+
+		/* the coordinator cancels the statement itself once the deadline passed */
+		millisecondsLeft = Max((int64) secondsLeft * 1000 + microsecondsLeft / 1000, 1);
+
+		appendStringInfo(settingsCommand, "SET statement_timeout TO " INT64_FORMAT,
+						 millisecondsLeft);
+	}
+
+	parallelWorkersCommand = ParallelWorkersCommand(connection, parallelWorkerCount);
+	if (parallelWorkersCommand != NULL)
+	{
+		if (settingsCommand->len > 0)
+		{
+			appendStringInfoString(settingsCommand, "; ");
+		}
+
+		appendStringInfoString(settingsCommand, parallelWorkersCommand);
+	}
+
+	if (settingsCommand->len == 0)
+	{
+		return NULL;
+	}
+
+	return settingsCommand->data;
+}
+
+
+/*
+ * MultiClientTaskSettingsSet records that the command returned by
+ * MultiClientTaskSettingsCommand succeeded on the given connection.
+ */
+void
+MultiClientTaskSettingsSet(int32 connectionId, int parallelWorkerCount)
+{
+	MultiConnection *connection = NULL;
+
+	Assert(connectionId != INVALID_CONNECTION_ID);
+	connection = ClientConnectionArray[connectionId];
+	Assert(connection != NULL);
+
+	if (ForwardStatementTimeout(connection))
+	{
+		connection->statementTimeoutSet = true;
+	}
+
+	connection->parallelWorkerCount = parallelWorkerCount;
+}
+
+
+/*
+ * ForwardStatementTimeout returns whether the statement_timeout of the current
+ * statement should still be forwarded to the given connection.
+ */
+static bool
+ForwardStatementTimeout(MultiConnection *connection)
+{
+	return PropagateStatementTimeout && StatementTimeout > 0 &&
+		   !connection->statementTimeoutSet && !InCoordinatedTransaction();
+}
+
+
 /* MultiClientResultStatus checks result status for an asynchronous query. */
 ResultStatus
 MultiClientResultStatus(int32 connectionId)
@@ -701,9 +891,13 @@ MultiClientQueryStatus(int32 connectionId)
 }
 
 
-/* MultiClientCopyData copies data from the file. */
+/*
+ * MultiClientCopyData copies data from the file. Once the copy is done, the
+ * number of copied rows is returned in returnRowsReceived, if given.
+ */
 CopyStatus
-MultiClientCopyData(int32 connectionId, int32 fileDescriptor, uint64 *returnBytesReceived)
+MultiClientCopyData(int32 connectionId, int32 fileDescriptor, uint64 *returnBytesReceived,
+					uint64 *returnRowsReceived)
 {
 	MultiConnection *connection = NULL;
 	char *receiveBuffer = NULL;
@@ -773,6 +967,11 @@ MultiClientCopyData(int32 connectionId, int32 fileDescriptor, uint64 *returnByte
 		if (resultStatus == PGRES_COMMAND_OK)
 		{
 			copyStatus = CLIENT_COPY_DONE;
+
+			if (returnRowsReceived)
+			{
+				*returnRowsReceived = pg_strtouint64(PQcmdTuples(result), NULL, 10);
+			}
 		}
 		else
 		{
@@ -808,27 +1007,54 @@ MultiClientCopyData(int32 connectionId, int32 fileDescriptor, uint64 *returnByte
  *
  * Connections can be added using MultiClientRegisterWait(). All added
  * connections can then be waited upon together using MultiClientWait().
+ * The underlying wait event set is kept across calls to
+ * MultiClientResetWaitInfo(), and has to be released using
+ * MultiClientFreeWaitInfo().
  */
 WaitInfo *
 MultiClientCreateWaitInfo(int maxConnections)
 {
-	WaitInfo *waitInfo = palloc(sizeof(WaitInfo));
+	WaitInfo *waitInfo = palloc0(sizeof(WaitInfo));
+	int eventSetSize = 0;
+	int connectionIndex = 0;
+	int eventIndex = 0;
 
-#ifndef HAVE_POLL
+#ifdef WIN32
 
-	/* we subtract 2 to make room for the WL_POSTMASTER_DEATH and WL_LATCH_SET events */
-	if (maxConnections > FD_SETSIZE - 2)
+	/* make room for the latch, postmaster death and pgwin32_signal_event */
+	if (maxConnections > MAXIMUM_WAIT_OBJECTS - 3)
 	{
-		maxConnections = FD_SETSIZE - 2;
+		maxConnections = MAXIMUM_WAIT_OBJECTS - 3;
 	}
 #endif
 
+	/* we add 2 to make room for the WL_POSTMASTER_DEATH and WL_LATCH_SET events */
+	eventSetSize = maxConnections + 2;
+
 	waitInfo->maxWaiters = maxConnections;
+	waitInfo->memoryContext = CurrentMemoryContext;
+	waitInfo->registeredConnectionIds = palloc0(maxConnections * sizeof(int32));
+	waitInfo->registeredWaitFlags = palloc0(maxConnections * sizeof(int));
 
-	/* we use poll(2) if available, otherwise select(2) */
-#ifdef HAVE_POLL
-	waitInfo->pollfds = palloc(maxConnections * sizeof(struct pollfd));
-#endif
+	waitInfo->waitEventSet = NULL;
+	waitInfo->events = palloc0(eventSetSize * sizeof(WaitEvent));
+	waitInfo->eventSetSize = eventSetSize;
+	waitInfo->socketEventCount = 0;
+	waitInfo->eventConnectionIds = palloc0(eventSetSize * sizeof(int));
+	waitInfo->eventSockets = palloc0(eventSetSize * sizeof(int));
+	waitInfo->eventWaitFlags = palloc0(eventSetSize * sizeof(int));
+	waitInfo->connectionEventPositions = palloc0(MAX_CONNECTION_COUNT * sizeof(int));
+	waitInfo->connectionGeneration = ClientConnectionGeneration;
+
+	for (eventIndex = 0; eventIndex < eventSetSize; eventIndex++)
+	{
+		waitInfo->eventConnectionIds[eventIndex] = INVALID_CONNECTION_ID;
+	}
+
+	for (connectionIndex = 0; connectionIndex < MAX_CONNECTION_COUNT; connectionIndex++)
+	{
+		waitInfo->connectionEventPositions[connectionIndex] = -1;
+	}
 
 	/* initialize remaining fields */
 	MultiClientResetWaitInfo(waitInfo);
@@ -837,21 +1063,17 @@ MultiClientCreateWaitInfo(int maxConnections)
 }
 
 
-/* MultiClientResetWaitInfo clears all pending waits from a WaitInfo. */
+/*
+ * MultiClientResetWaitInfo clears all pending waits from a WaitInfo. The wait
+ * event set itself is kept, such that connections that are registered again
+ * in the next round do not have to be added to it again.
+ */
 void
 MultiClientResetWaitInfo(WaitInfo *waitInfo)
 {
 	waitInfo->registeredWaiters = 0;
 	waitInfo->haveReadyWaiter = false;
 	waitInfo->haveFailedWaiter = false;
-
-#ifndef HAVE_POLL
-	FD_ZERO(&(waitInfo->readFileDescriptorSet));
-	FD_ZERO(&(waitInfo->writeFileDescriptorSet));
-	FD_ZERO(&(waitInfo->exceptionFileDescriptorSet));
-
-	waitInfo->maxConnectionFileDescriptor = 0;
-#endif
 }
 
 
@@ -859,9 +1081,20 @@ MultiClientResetWaitInfo(WaitInfo *waitInfo)
 void
 MultiClientFreeWaitInfo(WaitInfo *waitInfo)
 {
-#ifdef HAVE_POLL
-	pfree(waitInfo->pollfds);
-#endif
+	/* the wait event set may hold a kernel file descriptor, so always free it */
+	if (waitInfo->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(waitInfo->waitEventSet);
+		waitInfo->waitEventSet = NULL;
+	}
+
+	pfree(waitInfo->registeredConnectionIds);
+	pfree(waitInfo->registeredWaitFlags);
+	pfree(waitInfo->events);
+	pfree(waitInfo->eventConnectionIds);
+	pfree(waitInfo->eventSockets);
+	pfree(waitInfo->eventWaitFlags);
+	pfree(waitInfo->connectionEventPositions);
 
 	pfree(waitInfo);
 }
@@ -875,14 +1108,9 @@ void
 MultiClientRegisterWait(WaitInfo *waitInfo, TaskExecutionStatus executionStatus,
 						int32 connectionId)
 {
-	MultiConnection *connection = NULL;
-#ifdef HAVE_POLL
-	struct pollfd *pollfd = NULL;
-#else
-	int connectionFileDescriptor = 0;
-#endif
+	int waitFlags = 0;
 
-	/* This is to make sure we could never register more than maxWaiters in Windows */
+	/* This is to make sure we could never register more than maxWaiters */
 	if (waitInfo->registeredWaiters >= waitInfo->maxWaiters)
 	{
 		return;
@@ -899,36 +1127,17 @@ MultiClientRegisterWait(WaitInfo *waitInfo, TaskExecutionStatus executionStatus,
 		return;
 	}
 
-	connection = ClientConnectionArray[connectionId];
-#ifdef HAVE_POLL
-	pollfd = &waitInfo->pollfds[waitInfo->registeredWaiters];
-	pollfd->fd = PQsocket(connection->pgConn);
 	if (executionStatus == TASK_STATUS_SOCKET_READ)
 	{
-		pollfd->events = POLLERR | POLLIN;
+		waitFlags = WL_SOCKET_READABLE;
 	}
 	else if (executionStatus == TASK_STATUS_SOCKET_WRITE)
 	{
-		pollfd->events = POLLERR | POLLOUT;
-	}
-
-#else
-	connectionFileDescriptor = PQsocket(connection->pgConn);
-	if (connectionFileDescriptor > waitInfo->maxConnectionFileDescriptor)
-	{
-		waitInfo->maxConnectionFileDescriptor = connectionFileDescriptor;
+		waitFlags = WL_SOCKET_WRITEABLE;
 	}
 
-	if (executionStatus == TASK_STATUS_SOCKET_READ)
-	{
-		FD_SET(connectionFileDescriptor, &(waitInfo->readFileDescriptorSet));
-	}
-	else if (executionStatus == TASK_STATUS_SOCKET_WRITE)
-	{
-		FD_SET(connectionFileDescriptor, &(waitInfo->writeFileDescriptorSet));
-	}
-#endif
-
+	waitInfo->registeredConnectionIds[waitInfo->registeredWaiters] = connectionId;
+	waitInfo->registeredWaitFlags[waitInfo->registeredWaiters] = waitFlags;
 	waitInfo->registeredWaiters++;
 }
 
@@ -940,6 +1149,17 @@ MultiClientRegisterWait(WaitInfo *waitInfo, TaskExecutionStatus executionStatus,
 void
 MultiClientWait(WaitInfo *waitInfo)
 {
+	/*
+	 * Wait for activity on any of the sockets. Limit the maximum time spent
+	 * waiting in one wait cycle, as insurance against edge cases. For
+	 * efficiency we don't want to wake quite as often as
+	 * citus.remote_task_check_interval, so rather arbitrarily sleep ten times
+	 * as long.
+	 */
+	long timeout = RemoteTaskCheckInterval * 10;
+	int eventCount = 0;
+	int eventIndex = 0;
+
 	/*
 	 * If we had a failure, we always want to sleep for a bit, to prevent
 	 * flooding the other system, probably making the situation worse.
@@ -958,76 +1178,192 @@ MultiClientWait(WaitInfo *waitInfo)
 		return;
 	}
 
-	while (true)
+	UpdateWaitEventSet(waitInfo);
+
+#if (PG_VERSION_NUM >= 100000)
+	eventCount = WaitEventSetWait(waitInfo->waitEventSet, timeout, waitInfo->events,
+								  waitInfo->eventSetSize, WAIT_EVENT_CLIENT_READ);
+#else
+	eventCount = WaitEventSetWait(waitInfo->waitEventSet, timeout, waitInfo->events,
+								  waitInfo->eventSetSize);
+#endif
+
+	if (eventCount == 0)
+	{
+		ereport(DEBUG5,
+				(errmsg("waiting for activity on tasks took longer than %ld ms",
+						timeout)));
+	}
+
+	for (eventIndex = 0; eventIndex < eventCount; eventIndex++)
 	{
+		WaitEvent *event = &waitInfo->events[eventIndex];
+
+		if (event->events & WL_POSTMASTER_DEATH)
+		{
+			ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+		}
+
 		/*
-		 * Wait for activity on any of the sockets. Limit the maximum time
-		 * spent waiting in one wait cycle, as insurance against edge
-		 * cases. For efficiency we don't want to wake quite as often as
-		 * citus.remote_task_check_interval, so rather arbitrarily sleep ten
-		 * times as long.
+		 * We do not process interrupts here, the caller checks for pending
+		 * cancellations such that it can clean up its connections first.
 		 */
-#ifdef HAVE_POLL
-		int rc = poll(waitInfo->pollfds, waitInfo->registeredWaiters,
-					  RemoteTaskCheckInterval * 10);
-#else
-		int maxConnectionFileDescriptor = waitInfo->maxConnectionFileDescriptor;
-		const int maxTimeout = RemoteTaskCheckInterval * 10 * 1000L;
-		struct timeval selectTimeout = { 0, maxTimeout };
-		int rc = 0;
-
-		/* it is not okay to call select when there is nothing to wait for */
-		if (waitInfo->registeredWaiters == 0)
+		if (event->events & WL_LATCH_SET)
 		{
-			return;
+			ResetLatch(MyLatch);
 		}
+	}
+}
 
-		rc = (select) (maxConnectionFileDescriptor + 1,
-					   &(waitInfo->readFileDescriptorSet),
-					   &(waitInfo->writeFileDescriptorSet),
-					   &(waitInfo->exceptionFileDescriptorSet),
-					   &selectTimeout);
 
-#endif
+/*
+ * UpdateWaitEventSet brings the wait event set in line with the waits that
+ * were registered in the current round. Connections that are already part
+ * of the set only have their wait flags modified, and new connections are
+ * added to the set. Since events cannot be removed from a WaitEventSet, the
+ * set is rebuilt when a connection no longer waits, when a connection was
+ * closed or released, or while connections are being established; libpq may
+ * replace the socket of a connection during connection establishment, even
+ * under the same file descriptor number.
+ */
+static void
+UpdateWaitEventSet(WaitInfo *waitInfo)
+{
+	bool rebuildWaitEventSet = false;
+	int existingEventCount = 0;
+	int waiterIndex = 0;
 
-		if (rc < 0)
-		{
-			/*
-			 * Signals that arrive can interrupt our poll(). In that case just
-			 * return. Every other error is unexpected and treated as such.
-			 */
-			int errorCode = errno;
-#ifdef WIN32
-			errorCode = WSAGetLastError();
-#endif
+	if (waitInfo->waitEventSet == NULL ||
+		waitInfo->connectionGeneration != ClientConnectionGeneration)
+	{
+		rebuildWaitEventSet = true;
+	}
 
-			if (errorCode == 0)
-			{
-				return;
-			}
-			else if (errorCode == EAGAIN || errorCode == EINTR)
-			{
-				return;
-			}
-			else
+	for (waiterIndex = 0; waiterIndex < waitInfo->registeredWaiters &&
+		 !rebuildWaitEventSet; waiterIndex++)
+	{
+		int32 connectionId = waitInfo->registeredConnectionIds[waiterIndex];
+		MultiConnection *connection = ClientConnectionArray[connectionId];
+		int eventPosition = waitInfo->connectionEventPositions[connectionId];
+
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			rebuildWaitEventSet = true;
+		}
+		else if (eventPosition >= 0)
+		{
+			if (waitInfo->eventSockets[eventPosition] != PQsocket(connection->pgConn))
 			{
-				ereport(ERROR, (errcode_for_file_access(),
-								errmsg("poll failed: %m")));
+				rebuildWaitEventSet = true;
 			}
+
+			existingEventCount++;
 		}
-		else if (rc == 0)
+	}
+
+	/* some connections in the set are no longer waiting */
+	if (existingEventCount != waitInfo->socketEventCount)
+	{
+		rebuildWaitEventSet = true;
+	}
+
+	if (rebuildWaitEventSet)
+	{
+		RebuildWaitEventSet(waitInfo);
+		return;
+	}
+
+	for (waiterIndex = 0; waiterIndex < waitInfo->registeredWaiters; waiterIndex++)
+	{
+		int32 connectionId = waitInfo->registeredConnectionIds[waiterIndex];
+		int waitFlags = waitInfo->registeredWaitFlags[waiterIndex];
+		int eventPosition = waitInfo->connectionEventPositions[connectionId];
+
+		if (eventPosition < 0)
+		{
+			AddConnectionToWaitEventSet(waitInfo, connectionId, waitFlags);
+		}
+		else if (waitInfo->eventWaitFlags[eventPosition] != waitFlags)
 		{
-			ereport(DEBUG5,
-					(errmsg("waiting for activity on tasks took longer than %d ms",
-							(int) RemoteTaskCheckInterval * 10)));
+			ModifyWaitEvent(waitInfo->waitEventSet, eventPosition, waitFlags, NULL);
+			waitInfo->eventWaitFlags[eventPosition] = waitFlags;
 		}
+	}
+}
 
-		/*
-		 * At least one fd changed received a readiness notification, time to
-		 * process tasks again.
-		 */
+
+/*
+ * RebuildWaitEventSet recreates the wait event set with the sockets of all
+ * connections that were registered in the current round.
+ */
+static void
+RebuildWaitEventSet(WaitInfo *waitInfo)
+{
+	int eventIndex = 0;
+	int waiterIndex = 0;
+
+	if (waitInfo->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(waitInfo->waitEventSet);
+		waitInfo->waitEventSet = NULL;
+	}
+
+	for (eventIndex = 0; eventIndex < waitInfo->eventSetSize; eventIndex++)
+	{
+		int32 connectionId = waitInfo->eventConnectionIds[eventIndex];
+
+		if (connectionId != INVALID_CONNECTION_ID)
+		{
+			waitInfo->connectionEventPositions[connectionId] = -1;
+			waitInfo->eventConnectionIds[eventIndex] = INVALID_CONNECTION_ID;
+		}
+	}
+
+	waitInfo->socketEventCount = 0;
+	waitInfo->connectionGeneration = ClientConnectionGeneration;
+	waitInfo->waitEventSet = CreateWaitEventSet(waitInfo->memoryContext,
+												waitInfo->eventSetSize);
+
+	AddWaitEventToSet(waitInfo->waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET,
+					  NULL, NULL);
+	AddWaitEventToSet(waitInfo->waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch,
+					  NULL);
+
+	for (waiterIndex = 0; waiterIndex < waitInfo->registeredWaiters; waiterIndex++)
+	{
+		int32 connectionId = waitInfo->registeredConnectionIds[waiterIndex];
+		int waitFlags = waitInfo->registeredWaitFlags[waiterIndex];
+
+		AddConnectionToWaitEventSet(waitInfo, connectionId, waitFlags);
+	}
+}
+
+
+/*
+ * AddConnectionToWaitEventSet adds the socket of the given connection to the
+ * wait event set, and remembers its position in the set.
+ */
+static void
+AddConnectionToWaitEventSet(WaitInfo *waitInfo, int32 connectionId, int waitFlags)
+{
+	MultiConnection *connection = ClientConnectionArray[connectionId];
+	int socket = PQsocket(connection->pgConn);
+	int eventPosition = 0;
+
+	/* a connection without a socket has failed, which the executor will notice */
+	if (socket == PGINVALID_SOCKET)
+	{
 		return;
 	}
+
+	eventPosition = AddWaitEventToSet(waitInfo->waitEventSet, waitFlags, socket, NULL,
+									  NULL);
+
+	waitInfo->connectionEventPositions[connectionId] = eventPosition;
+	waitInfo->eventConnectionIds[eventPosition] = connectionId;
+	waitInfo->eventSockets[eventPosition] = socket;
+	waitInfo->eventWaitFlags[eventPosition] = waitFlags;
+	waitInfo->socketEventCount++;
 }
 
 
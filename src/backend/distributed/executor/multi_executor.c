@@ -31,20 +31,58 @@
 #include "distributed/worker_protocol.h"
 #include "executor/execdebug.h"
 #include "commands/copy.h"
+#include "lib/binaryheap.h"
 #include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/tlist.h"
 #include "parser/parsetree.h"
 #include "storage/lmgr.h"
 #include "tcop/pquery.h"
 #include "tcop/utility.h"
 #include "utils/snapmgr.h"
 #include "utils/memutils.h"
+#include "utils/sortsupport.h"
 
 
 /* controls the connection type for multi shard update/delete queries */
 int MultiShardConnectionType = PARALLEL_CONNECTION;
 
 
+/*
+ * SortedMergeSource keeps the current row of a task result file that is read
+ * while merging sorted task results.
+ */
+typedef struct SortedMergeSource
+{
+	CopyState copyState;
+	MemoryContext rowContext;
+	Datum *columnValues;
+	bool *columnNulls;
+} SortedMergeSource;
+
+
+/*
+ * SortedMergeState contains the sources and the sort keys of a merge of sorted
+ * task results. The sort keys refer to columns of the task results.
+ */
+typedef struct SortedMergeState
+{
+	SortedMergeSource *sourceArray;
+	SortSupport sortKeyArray;
+	int sortKeyCount;
+} SortedMergeState;
+
+
 /* ocal function forward declarations */
+static void MergeSortedFilesIntoTupleStore(CitusScanState *citusScanState,
+										   Job *workerJob, char *copyFormat);
+static bool ReadNextMergeRow(SortedMergeSource *mergeSource,
+							 ExprContext *expressionContext);
+static int CompareMergeSources(Datum leftSource, Datum rightSource, void *arg);
+static void ReadCopyStateIntoTupleStore(CopyState copyState,
+										TupleDesc tupleDescriptor,
+										Tuplestorestate *tupstore);
+static List * CopyFormatOptions(char *copyFormat);
 static Relation StubRelation(TupleDesc tupleDescriptor);
 
 
@@ -88,6 +126,13 @@ ReturnTupleFromTuplestore(CitusScanState *scanState)
  *
  * Note that in the long term it'd be a lot better if Multi*Execute() directly
  * filled the tuplestores, but that's a fair bit of work.
+ *
+ * If the planner found the task results to be sorted in the order of the master
+ * query, we merge the files into the tuple store in sort order instead.
+ *
+ * Each file is read in a memory context of its own that is reset once its rows
+ * are in the tuple store, such that jobs with many tasks do not accumulate the
+ * state of reading every file until the end of the query.
  */
 void
 LoadTuplesIntoTupleStore(CitusScanState *citusScanState, Job *workerJob)
@@ -99,6 +144,8 @@ LoadTuplesIntoTupleStore(CitusScanState *citusScanState, Job *workerJob)
 	bool randomAccess = true;
 	bool interTransactions = false;
 	char *copyFormat = "text";
+	MemoryContext taskContext = NULL;
+	MemoryContext oldContext = NULL;
 
 	tupleDescriptor = customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
 
@@ -111,23 +158,240 @@ LoadTuplesIntoTupleStore(CitusScanState *citusScanState, Job *workerJob)
 		copyFormat = "binary";
 	}
 
+	if (citusScanState->distributedPlan->sortedMerge)
+	{
+		MergeSortedFilesIntoTupleStore(citusScanState, workerJob, copyFormat);
+		tuplestore_donestoring(citusScanState->tuplestorestate);
+
+		return;
+	}
+
+	taskContext = AllocSetContextCreate(CurrentMemoryContext,
+										"Task Result Context",
+										ALLOCSET_DEFAULT_MINSIZE,
+										ALLOCSET_DEFAULT_INITSIZE,
+										ALLOCSET_DEFAULT_MAXSIZE);
+
 	foreach(workerTaskCell, workerTaskList)
 	{
 		Task *workerTask = (Task *) lfirst(workerTaskCell);
 		StringInfo jobDirectoryName = NULL;
 		StringInfo taskFilename = NULL;
 
+		oldContext = MemoryContextSwitchTo(taskContext);
+
 		jobDirectoryName = MasterJobDirectoryName(workerTask->jobId);
 		taskFilename = TaskFilename(jobDirectoryName, workerTask->taskId);
 
 		ReadFileIntoTupleStore(taskFilename->data, copyFormat, tupleDescriptor,
 							   citusScanState->tuplestorestate);
+
+		MemoryContextSwitchTo(oldContext);
+		MemoryContextReset(taskContext);
 	}
 
+	MemoryContextDelete(taskContext);
+
 	tuplestore_donestoring(citusScanState->tuplestorestate);
 }
 
 
+/*
+ * MergeSortedFilesIntoTupleStore merges the result files of the tasks in the
+ * given job into the tuple store of the scan state. Each file holds rows that
+ * are sorted in the order of the master query, so we keep the current row of
+ * every file in a binary heap and repeatedly store the smallest one. Once the
+ * master query's limit is reached, the remaining rows are not read at all.
+ */
+static void
+MergeSortedFilesIntoTupleStore(CitusScanState *citusScanState, Job *workerJob,
+							   char *copyFormat)
+{
+	CustomScanState customScanState = citusScanState->customScanState;
+	Query *masterQuery = citusScanState->distributedPlan->masterQuery;
+	Tuplestorestate *tupleStore = citusScanState->tuplestorestate;
+	List *workerTaskList = workerJob->taskList;
+	List *sortClauseList = masterQuery->sortClause;
+	int sourceCount = list_length(workerTaskList);
+	TupleDesc tupleDescriptor = NULL;
+	SortedMergeState *mergeState = NULL;
+	binaryheap *mergeHeap = NULL;
+	EState *executorState = CreateExecutorState();
+	ExprContext *expressionContext = GetPerTupleExprContext(executorState);
+	ListCell *sortClauseCell = NULL;
+	ListCell *workerTaskCell = NULL;
+	int sortKeyIndex = 0;
+	int sourceIndex = 0;
+	int columnCount = 0;
+	int64 mergeRowLimit = -1;
+	int64 mergedRowCount = 0;
+
+	tupleDescriptor = customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	columnCount = tupleDescriptor->natts;
+
+	/* filters and set-returning functions change the number of rows after merge */
+	if (masterQuery->jointree->quals == NULL &&
+		!expression_returns_set((Node *) masterQuery->targetList))
+	{
+		mergeRowLimit = MasterQueryRowLimit(masterQuery);
+	}
+
+	mergeState = palloc0(sizeof(SortedMergeState));
+	mergeState->sortKeyCount = list_length(sortClauseList);
+	mergeState->sortKeyArray = palloc0(mergeState->sortKeyCount *
+									   sizeof(SortSupportData));
+	mergeState->sourceArray = palloc0(sourceCount * sizeof(SortedMergeSource));
+
+	foreach(sortClauseCell, sortClauseList)
+	{
+		SortGroupClause *sortClause = (SortGroupClause *) lfirst(sortClauseCell);
+		TargetEntry *sortTargetEntry =
+			get_sortgroupclause_tle(sortClause, masterQuery->targetList);
+		Var *sortColumn = (Var *) sortTargetEntry->expr;
+		SortSupport sortKey = &mergeState->sortKeyArray[sortKeyIndex];
+
+		Assert(IsA(sortColumn, Var));
+
+		sortKey->ssup_cxt = CurrentMemoryContext;
+		sortKey->ssup_collation = exprCollation((Node *) sortColumn);
+		sortKey->ssup_nulls_first = sortClause->nulls_first;
+		sortKey->ssup_attno = sortColumn->varattno;
+		sortKey->abbreviate = false;
+
+		PrepareSortSupportFromOrderingOp(sortClause->sortop, sortKey);
+
+		sortKeyIndex++;
+	}
+
+	mergeHeap = binaryheap_allocate(Max(sourceCount, 1), CompareMergeSources,
+									mergeState);
+
+	foreach(workerTaskCell, workerTaskList)
+	{
+		Task *workerTask = (Task *) lfirst(workerTaskCell);
+		SortedMergeSource *mergeSource = &mergeState->sourceArray[sourceIndex];
+		StringInfo jobDirectoryName = MasterJobDirectoryName(workerTask->jobId);
+		StringInfo taskFilename = TaskFilename(jobDirectoryName, workerTask->taskId);
+
+		mergeSource->copyState = BeginFileCopy(taskFilename->data, copyFormat,
+											   tupleDescriptor);
+		mergeSource->rowContext = AllocSetContextCreate(CurrentMemoryContext,
+														"SortedMergeSource",
+														ALLOCSET_DEFAULT_MINSIZE,
+														ALLOCSET_DEFAULT_INITSIZE,
+														ALLOCSET_DEFAULT_MAXSIZE);
+		mergeSource->columnValues = palloc0(columnCount * sizeof(Datum));
+		mergeSource->columnNulls = palloc0(columnCount * sizeof(bool));
+
+		if (ReadNextMergeRow(mergeSource, expressionContext))
+		{
+			binaryheap_add_unordered(mergeHeap, Int32GetDatum(sourceIndex));
+		}
+
+		sourceIndex++;
+	}
+
+	binaryheap_build(mergeHeap);
+
+	while (!binaryheap_empty(mergeHeap))
+	{
+		SortedMergeSource *mergeSource = NULL;
+
+		if (mergeRowLimit >= 0 && mergedRowCount >= mergeRowLimit)
+		{
+			break;
+		}
+
+		sourceIndex = DatumGetInt32(binaryheap_first(mergeHeap));
+		mergeSource = &mergeState->sourceArray[sourceIndex];
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, mergeSource->columnValues,
+							 mergeSource->columnNulls);
+		mergedRowCount++;
+
+		if (ReadNextMergeRow(mergeSource, expressionContext))
+		{
+			binaryheap_replace_first(mergeHeap, Int32GetDatum(sourceIndex));
+		}
+		else
+		{
+			binaryheap_remove_first(mergeHeap);
+		}
+	}
+
+	for (sourceIndex = 0; sourceIndex < sourceCount; sourceIndex++)
+	{
+		SortedMergeSource *mergeSource = &mergeState->sourceArray[sourceIndex];
+
+		EndCopyFrom(mergeSource->copyState);
+		MemoryContextDelete(mergeSource->rowContext);
+	}
+
+	binaryheap_free(mergeHeap);
+	FreeExecutorState(executorState);
+}
+
+
+/*
+ * ReadNextMergeRow reads the next row of the given merge source into its column
+ * arrays, and returns false if the source does not have any more rows. The
+ * values of the previous row are freed.
+ */
+static bool
+ReadNextMergeRow(SortedMergeSource *mergeSource, ExprContext *expressionContext)
+{
+	MemoryContext oldContext = NULL;
+	bool nextRowFound = false;
+
+	MemoryContextReset(mergeSource->rowContext);
+	oldContext = MemoryContextSwitchTo(mergeSource->rowContext);
+
+	nextRowFound = NextCopyFrom(mergeSource->copyState, expressionContext,
+								mergeSource->columnValues, mergeSource->columnNulls,
+								NULL);
+
+	MemoryContextSwitchTo(oldContext);
+
+	return nextRowFound;
+}
+
+
+/*
+ * CompareMergeSources compares the current rows of the two given merge sources
+ * on the sort keys of the merge. Since binaryheap is a max-heap, the result is
+ * inverted such that the source with the smallest row comes first.
+ */
+static int
+CompareMergeSources(Datum leftSource, Datum rightSource, void *arg)
+{
+	SortedMergeState *mergeState = (SortedMergeState *) arg;
+	SortedMergeSource *leftMergeSource =
+		&mergeState->sourceArray[DatumGetInt32(leftSource)];
+	SortedMergeSource *rightMergeSource =
+		&mergeState->sourceArray[DatumGetInt32(rightSource)];
+	int sortKeyIndex = 0;
+
+	for (sortKeyIndex = 0; sortKeyIndex < mergeState->sortKeyCount; sortKeyIndex++)
+	{
+		SortSupport sortKey = &mergeState->sortKeyArray[sortKeyIndex];
+		int columnIndex = sortKey->ssup_attno - 1;
+		int compare = 0;
+
+		compare = ApplySortComparator(leftMergeSource->columnValues[columnIndex],
+									  leftMergeSource->columnNulls[columnIndex],
+									  rightMergeSource->columnValues[columnIndex],
+									  rightMergeSource->columnNulls[columnIndex],
+									  sortKey);
+		if (compare != 0)
+		{
+			return -compare;
+		}
+	}
+
+	return 0;
+}
+
+
 /*
  * ReadFileIntoTupleStore parses the records in a COPY-formatted file according
  * according to the given tuple descriptor and stores the records in a tuple
@@ -137,14 +401,57 @@ void
 ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescriptor,
 					   Tuplestorestate *tupstore)
 {
-	CopyState copyState = NULL;
+	CopyState copyState = BeginFileCopy(fileName, copyFormat, tupleDescriptor);
 
-	/*
-	 * Trick BeginCopyFrom into using our tuple descriptor by pretending it belongs
-	 * to a relation.
-	 */
+	ReadCopyStateIntoTupleStore(copyState, tupleDescriptor, tupstore);
+}
+
+
+#if (PG_VERSION_NUM >= 100000)
+
+/*
+ * ReadCopyDataIntoTupleStore parses the COPY-formatted data returned by the
+ * given data source callback according to the given tuple descriptor and
+ * stores the records in a tuple store.
+ */
+void
+ReadCopyDataIntoTupleStore(copy_data_source_cb dataSource, char *copyFormat,
+						   TupleDesc tupleDescriptor, Tuplestorestate *tupstore)
+{
+	CopyState copyState = BeginDataSourceCopy(dataSource, copyFormat, tupleDescriptor);
+
+	ReadCopyStateIntoTupleStore(copyState, tupleDescriptor, tupstore);
+}
+
+
+/*
+ * BeginDataSourceCopy starts a COPY of the data returned by the given data
+ * source callback in the given format, which parses the records according to
+ * the given tuple descriptor.
+ */
+CopyState
+BeginDataSourceCopy(copy_data_source_cb dataSource, char *copyFormat,
+					TupleDesc tupleDescriptor)
+{
 	Relation stubRelation = StubRelation(tupleDescriptor);
+	List *copyOptions = CopyFormatOptions(copyFormat);
 
+	return BeginCopyFrom(NULL, stubRelation, NULL, false, dataSource, NULL,
+						 copyOptions);
+}
+
+
+#endif
+
+
+/*
+ * ReadCopyStateIntoTupleStore reads all records from the given COPY state into
+ * the tuple store and ends the COPY.
+ */
+static void
+ReadCopyStateIntoTupleStore(CopyState copyState, TupleDesc tupleDescriptor,
+							Tuplestorestate *tupstore)
+{
 	EState *executorState = CreateExecutorState();
 	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
 	ExprContext *executorExpressionContext = GetPerTupleExprContext(executorState);
@@ -153,25 +460,6 @@ ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescript
 	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
 	bool *columnNulls = palloc0(columnCount * sizeof(bool));
 
-	DefElem *copyOption = NULL;
-	List *copyOptions = NIL;
-
-#if (PG_VERSION_NUM >= 100000)
-	int location = -1; /* "unknown" token location */
-	copyOption = makeDefElem("format", (Node *) makeString(copyFormat), location);
-#else
-	copyOption = makeDefElem("format", (Node *) makeString(copyFormat));
-#endif
-	copyOptions = lappend(copyOptions, copyOption);
-
-#if (PG_VERSION_NUM >= 100000)
-	copyState = BeginCopyFrom(NULL, stubRelation, fileName, false, NULL,
-							  NULL, copyOptions);
-#else
-	copyState = BeginCopyFrom(stubRelation, fileName, false, NULL,
-							  copyOptions);
-#endif
-
 	while (true)
 	{
 		MemoryContext oldContext = NULL;
@@ -193,11 +481,106 @@ ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescript
 	}
 
 	EndCopyFrom(copyState);
+	FreeExecutorState(executorState);
 	pfree(columnValues);
 	pfree(columnNulls);
 }
 
 
+/*
+ * BeginFileCopy starts a COPY from the given file in the given format, which
+ * parses the records in the file according to the given tuple descriptor.
+ */
+CopyState
+BeginFileCopy(char *fileName, char *copyFormat, TupleDesc tupleDescriptor)
+{
+	CopyState copyState = NULL;
+
+	/*
+	 * Trick BeginCopyFrom into using our tuple descriptor by pretending it belongs
+	 * to a relation.
+	 */
+	Relation stubRelation = StubRelation(tupleDescriptor);
+	List *copyOptions = CopyFormatOptions(copyFormat);
+
+#if (PG_VERSION_NUM >= 100000)
+	copyState = BeginCopyFrom(NULL, stubRelation, fileName, false, NULL,
+							  NULL, copyOptions);
+#else
+	copyState = BeginCopyFrom(stubRelation, fileName, false, NULL,
+							  copyOptions);
+#endif
+
+	return copyState;
+}
+
+
+/*
+ * CopyFormatOptions returns the COPY options for reading data in the given
+ * format.
+ */
+static List *
+CopyFormatOptions(char *copyFormat)
+{
+	DefElem *copyOption = NULL;
+	List *copyOptions = NIL;
+
+#if (PG_VERSION_NUM >= 100000)
+	int location = -1; /* "unknown" token location */
+	copyOption = makeDefElem("format", (Node *) makeString(copyFormat), location);
+#else
+	copyOption = makeDefElem("format", (Node *) makeString(copyFormat));
+#endif
+	copyOptions = lappend(copyOptions, copyOption);
+
+	return copyOptions;
+}
+
+
+/*
+ * MasterQueryRowLimit returns the number of rows the master query needs from
+ * its input to satisfy its LIMIT, including the rows skipped by its OFFSET, or
+ * -1 if the master query does not have a constant limit.
+ */
+int64
+MasterQueryRowLimit(Query *masterQuery)
+{
+	Const *limitCount = NULL;
+	int64 rowLimit = 0;
+
+	if (masterQuery->limitCount == NULL || !IsA(masterQuery->limitCount, Const))
+	{
+		return -1;
+	}
+
+	limitCount = (Const *) masterQuery->limitCount;
+	if (limitCount->constisnull)
+	{
+		/* LIMIT ALL */
+		return -1;
+	}
+
+	rowLimit = DatumGetInt64(limitCount->constvalue);
+
+	if (masterQuery->limitOffset != NULL)
+	{
+		Const *limitOffset = (Const *) masterQuery->limitOffset;
+
+		if (!IsA(limitOffset, Const))
+		{
+			return -1;
+		}
+
+		if (!limitOffset->constisnull)
+		{
+			rowLimit += DatumGetInt64(limitOffset->constvalue);
+		}
+	}
+
+	return rowLimit;
+}
+
+
 /*
  * StubRelation creates a stub Relation from the given tuple descriptor.
  * To be able to use copy.c, we need a Relation descriptor. As there is no
@@ -32,22 +32,34 @@
 #include "distributed/multi_resowner.h"
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/node_health.h"
+#include "distributed/query_stats.h"
 #include "distributed/resource_lock.h"
+#include "distributed/shared_connection_stats.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/task_execution_stats.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
+#include "nodes/nodeFuncs.h"
 #include "storage/fd.h"
+#include "utils/memutils.h"
 #include "utils/timestamp.h"
 
 
+/* weight of the latest task duration in a worker's moving average */
+#define TASK_TIME_AVERAGE_WEIGHT 0.25
+
+
 /* Local functions forward declarations */
 static ConnectAction ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 										 TaskExecutionStatus *executionStatus,
 										 DistributedExecutionStats *executionStats);
 static bool TaskExecutionReadyToStart(TaskExecution *taskExecution);
 static bool TaskExecutionCompleted(TaskExecution *taskExecution);
-static void CancelTaskExecutionIfActive(TaskExecution *taskExecution);
-static void CancelRequestIfActive(TaskExecStatus taskStatus, int connectionId);
+static void CreateEmptyTaskFile(Task *task);
+static int64 TaskRowLimit(DistributedPlan *distributedPlan);
+static List * ActiveRequestConnectionList(TaskExecution *taskExecution);
+static bool RequestIsActive(TaskExecStatus taskStatus, int connectionId);
 
 /* Worker node state hash functions */
 static HTAB * WorkerHash(const char *workerHashName, List *workerNodeList);
@@ -56,25 +68,47 @@ static WorkerNodeState * WorkerHashEnter(HTAB *workerHash,
 										 char *nodeName, uint32 nodePort);
 static WorkerNodeState * WorkerHashLookup(HTAB *workerHash,
 										  const char *nodeName, uint32 nodePort);
+static WorkerNodeState * WorkerHashFind(HTAB *workerHash,
+										const char *nodeName, uint32 nodePort);
 static WorkerNodeState * LookupWorkerForTask(HTAB *workerHash, Task *task,
 											 TaskExecution *taskExecution);
 
 /* Throttling functions */
 static bool WorkerConnectionsExhausted(WorkerNodeState *workerNodeState);
 static bool MasterConnectionsExhausted(HTAB *workerHash);
+static bool SharedPoolExhausted(HTAB *workerHash, WorkerNodeState *workerNodeState);
 static uint32 TotalOpenConnectionCount(HTAB *workerHash);
 static void UpdateConnectionCounter(WorkerNodeState *workerNode,
 									ConnectAction connectAction);
 
+/* Runtime task assignment functions */
+static void AssignTaskToLeastLoadedWorker(HTAB *workerHash, Task *task,
+										  TaskExecution *taskExecution);
+static void UpdateWorkerTaskTime(WorkerNodeState *workerNodeState,
+								 TaskExecution *taskExecution);
+
 
 /*
  * MultiRealTimeExecute loops over the given tasks, and manages their execution
  * until either one task permanently fails or all tasks successfully complete.
  * The function opens up a connection for each task it needs to execute, and
  * manages these tasks' execution in real-time.
+ *
+ * If taskRowLimit is not negative, the coordinator needs at most that many
+ * rows from the tasks in total. Once completed tasks returned enough rows,
+ * the remaining tasks are cancelled and their result files are left empty.
+ *
+ * With the work-stealing task assignment policy, the placement of a task is
+ * only chosen when the task is about to start, based on the load and the task
+ * latencies observed on the workers during this execution.
+ *
+ * Task results are streamed to files rather than kept in memory. Any memory
+ * that managing a task allocates, such as command strings and file names, is
+ * allocated in a context that is reset after every step, such that executions
+ * with many tasks that loop for a long time do not grow the query context.
  */
 void
-MultiRealTimeExecute(Job *job)
+MultiRealTimeExecute(Job *job, int64 taskRowLimit)
 {
 	List *taskList = job->taskList;
 	List *taskExecutionList = NIL;
@@ -85,12 +119,22 @@ MultiRealTimeExecute(Job *job)
 	bool taskCompleted = false;
 	bool taskFailed = false;
 	bool sizeLimitIsExceeded = false;
+	bool checkTaskRowLimit = false;
+	bool taskRowLimitReached = false;
+	bool assignTasksAtRuntime = false;
+	List *incompleteTaskList = NIL;
+	List *cancelConnectionList = NIL;
 	DistributedExecutionStats executionStats = { 0 };
 
 	List *workerNodeList = NIL;
 	HTAB *workerHash = NULL;
 	const char *workerHashName = "Worker node hash";
 	WaitInfo *waitInfo = MultiClientCreateWaitInfo(list_length(taskList));
+	MemoryContext taskStepContext = AllocSetContextCreate(CurrentMemoryContext,
+														  "Task Step Context",
+														  ALLOCSET_DEFAULT_MINSIZE,
+														  ALLOCSET_DEFAULT_INITSIZE,
+														  ALLOCSET_DEFAULT_MAXSIZE);
 
 	workerNodeList = ActiveReadableNodeList();
 	workerHash = WorkerHash(workerHashName, workerNodeList);
@@ -100,6 +144,25 @@ MultiRealTimeExecute(Job *job)
 		BeginOrContinueCoordinatedTransaction();
 	}
 
+	/*
+	 * Cancelling tasks would abort the remote transactions, so only stop early
+	 * outside of transaction blocks. An empty file is a valid empty result in
+	 * text format only.
+	 */
+	if (taskRowLimit >= 0 && !IsTransactionBlock() && !BinaryMasterCopyFormat)
+	{
+		checkTaskRowLimit = true;
+	}
+
+	/*
+	 * Placement accesses in transaction blocks determine which connections
+	 * later commands use, so keep the planned assignment there.
+	 */
+	if (TaskAssignmentPolicy == TASK_ASSIGNMENT_WORK_STEALING && !IsTransactionBlock())
+	{
+		assignTasksAtRuntime = true;
+	}
+
 	/* initialize task execution structures for remote execution */
 	foreach(taskCell, taskList)
 	{
@@ -109,109 +172,151 @@ MultiRealTimeExecute(Job *job)
 		taskExecutionList = lappend(taskExecutionList, taskExecution);
 	}
 
-	/* loop around until all tasks complete, one task fails, or user cancels */
-	while (!(allTasksCompleted || taskFailed || QueryCancelPending ||
-			 sizeLimitIsExceeded))
+	/*
+	 * The wait event set holds a kernel file descriptor, so make sure it is
+	 * released when we error out of the execution loop.
+	 */
+	PG_TRY();
 	{
-		uint32 taskCount = list_length(taskList);
-		uint32 completedTaskCount = 0;
+		/* loop around until all tasks complete, one task fails, or user cancels */
+		while (!(allTasksCompleted || taskFailed || QueryCancelPending ||
+				 sizeLimitIsExceeded || taskRowLimitReached))
+		{
+			uint32 taskCount = list_length(taskList);
+			uint32 completedTaskCount = 0;
 
-		/* loop around all tasks and manage them */
-		ListCell *taskCell = NULL;
-		ListCell *taskExecutionCell = NULL;
+			/* loop around all tasks and manage them */
+			ListCell *taskCell = NULL;
+			ListCell *taskExecutionCell = NULL;
 
-		MultiClientResetWaitInfo(waitInfo);
+			MultiClientResetWaitInfo(waitInfo);
 
-		forboth(taskCell, taskList, taskExecutionCell, taskExecutionList)
-		{
-			Task *task = (Task *) lfirst(taskCell);
-			TaskExecution *taskExecution = (TaskExecution *) lfirst(taskExecutionCell);
-			ConnectAction connectAction = CONNECT_ACTION_NONE;
-			WorkerNodeState *workerNodeState = NULL;
-			TaskExecutionStatus executionStatus;
-
-			workerNodeState = LookupWorkerForTask(workerHash, task, taskExecution);
-
-			/* in case the task is about to start, throttle if necessary */
-			if (TaskExecutionReadyToStart(taskExecution) &&
-				(WorkerConnectionsExhausted(workerNodeState) ||
-				 MasterConnectionsExhausted(workerHash)))
+			forboth(taskCell, taskList, taskExecutionCell, taskExecutionList)
 			{
-				continue;
-			}
+				Task *task = (Task *) lfirst(taskCell);
+				TaskExecution *taskExecution =
+					(TaskExecution *) lfirst(taskExecutionCell);
+				ConnectAction connectAction = CONNECT_ACTION_NONE;
+				WorkerNodeState *workerNodeState = NULL;
+				TaskExecutionStatus executionStatus;
+				MemoryContext oldContext = NULL;
+				bool taskPreviouslyCompleted = TaskExecutionCompleted(taskExecution);
+
+				/* pick the placement of tasks that did not start yet */
+				if (assignTasksAtRuntime && taskExecution->failureCount == 0 &&
+					TaskExecutionReadyToStart(taskExecution))
+				{
+					AssignTaskToLeastLoadedWorker(workerHash, task, taskExecution);
+				}
 
-			/* call the function that performs the core task execution logic */
-			connectAction = ManageTaskExecution(task, taskExecution, &executionStatus,
-												&executionStats);
+				workerNodeState = LookupWorkerForTask(workerHash, task, taskExecution);
 
-			/* update the connection counter for throttling */
-			UpdateConnectionCounter(workerNodeState, connectAction);
+				/* in case the task is about to start, throttle if necessary */
+				if (TaskExecutionReadyToStart(taskExecution) &&
+					(WorkerConnectionsExhausted(workerNodeState) ||
+					 MasterConnectionsExhausted(workerHash) ||
+					 SharedPoolExhausted(workerHash, workerNodeState)))
+				{
+					continue;
+				}
 
-			/*
-			 * If this task failed, we need to iterate over task executions, and
-			 * manually clean out their client-side resources. Hence, we record
-			 * the failure here instead of immediately erroring out.
-			 */
-			taskFailed = TaskExecutionFailed(taskExecution);
-			if (taskFailed)
+				/* call the function that performs the core task execution logic */
+				oldContext = MemoryContextSwitchTo(taskStepContext);
+
+				connectAction = ManageTaskExecution(task, taskExecution, &executionStatus,
+													&executionStats);
+
+				MemoryContextSwitchTo(oldContext);
+				MemoryContextReset(taskStepContext);
+
+				/* update the connection counter for throttling */
+				UpdateConnectionCounter(workerNodeState, connectAction);
+
+				/*
+				 * If this task failed, we need to iterate over task executions, and
+				 * manually clean out their client-side resources. Hence, we record
+				 * the failure here instead of immediately erroring out.
+				 */
+				taskFailed = TaskExecutionFailed(taskExecution);
+				if (taskFailed)
+				{
+					failedTaskId = taskExecution->taskId;
+					break;
+				}
+
+				taskCompleted = TaskExecutionCompleted(taskExecution);
+				if (taskCompleted)
+				{
+					completedTaskCount++;
+
+					if (!taskPreviouslyCompleted)
+					{
+						UpdateWorkerTaskTime(workerNodeState, taskExecution);
+					}
+				}
+				else
+				{
+					uint32 currentIndex = taskExecution->currentNodeIndex;
+					int32 *connectionIdArray = taskExecution->connectionIdArray;
+					int32 connectionId = connectionIdArray[currentIndex];
+
+					/*
+					 * If not done with the task yet, make note of what this task
+					 * and its associated connection is waiting for.
+					 */
+					MultiClientRegisterWait(waitInfo, executionStatus, connectionId);
+				}
+			}
+
+			/* in case the task has intermediate results */
+			if (CheckIfSizeLimitIsExceeded(&executionStats))
 			{
-				failedTaskId = taskExecution->taskId;
+				sizeLimitIsExceeded = true;
 				break;
 			}
 
-			taskCompleted = TaskExecutionCompleted(taskExecution);
-			if (taskCompleted)
+			/*
+			 * Check if all tasks completed; otherwise wait as appropriate to
+			 * avoid a tight loop. That means we immediately continue if tasks are
+			 * ready to be processed further, and block when we're waiting for
+			 * network IO.
+			 */
+			if (completedTaskCount == taskCount)
+			{
+				allTasksCompleted = true;
+			}
+			else if (checkTaskRowLimit &&
+					 executionStats.completedTaskRowCount >= (uint64) taskRowLimit)
 			{
-				completedTaskCount++;
+				/* the remaining tasks cannot add rows to the result */
+				taskRowLimitReached = true;
 			}
 			else
 			{
-				uint32 currentIndex = taskExecution->currentNodeIndex;
-				int32 *connectionIdArray = taskExecution->connectionIdArray;
-				int32 connectionId = connectionIdArray[currentIndex];
-
-				/*
-				 * If not done with the task yet, make note of what this task
-				 * and its associated connection is waiting for.
-				 */
-				MultiClientRegisterWait(waitInfo, executionStatus, connectionId);
+				MultiClientWait(waitInfo);
 			}
-		}
-
-		/* in case the task has intermediate results */
-		if (CheckIfSizeLimitIsExceeded(&executionStats))
-		{
-			sizeLimitIsExceeded = true;
-			break;
-		}
-
-		/*
-		 * Check if all tasks completed; otherwise wait as appropriate to
-		 * avoid a tight loop. That means we immediately continue if tasks are
-		 * ready to be processed further, and block when we're waiting for
-		 * network IO.
-		 */
-		if (completedTaskCount == taskCount)
-		{
-			allTasksCompleted = true;
-		}
-		else
-		{
-			MultiClientWait(waitInfo);
-		}
 
 #ifdef WIN32
 
-		/*
-		 * Don't call CHECK_FOR_INTERRUPTS because we want to clean up after ourselves,
-		 * calling pgwin32_dispatch_queued_signals sets QueryCancelPending so we leave
-		 * the loop.
-		 */
-		pgwin32_dispatch_queued_signals();
+			/*
+			 * Don't call CHECK_FOR_INTERRUPTS because we want to clean up after
+			 * ourselves, calling pgwin32_dispatch_queued_signals sets
+			 * QueryCancelPending so we leave the loop.
+			 */
+			pgwin32_dispatch_queued_signals();
 #endif
+		}
+	}
+	PG_CATCH();
+	{
+		MultiClientFreeWaitInfo(waitInfo);
+
+		PG_RE_THROW();
 	}
+	PG_END_TRY();
 
 	MultiClientFreeWaitInfo(waitInfo);
+	MemoryContextDelete(taskStepContext);
 
 	/*
 	 * We prevent cancel/die interrupts until we clean up connections to worker
@@ -221,14 +326,23 @@ MultiRealTimeExecute(Job *job)
 	 */
 	HOLD_INTERRUPTS();
 
-	/* cancel any active task executions */
-	taskExecutionCell = NULL;
-	foreach(taskExecutionCell, taskExecutionList)
+	/* cancel any active task executions, back to back */
+	forboth(taskCell, taskList, taskExecutionCell, taskExecutionList)
 	{
+		Task *task = (Task *) lfirst(taskCell);
 		TaskExecution *taskExecution = (TaskExecution *) lfirst(taskExecutionCell);
-		CancelTaskExecutionIfActive(taskExecution);
+
+		if (!TaskExecutionCompleted(taskExecution))
+		{
+			incompleteTaskList = lappend(incompleteTaskList, task);
+		}
+
+		cancelConnectionList = list_concat(cancelConnectionList,
+										   ActiveRequestConnectionList(taskExecution));
 	}
 
+	MultiClientCancelList(cancelConnectionList);
+
 	/*
 	 * If cancel might have been sent, give remote backends some time to flush
 	 * their responses. This avoids some broken pipe logs on the backend-side.
@@ -236,7 +350,7 @@ MultiRealTimeExecute(Job *job)
 	 * FIXME: This shouldn't be dependant on RemoteTaskCheckInterval; they're
 	 * unrelated type of delays.
 	 */
-	if (taskFailed || QueryCancelPending)
+	if (taskFailed || QueryCancelPending || taskRowLimitReached)
 	{
 		long sleepInterval = RemoteTaskCheckInterval * 1000L;
 		pg_usleep(sleepInterval);
@@ -269,6 +383,22 @@ MultiRealTimeExecute(Job *job)
 	{
 		CHECK_FOR_INTERRUPTS();
 	}
+	else if (taskRowLimitReached)
+	{
+		ListCell *incompleteTaskCell = NULL;
+
+		ereport(DEBUG4, (errmsg("cancelled %d tasks after receiving " INT64_FORMAT
+								" rows", list_length(incompleteTaskList),
+								taskRowLimit)));
+
+		/* discard any partial results of the cancelled tasks */
+		foreach(incompleteTaskCell, incompleteTaskList)
+		{
+			Task *task = (Task *) lfirst(incompleteTaskCell);
+
+			CreateEmptyTaskFile(task);
+		}
+	}
 }
 
 
@@ -387,6 +517,9 @@ ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 											 "connection after %u ms",
 											 NodeConnectionTimeout)));
 
+					RecordConnectionEstablishmentFailure(
+						MultiClientGetConnection(connectionId));
+
 					taskStatusArray[currentIndex] = EXEC_TASK_FAILED;
 				}
 			}
@@ -447,13 +580,12 @@ ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 		{
 			int32 connectionId = connectionIdArray[currentIndex];
 			MultiConnection *connection = MultiClientGetConnection(connectionId);
-			RemoteTransaction *transaction = &connection->remoteTransaction;
 
 			/*
-			 * If BEGIN was not yet sent on this connection, send it now.
-			 * Otherwise, continue with the task.
+			 * If BEGIN, or a savepoint the connection lacks, was not yet sent
+			 * on this connection, send it now. Otherwise, continue with the task.
 			 */
-			if (transaction->transactionState == REMOTE_TRANS_INVALID)
+			if (RemoteTransactionNeedsBegin(connection))
 			{
 				StartRemoteTransactionBegin(connection);
 				taskStatusArray[currentIndex] = EXEC_BEGIN_RUNNING;
@@ -505,10 +637,29 @@ ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 		{
 			int32 connectionId = connectionIdArray[currentIndex];
 			bool querySent = false;
+			char *settingsCommand =
+				MultiClientTaskSettingsCommand(connectionId, task->parallelWorkerCount);
 
 			/* construct new query to copy query results to stdout */
 			char *queryString = task->queryString;
 			StringInfo computeTaskQuery = makeStringInfo();
+
+			/* give the task the deadline of the statement and its parallel workers */
+			if (settingsCommand != NULL)
+			{
+				querySent = MultiClientSendQuery(connectionId, settingsCommand);
+				if (querySent)
+				{
+					taskStatusArray[currentIndex] = EXEC_SET_TASK_SETTINGS_RUNNING;
+				}
+				else
+				{
+					taskStatusArray[currentIndex] = EXEC_TASK_FAILED;
+				}
+
+				break;
+			}
+
 			if (BinaryMasterCopyFormat)
 			{
 				appendStringInfo(computeTaskQuery, COPY_QUERY_TO_STDOUT_BINARY,
@@ -524,6 +675,45 @@ ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 			if (querySent)
 			{
 				taskStatusArray[currentIndex] = EXEC_COMPUTE_TASK_RUNNING;
+				taskExecution->bytesReceived = 0;
+
+				if (CollectingTaskStats())
+				{
+					taskExecution->queryStartTime = GetCurrentTimestamp();
+				}
+			}
+			else
+			{
+				taskStatusArray[currentIndex] = EXEC_TASK_FAILED;
+			}
+
+			break;
+		}
+
+		case EXEC_SET_TASK_SETTINGS_RUNNING:
+		{
+			int32 connectionId = connectionIdArray[currentIndex];
+			ResultStatus resultStatus = MultiClientResultStatus(connectionId);
+			QueryStatus queryStatus = CLIENT_INVALID_QUERY;
+
+			/* check if the result of the command is in progress or unavailable */
+			if (resultStatus == CLIENT_RESULT_BUSY)
+			{
+				*executionStatus = TASK_STATUS_SOCKET_READ;
+				taskStatusArray[currentIndex] = EXEC_SET_TASK_SETTINGS_RUNNING;
+				break;
+			}
+			else if (resultStatus == CLIENT_RESULT_UNAVAILABLE)
+			{
+				taskStatusArray[currentIndex] = EXEC_TASK_FAILED;
+				break;
+			}
+
+			queryStatus = MultiClientQueryStatus(connectionId);
+			if (queryStatus == CLIENT_QUERY_DONE)
+			{
+				MultiClientTaskSettingsSet(connectionId, task->parallelWorkerCount);
+				taskStatusArray[currentIndex] = EXEC_COMPUTE_TASK_START;
 			}
 			else
 			{
@@ -602,16 +792,20 @@ ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 			int32 fileDesc = fileDescriptorArray[currentIndex];
 			int closed = -1;
 			uint64 bytesReceived = 0;
+			uint64 rowsReceived = 0;
 
 			/* copy data from worker node, and write to local file */
 			CopyStatus copyStatus = MultiClientCopyData(connectionId, fileDesc,
-														&bytesReceived);
+														&bytesReceived, &rowsReceived);
 
 			if (SubPlanLevel > 0)
 			{
 				executionStats->totalIntermediateResultSize += bytesReceived;
 			}
 
+			QueryStatsAddBytesReceived(bytesReceived);
+			taskExecution->bytesReceived += bytesReceived;
+
 			/* if worker node will continue to send more data, keep reading */
 			if (copyStatus == CLIENT_COPY_MORE)
 			{
@@ -626,6 +820,13 @@ ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 				if (closed >= 0)
 				{
 					taskStatusArray[currentIndex] = EXEC_TASK_DONE;
+					executionStats->completedTaskRowCount += rowsReceived;
+
+					RecordTaskExecutionStats(task, currentIndex,
+											 taskExecution->connectStartTime,
+											 taskExecution->queryStartTime,
+											 rowsReceived,
+											 taskExecution->bytesReceived);
 
 					/* we are done executing; we no longer need the connection */
 					MultiClientReleaseConnection(connectionId);
@@ -714,11 +915,70 @@ TaskExecutionCompleted(TaskExecution *taskExecution)
 }
 
 
-/* Iterates over all open connections, and cancels any active requests. */
+/*
+ * CreateEmptyTaskFile creates, or truncates, the result file of the given
+ * task, such that loading the task results yields no rows.
+ */
 static void
-CancelTaskExecutionIfActive(TaskExecution *taskExecution)
+CreateEmptyTaskFile(Task *task)
 {
+	StringInfo jobDirectoryName = MasterJobDirectoryName(task->jobId);
+	StringInfo taskFilename = TaskFilename(jobDirectoryName, task->taskId);
+	int fileFlags = (O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
+	int fileMode = (S_IRUSR | S_IWUSR);
+
+	int32 fileDescriptor = BasicOpenFilePerm(taskFilename->data, fileFlags, fileMode);
+	if (fileDescriptor < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m",
+							   taskFilename->data)));
+	}
+
+	close(fileDescriptor);
+}
+
+
+/*
+ * TaskRowLimit returns the number of task rows after which the coordinator
+ * does not need any more rows to compute the result of the given plan, or -1
+ * if all rows are needed. That is the case for a LIMIT on the coordinator if
+ * every task row ends up as one row of the result, i.e. the master query does
+ * not sort, group, aggregate, or filter. OFFSET rows are also needed.
+ */
+static int64
+TaskRowLimit(DistributedPlan *distributedPlan)
+{
+	Query *masterQuery = distributedPlan->masterQuery;
+
+	if (masterQuery == NULL)
+	{
+		return -1;
+	}
+
+	if (masterQuery->sortClause != NIL || masterQuery->groupClause != NIL ||
+		masterQuery->distinctClause != NIL || masterQuery->hasAggs ||
+		masterQuery->hasWindowFuncs || masterQuery->havingQual != NULL ||
+		masterQuery->jointree->quals != NULL ||
+		expression_returns_set((Node *) masterQuery->targetList))
+	{
+		return -1;
+	}
+
+	return MasterQueryRowLimit(masterQuery);
+}
+
+
+/*
+ * Iterates over all open connections, and returns the ones that have active
+ * requests that need to be cancelled.
+ */
+static List *
+ActiveRequestConnectionList(TaskExecution *taskExecution)
+{
+	List *connectionIdList = NIL;
 	uint32 nodeIndex = 0;
+
 	for (nodeIndex = 0; nodeIndex < taskExecution->nodeCount; nodeIndex++)
 	{
 		int32 connectionId = taskExecution->connectionIdArray[nodeIndex];
@@ -727,15 +987,20 @@ CancelTaskExecutionIfActive(TaskExecution *taskExecution)
 			TaskExecStatus *taskStatusArray = taskExecution->taskStatusArray;
 			TaskExecStatus taskStatus = taskStatusArray[nodeIndex];
 
-			CancelRequestIfActive(taskStatus, connectionId);
+			if (RequestIsActive(taskStatus, connectionId))
+			{
+				connectionIdList = lappend_int(connectionIdList, connectionId);
+			}
 		}
 	}
+
+	return connectionIdList;
 }
 
 
-/* Helper function to cancel an ongoing request, if any. */
-static void
-CancelRequestIfActive(TaskExecStatus taskStatus, int connectionId)
+/* Helper function to check whether there is an ongoing request to cancel. */
+static bool
+RequestIsActive(TaskExecStatus taskStatus, int connectionId)
 {
 	/*
 	 * We use the task status to determine if we have an active request being
@@ -746,13 +1011,15 @@ CancelRequestIfActive(TaskExecStatus taskStatus, int connectionId)
 		ResultStatus resultStatus = MultiClientResultStatus(connectionId);
 		if (resultStatus == CLIENT_RESULT_BUSY)
 		{
-			MultiClientCancel(connectionId);
+			return true;
 		}
 	}
 	else if (taskStatus == EXEC_COMPUTE_TASK_COPYING)
 	{
-		MultiClientCancel(connectionId);
+		return true;
 	}
+
+	return false;
 }
 
 
@@ -835,6 +1102,8 @@ WorkerHashEnter(HTAB *workerHash, char *nodeName, uint32 nodePort)
 
 	memcpy(workerNodeState, &workerNodeKey, sizeof(WorkerNodeState));
 	workerNodeState->openConnectionCount = 0;
+	workerNodeState->completedTaskCount = 0;
+	workerNodeState->averageTaskTime = 0.0;
 
 	return workerNodeState;
 }
@@ -846,6 +1115,24 @@ WorkerHashEnter(HTAB *workerHash, char *nodeName, uint32 nodePort)
  */
 static WorkerNodeState *
 WorkerHashLookup(HTAB *workerHash, const char *nodeName, uint32 nodePort)
+{
+	WorkerNodeState *workerNodeState = WorkerHashFind(workerHash, nodeName, nodePort);
+	if (workerNodeState == NULL)
+	{
+		ereport(ERROR, (errmsg("could not find worker node state for node \"%s:%u\"",
+							   nodeName, nodePort)));
+	}
+
+	return workerNodeState;
+}
+
+
+/*
+ * WorkerHashFind returns the worker node state that corresponds to the given
+ * node name and port number, or NULL if the hash has no such entry.
+ */
+static WorkerNodeState *
+WorkerHashFind(HTAB *workerHash, const char *nodeName, uint32 nodePort)
 {
 	bool handleFound = false;
 	WorkerNodeState *workerNodeState = NULL;
@@ -857,11 +1144,6 @@ WorkerHashLookup(HTAB *workerHash, const char *nodeName, uint32 nodePort)
 
 	workerNodeState = (WorkerNodeState *) hash_search(workerHash, (void *) &workerNodeKey,
 													  HASH_FIND, &handleFound);
-	if (workerNodeState == NULL)
-	{
-		ereport(ERROR, (errmsg("could not find worker node state for node \"%s:%u\"",
-							   nodeName, nodePort)));
-	}
 
 	return workerNodeState;
 }
@@ -931,6 +1213,38 @@ MasterConnectionsExhausted(HTAB *workerHash)
 }
 
 
+/*
+ * SharedPoolExhausted determines if all backends together hold as many
+ * connections to the worker as citus.max_shared_pool_size allows, such that
+ * starting another task would exceed the limit. Concurrent queries then share
+ * the worker's capacity, rather than each of them opening a connection per
+ * shard. We only throttle while the query has other connections open, since
+ * the tasks running on those make progress and eventually release them. A
+ * query without open connections instead waits for a slot when connecting,
+ * which does not keep connections that other backends may be waiting for.
+ */
+static bool
+SharedPoolExhausted(HTAB *workerHash, WorkerNodeState *workerNodeState)
+{
+	bool reachedLimit = false;
+	int sharedConnectionCount = 0;
+
+	if (!SharedConnectionLimitEnabled() || TotalOpenConnectionCount(workerHash) == 0)
+	{
+		return false;
+	}
+
+	sharedConnectionCount = SharedConnectionCount(workerNodeState->workerName,
+												  workerNodeState->workerPort);
+	if (sharedConnectionCount >= MaxSharedPoolSize)
+	{
+		reachedLimit = true;
+	}
+
+	return reachedLimit;
+}
+
+
 /*
  * TotalOpenConnectionCount counts the total number of open connections across all the
  * workers.
@@ -973,6 +1287,111 @@ UpdateConnectionCounter(WorkerNodeState *workerNode, ConnectAction connectAction
 }
 
 
+/*
+ * AssignTaskToLeastLoadedWorker points the given task execution, which has not
+ * started yet, at the placement whose worker is expected to complete it first.
+ * The estimate multiplies the number of tasks running on a worker by the
+ * average time tasks took on it so far. Workers that did not complete a task
+ * yet are assumed to be as slow as the slowest measured worker, and workers
+ * that exhausted their connections are skipped. Since this is re-evaluated
+ * while a task is throttled, idle workers holding another replica steal the
+ * tasks queued up for busy workers.
+ */
+static void
+AssignTaskToLeastLoadedWorker(HTAB *workerHash, Task *task,
+							  TaskExecution *taskExecution)
+{
+	List *taskPlacementList = task->taskPlacementList;
+	ListCell *taskPlacementCell = NULL;
+	uint32 placementIndex = 0;
+	uint32 bestPlacementIndex = taskExecution->currentNodeIndex;
+	double bestExpectedTime = -1.0;
+	double slowestTaskTime = 0.0;
+
+	/* a single placement leaves no choice */
+	if (list_length(taskPlacementList) < 2)
+	{
+		return;
+	}
+
+	foreach(taskPlacementCell, taskPlacementList)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
+		WorkerNodeState *workerNodeState = WorkerHashFind(workerHash,
+														  taskPlacement->nodeName,
+														  taskPlacement->nodePort);
+
+		if (workerNodeState != NULL && workerNodeState->completedTaskCount > 0)
+		{
+			slowestTaskTime = Max(slowestTaskTime, workerNodeState->averageTaskTime);
+		}
+	}
+
+	foreach(taskPlacementCell, taskPlacementList)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
+		WorkerNodeState *workerNodeState = WorkerHashFind(workerHash,
+														  taskPlacement->nodeName,
+														  taskPlacement->nodePort);
+		double taskTime = slowestTaskTime;
+		double expectedTime = 0.0;
+
+		if (workerNodeState == NULL || WorkerConnectionsExhausted(workerNodeState) ||
+			SharedPoolExhausted(workerHash, workerNodeState))
+		{
+			placementIndex++;
+			continue;
+		}
+
+		if (workerNodeState->completedTaskCount > 0)
+		{
+			taskTime = workerNodeState->averageTaskTime;
+		}
+
+		/* add one millisecond to still tell workers apart before measurements */
+		expectedTime = (workerNodeState->openConnectionCount + 1) * (taskTime + 1.0);
+		if (bestExpectedTime < 0.0 || expectedTime < bestExpectedTime)
+		{
+			bestExpectedTime = expectedTime;
+			bestPlacementIndex = placementIndex;
+		}
+
+		placementIndex++;
+	}
+
+	taskExecution->currentNodeIndex = bestPlacementIndex;
+}
+
+
+/*
+ * UpdateWorkerTaskTime adds the duration of the given, just completed task
+ * execution to the moving average of task durations on its worker.
+ */
+static void
+UpdateWorkerTaskTime(WorkerNodeState *workerNodeState, TaskExecution *taskExecution)
+{
+	long durationSeconds = 0;
+	int durationMicroseconds = 0;
+	double taskTime = 0.0;
+
+	TimestampDifference(taskExecution->connectStartTime, GetCurrentTimestamp(),
+						&durationSeconds, &durationMicroseconds);
+	taskTime = durationSeconds * 1000.0 + durationMicroseconds / 1000.0;
+
+	if (workerNodeState->completedTaskCount == 0)
+	{
+		workerNodeState->averageTaskTime = taskTime;
+	}
+	else
+	{
+		workerNodeState->averageTaskTime +=
+			TASK_TIME_AVERAGE_WEIGHT * (taskTime - workerNodeState->averageTaskTime);
+	}
+
+	workerNodeState->completedTaskCount++;
+}
+
+
 /*
  * RealTimeExecScan is a callback function which returns next tuple from a real-time
  * execution. In the first call, it executes distributed real-time plan and loads
@@ -989,14 +1408,21 @@ RealTimeExecScan(CustomScanState *node)
 	{
 		DistributedPlan *distributedPlan = scanState->distributedPlan;
 		Job *workerJob = distributedPlan->workerJob;
+		CitusScanState *previousScanState = NULL;
 
 		/* we are taking locks on partitions of partitioned tables */
 		LockPartitionsInRelationList(distributedPlan->relationIdList, AccessShareLock);
 
 		PrepareMasterJobDirectory(workerJob);
 
+		QueryStatsRemoteExecutionStart(scanState);
 		ExecuteSubPlans(distributedPlan);
-		MultiRealTimeExecute(workerJob);
+
+		previousScanState = BeginTaskStatsCollection(scanState);
+		MultiRealTimeExecute(workerJob, TaskRowLimit(distributedPlan));
+		EndTaskStatsCollection(previousScanState);
+
+		QueryStatsRemoteExecutionEnd();
 
 		LoadTuplesIntoTupleStore(scanState, workerJob);
 
@@ -17,7 +17,9 @@
 #include "funcapi.h"
 #include "libpq-fe.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 
+#include <math.h>
 #include <string.h>
 
 #include "access/htup.h"
@@ -26,13 +28,16 @@
 #include "access/tupdesc.h"
 #include "access/xact.h"
 #include "catalog/pg_type.h"
+#include "distributed/batched_replication.h"
 #include "distributed/citus_clauses.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/connection_management.h"
 #include "distributed/deparse_shard_query.h"
 #include "distributed/listutils.h"
+#include "distributed/local_executor.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/multi_copy.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_physical_planner.h"
@@ -41,11 +46,18 @@
 #include "distributed/multi_router_planner.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/placement_connection.h"
+#include "distributed/query_stats.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/relay_utility.h"
 #include "distributed/remote_commands.h"
 #include "distributed/remote_transaction.h"
 #include "distributed/resource_lock.h"
+#include "distributed/result_cache.h"
+#include "distributed/secondary_node_routing.h"
+#include "distributed/shard_access_stats.h"
+#include "distributed/task_execution_stats.h"
+#include "distributed/tenant_admission.h"
+#include "distributed/version_compat.h"
 #include "executor/execdesc.h"
 #include "executor/executor.h"
 #include "executor/instrument.h"
@@ -57,7 +69,9 @@
 #include "nodes/parsenodes.h"
 #include "nodes/pg_list.h"
 #include "nodes/plannodes.h"
+#include "optimizer/clauses.h"
 #include "storage/ipc.h"
+#include "storage/latch.h"
 #include "storage/lock.h"
 #include "tcop/dest.h"
 #include "utils/elog.h"
@@ -67,6 +81,7 @@
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/palloc.h"
+#include "utils/timestamp.h"
 #include "utils/tuplestore.h"
 
 
@@ -76,31 +91,172 @@ bool AllModificationsCommutative = false;
 /* we've deprecated this flag, keeping here for some time not to break existing users */
 bool EnableDeadlockPrevention = true;
 
+/* request task results in binary format when all column types allow it */
+bool EnableBinaryProtocol = false;
+
+/* return rows of router SELECTs directly from the connection, if possible */
+bool EnableResultStreaming = false;
+
+/* fetch rows of router SELECTs in bulk by wrapping the query in COPY */
+bool EnableCopyResultTransfer = false;
+
+/* run router SELECTs on connections outside the transaction without BEGIN */
+bool SkipRemoteBeginForSelects = false;
+
+/* latency percentile after which router SELECTs are sent to another replica */
+int HedgedReadPercentile = 0;
+
+/* response times of recent router SELECTs in milliseconds, used for hedging */
+static double ReadLatencyHistory[HEDGED_READ_HISTORY_SIZE];
+static int ReadLatencyCount = 0;
+static int NextReadLatencyIndex = 0;
+
+
+/*
+ * RouterSelectStream holds the state of a router SELECT whose rows are
+ * returned to the executor directly from the single-row mode connection,
+ * instead of being collected into a tuple store first.
+ */
+typedef struct RouterSelectStream
+{
+	/* connection the rows are read from, NULL once all rows are read */
+	MultiConnection *connection;
+
+	/* first result, read while checking whether the query succeeded */
+	PGresult *pendingResult;
+
+	/* metadata for building tuples from text or binary results */
+	AttInMetadata *attributeInputMetadata;
+	FmgrInfo *receiveFunctions;
+	Oid *typeIoParams;
+	char **columnArray;
+
+	/* memory context that is reset after building each tuple */
+	MemoryContext tupleContext;
+} RouterSelectStream;
+
+
+/* progress of a task of a multi-shard modification whose rows are streamed */
+typedef enum MultiModifyTaskState
+{
+	MODIFY_TASK_PENDING,
+	MODIFY_TASK_SENT,
+	MODIFY_TASK_DONE
+} MultiModifyTaskState;
+
+
+/*
+ * MultiModifyStream holds the state of a multi-shard modification whose
+ * RETURNING rows are returned to the executor as they arrive, one task after
+ * another, instead of being collected into a tuple store first. The rows of
+ * the current task are read through the scan's RouterSelectStream. Tasks run
+ * in parallel, except that a task whose connection is used by an earlier task
+ * is only sent once all rows of that task were read.
+ */
+typedef struct MultiModifyStream
+{
+	List *taskList;
+	int taskCount;
+	HTAB *shardConnectionHash;
+	MultiConnection **taskConnections;
+	MultiModifyTaskState *taskStates;
+
+	/* index of the task whose rows are read, -1 once all rows are read */
+	int currentTaskIndex;
+
+	ParamListInfo paramListInfo;
+	bool binaryResults;
+} MultiModifyStream;
+
+
+/*
+ * CopyResultReceiveState holds the state of reading the rows of a task query
+ * that was wrapped in COPY .. TO STDOUT from the connection, which are handed
+ * to the COPY parser through ReceiveCopyResultData.
+ */
+typedef struct CopyResultReceiveState
+{
+	MultiConnection *connection;
+
+	/* CopyData message that is currently passed to the parser */
+	char *rowBuffer;
+	int rowLength;
+	int rowOffset;
+
+	/* whether all rows were received or receiving them failed */
+	bool copyDone;
+	bool copyFailed;
+
+	DistributedExecutionStats *executionStats;
+} CopyResultReceiveState;
+
+
+/* COPY result that is currently being read by ReceiveCopyResultData */
+static CopyResultReceiveState *CurrentCopyResult = NULL;
+
 /* functions needed during run phase */
+static DistributedPlan * CopyDistributedPlanForExecution(DistributedPlan *distributedPlan,
+														 bool copyJobQuery);
 static void AcquireMetadataLocks(List *taskList);
-static ShardPlacementAccess * CreatePlacementAccess(ShardPlacement *placement,
-													ShardPlacementAccessType accessType);
 static void ExecuteSingleModifyTask(CitusScanState *scanState, Task *task,
 									bool multipleTasks, bool expectResults);
 static void ExecuteSingleSelectTask(CitusScanState *scanState, Task *task);
+static bool StartResultStream(CitusScanState *scanState, MultiConnection *connection,
+							  bool failOnError);
+static void SetTaskParallelWorkers(MultiConnection *connection, Task *task);
+static bool CanHedgeSelectTask(Task *task);
+static bool CanSelectOutsideRemoteTransaction(CitusScanState *scanState);
+static MultiConnection * WaitForHedgedSelectResponse(MultiConnection *connection,
+													 ListCell *taskPlacementCell,
+													 Task *task,
+													 ParamListInfo paramListInfo,
+													 bool binaryResults);
+static long HedgedReadDelay(void);
+static int CompareLatencies(const void *leftElement, const void *rightElement);
+static void RecordReadLatency(TimestampTz sendTime);
+static int WaitForFirstResponse(MultiConnection **connectionArray, int connectionCount,
+								long timeout);
+static void CancelAndDiscardResults(MultiConnection *connection);
+static TupleTableSlot * ReturnTupleFromStream(CitusScanState *scanState);
+static void EndResultStream(RouterSelectStream *stream);
+static bool CanStreamModifyTasks(List *taskList);
+static void StartMultiModifyStream(CitusScanState *scanState, List *taskList);
+static TupleTableSlot * ReturnTupleFromModifyStream(CitusScanState *scanState);
+static void SendModifyStreamTask(MultiModifyStream *stream, int taskIndex);
+static void StartNextModifyStreamTask(CitusScanState *scanState);
 static List * GetModifyConnections(Task *task, bool markCritical);
 static void ExecuteMultipleTasks(CitusScanState *scanState, List *taskList,
 								 bool isModificationQuery, bool expectResults);
 static int64 ExecuteModifyTasks(List *taskList, bool expectResults,
 								ParamListInfo paramListInfo, CitusScanState *scanState);
-static void AcquireExecutorShardLock(Task *task, CmdType commandType);
-static void AcquireExecutorMultiShardLocks(List *taskList);
+static HTAB * BeginModifyTasks(List *taskList);
 static bool RequiresConsistentSnapshot(Task *task);
-static void ExtractParametersFromParamListInfo(ParamListInfo paramListInfo,
-											   Oid **parameterTypes,
-											   const char ***parameterValues);
+static LOCKMODE MultiShardTaskLockMode(Task *task);
+static Oid TaskListTable(List *taskList);
+static bool UseBinaryResultFormat(CitusScanState *scanState);
+static bool UseCopyResultTransfer(CitusScanState *scanState,
+								  ParamListInfo paramListInfo, bool hedgeReads);
 static bool SendQueryInSingleRowMode(MultiConnection *connection, char *query,
-									 ParamListInfo paramListInfo);
+									 ParamListInfo paramListInfo, bool binaryResults,
+									 bool beginTransaction, bool prepareStatement);
 static bool StoreQueryResult(CitusScanState *scanState, MultiConnection *connection,
 							 bool failOnError, int64 *rows,
 							 DistributedExecutionStats *executionStats);
+#if (PG_VERSION_NUM >= 100000)
+static bool StoreCopyQueryResult(CitusScanState *scanState, MultiConnection *connection,
+								 bool binaryResults, bool failOnError, int64 *rows,
+								 DistributedExecutionStats *executionStats);
+static int ReceiveCopyResultData(void *outbuf, int minread, int maxread);
+#endif
 static bool ConsumeQueryResult(MultiConnection *connection, bool failOnError,
 							   int64 *rows);
+static void GetColumnReceiveFunctions(TupleDesc tupleDescriptor,
+									  FmgrInfo **receiveFunctions,
+									  Oid **typeIoParams);
+static HeapTuple BuildTupleFromBinaryResult(PGresult *result, int rowIndex,
+											TupleDesc tupleDescriptor,
+											FmgrInfo *receiveFunctions,
+											Oid *typeIoParams);
 
 
 /*
@@ -143,12 +299,18 @@ AcquireMetadataLocks(List *taskList)
  * to communicate that the application is only generating commutative
  * UPDATE/DELETE/UPSERT commands and exclusive locks are unnecessary.
  */
-static void
+void
 AcquireExecutorShardLock(Task *task, CmdType commandType)
 {
 	LOCKMODE lockMode = NoLock;
 	int64 shardId = task->anchorShardId;
 
+	/* cached results of the shard no longer reflect its contents */
+	if (commandType != CMD_SELECT && shardId != INVALID_SHARD_ID)
+	{
+		InvalidateCachedShardResults(shardId);
+	}
+
 	if (commandType == CMD_SELECT || list_length(task->taskPlacementList) == 1)
 	{
 		/*
@@ -263,49 +425,52 @@ AcquireExecutorShardLock(Task *task, CmdType commandType)
  * in the same order on all placements. It does not conflict with
  * RowExclusiveLock, which is normally obtained by single-shard, commutative
  * writes.
+ *
+ * When the tasks modify all shards of a table, the shards are locked as a
+ * whole using a single lock in the strongest of the lock modes of the tasks,
+ * rather than taking a lock per shard.
  */
-static void
+void
 AcquireExecutorMultiShardLocks(List *taskList)
 {
 	ListCell *taskCell = NULL;
+	bool allShardsLocked = false;
+	Oid relationId = TaskListTable(taskList);
 
-	foreach(taskCell, taskList)
+	if (OidIsValid(relationId))
 	{
-		Task *task = (Task *) lfirst(taskCell);
-		LOCKMODE lockMode = NoLock;
+		LOCKMODE tableLockMode = NoLock;
 
-		if (AllModificationsCommutative || list_length(task->taskPlacementList) == 1)
+		foreach(taskCell, taskList)
 		{
-			/*
-			 * When all writes are commutative then we only need to prevent multi-shard
-			 * commands from running concurrently with each other and with commands
-			 * that are explicitly non-commutative. When there is no replication then
-			 * we only need to prevent concurrent multi-shard commands.
-			 *
-			 * In either case, ShareUpdateExclusive has the desired effect, since
-			 * it conflicts with itself and ExclusiveLock (taken by non-commutative
-			 * writes).
-			 */
+			Task *task = (Task *) lfirst(taskCell);
 
-			lockMode = ShareUpdateExclusiveLock;
+			tableLockMode = Max(tableLockMode, MultiShardTaskLockMode(task));
 		}
-		else
+
+		allShardsLocked = LockTableShardResources(relationId, tableLockMode);
+	}
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		/* cached results of the shard no longer reflect its contents */
+		InvalidateCachedShardResults(task->anchorShardId);
+
+		if (!allShardsLocked)
 		{
+			LOCKMODE lockMode = MultiShardTaskLockMode(task);
+
 			/*
-			 * When there is replication, prevent all concurrent writes to the same
-			 * shards to ensure the writes are ordered.
+			 * If we are dealing with a partition we are also taking locks on
+			 * parent table to prevent deadlocks on concurrent operations on a
+			 * partition and its parent.
 			 */
-
-			lockMode = ExclusiveLock;
+			LockParentShardResourceIfPartition(task->anchorShardId, lockMode);
+			LockShardResource(task->anchorShardId, lockMode);
 		}
 
-		/*
-		 * If we are dealing with a partition we are also taking locks on parent table
-		 * to prevent deadlocks on concurrent operations on a partition and its parent.
-		 */
-		LockParentShardResourceIfPartition(task->anchorShardId, lockMode);
-		LockShardResource(task->anchorShardId, lockMode);
-
 		/*
 		 * If the task has a subselect, then we may need to lock the shards from which
 		 * the query selects as well to prevent the subselects from seeing different
@@ -327,6 +492,91 @@ AcquireExecutorMultiShardLocks(List *taskList)
 }
 
 
+/*
+ * MultiShardTaskLockMode returns the mode in which the anchor shard of a task
+ * of a multi-shard modification is locked, as explained in the comment on
+ * AcquireExecutorMultiShardLocks.
+ */
+static LOCKMODE
+MultiShardTaskLockMode(Task *task)
+{
+	LOCKMODE lockMode = NoLock;
+
+	if (AllModificationsCommutative || list_length(task->taskPlacementList) == 1)
+	{
+		/*
+		 * When all writes are commutative then we only need to prevent multi-shard
+		 * commands from running concurrently with each other and with commands
+		 * that are explicitly non-commutative. When there is no replication then
+		 * we only need to prevent concurrent multi-shard commands.
+		 *
+		 * In either case, ShareUpdateExclusive has the desired effect, since
+		 * it conflicts with itself and ExclusiveLock (taken by non-commutative
+		 * writes).
+		 */
+
+		lockMode = ShareUpdateExclusiveLock;
+	}
+	else
+	{
+		/*
+		 * When there is replication, prevent all concurrent writes to the same
+		 * shards to ensure the writes are ordered.
+		 */
+
+		lockMode = ExclusiveLock;
+	}
+
+	return lockMode;
+}
+
+
+/*
+ * TaskListTable returns the table whose shards are the anchor shards of the
+ * given tasks if the tasks modify all shards of a single table that is not a
+ * partition, and InvalidOid otherwise.
+ */
+static Oid
+TaskListTable(List *taskList)
+{
+	ListCell *taskCell = NULL;
+	Task *firstTask = NULL;
+	DistTableCacheEntry *cacheEntry = NULL;
+	Oid relationId = InvalidOid;
+
+	if (list_length(taskList) < 2)
+	{
+		return InvalidOid;
+	}
+
+	firstTask = (Task *) linitial(taskList);
+	relationId = ShardRelationId(firstTask->anchorShardId);
+	if (!OidIsValid(relationId))
+	{
+		return InvalidOid;
+	}
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (ShardRelationId(task->anchorShardId) != relationId)
+		{
+			return InvalidOid;
+		}
+	}
+
+	cacheEntry = DistributedTableCacheEntry(relationId);
+	if (cacheEntry->shardIntervalArrayLength != list_length(taskList) ||
+		PartitionTable(relationId))
+	{
+		return InvalidOid;
+	}
+
+	return relationId;
+}
+
+
 /*
  * RequiresConsistentSnapshot returns true if the given task need to take
  * the necessary locks to ensure that a subquery in the INSERT ... SELECT
@@ -402,10 +652,15 @@ CitusModifyBeginScan(CustomScanState *node, EState *estate, int eflags)
 
 	/*
 	 * We must not change the distributed plan since it may be reused across multiple
-	 * executions of a prepared statement. Instead we create a deep copy that we only
-	 * use for the current execution.
+	 * executions of a prepared statement. Instead we create a copy of the parts that
+	 * we change during the current execution. The job query is only modified when
+	 * functions are evaluated on the coordinator.
 	 */
-	distributedPlan = scanState->distributedPlan = copyObject(scanState->distributedPlan);
+	distributedPlan = scanState->distributedPlan;
+	distributedPlan = CopyDistributedPlanForExecution(distributedPlan,
+													  distributedPlan->workerJob->
+													  requiresMasterEvaluation);
+	scanState->distributedPlan = distributedPlan;
 
 	workerJob = distributedPlan->workerJob;
 	jobQuery = workerJob->jobQuery;
@@ -458,6 +713,50 @@ CitusModifyBeginScan(CustomScanState *node, EState *estate, int eflags)
 }
 
 
+/*
+ * CopyDistributedPlanForExecution returns a copy of a (possibly cached)
+ * distributed plan that the router executor can modify during a single
+ * execution. Deep copying the whole plan on every execution of a prepared
+ * statement is costly for plans with many tasks or a large query tree, while
+ * the executor only replaces the task list, the query strings and placement
+ * lists of tasks and, when functions or parameters are evaluated, the job
+ * query. We therefore only copy the plan, the worker job and the tasks
+ * themselves, and copy the job query if copyJobQuery is set. All other parts
+ * are shared with the cached plan and must not be modified.
+ */
+static DistributedPlan *
+CopyDistributedPlanForExecution(DistributedPlan *distributedPlan, bool copyJobQuery)
+{
+	DistributedPlan *executionPlan = palloc(sizeof(DistributedPlan));
+	Job *executionJob = palloc(sizeof(Job));
+	List *executionTaskList = NIL;
+	ListCell *taskCell = NULL;
+
+	memcpy(executionPlan, distributedPlan, sizeof(DistributedPlan));
+	memcpy(executionJob, distributedPlan->workerJob, sizeof(Job));
+
+	foreach(taskCell, executionJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		Task *executionTask = palloc(sizeof(Task));
+
+		memcpy(executionTask, task, sizeof(Task));
+		executionTaskList = lappend(executionTaskList, executionTask);
+	}
+
+	executionJob->taskList = executionTaskList;
+
+	if (copyJobQuery)
+	{
+		executionJob->jobQuery = copyObject(executionJob->jobQuery);
+	}
+
+	executionPlan->workerJob = executionJob;
+
+	return executionPlan;
+}
+
+
 /*
  * RouterSequentialModifyExecScan executes 0 or more modifications on a
  * distributed table sequentially and returns results if there are any.
@@ -476,6 +775,8 @@ RouterSequentialModifyExecScan(CustomScanState *node)
 		List *taskList = workerJob->taskList;
 		ListCell *taskCell = NULL;
 		bool multipleTasks = list_length(taskList) > 1;
+		EState *executorState = scanState->customScanState.ss.ps.state;
+		CitusScanState *previousScanState = NULL;
 
 		/*
 		 * We could naturally handle function-based transactions (i.e. those using
@@ -488,13 +789,43 @@ RouterSequentialModifyExecScan(CustomScanState *node)
 			BeginOrContinueCoordinatedTransaction();
 		}
 
+		QueryStatsRemoteExecutionStart(scanState);
+		previousScanState = BeginTaskStatsCollection(scanState);
+
+		/* single shard modifications count towards the limits of their tenant */
+		if (!multipleTasks && taskList != NIL)
+		{
+			scanState->tenantAdmission = AdmitTenantQuery((Task *) linitial(taskList));
+		}
+
 		foreach(taskCell, taskList)
 		{
 			Task *task = (Task *) lfirst(taskCell);
+			uint64 processedRowCount = executorState->es_processed;
+			TimestampTz startTime = 0;
+			instr_time taskStartTime;
+
+			INSTR_TIME_SET_CURRENT(taskStartTime);
+
+			if (CollectingTaskStats())
+			{
+				startTime = GetCurrentTimestamp();
+			}
 
 			ExecuteSingleModifyTask(scanState, task, multipleTasks, hasReturning);
+
+			RecordTaskShardAccess(task, SHARD_ACCESS_WRITE, &taskStartTime);
+			RecordTaskExecutionStats(task, 0, startTime, 0,
+									 executorState->es_processed - processedRowCount,
+									 0);
 		}
 
+		EndTaskStatsCollection(previousScanState);
+		QueryStatsRemoteExecutionEnd();
+
+		ReleaseTenantAdmission(scanState->tenantAdmission);
+		scanState->tenantAdmission = NULL;
+
 		scanState->finishedRemoteScan = true;
 	}
 
@@ -504,10 +835,33 @@ RouterSequentialModifyExecScan(CustomScanState *node)
 }
 
 
+/*
+ * RouterMultiModifyBeginScan prepares the multi-shard modification like
+ * CitusModifyBeginScan, and decides whether its RETURNING rows can be
+ * streamed from the connections, which requires citus.enable_result_streaming
+ * and a scan that is only read forward once, as for router SELECTs.
+ */
+void
+RouterMultiModifyBeginScan(CustomScanState *node, EState *estate, int eflags)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+	int rescanFlags = EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK | EXEC_FLAG_REWIND;
+
+	CitusModifyBeginScan(node, estate, eflags);
+
+	if (EnableResultStreaming && scanState->distributedPlan->hasReturning &&
+		SubPlanLevel == 0 && (eflags & rescanFlags) == 0 && estate->es_instrument == 0)
+	{
+		scanState->modifyStream = palloc0(sizeof(MultiModifyStream));
+	}
+}
+
+
 /*
  * RouterMultiModifyExecScan executes a list of tasks on remote nodes, retrieves
  * the results and, if RETURNING is used, stores them in custom scan's tuple store.
- * Then, it returns tuples one by one from this tuple store.
+ * Then, it returns tuples one by one from this tuple store. When streaming, the
+ * RETURNING rows are instead returned one by one as they arrive.
  */
 TupleTableSlot *
 RouterMultiModifyExecScan(CustomScanState *node)
@@ -523,148 +877,1293 @@ RouterMultiModifyExecScan(CustomScanState *node)
 		bool hasReturning = distributedPlan->hasReturning;
 		bool isModificationQuery = true;
 
-		ExecuteMultipleTasks(scanState, taskList, isModificationQuery, hasReturning);
+		QueryStatsRemoteExecutionStart(scanState);
+
+		if (scanState->modifyStream != NULL && CanStreamModifyTasks(taskList))
+		{
+			StartMultiModifyStream(scanState, taskList);
+		}
+		else
+		{
+			scanState->modifyStream = NULL;
+			ExecuteMultipleTasks(scanState, taskList, isModificationQuery,
+								 hasReturning);
+		}
+
+		QueryStatsRemoteExecutionEnd();
 
 		scanState->finishedRemoteScan = true;
 	}
 
-	resultSlot = ReturnTupleFromTuplestore(scanState);
+	if (scanState->modifyStream != NULL)
+	{
+		resultSlot = ReturnTupleFromModifyStream(scanState);
+	}
+	else
+	{
+		resultSlot = ReturnTupleFromTuplestore(scanState);
+	}
 
 	return resultSlot;
 }
 
 
 /*
- * RouterSelectExecScan executes a single select task on the remote node,
- * retrieves the results and stores them in custom scan's tuple store. Then, it
- * returns tuples one by one from this tuple store.
+ * RouterMultiModifyEndScan reads the RETURNING rows of a streaming multi-shard
+ * modification that were not returned, such that all tasks finish and their
+ * errors are raised before the transaction commits. It also cleans up the
+ * tuple store.
  */
-TupleTableSlot *
-RouterSelectExecScan(CustomScanState *node)
+void
+RouterMultiModifyEndScan(CustomScanState *node)
 {
 	CitusScanState *scanState = (CitusScanState *) node;
-	TupleTableSlot *resultSlot = NULL;
 
-	if (!scanState->finishedRemoteScan)
+	if (scanState->modifyStream != NULL && scanState->finishedRemoteScan)
 	{
-		DistributedPlan *distributedPlan = scanState->distributedPlan;
-		Job *workerJob = distributedPlan->workerJob;
-		List *taskList = workerJob->taskList;
+		TupleTableSlot *resultSlot = NULL;
 
-		/* we are taking locks on partitions of partitioned tables */
-		LockPartitionsInRelationList(distributedPlan->relationIdList, AccessShareLock);
+		do {
+			resultSlot = ReturnTupleFromModifyStream(scanState);
+		} while (!TupIsNull(resultSlot));
+	}
 
-		ExecuteSubPlans(distributedPlan);
+	if (scanState->tuplestorestate)
+	{
+		tuplestore_end(scanState->tuplestorestate);
+		scanState->tuplestorestate = NULL;
+	}
+}
 
-		if (list_length(taskList) > 0)
-		{
-			Task *task = (Task *) linitial(taskList);
 
-			ExecuteSingleSelectTask(scanState, task);
-		}
+/*
+ * PruneDeferredRouterSelect builds the task list of a router SELECT whose shard
+ * pruning was deferred to the executor, because the distribution key value was
+ * a parameter without a value during planning. We evaluate the parameters in
+ * the filters of the query and then prune the shards like the planner would.
+ */
+void
+PruneDeferredRouterSelect(CitusScanState *scanState)
+{
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	Job *workerJob = distributedPlan->workerJob;
+	PlanState *planState = &(scanState->customScanState.ss.ps);
+	FromExpr *joinTree = NULL;
+	DeferredErrorMessage *planningError = NULL;
 
-		scanState->finishedRemoteScan = true;
+	if (workerJob == NULL || !workerJob->deferredPruning)
+	{
+		return;
 	}
 
-	resultSlot = ReturnTupleFromTuplestore(scanState);
+	/*
+	 * The distributed plan is cached and reused across executions, so we
+	 * only modify a copy of it. The filters of the job query are modified.
+	 */
+	distributedPlan = CopyDistributedPlanForExecution(distributedPlan, true);
+	scanState->distributedPlan = distributedPlan;
+	workerJob = distributedPlan->workerJob;
 
-	return resultSlot;
+	joinTree = workerJob->jobQuery->jointree;
+	joinTree->quals = EvaluateExternalParams(joinTree->quals, planState);
+
+	workerJob->taskList = FastPathRouterTaskList(workerJob->jobQuery, &planningError);
+	if (planningError != NULL)
+	{
+		RaiseDeferredError(planningError, ERROR);
+	}
 }
 
 
 /*
- * ExecuteSingleSelectTask executes the task on the remote node, retrieves the
- * results and stores them in a tuple store.
- *
- * If the task fails on one of the placements, the function retries it on
- * other placements or errors out if the query fails on all placements.
+ * ResolveReadPlacementNodes points the task placements of a SELECT plan to the
+ * nodes that the current transaction reads from. The node that reads of a
+ * group go to depends on the transaction when reading from secondaries, while
+ * plans are cached across transactions. Plans with dependent jobs are left
+ * alone, since their nodes are assigned by the task tracker executor.
  */
-static void
-ExecuteSingleSelectTask(CitusScanState *scanState, Task *task)
+void
+ResolveReadPlacementNodes(CitusScanState *scanState)
 {
-	ParamListInfo paramListInfo =
-		scanState->customScanState.ss.ps.state->es_param_list_info;
-	List *taskPlacementList = task->taskPlacementList;
-	ListCell *taskPlacementCell = NULL;
-	char *queryString = task->queryString;
-	List *relationShardList = task->relationShardList;
-	DistributedExecutionStats executionStats = { 0 };
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	Job *workerJob = distributedPlan->workerJob;
+	ListCell *taskCell = NULL;
 
-	/*
-	 * Try to run the query to completion on one placement. If the query fails
-	 * attempt the query on the next placement.
-	 */
-	foreach(taskPlacementCell, taskPlacementList)
+	if (ReadFromSecondaries == USE_SECONDARY_NODES_NEVER ||
+		distributedPlan->operation != CMD_SELECT)
 	{
-		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
-		bool queryOK = false;
-		bool dontFailOnError = false;
-		int64 currentAffectedTupleCount = 0;
-		int connectionFlags = SESSION_LIFESPAN;
-		List *placementAccessList = NIL;
-		MultiConnection *connection = NULL;
+		return;
+	}
 
-		if (list_length(relationShardList) > 0)
-		{
-			placementAccessList = BuildPlacementSelectList(taskPlacement->groupId,
-														   relationShardList);
+	if (workerJob == NULL || workerJob->dependedJobList != NIL)
+	{
+		return;
+	}
 
-			Assert(list_length(placementAccessList) == list_length(relationShardList));
-		}
-		else
-		{
-			/*
-			 * When the SELECT prunes down to 0 shards, just use the dummy placement.
-			 *
-			 * FIXME: it would be preferable to evaluate the SELECT locally since no
-			 * data from the workers is required.
-			 */
+	/* the distributed plan is cached, so we only modify a copy of it */
+	distributedPlan = CopyDistributedPlanForExecution(distributedPlan, false);
+	scanState->distributedPlan = distributedPlan;
+	workerJob = distributedPlan->workerJob;
 
-			ShardPlacementAccess *placementAccess =
-				CreatePlacementAccess(taskPlacement, PLACEMENT_ACCESS_SELECT);
+	foreach(taskCell, workerJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		List *readPlacementList = NIL;
+		ListCell *placementCell = NULL;
 
-			placementAccessList = list_make1(placementAccess);
-		}
+		foreach(placementCell, task->taskPlacementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+			WorkerNode *workerNode = NULL;
 
-		connection = GetPlacementListConnection(connectionFlags, placementAccessList,
+			if (LookupNodeGroup(placement->groupId) != NULL)
+			{
+				workerNode = LookupNodeForGroup(placement->groupId);
+			}
+
+			if (workerNode != NULL &&
+				(strcmp(placement->nodeName, workerNode->workerName) != 0 ||
+				 placement->nodePort != workerNode->workerPort))
+			{
+				ShardPlacement *readPlacement = palloc(sizeof(ShardPlacement));
+
+				memcpy(readPlacement, placement, sizeof(ShardPlacement));
+				readPlacement->nodeName = pstrdup(workerNode->workerName);
+				readPlacement->nodePort = workerNode->workerPort;
+
+				placement = readPlacement;
+			}
+
+			readPlacementList = lappend(readPlacementList, placement);
+		}
+
+		task->taskPlacementList = readPlacementList;
+	}
+}
+
+
+/*
+ * RouterSelectBeginScan decides whether the rows of the router SELECT can be
+ * streamed directly from the connection. That requires citus.enable_result_streaming
+ * and a scan that is only read forward once. Results of subplans are always
+ * collected in a tuple store, since their size is checked against
+ * citus.max_intermediate_result_size.
+ */
+void
+RouterSelectBeginScan(CustomScanState *node, EState *estate, int eflags)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+	int rescanFlags = EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK | EXEC_FLAG_REWIND;
+
+	PruneDeferredRouterSelect(scanState);
+	ResolveReadPlacementNodes(scanState);
+
+	/* EXPLAIN ANALYZE shows the rows of the task, so it needs all of them up front */
+	if (EnableResultStreaming && SubPlanLevel == 0 && (eflags & rescanFlags) == 0 &&
+		estate->es_instrument == 0)
+	{
+		scanState->resultStream = palloc0(sizeof(RouterSelectStream));
+	}
+}
+
+
+/*
+ * RouterSelectEndScan releases the connection of a streaming router SELECT,
+ * reading any rows that were not returned, and its tenant admission. It also
+ * cleans up the tuple store.
+ */
+void
+RouterSelectEndScan(CustomScanState *node)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+
+	if (scanState->resultStream != NULL)
+	{
+		EndResultStream(scanState->resultStream);
+	}
+
+	ReleaseTenantAdmission(scanState->tenantAdmission);
+	scanState->tenantAdmission = NULL;
+
+	if (scanState->tuplestorestate)
+	{
+		tuplestore_end(scanState->tuplestorestate);
+		scanState->tuplestorestate = NULL;
+	}
+}
+
+
+/*
+ * RouterSelectExecScan executes a single select task on the remote node,
+ * retrieves the results and stores them in custom scan's tuple store. Then, it
+ * returns tuples one by one from this tuple store. When streaming, tuples are
+ * instead returned one by one as they arrive on the connection.
+ */
+TupleTableSlot *
+RouterSelectExecScan(CustomScanState *node)
+{
+	CitusScanState *scanState = (CitusScanState *) node;
+	TupleTableSlot *resultSlot = NULL;
+
+	if (!scanState->finishedRemoteScan)
+	{
+		DistributedPlan *distributedPlan = scanState->distributedPlan;
+		Job *workerJob = distributedPlan->workerJob;
+		List *taskList = workerJob->taskList;
+
+		/* we are taking locks on partitions of partitioned tables */
+		LockPartitionsInRelationList(distributedPlan->relationIdList, AccessShareLock);
+
+		QueryStatsRemoteExecutionStart(scanState);
+
+		ExecuteSubPlans(distributedPlan);
+
+		if (list_length(taskList) > 0)
+		{
+			Task *task = (Task *) linitial(taskList);
+			CitusScanState *previousScanState = NULL;
+			instr_time taskStartTime;
+
+			INSTR_TIME_SET_CURRENT(taskStartTime);
+
+			scanState->tenantAdmission = AdmitTenantQuery(task);
+
+			previousScanState = BeginTaskStatsCollection(scanState);
+			ExecuteSingleSelectTask(scanState, task);
+			EndTaskStatsCollection(previousScanState);
+
+			RecordTaskShardAccess(task, SHARD_ACCESS_READ, &taskStartTime);
+
+			/* streamed rows are still read from the worker until the scan ends */
+			if (scanState->resultStream == NULL)
+			{
+				ReleaseTenantAdmission(scanState->tenantAdmission);
+				scanState->tenantAdmission = NULL;
+			}
+		}
+
+		QueryStatsRemoteExecutionEnd();
+
+		scanState->finishedRemoteScan = true;
+	}
+
+	if (scanState->resultStream != NULL)
+	{
+		resultSlot = ReturnTupleFromStream(scanState);
+	}
+	else
+	{
+		resultSlot = ReturnTupleFromTuplestore(scanState);
+	}
+
+	return resultSlot;
+}
+
+
+/*
+ * ExecuteSingleSelectTask executes the task on the remote node, retrieves the
+ * results and stores them in a tuple store. When streaming, the function only
+ * waits for the first result and leaves the remaining rows on the connection.
+ *
+ * If the task fails on one of the placements, the function retries it on
+ * other placements or errors out if the query fails on all placements.
+ *
+ * Results of reference table lookups are taken from the result cache if
+ * possible, and added to it otherwise. Tasks whose placements are on the
+ * local node are executed locally if citus.enable_local_execution is set.
+ */
+static void
+ExecuteSingleSelectTask(CitusScanState *scanState, Task *task)
+{
+	ParamListInfo paramListInfo =
+		scanState->customScanState.ss.ps.state->es_param_list_info;
+	List *taskPlacementList = task->taskPlacementList;
+	ListCell *taskPlacementCell = NULL;
+	char *queryString = task->queryString;
+	List *relationShardList = task->relationShardList;
+	DistributedExecutionStats executionStats = { 0 };
+	bool binaryResults = UseBinaryResultFormat(scanState);
+	char *resultCacheKey = TaskResultCacheKey(scanState->distributedPlan, task,
+											  paramListInfo);
+	uint64 modificationCounter = 0;
+	List *localPlacementAccessList = NIL;
+	bool hedgeReads = CanHedgeSelectTask(task);
+	bool beginTransaction = !CanSelectOutsideRemoteTransaction(scanState);
+	bool copyResults = UseCopyResultTransfer(scanState, paramListInfo, hedgeReads);
+	int placementIndex = -1;
+
+	if (resultCacheKey != NULL &&
+		LoadCachedTaskResult(scanState, resultCacheKey, task, &modificationCounter))
+	{
+		/* the cached rows are returned from the tuple store */
+		scanState->resultStream = NULL;
+		return;
+	}
+
+	localPlacementAccessList = LocalTaskPlacementAccessList(scanState->distributedPlan,
+															task);
+	if (localPlacementAccessList != NIL)
+	{
+		RecordPlacementListLocalAccess(localPlacementAccessList);
+		ExecuteLocalSelectTask(scanState, task);
+
+		/* the local rows are returned from the tuple store */
+		scanState->resultStream = NULL;
+
+		if (resultCacheKey != NULL)
+		{
+			CacheTaskResult(scanState, resultCacheKey, task, modificationCounter);
+		}
+
+		return;
+	}
+
+	if (copyResults)
+	{
+		/* the rows arrive as COPY data, which is parsed in bulk */
+		StringInfo copyQueryString = makeStringInfo();
+
+		appendStringInfo(copyQueryString, binaryResults ? COPY_QUERY_TO_STDOUT_BINARY :
+						 COPY_QUERY_TO_STDOUT_TEXT, queryString);
+
+		queryString = copyQueryString->data;
+	}
+
+	/*
+	 * Try to run the query to completion on one placement. If the query fails
+	 * attempt the query on the next placement.
+	 */
+	foreach(taskPlacementCell, taskPlacementList)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
+		bool queryOK = false;
+		bool dontFailOnError = false;
+		int64 currentAffectedTupleCount = 0;
+		int connectionFlags = SESSION_LIFESPAN;
+		List *placementAccessList = NIL;
+		MultiConnection *connection = NULL;
+		TimestampTz startTime = 0;
+		TimestampTz queryStartTime = 0;
+
+		placementIndex++;
+
+		if (CollectingTaskStats())
+		{
+			startTime = GetCurrentTimestamp();
+		}
+
+		if (list_length(relationShardList) > 0)
+		{
+			placementAccessList = BuildPlacementSelectList(taskPlacement->groupId,
+														   relationShardList);
+
+			Assert(list_length(placementAccessList) == list_length(relationShardList));
+		}
+		else
+		{
+			/*
+			 * When the SELECT prunes down to 0 shards, just use the dummy placement.
+			 *
+			 * FIXME: it would be preferable to evaluate the SELECT locally since no
+			 * data from the workers is required.
+			 */
+
+			ShardPlacementAccess *placementAccess =
+				CreatePlacementAccess(taskPlacement, PLACEMENT_ACCESS_SELECT);
+
+			placementAccessList = list_make1(placementAccess);
+		}
+
+		connection = GetPlacementListConnection(connectionFlags, placementAccessList,
 												NULL);
 
-		/*
-		 * Make sure we open a transaction block and assign a distributed transaction
-		 * ID if we are in a coordinated transaction.
-		 *
-		 * This can happen when the SELECT goes to a node that was not involved in
-		 * the transaction so far, or when existing connections to the node are
-		 * claimed exclusively, e.g. the connection might be claimed to copy the
-		 * intermediate result of a CTE to the node. Especially in the latter case,
-		 * we want to make sure that we open a transaction block and assign a
-		 * distributed transaction ID, such that the query can read intermediate
-		 * results.
-		 */
-		RemoteTransactionBeginIfNecessary(connection);
+		SetTaskParallelWorkers(connection, task);
+
+		if (CollectingTaskStats())
+		{
+			queryStartTime = GetCurrentTimestamp();
+		}
+
+		/*
+		 * SendQueryInSingleRowMode makes sure we open a transaction block and
+		 * assign a distributed transaction ID if we are in a coordinated
+		 * transaction.
+		 *
+		 * This can happen when the SELECT goes to a node that was not involved in
+		 * the transaction so far, or when existing connections to the node are
+		 * claimed exclusively, e.g. the connection might be claimed to copy the
+		 * intermediate result of a CTE to the node. Especially in the latter case,
+		 * we want to make sure that we open a transaction block and assign a
+		 * distributed transaction ID, such that the query can read intermediate
+		 * results.
+		 *
+		 * With citus.skip_remote_begin_for_selects, simple SELECTs that do not
+		 * need the transaction block run on such connections without it.
+		 */
+		if (copyResults)
+		{
+			/* COPY data has the same format for text and binary results */
+			queryOK = SendQueryInSingleRowMode(connection, queryString, NULL, false,
+											   beginTransaction, false);
+		}
+		else
+		{
+			queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo,
+											   binaryResults, beginTransaction, true);
+		}
+
+		if (!queryOK)
+		{
+			continue;
+		}
+
+		if (hedgeReads)
+		{
+			connection = WaitForHedgedSelectResponse(connection, taskPlacementCell,
+													 task, paramListInfo,
+													 binaryResults);
+		}
+
+		if (scanState->resultStream != NULL)
+		{
+			queryOK = StartResultStream(scanState, connection, dontFailOnError);
+			if (queryOK)
+			{
+				return;
+			}
+
+			continue;
+		}
+
+#if (PG_VERSION_NUM >= 100000)
+		if (copyResults)
+		{
+			queryOK = StoreCopyQueryResult(scanState, connection, binaryResults,
+										   dontFailOnError, &currentAffectedTupleCount,
+										   &executionStats);
+		}
+		else
+#endif
+		{
+			queryOK = StoreQueryResult(scanState, connection, dontFailOnError,
+									   &currentAffectedTupleCount,
+									   &executionStats);
+		}
+
+		if (CheckIfSizeLimitIsExceeded(&executionStats))
+		{
+			ErrorSizeLimitIsExceeded();
+		}
+
+		if (queryOK)
+		{
+			RecordTaskExecutionStats(task, placementIndex, startTime, queryStartTime,
+									 currentAffectedTupleCount,
+									 executionStats.totalBytesReceived);
+
+			if (resultCacheKey != NULL)
+			{
+				CacheTaskResult(scanState, resultCacheKey, task, modificationCounter);
+			}
+
+			return;
+		}
+	}
+
+	ereport(ERROR, (errmsg("could not receive query results")));
+}
+
+
+/*
+ * SetTaskParallelWorkers sets the parallel workers that the planner suggested
+ * for the task as max_parallel_workers_per_gather of the connection, or resets
+ * the setting if an earlier task changed it. The connection outlives the
+ * statement, so it remembers the setting. We only change it outside of
+ * transaction blocks, and a failure only costs the task its parallelism.
+ */
+static void
+SetTaskParallelWorkers(MultiConnection *connection, Task *task)
+{
+	char *parallelWorkersCommand = NULL;
+	PGresult *result = NULL;
+	int executeResult = 0;
+
+	if (PQtransactionStatus(connection->pgConn) != PQTRANS_IDLE)
+	{
+		return;
+	}
+
+	parallelWorkersCommand = ParallelWorkersCommand(connection,
+													 task->parallelWorkerCount);
+	if (parallelWorkersCommand == NULL)
+	{
+		return;
+	}
+
+	executeResult = ExecuteOptionalRemoteCommand(connection, parallelWorkersCommand,
+												 &result);
+	if (executeResult != 0)
+	{
+		return;
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	connection->parallelWorkerCount = task->parallelWorkerCount;
+}
+
+
+/*
+ * CanHedgeSelectTask returns whether the given router SELECT task may be sent
+ * to a second placement when the first one is slow to respond. Connections in
+ * a coordinated transaction carry state that the result depends on, so only
+ * tasks outside of coordinated transactions are hedged.
+ */
+static bool
+CanHedgeSelectTask(Task *task)
+{
+	if (HedgedReadPercentile <= 0)
+	{
+		return false;
+	}
+
+	if (list_length(task->taskPlacementList) < 2 || task->relationShardList == NIL)
+	{
+		return false;
+	}
+
+	if (IsTransactionBlock() || InCoordinatedTransaction())
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * CanSelectOutsideRemoteTransaction returns whether the router SELECT of the
+ * given scan may run on a connection that did not join the coordinated
+ * transaction yet without opening a transaction block on it. The remote
+ * transactions use READ COMMITTED, so a single SELECT sees the same data
+ * with or without a transaction block, and the connection then needs neither
+ * BEGIN nor COMMIT, nor PREPARE TRANSACTION when the transaction uses 2PC.
+ *
+ * Queries that lock rows, read intermediate results or call volatile functions,
+ * which might write, do depend on the transaction block.
+ */
+static bool
+CanSelectOutsideRemoteTransaction(CitusScanState *scanState)
+{
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	Query *jobQuery = distributedPlan->workerJob->jobQuery;
+
+	if (!SkipRemoteBeginForSelects || !InCoordinatedTransaction())
+	{
+		return false;
+	}
+
+	/* serializable transactions expect all reads to be part of the transaction */
+	if (IsolationIsSerializable())
+	{
+		return false;
+	}
+
+	if (distributedPlan->subPlanList != NIL)
+	{
+		return false;
+	}
+
+	if (jobQuery == NULL || jobQuery->rowMarks != NIL ||
+		contain_volatile_functions((Node *) jobQuery))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * WaitForHedgedSelectResponse waits for the response to the query that was
+ * just sent over the given connection. If no response arrives within the
+ * configured percentile of recent response times, the query is also sent to
+ * the next placement of the task. The function returns the connection that
+ * responds first, after cancelling the query on the other connection.
+ */
+static MultiConnection *
+WaitForHedgedSelectResponse(MultiConnection *connection, ListCell *taskPlacementCell,
+							Task *task, ParamListInfo paramListInfo,
+							bool binaryResults)
+{
+	ListCell *hedgePlacementCell = lnext(taskPlacementCell);
+	ShardPlacement *hedgePlacement = NULL;
+	MultiConnection *hedgeConnection = NULL;
+	MultiConnection *connectionArray[2] = { connection, NULL };
+	List *placementAccessList = NIL;
+	TimestampTz sendTime = GetCurrentTimestamp();
+	long hedgeDelay = HedgedReadDelay();
+	int responseIndex = 0;
+
+	/* not enough history yet, or no placement left to send the query to */
+	if (hedgeDelay < 0 || hedgePlacementCell == NULL)
+	{
+		WaitForFirstResponse(connectionArray, 1, -1);
+		RecordReadLatency(sendTime);
+
+		return connection;
+	}
+
+	responseIndex = WaitForFirstResponse(connectionArray, 1, hedgeDelay);
+	if (responseIndex == 0)
+	{
+		RecordReadLatency(sendTime);
+
+		return connection;
+	}
+
+	hedgePlacement = (ShardPlacement *) lfirst(hedgePlacementCell);
+	placementAccessList = BuildPlacementSelectList(hedgePlacement->groupId,
+												   task->relationShardList);
+	hedgeConnection = GetPlacementListConnection(SESSION_LIFESPAN, placementAccessList,
+												 NULL);
+
+	if (hedgeConnection == connection ||
+		!SendQueryInSingleRowMode(hedgeConnection, task->queryString, paramListInfo,
+								  binaryResults, true, true))
+	{
+		/* could not hedge, keep waiting for the first placement */
+		return connection;
+	}
+
+	ereport(DEBUG2, (errmsg("sending task %u to %s:%d after %ld ms",
+							task->taskId, hedgePlacement->nodeName,
+							hedgePlacement->nodePort, hedgeDelay)));
+
+	connectionArray[1] = hedgeConnection;
+	responseIndex = WaitForFirstResponse(connectionArray, 2, -1);
+
+	/* the query on the slower placement is no longer needed */
+	CancelAndDiscardResults(connectionArray[1 - responseIndex]);
+	RecordReadLatency(sendTime);
+
+	return connectionArray[responseIndex];
+}
+
+
+/*
+ * HedgedReadDelay returns the number of milliseconds after which a router
+ * SELECT is sent to another placement, based on the configured percentile of
+ * recent response times. Returns -1 if there are too few recent responses to
+ * tell what a slow response is.
+ */
+static long
+HedgedReadDelay(void)
+{
+	double sortedLatencies[HEDGED_READ_HISTORY_SIZE];
+	int latencyCount = Min(ReadLatencyCount, HEDGED_READ_HISTORY_SIZE);
+	int percentileIndex = 0;
+
+	if (latencyCount < HEDGED_READ_MIN_HISTORY_SIZE)
+	{
+		return -1;
+	}
+
+	memcpy(sortedLatencies, ReadLatencyHistory, latencyCount * sizeof(double));
+	qsort(sortedLatencies, latencyCount, sizeof(double), CompareLatencies);
+
+	percentileIndex = (latencyCount - 1) * HedgedReadPercentile / 100;
+
+	return (long) ceil(sortedLatencies[percentileIndex]);
+}
+
+
+/* CompareLatencies is a qsort comparator for response times. */
+static int
+CompareLatencies(const void *leftElement, const void *rightElement)
+{
+	double leftLatency = *((const double *) leftElement);
+	double rightLatency = *((const double *) rightElement);
+
+	if (leftLatency < rightLatency)
+	{
+		return -1;
+	}
+	else if (leftLatency > rightLatency)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * RecordReadLatency adds the time since the given send time to the history
+ * of router SELECT response times, overwriting the oldest entry.
+ */
+static void
+RecordReadLatency(TimestampTz sendTime)
+{
+	long latencySeconds = 0;
+	int latencyMicroseconds = 0;
+
+	TimestampDifference(sendTime, GetCurrentTimestamp(), &latencySeconds,
+						&latencyMicroseconds);
+
+	ReadLatencyHistory[NextReadLatencyIndex] = latencySeconds * 1000.0 +
+											   latencyMicroseconds / 1000.0;
+
+	NextReadLatencyIndex = (NextReadLatencyIndex + 1) % HEDGED_READ_HISTORY_SIZE;
+	if (ReadLatencyCount < HEDGED_READ_HISTORY_SIZE)
+	{
+		ReadLatencyCount++;
+	}
+}
+
+
+/*
+ * WaitForFirstResponse waits until a response to the pending query on one of
+ * the given connections can be read without blocking, and returns the index
+ * of that connection. Connections that failed count as having responded, such
+ * that the caller reads and reports the failure. If timeout is not negative,
+ * the function returns -1 when no connection responded within timeout ms.
+ */
+static int
+WaitForFirstResponse(MultiConnection **connectionArray, int connectionCount,
+					 long timeout)
+{
+	TimestampTz startTime = GetCurrentTimestamp();
+	int responseIndex = -1;
+
+	while (responseIndex < 0)
+	{
+		WaitEventSet *waitEventSet = NULL;
+		WaitEvent event;
+		int connectionIndex = 0;
+		int eventCount = 0;
+		long remainingTimeout = -1;
+
+		waitEventSet = CreateWaitEventSet(CurrentMemoryContext, connectionCount + 2);
+
+		for (connectionIndex = 0; connectionIndex < connectionCount; connectionIndex++)
+		{
+			PGconn *pgConn = connectionArray[connectionIndex]->pgConn;
+			int eventMask = WL_SOCKET_READABLE;
+			int sendStatus = 0;
+
+			if (PQstatus(pgConn) == CONNECTION_BAD)
+			{
+				responseIndex = connectionIndex;
+				break;
+			}
+
+			/* send any part of the query that did not fit into the socket yet */
+			sendStatus = PQflush(pgConn);
+			if (sendStatus == 1)
+			{
+				eventMask |= WL_SOCKET_WRITEABLE;
+			}
+
+			if (sendStatus == -1 || PQconsumeInput(pgConn) == 0 || !PQisBusy(pgConn))
+			{
+				responseIndex = connectionIndex;
+				break;
+			}
+
+			AddWaitEventToSet(waitEventSet, eventMask, PQsocket(pgConn), NULL, NULL);
+		}
+
+		if (responseIndex >= 0)
+		{
+			FreeWaitEventSet(waitEventSet);
+			break;
+		}
+
+		if (timeout >= 0)
+		{
+			long elapsedSeconds = 0;
+			int elapsedMicroseconds = 0;
+
+			TimestampDifference(startTime, GetCurrentTimestamp(), &elapsedSeconds,
+								&elapsedMicroseconds);
+
+			remainingTimeout = timeout - (elapsedSeconds * 1000L +
+										  elapsedMicroseconds / 1000);
+			if (remainingTimeout <= 0)
+			{
+				FreeWaitEventSet(waitEventSet);
+				break;
+			}
+		}
+
+		AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL,
+						  NULL);
+		AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+#if (PG_VERSION_NUM >= 100000)
+		eventCount = WaitEventSetWait(waitEventSet, remainingTimeout, &event, 1,
+									  WAIT_EVENT_CLIENT_READ);
+#else
+		eventCount = WaitEventSetWait(waitEventSet, remainingTimeout, &event, 1);
+#endif
+
+		FreeWaitEventSet(waitEventSet);
+
+		if (eventCount > 0 && (event.events & WL_POSTMASTER_DEATH))
+		{
+			ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+		}
+
+		if (eventCount > 0 && (event.events & WL_LATCH_SET))
+		{
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+
+	return responseIndex;
+}
+
+
+/*
+ * CancelAndDiscardResults cancels the query that is running over the given
+ * connection and reads the remaining results, such that the connection can be
+ * used for other commands. The cancellation error is expected and therefore
+ * not reported.
+ */
+static void
+CancelAndDiscardResults(MultiConnection *connection)
+{
+	PGconn *pgConn = connection->pgConn;
+	PGcancel *cancel = NULL;
+	char errorMessage[256] = { 0 };
+	bool raiseInterrupts = true;
+
+	if (PQstatus(pgConn) != CONNECTION_OK)
+	{
+		return;
+	}
+
+	cancel = PQgetCancel(pgConn);
+	if (!PQcancel(cancel, errorMessage, sizeof(errorMessage)))
+	{
+		ereport(DEBUG1, (errmsg("could not cancel hedged query: %s", errorMessage)));
+	}
+	PQfreeCancel(cancel);
+
+	while (true)
+	{
+		PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (result == NULL)
+		{
+			break;
+		}
+
+		PQclear(result);
+	}
+}
+
+
+/*
+ * StartResultStream waits for the first result of the query that was sent on
+ * the connection. If the query failed and failOnError is false, a warning is
+ * emitted and the function returns false, such that the query can be retried
+ * on another placement. Otherwise, the connection is claimed for reading the
+ * remaining rows in ReturnTupleFromStream().
+ */
+static bool
+StartResultStream(CitusScanState *scanState, MultiConnection *connection,
+				  bool failOnError)
+{
+	RouterSelectStream *stream = scanState->resultStream;
+	TupleDesc tupleDescriptor =
+		scanState->customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	PGresult *result = NULL;
+	ExecStatusType resultStatus = PGRES_TUPLES_OK;
+	bool raiseInterrupts = true;
+	int errorLevel = failOnError ? ERROR : WARNING;
+
+	/* read the results of a BEGIN that was sent along with the query */
+	if (!FinishPipelinedRemoteTransactionBegin(connection))
+	{
+		return false;
+	}
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (result == NULL)
+	{
+		MarkRemoteTransactionFailed(connection, false);
+		ReportConnectionError(connection, errorLevel);
+		return false;
+	}
+
+	resultStatus = PQresultStatus(result);
+	if (resultStatus != PGRES_SINGLE_TUPLE && resultStatus != PGRES_TUPLES_OK)
+	{
+		MarkRemoteTransactionFailed(connection, false);
+		ReportResultError(connection, result, errorLevel);
+		PQclear(result);
+		return false;
+	}
+
+	/* the metadata is reused when streaming the rows of several tasks */
+	if (stream->tupleContext == NULL)
+	{
+		stream->attributeInputMetadata = TupleDescGetAttInMetadata(tupleDescriptor);
+		stream->columnArray = (char **) palloc0(tupleDescriptor->natts *
+												sizeof(char *));
+		stream->tupleContext = AllocSetContextCreate(CurrentMemoryContext,
+													 "RouterSelectStream",
+													 ALLOCSET_DEFAULT_MINSIZE,
+													 ALLOCSET_DEFAULT_INITSIZE,
+													 ALLOCSET_DEFAULT_MAXSIZE);
+	}
+
+	if (PQbinaryTuples(result) && stream->receiveFunctions == NULL)
+	{
+		GetColumnReceiveFunctions(tupleDescriptor, &stream->receiveFunctions,
+								  &stream->typeIoParams);
+	}
+
+	/* make sure nobody else sends commands until all rows are read */
+	ClaimConnectionExclusively(connection);
+
+	stream->connection = connection;
+	stream->pendingResult = result;
+
+	return true;
+}
+
+
+/*
+ * ReturnTupleFromStream reads the next row from the connection of a streaming
+ * router SELECT and returns it in the scan's result slot. It returns an empty
+ * slot once all rows are read. Errors are raised right away, since some rows
+ * may already have been returned and the query cannot be retried.
+ */
+static TupleTableSlot *
+ReturnTupleFromStream(CitusScanState *scanState)
+{
+	RouterSelectStream *stream = scanState->resultStream;
+	MultiConnection *connection = stream->connection;
+	TupleTableSlot *resultSlot = scanState->customScanState.ss.ps.ps_ResultTupleSlot;
+	TupleDesc tupleDescriptor = resultSlot->tts_tupleDescriptor;
+	PGresult *result = NULL;
+	ExecStatusType resultStatus = PGRES_TUPLES_OK;
+	HeapTuple heapTuple = NULL;
+	MemoryContext oldContext = NULL;
+	int columnIndex = 0;
+
+	ExecClearTuple(resultSlot);
+
+	if (connection == NULL)
+	{
+		/* task list was empty or all rows have been read */
+		return resultSlot;
+	}
+
+	if (stream->pendingResult != NULL)
+	{
+		result = stream->pendingResult;
+		stream->pendingResult = NULL;
+	}
+	else
+	{
+		bool raiseInterrupts = true;
+
+		result = GetRemoteCommandResult(connection, raiseInterrupts);
+	}
+
+	if (result == NULL)
+	{
+		EndResultStream(stream);
+		return resultSlot;
+	}
+
+	resultStatus = PQresultStatus(result);
+	if (resultStatus == PGRES_TUPLES_OK)
+	{
+		/* in single-row mode, the last result has no rows */
+		PQclear(result);
+		EndResultStream(stream);
+		return resultSlot;
+	}
+	else if (resultStatus != PGRES_SINGLE_TUPLE)
+	{
+		MarkRemoteTransactionFailed(connection, false);
+		ReportResultError(connection, result, ERROR);
+	}
+
+	Assert(PQnfields(result) == tupleDescriptor->natts);
+
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		QueryStatsAddBytesReceived(PQgetlength(result, 0, columnIndex));
+	}
+
+	/* build the tuple in a temporary context, protecting against leaks */
+	oldContext = MemoryContextSwitchTo(stream->tupleContext);
+
+	if (PQbinaryTuples(result))
+	{
+		heapTuple = BuildTupleFromBinaryResult(result, 0, tupleDescriptor,
+											   stream->receiveFunctions,
+											   stream->typeIoParams);
+	}
+	else
+	{
+		for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+		{
+			if (PQgetisnull(result, 0, columnIndex))
+			{
+				stream->columnArray[columnIndex] = NULL;
+			}
+			else
+			{
+				stream->columnArray[columnIndex] = PQgetvalue(result, 0, columnIndex);
+			}
+		}
+
+		heapTuple = BuildTupleFromCStrings(stream->attributeInputMetadata,
+										   stream->columnArray);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	heapTuple = heap_copytuple(heapTuple);
+	MemoryContextReset(stream->tupleContext);
+	PQclear(result);
+
+	ExecStoreTuple(heapTuple, resultSlot, InvalidBuffer, true);
+
+	return resultSlot;
+}
+
+
+/*
+ * EndResultStream reads any rows of a streaming router SELECT that were not
+ * returned, e.g. because of a LIMIT on the coordinator or a closed cursor, and
+ * releases the connection such that it can be used by other commands.
+ */
+static void
+EndResultStream(RouterSelectStream *stream)
+{
+	MultiConnection *connection = stream->connection;
+
+	if (stream->pendingResult != NULL)
+	{
+		PQclear(stream->pendingResult);
+		stream->pendingResult = NULL;
+	}
+
+	if (connection == NULL)
+	{
+		return;
+	}
+
+	ForgetResults(connection);
+	UnclaimConnection(connection);
+
+	stream->connection = NULL;
+}
+
+
+/*
+ * CanStreamModifyTasks returns whether the RETURNING rows of the given tasks
+ * can be streamed, which is the case if every task modifies a single
+ * placement. With multiple placements, the rows of each task are only
+ * returned from the first one, and the affected row counts of all placements
+ * are compared, which requires running them in rounds.
+ */
+static bool
+CanStreamModifyTasks(List *taskList)
+{
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (task->taskType != MODIFY_TASK || list_length(task->taskPlacementList) != 1)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * StartMultiModifyStream opens the transactions of a multi-shard modification,
+ * sends the tasks whose connections are not used by an earlier task, and
+ * starts streaming the rows of the first task.
+ */
+static void
+StartMultiModifyStream(CitusScanState *scanState, List *taskList)
+{
+	MultiModifyStream *stream = scanState->modifyStream;
+	EState *executorState = scanState->customScanState.ss.ps.state;
+	List *busyConnectionList = NIL;
+	ListCell *taskCell = NULL;
+	int taskIndex = 0;
+
+	stream->taskList = taskList;
+	stream->taskCount = list_length(taskList);
+	stream->paramListInfo = executorState->es_param_list_info;
+	stream->binaryResults = UseBinaryResultFormat(scanState);
+	stream->taskConnections = (MultiConnection **) palloc0(stream->taskCount *
+														   sizeof(MultiConnection *));
+	stream->taskStates = (MultiModifyTaskState *) palloc0(stream->taskCount *
+														  sizeof(MultiModifyTaskState));
+	stream->currentTaskIndex = -1;
+
+	stream->shardConnectionHash = BeginModifyTasks(taskList);
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		bool shardConnectionsFound = false;
+		ShardConnections *shardConnections = NULL;
+		MultiConnection *connection = NULL;
+
+		shardConnections = GetShardHashConnections(stream->shardConnectionHash,
+												   task->anchorShardId,
+												   &shardConnectionsFound);
+		connection = (MultiConnection *) linitial(shardConnections->connectionList);
+
+		stream->taskConnections[taskIndex] = connection;
+		stream->taskStates[taskIndex] = MODIFY_TASK_PENDING;
+
+		if (!list_member_ptr(busyConnectionList, connection))
+		{
+			SendModifyStreamTask(stream, taskIndex);
+			busyConnectionList = lappend(busyConnectionList, connection);
+		}
+
+		RecordTaskShardAccess(task, SHARD_ACCESS_WRITE, NULL);
+
+		taskIndex++;
+	}
+
+	list_free(busyConnectionList);
+
+	scanState->resultStream = palloc0(sizeof(RouterSelectStream));
+
+	StartNextModifyStreamTask(scanState);
+}
+
+
+/*
+ * ReturnTupleFromModifyStream returns the next RETURNING row of a streaming
+ * multi-shard modification, moving on to the next task once all rows of the
+ * current one were read. It returns an empty slot once all tasks finished.
+ */
+static TupleTableSlot *
+ReturnTupleFromModifyStream(CitusScanState *scanState)
+{
+	MultiModifyStream *stream = scanState->modifyStream;
+	EState *executorState = scanState->customScanState.ss.ps.state;
+	TupleTableSlot *resultSlot = NULL;
+
+	while (true)
+	{
+		resultSlot = ReturnTupleFromStream(scanState);
+		if (!TupIsNull(resultSlot))
+		{
+			/* every RETURNING row corresponds to a modified row */
+			executorState->es_processed++;
+
+			return resultSlot;
+		}
 
-		queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo);
-		if (!queryOK)
+		if (stream->currentTaskIndex < 0)
 		{
-			continue;
+			return resultSlot;
 		}
 
-		queryOK = StoreQueryResult(scanState, connection, dontFailOnError,
-								   &currentAffectedTupleCount,
-								   &executionStats);
+		StartNextModifyStreamTask(scanState);
+	}
+}
 
-		if (CheckIfSizeLimitIsExceeded(&executionStats))
+
+/*
+ * SendModifyStreamTask sends the query of the given task on its connection.
+ */
+static void
+SendModifyStreamTask(MultiModifyStream *stream, int taskIndex)
+{
+	Task *task = (Task *) list_nth(stream->taskList, taskIndex);
+	MultiConnection *connection = stream->taskConnections[taskIndex];
+	bool beginTransaction = true;
+	bool prepareStatement = true;
+	bool queryOK = false;
+
+	queryOK = SendQueryInSingleRowMode(connection, task->queryString,
+									   stream->paramListInfo, stream->binaryResults,
+									   beginTransaction, prepareStatement);
+	if (!queryOK)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	stream->taskStates[taskIndex] = MODIFY_TASK_SENT;
+}
+
+
+/*
+ * StartNextModifyStreamTask finishes the task whose rows were read, sends the
+ * next pending task on its connection, and starts streaming the rows of the
+ * first task that was sent and not finished yet. Once all tasks finished, the
+ * connections are released.
+ */
+static void
+StartNextModifyStreamTask(CitusScanState *scanState)
+{
+	MultiModifyStream *stream = scanState->modifyStream;
+	int finishedTaskIndex = stream->currentTaskIndex;
+	int taskIndex = 0;
+	bool failOnError = true;
+
+	if (finishedTaskIndex >= 0)
+	{
+		MultiConnection *connection = stream->taskConnections[finishedTaskIndex];
+
+		stream->taskStates[finishedTaskIndex] = MODIFY_TASK_DONE;
+
+		for (taskIndex = 0; taskIndex < stream->taskCount; taskIndex++)
 		{
-			ErrorSizeLimitIsExceeded();
+			if (stream->taskStates[taskIndex] == MODIFY_TASK_PENDING &&
+				stream->taskConnections[taskIndex] == connection)
+			{
+				SendModifyStreamTask(stream, taskIndex);
+				break;
+			}
 		}
+	}
 
-		if (queryOK)
+	stream->currentTaskIndex = -1;
+
+	for (taskIndex = 0; taskIndex < stream->taskCount; taskIndex++)
+	{
+		if (stream->taskStates[taskIndex] == MODIFY_TASK_SENT)
 		{
+			MultiConnection *connection = stream->taskConnections[taskIndex];
+
+			/* the result stream claims the connection until all rows are read */
+			UnclaimConnection(connection);
+			StartResultStream(scanState, connection, failOnError);
+			stream->currentTaskIndex = taskIndex;
+
 			return;
 		}
 	}
 
-	ereport(ERROR, (errmsg("could not receive query results")));
+	UnclaimAllShardConnections(stream->shardConnectionHash);
+
+	CHECK_FOR_INTERRUPTS();
 }
 
 
@@ -704,7 +2203,7 @@ BuildPlacementSelectList(uint32 groupId, List *relationShardList)
  * CreatePlacementAccess returns a new ShardPlacementAccess for the given placement
  * and access type.
  */
-static ShardPlacementAccess *
+ShardPlacementAccess *
 CreatePlacementAccess(ShardPlacement *placement, ShardPlacementAccessType accessType)
 {
 	ShardPlacementAccess *placementAccess = NULL;
@@ -741,12 +2240,30 @@ ExecuteSingleModifyTask(CitusScanState *scanState, Task *task, bool multipleTask
 	int failureCount = 0;
 	bool resultsOK = false;
 	bool gotResults = false;
+	bool binaryResults = expectResults && UseBinaryResultFormat(scanState);
 
 	char *queryString = task->queryString;
 	bool taskRequiresTwoPhaseCommit = (task->replicationModel == REPLICATION_MODEL_2PC);
 
 	ShardInterval *shardInterval = LoadShardInterval(task->anchorShardId);
 	Oid relationId = shardInterval->relationId;
+	bool batchModification = CanBatchModifyTask(task, operation, paramListInfo,
+												 expectResults || multipleTasks);
+
+	/*
+	 * When another backend is modifying the same reference table, let it
+	 * replicate our modification along with its own.
+	 */
+	if (batchModification)
+	{
+		int64 batchedTupleCount = 0;
+
+		if (WaitForBatchedModification(task, &batchedTupleCount))
+		{
+			executorState->es_processed += batchedTupleCount;
+			return;
+		}
+	}
 
 	/*
 	 * Modifications for reference tables are always done using 2PC. First
@@ -762,11 +2279,22 @@ ExecuteSingleModifyTask(CitusScanState *scanState, Task *task, bool multipleTask
 
 	/*
 	 * Get connections required to execute task. This will, if necessary,
-	 * establish the connection, mark as critical (when modifying reference
-	 * table) and start a transaction (when in a transaction).
+	 * establish the connection and mark as critical (when modifying reference
+	 * table).
 	 */
 	connectionList = GetModifyConnections(task, taskRequiresTwoPhaseCommit);
 
+	/*
+	 * Without parameters, BEGIN is sent along with the query on each placement
+	 * (when in a transaction). Parameterized queries and queries with binary
+	 * results use the extended protocol, which only allows a single statement,
+	 * so start the transactions in parallel upfront instead.
+	 */
+	if (paramListInfo != NULL || binaryResults)
+	{
+		RemoteTransactionsBeginIfNecessary(connectionList);
+	}
+
 	/*
 	 * If we are dealing with a partitioned table, we also need to lock its
 	 * partitions.
@@ -804,7 +2332,8 @@ ExecuteSingleModifyTask(CitusScanState *scanState, Task *task, bool multipleTask
 			continue;
 		}
 
-		queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo);
+		queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo,
+										   binaryResults, true, true);
 		if (!queryOK)
 		{
 			failureCount++;
@@ -890,6 +2419,12 @@ ExecuteSingleModifyTask(CitusScanState *scanState, Task *task, bool multipleTask
 
 	executorState->es_processed += affectedTupleCount;
 
+	/* run modifications that other backends handed to us while we held the lock */
+	if (batchModification)
+	{
+		ExecuteBatchedModifications(task, connectionList);
+	}
+
 	if (IsTransactionBlock())
 	{
 		XactModificationLevel = XACT_MODIFICATION_DATA;
@@ -899,8 +2434,8 @@ ExecuteSingleModifyTask(CitusScanState *scanState, Task *task, bool multipleTask
 
 /*
  * GetModifyConnections returns the list of connections required to execute
- * modify commands on the placements in tasPlacementList.  If necessary remote
- * transactions are started.
+ * modify commands on the placements in tasPlacementList. Remote transactions
+ * are not started here, that is left to the caller.
  *
  * If markCritical is true remote transactions are marked as critical.
  */
@@ -962,9 +2497,6 @@ GetModifyConnections(Task *task, bool markCritical)
 	/* then finish in parallel */
 	FinishConnectionListEstablishment(multiConnectionList);
 
-	/* and start transactions if applicable */
-	RemoteTransactionsBeginIfNecessary(multiConnectionList);
-
 	return multiConnectionList;
 }
 
@@ -984,6 +2516,7 @@ ExecuteMultipleTasks(CitusScanState *scanState, List *taskList,
 	EState *executorState = scanState->customScanState.ss.ps.state;
 	ParamListInfo paramListInfo = executorState->es_param_list_info;
 	int64 affectedTupleCount = -1;
+	ListCell *taskCell = NULL;
 
 	/* can only support modifications right now */
 	Assert(isModificationQuery);
@@ -992,6 +2525,14 @@ ExecuteMultipleTasks(CitusScanState *scanState, List *taskList,
 											scanState);
 
 	executorState->es_processed = affectedTupleCount;
+
+	/* the tasks ran in parallel, so we only count the writes */
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		RecordTaskShardAccess(task, SHARD_ACCESS_WRITE, NULL);
+	}
 }
 
 
@@ -1030,6 +2571,79 @@ ExecuteTasksSequentiallyWithoutResults(List *taskList)
 }
 
 
+/*
+ * ExecuteBatchedModifyTasksWithoutResults executes a list of modify tasks that
+ * do not return rows, such as TRUNCATE. Unlike ExecuteModifyTasks, which sends
+ * one command per placement at a time, the commands of all placements that use
+ * the same connection are sent as a single multi-statement command, and all
+ * connections run their commands in parallel. This reduces a command on a table
+ * with thousands of shards to a round trip per node.
+ */
+void
+ExecuteBatchedModifyTasksWithoutResults(List *taskList)
+{
+	Task *firstTask = NULL;
+	ShardInterval *firstShardInterval = NULL;
+	List *commandBatchList = NIL;
+	List *connectionList = NIL;
+	ListCell *taskCell = NULL;
+
+	if (taskList == NIL)
+	{
+		return;
+	}
+
+	firstTask = (Task *) linitial(taskList);
+	firstShardInterval = LoadShardInterval(firstTask->anchorShardId);
+	if (PartitionedTable(firstShardInterval->relationId))
+	{
+		LockPartitionRelations(firstShardInterval->relationId, RowExclusiveLock);
+	}
+
+	AcquireExecutorMultiShardLocks(taskList);
+
+	BeginOrContinueCoordinatedTransaction();
+
+	if (MultiShardCommitProtocol == COMMIT_PROTOCOL_2PC ||
+		firstTask->replicationModel == REPLICATION_MODEL_2PC)
+	{
+		CoordinatedTransactionUse2PC();
+	}
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		ListCell *placementCell = NULL;
+
+		foreach(placementCell, task->taskPlacementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+			MultiConnection *connection = NULL;
+
+			/* picks the connection that modified the placement earlier, if any */
+			connection = StartPlacementConnection(FOR_DML, placement, NULL);
+
+			if (!list_member_ptr(connectionList, connection))
+			{
+				MarkRemoteTransactionCritical(connection);
+				connectionList = lappend(connectionList, connection);
+			}
+
+			AppendConnectionCommand(&commandBatchList, connection, task->queryString);
+		}
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+	RemoteTransactionsBeginIfNecessary(connectionList);
+
+	XactModificationLevel = XACT_MODIFICATION_DATA;
+
+	ExecuteConnectionCommandBatches(commandBatchList);
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+
 /*
  * ExecuteModifyTasks executes a list of tasks on remote nodes, and
  * optionally retrieves the results and stores them in a tuple store.
@@ -1044,19 +2658,214 @@ ExecuteModifyTasks(List *taskList, bool expectResults, ParamListInfo paramListIn
 {
 	int64 totalAffectedTupleCount = 0;
 	ListCell *taskCell = NULL;
-	Task *firstTask = NULL;
-	ShardInterval *firstShardInterval = NULL;
-	int connectionFlags = 0;
-	List *affectedTupleCountList = NIL;
 	HTAB *shardConnectionHash = NULL;
 	bool tasksPending = true;
 	int placementIndex = 0;
+	int taskCount = 0;
+	int64 *affectedTupleCounts = NULL;
+	MultiConnection **taskConnections = NULL;
+	bool *taskDoneInRound = NULL;
+	bool binaryResults = expectResults && UseBinaryResultFormat(scanState);
 
 	if (taskList == NIL)
 	{
 		return 0;
 	}
 
+	shardConnectionHash = BeginModifyTasks(taskList);
+
+	taskCount = list_length(taskList);
+	affectedTupleCounts = (int64 *) palloc0(taskCount * sizeof(int64));
+	taskConnections = (MultiConnection **) palloc0(taskCount *
+												   sizeof(MultiConnection *));
+	taskDoneInRound = (bool *) palloc0(taskCount * sizeof(bool));
+
+	/* iterate over placements in rounds, to ensure in-order execution */
+	while (tasksPending)
+	{
+		bool passPending = true;
+
+		tasksPending = false;
+		memset(taskDoneInRound, 0, taskCount * sizeof(bool));
+
+		/*
+		 * Tasks whose placements were modified over the same connection earlier
+		 * in the transaction share that connection. Since a connection can only
+		 * run one command at a time, we execute each round in passes that use
+		 * every connection at most once, and run the passes one after another.
+		 */
+		while (passPending)
+		{
+			List *passConnectionList = NIL;
+			int taskIndex = 0;
+
+			passPending = false;
+
+			/* send command to all shard placements with the current index in parallel */
+			foreach(taskCell, taskList)
+			{
+				Task *task = (Task *) lfirst(taskCell);
+				int64 shardId = task->anchorShardId;
+				char *queryString = task->queryString;
+				bool shardConnectionsFound = false;
+				ShardConnections *shardConnections = NULL;
+				List *connectionList = NIL;
+				MultiConnection *connection = NULL;
+				bool queryOK = false;
+
+				taskConnections[taskIndex] = NULL;
+
+				shardConnections = GetShardHashConnections(shardConnectionHash, shardId,
+														   &shardConnectionsFound);
+				connectionList = shardConnections->connectionList;
+
+				if (taskDoneInRound[taskIndex] ||
+					placementIndex >= list_length(connectionList))
+				{
+					/* no more active placements for this task in this round */
+					taskIndex++;
+					continue;
+				}
+
+				connection = (MultiConnection *) list_nth(connectionList, placementIndex);
+
+				if (list_member_ptr(passConnectionList, connection))
+				{
+					/* connection runs another task's command, try in the next pass */
+					passPending = true;
+					taskIndex++;
+					continue;
+				}
+
+				queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo,
+												   binaryResults, true,
+												   task->taskType != DDL_TASK);
+				if (!queryOK)
+				{
+					ReportConnectionError(connection, ERROR);
+				}
+
+				passConnectionList = lappend(passConnectionList, connection);
+				taskConnections[taskIndex] = connection;
+				taskDoneInRound[taskIndex] = true;
+
+				taskIndex++;
+			}
+
+			/* collects results from all relevant shard placements */
+			taskIndex = 0;
+			foreach(taskCell, taskList)
+			{
+				Task *task = (Task *) lfirst(taskCell);
+				int64 shardId = task->anchorShardId;
+				bool shardConnectionsFound = false;
+				ShardConnections *shardConnections = NULL;
+				List *connectionList = NIL;
+				MultiConnection *connection = taskConnections[taskIndex];
+				int64 currentAffectedTupleCount = 0;
+				bool failOnError = true;
+				bool queryOK PG_USED_FOR_ASSERTS_ONLY = false;
+
+				/* abort in case of cancellation */
+				CHECK_FOR_INTERRUPTS();
+
+				if (connection == NULL)
+				{
+					/* no command sent for this task in this pass */
+					taskIndex++;
+					continue;
+				}
+
+				shardConnections = GetShardHashConnections(shardConnectionHash, shardId,
+														   &shardConnectionsFound);
+				connectionList = shardConnections->connectionList;
+
+				/*
+				 * If caller is interested, store query results the first time
+				 * through. The output of the query's execution on other shards is
+				 * discarded if we run there (because it's a modification query).
+				 */
+				if (placementIndex == 0 && expectResults)
+				{
+					Assert(scanState != NULL);
+
+					queryOK = StoreQueryResult(scanState, connection, failOnError,
+											   &currentAffectedTupleCount, NULL);
+				}
+				else
+				{
+					queryOK = ConsumeQueryResult(connection, failOnError,
+												 &currentAffectedTupleCount);
+				}
+
+				/* We error out if the worker fails to return a result for the query. */
+				if (!queryOK)
+				{
+					ReportConnectionError(connection, ERROR);
+				}
+
+				if (placementIndex == 0)
+				{
+					totalAffectedTupleCount += currentAffectedTupleCount;
+
+					/* keep track of the initial affected tuple count */
+					affectedTupleCounts[taskIndex] = currentAffectedTupleCount;
+				}
+				else
+				{
+					/* warn the user if shard placements have diverged */
+					int64 previousAffectedTupleCount = affectedTupleCounts[taskIndex];
+
+					if (currentAffectedTupleCount != previousAffectedTupleCount)
+					{
+						ereport(WARNING,
+								(errmsg("modified "INT64_FORMAT " tuples of shard "
+										UINT64_FORMAT ", but expected to modify "
+										INT64_FORMAT,
+										currentAffectedTupleCount, shardId,
+										previousAffectedTupleCount),
+								 errdetail("modified placement on %s:%d",
+										   connection->hostname, connection->port)));
+					}
+				}
+
+				if (!tasksPending && placementIndex + 1 < list_length(connectionList))
+				{
+					/* more tasks to be done after thise one */
+					tasksPending = true;
+				}
+
+				taskIndex++;
+			}
+
+			list_free(passConnectionList);
+		}
+
+		placementIndex++;
+	}
+
+	UnclaimAllShardConnections(shardConnectionHash);
+
+	CHECK_FOR_INTERRUPTS();
+
+	return totalAffectedTupleCount;
+}
+
+
+/*
+ * BeginModifyTasks takes the locks for executing the given modify or DDL
+ * tasks, and opens transactions on the connections to all their placements,
+ * which are returned in a hash by shard ID.
+ */
+static HTAB *
+BeginModifyTasks(List *taskList)
+{
+	ListCell *taskCell = NULL;
+	Task *firstTask = NULL;
+	ShardInterval *firstShardInterval = NULL;
+	int connectionFlags = 0;
+	HTAB *shardConnectionHash = NULL;
+
 	/*
 	 * In multi shard modification, we expect that all tasks operates on the
 	 * same relation, so it is enough to acquire a lock on the first task's
@@ -1082,6 +2891,16 @@ ExecuteModifyTasks(List *taskList, bool expectResults, ParamListInfo paramListIn
 	{
 		AcquireExecutorMultiShardLocks(taskList);
 	}
+	else
+	{
+		/* DDL commands may change what queries on the shards return */
+		foreach(taskCell, taskList)
+		{
+			Task *task = (Task *) lfirst(taskCell);
+
+			InvalidateCachedShardResults(task->anchorShardId);
+		}
+	}
 
 	BeginOrContinueCoordinatedTransaction();
 
@@ -1105,156 +2924,150 @@ ExecuteModifyTasks(List *taskList, bool expectResults, ParamListInfo paramListIn
 
 	XactModificationLevel = XACT_MODIFICATION_DATA;
 
-	/* iterate over placements in rounds, to ensure in-order execution */
-	while (tasksPending)
-	{
-		int taskIndex = 0;
-
-		tasksPending = false;
-
-		/* send command to all shard placements with the current index in parallel */
-		foreach(taskCell, taskList)
-		{
-			Task *task = (Task *) lfirst(taskCell);
-			int64 shardId = task->anchorShardId;
-			char *queryString = task->queryString;
-			bool shardConnectionsFound = false;
-			ShardConnections *shardConnections = NULL;
-			List *connectionList = NIL;
-			MultiConnection *connection = NULL;
-			bool queryOK = false;
-
-			shardConnections = GetShardHashConnections(shardConnectionHash, shardId,
-													   &shardConnectionsFound);
-			connectionList = shardConnections->connectionList;
-
-			if (placementIndex >= list_length(connectionList))
-			{
-				/* no more active placements for this task */
-				continue;
-			}
-
-			connection = (MultiConnection *) list_nth(connectionList, placementIndex);
-
-			queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo);
-			if (!queryOK)
-			{
-				ReportConnectionError(connection, ERROR);
-			}
-		}
-
-		/* collects results from all relevant shard placements */
-		foreach(taskCell, taskList)
-		{
-			Task *task = (Task *) lfirst(taskCell);
-			int64 shardId = task->anchorShardId;
-			bool shardConnectionsFound = false;
-			ShardConnections *shardConnections = NULL;
-			List *connectionList = NIL;
-			MultiConnection *connection = NULL;
-			int64 currentAffectedTupleCount = 0;
-			bool failOnError = true;
-			bool queryOK PG_USED_FOR_ASSERTS_ONLY = false;
-
-			/* abort in case of cancellation */
-			CHECK_FOR_INTERRUPTS();
-
-			shardConnections = GetShardHashConnections(shardConnectionHash, shardId,
-													   &shardConnectionsFound);
-			connectionList = shardConnections->connectionList;
-
-			if (placementIndex >= list_length(connectionList))
-			{
-				/* no more active placements for this task */
-				taskIndex++;
-				continue;
-			}
-
-			connection = (MultiConnection *) list_nth(connectionList, placementIndex);
-
-			/*
-			 * If caller is interested, store query results the first time
-			 * through. The output of the query's execution on other shards is
-			 * discarded if we run there (because it's a modification query).
-			 */
-			if (placementIndex == 0 && expectResults)
-			{
-				Assert(scanState != NULL);
+	return shardConnectionHash;
+}
 
-				queryOK = StoreQueryResult(scanState, connection, failOnError,
-										   &currentAffectedTupleCount, NULL);
-			}
-			else
-			{
-				queryOK = ConsumeQueryResult(connection, failOnError,
-											 &currentAffectedTupleCount);
-			}
 
-			/* We error out if the worker fails to return a result for the query. */
-			if (!queryOK)
-			{
-				ReportConnectionError(connection, ERROR);
-			}
+/*
+ * UseBinaryResultFormat returns whether the results of the tasks of the given
+ * scan should be requested in binary format, which is the case if
+ * citus.enable_binary_protocol is set and all result columns have binary
+ * send and receive functions.
+ */
+static bool
+UseBinaryResultFormat(CitusScanState *scanState)
+{
+	TupleDesc tupleDescriptor = NULL;
 
-			if (placementIndex == 0)
-			{
-				totalAffectedTupleCount += currentAffectedTupleCount;
+	if (!EnableBinaryProtocol || scanState == NULL)
+	{
+		return false;
+	}
 
-				/* keep track of the initial affected tuple count */
-				affectedTupleCountList = lappend_int(affectedTupleCountList,
-													 currentAffectedTupleCount);
-			}
-			else
-			{
-				/* warn the user if shard placements have diverged */
-				int64 previousAffectedTupleCount = list_nth_int(affectedTupleCountList,
-																taskIndex);
+	tupleDescriptor =
+		scanState->customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
 
-				if (currentAffectedTupleCount != previousAffectedTupleCount)
-				{
-					ereport(WARNING,
-							(errmsg("modified "INT64_FORMAT " tuples of shard "
-									UINT64_FORMAT ", but expected to modify "INT64_FORMAT,
-									currentAffectedTupleCount, shardId,
-									previousAffectedTupleCount),
-							 errdetail("modified placement on %s:%d",
-									   connection->hostname, connection->port)));
-				}
-			}
+	return CanUseBinaryCopyFormat(tupleDescriptor);
+}
 
-			if (!tasksPending && placementIndex + 1 < list_length(connectionList))
-			{
-				/* more tasks to be done after thise one */
-				tasksPending = true;
-			}
 
-			taskIndex++;
-		}
+/*
+ * UseCopyResultTransfer returns whether the task query of the given scan
+ * should be wrapped in COPY .. TO STDOUT, such that its rows are received as
+ * COPY data and parsed in bulk rather than one PGresult per row. This is only
+ * done if citus.enable_copy_result_transfer is set and the rows are stored in
+ * a tuple store. Queries with parameters are not wrapped, since COPY does not
+ * accept parameters, and neither are hedged reads, since those send the plain
+ * query to a second placement.
+ */
+static bool
+UseCopyResultTransfer(CitusScanState *scanState, ParamListInfo paramListInfo,
+					  bool hedgeReads)
+{
+#if (PG_VERSION_NUM >= 100000)
+	if (!EnableCopyResultTransfer || scanState == NULL)
+	{
+		return false;
+	}
 
-		placementIndex++;
+	if (paramListInfo != NULL && paramListInfo->numParams > 0)
+	{
+		return false;
 	}
 
-	UnclaimAllShardConnections(shardConnectionHash);
+	if (scanState->resultStream != NULL || hedgeReads)
+	{
+		return false;
+	}
 
-	CHECK_FOR_INTERRUPTS();
+	return true;
+#else
 
-	return totalAffectedTupleCount;
+	/* COPY can only parse data from a callback on PostgreSQL 10 and above */
+	return false;
+#endif
 }
 
 
 /*
  * SendQueryInSingleRowMode sends the given query on the connection in an
  * asynchronous way. The function also sets the single-row mode on the
- * connection so that we receive results a row at a time.
+ * connection so that we receive results a row at a time. If binaryResults
+ * is true, the results are requested in binary format.
+ *
+ * If we are in a coordinated transaction and the remote transaction has not
+ * started yet, the BEGIN is prepended to the query such that both are sent
+ * in a single round trip. The results of the BEGIN are read by
+ * StoreQueryResult() and ConsumeQueryResult(). Parameterized queries and
+ * queries with binary results cannot carry multiple statements, so for them
+ * the transaction is started in a blocking manner first.
+ *
+ * If beginTransaction is false, a connection that is not yet part of the
+ * coordinated transaction runs the query outside of a transaction block.
+ *
+ * If prepareStatement is true and citus.max_prepared_statements_per_connection
+ * is set, a query that is sent without a BEGIN is executed as a statement that
+ * is prepared on the connection. DDL commands are not worth preparing, since
+ * they are not repeated.
  */
 static bool
 SendQueryInSingleRowMode(MultiConnection *connection, char *query,
-						 ParamListInfo paramListInfo)
+						 ParamListInfo paramListInfo, bool binaryResults,
+						 bool beginTransaction, bool prepareStatement)
 {
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+	bool skipBegin = !beginTransaction &&
+					 transaction->transactionState == REMOTE_TRANS_INVALID;
+	bool beginPrepended = false;
 	int querySent = 0;
 	int singleRowMode = 0;
 
-	if (paramListInfo != NULL)
+	if (skipBegin)
+	{
+		/* the connection stays out of the coordinated transaction */
+	}
+	else if (paramListInfo != NULL || binaryResults)
+	{
+		RemoteTransactionBeginIfNecessary(connection);
+	}
+	else if (InCoordinatedTransaction() && RemoteTransactionNeedsBegin(connection))
+	{
+		StringInfo beginAndQuery = makeStringInfo();
+
+		appendStringInfoString(beginAndQuery, RemoteTransactionBeginCommand(connection));
+		appendStringInfoString(beginAndQuery, query);
+
+		query = beginAndQuery->data;
+		beginPrepended = true;
+	}
+
+	if (transaction->transactionFailed &&
+		transaction->transactionState == REMOTE_TRANS_STARTING)
+	{
+		/* BEGIN failed, don't send the query */
+		return false;
+	}
+
+	if (prepareStatement && MaxPreparedStatementsPerConnection > 0 && !beginPrepended)
+	{
+		/* a single statement, which the worker only has to plan once */
+		int parameterCount = 0;
+		Oid *parameterTypes = NULL;
+		const char **parameterValues = NULL;
+
+		if (paramListInfo != NULL)
+		{
+			parameterCount = paramListInfo->numParams;
+
+			ExtractParametersFromParamListInfo(paramListInfo, &parameterTypes,
+											   &parameterValues);
+		}
+
+		querySent = SendRemoteCommandPrepared(connection, query, parameterCount,
+											  parameterTypes, parameterValues,
+											  binaryResults);
+	}
+	else if (paramListInfo != NULL)
 	{
 		int parameterCount = paramListInfo->numParams;
 		Oid *parameterTypes = NULL;
@@ -1264,7 +3077,13 @@ SendQueryInSingleRowMode(MultiConnection *connection, char *query,
 										   &parameterValues);
 
 		querySent = SendRemoteCommandParams(connection, query, parameterCount,
-											parameterTypes, parameterValues);
+											parameterTypes, parameterValues,
+											binaryResults);
+	}
+	else if (binaryResults)
+	{
+		querySent = SendRemoteCommandParams(connection, query, 0, NULL, NULL,
+											binaryResults);
 	}
 	else
 	{
@@ -1294,7 +3113,7 @@ SendQueryInSingleRowMode(MultiConnection *connection, char *query,
  * ExtractParametersFromParamListInfo extracts parameter types and values from
  * the given ParamListInfo structure, and fills parameter type and value arrays.
  */
-static void
+void
 ExtractParametersFromParamListInfo(ParamListInfo paramListInfo, Oid **parameterTypes,
 								   const char ***parameterValues)
 {
@@ -1381,6 +3200,8 @@ StoreQueryResult(CitusScanState *scanState, MultiConnection *connection,
 	bool randomAccess = true;
 	bool interTransactions = false;
 	bool commandFailed = false;
+	FmgrInfo *receiveFunctions = NULL;
+	Oid *typeIoParams = NULL;
 	MemoryContext ioContext = AllocSetContextCreate(CurrentMemoryContext,
 													"StoreQueryResult",
 													ALLOCSET_DEFAULT_MINSIZE,
@@ -1401,6 +3222,13 @@ StoreQueryResult(CitusScanState *scanState, MultiConnection *connection,
 
 	tupleStore = scanState->tuplestorestate;
 
+	/* read the results of a BEGIN that was sent along with the query */
+	if (!FinishPipelinedRemoteTransactionBegin(connection))
+	{
+		MemoryContextDelete(ioContext);
+		return false;
+	}
+
 	for (;;)
 	{
 		uint32 rowIndex = 0;
@@ -1460,6 +3288,12 @@ StoreQueryResult(CitusScanState *scanState, MultiConnection *connection,
 		columnCount = PQnfields(result);
 		Assert(columnCount == expectedColumnCount);
 
+		if (PQbinaryTuples(result) && receiveFunctions == NULL)
+		{
+			GetColumnReceiveFunctions(tupleDescriptor, &receiveFunctions,
+									  &typeIoParams);
+		}
+
 		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
 		{
 			HeapTuple heapTuple = NULL;
@@ -1474,12 +3308,20 @@ StoreQueryResult(CitusScanState *scanState, MultiConnection *connection,
 				}
 				else
 				{
+					int rowLength = PQgetlength(result, rowIndex, columnIndex);
+
 					columnArray[columnIndex] = PQgetvalue(result, rowIndex, columnIndex);
 					if (SubPlanLevel > 0 && executionStats)
 					{
-						int rowLength = PQgetlength(result, rowIndex, columnIndex);
 						executionStats->totalIntermediateResultSize += rowLength;
 					}
+
+					if (executionStats != NULL)
+					{
+						executionStats->totalBytesReceived += rowLength;
+					}
+
+					QueryStatsAddBytesReceived(rowLength);
 				}
 			}
 
@@ -1490,7 +3332,15 @@ StoreQueryResult(CitusScanState *scanState, MultiConnection *connection,
 			 */
 			oldContext = MemoryContextSwitchTo(ioContext);
 
-			heapTuple = BuildTupleFromCStrings(attributeInputMetadata, columnArray);
+			if (PQbinaryTuples(result))
+			{
+				heapTuple = BuildTupleFromBinaryResult(result, rowIndex, tupleDescriptor,
+													   receiveFunctions, typeIoParams);
+			}
+			else
+			{
+				heapTuple = BuildTupleFromCStrings(attributeInputMetadata, columnArray);
+			}
 
 			MemoryContextSwitchTo(oldContext);
 
@@ -1508,6 +3358,315 @@ StoreQueryResult(CitusScanState *scanState, MultiConnection *connection,
 }
 
 
+/*
+ * GetColumnReceiveFunctions looks up the binary receive function and the type
+ * I/O parameter of each column in the tuple descriptor, and returns them in
+ * newly allocated arrays.
+ */
+static void
+GetColumnReceiveFunctions(TupleDesc tupleDescriptor, FmgrInfo **receiveFunctions,
+						  Oid **typeIoParams)
+{
+	int columnCount = tupleDescriptor->natts;
+	int columnIndex = 0;
+
+	*receiveFunctions = (FmgrInfo *) palloc0(columnCount * sizeof(FmgrInfo));
+	*typeIoParams = (Oid *) palloc0(columnCount * sizeof(Oid));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid receiveFunctionId = InvalidOid;
+
+		getTypeBinaryInputInfo(attribute->atttypid, &receiveFunctionId,
+							   &(*typeIoParams)[columnIndex]);
+		fmgr_info(receiveFunctionId, &(*receiveFunctions)[columnIndex]);
+	}
+}
+
+
+/*
+ * BuildTupleFromBinaryResult builds a heap tuple from the binary values in the
+ * given row of the result, using the receive functions of the column types.
+ */
+static HeapTuple
+BuildTupleFromBinaryResult(PGresult *result, int rowIndex, TupleDesc tupleDescriptor,
+						   FmgrInfo *receiveFunctions, Oid *typeIoParams)
+{
+	int columnCount = tupleDescriptor->natts;
+	int columnIndex = 0;
+	Datum *columnValues = (Datum *) palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = (bool *) palloc0(columnCount * sizeof(bool));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		FmgrInfo *receiveFunction = &receiveFunctions[columnIndex];
+		Oid typeIoParam = typeIoParams[columnIndex];
+		StringInfoData valueBuffer;
+
+		if (PQgetisnull(result, rowIndex, columnIndex))
+		{
+			/* call the receive function for NULLs too, to check domain constraints */
+			columnValues[columnIndex] = ReceiveFunctionCall(receiveFunction, NULL,
+															typeIoParam,
+															attribute->atttypmod);
+			columnNulls[columnIndex] = true;
+			continue;
+		}
+
+		/* receive functions expect a null-terminated buffer they may write to */
+		initStringInfo(&valueBuffer);
+		appendBinaryStringInfo(&valueBuffer, PQgetvalue(result, rowIndex, columnIndex),
+							   PQgetlength(result, rowIndex, columnIndex));
+
+		columnValues[columnIndex] = ReceiveFunctionCall(receiveFunction, &valueBuffer,
+														typeIoParam,
+														attribute->atttypmod);
+
+		if (valueBuffer.cursor != valueBuffer.len)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+							errmsg("incorrect binary data format in column %d",
+								   columnIndex + 1)));
+		}
+	}
+
+	return heap_form_tuple(tupleDescriptor, columnValues, columnNulls);
+}
+
+
+#if (PG_VERSION_NUM >= 100000)
+
+/*
+ * StoreCopyQueryResult reads the rows of a task query that was wrapped in
+ * COPY .. TO STDOUT from the given connection and parses them into the tuple
+ * store of the scan in bulk. Like StoreQueryResult, the function returns false
+ * if it can't receive the query results.
+ */
+static bool
+StoreCopyQueryResult(CitusScanState *scanState, MultiConnection *connection,
+					 bool binaryResults, bool failOnError, int64 *rows,
+					 DistributedExecutionStats *executionStats)
+{
+	TupleDesc tupleDescriptor =
+		scanState->customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	char *copyFormat = binaryResults ? "binary" : "text";
+	CopyResultReceiveState receiveState;
+	PGresult *result = NULL;
+	ExecStatusType resultStatus = 0;
+	bool randomAccess = true;
+	bool interTransactions = false;
+	bool raiseInterrupts = true;
+	bool commandFailed = false;
+
+	*rows = 0;
+
+	if (scanState->tuplestorestate == NULL)
+	{
+		scanState->tuplestorestate =
+			tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+	}
+	else if (!failOnError)
+	{
+		/* might have failed query execution on another placement before */
+		tuplestore_clear(scanState->tuplestorestate);
+	}
+
+	/* read the results of a BEGIN that was sent along with the query */
+	if (!FinishPipelinedRemoteTransactionBegin(connection))
+	{
+		return false;
+	}
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (PQresultStatus(result) != PGRES_COPY_OUT)
+	{
+		char *sqlStateString = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+		int category = ERRCODE_TO_CATEGORY(ERRCODE_INTEGRITY_CONSTRAINT_VIOLATION);
+		bool isConstraintViolation = SqlStateMatchesCategory(sqlStateString, category);
+
+		MarkRemoteTransactionFailed(connection, false);
+
+		if (isConstraintViolation || failOnError)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+		else
+		{
+			ReportResultError(connection, result, WARNING);
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+
+		return false;
+	}
+
+	PQclear(result);
+
+	memset(&receiveState, 0, sizeof(CopyResultReceiveState));
+	receiveState.connection = connection;
+	receiveState.executionStats = executionStats;
+
+	Assert(CurrentCopyResult == NULL);
+	CurrentCopyResult = &receiveState;
+
+	PG_TRY();
+	{
+		ReadCopyDataIntoTupleStore(ReceiveCopyResultData, copyFormat, tupleDescriptor,
+								   scanState->tuplestorestate);
+	}
+	PG_CATCH();
+	{
+		CurrentCopyResult = NULL;
+
+		if (receiveState.rowBuffer != NULL)
+		{
+			PQfreemem(receiveState.rowBuffer);
+		}
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	CurrentCopyResult = NULL;
+
+	if (receiveState.rowBuffer != NULL)
+	{
+		PQfreemem(receiveState.rowBuffer);
+	}
+
+	if (receiveState.copyFailed)
+	{
+		MarkRemoteTransactionFailed(connection, false);
+		ReportConnectionError(connection, WARNING);
+
+		return false;
+	}
+
+	/* the final result tells whether the query completed */
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	resultStatus = PQresultStatus(result);
+	if (resultStatus == PGRES_COMMAND_OK)
+	{
+		char *rowCountString = PQcmdTuples(result);
+
+		if (rowCountString != NULL && rowCountString[0] != '\0')
+		{
+			*rows = pg_strtouint64(rowCountString, NULL, 10);
+		}
+	}
+	else
+	{
+		char *sqlStateString = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+		int category = ERRCODE_TO_CATEGORY(ERRCODE_INTEGRITY_CONSTRAINT_VIOLATION);
+		bool isConstraintViolation = SqlStateMatchesCategory(sqlStateString, category);
+
+		MarkRemoteTransactionFailed(connection, false);
+
+		if (isConstraintViolation || failOnError)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+		else
+		{
+			ReportResultError(connection, result, WARNING);
+		}
+
+		commandFailed = true;
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	return !commandFailed;
+}
+
+
+/*
+ * ReceiveCopyResultData is the data source callback of the COPY that parses
+ * the rows of the current COPY result. It passes on the CopyData messages
+ * received from the connection and returns fewer than minread bytes only
+ * once all rows were received, or receiving them failed. Since every CopyData
+ * message holds a complete row, the parser never sees a partial row.
+ */
+static int
+ReceiveCopyResultData(void *outbuf, int minread, int maxread)
+{
+	CopyResultReceiveState *receiveState = CurrentCopyResult;
+	char *outputBuffer = (char *) outbuf;
+	int bytesCopied = 0;
+
+	while (bytesCopied < minread)
+	{
+		int bytesAvailable = receiveState->rowLength - receiveState->rowOffset;
+		int bytesToCopy = 0;
+		int rowLength = 0;
+		bool raiseInterrupts = true;
+
+		if (bytesAvailable > 0)
+		{
+			bytesToCopy = Min(bytesAvailable, maxread - bytesCopied);
+
+			memcpy(outputBuffer + bytesCopied,
+				   receiveState->rowBuffer + receiveState->rowOffset, bytesToCopy);
+
+			receiveState->rowOffset += bytesToCopy;
+			bytesCopied += bytesToCopy;
+
+			continue;
+		}
+
+		if (receiveState->copyDone || receiveState->copyFailed)
+		{
+			break;
+		}
+
+		if (receiveState->rowBuffer != NULL)
+		{
+			PQfreemem(receiveState->rowBuffer);
+			receiveState->rowBuffer = NULL;
+		}
+
+		receiveState->rowLength = 0;
+		receiveState->rowOffset = 0;
+
+		rowLength = GetRemoteCopyData(receiveState->connection,
+									  &receiveState->rowBuffer, raiseInterrupts);
+		if (rowLength == -1)
+		{
+			receiveState->copyDone = true;
+			break;
+		}
+		else if (rowLength < 0)
+		{
+			receiveState->copyFailed = true;
+			break;
+		}
+
+		receiveState->rowLength = rowLength;
+
+		if (receiveState->executionStats != NULL)
+		{
+			receiveState->executionStats->totalBytesReceived += rowLength;
+
+			if (SubPlanLevel > 0)
+			{
+				receiveState->executionStats->totalIntermediateResultSize += rowLength;
+			}
+		}
+
+		QueryStatsAddBytesReceived(rowLength);
+	}
+
+	return bytesCopied;
+}
+
+
+#endif
+
+
 /*
  * ConsumeQueryResult gets a query result from a connection, counting the rows
  * and checking for errors, but otherwise discarding potentially returned
@@ -1522,6 +3681,12 @@ ConsumeQueryResult(MultiConnection *connection, bool failOnError, int64 *rows)
 
 	*rows = 0;
 
+	/* read the results of a BEGIN that was sent along with the query */
+	if (!FinishPipelinedRemoteTransactionBegin(connection))
+	{
+		return false;
+	}
+
 	/*
 	 * Due to single row mode we have to do multiple GetRemoteCommandResult()
 	 * to finish processing of this query, even without RETURNING. For
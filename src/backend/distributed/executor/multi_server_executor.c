@@ -19,6 +19,7 @@
 
 #include <unistd.h>
 
+#include "distributed/job_directory_cleanup.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_resowner.h"
@@ -29,7 +30,9 @@
 int RemoteTaskCheckInterval = 100; /* per cycle sleep interval in millisecs */
 int TaskExecutorType = MULTI_EXECUTOR_REAL_TIME; /* distributed executor type */
 bool BinaryMasterCopyFormat = false; /* copy data from workers in binary format */
+bool PropagateStatementTimeout = true; /* forward statement_timeout to tasks */
 bool EnableRepartitionJoins = false;
+bool EnableExecutorSelection = false; /* pick the executor based on the plan */
 
 
 /*
@@ -54,6 +57,14 @@ JobExecutorType(DistributedPlan *distributedPlan)
 	if (routerExecutablePlan)
 	{
 		ereport(DEBUG2, (errmsg("Plan is router executable")));
+
+		/* the adaptive executor handles SELECT, UPDATE and DELETE */
+		if (executorType == MULTI_EXECUTOR_ADAPTIVE &&
+			distributedPlan->operation != CMD_INSERT)
+		{
+			return MULTI_EXECUTOR_ADAPTIVE;
+		}
+
 		return MULTI_EXECUTOR_ROUTER;
 	}
 
@@ -69,13 +80,33 @@ JobExecutorType(DistributedPlan *distributedPlan)
 	taskCount = list_length(job->taskList);
 	tasksPerNode = taskCount / ((double) workerNodeCount);
 
-	if (executorType == MULTI_EXECUTOR_REAL_TIME)
+	if (executorType == MULTI_EXECUTOR_REAL_TIME ||
+		executorType == MULTI_EXECUTOR_ADAPTIVE)
 	{
-		double reasonableConnectionCount = 0;
+		double reasonableConnectionCount = MaxMasterConnectionCount();
 		int dependedJobCount = 0;
 
-		/* if we need to open too many connections per worker, warn the user */
-		if (tasksPerNode >= MaxConnections)
+		/*
+		 * When the real-time executor would need more connections to the workers
+		 * or more file descriptors than it can get, the task-tracker executor is
+		 * the cheaper choice, since it runs all tasks over one connection per
+		 * worker. We only switch if the task trackers can take all the tasks.
+		 */
+		if (EnableExecutorSelection && executorType == MULTI_EXECUTOR_REAL_TIME &&
+			(tasksPerNode >= MaxConnections || taskCount >= reasonableConnectionCount) &&
+			tasksPerNode < MaxTrackedTasksPerNode)
+		{
+			ereport(DEBUG1, (errmsg("using task-tracker executor since the query "
+									"needs more connections than the real-time "
+									"executor can open")));
+			return MULTI_EXECUTOR_TASK_TRACKER;
+		}
+
+		/*
+		 * If we need to open too many connections per worker, warn the user. The
+		 * adaptive executor limits its connections per worker, so it is exempt.
+		 */
+		if (executorType == MULTI_EXECUTOR_REAL_TIME && tasksPerNode >= MaxConnections)
 		{
 			ereport(WARNING, (errmsg("this query uses more connections than the "
 									 "configured max_connections limit"),
@@ -89,8 +120,8 @@ JobExecutorType(DistributedPlan *distributedPlan)
 		 * The real-time executor caps the number of tasks it starts by the same limit,
 		 * but we still issue this warning because it degrades performance.
 		 */
-		reasonableConnectionCount = MaxMasterConnectionCount();
-		if (taskCount >= reasonableConnectionCount)
+		if (executorType == MULTI_EXECUTOR_REAL_TIME &&
+			taskCount >= reasonableConnectionCount)
 		{
 			ereport(WARNING, (errmsg("this query uses more file descriptors than the "
 									 "configured max_files_per_process limit"),
@@ -105,7 +136,7 @@ JobExecutorType(DistributedPlan *distributedPlan)
 		dependedJobCount = list_length(job->dependedJobList);
 		if (dependedJobCount > 0)
 		{
-			if (!EnableRepartitionJoins)
+			if (!EnableRepartitionJoins && !EnableExecutorSelection)
 			{
 				ereport(ERROR, (errmsg(
 									"the query contains a join that requires repartitioning"),
@@ -114,7 +145,9 @@ JobExecutorType(DistributedPlan *distributedPlan)
 			}
 
 			ereport(DEBUG1, (errmsg(
-								 "cannot use real time executor with repartition jobs"),
+								 "cannot use %s executor with repartition jobs",
+								 executorType == MULTI_EXECUTOR_ADAPTIVE ?
+								 "adaptive" : "real time"),
 							 errhint("Since you enabled citus.enable_repartition_joins "
 									 "Citus chose to use task-tracker.")));
 			return MULTI_EXECUTOR_TASK_TRACKER;
@@ -151,14 +184,15 @@ MaxMasterConnectionCount(void)
 
 /*
  * RemoveJobDirectory gets automatically called at portal drop (end of query) or
- * at transaction abort. The function removes the job directory and releases the
- * associated job resource from the resource manager.
+ * at transaction abort. The function removes the job directory, leaving the
+ * removal of its files to the task tracker, and releases the associated job
+ * resource from the resource manager.
  */
 void
 RemoveJobDirectory(uint64 jobId)
 {
 	StringInfo jobDirectoryName = MasterJobDirectoryName(jobId);
-	CitusRemoveDirectory(jobDirectoryName);
+	RemoveJobCacheDirectory(jobDirectoryName);
 
 	ResourceOwnerForgetJobDirectory(CurrentResourceOwner, jobId);
 }
@@ -181,8 +215,18 @@ InitTaskExecution(Task *task, TaskExecStatus initialTaskExecStatus)
 	taskExecution->taskId = task->taskId;
 	taskExecution->nodeCount = nodeCount;
 	taskExecution->connectStartTime = 0;
+	taskExecution->queryStartTime = 0;
+	taskExecution->bytesReceived = 0;
 	taskExecution->currentNodeIndex = 0;
+	taskExecution->pushedNodeIndex = -1;
+	taskExecution->bloomFilterTaskList = NIL;
+	taskExecution->partitionCommand = NULL;
 	taskExecution->failureCount = 0;
+	taskExecution->queueTime = 0;
+	taskExecution->executionTime = -1.0;
+	taskExecution->speculativeNodeIndex = -1;
+	taskExecution->speculativeCopyStarted = false;
+	taskExecution->awaitingPlacement = false;
 
 	taskExecution->taskStatusArray = palloc0(nodeCount * sizeof(TaskExecStatus));
 	taskExecution->transmitStatusArray = palloc0(nodeCount * sizeof(TransmitExecStatus));
@@ -18,7 +18,9 @@
  */
 
 #include "postgres.h"
+#include "libpq-fe.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -33,12 +35,19 @@
 #include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/partition_cache.h"
 #include "distributed/pg_dist_partition.h"
+#include "distributed/query_stats.h"
+#include "distributed/remote_commands.h"
 #include "distributed/resource_lock.h"
+#include "distributed/result_cache.h"
+#include "distributed/secondary_node_routing.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
+#include "optimizer/clauses.h"
 #include "storage/fd.h"
+#include "storage/latch.h"
 #include "utils/builtins.h"
 #include "utils/hsearch.h"
 #include "utils/timestamp.h"
@@ -46,6 +55,61 @@
 
 int MaxAssignTaskBatchSize = 64; /* maximum number of tasks to assign per round */
 int MaxTaskStatusBatchSize = 64; /* maximum number of tasks status checks per round */
+bool EnableRepartitionPush = false; /* stream map output to merge task nodes */
+int RepartitionBloomFilterSize = 0; /* size of join key bloom filters in KB */
+double SpeculativeMapTaskFactor = 0.0; /* re-execute map tasks slower than this */
+bool EnableLocalityAwareMerge = false; /* run merge tasks close to their input */
+bool EnableRepartitionCache = false; /* reuse map output of unmodified shards */
+
+
+/* partition destination arguments appended to map task commands */
+#define PUSH_PARTITION_ARGUMENTS \
+	", ARRAY[%s]::integer[], ARRAY[%s]::text[], ARRAY[%s]::integer[])"
+
+#define NO_PUSH_PARTITION_ARGUMENTS \
+	", ARRAY[]::integer[], ARRAY[]::text[], ARRAY[]::integer[]"
+
+/* query to learn the sizes of the partition files of map tasks on a node */
+#define PARTITION_FILE_SIZES_QUERY \
+	"SELECT task_id, partition_id, file_size " \
+	"FROM worker_partition_file_sizes(" UINT64_FORMAT ", ARRAY[%s]::integer[])"
+
+/* bloom filter arguments appended to hash partition commands after the above */
+#define BLOOM_FILTER_ARGUMENTS \
+	", %u, " UINT64_FORMAT ", ARRAY[%s]::integer[], ARRAY[%s]::text[], " \
+	"ARRAY[%s]::integer[])"
+
+
+/*
+ * MapOutputSizeKey is used as a key in the hash of map output sizes. It
+ * identifies a map task.
+ */
+typedef struct MapOutputSizeKey
+{
+	uint64 jobId;
+	uint32 taskId;
+} MapOutputSizeKey;
+
+
+/*
+ * MapOutputSizeEntry holds the sizes of the partition files of a map task,
+ * indexed by partition id.
+ */
+typedef struct MapOutputSizeEntry
+{
+	MapOutputSizeKey key;
+	uint32 partitionCount;
+	uint64 *partitionSizeArray;
+} MapOutputSizeEntry;
+
+
+/* NodeInputSize is the number of bytes of a merge task's input on a node */
+typedef struct NodeInputSize
+{
+	char *nodeName;
+	uint32 nodePort;
+	uint64 inputSize;
+} NodeInputSize;
 
 
 /* TaskMapKey is used as a key in task hash */
@@ -70,6 +134,7 @@ typedef struct TaskMapEntry
 
 /* Local functions forward declarations to init tasks and trackers */
 static List * TaskAndExecutionList(List *jobTaskList);
+static List * DependencyOrderedTaskList(List *taskAndExecutionList);
 static HTAB * TaskHashCreate(uint32 taskHashSize);
 static Task * TaskHashEnter(HTAB *taskHash, Task *task);
 static Task * TaskHashLookup(HTAB *trackerHash, TaskType taskType, uint64 jobId,
@@ -86,6 +151,8 @@ static void TrackerHashConnect(HTAB *taskTrackerHash);
 static TrackerStatus TrackerConnectPoll(TaskTracker *taskTracker);
 static TaskTracker * ResolveTaskTracker(HTAB *trackerHash, Task *task,
 										TaskExecution *taskExecution);
+static TaskTracker * NodeIndexTaskTracker(HTAB *trackerHash, Task *task,
+										  uint32 nodeIndex);
 static TaskTracker * ResolveMapTaskTracker(HTAB *trackerHash, Task *task,
 										   TaskExecution *taskExecution);
 static TaskTracker * TrackerHashLookup(HTAB *trackerHash, const char *nodeName,
@@ -101,7 +168,39 @@ static TransmitExecStatus ManageTransmitExecution(TaskTracker *transmitTracker,
 												  DistributedExecutionStats *
 												  executionStats);
 static bool TaskExecutionsCompleted(List *taskList);
+static double MedianMapTaskExecutionTime(List *taskAndExecutionList);
+static int CompareExecutionTimes(const void *leftElement, const void *rightElement);
+static void ManageSpeculativeMapTask(HTAB *taskTrackerHash, Task *task,
+									 double medianExecutionTime);
+static bool SpeculativeMapTaskDue(Task *task, double medianExecutionTime);
+static void StartSpeculativeMapTask(HTAB *taskTrackerHash, Task *task);
+static void StopSpeculativeMapTask(TaskExecution *taskExecution);
+static double MillisecondsBetween(TimestampTz startTime, TimestampTz endTime);
+static List * LocalityAwareTaskList(List *taskAndExecutionList);
+static List * PlaceTasksNearMergeInput(HTAB *taskTrackerHash,
+									   List *taskAndExecutionList,
+									   List *unplacedTaskList,
+									   HTAB *mapOutputSizeHash);
+static void PlaceConstraintGroup(HTAB *taskTrackerHash, List *taskAndExecutionList,
+								 List *mergeTaskList, List *mapFetchTaskList,
+								 HTAB *mapOutputSizeHash);
+static bool ConstraintGroupUnassigned(List *constrainedTaskList);
+static ShardPlacement * MapTaskPlacement(Task *mapTask);
+static HTAB * MapOutputSizeHashCreate(void);
+static void FetchMapOutputSizes(HTAB *mapOutputSizeHash, List *mapTaskList);
+static void FetchNodeMapOutputSizes(HTAB *mapOutputSizeHash, ShardPlacement *placement,
+									List *mapTaskList);
+static uint64 MapOutputPartitionSize(HTAB *mapOutputSizeHash, Task *mapTask,
+									 uint32 partitionId);
 static StringInfo MapFetchTaskQueryString(Task *mapFetchTask, Task *mapTask);
+static void AssignPartitionPushDestinations(Task *mapTask, List *mapFetchTaskList);
+static void AssignBloomFilters(Job *job, List *taskAndExecutionList);
+static bool DualPartitionJob(Job *job, uint64 jobId);
+static List * MergeTaskMapTaskList(Task *mergeTask);
+static bool RepartitionCacheAllowed(Job *job, Task *mapTask);
+static char * CachedPartitionCommand(Task *mapTask);
+static char * BloomFilterCommand(const char *partitionCommand, uint32 bloomFilterSize,
+								 List *filterTaskList);
 static void TrackerQueueSqlTask(TaskTracker *taskTracker, Task *task);
 static void TrackerQueueTask(TaskTracker *taskTracker, Task *task);
 static StringInfo TaskAssignmentQuery(Task *task, char *queryString);
@@ -126,10 +225,20 @@ static void ReassignMapFetchTaskList(List *mapFetchTaskList);
 static void ManageTaskTracker(TaskTracker *taskTracker);
 static bool TrackerConnectionUp(TaskTracker *taskTracker);
 static void TrackerReconnectPoll(TaskTracker *taskTracker);
+static void ListenForTaskStatusChanges(int32 connectionId);
+static void WaitForTrackerActivity(HTAB *taskTrackerHash, HTAB *transmitTrackerHash,
+								   long timeout);
+static void AddTrackerWaitEvents(WaitEventSet *waitEventSet, HTAB *trackerHash);
+static void ConsumeTrackerNotifications(HTAB *trackerHash);
 static List * AssignQueuedTasks(TaskTracker *taskTracker);
+static bool TaskStatusCheckDue(TaskTracker *taskTracker);
 static List * TaskStatusBatchList(TaskTracker *taskTracker);
+static List * TaskStatusBatchJobList(List *taskList);
 static StringInfo TaskStatusBatchQuery(List *taskList);
 static void ReceiveTaskStatusBatchQueryResponse(TaskTracker *taskTracker);
+static void UpdateJobTaskStatuses(List *taskList, uint64 jobId, void *queryResult,
+								  int rowCount);
+static TaskStatus ParseTaskStatus(char *valueString);
 static void ManageTransmitTracker(TaskTracker *transmitTracker);
 static TrackerTaskState * NextQueuedFileTransmit(HTAB *taskStateHash);
 
@@ -155,6 +264,7 @@ MultiTaskTrackerExecute(Job *job)
 {
 	List *jobTaskList = job->taskList;
 	List *taskAndExecutionList = NIL;
+	List *dependencyOrderedTaskList = NIL;
 	ListCell *taskAndExecutionCell = NULL;
 	uint32 taskTrackerCount = 0;
 	uint32 topLevelTaskCount = 0;
@@ -174,12 +284,24 @@ MultiTaskTrackerExecute(Job *job)
 	const char *transmitTrackerHashName = "Transmit Tracker Hash";
 	List *jobIdList = NIL;
 
+	/* pushed partitions would be sent twice by speculative map tasks */
+	bool speculateMapTasks = (SpeculativeMapTaskFactor > 0.0 && !EnableRepartitionPush);
+	List *unplacedTaskList = NIL;
+	HTAB *mapOutputSizeHash = NULL;
+
 	if (ReadFromSecondaries == USE_SECONDARY_NODES_ALWAYS)
 	{
 		ereport(ERROR, (errmsg("task tracker queries are not allowed while "
 							   "citus.use_secondary_nodes is 'always'"),
 						errhint("try setting citus.task_executor_type TO 'real-time'")));
 	}
+	else if (ReadFromSecondaryNodes())
+	{
+		ereport(ERROR, (errmsg("task tracker queries are not allowed in read-only "
+							   "transactions while citus.use_secondary_nodes is "
+							   "'read-only'"),
+						errhint("try setting citus.task_executor_type TO 'real-time'")));
+	}
 
 	/*
 	 * We walk over the task tree, and create a task execution struct for each
@@ -187,6 +309,73 @@ MultiTaskTrackerExecute(Job *job)
 	 */
 	taskAndExecutionList = TaskAndExecutionList(jobTaskList);
 
+	/*
+	 * We manage tasks after the tasks they depend on, so that a map fetch task
+	 * is queued in the same pass in which its map task completes, and a merge
+	 * task in the same pass in which its last fetch completes.
+	 */
+	dependencyOrderedTaskList = DependencyOrderedTaskList(taskAndExecutionList);
+
+	/*
+	 * If enabled, we make map tasks stream their partitions to the nodes that
+	 * run the merge tasks, in which case the map fetch tasks have nothing to do.
+	 */
+	if (EnableRepartitionPush)
+	{
+		foreach(taskAndExecutionCell, taskAndExecutionList)
+		{
+			Task *task = (Task *) lfirst(taskAndExecutionCell);
+
+			if (task->taskType == MAP_TASK)
+			{
+				List *mapFetchTaskList = UpstreamDependencyList(taskAndExecutionList,
+																task);
+
+				AssignPartitionPushDestinations(task, mapFetchTaskList);
+			}
+		}
+	}
+
+	/*
+	 * If enabled, we have the map tasks of one side of each dual partition join
+	 * build bloom filters on their keys, which the other side uses to drop rows.
+	 */
+	if (RepartitionBloomFilterSize > 0)
+	{
+		AssignBloomFilters(job, taskAndExecutionList);
+	}
+
+	/*
+	 * If enabled, map tasks that read shards have workers reuse the partition
+	 * files they wrote for the same command, unless the shards were modified
+	 * since. Pushed partitions and bloom filters depend on the other tasks of
+	 * the job, so we do not cache the output of such map tasks.
+	 */
+	if (EnableRepartitionCache && !EnableRepartitionPush &&
+		RepartitionBloomFilterSize == 0)
+	{
+		foreach(taskAndExecutionCell, taskAndExecutionList)
+		{
+			Task *task = (Task *) lfirst(taskAndExecutionCell);
+
+			if (task->taskType == MAP_TASK && RepartitionCacheAllowed(job, task))
+			{
+				task->queryString = CachedPartitionCommand(task);
+			}
+		}
+	}
+
+	/*
+	 * If enabled, we hold back map fetch tasks until the map tasks complete,
+	 * and then move their merge tasks to the node with most of their input.
+	 * With pushed partitions, the merge task nodes are already fixed.
+	 */
+	if (EnableLocalityAwareMerge && !EnableRepartitionPush)
+	{
+		unplacedTaskList = LocalityAwareTaskList(taskAndExecutionList);
+		mapOutputSizeHash = MapOutputSizeHashCreate();
+	}
+
 	/*
 	 * We now count the number of "top level" tasks in the query tree. Once they
 	 * complete, we'll need to fetch these tasks' results to the master node.
@@ -233,10 +422,25 @@ MultiTaskTrackerExecute(Job *job)
 		uint32 completedTransmitCount = 0;
 		uint32 healthyTrackerCount = 0;
 		double acceptableHealthyTrackerCount = 0.0;
+		double medianMapTaskTime = -1.0;
 
 		/* first, loop around all tasks and manage them */
 		ListCell *taskAndExecutionCell = NULL;
-		foreach(taskAndExecutionCell, taskAndExecutionList)
+
+		if (speculateMapTasks)
+		{
+			medianMapTaskTime = MedianMapTaskExecutionTime(taskAndExecutionList);
+		}
+
+		if (unplacedTaskList != NIL)
+		{
+			unplacedTaskList = PlaceTasksNearMergeInput(taskTrackerHash,
+														taskAndExecutionList,
+														unplacedTaskList,
+														mapOutputSizeHash);
+		}
+
+		foreach(taskAndExecutionCell, dependencyOrderedTaskList)
 		{
 			Task *task = (Task *) lfirst(taskAndExecutionCell);
 			TaskExecution *taskExecution = task->taskExecution;
@@ -292,6 +496,16 @@ MultiTaskTrackerExecute(Job *job)
 				ReassignTaskList(mapTaskList);
 			}
 
+			/*
+			 * A map task that runs much longer than the others is also started
+			 * on another node that has a replica of its shard, and we use the
+			 * output of whichever copy finishes first.
+			 */
+			if (speculateMapTasks && task->taskType == MAP_TASK)
+			{
+				ManageSpeculativeMapTask(taskTrackerHash, task, medianMapTaskTime);
+			}
+
 			/*
 			 * If this task permanently failed, we first need to manually clean
 			 * out client-side resources for all task executions. We therefore
@@ -408,15 +622,19 @@ MultiTaskTrackerExecute(Job *job)
 			clusterFailed = true;
 		}
 
-		/* check if we completed execution; otherwise sleep to avoid tight loop */
+		/*
+		 * Check if we completed execution; otherwise wait to avoid tight loop.
+		 * Task trackers notify us when tasks complete, so we only wait for the
+		 * full interval if nothing happens on the tracker connections.
+		 */
 		if (completedTransmitCount == topLevelTaskCount)
 		{
 			allTasksCompleted = true;
 		}
 		else
 		{
-			long sleepIntervalPerCycle = RemoteTaskCheckInterval * 1000L;
-			pg_usleep(sleepIntervalPerCycle);
+			WaitForTrackerActivity(taskTrackerHash, transmitTrackerHash,
+								   RemoteTaskCheckInterval);
 		}
 	}
 
@@ -542,6 +760,32 @@ TaskAndExecutionList(List *jobTaskList)
 }
 
 
+/*
+ * DependencyOrderedTaskList returns the tasks in the given list, which is in
+ * breadth-first order starting from the top level tasks, in reverse. For the
+ * task trees we plan, a task in the returned list comes after all tasks it
+ * depends on, and the execution loop sees a task's dependencies complete
+ * before it visits the task itself. Otherwise, each stage of a repartition job
+ * would wait for one more round of task status checks before its tasks could
+ * be assigned.
+ */
+static List *
+DependencyOrderedTaskList(List *taskAndExecutionList)
+{
+	List *dependencyOrderedTaskList = NIL;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskAndExecutionList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		dependencyOrderedTaskList = lcons(task, dependencyOrderedTaskList);
+	}
+
+	return dependencyOrderedTaskList;
+}
+
+
 /*
  * TaskHashCreate allocates memory for a task hash, initializes an
  * empty hash, and returns this hash.
@@ -897,6 +1141,8 @@ TrackerConnectPoll(TaskTracker *taskTracker)
 			if (pollStatus == CLIENT_CONNECTION_READY)
 			{
 				taskTracker->trackerStatus = TRACKER_CONNECTED;
+
+				ListenForTaskStatusChanges(connectionId);
 			}
 			else if (pollStatus == CLIENT_CONNECTION_BUSY ||
 					 pollStatus == CLIENT_CONNECTION_BUSY_READ ||
@@ -963,11 +1209,21 @@ TrackerConnectPoll(TaskTracker *taskTracker)
  */
 static TaskTracker *
 ResolveTaskTracker(HTAB *trackerHash, Task *task, TaskExecution *taskExecution)
+{
+	return NodeIndexTaskTracker(trackerHash, task, taskExecution->currentNodeIndex);
+}
+
+
+/*
+ * NodeIndexTaskTracker resolves the task tracker of the worker node at the
+ * given index in the placement list of the given task.
+ */
+static TaskTracker *
+NodeIndexTaskTracker(HTAB *trackerHash, Task *task, uint32 nodeIndex)
 {
 	List *taskPlacementList = task->taskPlacementList;
-	uint32 currentIndex = taskExecution->currentNodeIndex;
 
-	ShardPlacement *taskPlacement = list_nth(taskPlacementList, currentIndex);
+	ShardPlacement *taskPlacement = list_nth(taskPlacementList, nodeIndex);
 	char *nodeName = taskPlacement->nodeName;
 	uint32 nodePort = taskPlacement->nodePort;
 
@@ -1079,14 +1335,60 @@ ManageTaskExecution(TaskTracker *taskTracker, TaskTracker *sourceTaskTracker,
 			 * if these dependencies' executions have completed.
 			 */
 			taskExecutionsCompleted = TaskExecutionsCompleted(task->dependedTaskList);
-			if (!taskExecutionsCompleted)
+			if (!taskExecutionsCompleted || taskExecution->awaitingPlacement)
 			{
 				nextExecutionStatus = EXEC_TASK_UNASSIGNED;
 				break;
 			}
 
-			/* if map fetch task, create query string from completed map task */
+			/*
+			 * Map tasks that probe bloom filters wait for the filters to be built,
+			 * and then learn where to fetch them from.
+			 */
+			if (taskExecution->bloomFilterTaskList != NIL)
+			{
+				List *filterTaskList = taskExecution->bloomFilterTaskList;
+
+				taskExecutionsCompleted = TaskExecutionsCompleted(filterTaskList);
+				if (!taskExecutionsCompleted)
+				{
+					nextExecutionStatus = EXEC_TASK_UNASSIGNED;
+					break;
+				}
+
+				task->queryString = BloomFilterCommand(taskExecution->partitionCommand,
+													   0, filterTaskList);
+			}
+
+			/*
+			 * If the map task already pushed this partition to our node, there is
+			 * nothing to fetch. If we were failed over to another node since, the
+			 * partition is not available there and we cannot recover.
+			 */
 			taskType = task->taskType;
+			if (taskType == MAP_OUTPUT_FETCH_TASK && taskExecution->pushedNodeIndex >= 0)
+			{
+				if ((uint32) taskExecution->pushedNodeIndex == currentNodeIndex)
+				{
+					nextExecutionStatus = EXEC_TASK_DONE;
+				}
+				else
+				{
+					ereport(WARNING, (errmsg("map output for task %u was pushed to a "
+											 "node that no longer runs its merge task",
+											 task->taskId),
+									  errhint("Set citus.enable_repartition_push to "
+											  "off to allow merge tasks to fail "
+											  "over.")));
+
+					taskExecution->criticalErrorOccurred = true;
+					nextExecutionStatus = EXEC_TASK_UNASSIGNED;
+				}
+
+				break;
+			}
+
+			/* if map fetch task, create query string from completed map task */
 			if (taskType == MAP_OUTPUT_FETCH_TASK)
 			{
 				StringInfo mapFetchTaskQueryString = NULL;
@@ -1111,6 +1413,8 @@ ManageTaskExecution(TaskTracker *taskTracker, TaskTracker *sourceTaskTracker,
 				TrackerQueueTask(taskTracker, task);
 			}
 
+			taskExecution->queueTime = GetCurrentTimestamp();
+
 			nextExecutionStatus = EXEC_TASK_QUEUED;
 			break;
 		}
@@ -1129,6 +1433,9 @@ ManageTaskExecution(TaskTracker *taskTracker, TaskTracker *sourceTaskTracker,
 			remoteTaskStatus = TrackerTaskStatus(taskTracker, task);
 			if (remoteTaskStatus == TASK_SUCCEEDED)
 			{
+				taskExecution->executionTime =
+					MillisecondsBetween(taskExecution->queueTime, GetCurrentTimestamp());
+
 				nextExecutionStatus = EXEC_TASK_DONE;
 			}
 			else if (remoteTaskStatus == TASK_CLIENT_SIDE_ASSIGN_FAILED ||
@@ -1281,138 +1588,864 @@ ManageTaskExecution(TaskTracker *taskTracker, TaskTracker *sourceTaskTracker,
 
 
 /*
- * ManageTransmitExecution manages logic to fetch the results of the given SQL
- * task to the master node. For this, the function checks if the given SQL task
- * has completed. If it has, the function starts the copy out protocol to fetch
- * the task's results and write them to the local filesystem. When the transmit
- * completes or fails, the function notes that by changing the transmit status.
+ * MedianMapTaskExecutionTime returns the median execution time of the map
+ * tasks in the given list that completed. The function returns -1 while less
+ * than half of the map tasks completed, since the median of only the fastest
+ * tasks would make the others look like stragglers.
  */
-static TransmitExecStatus
-ManageTransmitExecution(TaskTracker *transmitTracker,
-						Task *task, TaskExecution *taskExecution,
-						DistributedExecutionStats *executionStats)
+static double
+MedianMapTaskExecutionTime(List *taskAndExecutionList)
 {
-	int32 *fileDescriptorArray = taskExecution->fileDescriptorArray;
-	uint32 currentNodeIndex = taskExecution->currentNodeIndex;
-	uint32 nextNodeIndex = 0;
+	ListCell *taskCell = NULL;
+	double *executionTimeArray = NULL;
+	int mapTaskCount = 0;
+	int completedTaskCount = 0;
+	double medianExecutionTime = -1.0;
 
-	TransmitExecStatus *transmitStatusArray = taskExecution->transmitStatusArray;
-	TransmitExecStatus currentTransmitStatus = transmitStatusArray[currentNodeIndex];
-	TransmitExecStatus nextTransmitStatus = EXEC_TRANSMIT_INVALID_FIRST;
-	Assert(task->taskType == SQL_TASK);
+	executionTimeArray = palloc0(list_length(taskAndExecutionList) * sizeof(double));
 
-	switch (currentTransmitStatus)
+	foreach(taskCell, taskAndExecutionList)
 	{
-		case EXEC_TRANSMIT_UNASSIGNED:
-		{
-			TaskExecStatus *taskStatusArray = taskExecution->taskStatusArray;
-			TaskExecStatus currentExecutionStatus = taskStatusArray[currentNodeIndex];
-			bool trackerHealthy = false;
-
-			/* if top level task's in progress, nothing to do */
-			if (currentExecutionStatus != EXEC_TASK_DONE)
-			{
-				nextTransmitStatus = EXEC_TRANSMIT_UNASSIGNED;
-				break;
-			}
-
-			trackerHealthy = TrackerHealthy(transmitTracker);
-			if (!trackerHealthy)
-			{
-				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_FAILED;
-				break;
-			}
+		Task *task = (Task *) lfirst(taskCell);
+		TaskExecution *taskExecution = task->taskExecution;
 
-			TrackerQueueFileTransmit(transmitTracker, task);
-			nextTransmitStatus = EXEC_TRANSMIT_QUEUED;
-			break;
+		if (task->taskType != MAP_TASK)
+		{
+			continue;
 		}
 
-		case EXEC_TRANSMIT_QUEUED:
+		mapTaskCount++;
+
+		if (taskExecution->executionTime >= 0.0)
 		{
-			QueryStatus queryStatus = CLIENT_INVALID_QUERY;
-			int32 connectionId = INVALID_CONNECTION_ID;
-			TaskStatus taskStatus = TASK_STATUS_INVALID_FIRST;
+			executionTimeArray[completedTaskCount++] = taskExecution->executionTime;
+		}
+	}
 
-			bool trackerHealthy = TrackerHealthy(transmitTracker);
-			if (!trackerHealthy)
-			{
-				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_FAILED;
-				break;
-			}
+	if (completedTaskCount > 0 && completedTaskCount * 2 >= mapTaskCount)
+	{
+		qsort(executionTimeArray, completedTaskCount, sizeof(double),
+			  CompareExecutionTimes);
 
-			taskStatus = TrackerTaskStatus(transmitTracker, task);
-			if (taskStatus == TASK_FILE_TRANSMIT_QUEUED)
-			{
-				/* remain in queued status until tracker assigns this task */
-				nextTransmitStatus = EXEC_TRANSMIT_QUEUED;
-				break;
-			}
-			else if (taskStatus == TASK_CLIENT_SIDE_TRANSMIT_FAILED)
-			{
-				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_RETRY;
-				break;
-			}
+		medianExecutionTime = executionTimeArray[completedTaskCount / 2];
+	}
 
-			/* the open connection belongs to this task */
-			connectionId = TransmitTrackerConnectionId(transmitTracker, task);
-			Assert(connectionId != INVALID_CONNECTION_ID);
-			Assert(taskStatus == TASK_ASSIGNED);
+	pfree(executionTimeArray);
 
-			/* start copy protocol */
-			queryStatus = MultiClientQueryStatus(connectionId);
-			if (queryStatus == CLIENT_QUERY_COPY)
-			{
-				StringInfo jobDirectoryName = MasterJobDirectoryName(task->jobId);
-				StringInfo taskFilename = TaskFilename(jobDirectoryName, task->taskId);
+	return medianExecutionTime;
+}
 
-				char *filename = taskFilename->data;
-				int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
-				int fileMode = (S_IRUSR | S_IWUSR);
 
-				int32 fileDescriptor = BasicOpenFilePerm(filename, fileFlags, fileMode);
-				if (fileDescriptor >= 0)
-				{
-					/*
-					 * All files inside the job directory get automatically cleaned
-					 * up on transaction commit or abort.
-					 */
-					fileDescriptorArray[currentNodeIndex] = fileDescriptor;
-					nextTransmitStatus = EXEC_TRANSMIT_COPYING;
-				}
-				else
-				{
-					ereport(WARNING, (errcode_for_file_access(),
-									  errmsg("could not open file \"%s\": %m",
-											 filename)));
+/* CompareExecutionTimes is a qsort comparator for execution times. */
+static int
+CompareExecutionTimes(const void *leftElement, const void *rightElement)
+{
+	double leftTime = *((const double *) leftElement);
+	double rightTime = *((const double *) rightElement);
 
-					nextTransmitStatus = EXEC_TRANSMIT_TRACKER_RETRY;
-				}
-			}
-			else
-			{
-				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_RETRY;
-			}
+	if (leftTime < rightTime)
+	{
+		return -1;
+	}
+	else if (leftTime > rightTime)
+	{
+		return 1;
+	}
 
-			/*
-			 * We use task tracker logic to manage file transmits as well, but that
-			 * abstraction starts to leak after we drop into the copy protocol. To
-			 * make our task tracker logic work, we need to "void" the tracker's
-			 * connection if the transmit task failed in here.
-			 */
-			if (nextTransmitStatus == EXEC_TRANSMIT_TRACKER_RETRY)
-			{
-				transmitTracker->connectionBusy = false;
-				transmitTracker->connectionBusyOnTask = NULL;
-			}
+	return 0;
+}
 
-			break;
-		}
 
-		case EXEC_TRANSMIT_COPYING:
-		{
-			int32 fileDescriptor = fileDescriptorArray[currentNodeIndex];
-			CopyStatus copyStatus = CLIENT_INVALID_COPY;
+/*
+ * ManageSpeculativeMapTask starts a speculative copy of the given map task on
+ * another node when the task runs for much longer than the median map task,
+ * and tracks the copy once started. If the copy completes first, the task
+ * execution moves over to the copy's node, so that map fetch tasks fetch the
+ * partitions from there. If the original completes or fails first, or the
+ * copy fails, we stop tracking the copy. A stopped copy may still run on its
+ * node, and its files are removed with the other files of the job.
+ */
+static void
+ManageSpeculativeMapTask(HTAB *taskTrackerHash, Task *task, double medianExecutionTime)
+{
+	TaskExecution *taskExecution = task->taskExecution;
+	TaskExecStatus *taskStatusArray = taskExecution->taskStatusArray;
+	uint32 currentNodeIndex = taskExecution->currentNodeIndex;
+	int32 speculativeNodeIndex = taskExecution->speculativeNodeIndex;
+	TaskTracker *speculativeTracker = NULL;
+	TaskStatus remoteTaskStatus = TASK_STATUS_INVALID_FIRST;
+
+	if (speculativeNodeIndex < 0)
+	{
+		if (taskStatusArray[currentNodeIndex] == EXEC_TASK_QUEUED &&
+			SpeculativeMapTaskDue(task, medianExecutionTime))
+		{
+			StartSpeculativeMapTask(taskTrackerHash, task);
+		}
+
+		return;
+	}
+
+	if (taskStatusArray[currentNodeIndex] != EXEC_TASK_QUEUED)
+	{
+		StopSpeculativeMapTask(taskExecution);
+		return;
+	}
+
+	speculativeTracker = NodeIndexTaskTracker(taskTrackerHash, task,
+											  (uint32) speculativeNodeIndex);
+	if (!TrackerHealthy(speculativeTracker))
+	{
+		StopSpeculativeMapTask(taskExecution);
+		return;
+	}
+
+	remoteTaskStatus = TrackerTaskStatus(speculativeTracker, task);
+	if (remoteTaskStatus == TASK_SUCCEEDED)
+	{
+		ereport(DEBUG1, (errmsg("speculative copy of map task %u on node \"%s:%u\" "
+								"completed first", task->taskId,
+								speculativeTracker->workerName,
+								speculativeTracker->workerPort)));
+
+		/* the original keeps running, but we no longer check its status */
+		taskStatusArray[currentNodeIndex] = EXEC_TASK_UNASSIGNED;
+		taskStatusArray[speculativeNodeIndex] = EXEC_TASK_DONE;
+
+		taskExecution->currentNodeIndex = (uint32) speculativeNodeIndex;
+		taskExecution->speculativeNodeIndex = -1;
+		taskExecution->executionTime =
+			MillisecondsBetween(taskExecution->queueTime, GetCurrentTimestamp());
+	}
+	else if (remoteTaskStatus == TASK_CLIENT_SIDE_ASSIGN_FAILED ||
+			 remoteTaskStatus == TASK_CLIENT_SIDE_STATUS_FAILED ||
+			 remoteTaskStatus == TASK_PERMANENTLY_FAILED)
+	{
+		StopSpeculativeMapTask(taskExecution);
+	}
+}
+
+
+/*
+ * SpeculativeMapTaskDue returns whether the given map task has been running
+ * for long enough to start a speculative copy of it. We start at most one
+ * copy per task, and only for tasks with a replica on another node. Map tasks
+ * that read the output of merge tasks are bound to the nodes that ran those.
+ */
+static bool
+SpeculativeMapTaskDue(Task *task, double medianExecutionTime)
+{
+	TaskExecution *taskExecution = task->taskExecution;
+	double runningTime = 0.0;
+	double speculationThreshold = 0.0;
+
+	if (medianExecutionTime < 0.0 || taskExecution->speculativeCopyStarted ||
+		taskExecution->nodeCount < 2 || MergeTaskList(task->dependedTaskList) != NIL)
+	{
+		return false;
+	}
+
+	/* do not bother with tasks that are only slow compared to tiny ones */
+	speculationThreshold = Max(medianExecutionTime * SpeculativeMapTaskFactor,
+							   (double) RemoteTaskCheckInterval);
+
+	runningTime = MillisecondsBetween(taskExecution->queueTime, GetCurrentTimestamp());
+
+	return runningTime > speculationThreshold;
+}
+
+
+/*
+ * StartSpeculativeMapTask queues a copy of the given map task on the next
+ * healthy task tracker that has a replica of the task's shard.
+ */
+static void
+StartSpeculativeMapTask(HTAB *taskTrackerHash, Task *task)
+{
+	TaskExecution *taskExecution = task->taskExecution;
+	uint32 nodeCount = taskExecution->nodeCount;
+	uint32 currentNodeIndex = taskExecution->currentNodeIndex;
+	uint32 nodeOffset = 0;
+
+	for (nodeOffset = 1; nodeOffset < nodeCount; nodeOffset++)
+	{
+		uint32 nodeIndex = (currentNodeIndex + nodeOffset) % nodeCount;
+		TaskTracker *taskTracker = NodeIndexTaskTracker(taskTrackerHash, task,
+														nodeIndex);
+
+		if (!TrackerHealthy(taskTracker))
+		{
+			continue;
+		}
+
+		ereport(DEBUG1, (errmsg("starting speculative copy of map task %u on node "
+								"\"%s:%u\"", task->taskId, taskTracker->workerName,
+								taskTracker->workerPort)));
+
+		TrackerQueueTask(taskTracker, task);
+
+		taskExecution->taskStatusArray[nodeIndex] = EXEC_TASK_QUEUED;
+		taskExecution->speculativeNodeIndex = (int32) nodeIndex;
+		break;
+	}
+
+	/* we try only once, even if there was no other node to run the copy on */
+	taskExecution->speculativeCopyStarted = true;
+}
+
+
+/*
+ * StopSpeculativeMapTask stops tracking the speculative copy of a map task, if
+ * the task has one.
+ */
+static void
+StopSpeculativeMapTask(TaskExecution *taskExecution)
+{
+	int32 speculativeNodeIndex = taskExecution->speculativeNodeIndex;
+
+	if (speculativeNodeIndex < 0)
+	{
+		return;
+	}
+
+	if ((uint32) speculativeNodeIndex != taskExecution->currentNodeIndex)
+	{
+		taskExecution->taskStatusArray[speculativeNodeIndex] = EXEC_TASK_UNASSIGNED;
+	}
+
+	taskExecution->speculativeNodeIndex = -1;
+}
+
+
+/* MillisecondsBetween returns the number of milliseconds between two timestamps. */
+static double
+MillisecondsBetween(TimestampTz startTime, TimestampTz endTime)
+{
+	long seconds = 0;
+	int microseconds = 0;
+
+	TimestampDifference(startTime, endTime, &seconds, &microseconds);
+
+	return seconds * 1000.0 + microseconds / 1000.0;
+}
+
+
+/*
+ * LocalityAwareTaskList finds the tasks that depend on merge tasks and may
+ * run on any node, and returns one such task for each constraint group. Tasks
+ * that also read a shard are bound to the shard's placements. The function
+ * makes the map fetch tasks of the returned groups wait until their merge
+ * tasks were placed.
+ */
+static List *
+LocalityAwareTaskList(List *taskAndExecutionList)
+{
+	List *localityAwareTaskList = NIL;
+	List *placedMergeTaskList = NIL;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskAndExecutionList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		List *mergeTaskList = NIL;
+		ListCell *mergeTaskCell = NULL;
+		Task *firstMergeTask = NULL;
+
+		if (task->taskType != SQL_TASK && task->taskType != MAP_TASK)
+		{
+			continue;
+		}
+
+		if (task->anchorShardId != INVALID_SHARD_ID)
+		{
+			continue;
+		}
+
+		mergeTaskList = MergeTaskList(task->dependedTaskList);
+		if (mergeTaskList == NIL)
+		{
+			continue;
+		}
+
+		/* tasks that depend on the same merge task are in the same group */
+		firstMergeTask = (Task *) linitial(mergeTaskList);
+		if (list_member_ptr(placedMergeTaskList, firstMergeTask))
+		{
+			continue;
+		}
+
+		placedMergeTaskList = lappend(placedMergeTaskList, firstMergeTask);
+		localityAwareTaskList = lappend(localityAwareTaskList, task);
+
+		foreach(mergeTaskCell, mergeTaskList)
+		{
+			Task *mergeTask = (Task *) lfirst(mergeTaskCell);
+			ListCell *mapFetchTaskCell = NULL;
+
+			foreach(mapFetchTaskCell, mergeTask->dependedTaskList)
+			{
+				Task *mapFetchTask = (Task *) lfirst(mapFetchTaskCell);
+
+				mapFetchTask->taskExecution->awaitingPlacement = true;
+			}
+		}
+	}
+
+	return localityAwareTaskList;
+}
+
+
+/*
+ * PlaceTasksNearMergeInput walks over the given tasks whose constraint groups
+ * were not placed yet. Once all map tasks that the merge tasks of a group
+ * depend on completed, the function places the group on the node that holds
+ * most of the merge tasks' input, and lets the group's map fetch tasks run.
+ * The function returns the tasks whose groups still wait for map tasks.
+ */
+static List *
+PlaceTasksNearMergeInput(HTAB *taskTrackerHash, List *taskAndExecutionList,
+						 List *unplacedTaskList, HTAB *mapOutputSizeHash)
+{
+	List *remainingTaskList = NIL;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, unplacedTaskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		List *mergeTaskList = MergeTaskList(task->dependedTaskList);
+		List *mapFetchTaskList = NIL;
+		List *mapTaskList = NIL;
+		ListCell *mergeTaskCell = NULL;
+		ListCell *mapFetchTaskCell = NULL;
+
+		foreach(mergeTaskCell, mergeTaskList)
+		{
+			Task *mergeTask = (Task *) lfirst(mergeTaskCell);
+
+			mapFetchTaskList = list_concat(mapFetchTaskList,
+										   list_copy(mergeTask->dependedTaskList));
+			mapTaskList = TaskListConcatUnique(mapTaskList,
+											   MergeTaskMapTaskList(mergeTask));
+		}
+
+		if (!TaskExecutionsCompleted(mapTaskList))
+		{
+			remainingTaskList = lappend(remainingTaskList, task);
+			continue;
+		}
+
+		FetchMapOutputSizes(mapOutputSizeHash, mapTaskList);
+
+		PlaceConstraintGroup(taskTrackerHash, taskAndExecutionList, mergeTaskList,
+							 mapFetchTaskList, mapOutputSizeHash);
+
+		foreach(mapFetchTaskCell, mapFetchTaskList)
+		{
+			Task *mapFetchTask = (Task *) lfirst(mapFetchTaskCell);
+
+			mapFetchTask->taskExecution->awaitingPlacement = false;
+		}
+	}
+
+	return remainingTaskList;
+}
+
+
+/*
+ * PlaceConstraintGroup sums up the sizes of the partitions that the given map
+ * fetch tasks fetch per node that the partitions are on. If the node with
+ * most of the input is not the node that the given merge tasks are assigned
+ * to, the function moves all tasks in their constraint group to that node.
+ * The other nodes the group was assigned to remain as fail over nodes.
+ */
+static void
+PlaceConstraintGroup(HTAB *taskTrackerHash, List *taskAndExecutionList,
+					 List *mergeTaskList, List *mapFetchTaskList,
+					 HTAB *mapOutputSizeHash)
+{
+	Task *firstMergeTask = (Task *) linitial(mergeTaskList);
+	List *currentPlacementList = firstMergeTask->taskPlacementList;
+	ShardPlacement *currentPlacement = (ShardPlacement *) linitial(currentPlacementList);
+	List *nodeInputSizeList = NIL;
+	NodeInputSize *largestInputSize = NULL;
+	TaskTracker *taskTracker = NULL;
+	ShardPlacement *inputPlacement = NULL;
+	List *constrainedTaskList = NIL;
+	List *placementList = NIL;
+	ListCell *mapFetchTaskCell = NULL;
+	ListCell *nodeInputSizeCell = NULL;
+	ListCell *placementCell = NULL;
+	ListCell *taskCell = NULL;
+
+	foreach(mapFetchTaskCell, mapFetchTaskList)
+	{
+		Task *mapFetchTask = (Task *) lfirst(mapFetchTaskCell);
+		Task *mapTask = (Task *) linitial(mapFetchTask->dependedTaskList);
+		ShardPlacement *mapTaskPlacement = MapTaskPlacement(mapTask);
+		NodeInputSize *nodeInputSize = NULL;
+
+		foreach(nodeInputSizeCell, nodeInputSizeList)
+		{
+			NodeInputSize *candidateSize = (NodeInputSize *) lfirst(nodeInputSizeCell);
+
+			if (strncmp(candidateSize->nodeName, mapTaskPlacement->nodeName,
+						WORKER_LENGTH) == 0 &&
+				candidateSize->nodePort == mapTaskPlacement->nodePort)
+			{
+				nodeInputSize = candidateSize;
+				break;
+			}
+		}
+
+		if (nodeInputSize == NULL)
+		{
+			nodeInputSize = palloc0(sizeof(NodeInputSize));
+			nodeInputSize->nodeName = mapTaskPlacement->nodeName;
+			nodeInputSize->nodePort = mapTaskPlacement->nodePort;
+
+			nodeInputSizeList = lappend(nodeInputSizeList, nodeInputSize);
+		}
+
+		nodeInputSize->inputSize += MapOutputPartitionSize(mapOutputSizeHash, mapTask,
+														   mapFetchTask->partitionId);
+	}
+
+	foreach(nodeInputSizeCell, nodeInputSizeList)
+	{
+		NodeInputSize *nodeInputSize = (NodeInputSize *) lfirst(nodeInputSizeCell);
+
+		if (largestInputSize == NULL ||
+			nodeInputSize->inputSize > largestInputSize->inputSize)
+		{
+			largestInputSize = nodeInputSize;
+		}
+	}
+
+	if (largestInputSize == NULL || largestInputSize->inputSize == 0)
+	{
+		return;
+	}
+
+	if (strncmp(largestInputSize->nodeName, currentPlacement->nodeName,
+				WORKER_LENGTH) == 0 &&
+		largestInputSize->nodePort == currentPlacement->nodePort)
+	{
+		return;
+	}
+
+	taskTracker = TrackerHashLookup(taskTrackerHash, largestInputSize->nodeName,
+									largestInputSize->nodePort);
+	if (!TrackerHealthy(taskTracker))
+	{
+		return;
+	}
+
+	/* tasks of the group may have failed over already */
+	constrainedTaskList = ConstrainedTaskList(taskAndExecutionList, firstMergeTask);
+	if (!ConstraintGroupUnassigned(constrainedTaskList))
+	{
+		return;
+	}
+
+	inputPlacement = CitusMakeNode(ShardPlacement);
+	inputPlacement->nodeName = pstrdup(largestInputSize->nodeName);
+	inputPlacement->nodePort = largestInputSize->nodePort;
+
+	/* the task executions track as many nodes as the group was assigned to */
+	placementList = list_make1(inputPlacement);
+
+	foreach(placementCell, currentPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+		if (list_length(placementList) == list_length(currentPlacementList))
+		{
+			break;
+		}
+
+		if (strncmp(placement->nodeName, inputPlacement->nodeName,
+					WORKER_LENGTH) == 0 &&
+			placement->nodePort == inputPlacement->nodePort)
+		{
+			continue;
+		}
+
+		placementList = lappend(placementList, placement);
+	}
+
+	foreach(taskCell, constrainedTaskList)
+	{
+		Task *constrainedTask = (Task *) lfirst(taskCell);
+
+		constrainedTask->taskPlacementList = placementList;
+	}
+
+	ereport(DEBUG2, (errmsg("assigned merge task %u to node %s:%u, which has "
+							UINT64_FORMAT " bytes of its input",
+							firstMergeTask->taskId, inputPlacement->nodeName,
+							inputPlacement->nodePort, largestInputSize->inputSize)));
+}
+
+
+/*
+ * ConstraintGroupUnassigned returns whether none of the tasks in the given
+ * constraint group was assigned to a task tracker or failed over yet.
+ */
+static bool
+ConstraintGroupUnassigned(List *constrainedTaskList)
+{
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, constrainedTaskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		TaskExecution *taskExecution = task->taskExecution;
+
+		if (taskExecution->currentNodeIndex != 0 || taskExecution->failureCount > 0 ||
+			taskExecution->taskStatusArray[0] != EXEC_TASK_UNASSIGNED)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/* MapOutputSizeHashCreate creates the hash that keeps the map output sizes. */
+static HTAB *
+MapOutputSizeHashCreate(void)
+{
+	HASHCTL info;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(MapOutputSizeKey);
+	info.entrysize = sizeof(MapOutputSizeEntry);
+	info.hcxt = CurrentMemoryContext;
+
+	return hash_create("Map Output Size Hash", 128, &info,
+					   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+}
+
+
+/*
+ * FetchMapOutputSizes learns the partition file sizes of the given map tasks
+ * whose sizes are not known yet, with one query to each node they ran on.
+ */
+static void
+FetchMapOutputSizes(HTAB *mapOutputSizeHash, List *mapTaskList)
+{
+	List *unknownTaskList = NIL;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, mapTaskList)
+	{
+		Task *mapTask = (Task *) lfirst(taskCell);
+		MapOutputSizeKey sizeKey;
+		bool found = false;
+
+		memset(&sizeKey, 0, sizeof(sizeKey));
+		sizeKey.jobId = mapTask->jobId;
+		sizeKey.taskId = mapTask->taskId;
+
+		hash_search(mapOutputSizeHash, &sizeKey, HASH_FIND, &found);
+		if (!found)
+		{
+			unknownTaskList = lappend(unknownTaskList, mapTask);
+		}
+	}
+
+	while (unknownTaskList != NIL)
+	{
+		Task *firstTask = (Task *) linitial(unknownTaskList);
+		ShardPlacement *nodePlacement = MapTaskPlacement(firstTask);
+		List *nodeTaskList = NIL;
+		List *otherNodeTaskList = NIL;
+
+		foreach(taskCell, unknownTaskList)
+		{
+			Task *mapTask = (Task *) lfirst(taskCell);
+			ShardPlacement *mapTaskPlacement = MapTaskPlacement(mapTask);
+
+			if (strncmp(mapTaskPlacement->nodeName, nodePlacement->nodeName,
+						WORKER_LENGTH) == 0 &&
+				mapTaskPlacement->nodePort == nodePlacement->nodePort)
+			{
+				nodeTaskList = lappend(nodeTaskList, mapTask);
+			}
+			else
+			{
+				otherNodeTaskList = lappend(otherNodeTaskList, mapTask);
+			}
+		}
+
+		FetchNodeMapOutputSizes(mapOutputSizeHash, nodePlacement, nodeTaskList);
+
+		list_free(unknownTaskList);
+		unknownTaskList = otherNodeTaskList;
+	}
+}
+
+
+/*
+ * FetchNodeMapOutputSizes queries the partition file sizes of the given map
+ * tasks from the node of the given placement, and stores them in the hash. If
+ * the node cannot tell, the sizes are taken as 0, so that the tasks are not
+ * moved because of them.
+ */
+static void
+FetchNodeMapOutputSizes(HTAB *mapOutputSizeHash, ShardPlacement *placement,
+						List *mapTaskList)
+{
+	MultiConnection *connection = NULL;
+	StringInfo taskIdString = makeStringInfo();
+	StringInfo sizeQuery = makeStringInfo();
+	Task *firstTask = (Task *) linitial(mapTaskList);
+	PGresult *result = NULL;
+	ListCell *taskCell = NULL;
+	int executeResult = 0;
+
+	foreach(taskCell, mapTaskList)
+	{
+		Task *mapTask = (Task *) lfirst(taskCell);
+		MapOutputSizeEntry *sizeEntry = NULL;
+		MapOutputSizeKey sizeKey;
+		bool found = false;
+
+		memset(&sizeKey, 0, sizeof(sizeKey));
+		sizeKey.jobId = mapTask->jobId;
+		sizeKey.taskId = mapTask->taskId;
+
+		sizeEntry = hash_search(mapOutputSizeHash, &sizeKey, HASH_ENTER, &found);
+		sizeEntry->partitionCount = 0;
+		sizeEntry->partitionSizeArray = NULL;
+
+		if (taskIdString->len > 0)
+		{
+			appendStringInfoChar(taskIdString, ',');
+		}
+
+		appendStringInfo(taskIdString, "%u", mapTask->taskId);
+	}
+
+	appendStringInfo(sizeQuery, PARTITION_FILE_SIZES_QUERY, firstTask->jobId,
+					 taskIdString->data);
+
+	connection = GetNodeConnection(0, placement->nodeName, placement->nodePort);
+
+	executeResult = ExecuteOptionalRemoteCommand(connection, sizeQuery->data, &result);
+	if (executeResult == 0)
+	{
+		int rowCount = PQntuples(result);
+		int rowIndex = 0;
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			MapOutputSizeEntry *sizeEntry = NULL;
+			MapOutputSizeKey sizeKey;
+			uint32 partitionId = 0;
+			bool found = false;
+
+			memset(&sizeKey, 0, sizeof(sizeKey));
+			sizeKey.jobId = firstTask->jobId;
+			sizeKey.taskId = (uint32) strtoul(PQgetvalue(result, rowIndex, 0), NULL, 10);
+			partitionId = (uint32) strtoul(PQgetvalue(result, rowIndex, 1), NULL, 10);
+
+			sizeEntry = hash_search(mapOutputSizeHash, &sizeKey, HASH_FIND, &found);
+			if (!found)
+			{
+				continue;
+			}
+
+			if (partitionId >= sizeEntry->partitionCount)
+			{
+				uint32 partitionCount = partitionId + 1;
+				Size arraySize = partitionCount * sizeof(uint64);
+
+				if (sizeEntry->partitionSizeArray == NULL)
+				{
+					sizeEntry->partitionSizeArray = palloc0(arraySize);
+				}
+				else
+				{
+					sizeEntry->partitionSizeArray =
+						repalloc(sizeEntry->partitionSizeArray, arraySize);
+					memset(sizeEntry->partitionSizeArray + sizeEntry->partitionCount,
+						   0, (partitionCount - sizeEntry->partitionCount) *
+						   sizeof(uint64));
+				}
+
+				sizeEntry->partitionCount = partitionCount;
+			}
+
+			sizeEntry->partitionSizeArray[partitionId] =
+				pg_strtouint64(PQgetvalue(result, rowIndex, 2), NULL, 10);
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+	}
+}
+
+
+/*
+ * MapOutputPartitionSize returns the size of the given partition of the given
+ * map task's output, or 0 if it is not known.
+ */
+static uint64
+MapOutputPartitionSize(HTAB *mapOutputSizeHash, Task *mapTask, uint32 partitionId)
+{
+	MapOutputSizeEntry *sizeEntry = NULL;
+	MapOutputSizeKey sizeKey;
+	bool found = false;
+
+	memset(&sizeKey, 0, sizeof(sizeKey));
+	sizeKey.jobId = mapTask->jobId;
+	sizeKey.taskId = mapTask->taskId;
+
+	sizeEntry = hash_search(mapOutputSizeHash, &sizeKey, HASH_FIND, &found);
+	if (!found || partitionId >= sizeEntry->partitionCount)
+	{
+		return 0;
+	}
+
+	return sizeEntry->partitionSizeArray[partitionId];
+}
+
+
+/*
+ * ManageTransmitExecution manages logic to fetch the results of the given SQL
+ * task to the master node. For this, the function checks if the given SQL task
+ * has completed. If it has, the function starts the copy out protocol to fetch
+ * the task's results and write them to the local filesystem. When the transmit
+ * completes or fails, the function notes that by changing the transmit status.
+ */
+static TransmitExecStatus
+ManageTransmitExecution(TaskTracker *transmitTracker,
+						Task *task, TaskExecution *taskExecution,
+						DistributedExecutionStats *executionStats)
+{
+	int32 *fileDescriptorArray = taskExecution->fileDescriptorArray;
+	uint32 currentNodeIndex = taskExecution->currentNodeIndex;
+	uint32 nextNodeIndex = 0;
+
+	TransmitExecStatus *transmitStatusArray = taskExecution->transmitStatusArray;
+	TransmitExecStatus currentTransmitStatus = transmitStatusArray[currentNodeIndex];
+	TransmitExecStatus nextTransmitStatus = EXEC_TRANSMIT_INVALID_FIRST;
+	Assert(task->taskType == SQL_TASK);
+
+	switch (currentTransmitStatus)
+	{
+		case EXEC_TRANSMIT_UNASSIGNED:
+		{
+			TaskExecStatus *taskStatusArray = taskExecution->taskStatusArray;
+			TaskExecStatus currentExecutionStatus = taskStatusArray[currentNodeIndex];
+			bool trackerHealthy = false;
+
+			/* if top level task's in progress, nothing to do */
+			if (currentExecutionStatus != EXEC_TASK_DONE)
+			{
+				nextTransmitStatus = EXEC_TRANSMIT_UNASSIGNED;
+				break;
+			}
+
+			trackerHealthy = TrackerHealthy(transmitTracker);
+			if (!trackerHealthy)
+			{
+				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_FAILED;
+				break;
+			}
+
+			TrackerQueueFileTransmit(transmitTracker, task);
+			nextTransmitStatus = EXEC_TRANSMIT_QUEUED;
+			break;
+		}
+
+		case EXEC_TRANSMIT_QUEUED:
+		{
+			QueryStatus queryStatus = CLIENT_INVALID_QUERY;
+			int32 connectionId = INVALID_CONNECTION_ID;
+			TaskStatus taskStatus = TASK_STATUS_INVALID_FIRST;
+
+			bool trackerHealthy = TrackerHealthy(transmitTracker);
+			if (!trackerHealthy)
+			{
+				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_FAILED;
+				break;
+			}
+
+			taskStatus = TrackerTaskStatus(transmitTracker, task);
+			if (taskStatus == TASK_FILE_TRANSMIT_QUEUED)
+			{
+				/* remain in queued status until tracker assigns this task */
+				nextTransmitStatus = EXEC_TRANSMIT_QUEUED;
+				break;
+			}
+			else if (taskStatus == TASK_CLIENT_SIDE_TRANSMIT_FAILED)
+			{
+				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_RETRY;
+				break;
+			}
+
+			/* the open connection belongs to this task */
+			connectionId = TransmitTrackerConnectionId(transmitTracker, task);
+			Assert(connectionId != INVALID_CONNECTION_ID);
+			Assert(taskStatus == TASK_ASSIGNED);
+
+			/* start copy protocol */
+			queryStatus = MultiClientQueryStatus(connectionId);
+			if (queryStatus == CLIENT_QUERY_COPY)
+			{
+				StringInfo jobDirectoryName = MasterJobDirectoryName(task->jobId);
+				StringInfo taskFilename = TaskFilename(jobDirectoryName, task->taskId);
+
+				char *filename = taskFilename->data;
+				int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
+				int fileMode = (S_IRUSR | S_IWUSR);
+
+				int32 fileDescriptor = BasicOpenFilePerm(filename, fileFlags, fileMode);
+				if (fileDescriptor >= 0)
+				{
+					/*
+					 * All files inside the job directory get automatically cleaned
+					 * up on transaction commit or abort.
+					 */
+					fileDescriptorArray[currentNodeIndex] = fileDescriptor;
+					nextTransmitStatus = EXEC_TRANSMIT_COPYING;
+				}
+				else
+				{
+					ereport(WARNING, (errcode_for_file_access(),
+									  errmsg("could not open file \"%s\": %m",
+											 filename)));
+
+					nextTransmitStatus = EXEC_TRANSMIT_TRACKER_RETRY;
+				}
+			}
+			else
+			{
+				nextTransmitStatus = EXEC_TRANSMIT_TRACKER_RETRY;
+			}
+
+			/*
+			 * We use task tracker logic to manage file transmits as well, but that
+			 * abstraction starts to leak after we drop into the copy protocol. To
+			 * make our task tracker logic work, we need to "void" the tracker's
+			 * connection if the transmit task failed in here.
+			 */
+			if (nextTransmitStatus == EXEC_TRANSMIT_TRACKER_RETRY)
+			{
+				transmitTracker->connectionBusy = false;
+				transmitTracker->connectionBusyOnTask = NULL;
+			}
+
+			break;
+		}
+
+		case EXEC_TRANSMIT_COPYING:
+		{
+			int32 fileDescriptor = fileDescriptorArray[currentNodeIndex];
+			CopyStatus copyStatus = CLIENT_INVALID_COPY;
 			int closed = -1;
 			uint64 bytesReceived = 0;
 
@@ -1421,13 +2454,15 @@ ManageTransmitExecution(TaskTracker *transmitTracker,
 			Assert(connectionId != INVALID_CONNECTION_ID);
 
 			copyStatus = MultiClientCopyData(connectionId, fileDescriptor,
-											 &bytesReceived);
+											 &bytesReceived, NULL);
 
 			if (SubPlanLevel > 0)
 			{
 				executionStats->totalIntermediateResultSize += bytesReceived;
 			}
 
+			QueryStatsAddBytesReceived(bytesReceived);
+
 			if (copyStatus == CLIENT_COPY_MORE)
 			{
 				/* worker node continues to send more data, keep reading */
@@ -1518,93 +2553,476 @@ ManageTransmitExecution(TaskTracker *transmitTracker,
 			break;
 		}
 
-		case EXEC_TRANSMIT_DONE:
-		{
-			/* we are done with fetching task results to the master node */
-			nextTransmitStatus = EXEC_TRANSMIT_DONE;
-			break;
-		}
+		case EXEC_TRANSMIT_DONE:
+		{
+			/* we are done with fetching task results to the master node */
+			nextTransmitStatus = EXEC_TRANSMIT_DONE;
+			break;
+		}
+
+		default:
+		{
+			/* we fatal here to avoid leaking client-side resources */
+			ereport(FATAL, (errmsg("invalid transmit status: %d",
+								   currentTransmitStatus)));
+			break;
+		}
+	}
+
+	/* update file transmit status for most recent transmit tracker */
+	nextNodeIndex = taskExecution->currentNodeIndex;
+	transmitStatusArray[nextNodeIndex] = nextTransmitStatus;
+
+	return nextTransmitStatus;
+}
+
+
+/*
+ * TaskExecutionsCompleted checks if all task executions in the given task list
+ * have completed. If they have, the function returns true. Note that this
+ * function takes the list of tasks as an optimization over separately
+ * extracting a list of task executions, but it should only operate on task
+ * executions to preserve the abstraction.
+ */
+static bool
+TaskExecutionsCompleted(List *taskList)
+{
+	bool taskExecutionsComplete = true;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		TaskExecution *taskExecution = task->taskExecution;
+		uint32 nodeIndex = taskExecution->currentNodeIndex;
+
+		TaskExecStatus taskStatus = taskExecution->taskStatusArray[nodeIndex];
+		if (taskStatus != EXEC_TASK_DONE)
+		{
+			taskExecutionsComplete = false;
+			break;
+		}
+	}
+
+	return taskExecutionsComplete;
+}
+
+
+/*
+ * MapFetchTaskQueryString constructs the map fetch query string from the given
+ * map output fetch task and its downstream map task dependency. The constructed
+ * query string allows fetching the map task's partitioned output file from the
+ * worker node it's created to the worker node that will execute the merge task.
+ */
+static StringInfo
+MapFetchTaskQueryString(Task *mapFetchTask, Task *mapTask)
+{
+	StringInfo mapFetchQueryString = NULL;
+	uint32 partitionFileId = mapFetchTask->partitionId;
+	uint32 mergeTaskId = mapFetchTask->upstreamTaskId;
+
+	/* find the node name/port for map task's execution */
+	ShardPlacement *mapTaskPlacement = MapTaskPlacement(mapTask);
+	char *mapTaskNodeName = mapTaskPlacement->nodeName;
+	uint32 mapTaskNodePort = mapTaskPlacement->nodePort;
+
+	TaskExecution *mapFetchTaskExecution = mapFetchTask->taskExecution;
+	ShardPlacement *mapFetchTaskPlacement =
+		list_nth(mapFetchTask->taskPlacementList,
+				 mapFetchTaskExecution->currentNodeIndex);
+
+	Assert(mapFetchTask->taskType == MAP_OUTPUT_FETCH_TASK);
+	Assert(mapTask->taskType == MAP_TASK);
+
+	mapFetchQueryString = makeStringInfo();
+
+	/* partitions of map tasks on the same node need not go over the network */
+	if (EnableLocalityAwareMerge &&
+		strncmp(mapTaskNodeName, mapFetchTaskPlacement->nodeName, WORKER_LENGTH) == 0 &&
+		mapTaskNodePort == mapFetchTaskPlacement->nodePort)
+	{
+		appendStringInfo(mapFetchQueryString, MAP_OUTPUT_LINK_COMMAND,
+						 mapTask->jobId, mapTask->taskId, partitionFileId,
+						 mergeTaskId);
+
+		return mapFetchQueryString;
+	}
+
+	appendStringInfo(mapFetchQueryString, MAP_OUTPUT_FETCH_COMMAND,
+					 mapTask->jobId, mapTask->taskId, partitionFileId,
+					 mergeTaskId, /* fetch results to merge task */
+					 mapTaskNodeName, mapTaskNodePort);
+
+	return mapFetchQueryString;
+}
+
+
+/*
+ * MapTaskPlacement returns the placement of the node that the given map task
+ * executes on.
+ */
+static ShardPlacement *
+MapTaskPlacement(Task *mapTask)
+{
+	TaskExecution *mapTaskExecution = mapTask->taskExecution;
+
+	return (ShardPlacement *) list_nth(mapTask->taskPlacementList,
+									   mapTaskExecution->currentNodeIndex);
+}
+
+
+/*
+ * AssignPartitionPushDestinations appends the destinations of the given map
+ * task's partitions to its partition command, so that the map task streams
+ * each partition directly into the directory of the merge task that consumes
+ * it. The destination is the node that the corresponding map fetch task is
+ * assigned to; we record it in the fetch task's execution so that the fetch
+ * task completes without fetching anything.
+ */
+static void
+AssignPartitionPushDestinations(Task *mapTask, List *mapFetchTaskList)
+{
+	StringInfo upstreamTaskIdString = makeStringInfo();
+	StringInfo nodeNameString = makeStringInfo();
+	StringInfo nodePortString = makeStringInfo();
+	StringInfo mapQueryString = NULL;
+	Task **mapFetchTaskArray = NULL;
+	ListCell *mapFetchTaskCell = NULL;
+	char *partitionCommand = mapTask->queryString;
+	int partitionCommandLength = strlen(partitionCommand);
+	uint32 fileCount = 0;
+	uint32 fileIndex = 0;
+
+	Assert(mapTask->taskType == MAP_TASK);
+	Assert(partitionCommand[partitionCommandLength - 1] == ')');
+
+	/* partition file ids are assigned densely, starting from 0 */
+	foreach(mapFetchTaskCell, mapFetchTaskList)
+	{
+		Task *mapFetchTask = (Task *) lfirst(mapFetchTaskCell);
+
+		fileCount = Max(fileCount, mapFetchTask->partitionId + 1);
+	}
+
+	mapFetchTaskArray = palloc0(fileCount * sizeof(Task *));
+	foreach(mapFetchTaskCell, mapFetchTaskList)
+	{
+		Task *mapFetchTask = (Task *) lfirst(mapFetchTaskCell);
+
+		mapFetchTaskArray[mapFetchTask->partitionId] = mapFetchTask;
+	}
+
+	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
+	{
+		Task *mapFetchTask = mapFetchTaskArray[fileIndex];
+		const char *separator = (fileIndex > 0) ? ", " : "";
+
+		/* partitions that nobody fetches are written to local files as before */
+		if (mapFetchTask == NULL)
+		{
+			appendStringInfo(upstreamTaskIdString, "%s0", separator);
+			appendStringInfo(nodeNameString, "%s''", separator);
+			appendStringInfo(nodePortString, "%s0", separator);
+		}
+		else
+		{
+			TaskExecution *mapFetchTaskExecution = mapFetchTask->taskExecution;
+			uint32 currentIndex = mapFetchTaskExecution->currentNodeIndex;
+			ShardPlacement *mergeTaskPlacement =
+				list_nth(mapFetchTask->taskPlacementList, currentIndex);
+
+			appendStringInfo(upstreamTaskIdString, "%s%u", separator,
+							 mapFetchTask->upstreamTaskId);
+			appendStringInfo(nodeNameString, "%s%s", separator,
+							 quote_literal_cstr(mergeTaskPlacement->nodeName));
+			appendStringInfo(nodePortString, "%s%u", separator,
+							 mergeTaskPlacement->nodePort);
+
+			mapFetchTaskExecution->pushedNodeIndex = currentIndex;
+		}
+	}
+
+	/* replace the closing parenthesis of the command with the extra arguments */
+	mapQueryString = makeStringInfo();
+	appendBinaryStringInfo(mapQueryString, partitionCommand, partitionCommandLength - 1);
+	appendStringInfo(mapQueryString, PUSH_PARTITION_ARGUMENTS,
+					 upstreamTaskIdString->data, nodeNameString->data,
+					 nodePortString->data);
+
+	mapTask->queryString = mapQueryString->data;
+}
+
+
+/*
+ * AssignBloomFilters finds the dual partition joins in the task list, and sets
+ * up bloom filter pruning for them. The map tasks of the join's first side add
+ * each partition key to a bloom filter, which they store next to their output.
+ * The map tasks of the second side wait for these tasks, fetch and merge their
+ * filters, and drop rows whose keys cannot find a match in the join.
+ *
+ * Repartition joins are inner equi-joins on the partition columns, and both
+ * sides are hash partitioned with compatible hash functions. A second side row
+ * therefore only has join partners if its key hash is in one of the filters.
+ */
+static void
+AssignBloomFilters(Job *job, List *taskAndExecutionList)
+{
+	List *assignedMergeTaskList = NIL;
+	uint32 bloomFilterSize = (uint32) RepartitionBloomFilterSize * 1024L;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskAndExecutionList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		List *mergeTaskList = NIL;
+		Task *buildMergeTask = NULL;
+		Task *probeMergeTask = NULL;
+		List *buildMapTaskList = NIL;
+		List *probeMapTaskList = NIL;
+		ListCell *mapTaskCell = NULL;
+
+		if (task->taskType != SQL_TASK && task->taskType != MAP_TASK)
+		{
+			continue;
+		}
+
+		/* join tasks of dual partition joins depend on one merge task per side */
+		mergeTaskList = MergeTaskList(task->dependedTaskList);
+		if (list_length(mergeTaskList) != 2)
+		{
+			continue;
+		}
+
+		buildMergeTask = (Task *) linitial(mergeTaskList);
+		probeMergeTask = (Task *) lsecond(mergeTaskList);
+
+		if (buildMergeTask->jobId == probeMergeTask->jobId ||
+			!DualPartitionJob(job, buildMergeTask->jobId) ||
+			!DualPartitionJob(job, probeMergeTask->jobId))
+		{
+			continue;
+		}
+
+		/* all join tasks of a job pair share the same map tasks */
+		if (TaskListMember(assignedMergeTaskList, probeMergeTask))
+		{
+			continue;
+		}
+
+		assignedMergeTaskList = lappend(assignedMergeTaskList, probeMergeTask);
+
+		buildMapTaskList = MergeTaskMapTaskList(buildMergeTask);
+		probeMapTaskList = MergeTaskMapTaskList(probeMergeTask);
+
+		foreach(mapTaskCell, buildMapTaskList)
+		{
+			Task *mapTask = (Task *) lfirst(mapTaskCell);
+
+			mapTask->queryString = BloomFilterCommand(mapTask->queryString,
+													  bloomFilterSize, NIL);
+		}
+
+		foreach(mapTaskCell, probeMapTaskList)
+		{
+			Task *mapTask = (Task *) lfirst(mapTaskCell);
+			TaskExecution *mapTaskExecution = mapTask->taskExecution;
+
+			mapTaskExecution->bloomFilterTaskList = buildMapTaskList;
+			mapTaskExecution->partitionCommand = mapTask->queryString;
+		}
+	}
+}
+
+
+/*
+ * DualPartitionJob returns whether the job with the given identifier in the
+ * job tree hash partitions one side of a join. Subquery map-merge jobs also
+ * hash partition, but reduce their partitions in the merge tasks.
+ */
+static bool
+DualPartitionJob(Job *job, uint64 jobId)
+{
+	List *jobQueue = list_make1(job);
+
+	while (jobQueue != NIL)
+	{
+		Job *currentJob = (Job *) linitial(jobQueue);
+		jobQueue = list_delete_first(jobQueue);
+
+		if (currentJob->jobId == jobId)
+		{
+			MapMergeJob *mapMergeJob = NULL;
+
+			if (!CitusIsA(currentJob, MapMergeJob))
+			{
+				return false;
+			}
+
+			mapMergeJob = (MapMergeJob *) currentJob;
+			return mapMergeJob->partitionType == HASH_PARTITION_TYPE &&
+				   mapMergeJob->reduceQuery == NULL;
+		}
+
+		jobQueue = list_concat(jobQueue, list_copy(currentJob->dependedJobList));
+	}
+
+	return false;
+}
+
+
+/*
+ * MergeTaskMapTaskList returns the map tasks whose output the given merge task
+ * fetches. Every merge task fetches one partition from each map task of its
+ * job, so these are all map tasks of the job.
+ */
+static List *
+MergeTaskMapTaskList(Task *mergeTask)
+{
+	List *mapTaskList = NIL;
+	ListCell *mapFetchTaskCell = NULL;
+
+	foreach(mapFetchTaskCell, mergeTask->dependedTaskList)
+	{
+		Task *mapFetchTask = (Task *) lfirst(mapFetchTaskCell);
+		Task *mapTask = (Task *) linitial(mapFetchTask->dependedTaskList);
+
+		Assert(mapFetchTask->taskType == MAP_OUTPUT_FETCH_TASK);
+		Assert(mapTask->taskType == MAP_TASK);
+
+		mapTaskList = TaskListAppendUnique(mapTaskList, mapTask);
+	}
+
+	return mapTaskList;
+}
+
+
+/*
+ * RepartitionCacheAllowed returns whether the output of the given map task may
+ * be cached. The map task needs to read shards rather than the output of other
+ * tasks, and its filter query needs to return the same rows as long as the
+ * shards are not modified.
+ */
+static bool
+RepartitionCacheAllowed(Job *job, Task *mapTask)
+{
+	List *jobQueue = list_make1(job);
 
-		default:
+	if (mapTask->dependedTaskList != NIL || mapTask->anchorShardId == INVALID_SHARD_ID)
+	{
+		return false;
+	}
+
+	while (jobQueue != NIL)
+	{
+		Job *currentJob = (Job *) linitial(jobQueue);
+		jobQueue = list_delete_first(jobQueue);
+
+		if (currentJob->jobId == mapTask->jobId)
 		{
-			/* we fatal here to avoid leaking client-side resources */
-			ereport(FATAL, (errmsg("invalid transmit status: %d",
-								   currentTransmitStatus)));
-			break;
+			return CitusIsA(currentJob, MapMergeJob) &&
+				   !contain_mutable_functions((Node *) currentJob->jobQuery);
 		}
-	}
 
-	/* update file transmit status for most recent transmit tracker */
-	nextNodeIndex = taskExecution->currentNodeIndex;
-	transmitStatusArray[nextNodeIndex] = nextTransmitStatus;
+		jobQueue = list_concat(jobQueue, list_copy(currentJob->dependedJobList));
+	}
 
-	return nextTransmitStatus;
+	return false;
 }
 
 
 /*
- * TaskExecutionsCompleted checks if all task executions in the given task list
- * have completed. If they have, the function returns true. Note that this
- * function takes the list of tasks as an optimization over separately
- * extracting a list of task executions, but it should only operate on task
- * executions to preserve the abstraction.
+ * CachedPartitionCommand wraps the command of the given map task in a call to
+ * worker_cached_partition_table(). The version passed along consists of the
+ * modification counters of the shards that the map task reads, which we read
+ * before the map task runs. The worker may therefore cache files that already
+ * contain later changes under the version, but never miss changes made after
+ * it.
  */
-static bool
-TaskExecutionsCompleted(List *taskList)
+static char *
+CachedPartitionCommand(Task *mapTask)
 {
-	bool taskExecutionsComplete = true;
-	ListCell *taskCell = NULL;
+	StringInfo version = makeStringInfo();
+	StringInfo cachedCommand = makeStringInfo();
+	ListCell *relationShardCell = NULL;
 
-	foreach(taskCell, taskList)
+	appendStringInfo(version, UINT64_FORMAT ":" UINT64_FORMAT,
+					 mapTask->anchorShardId,
+					 ShardModificationCounter(mapTask->anchorShardId));
+
+	foreach(relationShardCell, mapTask->relationShardList)
 	{
-		Task *task = (Task *) lfirst(taskCell);
-		TaskExecution *taskExecution = task->taskExecution;
-		uint32 nodeIndex = taskExecution->currentNodeIndex;
+		RelationShard *relationShard = (RelationShard *) lfirst(relationShardCell);
+		uint64 shardId = relationShard->shardId;
 
-		TaskExecStatus taskStatus = taskExecution->taskStatusArray[nodeIndex];
-		if (taskStatus != EXEC_TASK_DONE)
+		if (shardId == mapTask->anchorShardId)
 		{
-			taskExecutionsComplete = false;
-			break;
+			continue;
 		}
+
+		appendStringInfo(version, " " UINT64_FORMAT ":" UINT64_FORMAT, shardId,
+						 ShardModificationCounter(shardId));
 	}
 
-	return taskExecutionsComplete;
+	appendStringInfo(cachedCommand, CACHED_PARTITION_COMMAND, mapTask->jobId,
+					 mapTask->taskId, quote_literal_cstr(version->data),
+					 quote_literal_cstr(mapTask->queryString));
+
+	return cachedCommand->data;
 }
 
 
 /*
- * MapFetchTaskQueryString constructs the map fetch query string from the given
- * map output fetch task and its downstream map task dependency. The constructed
- * query string allows fetching the map task's partitioned output file from the
- * worker node it's created to the worker node that will execute the merge task.
+ * BloomFilterCommand appends the bloom filter arguments to the given hash
+ * partition command. If the filter size is not zero, the map task builds a
+ * filter of that size. If the filter task list is not empty, the map task
+ * fetches the filters of these tasks from the nodes they completed on. When
+ * partitions are not pushed, the command lacks the partition destinations,
+ * and we first append empty ones.
  */
-static StringInfo
-MapFetchTaskQueryString(Task *mapFetchTask, Task *mapTask)
+static char *
+BloomFilterCommand(const char *partitionCommand, uint32 bloomFilterSize,
+				   List *filterTaskList)
 {
-	StringInfo mapFetchQueryString = NULL;
-	uint32 partitionFileId = mapFetchTask->partitionId;
-	uint32 mergeTaskId = mapFetchTask->upstreamTaskId;
+	StringInfo filterTaskIdString = makeStringInfo();
+	StringInfo nodeNameString = makeStringInfo();
+	StringInfo nodePortString = makeStringInfo();
+	StringInfo mapQueryString = makeStringInfo();
+	uint64 filterJobId = 0;
+	int partitionCommandLength = strlen(partitionCommand);
+	ListCell *filterTaskCell = NULL;
 
-	/* find the node name/port for map task's execution */
-	List *mapTaskPlacementList = mapTask->taskPlacementList;
-	TaskExecution *mapTaskExecution = mapTask->taskExecution;
-	uint32 currentIndex = mapTaskExecution->currentNodeIndex;
+	Assert(partitionCommand[partitionCommandLength - 1] == ')');
 
-	ShardPlacement *mapTaskPlacement = list_nth(mapTaskPlacementList, currentIndex);
-	char *mapTaskNodeName = mapTaskPlacement->nodeName;
-	uint32 mapTaskNodePort = mapTaskPlacement->nodePort;
+	foreach(filterTaskCell, filterTaskList)
+	{
+		Task *filterTask = (Task *) lfirst(filterTaskCell);
+		TaskExecution *filterTaskExecution = filterTask->taskExecution;
+		uint32 currentIndex = filterTaskExecution->currentNodeIndex;
+		ShardPlacement *filterTaskPlacement =
+			list_nth(filterTask->taskPlacementList, currentIndex);
+		const char *separator = (filterTaskIdString->len > 0) ? ", " : "";
+
+		filterJobId = filterTask->jobId;
+
+		appendStringInfo(filterTaskIdString, "%s%u", separator, filterTask->taskId);
+		appendStringInfo(nodeNameString, "%s%s", separator,
+						 quote_literal_cstr(filterTaskPlacement->nodeName));
+		appendStringInfo(nodePortString, "%s%u", separator,
+						 filterTaskPlacement->nodePort);
+	}
 
-	Assert(mapFetchTask->taskType == MAP_OUTPUT_FETCH_TASK);
-	Assert(mapTask->taskType == MAP_TASK);
+	/* replace the closing parenthesis of the command with the extra arguments */
+	appendBinaryStringInfo(mapQueryString, partitionCommand, partitionCommandLength - 1);
+	if (!EnableRepartitionPush)
+	{
+		appendStringInfoString(mapQueryString, NO_PUSH_PARTITION_ARGUMENTS);
+	}
 
-	mapFetchQueryString = makeStringInfo();
-	appendStringInfo(mapFetchQueryString, MAP_OUTPUT_FETCH_COMMAND,
-					 mapTask->jobId, mapTask->taskId, partitionFileId,
-					 mergeTaskId, /* fetch results to merge task */
-					 mapTaskNodeName, mapTaskNodePort);
+	appendStringInfo(mapQueryString, BLOOM_FILTER_ARGUMENTS, bloomFilterSize,
+					 filterJobId, filterTaskIdString->data, nodeNameString->data,
+					 nodePortString->data);
 
-	return mapFetchQueryString;
+	return mapQueryString->data;
 }
 
 
@@ -2102,6 +3520,9 @@ ReassignTaskList(List *taskList)
 		taskStatusArray[currentNodeIndex] = EXEC_TASK_UNASSIGNED;
 		transmitStatusArray[currentNodeIndex] = EXEC_TRANSMIT_UNASSIGNED;
 
+		/* the failed over task no longer races a speculative copy */
+		StopSpeculativeMapTask(taskExecution);
+
 		/* update node index to try next worker node */
 		AdjustStateForFailure(taskExecution);
 	}
@@ -2174,9 +3595,10 @@ ManageTaskTracker(TaskTracker *taskTracker)
 
 	/*
 	 * (2) We find assigned tasks. We then send an asynchronous query to check
-	 * the tasks' statuses.
+	 * the tasks' statuses. We check once per status check interval, or right
+	 * away if the task tracker notified us that a task completed.
 	 */
-	if (!taskTracker->connectionBusy)
+	if (!taskTracker->connectionBusy && TaskStatusCheckDue(taskTracker))
 	{
 		List *taskStatusBatchList = TaskStatusBatchList(taskTracker);
 
@@ -2190,6 +3612,10 @@ ManageTaskTracker(TaskTracker *taskTracker)
 			taskStatusBatchQuery = TaskStatusBatchQuery(taskStatusBatchList);
 
 			querySent = MultiClientSendQuery(connectionId, taskStatusBatchQuery->data);
+
+			taskTracker->statusCheckTime = GetCurrentTimestamp();
+			taskTracker->taskCompletionNotified = false;
+
 			if (querySent)
 			{
 				taskTracker->connectionBusy = true;
@@ -2306,6 +3732,150 @@ TrackerReconnectPoll(TaskTracker *taskTracker)
 }
 
 
+/*
+ * ListenForTaskStatusChanges subscribes the given task tracker connection to
+ * the notifications that task trackers send when a task completes.
+ */
+static void
+ListenForTaskStatusChanges(int32 connectionId)
+{
+	MultiConnection *connection = MultiClientGetConnection(connectionId);
+	PGresult *result = NULL;
+
+	/* without notifications, we still check task statuses periodically */
+	ExecuteOptionalRemoteCommand(connection, TASK_STATUS_LISTEN_COMMAND, &result);
+	PQclear(result);
+	ForgetResults(connection);
+}
+
+
+/*
+ * WaitForTrackerActivity waits until one of the connections to the task and
+ * transmit trackers receives data, or until the given timeout in milliseconds
+ * passes. The data can be the response to a status query or file transmit, or
+ * a notification that a task completed, which makes us check task statuses
+ * before the next status check interval.
+ */
+static void
+WaitForTrackerActivity(HTAB *taskTrackerHash, HTAB *transmitTrackerHash, long timeout)
+{
+	long trackerCount = hash_get_num_entries(taskTrackerHash) +
+						hash_get_num_entries(transmitTrackerHash);
+	WaitEventSet *waitEventSet = NULL;
+	WaitEvent event;
+	int eventCount = 0;
+
+	/* make room for the signal latch and postmaster death events */
+	waitEventSet = CreateWaitEventSet(CurrentMemoryContext, trackerCount + 2);
+
+	AddTrackerWaitEvents(waitEventSet, taskTrackerHash);
+	AddTrackerWaitEvents(waitEventSet, transmitTrackerHash);
+
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+#if (PG_VERSION_NUM >= 100000)
+	eventCount = WaitEventSetWait(waitEventSet, timeout, &event, 1,
+								  WAIT_EVENT_CLIENT_READ);
+#else
+	eventCount = WaitEventSetWait(waitEventSet, timeout, &event, 1);
+#endif
+
+	FreeWaitEventSet(waitEventSet);
+
+	if (eventCount > 0 && (event.events & WL_POSTMASTER_DEATH))
+	{
+		ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+	}
+
+	/* the execution loop checks for cancellation requests */
+	if (eventCount > 0 && (event.events & WL_LATCH_SET))
+	{
+		ResetLatch(MyLatch);
+	}
+
+	ConsumeTrackerNotifications(taskTrackerHash);
+	ConsumeTrackerNotifications(transmitTrackerHash);
+}
+
+
+/*
+ * AddTrackerWaitEvents adds the sockets of the established connections to
+ * the trackers in the given hash to the wait event set, to wait for them to
+ * become readable.
+ */
+static void
+AddTrackerWaitEvents(WaitEventSet *waitEventSet, HTAB *trackerHash)
+{
+	HASH_SEQ_STATUS status;
+	TaskTracker *taskTracker = NULL;
+
+	hash_seq_init(&status, trackerHash);
+
+	taskTracker = (TaskTracker *) hash_seq_search(&status);
+	while (taskTracker != NULL)
+	{
+		if (taskTracker->trackerStatus == TRACKER_CONNECTED &&
+			taskTracker->connectionId != INVALID_CONNECTION_ID)
+		{
+			MultiConnection *connection =
+				MultiClientGetConnection(taskTracker->connectionId);
+
+			if (PQstatus(connection->pgConn) == CONNECTION_OK)
+			{
+				AddWaitEventToSet(waitEventSet, WL_SOCKET_READABLE,
+								  PQsocket(connection->pgConn), NULL, NULL);
+			}
+		}
+
+		taskTracker = (TaskTracker *) hash_seq_search(&status);
+	}
+}
+
+
+/*
+ * ConsumeTrackerNotifications reads any available input on the established
+ * connections to the trackers in the given hash, and records whether it
+ * contained task completion notifications. Other input stays buffered for
+ * the code that manages the trackers.
+ */
+static void
+ConsumeTrackerNotifications(HTAB *trackerHash)
+{
+	HASH_SEQ_STATUS status;
+	TaskTracker *taskTracker = NULL;
+
+	hash_seq_init(&status, trackerHash);
+
+	taskTracker = (TaskTracker *) hash_seq_search(&status);
+	while (taskTracker != NULL)
+	{
+		if (taskTracker->trackerStatus == TRACKER_CONNECTED &&
+			taskTracker->connectionId != INVALID_CONNECTION_ID)
+		{
+			MultiConnection *connection =
+				MultiClientGetConnection(taskTracker->connectionId);
+			PGconn *pgConn = connection->pgConn;
+			PGnotify *notification = NULL;
+
+			if (PQstatus(pgConn) == CONNECTION_OK && PQconsumeInput(pgConn) != 0)
+			{
+				notification = PQnotifies(pgConn);
+				while (notification != NULL)
+				{
+					taskTracker->taskCompletionNotified = true;
+
+					PQfreemem(notification);
+					notification = PQnotifies(pgConn);
+				}
+			}
+		}
+
+		taskTracker = (TaskTracker *) hash_seq_search(&status);
+	}
+}
+
+
 /*
  * AssignQueuedTasks walks over the given task tracker's task state hash, finds
  * queued tasks in this hash, and synchronously assigns them to the given task
@@ -2395,6 +3965,26 @@ AssignQueuedTasks(TaskTracker *taskTracker)
 }
 
 
+/*
+ * TaskStatusCheckDue returns whether we should check the statuses of the tasks
+ * assigned to the given task tracker, because the tracker notified us that a
+ * task completed or because the status check interval passed since the last
+ * check.
+ */
+static bool
+TaskStatusCheckDue(TaskTracker *taskTracker)
+{
+	if (taskTracker->taskCompletionNotified)
+	{
+		return true;
+	}
+
+	return TimestampDifferenceExceeds(taskTracker->statusCheckTime,
+									  GetCurrentTimestamp(),
+									  RemoteTaskCheckInterval);
+}
+
+
 /*
  * TaskStatusBatchList returns a list containing up to MaxTaskStatusBatchSize
  * tasks from the list of assigned tasks. When the number of tasks is greater
@@ -2461,81 +4051,102 @@ TaskStatusBatchList(TaskTracker *taskTracker)
 
 
 /*
- * TaskStatusBatchQuery builds a command string containing multiple
- * task_tracker_task_status queries from a TrackerTaskState list.
+ * TaskStatusBatchJobList returns one task from each of the jobs the given tasks
+ * belong to, in the order in which the jobs first appear in the list.
  */
-static StringInfo
-TaskStatusBatchQuery(List *taskList)
+static List *
+TaskStatusBatchJobList(List *taskList)
 {
-	StringInfo taskStatusBatchQuery = makeStringInfo();
+	List *jobTaskList = NIL;
 	ListCell *taskCell = NULL;
 
 	foreach(taskCell, taskList)
 	{
 		TrackerTaskState *taskState = (TrackerTaskState *) lfirst(taskCell);
+		ListCell *jobTaskCell = NULL;
+		bool jobFound = false;
+
+		foreach(jobTaskCell, jobTaskList)
+		{
+			TrackerTaskState *jobTaskState = (TrackerTaskState *) lfirst(jobTaskCell);
+
+			if (jobTaskState->jobId == taskState->jobId)
+			{
+				jobFound = true;
+				break;
+			}
+		}
+
+		if (!jobFound)
+		{
+			jobTaskList = lappend(jobTaskList, taskState);
+		}
+	}
+
+	return jobTaskList;
+}
+
+
+/*
+ * TaskStatusBatchQuery builds a command string containing one
+ * task_tracker_job_status query for each job of the tasks in the given
+ * TrackerTaskState list. Each query returns the statuses of all tasks of
+ * the job, so the number of queries does not grow with the number of tasks.
+ */
+static StringInfo
+TaskStatusBatchQuery(List *taskList)
+{
+	StringInfo taskStatusBatchQuery = makeStringInfo();
+	List *jobTaskList = TaskStatusBatchJobList(taskList);
+	ListCell *jobTaskCell = NULL;
 
-		appendStringInfo(taskStatusBatchQuery, TASK_STATUS_QUERY,
-						 taskState->jobId, taskState->taskId);
+	foreach(jobTaskCell, jobTaskList)
+	{
+		TrackerTaskState *jobTaskState = (TrackerTaskState *) lfirst(jobTaskCell);
+
+		appendStringInfo(taskStatusBatchQuery, JOB_STATUS_QUERY, jobTaskState->jobId);
 	}
 
+	list_free(jobTaskList);
+
 	return taskStatusBatchQuery;
 }
 
 
 /*
- * ReceiveTaskStatusBatchQueryResponse assumes that a batch of task status
+ * ReceiveTaskStatusBatchQueryResponse assumes that a batch of job status
  * queries have been previously sent to the given task tracker, and receives
  * and processes the responses for these status queries. If a status check fails
- * only one task status is marked as failed and the remainder is considered not
- * executed.
+ * only one task of the job is marked as failed and the remainder is considered
+ * not executed.
  */
 static void
 ReceiveTaskStatusBatchQueryResponse(TaskTracker *taskTracker)
 {
-	ListCell *taskCell = NULL;
 	List *checkedTaskList = taskTracker->connectionBusyOnTaskList;
+	List *jobTaskList = TaskStatusBatchJobList(checkedTaskList);
+	ListCell *jobTaskCell = NULL;
 	int32 connectionId = taskTracker->connectionId;
 	int rowCount = 0;
 	int columnCount = 0;
 	void *queryResult = NULL;
 
-	foreach(taskCell, checkedTaskList)
+	foreach(jobTaskCell, jobTaskList)
 	{
-		TrackerTaskState *checkedTask = (TrackerTaskState *) lfirst(taskCell);
-		TaskStatus taskStatus = TASK_STATUS_INVALID_FIRST;
+		TrackerTaskState *jobTaskState = (TrackerTaskState *) lfirst(jobTaskCell);
 
 		BatchQueryStatus queryStatus = MultiClientBatchResult(connectionId, &queryResult,
 															  &rowCount, &columnCount);
 		if (queryStatus == CLIENT_BATCH_QUERY_CONTINUE)
 		{
-			char *valueString = MultiClientGetValue(queryResult, 0, 0);
-			if (valueString == NULL || (*valueString) == '\0')
-			{
-				taskStatus = TASK_PERMANENTLY_FAILED;
-			}
-			else
-			{
-				char *valueStringEnd = NULL;
-				errno = 0;
-
-				taskStatus = strtoul(valueString, &valueStringEnd, 0);
-				if (errno != 0 || (*valueStringEnd) != '\0')
-				{
-					/* we couldn't parse received integer */
-					taskStatus = TASK_PERMANENTLY_FAILED;
-				}
-
-				Assert(taskStatus > TASK_STATUS_INVALID_FIRST);
-				Assert(taskStatus < TASK_STATUS_LAST);
-			}
+			UpdateJobTaskStatuses(checkedTaskList, jobTaskState->jobId, queryResult,
+								  rowCount);
 		}
 		else
 		{
-			taskStatus = TASK_CLIENT_SIDE_STATUS_FAILED;
+			jobTaskState->status = TASK_CLIENT_SIDE_STATUS_FAILED;
 		}
 
-		checkedTask->status = taskStatus;
-
 		MultiClientClearResult(queryResult);
 
 		if (queryStatus == CLIENT_BATCH_QUERY_FAILED)
@@ -2548,6 +4159,103 @@ ReceiveTaskStatusBatchQueryResponse(TaskTracker *taskTracker)
 	/* call MultiClientBatchResult one more time to finish reading results */
 	MultiClientBatchResult(connectionId, &queryResult, &rowCount, &columnCount);
 	Assert(queryResult == NULL);
+
+	list_free(jobTaskList);
+}
+
+
+/*
+ * UpdateJobTaskStatuses sets the status of the tasks of the given job in the
+ * given TrackerTaskState list from the result of a job status query, whose
+ * rows are ordered by task id. Tasks that the task tracker does not know
+ * about are marked as failed, as checking their status individually would
+ * have failed as well.
+ */
+static void
+UpdateJobTaskStatuses(List *taskList, uint64 jobId, void *queryResult, int rowCount)
+{
+	ListCell *taskCell = NULL;
+	uint32 *taskIdArray = palloc0(Max(rowCount, 1) * sizeof(uint32));
+	TaskStatus *taskStatusArray = palloc0(Max(rowCount, 1) * sizeof(TaskStatus));
+	int rowIndex = 0;
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		char *taskIdString = MultiClientGetValue(queryResult, rowIndex, 0);
+		char *taskStatusString = MultiClientGetValue(queryResult, rowIndex, 1);
+
+		taskIdArray[rowIndex] = (uint32) strtoul(taskIdString, NULL, 10);
+		taskStatusArray[rowIndex] = ParseTaskStatus(taskStatusString);
+	}
+
+	foreach(taskCell, taskList)
+	{
+		TrackerTaskState *taskState = (TrackerTaskState *) lfirst(taskCell);
+		TaskStatus taskStatus = TASK_CLIENT_SIDE_STATUS_FAILED;
+		int lowIndex = 0;
+		int highIndex = rowCount - 1;
+
+		if (taskState->jobId != jobId)
+		{
+			continue;
+		}
+
+		/* binary search for the task in the rows ordered by task id */
+		while (lowIndex <= highIndex)
+		{
+			int middleIndex = lowIndex + (highIndex - lowIndex) / 2;
+
+			if (taskIdArray[middleIndex] < taskState->taskId)
+			{
+				lowIndex = middleIndex + 1;
+			}
+			else if (taskIdArray[middleIndex] > taskState->taskId)
+			{
+				highIndex = middleIndex - 1;
+			}
+			else
+			{
+				taskStatus = taskStatusArray[middleIndex];
+				break;
+			}
+		}
+
+		taskState->status = taskStatus;
+	}
+
+	pfree(taskIdArray);
+	pfree(taskStatusArray);
+}
+
+
+/*
+ * ParseTaskStatus parses a task status that a task tracker returned, and
+ * returns TASK_PERMANENTLY_FAILED if the value is not a valid status.
+ */
+static TaskStatus
+ParseTaskStatus(char *valueString)
+{
+	TaskStatus taskStatus = TASK_STATUS_INVALID_FIRST;
+	char *valueStringEnd = NULL;
+
+	if (valueString == NULL || (*valueString) == '\0')
+	{
+		return TASK_PERMANENTLY_FAILED;
+	}
+
+	errno = 0;
+
+	taskStatus = strtoul(valueString, &valueStringEnd, 0);
+	if (errno != 0 || (*valueStringEnd) != '\0')
+	{
+		/* we couldn't parse received integer */
+		return TASK_PERMANENTLY_FAILED;
+	}
+
+	Assert(taskStatus > TASK_STATUS_INVALID_FIRST);
+	Assert(taskStatus < TASK_STATUS_LAST);
+
+	return taskStatus;
 }
 
 
@@ -2765,12 +4473,13 @@ TrackerHashWaitActiveRequest(HTAB *taskTrackerHash)
 /*
  * TrackerHashCancelActiveRequest walks over task trackers in the given hash,
  * and checks if they have an ongoing request. If they do, the function sends a
- * cancel message on that connection.
+ * cancel message on that connection. The cancel messages are sent back to back.
  */
 static void
 TrackerHashCancelActiveRequest(HTAB *taskTrackerHash)
 {
 	TaskTracker *taskTracker = NULL;
+	List *connectionIdList = NIL;
 	HASH_SEQ_STATUS status;
 	hash_seq_init(&status, taskTrackerHash);
 
@@ -2782,11 +4491,13 @@ TrackerHashCancelActiveRequest(HTAB *taskTrackerHash)
 		/* if we have an ongoing request, send cancel message */
 		if (trackerConnectionUp && taskTracker->connectionBusy)
 		{
-			MultiClientCancel(taskTracker->connectionId);
+			connectionIdList = lappend_int(connectionIdList, taskTracker->connectionId);
 		}
 
 		taskTracker = (TaskTracker *) hash_seq_search(&status);
 	}
+
+	MultiClientCancelList(connectionIdList);
 }
 
 
@@ -3012,7 +4723,10 @@ TaskTrackerExecScan(CustomScanState *node)
 		LockPartitionsInRelationList(distributedPlan->relationIdList, AccessShareLock);
 
 		PrepareMasterJobDirectory(workerJob);
+
+		QueryStatsRemoteExecutionStart(scanState);
 		MultiTaskTrackerExecute(workerJob);
+		QueryStatsRemoteExecutionEnd();
 
 		LoadTuplesIntoTupleStore(scanState, workerJob);
 
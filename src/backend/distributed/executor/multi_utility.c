@@ -30,13 +30,16 @@
 #include "catalog/pg_class.h"
 #include "citus_version.h"
 #include "catalog/pg_constraint.h"
+#include "catalog/pg_constraint_fn.h"
 #include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
 #include "commands/defrem.h"
 #include "commands/tablecmds.h"
 #include "commands/prepare.h"
+#include "distributed/adaptive_executor.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/colocation_utils.h"
+#include "distributed/column_statistics.h"
 #include "distributed/intermediate_results.h"
 #include "distributed/maintenanced.h"
 #include "distributed/master_metadata_utility.h"
@@ -51,8 +54,12 @@
 #include "distributed/multi_router_planner.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/multi_utility.h" /* IWYU pragma: keep */
+#include "distributed/parallel_copy_to.h"
 #include "distributed/pg_dist_partition.h"
+#include "distributed/remote_commands.h"
 #include "distributed/resource_lock.h"
+#include "distributed/shard_invalidation_log.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/transaction_management.h"
 #include "distributed/transmit.h"
 #include "distributed/worker_protocol.h"
@@ -86,10 +93,16 @@
 #include "utils/palloc.h"
 #include "utils/rel.h"
 #include "utils/relcache.h"
+#include "utils/ruleutils.h"
 #include "utils/syscache.h"
 
 
 bool EnableDDLPropagation = true; /* ddl propagation is enabled */
+int MaxDDLPoolSize = 0; /* connections per worker for DDL, 0 for one per placement */
+int MaxVacuumPoolSize = 0; /* connections per worker for VACUUM and ANALYZE */
+int VacuumCostDelay = -1; /* vacuum_cost_delay on workers, -1 for their default */
+bool UpdateShardStatisticsOnAnalyze = false; /* record shard sizes after ANALYZE */
+bool ParallelForeignKeyValidation = false; /* validate new foreign keys separately */
 
 /*
  * This struct defines the state for the callback for drop statements.
@@ -110,6 +123,7 @@ static bool IsCitusExtensionStmt(Node *parsetree);
 static bool IsTransmitStmt(Node *parsetree);
 static void VerifyTransmitStmt(CopyStmt *copyStatement);
 static bool IsCopyResultStmt(CopyStmt *copyStatement);
+static bool IsCopyPartitionStmt(CopyStmt *copyStatement);
 
 /* Local functions forward declarations for processing distributed table commands */
 static Node * ProcessCopyStmt(CopyStmt *copyStatement, char *completionTag,
@@ -131,6 +145,7 @@ static void ProcessVacuumStmt(VacuumStmt *vacuumStmt, const char *vacuumCommand)
 static bool IsSupportedDistributedVacuumStmt(Oid relationId, VacuumStmt *vacuumStmt);
 static List * VacuumTaskList(Oid relationId, VacuumStmt *vacuumStmt);
 static StringInfo DeparseVacuumStmtPrefix(VacuumStmt *vacuumStmt);
+static char * VacuumSessionSetupCommand(void);
 static char * DeparseVacuumColumnNames(List *columnNameList);
 
 
@@ -160,6 +175,7 @@ static bool IsIndexRenameStmt(RenameStmt *renameStmt);
 static bool AlterInvolvesPartitionColumn(AlterTableStmt *alterTableStatement,
 										 AlterTableCmd *command);
 static void ExecuteDistributedDDLJob(DDLJob *ddlJob);
+static void ExecuteForeignKeyDDLJob(DDLJob *ddlJob);
 static List * DDLTaskList(Oid relationId, const char *commandString);
 static List * CreateIndexTaskList(Oid relationId, IndexStmt *indexStmt);
 static List * DropIndexTaskList(Oid relationId, Oid indexId, DropStmt *dropStmt);
@@ -243,19 +259,53 @@ multi_ProcessUtility(PlannedStmt *pstmt,
 
 	if (IsA(parsetree, TransactionStmt))
 	{
+		TransactionStmt *transactionStmt = (TransactionStmt *) parsetree;
+		bool commitPrepared = (transactionStmt->kind == TRANS_STMT_COMMIT_PREPARED);
+
 		/*
 		 * Transaction statements (e.g. ABORT, COMMIT) can be run in aborted
 		 * transactions in which case a lot of checks cannot be done safely in
 		 * that state. Since we never need to intercept transaction statements,
 		 * skip our checks and immediately fall into standard_ProcessUtility.
+		 *
+		 * The only exception is COMMIT PREPARED, which commits metadata changes
+		 * without running the transaction callbacks of the backend that made
+		 * them, so we clean up the shared metadata cache and log the changes
+		 * for other backends around it.
 		 */
+		if (commitPrepared)
+		{
+			BeginSharedMetadataCacheCommitPrepared();
+			BeginShardInvalidationLogCommitPrepared();
+		}
+
+		PG_TRY();
+		{
 #if (PG_VERSION_NUM >= 100000)
-		standard_ProcessUtility(pstmt, queryString, context,
-								params, queryEnv, dest, completionTag);
+			standard_ProcessUtility(pstmt, queryString, context,
+									params, queryEnv, dest, completionTag);
 #else
-		standard_ProcessUtility(parsetree, queryString, context,
-								params, dest, completionTag);
+			standard_ProcessUtility(parsetree, queryString, context,
+									params, dest, completionTag);
 #endif
+		}
+		PG_CATCH();
+		{
+			if (commitPrepared)
+			{
+				EndSharedMetadataCacheCommitPrepared();
+				EndShardInvalidationLogCommitPrepared();
+			}
+
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+
+		if (commitPrepared)
+		{
+			EndSharedMetadataCacheCommitPrepared();
+			EndShardInvalidationLogCommitPrepared();
+		}
 
 		return;
 	}
@@ -745,6 +795,33 @@ IsCopyResultStmt(CopyStmt *copyStatement)
 }
 
 
+/*
+ * IsCopyPartitionStmt determines whether the given copy statement is a
+ * COPY "partitionname" FROM STDIN WITH (format partition) statement, which is
+ * used by map tasks to stream partitions to the nodes that merge them.
+ */
+static bool
+IsCopyPartitionStmt(CopyStmt *copyStatement)
+{
+	ListCell *optionCell = NULL;
+	bool hasFormatPartition = false;
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *defel = (DefElem *) lfirst(optionCell);
+
+		if (strncmp(defel->defname, "format", NAMEDATALEN) == 0 &&
+			strncmp(defGetString(defel), "partition", NAMEDATALEN) == 0)
+		{
+			hasFormatPartition = true;
+			break;
+		}
+	}
+
+	return hasFormatPartition;
+}
+
+
 /*
  * ProcessCopyStmt handles Citus specific concerns for COPY like supporting
  * COPYing from distributed tables and preventing unsupported actions. The
@@ -775,6 +852,27 @@ ProcessCopyStmt(CopyStmt *copyStatement, char *completionTag, bool *commandMustR
 		return NULL;
 	}
 
+	/*
+	 * Handle special COPY "partitionname" FROM STDIN WITH (format partition)
+	 * commands through which map tasks push partitions to merge task nodes.
+	 * Like transmit, these write into the job cache and need superuser.
+	 */
+	if (IsCopyPartitionStmt(copyStatement))
+	{
+		EnsureSuperUser();
+
+		if (!copyStatement->is_from || copyStatement->filename != NULL ||
+			copyStatement->relation == NULL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("FORMAT 'partition' only supports COPY FROM STDIN")));
+		}
+
+		ReceivePushedPartitionFile(copyStatement->relation->relname);
+
+		return NULL;
+	}
+
 	/*
 	 * We check whether a distributed relation is affected. For that, we need to open the
 	 * relation. To prevent race conditions with later lookups, lock the table, and modify
@@ -837,6 +935,13 @@ ProcessCopyStmt(CopyStmt *copyStatement, char *completionTag, bool *commandMustR
 				CitusCopyFrom(copyStatement, completionTag);
 				return NULL;
 			}
+			else if (CanParallelCopyTo(copyStatement))
+			{
+				CheckCopyPermissions(copyStatement);
+
+				CitusCopyTo(copyStatement, completionTag);
+				return NULL;
+			}
 			else if (!copyStatement->is_from)
 			{
 				/*
@@ -1250,6 +1355,7 @@ PlanAlterTableStmt(AlterTableStmt *alterTableStatement, const char *alterTableCo
 	bool isDistributedRelation = false;
 	List *commandList = NIL;
 	ListCell *commandCell = NULL;
+	char *foreignConstraintName = NULL;
 
 	/* first check whether a distributed relation is affected */
 	if (alterTableStatement->relation == NULL)
@@ -1333,6 +1439,17 @@ PlanAlterTableStmt(AlterTableStmt *alterTableStatement, const char *alterTableCo
 				 * transaction is in process, which causes deadlock.
 				 */
 				constraint->skip_validation = true;
+
+				/*
+				 * Outside of transaction blocks, the constraint can be added as
+				 * NOT VALID first and validated on the shards afterwards, such
+				 * that the shards are scanned without blocking writes.
+				 */
+				if (ParallelForeignKeyValidation && constraint->initially_valid &&
+					!IsTransactionBlock())
+				{
+					foreignConstraintName = constraint->conname;
+				}
 			}
 		}
 #if (PG_VERSION_NUM >= 100000)
@@ -1378,7 +1495,14 @@ PlanAlterTableStmt(AlterTableStmt *alterTableStatement, const char *alterTableCo
 	ddlJob->concurrentIndexCmd = false;
 	ddlJob->commandString = alterTableCommand;
 
-	if (rightRelationId)
+	if (foreignConstraintName != NULL)
+	{
+		/* tasks are built from the constraint on the coordinator once it exists */
+		ddlJob->foreignConstraintName = foreignConstraintName;
+		ddlJob->referencedRelationId = rightRelationId;
+		ddlJob->taskList = NIL;
+	}
+	else if (rightRelationId)
 	{
 		/* if foreign key related, use specialized task list function ... */
 		ddlJob->taskList = InterShardDDLTaskList(leftRelationId, rightRelationId,
@@ -1647,7 +1771,50 @@ ProcessVacuumStmt(VacuumStmt *vacuumStmt, const char *vacuumCommand)
 		MultiShardCommitProtocol = COMMIT_PROTOCOL_BARE;
 	}
 
-	ExecuteModifyTasksWithoutResults(taskList);
+	/*
+	 * Vacuuming all placements of a worker at once can saturate its disks, so
+	 * we can limit the number of commands per worker and throttle them.
+	 */
+	if (MaxVacuumPoolSize > 0 && !IsTransactionBlock())
+	{
+		ExecuteUtilityTaskListWithoutResults(taskList, MaxVacuumPoolSize,
+											 VacuumSessionSetupCommand());
+	}
+	else
+	{
+		ExecuteModifyTasksWithoutResults(taskList);
+	}
+
+	/* the planner uses the shard sizes and column statistics, e.g. for joins */
+	if ((vacuumStmt->options & VACOPT_ANALYZE) != 0 && UpdateShardStatisticsOnAnalyze)
+	{
+		UpdateShardPlacementLengths(relationId);
+		UpdateColumnStatistics(relationId);
+	}
+}
+
+
+/*
+ * VacuumSessionSetupCommand returns the command that sets vacuum_cost_delay
+ * on the worker sessions to citus.vacuum_cost_delay. The worker's default is
+ * restored if it is not set, since the sessions may have been throttled by
+ * an earlier command.
+ */
+static char *
+VacuumSessionSetupCommand(void)
+{
+	StringInfo setupCommand = makeStringInfo();
+
+	if (VacuumCostDelay >= 0)
+	{
+		appendStringInfo(setupCommand, "SET vacuum_cost_delay TO %d", VacuumCostDelay);
+	}
+	else
+	{
+		appendStringInfoString(setupCommand, "SET vacuum_cost_delay TO DEFAULT");
+	}
+
+	return setupCommand->data;
 }
 
 
@@ -3074,15 +3241,32 @@ ExecuteDistributedDDLJob(DDLJob *ddlJob)
 
 	EnsureCoordinator();
 
-	if (!ddlJob->concurrentIndexCmd)
+	/* statements prepared on the shards may no longer return the same columns */
+	InvalidatePreparedStatements();
+
+	if (ddlJob->foreignConstraintName != NULL)
+	{
+		ExecuteForeignKeyDDLJob(ddlJob);
+	}
+	else if (!ddlJob->concurrentIndexCmd)
 	{
 		if (shouldSyncMetadata)
 		{
-			SendCommandToWorkers(WORKERS_WITH_METADATA, DISABLE_DDL_PROPAGATION);
-			SendCommandToWorkers(WORKERS_WITH_METADATA, (char *) ddlJob->commandString);
+			List *commandList = list_make2(DISABLE_DDL_PROPAGATION,
+										   (char *) ddlJob->commandString);
+
+			SendCommandListToWorkers(WORKERS_WITH_METADATA, commandList);
 		}
 
-		ExecuteModifyTasksWithoutResults(ddlJob->taskList);
+		if (MaxDDLPoolSize > 0 && !IsTransactionBlock())
+		{
+			ExecuteUtilityTaskListWithoutResults(ddlJob->taskList, MaxDDLPoolSize,
+												 NULL);
+		}
+		else
+		{
+			ExecuteModifyTasksWithoutResults(ddlJob->taskList);
+		}
 	}
 	else
 	{
@@ -3093,7 +3277,15 @@ ExecuteDistributedDDLJob(DDLJob *ddlJob)
 
 		PG_TRY();
 		{
-			ExecuteTasksSequentiallyWithoutResults(ddlJob->taskList);
+			if (MaxDDLPoolSize > 0)
+			{
+				ExecuteUtilityTaskListWithoutResults(ddlJob->taskList, MaxDDLPoolSize,
+													 NULL);
+			}
+			else
+			{
+				ExecuteTasksSequentiallyWithoutResults(ddlJob->taskList);
+			}
 
 			if (shouldSyncMetadata)
 			{
@@ -3117,6 +3309,81 @@ ExecuteDistributedDDLJob(DDLJob *ddlJob)
 }
 
 
+/*
+ * ExecuteForeignKeyDDLJob adds the foreign key of the given DDLJob to the
+ * shards in two steps. The constraint is first added as NOT VALID to all
+ * shards, which only briefly blocks writes, and then validated on the shards
+ * in parallel, which scans the shards while holding a SHARE UPDATE EXCLUSIVE
+ * lock on the referencing shard and a ROW SHARE lock on the referenced shard.
+ * Both steps commit on the shards right away, since the validation could not
+ * proceed while the coordinated transaction holds the locks of the first step.
+ */
+static void
+ExecuteForeignKeyDDLJob(DDLJob *ddlJob)
+{
+	Oid relationId = ddlJob->targetRelationId;
+	char *constraintName = ddlJob->foreignConstraintName;
+	bool shouldSyncMetadata = ShouldSyncTableMetadata(relationId);
+	int poolSize = Max(MaxDDLPoolSize, 1);
+	MemoryContext savedContext = CurrentMemoryContext;
+	Oid constraintId = InvalidOid;
+	StringInfo addCommand = makeStringInfo();
+	StringInfo validateCommand = makeStringInfo();
+	List *addTaskList = NIL;
+	List *validateTaskList = NIL;
+
+	constraintId = get_relation_constraint_oid(relationId, constraintName, false);
+
+	appendStringInfo(addCommand, "%s NOT VALID",
+					 pg_get_constraintdef_command(constraintId));
+	appendStringInfo(validateCommand, "ALTER TABLE %s VALIDATE CONSTRAINT %s",
+					 generate_qualified_relation_name(relationId),
+					 quote_identifier(constraintName));
+
+	addTaskList = InterShardDDLTaskList(relationId, ddlJob->referencedRelationId,
+										addCommand->data);
+	validateTaskList = DDLTaskList(relationId, validateCommand->data);
+
+	/* save old commit protocol to restore at xact end */
+	Assert(SavedMultiShardCommitProtocol == COMMIT_PROTOCOL_BARE);
+	SavedMultiShardCommitProtocol = MultiShardCommitProtocol;
+	MultiShardCommitProtocol = COMMIT_PROTOCOL_BARE;
+
+	PG_TRY();
+	{
+		ExecuteUtilityTaskListWithoutResults(addTaskList, poolSize, NULL);
+		ExecuteUtilityTaskListWithoutResults(validateTaskList, poolSize, NULL);
+
+		if (shouldSyncMetadata)
+		{
+			List *commandList = list_make2(DISABLE_DDL_PROPAGATION,
+										   (char *) ddlJob->commandString);
+
+			SendBareCommandListToWorkers(WORKERS_WITH_METADATA, commandList);
+		}
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata = NULL;
+
+		MemoryContextSwitchTo(savedContext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		ereport(ERROR,
+				(errcode(edata->sqlerrcode),
+				 errmsg("%s", edata->message),
+				 errdetail("The foreign key may have been added as NOT VALID to "
+						   "some of the shards."),
+				 errhint("Use ALTER TABLE %s DROP CONSTRAINT IF EXISTS %s to "
+						 "remove it, then retry the original command.",
+						 generate_qualified_relation_name(relationId),
+						 quote_identifier(constraintName))));
+	}
+	PG_END_TRY();
+}
+
+
 /*
  * DDLTaskList builds a list of tasks to execute a DDL command on a
  * given list of shards.
@@ -3802,6 +4069,7 @@ ProcessDropTableStmt(DropStmt *dropTableStatement)
 		bool missingOK = true;
 		List *partitionList = NIL;
 		ListCell *partitionCell = NULL;
+		List *commandList = NIL;
 
 		Oid relationId = RangeVarGetRelid(tableRangeVar, AccessShareLock, missingOK);
 
@@ -3821,7 +4089,7 @@ ProcessDropTableStmt(DropStmt *dropTableStatement)
 			continue;
 		}
 
-		SendCommandToWorkers(WORKERS_WITH_METADATA, DISABLE_DDL_PROPAGATION);
+		commandList = lappend(commandList, DISABLE_DDL_PROPAGATION);
 
 		foreach(partitionCell, partitionList)
 		{
@@ -3829,7 +4097,9 @@ ProcessDropTableStmt(DropStmt *dropTableStatement)
 			char *detachPartitionCommand =
 				GenerateDetachPartitionCommand(partitionRelationId);
 
-			SendCommandToWorkers(WORKERS_WITH_METADATA, detachPartitionCommand);
+			commandList = lappend(commandList, detachPartitionCommand);
 		}
+
+		SendCommandListToWorkers(WORKERS_WITH_METADATA, commandList);
 	}
 }
@@ -0,0 +1,860 @@
+/*-------------------------------------------------------------------------
+ *
+ * query_stats.c
+ *   Tracks where the time of distributed queries goes, per statement, in
+ *   the citus_stat_statements view.
+ *
+ *   Statements are keyed by the query id of the top-level coordinator query,
+ *   which pg_stat_statements computes from the normalized query tree. When
+ *   pg_stat_statements is not loaded, the query id is 0 and we hash the query
+ *   text instead, such that statements with different constants end up in
+ *   different entries.
+ *
+ *   The executor hooks measure the total execution time of top-level queries.
+ *   The executors report when they execute subplans and run the distributed
+ *   part of the query, and how many bytes they receive. The time spent on the
+ *   coordinator outside of those, such as merging the results of the tasks,
+ *   is the remainder. The statistics of a query are added to the shared hash
+ *   when it ends.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/hash.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/multi_server_executor.h"
+#include "distributed/query_stats.h"
+#include "distributed/query_trace.h"
+#include "executor/executor.h"
+#include "executor/instrument.h"
+#include "portability/instr_time.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+
+#define CITUS_STAT_STATEMENTS_COLUMNS 14
+
+
+/* shared memory holding the lock that protects the statistics hash */
+typedef struct QueryStatsControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+} QueryStatsControlData;
+
+
+/* identifies a statement in the statistics hash */
+typedef struct QueryStatsHashKey
+{
+	Oid userId;
+	Oid databaseId;
+	uint64 queryId;
+	int executorType;
+} QueryStatsHashKey;
+
+
+/* statistics of a statement, summed over all of its executions */
+typedef struct QueryStatsHashEntry
+{
+	QueryStatsHashKey key;
+
+	int64 calls;
+	int64 shardCount;
+	double planningTime;
+	double subPlanTime;
+	double remoteTime;
+	double mergeTime;
+	double totalTime;
+	int64 bytesReceived;
+	int64 intermediateResultBytes;
+
+	char query[QUERY_STATS_TEXT_LENGTH];
+} QueryStatsHashEntry;
+
+
+/* statistics of the top-level query that the current backend executes */
+typedef struct CurrentQueryStatsData
+{
+	QueryDesc *queryDesc;
+	int executorType;
+	int64 shardCount;
+	double planningTime;
+	double subPlanTime;
+	double remoteTime;
+	int64 bytesReceived;
+	int64 intermediateResultBytes;
+
+	/* nesting depth and start time of remote and subplan execution */
+	int remoteDepth;
+	instr_time remoteStartTime;
+	double remoteStartSubPlanTime;
+	int subPlanDepth;
+	instr_time subPlanStartTime;
+} CurrentQueryStatsData;
+
+
+/* config variables */
+int StatStatementsMax = 1000;
+int StatStatementsTrack = STAT_STATEMENTS_TRACK_NONE;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
+
+static QueryStatsControlData *QueryStatsControl = NULL;
+static HTAB *QueryStatsHash = NULL;
+
+/* nesting level of the executor, to only track top-level queries */
+int ExecutorNestingLevel = 0;
+
+/* planning time of the next top-level query */
+static double PendingPlanningTime = 0.0;
+
+/* statistics of the current top-level query, if it is tracked */
+static bool CurrentQueryTracked = false;
+static CurrentQueryStatsData CurrentQueryStats;
+
+
+static size_t QueryStatsShmemSize(void);
+static void QueryStatsShmemInit(void);
+static void CitusExecutorStart(QueryDesc *queryDesc, int eflags);
+#if (PG_VERSION_NUM >= 100000)
+static void CitusExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+							 uint64 count, bool execute_once);
+#else
+static void CitusExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+							 uint64 count);
+#endif
+static void CitusExecutorFinish(QueryDesc *queryDesc);
+static void CitusExecutorEnd(QueryDesc *queryDesc);
+static void StoreQueryStats(QueryDesc *queryDesc, double totalTime);
+static QueryStatsHashEntry * CreateQueryStatsEntry(QueryStatsHashKey *key,
+												   const char *queryString);
+static double ElapsedMilliseconds(instr_time startTime);
+static const char * ExecutorTypeName(int executorType);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(citus_stat_statements);
+PG_FUNCTION_INFO_V1(citus_stat_statements_reset);
+
+
+/*
+ * citus_stat_statements returns the execution statistics of the tracked
+ * distributed statements. The query texts of statements of other users are
+ * only shown to superusers.
+ */
+Datum
+citus_stat_statements(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	HASH_SEQ_STATUS status;
+	QueryStatsHashEntry *entry = NULL;
+	Oid currentUserId = GetUserId();
+	bool isSuperuser = superuser();
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&QueryStatsControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, QueryStatsHash);
+
+	while ((entry = (QueryStatsHashEntry *) hash_seq_search(&status)) != NULL)
+	{
+		Datum values[CITUS_STAT_STATEMENTS_COLUMNS];
+		bool nulls[CITUS_STAT_STATEMENTS_COLUMNS];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int64GetDatum((int64) entry->key.queryId);
+		values[1] = ObjectIdGetDatum(entry->key.userId);
+		values[2] = ObjectIdGetDatum(entry->key.databaseId);
+
+		if (isSuperuser || entry->key.userId == currentUserId)
+		{
+			values[3] = CStringGetTextDatum(entry->query);
+		}
+		else
+		{
+			values[3] = CStringGetTextDatum("<insufficient privilege>");
+		}
+
+		values[4] = CStringGetTextDatum(ExecutorTypeName(entry->key.executorType));
+		values[5] = Int64GetDatum(entry->calls);
+		values[6] = Int64GetDatum(entry->shardCount);
+		values[7] = Float8GetDatum(entry->planningTime);
+		values[8] = Float8GetDatum(entry->subPlanTime);
+		values[9] = Float8GetDatum(entry->remoteTime);
+		values[10] = Float8GetDatum(entry->mergeTime);
+		values[11] = Float8GetDatum(entry->totalTime);
+		values[12] = Int64GetDatum(entry->bytesReceived);
+		values[13] = Int64GetDatum(entry->intermediateResultBytes);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+	}
+
+	LWLockRelease(&QueryStatsControl->lock);
+
+	tuplestore_donestoring(tupleStore);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * citus_stat_statements_reset removes all statistics from citus_stat_statements.
+ */
+Datum
+citus_stat_statements_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS status;
+	QueryStatsHashEntry *entry = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	LWLockAcquire(&QueryStatsControl->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, QueryStatsHash);
+
+	while ((entry = (QueryStatsHashEntry *) hash_seq_search(&status)) != NULL)
+	{
+		hash_search(QueryStatsHash, &entry->key, HASH_REMOVE, NULL);
+	}
+
+	LWLockRelease(&QueryStatsControl->lock);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * QueryStatsRecordPlanningTime remembers the time it took to plan a top-level
+ * distributed query, such that it is added to its statistics when it runs.
+ */
+void
+QueryStatsRecordPlanningTime(double planningTime)
+{
+	PendingPlanningTime = planningTime;
+}
+
+
+/*
+ * QueryStatsRemoteExecutionStart is called by the custom scans when they start
+ * running the distributed part of a query. Remote execution of nested queries,
+ * for instance of subplans, is part of the outermost one.
+ */
+void
+QueryStatsRemoteExecutionStart(CitusScanState *scanState)
+{
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+
+	QueryTraceRemoteExecutionStart();
+
+	if (!CurrentQueryTracked)
+	{
+		return;
+	}
+
+	if (CurrentQueryStats.remoteDepth == 0)
+	{
+		if (CurrentQueryStats.executorType == MULTI_EXECUTOR_INVALID_FIRST)
+		{
+			CurrentQueryStats.executorType = scanState->executorType;
+		}
+
+		if (distributedPlan->workerJob != NULL)
+		{
+			CurrentQueryStats.shardCount +=
+				list_length(distributedPlan->workerJob->taskList);
+		}
+
+		INSTR_TIME_SET_CURRENT(CurrentQueryStats.remoteStartTime);
+		CurrentQueryStats.remoteStartSubPlanTime = CurrentQueryStats.subPlanTime;
+	}
+
+	CurrentQueryStats.remoteDepth++;
+}
+
+
+/*
+ * QueryStatsRemoteExecutionEnd is called by the custom scans when they finish
+ * running the distributed part of a query. Subplans that were executed in the
+ * meantime are not part of the remote execution time.
+ */
+void
+QueryStatsRemoteExecutionEnd(void)
+{
+	QueryTraceRemoteExecutionEnd();
+
+	if (!CurrentQueryTracked || CurrentQueryStats.remoteDepth == 0)
+	{
+		return;
+	}
+
+	CurrentQueryStats.remoteDepth--;
+
+	if (CurrentQueryStats.remoteDepth == 0)
+	{
+		double elapsedTime = ElapsedMilliseconds(CurrentQueryStats.remoteStartTime);
+		double subPlanTime = CurrentQueryStats.subPlanTime -
+							 CurrentQueryStats.remoteStartSubPlanTime;
+
+		CurrentQueryStats.remoteTime += Max(elapsedTime - subPlanTime, 0.0);
+	}
+}
+
+
+/*
+ * QueryStatsSubPlanExecutionStart is called when ExecuteSubPlans starts
+ * executing the subplans of a distributed plan.
+ */
+void
+QueryStatsSubPlanExecutionStart(void)
+{
+	RecordQueryTraceEvent(QUERY_TRACE_SUBPLANS, QUERY_TRACE_BEGIN, NULL, 0);
+
+	if (!CurrentQueryTracked)
+	{
+		return;
+	}
+
+	if (CurrentQueryStats.subPlanDepth == 0)
+	{
+		INSTR_TIME_SET_CURRENT(CurrentQueryStats.subPlanStartTime);
+	}
+
+	CurrentQueryStats.subPlanDepth++;
+}
+
+
+/*
+ * QueryStatsSubPlanExecutionEnd is called when ExecuteSubPlans finished
+ * executing the subplans of a distributed plan.
+ */
+void
+QueryStatsSubPlanExecutionEnd(void)
+{
+	RecordQueryTraceEvent(QUERY_TRACE_SUBPLANS, QUERY_TRACE_END, NULL, 0);
+
+	if (!CurrentQueryTracked || CurrentQueryStats.subPlanDepth == 0)
+	{
+		return;
+	}
+
+	CurrentQueryStats.subPlanDepth--;
+
+	if (CurrentQueryStats.subPlanDepth == 0)
+	{
+		CurrentQueryStats.subPlanTime +=
+			ElapsedMilliseconds(CurrentQueryStats.subPlanStartTime);
+	}
+}
+
+
+/*
+ * QueryStatsAddBytesReceived adds the given number of bytes that an executor
+ * received from the workers to the statistics of the current query.
+ */
+void
+QueryStatsAddBytesReceived(uint64 byteCount)
+{
+	QueryTraceRowReceived();
+
+	if (CurrentQueryTracked)
+	{
+		CurrentQueryStats.bytesReceived += byteCount;
+	}
+}
+
+
+/*
+ * QueryStatsAddIntermediateResultBytes adds the given number of bytes written
+ * to intermediate results to the statistics of the current query.
+ */
+void
+QueryStatsAddIntermediateResultBytes(uint64 byteCount)
+{
+	if (CurrentQueryTracked)
+	{
+		CurrentQueryStats.intermediateResultBytes += byteCount;
+	}
+}
+
+
+/*
+ * CitusExecutorStart starts tracking top-level queries when tracking is
+ * enabled. Whether the query is distributed is only known once one of the
+ * custom scans starts remote execution.
+ */
+static void
+CitusExecutorStart(QueryDesc *queryDesc, int eflags)
+{
+	bool trackQuery = false;
+
+	if (ExecutorNestingLevel == 0)
+	{
+		trackQuery = StatStatementsTrack != STAT_STATEMENTS_TRACK_NONE &&
+					 QueryStatsHash != NULL &&
+					 !(eflags & EXEC_FLAG_EXPLAIN_ONLY);
+
+		memset(&CurrentQueryStats, 0, sizeof(CurrentQueryStats));
+		CurrentQueryTracked = false;
+
+		if (trackQuery)
+		{
+			CurrentQueryStats.queryDesc = queryDesc;
+			CurrentQueryStats.executorType = MULTI_EXECUTOR_INVALID_FIRST;
+			CurrentQueryStats.planningTime = PendingPlanningTime;
+		}
+
+		PendingPlanningTime = 0.0;
+
+		QueryTraceStatementStart(false);
+	}
+
+	if (prev_ExecutorStart != NULL)
+	{
+		prev_ExecutorStart(queryDesc, eflags);
+	}
+	else
+	{
+		standard_ExecutorStart(queryDesc, eflags);
+	}
+
+	if (trackQuery)
+	{
+		/* let the executor measure the total time, as pg_stat_statements does */
+		if (queryDesc->totaltime == NULL)
+		{
+			MemoryContext oldContext =
+				MemoryContextSwitchTo(queryDesc->estate->es_query_cxt);
+
+			queryDesc->totaltime = InstrAlloc(1, INSTRUMENT_TIMER);
+
+			MemoryContextSwitchTo(oldContext);
+		}
+
+		CurrentQueryTracked = true;
+	}
+}
+
+
+/*
+ * CitusExecutorRun keeps track of the executor nesting level.
+ */
+#if (PG_VERSION_NUM >= 100000)
+static void
+CitusExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count,
+				 bool execute_once)
+#else
+static void
+CitusExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count)
+#endif
+{
+	ExecutorNestingLevel++;
+
+	PG_TRY();
+	{
+#if (PG_VERSION_NUM >= 100000)
+		if (prev_ExecutorRun != NULL)
+		{
+			prev_ExecutorRun(queryDesc, direction, count, execute_once);
+		}
+		else
+		{
+			standard_ExecutorRun(queryDesc, direction, count, execute_once);
+		}
+#else
+		if (prev_ExecutorRun != NULL)
+		{
+			prev_ExecutorRun(queryDesc, direction, count);
+		}
+		else
+		{
+			standard_ExecutorRun(queryDesc, direction, count);
+		}
+#endif
+
+		ExecutorNestingLevel--;
+	}
+	PG_CATCH();
+	{
+		ExecutorNestingLevel--;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+
+/*
+ * CitusExecutorFinish keeps track of the executor nesting level.
+ */
+static void
+CitusExecutorFinish(QueryDesc *queryDesc)
+{
+	ExecutorNestingLevel++;
+
+	PG_TRY();
+	{
+		if (prev_ExecutorFinish != NULL)
+		{
+			prev_ExecutorFinish(queryDesc);
+		}
+		else
+		{
+			standard_ExecutorFinish(queryDesc);
+		}
+
+		ExecutorNestingLevel--;
+	}
+	PG_CATCH();
+	{
+		ExecutorNestingLevel--;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+
+/*
+ * CitusExecutorEnd adds the statistics of a tracked distributed query to the
+ * shared hash when the query ends.
+ */
+static void
+CitusExecutorEnd(QueryDesc *queryDesc)
+{
+	if (CurrentQueryTracked && CurrentQueryStats.queryDesc == queryDesc)
+	{
+		if (CurrentQueryStats.executorType != MULTI_EXECUTOR_INVALID_FIRST &&
+			queryDesc->totaltime != NULL)
+		{
+			/* make sure stats accumulation is done */
+			InstrEndLoop(queryDesc->totaltime);
+
+			StoreQueryStats(queryDesc, queryDesc->totaltime->total * 1000.0);
+		}
+
+		CurrentQueryTracked = false;
+	}
+
+	if (prev_ExecutorEnd != NULL)
+	{
+		prev_ExecutorEnd(queryDesc);
+	}
+	else
+	{
+		standard_ExecutorEnd(queryDesc);
+	}
+}
+
+
+/*
+ * StoreQueryStats adds the statistics of the current query to its entry in
+ * the shared hash.
+ */
+static void
+StoreQueryStats(QueryDesc *queryDesc, double totalTime)
+{
+	QueryStatsHashKey key;
+	QueryStatsHashEntry *entry = NULL;
+	const char *queryString = queryDesc->sourceText;
+	double mergeTime = 0.0;
+
+	if (queryString == NULL)
+	{
+		queryString = "";
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.userId = GetUserId();
+	key.databaseId = MyDatabaseId;
+	key.queryId = (uint64) queryDesc->plannedstmt->queryId;
+	key.executorType = CurrentQueryStats.executorType;
+
+	if (key.queryId == 0)
+	{
+		key.queryId = (uint64) DatumGetUInt32(hash_any((const unsigned char *) queryString,
+													   strlen(queryString)));
+	}
+
+	mergeTime = totalTime - CurrentQueryStats.remoteTime - CurrentQueryStats.subPlanTime;
+
+	LWLockAcquire(&QueryStatsControl->lock, LW_EXCLUSIVE);
+
+	entry = (QueryStatsHashEntry *) hash_search(QueryStatsHash, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		entry = CreateQueryStatsEntry(&key, queryString);
+	}
+
+	entry->calls++;
+	entry->shardCount += CurrentQueryStats.shardCount;
+	entry->planningTime += CurrentQueryStats.planningTime;
+	entry->subPlanTime += CurrentQueryStats.subPlanTime;
+	entry->remoteTime += CurrentQueryStats.remoteTime;
+	entry->mergeTime += Max(mergeTime, 0.0);
+	entry->totalTime += totalTime;
+	entry->bytesReceived += CurrentQueryStats.bytesReceived;
+	entry->intermediateResultBytes += CurrentQueryStats.intermediateResultBytes;
+
+	LWLockRelease(&QueryStatsControl->lock);
+}
+
+
+/*
+ * CreateQueryStatsEntry adds an entry for the given statement to the shared
+ * hash. When the hash is full, the entry with the fewest calls is evicted
+ * first. The caller should hold the lock in exclusive mode.
+ */
+static QueryStatsHashEntry *
+CreateQueryStatsEntry(QueryStatsHashKey *key, const char *queryString)
+{
+	QueryStatsHashEntry *entry = NULL;
+	bool found = false;
+
+	if (hash_get_num_entries(QueryStatsHash) >= StatStatementsMax)
+	{
+		HASH_SEQ_STATUS status;
+		QueryStatsHashEntry *currentEntry = NULL;
+		QueryStatsHashEntry *evictedEntry = NULL;
+
+		hash_seq_init(&status, QueryStatsHash);
+
+		while ((currentEntry = (QueryStatsHashEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (evictedEntry == NULL || currentEntry->calls < evictedEntry->calls)
+			{
+				evictedEntry = currentEntry;
+			}
+		}
+
+		hash_search(QueryStatsHash, &evictedEntry->key, HASH_REMOVE, NULL);
+	}
+
+	entry = (QueryStatsHashEntry *) hash_search(QueryStatsHash, key, HASH_ENTER,
+												&found);
+
+	memset(((char *) entry) + sizeof(QueryStatsHashKey), 0,
+		   sizeof(QueryStatsHashEntry) - sizeof(QueryStatsHashKey));
+	strlcpy(entry->query, queryString, QUERY_STATS_TEXT_LENGTH);
+
+	return entry;
+}
+
+
+/*
+ * ElapsedMilliseconds returns the number of milliseconds since the given time.
+ */
+static double
+ElapsedMilliseconds(instr_time startTime)
+{
+	instr_time currentTime;
+
+	INSTR_TIME_SET_CURRENT(currentTime);
+	INSTR_TIME_SUBTRACT(currentTime, startTime);
+
+	return INSTR_TIME_GET_MILLISEC(currentTime);
+}
+
+
+/*
+ * ExecutorTypeName returns the name of the given executor type, as used in
+ * citus.task_executor_type where applicable.
+ */
+static const char *
+ExecutorTypeName(int executorType)
+{
+	switch (executorType)
+	{
+		case MULTI_EXECUTOR_REAL_TIME:
+		{
+			return "real-time";
+		}
+
+		case MULTI_EXECUTOR_TASK_TRACKER:
+		{
+			return "task-tracker";
+		}
+
+		case MULTI_EXECUTOR_ROUTER:
+		{
+			return "router";
+		}
+
+		case MULTI_EXECUTOR_COORDINATOR_INSERT_SELECT:
+		{
+			return "insert-select";
+		}
+
+		case MULTI_EXECUTOR_ADAPTIVE:
+		{
+			return "adaptive";
+		}
+
+		default:
+		{
+			return "unknown";
+		}
+	}
+}
+
+
+/*
+ * InitializeCitusQueryStats requests the necessary shared memory from Postgres
+ * and sets up the shared memory startup and executor hooks.
+ */
+void
+InitializeCitusQueryStats(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(QueryStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = QueryStatsShmemInit;
+
+	prev_ExecutorStart = ExecutorStart_hook;
+	ExecutorStart_hook = CitusExecutorStart;
+	prev_ExecutorRun = ExecutorRun_hook;
+	ExecutorRun_hook = CitusExecutorRun;
+	prev_ExecutorFinish = ExecutorFinish_hook;
+	ExecutorFinish_hook = CitusExecutorFinish;
+	prev_ExecutorEnd = ExecutorEnd_hook;
+	ExecutorEnd_hook = CitusExecutorEnd;
+}
+
+
+/*
+ * QueryStatsShmemSize computes how much shared memory is required.
+ */
+static size_t
+QueryStatsShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, sizeof(QueryStatsControlData));
+
+	hashSize = hash_estimate_size(StatStatementsMax, sizeof(QueryStatsHashEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * QueryStatsShmemInit initializes the shared memory that holds the statement
+ * statistics.
+ */
+static void
+QueryStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	QueryStatsControl =
+		(QueryStatsControlData *) ShmemInitStruct("Citus Query Stats Data",
+												  sizeof(QueryStatsControlData),
+												  &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out all the memory */
+		memset(QueryStatsControl, 0, sizeof(QueryStatsControlData));
+
+#if (PG_VERSION_NUM >= 100000)
+		QueryStatsControl->trancheId = LWLockNewTrancheId();
+		QueryStatsControl->lockTrancheName = "Citus Query Stats";
+		LWLockRegisterTranche(QueryStatsControl->trancheId,
+							  QueryStatsControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &QueryStatsControl->lockTranche;
+
+			QueryStatsControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &QueryStatsControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Citus Query Stats";
+			LWLockRegisterTranche(QueryStatsControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&QueryStatsControl->lock, QueryStatsControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(QueryStatsHashKey);
+	hashInfo.entrysize = sizeof(QueryStatsHashEntry);
+	hashFlags = (HASH_ELEM | HASH_BLOBS);
+
+	QueryStatsHash = ShmemInitHash("Citus Query Stats Hash",
+								   StatStatementsMax, StatStatementsMax,
+								   &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
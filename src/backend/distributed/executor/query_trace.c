@@ -0,0 +1,642 @@
+/*-------------------------------------------------------------------------
+ *
+ * query_trace.c
+ *   Records timestamped events of a sample of the distributed queries in a
+ *   ring buffer in shared memory, to analyze the latency of individual
+ *   queries.
+ *
+ *   Whether a statement is traced is decided when it is planned, or when it
+ *   starts executing if it uses a plan that was created earlier, such that
+ *   citus.query_trace_sample_rate of the statements are traced. The events
+ *   of a traced statement, such as planning, executing subplans, acquiring
+ *   connections, sending queries and receiving the first and last row, share
+ *   a trace id. Commit phases of the transaction are added to the trace of
+ *   the statement that ends it, if that statement is traced.
+ *
+ *   The buffer keeps the last citus.query_trace_buffer_size events of all
+ *   backends. citus_query_trace_json() dumps them in the JSON format that
+ *   chrome://tracing loads, with one row per traced statement.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "distributed/metadata_cache.h"
+#include "distributed/query_trace.h"
+#include "lib/stringinfo.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/json.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+
+#define CITUS_QUERY_TRACE_EVENTS_COLUMNS 7
+
+/* maximum length of the label of an event, such as host:port */
+#define QUERY_TRACE_LABEL_LENGTH 128
+
+
+/* an event in the ring buffer */
+typedef struct QueryTraceEventData
+{
+	uint64 traceId;
+	int pid;
+	QueryTraceEventType eventType;
+	char phase;
+	TimestampTz eventTime;
+	int64 detail;
+	char label[QUERY_TRACE_LABEL_LENGTH];
+} QueryTraceEventData;
+
+
+/*
+ * QueryTraceControlData is the header of the ring buffer, holding the lock
+ * that protects the buffer.
+ */
+typedef struct QueryTraceControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+
+	/* total number of events ever written, the next one goes to this % size */
+	uint64 eventCount;
+
+	/* identifier of the next traced statement */
+	uint64 nextTraceId;
+} QueryTraceControlData;
+
+
+/* names of the events as shown by the UDFs */
+static const char *QueryTraceEventNames[] = {
+	"plan", "subplans", "remote execution", "connection acquired", "query sent",
+	"first row", "last row", "prepare", "commit", "abort"
+};
+
+
+/* config variables */
+double QueryTraceSampleRate = 0.0;
+int QueryTraceBufferSize = 10000;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static QueryTraceControlData *QueryTraceControl = NULL;
+static QueryTraceEventData *QueryTraceEventArray = NULL;
+
+/* trace id of the statement that this backend runs, 0 if it is not traced */
+static uint64 CurrentTraceId = 0;
+
+/* whether the sampling decision was made while planning the current statement */
+static bool CurrentStatementPlanned = false;
+
+/* nesting depth of remote execution and whether a row was received at it */
+static int RemoteExecutionDepth = 0;
+static bool FirstRowReceived = false;
+
+
+static size_t QueryTraceShmemSize(void);
+static void QueryTraceShmemInit(void);
+static QueryTraceEventData * CopyQueryTraceEvents(int *eventCount);
+static void AppendQueryTraceEventJson(StringInfo json, QueryTraceEventData *event,
+									  TimestampTz baseTime);
+
+
+PG_FUNCTION_INFO_V1(citus_query_trace_events);
+PG_FUNCTION_INFO_V1(citus_query_trace_json);
+PG_FUNCTION_INFO_V1(citus_query_trace_reset);
+
+
+/*
+ * citus_query_trace_events returns the events in the ring buffer, from the
+ * oldest to the most recent one.
+ */
+Datum
+citus_query_trace_events(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	QueryTraceEventData *eventArray = NULL;
+	int eventCount = 0;
+	int eventIndex = 0;
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	eventArray = CopyQueryTraceEvents(&eventCount);
+
+	for (eventIndex = 0; eventIndex < eventCount; eventIndex++)
+	{
+		QueryTraceEventData *event = &eventArray[eventIndex];
+		Datum values[CITUS_QUERY_TRACE_EVENTS_COLUMNS];
+		bool nulls[CITUS_QUERY_TRACE_EVENTS_COLUMNS];
+		char phase[2] = { event->phase, '\0' };
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int64GetDatum((int64) event->traceId);
+		values[1] = Int32GetDatum(event->pid);
+		values[2] = CStringGetTextDatum(QueryTraceEventNames[event->eventType]);
+		values[3] = CStringGetTextDatum(phase);
+		values[4] = TimestampTzGetDatum(event->eventTime);
+		values[5] = Int64GetDatum(event->detail);
+
+		if (event->label[0] != '\0')
+		{
+			values[6] = CStringGetTextDatum(event->label);
+		}
+		else
+		{
+			nulls[6] = true;
+		}
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+	}
+
+	tuplestore_donestoring(tupleStore);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * citus_query_trace_json returns the events in the ring buffer in the JSON
+ * format of chrome://tracing. If a trace id is given, only the events of that
+ * statement are returned. Timestamps are in microseconds since the oldest
+ * event that is returned.
+ */
+Datum
+citus_query_trace_json(PG_FUNCTION_ARGS)
+{
+	bool filterTraceId = !PG_ARGISNULL(0);
+	uint64 traceId = filterTraceId ? (uint64) PG_GETARG_INT64(0) : 0;
+	QueryTraceEventData *eventArray = NULL;
+	int eventCount = 0;
+	int eventIndex = 0;
+	TimestampTz baseTime = 0;
+	bool foundEvent = false;
+	StringInfo json = makeStringInfo();
+
+	CheckCitusVersion(ERROR);
+
+	eventArray = CopyQueryTraceEvents(&eventCount);
+
+	appendStringInfoString(json, "{\"traceEvents\":[");
+
+	for (eventIndex = 0; eventIndex < eventCount; eventIndex++)
+	{
+		QueryTraceEventData *event = &eventArray[eventIndex];
+
+		if (filterTraceId && event->traceId != traceId)
+		{
+			continue;
+		}
+
+		if (!foundEvent)
+		{
+			baseTime = event->eventTime;
+			foundEvent = true;
+		}
+		else
+		{
+			appendStringInfoChar(json, ',');
+		}
+
+		AppendQueryTraceEventJson(json, event, baseTime);
+	}
+
+	appendStringInfoString(json, "],\"displayTimeUnit\":\"ms\"}");
+
+	PG_RETURN_TEXT_P(cstring_to_text(json->data));
+}
+
+
+/*
+ * citus_query_trace_reset removes all events from the ring buffer.
+ */
+Datum
+citus_query_trace_reset(PG_FUNCTION_ARGS)
+{
+	CheckCitusVersion(ERROR);
+
+	if (QueryTraceControl != NULL)
+	{
+		LWLockAcquire(&QueryTraceControl->lock, LW_EXCLUSIVE);
+		QueryTraceControl->eventCount = 0;
+		LWLockRelease(&QueryTraceControl->lock);
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * CopyQueryTraceEvents returns a copy of the events in the ring buffer, from
+ * the oldest to the most recent one, and sets eventCount to their number.
+ */
+static QueryTraceEventData *
+CopyQueryTraceEvents(int *eventCount)
+{
+	QueryTraceEventData *eventArray = NULL;
+	uint64 totalEventCount = 0;
+	int copiedEventCount = 0;
+	int firstEventIndex = 0;
+	int eventIndex = 0;
+
+	*eventCount = 0;
+
+	if (QueryTraceControl == NULL || QueryTraceBufferSize == 0)
+	{
+		return NULL;
+	}
+
+	eventArray = palloc(QueryTraceBufferSize * sizeof(QueryTraceEventData));
+
+	LWLockAcquire(&QueryTraceControl->lock, LW_SHARED);
+
+	totalEventCount = QueryTraceControl->eventCount;
+	if (totalEventCount > (uint64) QueryTraceBufferSize)
+	{
+		/* the buffer wrapped around, the oldest event is the next to overwrite */
+		copiedEventCount = QueryTraceBufferSize;
+		firstEventIndex = (int) (totalEventCount % QueryTraceBufferSize);
+	}
+	else
+	{
+		copiedEventCount = (int) totalEventCount;
+		firstEventIndex = 0;
+	}
+
+	for (eventIndex = 0; eventIndex < copiedEventCount; eventIndex++)
+	{
+		int bufferIndex = (firstEventIndex + eventIndex) % QueryTraceBufferSize;
+
+		memcpy(&eventArray[eventIndex], &QueryTraceEventArray[bufferIndex],
+			   sizeof(QueryTraceEventData));
+	}
+
+	LWLockRelease(&QueryTraceControl->lock);
+
+	*eventCount = copiedEventCount;
+
+	return eventArray;
+}
+
+
+/*
+ * AppendQueryTraceEventJson appends the given event as a chrome://tracing
+ * event object to json. Each traced statement is shown as its own thread of
+ * the process of the backend that ran it.
+ */
+static void
+AppendQueryTraceEventJson(StringInfo json, QueryTraceEventData *event,
+						  TimestampTz baseTime)
+{
+	long seconds = 0;
+	int microseconds = 0;
+	int64 timestamp = 0;
+
+	TimestampDifference(baseTime, event->eventTime, &seconds, &microseconds);
+	timestamp = (int64) seconds * 1000000 + microseconds;
+
+	appendStringInfoString(json, "{\"name\":");
+	escape_json(json, QueryTraceEventNames[event->eventType]);
+	appendStringInfo(json, ",\"cat\":\"citus\",\"ph\":\"%c\",\"ts\":" INT64_FORMAT
+					 ",\"pid\":%d,\"tid\":" UINT64_FORMAT,
+					 event->phase, timestamp, event->pid, event->traceId);
+
+	if (event->phase == QUERY_TRACE_INSTANT)
+	{
+		appendStringInfoString(json, ",\"s\":\"t\"");
+	}
+
+	appendStringInfo(json, ",\"args\":{\"detail\":" INT64_FORMAT, event->detail);
+
+	if (event->label[0] != '\0')
+	{
+		appendStringInfoString(json, ",\"label\":");
+		escape_json(json, event->label);
+	}
+
+	appendStringInfoString(json, "}}");
+}
+
+
+/*
+ * QueryTraceStatementStart decides whether the statement that starts is
+ * traced. It is called when a top-level distributed query is planned, with
+ * planned set to true, and when a top-level query starts executing. The
+ * decision made while planning a statement carries over to its execution.
+ */
+void
+QueryTraceStatementStart(bool planned)
+{
+	if (!planned && CurrentStatementPlanned)
+	{
+		CurrentStatementPlanned = false;
+		return;
+	}
+
+	CurrentStatementPlanned = planned;
+	CurrentTraceId = 0;
+	RemoteExecutionDepth = 0;
+	FirstRowReceived = false;
+
+	if (QueryTraceControl == NULL || QueryTraceBufferSize == 0 ||
+		QueryTraceSampleRate <= 0.0)
+	{
+		return;
+	}
+
+	/* sample the statement in the same way as auto_explain */
+	if (random() > QueryTraceSampleRate * MAX_RANDOM_VALUE)
+	{
+		return;
+	}
+
+	LWLockAcquire(&QueryTraceControl->lock, LW_EXCLUSIVE);
+	CurrentTraceId = QueryTraceControl->nextTraceId++;
+	LWLockRelease(&QueryTraceControl->lock);
+}
+
+
+/*
+ * RecordQueryTraceEvent adds an event with the given label and detail to the
+ * ring buffer, if the current statement is traced.
+ */
+void
+RecordQueryTraceEvent(QueryTraceEventType eventType, char phase, const char *label,
+					  int64 detail)
+{
+	QueryTraceEventData *event = NULL;
+	TimestampTz eventTime = 0;
+	int bufferIndex = 0;
+
+	if (CurrentTraceId == 0 || QueryTraceControl == NULL)
+	{
+		return;
+	}
+
+	eventTime = GetCurrentTimestamp();
+
+	LWLockAcquire(&QueryTraceControl->lock, LW_EXCLUSIVE);
+
+	bufferIndex = (int) (QueryTraceControl->eventCount % QueryTraceBufferSize);
+	QueryTraceControl->eventCount++;
+
+	event = &QueryTraceEventArray[bufferIndex];
+	event->traceId = CurrentTraceId;
+	event->pid = MyProcPid;
+	event->eventType = eventType;
+	event->phase = phase;
+	event->eventTime = eventTime;
+	event->detail = detail;
+
+	if (label != NULL)
+	{
+		strlcpy(event->label, label, QUERY_TRACE_LABEL_LENGTH);
+	}
+	else
+	{
+		event->label[0] = '\0';
+	}
+
+	LWLockRelease(&QueryTraceControl->lock);
+}
+
+
+/*
+ * RecordQueryTraceNodeEvent adds an event that concerns the given worker node
+ * to the ring buffer, if the current statement is traced.
+ */
+void
+RecordQueryTraceNodeEvent(QueryTraceEventType eventType, const char *hostname,
+						  int port, int64 detail)
+{
+	char label[QUERY_TRACE_LABEL_LENGTH];
+
+	if (CurrentTraceId == 0)
+	{
+		return;
+	}
+
+	snprintf(label, QUERY_TRACE_LABEL_LENGTH, "%s:%d", hostname, port);
+
+	RecordQueryTraceEvent(eventType, QUERY_TRACE_INSTANT, label, detail);
+}
+
+
+/*
+ * QueryTraceRemoteExecutionStart records that an executor starts running the
+ * distributed part of a query.
+ */
+void
+QueryTraceRemoteExecutionStart(void)
+{
+	if (CurrentTraceId == 0)
+	{
+		return;
+	}
+
+	RemoteExecutionDepth++;
+	FirstRowReceived = false;
+
+	RecordQueryTraceEvent(QUERY_TRACE_REMOTE_EXECUTION, QUERY_TRACE_BEGIN, NULL,
+						  RemoteExecutionDepth);
+}
+
+
+/*
+ * QueryTraceRemoteExecutionEnd records that an executor received all rows
+ * of the distributed part of a query.
+ */
+void
+QueryTraceRemoteExecutionEnd(void)
+{
+	if (CurrentTraceId == 0 || RemoteExecutionDepth == 0)
+	{
+		return;
+	}
+
+	if (FirstRowReceived)
+	{
+		RecordQueryTraceEvent(QUERY_TRACE_LAST_ROW, QUERY_TRACE_INSTANT, NULL,
+							  RemoteExecutionDepth);
+	}
+
+	RecordQueryTraceEvent(QUERY_TRACE_REMOTE_EXECUTION, QUERY_TRACE_END, NULL,
+						  RemoteExecutionDepth);
+
+	RemoteExecutionDepth--;
+
+	/* rows that arrive next belong to the enclosing remote execution */
+	FirstRowReceived = false;
+}
+
+
+/*
+ * QueryTraceRowReceived records the first row that an executor receives
+ * from the workers during remote execution.
+ */
+void
+QueryTraceRowReceived(void)
+{
+	if (CurrentTraceId == 0 || FirstRowReceived)
+	{
+		return;
+	}
+
+	FirstRowReceived = true;
+
+	RecordQueryTraceEvent(QUERY_TRACE_FIRST_ROW, QUERY_TRACE_INSTANT, NULL,
+						  RemoteExecutionDepth);
+}
+
+
+/*
+ * ResetQueryTraceState stops tracing when the transaction ends.
+ */
+void
+ResetQueryTraceState(void)
+{
+	CurrentTraceId = 0;
+	CurrentStatementPlanned = false;
+	RemoteExecutionDepth = 0;
+	FirstRowReceived = false;
+}
+
+
+/*
+ * InitializeQueryTrace requests the necessary shared memory from Postgres and
+ * sets up the shared memory startup hook.
+ */
+void
+InitializeQueryTrace(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(QueryTraceShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = QueryTraceShmemInit;
+}
+
+
+/*
+ * QueryTraceShmemSize computes how much shared memory is required.
+ */
+static size_t
+QueryTraceShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(QueryTraceControlData));
+	size = add_size(size, mul_size(sizeof(QueryTraceEventData), QueryTraceBufferSize));
+
+	return size;
+}
+
+
+/*
+ * QueryTraceShmemInit initializes the shared memory used for the ring buffer
+ * of query trace events.
+ */
+static void
+QueryTraceShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	QueryTraceControl =
+		(QueryTraceControlData *) ShmemInitStruct(
+			"Query Trace Data",
+			sizeof(QueryTraceControlData),
+			&alreadyInitialized);
+
+	QueryTraceEventArray =
+		(QueryTraceEventData *) ShmemInitStruct(
+			"Query Trace Events",
+			mul_size(sizeof(QueryTraceEventData), QueryTraceBufferSize),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(QueryTraceControl, 0, sizeof(QueryTraceControlData));
+
+		/* trace id 0 means that a statement is not traced */
+		QueryTraceControl->nextTraceId = 1;
+
+#if (PG_VERSION_NUM >= 100000)
+		QueryTraceControl->trancheId = LWLockNewTrancheId();
+		QueryTraceControl->lockTrancheName = "Query Trace";
+		LWLockRegisterTranche(QueryTraceControl->trancheId,
+							  QueryTraceControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &QueryTraceControl->lockTranche;
+
+			QueryTraceControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &QueryTraceControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Query Trace";
+			LWLockRegisterTranche(QueryTraceControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&QueryTraceControl->lock, QueryTraceControl->trancheId);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
@@ -0,0 +1,537 @@
+/*-------------------------------------------------------------------------
+ *
+ * result_cache.c
+ *	  Caches the results of read-only router queries on reference tables in
+ *	  the backends of the coordinator, such that repeated lookups do not need
+ *	  a round trip to the worker.
+ *
+ *	  A cached result is keyed by the query string of the task and the values
+ *	  of its parameters. Each shard is mapped onto a modification counter in
+ *	  shared memory, which is incremented whenever a modification of the shard
+ *	  is executed through this coordinator, and once more when the modifying
+ *	  transaction ends. A cached result is only used if the counter of its
+ *	  shard did not change since the query was sent to the worker. Changes
+ *	  that are made directly on the workers are not observed.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "access/hash.h"
+#include "access/htup_details.h"
+#include "access/tupdesc.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/multi_router_executor.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/result_cache.h"
+#include "executor/tuptable.h"
+#include "lib/stringinfo.h"
+#include "optimizer/clauses.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+
+/*
+ * ResultCacheSharedData holds the modification counters that the shards are
+ * mapped onto. Several shards may share a counter, in which case modifying
+ * one of them also invalidates the cached results of the others.
+ */
+typedef struct ResultCacheSharedData
+{
+	pg_atomic_uint64 modificationCounters[RESULT_CACHE_COUNTER_COUNT];
+} ResultCacheSharedData;
+
+
+/* hash entry of a cached task result */
+typedef struct ResultCacheEntry
+{
+	/* hash of the cache key, used as the hash key */
+	uint32 cacheKeyHash;
+
+	/* query string and parameter values of the task */
+	char *cacheKey;
+
+	/* shard that was read and the value of its counter at the time */
+	uint64 shardId;
+	uint64 modificationCounter;
+
+	/* rows of the result, stored as minimal tuples */
+	TupleDesc tupleDescriptor;
+	List *tupleList;
+
+	/* memory context holding the cache key and the result */
+	MemoryContext entryContext;
+} ResultCacheEntry;
+
+
+/* config variable managed via guc.c */
+bool EnableResultCache = false;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ResultCacheSharedData *ResultCacheShared = NULL;
+
+/* cached results of the current backend */
+static HTAB *ResultCacheHash = NULL;
+static MemoryContext ResultCacheContext = NULL;
+
+/* indexes of the counters of shards modified in the current transaction */
+static List *ModifiedShardCounterList = NIL;
+
+
+static void ResultCacheShmemInit(void);
+static void InitializeResultCacheHash(void);
+static void ResetResultCache(void);
+static void RemoveResultCacheEntry(ResultCacheEntry *cacheEntry);
+static int ShardCounterIndex(uint64 shardId);
+
+
+/*
+ * InitializeResultCache requests the shared memory for the modification
+ * counters from Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeResultCache(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(sizeof(ResultCacheSharedData));
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = ResultCacheShmemInit;
+}
+
+
+/*
+ * ResultCacheShmemInit initializes the modification counters in shared
+ * memory.
+ */
+static void
+ResultCacheShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ResultCacheShared =
+		(ResultCacheSharedData *) ShmemInitStruct("Result Cache Counters",
+												  sizeof(ResultCacheSharedData),
+												  &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		int counterIndex = 0;
+
+		/*
+		 * Counters start at the current time, such that they do not take
+		 * values again that they took before a restart. Partition files that
+		 * workers cached under a counter value thus stay invalid.
+		 */
+		uint64 initialCounter = (uint64) GetCurrentTimestamp();
+
+		for (counterIndex = 0; counterIndex < RESULT_CACHE_COUNTER_COUNT; counterIndex++)
+		{
+			pg_atomic_init_u64(&ResultCacheShared->modificationCounters[counterIndex],
+							   initialCounter);
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * TaskResultCacheKey returns the key under which the result of the given
+ * router SELECT task is cached, or NULL if the result cannot be cached. We
+ * only cache the results of queries that read a single reference table, and
+ * that return the same result as long as the table is not modified.
+ */
+char *
+TaskResultCacheKey(DistributedPlan *distributedPlan, Task *task,
+				   ParamListInfo paramListInfo)
+{
+	Query *jobQuery = distributedPlan->workerJob->jobQuery;
+	RelationShard *relationShard = NULL;
+	StringInfo cacheKey = NULL;
+
+	if (!EnableResultCache || ResultCacheShared == NULL)
+	{
+		return NULL;
+	}
+
+	/* intermediate results are different in every execution */
+	if (distributedPlan->subPlanList != NIL)
+	{
+		return NULL;
+	}
+
+	if (list_length(task->relationShardList) != 1)
+	{
+		return NULL;
+	}
+
+	relationShard = (RelationShard *) linitial(task->relationShardList);
+	if (PartitionMethod(relationShard->relationId) != DISTRIBUTE_BY_NONE ||
+		relationShard->shardId != task->anchorShardId)
+	{
+		return NULL;
+	}
+
+	if (jobQuery->commandType != CMD_SELECT || jobQuery->rowMarks != NIL ||
+		contain_mutable_functions((Node *) jobQuery))
+	{
+		return NULL;
+	}
+
+	/*
+	 * Prefix the query string and the parameter values with their length, such
+	 * that different queries and parameters cannot give the same key.
+	 */
+	cacheKey = makeStringInfo();
+	appendStringInfo(cacheKey, "%d:%s", (int) strlen(task->queryString),
+					 task->queryString);
+
+	if (paramListInfo != NULL && paramListInfo->numParams > 0)
+	{
+		int parameterCount = paramListInfo->numParams;
+		Oid *parameterTypes = NULL;
+		const char **parameterValues = NULL;
+		int parameterIndex = 0;
+
+		ExtractParametersFromParamListInfo(paramListInfo, &parameterTypes,
+										   &parameterValues);
+
+		for (parameterIndex = 0; parameterIndex < parameterCount; parameterIndex++)
+		{
+			const char *parameterValue = parameterValues[parameterIndex];
+
+			appendStringInfo(cacheKey, " $%d %u ", parameterIndex + 1,
+							 parameterTypes[parameterIndex]);
+
+			if (parameterValue == NULL)
+			{
+				appendStringInfoString(cacheKey, "NULL");
+			}
+			else
+			{
+				appendStringInfo(cacheKey, "%d:%s", (int) strlen(parameterValue),
+								 parameterValue);
+			}
+		}
+	}
+
+	return cacheKey->data;
+}
+
+
+/*
+ * LoadCachedTaskResult fills the tuple store of the given scan state with the
+ * cached result of the task, and returns true. If there is no valid cached
+ * result, the function returns false and sets modificationCounter to the
+ * current counter of the task's shard, which should be passed to
+ * CacheTaskResult() once the result is received from the worker.
+ */
+bool
+LoadCachedTaskResult(CitusScanState *scanState, char *cacheKey, Task *task,
+					 uint64 *modificationCounter)
+{
+	TupleDesc tupleDescriptor =
+		scanState->customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	uint64 shardId = task->anchorShardId;
+	uint32 cacheKeyHash = string_hash(cacheKey, strlen(cacheKey) + 1);
+	ResultCacheEntry *cacheEntry = NULL;
+	TupleTableSlot *tupleSlot = NULL;
+	ListCell *tupleCell = NULL;
+	bool randomAccess = true;
+	bool interTransactions = false;
+	bool found = false;
+
+	/* read the counter before the query is sent */
+	*modificationCounter = ShardModificationCounter(shardId);
+
+	if (ResultCacheHash == NULL)
+	{
+		return false;
+	}
+
+	cacheEntry = hash_search(ResultCacheHash, &cacheKeyHash, HASH_FIND, &found);
+	if (!found)
+	{
+		return false;
+	}
+
+	if (cacheEntry->shardId != shardId ||
+		cacheEntry->modificationCounter != *modificationCounter ||
+		strcmp(cacheEntry->cacheKey, cacheKey) != 0 ||
+		!equalTupleDescs(cacheEntry->tupleDescriptor, tupleDescriptor))
+	{
+		RemoveResultCacheEntry(cacheEntry);
+		return false;
+	}
+
+	Assert(scanState->tuplestorestate == NULL);
+	scanState->tuplestorestate =
+		tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+
+	tupleSlot = MakeSingleTupleTableSlot(tupleDescriptor);
+
+	foreach(tupleCell, cacheEntry->tupleList)
+	{
+		MinimalTuple minimalTuple = (MinimalTuple) lfirst(tupleCell);
+		bool shouldFree = false;
+
+		ExecStoreMinimalTuple(minimalTuple, tupleSlot, shouldFree);
+		tuplestore_puttupleslot(scanState->tuplestorestate, tupleSlot);
+	}
+
+	ExecDropSingleTupleTableSlot(tupleSlot);
+
+	return true;
+}
+
+
+/*
+ * CacheTaskResult stores the rows in the tuple store of the given scan state
+ * as the cached result of the task, unless the result is too large. The
+ * modification counter should be the one returned by LoadCachedTaskResult()
+ * before the query was sent.
+ */
+void
+CacheTaskResult(CitusScanState *scanState, char *cacheKey, Task *task,
+				uint64 modificationCounter)
+{
+	Tuplestorestate *tupleStore = scanState->tuplestorestate;
+	TupleDesc tupleDescriptor =
+		scanState->customScanState.ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	uint32 cacheKeyHash = string_hash(cacheKey, strlen(cacheKey) + 1);
+	ResultCacheEntry *cacheEntry = NULL;
+	MemoryContext entryContext = NULL;
+	MemoryContext oldContext = NULL;
+	TupleTableSlot *tupleSlot = NULL;
+	List *tupleList = NIL;
+	Size resultSize = 0;
+	bool resultTooLarge = false;
+	bool found = false;
+
+	if (tupleStore == NULL)
+	{
+		return;
+	}
+
+	if (ResultCacheHash == NULL)
+	{
+		InitializeResultCacheHash();
+	}
+
+	/* make room by throwing away all cached results, they are cheap to fetch */
+	if (hash_get_num_entries(ResultCacheHash) >= RESULT_CACHE_MAX_ENTRIES)
+	{
+		ResetResultCache();
+	}
+
+	entryContext = AllocSetContextCreate(ResultCacheContext, "ResultCacheEntry",
+										 ALLOCSET_SMALL_MINSIZE,
+										 ALLOCSET_SMALL_INITSIZE,
+										 ALLOCSET_SMALL_MAXSIZE);
+
+	tupleSlot = MakeSingleTupleTableSlot(tupleDescriptor);
+	tuplestore_rescan(tupleStore);
+
+	while (tuplestore_gettupleslot(tupleStore, true, false, tupleSlot))
+	{
+		MinimalTuple minimalTuple = NULL;
+
+		oldContext = MemoryContextSwitchTo(entryContext);
+		minimalTuple = ExecCopySlotMinimalTuple(tupleSlot);
+		tupleList = lappend(tupleList, minimalTuple);
+		MemoryContextSwitchTo(oldContext);
+
+		resultSize += minimalTuple->t_len;
+		if (resultSize > RESULT_CACHE_MAX_RESULT_SIZE)
+		{
+			resultTooLarge = true;
+			break;
+		}
+	}
+
+	ExecDropSingleTupleTableSlot(tupleSlot);
+
+	/* the executor reads the tuple store from the start */
+	tuplestore_rescan(tupleStore);
+
+	if (resultTooLarge)
+	{
+		MemoryContextDelete(entryContext);
+		return;
+	}
+
+	cacheEntry = hash_search(ResultCacheHash, &cacheKeyHash, HASH_ENTER, &found);
+	if (found)
+	{
+		MemoryContextDelete(cacheEntry->entryContext);
+	}
+
+	oldContext = MemoryContextSwitchTo(entryContext);
+
+	cacheEntry->cacheKey = pstrdup(cacheKey);
+	cacheEntry->shardId = task->anchorShardId;
+	cacheEntry->modificationCounter = modificationCounter;
+	cacheEntry->tupleDescriptor = CreateTupleDescCopy(tupleDescriptor);
+	cacheEntry->tupleList = tupleList;
+	cacheEntry->entryContext = entryContext;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * InvalidateCachedShardResults increments the modification counter of the
+ * given shard, such that no backend uses results it cached before. Since
+ * other backends may still cache results that do not yet include the changes
+ * of the current transaction, the counter is incremented again when the
+ * transaction ends.
+ */
+void
+InvalidateCachedShardResults(uint64 shardId)
+{
+	int counterIndex = 0;
+	MemoryContext oldContext = NULL;
+
+	if (ResultCacheShared == NULL)
+	{
+		return;
+	}
+
+	counterIndex = ShardCounterIndex(shardId);
+	pg_atomic_fetch_add_u64(&ResultCacheShared->modificationCounters[counterIndex], 1);
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+	ModifiedShardCounterList = list_append_unique_int(ModifiedShardCounterList,
+													  counterIndex);
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * ResetResultCacheTransactionState increments the modification counters of
+ * the shards that were modified in the current transaction once more. It is
+ * called at the end of the transaction, after the changes were committed or
+ * aborted on the workers.
+ */
+void
+ResetResultCacheTransactionState(void)
+{
+	ListCell *counterIndexCell = NULL;
+
+	foreach(counterIndexCell, ModifiedShardCounterList)
+	{
+		int counterIndex = lfirst_int(counterIndexCell);
+
+		pg_atomic_fetch_add_u64(&ResultCacheShared->modificationCounters[counterIndex],
+								1);
+	}
+
+	/* the list is allocated in the transaction context */
+	ModifiedShardCounterList = NIL;
+}
+
+
+/*
+ * InitializeResultCacheHash creates the memory context and the hash that hold
+ * the cached results of the backend.
+ */
+static void
+InitializeResultCacheHash(void)
+{
+	HASHCTL info;
+	int hashFlags = (HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	if (ResultCacheContext == NULL)
+	{
+		ResultCacheContext = AllocSetContextCreate(CacheMemoryContext,
+												   "ResultCacheContext",
+												   ALLOCSET_DEFAULT_MINSIZE,
+												   ALLOCSET_DEFAULT_INITSIZE,
+												   ALLOCSET_DEFAULT_MAXSIZE);
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint32);
+	info.entrysize = sizeof(ResultCacheEntry);
+	info.hcxt = ResultCacheContext;
+
+	ResultCacheHash = hash_create("Result Cache Hash", 64, &info, hashFlags);
+}
+
+
+/*
+ * ResetResultCache removes all cached results of the backend.
+ */
+static void
+ResetResultCache(void)
+{
+	MemoryContextReset(ResultCacheContext);
+	ResultCacheHash = NULL;
+
+	InitializeResultCacheHash();
+}
+
+
+/*
+ * RemoveResultCacheEntry removes the given cached result from the hash and
+ * frees its memory.
+ */
+static void
+RemoveResultCacheEntry(ResultCacheEntry *cacheEntry)
+{
+	MemoryContext entryContext = cacheEntry->entryContext;
+	bool found = false;
+
+	hash_search(ResultCacheHash, &cacheEntry->cacheKeyHash, HASH_REMOVE, &found);
+	MemoryContextDelete(entryContext);
+}
+
+
+/*
+ * ShardCounterIndex returns the index of the modification counter that the
+ * given shard is mapped onto.
+ */
+static int
+ShardCounterIndex(uint64 shardId)
+{
+	return (int) (shardId % RESULT_CACHE_COUNTER_COUNT);
+}
+
+
+/*
+ * ShardModificationCounter returns the current modification counter of the
+ * given shard.
+ */
+uint64
+ShardModificationCounter(uint64 shardId)
+{
+	int counterIndex = ShardCounterIndex(shardId);
+
+	return pg_atomic_read_u64(&ResultCacheShared->modificationCounters[counterIndex]);
+}
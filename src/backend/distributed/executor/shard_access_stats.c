@@ -0,0 +1,568 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_access_stats.c
+ *   Counts the reads and writes of each shard by the router executor, along
+ *   with the time spent executing them, to find hot shards.
+ *
+ *   The counters live in a shared hash keyed by shard id. Updating a counter
+ *   only takes the lock of the hash in shared mode, and a spinlock on the
+ *   entry, as pg_stat_statements does. The lock is only taken in exclusive
+ *   mode to add shards to the hash. When the hash is full, accesses to shards
+ *   that are not in it yet are not counted.
+ *
+ *   With MX, router queries also run on the workers, so each node only counts
+ *   its own accesses. citus_dist_shard_access_stats adds up the counters of
+ *   all nodes that have metadata.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+
+#include "distributed/connection_management.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/hash_helpers.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/relay_utility.h"
+#include "distributed/remote_commands.h"
+#include "distributed/shard_access_stats.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+
+#define SHARD_ACCESS_STATS_COLUMNS 4
+#define SHARD_ACCESS_STATS_QUERY \
+	"SELECT shardid, reads, writes, execution_time FROM citus_shard_access_stats()"
+
+
+/* shared memory holding the lock that protects the shard access hash */
+typedef struct ShardAccessStatsControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+} ShardAccessStatsControlData;
+
+
+/* access counters of a shard */
+typedef struct ShardAccessStatsEntry
+{
+	uint64 shardId;
+
+	slock_t mutex;
+	int64 reads;
+	int64 writes;
+	double executionTime;
+} ShardAccessStatsEntry;
+
+
+/* config variables */
+bool TrackShardAccess = true;
+int ShardAccessStatsMax = 10000;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static ShardAccessStatsControlData *ShardAccessStatsControl = NULL;
+static HTAB *ShardAccessStatsHash = NULL;
+
+
+static size_t ShardAccessStatsShmemSize(void);
+static void ShardAccessStatsShmemInit(void);
+static void RecordShardAccess(uint64 shardId, ShardAccessType accessType,
+							  double executionTime);
+static HTAB * CreateShardAccessHash(void);
+static void AddLocalShardAccessStats(HTAB *shardAccessHash);
+static void AddRemoteShardAccessStats(HTAB *shardAccessHash);
+static void ReturnShardAccessStats(FunctionCallInfo fcinfo, HTAB *shardAccessHash);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(citus_shard_access_stats);
+PG_FUNCTION_INFO_V1(citus_dist_shard_access_stats);
+PG_FUNCTION_INFO_V1(citus_shard_access_stats_reset);
+
+
+/*
+ * citus_shard_access_stats returns the reads, writes and execution time of
+ * the shards that were accessed from this node.
+ */
+Datum
+citus_shard_access_stats(PG_FUNCTION_ARGS)
+{
+	HTAB *shardAccessHash = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	shardAccessHash = CreateShardAccessHash();
+	AddLocalShardAccessStats(shardAccessHash);
+
+	ReturnShardAccessStats(fcinfo, shardAccessHash);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * citus_dist_shard_access_stats returns the reads, writes and execution time
+ * of the shards, summed over this node and all other nodes with metadata.
+ */
+Datum
+citus_dist_shard_access_stats(PG_FUNCTION_ARGS)
+{
+	HTAB *shardAccessHash = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	shardAccessHash = CreateShardAccessHash();
+	AddLocalShardAccessStats(shardAccessHash);
+	AddRemoteShardAccessStats(shardAccessHash);
+
+	ReturnShardAccessStats(fcinfo, shardAccessHash);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * citus_shard_access_stats_reset discards the shard access counters of this
+ * node.
+ */
+Datum
+citus_shard_access_stats_reset(PG_FUNCTION_ARGS)
+{
+	CheckCitusVersion(ERROR);
+
+	LWLockAcquire(&ShardAccessStatsControl->lock, LW_EXCLUSIVE);
+	hash_delete_all(ShardAccessStatsHash);
+	LWLockRelease(&ShardAccessStatsControl->lock);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * RecordTaskShardAccess counts an access to the shards of the given task,
+ * which took the time since startTime to execute. Reads that join co-located
+ * shards count as a read of each of them, while writes only count for the
+ * shard that is modified.
+ */
+void
+RecordTaskShardAccess(Task *task, ShardAccessType accessType, instr_time *startTime)
+{
+	instr_time executionTime;
+	double executionMillis = 0.0;
+	ListCell *relationShardCell = NULL;
+
+	if (!TrackShardAccess || ShardAccessStatsHash == NULL)
+	{
+		return;
+	}
+
+	if (startTime != NULL)
+	{
+		INSTR_TIME_SET_CURRENT(executionTime);
+		INSTR_TIME_SUBTRACT(executionTime, *startTime);
+		executionMillis = INSTR_TIME_GET_MILLISEC(executionTime);
+	}
+
+	if (accessType == SHARD_ACCESS_WRITE || task->relationShardList == NIL)
+	{
+		if (task->anchorShardId != INVALID_SHARD_ID)
+		{
+			RecordShardAccess(task->anchorShardId, accessType, executionMillis);
+		}
+
+		return;
+	}
+
+	foreach(relationShardCell, task->relationShardList)
+	{
+		RelationShard *relationShard = (RelationShard *) lfirst(relationShardCell);
+
+		RecordShardAccess(relationShard->shardId, accessType, executionMillis);
+	}
+}
+
+
+/*
+ * RecordShardAccess adds an access to the counters of the given shard.
+ */
+static void
+RecordShardAccess(uint64 shardId, ShardAccessType accessType, double executionTime)
+{
+	ShardAccessStatsEntry *entry = NULL;
+
+	LWLockAcquire(&ShardAccessStatsControl->lock, LW_SHARED);
+
+	entry = (ShardAccessStatsEntry *) hash_search(ShardAccessStatsHash, &shardId,
+												  HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		bool found = false;
+
+		/* need exclusive lock to add the shard */
+		LWLockRelease(&ShardAccessStatsControl->lock);
+		LWLockAcquire(&ShardAccessStatsControl->lock, LW_EXCLUSIVE);
+
+		if (hash_get_num_entries(ShardAccessStatsHash) >= ShardAccessStatsMax)
+		{
+			/* the shard may have been added in the meantime */
+			entry = (ShardAccessStatsEntry *) hash_search(ShardAccessStatsHash,
+														  &shardId, HASH_FIND, NULL);
+			if (entry == NULL)
+			{
+				LWLockRelease(&ShardAccessStatsControl->lock);
+				return;
+			}
+		}
+		else
+		{
+			entry = (ShardAccessStatsEntry *) hash_search(ShardAccessStatsHash,
+														  &shardId, HASH_ENTER,
+														  &found);
+			if (!found)
+			{
+				SpinLockInit(&entry->mutex);
+				entry->reads = 0;
+				entry->writes = 0;
+				entry->executionTime = 0.0;
+			}
+		}
+	}
+
+	SpinLockAcquire(&entry->mutex);
+
+	if (accessType == SHARD_ACCESS_READ)
+	{
+		entry->reads++;
+	}
+	else
+	{
+		entry->writes++;
+	}
+
+	entry->executionTime += executionTime;
+
+	SpinLockRelease(&entry->mutex);
+
+	LWLockRelease(&ShardAccessStatsControl->lock);
+}
+
+
+/*
+ * CreateShardAccessHash creates a backend-local hash in the current memory
+ * context to collect shard access counters in.
+ */
+static HTAB *
+CreateShardAccessHash(void)
+{
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(uint64);
+	hashInfo.entrysize = sizeof(ShardAccessStatsEntry);
+	hashInfo.hcxt = CurrentMemoryContext;
+	hashFlags = (HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	return hash_create("Shard Access Stats", 32, &hashInfo, hashFlags);
+}
+
+
+/*
+ * AddLocalShardAccessStats copies the counters in shared memory into the
+ * given backend-local hash.
+ */
+static void
+AddLocalShardAccessStats(HTAB *shardAccessHash)
+{
+	HASH_SEQ_STATUS status;
+	ShardAccessStatsEntry *sharedEntry = NULL;
+
+	LWLockAcquire(&ShardAccessStatsControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, ShardAccessStatsHash);
+
+	while ((sharedEntry = (ShardAccessStatsEntry *) hash_seq_search(&status)) != NULL)
+	{
+		ShardAccessStatsEntry *entry = NULL;
+
+		entry = (ShardAccessStatsEntry *) hash_search(shardAccessHash,
+													  &sharedEntry->shardId,
+													  HASH_ENTER, NULL);
+
+		SpinLockAcquire(&sharedEntry->mutex);
+		entry->reads = sharedEntry->reads;
+		entry->writes = sharedEntry->writes;
+		entry->executionTime = sharedEntry->executionTime;
+		SpinLockRelease(&sharedEntry->mutex);
+	}
+
+	LWLockRelease(&ShardAccessStatsControl->lock);
+}
+
+
+/*
+ * AddRemoteShardAccessStats fetches the counters of all other nodes with
+ * metadata in parallel and adds them to the given hash.
+ */
+static void
+AddRemoteShardAccessStats(HTAB *shardAccessHash)
+{
+	List *workerNodeList = ActivePrimaryNodeList();
+	ListCell *workerNodeCell = NULL;
+	List *connectionList = NIL;
+	ListCell *connectionCell = NULL;
+	int localGroupId = GetLocalGroupId();
+	uint32 connectionFlag = 0;
+	bool raiseErrors = true;
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		MultiConnection *connection = NULL;
+
+		/* only nodes with metadata run queries on shards themselves */
+		if (!workerNode->hasMetadata || workerNode->groupId == localGroupId)
+		{
+			continue;
+		}
+
+		connection = StartNodeConnection(connectionFlag, workerNode->workerName,
+										 workerNode->workerPort);
+
+		connectionList = lappend(connectionList, connection);
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		if (SendRemoteCommand(connection, SHARD_ACCESS_STATS_QUERY) == 0)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		PGresult *result = GetRemoteCommandResult(connection, raiseErrors);
+		int rowCount = 0;
+		int rowIndex = 0;
+
+		if (!IsResponseOK(result) || PQnfields(result) != SHARD_ACCESS_STATS_COLUMNS)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		rowCount = PQntuples(result);
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			uint64 shardId = strtoull(PQgetvalue(result, rowIndex, 0), NULL, 10);
+			ShardAccessStatsEntry *entry = NULL;
+			bool found = false;
+
+			entry = (ShardAccessStatsEntry *) hash_search(shardAccessHash, &shardId,
+														  HASH_ENTER, &found);
+			if (!found)
+			{
+				entry->reads = 0;
+				entry->writes = 0;
+				entry->executionTime = 0.0;
+			}
+
+			entry->reads += strtoll(PQgetvalue(result, rowIndex, 1), NULL, 10);
+			entry->writes += strtoll(PQgetvalue(result, rowIndex, 2), NULL, 10);
+			entry->executionTime += strtod(PQgetvalue(result, rowIndex, 3), NULL);
+		}
+
+		PQclear(result);
+		ClearResults(connection, raiseErrors);
+	}
+}
+
+
+/*
+ * ReturnShardAccessStats returns the counters in the given hash as the result
+ * set of a set-returning function.
+ */
+static void
+ReturnShardAccessStats(FunctionCallInfo fcinfo, HTAB *shardAccessHash)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	HASH_SEQ_STATUS status;
+	ShardAccessStatsEntry *entry = NULL;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	hash_seq_init(&status, shardAccessHash);
+
+	while ((entry = (ShardAccessStatsEntry *) hash_seq_search(&status)) != NULL)
+	{
+		Datum values[SHARD_ACCESS_STATS_COLUMNS];
+		bool nulls[SHARD_ACCESS_STATS_COLUMNS];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int64GetDatum((int64) entry->shardId);
+		values[1] = Int64GetDatum(entry->reads);
+		values[2] = Int64GetDatum(entry->writes);
+		values[3] = Float8GetDatum(entry->executionTime);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+	}
+
+	tuplestore_donestoring(tupleStore);
+}
+
+
+/*
+ * InitializeShardAccessStats requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeShardAccessStats(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(ShardAccessStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = ShardAccessStatsShmemInit;
+}
+
+
+/*
+ * ShardAccessStatsShmemSize computes how much shared memory is required.
+ */
+static size_t
+ShardAccessStatsShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, sizeof(ShardAccessStatsControlData));
+
+	hashSize = hash_estimate_size(ShardAccessStatsMax, sizeof(ShardAccessStatsEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * ShardAccessStatsShmemInit initializes the shared memory that holds the shard
+ * access counters.
+ */
+static void
+ShardAccessStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ShardAccessStatsControl =
+		(ShardAccessStatsControlData *) ShmemInitStruct(
+			"Citus Shard Access Stats Data",
+			sizeof(ShardAccessStatsControlData),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out all the memory */
+		memset(ShardAccessStatsControl, 0, sizeof(ShardAccessStatsControlData));
+
+#if (PG_VERSION_NUM >= 100000)
+		ShardAccessStatsControl->trancheId = LWLockNewTrancheId();
+		ShardAccessStatsControl->lockTrancheName = "Citus Shard Access Stats";
+		LWLockRegisterTranche(ShardAccessStatsControl->trancheId,
+							  ShardAccessStatsControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &ShardAccessStatsControl->lockTranche;
+
+			ShardAccessStatsControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &ShardAccessStatsControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Citus Shard Access Stats";
+			LWLockRegisterTranche(ShardAccessStatsControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&ShardAccessStatsControl->lock,
+						 ShardAccessStatsControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(uint64);
+	hashInfo.entrysize = sizeof(ShardAccessStatsEntry);
+	hashFlags = (HASH_ELEM | HASH_BLOBS);
+
+	ShardAccessStatsHash = ShmemInitHash("Citus Shard Access Stats Hash",
+										 ShardAccessStatsMax, ShardAccessStatsMax,
+										 &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
@@ -10,13 +10,20 @@
 
 #include "postgres.h"
 
+#include "distributed/adaptive_executor.h"
+#include "distributed/citus_custom_scan.h"
+#include "distributed/distributed_planner.h"
 #include "distributed/intermediate_results.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/query_stats.h"
 #include "distributed/recursive_planning.h"
+#include "distributed/resource_lock.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/worker_manager.h"
 #include "executor/executor.h"
+#include "lib/stringinfo.h"
+#include "utils/tuplestore.h"
 
 
 int MaxIntermediateResult = 1048576; /* maximum size in KB the intermediate result can grow to */
@@ -24,18 +31,41 @@ int MaxIntermediateResult = 1048576; /* maximum size in KB the intermediate resu
 int SubPlanLevel = 0;
 
 
+/* local function forward declarations */
+static bool CanExecuteSubPlanConcurrently(DistributedSubPlan *subPlan);
+static bool SubPlanDependsOn(DistributedSubPlan *subPlan,
+							 DistributedSubPlan *otherSubPlan, uint64 planId);
+static char * QuotedResultId(uint64 planId, uint32 subPlanId);
+static List * SubPlanNodeList(DistributedSubPlan *subPlan,
+							  DistributedPlan *distributedPlan, List *nodeList);
+static bool AppendPlacementsReadingResult(DistributedPlan *distributedPlan,
+										  char *quotedResultId, List **placementList);
+static DistributedPlan * FindDistributedPlan(Plan *plan);
+static void ExecuteSubPlanSequentially(DistributedSubPlan *subPlan,
+									   DistributedPlan *distributedPlan,
+									   List *nodeList);
+static void ExecuteSubPlansConcurrently(List *subPlanList,
+										DistributedPlan *distributedPlan,
+										List *nodeList);
+
+
 /*
- * ExecuteSubPlans executes a list of subplans from a distributed plan
- * by sequentially executing each plan from the top.
+ * ExecuteSubPlans executes a list of subplans from a distributed plan.
+ *
+ * Subplans are executed in waves. A wave consists of all remaining subplans
+ * that do not depend on a remaining subplan that comes before them, which
+ * always includes the first remaining subplan. When a wave contains several
+ * subplans, their tasks are executed at the same time such that the query
+ * only pays for the latency of the slowest one. Subplans that cannot run
+ * concurrently act as barriers and are executed on their own, in order.
  */
 void
 ExecuteSubPlans(DistributedPlan *distributedPlan)
 {
 	uint64 planId = distributedPlan->planId;
 	List *subPlanList = distributedPlan->subPlanList;
-	ListCell *subPlanCell = NULL;
+	List *remainingSubPlanList = NIL;
 	List *nodeList = NIL;
-	bool writeLocalFile = false;
 
 	if (subPlanList == NIL)
 	{
@@ -43,28 +73,442 @@ ExecuteSubPlans(DistributedPlan *distributedPlan)
 		return;
 	}
 
+	QueryStatsSubPlanExecutionStart();
+
 	nodeList = ActiveReadableNodeList();
+	remainingSubPlanList = list_copy(subPlanList);
+
+	while (remainingSubPlanList != NIL)
+	{
+		List *readySubPlanList = NIL;
+		List *waitingSubPlanList = NIL;
+		ListCell *subPlanCell = NULL;
+
+		foreach(subPlanCell, remainingSubPlanList)
+		{
+			DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+			bool subPlanReady = true;
+			ListCell *otherSubPlanCell = NULL;
+
+			/* a subplan can only depend on remaining subplans that precede it */
+			foreach(otherSubPlanCell, remainingSubPlanList)
+			{
+				DistributedSubPlan *otherSubPlan =
+					(DistributedSubPlan *) lfirst(otherSubPlanCell);
+
+				if (otherSubPlan == subPlan)
+				{
+					break;
+				}
+
+				if (SubPlanDependsOn(subPlan, otherSubPlan, planId))
+				{
+					subPlanReady = false;
+					break;
+				}
+			}
+
+			if (subPlanReady)
+			{
+				readySubPlanList = lappend(readySubPlanList, subPlan);
+			}
+			else
+			{
+				waitingSubPlanList = lappend(waitingSubPlanList, subPlan);
+			}
+		}
+
+		if (list_length(readySubPlanList) > 1)
+		{
+			ExecuteSubPlansConcurrently(readySubPlanList, distributedPlan, nodeList);
+		}
+		else
+		{
+			DistributedSubPlan *subPlan =
+				(DistributedSubPlan *) linitial(readySubPlanList);
+
+			ExecuteSubPlanSequentially(subPlan, distributedPlan, nodeList);
+		}
+
+		remainingSubPlanList = waitingSubPlanList;
+	}
+
+	QueryStatsSubPlanExecutionEnd();
+}
+
+
+/*
+ * CanExecuteSubPlanConcurrently returns true if the subplan is a read-only
+ * distributed query whose tasks return the final result of the subplan, such
+ * that the tasks can be run alongside the tasks of other subplans. Plans that
+ * need a master query, repartitioning, or that have subplans of their own are
+ * executed by their regular executor.
+ */
+static bool
+CanExecuteSubPlanConcurrently(DistributedSubPlan *subPlan)
+{
+	PlannedStmt *plannedStmt = subPlan->plan;
+	Plan *planTree = plannedStmt->planTree;
+	CustomScan *customScan = NULL;
+	DistributedPlan *distributedPlan = NULL;
+	Job *workerJob = NULL;
+	ListCell *taskCell = NULL;
+
+	if (plannedStmt->commandType != CMD_SELECT || plannedStmt->hasModifyingCTE ||
+		!IsA(planTree, CustomScan))
+	{
+		return false;
+	}
+
+	customScan = (CustomScan *) planTree;
+	if (customScan->methods != &RouterCustomScanMethods &&
+		customScan->methods != &AdaptiveExecutorCustomScanMethods)
+	{
+		return false;
+	}
+
+	distributedPlan = GetDistributedPlan(customScan);
+	workerJob = distributedPlan->workerJob;
+
+	if (distributedPlan->operation != CMD_SELECT ||
+		distributedPlan->planningError != NULL ||
+		distributedPlan->masterQuery != NULL ||
+		distributedPlan->subPlanList != NIL ||
+		workerJob == NULL || workerJob->dependedJobList != NIL)
+	{
+		return false;
+	}
+
+	foreach(taskCell, workerJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (task->queryString == NULL || task->taskPlacementList == NIL)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * SubPlanDependsOn returns whether subPlan has to be executed after
+ * otherSubPlan, which precedes it in the list of subplans. This is the case
+ * if one of the tasks of subPlan reads the intermediate result of otherSubPlan,
+ * or if we cannot tell because either of them is not executed concurrently.
+ */
+static bool
+SubPlanDependsOn(DistributedSubPlan *subPlan, DistributedSubPlan *otherSubPlan,
+				 uint64 planId)
+{
+	CustomScan *customScan = NULL;
+	DistributedPlan *distributedPlan = NULL;
+	char *quotedResultId = NULL;
+	ListCell *taskCell = NULL;
+
+	if (!CanExecuteSubPlanConcurrently(subPlan) ||
+		!CanExecuteSubPlanConcurrently(otherSubPlan))
+	{
+		return true;
+	}
+
+	quotedResultId = QuotedResultId(planId, otherSubPlan->subPlanId);
+
+	customScan = (CustomScan *) subPlan->plan->planTree;
+	distributedPlan = GetDistributedPlan(customScan);
+
+	foreach(taskCell, distributedPlan->workerJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (strstr(task->queryString, quotedResultId) != NULL)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * QuotedResultId returns the result ID of the given subplan as it appears in
+ * the text literal of a read_intermediate_result call in a task query.
+ */
+static char *
+QuotedResultId(uint64 planId, uint32 subPlanId)
+{
+	StringInfo quotedResultId = makeStringInfo();
+
+	appendStringInfo(quotedResultId, "'%s'", GenerateResultId(planId, subPlanId));
+
+	return quotedResultId->data;
+}
+
+
+/*
+ * SubPlanNodeList returns the nodes in nodeList to which the result of the
+ * subplan needs to be sent, which are the nodes that hold a placement of a
+ * task reading the result. The tasks of the distributed plan and of the
+ * subplans that follow the subplan are considered, since only those can read
+ * its result. If we cannot tell which tasks read the result, for instance
+ * because some of them are only created during repartitioning, the result
+ * is sent to all nodes in nodeList.
+ */
+static List *
+SubPlanNodeList(DistributedSubPlan *subPlan, DistributedPlan *distributedPlan,
+				List *nodeList)
+{
+	char *quotedResultId = QuotedResultId(distributedPlan->planId,
+										  subPlan->subPlanId);
+	List *placementList = NIL;
+	List *subPlanNodeList = NIL;
+	ListCell *subPlanCell = NULL;
+	ListCell *nodeCell = NULL;
+	bool followsSubPlan = false;
+
+	if (!AppendPlacementsReadingResult(distributedPlan, quotedResultId,
+									   &placementList))
+	{
+		return nodeList;
+	}
+
+	foreach(subPlanCell, distributedPlan->subPlanList)
+	{
+		DistributedSubPlan *otherSubPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+		DistributedPlan *otherDistributedPlan = NULL;
+
+		if (otherSubPlan == subPlan)
+		{
+			followsSubPlan = true;
+			continue;
+		}
+		else if (!followsSubPlan)
+		{
+			continue;
+		}
+
+		otherDistributedPlan = FindDistributedPlan(otherSubPlan->plan->planTree);
+		if (otherDistributedPlan == NULL ||
+			!AppendPlacementsReadingResult(otherDistributedPlan, quotedResultId,
+										   &placementList))
+		{
+			return nodeList;
+		}
+	}
+
+	foreach(nodeCell, nodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(nodeCell);
+		ListCell *placementCell = NULL;
+
+		foreach(placementCell, placementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+			if (strncmp(placement->nodeName, workerNode->workerName,
+						WORKER_LENGTH) == 0 &&
+				placement->nodePort == workerNode->workerPort)
+			{
+				subPlanNodeList = lappend(subPlanNodeList, workerNode);
+				break;
+			}
+		}
+	}
+
+	ereport(DEBUG4, (errmsg("sending result of subplan %s to %d of %d nodes",
+							GenerateResultId(distributedPlan->planId,
+											 subPlan->subPlanId),
+							list_length(subPlanNodeList), list_length(nodeList))));
+
+	return subPlanNodeList;
+}
+
+
+/*
+ * AppendPlacementsReadingResult appends the placements of the tasks of the
+ * distributed plan that read the given result to placementList. All the
+ * placements of a task are included, since the task may fail over to any of
+ * them. The function returns false if the tasks that will run on the workers
+ * are not known in advance.
+ */
+static bool
+AppendPlacementsReadingResult(DistributedPlan *distributedPlan, char *quotedResultId,
+							  List **placementList)
+{
+	Job *workerJob = distributedPlan->workerJob;
+	ListCell *taskCell = NULL;
+
+	if (distributedPlan->planningError != NULL || workerJob == NULL ||
+		workerJob->dependedJobList != NIL)
+	{
+		return false;
+	}
+
+	foreach(taskCell, workerJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (task->queryString == NULL)
+		{
+			return false;
+		}
+
+		if (strstr(task->queryString, quotedResultId) != NULL)
+		{
+			*placementList = list_concat(*placementList,
+										 list_copy(task->taskPlacementList));
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * FindDistributedPlan returns the distributed plan of the Citus custom scan
+ * in the given plan tree, which is either at the top of the tree or below the
+ * nodes of the master query. The function returns NULL if the plan does not
+ * contain a Citus custom scan.
+ */
+static DistributedPlan *
+FindDistributedPlan(Plan *plan)
+{
+	DistributedPlan *distributedPlan = NULL;
+
+	if (plan == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(plan, CustomScan))
+	{
+		CustomScan *customScan = (CustomScan *) plan;
+		const CustomScanMethods *methods = customScan->methods;
+
+		if (methods == &RealTimeCustomScanMethods ||
+			methods == &TaskTrackerCustomScanMethods ||
+			methods == &RouterCustomScanMethods ||
+			methods == &CoordinatorInsertSelectCustomScanMethods ||
+			methods == &AdaptiveExecutorCustomScanMethods ||
+			methods == &DelayedErrorCustomScanMethods)
+		{
+			return GetDistributedPlan(customScan);
+		}
+
+		return NULL;
+	}
+
+	distributedPlan = FindDistributedPlan(plan->lefttree);
+	if (distributedPlan == NULL)
+	{
+		distributedPlan = FindDistributedPlan(plan->righttree);
+	}
+
+	return distributedPlan;
+}
+
+
+/*
+ * ExecuteSubPlanSequentially executes the subplan using its regular executor
+ * and sends its result to the nodes that read it.
+ */
+static void
+ExecuteSubPlanSequentially(DistributedSubPlan *subPlan, DistributedPlan *distributedPlan,
+						   List *nodeList)
+{
+	PlannedStmt *plannedStmt = subPlan->plan;
+	uint32 subPlanId = subPlan->subPlanId;
+	DestReceiver *copyDest = NULL;
+	ParamListInfo params = NULL;
+	EState *estate = NULL;
+	bool writeLocalFile = false;
+	List *subPlanNodeList = SubPlanNodeList(subPlan, distributedPlan, nodeList);
+
+	char *resultId = GenerateResultId(distributedPlan->planId, subPlanId);
+
+	SubPlanLevel++;
+	estate = CreateExecutorState();
+	copyDest = (DestReceiver *) CreateRemoteFileDestReceiver(resultId, estate,
+															 subPlanNodeList,
+															 writeLocalFile);
+
+	ExecutePlanIntoDestReceiver(plannedStmt, params, copyDest);
+
+	SubPlanLevel--;
+	FreeExecutorState(estate);
+}
+
+
+/*
+ * ExecuteSubPlansConcurrently executes the tasks of all given subplans in a
+ * single adaptive execution, which collects the results of each subplan in a
+ * tuple store, and then sends each result to the nodes that read it.
+ */
+static void
+ExecuteSubPlansConcurrently(List *subPlanList, DistributedPlan *distributedPlan,
+							List *nodeList)
+{
+	uint64 planId = distributedPlan->planId;
+	List *taskListResultList = NIL;
+	ListCell *subPlanCell = NULL;
+	ListCell *taskListResultCell = NULL;
+	bool writeLocalFile = false;
 
 	foreach(subPlanCell, subPlanList)
 	{
 		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
-		PlannedStmt *plannedStmt = subPlan->plan;
-		uint32 subPlanId = subPlan->subPlanId;
-		DestReceiver *copyDest = NULL;
-		ParamListInfo params = NULL;
-		EState *estate = NULL;
+		Plan *planTree = subPlan->plan->planTree;
+		DistributedPlan *subDistributedPlan =
+			GetDistributedPlan((CustomScan *) planTree);
+		TaskListResult *taskListResult =
+			(TaskListResult *) palloc0(sizeof(TaskListResult));
+
+		/* we are taking locks on partitions of partitioned tables */
+		LockPartitionsInRelationList(subDistributedPlan->relationIdList,
+									 AccessShareLock);
+
+		taskListResult->taskList = subDistributedPlan->workerJob->taskList;
+		taskListResult->tupleDescriptor = ExecTypeFromTL(planTree->targetlist, false);
+		taskListResult->tupleStore = NULL;
 
-		char *resultId = GenerateResultId(planId, subPlanId);
+		taskListResultList = lappend(taskListResultList, taskListResult);
+	}
+
+	SubPlanLevel++;
+	ExecuteTaskListsIntoTupleStores(taskListResultList);
+
+	forboth(subPlanCell, subPlanList, taskListResultCell, taskListResultList)
+	{
+		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+		TaskListResult *taskListResult = (TaskListResult *) lfirst(taskListResultCell);
+		TupleDesc tupleDescriptor = taskListResult->tupleDescriptor;
+		char *resultId = GenerateResultId(planId, subPlan->subPlanId);
+		EState *estate = CreateExecutorState();
+		DestReceiver *copyDest = NULL;
+		TupleTableSlot *tupleSlot = MakeSingleTupleTableSlot(tupleDescriptor);
+		List *subPlanNodeList = SubPlanNodeList(subPlan, distributedPlan, nodeList);
 
-		SubPlanLevel++;
-		estate = CreateExecutorState();
 		copyDest = (DestReceiver *) CreateRemoteFileDestReceiver(resultId, estate,
-																 nodeList,
+																 subPlanNodeList,
 																 writeLocalFile);
 
-		ExecutePlanIntoDestReceiver(plannedStmt, params, copyDest);
+		copyDest->rStartup(copyDest, CMD_SELECT, tupleDescriptor);
+
+		while (tuplestore_gettupleslot(taskListResult->tupleStore, true, false,
+									   tupleSlot))
+		{
+			copyDest->receiveSlot(tupleSlot, copyDest);
+		}
 
-		SubPlanLevel--;
+		copyDest->rShutdown(copyDest);
+
+		ExecDropSingleTupleTableSlot(tupleSlot);
+		tuplestore_end(taskListResult->tupleStore);
 		FreeExecutorState(estate);
 	}
+
+	SubPlanLevel--;
 }
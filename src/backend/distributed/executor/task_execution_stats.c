@@ -0,0 +1,151 @@
+/*-------------------------------------------------------------------------
+ *
+ * task_execution_stats.c
+ *   Collects the execution time, row count, bytes received and connection
+ *   wait time of each task while a distributed query is run by EXPLAIN
+ *   ANALYZE, such that EXPLAIN can show them without running the tasks
+ *   again.
+ *
+ *   The executors do not know which scan they execute tasks for, so the scan
+ *   that is executing its tasks is kept in a global. Statistics are only
+ *   collected while an instrumented scan executes its tasks. Scans of nested
+ *   queries, such as subplans, suspend the collection of the outer scan.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "distributed/task_execution_stats.h"
+#include "nodes/execnodes.h"
+#include "utils/memutils.h"
+
+
+/* scan whose task statistics are collected, if any */
+static CitusScanState *TaskStatsScanState = NULL;
+
+
+static double TimestampDifferenceMilliseconds(TimestampTz startTime,
+											  TimestampTz endTime);
+
+
+/*
+ * BeginTaskStatsCollection starts collecting the statistics of the tasks that
+ * are executed for the given scan in its task statistics list, if the scan is
+ * instrumented by EXPLAIN ANALYZE. It returns the scan whose collection was
+ * suspended, which should be passed to EndTaskStatsCollection.
+ */
+CitusScanState *
+BeginTaskStatsCollection(CitusScanState *scanState)
+{
+	CitusScanState *previousScanState = TaskStatsScanState;
+
+	if (scanState->customScanState.ss.ps.instrument != NULL)
+	{
+		TaskStatsScanState = scanState;
+	}
+	else
+	{
+		TaskStatsScanState = NULL;
+	}
+
+	return previousScanState;
+}
+
+
+/*
+ * EndTaskStatsCollection stops collecting task statistics for the current scan
+ * and resumes the collection for the scan that was suspended.
+ */
+void
+EndTaskStatsCollection(CitusScanState *previousScanState)
+{
+	TaskStatsScanState = previousScanState;
+}
+
+
+/*
+ * CollectingTaskStats returns whether the statistics of tasks that are
+ * executed are currently collected.
+ */
+bool
+CollectingTaskStats(void)
+{
+	return TaskStatsScanState != NULL;
+}
+
+
+/*
+ * RecordTaskExecutionStats adds the statistics of a task that just finished
+ * on the placement at placementIndex to the scan whose tasks are executed.
+ * The task started at startTime, and its query was sent at queryStartTime,
+ * or at 0 if that is not known.
+ */
+void
+RecordTaskExecutionStats(Task *task, int placementIndex, TimestampTz startTime,
+						 TimestampTz queryStartTime, uint64 rowCount,
+						 uint64 bytesReceived)
+{
+	CitusScanState *scanState = TaskStatsScanState;
+	MemoryContext queryContext = NULL;
+	MemoryContext oldContext = NULL;
+	TaskExecutionStats *taskStats = NULL;
+	TimestampTz endTime = 0;
+
+	if (scanState == NULL)
+	{
+		return;
+	}
+
+	endTime = GetCurrentTimestamp();
+
+	/* the statistics are needed until EXPLAIN prints the plan */
+	queryContext = scanState->customScanState.ss.ps.state->es_query_cxt;
+	oldContext = MemoryContextSwitchTo(queryContext);
+
+	taskStats = (TaskExecutionStats *) palloc0(sizeof(TaskExecutionStats));
+	taskStats->taskId = task->taskId;
+	taskStats->placementIndex = placementIndex;
+	taskStats->executionTime = TimestampDifferenceMilliseconds(startTime, endTime);
+	taskStats->rowCount = rowCount;
+	taskStats->bytesReceived = bytesReceived;
+
+	if (queryStartTime != 0)
+	{
+		taskStats->connectionWaitTime =
+			TimestampDifferenceMilliseconds(startTime, queryStartTime);
+	}
+
+	scanState->taskStatsList = lappend(scanState->taskStatsList, taskStats);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * ResetTaskStatsCollection stops collecting task statistics after an error,
+ * since the scan that was collecting them no longer exists.
+ */
+void
+ResetTaskStatsCollection(void)
+{
+	TaskStatsScanState = NULL;
+}
+
+
+/*
+ * TimestampDifferenceMilliseconds returns the number of milliseconds between
+ * the given timestamps.
+ */
+static double
+TimestampDifferenceMilliseconds(TimestampTz startTime, TimestampTz endTime)
+{
+	long seconds = 0;
+	int microseconds = 0;
+
+	TimestampDifference(startTime, endTime, &seconds, &microseconds);
+
+	return seconds * 1000.0 + microseconds / 1000.0;
+}
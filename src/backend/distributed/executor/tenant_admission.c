@@ -0,0 +1,1022 @@
+/*-------------------------------------------------------------------------
+ *
+ * tenant_admission.c
+ *   Enforces citus.max_tenant_concurrency and
+ *   citus.max_tenant_queries_per_second for queries that the router planner
+ *   routed to a single shard.
+ *
+ *   A tenant is identified by the shard group that its distribution column
+ *   value maps to, that is the colocation group and the index of the shard in
+ *   it. All backends of a node share a counter of running queries and a token
+ *   bucket per tenant. A query that would exceed either limit waits in the
+ *   executor until another query of the same tenant finishes or the bucket
+ *   refills, instead of taking up another connection slot on the worker that
+ *   holds the tenant's shards. The limits apply per node, so on MX clusters
+ *   every node that routes queries enforces them for its own backends.
+ *
+ *   Waiting for an admission is not a lock wait, so neither Postgres nor the
+ *   distributed deadlock detector can see it. Queries on tenants whose shards
+ *   the transaction already accessed are therefore admitted right away, as
+ *   the query holding the admission might wait for the transaction's locks.
+ *   citus_tenant_admission_waits() shows which backends wait for which.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include <math.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/xact.h"
+#include "distributed/colocation_utils.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/placement_connection.h"
+#include "distributed/shardinterval_utils.h"
+#include "distributed/tenant_admission.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+
+/* number of tenants for which we keep counters in shared memory */
+#define TRACKED_TENANT_COUNT 4096
+
+/* maximum number of milliseconds to sleep before checking for admission again */
+#define TENANT_ADMISSION_POLL_INTERVAL 10
+
+/* number of admissions per backend that citus_tenant_admission_waits() shows */
+#define MAX_TRACKED_BACKEND_ADMISSIONS 8
+
+
+/*
+ * TenantAdmissionControlData is the header of the shared memory segment,
+ * holding the lock that protects the hash of tenant counters.
+ */
+typedef struct TenantAdmissionControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+} TenantAdmissionControlData;
+
+
+/*
+ * TenantHashKey identifies a tenant. For hash distributed tables, it is the
+ * colocation group and the index of the shard within the group, such that
+ * queries on colocated tables count towards the same tenant. For other
+ * tables, colocationId is INVALID_COLOCATION_ID and shardIndex holds the
+ * shard id.
+ */
+typedef struct TenantHashKey
+{
+	uint32 colocationId;
+	uint64 shardIndex;
+} TenantHashKey;
+
+
+/* hash entry with the counters of a tenant */
+typedef struct TenantHashEntry
+{
+	TenantHashKey key;
+
+	/* number of queries running and waiting across all backends */
+	int activeQueries;
+	int waitingQueries;
+
+	/* number of queries admitted since the entry was created */
+	uint64 admittedQueries;
+
+	/* token bucket for citus.max_tenant_queries_per_second */
+	double availableTokens;
+	TimestampTz lastRefillTime;
+} TenantHashEntry;
+
+
+/*
+ * BackendTenantAdmissions holds the tenant that a backend waits for and the
+ * tenants of the admissions that it holds, such that other backends can tell
+ * who blocks whom. It is protected by the lock in TenantAdmissionControlData.
+ */
+typedef struct BackendTenantAdmissions
+{
+	bool waiting;
+	TenantHashKey waitingKey;
+	int heldCount;
+	TenantHashKey heldKeys[MAX_TRACKED_BACKEND_ADMISSIONS];
+} BackendTenantAdmissions;
+
+
+/* a query's admission, held until ReleaseTenantAdmission */
+struct TenantAdmission
+{
+	TenantHashKey key;
+	SubTransactionId subId;
+
+	/* whether the query was counted in shared memory */
+	bool tracked;
+};
+
+
+/* config variables managed via guc.c */
+int MaxTenantConcurrency = DISABLE_TENANT_LIMIT;
+int MaxTenantQueriesPerSecond = DISABLE_TENANT_LIMIT;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static TenantAdmissionControlData *TenantAdmissionControl = NULL;
+
+/* hash of tenant -> counters across all backends */
+static HTAB *TenantHash = NULL;
+
+/* array of the admissions of each backend, indexed by pgprocno */
+static BackendTenantAdmissions *BackendTenantAdmissionsArray = NULL;
+
+/* admissions that this backend holds, allocated in TopMemoryContext */
+static List *HeldTenantAdmissions = NIL;
+
+/* tenant that this backend waits for, counted in its waiting queries */
+static bool WaitingForTenant = false;
+static TenantHashKey WaitingTenantKey;
+
+
+static bool TenantHashKeyForTask(Task *task, TenantHashKey *key);
+static bool HoldsTenantAdmission(TenantHashKey *key);
+static bool TaskPlacementsAccessedInXact(Task *task);
+static bool TryAdmitTenantQuery(TenantHashKey *key, bool force, long *waitMillis,
+								bool *tracked);
+static void StopWaitingForTenant(void);
+static void DecrementTenantQueryCount(TenantHashKey *key);
+static TenantHashEntry * EnterTenantHashEntry(TenantHashKey *key);
+static void RefillTenantTokens(TenantHashEntry *tenantEntry);
+static BackendTenantAdmissions * MyBackendTenantAdmissions(void);
+static void RemoveBackendHeldKey(TenantHashKey *key);
+static size_t TenantAdmissionShmemSize(void);
+static void TenantAdmissionShmemInit(void);
+
+
+PG_FUNCTION_INFO_V1(citus_tenant_admission_stats);
+PG_FUNCTION_INFO_V1(citus_tenant_admission_waits);
+
+
+/*
+ * citus_tenant_admission_stats returns the counters that this node keeps for
+ * each tenant while citus.max_tenant_concurrency or
+ * citus.max_tenant_queries_per_second is set.
+ */
+Datum
+citus_tenant_admission_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *returnSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext perQueryContext = NULL;
+	MemoryContext oldContext = NULL;
+	HASH_SEQ_STATUS status;
+	TenantHashEntry *tenantEntry = NULL;
+
+	Datum values[5];
+	bool isNulls[5];
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (returnSetInfo == NULL || !IsA(returnSetInfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context " \
+						"that cannot accept a set")));
+	}
+
+	if (!(returnSetInfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+	}
+
+	/* build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	perQueryContext = returnSetInfo->econtext->ecxt_per_query_memory;
+
+	oldContext = MemoryContextSwitchTo(perQueryContext);
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	returnSetInfo->returnMode = SFRM_Materialize;
+	returnSetInfo->setResult = tupleStore;
+	returnSetInfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&TenantAdmissionControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, TenantHash);
+	tenantEntry = (TenantHashEntry *) hash_seq_search(&status);
+	while (tenantEntry != NULL)
+	{
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = UInt32GetDatum(tenantEntry->key.colocationId);
+		values[1] = Int64GetDatum(tenantEntry->key.shardIndex);
+		values[2] = Int32GetDatum(tenantEntry->activeQueries);
+		values[3] = Int32GetDatum(tenantEntry->waitingQueries);
+		values[4] = Int64GetDatum(tenantEntry->admittedQueries);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+		tenantEntry = (TenantHashEntry *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&TenantAdmissionControl->lock);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * citus_tenant_admission_waits returns a row for each backend of this node
+ * that waits for admission to a tenant, and each backend that holds an
+ * admission to that tenant. Backends that only wait for the tenant's query
+ * rate to allow another query are not shown.
+ */
+Datum
+citus_tenant_admission_waits(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *returnSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext perQueryContext = NULL;
+	MemoryContext oldContext = NULL;
+	int waitingIndex = 0;
+
+	Datum values[4];
+	bool isNulls[4];
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (returnSetInfo == NULL || !IsA(returnSetInfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context " \
+						"that cannot accept a set")));
+	}
+
+	if (!(returnSetInfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+	}
+
+	/* build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	perQueryContext = returnSetInfo->econtext->ecxt_per_query_memory;
+
+	oldContext = MemoryContextSwitchTo(perQueryContext);
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	returnSetInfo->returnMode = SFRM_Materialize;
+	returnSetInfo->setResult = tupleStore;
+	returnSetInfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&TenantAdmissionControl->lock, LW_SHARED);
+
+	for (waitingIndex = 0; waitingIndex < MaxBackends; waitingIndex++)
+	{
+		BackendTenantAdmissions *waitingBackend =
+			&BackendTenantAdmissionsArray[waitingIndex];
+		int holdingIndex = 0;
+
+		if (!waitingBackend->waiting)
+		{
+			continue;
+		}
+
+		for (holdingIndex = 0; holdingIndex < MaxBackends; holdingIndex++)
+		{
+			BackendTenantAdmissions *holdingBackend =
+				&BackendTenantAdmissionsArray[holdingIndex];
+			int keyIndex = 0;
+
+			if (holdingIndex == waitingIndex)
+			{
+				continue;
+			}
+
+			for (keyIndex = 0; keyIndex < holdingBackend->heldCount; keyIndex++)
+			{
+				TenantHashKey *heldKey = &holdingBackend->heldKeys[keyIndex];
+
+				if (memcmp(heldKey, &waitingBackend->waitingKey,
+						   sizeof(TenantHashKey)) != 0)
+				{
+					continue;
+				}
+
+				memset(values, 0, sizeof(values));
+				memset(isNulls, false, sizeof(isNulls));
+
+				values[0] = Int32GetDatum(ProcGlobal->allProcs[waitingIndex].pid);
+				values[1] = Int32GetDatum(ProcGlobal->allProcs[holdingIndex].pid);
+				values[2] = UInt32GetDatum(heldKey->colocationId);
+				values[3] = Int64GetDatum(heldKey->shardIndex);
+
+				tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+				break;
+			}
+		}
+	}
+
+	LWLockRelease(&TenantAdmissionControl->lock);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * TenantLimitsEnabled returns whether router queries are subject to any of
+ * the per-tenant limits.
+ */
+bool
+TenantLimitsEnabled(void)
+{
+	return MaxTenantConcurrency != DISABLE_TENANT_LIMIT ||
+		   MaxTenantQueriesPerSecond != DISABLE_TENANT_LIMIT;
+}
+
+
+/*
+ * AdmitTenantQuery waits until the tenant of the given single shard task may
+ * run another query, and returns the admission that the caller should release
+ * once the task's results are read. The function returns NULL if the task is
+ * not subject to the tenant limits.
+ *
+ * Backends that already hold an admission for the tenant, for instance
+ * because a function in a query on the tenant's shard runs another query on
+ * it, are admitted right away, so they cannot end up waiting for themselves.
+ * The same goes for transactions that already accessed the tenant's shards,
+ * since the query holding the admission might wait for their locks. The
+ * wait can be cancelled by the user.
+ */
+TenantAdmission *
+AdmitTenantQuery(Task *task)
+{
+	TenantAdmission *admission = NULL;
+	MemoryContext oldContext = NULL;
+	TenantHashKey key;
+	bool force = false;
+	bool tracked = false;
+	long waitMillis = 0;
+
+	if (!TenantLimitsEnabled() || !TenantHashKeyForTask(task, &key))
+	{
+		return NULL;
+	}
+
+	force = HoldsTenantAdmission(&key) || TaskPlacementsAccessedInXact(task);
+
+	while (!TryAdmitTenantQuery(&key, force, &waitMillis, &tracked))
+	{
+		int latchFlags = WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH;
+		int rc = 0;
+
+#if (PG_VERSION_NUM >= 100000)
+		rc = WaitLatch(MyLatch, latchFlags, waitMillis, PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatch(MyLatch, latchFlags, waitMillis);
+#endif
+
+		if (rc & WL_POSTMASTER_DEATH)
+		{
+			proc_exit(1);
+		}
+
+		if (rc & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	admission = palloc0(sizeof(TenantAdmission));
+	admission->key = key;
+	admission->subId = GetCurrentSubTransactionId();
+	admission->tracked = tracked;
+
+	HeldTenantAdmissions = lappend(HeldTenantAdmissions, admission);
+
+	MemoryContextSwitchTo(oldContext);
+
+	return admission;
+}
+
+
+/*
+ * ReleaseTenantAdmission lets the next query of the admission's tenant run.
+ * Admissions that were already released, for instance at the end of the
+ * transaction, are ignored.
+ */
+void
+ReleaseTenantAdmission(TenantAdmission *admission)
+{
+	if (admission == NULL || !list_member_ptr(HeldTenantAdmissions, admission))
+	{
+		return;
+	}
+
+	HeldTenantAdmissions = list_delete_ptr(HeldTenantAdmissions, admission);
+
+	if (admission->tracked)
+	{
+		DecrementTenantQueryCount(&admission->key);
+	}
+
+	pfree(admission);
+}
+
+
+/*
+ * ReleaseSubXactTenantAdmissions releases the admissions that were taken in
+ * the given subtransaction or its children, which are being rolled back.
+ */
+void
+ReleaseSubXactTenantAdmissions(SubTransactionId subId)
+{
+	List *admissionList = list_copy(HeldTenantAdmissions);
+	ListCell *admissionCell = NULL;
+
+	foreach(admissionCell, admissionList)
+	{
+		TenantAdmission *admission = (TenantAdmission *) lfirst(admissionCell);
+
+		if (admission->subId >= subId)
+		{
+			ReleaseTenantAdmission(admission);
+		}
+	}
+
+	list_free(admissionList);
+}
+
+
+/*
+ * ResetTenantAdmissionState releases all admissions that this backend holds.
+ * It is called at the end of transactions, such that errors in the middle of
+ * a query do not keep the tenant's slot occupied, or a cancelled wait counted.
+ */
+void
+ResetTenantAdmissionState(void)
+{
+	if (WaitingForTenant)
+	{
+		StopWaitingForTenant();
+	}
+
+	while (HeldTenantAdmissions != NIL)
+	{
+		TenantAdmission *admission =
+			(TenantAdmission *) linitial(HeldTenantAdmissions);
+
+		ReleaseTenantAdmission(admission);
+	}
+}
+
+
+/*
+ * TenantHashKeyForTask fills the key of the tenant whose shards the given task
+ * accesses, and returns whether the task belongs to a tenant. Reference
+ * tables are shared by all tenants and are not limited.
+ */
+static bool
+TenantHashKeyForTask(Task *task, TenantHashKey *key)
+{
+	uint64 shardId = task->anchorShardId;
+	ShardInterval *shardInterval = NULL;
+	DistTableCacheEntry *cacheEntry = NULL;
+
+	if (shardId == INVALID_SHARD_ID)
+	{
+		return false;
+	}
+
+	shardInterval = LoadShardInterval(shardId);
+	cacheEntry = DistributedTableCacheEntry(shardInterval->relationId);
+	if (cacheEntry->partitionMethod == DISTRIBUTE_BY_NONE)
+	{
+		return false;
+	}
+
+	memset(key, 0, sizeof(TenantHashKey));
+
+	if (cacheEntry->partitionMethod == DISTRIBUTE_BY_HASH &&
+		cacheEntry->colocationId != INVALID_COLOCATION_ID)
+	{
+		key->colocationId = cacheEntry->colocationId;
+		key->shardIndex = (uint64) ShardIndex(shardInterval);
+	}
+	else
+	{
+		key->colocationId = INVALID_COLOCATION_ID;
+		key->shardIndex = shardId;
+	}
+
+	return true;
+}
+
+
+/*
+ * HoldsTenantAdmission returns whether this backend already holds an
+ * admission for the given tenant.
+ */
+static bool
+HoldsTenantAdmission(TenantHashKey *key)
+{
+	ListCell *admissionCell = NULL;
+
+	foreach(admissionCell, HeldTenantAdmissions)
+	{
+		TenantAdmission *admission = (TenantAdmission *) lfirst(admissionCell);
+
+		if (memcmp(&admission->key, key, sizeof(TenantHashKey)) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * TaskPlacementsAccessedInXact returns whether the current transaction
+ * accessed any of the placements of the given task, or placements that are
+ * co-located with them, over a connection.
+ */
+static bool
+TaskPlacementsAccessedInXact(Task *task)
+{
+	ListCell *placementCell = NULL;
+
+	foreach(placementCell, task->taskPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+		if (PlacementAccessedInXact(placement))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * TryAdmitTenantQuery counts a new query for the given tenant unless that
+ * would exceed the tenant limits and force is false. The function returns
+ * whether the query was admitted. If not, it marks the backend as waiting and
+ * sets waitMillis to the time after which it is worth trying again. tracked
+ * tells whether the query is counted in shared memory.
+ */
+static bool
+TryAdmitTenantQuery(TenantHashKey *key, bool force, long *waitMillis, bool *tracked)
+{
+	TenantHashEntry *tenantEntry = NULL;
+	BackendTenantAdmissions *backendAdmissions = MyBackendTenantAdmissions();
+	bool rateLimited = MaxTenantQueriesPerSecond != DISABLE_TENANT_LIMIT;
+	bool admitted = false;
+
+	LWLockAcquire(&TenantAdmissionControl->lock, LW_EXCLUSIVE);
+
+	tenantEntry = EnterTenantHashEntry(key);
+
+	/*
+	 * Out of shared memory for the hash even though no tenant is idle. We do
+	 * not want to block queries in that case, so we let them through
+	 * untracked.
+	 */
+	if (tenantEntry == NULL)
+	{
+		LWLockRelease(&TenantAdmissionControl->lock);
+
+		ereport(DEBUG1, (errmsg("could not track the queries of tenant %u:"
+								UINT64_FORMAT, key->colocationId,
+								key->shardIndex)));
+
+		*tracked = false;
+		return true;
+	}
+
+	if (rateLimited)
+	{
+		RefillTenantTokens(tenantEntry);
+	}
+
+	if (force ||
+		((MaxTenantConcurrency == DISABLE_TENANT_LIMIT ||
+		  tenantEntry->activeQueries < MaxTenantConcurrency) &&
+		 (!rateLimited || tenantEntry->availableTokens >= 1.0)))
+	{
+		tenantEntry->activeQueries++;
+		tenantEntry->admittedQueries++;
+
+		if (rateLimited && !force)
+		{
+			tenantEntry->availableTokens -= 1.0;
+		}
+
+		if (WaitingForTenant)
+		{
+			tenantEntry->waitingQueries--;
+			WaitingForTenant = false;
+		}
+
+		if (backendAdmissions != NULL)
+		{
+			backendAdmissions->waiting = false;
+
+			if (backendAdmissions->heldCount < MAX_TRACKED_BACKEND_ADMISSIONS)
+			{
+				backendAdmissions->heldKeys[backendAdmissions->heldCount] = *key;
+				backendAdmissions->heldCount++;
+			}
+		}
+
+		admitted = true;
+	}
+	else
+	{
+		*waitMillis = TENANT_ADMISSION_POLL_INTERVAL;
+
+		if (rateLimited && tenantEntry->availableTokens < 1.0)
+		{
+			/* sleep until the next token arrives if that is further away */
+			double missingTokens = 1.0 - tenantEntry->availableTokens;
+			long refillMillis = (long) ceil(missingTokens * 1000.0 /
+											MaxTenantQueriesPerSecond);
+
+			*waitMillis = Max(refillMillis, TENANT_ADMISSION_POLL_INTERVAL);
+		}
+
+		if (!WaitingForTenant)
+		{
+			tenantEntry->waitingQueries++;
+			WaitingForTenant = true;
+			WaitingTenantKey = *key;
+
+			if (backendAdmissions != NULL)
+			{
+				backendAdmissions->waiting = true;
+				backendAdmissions->waitingKey = *key;
+			}
+
+			ereport(DEBUG1, (errmsg("waiting for admission to tenant %u:"
+									UINT64_FORMAT ", which has %d running queries",
+									key->colocationId, key->shardIndex,
+									tenantEntry->activeQueries)));
+		}
+	}
+
+	LWLockRelease(&TenantAdmissionControl->lock);
+
+	*tracked = true;
+	return admitted;
+}
+
+
+/*
+ * StopWaitingForTenant removes a query that was cancelled while it waited for
+ * admission from the waiting queries of its tenant.
+ */
+static void
+StopWaitingForTenant(void)
+{
+	TenantHashEntry *tenantEntry = NULL;
+	bool entryFound = false;
+
+	BackendTenantAdmissions *backendAdmissions = MyBackendTenantAdmissions();
+
+	WaitingForTenant = false;
+
+	LWLockAcquire(&TenantAdmissionControl->lock, LW_EXCLUSIVE);
+
+	tenantEntry = (TenantHashEntry *) hash_search(TenantHash, &WaitingTenantKey,
+												  HASH_FIND, &entryFound);
+	if (entryFound && tenantEntry->waitingQueries > 0)
+	{
+		tenantEntry->waitingQueries--;
+	}
+
+	if (backendAdmissions != NULL)
+	{
+		backendAdmissions->waiting = false;
+	}
+
+	LWLockRelease(&TenantAdmissionControl->lock);
+}
+
+
+/*
+ * DecrementTenantQueryCount removes a finished query from the given tenant's
+ * running queries. Waiting backends notice the free slot when they next poll.
+ */
+static void
+DecrementTenantQueryCount(TenantHashKey *key)
+{
+	TenantHashEntry *tenantEntry = NULL;
+	bool entryFound = false;
+
+	LWLockAcquire(&TenantAdmissionControl->lock, LW_EXCLUSIVE);
+
+	tenantEntry = (TenantHashEntry *) hash_search(TenantHash, key, HASH_FIND,
+												  &entryFound);
+	if (entryFound && tenantEntry->activeQueries > 0)
+	{
+		tenantEntry->activeQueries--;
+	}
+
+	RemoveBackendHeldKey(key);
+
+	LWLockRelease(&TenantAdmissionControl->lock);
+}
+
+
+/*
+ * EnterTenantHashEntry returns the hash entry of the given tenant, creating it
+ * if needed. When the hash is full, the entries of idle tenants are removed
+ * to make room, which forgets their admitted query counts. The function
+ * returns NULL if no tenant is idle. The caller should hold the lock in
+ * exclusive mode.
+ */
+static TenantHashEntry *
+EnterTenantHashEntry(TenantHashKey *key)
+{
+	TenantHashEntry *tenantEntry = NULL;
+	bool entryFound = false;
+
+	tenantEntry = (TenantHashEntry *) hash_search(TenantHash, key, HASH_ENTER_NULL,
+												  &entryFound);
+	if (tenantEntry == NULL)
+	{
+		HASH_SEQ_STATUS status;
+		TenantHashEntry *idleEntry = NULL;
+
+		hash_seq_init(&status, TenantHash);
+		idleEntry = (TenantHashEntry *) hash_seq_search(&status);
+		while (idleEntry != NULL)
+		{
+			if (idleEntry->activeQueries == 0 && idleEntry->waitingQueries == 0)
+			{
+				hash_search(TenantHash, &idleEntry->key, HASH_REMOVE, NULL);
+			}
+
+			idleEntry = (TenantHashEntry *) hash_seq_search(&status);
+		}
+
+		tenantEntry = (TenantHashEntry *) hash_search(TenantHash, key,
+													  HASH_ENTER_NULL, &entryFound);
+		if (tenantEntry == NULL)
+		{
+			return NULL;
+		}
+	}
+
+	if (!entryFound)
+	{
+		tenantEntry->activeQueries = 0;
+		tenantEntry->waitingQueries = 0;
+		tenantEntry->admittedQueries = 0;
+		tenantEntry->availableTokens = MaxTenantQueriesPerSecond;
+		tenantEntry->lastRefillTime = GetCurrentTimestamp();
+	}
+
+	return tenantEntry;
+}
+
+
+/*
+ * RefillTenantTokens adds the tokens that accrued since the last refill to
+ * the tenant's bucket. The bucket holds at most one second worth of tokens,
+ * which is the largest burst of queries that a tenant can start at once.
+ */
+static void
+RefillTenantTokens(TenantHashEntry *tenantEntry)
+{
+	TimestampTz currentTime = GetCurrentTimestamp();
+	double maxTokens = Max(MaxTenantQueriesPerSecond, 1);
+	long elapsedSeconds = 0;
+	int elapsedMicroseconds = 0;
+	double elapsedTime = 0.0;
+
+	TimestampDifference(tenantEntry->lastRefillTime, currentTime, &elapsedSeconds,
+						&elapsedMicroseconds);
+	elapsedTime = elapsedSeconds + elapsedMicroseconds / 1000000.0;
+
+	tenantEntry->availableTokens += elapsedTime * MaxTenantQueriesPerSecond;
+	if (tenantEntry->availableTokens > maxTokens)
+	{
+		tenantEntry->availableTokens = maxTokens;
+	}
+
+	tenantEntry->lastRefillTime = currentTime;
+}
+
+
+/*
+ * MyBackendTenantAdmissions returns the entry of the current backend in the
+ * array of admissions, or NULL if the backend does not have one.
+ */
+static BackendTenantAdmissions *
+MyBackendTenantAdmissions(void)
+{
+	if (BackendTenantAdmissionsArray == NULL || MyProc == NULL ||
+		MyProc->pgprocno >= MaxBackends)
+	{
+		return NULL;
+	}
+
+	return &BackendTenantAdmissionsArray[MyProc->pgprocno];
+}
+
+
+/*
+ * RemoveBackendHeldKey removes one admission to the given tenant from the
+ * admissions of the current backend. The caller should hold the lock in
+ * exclusive mode.
+ */
+static void
+RemoveBackendHeldKey(TenantHashKey *key)
+{
+	BackendTenantAdmissions *backendAdmissions = MyBackendTenantAdmissions();
+	int keyIndex = 0;
+
+	if (backendAdmissions == NULL)
+	{
+		return;
+	}
+
+	for (keyIndex = 0; keyIndex < backendAdmissions->heldCount; keyIndex++)
+	{
+		if (memcmp(&backendAdmissions->heldKeys[keyIndex], key,
+				   sizeof(TenantHashKey)) == 0)
+		{
+			int lastIndex = backendAdmissions->heldCount - 1;
+
+			backendAdmissions->heldKeys[keyIndex] = backendAdmissions->heldKeys[lastIndex];
+			backendAdmissions->heldCount--;
+
+			return;
+		}
+	}
+}
+
+
+/*
+ * InitializeTenantAdmission requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeTenantAdmission(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(TenantAdmissionShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = TenantAdmissionShmemInit;
+}
+
+
+/*
+ * TenantAdmissionShmemSize computes how much shared memory is required.
+ */
+static size_t
+TenantAdmissionShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, sizeof(TenantAdmissionControlData));
+	size = add_size(size, mul_size(sizeof(BackendTenantAdmissions), MaxBackends));
+
+	hashSize = hash_estimate_size(TRACKED_TENANT_COUNT, sizeof(TenantHashEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * TenantAdmissionShmemInit initializes the shared memory used for keeping
+ * track of the queries of each tenant across backends.
+ */
+static void
+TenantAdmissionShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	TenantAdmissionControl =
+		(TenantAdmissionControlData *) ShmemInitStruct(
+			"Tenant Admission Data",
+			sizeof(TenantAdmissionControlData),
+			&alreadyInitialized);
+
+	BackendTenantAdmissionsArray =
+		(BackendTenantAdmissions *) ShmemInitStruct(
+			"Backend Tenant Admissions",
+			mul_size(sizeof(BackendTenantAdmissions), MaxBackends),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out all the memory */
+		memset(TenantAdmissionControl, 0, sizeof(TenantAdmissionControlData));
+		memset(BackendTenantAdmissionsArray, 0,
+			   mul_size(sizeof(BackendTenantAdmissions), MaxBackends));
+
+#if (PG_VERSION_NUM >= 100000)
+		TenantAdmissionControl->trancheId = LWLockNewTrancheId();
+		TenantAdmissionControl->lockTrancheName = "Tenant Admission";
+		LWLockRegisterTranche(TenantAdmissionControl->trancheId,
+							  TenantAdmissionControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &TenantAdmissionControl->lockTranche;
+
+			TenantAdmissionControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &TenantAdmissionControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Tenant Admission";
+			LWLockRegisterTranche(TenantAdmissionControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&TenantAdmissionControl->lock,
+						 TenantAdmissionControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(TenantHashKey);
+	hashInfo.entrysize = sizeof(TenantHashEntry);
+	hashFlags = (HASH_ELEM | HASH_BLOBS);
+
+	TenantHash = ShmemInitHash("Tenant Admission Hash",
+							   TRACKED_TENANT_COUNT, TRACKED_TENANT_COUNT,
+							   &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
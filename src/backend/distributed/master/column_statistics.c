@@ -0,0 +1,1103 @@
+/*-------------------------------------------------------------------------
+ *
+ * column_statistics.c
+ *   Routines for merging the column statistics of the shards of a distributed
+ *   table into the coordinator's catalog.
+ *
+ *   The shell table of a distributed table on the coordinator is empty, so
+ *   ANALYZE leaves it without column statistics, and plans that use the
+ *   table's columns fall back to default selectivities. We therefore query
+ *   pg_stats for all shards in parallel, merge the null fractions, widths,
+ *   distinct counts, most common values and histograms of the shards, and
+ *   store the result in pg_statistic for the shell table. The row and page
+ *   counts of the shards are summed into pg_class. The distributed planner
+ *   uses these statistics to estimate the sizes of joins when ordering them.
+ *
+ *   Merging is approximate. Distinct counts of the distribution column are
+ *   added up since the shards hold disjoint values, whereas for other columns
+ *   the largest count of a shard is used unless the values are unique on all
+ *   shards. The most common values of the shards are added
+ *   up by value, and the histogram bounds of the shards are weighted by the
+ *   rows in their buckets to pick new bounds.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include <math.h>
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
+#include "commands/vacuum.h"
+#include "distributed/adaptive_executor.h"
+#include "distributed/column_statistics.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_protocol.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/multi_partitioning_utils.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/relay_utility.h"
+#include "distributed/worker_manager.h"
+#include "distributed/worker_protocol.h"
+#include "executor/tuptable.h"
+#include "storage/lmgr.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
+
+
+/* returns the table and column statistics of a shard, one row per column */
+#define SHARD_COLUMN_STATISTICS_QUERY \
+	"SELECT " UINT64_FORMAT ", c.reltuples, c.relpages, s.attname, s.null_frac, " \
+	"s.avg_width, s.n_distinct, s.most_common_vals::text, " \
+	"s.most_common_freqs::text, s.histogram_bounds::text " \
+	"FROM pg_class c JOIN pg_namespace n ON (n.oid = c.relnamespace) " \
+	"LEFT JOIN pg_stats s ON (s.schemaname = n.nspname AND " \
+	"s.tablename = c.relname AND s.inherited = (c.relkind = 'p')) " \
+	"WHERE c.oid = %s::regclass"
+
+#define SHARD_COLUMN_STATISTICS_COLUMNS 10
+
+/* the fraction of rows above which a distinct count is stored as a fraction */
+#define DISTINCT_FRACTION_THRESHOLD 0.1
+
+
+/* ShardStatistics holds the row and page counts of a shard */
+typedef struct ShardStatistics
+{
+	uint64 shardId;
+	double rowCount;
+	int32 pageCount;
+} ShardStatistics;
+
+/* WeightedValue is a column value that stands for a number of rows */
+typedef struct WeightedValue
+{
+	Datum value;
+	double weight;
+} WeightedValue;
+
+/* ValueSortContext holds the comparison function of a column for sorting */
+typedef struct ValueSortContext
+{
+	FmgrInfo *compareFunction;
+	Oid collationId;
+} ValueSortContext;
+
+/*
+ * ColumnStatistics accumulates the statistics of a column across shards and
+ * holds the merged statistics afterwards.
+ */
+typedef struct ColumnStatistics
+{
+	char attributeName[NAMEDATALEN];
+	AttrNumber attributeNumber;
+	Oid typeId;
+	Oid collationId;
+	TypeCacheEntry *typeEntry;
+	bool distributionColumn;
+
+	/* accumulated over the shards that have statistics for the column */
+	double rowCount;
+	double nullCount;
+	double widthSum;
+	double distinctSum;
+	double distinctMax;
+	bool distinctUnique;
+	List *commonValueList;
+	List *histogramValueList;
+
+	/* merged statistics */
+	float4 nullFraction;
+	int32 averageWidth;
+	float4 distinctCount;
+	WeightedValue *commonValueArray;
+	int commonValueCount;
+	WeightedValue *histogramBoundArray;
+	int histogramBoundCount;
+} ColumnStatistics;
+
+
+/* Config variables managed via guc.c */
+int ColumnStatisticsInterval = -1; /* in milliseconds, -1 to disable */
+
+
+static TupleDesc ShardColumnStatisticsTupleDesc(void);
+static List * ShardColumnStatisticsTaskList(Oid relationId);
+static void AddShardColumnStatistics(Oid relationId, HTAB *columnStatisticsHash,
+									 double shardRowCount, Datum *values, bool *isNulls);
+static bool SortableColumnType(TypeCacheEntry *typeEntry);
+static Datum * DeconstructStatisticsArray(char *arrayString, Oid elementTypeId,
+										  int *elementCount);
+static void MergeColumnStatistics(ColumnStatistics *columnStatistics);
+static void MergeCommonValues(ColumnStatistics *columnStatistics,
+							  double nonNullRowCount, double distinctCount);
+static void MergeHistogramBounds(ColumnStatistics *columnStatistics);
+static WeightedValue * WeightedValueArray(List *weightedValueList);
+static int CompareWeightedValues(const void *leftElement, const void *rightElement,
+								 void *context);
+static int CompareWeightedValueWeights(const void *leftElement,
+									   const void *rightElement);
+static void StoreColumnStatistics(Oid relationId, bool inherited,
+								  ColumnStatistics *columnStatistics);
+static void StoreRelationStatistics(Oid relationId, double rowCount, int32 pageCount);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(master_update_column_statistics);
+
+
+/*
+ * master_update_column_statistics merges the column statistics of the shards
+ * of the given distributed table into the coordinator's catalog.
+ */
+Datum
+master_update_column_statistics(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+	EnsureTableOwner(relationId);
+
+	if (!IsDistributedTable(relationId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+						errmsg("table \"%s\" is not distributed",
+							   get_rel_name(relationId))));
+	}
+
+	/* ANALYZE takes the same lock, and we overwrite what it stores */
+	LockRelationOid(relationId, ShareUpdateExclusiveLock);
+
+	UpdateColumnStatistics(relationId);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * UpdateAllColumnStatistics merges the column statistics of the shards of all
+ * distributed tables, and returns the number of tables it updated. Tables that
+ * are locked by other commands are skipped, and a table whose update fails
+ * only causes a warning. It is called by the maintenance daemon.
+ */
+int
+UpdateAllColumnStatistics(void)
+{
+	List *distTableCacheEntryList = NIL;
+	ListCell *distTableCacheEntryCell = NULL;
+	volatile int updatedTableCount = 0;
+
+	/* the maintenance daemon does not have a snapshot for running queries */
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	distTableCacheEntryList = DistributedTableList();
+
+	foreach(distTableCacheEntryCell, distTableCacheEntryList)
+	{
+		DistTableCacheEntry *cacheEntry =
+			(DistTableCacheEntry *) lfirst(distTableCacheEntryCell);
+		Oid relationId = cacheEntry->relationId;
+		MemoryContext savedContext = CurrentMemoryContext;
+		ResourceOwner savedOwner = CurrentResourceOwner;
+
+		if (!ConditionalLockRelationOid(relationId, ShareUpdateExclusiveLock))
+		{
+			ereport(DEBUG1, (errmsg("could not lock table %u, skipping its column "
+									"statistics", relationId)));
+			continue;
+		}
+
+		/* the table may have been dropped since we read the metadata */
+		if (get_rel_name(relationId) == NULL)
+		{
+			continue;
+		}
+
+		BeginInternalSubTransaction(NULL);
+
+		PG_TRY();
+		{
+			UpdateColumnStatistics(relationId);
+			updatedTableCount++;
+
+			ReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(savedContext);
+			CurrentResourceOwner = savedOwner;
+		}
+		PG_CATCH();
+		{
+			ErrorData *edata = NULL;
+
+			MemoryContextSwitchTo(savedContext);
+			edata = CopyErrorData();
+			FlushErrorState();
+
+			RollbackAndReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(savedContext);
+			CurrentResourceOwner = savedOwner;
+
+			/* rethrow as WARNING */
+			edata->elevel = WARNING;
+			ThrowErrorData(edata);
+		}
+		PG_END_TRY();
+	}
+
+	PopActiveSnapshot();
+
+	return updatedTableCount;
+}
+
+
+/*
+ * UpdateColumnStatistics queries the statistics of all shards of the given
+ * table at once, each from one of its placements, merges them per column and
+ * stores them for the table in pg_statistic and pg_class. Shards that have
+ * never been analyzed report no rows and do not contribute. Columns without
+ * statistics on any shard keep their current statistics.
+ */
+void
+UpdateColumnStatistics(Oid relationId)
+{
+	List *taskList = ShardColumnStatisticsTaskList(relationId);
+	TaskListResult *taskListResult = palloc0(sizeof(TaskListResult));
+	TupleDesc tupleDescriptor = NULL;
+	TupleTableSlot *tupleSlot = NULL;
+	HTAB *shardStatisticsHash = NULL;
+	HTAB *columnStatisticsHash = NULL;
+	HASHCTL info;
+	HASH_SEQ_STATUS status;
+	ShardStatistics *shardStatistics = NULL;
+	ColumnStatistics *columnStatistics = NULL;
+	Var *partitionKey = DistPartitionKey(relationId);
+	bool inherited = PartitionedTable(relationId);
+	double rowCount = 0.0;
+	int32 pageCount = 0;
+
+	if (taskList == NIL)
+	{
+		return;
+	}
+
+	tupleDescriptor = ShardColumnStatisticsTupleDesc();
+
+	taskListResult->taskList = taskList;
+	taskListResult->tupleDescriptor = tupleDescriptor;
+	taskListResult->tupleStore = NULL;
+
+	ExecuteTaskListsIntoTupleStores(list_make1(taskListResult));
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint64);
+	info.entrysize = sizeof(ShardStatistics);
+	info.hcxt = CurrentMemoryContext;
+	shardStatisticsHash = hash_create("Shard Statistics Hash", 32, &info,
+									  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = NAMEDATALEN;
+	info.entrysize = sizeof(ColumnStatistics);
+	info.hcxt = CurrentMemoryContext;
+	columnStatisticsHash = hash_create("Column Statistics Hash", 32, &info,
+									   HASH_ELEM | HASH_CONTEXT);
+
+	tupleSlot = MakeSingleTupleTableSlot(tupleDescriptor);
+
+	while (tuplestore_gettupleslot(taskListResult->tupleStore, true, false, tupleSlot))
+	{
+		Datum values[SHARD_COLUMN_STATISTICS_COLUMNS];
+		bool isNulls[SHARD_COLUMN_STATISTICS_COLUMNS];
+		uint64 shardId = INVALID_SHARD_ID;
+		double shardRowCount = 0.0;
+		bool found = false;
+
+		slot_getallattrs(tupleSlot);
+		memcpy(values, tupleSlot->tts_values, sizeof(values));
+		memcpy(isNulls, tupleSlot->tts_isnull, sizeof(isNulls));
+
+		if (isNulls[0] || isNulls[1] || isNulls[2])
+		{
+			continue;
+		}
+
+		shardId = DatumGetInt64(values[0]);
+		shardRowCount = DatumGetFloat4(values[1]);
+
+		/* the shard's row and page counts are repeated for every column */
+		shardStatistics = hash_search(shardStatisticsHash, &shardId, HASH_ENTER,
+									  &found);
+		if (!found)
+		{
+			shardStatistics->rowCount = shardRowCount;
+			shardStatistics->pageCount = DatumGetInt32(values[2]);
+		}
+
+		/* empty and unanalyzed shards say nothing about the columns */
+		if (shardRowCount <= 0 || isNulls[3])
+		{
+			continue;
+		}
+
+		AddShardColumnStatistics(relationId, columnStatisticsHash, shardRowCount,
+								 values, isNulls);
+	}
+
+	ExecDropSingleTupleTableSlot(tupleSlot);
+	tuplestore_end(taskListResult->tupleStore);
+
+	hash_seq_init(&status, shardStatisticsHash);
+	while ((shardStatistics = hash_seq_search(&status)) != NULL)
+	{
+		rowCount += shardStatistics->rowCount;
+		pageCount += shardStatistics->pageCount;
+	}
+
+	hash_seq_init(&status, columnStatisticsHash);
+	while ((columnStatistics = hash_seq_search(&status)) != NULL)
+	{
+		if (columnStatistics->attributeNumber == InvalidAttrNumber)
+		{
+			continue;
+		}
+
+		columnStatistics->distributionColumn =
+			(partitionKey != NULL &&
+			 partitionKey->varattno == columnStatistics->attributeNumber);
+
+		MergeColumnStatistics(columnStatistics);
+		StoreColumnStatistics(relationId, inherited, columnStatistics);
+	}
+
+	StoreRelationStatistics(relationId, rowCount, pageCount);
+
+	hash_destroy(shardStatisticsHash);
+	hash_destroy(columnStatisticsHash);
+
+	CommandCounterIncrement();
+}
+
+
+/*
+ * RelationRowCount returns the number of rows of the given table according to
+ * pg_class. For distributed tables, this is the number of rows that the last
+ * update of the column statistics found on the shards.
+ */
+double
+RelationRowCount(Oid relationId)
+{
+	HeapTuple classTuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relationId));
+	double rowCount = 0.0;
+
+	if (HeapTupleIsValid(classTuple))
+	{
+		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(classTuple);
+
+		rowCount = classForm->reltuples;
+
+		ReleaseSysCache(classTuple);
+	}
+
+	return rowCount;
+}
+
+
+/*
+ * ColumnDistinctCount returns the number of distinct values of the given column
+ * according to pg_statistic, or 0 if the column has no statistics.
+ */
+double
+ColumnDistinctCount(Oid relationId, AttrNumber attributeNumber)
+{
+	bool inherited = PartitionedTable(relationId);
+	HeapTuple statisticTuple = NULL;
+	double distinctCount = 0.0;
+
+	statisticTuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(relationId),
+									 Int16GetDatum(attributeNumber),
+									 BoolGetDatum(inherited));
+	if (!HeapTupleIsValid(statisticTuple))
+	{
+		return 0.0;
+	}
+
+	distinctCount = ((Form_pg_statistic) GETSTRUCT(statisticTuple))->stadistinct;
+
+	ReleaseSysCache(statisticTuple);
+
+	/* negative counts are a fraction of the rows */
+	if (distinctCount < 0)
+	{
+		distinctCount = -distinctCount * RelationRowCount(relationId);
+	}
+
+	return distinctCount;
+}
+
+
+/*
+ * ShardColumnStatisticsTupleDesc returns the tuple descriptor of the rows that
+ * SHARD_COLUMN_STATISTICS_QUERY returns.
+ */
+static TupleDesc
+ShardColumnStatisticsTupleDesc(void)
+{
+	bool hasOid = false;
+	TupleDesc tupleDescriptor = CreateTemplateTupleDesc(SHARD_COLUMN_STATISTICS_COLUMNS,
+														hasOid);
+
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 1, "shardid", INT8OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 2, "reltuples", FLOAT4OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 3, "relpages", INT4OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 4, "attname", TEXTOID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 5, "null_frac", FLOAT4OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 6, "avg_width", INT4OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 7, "n_distinct", FLOAT4OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 8, "most_common_vals", TEXTOID,
+					   -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 9, "most_common_freqs", TEXTOID,
+					   -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 10, "histogram_bounds", TEXTOID,
+					   -1, 0);
+
+	return tupleDescriptor;
+}
+
+
+/*
+ * ShardColumnStatisticsTaskList returns a task per shard of the given table
+ * that queries the statistics of the shard.
+ */
+static List *
+ShardColumnStatisticsTaskList(Oid relationId)
+{
+	List *shardIntervalList = LoadShardIntervalList(relationId);
+	ListCell *shardIntervalCell = NULL;
+	char *relationName = get_rel_name(relationId);
+	Oid schemaId = get_rel_namespace(relationId);
+	char *schemaName = get_namespace_name(schemaId);
+	List *taskList = NIL;
+	uint32 taskId = 1;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		char *shardName = pstrdup(relationName);
+		char *quotedShardName = NULL;
+		StringInfo statisticsQuery = makeStringInfo();
+		Task *task = NULL;
+
+		AppendShardIdToName(&shardName, shardId);
+		quotedShardName = quote_literal_cstr(quote_qualified_identifier(schemaName,
+																		shardName));
+
+		appendStringInfo(statisticsQuery, SHARD_COLUMN_STATISTICS_QUERY, shardId,
+						 quotedShardName);
+
+		task = CreateBasicTask(INVALID_JOB_ID, taskId++, ROUTER_TASK,
+							   statisticsQuery->data);
+		task->anchorShardId = shardId;
+		task->taskPlacementList = FinalizedShardPlacementList(shardId);
+
+		taskList = lappend(taskList, task);
+	}
+
+	return taskList;
+}
+
+
+/*
+ * AddShardColumnStatistics adds the statistics of a column of a shard, given
+ * as a row of SHARD_COLUMN_STATISTICS_QUERY, to the column's statistics in the
+ * hash. Columns that no longer exist are marked with an invalid attribute
+ * number and skipped.
+ */
+static void
+AddShardColumnStatistics(Oid relationId, HTAB *columnStatisticsHash,
+						 double shardRowCount, Datum *values, bool *isNulls)
+{
+	char attributeName[NAMEDATALEN];
+	ColumnStatistics *columnStatistics = NULL;
+	double nullFraction = isNulls[4] ? 0.0 : DatumGetFloat4(values[4]);
+	double averageWidth = isNulls[5] ? 0.0 : DatumGetInt32(values[5]);
+	double distinctCount = isNulls[6] ? 0.0 : DatumGetFloat4(values[6]);
+	double nonNullRowCount = shardRowCount * (1.0 - nullFraction);
+	double commonFrequencySum = 0.0;
+	bool found = false;
+
+	memset(attributeName, 0, NAMEDATALEN);
+	strlcpy(attributeName, TextDatumGetCString(values[3]), NAMEDATALEN);
+
+	columnStatistics = hash_search(columnStatisticsHash, attributeName, HASH_ENTER,
+								   &found);
+	if (!found)
+	{
+		int32 typeModifier = -1;
+
+		memset(((char *) columnStatistics) + NAMEDATALEN, 0,
+			   sizeof(ColumnStatistics) - NAMEDATALEN);
+
+		columnStatistics->attributeNumber = get_attnum(relationId, attributeName);
+		if (columnStatistics->attributeNumber != InvalidAttrNumber)
+		{
+			get_atttypetypmodcoll(relationId, columnStatistics->attributeNumber,
+								  &columnStatistics->typeId, &typeModifier,
+								  &columnStatistics->collationId);
+			columnStatistics->typeEntry =
+				lookup_type_cache(columnStatistics->typeId,
+								  TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR |
+								  TYPECACHE_CMP_PROC_FINFO);
+		}
+
+		columnStatistics->distinctUnique = true;
+	}
+
+	if (columnStatistics->attributeNumber == InvalidAttrNumber)
+	{
+		return;
+	}
+
+	columnStatistics->rowCount += shardRowCount;
+	columnStatistics->nullCount += shardRowCount * nullFraction;
+	columnStatistics->widthSum += nonNullRowCount * averageWidth;
+
+	/* ANALYZE stores -1 for unique columns */
+	if (distinctCount != -1.0)
+	{
+		columnStatistics->distinctUnique = false;
+	}
+
+	/* negative distinct counts are a fraction of the rows */
+	if (distinctCount < 0)
+	{
+		distinctCount = -distinctCount * shardRowCount;
+	}
+
+	columnStatistics->distinctSum += distinctCount;
+	columnStatistics->distinctMax = Max(columnStatistics->distinctMax, distinctCount);
+
+	if (!SortableColumnType(columnStatistics->typeEntry))
+	{
+		return;
+	}
+
+	if (!isNulls[7] && !isNulls[8])
+	{
+		int valueCount = 0;
+		int frequencyCount = 0;
+		Datum *valueArray = DeconstructStatisticsArray(TextDatumGetCString(values[7]),
+													   columnStatistics->typeId,
+													   &valueCount);
+		Datum *frequencyArray =
+			DeconstructStatisticsArray(TextDatumGetCString(values[8]), FLOAT4OID,
+									   &frequencyCount);
+		int valueIndex = 0;
+
+		for (valueIndex = 0; valueIndex < Min(valueCount, frequencyCount); valueIndex++)
+		{
+			WeightedValue *commonValue = palloc0(sizeof(WeightedValue));
+			double frequency = DatumGetFloat4(frequencyArray[valueIndex]);
+
+			commonValue->value = valueArray[valueIndex];
+			commonValue->weight = frequency * shardRowCount;
+			commonFrequencySum += frequency;
+
+			columnStatistics->commonValueList =
+				lappend(columnStatistics->commonValueList, commonValue);
+		}
+	}
+
+	if (!isNulls[9])
+	{
+		int boundCount = 0;
+		Datum *boundArray = DeconstructStatisticsArray(TextDatumGetCString(values[9]),
+													   columnStatistics->typeId,
+													   &boundCount);
+		double histogramRowCount = 0.0;
+		int boundIndex = 0;
+
+		if (boundCount < 2)
+		{
+			return;
+		}
+
+		/* each bound stands for the rows of one bucket */
+		histogramRowCount = shardRowCount *
+							Max(1.0 - nullFraction - commonFrequencySum, 0.0);
+
+		for (boundIndex = 0; boundIndex < boundCount; boundIndex++)
+		{
+			WeightedValue *histogramValue = palloc0(sizeof(WeightedValue));
+
+			histogramValue->value = boundArray[boundIndex];
+			histogramValue->weight = histogramRowCount / (boundCount - 1);
+
+			columnStatistics->histogramValueList =
+				lappend(columnStatistics->histogramValueList, histogramValue);
+		}
+	}
+}
+
+
+/*
+ * SortableColumnType returns whether the most common values and histograms of
+ * a column of the given type can be merged. This requires a default btree
+ * operator class. Array columns are skipped, since their statistics hold the
+ * array elements.
+ */
+static bool
+SortableColumnType(TypeCacheEntry *typeEntry)
+{
+	if (typeEntry == NULL || type_is_array(typeEntry->type_id))
+	{
+		return false;
+	}
+
+	return OidIsValid(typeEntry->eq_opr) && OidIsValid(typeEntry->lt_opr) &&
+		   OidIsValid(typeEntry->cmp_proc_finfo.fn_oid);
+}
+
+
+/*
+ * DeconstructStatisticsArray parses the text representation of an array of the
+ * given element type, as pg_stats shows it, and returns its elements.
+ */
+static Datum *
+DeconstructStatisticsArray(char *arrayString, Oid elementTypeId, int *elementCount)
+{
+	Datum arrayDatum = OidFunctionCall3(F_ARRAY_IN, CStringGetDatum(arrayString),
+										ObjectIdGetDatum(elementTypeId),
+										Int32GetDatum(-1));
+	ArrayType *array = DatumGetArrayTypeP(arrayDatum);
+	Datum *elementArray = NULL;
+	int16 typeLength = 0;
+	bool typeByValue = false;
+	char typeAlignment = 0;
+
+	get_typlenbyvalalign(elementTypeId, &typeLength, &typeByValue, &typeAlignment);
+	deconstruct_array(array, elementTypeId, typeLength, typeByValue, typeAlignment,
+					  &elementArray, NULL, elementCount);
+
+	return elementArray;
+}
+
+
+/*
+ * MergeColumnStatistics computes the statistics of the table's column from the
+ * statistics of the shards that were accumulated.
+ */
+static void
+MergeColumnStatistics(ColumnStatistics *columnStatistics)
+{
+	double rowCount = columnStatistics->rowCount;
+	double nonNullRowCount = Max(rowCount - columnStatistics->nullCount, 0.0);
+	double distinctCount = 0.0;
+
+	columnStatistics->nullFraction = (float4) (columnStatistics->nullCount / rowCount);
+
+	if (nonNullRowCount > 0)
+	{
+		columnStatistics->averageWidth =
+			(int32) rint(columnStatistics->widthSum / nonNullRowCount);
+	}
+
+	/*
+	 * Shards hold disjoint values of the distribution column. Other columns
+	 * may have the same values on all shards, so we take the largest count,
+	 * unless the values are unique on every shard, which usually means they
+	 * are unique across shards, like identifiers.
+	 */
+	if (columnStatistics->distributionColumn ||
+		columnStatistics->distinctUnique)
+	{
+		distinctCount = columnStatistics->distinctSum;
+	}
+	else
+	{
+		distinctCount = columnStatistics->distinctMax;
+	}
+
+	distinctCount = Min(distinctCount, nonNullRowCount);
+
+	/* like ANALYZE, we store large distinct counts as a fraction of the rows */
+	if (distinctCount > DISTINCT_FRACTION_THRESHOLD * rowCount)
+	{
+		columnStatistics->distinctCount = (float4) Max(-distinctCount / rowCount, -1.0);
+	}
+	else
+	{
+		columnStatistics->distinctCount = (float4) distinctCount;
+	}
+
+	MergeCommonValues(columnStatistics, nonNullRowCount, distinctCount);
+	MergeHistogramBounds(columnStatistics);
+}
+
+
+/*
+ * MergeCommonValues adds up the rows of the most common values of the shards
+ * by value, and keeps up to default_statistics_target values that are more
+ * common than the average value, most common first. Like ANALYZE, we keep all
+ * values if they are all the distinct values of the column.
+ */
+static void
+MergeCommonValues(ColumnStatistics *columnStatistics, double nonNullRowCount,
+				  double distinctCount)
+{
+	List *commonValueList = columnStatistics->commonValueList;
+	int valueCount = list_length(commonValueList);
+	WeightedValue *valueArray = NULL;
+	ValueSortContext sortContext;
+	double averageWeight = 0.0;
+	int mergedCount = 0;
+	int valueIndex = 0;
+
+	if (valueCount == 0)
+	{
+		return;
+	}
+
+	valueArray = WeightedValueArray(commonValueList);
+
+	sortContext.compareFunction = &columnStatistics->typeEntry->cmp_proc_finfo;
+	sortContext.collationId = columnStatistics->collationId;
+	qsort_arg(valueArray, valueCount, sizeof(WeightedValue), CompareWeightedValues,
+			  &sortContext);
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (mergedCount > 0 &&
+			CompareWeightedValues(&valueArray[mergedCount - 1], &valueArray[valueIndex],
+								  &sortContext) == 0)
+		{
+			valueArray[mergedCount - 1].weight += valueArray[valueIndex].weight;
+		}
+		else
+		{
+			valueArray[mergedCount++] = valueArray[valueIndex];
+		}
+	}
+
+	qsort(valueArray, mergedCount, sizeof(WeightedValue), CompareWeightedValueWeights);
+
+	if (distinctCount > 0 &&
+		(mergedCount < distinctCount || mergedCount > default_statistics_target))
+	{
+		averageWeight = nonNullRowCount / distinctCount;
+	}
+
+	valueCount = 0;
+	while (valueCount < Min(mergedCount, default_statistics_target) &&
+		   valueArray[valueCount].weight > averageWeight)
+	{
+		valueCount++;
+	}
+
+	columnStatistics->commonValueArray = valueArray;
+	columnStatistics->commonValueCount = valueCount;
+}
+
+
+/*
+ * MergeHistogramBounds picks up to default_statistics_target + 1 bounds from
+ * the histogram bounds of the shards, such that the buckets between them hold
+ * about the same number of rows.
+ */
+static void
+MergeHistogramBounds(ColumnStatistics *columnStatistics)
+{
+	List *histogramValueList = columnStatistics->histogramValueList;
+	int valueCount = list_length(histogramValueList);
+	WeightedValue *valueArray = NULL;
+	WeightedValue *boundArray = NULL;
+	ValueSortContext sortContext;
+	double totalWeight = 0.0;
+	double cumulativeWeight = 0.0;
+	int targetBoundCount = Min(valueCount, default_statistics_target + 1);
+	int boundCount = 0;
+	int valueIndex = 0;
+
+	if (targetBoundCount < 2)
+	{
+		return;
+	}
+
+	valueArray = WeightedValueArray(histogramValueList);
+
+	sortContext.compareFunction = &columnStatistics->typeEntry->cmp_proc_finfo;
+	sortContext.collationId = columnStatistics->collationId;
+	qsort_arg(valueArray, valueCount, sizeof(WeightedValue), CompareWeightedValues,
+			  &sortContext);
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		totalWeight += valueArray[valueIndex].weight;
+	}
+
+	boundArray = palloc0(targetBoundCount * sizeof(WeightedValue));
+
+	/* the first and last bounds are the lowest and highest values */
+	boundArray[boundCount++] = valueArray[0];
+
+	for (valueIndex = 1; valueIndex < valueCount - 1; valueIndex++)
+	{
+		double nextBoundWeight = totalWeight * boundCount / (targetBoundCount - 1);
+
+		cumulativeWeight += valueArray[valueIndex].weight;
+
+		if (boundCount < targetBoundCount - 1 && cumulativeWeight >= nextBoundWeight &&
+			CompareWeightedValues(&boundArray[boundCount - 1], &valueArray[valueIndex],
+								  &sortContext) < 0)
+		{
+			boundArray[boundCount++] = valueArray[valueIndex];
+		}
+	}
+
+	if (CompareWeightedValues(&boundArray[boundCount - 1], &valueArray[valueCount - 1],
+							  &sortContext) < 0)
+	{
+		boundArray[boundCount++] = valueArray[valueCount - 1];
+	}
+
+	if (boundCount < 2)
+	{
+		return;
+	}
+
+	columnStatistics->histogramBoundArray = boundArray;
+	columnStatistics->histogramBoundCount = boundCount;
+}
+
+
+/*
+ * WeightedValueArray copies the weighted values in the given list into an
+ * array, for sorting.
+ */
+static WeightedValue *
+WeightedValueArray(List *weightedValueList)
+{
+	WeightedValue *weightedValueArray =
+		palloc0(list_length(weightedValueList) * sizeof(WeightedValue));
+	ListCell *weightedValueCell = NULL;
+	int valueIndex = 0;
+
+	foreach(weightedValueCell, weightedValueList)
+	{
+		WeightedValue *weightedValue = (WeightedValue *) lfirst(weightedValueCell);
+
+		weightedValueArray[valueIndex++] = *weightedValue;
+	}
+
+	return weightedValueArray;
+}
+
+
+/* CompareWeightedValues orders weighted values by value */
+static int
+CompareWeightedValues(const void *leftElement, const void *rightElement, void *context)
+{
+	const WeightedValue *leftValue = (const WeightedValue *) leftElement;
+	const WeightedValue *rightValue = (const WeightedValue *) rightElement;
+	ValueSortContext *sortContext = (ValueSortContext *) context;
+	Datum comparison = FunctionCall2Coll(sortContext->compareFunction,
+										 sortContext->collationId,
+										 leftValue->value, rightValue->value);
+
+	return DatumGetInt32(comparison);
+}
+
+
+/* CompareWeightedValueWeights orders weighted values by weight, largest first */
+static int
+CompareWeightedValueWeights(const void *leftElement, const void *rightElement)
+{
+	const WeightedValue *leftValue = (const WeightedValue *) leftElement;
+	const WeightedValue *rightValue = (const WeightedValue *) rightElement;
+
+	if (leftValue->weight > rightValue->weight)
+	{
+		return -1;
+	}
+	else if (leftValue->weight < rightValue->weight)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * StoreColumnStatistics writes the merged statistics of a column into the
+ * pg_statistic row of the given table, in the slots that ANALYZE would use.
+ */
+static void
+StoreColumnStatistics(Oid relationId, bool inherited, ColumnStatistics *columnStatistics)
+{
+	Relation pgStatistic = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple oldTuple = NULL;
+	HeapTuple newTuple = NULL;
+	Datum values[Natts_pg_statistic];
+	bool isNulls[Natts_pg_statistic];
+	bool replace[Natts_pg_statistic];
+	TypeCacheEntry *typeEntry = columnStatistics->typeEntry;
+	int16 typeLength = 0;
+	bool typeByValue = false;
+	char typeAlignment = 0;
+	int slotIndex = 0;
+	int valueIndex = 0;
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+	memset(replace, true, sizeof(replace));
+
+	values[Anum_pg_statistic_starelid - 1] = ObjectIdGetDatum(relationId);
+	values[Anum_pg_statistic_staattnum - 1] =
+		Int16GetDatum(columnStatistics->attributeNumber);
+	values[Anum_pg_statistic_stainherit - 1] = BoolGetDatum(inherited);
+	values[Anum_pg_statistic_stanullfrac - 1] =
+		Float4GetDatum(columnStatistics->nullFraction);
+	values[Anum_pg_statistic_stawidth - 1] =
+		Int32GetDatum(columnStatistics->averageWidth);
+	values[Anum_pg_statistic_stadistinct - 1] =
+		Float4GetDatum(columnStatistics->distinctCount);
+
+	for (slotIndex = 0; slotIndex < STATISTIC_NUM_SLOTS; slotIndex++)
+	{
+		values[Anum_pg_statistic_stakind1 - 1 + slotIndex] = Int16GetDatum(0);
+		values[Anum_pg_statistic_staop1 - 1 + slotIndex] = ObjectIdGetDatum(InvalidOid);
+		isNulls[Anum_pg_statistic_stanumbers1 - 1 + slotIndex] = true;
+		isNulls[Anum_pg_statistic_stavalues1 - 1 + slotIndex] = true;
+	}
+
+	get_typlenbyvalalign(columnStatistics->typeId, &typeLength, &typeByValue,
+						 &typeAlignment);
+
+	slotIndex = 0;
+
+	if (columnStatistics->commonValueCount > 0)
+	{
+		int valueCount = columnStatistics->commonValueCount;
+		Datum *valueArray = palloc0(valueCount * sizeof(Datum));
+		Datum *frequencyArray = palloc0(valueCount * sizeof(Datum));
+
+		for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+		{
+			WeightedValue *commonValue = &columnStatistics->commonValueArray[valueIndex];
+
+			valueArray[valueIndex] = commonValue->value;
+			frequencyArray[valueIndex] =
+				Float4GetDatum(commonValue->weight / columnStatistics->rowCount);
+		}
+
+		values[Anum_pg_statistic_stakind1 - 1 + slotIndex] =
+			Int16GetDatum(STATISTIC_KIND_MCV);
+		values[Anum_pg_statistic_staop1 - 1 + slotIndex] =
+			ObjectIdGetDatum(typeEntry->eq_opr);
+		values[Anum_pg_statistic_stanumbers1 - 1 + slotIndex] =
+			PointerGetDatum(construct_array(frequencyArray, valueCount, FLOAT4OID,
+											sizeof(float4), FLOAT4PASSBYVAL, 'i'));
+		isNulls[Anum_pg_statistic_stanumbers1 - 1 + slotIndex] = false;
+		values[Anum_pg_statistic_stavalues1 - 1 + slotIndex] =
+			PointerGetDatum(construct_array(valueArray, valueCount,
+											columnStatistics->typeId, typeLength,
+											typeByValue, typeAlignment));
+		isNulls[Anum_pg_statistic_stavalues1 - 1 + slotIndex] = false;
+		slotIndex++;
+	}
+
+	if (columnStatistics->histogramBoundCount > 0)
+	{
+		int boundCount = columnStatistics->histogramBoundCount;
+		Datum *boundArray = palloc0(boundCount * sizeof(Datum));
+
+		for (valueIndex = 0; valueIndex < boundCount; valueIndex++)
+		{
+			boundArray[valueIndex] = columnStatistics->histogramBoundArray[valueIndex].value;
+		}
+
+		values[Anum_pg_statistic_stakind1 - 1 + slotIndex] =
+			Int16GetDatum(STATISTIC_KIND_HISTOGRAM);
+		values[Anum_pg_statistic_staop1 - 1 + slotIndex] =
+			ObjectIdGetDatum(typeEntry->lt_opr);
+		values[Anum_pg_statistic_stavalues1 - 1 + slotIndex] =
+			PointerGetDatum(construct_array(boundArray, boundCount,
+											columnStatistics->typeId, typeLength,
+											typeByValue, typeAlignment));
+		isNulls[Anum_pg_statistic_stavalues1 - 1 + slotIndex] = false;
+		slotIndex++;
+	}
+
+	pgStatistic = heap_open(StatisticRelationId, RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgStatistic);
+
+	oldTuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(relationId),
+							   Int16GetDatum(columnStatistics->attributeNumber),
+							   BoolGetDatum(inherited));
+	if (HeapTupleIsValid(oldTuple))
+	{
+		newTuple = heap_modify_tuple(oldTuple, tupleDescriptor, values, isNulls,
+									 replace);
+		ReleaseSysCache(oldTuple);
+
+		CatalogTupleUpdate(pgStatistic, &newTuple->t_self, newTuple);
+	}
+	else
+	{
+		newTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+		CatalogTupleInsert(pgStatistic, newTuple);
+	}
+
+	heap_freetuple(newTuple);
+	heap_close(pgStatistic, RowExclusiveLock);
+}
+
+
+/*
+ * StoreRelationStatistics stores the given row and page counts of a table in
+ * pg_class. Unlike ANALYZE, which updates pg_class in place, we update the row
+ * transactionally such that it can be rolled back with the column statistics.
+ */
+static void
+StoreRelationStatistics(Oid relationId, double rowCount, int32 pageCount)
+{
+	Relation pgClass = heap_open(RelationRelationId, RowExclusiveLock);
+	HeapTuple classTuple = SearchSysCacheCopy1(RELOID, ObjectIdGetDatum(relationId));
+	Form_pg_class classForm = NULL;
+
+	if (!HeapTupleIsValid(classTuple))
+	{
+		ereport(ERROR, (errmsg("could not find pg_class entry for relation %u",
+							   relationId)));
+	}
+
+	classForm = (Form_pg_class) GETSTRUCT(classTuple);
+	classForm->reltuples = (float4) rowCount;
+	classForm->relpages = pageCount;
+
+	CatalogTupleUpdate(pgClass, &classTuple->t_self, classTuple);
+
+	heap_freetuple(classTuple);
+	heap_close(pgClass, RowExclusiveLock);
+}
@@ -21,6 +21,7 @@
 #include "distributed/connection_management.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/node_fanout.h"
 #include "distributed/remote_commands.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
@@ -30,6 +31,17 @@
 #include "distributed/multi_client_executor.h"
 
 
+/*
+ * CommandResultArrays points to the arrays in which the status and result of
+ * commands that run in parallel are stored.
+ */
+typedef struct CommandResultArrays
+{
+	bool *statusArray;
+	StringInfo *resultStringArray;
+} CommandResultArrays;
+
+
 PG_FUNCTION_INFO_V1(master_run_on_worker);
 
 static int ParseCommandParameters(FunctionCallInfo fcinfo, StringInfo **nodeNameArray,
@@ -41,8 +53,8 @@ static void ExecuteCommandsInParallelAndStoreResults(StringInfo *nodeNameArray,
 													 bool *statusArray,
 													 StringInfo *resultStringArray,
 													 int commmandCount);
-static bool GetConnectionStatusAndResult(MultiConnection *connection, bool *resultStatus,
-										 StringInfo queryResultString);
+static void StoreCommandResult(NodeCommandList *nodeCommandList, PGresult *queryResult,
+							   void *callbackContext);
 static bool EvaluateQueryResult(MultiConnection *connection, PGresult *queryResult,
 								StringInfo queryResultString);
 static void StoreErrorMessage(MultiConnection *connection, StringInfo queryResultString);
@@ -216,7 +228,9 @@ ParseCommandParameters(FunctionCallInfo fcinfo, StringInfo **nodeNameArray,
  * nodeNameArray and nodePortArray, and executes command in commandStringArray
  * in parallel fashion. Execution success status and result is reported for
  * each command in statusArray and resultStringArray. Each array contains
- * commandCount items.
+ * commandCount items. Up to citus.max_node_command_concurrency commands run
+ * at a time, and the connection of each command is closed as soon as the
+ * command finished.
  */
 static void
 ExecuteCommandsInParallelAndStoreResults(StringInfo *nodeNameArray, int *nodePortArray,
@@ -225,150 +239,75 @@ ExecuteCommandsInParallelAndStoreResults(StringInfo *nodeNameArray, int *nodePor
 										 int commmandCount)
 {
 	int commandIndex = 0;
-	MultiConnection **connectionArray =
-		palloc0(commmandCount * sizeof(MultiConnection *));
-	int finishedCount = 0;
+	List *nodeCommandListList = NIL;
+	ListCell *nodeCommandListCell = NULL;
+	int connectionFlags = FORCE_NEW_CONNECTION;
+	bool useTransaction = false;
+	CommandResultArrays resultArrays;
 
-	/* establish connections */
 	for (commandIndex = 0; commandIndex < commmandCount; commandIndex++)
 	{
 		char *nodeName = nodeNameArray[commandIndex]->data;
 		int nodePort = nodePortArray[commandIndex];
-		int connectionFlags = FORCE_NEW_CONNECTION;
-		MultiConnection *connection =
-			GetNodeConnection(connectionFlags, nodeName, nodePort);
-		StringInfo queryResultString = resultStringArray[commandIndex];
-
-		statusArray[commandIndex] = true;
-
-		if (PQstatus(connection->pgConn) != CONNECTION_OK)
-		{
-			appendStringInfo(queryResultString, "failed to connect to %s:%d", nodeName,
-							 (int) nodePort);
-			statusArray[commandIndex] = false;
-			finishedCount++;
-		}
-		else
-		{
-			connectionArray[commandIndex] = connection;
-		}
-	}
-
-	/* send queries at once */
-	for (commandIndex = 0; commandIndex < commmandCount; commandIndex++)
-	{
-		int querySent = 0;
-		MultiConnection *connection = connectionArray[commandIndex];
 		char *queryString = commandStringArray[commandIndex]->data;
-		StringInfo queryResultString = resultStringArray[commandIndex];
-
-		/*
-		 * If we don't have a connection, nothing to send, error string should already
-		 * been filled.
-		 */
-		if (connection == NULL)
-		{
-			continue;
-		}
+		NodeCommandList *nodeCommandList =
+			MakeNodeCommandList(nodeName, nodePort, list_make1(queryString));
 
-		querySent = SendRemoteCommand(connection, queryString);
-		if (querySent == 0)
-		{
-			StoreErrorMessage(connection, queryResultString);
-			statusArray[commandIndex] = false;
-			CloseConnection(connection);
-			connectionArray[commandIndex] = NULL;
-			finishedCount++;
-		}
+		nodeCommandListList = lappend(nodeCommandListList, nodeCommandList);
 	}
 
-	/* check for query results */
-	while (finishedCount < commmandCount)
-	{
-		for (commandIndex = 0; commandIndex < commmandCount; commandIndex++)
-		{
-			MultiConnection *connection = connectionArray[commandIndex];
-			StringInfo queryResultString = resultStringArray[commandIndex];
-			bool success = false;
-			bool queryFinished = false;
-
-			if (connection == NULL)
-			{
-				continue;
-			}
-
-			queryFinished = GetConnectionStatusAndResult(connection, &success,
-														 queryResultString);
+	resultArrays.statusArray = statusArray;
+	resultArrays.resultStringArray = resultStringArray;
 
-			if (queryFinished)
-			{
-				finishedCount++;
-				statusArray[commandIndex] = success;
-				connectionArray[commandIndex] = NULL;
-				CloseConnection(connection);
-			}
-		}
+	/* nodes are numbered in the order of the list, which matches the arrays */
+	ExecuteNodeCommandLists(nodeCommandListList, connectionFlags, NULL,
+							useTransaction, StoreCommandResult, &resultArrays);
 
-		CHECK_FOR_INTERRUPTS();
+	foreach(nodeCommandListCell, nodeCommandListList)
+	{
+		NodeCommandList *nodeCommandList =
+			(NodeCommandList *) lfirst(nodeCommandListCell);
 
-		if (finishedCount < commmandCount)
+		if (!nodeCommandList->success)
 		{
-			long sleepIntervalPerCycle = RemoteTaskCheckInterval * 1000L;
-			pg_usleep(sleepIntervalPerCycle);
+			statusArray[nodeCommandList->nodeIndex] = false;
 		}
 	}
-
-	pfree(connectionArray);
 }
 
 
 /*
- * GetConnectionStatusAndResult checks the active connection and returns true if
- * query execution is finished (either success or fail).
- * Query success/fail in resultStatus, and query result in queryResultString are
- * reported upon completion of the query.
+ * StoreCommandResult is the result callback of commands that run in parallel,
+ * which stores the status and result of a command in the result arrays as soon
+ * as it arrives.
  */
-static bool
-GetConnectionStatusAndResult(MultiConnection *connection, bool *resultStatus,
-							 StringInfo queryResultString)
+static void
+StoreCommandResult(NodeCommandList *nodeCommandList, PGresult *queryResult,
+				   void *callbackContext)
 {
-	bool finished = true;
-	ConnStatusType connectionStatus = PQstatus(connection->pgConn);
-	int consumeInput = 0;
-	PGresult *queryResult = NULL;
-	bool success = false;
+	CommandResultArrays *resultArrays = (CommandResultArrays *) callbackContext;
+	int commandIndex = nodeCommandList->nodeIndex;
+	StringInfo queryResultString = resultArrays->resultStringArray[commandIndex];
+	MultiConnection *connection = nodeCommandList->connection;
 
-	*resultStatus = false;
 	resetStringInfo(queryResultString);
 
-	if (connectionStatus == CONNECTION_BAD)
+	if (queryResult != NULL)
 	{
-		appendStringInfo(queryResultString, "connection lost");
-		return finished;
+		resultArrays->statusArray[commandIndex] =
+			EvaluateQueryResult(connection, queryResult, queryResultString);
 	}
-
-	consumeInput = PQconsumeInput(connection->pgConn);
-	if (consumeInput == 0)
+	else if (!nodeCommandList->connectionEstablished)
 	{
-		appendStringInfo(queryResultString, "query result unavailable");
-		return finished;
+		appendStringInfo(queryResultString, "failed to connect to %s:%d",
+						 nodeCommandList->nodeName, (int) nodeCommandList->nodePort);
+		resultArrays->statusArray[commandIndex] = false;
 	}
-
-	/* check later if busy */
-	if (PQisBusy(connection->pgConn) != 0)
+	else
 	{
-		finished = false;
-		return finished;
+		StoreErrorMessage(connection, queryResultString);
+		resultArrays->statusArray[commandIndex] = false;
 	}
-
-	/* query result is available at this point */
-	queryResult = PQgetResult(connection->pgConn);
-	success = EvaluateQueryResult(connection, queryResult, queryResultString);
-	PQclear(queryResult);
-
-	*resultStatus = success;
-	finished = true;
-	return true;
 }
 
 
@@ -25,6 +25,7 @@
 
 #include "catalog/namespace.h"
 #include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
 #include "distributed/listutils.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
@@ -55,6 +56,13 @@
 PG_FUNCTION_INFO_V1(master_create_worker_shards);
 
 
+/* local function forward declarations */
+static ShardInterval * NewHashShardInterval(Oid relationId, uint64 shardId,
+											char storageType, int32 shardMinValue,
+											int32 shardMaxValue);
+static List * InsertedShardPlacementList(List *groupPlacementList);
+
+
 /*
  * master_create_worker_shards is a user facing function to create worker shards
  * for the given relation in round robin order.
@@ -70,12 +78,13 @@ master_create_worker_shards(PG_FUNCTION_ARGS)
 
 	/* do not add any data */
 	bool useExclusiveConnections = false;
+	bool deferIndexCreation = false;
 
 	EnsureCoordinator();
 	CheckCitusVersion(ERROR);
 
 	CreateShardsWithRoundRobinPolicy(distributedTableId, shardCount, replicationFactor,
-									 useExclusiveConnections);
+									 useExclusiveConnections, deferIndexCreation);
 
 	PG_RETURN_VOID();
 }
@@ -88,11 +97,14 @@ master_create_worker_shards(PG_FUNCTION_ARGS)
  * visible. Note that the function assumes the table is hash partitioned and
  * calculates the min/max hash token ranges for each shard, giving them an equal
  * split of the hash space. Finally, function creates empty shard placements on
- * worker nodes.
+ * worker nodes. With deferIndexCreation, the shards are created without their
+ * indexes and constraints, and the caller creates them after loading data by
+ * calling CreateShardIndexesOnWorkers.
  */
 void
 CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
-								 int32 replicationFactor, bool useExclusiveConnections)
+								 int32 replicationFactor, bool useExclusiveConnections,
+								 bool deferIndexCreation)
 {
 	char shardStorageType = 0;
 	List *workerNodeList = NIL;
@@ -103,6 +115,8 @@ CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
 	int64 shardIndex = 0;
 	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(distributedTableId);
 	bool colocatedShard = false;
+	List *shardIntervalList = NIL;
+	List *groupPlacementList = NIL;
 	List *insertedShardPlacements = NIL;
 
 	/* make sure table is hash partitioned */
@@ -196,12 +210,11 @@ CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
 		uint32 roundRobinNodeIndex = shardIndex % workerNodeCount;
 
 		/* initialize the hash token space for this shard */
-		text *minHashTokenText = NULL;
-		text *maxHashTokenText = NULL;
 		int32 shardMinHashToken = INT32_MIN + (shardIndex * hashTokenIncrement);
 		int32 shardMaxHashToken = shardMinHashToken + (hashTokenIncrement - 1);
 		uint64 shardId = GetNextShardId();
-		List *currentInsertedShardPlacements = NIL;
+		ShardInterval *shardInterval = NULL;
+		List *shardPlacementList = NIL;
 
 		/* if we are at the last shard, make sure the max token value is INT_MAX */
 		if (shardIndex == (shardCount - 1))
@@ -209,10 +222,6 @@ CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
 			shardMaxHashToken = INT32_MAX;
 		}
 
-		/* insert the shard metadata row along with its min/max values */
-		minHashTokenText = IntegerToText(shardMinHashToken);
-		maxHashTokenText = IntegerToText(shardMaxHashToken);
-
 		/*
 		 * Grabbing the shard metadata lock isn't technically necessary since
 		 * we already hold an exclusive lock on the partition table, but we'll
@@ -221,20 +230,29 @@ CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
 		 */
 		LockShardDistributionMetadata(shardId, ExclusiveLock);
 
-		InsertShardRow(distributedTableId, shardId, shardStorageType,
-					   minHashTokenText, maxHashTokenText);
+		shardInterval = NewHashShardInterval(distributedTableId, shardId,
+											 shardStorageType, shardMinHashToken,
+											 shardMaxHashToken);
+		shardIntervalList = lappend(shardIntervalList, shardInterval);
 
-		currentInsertedShardPlacements = InsertShardPlacementRows(distributedTableId,
-																  shardId,
-																  workerNodeList,
-																  roundRobinNodeIndex,
-																  replicationFactor);
-		insertedShardPlacements = list_concat(insertedShardPlacements,
-											  currentInsertedShardPlacements);
+		shardPlacementList = NewShardPlacementList(shardId, workerNodeList,
+												   roundRobinNodeIndex,
+												   replicationFactor);
+		groupPlacementList = list_concat(groupPlacementList, shardPlacementList);
 	}
 
+	/*
+	 * Insert the shard metadata rows along with their min/max values and their
+	 * placements in one go, such that we only invalidate the table once instead
+	 * of once per row.
+	 */
+	InsertShardRowList(shardIntervalList);
+	InsertShardPlacementRowList(distributedTableId, groupPlacementList);
+
+	insertedShardPlacements = InsertedShardPlacementList(groupPlacementList);
+
 	CreateShardsOnWorkers(distributedTableId, insertedShardPlacements,
-						  useExclusiveConnections, colocatedShard);
+						  useExclusiveConnections, colocatedShard, deferIndexCreation);
 
 	if (QueryCancelPending)
 	{
@@ -248,17 +266,20 @@ CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
 
 /*
  * CreateColocatedShards creates shards for the target relation colocated with
- * the source relation.
+ * the source relation, deferring the creation of their indexes the same way as
+ * CreateShardsWithRoundRobinPolicy.
  */
 void
 CreateColocatedShards(Oid targetRelationId, Oid sourceRelationId, bool
-					  useExclusiveConnections)
+					  useExclusiveConnections, bool deferIndexCreation)
 {
 	char targetShardStorageType = 0;
 	List *existingShardList = NIL;
 	List *sourceShardIntervalList = NIL;
 	ListCell *sourceShardCell = NULL;
 	bool colocatedShard = true;
+	List *shardIntervalList = NIL;
+	List *groupPlacementList = NIL;
 	List *insertedShardPlacements = NIL;
 
 	/* make sure that tables are hash partitioned */
@@ -304,37 +325,41 @@ CreateColocatedShards(Oid targetRelationId, Oid sourceRelationId, bool
 
 		int32 shardMinValue = DatumGetInt32(sourceShardInterval->minValue);
 		int32 shardMaxValue = DatumGetInt32(sourceShardInterval->maxValue);
-		text *shardMinValueText = IntegerToText(shardMinValue);
-		text *shardMaxValueText = IntegerToText(shardMaxValue);
 		List *sourceShardPlacementList = ShardPlacementList(sourceShardId);
+		ShardInterval *shardInterval = NULL;
 
-		InsertShardRow(targetRelationId, newShardId, targetShardStorageType,
-					   shardMinValueText, shardMaxValueText);
+		shardInterval = NewHashShardInterval(targetRelationId, newShardId,
+											 targetShardStorageType, shardMinValue,
+											 shardMaxValue);
+		shardIntervalList = lappend(shardIntervalList, shardInterval);
 
 		foreach(sourceShardPlacementCell, sourceShardPlacementList)
 		{
 			ShardPlacement *sourcePlacement =
 				(ShardPlacement *) lfirst(sourceShardPlacementCell);
-			uint32 groupId = sourcePlacement->groupId;
-			const RelayFileState shardState = FILE_FINALIZED;
-			const uint64 shardSize = 0;
-			uint64 shardPlacementId = 0;
-			ShardPlacement *shardPlacement = NULL;
-
-			/*
-			 * Optimistically add shard placement row the pg_dist_shard_placement, in case
-			 * of any error it will be roll-backed.
-			 */
-			shardPlacementId = InsertShardPlacementRow(newShardId, INVALID_PLACEMENT_ID,
-													   shardState, shardSize, groupId);
-
-			shardPlacement = LoadShardPlacement(newShardId, shardPlacementId);
-			insertedShardPlacements = lappend(insertedShardPlacements, shardPlacement);
+			GroupShardPlacement *placement = CitusMakeNode(GroupShardPlacement);
+
+			placement->placementId = INVALID_PLACEMENT_ID;
+			placement->shardId = newShardId;
+			placement->shardState = FILE_FINALIZED;
+			placement->shardLength = 0;
+			placement->groupId = sourcePlacement->groupId;
+
+			groupPlacementList = lappend(groupPlacementList, placement);
 		}
 	}
 
+	/*
+	 * Optimistically add the shard and shard placement rows, in case of any
+	 * error they will be rolled back.
+	 */
+	InsertShardRowList(shardIntervalList);
+	InsertShardPlacementRowList(targetRelationId, groupPlacementList);
+
+	insertedShardPlacements = InsertedShardPlacementList(groupPlacementList);
+
 	CreateShardsOnWorkers(targetRelationId, insertedShardPlacements,
-						  useExclusiveConnections, colocatedShard);
+						  useExclusiveConnections, colocatedShard, deferIndexCreation);
 }
 
 
@@ -344,7 +369,7 @@ CreateColocatedShards(Oid targetRelationId, Oid sourceRelationId, bool
  * Also, the shard is replicated to the all active nodes in the cluster.
  */
 void
-CreateReferenceTableShard(Oid distributedTableId)
+CreateReferenceTableShard(Oid distributedTableId, bool deferIndexCreation)
 {
 	char shardStorageType = 0;
 	List *workerNodeList = NIL;
@@ -410,7 +435,7 @@ CreateReferenceTableShard(Oid distributedTableId)
 													   replicationFactor);
 
 	CreateShardsOnWorkers(distributedTableId, insertedShardPlacements,
-						  useExclusiveConnection, colocatedShard);
+						  useExclusiveConnection, colocatedShard, deferIndexCreation);
 }
 
 
@@ -431,6 +456,56 @@ CheckHashPartitionedTable(Oid distributedTableId)
 }
 
 
+/*
+ * NewHashShardInterval returns a shard interval for a not yet inserted shard of
+ * a hash distributed table with the given hash token range.
+ */
+static ShardInterval *
+NewHashShardInterval(Oid relationId, uint64 shardId, char storageType,
+					 int32 shardMinValue, int32 shardMaxValue)
+{
+	ShardInterval *shardInterval = CitusMakeNode(ShardInterval);
+
+	shardInterval->relationId = relationId;
+	shardInterval->storageType = storageType;
+	shardInterval->valueTypeId = INT4OID;
+	shardInterval->valueTypeLen = sizeof(int32);
+	shardInterval->valueByVal = true;
+	shardInterval->minValueExists = true;
+	shardInterval->maxValueExists = true;
+	shardInterval->minValue = Int32GetDatum(shardMinValue);
+	shardInterval->maxValue = Int32GetDatum(shardMaxValue);
+	shardInterval->shardId = shardId;
+
+	return shardInterval;
+}
+
+
+/*
+ * InsertedShardPlacementList returns the shard placements for the given list
+ * of inserted group shard placements. Since the table is only invalidated once
+ * after all rows are inserted, we build its cache entry only once here.
+ */
+static List *
+InsertedShardPlacementList(List *groupPlacementList)
+{
+	List *insertedShardPlacements = NIL;
+	ListCell *groupPlacementCell = NULL;
+
+	foreach(groupPlacementCell, groupPlacementList)
+	{
+		GroupShardPlacement *groupPlacement =
+			(GroupShardPlacement *) lfirst(groupPlacementCell);
+		ShardPlacement *shardPlacement = LoadShardPlacement(groupPlacement->shardId,
+															groupPlacement->placementId);
+
+		insertedShardPlacements = lappend(insertedShardPlacements, shardPlacement);
+	}
+
+	return insertedShardPlacements;
+}
+
+
 /* Helper function to convert an integer value to a text type */
 text *
 IntegerToText(int32 value)
@@ -33,6 +33,7 @@
 #include "distributed/multi_logical_planner.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/multi_shard_transaction.h"
 #include "distributed/multi_utility.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
@@ -66,8 +67,6 @@ static void CheckDeleteCriteria(Node *deleteCriteria);
 static void CheckPartitionColumn(Oid relationId, Node *whereClause);
 static List * ShardsMatchingDeleteCriteria(Oid relationId, List *shardList,
 										   Node *deleteCriteria);
-static int DropShards(Oid relationId, char *schemaName, char *relationName,
-					  List *deletableShardIntervalList);
 
 
 /* exports for SQL callable functions */
@@ -295,10 +294,12 @@ master_drop_sequences(PG_FUNCTION_ARGS)
 
 	if (dropSeqCommand->len != 0)
 	{
+		List *commandList = NIL;
+
 		appendStringInfoString(dropSeqCommand, " CASCADE");
 
-		SendCommandToWorkers(WORKERS_WITH_METADATA, DISABLE_DDL_PROPAGATION);
-		SendCommandToWorkers(WORKERS_WITH_METADATA, dropSeqCommand->data);
+		commandList = list_make2(DISABLE_DDL_PROPAGATION, dropSeqCommand->data);
+		SendCommandListToWorkers(WORKERS_WITH_METADATA, commandList);
 	}
 
 	PG_RETURN_VOID();
@@ -340,13 +341,16 @@ CheckTableSchemaNameForDrop(Oid relationId, char **schemaName, char **tableName)
  * called when the table is already dropped.
  *
  * We mark shard placements that we couldn't drop as to be deleted later, but
- * we do delete the shard metadadata.
+ * we do delete the shard metadadata. The DROP commands for all placements that
+ * share a connection are sent as a single command, so tables with many shards
+ * are dropped in one round trip per connection.
  */
-static int
+int
 DropShards(Oid relationId, char *schemaName, char *relationName,
 		   List *deletableShardIntervalList)
 {
 	ListCell *shardIntervalCell = NULL;
+	List *commandBatchList = NIL;
 	int droppedShardCount = 0;
 
 	BeginOrContinueCoordinatedTransaction();
@@ -385,7 +389,7 @@ DropShards(Oid relationId, char *schemaName, char *relationName,
 			char *extensionOwner = CitusExtensionOwnerName();
 
 			char storageType = shardInterval->storageType;
-			if (storageType == SHARD_STORAGE_TABLE)
+			if (storageType == SHARD_STORAGE_TABLE || storageType == SHARD_STORAGE_COLD)
 			{
 				appendStringInfo(workerDropQuery, DROP_REGULAR_TABLE_COMMAND,
 								 quotedShardName);
@@ -419,7 +423,8 @@ DropShards(Oid relationId, char *schemaName, char *relationName,
 
 			MarkRemoteTransactionCritical(connection);
 
-			ExecuteCriticalRemoteCommand(connection, workerDropQuery->data);
+			AppendConnectionCommand(&commandBatchList, connection,
+									workerDropQuery->data);
 
 			DeleteShardPlacementRow(shardPlacement->placementId);
 		}
@@ -427,6 +432,9 @@ DropShards(Oid relationId, char *schemaName, char *relationName,
 		DeleteShardRow(shardId);
 	}
 
+	/* drop the shards with a single command per connection, on all nodes at once */
+	ExecuteConnectionCommandBatches(commandBatchList);
+
 	droppedShardCount = list_length(deletableShardIntervalList);
 
 	return droppedShardCount;
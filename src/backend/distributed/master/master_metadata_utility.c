@@ -45,14 +45,41 @@
 #include "parser/scansup.h"
 #include "storage/lmgr.h"
 #include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
 #include "utils/fmgroids.h"
+#include "utils/hsearch.h"
 #include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 #include "utils/tqual.h"
+#include "utils/tuplestore.h"
+
+
+/*
+ * TableSizeCacheKey identifies a cached table size by the table and the size
+ * function that was used to compute it.
+ */
+typedef struct TableSizeCacheKey
+{
+	Oid relationId;
+	char sizeQuery[NAMEDATALEN];
+} TableSizeCacheKey;
+
+typedef struct TableSizeCacheEntry
+{
+	TableSizeCacheKey key;
+	uint64 tableSize;
+	TimestampTz fetchTime;
+} TableSizeCacheEntry;
+
+
+/* config variable for how long fetched table sizes are reused, in ms */
+int TableSizeCacheTTL = 0;
 
 
 /* Local functions forward declarations */
@@ -61,13 +88,24 @@ static void RecordDistributedRelationDependencies(Oid distributedRelationId,
 												  Node *distributionKey);
 static GroupShardPlacement * TupleToGroupShardPlacement(TupleDesc tupleDesc,
 														HeapTuple heapTuple);
+static HeapTuple FormShardTuple(TupleDesc tupleDescriptor, Oid relationId,
+								uint64 shardId, char storageType,
+								text *shardMinValue, text *shardMaxValue);
+static HeapTuple FormShardPlacementTuple(TupleDesc tupleDescriptor,
+										 GroupShardPlacement *placement);
 static uint64 DistributedTableSize(Oid relationId, char *sizeQuery);
-static uint64 DistributedTableSizeOnWorker(WorkerNode *workerNode, Oid relationId,
-										   char *sizeQuery);
+static uint64 * DistributedTableSizes(List *relationIdList, char *sizeQuery);
+static void FetchDistributedTableSizes(List *relationIdList, List *sizeQueryList,
+									   uint64 *tableSizes);
 static List * ShardIntervalsOnWorkerGroup(WorkerNode *workerNode, Oid relationId);
-static StringInfo GenerateSizeQueryOnMultiplePlacements(Oid distributedRelationId,
-														List *shardIntervalList,
-														char *sizeQuery);
+static void AppendSizeQueryOnMultiplePlacements(StringInfo selectQuery,
+												Oid distributedRelationId,
+												List *shardIntervalList,
+												char *sizeQuery);
+static char * TableSizeFunction(Oid relationId, char *sizeQuery);
+static TableSizeCacheEntry * LookupTableSizeCacheEntry(Oid relationId, char *sizeQuery,
+													   bool *found);
+static void ReturnDistributedTableSizes(FunctionCallInfo fcinfo, char *sizeQuery);
 static void ErrorIfNotSuitableToGetSize(Oid relationId);
 
 
@@ -75,6 +113,8 @@ static void ErrorIfNotSuitableToGetSize(Oid relationId);
 PG_FUNCTION_INFO_V1(citus_table_size);
 PG_FUNCTION_INFO_V1(citus_total_relation_size);
 PG_FUNCTION_INFO_V1(citus_relation_size);
+PG_FUNCTION_INFO_V1(citus_table_sizes);
+PG_FUNCTION_INFO_V1(citus_total_relation_sizes);
 
 
 /*
@@ -86,16 +126,10 @@ citus_total_relation_size(PG_FUNCTION_ARGS)
 {
 	Oid relationId = PG_GETARG_OID(0);
 	uint64 totalRelationSize = 0;
-	char *tableSizeFunction = PG_TOTAL_RELATION_SIZE_FUNCTION;
 
 	CheckCitusVersion(ERROR);
 
-	if (CStoreTable(relationId))
-	{
-		tableSizeFunction = CSTORE_TABLE_SIZE_FUNCTION;
-	}
-
-	totalRelationSize = DistributedTableSize(relationId, tableSizeFunction);
+	totalRelationSize = DistributedTableSize(relationId, PG_TOTAL_RELATION_SIZE_FUNCTION);
 
 	PG_RETURN_INT64(totalRelationSize);
 }
@@ -110,16 +144,10 @@ citus_table_size(PG_FUNCTION_ARGS)
 {
 	Oid relationId = PG_GETARG_OID(0);
 	uint64 tableSize = 0;
-	char *tableSizeFunction = PG_TABLE_SIZE_FUNCTION;
 
 	CheckCitusVersion(ERROR);
 
-	if (CStoreTable(relationId))
-	{
-		tableSizeFunction = CSTORE_TABLE_SIZE_FUNCTION;
-	}
-
-	tableSize = DistributedTableSize(relationId, tableSizeFunction);
+	tableSize = DistributedTableSize(relationId, PG_TABLE_SIZE_FUNCTION);
 
 	PG_RETURN_INT64(tableSize);
 }
@@ -134,33 +162,154 @@ citus_relation_size(PG_FUNCTION_ARGS)
 {
 	Oid relationId = PG_GETARG_OID(0);
 	uint64 relationSize = 0;
-	char *tableSizeFunction = PG_RELATION_SIZE_FUNCTION;
 
 	CheckCitusVersion(ERROR);
 
-	if (CStoreTable(relationId))
+	relationSize = DistributedTableSize(relationId, PG_RELATION_SIZE_FUNCTION);
+
+	PG_RETURN_INT64(relationSize);
+}
+
+
+/*
+ * citus_table_sizes accepts an array of tables and returns the size of each
+ * distributed table without its indexes, fetching the sizes of all tables with
+ * a single query per node.
+ */
+Datum
+citus_table_sizes(PG_FUNCTION_ARGS)
+{
+	CheckCitusVersion(ERROR);
+
+	ReturnDistributedTableSizes(fcinfo, PG_TABLE_SIZE_FUNCTION);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * citus_total_relation_sizes accepts an array of tables and returns the size
+ * of each distributed table including its indexes, fetching the sizes of all
+ * tables with a single query per node.
+ */
+Datum
+citus_total_relation_sizes(PG_FUNCTION_ARGS)
+{
+	CheckCitusVersion(ERROR);
+
+	ReturnDistributedTableSizes(fcinfo, PG_TOTAL_RELATION_SIZE_FUNCTION);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * ReturnDistributedTableSizes computes the sizes of the tables in the array
+ * given as the first argument of the function and returns them as a set of
+ * (logicalrelid, size) rows in the same order.
+ */
+static void
+ReturnDistributedTableSizes(FunctionCallInfo fcinfo, char *sizeQuery)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	ArrayType *relationIdArray = PG_GETARG_ARRAYTYPE_P(0);
+	int relationCount = ArrayObjectCount(relationIdArray);
+	Datum *relationIdDatumArray = DeconstructArrayObject(relationIdArray);
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	List *relationIdList = NIL;
+	uint64 *tableSizes = NULL;
+	int relationIndex = 0;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
 	{
-		tableSizeFunction = CSTORE_TABLE_SIZE_FUNCTION;
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
 	}
 
-	relationSize = DistributedTableSize(relationId, tableSizeFunction);
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
 
-	PG_RETURN_INT64(relationSize);
+	for (relationIndex = 0; relationIndex < relationCount; relationIndex++)
+	{
+		Oid relationId = DatumGetObjectId(relationIdDatumArray[relationIndex]);
+
+		relationIdList = lappend_oid(relationIdList, relationId);
+	}
+
+	tableSizes = DistributedTableSizes(relationIdList, sizeQuery);
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	for (relationIndex = 0; relationIndex < relationCount; relationIndex++)
+	{
+		Datum values[2];
+		bool nulls[2];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = relationIdDatumArray[relationIndex];
+		values[1] = Int64GetDatum(tableSizes[relationIndex]);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+	}
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
 }
 
 
 /*
  * DistributedTableSize is helper function for each kind of citus size functions.
- * It first checks whether the table is distributed and size query can be run on
- * it. Connection to each node has to be established to get the size of the table.
+ * It returns the size of a single table, see DistributedTableSizes.
  */
 static uint64
 DistributedTableSize(Oid relationId, char *sizeQuery)
 {
-	Relation relation = NULL;
-	List *workerNodeList = NULL;
-	ListCell *workerNodeCell = NULL;
-	uint64 totalRelationSize = 0;
+	List *relationIdList = list_make1_oid(relationId);
+	uint64 *tableSizes = DistributedTableSizes(relationIdList, sizeQuery);
+
+	return tableSizes[0];
+}
+
+
+/*
+ * DistributedTableSizes returns the sizes of the given tables, in the same
+ * order. It first checks whether the tables are distributed and size queries
+ * can be run on them. Sizes that were fetched less than citus.table_size_cache_ttl
+ * ago are taken from the cache, the others are fetched from all nodes at once.
+ */
+static uint64 *
+DistributedTableSizes(List *relationIdList, char *sizeQuery)
+{
+	int relationCount = list_length(relationIdList);
+	uint64 *tableSizes = (uint64 *) palloc0(Max(relationCount, 1) * sizeof(uint64));
+	bool *sizeCached = (bool *) palloc0(Max(relationCount, 1) * sizeof(bool));
+	List *relationList = NIL;
+	List *uncachedRelationIdList = NIL;
+	List *uncachedSizeQueryList = NIL;
+	ListCell *relationIdCell = NULL;
+	ListCell *relationCell = NULL;
+	int relationIndex = 0;
+	TimestampTz currentTime = GetCurrentTimestamp();
 
 	if (XactModificationLevel == XACT_MODIFICATION_DATA)
 	{
@@ -169,76 +318,269 @@ DistributedTableSize(Oid relationId, char *sizeQuery)
 							   " blocks which contain multi-shard data modifications")));
 	}
 
-	relation = try_relation_open(relationId, AccessShareLock);
+	foreach(relationIdCell, relationIdList)
+	{
+		Oid relationId = lfirst_oid(relationIdCell);
+		Relation relation = try_relation_open(relationId, AccessShareLock);
+
+		if (relation == NULL)
+		{
+			ereport(ERROR,
+					(errmsg("could not compute table size: relation does not exist")));
+		}
+
+		relationList = lappend(relationList, relation);
+
+		ErrorIfNotSuitableToGetSize(relationId);
+	}
+
+	foreach(relationIdCell, relationIdList)
+	{
+		Oid relationId = lfirst_oid(relationIdCell);
+		char *tableSizeFunction = TableSizeFunction(relationId, sizeQuery);
+		bool found = false;
+
+		if (TableSizeCacheTTL > 0)
+		{
+			TableSizeCacheEntry *cacheEntry =
+				LookupTableSizeCacheEntry(relationId, tableSizeFunction, &found);
+
+			if (found && !TimestampDifferenceExceeds(cacheEntry->fetchTime, currentTime,
+													 TableSizeCacheTTL))
+			{
+				tableSizes[relationIndex] = cacheEntry->tableSize;
+				sizeCached[relationIndex] = true;
+				relationIndex++;
+				continue;
+			}
+		}
+
+		uncachedRelationIdList = lappend_oid(uncachedRelationIdList, relationId);
+		uncachedSizeQueryList = lappend(uncachedSizeQueryList, tableSizeFunction);
+		relationIndex++;
+	}
+
+	if (uncachedRelationIdList != NIL)
+	{
+		int uncachedRelationCount = list_length(uncachedRelationIdList);
+		uint64 *fetchedSizes = (uint64 *) palloc0(uncachedRelationCount *
+												  sizeof(uint64));
+		ListCell *sizeQueryCell = NULL;
+		int fetchedIndex = 0;
+
+		FetchDistributedTableSizes(uncachedRelationIdList, uncachedSizeQueryList,
+								   fetchedSizes);
+
+		forboth(relationIdCell, uncachedRelationIdList, sizeQueryCell,
+				uncachedSizeQueryList)
+		{
+			Oid relationId = lfirst_oid(relationIdCell);
+			char *tableSizeFunction = (char *) lfirst(sizeQueryCell);
+
+			if (TableSizeCacheTTL > 0)
+			{
+				bool found = false;
+				TableSizeCacheEntry *cacheEntry =
+					LookupTableSizeCacheEntry(relationId, tableSizeFunction, &found);
+
+				cacheEntry->tableSize = fetchedSizes[fetchedIndex];
+				cacheEntry->fetchTime = currentTime;
+			}
+
+			fetchedIndex++;
+		}
+
+		/* fill in the fetched sizes in the order of the given relations */
+		fetchedIndex = 0;
+		for (relationIndex = 0; relationIndex < relationCount; relationIndex++)
+		{
+			if (!sizeCached[relationIndex])
+			{
+				tableSizes[relationIndex] = fetchedSizes[fetchedIndex];
+				fetchedIndex++;
+			}
+		}
+	}
 
-	if (relation == NULL)
+	foreach(relationCell, relationList)
 	{
-		ereport(ERROR,
-				(errmsg("could not compute table size: relation does not exist")));
+		Relation relation = (Relation) lfirst(relationCell);
+
+		heap_close(relation, AccessShareLock);
 	}
 
-	ErrorIfNotSuitableToGetSize(relationId);
+	return tableSizes;
+}
+
 
-	workerNodeList = ActiveReadableNodeList();
+/*
+ * FetchDistributedTableSizes sums up the sizes of the shard placements of the
+ * given tables on all nodes, using the size function at the same position in
+ * sizeQueryList for each table. Each node gets a single query returning one
+ * column per table, and the queries are sent to all nodes before waiting for
+ * any of the results.
+ */
+static void
+FetchDistributedTableSizes(List *relationIdList, List *sizeQueryList,
+						   uint64 *tableSizes)
+{
+	List *workerNodeList = ActiveReadableNodeList();
+	ListCell *workerNodeCell = NULL;
+	List *connectionList = NIL;
+	List *queryList = NIL;
+	ListCell *connectionCell = NULL;
+	ListCell *queryCell = NULL;
+	uint32 connectionFlag = 0;
+	bool raiseErrors = true;
 
 	foreach(workerNodeCell, workerNodeList)
 	{
 		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
-		uint64 relationSizeOnNode = DistributedTableSizeOnWorker(workerNode, relationId,
-																 sizeQuery);
-		totalRelationSize += relationSizeOnNode;
+		StringInfo tableSizeQuery = makeStringInfo();
+		ListCell *relationIdCell = NULL;
+		ListCell *sizeQueryCell = NULL;
+		bool hasShardsOnNode = false;
+		bool firstRelation = true;
+		MultiConnection *connection = NULL;
+
+		appendStringInfo(tableSizeQuery, "SELECT ");
+
+		forboth(relationIdCell, relationIdList, sizeQueryCell, sizeQueryList)
+		{
+			Oid relationId = lfirst_oid(relationIdCell);
+			char *sizeQuery = (char *) lfirst(sizeQueryCell);
+			List *shardIntervalsOnNode = ShardIntervalsOnWorkerGroup(workerNode,
+																	 relationId);
+
+			if (shardIntervalsOnNode != NIL)
+			{
+				hasShardsOnNode = true;
+			}
+
+			if (!firstRelation)
+			{
+				appendStringInfo(tableSizeQuery, ", ");
+			}
+
+			firstRelation = false;
+
+			AppendSizeQueryOnMultiplePlacements(tableSizeQuery, relationId,
+												shardIntervalsOnNode, sizeQuery);
+		}
+
+		appendStringInfo(tableSizeQuery, ";");
+
+		/* nodes without any of the shards would only return zeros */
+		if (!hasShardsOnNode)
+		{
+			continue;
+		}
+
+		connection = StartNodeConnection(connectionFlag, workerNode->workerName,
+										 workerNode->workerPort);
+
+		connectionList = lappend(connectionList, connection);
+		queryList = lappend(queryList, tableSizeQuery->data);
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+
+	forboth(connectionCell, connectionList, queryCell, queryList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		char *tableSizeQuery = (char *) lfirst(queryCell);
+
+		if (SendRemoteCommand(connection, tableSizeQuery) == 0)
+		{
+			ReportConnectionError(connection, WARNING);
+			ereport(ERROR, (errcode(ERRCODE_CONNECTION_FAILURE),
+							errmsg("cannot get the size because of a connection error")));
+		}
 	}
 
-	heap_close(relation, AccessShareLock);
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		PGresult *result = GetRemoteCommandResult(connection, raiseErrors);
+		int relationCount = list_length(relationIdList);
+		int relationIndex = 0;
+
+		if (!IsResponseOK(result) || PQntuples(result) != 1 ||
+			PQnfields(result) != relationCount)
+		{
+			ReportResultError(connection, result, WARNING);
+			ereport(ERROR, (errcode(ERRCODE_CONNECTION_FAILURE),
+							errmsg("cannot get the size because of a connection error")));
+		}
+
+		for (relationIndex = 0; relationIndex < relationCount; relationIndex++)
+		{
+			char *tableSizeString = PQgetvalue(result, 0, relationIndex);
+
+			tableSizes[relationIndex] += strtoull(tableSizeString, NULL, 10);
+		}
 
-	return totalRelationSize;
+		PQclear(result);
+		ClearResults(connection, raiseErrors);
+	}
 }
 
 
 /*
- * DistributedTableSizeOnWorker gets the workerNode and relationId to calculate
- * size of that relation on the given workerNode by summing up the size of each
- * shard placement.
+ * TableSizeFunction returns the size function to use for the given table,
+ * which is the given size function except for cstore tables.
  */
-static uint64
-DistributedTableSizeOnWorker(WorkerNode *workerNode, Oid relationId, char *sizeQuery)
+static char *
+TableSizeFunction(Oid relationId, char *sizeQuery)
 {
-	StringInfo tableSizeQuery = NULL;
-	StringInfo tableSizeStringInfo = NULL;
-	char *workerNodeName = workerNode->workerName;
-	uint32 workerNodePort = workerNode->workerPort;
-	char *tableSizeString;
-	uint64 tableSize = 0;
-	MultiConnection *connection = NULL;
-	uint32 connectionFlag = 0;
-	PGresult *result = NULL;
-	int queryResult = 0;
-	List *sizeList = NIL;
-	bool raiseErrors = true;
+	if (CStoreTable(relationId))
+	{
+		return CSTORE_TABLE_SIZE_FUNCTION;
+	}
 
-	List *shardIntervalsOnNode = ShardIntervalsOnWorkerGroup(workerNode, relationId);
+	return sizeQuery;
+}
 
-	tableSizeQuery = GenerateSizeQueryOnMultiplePlacements(relationId,
-														   shardIntervalsOnNode,
-														   sizeQuery);
 
-	connection = GetNodeConnection(connectionFlag, workerNodeName, workerNodePort);
-	queryResult = ExecuteOptionalRemoteCommand(connection, tableSizeQuery->data, &result);
+/*
+ * LookupTableSizeCacheEntry returns the cache entry of the size of the given
+ * table for the given size function, creating an empty one if it does not
+ * exist. The cache lives in CacheMemoryContext, so sizes are kept across
+ * transactions for citus.table_size_cache_ttl.
+ */
+static TableSizeCacheEntry *
+LookupTableSizeCacheEntry(Oid relationId, char *sizeQuery, bool *found)
+{
+	static HTAB *TableSizeCacheHash = NULL;
+	TableSizeCacheKey cacheKey;
+	TableSizeCacheEntry *cacheEntry = NULL;
 
-	if (queryResult != 0)
+	if (TableSizeCacheHash == NULL)
 	{
-		ereport(ERROR, (errcode(ERRCODE_CONNECTION_FAILURE),
-						errmsg("cannot get the size because of a connection error")));
+		HASHCTL info;
+		int hashFlags = (HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(TableSizeCacheKey);
+		info.entrysize = sizeof(TableSizeCacheEntry);
+		info.hcxt = CacheMemoryContext;
+
+		TableSizeCacheHash = hash_create("Table Size Cache", 32, &info, hashFlags);
 	}
 
-	sizeList = ReadFirstColumnAsText(result);
-	tableSizeStringInfo = (StringInfo) linitial(sizeList);
-	tableSizeString = tableSizeStringInfo->data;
-	tableSize = atol(tableSizeString);
+	memset(&cacheKey, 0, sizeof(cacheKey));
+	cacheKey.relationId = relationId;
+	strlcpy(cacheKey.sizeQuery, sizeQuery, NAMEDATALEN);
 
-	ClearResults(connection, raiseErrors);
+	cacheEntry = (TableSizeCacheEntry *) hash_search(TableSizeCacheHash, &cacheKey,
+													 HASH_ENTER, found);
+	if (!*found)
+	{
+		cacheEntry->tableSize = 0;
+		cacheEntry->fetchTime = 0;
+	}
 
-	return tableSize;
+	return cacheEntry;
 }
 
 
@@ -258,10 +600,10 @@ GroupShardPlacementsForTableOnGroup(Oid relationId, uint32 groupId)
 
 	for (shardIndex = 0; shardIndex < shardIntervalArrayLength; shardIndex++)
 	{
+		int numberOfPlacements = 0;
 		GroupShardPlacement *placementArray =
-			distTableCacheEntry->arrayOfPlacementArrays[shardIndex];
-		int numberOfPlacements =
-			distTableCacheEntry->arrayOfPlacementArrayLengths[shardIndex];
+			CachedShardPlacementArray(distTableCacheEntry, shardIndex,
+									  &numberOfPlacements);
 		int placementIndex = 0;
 
 		for (placementIndex = 0; placementIndex < numberOfPlacements; placementIndex++)
@@ -296,10 +638,10 @@ ShardIntervalsOnWorkerGroup(WorkerNode *workerNode, Oid relationId)
 
 	for (shardIndex = 0; shardIndex < shardIntervalArrayLength; shardIndex++)
 	{
+		int numberOfPlacements = 0;
 		GroupShardPlacement *placementArray =
-			distTableCacheEntry->arrayOfPlacementArrays[shardIndex];
-		int numberOfPlacements =
-			distTableCacheEntry->arrayOfPlacementArrayLengths[shardIndex];
+			CachedShardPlacementArray(distTableCacheEntry, shardIndex,
+									  &numberOfPlacements);
 		int placementIndex = 0;
 
 		for (placementIndex = 0; placementIndex < numberOfPlacements; placementIndex++)
@@ -333,25 +675,21 @@ ShardIntervalsOnWorkerGroup(WorkerNode *workerNode, Oid relationId)
 
 
 /*
- * GenerateSizeQueryOnMultiplePlacements generates a select size query to get
- * size of multiple tables from the relation with distributedRelationId. Note
- * that, different size functions supported by PG are also supported by this
- * function changing the size query given as the last parameter to function.
- * Format of sizeQuery is pg_*_size(%s). Examples of it can be found in the
- * master_protocol.h
+ * AppendSizeQueryOnMultiplePlacements appends an expression that sums up the
+ * size of the given shards of the relation with distributedRelationId to the
+ * select query. Note that, different size functions supported by PG are also
+ * supported by this function changing the size query given as the last
+ * parameter to function. Format of sizeQuery is pg_*_size(%s). Examples of it
+ * can be found in the master_metadata_utility.h
  */
-static StringInfo
-GenerateSizeQueryOnMultiplePlacements(Oid distributedRelationId, List *shardIntervalList,
-									  char *sizeQuery)
+static void
+AppendSizeQueryOnMultiplePlacements(StringInfo selectQuery, Oid distributedRelationId,
+									List *shardIntervalList, char *sizeQuery)
 {
 	Oid schemaId = get_rel_namespace(distributedRelationId);
 	char *schemaName = get_namespace_name(schemaId);
-
-	StringInfo selectQuery = makeStringInfo();
 	ListCell *shardIntervalCell = NULL;
 
-	appendStringInfo(selectQuery, "SELECT ");
-
 	foreach(shardIntervalCell, shardIntervalList)
 	{
 		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
@@ -372,9 +710,7 @@ GenerateSizeQueryOnMultiplePlacements(Oid distributedRelationId, List *shardInte
 	 * Add 0 as a last size, it handles empty list case and makes size control checks
 	 * unnecessary which would have implemented without this line.
 	 */
-	appendStringInfo(selectQuery, "0;");
-
-	return selectQuery;
+	appendStringInfo(selectQuery, "0");
 }
 
 
@@ -628,6 +964,30 @@ ShardLength(uint64 shardId)
 }
 
 
+/*
+ * TableShardLength returns the sum of the lengths of the given distributed
+ * table's shards, as recorded in the metadata. The shard lengths are only kept
+ * up to date for append distributed tables, and for other tables after calls
+ * to master_update_shard_statistics(); otherwise they are 0.
+ */
+uint64
+TableShardLength(Oid relationId)
+{
+	List *shardIntervalList = LoadShardIntervalList(relationId);
+	ListCell *shardIntervalCell = NULL;
+	uint64 tableLength = 0;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+
+		tableLength += ShardLength(shardInterval->shardId);
+	}
+
+	return tableLength;
+}
+
+
 /*
  * NodeGroupHasShardPlacements returns whether any active shards are placed on the group
  */
@@ -822,37 +1182,13 @@ InsertShardRow(Oid relationId, uint64 shardId, char storageType,
 	Relation pgDistShard = NULL;
 	TupleDesc tupleDescriptor = NULL;
 	HeapTuple heapTuple = NULL;
-	Datum values[Natts_pg_dist_shard];
-	bool isNulls[Natts_pg_dist_shard];
-
-	/* form new shard tuple */
-	memset(values, 0, sizeof(values));
-	memset(isNulls, false, sizeof(isNulls));
-
-	values[Anum_pg_dist_shard_logicalrelid - 1] = ObjectIdGetDatum(relationId);
-	values[Anum_pg_dist_shard_shardid - 1] = Int64GetDatum(shardId);
-	values[Anum_pg_dist_shard_shardstorage - 1] = CharGetDatum(storageType);
-
-	/* dropped shardalias column must also be set; it is still part of the tuple */
-	isNulls[Anum_pg_dist_shard_shardalias_DROPPED - 1] = true;
-
-	/* check if shard min/max values are null */
-	if (shardMinValue != NULL && shardMaxValue != NULL)
-	{
-		values[Anum_pg_dist_shard_shardminvalue - 1] = PointerGetDatum(shardMinValue);
-		values[Anum_pg_dist_shard_shardmaxvalue - 1] = PointerGetDatum(shardMaxValue);
-	}
-	else
-	{
-		isNulls[Anum_pg_dist_shard_shardminvalue - 1] = true;
-		isNulls[Anum_pg_dist_shard_shardmaxvalue - 1] = true;
-	}
 
 	/* open shard relation and insert new tuple */
 	pgDistShard = heap_open(DistShardRelationId(), RowExclusiveLock);
 
 	tupleDescriptor = RelationGetDescr(pgDistShard);
-	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+	heapTuple = FormShardTuple(tupleDescriptor, relationId, shardId, storageType,
+							   shardMinValue, shardMaxValue);
 
 	CatalogTupleInsert(pgDistShard, heapTuple);
 
@@ -865,51 +1201,229 @@ InsertShardRow(Oid relationId, uint64 shardId, char storageType,
 
 
 /*
- * InsertShardPlacementRow opens the shard placement system catalog, and inserts
- * a new row with the given values into that system catalog. If placementId is
- * INVALID_PLACEMENT_ID, a new placement id will be assigned.Then, returns the
- * placement id of the added shard placement.
+ * InsertShardRowList inserts a row into the shard system catalog for each of
+ * the given shard intervals. Since the rows are typically those of all shards
+ * of a new table, we open the catalog and its indexes only once, and register
+ * a single invalidation per distributed table after all rows are inserted.
  */
-uint64
-InsertShardPlacementRow(uint64 shardId, uint64 placementId,
-						char shardState, uint64 shardLength,
-						uint32 groupId)
+void
+InsertShardRowList(List *shardIntervalList)
 {
-	Relation pgDistPlacement = NULL;
+	Relation pgDistShard = NULL;
 	TupleDesc tupleDescriptor = NULL;
-	HeapTuple heapTuple = NULL;
-	Datum values[Natts_pg_dist_placement];
-	bool isNulls[Natts_pg_dist_placement];
-
-	/* form new shard placement tuple */
-	memset(values, 0, sizeof(values));
-	memset(isNulls, false, sizeof(isNulls));
+	CatalogIndexState indexState = NULL;
+	List *relationIdList = NIL;
+	ListCell *shardIntervalCell = NULL;
+	ListCell *relationIdCell = NULL;
 
-	if (placementId == INVALID_PLACEMENT_ID)
+	if (shardIntervalList == NIL)
 	{
-		placementId = master_get_new_placementid(NULL);
+		return;
 	}
-	values[Anum_pg_dist_placement_placementid - 1] = Int64GetDatum(placementId);
-	values[Anum_pg_dist_placement_shardid - 1] = Int64GetDatum(shardId);
-	values[Anum_pg_dist_placement_shardstate - 1] = CharGetDatum(shardState);
-	values[Anum_pg_dist_placement_shardlength - 1] = Int64GetDatum(shardLength);
-	values[Anum_pg_dist_placement_groupid - 1] = Int64GetDatum(groupId);
 
-	/* open shard placement relation and insert new tuple */
-	pgDistPlacement = heap_open(DistPlacementRelationId(), RowExclusiveLock);
+	pgDistShard = heap_open(DistShardRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistShard);
+	indexState = CatalogOpenIndexes(pgDistShard);
 
-	tupleDescriptor = RelationGetDescr(pgDistPlacement);
-	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		text *shardMinValue = NULL;
+		text *shardMaxValue = NULL;
+		HeapTuple heapTuple = NULL;
 
-	CatalogTupleInsert(pgDistPlacement, heapTuple);
+		if (shardInterval->minValueExists && shardInterval->maxValueExists)
+		{
+			char *minValueString = DatumToString(shardInterval->minValue,
+												 shardInterval->valueTypeId);
+			char *maxValueString = DatumToString(shardInterval->maxValue,
+												 shardInterval->valueTypeId);
 
-	CitusInvalidateRelcacheByShardId(shardId);
+			shardMinValue = cstring_to_text(minValueString);
+			shardMaxValue = cstring_to_text(maxValueString);
+		}
 
-	CommandCounterIncrement();
-	heap_close(pgDistPlacement, NoLock);
+		heapTuple = FormShardTuple(tupleDescriptor, shardInterval->relationId,
+								   shardInterval->shardId, shardInterval->storageType,
+								   shardMinValue, shardMaxValue);
 
-	return placementId;
-}
+		CatalogTupleInsertWithInfo(pgDistShard, heapTuple, indexState);
+		heap_freetuple(heapTuple);
+
+		relationIdList = list_append_unique_oid(relationIdList,
+												shardInterval->relationId);
+	}
+
+	CatalogCloseIndexes(indexState);
+
+	/* invalidate previous cache entries and close relation */
+	foreach(relationIdCell, relationIdList)
+	{
+		CitusInvalidateRelcacheByRelid(lfirst_oid(relationIdCell));
+	}
+
+	CommandCounterIncrement();
+	heap_close(pgDistShard, NoLock);
+}
+
+
+/*
+ * FormShardTuple forms a pg_dist_shard tuple from the given values. Note that
+ * we allow the caller to pass in null min/max values for empty shards.
+ */
+static HeapTuple
+FormShardTuple(TupleDesc tupleDescriptor, Oid relationId, uint64 shardId,
+			   char storageType, text *shardMinValue, text *shardMaxValue)
+{
+	Datum values[Natts_pg_dist_shard];
+	bool isNulls[Natts_pg_dist_shard];
+
+	/* form new shard tuple */
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_pg_dist_shard_logicalrelid - 1] = ObjectIdGetDatum(relationId);
+	values[Anum_pg_dist_shard_shardid - 1] = Int64GetDatum(shardId);
+	values[Anum_pg_dist_shard_shardstorage - 1] = CharGetDatum(storageType);
+
+	/* dropped shardalias column must also be set; it is still part of the tuple */
+	isNulls[Anum_pg_dist_shard_shardalias_DROPPED - 1] = true;
+
+	/* check if shard min/max values are null */
+	if (shardMinValue != NULL && shardMaxValue != NULL)
+	{
+		values[Anum_pg_dist_shard_shardminvalue - 1] = PointerGetDatum(shardMinValue);
+		values[Anum_pg_dist_shard_shardmaxvalue - 1] = PointerGetDatum(shardMaxValue);
+	}
+	else
+	{
+		isNulls[Anum_pg_dist_shard_shardminvalue - 1] = true;
+		isNulls[Anum_pg_dist_shard_shardmaxvalue - 1] = true;
+	}
+
+	return heap_form_tuple(tupleDescriptor, values, isNulls);
+}
+
+
+/*
+ * InsertShardPlacementRow opens the shard placement system catalog, and inserts
+ * a new row with the given values into that system catalog. If placementId is
+ * INVALID_PLACEMENT_ID, a new placement id will be assigned.Then, returns the
+ * placement id of the added shard placement.
+ */
+uint64
+InsertShardPlacementRow(uint64 shardId, uint64 placementId,
+						char shardState, uint64 shardLength,
+						uint32 groupId)
+{
+	Relation pgDistPlacement = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	GroupShardPlacement placement;
+
+	if (placementId == INVALID_PLACEMENT_ID)
+	{
+		placementId = master_get_new_placementid(NULL);
+	}
+
+	memset(&placement, 0, sizeof(placement));
+	placement.placementId = placementId;
+	placement.shardId = shardId;
+	placement.shardState = shardState;
+	placement.shardLength = shardLength;
+	placement.groupId = groupId;
+
+	/* open shard placement relation and insert new tuple */
+	pgDistPlacement = heap_open(DistPlacementRelationId(), RowExclusiveLock);
+
+	tupleDescriptor = RelationGetDescr(pgDistPlacement);
+	heapTuple = FormShardPlacementTuple(tupleDescriptor, &placement);
+
+	CatalogTupleInsert(pgDistPlacement, heapTuple);
+
+	CitusInvalidateRelcacheByShardId(shardId);
+
+	CommandCounterIncrement();
+	heap_close(pgDistPlacement, NoLock);
+
+	return placementId;
+}
+
+
+/*
+ * InsertShardPlacementRowList inserts a row into the shard placement system
+ * catalog for each of the given placements of shards of the given distributed
+ * table. Placements with an INVALID_PLACEMENT_ID get a new placement id, which
+ * is stored in the placement. Like InsertShardRowList, we only register a
+ * single invalidation for the table after all rows are inserted.
+ */
+void
+InsertShardPlacementRowList(Oid relationId, List *placementList)
+{
+	Relation pgDistPlacement = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	CatalogIndexState indexState = NULL;
+	ListCell *placementCell = NULL;
+
+	if (placementList == NIL)
+	{
+		return;
+	}
+
+	pgDistPlacement = heap_open(DistPlacementRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistPlacement);
+	indexState = CatalogOpenIndexes(pgDistPlacement);
+
+	foreach(placementCell, placementList)
+	{
+		GroupShardPlacement *placement = (GroupShardPlacement *) lfirst(placementCell);
+		HeapTuple heapTuple = NULL;
+
+		if (placement->placementId == INVALID_PLACEMENT_ID)
+		{
+			placement->placementId = master_get_new_placementid(NULL);
+		}
+
+		heapTuple = FormShardPlacementTuple(tupleDescriptor, placement);
+
+		CatalogTupleInsertWithInfo(pgDistPlacement, heapTuple, indexState);
+		heap_freetuple(heapTuple);
+	}
+
+	CatalogCloseIndexes(indexState);
+
+	CitusInvalidateRelcacheByRelid(relationId);
+
+	CommandCounterIncrement();
+	heap_close(pgDistPlacement, NoLock);
+}
+
+
+/*
+ * FormShardPlacementTuple forms a pg_dist_placement tuple for the given
+ * placement.
+ */
+static HeapTuple
+FormShardPlacementTuple(TupleDesc tupleDescriptor, GroupShardPlacement *placement)
+{
+	Datum values[Natts_pg_dist_placement];
+	bool isNulls[Natts_pg_dist_placement];
+
+	/* form new shard placement tuple */
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_pg_dist_placement_placementid - 1] =
+		Int64GetDatum(placement->placementId);
+	values[Anum_pg_dist_placement_shardid - 1] = Int64GetDatum(placement->shardId);
+	values[Anum_pg_dist_placement_shardstate - 1] =
+		CharGetDatum(placement->shardState);
+	values[Anum_pg_dist_placement_shardlength - 1] =
+		Int64GetDatum(placement->shardLength);
+	values[Anum_pg_dist_placement_groupid - 1] = Int64GetDatum(placement->groupId);
+
+	return heap_form_tuple(tupleDescriptor, values, isNulls);
+}
 
 
 /*
@@ -1203,6 +1717,185 @@ UpdateShardPlacementState(uint64 placementId, char shardState)
 }
 
 
+/*
+ * UpdateShardPlacementLength sets the shardLength for the placement identified
+ * by placementId.
+ */
+void
+UpdateShardPlacementLength(uint64 placementId, uint64 shardLength)
+{
+	Relation pgDistPlacement = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[Natts_pg_dist_placement];
+	bool isnull[Natts_pg_dist_placement];
+	bool replace[Natts_pg_dist_placement];
+	uint64 shardId = INVALID_SHARD_ID;
+	bool colIsNull = false;
+
+	pgDistPlacement = heap_open(DistPlacementRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistPlacement);
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_placement_placementid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(placementId));
+
+	scanDescriptor = systable_beginscan(pgDistPlacement,
+										DistPlacementPlacementidIndexId(), indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		ereport(ERROR, (errmsg("could not find valid entry for shard placement "
+							   UINT64_FORMAT,
+							   placementId)));
+	}
+
+	memset(replace, 0, sizeof(replace));
+
+	values[Anum_pg_dist_placement_shardlength - 1] = Int64GetDatum(shardLength);
+	isnull[Anum_pg_dist_placement_shardlength - 1] = false;
+	replace[Anum_pg_dist_placement_shardlength - 1] = true;
+
+	heapTuple = heap_modify_tuple(heapTuple, tupleDescriptor, values, isnull, replace);
+
+	CatalogTupleUpdate(pgDistPlacement, &heapTuple->t_self, heapTuple);
+
+	shardId = DatumGetInt64(heap_getattr(heapTuple,
+										 Anum_pg_dist_placement_shardid,
+										 tupleDescriptor, &colIsNull));
+	Assert(!colIsNull);
+	CitusInvalidateRelcacheByShardId(shardId);
+
+	CommandCounterIncrement();
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistPlacement, NoLock);
+}
+
+
+/*
+ * UpdateShardStorageType sets the storage type of the shard identified by
+ * shardId.
+ */
+void
+UpdateShardStorageType(uint64 shardId, char storageType)
+{
+	Relation pgDistShard = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[Natts_pg_dist_shard];
+	bool isnull[Natts_pg_dist_shard];
+	bool replace[Natts_pg_dist_shard];
+	Oid relationId = InvalidOid;
+	bool colIsNull = false;
+
+	pgDistShard = heap_open(DistShardRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistShard);
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_shard_shardid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(shardId));
+
+	scanDescriptor = systable_beginscan(pgDistShard,
+										DistShardShardidIndexId(), indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		ereport(ERROR, (errmsg("could not find valid entry for shard "
+							   UINT64_FORMAT, shardId)));
+	}
+
+	memset(replace, 0, sizeof(replace));
+
+	values[Anum_pg_dist_shard_shardstorage - 1] = CharGetDatum(storageType);
+	isnull[Anum_pg_dist_shard_shardstorage - 1] = false;
+	replace[Anum_pg_dist_shard_shardstorage - 1] = true;
+
+	heapTuple = heap_modify_tuple(heapTuple, tupleDescriptor, values, isnull, replace);
+
+	CatalogTupleUpdate(pgDistShard, &heapTuple->t_self, heapTuple);
+
+	relationId = DatumGetObjectId(heap_getattr(heapTuple,
+											   Anum_pg_dist_shard_logicalrelid,
+											   tupleDescriptor, &colIsNull));
+	Assert(!colIsNull);
+	CitusInvalidateRelcacheByRelid(relationId);
+
+	CommandCounterIncrement();
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistShard, NoLock);
+}
+
+
+/*
+ * UpdatePlacementGroupId sets the groupId for the placement identified by
+ * placementId, which moves the placement to a node in that group.
+ */
+void
+UpdatePlacementGroupId(uint64 placementId, uint32 groupId)
+{
+	Relation pgDistPlacement = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[Natts_pg_dist_placement];
+	bool isnull[Natts_pg_dist_placement];
+	bool replace[Natts_pg_dist_placement];
+	uint64 shardId = INVALID_SHARD_ID;
+	bool colIsNull = false;
+
+	pgDistPlacement = heap_open(DistPlacementRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistPlacement);
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_placement_placementid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(placementId));
+
+	scanDescriptor = systable_beginscan(pgDistPlacement,
+										DistPlacementPlacementidIndexId(), indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		ereport(ERROR, (errmsg("could not find valid entry for shard placement "
+							   UINT64_FORMAT,
+							   placementId)));
+	}
+
+	memset(replace, 0, sizeof(replace));
+
+	values[Anum_pg_dist_placement_groupid - 1] = UInt32GetDatum(groupId);
+	isnull[Anum_pg_dist_placement_groupid - 1] = false;
+	replace[Anum_pg_dist_placement_groupid - 1] = true;
+
+	heapTuple = heap_modify_tuple(heapTuple, tupleDescriptor, values, isnull, replace);
+
+	CatalogTupleUpdate(pgDistPlacement, &heapTuple->t_self, heapTuple);
+
+	shardId = DatumGetInt64(heap_getattr(heapTuple,
+										 Anum_pg_dist_placement_shardid,
+										 tupleDescriptor, &colIsNull));
+	Assert(!colIsNull);
+	CitusInvalidateRelcacheByShardId(shardId);
+
+	CommandCounterIncrement();
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistPlacement, NoLock);
+}
+
+
 /*
  * UpdateColocationGroupReplicationFactor finds colocation group record for given
  * colocationId and updates its replication factor to given replicationFactor value.
@@ -1265,6 +1958,66 @@ UpdateColocationGroupReplicationFactor(uint32 colocationId, int replicationFacto
 }
 
 
+/*
+ * UpdateColocationGroupShardCount finds colocation group record for given
+ * colocationId and updates its shard count to given shardCount value, such that
+ * new tables are only co-located with the group if they have as many shards.
+ */
+void
+UpdateColocationGroupShardCount(uint32 colocationId, int shardCount)
+{
+	Relation pgDistColocation = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+	HeapTuple newHeapTuple = NULL;
+	TupleDesc tupleDescriptor = NULL;
+
+	Datum values[Natts_pg_dist_colocation];
+	bool isnull[Natts_pg_dist_colocation];
+	bool replace[Natts_pg_dist_colocation];
+
+	/* we first search for colocation group by its colocation id */
+	pgDistColocation = heap_open(DistColocationRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistColocation);
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_colocation_colocationid, BTEqualStrategyNumber,
+				F_OIDEQ, ObjectIdGetDatum(colocationId));
+
+	scanDescriptor = systable_beginscan(pgDistColocation,
+										DistColocationColocationidIndexId(), indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+						errmsg("could not find valid entry for colocation group "
+							   "%d", colocationId)));
+	}
+
+	/* after we find colocation group, we update it with new values */
+	memset(replace, false, sizeof(replace));
+	memset(isnull, false, sizeof(isnull));
+	memset(values, 0, sizeof(values));
+
+	values[Anum_pg_dist_colocation_shardcount - 1] = Int32GetDatum(shardCount);
+	replace[Anum_pg_dist_colocation_shardcount - 1] = true;
+
+	newHeapTuple = heap_modify_tuple(heapTuple, tupleDescriptor, values, isnull, replace);
+
+	CatalogTupleUpdate(pgDistColocation, &newHeapTuple->t_self, newHeapTuple);
+
+	CommandCounterIncrement();
+
+	heap_freetuple(newHeapTuple);
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistColocation, NoLock);
+}
+
+
 /*
  * Check that the current user has `mode` permissions on relationId, error out
  * if not. Superusers always have such permissions.
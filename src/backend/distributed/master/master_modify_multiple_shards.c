@@ -177,7 +177,16 @@ master_modify_multiple_shards(PG_FUNCTION_ARGS)
 	CHECK_FOR_INTERRUPTS();
 
 	taskList = ModifyMultipleShardsTaskList(modifyQuery, prunedShardIntervalList);
-	affectedTupleCount = ExecuteModifyTasksWithoutResults(taskList);
+
+	if (modifyQuery->commandType == CMD_UTILITY)
+	{
+		/* TRUNCATE does not report a row count, so send all shards at once */
+		ExecuteBatchedModifyTasksWithoutResults(taskList);
+	}
+	else
+	{
+		affectedTupleCount = ExecuteModifyTasksWithoutResults(taskList);
+	}
 
 	PG_RETURN_INT32(affectedTupleCount);
 }
@@ -71,7 +71,6 @@ int ShardPlacementPolicy = SHARD_PLACEMENT_ROUND_ROBIN;
 int NextShardId = 0;
 int NextPlacementId = 0;
 
-static List * GetTableReplicaIdentityCommand(Oid relationId);
 static Datum WorkerNodeGetDatum(WorkerNode *workerNode, TupleDesc tupleDescriptor);
 
 /* exports for SQL callable functions */
@@ -575,7 +574,7 @@ GetTableDDLEvents(Oid relationId, bool includeSequenceDefaults)
  * GetTableReplicaIdentityCommand returns the list of DDL commands to
  * (re)define the replica identity choice for a given table.
  */
-static List *
+List *
 GetTableReplicaIdentityCommand(Oid relationId)
 {
 	List *replicaIdentityCreateCommandList = NIL;
@@ -13,35 +13,86 @@
 #include "postgres.h"
 #include "c.h"
 #include "fmgr.h"
+#include "libpq-fe.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 
 #include <string.h>
 
+#include "access/heapam.h"
+#include "access/xact.h"
 #include "catalog/pg_class.h"
+#include "commands/dbcommands.h"
+#include "distributed/citus_ruleutils.h"
 #include "distributed/colocation_utils.h"
 #include "distributed/connection_management.h"
 #include "distributed/listutils.h"
+#include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/metadata_sync.h"
+#include "distributed/multi_copy.h"
+#include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_router_executor.h"
+#include "distributed/reference_table_utils.h"
+#include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
 #include "distributed/resource_lock.h"
+#include "distributed/transaction_management.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/worker_transaction.h"
 #include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
+#include "storage/latch.h"
+#include "storage/lmgr.h"
 #include "storage/lock.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
 #include "utils/errcodes.h"
 #include "utils/lsyscache.h"
 #include "utils/palloc.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
 
 
 #define TRANSFER_MODE_AUTOMATIC 'a'
 #define TRANSFER_MODE_FORCE_LOGICAL 'l'
 #define TRANSFER_MODE_BLOCK_WRITES 'b'
 
+/* names of the replication objects used to move the shards of a colocation group */
+#define SHARD_MOVE_PUBLICATION_PREFIX "citus_shard_move_publication_"
+#define SHARD_MOVE_SUBSCRIPTION_PREFIX "citus_shard_move_subscription_"
+
+/* time to wait between checks of the replication progress, in microseconds */
+#define SHARD_MOVE_POLL_INTERVAL 100000L
+
+/* commands that stream the rows of a shard through the coordinator */
+#define COPY_SHARD_TO_STDOUT_COMMAND "COPY %s TO STDOUT WITH (FORMAT %s)"
+#define COPY_SHARD_FROM_STDIN_COMMAND "COPY %s FROM STDIN WITH (FORMAT %s)"
+
+
+/*
+ * ShardCopyStream represents the copy of a shard from a source node to a target
+ * node, for which the coordinator passes the output of a COPY .. TO STDOUT on
+ * the source on to a COPY .. FROM STDIN on the target. The target recreates
+ * the shard in a transaction that commits once the rows are copied.
+ */
+typedef struct ShardCopyStream
+{
+	ShardInterval *shardInterval;
+	MultiConnection *sourceConnection;
+	MultiConnection *targetConnection;
+} ShardCopyStream;
+
+
+/* PlacementRepair represents the repair of an inactive placement of a shard */
+typedef struct PlacementRepair
+{
+	ShardPlacement *sourcePlacement;
+	ShardPlacement *targetPlacement;
+} PlacementRepair;
+
 
 /* local function forward declarations */
 static char LookupShardTransferMode(Oid shardReplicationModeOid);
@@ -51,12 +102,71 @@ static void RepairShardPlacement(int64 shardId, char *sourceNodeName,
 static void EnsureShardCanBeRepaired(int64 shardId, char *sourceNodeName,
 									 int32 sourceNodePort, char *targetNodeName,
 									 int32 targetNodePort);
+static void EnsureTableCanBeRepaired(Oid relationId);
+static int RepairNodePlacements(char *nodeName, int32 nodePort,
+								int maxConcurrentRepairs);
+static List * NodePlacementRepairList(WorkerNode *workerNode);
+static bool NodeGroupHasInactivePlacement(uint64 shardId, uint32 groupId);
+static void CopyShardData(ShardInterval *shardInterval, char *sourceNodeName,
+						  int32 sourceNodePort, char *targetNodeName,
+						  int32 targetNodePort, bool createForeignConstraints);
+static ShardCopyStream * StartShardCopyStream(ShardInterval *shardInterval,
+											  char *sourceNodeName,
+											  int32 sourceNodePort,
+											  char *targetNodeName,
+											  int32 targetNodePort);
+static bool ReceiveShardCopyData(ShardCopyStream *copyStream);
+static void FinishShardCopyStream(ShardCopyStream *copyStream,
+								  bool createForeignConstraints);
+static void WaitForShardCopyStreams(List *copyStreamList);
+static void MoveShardPlacement(int64 shardId, char *sourceNodeName,
+							   int32 sourceNodePort, char *targetNodeName,
+							   int32 targetNodePort, char shardReplicationMode);
+static void EnsureTableCanBeMoved(Oid relationId);
+static void EnsureShardsCanBeMoved(List *shardIntervalList, char *sourceNodeName,
+								   int32 sourceNodePort, char *targetNodeName,
+								   int32 targetNodePort);
+static char * LogicalReplicationBlocker(List *shardIntervalList);
+static void CopyShardsBlockingWrites(List *shardIntervalList, char *sourceNodeName,
+									 int32 sourceNodePort, char *targetNodeName,
+									 int32 targetNodePort);
+static void CreateShardForeignConstraints(List *shardIntervalList,
+										  char *targetNodeName, int32 targetNodePort);
+static void UpdateMovedShardPlacements(List *shardIntervalList, char *sourceNodeName,
+									   int32 sourceNodePort, WorkerNode *targetNode);
+static void DropShardsOnNode(List *shardIntervalList, char *nodeName, int32 nodePort);
+#if (PG_VERSION_NUM >= 100000)
+static void LogicallyReplicateShards(List *shardIntervalList, char *sourceNodeName,
+									 int32 sourceNodePort, char *targetNodeName,
+									 int32 targetNodePort);
+static List * CreateShardWithIndexesCommandList(ShardInterval *shardInterval);
+static char * ShardMovePublicationCommand(List *shardIntervalList,
+										  char *publicationName);
+static char * ShardMoveSubscriptionCommand(char *subscriptionName,
+										   char *publicationName, char *nodeName,
+										   int32 nodePort);
+static void AppendConnectionValue(StringInfo buffer, const char *value);
+static void WaitForInitialSync(MultiConnection *targetConnection,
+							   char *subscriptionName);
+static void WaitForCatchUp(MultiConnection *sourceConnection, char *slotName);
+static void DropFailedShardMoveObjects(List *shardIntervalList, char *sourceNodeName,
+									   int32 sourceNodePort, char *targetNodeName,
+									   int32 targetNodePort, char *publicationName,
+									   char *subscriptionName);
+static void DropLeftoverReplicationObjects(MultiConnection *sourceConnection,
+										   MultiConnection *targetConnection,
+										   char *publicationName,
+										   char *subscriptionName);
+static char * ExecuteRemoteQueryForValue(MultiConnection *connection,
+										 const char *query);
+#endif
 static List * RecreateTableDDLCommandList(Oid relationId);
 static List * WorkerApplyShardDDLCommandList(List *ddlCommandList, int64 shardId);
 
 /* declarations for dynamic loading */
 PG_FUNCTION_INFO_V1(master_copy_shard_placement);
 PG_FUNCTION_INFO_V1(master_move_shard_placement);
+PG_FUNCTION_INFO_V1(master_repair_node_placements);
 
 
 /*
@@ -111,14 +221,61 @@ master_copy_shard_placement(PG_FUNCTION_ARGS)
 
 /*
  * master_move_shard_placement moves given shard (and its co-located shards) from one
- * node to the other node.
+ * node to the other node. With logical replication, writes to the shards are only
+ * blocked while the target catches up with the last changes. Otherwise they are
+ * blocked while the shards are copied.
  */
 Datum
 master_move_shard_placement(PG_FUNCTION_ARGS)
 {
-	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-					errmsg("master_move_shard_placement() is only supported on "
-						   "Citus Enterprise")));
+	int64 shardId = PG_GETARG_INT64(0);
+	text *sourceNodeNameText = PG_GETARG_TEXT_P(1);
+	int32 sourceNodePort = PG_GETARG_INT32(2);
+	text *targetNodeNameText = PG_GETARG_TEXT_P(3);
+	int32 targetNodePort = PG_GETARG_INT32(4);
+	Oid shardReplicationModeOid = PG_GETARG_OID(5);
+	char shardReplicationMode = LookupShardTransferMode(shardReplicationModeOid);
+
+	char *sourceNodeName = text_to_cstring(sourceNodeNameText);
+	char *targetNodeName = text_to_cstring(targetNodeNameText);
+
+	EnsureCoordinator();
+	CheckCitusVersion(ERROR);
+
+	MoveShardPlacement(shardId, sourceNodeName, sourceNodePort, targetNodeName,
+					   targetNodePort, shardReplicationMode);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * master_repair_node_placements repairs all inactive placements on the given
+ * node from healthy placements on other nodes, copying up to the given number
+ * of shards at the same time. It returns the number of repaired placements.
+ */
+Datum
+master_repair_node_placements(PG_FUNCTION_ARGS)
+{
+	text *nodeNameText = PG_GETARG_TEXT_P(0);
+	int32 nodePort = PG_GETARG_INT32(1);
+	int32 maxConcurrentRepairs = PG_GETARG_INT32(2);
+	char *nodeName = text_to_cstring(nodeNameText);
+	int repairedPlacementCount = 0;
+
+	EnsureCoordinator();
+	CheckCitusVersion(ERROR);
+
+	if (maxConcurrentRepairs < 1)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("max_concurrent_repairs must be at least 1")));
+	}
+
+	repairedPlacementCount = RepairNodePlacements(nodeName, nodePort,
+												  maxConcurrentRepairs);
+
+	PG_RETURN_INT32(repairedPlacementCount);
 }
 
 
@@ -165,27 +322,14 @@ RepairShardPlacement(int64 shardId, char *sourceNodeName, int32 sourceNodePort,
 {
 	ShardInterval *shardInterval = LoadShardInterval(shardId);
 	Oid distributedTableId = shardInterval->relationId;
-
-	char relationKind = get_rel_relkind(distributedTableId);
-	char *tableOwner = TableOwner(shardInterval->relationId);
 	bool missingOk = false;
+	bool createForeignConstraints = true;
 
-	List *ddlCommandList = NIL;
-	List *foreignConstraintCommandList = NIL;
 	List *placementList = NIL;
 	ShardPlacement *placement = NULL;
 
 	EnsureTableOwner(distributedTableId);
-
-	if (relationKind == RELKIND_FOREIGN_TABLE)
-	{
-		char *relationName = get_rel_name(distributedTableId);
-		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-						errmsg("cannot repair shard"),
-						errdetail("Table %s is a foreign table. Repairing "
-								  "shards backed by foreign tables is "
-								  "not supported.", relationName)));
-	}
+	EnsureTableCanBeRepaired(distributedTableId);
 
 	/*
 	 * We plan to move the placement to the healthy state, so we need to grab a shard
@@ -200,12 +344,9 @@ RepairShardPlacement(int64 shardId, char *sourceNodeName, int32 sourceNodePort,
 	EnsureShardCanBeRepaired(shardId, sourceNodeName, sourceNodePort, targetNodeName,
 							 targetNodePort);
 
-	/* we generate necessary commands to recreate the shard in target node */
-	ddlCommandList = CopyShardCommandList(shardInterval, sourceNodeName, sourceNodePort);
-	foreignConstraintCommandList = CopyShardForeignConstraintCommandList(shardInterval);
-	ddlCommandList = list_concat(ddlCommandList, foreignConstraintCommandList);
-	SendCommandListToWorkerInSingleTransaction(targetNodeName, targetNodePort, tableOwner,
-											   ddlCommandList);
+	/* recreate the shard on the target node and stream the rows into it */
+	CopyShardData(shardInterval, sourceNodeName, sourceNodePort, targetNodeName,
+				  targetNodePort, createForeignConstraints);
 
 	/* after successful repair, we update shard state as healthy*/
 	placementList = ShardPlacementList(shardId);
@@ -247,6 +388,1337 @@ EnsureShardCanBeRepaired(int64 shardId, char *sourceNodeName, int32 sourceNodePo
 }
 
 
+/*
+ * EnsureTableCanBeRepaired errors out if the placements of the given table cannot
+ * be repaired.
+ */
+static void
+EnsureTableCanBeRepaired(Oid relationId)
+{
+	if (get_rel_relkind(relationId) == RELKIND_FOREIGN_TABLE)
+	{
+		char *relationName = get_rel_name(relationId);
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot repair shard"),
+						errdetail("Table %s is a foreign table. Repairing "
+								  "shards backed by foreign tables is "
+								  "not supported.", relationName)));
+	}
+}
+
+
+/*
+ * RepairNodePlacements repairs the inactive placements on the given node, with
+ * up to maxConcurrentRepairs shards streaming from their source nodes at the
+ * same time. The placements are marked healthy once all shards are copied, and
+ * stay locked until the transaction ends.
+ */
+static int
+RepairNodePlacements(char *nodeName, int32 nodePort, int maxConcurrentRepairs)
+{
+	WorkerNode *workerNode = FindWorkerNode(nodeName, nodePort);
+	List *repairList = NIL;
+	List *sourcePlacementList = NIL;
+	ListCell *repairCell = NULL;
+
+	if (workerNode == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("node %s:%d does not exist", nodeName, nodePort)));
+	}
+
+	repairList = NodePlacementRepairList(workerNode);
+
+	foreach(repairCell, repairList)
+	{
+		PlacementRepair *repair = (PlacementRepair *) lfirst(repairCell);
+
+		sourcePlacementList = lappend(sourcePlacementList, repair->sourcePlacement);
+	}
+
+	StreamShardPlacementsToNode(sourcePlacementList, workerNode->workerName,
+								workerNode->workerPort, maxConcurrentRepairs);
+
+	foreach(repairCell, repairList)
+	{
+		PlacementRepair *repair = (PlacementRepair *) lfirst(repairCell);
+
+		UpdateShardPlacementState(repair->targetPlacement->placementId,
+								  FILE_FINALIZED);
+	}
+
+	return list_length(repairList);
+}
+
+
+/*
+ * StreamShardPlacementsToNode copies the shards of the given healthy source
+ * placements to the target node, with up to maxConcurrentCopies shards
+ * streaming from their source nodes at the same time. Each shard commits on
+ * the target node once its rows are loaded and its indexes are built, and the
+ * foreign keys are created after all shards exist on the target node, since
+ * they may reference each other. The caller locks the shards and updates the
+ * placement metadata.
+ */
+void
+StreamShardPlacementsToNode(List *sourcePlacementList, char *targetNodeName,
+							int32 targetNodePort, int maxConcurrentCopies)
+{
+	List *pendingPlacementList = list_copy(sourcePlacementList);
+	List *activeCopyStreamList = NIL;
+	List *shardIntervalList = NIL;
+
+	while (pendingPlacementList != NIL || activeCopyStreamList != NIL)
+	{
+		List *remainingCopyStreamList = NIL;
+		ListCell *copyStreamCell = NULL;
+		bool copyFinished = false;
+
+		while (pendingPlacementList != NIL &&
+			   list_length(activeCopyStreamList) < maxConcurrentCopies)
+		{
+			ShardPlacement *sourcePlacement =
+				(ShardPlacement *) linitial(pendingPlacementList);
+			ShardInterval *shardInterval = LoadShardInterval(sourcePlacement->shardId);
+			ShardCopyStream *copyStream = NULL;
+
+			pendingPlacementList = list_delete_first(pendingPlacementList);
+
+			copyStream = StartShardCopyStream(shardInterval, sourcePlacement->nodeName,
+											  sourcePlacement->nodePort, targetNodeName,
+											  targetNodePort);
+
+			activeCopyStreamList = lappend(activeCopyStreamList, copyStream);
+			shardIntervalList = lappend(shardIntervalList, shardInterval);
+		}
+
+		foreach(copyStreamCell, activeCopyStreamList)
+		{
+			ShardCopyStream *copyStream = (ShardCopyStream *) lfirst(copyStreamCell);
+			bool createForeignConstraints = false;
+
+			if (!ReceiveShardCopyData(copyStream))
+			{
+				remainingCopyStreamList = lappend(remainingCopyStreamList, copyStream);
+				continue;
+			}
+
+			FinishShardCopyStream(copyStream, createForeignConstraints);
+
+			copyFinished = true;
+		}
+
+		activeCopyStreamList = remainingCopyStreamList;
+
+		if (!copyFinished && activeCopyStreamList != NIL)
+		{
+			WaitForShardCopyStreams(activeCopyStreamList);
+		}
+	}
+
+	CreateShardForeignConstraints(shardIntervalList, targetNodeName, targetNodePort);
+}
+
+
+/*
+ * NodePlacementRepairList returns a PlacementRepair for each inactive placement
+ * on the given node, with a healthy placement on another node as its source.
+ * It locks the shards in a consistent order to block concurrent repairs and
+ * modifications.
+ */
+static List *
+NodePlacementRepairList(WorkerNode *workerNode)
+{
+	List *distTableOidList = SortList(DistTableOidList(), CompareOids);
+	ListCell *distTableOidCell = NULL;
+	List *repairList = NIL;
+
+	foreach(distTableOidCell, distTableOidList)
+	{
+		Oid relationId = lfirst_oid(distTableOidCell);
+		List *shardIntervalList = LoadShardIntervalList(relationId);
+		ListCell *shardIntervalCell = NULL;
+
+		foreach(shardIntervalCell, shardIntervalList)
+		{
+			ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+			uint64 shardId = shardInterval->shardId;
+			List *shardPlacementList = NIL;
+			ListCell *shardPlacementCell = NULL;
+			ShardPlacement *sourcePlacement = NULL;
+			ShardPlacement *targetPlacement = NULL;
+			PlacementRepair *repair = NULL;
+
+			if (!NodeGroupHasInactivePlacement(shardId, workerNode->groupId))
+			{
+				continue;
+			}
+
+			EnsureTableOwner(relationId);
+			EnsureTableCanBeRepaired(relationId);
+
+			LockShardDistributionMetadata(shardId, ExclusiveLock);
+
+			/* the placements may have changed while we waited for the lock */
+			shardPlacementList = ShardPlacementList(shardId);
+			foreach(shardPlacementCell, shardPlacementList)
+			{
+				ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+
+				if (placement->groupId == workerNode->groupId)
+				{
+					if (placement->shardState == FILE_INACTIVE)
+					{
+						targetPlacement = placement;
+					}
+				}
+				else if (placement->shardState == FILE_FINALIZED &&
+						 sourcePlacement == NULL)
+				{
+					sourcePlacement = placement;
+				}
+			}
+
+			if (targetPlacement == NULL)
+			{
+				continue;
+			}
+
+			if (sourcePlacement == NULL)
+			{
+				ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+								errmsg("cannot repair shard " UINT64_FORMAT, shardId),
+								errdetail("The shard has no healthy placement on "
+										  "another node.")));
+			}
+
+			repair = palloc0(sizeof(PlacementRepair));
+			repair->sourcePlacement = sourcePlacement;
+			repair->targetPlacement = targetPlacement;
+
+			repairList = lappend(repairList, repair);
+		}
+	}
+
+	return repairList;
+}
+
+
+/*
+ * NodeGroupHasInactivePlacement returns whether the given shard has an inactive
+ * placement in the given group.
+ */
+static bool
+NodeGroupHasInactivePlacement(uint64 shardId, uint32 groupId)
+{
+	List *shardPlacementList = ShardPlacementList(shardId);
+	ListCell *shardPlacementCell = NULL;
+
+	foreach(shardPlacementCell, shardPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+
+		if (placement->groupId == groupId && placement->shardState == FILE_INACTIVE)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * CopyShardData recreates the given shard on the target node and streams its
+ * rows from the source node into it. With createForeignConstraints, the foreign
+ * keys of the shard are created along with its indexes.
+ */
+static void
+CopyShardData(ShardInterval *shardInterval, char *sourceNodeName, int32 sourceNodePort,
+			  char *targetNodeName, int32 targetNodePort, bool createForeignConstraints)
+{
+	ShardCopyStream *copyStream = StartShardCopyStream(shardInterval, sourceNodeName,
+													   sourceNodePort, targetNodeName,
+													   targetNodePort);
+	List *copyStreamList = list_make1(copyStream);
+
+	while (!ReceiveShardCopyData(copyStream))
+	{
+		WaitForShardCopyStreams(copyStreamList);
+	}
+
+	FinishShardCopyStream(copyStream, createForeignConstraints);
+}
+
+
+/*
+ * StartShardCopyStream opens new connections to the source and target nodes
+ * as the owner of the table, recreates the shard on the target node in a new
+ * transaction, and starts the COPY commands, using the binary format when all
+ * column types support it.
+ *
+ * Unlike worker_append_table_to_shard, the rows are not first written to a
+ * file on the target node.
+ */
+static ShardCopyStream *
+StartShardCopyStream(ShardInterval *shardInterval, char *sourceNodeName,
+					 int32 sourceNodePort, char *targetNodeName, int32 targetNodePort)
+{
+	ShardCopyStream *copyStream = palloc0(sizeof(ShardCopyStream));
+	Oid relationId = shardInterval->relationId;
+	char *tableOwner = TableOwner(relationId);
+	char *shardName = ConstructQualifiedShardName(shardInterval);
+	List *tableRecreationCommandList = NIL;
+	ListCell *commandCell = NULL;
+	StringInfo copyFromCommand = makeStringInfo();
+	StringInfo copyToCommand = makeStringInfo();
+	uint32 connectionFlags = FORCE_NEW_CONNECTION;
+	Relation distributedRelation = NULL;
+	char *copyFormat = "text";
+	MultiConnection *sourceConnection = NULL;
+	MultiConnection *targetConnection = NULL;
+	PGresult *result = NULL;
+	bool raiseInterrupts = true;
+
+	if (XactModificationLevel > XACT_MODIFICATION_NONE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_ACTIVE_SQL_TRANSACTION),
+						errmsg("cannot open new connections after the first modification "
+							   "command within a transaction")));
+	}
+
+	distributedRelation = heap_open(relationId, AccessShareLock);
+	if (CanUseBinaryCopyFormat(RelationGetDescr(distributedRelation)))
+	{
+		copyFormat = "binary";
+	}
+
+	heap_close(distributedRelation, NoLock);
+
+	tableRecreationCommandList = RecreateTableDDLCommandList(relationId);
+	tableRecreationCommandList =
+		WorkerApplyShardDDLCommandList(tableRecreationCommandList,
+									   shardInterval->shardId);
+
+	targetConnection = GetNodeUserDatabaseConnection(connectionFlags, targetNodeName,
+													 targetNodePort, tableOwner, NULL);
+
+	MarkRemoteTransactionCritical(targetConnection);
+	RemoteTransactionBegin(targetConnection);
+
+	foreach(commandCell, tableRecreationCommandList)
+	{
+		char *command = (char *) lfirst(commandCell);
+
+		ExecuteCriticalRemoteCommand(targetConnection, command);
+	}
+
+	appendStringInfo(copyFromCommand, COPY_SHARD_FROM_STDIN_COMMAND, shardName,
+					 copyFormat);
+
+	if (!SendRemoteCommand(targetConnection, copyFromCommand->data))
+	{
+		ReportConnectionError(targetConnection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(targetConnection, raiseInterrupts);
+	if (PQresultStatus(result) != PGRES_COPY_IN)
+	{
+		ReportResultError(targetConnection, result, ERROR);
+	}
+
+	PQclear(result);
+
+	sourceConnection = GetNodeUserDatabaseConnection(connectionFlags, sourceNodeName,
+													 sourceNodePort, tableOwner, NULL);
+
+	appendStringInfo(copyToCommand, COPY_SHARD_TO_STDOUT_COMMAND, shardName,
+					 copyFormat);
+
+	if (!SendRemoteCommand(sourceConnection, copyToCommand->data))
+	{
+		ReportConnectionError(sourceConnection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(sourceConnection, raiseInterrupts);
+	if (PQresultStatus(result) != PGRES_COPY_OUT)
+	{
+		ReportResultError(sourceConnection, result, ERROR);
+	}
+
+	PQclear(result);
+
+	copyStream->shardInterval = shardInterval;
+	copyStream->sourceConnection = sourceConnection;
+	copyStream->targetConnection = targetConnection;
+
+	return copyStream;
+}
+
+
+/*
+ * ReceiveShardCopyData passes the rows that the source node sent so far on to
+ * the target node, without waiting for more. It returns true once the source
+ * sent all rows and both COPY commands completed, and false otherwise.
+ */
+static bool
+ReceiveShardCopyData(ShardCopyStream *copyStream)
+{
+	MultiConnection *sourceConnection = copyStream->sourceConnection;
+	MultiConnection *targetConnection = copyStream->targetConnection;
+	PGresult *result = NULL;
+	bool raiseInterrupts = true;
+
+	if (PQconsumeInput(sourceConnection->pgConn) == 0)
+	{
+		ReportConnectionError(sourceConnection, ERROR);
+	}
+
+	while (true)
+	{
+		char *buffer = NULL;
+		bool async = true;
+		int bufferLength = PQgetCopyData(sourceConnection->pgConn, &buffer, async);
+
+		if (bufferLength == 0)
+		{
+			/* no complete row yet, wait for the source */
+			return false;
+		}
+		else if (bufferLength == -1)
+		{
+			break;
+		}
+		else if (bufferLength == -2)
+		{
+			ReportConnectionError(sourceConnection, ERROR);
+		}
+
+		if (!PutRemoteCopyData(targetConnection, buffer, bufferLength))
+		{
+			ReportConnectionError(targetConnection, ERROR);
+		}
+
+		PQfreemem(buffer);
+	}
+
+	/* the source sent all rows, check that both COPY commands succeeded */
+	result = GetRemoteCommandResult(sourceConnection, raiseInterrupts);
+	if (!IsResponseOK(result))
+	{
+		ReportResultError(sourceConnection, result, ERROR);
+	}
+
+	PQclear(result);
+	ForgetResults(sourceConnection);
+
+	if (!PutRemoteCopyEnd(targetConnection, NULL))
+	{
+		ReportConnectionError(targetConnection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(targetConnection, raiseInterrupts);
+	if (!IsResponseOK(result))
+	{
+		ReportResultError(targetConnection, result, ERROR);
+	}
+
+	PQclear(result);
+	ForgetResults(targetConnection);
+
+	return true;
+}
+
+
+/*
+ * FinishShardCopyStream creates the indexes and constraints of the copied shard
+ * on the target node, commits the transaction on the target node and closes
+ * the connections of the stream.
+ */
+static void
+FinishShardCopyStream(ShardCopyStream *copyStream, bool createForeignConstraints)
+{
+	ShardInterval *shardInterval = copyStream->shardInterval;
+	MultiConnection *targetConnection = copyStream->targetConnection;
+	List *indexCommandList = NIL;
+	ListCell *commandCell = NULL;
+
+	indexCommandList = GetTableIndexAndConstraintCommands(shardInterval->relationId);
+	indexCommandList = WorkerApplyShardDDLCommandList(indexCommandList,
+													  shardInterval->shardId);
+
+	if (createForeignConstraints)
+	{
+		List *foreignConstraintCommandList =
+			CopyShardForeignConstraintCommandList(shardInterval);
+
+		indexCommandList = list_concat(indexCommandList, foreignConstraintCommandList);
+	}
+
+	foreach(commandCell, indexCommandList)
+	{
+		char *command = (char *) lfirst(commandCell);
+
+		ExecuteCriticalRemoteCommand(targetConnection, command);
+	}
+
+	RemoteTransactionCommit(targetConnection);
+
+	CloseConnection(targetConnection);
+	CloseConnection(copyStream->sourceConnection);
+}
+
+
+/*
+ * WaitForShardCopyStreams waits until the connection to the source node of
+ * one of the given shard copy streams becomes readable.
+ */
+static void
+WaitForShardCopyStreams(List *copyStreamList)
+{
+	WaitEventSet *waitEventSet = NULL;
+	ListCell *copyStreamCell = NULL;
+	WaitEvent event;
+	int eventCount = 0;
+	long timeout = -1;
+
+	/* make room for the signal latch and postmaster death events */
+	waitEventSet = CreateWaitEventSet(CurrentMemoryContext,
+									  list_length(copyStreamList) + 2);
+
+	foreach(copyStreamCell, copyStreamList)
+	{
+		ShardCopyStream *copyStream = (ShardCopyStream *) lfirst(copyStreamCell);
+		int sock = PQsocket(copyStream->sourceConnection->pgConn);
+
+		AddWaitEventToSet(waitEventSet, WL_SOCKET_READABLE, sock, NULL, NULL);
+	}
+
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+#if (PG_VERSION_NUM >= 100000)
+	eventCount = WaitEventSetWait(waitEventSet, timeout, &event, 1,
+								  WAIT_EVENT_CLIENT_READ);
+#else
+	eventCount = WaitEventSetWait(waitEventSet, timeout, &event, 1);
+#endif
+
+	FreeWaitEventSet(waitEventSet);
+
+	if (eventCount > 0 && (event.events & WL_POSTMASTER_DEATH))
+	{
+		ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+	}
+
+	if (eventCount > 0 && (event.events & WL_LATCH_SET))
+	{
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+
+/*
+ * MoveShardPlacement moves the given shard and its co-located shards from the
+ * source node to the target node, and drops them on the source node once the
+ * placements point to the target node.
+ */
+static void
+MoveShardPlacement(int64 shardId, char *sourceNodeName, int32 sourceNodePort,
+				   char *targetNodeName, int32 targetNodePort,
+				   char shardReplicationMode)
+{
+	ShardInterval *shardInterval = LoadShardInterval(shardId);
+	Oid distributedTableId = shardInterval->relationId;
+	List *colocatedTableList = ColocatedTableList(distributedTableId);
+	ListCell *colocatedTableCell = NULL;
+	List *colocatedShardList = NIL;
+	WorkerNode *targetNode = NULL;
+	bool useLogicalReplication = false;
+
+	/*
+	 * Block concurrent moves and DDL on the tables, but not reads and writes,
+	 * which only block on the shard metadata locks.
+	 */
+	colocatedTableList = SortList(colocatedTableList, CompareOids);
+	foreach(colocatedTableCell, colocatedTableList)
+	{
+		Oid colocatedTableId = lfirst_oid(colocatedTableCell);
+
+		EnsureTableOwner(colocatedTableId);
+		LockRelationOid(colocatedTableId, ShareUpdateExclusiveLock);
+		EnsureTableCanBeMoved(colocatedTableId);
+	}
+
+	colocatedShardList = ColocatedShardIntervalList(shardInterval);
+	colocatedShardList = SortList(colocatedShardList, CompareShardIntervalsById);
+
+	EnsureShardsCanBeMoved(colocatedShardList, sourceNodeName, sourceNodePort,
+						   targetNodeName, targetNodePort);
+
+	targetNode = FindWorkerNode(targetNodeName, targetNodePort);
+	if (targetNode == NULL || !targetNode->isActive || !WorkerNodeIsPrimary(targetNode))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("target node %s:%d is not an active primary node",
+							   targetNodeName, targetNodePort)));
+	}
+
+	if (shardReplicationMode != TRANSFER_MODE_BLOCK_WRITES)
+	{
+		char *blocker = LogicalReplicationBlocker(colocatedShardList);
+
+		if (blocker == NULL)
+		{
+			useLogicalReplication = true;
+		}
+		else if (shardReplicationMode == TRANSFER_MODE_FORCE_LOGICAL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("cannot use logical replication to move shard "
+								   INT64_FORMAT, shardId),
+							errdetail("%s", blocker)));
+		}
+		else
+		{
+			ereport(NOTICE, (errmsg("moving shard " INT64_FORMAT " while blocking "
+									"writes", shardId),
+							 errdetail("%s", blocker)));
+		}
+	}
+
+	if (useLogicalReplication)
+	{
+#if (PG_VERSION_NUM >= 100000)
+
+		/* subscriptions cannot be created in a transaction block */
+		PreventTransactionChain(true, "master_move_shard_placement");
+
+		LogicallyReplicateShards(colocatedShardList, sourceNodeName, sourceNodePort,
+								 targetNodeName, targetNodePort);
+#endif
+	}
+	else
+	{
+		LockShardListMetadata(colocatedShardList, ExclusiveLock);
+
+		CopyShardsBlockingWrites(colocatedShardList, sourceNodeName, sourceNodePort,
+								 targetNodeName, targetNodePort);
+	}
+
+	/* writes are blocked from here on, commit the new placements with the drops */
+	UpdateMovedShardPlacements(colocatedShardList, sourceNodeName, sourceNodePort,
+							   targetNode);
+	DropShardsOnNode(colocatedShardList, sourceNodeName, sourceNodePort);
+}
+
+
+/*
+ * EnsureTableCanBeMoved errors out if the shards of the given table cannot
+ * be moved to another node.
+ */
+static void
+EnsureTableCanBeMoved(Oid relationId)
+{
+	char *relationName = get_rel_name(relationId);
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+
+	if (cacheEntry->partitionMethod == DISTRIBUTE_BY_NONE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot move shard"),
+						errdetail("Table %s is a reference table, which has a "
+								  "placement on every node.", relationName)));
+	}
+
+	if (get_rel_relkind(relationId) == RELKIND_FOREIGN_TABLE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot move shard"),
+						errdetail("Table %s is a foreign table. Moving shards "
+								  "backed by foreign tables is not supported.",
+								  relationName)));
+	}
+
+	if (PartitionedTable(relationId) || PartitionTable(relationId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot move shard"),
+						errdetail("Table %s is a partitioned table or a partition. "
+								  "Moving shards of partitioned tables is not "
+								  "supported.", relationName)));
+	}
+}
+
+
+/*
+ * EnsureShardsCanBeMoved checks that the given shards have a healthy placement
+ * on the source node and no placement on the target node.
+ */
+static void
+EnsureShardsCanBeMoved(List *shardIntervalList, char *sourceNodeName,
+					   int32 sourceNodePort, char *targetNodeName, int32 targetNodePort)
+{
+	ListCell *shardIntervalCell = NULL;
+
+	if (strncmp(sourceNodeName, targetNodeName, MAX_NODE_LENGTH) == 0 &&
+		sourceNodePort == targetNodePort)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("source and target nodes must be different")));
+	}
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		List *shardPlacementList = ShardPlacementList(shardId);
+		ShardPlacement *sourcePlacement = NULL;
+		ShardPlacement *targetPlacement = NULL;
+		bool missingSourceOk = false;
+		bool missingTargetOk = true;
+
+		sourcePlacement = SearchShardPlacementInList(shardPlacementList, sourceNodeName,
+													 sourceNodePort, missingSourceOk);
+		if (sourcePlacement->shardState != FILE_FINALIZED)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("source placement of shard " UINT64_FORMAT
+								   " must be in finalized state", shardId)));
+		}
+
+		targetPlacement = SearchShardPlacementInList(shardPlacementList, targetNodeName,
+													 targetNodePort, missingTargetOk);
+		if (targetPlacement != NULL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("shard " UINT64_FORMAT " already has a placement "
+								   "on node %s:%d", shardId, targetNodeName,
+								   targetNodePort)));
+		}
+	}
+}
+
+
+/*
+ * LogicalReplicationBlocker returns the reason why the given shards cannot be
+ * moved using logical replication, or NULL if they can.
+ */
+static char *
+LogicalReplicationBlocker(List *shardIntervalList)
+{
+#if (PG_VERSION_NUM >= 100000)
+	ListCell *shardIntervalCell = NULL;
+
+	if (IsTransactionBlock())
+	{
+		return "Subscriptions cannot be created in a transaction block.";
+	}
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		Oid relationId = shardInterval->relationId;
+		Relation relation = heap_open(relationId, AccessShareLock);
+		char replicaIdentity = relation->rd_rel->relreplident;
+		bool hasReplicaIdentity = false;
+
+		if (replicaIdentity == REPLICA_IDENTITY_FULL)
+		{
+			hasReplicaIdentity = true;
+		}
+		else if (replicaIdentity != REPLICA_IDENTITY_NOTHING)
+		{
+			/* the primary key or the replica identity index */
+			hasReplicaIdentity = OidIsValid(RelationGetReplicaIndex(relation));
+		}
+
+		heap_close(relation, NoLock);
+
+		if (!hasReplicaIdentity)
+		{
+			StringInfo blocker = makeStringInfo();
+
+			appendStringInfo(blocker, "Table %s does not have a replica identity, "
+										"which is needed to replicate updates and "
+										"deletes.", get_rel_name(relationId));
+
+			return blocker->data;
+		}
+	}
+
+	return NULL;
+#else
+	return "Logical replication requires PostgreSQL 10 or higher.";
+#endif
+}
+
+
+/*
+ * CopyShardsBlockingWrites copies the given shards from the source node to the
+ * target node. The caller blocks writes to the shards for the whole copy.
+ */
+static void
+CopyShardsBlockingWrites(List *shardIntervalList, char *sourceNodeName,
+						 int32 sourceNodePort, char *targetNodeName,
+						 int32 targetNodePort)
+{
+	ListCell *shardIntervalCell = NULL;
+	bool createForeignConstraints = false;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+
+		CopyShardData(shardInterval, sourceNodeName, sourceNodePort, targetNodeName,
+					  targetNodePort, createForeignConstraints);
+	}
+
+	/* foreign keys may reference any of the co-located shards */
+	CreateShardForeignConstraints(shardIntervalList, targetNodeName, targetNodePort);
+}
+
+
+/*
+ * CreateShardForeignConstraints creates the foreign keys of the given shards on
+ * the target node, once all of them have been created there.
+ */
+static void
+CreateShardForeignConstraints(List *shardIntervalList, char *targetNodeName,
+							  int32 targetNodePort)
+{
+	ListCell *shardIntervalCell = NULL;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		char *tableOwner = TableOwner(shardInterval->relationId);
+		List *commandList = CopyShardForeignConstraintCommandList(shardInterval);
+
+		if (commandList != NIL)
+		{
+			SendCommandListToWorkerInSingleTransaction(targetNodeName, targetNodePort,
+													   tableOwner, commandList);
+		}
+	}
+}
+
+
+/*
+ * UpdateMovedShardPlacements points the placements of the given shards on the
+ * source node to the group of the target node, also on the workers with
+ * metadata.
+ */
+static void
+UpdateMovedShardPlacements(List *shardIntervalList, char *sourceNodeName,
+						   int32 sourceNodePort, WorkerNode *targetNode)
+{
+	ListCell *shardIntervalCell = NULL;
+	uint32 targetGroupId = targetNode->groupId;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		List *shardPlacementList = ShardPlacementList(shardId);
+		bool missingOk = false;
+		ShardPlacement *placement = SearchShardPlacementInList(shardPlacementList,
+															   sourceNodeName,
+															   sourceNodePort,
+															   missingOk);
+
+		UpdatePlacementGroupId(placement->placementId, targetGroupId);
+
+		if (ShouldSyncTableMetadata(shardInterval->relationId))
+		{
+			char *placementCommand = PlacementUpsertCommand(shardId,
+															placement->placementId,
+															FILE_FINALIZED,
+															placement->shardLength,
+															targetGroupId);
+
+			SendCommandToWorkers(WORKERS_WITH_METADATA, placementCommand);
+		}
+	}
+}
+
+
+/*
+ * DropShardsOnNode drops the given shards on the given node as part of the
+ * coordinated transaction, such that they are only dropped if the transaction
+ * that removes their placements commits.
+ */
+static void
+DropShardsOnNode(List *shardIntervalList, char *nodeName, int32 nodePort)
+{
+	ListCell *shardIntervalCell = NULL;
+	char *extensionOwner = CitusExtensionOwnerName();
+	uint32 connectionFlags = FOR_DDL;
+	MultiConnection *connection = NULL;
+
+	BeginOrContinueCoordinatedTransaction();
+	CoordinatedTransactionUse2PC();
+
+	connection = GetNodeUserDatabaseConnection(connectionFlags, nodeName, nodePort,
+											   extensionOwner, NULL);
+
+	MarkRemoteTransactionCritical(connection);
+	RemoteTransactionBeginIfNecessary(connection);
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		char *qualifiedShardName = ConstructQualifiedShardName(shardInterval);
+		StringInfo dropCommand = makeStringInfo();
+
+		appendStringInfo(dropCommand, DROP_REGULAR_TABLE_COMMAND, qualifiedShardName);
+
+		ExecuteCriticalRemoteCommand(connection, dropCommand->data);
+	}
+}
+
+
+#if (PG_VERSION_NUM >= 100000)
+
+/*
+ * LogicallyReplicateShards copies the given shards from the source node to the
+ * target node using a subscription on the target node to a publication of the
+ * shards on the source node. The subscription first copies the existing rows,
+ * and then streams the changes made in the meantime. We wait for the target to
+ * catch up, then block writes to the shards, and wait for it to catch up with
+ * the last changes before dropping the subscription. If anything fails, the
+ * subscription, replication slot, publication and target shards are dropped.
+ *
+ * Writes from workers with metadata are not blocked by the shard metadata
+ * locks of the coordinator.
+ */
+static void
+LogicallyReplicateShards(List *shardIntervalList, char *sourceNodeName,
+						 int32 sourceNodePort, char *targetNodeName,
+						 int32 targetNodePort)
+{
+	ShardInterval *firstShardInterval = (ShardInterval *) linitial(shardIntervalList);
+	uint64 firstShardId = firstShardInterval->shardId;
+	char *superUser = CitusExtensionOwnerName();
+	uint32 connectionFlags = FORCE_NEW_CONNECTION;
+	MultiConnection *sourceConnection = NULL;
+	MultiConnection *targetConnection = NULL;
+	StringInfo publicationName = makeStringInfo();
+	StringInfo subscriptionName = makeStringInfo();
+	StringInfo dropCommand = makeStringInfo();
+	ListCell *shardIntervalCell = NULL;
+	char *command = NULL;
+	MemoryContext savedContext = CurrentMemoryContext;
+
+	appendStringInfo(publicationName, SHARD_MOVE_PUBLICATION_PREFIX UINT64_FORMAT,
+					 firstShardId);
+	appendStringInfo(subscriptionName, SHARD_MOVE_SUBSCRIPTION_PREFIX UINT64_FORMAT,
+					 firstShardId);
+
+	/* replication objects are not transactional, use separate connections */
+	sourceConnection = GetNodeUserDatabaseConnection(connectionFlags, sourceNodeName,
+													 sourceNodePort, superUser, NULL);
+	targetConnection = GetNodeUserDatabaseConnection(connectionFlags, targetNodeName,
+													 targetNodePort, superUser, NULL);
+
+	DropLeftoverReplicationObjects(sourceConnection, targetConnection,
+								   publicationName->data, subscriptionName->data);
+
+	PG_TRY();
+	{
+		/* the subscription needs the tables and their replica identity indexes */
+		foreach(shardIntervalCell, shardIntervalList)
+		{
+			ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+			char *tableOwner = TableOwner(shardInterval->relationId);
+			List *ddlCommandList = CreateShardWithIndexesCommandList(shardInterval);
+
+			SendCommandListToWorkerInSingleTransaction(targetNodeName, targetNodePort,
+													   tableOwner, ddlCommandList);
+		}
+
+		command = ShardMovePublicationCommand(shardIntervalList, publicationName->data);
+		ExecuteCriticalRemoteCommand(sourceConnection, command);
+
+		command = ShardMoveSubscriptionCommand(subscriptionName->data,
+											   publicationName->data, sourceNodeName,
+											   sourceNodePort);
+		ExecuteCriticalRemoteCommand(targetConnection, command);
+
+		WaitForInitialSync(targetConnection, subscriptionName->data);
+
+		/* catch up once while writes continue, to keep the blocking window short */
+		WaitForCatchUp(sourceConnection, subscriptionName->data);
+
+		LockShardListMetadata(shardIntervalList, ExclusiveLock);
+
+		WaitForCatchUp(sourceConnection, subscriptionName->data);
+
+		/* dropping the subscription also drops its replication slot */
+		appendStringInfo(dropCommand, "DROP SUBSCRIPTION %s",
+						 quote_identifier(subscriptionName->data));
+		ExecuteCriticalRemoteCommand(targetConnection, dropCommand->data);
+
+		resetStringInfo(dropCommand);
+		appendStringInfo(dropCommand, "DROP PUBLICATION %s",
+						 quote_identifier(publicationName->data));
+		ExecuteCriticalRemoteCommand(sourceConnection, dropCommand->data);
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata = NULL;
+
+		MemoryContextSwitchTo(savedContext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		/* the connections may be in the middle of a command */
+		CloseConnection(sourceConnection);
+		CloseConnection(targetConnection);
+
+		DropFailedShardMoveObjects(shardIntervalList, sourceNodeName, sourceNodePort,
+								   targetNodeName, targetNodePort,
+								   publicationName->data, subscriptionName->data);
+
+		ReThrowError(edata);
+	}
+	PG_END_TRY();
+
+	CloseConnection(sourceConnection);
+	CloseConnection(targetConnection);
+
+	CreateShardForeignConstraints(shardIntervalList, targetNodeName, targetNodePort);
+}
+
+
+/*
+ * CreateShardWithIndexesCommandList returns the commands to create the given
+ * shard on a node, with its indexes and replica identity but without data.
+ */
+static List *
+CreateShardWithIndexesCommandList(ShardInterval *shardInterval)
+{
+	Oid relationId = shardInterval->relationId;
+	List *ddlCommandList = RecreateTableDDLCommandList(relationId);
+	List *indexCommandList = GetTableIndexAndConstraintCommands(relationId);
+	char *replicaIdentityCommand = pg_get_replica_identity_command(relationId);
+
+	ddlCommandList = list_concat(ddlCommandList, indexCommandList);
+
+	if (replicaIdentityCommand != NULL)
+	{
+		ddlCommandList = lappend(ddlCommandList, replicaIdentityCommand);
+	}
+
+	return WorkerApplyShardDDLCommandList(ddlCommandList, shardInterval->shardId);
+}
+
+
+/*
+ * ShardMovePublicationCommand returns the command to create a publication of
+ * the given shards with the given name.
+ */
+static char *
+ShardMovePublicationCommand(List *shardIntervalList, char *publicationName)
+{
+	StringInfo command = makeStringInfo();
+	ListCell *shardIntervalCell = NULL;
+	bool firstShard = true;
+
+	appendStringInfo(command, "CREATE PUBLICATION %s FOR TABLE ",
+					 quote_identifier(publicationName));
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+
+		if (!firstShard)
+		{
+			appendStringInfoString(command, ", ");
+		}
+
+		appendStringInfoString(command, ConstructQualifiedShardName(shardInterval));
+		firstShard = false;
+	}
+
+	return command->data;
+}
+
+
+/*
+ * ShardMoveSubscriptionCommand returns the command to create a subscription
+ * with the given name to the given publication on the given node. The
+ * subscription connects to the same database as the extension owner.
+ */
+static char *
+ShardMoveSubscriptionCommand(char *subscriptionName, char *publicationName,
+							 char *nodeName, int32 nodePort)
+{
+	StringInfo connectionString = makeStringInfo();
+	StringInfo command = makeStringInfo();
+
+	appendStringInfoString(connectionString, "host=");
+	AppendConnectionValue(connectionString, nodeName);
+	appendStringInfo(connectionString, " port=%d user=", nodePort);
+	AppendConnectionValue(connectionString, CitusExtensionOwnerName());
+	appendStringInfoString(connectionString, " dbname=");
+	AppendConnectionValue(connectionString, get_database_name(MyDatabaseId));
+	appendStringInfoString(connectionString, " sslmode=");
+	AppendConnectionValue(connectionString, CitusSSLModeString());
+
+	appendStringInfo(command, "CREATE SUBSCRIPTION %s CONNECTION %s PUBLICATION %s",
+					 quote_identifier(subscriptionName),
+					 quote_literal_cstr(connectionString->data),
+					 quote_identifier(publicationName));
+
+	return command->data;
+}
+
+
+/*
+ * AppendConnectionValue appends the given value to a libpq connection string,
+ * quoted as described in the "Parameter Key Words" section of the libpq docs.
+ */
+static void
+AppendConnectionValue(StringInfo buffer, const char *value)
+{
+	const char *character = NULL;
+
+	appendStringInfoChar(buffer, '\'');
+
+	for (character = value; *character != '\0'; character++)
+	{
+		if (*character == '\'' || *character == '\\')
+		{
+			appendStringInfoChar(buffer, '\\');
+		}
+
+		appendStringInfoChar(buffer, *character);
+	}
+
+	appendStringInfoChar(buffer, '\'');
+}
+
+
+/*
+ * WaitForInitialSync waits until the subscription copied the existing rows of
+ * all tables in its publication.
+ */
+static void
+WaitForInitialSync(MultiConnection *targetConnection, char *subscriptionName)
+{
+	StringInfo query = makeStringInfo();
+
+	appendStringInfo(query, "SELECT count(*) FROM pg_subscription_rel, pg_subscription "
+							"WHERE srsubid = pg_subscription.oid AND subname = %s "
+							"AND srsubstate NOT IN ('r', 's')",
+					 quote_literal_cstr(subscriptionName));
+
+	while (true)
+	{
+		char *syncingTableCount = ExecuteRemoteQueryForValue(targetConnection,
+															 query->data);
+
+		if (strcmp(syncingTableCount, "0") == 0)
+		{
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		pg_usleep(SHARD_MOVE_POLL_INTERVAL);
+	}
+}
+
+
+/*
+ * WaitForCatchUp waits until the subscriber confirmed that it flushed all
+ * changes made on the source node up to the time of the call.
+ */
+static void
+WaitForCatchUp(MultiConnection *sourceConnection, char *slotName)
+{
+	StringInfo query = makeStringInfo();
+	char *sourcePosition = ExecuteRemoteQueryForValue(sourceConnection,
+													  "SELECT pg_current_wal_lsn()");
+
+	appendStringInfo(query, "SELECT confirmed_flush_lsn >= %s::pg_lsn "
+							"FROM pg_replication_slots WHERE slot_name = %s",
+					 quote_literal_cstr(sourcePosition), quote_literal_cstr(slotName));
+
+	while (true)
+	{
+		char *caughtUp = ExecuteRemoteQueryForValue(sourceConnection, query->data);
+
+		if (strcmp(caughtUp, "t") == 0)
+		{
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		pg_usleep(SHARD_MOVE_POLL_INTERVAL);
+	}
+}
+
+
+/*
+ * DropFailedShardMoveObjects drops the subscription, replication slot,
+ * publication and target shards of a shard move that failed, over new
+ * connections. Since it is called while handling an error, it only warns if
+ * the objects cannot be dropped, in which case the next move of the shards
+ * drops the replication objects.
+ */
+static void
+DropFailedShardMoveObjects(List *shardIntervalList, char *sourceNodeName,
+						   int32 sourceNodePort, char *targetNodeName,
+						   int32 targetNodePort, char *publicationName,
+						   char *subscriptionName)
+{
+	ShardInterval *firstShardInterval = (ShardInterval *) linitial(shardIntervalList);
+	char *superUser = CitusExtensionOwnerName();
+	uint32 connectionFlags = FORCE_NEW_CONNECTION;
+	MultiConnection *sourceConnection = NULL;
+	MultiConnection *targetConnection = NULL;
+	MemoryContext savedContext = CurrentMemoryContext;
+
+	sourceConnection = GetNodeUserDatabaseConnection(connectionFlags, sourceNodeName,
+													 sourceNodePort, superUser, NULL);
+	targetConnection = GetNodeUserDatabaseConnection(connectionFlags, targetNodeName,
+													 targetNodePort, superUser, NULL);
+
+	PG_TRY();
+	{
+		StringInfo command = makeStringInfo();
+		ListCell *shardIntervalCell = NULL;
+
+		/* dropping the subscription also drops its replication slot */
+		appendStringInfo(command, "DROP SUBSCRIPTION IF EXISTS %s",
+						 quote_identifier(subscriptionName));
+		ExecuteCriticalRemoteCommand(targetConnection, command->data);
+
+		DropLeftoverReplicationObjects(sourceConnection, targetConnection,
+									   publicationName, subscriptionName);
+
+		foreach(shardIntervalCell, shardIntervalList)
+		{
+			ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+
+			resetStringInfo(command);
+			appendStringInfo(command, DROP_REGULAR_TABLE_COMMAND,
+							 ConstructQualifiedShardName(shardInterval));
+			ExecuteCriticalRemoteCommand(targetConnection, command->data);
+		}
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata = NULL;
+
+		MemoryContextSwitchTo(savedContext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		ereport(WARNING, (errmsg("could not clean up after failing to move shard "
+								 UINT64_FORMAT, firstShardInterval->shardId),
+						  errdetail("%s", edata->message)));
+	}
+	PG_END_TRY();
+
+	CloseConnection(sourceConnection);
+	CloseConnection(targetConnection);
+}
+
+
+/*
+ * DropLeftoverReplicationObjects drops the subscription, replication slot and
+ * publication of an earlier move of the same shards that failed. The
+ * subscription is detached from its slot first, since the slot may be gone.
+ */
+static void
+DropLeftoverReplicationObjects(MultiConnection *sourceConnection,
+							   MultiConnection *targetConnection,
+							   char *publicationName, char *subscriptionName)
+{
+	StringInfo command = makeStringInfo();
+	char *quotedSubscriptionName = quote_identifier(subscriptionName);
+	char *subscriptionCount = NULL;
+
+	appendStringInfo(command, "SELECT count(*) FROM pg_subscription WHERE subname = %s",
+					 quote_literal_cstr(subscriptionName));
+	subscriptionCount = ExecuteRemoteQueryForValue(targetConnection, command->data);
+
+	if (strcmp(subscriptionCount, "0") != 0)
+	{
+		resetStringInfo(command);
+		appendStringInfo(command, "ALTER SUBSCRIPTION %s DISABLE",
+						 quotedSubscriptionName);
+		ExecuteCriticalRemoteCommand(targetConnection, command->data);
+
+		resetStringInfo(command);
+		appendStringInfo(command, "ALTER SUBSCRIPTION %s SET (slot_name = NONE)",
+						 quotedSubscriptionName);
+		ExecuteCriticalRemoteCommand(targetConnection, command->data);
+
+		resetStringInfo(command);
+		appendStringInfo(command, "DROP SUBSCRIPTION %s", quotedSubscriptionName);
+		ExecuteCriticalRemoteCommand(targetConnection, command->data);
+	}
+
+	resetStringInfo(command);
+	appendStringInfo(command, "SELECT pg_drop_replication_slot(slot_name) "
+							  "FROM pg_replication_slots WHERE slot_name = %s",
+					 quote_literal_cstr(subscriptionName));
+	ExecuteCriticalRemoteCommand(sourceConnection, command->data);
+
+	resetStringInfo(command);
+	appendStringInfo(command, "DROP PUBLICATION IF EXISTS %s",
+					 quote_identifier(publicationName));
+	ExecuteCriticalRemoteCommand(sourceConnection, command->data);
+}
+
+
+/*
+ * ExecuteRemoteQueryForValue runs a query that returns a single row with a
+ * single column over the given connection, and returns the value as text.
+ * It errors out if the query fails or does not return a single row.
+ */
+static char *
+ExecuteRemoteQueryForValue(MultiConnection *connection, const char *query)
+{
+	PGresult *result = NULL;
+	char *value = NULL;
+	bool raiseInterrupts = true;
+
+	if (!SendRemoteCommand(connection, query))
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (!IsResponseOK(result))
+	{
+		ReportResultError(connection, result, ERROR);
+	}
+
+	if (PQntuples(result) != 1 || PQnfields(result) != 1)
+	{
+		ereport(ERROR, (errmsg("unexpected result of query \"%s\" on node %s:%d",
+							   query, connection->hostname, connection->port)));
+	}
+
+	value = pstrdup(PQgetvalue(result, 0, 0));
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	return value;
+}
+
+
+#endif
+
+
 /*
  * SearchShardPlacementInList searches a provided list for a shard placement with the
  * specified node name and port. If missingOk is set to true, this function returns NULL
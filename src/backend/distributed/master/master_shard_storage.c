@@ -0,0 +1,238 @@
+/*-------------------------------------------------------------------------
+ *
+ * master_shard_storage.c
+ *
+ * This file contains functions to move shards of append distributed tables
+ * between hot and cold storage. Cold shards are regular tables on the workers
+ * that live in a separate, typically cheaper, tablespace. They can still be
+ * queried and modified, but no longer be appended to.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "c.h"
+#include "fmgr.h"
+
+#include "catalog/pg_class.h"
+#include "distributed/connection_management.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_protocol.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/multi_shard_transaction.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/pg_dist_shard.h"
+#include "distributed/placement_connection.h"
+#include "distributed/relay_utility.h"
+#include "distributed/remote_transaction.h"
+#include "distributed/resource_lock.h"
+#include "distributed/transaction_management.h"
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#include "storage/lmgr.h"
+#include "storage/lock.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+
+
+/* commands that move a shard and its indexes to another tablespace */
+#define SET_TABLE_TABLESPACE_COMMAND "ALTER TABLE %s SET TABLESPACE %s"
+#define SET_INDEX_TABLESPACE_COMMAND "ALTER INDEX %s SET TABLESPACE %s"
+
+
+/* local function forward declarations */
+static void SetShardStorageTier(uint64 shardId, char storageType,
+								char *tablespaceName);
+static void EnsureShardStorageTierCanChange(ShardInterval *shardInterval);
+static List * ShardTablespaceCommandList(ShardInterval *shardInterval,
+										 char *tablespaceName);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(master_mark_shard_cold);
+PG_FUNCTION_INFO_V1(master_mark_shard_hot);
+
+
+/*
+ * master_mark_shard_cold moves all placements of the given shard of an append
+ * distributed table to the given tablespace on their nodes, and marks the shard
+ * as being in cold storage, which prevents further appends to it.
+ */
+Datum
+master_mark_shard_cold(PG_FUNCTION_ARGS)
+{
+	int64 shardId = PG_GETARG_INT64(0);
+	Name tablespaceName = PG_GETARG_NAME(1);
+
+	EnsureCoordinator();
+	CheckCitusVersion(ERROR);
+
+	SetShardStorageTier(shardId, SHARD_STORAGE_COLD, NameStr(*tablespaceName));
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * master_mark_shard_hot moves all placements of the given cold shard back to
+ * the given tablespace, by default pg_default, and marks the shard as a
+ * regular table again, such that it can be appended to.
+ */
+Datum
+master_mark_shard_hot(PG_FUNCTION_ARGS)
+{
+	int64 shardId = PG_GETARG_INT64(0);
+	Name tablespaceName = PG_GETARG_NAME(1);
+
+	EnsureCoordinator();
+	CheckCitusVersion(ERROR);
+
+	SetShardStorageTier(shardId, SHARD_STORAGE_TABLE, NameStr(*tablespaceName));
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * SetShardStorageTier moves the healthy placements of the given shard to the
+ * given tablespace and sets the storage type of the shard, as part of the
+ * coordinated transaction. Appends to the shard are blocked in the meantime,
+ * since the placements are rewritten.
+ */
+static void
+SetShardStorageTier(uint64 shardId, char storageType, char *tablespaceName)
+{
+	ShardInterval *shardInterval = LoadShardInterval(shardId);
+	Oid relationId = shardInterval->relationId;
+	char *tableOwner = NULL;
+	List *commandList = NIL;
+	List *shardPlacementList = NIL;
+	ListCell *shardPlacementCell = NULL;
+	List *commandBatchList = NIL;
+
+	EnsureTableOwner(relationId);
+
+	/* block DDL on the table, which would need to know the tablespace */
+	LockRelationOid(relationId, ShareUpdateExclusiveLock);
+
+	EnsureShardStorageTierCanChange(shardInterval);
+
+	/* appends take a share lock on the metadata */
+	LockShardDistributionMetadata(shardId, ExclusiveLock);
+
+	tableOwner = TableOwner(relationId);
+	commandList = ShardTablespaceCommandList(shardInterval, tablespaceName);
+
+	BeginOrContinueCoordinatedTransaction();
+	CoordinatedTransactionUse2PC();
+
+	shardPlacementList = FinalizedShardPlacementList(shardId);
+	foreach(shardPlacementCell, shardPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+		uint32 connectionFlags = FOR_DDL;
+		MultiConnection *connection = NULL;
+		ListCell *commandCell = NULL;
+
+		connection = GetPlacementConnection(connectionFlags, placement, tableOwner);
+
+		MarkRemoteTransactionCritical(connection);
+		RemoteTransactionBeginIfNecessary(connection);
+
+		foreach(commandCell, commandList)
+		{
+			char *command = (char *) lfirst(commandCell);
+
+			AppendConnectionCommand(&commandBatchList, connection, command);
+		}
+	}
+
+	/* rewrite the placements on all nodes at the same time */
+	ExecuteConnectionCommandBatches(commandBatchList);
+
+	if (shardInterval->storageType != storageType)
+	{
+		UpdateShardStorageType(shardId, storageType);
+	}
+}
+
+
+/*
+ * EnsureShardStorageTierCanChange errors out if the given shard cannot be moved
+ * between hot and cold storage, which is only supported for regular tables of
+ * append distributed tables.
+ */
+static void
+EnsureShardStorageTierCanChange(ShardInterval *shardInterval)
+{
+	Oid relationId = shardInterval->relationId;
+	char *relationName = get_rel_name(relationId);
+	uint64 shardId = shardInterval->shardId;
+	char storageType = shardInterval->storageType;
+
+	if (PartitionMethod(relationId) != DISTRIBUTE_BY_APPEND)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot change the storage of shard " UINT64_FORMAT,
+							   shardId),
+						errdetail("Table %s is not an append-distributed table.",
+								  relationName)));
+	}
+
+	if (storageType != SHARD_STORAGE_TABLE && storageType != SHARD_STORAGE_COLD)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot change the storage of shard " UINT64_FORMAT,
+							   shardId),
+						errdetail("The underlying shard is not a regular table.")));
+	}
+}
+
+
+/*
+ * ShardTablespaceCommandList returns the commands that move the given shard
+ * and the indexes on it to the given tablespace.
+ */
+static List *
+ShardTablespaceCommandList(ShardInterval *shardInterval, char *tablespaceName)
+{
+	Oid relationId = shardInterval->relationId;
+	uint64 shardId = shardInterval->shardId;
+	char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+	const char *quotedTablespaceName = quote_identifier(tablespaceName);
+	char *qualifiedShardName = ConstructQualifiedShardName(shardInterval);
+	StringInfo tableCommand = makeStringInfo();
+	List *commandList = NIL;
+	Relation relation = NULL;
+	List *indexOidList = NIL;
+	ListCell *indexOidCell = NULL;
+
+	appendStringInfo(tableCommand, SET_TABLE_TABLESPACE_COMMAND, qualifiedShardName,
+					 quotedTablespaceName);
+	commandList = lappend(commandList, tableCommand->data);
+
+	relation = relation_open(relationId, AccessShareLock);
+	indexOidList = RelationGetIndexList(relation);
+	relation_close(relation, NoLock);
+
+	foreach(indexOidCell, indexOidList)
+	{
+		Oid indexOid = lfirst_oid(indexOidCell);
+		char *shardIndexName = get_rel_name(indexOid);
+		StringInfo indexCommand = makeStringInfo();
+
+		AppendShardIdToName(&shardIndexName, shardId);
+
+		appendStringInfo(indexCommand, SET_INDEX_TABLESPACE_COMMAND,
+						 quote_qualified_identifier(schemaName, shardIndexName),
+						 quotedTablespaceName);
+		commandList = lappend(commandList, indexCommand->data);
+	}
+
+	return commandList;
+}
@@ -3,7 +3,8 @@
  * master_split_shards.c
  *
  * This file contains functions to split a shard according to a given
- * distribution column value.
+ * distribution column value, or into a number of shards with equal hash
+ * ranges.
  *
  * Copyright (c) 2014-2017, Citus Data, Inc.
  *
@@ -15,21 +16,34 @@
 #include "fmgr.h"
 
 #include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "distributed/citus_nodes.h"
 #include "distributed/colocation_utils.h"
+#include "distributed/connection_management.h"
+#include "distributed/listutils.h"
+#include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/metadata_sync.h"
 #include "distributed/multi_join_order.h"
+#include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_router_planner.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
+#include "distributed/reference_table_utils.h"
 #include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
 #include "distributed/resource_lock.h"
+#include "distributed/shardinterval_utils.h"
+#include "distributed/transaction_management.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/worker_transaction.h"
+#include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
+#include "storage/lmgr.h"
 #include "storage/lock.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
 #include "utils/errcodes.h"
@@ -37,8 +51,29 @@
 #include "utils/typcache.h"
 
 
+/* command that copies the rows of a hash range of a shard into a child shard */
+#define SPLIT_SHARD_COPY_COMMAND \
+	"INSERT INTO %s SELECT * FROM %s WHERE worker_hash(%s) BETWEEN %d AND %d"
+
+
+/* local function forward declarations */
+static List * SplitShard(uint64 shardId, int splitCount);
+static void EnsureTableCanBeSplit(Oid relationId);
+static List * SplitShardOnPlacements(ShardInterval *shardInterval, int splitCount);
+static void CreateChildShardOnPlacement(ShardInterval *shardInterval,
+										uint64 childShardId, int32 childMinValue,
+										int32 childMaxValue,
+										MultiConnection *connection);
+static void UpdateSplitShardMetadata(ShardInterval *shardInterval,
+									 List *childShardIdList, int splitCount);
+static void ChildShardHashRange(ShardInterval *shardInterval, int splitCount,
+								int childIndex, int32 *childMinValue,
+								int32 *childMaxValue);
+
+
 /* declarations for dynamic loading */
 PG_FUNCTION_INFO_V1(isolate_tenant_to_new_shard);
+PG_FUNCTION_INFO_V1(master_split_shard);
 PG_FUNCTION_INFO_V1(worker_hash);
 
 
@@ -55,6 +90,393 @@ isolate_tenant_to_new_shard(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * master_split_shard splits the given shard of a hash-distributed table into
+ * split_count shards with equal hash ranges, together with its co-located
+ * shards. The new shards are placed on the nodes of the original shard, from
+ * where they can be moved individually. Returns the ids of the new shards of
+ * the table of the given shard.
+ */
+Datum
+master_split_shard(PG_FUNCTION_ARGS)
+{
+	int64 shardId = PG_GETARG_INT64(0);
+	int32 splitCount = PG_GETARG_INT32(1);
+	List *childShardIdList = NIL;
+	ListCell *childShardIdCell = NULL;
+	Datum *childShardIdArray = NULL;
+	ArrayType *childShardIdObject = NULL;
+	int childShardIndex = 0;
+
+	EnsureCoordinator();
+	CheckCitusVersion(ERROR);
+
+	childShardIdList = SplitShard(shardId, splitCount);
+
+	childShardIdArray = palloc0(list_length(childShardIdList) * sizeof(Datum));
+	foreach(childShardIdCell, childShardIdList)
+	{
+		uint64 *childShardId = (uint64 *) lfirst(childShardIdCell);
+
+		childShardIdArray[childShardIndex++] = Int64GetDatum(*childShardId);
+	}
+
+	childShardIdObject = construct_array(childShardIdArray, childShardIndex, INT8OID,
+										 sizeof(int64), FLOAT8PASSBYVAL, 'd');
+
+	PG_RETURN_ARRAYTYPE_P(childShardIdObject);
+}
+
+
+/*
+ * SplitShard splits the given shard and its co-located shards into splitCount
+ * shards each, and returns the ids of the new shards of the given shard.
+ *
+ * The rows are copied into the new shards on the nodes themselves, using
+ * worker_hash to select the rows of each hash range, in the same distributed
+ * transaction that drops the original shards and updates the metadata. Writes
+ * to the shards are blocked in the meantime, reads are not.
+ */
+static List *
+SplitShard(uint64 shardId, int splitCount)
+{
+	ShardInterval *shardInterval = LoadShardInterval(shardId);
+	Oid distributedTableId = shardInterval->relationId;
+	DistTableCacheEntry *cacheEntry = NULL;
+	List *colocatedTableList = NIL;
+	ListCell *colocatedTableCell = NULL;
+	List *colocatedShardList = NIL;
+	ListCell *colocatedShardCell = NULL;
+	List *childShardIdList = NIL;
+	int64 hashRangeSize = 0;
+	int shardCount = 0;
+
+	/* block concurrent splits, moves and DDL on the tables */
+	colocatedTableList = ColocatedTableList(distributedTableId);
+	colocatedTableList = SortList(colocatedTableList, CompareOids);
+	foreach(colocatedTableCell, colocatedTableList)
+	{
+		Oid colocatedTableId = lfirst_oid(colocatedTableCell);
+
+		EnsureTableOwner(colocatedTableId);
+		LockRelationOid(colocatedTableId, ShareUpdateExclusiveLock);
+		EnsureTableCanBeSplit(colocatedTableId);
+	}
+
+	hashRangeSize = (int64) DatumGetInt32(shardInterval->maxValue) -
+					(int64) DatumGetInt32(shardInterval->minValue) + 1;
+	if (splitCount < 2 || splitCount > hashRangeSize)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("split count must be between 2 and the number of "
+							   "hash values of shard " UINT64_FORMAT, shardId)));
+	}
+
+	colocatedShardList = ColocatedShardIntervalList(shardInterval);
+	colocatedShardList = SortList(colocatedShardList, CompareShardIntervalsById);
+
+	foreach(colocatedShardCell, colocatedShardList)
+	{
+		ShardInterval *colocatedShard = (ShardInterval *) lfirst(colocatedShardCell);
+		List *shardPlacementList = ShardPlacementList(colocatedShard->shardId);
+		ListCell *shardPlacementCell = NULL;
+
+		foreach(shardPlacementCell, shardPlacementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+
+			if (placement->shardState != FILE_FINALIZED)
+			{
+				ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+								errmsg("cannot split shard " UINT64_FORMAT,
+									   colocatedShard->shardId),
+								errdetail("All placements of the shard must be "
+										  "healthy.")));
+			}
+		}
+	}
+
+	/* the rows are copied in the transaction that drops the shards */
+	LockShardListMetadata(colocatedShardList, ExclusiveLock);
+
+	foreach(colocatedShardCell, colocatedShardList)
+	{
+		ShardInterval *colocatedShard = (ShardInterval *) lfirst(colocatedShardCell);
+		List *colocatedChildShardIdList = SplitShardOnPlacements(colocatedShard,
+																 splitCount);
+
+		if (colocatedShard->shardId == shardId)
+		{
+			childShardIdList = colocatedChildShardIdList;
+		}
+	}
+
+	cacheEntry = DistributedTableCacheEntry(distributedTableId);
+	if (cacheEntry->colocationId != INVALID_COLOCATION_ID)
+	{
+		shardCount = ShardIntervalCount(distributedTableId);
+		UpdateColocationGroupShardCount(cacheEntry->colocationId, shardCount);
+	}
+
+	return childShardIdList;
+}
+
+
+/*
+ * EnsureTableCanBeSplit errors out if the shards of the given table cannot be
+ * split.
+ */
+static void
+EnsureTableCanBeSplit(Oid relationId)
+{
+	char *relationName = get_rel_name(relationId);
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+
+	if (cacheEntry->partitionMethod != DISTRIBUTE_BY_HASH)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot split shard"),
+						errdetail("Table %s is not a hash-distributed table.",
+								  relationName)));
+	}
+
+	if (get_rel_relkind(relationId) == RELKIND_FOREIGN_TABLE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot split shard"),
+						errdetail("Table %s is a foreign table. Splitting shards "
+								  "backed by foreign tables is not supported.",
+								  relationName)));
+	}
+
+	if (PartitionedTable(relationId) || PartitionTable(relationId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot split shard"),
+						errdetail("Table %s is a partitioned table or a partition. "
+								  "Splitting shards of partitioned tables is not "
+								  "supported.", relationName)));
+	}
+
+	if (GetTableForeignConstraintCommands(relationId) != NIL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot split shard"),
+						errdetail("Table %s has a foreign key. Splitting shards of "
+								  "tables with foreign keys is not supported.",
+								  relationName)));
+	}
+}
+
+
+/*
+ * SplitShardOnPlacements creates splitCount child shards of the given shard on
+ * each of its placements, copies the rows of their hash ranges into them and
+ * drops the shard, all as part of the coordinated transaction. It then replaces
+ * the shard by the child shards in the metadata and returns their ids.
+ */
+static List *
+SplitShardOnPlacements(ShardInterval *shardInterval, int splitCount)
+{
+	Oid relationId = shardInterval->relationId;
+	char *tableOwner = TableOwner(relationId);
+	char *qualifiedShardName = ConstructQualifiedShardName(shardInterval);
+	List *shardPlacementList = ShardPlacementList(shardInterval->shardId);
+	ListCell *shardPlacementCell = NULL;
+	List *childShardIdList = NIL;
+	int childIndex = 0;
+
+	for (childIndex = 0; childIndex < splitCount; childIndex++)
+	{
+		uint64 *childShardId = palloc0(sizeof(uint64));
+
+		*childShardId = GetNextShardId();
+		childShardIdList = lappend(childShardIdList, childShardId);
+	}
+
+	BeginOrContinueCoordinatedTransaction();
+	CoordinatedTransactionUse2PC();
+
+	foreach(shardPlacementCell, shardPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+		uint32 connectionFlags = FOR_DDL;
+		MultiConnection *connection = NULL;
+		ListCell *childShardIdCell = NULL;
+		StringInfo dropCommand = makeStringInfo();
+
+		/* the drop has to use the connection that read the shard */
+		connection = GetNodeUserDatabaseConnection(connectionFlags, placement->nodeName,
+												   placement->nodePort, tableOwner,
+												   NULL);
+
+		MarkRemoteTransactionCritical(connection);
+		RemoteTransactionBeginIfNecessary(connection);
+
+		childIndex = 0;
+		foreach(childShardIdCell, childShardIdList)
+		{
+			uint64 *childShardId = (uint64 *) lfirst(childShardIdCell);
+			int32 childMinValue = 0;
+			int32 childMaxValue = 0;
+
+			ChildShardHashRange(shardInterval, splitCount, childIndex, &childMinValue,
+								&childMaxValue);
+
+			CreateChildShardOnPlacement(shardInterval, *childShardId, childMinValue,
+										childMaxValue, connection);
+			childIndex++;
+		}
+
+		appendStringInfo(dropCommand, DROP_REGULAR_TABLE_COMMAND, qualifiedShardName);
+		ExecuteCriticalRemoteCommand(connection, dropCommand->data);
+	}
+
+	UpdateSplitShardMetadata(shardInterval, childShardIdList, splitCount);
+
+	return childShardIdList;
+}
+
+
+/*
+ * CreateChildShardOnPlacement creates a child shard with the given hash range
+ * over the given connection and copies the rows in that range from the given
+ * shard into it. The indexes are created after the rows are copied.
+ */
+static void
+CreateChildShardOnPlacement(ShardInterval *shardInterval, uint64 childShardId,
+							int32 childMinValue, int32 childMaxValue,
+							MultiConnection *connection)
+{
+	Oid relationId = shardInterval->relationId;
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+	bool forShardCreation = true;
+	List *tableCreationCommandList = GetTableCreationCommands(relationId,
+															  forShardCreation);
+	List *indexCommandList = GetTableIndexAndConstraintCommands(relationId);
+	AttrNumber partitionColumnId = cacheEntry->partitionColumn->varattno;
+	char *partitionColumnName = get_attname(relationId, partitionColumnId);
+	ShardInterval *childShardInterval = CitusMakeNode(ShardInterval);
+	StringInfo copyCommand = makeStringInfo();
+	int shardIndex = 0;
+
+	CopyShardInterval(shardInterval, childShardInterval);
+	childShardInterval->shardId = childShardId;
+
+	WorkerCreateShard(relationId, shardIndex, childShardId, tableCreationCommandList,
+					  NIL, NULL, connection);
+
+	appendStringInfo(copyCommand, SPLIT_SHARD_COPY_COMMAND,
+					 ConstructQualifiedShardName(childShardInterval),
+					 ConstructQualifiedShardName(shardInterval),
+					 quote_identifier(partitionColumnName), childMinValue,
+					 childMaxValue);
+	ExecuteCriticalRemoteCommand(connection, copyCommand->data);
+
+	if (indexCommandList != NIL)
+	{
+		WorkerCreateShard(relationId, shardIndex, childShardId, indexCommandList,
+						  NIL, NULL, connection);
+	}
+}
+
+
+/*
+ * UpdateSplitShardMetadata removes the given shard and its placements from the
+ * metadata and adds the child shards, with their hash ranges and placements on
+ * the groups of the placements of the shard, also on the workers with metadata.
+ */
+static void
+UpdateSplitShardMetadata(ShardInterval *shardInterval, List *childShardIdList,
+						 int splitCount)
+{
+	Oid relationId = shardInterval->relationId;
+	uint64 shardId = shardInterval->shardId;
+	List *shardPlacementList = ShardPlacementList(shardId);
+	ListCell *shardPlacementCell = NULL;
+	ListCell *childShardIdCell = NULL;
+	List *childShardIntervalList = NIL;
+	int childIndex = 0;
+
+	/* remove the shard first, such that the hash ranges never overlap */
+	foreach(shardPlacementCell, shardPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+
+		DeleteShardPlacementRow(placement->placementId);
+	}
+
+	DeleteShardRow(shardId);
+
+	foreach(childShardIdCell, childShardIdList)
+	{
+		uint64 *childShardId = (uint64 *) lfirst(childShardIdCell);
+		int32 childMinValue = 0;
+		int32 childMaxValue = 0;
+
+		ChildShardHashRange(shardInterval, splitCount, childIndex, &childMinValue,
+							&childMaxValue);
+
+		InsertShardRow(relationId, *childShardId, shardInterval->storageType,
+					   IntegerToText(childMinValue), IntegerToText(childMaxValue));
+
+		foreach(shardPlacementCell, shardPlacementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+
+			InsertShardPlacementRow(*childShardId, INVALID_PLACEMENT_ID,
+									FILE_FINALIZED, 0, placement->groupId);
+		}
+
+		childIndex++;
+	}
+
+	if (ShouldSyncTableMetadata(relationId))
+	{
+		List *commandList = ShardDeleteCommandList(shardInterval);
+		ListCell *commandCell = NULL;
+
+		foreach(childShardIdCell, childShardIdList)
+		{
+			uint64 *childShardId = (uint64 *) lfirst(childShardIdCell);
+			ShardInterval *childShardInterval = LoadShardInterval(*childShardId);
+
+			childShardIntervalList = lappend(childShardIntervalList,
+											 childShardInterval);
+		}
+
+		commandList = list_concat(commandList,
+								  ShardListInsertCommand(childShardIntervalList));
+
+		foreach(commandCell, commandList)
+		{
+			char *command = (char *) lfirst(commandCell);
+
+			SendCommandToWorkers(WORKERS_WITH_METADATA, command);
+		}
+	}
+}
+
+
+/*
+ * ChildShardHashRange sets the hash range of the child shard at the given
+ * index when the hash range of the given shard is split into splitCount
+ * ranges of equal size.
+ */
+static void
+ChildShardHashRange(ShardInterval *shardInterval, int splitCount, int childIndex,
+					int32 *childMinValue, int32 *childMaxValue)
+{
+	int64 minValue = DatumGetInt32(shardInterval->minValue);
+	int64 maxValue = DatumGetInt32(shardInterval->maxValue);
+	int64 hashRangeSize = maxValue - minValue + 1;
+
+	*childMinValue = (int32) (minValue + childIndex * hashRangeSize / splitCount);
+	*childMaxValue = (int32) (minValue + (childIndex + 1) * hashRangeSize /
+							  splitCount - 1);
+}
+
+
 /*
  * worker_hash returns the hashed value of the given value.
  */
@@ -24,9 +24,11 @@
 #include "commands/tablecmds.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_type.h"
 #if (PG_VERSION_NUM >= 100000)
 #include "catalog/partition.h"
 #endif
+#include "distributed/adaptive_executor.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/colocation_utils.h"
 #include "distributed/connection_management.h"
@@ -36,11 +38,14 @@
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_partitioning_utils.h"
+#include "distributed/multi_physical_planner.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
 #include "distributed/placement_connection.h"
 #include "distributed/remote_commands.h"
 #include "distributed/resource_lock.h"
+#include "distributed/shard_statistics.h"
+#include "distributed/shard_zone_maps.h"
 #include "distributed/transaction_management.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
@@ -54,10 +59,66 @@
 #include "utils/tqual.h"
 
 
+/*
+ * ShardCreationConnection keeps the commands that create shards over a single
+ * connection. CreateShardsOnWorkers sends them one at a time, but in parallel
+ * with the commands on other connections.
+ */
+typedef struct ShardCreationConnection
+{
+	MultiConnection *connection;
+	List *commandList;
+} ShardCreationConnection;
+
+
+/*
+ * ShardForeignConstraintTemplate describes a foreign constraint command of a
+ * table with the parts of the worker_apply_inter_shard_ddl_command call that
+ * are the same for all of its shards.
+ */
+typedef struct ShardForeignConstraintTemplate
+{
+	Oid referencedRelationId;
+	char *escapedReferencedSchemaName;
+	char *escapedCommand;
+} ShardForeignConstraintTemplate;
+
+
+/*
+ * ShardCommandTemplate holds the escaped DDL commands that create the shards
+ * of a table, with the shard ids left out. The commands are escaped, and the
+ * foreign constraint commands are parsed, only once per table, such that the
+ * command for each shard is built by substituting its shard ids, which keeps
+ * the coordinator cost of tables with many shards and constraints low.
+ */
+typedef struct ShardCommandTemplate
+{
+	Oid relationId;
+	char *escapedSchemaName;
+	bool includeSchemaName;
+	List *escapedDDLCommandList;
+	List *foreignConstraintTemplateList;
+
+	/* set if the shards are partitions, NULL otherwise */
+	char *escapedAttachPartitionCommand;
+	Oid parentRelationId;
+	char *escapedParentSchemaName;
+} ShardCommandTemplate;
+
+
 /* Local functions forward declarations */
 static bool WorkerShardStats(ShardPlacement *placement, Oid relationId,
 							 char *shardName, uint64 *shardSize,
 							 text **shardMinValue, text **shardMaxValue);
+static ShardCommandTemplate * CreateShardCommandTemplate(Oid relationId,
+														 List *ddlCommandList,
+														 List *foreignCommandList,
+														 char *attachPartitionCommand);
+static char * WorkerCreateShardCommand(ShardCommandTemplate *commandTemplate,
+									   int shardIndex, uint64 shardId);
+static ShardCreationConnection * FindShardCreationConnection(
+	List **shardCreationConnectionList, MultiConnection *connection);
+static void ExecuteShardCreationCommands(List *shardCreationConnectionList);
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(master_create_empty_shard);
@@ -243,6 +304,14 @@ master_append_table_to_shard(PG_FUNCTION_ARGS)
 
 	EnsureTablePermissions(relationId, ACL_INSERT);
 
+	if (storageType == SHARD_STORAGE_COLD)
+	{
+		ereport(ERROR, (errmsg("cannot append to shardId " UINT64_FORMAT, shardId),
+						errdetail("The shard is in cold storage."),
+						errhint("Use master_mark_shard_hot() to allow appends to "
+								"the shard again.")));
+	}
+
 	if (storageType != SHARD_STORAGE_TABLE && !cstoreTable)
 	{
 		ereport(ERROR, (errmsg("cannot append to shardId " UINT64_FORMAT, shardId),
@@ -313,8 +382,19 @@ master_append_table_to_shard(PG_FUNCTION_ARGS)
 
 	MarkFailedShardPlacements();
 
-	/* update shard statistics and get new shard size */
-	newShardSize = UpdateShardStatistics(shardId);
+	/*
+	 * Update shard statistics and get new shard size. When the update is
+	 * deferred, the fill level is based on the size from the last update.
+	 */
+	if (DeferShardStatistics)
+	{
+		MarkShardStatisticsStale(shardId);
+		newShardSize = ShardLength(shardId);
+	}
+	else
+	{
+		newShardSize = UpdateShardStatistics(shardId);
+	}
 
 	/* calculate ratio of current shard size compared to shard max size */
 	shardMaxSizeInBytes = (int64) ShardMaxSize * 1024L;
@@ -440,35 +520,59 @@ CreateAppendDistributedShardPlacements(Oid relationId, int64 shardId,
 List *
 InsertShardPlacementRows(Oid relationId, int64 shardId, List *workerNodeList,
 						 int workerStartIndex, int replicationFactor)
+{
+	List *groupPlacementList = NIL;
+	ListCell *groupPlacementCell = NULL;
+	List *insertedShardPlacements = NIL;
+
+	groupPlacementList = NewShardPlacementList(shardId, workerNodeList,
+											   workerStartIndex, replicationFactor);
+	InsertShardPlacementRowList(relationId, groupPlacementList);
+
+	foreach(groupPlacementCell, groupPlacementList)
+	{
+		GroupShardPlacement *groupPlacement =
+			(GroupShardPlacement *) lfirst(groupPlacementCell);
+		ShardPlacement *shardPlacement = LoadShardPlacement(shardId,
+															groupPlacement->placementId);
+
+		insertedShardPlacements = lappend(insertedShardPlacements, shardPlacement);
+	}
+
+	return insertedShardPlacements;
+}
+
+
+/*
+ * NewShardPlacementList returns the finalized placements of the given shard
+ * on replicationFactor worker nodes, starting at the given index into the
+ * worker node list. The placements do not have a placement id yet, which
+ * InsertShardPlacementRowList assigns when inserting them.
+ */
+List *
+NewShardPlacementList(int64 shardId, List *workerNodeList, int workerStartIndex,
+					  int replicationFactor)
 {
 	int workerNodeCount = list_length(workerNodeList);
 	int attemptNumber = 0;
-	int placementsInserted = 0;
-	List *insertedShardPlacements = NIL;
+	List *placementList = NIL;
 
 	for (attemptNumber = 0; attemptNumber < replicationFactor; attemptNumber++)
 	{
 		int workerNodeIndex = (workerStartIndex + attemptNumber) % workerNodeCount;
 		WorkerNode *workerNode = (WorkerNode *) list_nth(workerNodeList, workerNodeIndex);
-		uint32 nodeGroupId = workerNode->groupId;
-		const RelayFileState shardState = FILE_FINALIZED;
-		const uint64 shardSize = 0;
-		uint64 shardPlacementId = 0;
-		ShardPlacement *shardPlacement = NULL;
+		GroupShardPlacement *placement = CitusMakeNode(GroupShardPlacement);
 
-		shardPlacementId = InsertShardPlacementRow(shardId, INVALID_PLACEMENT_ID,
-												   shardState, shardSize, nodeGroupId);
-		shardPlacement = LoadShardPlacement(shardId, shardPlacementId);
-		insertedShardPlacements = lappend(insertedShardPlacements, shardPlacement);
+		placement->placementId = INVALID_PLACEMENT_ID;
+		placement->shardId = shardId;
+		placement->shardState = FILE_FINALIZED;
+		placement->shardLength = 0;
+		placement->groupId = workerNode->groupId;
 
-		placementsInserted++;
-		if (placementsInserted >= replicationFactor)
-		{
-			break;
-		}
+		placementList = lappend(placementList, placement);
 	}
 
-	return insertedShardPlacements;
+	return placementList;
 }
 
 
@@ -478,29 +582,52 @@ InsertShardPlacementRows(Oid relationId, int64 shardId, List *workerNodeList,
  * needs an exclusive connection (in case of distributing local table with data
  * on it) or creating shards in a transaction, per placement connection is opened
  * for each placement.
+ *
+ * All DDL commands for a shard are sent in a single round trip, and shards are
+ * created in parallel over all connections.
+ *
+ * If the caller is about to load data into the shards, it can pass
+ * deferIndexCreation to only create the tables, and create the indexes and
+ * constraints once the data is loaded by calling CreateShardIndexesOnWorkers.
+ * Building an index over existing rows is much faster than maintaining it
+ * for every inserted row.
  */
 void
 CreateShardsOnWorkers(Oid distributedRelationId, List *shardPlacements,
-					  bool useExclusiveConnection, bool colocatedShard)
+					  bool useExclusiveConnection, bool colocatedShard,
+					  bool deferIndexCreation)
 {
 	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(distributedRelationId);
 	char *placementOwner = TableOwner(distributedRelationId);
 	bool includeSequenceDefaults = false;
-	List *ddlCommandList = GetTableDDLEvents(distributedRelationId,
-											 includeSequenceDefaults);
-	List *foreignConstraintCommandList = GetTableForeignConstraintCommands(
-		distributedRelationId);
+	List *ddlCommandList = NIL;
+	List *foreignConstraintCommandList = NIL;
 	List *claimedConnectionList = NIL;
+	List *shardCreationConnectionList = NIL;
+	List *connectionList = NIL;
 	ListCell *connectionCell = NULL;
 	ListCell *shardPlacementCell = NULL;
 	int connectionFlags = FOR_DDL;
 	char *alterTableAttachPartitionCommand = NULL;
+	ShardCommandTemplate *commandTemplate = NULL;
 
 	if (useExclusiveConnection)
 	{
 		connectionFlags |= CONNECTION_PER_PLACEMENT;
 	}
 
+	if (deferIndexCreation)
+	{
+		ddlCommandList = GetTableCreationCommands(distributedRelationId,
+												  includeSequenceDefaults);
+	}
+	else
+	{
+		ddlCommandList = GetTableDDLEvents(distributedRelationId,
+										   includeSequenceDefaults);
+		foreignConstraintCommandList =
+			GetTableForeignConstraintCommands(distributedRelationId);
+	}
 
 	if (PartitionTable(distributedRelationId))
 	{
@@ -508,6 +635,10 @@ CreateShardsOnWorkers(Oid distributedRelationId, List *shardPlacements,
 			GenerateAlterTableAttachPartitionCommand(distributedRelationId);
 	}
 
+	commandTemplate = CreateShardCommandTemplate(distributedRelationId, ddlCommandList,
+												 foreignConstraintCommandList,
+												 alterTableAttachPartitionCommand);
+
 	BeginOrContinueCoordinatedTransaction();
 
 	if (MultiShardCommitProtocol == COMMIT_PROTOCOL_2PC ||
@@ -522,6 +653,8 @@ CreateShardsOnWorkers(Oid distributedRelationId, List *shardPlacements,
 		uint64 shardId = shardPlacement->shardId;
 		ShardInterval *shardInterval = LoadShardInterval(shardId);
 		MultiConnection *connection = NULL;
+		ShardCreationConnection *shardCreationConnection = NULL;
+		char *createShardCommand = NULL;
 		int shardIndex = -1;
 
 		if (colocatedShard)
@@ -537,14 +670,30 @@ CreateShardsOnWorkers(Oid distributedRelationId, List *shardPlacements,
 			claimedConnectionList = lappend(claimedConnectionList, connection);
 		}
 
-		RemoteTransactionBeginIfNecessary(connection);
-		MarkRemoteTransactionCritical(connection);
+		createShardCommand = WorkerCreateShardCommand(commandTemplate, shardIndex,
+													  shardId);
+
+		shardCreationConnection =
+			FindShardCreationConnection(&shardCreationConnectionList, connection);
+		shardCreationConnection->commandList =
+			lappend(shardCreationConnection->commandList, createShardCommand);
+	}
 
-		WorkerCreateShard(distributedRelationId, shardIndex, shardId,
-						  ddlCommandList, foreignConstraintCommandList,
-						  alterTableAttachPartitionCommand, connection);
+	/* open the transactions on all connections in parallel */
+	foreach(connectionCell, shardCreationConnectionList)
+	{
+		ShardCreationConnection *shardCreationConnection =
+			(ShardCreationConnection *) lfirst(connectionCell);
+		MultiConnection *connection = shardCreationConnection->connection;
+
+		MarkRemoteTransactionCritical(connection);
+		connectionList = lappend(connectionList, connection);
 	}
 
+	RemoteTransactionsBeginIfNecessary(connectionList);
+
+	ExecuteShardCreationCommands(shardCreationConnectionList);
+
 	/*
 	 * We need to unclaim all connections to make them usable again for the copy
 	 * command, otherwise copy going to open new connections to placements and
@@ -558,6 +707,174 @@ CreateShardsOnWorkers(Oid distributedRelationId, List *shardPlacements,
 }
 
 
+/*
+ * CreateShardIndexesOnWorkers creates the indexes, constraints and replica
+ * identity of the shards of the given table, which CreateShardsOnWorkers left
+ * out with deferIndexCreation. The commands are sent over the connections
+ * that created the shards and loaded the data into them, and the indexes of
+ * all placements are built in parallel over the different connections.
+ */
+void
+CreateShardIndexesOnWorkers(Oid distributedRelationId)
+{
+	char *placementOwner = TableOwner(distributedRelationId);
+	List *indexCommandList = GetTableIndexAndConstraintCommands(distributedRelationId);
+	List *replicaIdentityCommandList =
+		GetTableReplicaIdentityCommand(distributedRelationId);
+	List *foreignConstraintCommandList =
+		GetTableForeignConstraintCommands(distributedRelationId);
+	List *shardIntervalList = NIL;
+	List *shardCreationConnectionList = NIL;
+	List *connectionList = NIL;
+	ListCell *shardIntervalCell = NULL;
+	ListCell *connectionCell = NULL;
+	int connectionFlags = FOR_DDL;
+	ShardCommandTemplate *commandTemplate = NULL;
+
+	indexCommandList = list_concat(indexCommandList, replicaIdentityCommandList);
+	if (indexCommandList == NIL && foreignConstraintCommandList == NIL)
+	{
+		return;
+	}
+
+	commandTemplate = CreateShardCommandTemplate(distributedRelationId, indexCommandList,
+												 foreignConstraintCommandList, NULL);
+
+	shardIntervalList = LoadShardIntervalList(distributedRelationId);
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		int shardIndex = ShardIndex(shardInterval);
+		List *shardPlacementList = FinalizedShardPlacementList(shardId);
+		ListCell *shardPlacementCell = NULL;
+
+		foreach(shardPlacementCell, shardPlacementList)
+		{
+			ShardPlacement *shardPlacement =
+				(ShardPlacement *) lfirst(shardPlacementCell);
+			MultiConnection *connection = NULL;
+			ShardCreationConnection *shardCreationConnection = NULL;
+			char *createIndexCommand = NULL;
+
+			connection = GetPlacementConnection(connectionFlags, shardPlacement,
+												placementOwner);
+
+			createIndexCommand = WorkerCreateShardCommand(commandTemplate, shardIndex,
+														  shardId);
+
+			shardCreationConnection =
+				FindShardCreationConnection(&shardCreationConnectionList, connection);
+			shardCreationConnection->commandList =
+				lappend(shardCreationConnection->commandList, createIndexCommand);
+		}
+	}
+
+	foreach(connectionCell, shardCreationConnectionList)
+	{
+		ShardCreationConnection *shardCreationConnection =
+			(ShardCreationConnection *) lfirst(connectionCell);
+		MultiConnection *connection = shardCreationConnection->connection;
+
+		MarkRemoteTransactionCritical(connection);
+		connectionList = lappend(connectionList, connection);
+	}
+
+	RemoteTransactionsBeginIfNecessary(connectionList);
+
+	ExecuteShardCreationCommands(shardCreationConnectionList);
+}
+
+
+/*
+ * FindShardCreationConnection returns the entry for the given connection in
+ * the given list, and appends a new entry to the list if there is none yet.
+ */
+static ShardCreationConnection *
+FindShardCreationConnection(List **shardCreationConnectionList,
+							MultiConnection *connection)
+{
+	ShardCreationConnection *shardCreationConnection = NULL;
+	ListCell *shardCreationConnectionCell = NULL;
+
+	foreach(shardCreationConnectionCell, *shardCreationConnectionList)
+	{
+		shardCreationConnection =
+			(ShardCreationConnection *) lfirst(shardCreationConnectionCell);
+
+		if (shardCreationConnection->connection == connection)
+		{
+			return shardCreationConnection;
+		}
+	}
+
+	shardCreationConnection = palloc0(sizeof(ShardCreationConnection));
+	shardCreationConnection->connection = connection;
+	shardCreationConnection->commandList = NIL;
+
+	*shardCreationConnectionList = lappend(*shardCreationConnectionList,
+										   shardCreationConnection);
+
+	return shardCreationConnection;
+}
+
+
+/*
+ * ExecuteShardCreationCommands executes the shard creation commands on all
+ * given connections. In each round, we send the next command on every
+ * connection that still has commands before waiting for any of the results,
+ * such that the workers create the shards in parallel.
+ */
+static void
+ExecuteShardCreationCommands(List *shardCreationConnectionList)
+{
+	bool commandsPending = true;
+
+	while (commandsPending)
+	{
+		List *activeConnectionList = NIL;
+		ListCell *shardCreationConnectionCell = NULL;
+		ListCell *connectionCell = NULL;
+
+		foreach(shardCreationConnectionCell, shardCreationConnectionList)
+		{
+			ShardCreationConnection *shardCreationConnection =
+				(ShardCreationConnection *) lfirst(shardCreationConnectionCell);
+			MultiConnection *connection = shardCreationConnection->connection;
+			char *createShardCommand = NULL;
+			int querySent = 0;
+
+			if (shardCreationConnection->commandList == NIL)
+			{
+				continue;
+			}
+
+			createShardCommand = (char *) linitial(shardCreationConnection->commandList);
+			shardCreationConnection->commandList =
+				list_delete_first(shardCreationConnection->commandList);
+
+			querySent = SendRemoteCommand(connection, createShardCommand);
+			if (querySent == 0)
+			{
+				ReportConnectionError(connection, ERROR);
+			}
+
+			activeConnectionList = lappend(activeConnectionList, connection);
+		}
+
+		foreach(connectionCell, activeConnectionList)
+		{
+			MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+			FinishCriticalRemoteCommand(connection);
+		}
+
+		commandsPending = (activeConnectionList != NIL);
+	}
+}
+
+
 /*
  * WorkerCreateShard applies DDL commands for the given shardId to create the
  * shard on the worker node. Commands are sent to the worker node over the
@@ -568,45 +885,54 @@ WorkerCreateShard(Oid relationId, int shardIndex, uint64 shardId, List *ddlComma
 				  List *foreignConstraintCommandList,
 				  char *alterTableAttachPartitionCommand, MultiConnection *connection)
 {
+	ShardCommandTemplate *commandTemplate =
+		CreateShardCommandTemplate(relationId, ddlCommandList,
+								   foreignConstraintCommandList,
+								   alterTableAttachPartitionCommand);
+	char *createShardCommand = WorkerCreateShardCommand(commandTemplate, shardIndex,
+														shardId);
+
+	ExecuteCriticalRemoteCommand(connection, createShardCommand);
+}
+
+
+/*
+ * CreateShardCommandTemplate escapes the given commands that create the shards
+ * of the given table, and looks up the schemas and referenced tables they need,
+ * such that WorkerCreateShardCommand only has to fill in the shard ids.
+ */
+static ShardCommandTemplate *
+CreateShardCommandTemplate(Oid relationId, List *ddlCommandList,
+						   List *foreignConstraintCommandList,
+						   char *alterTableAttachPartitionCommand)
+{
+	ShardCommandTemplate *commandTemplate = palloc0(sizeof(ShardCommandTemplate));
 	Oid schemaId = get_rel_namespace(relationId);
 	char *schemaName = get_namespace_name(schemaId);
-	char *escapedSchemaName = quote_literal_cstr(schemaName);
 	ListCell *ddlCommandCell = NULL;
 	ListCell *foreignConstraintCommandCell = NULL;
 
+	commandTemplate->relationId = relationId;
+	commandTemplate->escapedSchemaName = quote_literal_cstr(schemaName);
+	commandTemplate->includeSchemaName = (strcmp(schemaName, "public") != 0);
+
 	foreach(ddlCommandCell, ddlCommandList)
 	{
 		char *ddlCommand = (char *) lfirst(ddlCommandCell);
 		char *escapedDDLCommand = quote_literal_cstr(ddlCommand);
-		StringInfo applyDDLCommand = makeStringInfo();
 
-		if (strcmp(schemaName, "public") != 0)
-		{
-			appendStringInfo(applyDDLCommand, WORKER_APPLY_SHARD_DDL_COMMAND, shardId,
-							 escapedSchemaName, escapedDDLCommand);
-		}
-		else
-		{
-			appendStringInfo(applyDDLCommand,
-							 WORKER_APPLY_SHARD_DDL_COMMAND_WITHOUT_SCHEMA, shardId,
-							 escapedDDLCommand);
-		}
-
-		ExecuteCriticalRemoteCommand(connection, applyDDLCommand->data);
+		commandTemplate->escapedDDLCommandList =
+			lappend(commandTemplate->escapedDDLCommandList, escapedDDLCommand);
 	}
 
 	foreach(foreignConstraintCommandCell, foreignConstraintCommandList)
 	{
 		char *command = (char *) lfirst(foreignConstraintCommandCell);
-		char *escapedCommand = quote_literal_cstr(command);
-
+		ShardForeignConstraintTemplate *constraintTemplate =
+			palloc0(sizeof(ShardForeignConstraintTemplate));
 		Oid referencedRelationId = InvalidOid;
 		Oid referencedSchemaId = InvalidOid;
 		char *referencedSchemaName = NULL;
-		char *escapedReferencedSchemaName = NULL;
-		uint64 referencedShardId = INVALID_SHARD_ID;
-
-		StringInfo applyForeignConstraintCommand = makeStringInfo();
 
 		/* we need to parse the foreign constraint command to get referencing table id */
 		referencedRelationId = ForeignConstraintGetReferencedTableId(command);
@@ -619,7 +945,75 @@ WorkerCreateShard(Oid relationId, int shardIndex, uint64 shardId, List *ddlComma
 
 		referencedSchemaId = get_rel_namespace(referencedRelationId);
 		referencedSchemaName = get_namespace_name(referencedSchemaId);
-		escapedReferencedSchemaName = quote_literal_cstr(referencedSchemaName);
+
+		constraintTemplate->referencedRelationId = referencedRelationId;
+		constraintTemplate->escapedReferencedSchemaName =
+			quote_literal_cstr(referencedSchemaName);
+		constraintTemplate->escapedCommand = quote_literal_cstr(command);
+
+		commandTemplate->foreignConstraintTemplateList =
+			lappend(commandTemplate->foreignConstraintTemplateList, constraintTemplate);
+	}
+
+	if (alterTableAttachPartitionCommand != NULL)
+	{
+		Oid parentRelationId = PartitionParentOid(relationId);
+		Oid parentSchemaId = get_rel_namespace(parentRelationId);
+		char *parentSchemaName = get_namespace_name(parentSchemaId);
+
+		Assert(PartitionTable(relationId));
+
+		commandTemplate->parentRelationId = parentRelationId;
+		commandTemplate->escapedParentSchemaName = quote_literal_cstr(parentSchemaName);
+		commandTemplate->escapedAttachPartitionCommand =
+			quote_literal_cstr(alterTableAttachPartitionCommand);
+	}
+
+	return commandTemplate;
+}
+
+
+/*
+ * WorkerCreateShardCommand returns a single multi-statement command that
+ * applies the DDL commands of the given template for the given shardId to
+ * create the shard on a worker node, such that the table, its indexes and its
+ * constraints are created in a single round trip.
+ */
+static char *
+WorkerCreateShardCommand(ShardCommandTemplate *commandTemplate, int shardIndex,
+						 uint64 shardId)
+{
+	Oid relationId = commandTemplate->relationId;
+	char *escapedSchemaName = commandTemplate->escapedSchemaName;
+	ListCell *ddlCommandCell = NULL;
+	ListCell *constraintTemplateCell = NULL;
+	StringInfo createShardCommand = makeStringInfo();
+
+	foreach(ddlCommandCell, commandTemplate->escapedDDLCommandList)
+	{
+		char *escapedDDLCommand = (char *) lfirst(ddlCommandCell);
+
+		if (commandTemplate->includeSchemaName)
+		{
+			appendStringInfo(createShardCommand, WORKER_APPLY_SHARD_DDL_COMMAND,
+							 shardId, escapedSchemaName, escapedDDLCommand);
+		}
+		else
+		{
+			appendStringInfo(createShardCommand,
+							 WORKER_APPLY_SHARD_DDL_COMMAND_WITHOUT_SCHEMA, shardId,
+							 escapedDDLCommand);
+		}
+
+		appendStringInfoChar(createShardCommand, ';');
+	}
+
+	foreach(constraintTemplateCell, commandTemplate->foreignConstraintTemplateList)
+	{
+		ShardForeignConstraintTemplate *constraintTemplate =
+			(ShardForeignConstraintTemplate *) lfirst(constraintTemplateCell);
+		Oid referencedRelationId = constraintTemplate->referencedRelationId;
+		uint64 referencedShardId = INVALID_SHARD_ID;
 
 		/*
 		 * In case of self referencing shards, relation itself might not be distributed
@@ -637,47 +1031,34 @@ WorkerCreateShard(Oid relationId, int shardIndex, uint64 shardId, List *ddlComma
 														   shardIndex);
 		}
 
-		appendStringInfo(applyForeignConstraintCommand,
+		appendStringInfo(createShardCommand,
 						 WORKER_APPLY_INTER_SHARD_DDL_COMMAND, shardId, escapedSchemaName,
-						 referencedShardId, escapedReferencedSchemaName, escapedCommand);
-
+						 referencedShardId,
+						 constraintTemplate->escapedReferencedSchemaName,
+						 constraintTemplate->escapedCommand);
 
-		ExecuteCriticalRemoteCommand(connection, applyForeignConstraintCommand->data);
+		appendStringInfoChar(createShardCommand, ';');
 	}
 
 	/*
 	 * If the shard is created for a partition, send the command to create the
 	 * partitioning hierarcy on the shard.
 	 */
-	if (alterTableAttachPartitionCommand != NULL)
+	if (commandTemplate->escapedAttachPartitionCommand != NULL)
 	{
-		Oid parentRelationId = PartitionParentOid(relationId);
-		uint64 correspondingParentShardId = InvalidOid;
-		StringInfo applyAttachPartitionCommand = makeStringInfo();
+		uint64 correspondingParentShardId =
+			ColocatedShardIdInRelation(commandTemplate->parentRelationId, shardIndex);
 
-		Oid parentSchemaId = InvalidOid;
-		char *parentSchemaName = NULL;
-		char *escapedParentSchemaName = NULL;
-		char *escapedCommand = NULL;
-
-		Assert(PartitionTable(relationId));
-
-		parentSchemaId = get_rel_namespace(parentRelationId);
-		parentSchemaName = get_namespace_name(parentSchemaId);
-		escapedParentSchemaName = quote_literal_cstr(parentSchemaName);
-		escapedCommand = quote_literal_cstr(alterTableAttachPartitionCommand);
-
-		correspondingParentShardId = ColocatedShardIdInRelation(parentRelationId,
-																shardIndex);
-
-		appendStringInfo(applyAttachPartitionCommand,
+		appendStringInfo(createShardCommand,
 						 WORKER_APPLY_INTER_SHARD_DDL_COMMAND, correspondingParentShardId,
-						 escapedParentSchemaName, shardId, escapedSchemaName,
-						 escapedCommand);
-
+						 commandTemplate->escapedParentSchemaName, shardId,
+						 escapedSchemaName,
+						 commandTemplate->escapedAttachPartitionCommand);
 
-		ExecuteCriticalRemoteCommand(connection, applyAttachPartitionCommand->data);
+		appendStringInfoChar(createShardCommand, ';');
 	}
+
+	return createShardCommand->data;
 }
 
 
@@ -695,6 +1076,8 @@ UpdateShardStatistics(int64 shardId)
 	char *shardQualifiedName = NULL;
 	List *shardPlacementList = NIL;
 	ListCell *shardPlacementCell = NULL;
+	ShardPlacement *statsPlacement = NULL;
+	List *zoneMapColumnList = NIL;
 	bool statsOK = false;
 	uint64 shardSize = 0;
 	text *minValue = NULL;
@@ -720,6 +1103,7 @@ UpdateShardStatistics(int64 shardId)
 								   &shardSize, &minValue, &maxValue);
 		if (statsOK)
 		{
+			statsPlacement = placement;
 			break;
 		}
 	}
@@ -769,10 +1153,126 @@ UpdateShardStatistics(int64 shardId)
 
 	RESUME_INTERRUPTS();
 
+	/*
+	 * Stale zone maps could prune the shard on rows it now contains. The zone
+	 * maps of the table tell which columns of the shard to summarize.
+	 */
+	zoneMapColumnList = ShardZoneMapColumnList(relationId);
+	if (zoneMapColumnList != NIL &&
+		(statsPlacement == NULL ||
+		 !UpdatePlacementShardZoneMaps(statsPlacement, shardInterval,
+									   zoneMapColumnList)))
+	{
+		ClearShardZoneMaps(shardId);
+	}
+
 	return shardSize;
 }
 
 
+/*
+ * UpdateShardPlacementLengths queries the sizes of all shards of the given
+ * table at once, each from one of its placements, and records them as the
+ * length of the finalized placements of the shard. It is used to refresh the
+ * statistics in the metadata after the shards were vacuumed or analyzed.
+ */
+void
+UpdateShardPlacementLengths(Oid relationId)
+{
+	List *shardIntervalList = LoadShardIntervalList(relationId);
+	ListCell *shardIntervalCell = NULL;
+	char *relationName = get_rel_name(relationId);
+	Oid schemaId = get_rel_namespace(relationId);
+	char *schemaName = get_namespace_name(schemaId);
+	bool cstoreTable = CStoreTable(relationId);
+	TaskListResult *taskListResult = palloc0(sizeof(TaskListResult));
+	TupleDesc tupleDescriptor = NULL;
+	TupleTableSlot *tupleSlot = NULL;
+	List *taskList = NIL;
+	uint32 taskId = 1;
+	bool hasOid = false;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		char *shardName = pstrdup(relationName);
+		char *quotedShardName = NULL;
+		StringInfo lengthQuery = makeStringInfo();
+		Task *task = NULL;
+
+		AppendShardIdToName(&shardName, shardId);
+		quotedShardName = quote_literal_cstr(quote_qualified_identifier(schemaName,
+																		shardName));
+
+		if (cstoreTable)
+		{
+			appendStringInfo(lengthQuery, SHARD_CSTORE_TABLE_LENGTH_QUERY, shardId,
+							 quotedShardName);
+		}
+		else
+		{
+			appendStringInfo(lengthQuery, SHARD_TABLE_LENGTH_QUERY, shardId,
+							 quotedShardName);
+		}
+
+		task = CreateBasicTask(INVALID_JOB_ID, taskId++, ROUTER_TASK, lengthQuery->data);
+		task->anchorShardId = shardId;
+		task->taskPlacementList = FinalizedShardPlacementList(shardId);
+
+		taskList = lappend(taskList, task);
+	}
+
+	if (taskList == NIL)
+	{
+		return;
+	}
+
+	tupleDescriptor = CreateTemplateTupleDesc(2, hasOid);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 1, "shardid", INT8OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 2, "shardlength", INT8OID, -1, 0);
+
+	taskListResult->taskList = taskList;
+	taskListResult->tupleDescriptor = tupleDescriptor;
+	taskListResult->tupleStore = NULL;
+
+	ExecuteTaskListsIntoTupleStores(list_make1(taskListResult));
+
+	tupleSlot = MakeSingleTupleTableSlot(tupleDescriptor);
+
+	while (tuplestore_gettupleslot(taskListResult->tupleStore, true, false, tupleSlot))
+	{
+		bool shardIdIsNull = false;
+		bool shardLengthIsNull = false;
+		Datum shardIdDatum = slot_getattr(tupleSlot, 1, &shardIdIsNull);
+		Datum shardLengthDatum = slot_getattr(tupleSlot, 2, &shardLengthIsNull);
+		uint64 shardId = INVALID_SHARD_ID;
+		uint64 shardLength = 0;
+		List *shardPlacementList = NIL;
+		ListCell *shardPlacementCell = NULL;
+
+		if (shardIdIsNull || shardLengthIsNull)
+		{
+			continue;
+		}
+
+		shardId = DatumGetInt64(shardIdDatum);
+		shardLength = DatumGetInt64(shardLengthDatum);
+
+		shardPlacementList = FinalizedShardPlacementList(shardId);
+		foreach(shardPlacementCell, shardPlacementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
+
+			UpdateShardPlacementLength(placement->placementId, shardLength);
+		}
+	}
+
+	ExecDropSingleTupleTableSlot(tupleSlot);
+	tuplestore_end(taskListResult->tupleStore);
+}
+
+
 /*
  * WorkerShardStats queries the worker node, and retrieves shard statistics that
  * we assume have changed after new table data have been appended to the shard.
@@ -0,0 +1,732 @@
+/*-------------------------------------------------------------------------
+ *
+ * rollup_tables.c
+ *   Routines for incrementally aggregating the new rows of a distributed
+ *   table into a colocated rollup table.
+ *
+ *   Dashboards typically aggregate raw events into rollup tables by running
+ *   an INSERT ... SELECT ... GROUP BY over a time window again and again. A
+ *   rollup registered with master_create_rollup instead remembers the last
+ *   value of the sequence column of the source table that it aggregated in
+ *   pg_dist_rollup, and every run only aggregates the rows after it. The
+ *   aggregation query gets the first and the last sequence value of the new
+ *   window as $1 and $2, and since the source and rollup tables are
+ *   colocated, it is pushed down to all pairs of shards in parallel. The
+ *   maintenance daemon runs all rollups every citus.rollup_interval, and
+ *   master_run_rollup runs a single rollup right away.
+ *
+ *   A window ends at the last value handed out by the sequence once in-flight
+ *   writes to the source table have finished, such that rows that commit
+ *   later always have a sequence value in a later window. Since the window
+ *   and the aggregation are committed together, every row is aggregated
+ *   exactly once.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/dependency.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_type.h"
+#include "commands/sequence.h"
+#include "distributed/citus_ruleutils.h"
+#include "distributed/colocation_utils.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_protocol.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/pg_dist_rollup.h"
+#include "distributed/rollup_tables.h"
+#include "distributed/worker_protocol.h"
+#include "executor/spi.h"
+#include "nodes/parsenodes.h"
+#include "storage/lmgr.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+
+
+/* Rollup is a row of pg_dist_rollup */
+typedef struct Rollup
+{
+	Oid rollupRelationId;
+	Oid sourceRelationId;
+	Oid sequenceId;
+	int64 lastAggregatedId;
+	char *aggregateQuery;
+} Rollup;
+
+
+/* Config variables managed via guc.c */
+int RollupInterval = 60 * 1000; /* in milliseconds, -1 to disable */
+
+
+static void EnsureRollupAllowed(Oid rollupRelationId, Oid sourceRelationId,
+								char *aggregateQuery);
+static Oid ColumnSequenceId(Oid relationId, char *columnName);
+static int64 RunRollup(Rollup *rollup);
+static int64 RollupWindowEnd(Rollup *rollup);
+static int64 SequenceLastValue(Oid sequenceId);
+static void ExecuteAggregateQuery(Rollup *rollup, int64 windowStart, int64 windowEnd);
+static Rollup * LookupRollup(Oid rollupRelationId);
+static List * RollupList(void);
+static Rollup * TupleToRollup(HeapTuple heapTuple, TupleDesc tupleDescriptor);
+static void InsertRollup(Rollup *rollup);
+static void UpdateRollupLastAggregatedId(Oid rollupRelationId, int64 lastAggregatedId);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(master_create_rollup);
+PG_FUNCTION_INFO_V1(master_drop_rollup);
+PG_FUNCTION_INFO_V1(master_run_rollup);
+
+
+/*
+ * master_create_rollup registers the given rollup table as the target of the
+ * aggregation query, which aggregates the rows of the source table whose
+ * sequence column value is between $1 and $2. The first run aggregates all
+ * rows that already exist.
+ */
+Datum
+master_create_rollup(PG_FUNCTION_ARGS)
+{
+	Oid rollupRelationId = PG_GETARG_OID(0);
+	Oid sourceRelationId = PG_GETARG_OID(1);
+	char *sequenceColumnName = text_to_cstring(PG_GETARG_TEXT_P(2));
+	char *aggregateQuery = text_to_cstring(PG_GETARG_TEXT_P(3));
+	Rollup rollup;
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+	EnsureTableOwner(rollupRelationId);
+
+	/* block concurrent runs of an existing rollup */
+	LockRelationOid(rollupRelationId, ShareUpdateExclusiveLock);
+	LockRelationOid(sourceRelationId, AccessShareLock);
+
+	if (LookupRollup(rollupRelationId) != NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DUPLICATE_OBJECT),
+						errmsg("table \"%s\" is already a rollup table",
+							   get_rel_name(rollupRelationId))));
+	}
+
+	EnsureRollupAllowed(rollupRelationId, sourceRelationId, aggregateQuery);
+
+	memset(&rollup, 0, sizeof(Rollup));
+	rollup.rollupRelationId = rollupRelationId;
+	rollup.sourceRelationId = sourceRelationId;
+	rollup.sequenceId = ColumnSequenceId(sourceRelationId, sequenceColumnName);
+	rollup.lastAggregatedId = 0;
+	rollup.aggregateQuery = aggregateQuery;
+
+	InsertRollup(&rollup);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * master_drop_rollup stops maintaining the given rollup table. The table
+ * itself and the rows aggregated so far are kept.
+ */
+Datum
+master_drop_rollup(PG_FUNCTION_ARGS)
+{
+	Oid rollupRelationId = PG_GETARG_OID(0);
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+	EnsureTableOwner(rollupRelationId);
+
+	LockRelationOid(rollupRelationId, ShareUpdateExclusiveLock);
+
+	if (LookupRollup(rollupRelationId) == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+						errmsg("table \"%s\" is not a rollup table",
+							   get_rel_name(rollupRelationId))));
+	}
+
+	DeleteRollups(rollupRelationId);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * master_run_rollup aggregates the rows that were added to the source table of
+ * the given rollup table since its last run, and returns the last sequence
+ * value that is now aggregated.
+ */
+Datum
+master_run_rollup(PG_FUNCTION_ARGS)
+{
+	Oid rollupRelationId = PG_GETARG_OID(0);
+	Rollup *rollup = NULL;
+	int64 lastAggregatedId = 0;
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+	EnsureTableOwner(rollupRelationId);
+
+	/* wait for concurrent runs, which would aggregate the same window */
+	LockRelationOid(rollupRelationId, ShareUpdateExclusiveLock);
+
+	rollup = LookupRollup(rollupRelationId);
+	if (rollup == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+						errmsg("table \"%s\" is not a rollup table",
+							   get_rel_name(rollupRelationId)),
+						errhint("Use master_create_rollup() to create one.")));
+	}
+
+	lastAggregatedId = RunRollup(rollup);
+
+	PG_RETURN_INT64(lastAggregatedId);
+}
+
+
+/*
+ * EnsureRollupAllowed errors out if the aggregation query cannot be used to
+ * maintain the given rollup table from the given source table.
+ */
+static void
+EnsureRollupAllowed(Oid rollupRelationId, Oid sourceRelationId, char *aggregateQuery)
+{
+	char *rollupRelationName = get_rel_name(rollupRelationId);
+	Node *parseTree = NULL;
+	InsertStmt *insertStatement = NULL;
+
+	if (!IsDistributedTable(rollupRelationId))
+	{
+		ereport(ERROR, (errmsg("relation \"%s\" is not a distributed table",
+							   rollupRelationName)));
+	}
+
+	if (!IsDistributedTable(sourceRelationId))
+	{
+		ereport(ERROR, (errmsg("relation \"%s\" is not a distributed table",
+							   get_rel_name(sourceRelationId))));
+	}
+
+	if (PartitionMethod(rollupRelationId) != DISTRIBUTE_BY_HASH ||
+		PartitionMethod(sourceRelationId) != DISTRIBUTE_BY_HASH ||
+		!TablesColocated(rollupRelationId, sourceRelationId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot create rollup table \"%s\"", rollupRelationName),
+						errdetail("The rollup table and the source table need to be "
+								  "colocated hash distributed tables.")));
+	}
+
+	parseTree = ParseTreeNode(aggregateQuery);
+	if (!IsA(parseTree, InsertStmt) ||
+		((InsertStmt *) parseTree)->selectStmt == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("aggregate query must be an INSERT ... SELECT command")));
+	}
+
+	insertStatement = (InsertStmt *) parseTree;
+	if (RangeVarGetRelid(insertStatement->relation, NoLock, false) != rollupRelationId)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("aggregate query must insert into \"%s\"",
+							   rollupRelationName)));
+	}
+}
+
+
+/*
+ * ColumnSequenceId returns the sequence that is owned by the given column, as
+ * for serial and bigserial columns.
+ */
+static Oid
+ColumnSequenceId(Oid relationId, char *columnName)
+{
+	AttrNumber attributeNumber = get_attnum(relationId, columnName);
+	List *sequenceIdList = NIL;
+	ListCell *sequenceIdCell = NULL;
+
+	if (attributeNumber == InvalidAttrNumber)
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+						errmsg("column \"%s\" of relation \"%s\" does not exist",
+							   columnName, get_rel_name(relationId))));
+	}
+
+#if (PG_VERSION_NUM >= 100000)
+	sequenceIdList = getOwnedSequences(relationId, attributeNumber);
+#else
+	sequenceIdList = getOwnedSequences(relationId);
+#endif
+
+	foreach(sequenceIdCell, sequenceIdList)
+	{
+		Oid sequenceId = lfirst_oid(sequenceIdCell);
+		Oid ownedByTableId = InvalidOid;
+		int32 ownedByColumnId = 0;
+		bool sequenceOwned = false;
+
+#if (PG_VERSION_NUM >= 100000)
+		sequenceOwned = sequenceIsOwned(sequenceId, DEPENDENCY_AUTO, &ownedByTableId,
+										&ownedByColumnId);
+#else
+		sequenceOwned = sequenceIsOwned(sequenceId, &ownedByTableId, &ownedByColumnId);
+#endif
+
+		if (sequenceOwned && ownedByColumnId == attributeNumber)
+		{
+			return sequenceId;
+		}
+	}
+
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("column \"%s\" of relation \"%s\" does not own a sequence",
+						   columnName, get_rel_name(relationId)),
+					errhint("Use a serial or bigserial column as the sequence "
+							"column.")));
+}
+
+
+/*
+ * RunRollup aggregates the rows of the source table with sequence values after
+ * the last aggregated value, up to the end of the current window, and records
+ * the end of the window as the last aggregated value. The caller is expected
+ * to hold a lock that blocks concurrent runs of the rollup. The function
+ * returns the last aggregated value.
+ */
+static int64
+RunRollup(Rollup *rollup)
+{
+	int64 windowStart = rollup->lastAggregatedId + 1;
+	int64 windowEnd = RollupWindowEnd(rollup);
+
+	if (windowEnd < windowStart)
+	{
+		return rollup->lastAggregatedId;
+	}
+
+	ereport(DEBUG1, (errmsg("aggregating rows " INT64_FORMAT " to " INT64_FORMAT
+							" of \"%s\" into \"%s\"", windowStart, windowEnd,
+							get_rel_name(rollup->sourceRelationId),
+							get_rel_name(rollup->rollupRelationId))));
+
+	ExecuteAggregateQuery(rollup, windowStart, windowEnd);
+	UpdateRollupLastAggregatedId(rollup->rollupRelationId, windowEnd);
+
+	return windowEnd;
+}
+
+
+/*
+ * RollupWindowEnd returns the last sequence value that can be aggregated. It
+ * first waits for the transactions that are writing to the source table, in
+ * which a row may have taken a sequence value but not committed yet. The lock
+ * is taken in a subtransaction that is rolled back right away, such that
+ * writes are only blocked while waiting.
+ */
+static int64
+RollupWindowEnd(Rollup *rollup)
+{
+	MemoryContext savedContext = CurrentMemoryContext;
+	ResourceOwner savedOwner = CurrentResourceOwner;
+	int64 windowEnd = 0;
+
+	BeginInternalSubTransaction(NULL);
+
+	LockRelationOid(rollup->sourceRelationId, ExclusiveLock);
+	windowEnd = SequenceLastValue(rollup->sequenceId);
+
+	RollbackAndReleaseCurrentSubTransaction();
+
+	MemoryContextSwitchTo(savedContext);
+	CurrentResourceOwner = savedOwner;
+
+	return windowEnd;
+}
+
+
+/*
+ * SequenceLastValue returns the last value that the given sequence handed out.
+ */
+static int64
+SequenceLastValue(Oid sequenceId)
+{
+	StringInfo query = makeStringInfo();
+	int64 lastValue = 0;
+	bool isCalled = false;
+	bool isNull = false;
+	int spiResult = 0;
+
+	appendStringInfo(query, "SELECT last_value, is_called FROM %s",
+					 generate_qualified_relation_name(sequenceId));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+	}
+
+	spiResult = SPI_execute(query->data, true, 1);
+	if (spiResult != SPI_OK_SELECT || SPI_processed != 1)
+	{
+		ereport(ERROR, (errmsg("could not read sequence %u", sequenceId)));
+	}
+
+	lastValue = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+											SPI_tuptable->tupdesc, 1, &isNull));
+	isCalled = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+										  SPI_tuptable->tupdesc, 2, &isNull));
+
+	SPI_finish();
+
+	/* last_value has not been handed out yet if nextval was never called */
+	if (!isCalled)
+	{
+		lastValue -= 1;
+	}
+
+	return lastValue;
+}
+
+
+/*
+ * ExecuteAggregateQuery runs the aggregation query of the rollup for the given
+ * window of sequence values, as the owner of the rollup table.
+ */
+static void
+ExecuteAggregateQuery(Rollup *rollup, int64 windowStart, int64 windowEnd)
+{
+	Oid argumentTypes[2] = { INT8OID, INT8OID };
+	Datum argumentValues[2] = { Int64GetDatum(windowStart), Int64GetDatum(windowEnd) };
+	Oid rollupOwnerId = get_role_oid(TableOwner(rollup->rollupRelationId), false);
+	Oid savedUserId = InvalidOid;
+	int savedSecurityContext = 0;
+	int spiResult = 0;
+
+	/* the maintenance daemon should not run the query with its own privileges */
+	GetUserIdAndSecContext(&savedUserId, &savedSecurityContext);
+	SetUserIdAndSecContext(rollupOwnerId, SECURITY_LOCAL_USERID_CHANGE);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+	}
+
+	spiResult = SPI_execute_with_args(rollup->aggregateQuery, 2, argumentTypes,
+									  argumentValues, NULL, false, 0);
+	if (spiResult != SPI_OK_INSERT && spiResult != SPI_OK_INSERT_RETURNING)
+	{
+		ereport(ERROR, (errmsg("could not run the aggregate query of rollup "
+							   "table \"%s\"", get_rel_name(rollup->rollupRelationId))));
+	}
+
+	SPI_finish();
+
+	SetUserIdAndSecContext(savedUserId, savedSecurityContext);
+}
+
+
+/*
+ * RunRollups runs all rollups whose rollup table is not locked by another
+ * transaction, each in its own subtransaction such that a failing aggregation
+ * query only holds up its own rollup. It returns the number of rollups that
+ * aggregated new rows.
+ */
+int
+RunRollups(void)
+{
+	List *rollupList = NIL;
+	ListCell *rollupCell = NULL;
+	volatile int aggregatedRollupCount = 0;
+
+	/* the maintenance daemon does not have a snapshot for running queries */
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	rollupList = RollupList();
+
+	foreach(rollupCell, rollupList)
+	{
+		Rollup *rollup = (Rollup *) lfirst(rollupCell);
+		MemoryContext savedContext = CurrentMemoryContext;
+		ResourceOwner savedOwner = CurrentResourceOwner;
+
+		if (!ConditionalLockRelationOid(rollup->rollupRelationId,
+										ShareUpdateExclusiveLock))
+		{
+			ereport(DEBUG1, (errmsg("could not lock table %u, skipping its rollup",
+									rollup->rollupRelationId)));
+			continue;
+		}
+
+		/* the tables may have been dropped since we read the rollups */
+		if (get_rel_name(rollup->rollupRelationId) == NULL ||
+			get_rel_name(rollup->sourceRelationId) == NULL)
+		{
+			continue;
+		}
+
+		BeginInternalSubTransaction(NULL);
+
+		PG_TRY();
+		{
+			if (RunRollup(rollup) > rollup->lastAggregatedId)
+			{
+				aggregatedRollupCount++;
+			}
+
+			ReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(savedContext);
+			CurrentResourceOwner = savedOwner;
+		}
+		PG_CATCH();
+		{
+			ErrorData *edata = NULL;
+
+			MemoryContextSwitchTo(savedContext);
+			edata = CopyErrorData();
+			FlushErrorState();
+
+			RollbackAndReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(savedContext);
+			CurrentResourceOwner = savedOwner;
+
+			/* rethrow as WARNING */
+			edata->elevel = WARNING;
+			ThrowErrorData(edata);
+		}
+		PG_END_TRY();
+	}
+
+	PopActiveSnapshot();
+
+	return aggregatedRollupCount;
+}
+
+
+/*
+ * LookupRollup returns the row of pg_dist_rollup for the given rollup table,
+ * or NULL if the table is not a rollup table.
+ */
+static Rollup *
+LookupRollup(Oid rollupRelationId)
+{
+	Relation pgDistRollup = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+	Rollup *rollup = NULL;
+
+	pgDistRollup = heap_open(DistRollupRelationId(), AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_rollup_rollupid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(rollupRelationId));
+
+	scanDescriptor = systable_beginscan(pgDistRollup, DistRollupPrimaryKeyIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		rollup = TupleToRollup(heapTuple, RelationGetDescr(pgDistRollup));
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistRollup, NoLock);
+
+	return rollup;
+}
+
+
+/*
+ * RollupList returns all rows of pg_dist_rollup.
+ */
+static List *
+RollupList(void)
+{
+	Relation pgDistRollup = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	List *rollupList = NIL;
+
+	pgDistRollup = heap_open(DistRollupRelationId(), AccessShareLock);
+
+	scanDescriptor = systable_beginscan(pgDistRollup, InvalidOid, false, NULL, 0, NULL);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		Rollup *rollup = TupleToRollup(heapTuple, RelationGetDescr(pgDistRollup));
+
+		rollupList = lappend(rollupList, rollup);
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistRollup, NoLock);
+
+	return rollupList;
+}
+
+
+/*
+ * TupleToRollup converts a row of pg_dist_rollup into a Rollup.
+ */
+static Rollup *
+TupleToRollup(HeapTuple heapTuple, TupleDesc tupleDescriptor)
+{
+	Rollup *rollup = palloc0(sizeof(Rollup));
+	Datum values[Natts_pg_dist_rollup];
+	bool isNulls[Natts_pg_dist_rollup];
+
+	heap_deform_tuple(heapTuple, tupleDescriptor, values, isNulls);
+
+	rollup->rollupRelationId = DatumGetObjectId(values[Anum_pg_dist_rollup_rollupid - 1]);
+	rollup->sourceRelationId = DatumGetObjectId(values[Anum_pg_dist_rollup_sourceid - 1]);
+	rollup->sequenceId = DatumGetObjectId(values[Anum_pg_dist_rollup_sequenceid - 1]);
+	rollup->lastAggregatedId =
+		DatumGetInt64(values[Anum_pg_dist_rollup_lastaggregatedid - 1]);
+	rollup->aggregateQuery =
+		TextDatumGetCString(values[Anum_pg_dist_rollup_aggregatequery - 1]);
+
+	return rollup;
+}
+
+
+/*
+ * InsertRollup adds a row for the given rollup to pg_dist_rollup.
+ */
+static void
+InsertRollup(Rollup *rollup)
+{
+	Relation pgDistRollup = NULL;
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_pg_dist_rollup];
+	bool isNulls[Natts_pg_dist_rollup];
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_pg_dist_rollup_rollupid - 1] =
+		ObjectIdGetDatum(rollup->rollupRelationId);
+	values[Anum_pg_dist_rollup_sourceid - 1] =
+		ObjectIdGetDatum(rollup->sourceRelationId);
+	values[Anum_pg_dist_rollup_sequenceid - 1] = ObjectIdGetDatum(rollup->sequenceId);
+	values[Anum_pg_dist_rollup_lastaggregatedid - 1] =
+		Int64GetDatum(rollup->lastAggregatedId);
+	values[Anum_pg_dist_rollup_aggregatequery - 1] =
+		CStringGetTextDatum(rollup->aggregateQuery);
+
+	pgDistRollup = heap_open(DistRollupRelationId(), RowExclusiveLock);
+
+	heapTuple = heap_form_tuple(RelationGetDescr(pgDistRollup), values, isNulls);
+	CatalogTupleInsert(pgDistRollup, heapTuple);
+
+	CommandCounterIncrement();
+	heap_close(pgDistRollup, NoLock);
+}
+
+
+/*
+ * UpdateRollupLastAggregatedId records the last aggregated sequence value of
+ * the given rollup table in pg_dist_rollup.
+ */
+static void
+UpdateRollupLastAggregatedId(Oid rollupRelationId, int64 lastAggregatedId)
+{
+	Relation pgDistRollup = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_pg_dist_rollup];
+	bool isNulls[Natts_pg_dist_rollup];
+	bool replace[Natts_pg_dist_rollup];
+
+	pgDistRollup = heap_open(DistRollupRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistRollup);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_rollup_rollupid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(rollupRelationId));
+
+	scanDescriptor = systable_beginscan(pgDistRollup, DistRollupPrimaryKeyIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		ereport(ERROR, (errmsg("could not find rollup table %u", rollupRelationId)));
+	}
+
+	memset(replace, 0, sizeof(replace));
+
+	values[Anum_pg_dist_rollup_lastaggregatedid - 1] = Int64GetDatum(lastAggregatedId);
+	isNulls[Anum_pg_dist_rollup_lastaggregatedid - 1] = false;
+	replace[Anum_pg_dist_rollup_lastaggregatedid - 1] = true;
+
+	heapTuple = heap_modify_tuple(heapTuple, tupleDescriptor, values, isNulls, replace);
+	CatalogTupleUpdate(pgDistRollup, &heapTuple->t_self, heapTuple);
+
+	CommandCounterIncrement();
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistRollup, NoLock);
+}
+
+
+/*
+ * DeleteRollups removes the rollups that aggregate into or from the given
+ * table from pg_dist_rollup.
+ */
+void
+DeleteRollups(Oid relationId)
+{
+	Relation pgDistRollup = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	bool rollupDeleted = false;
+
+	pgDistRollup = heap_open(DistRollupRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistRollup);
+
+	scanDescriptor = systable_beginscan(pgDistRollup, InvalidOid, false, NULL, 0, NULL);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		Rollup *rollup = TupleToRollup(heapTuple, tupleDescriptor);
+
+		if (rollup->rollupRelationId == relationId ||
+			rollup->sourceRelationId == relationId)
+		{
+			simple_heap_delete(pgDistRollup, &heapTuple->t_self);
+			rollupDeleted = true;
+		}
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	if (rollupDeleted)
+	{
+		CommandCounterIncrement();
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistRollup, NoLock);
+}
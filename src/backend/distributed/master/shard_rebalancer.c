@@ -0,0 +1,1009 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_rebalancer.c
+ *
+ * This file contains functions to compute a plan of shard moves that balances
+ * the shards of distributed tables across the workers, and to execute the
+ * plan using master_move_shard_placement.
+ *
+ * Each shard is moved together with its co-located shards, which we call a
+ * shard group. The cost of a shard group placement is a weighted sum of its
+ * share of the total disk size and its share of the total query load of the
+ * shard groups that are rebalanced. The load is derived from the statistics
+ * that the workers keep for each shard in pg_stat_user_tables.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "c.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "distributed/colocation_utils.h"
+#include "distributed/connection_management.h"
+#include "distributed/listutils.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_partitioning_utils.h"
+#include "distributed/reference_table_utils.h"
+#include "distributed/remote_commands.h"
+#include "distributed/shard_rebalancer.h"
+#include "distributed/task_tracker.h"
+#include "distributed/worker_manager.h"
+#include "distributed/worker_protocol.h"
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#include "postmaster/postmaster.h"
+#include "utils/acl.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/palloc.h"
+#include "utils/tuplestore.h"
+
+
+/* query that returns the size and the number of accessed tuples of given shards */
+#define SHARD_STATISTICS_QUERY \
+	"SELECT coalesce(pg_total_relation_size(to_regclass(shard.name)), 0), " \
+	"coalesce(stat.seq_tup_read + coalesce(stat.idx_tup_fetch, 0) + " \
+	"stat.n_tup_ins + stat.n_tup_upd + stat.n_tup_del, 0) " \
+	"FROM unnest(ARRAY[%s]::text[]) WITH ORDINALITY AS shard (name, ordinality) " \
+	"LEFT JOIN pg_stat_user_tables stat ON (stat.relid = to_regclass(shard.name)) " \
+	"ORDER BY shard.ordinality"
+
+/* time to wait between checks of the running shard moves, in microseconds */
+#define REBALANCE_POLL_INTERVAL 100000L
+
+/* number of columns returned by get_rebalance_table_shards_plan */
+#define REBALANCE_PLAN_COLUMNS 7
+
+
+/*
+ * RebalanceShardGroup represents a shard and its co-located shards, which
+ * are always moved together.
+ */
+typedef struct RebalanceShardGroup
+{
+	Oid relationId;
+	uint64 shardId;
+	List *shardIntervalList;
+	bool movable;
+} RebalanceShardGroup;
+
+
+/* RebalancePlacement represents the placement of a shard group on a node */
+typedef struct RebalancePlacement
+{
+	RebalanceShardGroup *shardGroup;
+	uint64 size;
+	uint64 load;
+	double cost;
+} RebalancePlacement;
+
+
+/* RebalanceNode keeps the shard group placements of a worker node */
+typedef struct RebalanceNode
+{
+	WorkerNode *workerNode;
+	List *placementList;
+	double utilization;
+} RebalanceNode;
+
+
+/* ShardMove represents a single step of the rebalance plan */
+typedef struct ShardMove
+{
+	RebalanceShardGroup *shardGroup;
+	uint64 size;
+	WorkerNode *sourceNode;
+	WorkerNode *targetNode;
+
+	/* connection over which the move is executed */
+	MultiConnection *connection;
+} ShardMove;
+
+
+/* config variables for the rebalancer */
+double RebalanceLoadWeight = 0.5;
+int RebalanceMaxConcurrentMoves = 1;
+
+
+/* local function forward declarations */
+static List * RebalancePlanFromArguments(FunctionCallInfo fcinfo);
+static List * RebalanceTableList(Oid relationId);
+static bool ColocationGroupCanBeRebalanced(Oid relationId);
+static List * RebalanceNodeList(List *tableList, List *excludedShardList);
+static RebalanceNode * FindRebalanceNode(List *rebalanceNodeList, char *nodeName,
+										 uint32 nodePort);
+static bool ShardGroupIsExcluded(List *shardIntervalList, List *excludedShardList);
+static void CollectShardGroupStatistics(List *rebalanceNodeList);
+static void ComputePlacementCosts(List *rebalanceNodeList);
+static List * PlanShardMoves(List *rebalanceNodeList, float4 threshold,
+							 int maxShardMoves);
+static bool NodeHasShardGroup(RebalanceNode *rebalanceNode,
+							  RebalanceShardGroup *shardGroup);
+static void ExecuteShardMoves(List *shardMoveList, char *transferMode);
+static void StartShardMove(ShardMove *shardMove, char *transferMode);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(get_rebalance_table_shards_plan);
+PG_FUNCTION_INFO_V1(rebalance_table_shards);
+
+
+/*
+ * get_rebalance_table_shards_plan returns the shard moves that rebalance_table_shards
+ * would execute for the given arguments, without moving any shards.
+ */
+Datum
+get_rebalance_table_shards_plan(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	List *shardMoveList = NIL;
+	ListCell *shardMoveCell = NULL;
+
+	EnsureCoordinator();
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	shardMoveList = RebalancePlanFromArguments(fcinfo);
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	foreach(shardMoveCell, shardMoveList)
+	{
+		ShardMove *shardMove = (ShardMove *) lfirst(shardMoveCell);
+		Datum values[REBALANCE_PLAN_COLUMNS];
+		bool nulls[REBALANCE_PLAN_COLUMNS];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(shardMove->shardGroup->relationId);
+		values[1] = Int64GetDatum(shardMove->shardGroup->shardId);
+		values[2] = Int64GetDatum(shardMove->size);
+		values[3] = CStringGetTextDatum(shardMove->sourceNode->workerName);
+		values[4] = Int32GetDatum(shardMove->sourceNode->workerPort);
+		values[5] = CStringGetTextDatum(shardMove->targetNode->workerName);
+		values[6] = Int32GetDatum(shardMove->targetNode->workerPort);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+	}
+
+	tuplestore_donestoring(tupleStore);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * rebalance_table_shards computes a plan of shard moves that balances the
+ * shard groups of the given table, or of all distributed tables, across the
+ * workers and executes it. Up to citus.rebalance_max_concurrent_moves moves
+ * run at the same time, each over its own connection to the coordinator such
+ * that it commits independently of the others.
+ */
+Datum
+rebalance_table_shards(PG_FUNCTION_ARGS)
+{
+	Oid shardTransferModeOid = InvalidOid;
+	char *shardTransferMode = NULL;
+	List *shardMoveList = NIL;
+
+	EnsureCoordinator();
+	CheckCitusVersion(ERROR);
+
+	/* the moves commit independently, so we cannot roll them back */
+	PreventTransactionChain(true, "rebalance_table_shards");
+
+	if (PG_ARGISNULL(4))
+	{
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("shard_transfer_mode cannot be NULL")));
+	}
+
+	shardTransferModeOid = PG_GETARG_OID(4);
+	shardTransferMode = DatumGetCString(DirectFunctionCall1(enum_out,
+															shardTransferModeOid));
+
+	shardMoveList = RebalancePlanFromArguments(fcinfo);
+
+	ExecuteShardMoves(shardMoveList, shardTransferMode);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * RebalancePlanFromArguments computes the rebalance plan for the relation,
+ * threshold, max_shard_moves and excluded_shard_list arguments that both
+ * rebalancer functions take, and returns it as a list of ShardMoves.
+ */
+static List *
+RebalancePlanFromArguments(FunctionCallInfo fcinfo)
+{
+	Oid relationId = InvalidOid;
+	float4 threshold = 0.0;
+	int32 maxShardMoves = 0;
+	List *excludedShardList = NIL;
+	List *tableList = NIL;
+	List *rebalanceNodeList = NIL;
+
+	if (!PG_ARGISNULL(0))
+	{
+		relationId = PG_GETARG_OID(0);
+	}
+
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("threshold and max_shard_moves cannot be NULL")));
+	}
+
+	threshold = PG_GETARG_FLOAT4(1);
+	if (threshold < 0.0 || threshold > 1.0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("threshold must be between 0 and 1")));
+	}
+
+	maxShardMoves = PG_GETARG_INT32(2);
+	if (maxShardMoves < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("max_shard_moves cannot be negative")));
+	}
+
+	if (!PG_ARGISNULL(3))
+	{
+		ArrayType *excludedShardArray = PG_GETARG_ARRAYTYPE_P(3);
+		int excludedShardCount = ArrayObjectCount(excludedShardArray);
+		Datum *excludedShardDatumArray = DeconstructArrayObject(excludedShardArray);
+		int excludedShardIndex = 0;
+
+		for (excludedShardIndex = 0; excludedShardIndex < excludedShardCount;
+			 excludedShardIndex++)
+		{
+			int64 *excludedShardId = palloc0(sizeof(int64));
+
+			*excludedShardId = DatumGetInt64(excludedShardDatumArray[excludedShardIndex]);
+			excludedShardList = lappend(excludedShardList, excludedShardId);
+		}
+	}
+
+	tableList = RebalanceTableList(relationId);
+	rebalanceNodeList = RebalanceNodeList(tableList, excludedShardList);
+
+	CollectShardGroupStatistics(rebalanceNodeList);
+	ComputePlacementCosts(rebalanceNodeList);
+
+	return PlanShardMoves(rebalanceNodeList, threshold, maxShardMoves);
+}
+
+
+/*
+ * RebalanceTableList returns the tables to rebalance. If a relation is given,
+ * it errors out if its shards cannot be moved. Otherwise, it returns all the
+ * distributed tables owned by the current user whose shards can be moved.
+ */
+static List *
+RebalanceTableList(Oid relationId)
+{
+	List *distTableOidList = NIL;
+	ListCell *distTableOidCell = NULL;
+	List *tableList = NIL;
+
+	if (OidIsValid(relationId))
+	{
+		char *relationName = get_rel_name(relationId);
+
+		EnsureTableOwner(relationId);
+
+		if (!IsDistributedTable(relationId))
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("table %s is not distributed", relationName)));
+		}
+
+		if (!ColocationGroupCanBeRebalanced(relationId))
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("cannot rebalance table %s", relationName),
+							errdetail("Reference tables, foreign tables, partitioned "
+									  "tables and tables co-located with them "
+									  "cannot be rebalanced.")));
+		}
+
+		return list_make1_oid(relationId);
+	}
+
+	distTableOidList = SortList(DistTableOidList(), CompareOids);
+
+	foreach(distTableOidCell, distTableOidList)
+	{
+		Oid distTableOid = lfirst_oid(distTableOidCell);
+
+		if (!pg_class_ownercheck(distTableOid, GetUserId()))
+		{
+			continue;
+		}
+
+		if (!ColocationGroupCanBeRebalanced(distTableOid))
+		{
+			continue;
+		}
+
+		tableList = lappend_oid(tableList, distTableOid);
+	}
+
+	return tableList;
+}
+
+
+/*
+ * ColocationGroupCanBeRebalanced returns whether the shards of the given table
+ * and those of the tables co-located with it can be moved.
+ */
+static bool
+ColocationGroupCanBeRebalanced(Oid relationId)
+{
+	List *colocatedTableList = ColocatedTableList(relationId);
+	ListCell *colocatedTableCell = NULL;
+
+	foreach(colocatedTableCell, colocatedTableList)
+	{
+		Oid colocatedTableId = lfirst_oid(colocatedTableCell);
+		DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(colocatedTableId);
+
+		if (cacheEntry->partitionMethod == DISTRIBUTE_BY_NONE ||
+			get_rel_relkind(colocatedTableId) == RELKIND_FOREIGN_TABLE ||
+			PartitionedTable(colocatedTableId) || PartitionTable(colocatedTableId))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * RebalanceNodeList returns a RebalanceNode for each active primary node, with
+ * the placements of the shard groups of the given tables on that node. Tables
+ * that are co-located with an earlier table in the list are skipped, since
+ * their shards are part of the same shard groups.
+ */
+static List *
+RebalanceNodeList(List *tableList, List *excludedShardList)
+{
+	List *workerNodeList = SortList(ActivePrimaryNodeList(), CompareWorkerNodes);
+	ListCell *workerNodeCell = NULL;
+	List *rebalanceNodeList = NIL;
+	List *seenColocationIdList = NIL;
+	ListCell *tableCell = NULL;
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		RebalanceNode *rebalanceNode = palloc0(sizeof(RebalanceNode));
+
+		rebalanceNode->workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		rebalanceNodeList = lappend(rebalanceNodeList, rebalanceNode);
+	}
+
+	foreach(tableCell, tableList)
+	{
+		Oid relationId = lfirst_oid(tableCell);
+		DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+		uint32 colocationId = cacheEntry->colocationId;
+		List *shardIntervalList = NIL;
+		ListCell *shardIntervalCell = NULL;
+
+		if (colocationId != INVALID_COLOCATION_ID)
+		{
+			if (list_member_int(seenColocationIdList, (int) colocationId))
+			{
+				continue;
+			}
+
+			seenColocationIdList = lappend_int(seenColocationIdList, (int) colocationId);
+		}
+
+		shardIntervalList = LoadShardIntervalList(relationId);
+
+		foreach(shardIntervalCell, shardIntervalList)
+		{
+			ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+			RebalanceShardGroup *shardGroup = palloc0(sizeof(RebalanceShardGroup));
+			List *shardPlacementList = ShardPlacementList(shardInterval->shardId);
+			ListCell *shardPlacementCell = NULL;
+
+			shardGroup->relationId = relationId;
+			shardGroup->shardId = shardInterval->shardId;
+			shardGroup->shardIntervalList = ColocatedShardIntervalList(shardInterval);
+			shardGroup->movable = !ShardGroupIsExcluded(shardGroup->shardIntervalList,
+														excludedShardList);
+
+			foreach(shardPlacementCell, shardPlacementList)
+			{
+				ShardPlacement *shardPlacement =
+					(ShardPlacement *) lfirst(shardPlacementCell);
+
+				/* moves require all placements of the shard group to be healthy */
+				if (shardPlacement->shardState != FILE_FINALIZED)
+				{
+					shardGroup->movable = false;
+				}
+			}
+
+			foreach(shardPlacementCell, shardPlacementList)
+			{
+				ShardPlacement *shardPlacement =
+					(ShardPlacement *) lfirst(shardPlacementCell);
+				RebalanceNode *rebalanceNode = NULL;
+				RebalancePlacement *rebalancePlacement = NULL;
+
+				rebalanceNode = FindRebalanceNode(rebalanceNodeList,
+												  shardPlacement->nodeName,
+												  shardPlacement->nodePort);
+				if (rebalanceNode == NULL)
+				{
+					/* placements on inactive nodes do not take part */
+					continue;
+				}
+
+				rebalancePlacement = palloc0(sizeof(RebalancePlacement));
+				rebalancePlacement->shardGroup = shardGroup;
+
+				rebalanceNode->placementList = lappend(rebalanceNode->placementList,
+													   rebalancePlacement);
+			}
+		}
+	}
+
+	return rebalanceNodeList;
+}
+
+
+/*
+ * FindRebalanceNode returns the RebalanceNode of the given worker, or NULL if
+ * the worker is not in the list.
+ */
+static RebalanceNode *
+FindRebalanceNode(List *rebalanceNodeList, char *nodeName, uint32 nodePort)
+{
+	ListCell *rebalanceNodeCell = NULL;
+
+	foreach(rebalanceNodeCell, rebalanceNodeList)
+	{
+		RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+		WorkerNode *workerNode = rebalanceNode->workerNode;
+
+		if (strncmp(workerNode->workerName, nodeName, WORKER_LENGTH) == 0 &&
+			workerNode->workerPort == nodePort)
+		{
+			return rebalanceNode;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * ShardGroupIsExcluded returns whether any of the given shards is in the list
+ * of excluded shard ids.
+ */
+static bool
+ShardGroupIsExcluded(List *shardIntervalList, List *excludedShardList)
+{
+	ListCell *shardIntervalCell = NULL;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		ListCell *excludedShardCell = NULL;
+
+		foreach(excludedShardCell, excludedShardList)
+		{
+			int64 *excludedShardId = (int64 *) lfirst(excludedShardCell);
+
+			if ((uint64) *excludedShardId == shardInterval->shardId)
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * CollectShardGroupStatistics fetches the size and the number of tuples that
+ * were read or written for each shard on each node, and sums them up for the
+ * shard group placements. The nodes are queried in parallel.
+ */
+static void
+CollectShardGroupStatistics(List *rebalanceNodeList)
+{
+	List *connectionList = NIL;
+	ListCell *connectionCell = NULL;
+	ListCell *rebalanceNodeCell = NULL;
+	uint32 connectionFlags = 0;
+
+	foreach(rebalanceNodeCell, rebalanceNodeList)
+	{
+		RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+		WorkerNode *workerNode = rebalanceNode->workerNode;
+		MultiConnection *connection = NULL;
+
+		if (rebalanceNode->placementList == NIL)
+		{
+			connectionList = lappend(connectionList, NULL);
+			continue;
+		}
+
+		connection = StartNodeConnection(connectionFlags, workerNode->workerName,
+										 workerNode->workerPort);
+		connectionList = lappend(connectionList, connection);
+	}
+
+	forboth(rebalanceNodeCell, rebalanceNodeList, connectionCell, connectionList)
+	{
+		RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		StringInfo shardNameArray = makeStringInfo();
+		StringInfo statisticsQuery = makeStringInfo();
+		ListCell *placementCell = NULL;
+
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		foreach(placementCell, rebalanceNode->placementList)
+		{
+			RebalancePlacement *placement = (RebalancePlacement *) lfirst(placementCell);
+			ListCell *shardIntervalCell = NULL;
+
+			foreach(shardIntervalCell, placement->shardGroup->shardIntervalList)
+			{
+				ShardInterval *shardInterval =
+					(ShardInterval *) lfirst(shardIntervalCell);
+				char *shardName = ConstructQualifiedShardName(shardInterval);
+
+				if (shardNameArray->len > 0)
+				{
+					appendStringInfoChar(shardNameArray, ',');
+				}
+
+				appendStringInfoString(shardNameArray, quote_literal_cstr(shardName));
+			}
+		}
+
+		appendStringInfo(statisticsQuery, SHARD_STATISTICS_QUERY, shardNameArray->data);
+
+		FinishConnectionEstablishment(connection);
+
+		if (!SendRemoteCommand(connection, statisticsQuery->data))
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	forboth(rebalanceNodeCell, rebalanceNodeList, connectionCell, connectionList)
+	{
+		RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		ListCell *placementCell = NULL;
+		PGresult *result = NULL;
+		bool raiseInterrupts = true;
+		int rowIndex = 0;
+		int rowCount = 0;
+
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (!IsResponseOK(result))
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		rowCount = PQntuples(result);
+
+		foreach(placementCell, rebalanceNode->placementList)
+		{
+			RebalancePlacement *placement = (RebalancePlacement *) lfirst(placementCell);
+			int shardCount = list_length(placement->shardGroup->shardIntervalList);
+			int shardIndex = 0;
+
+			for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+			{
+				if (rowIndex >= rowCount)
+				{
+					ereport(ERROR, (errmsg("could not fetch shard statistics from "
+										   "node %s:%d", connection->hostname,
+										   connection->port)));
+				}
+
+				placement->size += pg_strtouint64(PQgetvalue(result, rowIndex, 0),
+												  NULL, 10);
+				placement->load += pg_strtouint64(PQgetvalue(result, rowIndex, 1),
+												  NULL, 10);
+				rowIndex++;
+			}
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+	}
+}
+
+
+/*
+ * ComputePlacementCosts sets the cost of each shard group placement to its
+ * share of the total size and its share of the total load, weighted by
+ * citus.rebalance_load_weight, and the utilization of each node to the sum of
+ * the costs of its placements. If neither the size nor the load says anything,
+ * for instance because the tables are empty, all placements cost the same.
+ */
+static void
+ComputePlacementCosts(List *rebalanceNodeList)
+{
+	ListCell *rebalanceNodeCell = NULL;
+	double totalSize = 0.0;
+	double totalLoad = 0.0;
+	double sizeWeight = 0.0;
+	double loadWeight = 0.0;
+	int placementCount = 0;
+
+	foreach(rebalanceNodeCell, rebalanceNodeList)
+	{
+		RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+		ListCell *placementCell = NULL;
+
+		foreach(placementCell, rebalanceNode->placementList)
+		{
+			RebalancePlacement *placement = (RebalancePlacement *) lfirst(placementCell);
+
+			totalSize += (double) placement->size;
+			totalLoad += (double) placement->load;
+			placementCount++;
+		}
+	}
+
+	if (totalSize > 0.0)
+	{
+		sizeWeight = 1.0 - RebalanceLoadWeight;
+	}
+
+	if (totalLoad > 0.0)
+	{
+		loadWeight = RebalanceLoadWeight;
+	}
+
+	foreach(rebalanceNodeCell, rebalanceNodeList)
+	{
+		RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+		ListCell *placementCell = NULL;
+
+		rebalanceNode->utilization = 0.0;
+
+		foreach(placementCell, rebalanceNode->placementList)
+		{
+			RebalancePlacement *placement = (RebalancePlacement *) lfirst(placementCell);
+
+			if (sizeWeight + loadWeight > 0.0)
+			{
+				double cost = 0.0;
+
+				if (sizeWeight > 0.0)
+				{
+					cost += sizeWeight * placement->size / totalSize;
+				}
+
+				if (loadWeight > 0.0)
+				{
+					cost += loadWeight * placement->load / totalLoad;
+				}
+
+				placement->cost = cost / (sizeWeight + loadWeight);
+			}
+			else
+			{
+				placement->cost = 1.0 / placementCount;
+			}
+
+			rebalanceNode->utilization += placement->cost;
+		}
+	}
+}
+
+
+/*
+ * PlanShardMoves greedily moves shard groups from the most utilized node to
+ * the least utilized node, until the utilization of all nodes is within the
+ * threshold of the average utilization, no move reduces the utilization of
+ * the most utilized node, or maxShardMoves moves are planned. On each step it
+ * picks the most expensive shard group that still leaves the target less
+ * utilized than the source was.
+ */
+static List *
+PlanShardMoves(List *rebalanceNodeList, float4 threshold, int maxShardMoves)
+{
+	List *shardMoveList = NIL;
+	ListCell *rebalanceNodeCell = NULL;
+	double totalUtilization = 0.0;
+	double averageUtilization = 0.0;
+
+	if (list_length(rebalanceNodeList) < 2)
+	{
+		return NIL;
+	}
+
+	foreach(rebalanceNodeCell, rebalanceNodeList)
+	{
+		RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+
+		totalUtilization += rebalanceNode->utilization;
+	}
+
+	averageUtilization = totalUtilization / list_length(rebalanceNodeList);
+
+	while (list_length(shardMoveList) < maxShardMoves)
+	{
+		RebalanceNode *sourceNode = NULL;
+		RebalanceNode *targetNode = NULL;
+		RebalancePlacement *movedPlacement = NULL;
+		ListCell *placementCell = NULL;
+		ShardMove *shardMove = NULL;
+
+		foreach(rebalanceNodeCell, rebalanceNodeList)
+		{
+			RebalanceNode *rebalanceNode = (RebalanceNode *) lfirst(rebalanceNodeCell);
+
+			if (sourceNode == NULL ||
+				rebalanceNode->utilization > sourceNode->utilization)
+			{
+				sourceNode = rebalanceNode;
+			}
+
+			if (targetNode == NULL ||
+				rebalanceNode->utilization < targetNode->utilization)
+			{
+				targetNode = rebalanceNode;
+			}
+		}
+
+		if (sourceNode->utilization <= averageUtilization * (1.0 + threshold) &&
+			targetNode->utilization >= averageUtilization * (1.0 - threshold))
+		{
+			break;
+		}
+
+		foreach(placementCell, sourceNode->placementList)
+		{
+			RebalancePlacement *placement = (RebalancePlacement *) lfirst(placementCell);
+
+			if (!placement->shardGroup->movable ||
+				targetNode->utilization + placement->cost >= sourceNode->utilization ||
+				NodeHasShardGroup(targetNode, placement->shardGroup))
+			{
+				continue;
+			}
+
+			if (movedPlacement == NULL || placement->cost > movedPlacement->cost)
+			{
+				movedPlacement = placement;
+			}
+		}
+
+		if (movedPlacement == NULL)
+		{
+			break;
+		}
+
+		sourceNode->placementList = list_delete_ptr(sourceNode->placementList,
+													movedPlacement);
+		sourceNode->utilization -= movedPlacement->cost;
+		targetNode->placementList = lappend(targetNode->placementList,
+											movedPlacement);
+		targetNode->utilization += movedPlacement->cost;
+
+		shardMove = palloc0(sizeof(ShardMove));
+		shardMove->shardGroup = movedPlacement->shardGroup;
+		shardMove->size = movedPlacement->size;
+		shardMove->sourceNode = sourceNode->workerNode;
+		shardMove->targetNode = targetNode->workerNode;
+
+		shardMoveList = lappend(shardMoveList, shardMove);
+	}
+
+	return shardMoveList;
+}
+
+
+/*
+ * NodeHasShardGroup returns whether the node has a placement of the given
+ * shard group.
+ */
+static bool
+NodeHasShardGroup(RebalanceNode *rebalanceNode, RebalanceShardGroup *shardGroup)
+{
+	ListCell *placementCell = NULL;
+
+	foreach(placementCell, rebalanceNode->placementList)
+	{
+		RebalancePlacement *placement = (RebalancePlacement *) lfirst(placementCell);
+
+		if (placement->shardGroup == shardGroup)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ExecuteShardMoves executes the given shard moves, running up to
+ * citus.rebalance_max_concurrent_moves of them at the same time. Moves of
+ * shards in the same colocation group lock the same tables and may depend on
+ * each other, so they run one after the other in the order of the plan.
+ */
+static void
+ExecuteShardMoves(List *shardMoveList, char *transferMode)
+{
+	List *pendingMoveList = list_copy(shardMoveList);
+	List *runningMoveList = NIL;
+
+	while (pendingMoveList != NIL || runningMoveList != NIL)
+	{
+		List *busyTableList = NIL;
+		List *remainingMoveList = NIL;
+		ListCell *shardMoveCell = NULL;
+		bool moveFinished = false;
+
+		foreach(shardMoveCell, runningMoveList)
+		{
+			ShardMove *shardMove = (ShardMove *) lfirst(shardMoveCell);
+
+			busyTableList = lappend_oid(busyTableList, shardMove->shardGroup->relationId);
+		}
+
+		foreach(shardMoveCell, pendingMoveList)
+		{
+			ShardMove *shardMove = (ShardMove *) lfirst(shardMoveCell);
+			Oid colocatedTableId = shardMove->shardGroup->relationId;
+
+			if (list_length(runningMoveList) < RebalanceMaxConcurrentMoves &&
+				!list_member_oid(busyTableList, colocatedTableId))
+			{
+				StartShardMove(shardMove, transferMode);
+				runningMoveList = lappend(runningMoveList, shardMove);
+			}
+			else
+			{
+				remainingMoveList = lappend(remainingMoveList, shardMove);
+			}
+
+			busyTableList = lappend_oid(busyTableList, colocatedTableId);
+		}
+
+		pendingMoveList = remainingMoveList;
+		remainingMoveList = NIL;
+
+		foreach(shardMoveCell, runningMoveList)
+		{
+			ShardMove *shardMove = (ShardMove *) lfirst(shardMoveCell);
+			MultiConnection *connection = shardMove->connection;
+
+			if (PQconsumeInput(connection->pgConn) == 0)
+			{
+				ReportConnectionError(connection, ERROR);
+			}
+
+			if (PQisBusy(connection->pgConn))
+			{
+				remainingMoveList = lappend(remainingMoveList, shardMove);
+				continue;
+			}
+
+			FinishCriticalRemoteCommand(connection);
+			CloseConnection(connection);
+			shardMove->connection = NULL;
+
+			moveFinished = true;
+		}
+
+		runningMoveList = remainingMoveList;
+
+		if (!moveFinished && runningMoveList != NIL)
+		{
+			CHECK_FOR_INTERRUPTS();
+
+			pg_usleep(REBALANCE_POLL_INTERVAL);
+		}
+	}
+}
+
+
+/*
+ * StartShardMove opens a new connection to the coordinator and sends the
+ * master_move_shard_placement call for the given move over it, such that the
+ * move runs in its own transaction.
+ */
+static void
+StartShardMove(ShardMove *shardMove, char *transferMode)
+{
+	uint32 connectionFlags = FORCE_NEW_CONNECTION;
+	WorkerNode *sourceNode = shardMove->sourceNode;
+	WorkerNode *targetNode = shardMove->targetNode;
+	StringInfo moveCommand = makeStringInfo();
+	MultiConnection *connection = NULL;
+
+	ereport(NOTICE, (errmsg("moving shard " UINT64_FORMAT " from %s:%d to %s:%d",
+							shardMove->shardGroup->shardId, sourceNode->workerName,
+							sourceNode->workerPort, targetNode->workerName,
+							targetNode->workerPort)));
+
+	appendStringInfo(moveCommand,
+					 "SELECT master_move_shard_placement(" UINT64_FORMAT
+					 ", %s, %d, %s, %d, %s)",
+					 shardMove->shardGroup->shardId,
+					 quote_literal_cstr(sourceNode->workerName), sourceNode->workerPort,
+					 quote_literal_cstr(targetNode->workerName), targetNode->workerPort,
+					 quote_literal_cstr(transferMode));
+
+	connection = GetNodeConnection(connectionFlags, LOCAL_HOST_NAME, PostPortNumber);
+	if (PQstatus(connection->pgConn) != CONNECTION_OK)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	if (!SendRemoteCommand(connection, moveCommand->data))
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	shardMove->connection = connection;
+}
@@ -0,0 +1,496 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_retention.c
+ *   Routines for dropping the shards of time-partitioned tables once all of
+ *   their rows are older than a retention period.
+ *
+ *   Append and range distributed tables that are partitioned by time are
+ *   typically cleaned up by regularly dropping the shards that only hold
+ *   expired rows. master_set_retention_policy records how long the rows of
+ *   such a table are kept in pg_dist_retention_policy, and the maintenance
+ *   daemon drops the shards whose maximum partition column value is older
+ *   than that every citus.shard_retention_check_interval. The daemon drops at
+ *   most citus.shard_retention_batch_size shards per transaction, and sends
+ *   the DROP commands of a batch as a single command per worker, to all
+ *   workers in parallel.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_type.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_protocol.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/pg_dist_retention_policy.h"
+#include "distributed/shard_retention.h"
+#include "storage/lmgr.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+
+/* RetentionPolicy is a row of pg_dist_retention_policy */
+typedef struct RetentionPolicy
+{
+	Oid relationId;
+	Interval retentionPeriod;
+} RetentionPolicy;
+
+
+/* Config variables managed via guc.c */
+int ShardRetentionCheckInterval = 60 * 60 * 1000; /* in milliseconds, -1 to disable */
+int ShardRetentionBatchSize = 1000;
+
+
+static void EnsureRetentionPolicyAllowed(Oid relationId, Interval *retentionPeriod);
+static bool LookupRetentionPolicy(Oid relationId, Interval *retentionPeriod);
+static List * RetentionPolicyList(void);
+static void InsertRetentionPolicy(Oid relationId, Interval *retentionPeriod);
+static Datum ExpiredShardCutoff(Oid partitionColumnType, Interval *retentionPeriod);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(master_set_retention_policy);
+PG_FUNCTION_INFO_V1(master_drop_expired_shards);
+
+
+/*
+ * master_set_retention_policy sets the retention period of the given append
+ * or range distributed table, whose partition column has to be a date or
+ * timestamp. Passing NULL as the period removes the retention policy of the
+ * table.
+ */
+Datum
+master_set_retention_policy(PG_FUNCTION_ARGS)
+{
+	Oid relationId = InvalidOid;
+	Interval *retentionPeriod = NULL;
+
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("table name cannot be NULL")));
+	}
+
+	relationId = PG_GETARG_OID(0);
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+	EnsureTableOwner(relationId);
+
+	LockRelationOid(relationId, AccessShareLock);
+
+	DeleteRetentionPolicy(relationId);
+
+	if (!PG_ARGISNULL(1))
+	{
+		retentionPeriod = PG_GETARG_INTERVAL_P(1);
+
+		EnsureRetentionPolicyAllowed(relationId, retentionPeriod);
+		InsertRetentionPolicy(relationId, retentionPeriod);
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * master_drop_expired_shards drops the shards of the given table that are
+ * expired according to its retention policy right away, and returns the
+ * number of dropped shards.
+ */
+Datum
+master_drop_expired_shards(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	Interval retentionPeriod;
+	int droppedShardCount = 0;
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+	EnsureTableOwner(relationId);
+
+	/* block writes, like master_apply_delete_command */
+	LockRelationOid(relationId, ExclusiveLock);
+
+	if (!LookupRetentionPolicy(relationId, &retentionPeriod))
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("table \"%s\" does not have a retention policy",
+							   get_rel_name(relationId)),
+						errhint("Use master_set_retention_policy() to set one.")));
+	}
+
+	droppedShardCount = DropExpiredShards(relationId, &retentionPeriod, 0);
+
+	PG_RETURN_INT32(droppedShardCount);
+}
+
+
+/*
+ * EnsureRetentionPolicyAllowed errors out if the given table cannot have a
+ * retention policy with the given period.
+ */
+static void
+EnsureRetentionPolicyAllowed(Oid relationId, Interval *retentionPeriod)
+{
+	char *relationName = get_rel_name(relationId);
+	Interval zeroInterval;
+	char partitionMethod = 0;
+	Oid partitionColumnType = InvalidOid;
+
+	if (!IsDistributedTable(relationId))
+	{
+		ereport(ERROR, (errmsg("relation \"%s\" is not a distributed table",
+							   relationName)));
+	}
+
+	partitionMethod = PartitionMethod(relationId);
+	if (partitionMethod != DISTRIBUTE_BY_APPEND &&
+		partitionMethod != DISTRIBUTE_BY_RANGE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot set a retention policy for table \"%s\"",
+							   relationName),
+						errdetail("Retention policies are only supported for append "
+								  "and range distributed tables.")));
+	}
+
+	partitionColumnType = DistPartitionKey(relationId)->vartype;
+	if (partitionColumnType != DATEOID && partitionColumnType != TIMESTAMPOID &&
+		partitionColumnType != TIMESTAMPTZOID)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot set a retention policy for table \"%s\"",
+							   relationName),
+						errdetail("Retention policies require a distribution column "
+								  "of type date, timestamp or timestamptz.")));
+	}
+
+	memset(&zeroInterval, 0, sizeof(Interval));
+	if (DatumGetBool(DirectFunctionCall2(interval_le,
+										 IntervalPGetDatum(retentionPeriod),
+										 IntervalPGetDatum(&zeroInterval))))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("retention period must be positive")));
+	}
+}
+
+
+/*
+ * DropExpiredShards drops the shards of the given table whose rows are all
+ * older than the given retention period, that is whose maximum partition
+ * column value is before the current time minus the period. Shards without
+ * min/max values are kept. If maxShardCount is positive, at most that many
+ * shards are dropped. The caller is expected to hold a lock that blocks
+ * writes to the table. The function returns the number of dropped shards.
+ */
+int
+DropExpiredShards(Oid relationId, Interval *retentionPeriod, int maxShardCount)
+{
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+	FmgrInfo *compareFunction = cacheEntry->shardIntervalCompareFunction;
+	Oid partitionColumnType = DistPartitionKey(relationId)->vartype;
+	char *relationName = get_rel_name(relationId);
+	char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+	Datum cutoff = ExpiredShardCutoff(partitionColumnType, retentionPeriod);
+	List *shardIntervalList = LoadShardIntervalList(relationId);
+	List *expiredShardIntervalList = NIL;
+	ListCell *shardIntervalCell = NULL;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		int compareResult = 0;
+
+		if (!shardInterval->minValueExists || !shardInterval->maxValueExists)
+		{
+			continue;
+		}
+
+		compareResult = DatumGetInt32(FunctionCall2(compareFunction,
+													shardInterval->maxValue,
+													cutoff));
+		if (compareResult >= 0)
+		{
+			continue;
+		}
+
+		expiredShardIntervalList = lappend(expiredShardIntervalList, shardInterval);
+
+		if (maxShardCount > 0 &&
+			list_length(expiredShardIntervalList) >= maxShardCount)
+		{
+			break;
+		}
+	}
+
+	if (expiredShardIntervalList == NIL)
+	{
+		return 0;
+	}
+
+	ereport(DEBUG1, (errmsg("dropping %d expired shards of \"%s\"",
+							list_length(expiredShardIntervalList), relationName)));
+
+	return DropShards(relationId, schemaName, relationName, expiredShardIntervalList);
+}
+
+
+/*
+ * ExpiredShardCutoff returns the current time minus the given retention
+ * period, as a value of the given partition column type.
+ */
+static Datum
+ExpiredShardCutoff(Oid partitionColumnType, Interval *retentionPeriod)
+{
+	Datum cutoff = DirectFunctionCall2(timestamptz_mi_interval,
+									   TimestampTzGetDatum(GetCurrentTimestamp()),
+									   IntervalPGetDatum(retentionPeriod));
+
+	switch (partitionColumnType)
+	{
+		case TIMESTAMPTZOID:
+		{
+			return cutoff;
+		}
+
+		case TIMESTAMPOID:
+		{
+			return DirectFunctionCall1(timestamptz_timestamp, cutoff);
+		}
+
+		case DATEOID:
+		{
+			return DirectFunctionCall1(timestamptz_date, cutoff);
+		}
+
+		default:
+		{
+			ereport(ERROR, (errmsg("unsupported partition column type %u for "
+								   "retention policy", partitionColumnType)));
+		}
+	}
+}
+
+
+/*
+ * ApplyRetentionPolicies drops the expired shards of the tables that have a
+ * retention policy, up to citus.shard_retention_batch_size shards in total.
+ * Tables that are locked by other transactions are skipped, to not hold up
+ * the maintenance daemon. The function returns the number of dropped shards,
+ * and sets moreShardsExpired when the batch was full, in which case the
+ * caller is expected to commit and call it again.
+ */
+int
+ApplyRetentionPolicies(bool *moreShardsExpired)
+{
+	List *retentionPolicyList = RetentionPolicyList();
+	ListCell *retentionPolicyCell = NULL;
+	int droppedShardCount = 0;
+
+	*moreShardsExpired = false;
+
+	foreach(retentionPolicyCell, retentionPolicyList)
+	{
+		RetentionPolicy *policy = (RetentionPolicy *) lfirst(retentionPolicyCell);
+		Oid relationId = policy->relationId;
+		int maxShardCount = ShardRetentionBatchSize - droppedShardCount;
+
+		if (!ConditionalLockRelationOid(relationId, ExclusiveLock))
+		{
+			ereport(DEBUG1, (errmsg("could not lock table %u, skipping its "
+									"retention policy", relationId)));
+			continue;
+		}
+
+		/* the table may have been dropped since we read the policy */
+		if (get_rel_name(relationId) == NULL || !IsDistributedTable(relationId))
+		{
+			continue;
+		}
+
+		droppedShardCount += DropExpiredShards(relationId, &policy->retentionPeriod,
+											   maxShardCount);
+
+		if (droppedShardCount >= ShardRetentionBatchSize)
+		{
+			*moreShardsExpired = true;
+			break;
+		}
+	}
+
+	return droppedShardCount;
+}
+
+
+/*
+ * LookupRetentionPolicy reads the retention period of the given table into
+ * retentionPeriod, and returns whether the table has a retention policy.
+ */
+static bool
+LookupRetentionPolicy(Oid relationId, Interval *retentionPeriod)
+{
+	Relation pgDistRetentionPolicy = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+	bool found = false;
+
+	pgDistRetentionPolicy = heap_open(DistRetentionPolicyRelationId(), AccessShareLock);
+	tupleDescriptor = RelationGetDescr(pgDistRetentionPolicy);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_retention_policy_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDescriptor = systable_beginscan(pgDistRetentionPolicy,
+										DistRetentionPolicyPrimaryKeyIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		bool isNull = false;
+		Datum retentionPeriodDatum =
+			heap_getattr(heapTuple, Anum_pg_dist_retention_policy_retentionperiod,
+						 tupleDescriptor, &isNull);
+
+		*retentionPeriod = *DatumGetIntervalP(retentionPeriodDatum);
+		found = true;
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistRetentionPolicy, NoLock);
+
+	return found;
+}
+
+
+/*
+ * RetentionPolicyList returns all rows of pg_dist_retention_policy.
+ */
+static List *
+RetentionPolicyList(void)
+{
+	Relation pgDistRetentionPolicy = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	List *retentionPolicyList = NIL;
+
+	pgDistRetentionPolicy = heap_open(DistRetentionPolicyRelationId(), AccessShareLock);
+	tupleDescriptor = RelationGetDescr(pgDistRetentionPolicy);
+
+	scanDescriptor = systable_beginscan(pgDistRetentionPolicy, InvalidOid, false,
+										NULL, 0, NULL);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		RetentionPolicy *policy = palloc0(sizeof(RetentionPolicy));
+		bool isNull = false;
+		Datum relationIdDatum =
+			heap_getattr(heapTuple, Anum_pg_dist_retention_policy_logicalrelid,
+						 tupleDescriptor, &isNull);
+		Datum retentionPeriodDatum =
+			heap_getattr(heapTuple, Anum_pg_dist_retention_policy_retentionperiod,
+						 tupleDescriptor, &isNull);
+
+		policy->relationId = DatumGetObjectId(relationIdDatum);
+		policy->retentionPeriod = *DatumGetIntervalP(retentionPeriodDatum);
+
+		retentionPolicyList = lappend(retentionPolicyList, policy);
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistRetentionPolicy, NoLock);
+
+	return retentionPolicyList;
+}
+
+
+/*
+ * InsertRetentionPolicy adds a row for the given table to
+ * pg_dist_retention_policy.
+ */
+static void
+InsertRetentionPolicy(Oid relationId, Interval *retentionPeriod)
+{
+	Relation pgDistRetentionPolicy = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_pg_dist_retention_policy];
+	bool isNulls[Natts_pg_dist_retention_policy];
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_pg_dist_retention_policy_logicalrelid - 1] =
+		ObjectIdGetDatum(relationId);
+	values[Anum_pg_dist_retention_policy_retentionperiod - 1] =
+		IntervalPGetDatum(retentionPeriod);
+
+	pgDistRetentionPolicy = heap_open(DistRetentionPolicyRelationId(),
+									  RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistRetentionPolicy);
+
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+	CatalogTupleInsert(pgDistRetentionPolicy, heapTuple);
+
+	CommandCounterIncrement();
+	heap_close(pgDistRetentionPolicy, NoLock);
+}
+
+
+/*
+ * DeleteRetentionPolicy removes the retention policy of the given table, if
+ * it has one.
+ */
+void
+DeleteRetentionPolicy(Oid relationId)
+{
+	Relation pgDistRetentionPolicy = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+
+	pgDistRetentionPolicy = heap_open(DistRetentionPolicyRelationId(),
+									  RowExclusiveLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_retention_policy_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDescriptor = systable_beginscan(pgDistRetentionPolicy,
+										DistRetentionPolicyPrimaryKeyIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(pgDistRetentionPolicy, &heapTuple->t_self);
+		CommandCounterIncrement();
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistRetentionPolicy, NoLock);
+}
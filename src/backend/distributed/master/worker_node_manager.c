@@ -15,6 +15,7 @@
 #include "miscadmin.h"
 
 #include "commands/dbcommands.h"
+#include "distributed/master_metadata_utility.h"
 #include "distributed/worker_manager.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_client_executor.h"
@@ -37,6 +38,7 @@
 /* Config variables managed via guc.c */
 char *WorkerListFileName;
 int MaxWorkerNodesTracked = 2048;    /* determines worker node hash table size */
+char *LocalNodeRack = NULL;
 
 
 /* Local functions forward declarations */
@@ -386,6 +388,100 @@ ActiveReadableNodeList(void)
 }
 
 
+/*
+ * ExecutingNodeRack returns the network location of the node that plans the
+ * query. This is citus.local_node_rack if set, and otherwise the rack of the
+ * local node in pg_dist_node. The function returns NULL if the location is
+ * not known, which is the case on a coordinator without the setting.
+ */
+char *
+ExecutingNodeRack(void)
+{
+	WorkerNodeGroup *localNodeGroup = NULL;
+	int localGroupId = 0;
+
+	if (LocalNodeRack != NULL && LocalNodeRack[0] != '\0')
+	{
+		return LocalNodeRack;
+	}
+
+	localGroupId = GetLocalGroupId();
+	if (localGroupId == 0)
+	{
+		return NULL;
+	}
+
+	localNodeGroup = LookupNodeGroup(localGroupId);
+	if (localNodeGroup == NULL || localNodeGroup->primaryNode == NULL)
+	{
+		return NULL;
+	}
+
+	return localNodeGroup->primaryNode->workerRack;
+}
+
+
+/*
+ * NodeInRack returns true if the worker node with the given name and port is
+ * in the given rack. Nodes that are not in the metadata are in no rack.
+ */
+bool
+NodeInRack(char *nodeName, int32 nodePort, const char *nodeRack)
+{
+	WorkerNode *workerNode = NULL;
+
+	if (nodeRack == NULL)
+	{
+		return false;
+	}
+
+	workerNode = FindWorkerNode(nodeName, nodePort);
+	if (workerNode == NULL)
+	{
+		return false;
+	}
+
+	return strncmp(workerNode->workerRack, nodeRack, WORKER_LENGTH) == 0;
+}
+
+
+/*
+ * SortPlacementListByRack returns the given placement list with the placements
+ * on nodes in the given rack moved to the front. The order of the placements
+ * is otherwise retained, such that the assignment policies still decide among
+ * the placements in the same rack. The list is returned as is if the rack is
+ * NULL.
+ */
+List *
+SortPlacementListByRack(List *placementList, const char *nodeRack)
+{
+	List *rackPlacementList = NIL;
+	List *otherPlacementList = NIL;
+	ListCell *placementCell = NULL;
+
+	if (nodeRack == NULL)
+	{
+		return placementList;
+	}
+
+	foreach(placementCell, placementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+		if (NodeInRack(placement->nodeName, placement->nodePort, nodeRack))
+		{
+			rackPlacementList = lappend(rackPlacementList, placement);
+		}
+		else
+		{
+			otherPlacementList = lappend(otherPlacementList, placement);
+		}
+	}
+
+	return list_concat(rackPlacementList, otherPlacementList);
+}
+
+
 /*
  * PrimaryNodesNotInList scans through the worker node hash and returns a list of all
  * primary nodes which are not in currentList. It runs in O(n*m) but currentList is
@@ -28,6 +28,7 @@
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_type.h"
 #include "distributed/citus_ruleutils.h"
+#include "distributed/connection_management.h"
 #include "distributed/distribution_column.h"
 #include "distributed/listutils.h"
 #include "distributed/master_metadata_utility.h"
@@ -37,6 +38,7 @@
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/pg_dist_node.h"
+#include "distributed/remote_commands.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_transaction.h"
 #include "distributed/version_compat.h"
@@ -44,12 +46,52 @@
 #include "nodes/pg_list.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/hsearch.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
 #include "utils/tqual.h"
 
 
+/* state of a shard of a metadata worker, compared to the local metadata */
+typedef enum WorkerShardSyncState
+{
+	WORKER_SHARD_UNKNOWN = 0,
+	WORKER_SHARD_IN_SYNC = 1,
+	WORKER_SHARD_REPLACED = 2
+} WorkerShardSyncState;
+
+
+/* pg_dist_shard row of a metadata worker */
+typedef struct WorkerShardEntry
+{
+	uint64 shardId;
+
+	/* relation name, storage type and min/max values as in ShardMetadataString */
+	char *shardMetadata;
+
+	WorkerShardSyncState syncState;
+} WorkerShardEntry;
+
+
+/* pg_dist_placement row of a metadata worker */
+typedef struct WorkerPlacementEntry
+{
+	uint64 placementId;
+	uint64 shardId;
+	int shardState;
+	uint64 shardLength;
+	uint32 groupId;
+
+	/* whether the placement also exists locally */
+	bool matched;
+} WorkerPlacementEntry;
+
+
+/* config variable to only send metadata differences to workers that have metadata */
+bool IncrementalMetadataSync = false;
+
+
 static char * LocalGroupIdUpdateCommand(uint32 groupId);
 static void MarkNodeHasMetadata(char *nodeName, int32 nodePort, bool hasMetadata);
 static List * SequenceDDLCommandsForTable(Oid relationId);
@@ -59,6 +101,14 @@ static char * TruncateTriggerCreateCommand(Oid relationId);
 static char * SchemaOwnerName(Oid objectId);
 static bool HasMetadataWorkers(void);
 static List * DetachPartitionCommandList(void);
+static bool MetadataDeltaCommands(WorkerNode *workerNode, char *nodeUser,
+								  List **commandList);
+static bool WorkerTablesMatch(MultiConnection *connection, List *propagatedTableList);
+static HTAB * WorkerShardHash(MultiConnection *connection);
+static HTAB * WorkerPlacementHash(MultiConnection *connection);
+static PGresult * ExecuteMetadataQuery(MultiConnection *connection, char *query);
+static char * ShardMetadataString(ShardInterval *shardInterval);
+static List * ShardIdDeleteCommandList(uint64 shardId);
 
 PG_FUNCTION_INFO_V1(start_metadata_sync_to_node);
 PG_FUNCTION_INFO_V1(stop_metadata_sync_to_node);
@@ -86,6 +136,7 @@ start_metadata_sync_to_node(PG_FUNCTION_ARGS)
 	List *recreateMetadataSnapshotCommandList = NIL;
 	List *dropMetadataCommandList = NIL;
 	List *createMetadataCommandList = NIL;
+	List *deltaCommandList = NIL;
 
 	EnsureCoordinator();
 	EnsureSuperUser();
@@ -127,18 +178,29 @@ start_metadata_sync_to_node(PG_FUNCTION_ARGS)
 	/* generate and add the local group id's update query */
 	localGroupIdUpdateCommand = LocalGroupIdUpdateCommand(workerNode->groupId);
 
-	/* generate the queries which drop the metadata */
-	dropMetadataCommandList = MetadataDropCommands();
-
-	/* generate the queries which create the metadata from scratch */
-	createMetadataCommandList = MetadataCreateCommands();
-
 	recreateMetadataSnapshotCommandList = lappend(recreateMetadataSnapshotCommandList,
 												  localGroupIdUpdateCommand);
-	recreateMetadataSnapshotCommandList = list_concat(recreateMetadataSnapshotCommandList,
-													  dropMetadataCommandList);
-	recreateMetadataSnapshotCommandList = list_concat(recreateMetadataSnapshotCommandList,
-													  createMetadataCommandList);
+
+	if (IncrementalMetadataSync &&
+		MetadataDeltaCommands(workerNode, extensionOwner, &deltaCommandList))
+	{
+		/* the worker already has the tables, only send what differs */
+		recreateMetadataSnapshotCommandList =
+			list_concat(recreateMetadataSnapshotCommandList, deltaCommandList);
+	}
+	else
+	{
+		/* generate the queries which drop the metadata */
+		dropMetadataCommandList = MetadataDropCommands();
+
+		/* generate the queries which create the metadata from scratch */
+		createMetadataCommandList = MetadataCreateCommands();
+
+		recreateMetadataSnapshotCommandList =
+			list_concat(recreateMetadataSnapshotCommandList, dropMetadataCommandList);
+		recreateMetadataSnapshotCommandList =
+			list_concat(recreateMetadataSnapshotCommandList, createMetadataCommandList);
+	}
 
 	/*
 	 * Send the snapshot recreation commands in a single remote transaction and
@@ -714,7 +776,17 @@ ShardListInsertCommand(List *shardIntervalList)
 List *
 ShardDeleteCommandList(ShardInterval *shardInterval)
 {
-	uint64 shardId = shardInterval->shardId;
+	return ShardIdDeleteCommandList(shardInterval->shardId);
+}
+
+
+/*
+ * ShardIdDeleteCommandList generates a command list that can be executed to
+ * delete shard and shard placement metadata for the shard with the given ID.
+ */
+static List *
+ShardIdDeleteCommandList(uint64 shardId)
+{
 	List *commandList = NIL;
 	StringInfo deletePlacementCommand = NULL;
 	StringInfo deleteShardCommand = NULL;
@@ -1106,18 +1178,12 @@ void
 CreateTableMetadataOnWorkers(Oid relationId)
 {
 	List *commandList = GetDistributedTableDDLEvents(relationId);
-	ListCell *commandCell = NULL;
 
 	/* prevent recursive propagation */
-	SendCommandToWorkers(WORKERS_WITH_METADATA, DISABLE_DDL_PROPAGATION);
+	commandList = lcons(DISABLE_DDL_PROPAGATION, commandList);
 
-	/* send the commands one by one */
-	foreach(commandCell, commandList)
-	{
-		char *command = (char *) lfirst(commandCell);
-
-		SendCommandToWorkers(WORKERS_WITH_METADATA, command);
-	}
+	/* the commands are pipelined on each worker */
+	SendCommandListToWorkers(WORKERS_WITH_METADATA, commandList);
 }
 
 
@@ -1179,3 +1245,400 @@ DetachPartitionCommandList(void)
 
 	return detachPartitionCommandList;
 }
+
+
+/*
+ * MetadataDeltaCommands reads the shard and placement metadata that the given
+ * worker already has, and generates the commands that bring it in line with
+ * the local metadata by deleting, inserting and updating only the shards and
+ * placements that differ. The node list is always sent in full. The function
+ * returns false if the worker does not have the same distributed tables, in
+ * which case the metadata needs to be recreated from scratch.
+ */
+static bool
+MetadataDeltaCommands(WorkerNode *workerNode, char *nodeUser, List **commandList)
+{
+	List *distributedTableList = DistributedTableList();
+	List *propagatedTableList = NIL;
+	bool includeNodesFromOtherClusters = true;
+	List *workerNodeList = ReadWorkerNodes(includeNodesFromOtherClusters);
+	List *placementDeleteCommandList = NIL;
+	List *shardDeleteCommandList = NIL;
+	List *insertedShardList = NIL;
+	List *placementUpsertCommandList = NIL;
+	MultiConnection *connection = NULL;
+	HTAB *workerShardHash = NULL;
+	HTAB *workerPlacementHash = NULL;
+	HASH_SEQ_STATUS status;
+	WorkerShardEntry *shardEntry = NULL;
+	WorkerPlacementEntry *placementEntry = NULL;
+	ListCell *tableCell = NULL;
+	int connectionFlags = FORCE_NEW_CONNECTION;
+
+	foreach(tableCell, distributedTableList)
+	{
+		DistTableCacheEntry *cacheEntry = (DistTableCacheEntry *) lfirst(tableCell);
+
+		if (ShouldSyncTableMetadata(cacheEntry->relationId))
+		{
+			propagatedTableList = lappend(propagatedTableList, cacheEntry);
+		}
+	}
+
+	connection = GetNodeUserDatabaseConnection(connectionFlags, workerNode->workerName,
+											   workerNode->workerPort, nodeUser, NULL);
+
+	if (!WorkerTablesMatch(connection, propagatedTableList))
+	{
+		CloseConnection(connection);
+		return false;
+	}
+
+	workerShardHash = WorkerShardHash(connection);
+	workerPlacementHash = WorkerPlacementHash(connection);
+
+	CloseConnection(connection);
+
+	foreach(tableCell, propagatedTableList)
+	{
+		DistTableCacheEntry *cacheEntry = (DistTableCacheEntry *) lfirst(tableCell);
+		List *shardIntervalList = LoadShardIntervalList(cacheEntry->relationId);
+		ListCell *shardIntervalCell = NULL;
+
+		foreach(shardIntervalCell, shardIntervalList)
+		{
+			ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+			uint64 shardId = shardInterval->shardId;
+			char *shardMetadata = ShardMetadataString(shardInterval);
+			List *placementList = NIL;
+			ListCell *placementCell = NULL;
+			bool shardFound = false;
+
+			shardEntry = (WorkerShardEntry *) hash_search(workerShardHash, &shardId,
+														  HASH_FIND, &shardFound);
+			if (!shardFound)
+			{
+				insertedShardList = lappend(insertedShardList, shardInterval);
+				continue;
+			}
+
+			/* shards that changed are inserted again, along with their placements */
+			if (strcmp(shardEntry->shardMetadata, shardMetadata) != 0)
+			{
+				shardEntry->syncState = WORKER_SHARD_REPLACED;
+				insertedShardList = lappend(insertedShardList, shardInterval);
+				continue;
+			}
+
+			shardEntry->syncState = WORKER_SHARD_IN_SYNC;
+
+			placementList = FinalizedShardPlacementList(shardId);
+			foreach(placementCell, placementList)
+			{
+				ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+				bool placementFound = false;
+
+				placementEntry = (WorkerPlacementEntry *) hash_search(
+					workerPlacementHash, &placement->placementId, HASH_FIND,
+					&placementFound);
+				if (placementFound)
+				{
+					placementEntry->matched = true;
+				}
+
+				if (!placementFound || placementEntry->shardId != shardId ||
+					placementEntry->shardState != FILE_FINALIZED ||
+					placementEntry->shardLength != placement->shardLength ||
+					placementEntry->groupId != placement->groupId)
+				{
+					char *placementUpsertCommand =
+						PlacementUpsertCommand(shardId, placement->placementId,
+											   FILE_FINALIZED, placement->shardLength,
+											   placement->groupId);
+
+					placementUpsertCommandList = lappend(placementUpsertCommandList,
+														 placementUpsertCommand);
+				}
+			}
+		}
+	}
+
+	/* delete other placements, unless their shard is deleted anyway */
+	hash_seq_init(&status, workerPlacementHash);
+	while ((placementEntry = (WorkerPlacementEntry *) hash_seq_search(&status)) != NULL)
+	{
+		StringInfo placementDeleteCommand = NULL;
+		bool shardFound = false;
+
+		if (placementEntry->matched)
+		{
+			continue;
+		}
+
+		shardEntry = (WorkerShardEntry *) hash_search(workerShardHash,
+													  &placementEntry->shardId,
+													  HASH_FIND, &shardFound);
+		if (shardFound && shardEntry->syncState != WORKER_SHARD_IN_SYNC)
+		{
+			continue;
+		}
+
+		placementDeleteCommand = makeStringInfo();
+		appendStringInfo(placementDeleteCommand,
+						 "DELETE FROM pg_dist_placement WHERE placementid = "
+						 UINT64_FORMAT, placementEntry->placementId);
+
+		placementDeleteCommandList = lappend(placementDeleteCommandList,
+											 placementDeleteCommand->data);
+	}
+
+	/* delete shards that no longer exist or changed */
+	hash_seq_init(&status, workerShardHash);
+	while ((shardEntry = (WorkerShardEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (shardEntry->syncState != WORKER_SHARD_IN_SYNC)
+		{
+			shardDeleteCommandList =
+				list_concat(shardDeleteCommandList,
+							ShardIdDeleteCommandList(shardEntry->shardId));
+		}
+	}
+
+	/* make sure we have deterministic output for our tests */
+	SortList(workerNodeList, CompareWorkerNodes);
+
+	*commandList = NIL;
+	*commandList = lappend(*commandList, DELETE_ALL_NODES);
+	*commandList = lappend(*commandList, NodeListInsertCommand(workerNodeList));
+	*commandList = list_concat(*commandList, placementDeleteCommandList);
+	*commandList = list_concat(*commandList, shardDeleteCommandList);
+	*commandList = list_concat(*commandList, ShardListInsertCommand(insertedShardList));
+	*commandList = list_concat(*commandList, placementUpsertCommandList);
+
+	hash_destroy(workerShardHash);
+	hash_destroy(workerPlacementHash);
+
+	return true;
+}
+
+
+/*
+ * WorkerTablesMatch returns whether the pg_dist_partition rows on the worker
+ * behind the given connection describe exactly the given distributed tables.
+ */
+static bool
+WorkerTablesMatch(MultiConnection *connection, List *propagatedTableList)
+{
+	char *query =
+		"SELECT quote_ident(n.nspname) || '.' || quote_ident(c.relname), "
+		"p.partmethod, coalesce(column_to_column_name(p.logicalrelid, p.partkey), ''), "
+		"p.colocationid, p.repmodel FROM pg_dist_partition p "
+		"JOIN pg_class c ON (c.oid = p.logicalrelid) "
+		"JOIN pg_namespace n ON (n.oid = c.relnamespace)";
+	PGresult *result = ExecuteMetadataQuery(connection, query);
+	int rowCount = PQntuples(result);
+	ListCell *tableCell = NULL;
+	bool tablesMatch = (rowCount == list_length(propagatedTableList));
+
+	foreach(tableCell, propagatedTableList)
+	{
+		DistTableCacheEntry *cacheEntry = (DistTableCacheEntry *) lfirst(tableCell);
+		Oid relationId = cacheEntry->relationId;
+		char *relationName = generate_qualified_relation_name(relationId);
+		char *columnName = "";
+		bool tableFound = false;
+		int rowIndex = 0;
+
+		if (!tablesMatch)
+		{
+			break;
+		}
+
+		if (cacheEntry->partitionMethod != DISTRIBUTE_BY_NONE)
+		{
+			columnName = ColumnNameToColumn(relationId, cacheEntry->partitionKeyString);
+		}
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			if (strcmp(PQgetvalue(result, rowIndex, 0), relationName) != 0)
+			{
+				continue;
+			}
+
+			tableFound =
+				PQgetvalue(result, rowIndex, 1)[0] == cacheEntry->partitionMethod &&
+				strcmp(PQgetvalue(result, rowIndex, 2), columnName) == 0 &&
+				strtoul(PQgetvalue(result, rowIndex, 3), NULL, 10) ==
+				cacheEntry->colocationId &&
+				PQgetvalue(result, rowIndex, 4)[0] == cacheEntry->replicationModel;
+			break;
+		}
+
+		tablesMatch = tableFound;
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	return tablesMatch;
+}
+
+
+/*
+ * WorkerShardHash reads the pg_dist_shard rows on the worker behind the given
+ * connection into a hash table keyed by shard ID.
+ */
+static HTAB *
+WorkerShardHash(MultiConnection *connection)
+{
+	char *query =
+		"SELECT s.shardid, quote_ident(n.nspname) || '.' || quote_ident(c.relname) "
+		"|| ' ' || s.shardstorage || ' ' || coalesce(s.shardminvalue, 'NULL') "
+		"|| ' ' || coalesce(s.shardmaxvalue, 'NULL') FROM pg_dist_shard s "
+		"JOIN pg_class c ON (c.oid = s.logicalrelid) "
+		"JOIN pg_namespace n ON (n.oid = c.relnamespace)";
+	PGresult *result = ExecuteMetadataQuery(connection, query);
+	int rowCount = PQntuples(result);
+	int rowIndex = 0;
+	HTAB *shardHash = NULL;
+	HASHCTL info;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint64);
+	info.entrysize = sizeof(WorkerShardEntry);
+	info.hcxt = CurrentMemoryContext;
+
+	shardHash = hash_create("Worker Shard Hash", Max(rowCount, 32), &info,
+							HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		uint64 shardId = pg_strtouint64(PQgetvalue(result, rowIndex, 0), NULL, 10);
+		WorkerShardEntry *shardEntry = NULL;
+		bool shardFound = false;
+
+		shardEntry = (WorkerShardEntry *) hash_search(shardHash, &shardId, HASH_ENTER,
+													  &shardFound);
+		shardEntry->shardMetadata = pstrdup(PQgetvalue(result, rowIndex, 1));
+		shardEntry->syncState = WORKER_SHARD_UNKNOWN;
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	return shardHash;
+}
+
+
+/*
+ * WorkerPlacementHash reads the pg_dist_placement rows on the worker behind the
+ * given connection into a hash table keyed by placement ID.
+ */
+static HTAB *
+WorkerPlacementHash(MultiConnection *connection)
+{
+	char *query = "SELECT placementid, shardid, shardstate, shardlength, groupid "
+				  "FROM pg_dist_placement";
+	PGresult *result = ExecuteMetadataQuery(connection, query);
+	int rowCount = PQntuples(result);
+	int rowIndex = 0;
+	HTAB *placementHash = NULL;
+	HASHCTL info;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint64);
+	info.entrysize = sizeof(WorkerPlacementEntry);
+	info.hcxt = CurrentMemoryContext;
+
+	placementHash = hash_create("Worker Placement Hash", Max(rowCount, 32), &info,
+								HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		uint64 placementId = pg_strtouint64(PQgetvalue(result, rowIndex, 0), NULL, 10);
+		WorkerPlacementEntry *placementEntry = NULL;
+		bool placementFound = false;
+
+		placementEntry = (WorkerPlacementEntry *) hash_search(placementHash,
+															  &placementId,
+															  HASH_ENTER,
+															  &placementFound);
+		placementEntry->shardId =
+			pg_strtouint64(PQgetvalue(result, rowIndex, 1), NULL, 10);
+		placementEntry->shardState = atoi(PQgetvalue(result, rowIndex, 2));
+		placementEntry->shardLength =
+			pg_strtouint64(PQgetvalue(result, rowIndex, 3), NULL, 10);
+		placementEntry->groupId = (uint32) strtoul(PQgetvalue(result, rowIndex, 4),
+												   NULL, 10);
+		placementEntry->matched = false;
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	return placementHash;
+}
+
+
+/*
+ * ExecuteMetadataQuery runs the given query over the given connection and
+ * returns its result, or errors out if the query fails.
+ */
+static PGresult *
+ExecuteMetadataQuery(MultiConnection *connection, char *query)
+{
+	bool raiseInterrupts = true;
+	PGresult *result = NULL;
+	int querySent = SendRemoteCommand(connection, query);
+
+	if (querySent == 0)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (!IsResponseOK(result))
+	{
+		ReportResultError(connection, result, ERROR);
+	}
+
+	return result;
+}
+
+
+/*
+ * ShardMetadataString returns the relation name, storage type and min/max
+ * values of the given shard in the form that WorkerShardHash reads them from
+ * a worker, as they are sent by ShardListInsertCommand.
+ */
+static char *
+ShardMetadataString(ShardInterval *shardInterval)
+{
+	StringInfo shardMetadata = makeStringInfo();
+	char *qualifiedRelationName =
+		generate_qualified_relation_name(shardInterval->relationId);
+
+	appendStringInfo(shardMetadata, "%s %c ", qualifiedRelationName,
+					 shardInterval->storageType);
+
+	if (shardInterval->minValueExists)
+	{
+		appendStringInfo(shardMetadata, "%d ", DatumGetInt32(shardInterval->minValue));
+	}
+	else
+	{
+		appendStringInfoString(shardMetadata, "NULL ");
+	}
+
+	if (shardInterval->maxValueExists)
+	{
+		appendStringInfo(shardMetadata, "%d", DatumGetInt32(shardInterval->maxValue));
+	}
+	else
+	{
+		appendStringInfoString(shardMetadata, "NULL");
+	}
+
+	return shardMetadata->data;
+}
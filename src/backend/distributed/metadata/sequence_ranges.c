@@ -0,0 +1,395 @@
+/*-------------------------------------------------------------------------
+ *
+ * sequence_ranges.c
+ *   Routines for handing out ranges of sequence values to metadata workers.
+ *
+ *   On metadata workers, the sequences of distributed tables are restricted
+ *   to a static range per group (see AlterSequenceMinMax). When
+ *   citus.sequence_range_size is set, nextval() calls of such sequences that
+ *   are evaluated by the router executor on a metadata worker are instead
+ *   served from a range of values that the backend allocates from the
+ *   sequence on the coordinator through master_allocate_sequence_range. A
+ *   new range is only allocated once the values of the previous one are
+ *   used up, such that most nextval() calls stay local while all nodes draw
+ *   from the single, large range of the coordinator's sequence.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "catalog/dependency.h"
+#include "catalog/pg_class.h"
+#include "commands/sequence.h"
+#include "distributed/citus_ruleutils.h"
+#include "distributed/connection_management.h"
+#include "distributed/master_protocol.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/remote_commands.h"
+#include "distributed/sequence_ranges.h"
+#include "distributed/worker_manager.h"
+#include "storage/lmgr.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/int8.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+
+/*
+ * SequenceRangeEntry holds the range of values that the current backend
+ * allocated for a sequence on the coordinator.
+ */
+typedef struct SequenceRangeEntry
+{
+	Oid sequenceId;
+
+	/* whether nextval() calls of the sequence are served from ranges */
+	bool rangeAllocated;
+
+	/* next value to return, increment and number of values left in the range */
+	int64 nextValue;
+	int64 increment;
+	int64 remainingValueCount;
+} SequenceRangeEntry;
+
+
+/* Config variables managed via guc.c */
+int SequenceRangeSize = 0; /* 0 disables range allocation */
+
+/* ranges allocated by this backend, keyed by sequence OID */
+static HTAB *SequenceRangeHash = NULL;
+
+
+/* local function forward declarations */
+static SequenceRangeEntry * LookupSequenceRangeEntry(Oid sequenceId);
+static bool SequenceOwnedByDistributedTable(Oid sequenceId);
+static bool AllocateSequenceRange(SequenceRangeEntry *rangeEntry);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(master_allocate_sequence_range);
+
+
+/*
+ * master_allocate_sequence_range takes up to range_size consecutive values
+ * of the given sequence on the coordinator and returns the first and the last
+ * of them, along with the increment of the sequence. Fewer values are
+ * returned when the sequence reaches its maximum value.
+ *
+ * The values are taken by a single nextval() call followed by a setval()
+ * call. Both happen under a lock that conflicts with nextval(), such that no
+ * other backend takes a value from the middle of the range.
+ */
+Datum
+master_allocate_sequence_range(PG_FUNCTION_ARGS)
+{
+	Oid sequenceId = PG_GETARG_OID(0);
+	int64 rangeSize = PG_GETARG_INT64(1);
+	Form_pg_sequence sequenceData = NULL;
+	int64 increment = 0;
+	int64 maxValue = 0;
+	int64 firstValue = 0;
+	int64 lastValue = 0;
+	uint64 availableValueCount = 0;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple resultTuple = NULL;
+	Datum values[3];
+	bool isNulls[3];
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+
+	if (rangeSize <= 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("range size must be positive")));
+	}
+
+	if (get_rel_relkind(sequenceId) != RELKIND_SEQUENCE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+						errmsg("\"%s\" is not a sequence", get_rel_name(sequenceId))));
+	}
+
+	if (pg_class_aclcheck(sequenceId, GetUserId(), ACL_UPDATE) != ACLCHECK_OK)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("permission denied for sequence %s",
+							   get_rel_name(sequenceId))));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	/* block nextval() calls and other allocations until we advanced the sequence */
+	LockRelationOid(sequenceId, ShareRowExclusiveLock);
+
+	sequenceData = pg_get_sequencedef(sequenceId);
+#if (PG_VERSION_NUM >= 100000)
+	increment = sequenceData->seqincrement;
+	maxValue = sequenceData->seqmax;
+#else
+	increment = sequenceData->increment_by;
+	maxValue = sequenceData->max_value;
+#endif
+
+	if (increment < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot allocate a range of sequence \"%s\"",
+							   get_rel_name(sequenceId)),
+						errdetail("Only ascending sequences are supported.")));
+	}
+
+	firstValue = DatumGetInt64(DirectFunctionCall1(nextval_oid,
+												   ObjectIdGetDatum(sequenceId)));
+
+	/* nextval() errors out beyond the maximum, so the difference is not negative */
+	availableValueCount = ((uint64) maxValue - (uint64) firstValue) / increment + 1;
+	if ((uint64) rangeSize > availableValueCount)
+	{
+		rangeSize = (int64) availableValueCount;
+	}
+
+	lastValue = firstValue + (rangeSize - 1) * increment;
+	if (lastValue != firstValue)
+	{
+		DirectFunctionCall3(setval3_oid, ObjectIdGetDatum(sequenceId),
+							Int64GetDatum(lastValue), BoolGetDatum(true));
+	}
+
+	memset(isNulls, false, sizeof(isNulls));
+	values[0] = Int64GetDatum(firstValue);
+	values[1] = Int64GetDatum(lastValue);
+	values[2] = Int64GetDatum(increment);
+
+	resultTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(resultTuple));
+}
+
+
+/*
+ * IsRangeAllocatedSequence returns whether nextval() calls of the given
+ * sequence are served from ranges allocated on the coordinator, which is the
+ * case on metadata workers for sequences that are owned by a distributed
+ * table when citus.sequence_range_size is set.
+ */
+bool
+IsRangeAllocatedSequence(Oid sequenceId)
+{
+	SequenceRangeEntry *rangeEntry = NULL;
+
+	if (SequenceRangeSize <= 0 || !CitusHasBeenLoaded() || IsCoordinator())
+	{
+		return false;
+	}
+
+	rangeEntry = LookupSequenceRangeEntry(sequenceId);
+
+	return rangeEntry->rangeAllocated;
+}
+
+
+/*
+ * NextRangeAllocatedSequenceValue sets *sequenceValue to the next value of
+ * the given sequence from the range that this backend allocated on the
+ * coordinator, and allocates a new range if the current one is used up. The
+ * function returns false if the value should be taken from the local
+ * sequence instead, which is when the sequence is not range allocated or the
+ * coordinator cannot hand out a range.
+ *
+ * Unlike nextval(), the function does not set the currval() of the sequence.
+ */
+bool
+NextRangeAllocatedSequenceValue(Oid sequenceId, int64 *sequenceValue)
+{
+	SequenceRangeEntry *rangeEntry = NULL;
+
+	if (!IsRangeAllocatedSequence(sequenceId))
+	{
+		return false;
+	}
+
+	/* values may have been allocated by another role in this session */
+	if (pg_class_aclcheck(sequenceId, GetUserId(), ACL_USAGE | ACL_UPDATE) !=
+		ACLCHECK_OK)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("permission denied for sequence %s",
+							   get_rel_name(sequenceId))));
+	}
+
+	rangeEntry = LookupSequenceRangeEntry(sequenceId);
+	if (rangeEntry->remainingValueCount <= 0 && !AllocateSequenceRange(rangeEntry))
+	{
+		return false;
+	}
+
+	*sequenceValue = rangeEntry->nextValue;
+
+	rangeEntry->remainingValueCount--;
+	if (rangeEntry->remainingValueCount > 0)
+	{
+		rangeEntry->nextValue += rangeEntry->increment;
+	}
+
+	return true;
+}
+
+
+/*
+ * LookupSequenceRangeEntry returns the range entry of the given sequence, and
+ * creates it if this backend did not use the sequence before.
+ */
+static SequenceRangeEntry *
+LookupSequenceRangeEntry(Oid sequenceId)
+{
+	SequenceRangeEntry *rangeEntry = NULL;
+	bool found = false;
+
+	if (SequenceRangeHash == NULL)
+	{
+		HASHCTL info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(Oid);
+		info.entrysize = sizeof(SequenceRangeEntry);
+		info.hcxt = CacheMemoryContext;
+
+		SequenceRangeHash = hash_create("Sequence Range Hash", 32, &info,
+										HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	rangeEntry = hash_search(SequenceRangeHash, &sequenceId, HASH_FIND, &found);
+	if (found)
+	{
+		return rangeEntry;
+	}
+
+	/* determine ownership before entering, in case the lookup errors out */
+	found = SequenceOwnedByDistributedTable(sequenceId);
+
+	rangeEntry = hash_search(SequenceRangeHash, &sequenceId, HASH_ENTER, NULL);
+	rangeEntry->rangeAllocated = found;
+	rangeEntry->nextValue = 0;
+	rangeEntry->increment = 1;
+	rangeEntry->remainingValueCount = 0;
+
+	return rangeEntry;
+}
+
+
+/*
+ * SequenceOwnedByDistributedTable returns whether the given sequence is owned
+ * by a column of a distributed table.
+ */
+static bool
+SequenceOwnedByDistributedTable(Oid sequenceId)
+{
+	bool sequenceOwned = false;
+	Oid ownedByTableId = InvalidOid;
+	int32 ownedByColumnId = 0;
+
+#if (PG_VERSION_NUM >= 100000)
+	sequenceOwned = sequenceIsOwned(sequenceId, DEPENDENCY_AUTO, &ownedByTableId,
+									&ownedByColumnId);
+	if (!sequenceOwned)
+	{
+		sequenceOwned = sequenceIsOwned(sequenceId, DEPENDENCY_INTERNAL, &ownedByTableId,
+										&ownedByColumnId);
+	}
+#else
+	sequenceOwned = sequenceIsOwned(sequenceId, &ownedByTableId, &ownedByColumnId);
+#endif
+
+	return sequenceOwned && IsDistributedTable(ownedByTableId);
+}
+
+
+/*
+ * AllocateSequenceRange allocates a new range of citus.sequence_range_size
+ * values of the entry's sequence on the coordinator and stores it in the
+ * entry. The allocation happens on a connection that is not part of the
+ * current distributed transaction, such that the coordinator's sequence lock
+ * is released right away and the range is not lost when the transaction
+ * aborts. The function returns false if no coordinator is known or the
+ * allocation fails.
+ */
+static bool
+AllocateSequenceRange(SequenceRangeEntry *rangeEntry)
+{
+	WorkerNode *coordinatorNode = PrimaryNodeForGroup(0, NULL);
+	MultiConnection *connection = NULL;
+	StringInfo allocateQuery = NULL;
+	PGresult *result = NULL;
+	int64 firstValue = 0;
+	int64 lastValue = 0;
+	int64 increment = 0;
+	int queryResult = 0;
+
+	if (coordinatorNode == NULL)
+	{
+		ereport(DEBUG1, (errmsg("no coordinator to allocate a range of sequence "
+								"\"%s\" from", get_rel_name(rangeEntry->sequenceId))));
+		return false;
+	}
+
+	connection = GetNodeConnection(SESSION_LIFESPAN, coordinatorNode->workerName,
+								   coordinatorNode->workerPort);
+	if (connection->remoteTransaction.transactionState != REMOTE_TRANS_INVALID ||
+		connection->claimedExclusively)
+	{
+		connection = GetNodeConnection(SESSION_LIFESPAN | FORCE_NEW_CONNECTION,
+									   coordinatorNode->workerName,
+									   coordinatorNode->workerPort);
+	}
+
+	if (connection->pgConn == NULL || PQstatus(connection->pgConn) != CONNECTION_OK)
+	{
+		ereport(DEBUG1, (errmsg("could not connect to the coordinator to allocate a "
+								"range of sequence \"%s\"",
+								get_rel_name(rangeEntry->sequenceId))));
+		return false;
+	}
+
+	allocateQuery = makeStringInfo();
+	appendStringInfo(allocateQuery, ALLOCATE_SEQUENCE_RANGE_QUERY,
+					 quote_literal_cstr(generate_qualified_relation_name(
+											rangeEntry->sequenceId)),
+					 SequenceRangeSize);
+
+	ClaimConnectionExclusively(connection);
+
+	queryResult = ExecuteOptionalRemoteCommand(connection, allocateQuery->data,
+											   &result);
+	if (queryResult != 0)
+	{
+		UnclaimConnection(connection);
+		return false;
+	}
+
+	scanint8(PQgetvalue(result, 0, 0), false, &firstValue);
+	scanint8(PQgetvalue(result, 0, 1), false, &lastValue);
+	scanint8(PQgetvalue(result, 0, 2), false, &increment);
+
+	PQclear(result);
+	ForgetResults(connection);
+	UnclaimConnection(connection);
+
+	rangeEntry->nextValue = firstValue;
+	rangeEntry->increment = increment;
+	rangeEntry->remainingValueCount = (lastValue - firstValue) / increment + 1;
+
+	return true;
+}
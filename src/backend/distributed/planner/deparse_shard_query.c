@@ -18,8 +18,12 @@
 #include "distributed/deparse_shard_query.h"
 #include "distributed/insert_select_planner.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/multi_logical_planner.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_router_planner.h"
+#include "distributed/planner_stats.h"
+#include "distributed/relay_utility.h"
+#include "distributed/shard_pruning.h"
 #include "distributed/version_compat.h"
 #include "lib/stringinfo.h"
 #include "nodes/makefuncs.h"
@@ -29,13 +33,26 @@
 #include "nodes/pg_list.h"
 #include "parser/parsetree.h"
 #include "storage/lock.h"
+#include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
 
 
+/* prefix of the names that stand in for shard names while building templates */
+#define SHARD_PLACEHOLDER_PREFIX "citus_shard_placeholder_"
+
+
 static void UpdateTaskQueryString(Query *query, Oid distributedTableId,
-								  RangeTblEntry *valuesRTE, Task *task);
+								  RangeTblEntry *valuesRTE, Task *task,
+								  ShardQueryTemplate **queryTemplate);
 static void ConvertRteToSubqueryWithEmptyResult(RangeTblEntry *rte);
+static char * FillShardQueryTemplate(ShardQueryTemplate *queryTemplate,
+									 char **shardNameArray);
+static uint64 * RelationShardIdArray(ShardQueryTemplate *queryTemplate,
+									 List *relationShardList);
+static int RelationRangeTableEntryCount(Query *query);
+static char * DeparseRelationShardQueryString(Query *query, List *relationShardList,
+											  ShardQueryTemplate **queryTemplate);
 
 
 /*
@@ -48,17 +65,36 @@ RebuildQueryStrings(Query *originalQuery, List *taskList)
 	ListCell *taskCell = NULL;
 	Oid relationId = ((RangeTblEntry *) linitial(originalQuery->rtable))->relid;
 	RangeTblEntry *valuesRTE = ExtractDistributedInsertValuesRTE(originalQuery);
+	ShardQueryTemplate *queryTemplate = NULL;
+	ShardQueryTemplate **queryTemplatePointer = NULL;
+	bool filterArrays = false;
+
+	PlannerStatsStart(PLANNER_STAGE_DEPARSE);
+
+	/*
+	 * Multi-shard UPDATE/DELETE tasks only differ in their shard names, unless
+	 * we give each task only the IN list values that its shard contains.
+	 */
+	if (UpdateOrDeleteQuery(originalQuery) && list_length(taskList) > 1)
+	{
+		RangeTblEntry *resultRangeTableEntry = rt_fetch(originalQuery->resultRelation,
+														originalQuery->rtable);
+
+		filterArrays = HasShardFilterableArray(originalQuery->jointree->quals,
+											   resultRangeTableEntry->relid,
+											   originalQuery->resultRelation);
+		if (!filterArrays)
+		{
+			queryTemplatePointer = &queryTemplate;
+		}
+	}
 
 	foreach(taskCell, taskList)
 	{
 		Task *task = (Task *) lfirst(taskCell);
 		Query *query = originalQuery;
 
-		if (UpdateOrDeleteQuery(query) && list_length(taskList))
-		{
-			query = copyObject(originalQuery);
-		}
-		else if (task->insertSelectQuery)
+		if (task->insertSelectQuery)
 		{
 			/* for INSERT..SELECT, adjust shard names in SELECT part */
 			RangeTblEntry *copiedInsertRte = NULL;
@@ -92,6 +128,14 @@ RebuildQueryStrings(Query *originalQuery, List *taskList)
 
 			UpdateRelationToShardNames((Node *) copiedSubquery, relationShardList);
 		}
+		else if (filterArrays)
+		{
+			ShardInterval *shardInterval = LoadShardInterval(task->anchorShardId);
+
+			query = copyObject(originalQuery);
+			FilterArraysForShard(query->jointree->quals, query->resultRelation,
+								 shardInterval);
+		}
 		else if (task->upsertQuery || valuesRTE != NULL)
 		{
 			RangeTblEntry *rangeTableEntry = NULL;
@@ -111,10 +155,12 @@ RebuildQueryStrings(Query *originalQuery, List *taskList)
 
 		ereport(DEBUG4, (errmsg("query before rebuilding: %s", task->queryString)));
 
-		UpdateTaskQueryString(query, relationId, valuesRTE, task);
+		UpdateTaskQueryString(query, relationId, valuesRTE, task, queryTemplatePointer);
 
 		ereport(DEBUG4, (errmsg("query after rebuilding:  %s", task->queryString)));
 	}
+
+	PlannerStatsEnd(PLANNER_STAGE_DEPARSE);
 }
 
 
@@ -123,11 +169,13 @@ RebuildQueryStrings(Query *originalQuery, List *taskList)
  * Task. If the Task has row values from a multi-row INSERT, those are injected
  * into the provided query (using the provided valuesRTE, which must belong to
  * the query) before deparse occurs (the query's full VALUES list will be
- * restored before this function returns).
+ * restored before this function returns). For UPDATE and DELETE queries, the
+ * query string may be built from the given template, see
+ * DeparseRelationShardQuery.
  */
 static void
 UpdateTaskQueryString(Query *query, Oid distributedTableId, RangeTblEntry *valuesRTE,
-					  Task *task)
+					  Task *task, ShardQueryTemplate **queryTemplate)
 {
 	StringInfo queryString = makeStringInfo();
 	List *oldValuesLists = NIL;
@@ -154,9 +202,10 @@ UpdateTaskQueryString(Query *query, Oid distributedTableId, RangeTblEntry *value
 	else
 	{
 		List *relationShardList = task->relationShardList;
-		UpdateRelationToShardNames((Node *) query, relationShardList);
+		char *shardQueryString = DeparseRelationShardQuery(query, relationShardList,
+														   queryTemplate);
 
-		pg_get_query_def(query, queryString);
+		appendStringInfoString(queryString, shardQueryString);
 	}
 
 	if (valuesRTE != NULL)
@@ -315,3 +364,341 @@ ConvertRteToSubqueryWithEmptyResult(RangeTblEntry *rte)
 	rte->subquery = subquery;
 	rte->alias = copyObject(rte->eref);
 }
+
+
+/*
+ * DeparseRelationShardQuery returns the query string of a copy of the given
+ * query in which relations are replaced by their shards in relationShardList.
+ *
+ * If queryTemplate is not NULL, it is used to share the work of deparsing
+ * between tasks whose queries only differ in their shards: the first call
+ * builds a template from the query, and later calls fill in the shard names
+ * of their task into it. The template is only used when each relation in the
+ * query is replaced by a shard, since relations without a shard are deparsed
+ * as empty subqueries instead.
+ */
+char *
+DeparseRelationShardQuery(Query *query, List *relationShardList,
+						  ShardQueryTemplate **queryTemplate)
+{
+	char *queryString = NULL;
+
+	PlannerStatsStart(PLANNER_STAGE_DEPARSE);
+	queryString = DeparseRelationShardQueryString(query, relationShardList,
+												  queryTemplate);
+	PlannerStatsEnd(PLANNER_STAGE_DEPARSE);
+
+	return queryString;
+}
+
+
+/*
+ * DeparseRelationShardQueryString implements DeparseRelationShardQuery, which
+ * additionally tracks the calls and time of deparsing in citus_stat_planner.
+ */
+static char *
+DeparseRelationShardQueryString(Query *query, List *relationShardList,
+								ShardQueryTemplate **queryTemplate)
+{
+	StringInfo queryString = makeStringInfo();
+	Query *shardQuery = NULL;
+
+	if (queryTemplate != NULL && *queryTemplate != NULL && (*queryTemplate)->valid)
+	{
+		uint64 *shardIdArray = RelationShardIdArray(*queryTemplate, relationShardList);
+
+		if (shardIdArray != NULL)
+		{
+			return InstantiateShardQueryTemplate(*queryTemplate, shardIdArray);
+		}
+	}
+
+	shardQuery = copyObject(query);
+	UpdateRelationToShardNames((Node *) shardQuery, relationShardList);
+
+	if (queryTemplate != NULL && *queryTemplate == NULL)
+	{
+		List *shardRangeTableEntryList = ShardRangeTableEntryList(shardQuery);
+
+		if (list_length(shardRangeTableEntryList) == RelationRangeTableEntryCount(query))
+		{
+			*queryTemplate = BuildShardQueryTemplate(shardQuery,
+													 shardRangeTableEntryList,
+													 queryString);
+
+			return queryString->data;
+		}
+
+		/* remember that the query is not suitable for a template */
+		*queryTemplate = palloc0(sizeof(ShardQueryTemplate));
+	}
+
+	pg_get_query_def(shardQuery, queryString);
+
+	return queryString->data;
+}
+
+
+/*
+ * ShardRangeTableEntryList returns the range table entries of the given query
+ * and its subqueries that refer to shards.
+ */
+List *
+ShardRangeTableEntryList(Query *query)
+{
+	List *rangeTableList = NIL;
+	List *shardRangeTableEntryList = NIL;
+	ListCell *rangeTableCell = NULL;
+
+	ExtractRangeTableEntryWalker((Node *) query, &rangeTableList);
+
+	foreach(rangeTableCell, rangeTableList)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		if (GetRangeTblKind(rangeTableEntry) == CITUS_RTE_SHARD)
+		{
+			shardRangeTableEntryList = lappend(shardRangeTableEntryList,
+											   rangeTableEntry);
+		}
+	}
+
+	return shardRangeTableEntryList;
+}
+
+
+/*
+ * BuildShardQueryTemplate deparses the given query into queryString, and
+ * returns a template of the query in which the names of the shards in the
+ * given range table entries are left out. To find where those names appear,
+ * we deparse the query a second time with placeholder names.
+ *
+ * The rest of the query string needs to be the same for all tasks, which we
+ * cannot tell from the query tree alone. We therefore check that the template
+ * reproduces the query string we deparsed, and mark the template as invalid
+ * if it does not, for example because a placeholder name appears elsewhere in
+ * the query.
+ */
+ShardQueryTemplate *
+BuildShardQueryTemplate(Query *query, List *shardRangeTableEntryList,
+						StringInfo queryString)
+{
+	ShardQueryTemplate *queryTemplate = palloc0(sizeof(ShardQueryTemplate));
+	StringInfo templateString = makeStringInfo();
+	int slotCount = list_length(shardRangeTableEntryList);
+	char **shardNameArray = NULL;
+	char *textStart = NULL;
+	char *placeholder = NULL;
+	char *instantiatedString = NULL;
+	int prefixLength = strlen(SHARD_PLACEHOLDER_PREFIX);
+	ListCell *rangeTableCell = NULL;
+	int slotIndex = 0;
+
+	pg_get_query_def(query, queryString);
+
+	if (slotCount == 0)
+	{
+		return queryTemplate;
+	}
+
+	queryTemplate->slotCount = slotCount;
+	queryTemplate->relationIds = palloc0(slotCount * sizeof(Oid));
+	queryTemplate->relationNames = palloc0(slotCount * sizeof(char *));
+	shardNameArray = palloc0(slotCount * sizeof(char *));
+
+	/* replace the shard names with placeholders, remembering the originals */
+	foreach(rangeTableCell, shardRangeTableEntryList)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+		StringInfo placeholderName = makeStringInfo();
+
+		ExtractRangeTblExtraData(rangeTableEntry, NULL, NULL,
+								 &shardNameArray[slotIndex], NULL);
+
+		queryTemplate->relationIds[slotIndex] = rangeTableEntry->relid;
+		queryTemplate->relationNames[slotIndex] = get_rel_name(rangeTableEntry->relid);
+
+		appendStringInfo(placeholderName, SHARD_PLACEHOLDER_PREFIX "%d", slotIndex);
+		ModifyRangeTblExtraData(rangeTableEntry, CITUS_RTE_SHARD, NULL,
+								placeholderName->data, NIL);
+
+		slotIndex++;
+	}
+
+	pg_get_query_def(query, templateString);
+
+	/* put the original shard names back in place */
+	slotIndex = 0;
+	foreach(rangeTableCell, shardRangeTableEntryList)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		ModifyRangeTblExtraData(rangeTableEntry, CITUS_RTE_SHARD, NULL,
+								shardNameArray[slotIndex], NIL);
+
+		slotIndex++;
+	}
+
+	/* split the template string at the placeholders */
+	textStart = templateString->data;
+	while ((placeholder = strstr(textStart, SHARD_PLACEHOLDER_PREFIX)) != NULL)
+	{
+		char *slotIndexStart = placeholder + prefixLength;
+		char *slotIndexEnd = NULL;
+		long placeholderSlotIndex = strtol(slotIndexStart, &slotIndexEnd, 10);
+
+		if (slotIndexEnd == slotIndexStart || placeholderSlotIndex < 0 ||
+			placeholderSlotIndex >= slotCount)
+		{
+			return queryTemplate;
+		}
+
+		queryTemplate->textList = lappend(queryTemplate->textList,
+										  pnstrdup(textStart, placeholder - textStart));
+		queryTemplate->slotIndexList = lappend_int(queryTemplate->slotIndexList,
+												   (int) placeholderSlotIndex);
+
+		textStart = slotIndexEnd;
+	}
+
+	queryTemplate->textList = lappend(queryTemplate->textList, pstrdup(textStart));
+
+	instantiatedString = FillShardQueryTemplate(queryTemplate, shardNameArray);
+	queryTemplate->valid = (strcmp(instantiatedString, queryString->data) == 0);
+
+	return queryTemplate;
+}
+
+
+/*
+ * InstantiateShardQueryTemplate returns the query string of the given valid
+ * template, in which each slot refers to the shard with the corresponding
+ * shard id in shardIdArray.
+ */
+char *
+InstantiateShardQueryTemplate(ShardQueryTemplate *queryTemplate, uint64 *shardIdArray)
+{
+	int slotCount = queryTemplate->slotCount;
+	char **shardNameArray = palloc0(slotCount * sizeof(char *));
+	char *queryString = NULL;
+	int slotIndex = 0;
+
+	Assert(queryTemplate->valid);
+
+	PlannerStatsStart(PLANNER_STAGE_DEPARSE);
+
+	for (slotIndex = 0; slotIndex < slotCount; slotIndex++)
+	{
+		char *shardName = pstrdup(queryTemplate->relationNames[slotIndex]);
+
+		AppendShardIdToName(&shardName, shardIdArray[slotIndex]);
+		shardNameArray[slotIndex] = shardName;
+	}
+
+	queryString = FillShardQueryTemplate(queryTemplate, shardNameArray);
+
+	PlannerStatsEnd(PLANNER_STAGE_DEPARSE);
+
+	return queryString;
+}
+
+
+/*
+ * FillShardQueryTemplate builds a query string from the given template by
+ * putting the quoted shard names in shardNameArray at the placeholders.
+ */
+static char *
+FillShardQueryTemplate(ShardQueryTemplate *queryTemplate, char **shardNameArray)
+{
+	StringInfo queryString = makeStringInfo();
+	ListCell *slotIndexCell = list_head(queryTemplate->slotIndexList);
+	ListCell *textCell = NULL;
+
+	foreach(textCell, queryTemplate->textList)
+	{
+		char *text = (char *) lfirst(textCell);
+
+		appendStringInfoString(queryString, text);
+
+		if (slotIndexCell != NULL)
+		{
+			int slotIndex = lfirst_int(slotIndexCell);
+
+			appendStringInfoString(queryString,
+								   quote_identifier(shardNameArray[slotIndex]));
+
+			slotIndexCell = lnext(slotIndexCell);
+		}
+	}
+
+	return queryString->data;
+}
+
+
+/*
+ * RelationShardIdArray returns the shard ids that the relations of the
+ * template's slots are replaced with according to relationShardList, or NULL
+ * if one of the relations does not have a shard in the list.
+ */
+static uint64 *
+RelationShardIdArray(ShardQueryTemplate *queryTemplate, List *relationShardList)
+{
+	int slotCount = queryTemplate->slotCount;
+	uint64 *shardIdArray = palloc0(slotCount * sizeof(uint64));
+	int slotIndex = 0;
+
+	for (slotIndex = 0; slotIndex < slotCount; slotIndex++)
+	{
+		Oid relationId = queryTemplate->relationIds[slotIndex];
+		uint64 shardId = INVALID_SHARD_ID;
+		ListCell *relationShardCell = NULL;
+
+		/* use the first match, like UpdateRelationToShardNames */
+		foreach(relationShardCell, relationShardList)
+		{
+			RelationShard *relationShard = (RelationShard *) lfirst(relationShardCell);
+
+			if (relationShard->relationId == relationId)
+			{
+				shardId = relationShard->shardId;
+				break;
+			}
+		}
+
+		if (shardId == INVALID_SHARD_ID)
+		{
+			return NULL;
+		}
+
+		shardIdArray[slotIndex] = shardId;
+	}
+
+	return shardIdArray;
+}
+
+
+/*
+ * RelationRangeTableEntryCount returns the number of relation range table
+ * entries in the given query and its subqueries.
+ */
+static int
+RelationRangeTableEntryCount(Query *query)
+{
+	List *rangeTableList = NIL;
+	ListCell *rangeTableCell = NULL;
+	int relationCount = 0;
+
+	ExtractRangeTableEntryWalker((Node *) query, &rangeTableList);
+
+	foreach(rangeTableCell, rangeTableList)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		if (rangeTableEntry->rtekind == RTE_RELATION)
+		{
+			relationCount++;
+		}
+	}
+
+	return relationCount;
+}
@@ -16,7 +16,11 @@
 #include "catalog/pg_type.h"
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/citus_nodes.h"
+#include "distributed/connection_management.h"
+#include "distributed/fast_path_router_planner.h"
+#include "distributed/function_call_delegation.h"
 #include "distributed/insert_select_planner.h"
+#include "distributed/intermediate_result_scan.h"
 #include "distributed/intermediate_results.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_executor.h"
@@ -27,12 +31,17 @@
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_master_planner.h"
 #include "distributed/multi_router_planner.h"
+#include "distributed/partition_pruning.h"
+#include "distributed/planner_stats.h"
+#include "distributed/query_stats.h"
+#include "distributed/query_trace.h"
 #include "distributed/recursive_planning.h"
 #include "executor/executor.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "parser/parsetree.h"
 #include "parser/parse_type.h"
+#include "portability/instr_time.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planner.h"
@@ -61,7 +70,6 @@ static DistributedPlan * CreateDistributedSelectPlan(uint64 planId, Query *origi
 													 bool hasUnresolvedParams,
 													 PlannerRestrictionContext *
 													 plannerRestrictionContext);
-static Node * ResolveExternalParams(Node *inputNode, ParamListInfo boundParams);
 
 static void AssignRTEIdentities(Query *queryTree);
 static void AssignRTEIdentity(RangeTblEntry *rangeTableEntry, int rteIdentifier);
@@ -75,13 +83,13 @@ static PlannedStmt * FinalizeNonRouterPlan(PlannedStmt *localPlan,
 static PlannedStmt * FinalizeRouterPlan(PlannedStmt *localPlan, CustomScan *customScan);
 static void CheckNodeIsDumpable(Node *node);
 static Node * CheckNodeCopyAndSerialization(Node *node);
+static bool ResolveSessionIntermediateResults(Node *node, void *context);
 static void AdjustReadIntermediateResultCost(RangeTblEntry *rangeTableEntry,
 											 RelOptInfo *relOptInfo);
 static List * CopyPlanParamList(List *originalPlanParamList);
 static PlannerRestrictionContext * CreateAndPushPlannerRestrictionContext(void);
 static PlannerRestrictionContext * CurrentPlannerRestrictionContext(void);
 static void PopPlannerRestrictionContext(void);
-static bool HasUnresolvedExternParamsWalker(Node *expression, ParamListInfo boundParams);
 
 
 /* Distributed planner hook */
@@ -93,6 +101,17 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 	Query *originalQuery = NULL;
 	PlannerRestrictionContext *plannerRestrictionContext = NULL;
 	bool setPartitionedTablesInherited = false;
+	bool fastPathRouterQuery = false;
+	DistributedPlan *delegatedFunctionPlan = NULL;
+	instr_time planningStartTime;
+
+	INSTR_TIME_SET_CURRENT(planningStartTime);
+
+	/* refer to intermediate results with a session lifetime by their key */
+	if (HasSessionIntermediateResults())
+	{
+		ResolveSessionIntermediateResults((Node *) parse, NULL);
+	}
 
 	if (cursorOptions & CURSOR_OPT_FORCE_DISTRIBUTED)
 	{
@@ -116,6 +135,25 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 									"table.")));
 		}
 
+		/* start connecting to the workers in the background, if enabled */
+		PrewarmNodeConnections();
+
+		/*
+		 * Inline the CTEs that are referenced once such that they are planned
+		 * along with the rest of the query rather than as separate subplans.
+		 * We do this before anything else is derived from the query tree.
+		 */
+		if (EnableCTEInlining && parse->commandType == CMD_SELECT)
+		{
+			RecursivelyInlineCtesInQueryTree(parse);
+		}
+
+		/*
+		 * Replace partitioned tables whose filters leave a single partition
+		 * by that partition, such that we only plan for and lock the latter.
+		 */
+		ReplacePartitionedTablesWithPrunedPartitions(parse);
+
 		/*
 		 * standard_planner scribbles on it's input, but for deparsing we need the
 		 * unmodified form. Note that we keep RTE_RELATIONs with their identities
@@ -128,19 +166,53 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 
 		setPartitionedTablesInherited = false;
 		AdjustPartitioningForDistributedPlanning(parse, setPartitionedTablesInherited);
+
+		fastPathRouterQuery = FastPathRouterQuery(originalQuery);
+
+		/* decide whether to trace a top-level statement when planning it */
+		if (plannerRestrictionContextList == NIL && ExecutorNestingLevel == 0)
+		{
+			QueryTraceStatementStart(true);
+		}
+
+		RecordQueryTraceEvent(QUERY_TRACE_PLAN, QUERY_TRACE_BEGIN, NULL, 0);
+	}
+	else
+	{
+		/*
+		 * Calls of distributed functions do not reference distributed tables,
+		 * but may be sent to the node that has the shard of their distribution
+		 * argument. We deparse the call before standard_planner modifies it.
+		 */
+		delegatedFunctionPlan = TryToDelegateFunctionCall(parse, boundParams);
 	}
 
 	/* create a restriction context and put it at the end if context list */
 	plannerRestrictionContext = CreateAndPushPlannerRestrictionContext();
+	plannerRestrictionContext->relationRestrictionContext->fastPathRouterQuery =
+		fastPathRouterQuery;
 
 	PG_TRY();
 	{
-		/*
-		 * First call into standard planner. This is required because the Citus
-		 * planner relies on parse tree transformations made by postgres' planner.
-		 */
-
-		result = standard_planner(parse, cursorOptions, boundParams);
+		if (fastPathRouterQuery)
+		{
+			/*
+			 * Simple single-shard queries do not need any of the information
+			 * that postgres' planner gathers, so we skip it altogether.
+			 */
+			PlannerStatsStart(PLANNER_STAGE_FAST_PATH);
+			result = FastPathPlanner(originalQuery, parse, boundParams);
+			PlannerStatsEnd(PLANNER_STAGE_FAST_PATH);
+		}
+		else
+		{
+			/*
+			 * First call into standard planner. This is required because the
+			 * Citus planner relies on parse tree transformations made by
+			 * postgres' planner.
+			 */
+			result = standard_planner(parse, cursorOptions, boundParams);
+		}
 
 		if (needsDistributedPlanning)
 		{
@@ -149,10 +221,23 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 			result = CreateDistributedPlan(planId, result, originalQuery, parse,
 										   boundParams, plannerRestrictionContext);
 		}
+		else if (delegatedFunctionPlan != NULL)
+		{
+			delegatedFunctionPlan->planId = NextPlanId++;
+
+			result = FinalizePlan(result, delegatedFunctionPlan);
+		}
 	}
 	PG_CATCH();
 	{
 		PopPlannerRestrictionContext();
+
+		/* the planner stages that were interrupted are counted again next time */
+		if (plannerRestrictionContextList == NIL)
+		{
+			ResetPlannerStatsState();
+		}
+
 		PG_RE_THROW();
 	}
 	PG_END_TRY();
@@ -167,6 +252,22 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 	/* remove the context from the context list */
 	PopPlannerRestrictionContext();
 
+	if (needsDistributedPlanning)
+	{
+		RecordQueryTraceEvent(QUERY_TRACE_PLAN, QUERY_TRACE_END, NULL, 0);
+	}
+
+	/* planning time of top-level distributed queries shows in citus_stat_statements */
+	if (needsDistributedPlanning && plannerRestrictionContextList == NIL)
+	{
+		instr_time planningTime;
+
+		INSTR_TIME_SET_CURRENT(planningTime);
+		INSTR_TIME_SUBTRACT(planningTime, planningStartTime);
+
+		QueryStatsRecordPlanningTime(INSTR_TIME_GET_MILLISEC(planningTime));
+	}
+
 	/*
 	 * In some cases, for example; parameterized SQL functions, we may miss that
 	 * there is a need for distributed planning. Such cases only become clear after
@@ -481,6 +582,8 @@ CreateDistributedPlan(uint64 planId, PlannedStmt *localPlan, Query *originalQuer
 	JoinRestrictionContext *joinRestrictionContext =
 		plannerRestrictionContext->joinRestrictionContext;
 
+	PlannerStatsStart(PLANNER_STAGE_DISTRIBUTED_PLAN);
+
 	if (HasUnresolvedExternParamsWalker((Node *) originalQuery, boundParams))
 	{
 		hasUnresolvedParams = true;
@@ -488,6 +591,7 @@ CreateDistributedPlan(uint64 planId, PlannedStmt *localPlan, Query *originalQuer
 
 	plannerRestrictionContext->joinRestrictionContext =
 		RemoveDuplicateJoinRestrictions(joinRestrictionContext);
+	plannerRestrictionContext->attributeEquivalencesGenerated = false;
 
 	if (IsModifyCommand(query))
 	{
@@ -498,11 +602,17 @@ CreateDistributedPlan(uint64 planId, PlannedStmt *localPlan, Query *originalQuer
 			distributedPlan =
 				CreateInsertSelectPlan(originalQuery, plannerRestrictionContext);
 		}
+		else if (MultiRowInsertViaCopy(originalQuery))
+		{
+			distributedPlan = CreateMultiRowInsertCopyPlan(originalQuery);
+		}
 		else
 		{
 			/* modifications are always routed through the same planner/executor */
+			PlannerStatsStart(PLANNER_STAGE_ROUTER);
 			distributedPlan =
 				CreateModifyPlan(originalQuery, query, plannerRestrictionContext);
+			PlannerStatsEnd(PLANNER_STAGE_ROUTER);
 		}
 
 		Assert(distributedPlan);
@@ -575,6 +685,8 @@ CreateDistributedPlan(uint64 planId, PlannedStmt *localPlan, Query *originalQuer
 		resultPlan->planTree->total_cost = FLT_MAX / 100000000;
 	}
 
+	PlannerStatsEnd(PLANNER_STAGE_DISTRIBUTED_PLAN);
+
 	return resultPlan;
 }
 
@@ -607,8 +719,11 @@ CreateDistributedSelectPlan(uint64 planId, Query *originalQuery, Query *query,
 	 * produce distributed query plans.
 	 */
 
+	PlannerStatsStart(PLANNER_STAGE_ROUTER);
 	distributedPlan = CreateRouterPlan(originalQuery, query,
 									   relationRestrictionContext);
+	PlannerStatsEnd(PLANNER_STAGE_ROUTER);
+
 	if (distributedPlan != NULL)
 	{
 		if (distributedPlan->planningError == NULL)
@@ -626,6 +741,19 @@ CreateDistributedSelectPlan(uint64 planId, Query *originalQuery, Query *query,
 		}
 	}
 
+	/*
+	 * Fast path queries are not planned by postgres, hence the code below does
+	 * not have what it needs. They should always be router plannable though,
+	 * unless for instance their shard has no active placements.
+	 */
+	if (relationRestrictionContext->fastPathRouterQuery)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("could not create a router plan for the query"),
+						errhint("Set citus.enable_fast_path_router_planner to off "
+								"to plan the query through the regular planner.")));
+	}
+
 	if (hasUnresolvedParams)
 	{
 		/*
@@ -652,8 +780,10 @@ CreateDistributedSelectPlan(uint64 planId, Query *originalQuery, Query *query,
 	 * Plan subqueries and CTEs that cannot be pushed down by recursively
 	 * calling the planner and return the resulting plans to subPlanList.
 	 */
+	PlannerStatsStart(PLANNER_STAGE_RECURSIVE);
 	subPlanList = GenerateSubplansForSubqueriesAndCTEs(planId, originalQuery,
 													   plannerRestrictionContext);
+	PlannerStatsEnd(PLANNER_STAGE_RECURSIVE);
 
 	/*
 	 * If subqueries were recursively planned then we need to replan the query
@@ -709,6 +839,8 @@ CreateDistributedSelectPlan(uint64 planId, Query *originalQuery, Query *query,
 	query->cteList = NIL;
 	Assert(originalQuery->cteList == NIL);
 
+	PlannerStatsStart(PLANNER_STAGE_LOGICAL);
+
 	logicalPlan = MultiLogicalPlanCreate(originalQuery, query,
 										 plannerRestrictionContext);
 	MultiLogicalPlanOptimize(logicalPlan);
@@ -726,6 +858,8 @@ CreateDistributedSelectPlan(uint64 planId, Query *originalQuery, Query *query,
 	distributedPlan = CreatePhysicalDistributedPlan(logicalPlan,
 													plannerRestrictionContext);
 
+	PlannerStatsEnd(PLANNER_STAGE_LOGICAL);
+
 	/* distributed plan currently should always succeed or error out */
 	Assert(distributedPlan && distributedPlan->planningError == NULL);
 
@@ -740,7 +874,7 @@ CreateDistributedSelectPlan(uint64 planId, Query *originalQuery, Query *query,
  * Note that this function is inspired by eval_const_expr() on Postgres.
  * We cannot use that function because it requires access to PlannerInfo.
  */
-static Node *
+Node *
 ResolveExternalParams(Node *inputNode, ParamListInfo boundParams)
 {
 	/* consider resolving external parameters only when boundParams exists */
@@ -894,6 +1028,12 @@ FinalizePlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan)
 			break;
 		}
 
+		case MULTI_EXECUTOR_ADAPTIVE:
+		{
+			customScan->methods = &AdaptiveExecutorCustomScanMethods;
+			break;
+		}
+
 		default:
 		{
 			customScan->methods = &DelayedErrorCustomScanMethods;
@@ -1139,6 +1279,7 @@ multi_join_restriction_hook(PlannerInfo *root,
 
 	joinRestrictionContext->joinRestrictionList =
 		lappend(joinRestrictionContext->joinRestrictionList, joinRestriction);
+	plannerRestrictionContext->attributeEquivalencesGenerated = false;
 
 	MemoryContextSwitchTo(oldMemoryContext);
 }
@@ -1215,14 +1356,61 @@ multi_relation_restriction_hook(PlannerInfo *root, RelOptInfo *relOptInfo, Index
 
 	relationRestrictionContext->relationRestrictionList =
 		lappend(relationRestrictionContext->relationRestrictionList, relationRestriction);
+	plannerRestrictionContext->attributeEquivalencesGenerated = false;
 
 	MemoryContextSwitchTo(oldMemoryContext);
 }
 
 
+/*
+ * ResolveSessionIntermediateResults replaces the result IDs in the
+ * read_intermediate_result calls of a query tree that name results with a
+ * session lifetime by the keys under which those results are stored. The
+ * keys then also end up in the queries that are sent to the workers.
+ */
+static bool
+ResolveSessionIntermediateResults(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, FuncExpr))
+	{
+		FuncExpr *funcExpr = (FuncExpr *) node;
+
+		if (funcExpr->funcid == CitusReadIntermediateResultFuncId())
+		{
+			Const *resultIdConst = (Const *) linitial(funcExpr->args);
+
+			if (IsA(resultIdConst, Const) && !resultIdConst->constisnull)
+			{
+				char *resultId = TextDatumGetCString(resultIdConst->constvalue);
+				char *storageKey = SessionIntermediateResultKey(resultId);
+
+				if (storageKey != NULL)
+				{
+					resultIdConst->constvalue = CStringGetTextDatum(storageKey);
+				}
+			}
+		}
+	}
+	else if (IsA(node, Query))
+	{
+		return query_tree_walker((Query *) node, ResolveSessionIntermediateResults,
+								 context, 0);
+	}
+
+	return expression_tree_walker(node, ResolveSessionIntermediateResults, context);
+}
+
+
 /*
  * AdjustReadIntermediateResultCost adjusts the row count and total cost
- * of a read_intermediate_result call based on the file size.
+ * of a read_intermediate_result call based on the file size, or on the row
+ * count of the result when it is known, and plans the call as a scan that
+ * reads the result row by row.
  */
 static void
 AdjustReadIntermediateResultCost(RangeTblEntry *rangeTableEntry, RelOptInfo *relOptInfo)
@@ -1240,6 +1428,8 @@ AdjustReadIntermediateResultCost(RangeTblEntry *rangeTableEntry, RelOptInfo *rel
 	char *resultId = NULL;
 	int64 resultSize = 0;
 	ListCell *typeCell = NULL;
+	char *resultFormatLabel = NULL;
+	uint64 knownRowCount = 0;
 	bool binaryFormat = false;
 	double rowCost = 0.;
 	double rowSizeEstimate = 0;
@@ -1335,8 +1525,25 @@ AdjustReadIntermediateResultCost(RangeTblEntry *rangeTableEntry, RelOptInfo *rel
 		rowCost += get_func_cost(inputFunctionId) * cpu_operator_cost;
 	}
 
-	/* estimate the number of rows based on the file size and estimated row size */
-	rowCountEstimate = Max(1, (double) resultSize / rowSizeEstimate);
+	if (IntermediateResultRowCount(resultId, &knownRowCount))
+	{
+		/* the result was written or read before, so its row count is known */
+		rowCountEstimate = Max(1, (double) knownRowCount);
+
+		if (binaryFormat && knownRowCount > 0)
+		{
+			/* the binary size of the rows is a good estimate of their width */
+			double rowOverhead = rowSizeEstimate - reltarget->width;
+			double rowWidth = (double) resultSize / knownRowCount - rowOverhead;
+
+			reltarget->width = Max(1, (int) rowWidth);
+		}
+	}
+	else
+	{
+		/* estimate the number of rows based on the file size and estimated row size */
+		rowCountEstimate = Max(1, (double) resultSize / rowSizeEstimate);
+	}
 
 	/* cost of reading the data */
 	ioCost = seq_page_cost * resultSize / BLCKSZ;
@@ -1347,6 +1554,11 @@ AdjustReadIntermediateResultCost(RangeTblEntry *rangeTableEntry, RelOptInfo *rel
 	path = (Path *) linitial(pathList);
 	path->rows = rowCountEstimate;
 	path->total_cost = rowCountEstimate * rowCost + ioCost;
+
+	/* read the result row by row instead of materializing it */
+	resultFormatLabel = DatumGetCString(DirectFunctionCall1(enum_out,
+															resultFormatDatum));
+	UseIntermediateResultScan(relOptInfo, rangeTableEntry, resultId, resultFormatLabel);
 }
 
 
@@ -1441,7 +1653,7 @@ PopPlannerRestrictionContext(void)
  * has external parameters that are not contained in boundParams, false
  * otherwise.
  */
-static bool
+bool
 HasUnresolvedExternParamsWalker(Node *expression, ParamListInfo boundParams)
 {
 	if (expression == NULL)
@@ -0,0 +1,272 @@
+/*-------------------------------------------------------------------------
+ *
+ * fast_path_router_planner.c
+ *
+ * Planning logic for simple single-shard SELECT queries of the form
+ *
+ *     SELECT ... FROM distributed_table WHERE distribution_key = value ...
+ *
+ * Such queries are common in OLTP workloads and are always router queries,
+ * yet the regular code path plans them through standard_planner() only to
+ * collect the restrictions that shard pruning needs. For these queries we
+ * generate a placeholder plan instead, and let the router planner prune the
+ * shards using the filters of the query itself. That saves the bulk of the
+ * planning time of short queries.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "distributed/distributed_planner.h"
+#include "distributed/fast_path_router_planner.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/multi_logical_planner.h"
+#include "distributed/multi_router_planner.h"
+#include "distributed/pg_dist_partition.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/pg_list.h"
+#include "optimizer/clauses.h"
+
+
+/* Config variable managed via guc.c */
+bool EnableFastPathRouterPlanner = true;
+
+
+/* local function forward declarations */
+static Node * DistributionKeyEqualityValue(Node *clause, Var *distributionKey);
+static PlannedStmt * GeneratePlaceHolderPlannedStmt(Query *parse);
+
+
+/*
+ * FastPathRouterQuery returns true if the given query is a SELECT on a single
+ * hash-distributed table with an equality filter on the distribution column
+ * against a constant or an external parameter, or a SELECT on a single
+ * reference table. Those queries always target a single shard, and can be
+ * planned via FastPathPlanner().
+ *
+ * The checks are deliberately conservative; anything that requires the postgres
+ * planner's view of the query, such as CTEs, subqueries or row locks, takes the
+ * regular code path.
+ */
+bool
+FastPathRouterQuery(Query *query)
+{
+	RangeTblEntry *rangeTableEntry = NULL;
+	FromExpr *joinTree = query->jointree;
+	Oid distributedTableId = InvalidOid;
+	char partitionMethod = 0;
+
+	if (!EnableFastPathRouterPlanner || !EnableRouterExecution)
+	{
+		return false;
+	}
+
+	if (query->commandType != CMD_SELECT || query->utilityStmt != NULL)
+	{
+		return false;
+	}
+
+	if (query->cteList != NIL || query->hasSubLinks || query->hasForUpdate ||
+		query->setOperations != NULL)
+	{
+		return false;
+	}
+
+	if (list_length(query->rtable) != 1 || joinTree == NULL ||
+		list_length(joinTree->fromlist) != 1 ||
+		!IsA(linitial(joinTree->fromlist), RangeTblRef))
+	{
+		return false;
+	}
+
+	rangeTableEntry = (RangeTblEntry *) linitial(query->rtable);
+	if (rangeTableEntry->rtekind != RTE_RELATION ||
+		rangeTableEntry->tablesample != NULL)
+	{
+		return false;
+	}
+
+	distributedTableId = rangeTableEntry->relid;
+	if (!IsDistributedTable(distributedTableId))
+	{
+		return false;
+	}
+
+	/* reference tables have a single shard, no matter what the filters are */
+	partitionMethod = PartitionMethod(distributedTableId);
+	if (partitionMethod == DISTRIBUTE_BY_NONE)
+	{
+		return true;
+	}
+
+	/*
+	 * Shards of range distributed tables may overlap, in which case the query
+	 * would not be router plannable, so we only consider hash distributed ones.
+	 */
+	if (partitionMethod != DISTRIBUTE_BY_HASH)
+	{
+		return false;
+	}
+
+	return FastPathDistributionKeyValue(query) != NULL;
+}
+
+
+/*
+ * FastPathDistributionKeyValue returns the constant or external parameter that
+ * the distribution column of the single relation in the given query is compared
+ * with in a top-level equality filter. If there are several such filters, the
+ * first one is returned. The function returns NULL if there is no such filter,
+ * which is always the case for reference tables.
+ */
+Node *
+FastPathDistributionKeyValue(Query *query)
+{
+	RangeTblEntry *rangeTableEntry = (RangeTblEntry *) linitial(query->rtable);
+	Oid distributedTableId = rangeTableEntry->relid;
+	Var *distributionKey = NULL;
+	List *qualList = NIL;
+	ListCell *qualCell = NULL;
+
+	if (PartitionMethod(distributedTableId) == DISTRIBUTE_BY_NONE)
+	{
+		return NULL;
+	}
+
+	distributionKey = PartitionColumn(distributedTableId, 1);
+	qualList = make_ands_implicit((Expr *) query->jointree->quals);
+	foreach(qualCell, qualList)
+	{
+		Node *qual = (Node *) lfirst(qualCell);
+		Node *distributionKeyValue = DistributionKeyEqualityValue(qual,
+																  distributionKey);
+
+		if (distributionKeyValue != NULL)
+		{
+			return distributionKeyValue;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * DistributionKeyEqualityValue returns the value operand if the given clause
+ * is of the form distributionKey = value, where value is a non-null constant
+ * or an external parameter. Otherwise, the function returns NULL.
+ */
+static Node *
+DistributionKeyEqualityValue(Node *clause, Var *distributionKey)
+{
+	OpExpr *operatorExpression = NULL;
+	Node *leftOperand = NULL;
+	Node *rightOperand = NULL;
+	Node *valueOperand = NULL;
+
+	if (!IsA(clause, OpExpr))
+	{
+		return NULL;
+	}
+
+	operatorExpression = (OpExpr *) clause;
+	if (list_length(operatorExpression->args) != 2 ||
+		!OperatorImplementsEquality(operatorExpression->opno))
+	{
+		return NULL;
+	}
+
+	/*
+	 * We do not look through coercions, since the operator might then not
+	 * belong to the operator family of the distribution column.
+	 */
+	leftOperand = get_leftop((Expr *) clause);
+	rightOperand = get_rightop((Expr *) clause);
+
+	if (IsA(leftOperand, Var) && equal(leftOperand, distributionKey))
+	{
+		valueOperand = rightOperand;
+	}
+	else if (IsA(rightOperand, Var) && equal(rightOperand, distributionKey))
+	{
+		valueOperand = leftOperand;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	if (IsA(valueOperand, Const) && !((Const *) valueOperand)->constisnull)
+	{
+		return valueOperand;
+	}
+	else if (IsA(valueOperand, Param) &&
+			 ((Param *) valueOperand)->paramkind == PARAM_EXTERN)
+	{
+		return valueOperand;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * FastPathPlanner creates the local plan for a query that passes
+ * FastPathRouterQuery(), without calling into standard_planner(). It replaces
+ * the bound parameters in the filters of the original query, which the router
+ * planner uses to prune shards, and returns a placeholder plan that the
+ * distributed planner wraps into the final plan.
+ *
+ * If the distribution column is compared with a parameter that has no value
+ * yet, as in generic plans of prepared statements, the router planner defers
+ * shard pruning to the executor. That keeps such plans cacheable.
+ */
+PlannedStmt *
+FastPathPlanner(Query *originalQuery, Query *parse, ParamListInfo boundParams)
+{
+	FromExpr *joinTree = originalQuery->jointree;
+
+	joinTree->quals = ResolveExternalParams(joinTree->quals, boundParams);
+
+	return GeneratePlaceHolderPlannedStmt(parse);
+}
+
+
+/*
+ * GeneratePlaceHolderPlannedStmt returns a planned statement that scans the
+ * single relation of the given query. The plan is never executed; the
+ * distributed planner only uses its target list and range table when it
+ * builds the final plan.
+ */
+static PlannedStmt *
+GeneratePlaceHolderPlannedStmt(Query *parse)
+{
+	PlannedStmt *result = makeNode(PlannedStmt);
+	SeqScan *seqScanNode = makeNode(SeqScan);
+	Plan *plan = &seqScanNode->plan;
+	RangeTblEntry *rangeTableEntry = (RangeTblEntry *) linitial(parse->rtable);
+
+	/* there is only a single relation range table entry */
+	seqScanNode->scanrelid = 1;
+
+	plan->targetlist = copyObject(parse->targetList);
+	plan->qual = NIL;
+	plan->lefttree = NULL;
+	plan->righttree = NULL;
+	plan->plan_node_id = 1;
+
+	result->commandType = parse->commandType;
+	result->queryId = parse->queryId;
+	result->canSetTag = true;
+
+	/* the range table is used for access permission checks */
+	result->rtable = copyObject(parse->rtable);
+	result->planTree = plan;
+	result->relationOids = list_make1_oid(rangeTableEntry->relid);
+
+	return result;
+}
@@ -0,0 +1,269 @@
+/*-------------------------------------------------------------------------
+ *
+ * function_call_delegation.c
+ *
+ * Planning logic for calls of distributed functions of the form
+ *
+ *     SELECT function(..., distribution_argument, ...)
+ *
+ * A function that runs many single-shard statements for the same value of
+ * the distribution column would otherwise need a round trip between the
+ * coordinator and a worker for each of them. If the function was distributed
+ * with create_distributed_function(), we instead send the whole call to the
+ * worker that has the shard of the value of its distribution argument. The
+ * worker has the metadata of the colocated tables, so the statements in the
+ * function run there as router queries on local shards.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "distributed/citus_nodefuncs.h"
+#include "distributed/citus_ruleutils.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/function_call_delegation.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/shardinterval_utils.h"
+#include "distributed/transaction_management.h"
+#include "distributed/worker_manager.h"
+#include "lib/stringinfo.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/pg_list.h"
+#include "utils/lsyscache.h"
+
+
+/* Config variable managed via guc.c */
+bool EnableFunctionCallDelegation = true;
+
+
+/* local function forward declarations */
+static FuncExpr * DelegatableFunctionCall(Query *query);
+static ShardPlacement * DelegationTargetPlacement(ShardInterval *shardInterval);
+
+
+/*
+ * TryToDelegateFunctionCall returns a router plan that runs the given query on
+ * the node that has the shard of the distribution argument, if the query is a
+ * call of a distributed function whose distribution argument is known during
+ * planning. Otherwise, it returns NULL and the query is planned as usual.
+ *
+ * Within a transaction block, the statements of the function would run in a
+ * transaction of the worker that is not part of the distributed transaction,
+ * so calls are only delegated outside of transaction blocks.
+ */
+DistributedPlan *
+TryToDelegateFunctionCall(Query *query, ParamListInfo boundParams)
+{
+	FuncExpr *funcExpr = NULL;
+	DistFunctionCacheEntry *functionCacheEntry = NULL;
+	Node *distributionArgument = NULL;
+	Const *distributionValue = NULL;
+	List *colocatedTableList = NIL;
+	Oid colocatedTableId = InvalidOid;
+	DistTableCacheEntry *tableCacheEntry = NULL;
+	ShardInterval *shardInterval = NULL;
+	ShardPlacement *placement = NULL;
+	RelationShard *relationShard = NULL;
+	StringInfo queryString = NULL;
+	Task *task = NULL;
+	Job *job = NULL;
+	DistributedPlan *distributedPlan = NULL;
+
+	if (!EnableFunctionCallDelegation)
+	{
+		return NULL;
+	}
+
+	funcExpr = DelegatableFunctionCall(query);
+	if (funcExpr == NULL)
+	{
+		return NULL;
+	}
+
+	/* pg_dist_function only exists once the extension is up to date */
+	if (!CitusHasBeenLoaded() || !CheckCitusVersion(DEBUG4))
+	{
+		return NULL;
+	}
+
+	functionCacheEntry = LookupDistFunctionCacheEntry(funcExpr->funcid);
+	if (functionCacheEntry == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsTransactionBlock() || InCoordinatedTransaction())
+	{
+		ereport(DEBUG1, (errmsg("not delegating the call of a distributed function "
+								"in a transaction block")));
+		return NULL;
+	}
+
+	if (functionCacheEntry->distributionArgIndex >= list_length(funcExpr->args))
+	{
+		return NULL;
+	}
+
+	/* the worker cannot resolve parameters that are not bound yet */
+	if (HasUnresolvedExternParamsWalker((Node *) query, boundParams))
+	{
+		return NULL;
+	}
+
+	if (boundParams != NULL)
+	{
+		query = (Query *) ResolveExternalParams((Node *) copyObject(query),
+												boundParams);
+		funcExpr = DelegatableFunctionCall(query);
+	}
+
+	distributionArgument = (Node *) list_nth(funcExpr->args,
+											 functionCacheEntry->distributionArgIndex);
+	if (!IsA(distributionArgument, Const))
+	{
+		ereport(DEBUG1, (errmsg("not delegating the call of a distributed function "
+								"since its distribution argument is not a constant")));
+		return NULL;
+	}
+
+	distributionValue = (Const *) distributionArgument;
+	if (distributionValue->constisnull)
+	{
+		return NULL;
+	}
+
+	colocatedTableList =
+		CachedColocationGroupTableList(functionCacheEntry->colocationId);
+	if (colocatedTableList == NIL)
+	{
+		return NULL;
+	}
+
+	colocatedTableId = linitial_oid(colocatedTableList);
+	tableCacheEntry = DistributedTableCacheEntry(colocatedTableId);
+
+	shardInterval = FindShardInterval(distributionValue->constvalue, tableCacheEntry);
+	if (shardInterval == NULL)
+	{
+		return NULL;
+	}
+
+	placement = DelegationTargetPlacement(shardInterval);
+	if (placement == NULL)
+	{
+		return NULL;
+	}
+
+	ereport(DEBUG1, (errmsg("delegating the call of distributed function %s to "
+							"node %s:%d", get_func_name(funcExpr->funcid),
+							placement->nodeName, placement->nodePort)));
+
+	relationShard = CitusMakeNode(RelationShard);
+	relationShard->relationId = colocatedTableId;
+	relationShard->shardId = shardInterval->shardId;
+
+	queryString = makeStringInfo();
+	pg_get_query_def(query, queryString);
+
+	task = CitusMakeNode(Task);
+	task->taskType = ROUTER_TASK;
+	task->taskId = 1;
+	task->queryString = queryString->data;
+	task->anchorShardId = shardInterval->shardId;
+	task->taskPlacementList = list_make1(placement);
+	task->relationShardList = list_make1(relationShard);
+	task->replicationModel = tableCacheEntry->replicationModel;
+
+	job = CitusMakeNode(Job);
+	job->jobId = INVALID_JOB_ID;
+	job->jobQuery = query;
+	job->taskList = list_make1(task);
+
+	distributedPlan = CitusMakeNode(DistributedPlan);
+	distributedPlan->operation = CMD_SELECT;
+	distributedPlan->workerJob = job;
+	distributedPlan->masterQuery = NULL;
+	distributedPlan->routerExecutable = true;
+	distributedPlan->hasReturning = false;
+
+	return distributedPlan;
+}
+
+
+/*
+ * DelegatableFunctionCall returns the function call of a query of the form
+ * SELECT function(...) without a FROM clause, or NULL for other queries.
+ */
+static FuncExpr *
+DelegatableFunctionCall(Query *query)
+{
+	TargetEntry *targetEntry = NULL;
+
+	if (query->commandType != CMD_SELECT || query->rtable != NIL ||
+		query->cteList != NIL || query->hasSubLinks || query->hasAggs ||
+		query->hasWindowFuncs)
+	{
+		return NULL;
+	}
+
+	if (query->jointree == NULL || query->jointree->quals != NULL ||
+		list_length(query->targetList) != 1)
+	{
+		return NULL;
+	}
+
+	targetEntry = (TargetEntry *) linitial(query->targetList);
+	if (!IsA(targetEntry->expr, FuncExpr))
+	{
+		return NULL;
+	}
+
+	return (FuncExpr *) targetEntry->expr;
+}
+
+
+/*
+ * DelegationTargetPlacement returns the placement of the given shard on which
+ * a function call can run, or NULL if there is none. Shards with multiple
+ * placements are not supported, since the writes of the function would only
+ * reach one of them. The node of the placement needs the metadata of the
+ * tables to run the statements of the function, and a call on the node that
+ * has the placement already runs locally.
+ */
+static ShardPlacement *
+DelegationTargetPlacement(ShardInterval *shardInterval)
+{
+	List *placementList = FinalizedShardPlacementList(shardInterval->shardId);
+	ShardPlacement *placement = NULL;
+	WorkerNode *workerNode = NULL;
+
+	if (list_length(placementList) != 1)
+	{
+		ereport(DEBUG1, (errmsg("not delegating the call of a distributed function "
+								"since the shard has multiple placements")));
+		return NULL;
+	}
+
+	placement = (ShardPlacement *) linitial(placementList);
+
+	if (placement->groupId == GetLocalGroupId())
+	{
+		return NULL;
+	}
+
+	workerNode = FindWorkerNode(placement->nodeName, placement->nodePort);
+	if (workerNode == NULL || !workerNode->hasMetadata)
+	{
+		ereport(DEBUG1, (errmsg("not delegating the call of a distributed function "
+								"since node %s:%d does not have metadata",
+								placement->nodeName, placement->nodePort)));
+		return NULL;
+	}
+
+	return placement;
+}
@@ -65,6 +65,10 @@ static Query * WrapSubquery(Query *subquery);
 static bool CheckInsertSelectQuery(Query *query);
 
 
+/* config variable managed via guc.c */
+int MultiRowInsertCopyThreshold = 0; /* 0 disables INSERT ... VALUES via COPY */
+
+
 /*
  * InsertSelectIntoDistributedTable returns true when the input query is an
  * INSERT INTO ... SELECT kind of query and the target is a distributed
@@ -1100,6 +1104,127 @@ InsertPartitionColumnMatchesSelect(Query *query, RangeTblEntry *insertRte,
 }
 
 
+/*
+ * MultiRowInsertViaCopy returns whether the given multi-row INSERT into a
+ * distributed table has at least citus.multi_row_insert_copy_threshold rows,
+ * in which case we send the rows to the shards with COPY. Building and running
+ * a statement per shard would then take considerably longer.
+ */
+bool
+MultiRowInsertViaCopy(Query *query)
+{
+	List *fromList = NIL;
+	RangeTblRef *reference = NULL;
+	RangeTblEntry *valuesRte = NULL;
+	RangeTblEntry *insertRte = NULL;
+
+	if (MultiRowInsertCopyThreshold <= 0 || query->commandType != CMD_INSERT)
+	{
+		return false;
+	}
+
+	/* rows that are inserted via COPY cannot be returned or conflict */
+	if (query->returningList != NIL || query->onConflict != NULL ||
+		query->cteList != NIL || query->hasSubLinks)
+	{
+		return false;
+	}
+
+	if (query->jointree == NULL || !IsA(query->jointree, FromExpr))
+	{
+		return false;
+	}
+
+	fromList = query->jointree->fromlist;
+	if (list_length(fromList) != 1 || !IsA(linitial(fromList), RangeTblRef))
+	{
+		return false;
+	}
+
+	reference = (RangeTblRef *) linitial(fromList);
+	valuesRte = rt_fetch(reference->rtindex, query->rtable);
+	if (valuesRte->rtekind != RTE_VALUES ||
+		list_length(valuesRte->values_lists) < MultiRowInsertCopyThreshold)
+	{
+		return false;
+	}
+
+	insertRte = ExtractInsertRangeTableEntry(query);
+	if (!IsDistributedTable(insertRte->relid) ||
+		PartitionMethod(insertRte->relid) == DISTRIBUTE_BY_APPEND)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * CreateMultiRowInsertCopyPlan creates a plan for a multi-row INSERT for which
+ * MultiRowInsertViaCopy returned true. We turn the VALUES list into a SELECT
+ * from the VALUES list, and plan the INSERT as an INSERT ... SELECT via the
+ * coordinator. The executor then evaluates the rows locally and sends them
+ * to the shards with COPY.
+ */
+DistributedPlan *
+CreateMultiRowInsertCopyPlan(Query *originalQuery)
+{
+	Query *insertQuery = copyObject(originalQuery);
+	RangeTblRef *reference = (RangeTblRef *) linitial(insertQuery->jointree->fromlist);
+	RangeTblEntry *valuesRte = rt_fetch(reference->rtindex, insertQuery->rtable);
+	List *firstRow = (List *) linitial(valuesRte->values_lists);
+	Query *valuesQuery = makeNode(Query);
+	RangeTblRef *valuesReference = makeNode(RangeTblRef);
+	RangeTblEntry *subqueryRte = makeNode(RangeTblEntry);
+	ListCell *rangeTableCell = NULL;
+	ListCell *valueCell = NULL;
+	AttrNumber columnNumber = 1;
+	int rangeTableIndex = 1;
+
+	/* SELECT * FROM (VALUES ...), with columns typed like the first row */
+	valuesReference->rtindex = 1;
+
+	valuesQuery->commandType = CMD_SELECT;
+	valuesQuery->querySource = QSRC_ORIGINAL;
+	valuesQuery->canSetTag = true;
+	valuesQuery->rtable = list_make1(valuesRte);
+	valuesQuery->jointree = makeFromExpr(list_make1(valuesReference), NULL);
+
+	foreach(valueCell, firstRow)
+	{
+		Node *value = (Node *) lfirst(valueCell);
+		char *columnName = strVal(list_nth(valuesRte->eref->colnames, columnNumber - 1));
+		Var *column = makeVar(1, columnNumber, exprType(value), exprTypmod(value),
+							  exprCollation(value), 0);
+		TargetEntry *targetEntry = makeTargetEntry((Expr *) column, columnNumber,
+												   columnName, false);
+
+		valuesQuery->targetList = lappend(valuesQuery->targetList, targetEntry);
+		columnNumber++;
+	}
+
+	subqueryRte->rtekind = RTE_SUBQUERY;
+	subqueryRte->subquery = valuesQuery;
+	subqueryRte->eref = copyObject(valuesRte->eref);
+	subqueryRte->inFromCl = true;
+
+	/* the INSERT's target list keeps referring to the same range table index */
+	foreach(rangeTableCell, insertQuery->rtable)
+	{
+		if (rangeTableIndex == reference->rtindex)
+		{
+			lfirst(rangeTableCell) = subqueryRte;
+			break;
+		}
+
+		rangeTableIndex++;
+	}
+
+	return CreateCoordinatorInsertSelectPlan(insertQuery);
+}
+
+
 /*
  * CreatteCoordinatorInsertSelectPlan creates a query plan for a SELECT into a
  * distributed table. The query plan can also be executed on a worker in MX.
@@ -22,6 +22,7 @@
 #include "optimizer/cost.h"
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/connection_management.h"
+#include "distributed/insert_select_executor.h"
 #include "distributed/insert_select_planner.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_executor.h"
@@ -35,6 +36,7 @@
 #include "distributed/remote_commands.h"
 #include "distributed/recursive_planning.h"
 #include "distributed/placement_connection.h"
+#include "distributed/task_execution_stats.h"
 #include "distributed/worker_protocol.h"
 #include "lib/stringinfo.h"
 #include "nodes/plannodes.h"
@@ -51,6 +53,8 @@
 #include "utils/lsyscache.h"
 #include "utils/snapmgr.h"
 
+#include <math.h>
+
 
 /* OR-able flags for ExplainXMLTag() (explain.c) */
 #define X_OPENING 0
@@ -74,12 +78,18 @@ typedef struct RemoteExplainPlan
 
 /* Explain functions for distributed queries */
 static void ExplainSubPlans(DistributedPlan *distributedPlan, ExplainState *es);
-static void ExplainJob(Job *job, ExplainState *es);
+static void ExplainJob(Job *job, List *taskStatsList, ExplainState *es);
+static void ExplainTaskStatsDistribution(List *taskStatsList, ExplainState *es);
+static void ExplainValueDistribution(const char *label, double *values, int valueCount,
+									 int digits, const char *unit, ExplainState *es);
+static int CompareDoubles(const void *leftElement, const void *rightElement);
 static void ExplainMapMergeJob(MapMergeJob *mapMergeJob, ExplainState *es);
-static void ExplainTaskList(List *taskList, ExplainState *es);
+static void ExplainTaskList(List *taskList, List *taskStatsList, ExplainState *es);
+static Task * SlowestTask(List *taskList, List *taskStatsList);
+static TaskExecutionStats * TaskStatsForTask(Task *task, List *taskStatsList);
 static RemoteExplainPlan * RemoteExplain(Task *task, ExplainState *es);
 static void ExplainTask(Task *task, int placementIndex, List *explainOutputList,
-						ExplainState *es);
+						TaskExecutionStats *taskStats, ExplainState *es);
 static void ExplainTaskPlacement(ShardPlacement *taskPlacement, List *explainOutputList,
 								 ExplainState *es);
 static StringInfo BuildRemoteExplainQuery(char *queryString, ExplainState *es);
@@ -131,7 +141,7 @@ CitusExplainScan(CustomScanState *node, List *ancestors, struct ExplainState *es
 		ExplainSubPlans(distributedPlan, es);
 	}
 
-	ExplainJob(distributedPlan->workerJob, es);
+	ExplainJob(distributedPlan->workerJob, scanState->taskStatsList, es);
 
 	ExplainCloseGroup("Distributed Query", "Distributed Query", true, es);
 }
@@ -160,6 +170,11 @@ CoordinatorInsertSelectExplainScan(CustomScanState *node, List *ancestors,
 							   "... SELECT commands via the coordinator")));
 	}
 
+	if (IsRepartitionedInsertSelect(distributedPlan))
+	{
+		ExplainPropertyText("INSERT/SELECT method", "repartition", es);
+	}
+
 	ExplainOpenGroup("Select Query", "Select Query", false, es);
 
 	/* explain the inner SELECT query */
@@ -178,12 +193,16 @@ CoordinatorInsertSelectExplainScan(CustomScanState *node, List *ancestors,
  * and complex subqueries. Because the planning for these queries
  * is done along with the top-level plan, we cannot determine the
  * planning time and set it to 0.
+ *
+ * The subplans have already been executed along with the distributed
+ * query, so they are not executed again for EXPLAIN ANALYZE.
  */
 static void
 ExplainSubPlans(DistributedPlan *distributedPlan, ExplainState *es)
 {
 	ListCell *subPlanCell = NULL;
 	uint64 planId = distributedPlan->planId;
+	bool savedAnalyze = es->analyze;
 
 	ExplainOpenGroup("Subplans", "Subplans", false, es);
 
@@ -209,12 +228,16 @@ ExplainSubPlans(DistributedPlan *distributedPlan, ExplainState *es)
 		INSTR_TIME_SET_CURRENT(planduration);
 		INSTR_TIME_SUBTRACT(planduration, planduration);
 
+		es->analyze = false;
+
 #if (PG_VERSION_NUM >= 100000)
 		ExplainOnePlan(plan, into, es, queryString, params, NULL, &planduration);
 #else
 		ExplainOnePlan(plan, into, es, queryString, params, &planduration);
 #endif
 
+		es->analyze = savedAnalyze;
+
 		if (es->format == EXPLAIN_FORMAT_TEXT)
 		{
 			es->indent -= 3;
@@ -229,15 +252,20 @@ ExplainSubPlans(DistributedPlan *distributedPlan, ExplainState *es)
  * ExplainJob shows the EXPLAIN output for a Job in the physical plan of
  * a distributed query by showing the remote EXPLAIN for the first task,
  * or all tasks if citus.explain_all_tasks is on.
+ *
+ * For EXPLAIN ANALYZE, taskStatsList contains the statistics of the tasks
+ * that were collected while executing the job. In that case, the distribution
+ * of the statistics is shown along with the slowest task instead of the first.
  */
 static void
-ExplainJob(Job *job, ExplainState *es)
+ExplainJob(Job *job, List *taskStatsList, ExplainState *es)
 {
 	List *dependedJobList = job->dependedJobList;
 	int dependedJobCount = list_length(dependedJobList);
 	ListCell *dependedJobCell = NULL;
 	List *taskList = job->taskList;
 	int taskCount = list_length(taskList);
+	bool showTaskStats = es->analyze && taskStatsList != NIL;
 
 	ExplainOpenGroup("Job", "Job", true, es);
 
@@ -252,6 +280,13 @@ ExplainJob(Job *job, ExplainState *es)
 	{
 		ExplainPropertyText("Tasks Shown", "All", es);
 	}
+	else if (showTaskStats)
+	{
+		StringInfo tasksShownText = makeStringInfo();
+		appendStringInfo(tasksShownText, "Slowest of %d", taskCount);
+
+		ExplainPropertyText("Tasks Shown", tasksShownText->data, es);
+	}
 	else
 	{
 		StringInfo tasksShownText = makeStringInfo();
@@ -260,6 +295,11 @@ ExplainJob(Job *job, ExplainState *es)
 		ExplainPropertyText("Tasks Shown", tasksShownText->data, es);
 	}
 
+	if (showTaskStats)
+	{
+		ExplainTaskStatsDistribution(taskStatsList, es);
+	}
+
 	/*
 	 * We cannot fetch EXPLAIN plans for jobs that have dependencies, since the
 	 * intermediate tables have not been created.
@@ -268,7 +308,7 @@ ExplainJob(Job *job, ExplainState *es)
 	{
 		ExplainOpenGroup("Tasks", "Tasks", false, es);
 
-		ExplainTaskList(taskList, es);
+		ExplainTaskList(taskList, showTaskStats ? taskStatsList : NIL, es);
 
 		ExplainCloseGroup("Tasks", "Tasks", false, es);
 	}
@@ -294,6 +334,115 @@ ExplainJob(Job *job, ExplainState *es)
 }
 
 
+/*
+ * ExplainTaskStatsDistribution shows the minimum, average, 95th percentile and
+ * maximum of the execution time, connection wait time, rows and bytes received
+ * of the tasks in taskStatsList. Times are only shown if timing is enabled.
+ */
+static void
+ExplainTaskStatsDistribution(List *taskStatsList, ExplainState *es)
+{
+	int taskStatsCount = list_length(taskStatsList);
+	double *executionTimes = palloc0(taskStatsCount * sizeof(double));
+	double *connectionWaitTimes = palloc0(taskStatsCount * sizeof(double));
+	double *rowCounts = palloc0(taskStatsCount * sizeof(double));
+	double *byteCounts = palloc0(taskStatsCount * sizeof(double));
+	ListCell *taskStatsCell = NULL;
+	int taskStatsIndex = 0;
+
+	foreach(taskStatsCell, taskStatsList)
+	{
+		TaskExecutionStats *taskStats = (TaskExecutionStats *) lfirst(taskStatsCell);
+
+		executionTimes[taskStatsIndex] = taskStats->executionTime;
+		connectionWaitTimes[taskStatsIndex] = taskStats->connectionWaitTime;
+		rowCounts[taskStatsIndex] = (double) taskStats->rowCount;
+		byteCounts[taskStatsIndex] = (double) taskStats->bytesReceived;
+
+		taskStatsIndex++;
+	}
+
+	ExplainOpenGroup("Task Statistics", "Task Statistics", true, es);
+
+	if (es->timing)
+	{
+		ExplainValueDistribution("Task Execution Time", executionTimes,
+								 taskStatsCount, 3, " ms", es);
+		ExplainValueDistribution("Connection Wait Time", connectionWaitTimes,
+								 taskStatsCount, 3, " ms", es);
+	}
+
+	ExplainValueDistribution("Rows Received", rowCounts, taskStatsCount, 0, "", es);
+	ExplainValueDistribution("Bytes Received", byteCounts, taskStatsCount, 0, "", es);
+
+	ExplainCloseGroup("Task Statistics", "Task Statistics", true, es);
+
+	pfree(executionTimes);
+	pfree(connectionWaitTimes);
+	pfree(rowCounts);
+	pfree(byteCounts);
+}
+
+
+/*
+ * ExplainValueDistribution shows the minimum, average, 95th percentile and
+ * maximum of the given values, with the given number of fractional digits.
+ * The values are sorted in place.
+ */
+static void
+ExplainValueDistribution(const char *label, double *values, int valueCount,
+						 int digits, const char *unit, ExplainState *es)
+{
+	StringInfo distributionText = makeStringInfo();
+	double valueSum = 0.0;
+	int percentileIndex = 0;
+	int valueIndex = 0;
+
+	Assert(valueCount > 0);
+
+	qsort(values, valueCount, sizeof(double), CompareDoubles);
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		valueSum += values[valueIndex];
+	}
+
+	/* use the nearest-rank method for the percentile */
+	percentileIndex = (int) ceil(0.95 * valueCount) - 1;
+
+	appendStringInfo(distributionText, "min %.*f%s, avg %.*f%s, p95 %.*f%s, max %.*f%s",
+					 digits, values[0], unit,
+					 digits, valueSum / valueCount, unit,
+					 digits, values[percentileIndex], unit,
+					 digits, values[valueCount - 1], unit);
+
+	ExplainPropertyText(label, distributionText->data, es);
+}
+
+
+/*
+ * CompareDoubles is a comparison function for sorting doubles in ascending
+ * order using qsort.
+ */
+static int
+CompareDoubles(const void *leftElement, const void *rightElement)
+{
+	double leftValue = *((const double *) leftElement);
+	double rightValue = *((const double *) rightElement);
+
+	if (leftValue < rightValue)
+	{
+		return -1;
+	}
+	else if (leftValue > rightValue)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
 /*
  * ExplainMapMergeJob shows a very basic EXPLAIN plan for a MapMergeJob. It does
  * not yet show the EXPLAIN plan for the individual tasks, because this requires
@@ -349,15 +498,27 @@ ExplainMapMergeJob(MapMergeJob *mapMergeJob, ExplainState *es)
 
 /*
  * ExplainTaskList shows the remote EXPLAIN for the first task in taskList,
- * or all tasks if citus.explain_all_tasks is on.
+ * or all tasks if citus.explain_all_tasks is on. If the execution statistics
+ * of the tasks are given in taskStatsList, the slowest task is shown instead
+ * of the first, along with its statistics.
  */
 static void
-ExplainTaskList(List *taskList, ExplainState *es)
+ExplainTaskList(List *taskList, List *taskStatsList, ExplainState *es)
 {
 	ListCell *taskCell = NULL;
 	ListCell *remoteExplainCell = NULL;
 	List *remoteExplainList = NIL;
 
+	if (taskStatsList != NIL && !ExplainAllTasks)
+	{
+		Task *slowestTask = SlowestTask(taskList, taskStatsList);
+
+		if (slowestTask != NULL)
+		{
+			taskList = list_make1(slowestTask);
+		}
+	}
+
 	foreach(taskCell, taskList)
 	{
 		Task *task = (Task *) lfirst(taskCell);
@@ -378,12 +539,73 @@ ExplainTaskList(List *taskList, ExplainState *es)
 		RemoteExplainPlan *remoteExplain =
 			(RemoteExplainPlan *) lfirst(remoteExplainCell);
 
+		TaskExecutionStats *taskStats = TaskStatsForTask(task, taskStatsList);
+
 		ExplainTask(task, remoteExplain->placementIndex,
-					remoteExplain->explainOutputList, es);
+					remoteExplain->explainOutputList, taskStats, es);
 	}
 }
 
 
+/*
+ * SlowestTask returns the task in taskList with the longest execution time
+ * in taskStatsList, or NULL if none of the tasks has statistics.
+ */
+static Task *
+SlowestTask(List *taskList, List *taskStatsList)
+{
+	TaskExecutionStats *slowestTaskStats = NULL;
+	ListCell *taskStatsCell = NULL;
+	ListCell *taskCell = NULL;
+
+	foreach(taskStatsCell, taskStatsList)
+	{
+		TaskExecutionStats *taskStats = (TaskExecutionStats *) lfirst(taskStatsCell);
+
+		if (slowestTaskStats == NULL ||
+			taskStats->executionTime > slowestTaskStats->executionTime)
+		{
+			slowestTaskStats = taskStats;
+		}
+	}
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (task->taskId == slowestTaskStats->taskId)
+		{
+			return task;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * TaskStatsForTask returns the execution statistics of the given task in
+ * taskStatsList, or NULL if they were not collected.
+ */
+static TaskExecutionStats *
+TaskStatsForTask(Task *task, List *taskStatsList)
+{
+	ListCell *taskStatsCell = NULL;
+
+	foreach(taskStatsCell, taskStatsList)
+	{
+		TaskExecutionStats *taskStats = (TaskExecutionStats *) lfirst(taskStatsCell);
+
+		if (taskStats->taskId == task->taskId)
+		{
+			return taskStats;
+		}
+	}
+
+	return NULL;
+}
+
+
 /*
  * RemoteExplain fetches the the remote EXPLAIN output for a single
  * task. It tries each shard placement until one succeeds or all
@@ -430,7 +652,7 @@ RemoteExplain(Task *task, ExplainState *es)
 		/*
 		 * Start a savepoint for the explain query. After running the explain
 		 * query, we will rollback to this savepoint. This saves us from side
-		 * effects of EXPLAIN ANALYZE on DML queries.
+		 * effects of the explain query, such as locks being taken.
 		 */
 		ExecuteCriticalRemoteCommand(connection, "SAVEPOINT citus_explain_savepoint");
 
@@ -468,10 +690,12 @@ RemoteExplain(Task *task, ExplainState *es)
 /*
  * ExplainTask shows the EXPLAIN output for an single task. The output has been
  * fetched from the placement at index placementIndex. If explainOutputList is NIL,
- * then the EXPLAIN output could not be fetched from any placement.
+ * then the EXPLAIN output could not be fetched from any placement. If taskStats
+ * is not NULL, the execution statistics of the task are shown as well.
  */
 static void
-ExplainTask(Task *task, int placementIndex, List *explainOutputList, ExplainState *es)
+ExplainTask(Task *task, int placementIndex, List *explainOutputList,
+			TaskExecutionStats *taskStats, ExplainState *es)
 {
 	ExplainOpenGroup("Task", NULL, true, es);
 
@@ -482,6 +706,26 @@ ExplainTask(Task *task, int placementIndex, List *explainOutputList, ExplainStat
 		es->indent += 3;
 	}
 
+	if (taskStats != NULL)
+	{
+		StringInfo rowCountText = makeStringInfo();
+		StringInfo byteCountText = makeStringInfo();
+
+		if (es->timing)
+		{
+			StringInfo executionTimeText = makeStringInfo();
+
+			appendStringInfo(executionTimeText, "%.3f ms", taskStats->executionTime);
+			ExplainPropertyText("Execution Time", executionTimeText->data, es);
+		}
+
+		appendStringInfo(rowCountText, UINT64_FORMAT, taskStats->rowCount);
+		ExplainPropertyText("Rows Received", rowCountText->data, es);
+
+		appendStringInfo(byteCountText, UINT64_FORMAT, taskStats->bytesReceived);
+		ExplainPropertyText("Bytes Received", byteCountText->data, es);
+	}
+
 	if (explainOutputList != NIL)
 	{
 		List *taskPlacementList = task->taskPlacementList;
@@ -589,6 +833,11 @@ ExplainTaskPlacement(ShardPlacement *taskPlacement, List *explainOutputList,
  * BuildRemoteExplainQuery returns an EXPLAIN query string
  * to run on a worker node which explicitly contains all
  * the options in the explain state.
+ *
+ * The query is never analyzed on the worker, since the statistics of
+ * EXPLAIN ANALYZE are collected while executing the distributed query
+ * instead of executing the task a second time. BUFFERS and TIMING
+ * require ANALYZE, so they are disabled as well.
  */
 static StringInfo
 BuildRemoteExplainQuery(char *queryString, ExplainState *es)
@@ -624,14 +873,11 @@ BuildRemoteExplainQuery(char *queryString, ExplainState *es)
 	}
 
 	appendStringInfo(explainQuery,
-					 "EXPLAIN (ANALYZE %s, VERBOSE %s, "
-					 "COSTS %s, BUFFERS %s, TIMING %s, "
+					 "EXPLAIN (ANALYZE FALSE, VERBOSE %s, "
+					 "COSTS %s, BUFFERS FALSE, TIMING FALSE, "
 					 "FORMAT %s) %s",
-					 es->analyze ? "TRUE" : "FALSE",
 					 es->verbose ? "TRUE" : "FALSE",
 					 es->costs ? "TRUE" : "FALSE",
-					 es->buffers ? "TRUE" : "FALSE",
-					 es->timing ? "TRUE" : "FALSE",
 					 formatStr,
 					 queryString);
 
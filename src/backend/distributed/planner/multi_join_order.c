@@ -18,12 +18,15 @@
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "catalog/pg_am.h"
+#include "distributed/column_statistics.h"
+#include "distributed/master_metadata_utility.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/worker_protocol.h"
 #include "lib/stringinfo.h"
+#include "optimizer/plancat.h"
 #include "optimizer/var.h"
 #include "nodes/nodeFuncs.h"
 #include "utils/builtins.h"
@@ -36,6 +39,24 @@
 /* Config variables managed via guc.c */
 int LargeTableShardCount = 4;   /* shard counts for a large table */
 bool LogMultiJoinOrder = false; /* print join order as a debugging aid */
+int JoinOrderSearchLimit = 0;   /* max table count for searching all join orders */
+
+
+/*
+ * JoinOrderSearchState keeps the state of the search over all join orders for
+ * the one that transfers the least amount of data. Table sizes are indexed by
+ * range table id.
+ */
+typedef struct JoinOrderSearchState
+{
+	List *tableEntryList;
+	List *joinClauseList;
+	double *tableSizeArray;
+	uint32 maxCartesianProductCount;
+
+	List *bestJoinOrder;
+	double bestTransferCost;
+} JoinOrderSearchState;
 
 /* Function pointer type definition for join rule evaluation functions */
 typedef JoinOrderNode *(*RuleEvalFunction) (JoinOrderNode *currentJoinNode,
@@ -55,6 +76,16 @@ static bool ExtractLeftMostRangeTableIndex(Node *node, int *rangeTableIndex);
 static List * JoinOrderForTable(TableEntry *firstTable, List *tableEntryList,
 								List *joinClauseList);
 static List * BestJoinOrder(List *candidateJoinOrders);
+static List * LowestTransferCostJoinOrder(List *tableEntryList, List *joinClauseList,
+										  List *greedyJoinOrder);
+static void SearchJoinOrders(JoinOrderSearchState *searchState, List *joinOrderList,
+							 List *joinedTableList, double intermediateSize,
+							 double transferCost, uint32 cartesianProductCount);
+static double JoinOrderTransferCost(List *joinOrder, List *tableEntryList,
+								   double *tableSizeArray);
+static double JoinTransferCost(JoinOrderNode *joinNode, List *tableEntryList,
+							   double tableSize, double *intermediateSize);
+static double JoinSizeRatio(JoinOrderNode *joinNode, List *tableEntryList);
 static List * FewestOfJoinRuleType(List *candidateJoinOrders, JoinRuleType ruleType);
 static uint32 JoinRuleTypeCount(List *joinOrder, JoinRuleType ruleTypeToCount);
 static List * LatestLargeDataTransfer(List *candidateJoinOrders);
@@ -412,6 +443,17 @@ JoinOrderList(List *tableEntryList, List *joinClauseList)
 
 	bestJoinOrder = BestJoinOrder(candidateJoinOrderList);
 
+	/*
+	 * For joins between few tables, we look at all join orders to see if one of
+	 * them transfers less data than the one found using the join rules alone.
+	 */
+	if (list_length(tableEntryList) > 2 &&
+		list_length(tableEntryList) <= JoinOrderSearchLimit)
+	{
+		bestJoinOrder = LowestTransferCostJoinOrder(tableEntryList, joinClauseList,
+													bestJoinOrder);
+	}
+
 	/* if logging is enabled, print join order */
 	if (LogMultiJoinOrder)
 	{
@@ -563,6 +605,284 @@ BestJoinOrder(List *candidateJoinOrders)
 }
 
 
+/*
+ * LowestTransferCostJoinOrder searches all left-deep join orders of the given
+ * tables for the one that has the lowest estimated network transfer, and
+ * returns it if it transfers less than the given greedy join order. The
+ * estimate uses the shard lengths in the metadata as table sizes, or the row
+ * counts and widths in the catalog if the shard lengths are unknown. Joins are
+ * treated as key joins, which leave the larger side's row count, unless the
+ * join columns have column statistics (see JoinSizeRatio).
+ *
+ * The search only considers join orders that have as few cartesian products
+ * as the greedy join order, and it stops extending a join order as soon as its
+ * cost reaches the cost of the best one found so far. If the shard lengths are
+ * unknown, all join orders have the same cost and the greedy one is kept.
+ */
+static List *
+LowestTransferCostJoinOrder(List *tableEntryList, List *joinClauseList,
+							List *greedyJoinOrder)
+{
+	JoinOrderSearchState searchState;
+	ListCell *tableEntryCell = NULL;
+	uint32 maxRangeTableId = 0;
+
+	foreach(tableEntryCell, tableEntryList)
+	{
+		TableEntry *tableEntry = (TableEntry *) lfirst(tableEntryCell);
+
+		maxRangeTableId = Max(maxRangeTableId, tableEntry->rangeTableId);
+	}
+
+	memset(&searchState, 0, sizeof(JoinOrderSearchState));
+	searchState.tableEntryList = tableEntryList;
+	searchState.joinClauseList = joinClauseList;
+	searchState.tableSizeArray = palloc0((maxRangeTableId + 1) * sizeof(double));
+	searchState.maxCartesianProductCount = JoinRuleTypeCount(greedyJoinOrder,
+															 CARTESIAN_PRODUCT);
+
+	foreach(tableEntryCell, tableEntryList)
+	{
+		TableEntry *tableEntry = (TableEntry *) lfirst(tableEntryCell);
+		double tableSize = (double) TableShardLength(tableEntry->relationId);
+
+		/* the column statistics also record the row counts of the shards */
+		if (tableSize == 0.0)
+		{
+			tableSize = RelationRowCount(tableEntry->relationId) *
+						get_relation_data_width(tableEntry->relationId, NULL);
+		}
+
+		searchState.tableSizeArray[tableEntry->rangeTableId] = tableSize;
+	}
+
+	searchState.bestJoinOrder = greedyJoinOrder;
+	searchState.bestTransferCost = JoinOrderTransferCost(greedyJoinOrder,
+														 tableEntryList,
+														 searchState.tableSizeArray);
+
+	foreach(tableEntryCell, tableEntryList)
+	{
+		TableEntry *firstTable = (TableEntry *) lfirst(tableEntryCell);
+		Oid firstRelationId = firstTable->relationId;
+		uint32 firstTableId = firstTable->rangeTableId;
+		Var *firstPartitionColumn = PartitionColumn(firstRelationId, firstTableId);
+		char firstPartitionMethod = PartitionMethod(firstRelationId);
+		JoinOrderNode *firstJoinNode = MakeJoinOrderNode(firstTable,
+														 JOIN_RULE_INVALID_FIRST,
+														 firstPartitionColumn,
+														 firstPartitionMethod,
+														 firstTable);
+
+		SearchJoinOrders(&searchState, list_make1(firstJoinNode),
+						 list_make1(firstTable),
+						 searchState.tableSizeArray[firstTableId], 0.0, 0);
+	}
+
+	return searchState.bestJoinOrder;
+}
+
+
+/*
+ * SearchJoinOrders extends the given partial join order with each of the
+ * tables that are not joined yet, and recurses until it finds complete join
+ * orders. Complete join orders that are cheaper than the best one found so far
+ * replace it in the search state.
+ */
+static void
+SearchJoinOrders(JoinOrderSearchState *searchState, List *joinOrderList,
+				 List *joinedTableList, double intermediateSize, double transferCost,
+				 uint32 cartesianProductCount)
+{
+	JoinOrderNode *currentJoinNode = (JoinOrderNode *) llast(joinOrderList);
+	List *pendingTableList = NIL;
+	ListCell *pendingTableCell = NULL;
+
+	if (transferCost >= searchState->bestTransferCost ||
+		cartesianProductCount > searchState->maxCartesianProductCount)
+	{
+		return;
+	}
+
+	if (list_length(joinedTableList) == list_length(searchState->tableEntryList))
+	{
+		searchState->bestJoinOrder = joinOrderList;
+		searchState->bestTransferCost = transferCost;
+		return;
+	}
+
+	pendingTableList = TableEntryListDifference(searchState->tableEntryList,
+												joinedTableList);
+
+	foreach(pendingTableCell, pendingTableList)
+	{
+		TableEntry *pendingTable = (TableEntry *) lfirst(pendingTableCell);
+		double tableSize = searchState->tableSizeArray[pendingTable->rangeTableId];
+		double joinedSize = intermediateSize;
+		double joinTransferCost = 0.0;
+		uint32 joinCartesianProductCount = cartesianProductCount;
+		JoinOrderNode *pendingJoinNode = NULL;
+
+		pendingJoinNode = EvaluateJoinRules(joinedTableList, currentJoinNode,
+											pendingTable, searchState->joinClauseList,
+											JOIN_INNER);
+		joinTransferCost = JoinTransferCost(pendingJoinNode,
+											searchState->tableEntryList, tableSize,
+											&joinedSize);
+
+		if (pendingJoinNode->joinRuleType == CARTESIAN_PRODUCT)
+		{
+			joinCartesianProductCount++;
+		}
+
+		/* partial join orders share their prefixes, so we copy before appending */
+		SearchJoinOrders(searchState,
+						 lappend(list_copy(joinOrderList), pendingJoinNode),
+						 lappend(list_copy(joinedTableList), pendingTable),
+						 joinedSize, transferCost + joinTransferCost,
+						 joinCartesianProductCount);
+	}
+}
+
+
+/*
+ * JoinOrderTransferCost returns the estimated amount of data that the given
+ * join order transfers across the network.
+ */
+static double
+JoinOrderTransferCost(List *joinOrder, List *tableEntryList, double *tableSizeArray)
+{
+	JoinOrderNode *firstJoinNode = (JoinOrderNode *) linitial(joinOrder);
+	double intermediateSize = tableSizeArray[firstJoinNode->tableEntry->rangeTableId];
+	double transferCost = 0.0;
+	ListCell *joinOrderNodeCell = NULL;
+
+	for_each_cell(joinOrderNodeCell, lnext(list_head(joinOrder)))
+	{
+		JoinOrderNode *joinNode = (JoinOrderNode *) lfirst(joinOrderNodeCell);
+		double tableSize = tableSizeArray[joinNode->tableEntry->rangeTableId];
+
+		transferCost += JoinTransferCost(joinNode, tableEntryList, tableSize,
+										 &intermediateSize);
+	}
+
+	return transferCost;
+}
+
+
+/*
+ * JoinTransferCost returns the estimated amount of data that joining the
+ * intermediate result with the next table in the join order transfers, and
+ * updates the intermediate result size with the estimated size of the join.
+ */
+static double
+JoinTransferCost(JoinOrderNode *joinNode, List *tableEntryList, double tableSize,
+				 double *intermediateSize)
+{
+	double transferCost = 0.0;
+
+	switch (joinNode->joinRuleType)
+	{
+		case SINGLE_PARTITION_JOIN:
+		{
+			/* the side that is not the anchor table gets repartitioned */
+			if (joinNode->anchorTable == joinNode->tableEntry)
+			{
+				transferCost = *intermediateSize;
+			}
+			else
+			{
+				transferCost = tableSize;
+			}
+
+			break;
+		}
+
+		case DUAL_PARTITION_JOIN:
+		{
+			transferCost = *intermediateSize + tableSize;
+			break;
+		}
+
+		case CARTESIAN_PRODUCT:
+		{
+			transferCost = (*intermediateSize) * tableSize;
+			break;
+		}
+
+		default:
+		{
+			/* reference and local joins do not transfer data */
+			break;
+		}
+	}
+
+	if (joinNode->joinRuleType == CARTESIAN_PRODUCT)
+	{
+		*intermediateSize = (*intermediateSize) * tableSize;
+	}
+	else
+	{
+		*intermediateSize = Max(*intermediateSize, tableSize) *
+							JoinSizeRatio(joinNode, tableEntryList);
+	}
+
+	return transferCost;
+}
+
+
+/*
+ * JoinSizeRatio returns the estimated size of the given join relative to the
+ * size of its larger side. Without column statistics, we assume a key join,
+ * which returns as many rows as the larger side. Otherwise, we estimate the
+ * row count of the join like the PostgreSQL planner does for an equi-join,
+ * as the product of the row counts divided by the larger distinct count of
+ * the join columns, and divide it by the larger row count. We use the first
+ * join clause whose columns both have statistics.
+ */
+static double
+JoinSizeRatio(JoinOrderNode *joinNode, List *tableEntryList)
+{
+	ListCell *joinClauseCell = NULL;
+
+	foreach(joinClauseCell, joinNode->joinClauseList)
+	{
+		OpExpr *joinClause = (OpExpr *) lfirst(joinClauseCell);
+		Var *leftColumn = LeftColumn(joinClause);
+		Var *rightColumn = RightColumn(joinClause);
+		TableEntry *leftTable = FindTableEntry(tableEntryList, leftColumn->varno);
+		TableEntry *rightTable = FindTableEntry(tableEntryList, rightColumn->varno);
+		double leftRowCount = 0.0;
+		double rightRowCount = 0.0;
+		double leftDistinctCount = 0.0;
+		double rightDistinctCount = 0.0;
+
+		if (leftTable == NULL || rightTable == NULL)
+		{
+			continue;
+		}
+
+		leftRowCount = RelationRowCount(leftTable->relationId);
+		rightRowCount = RelationRowCount(rightTable->relationId);
+		leftDistinctCount = ColumnDistinctCount(leftTable->relationId,
+												leftColumn->varattno);
+		rightDistinctCount = ColumnDistinctCount(rightTable->relationId,
+												 rightColumn->varattno);
+
+		if (leftRowCount <= 0 || rightRowCount <= 0 || leftDistinctCount <= 0 ||
+			rightDistinctCount <= 0)
+		{
+			continue;
+		}
+
+		return Min(leftRowCount, rightRowCount) /
+			   Max(leftDistinctCount, rightDistinctCount);
+	}
+
+	return 1.0;
+}
+
+
 /*
  * FewestOfJoinRuleType finds join orders that have the fewest number of times
  * the given join rule occurs in the candidate join orders, and filters all
@@ -22,6 +22,7 @@
 #include "catalog/namespace.h"
 #include "catalog/pg_aggregate.h"
 #include "catalog/pg_am.h"
+#include "catalog/pg_collation.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
 #include "commands/extension.h"
@@ -32,6 +33,7 @@
 #include "distributed/multi_logical_optimizer.h"
 #include "distributed/multi_logical_planner.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/multi_server_executor.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/worker_protocol.h"
 #include "nodes/makefuncs.h"
@@ -42,6 +44,7 @@
 #include "optimizer/var.h"
 #include "parser/parse_agg.h"
 #include "parser/parse_coerce.h"
+#include "parser/parse_func.h"
 #include "parser/parse_oper.h"
 #include "parser/parsetree.h"
 #include "utils/builtins.h"
@@ -58,6 +61,7 @@
 /* Config variable managed via guc.c */
 int LimitClauseRowFetchCount = -1; /* number of rows to fetch from each task */
 double CountDistinctErrorRate = 0.0; /* precision of count(distinct) approximate */
+bool EnableRepartitionedGroupBy = false; /* finish grouping on the workers */
 
 
 typedef struct MasterAggregateWalkerContext
@@ -117,6 +121,11 @@ static void ApplyExtendedOpNodes(MultiExtendedOp *originalNode,
 								 MultiExtendedOp *masterNode,
 								 MultiExtendedOp *workerNode);
 static void TransformSubqueryNode(MultiTable *subqueryNode, List *tableNodeList);
+static bool CanRepartitionGroupBy(MultiExtendedOp *originalOpNode,
+								  bool groupedByDisjointPartitionColumn,
+								  List *tableNodeList);
+static void RepartitionGroupBy(MultiExtendedOp *masterExtendedOpNode);
+static List * ReduceOutputTargetList(List *reduceTargetList);
 static MultiExtendedOp * MasterExtendedOpNode(MultiExtendedOp *originalOpNode,
 											  bool groupedByDisjointPartitionColumn,
 											  List *tableNodeList);
@@ -141,9 +150,14 @@ static bool WorkerAggregateWalker(Node *node,
 static List * WorkerAggregateExpressionList(Aggref *originalAggregate,
 											WorkerAggregateWalkerContext *walkerContextry);
 static AggregateType GetAggregateType(Oid aggFunctionId);
+static bool AggregateEnabledCustom(Oid aggFunctionId);
 static Oid AggregateArgumentType(Aggref *aggregate);
 static Oid AggregateFunctionOid(const char *functionName, Oid inputType);
 static Oid TypeOid(Oid schemaId, const char *typeName);
+static Oid ExtensionFunctionOid(const char *extensionName, const char *functionName,
+								List *argumentTypeList);
+static Oid ExtensionTypeOid(const char *extensionName, const char *typeName);
+static bool WorkerAggregateIsPartial(AggregateType aggregateType);
 static SortGroupClause * CreateSortGroupClause(Var *column);
 
 /* Local functions forward declarations for count(distinct) approximations */
@@ -157,6 +171,9 @@ static void ErrorIfContainsUnsupportedAggregate(MultiNode *logicalPlanNode);
 static void ErrorIfUnsupportedArrayAggregate(Aggref *arrayAggregateExpression);
 static void ErrorIfUnsupportedJsonAggregate(AggregateType type,
 											Aggref *aggregateExpression);
+static void ErrorIfUnsupportedCustomAggregate(Aggref *aggregateExpression);
+static void ErrorIfUnsupportedSketchAggregate(AggregateType type,
+											  Aggref *aggregateExpression);
 static void ErrorIfUnsupportedJsonObjectAggregate(AggregateType type,
 												  Aggref *aggregateExpression);
 static void ErrorIfUnsupportedAggregateDistinct(Aggref *aggregateExpression,
@@ -181,6 +198,7 @@ static bool HasOrderByAggregate(List *sortClauseList, List *targetList);
 static bool HasOrderByAverage(List *sortClauseList, List *targetList);
 static bool HasOrderByComplexExpression(List *sortClauseList, List *targetList);
 static bool HasOrderByHllType(List *sortClauseList, List *targetList);
+static bool HasDistinctOnAggregate(List *distinctClauseList, List *targetList);
 
 
 /*
@@ -194,13 +212,16 @@ static bool HasOrderByHllType(List *sortClauseList, List *targetList);
  * to return to the user, or aggregate expressions used by the aggregate node.
  * Third, the function pulls up the collect operators in the tree. Fourth, the
  * function finds the extended operator node, and splits this node into master
- * and worker extended operator nodes.
+ * and worker extended operator nodes. If enabled, the function finally moves
+ * the master's grouping to the workers by repartitioning the worker results on
+ * a group by column.
  */
 void
 MultiLogicalPlanOptimize(MultiTreeRoot *multiLogicalPlan)
 {
 	bool hasOrderByHllType = false;
 	bool groupedByDisjointPartitionColumn = false;
+	bool repartitionGroupBy = false;
 	List *selectNodeList = NIL;
 	List *projectNodeList = NIL;
 	List *collectNodeList = NIL;
@@ -285,6 +306,9 @@ MultiLogicalPlanOptimize(MultiTreeRoot *multiLogicalPlan)
 	workerExtendedOpNode = WorkerExtendedOpNode(extendedOpNode,
 												groupedByDisjointPartitionColumn,
 												tableNodeList);
+	repartitionGroupBy = CanRepartitionGroupBy(extendedOpNode,
+											   groupedByDisjointPartitionColumn,
+											   tableNodeList);
 
 	ApplyExtendedOpNodes(extendedOpNode, masterExtendedOpNode, workerExtendedOpNode);
 
@@ -298,6 +322,11 @@ MultiLogicalPlanOptimize(MultiTreeRoot *multiLogicalPlan)
 		}
 	}
 
+	if (repartitionGroupBy)
+	{
+		RepartitionGroupBy(masterExtendedOpNode);
+	}
+
 	/*
 	 * When enabled, count(distinct) approximation uses hll as the intermediate
 	 * data type. We currently have a mismatch between hll target entry and sort
@@ -1244,6 +1273,225 @@ TransformSubqueryNode(MultiTable *subqueryNode, List *tableNodeList)
 }
 
 
+/*
+ * CanRepartitionGroupBy returns true if the user enabled repartitioned grouping,
+ * and the master aggregation of the given extended operator node can run on the
+ * workers after we hash repartition the worker results on the first group by
+ * column. Since all rows of a group then end up in the same partition, each
+ * merge task computes final groups, and the master only concatenates them.
+ *
+ * We only repartition when it pays off and our map/merge machinery supports the
+ * query: the query needs to group on columns other than the partition column,
+ * must not have distinct aggregates, window functions, or subqueries, and may
+ * not order by columns that are not in the target list. The reduce query also
+ * resolves master columns through the first range table, so we need that table.
+ */
+static bool
+CanRepartitionGroupBy(MultiExtendedOp *originalOpNode,
+					  bool groupedByDisjointPartitionColumn,
+					  List *tableNodeList)
+{
+	List *groupClauseList = originalOpNode->groupClauseList;
+	List *targetEntryList = originalOpNode->targetList;
+	SortGroupClause *firstGroupClause = NULL;
+	List *aggregateList = NIL;
+	ListCell *aggregateCell = NULL;
+	ListCell *sortClauseCell = NULL;
+	ListCell *tableNodeCell = NULL;
+	bool hasFirstRangeTable = false;
+
+	if (!EnableRepartitionedGroupBy)
+	{
+		return false;
+	}
+
+	/* map/merge jobs only run on the task-tracker executor */
+	if (TaskExecutorType != MULTI_EXECUTOR_TASK_TRACKER && !EnableRepartitionJoins &&
+		!EnableExecutorSelection)
+	{
+		return false;
+	}
+
+	if (groupClauseList == NIL || groupedByDisjointPartitionColumn ||
+		originalOpNode->hasWindowFuncs)
+	{
+		return false;
+	}
+
+	/* we hash partition on the first group by column */
+	firstGroupClause = (SortGroupClause *) linitial(groupClauseList);
+	if (!firstGroupClause->hashable)
+	{
+		return false;
+	}
+
+	foreach(tableNodeCell, tableNodeList)
+	{
+		MultiTable *tableNode = (MultiTable *) lfirst(tableNodeCell);
+		if (tableNode->relationId == SUBQUERY_RELATION_ID ||
+			tableNode->relationId == SUBQUERY_PUSHDOWN_RELATION_ID)
+		{
+			return false;
+		}
+
+		if (tableNode->rangeTableId == 1)
+		{
+			hasFirstRangeTable = true;
+		}
+	}
+
+	if (!hasFirstRangeTable)
+	{
+		return false;
+	}
+
+	aggregateList = pull_var_clause((Node *) targetEntryList, PVC_INCLUDE_AGGREGATES);
+	aggregateList = list_concat(aggregateList,
+								pull_var_clause(originalOpNode->havingQual,
+												PVC_INCLUDE_AGGREGATES));
+	foreach(aggregateCell, aggregateList)
+	{
+		Node *aggregateNode = (Node *) lfirst(aggregateCell);
+		if (IsA(aggregateNode, Aggref) && ((Aggref *) aggregateNode)->aggdistinct != NIL)
+		{
+			return false;
+		}
+	}
+
+	/* the master only sees the columns the merge tasks return */
+	foreach(sortClauseCell, originalOpNode->sortClauseList)
+	{
+		SortGroupClause *sortClause = (SortGroupClause *) lfirst(sortClauseCell);
+		TargetEntry *sortTargetEntry = get_sortgroupclause_tle(sortClause,
+															   targetEntryList);
+		if (sortTargetEntry->resjunk)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * RepartitionGroupBy moves the given master extended operator node's grouping
+ * to the workers. For this, the function turns the master node into the reduce
+ * step of a repartitioned subquery, the same way TransformSubqueryNode() does:
+ * a partition node on the first group by column goes below the master node, and
+ * a subquery table node goes above it. We then add a worker node that returns
+ * the final groups, and a new master node that only orders the groups, applies
+ * distinct and limits them.
+ */
+static void
+RepartitionGroupBy(MultiExtendedOp *masterExtendedOpNode)
+{
+	MultiExtendedOp *reduceNode = masterExtendedOpNode;
+	MultiNode *parentNode = ParentNode((MultiNode *) reduceNode);
+	MultiNode *collectNode = ChildNode((MultiUnaryNode *) reduceNode);
+	MultiExtendedOp *newWorkerNode = CitusMakeNode(MultiExtendedOp);
+	MultiExtendedOp *newMasterNode = CitusMakeNode(MultiExtendedOp);
+	MultiCollect *newCollectNode = CitusMakeNode(MultiCollect);
+	MultiTable *subqueryNode = CitusMakeNode(MultiTable);
+	MultiPartition *partitionNode = CitusMakeNode(MultiPartition);
+	List *groupTargetEntryList = GroupTargetEntryList(reduceNode->groupClauseList,
+													  reduceNode->targetList);
+	TargetEntry *groupByTargetEntry = (TargetEntry *) linitial(groupTargetEntryList);
+	Node *groupByExpression = (Node *) groupByTargetEntry->expr;
+
+	Assert(UnaryOperator(parentNode));
+	Assert(CitusIsA(collectNode, MultiCollect));
+
+	/*
+	 * We only need the partition column's type to partition the worker results;
+	 * the map tasks find the column through the worker query's group clause.
+	 */
+	partitionNode->partitionColumn = makeVar(0, InvalidAttrNumber,
+											 exprType(groupByExpression),
+											 exprTypmod(groupByExpression),
+											 exprCollation(groupByExpression), 0);
+
+	subqueryNode->relationId = SUBQUERY_RELATION_ID;
+	subqueryNode->rangeTableId = SUBQUERY_RANGE_TABLE_ID;
+	subqueryNode->partitionColumn = NULL;
+	subqueryNode->alias = NULL;
+	subqueryNode->referenceNames = NULL;
+
+	newWorkerNode->targetList = ReduceOutputTargetList(reduceNode->targetList);
+
+	newMasterNode->targetList = ReduceOutputTargetList(reduceNode->targetList);
+	newMasterNode->sortClauseList = reduceNode->sortClauseList;
+	newMasterNode->distinctClause = reduceNode->distinctClause;
+	newMasterNode->hasDistinctOn = reduceNode->hasDistinctOn;
+	newMasterNode->limitCount = reduceNode->limitCount;
+	newMasterNode->limitOffset = reduceNode->limitOffset;
+
+	/*
+	 * Groups are complete within each merge task, so a merge task can apply the
+	 * limit on its own groups. Distinct and offset need to see all groups, so we
+	 * leave them to the master.
+	 */
+	reduceNode->distinctClause = NIL;
+	reduceNode->hasDistinctOn = false;
+	if (reduceNode->limitCount == NULL || reduceNode->limitOffset != NULL ||
+		newMasterNode->distinctClause != NIL)
+	{
+		reduceNode->sortClauseList = NIL;
+		reduceNode->limitCount = NULL;
+	}
+	reduceNode->limitOffset = NULL;
+
+	SetChild((MultiUnaryNode *) parentNode, (MultiNode *) newMasterNode);
+	SetChild((MultiUnaryNode *) newMasterNode, (MultiNode *) newCollectNode);
+	SetChild((MultiUnaryNode *) newCollectNode, (MultiNode *) newWorkerNode);
+	SetChild((MultiUnaryNode *) newWorkerNode, (MultiNode *) subqueryNode);
+	SetChild((MultiUnaryNode *) subqueryNode, (MultiNode *) reduceNode);
+	SetChild((MultiUnaryNode *) reduceNode, (MultiNode *) partitionNode);
+	SetChild((MultiUnaryNode *) partitionNode, collectNode);
+}
+
+
+/*
+ * ReduceOutputTargetList returns a target list that references the columns a
+ * reduce query with the given target list writes into its intermediate table.
+ * The reduce query does not write out junk entries, so we skip over them.
+ */
+static List *
+ReduceOutputTargetList(List *reduceTargetList)
+{
+	List *targetEntryList = NIL;
+	ListCell *targetEntryCell = NULL;
+	const Index tableId = 1;
+	AttrNumber columnId = 1;
+
+	foreach(targetEntryCell, reduceTargetList)
+	{
+		TargetEntry *reduceTargetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		Expr *reduceExpression = reduceTargetEntry->expr;
+		TargetEntry *newTargetEntry = NULL;
+		Var *column = NULL;
+
+		if (reduceTargetEntry->resjunk)
+		{
+			continue;
+		}
+
+		column = makeVar(tableId, columnId, exprType((Node *) reduceExpression),
+						 exprTypmod((Node *) reduceExpression),
+						 exprCollation((Node *) reduceExpression), 0);
+
+		newTargetEntry = makeTargetEntry((Expr *) column, columnId,
+										 reduceTargetEntry->resname, false);
+		newTargetEntry->ressortgroupref = reduceTargetEntry->ressortgroupref;
+
+		targetEntryList = lappend(targetEntryList, newTargetEntry);
+		columnId++;
+	}
+
+	return targetEntryList;
+}
+
+
 /*
  * MasterExtendedOpNode creates the master extended operator node from the given
  * target entries. The function walks over these target entries; and for entries
@@ -1671,6 +1919,107 @@ MasterAggregateExpression(Aggref *originalAggregate,
 
 		newMasterExpression = (Expr *) newMasterAggregate;
 	}
+	else if (aggregateType == AGGREGATE_TOPN_ADD_AGG ||
+			 aggregateType == AGGREGATE_TOPN_UNION_AGG ||
+			 aggregateType == AGGREGATE_TDIGEST ||
+			 aggregateType == AGGREGATE_TDIGEST_PERCENTILE)
+	{
+		/*
+		 * Top-k and percentile approximations are computed in two steps. The
+		 * worker nodes build topn or t-digest sketches over their rows, and we
+		 * union these sketches on the master. For tdigest_percentile(), we
+		 * then compute the percentile from the united t-digest, by calling
+		 * tdigest_percentile(tdigest, quantile) with the original quantile.
+		 */
+		const char *extensionName = NULL;
+		const char *masterAggregateName = NULL;
+		Oid sketchType = InvalidOid;
+		Var *sketchColumn = NULL;
+		List *argumentList = NIL;
+		List *argumentTypeList = NIL;
+		Aggref *newMasterAggregate = NULL;
+
+		if (aggregateType == AGGREGATE_TOPN_ADD_AGG ||
+			aggregateType == AGGREGATE_TOPN_UNION_AGG)
+		{
+			extensionName = TOPN_EXTENSION_NAME;
+			masterAggregateName = TOPN_UNION_AGGREGATE_NAME;
+			sketchType = JSONBOID;
+		}
+		else
+		{
+			extensionName = TDIGEST_EXTENSION_NAME;
+			masterAggregateName = AggregateNames[aggregateType];
+			sketchType = ExtensionTypeOid(TDIGEST_EXTENSION_NAME, TDIGEST_TYPE_NAME);
+		}
+
+		sketchColumn = makeVar(masterTableId, walkerContext->columnId, sketchType, -1,
+							   InvalidOid, columnLevelsUp);
+		walkerContext->columnId++;
+
+		argumentList = list_make1(makeTargetEntry((Expr *) sketchColumn, argumentId,
+												  NULL, false));
+		argumentTypeList = list_make1_oid(sketchType);
+
+		if (aggregateType == AGGREGATE_TDIGEST_PERCENTILE)
+		{
+			TargetEntry *quantileArgument = llast(originalAggregate->args);
+			Expr *quantileExpression = copyObject(quantileArgument->expr);
+			Oid quantileType = exprType((Node *) quantileExpression);
+
+			argumentList = lappend(argumentList,
+								   makeTargetEntry(quantileExpression, argumentId + 1,
+												   NULL, false));
+			argumentTypeList = lappend_oid(argumentTypeList, quantileType);
+		}
+
+		newMasterAggregate = copyObject(originalAggregate);
+		newMasterAggregate->aggfnoid = ExtensionFunctionOid(extensionName,
+															masterAggregateName,
+															argumentTypeList);
+		newMasterAggregate->aggtype = get_func_rettype(newMasterAggregate->aggfnoid);
+		newMasterAggregate->args = argumentList;
+		newMasterAggregate->aggfilter = NULL;
+		newMasterAggregate->aggtranstype = InvalidOid;
+		newMasterAggregate->aggargtypes = argumentTypeList;
+		newMasterAggregate->aggsplit = AGGSPLIT_SIMPLE;
+
+		newMasterExpression = (Expr *) newMasterAggregate;
+	}
+	else if (aggregateType == AGGREGATE_CUSTOM_COMBINE)
+	{
+		/*
+		 * Aggregates with combine functions return their transition states as
+		 * text from the workers. We compute coord_combine_agg(agg, state, NULL)
+		 * on the master to combine the states and finalize the result; the
+		 * third argument only determines the result type.
+		 */
+		const int combineArgumentCount = 3;
+		Oid combineFunctionId = FunctionOid("pg_catalog", COORD_COMBINE_AGGREGATE_NAME,
+											combineArgumentCount);
+		Oid aggregateReturnType = originalAggregate->aggtype;
+		Const *aggregateIdConst = makeConst(OIDOID, -1, InvalidOid, sizeof(Oid),
+											ObjectIdGetDatum(originalAggregate->aggfnoid),
+											false, true);
+		Const *resultTypeConst = makeNullConst(aggregateReturnType, -1, InvalidOid);
+		Var *stateColumn = makeVar(masterTableId, walkerContext->columnId, TEXTOID, -1,
+								   DEFAULT_COLLATION_OID, columnLevelsUp);
+
+		Aggref *newMasterAggregate = copyObject(originalAggregate);
+		newMasterAggregate->aggfnoid = combineFunctionId;
+		newMasterAggregate->args =
+			list_make3(makeTargetEntry((Expr *) aggregateIdConst, 1, NULL, false),
+					   makeTargetEntry((Expr *) stateColumn, 2, NULL, false),
+					   makeTargetEntry((Expr *) resultTypeConst, 3, NULL, false));
+		newMasterAggregate->aggfilter = NULL;
+		newMasterAggregate->aggtranstype = InvalidOid;
+		newMasterAggregate->aggargtypes = list_make3_oid(OIDOID, TEXTOID,
+														 aggregateReturnType);
+		newMasterAggregate->aggsplit = AGGSPLIT_SIMPLE;
+		walkerContext->columnId++;
+
+		newMasterExpression = (Expr *) newMasterAggregate;
+	}
 	else
 	{
 		/*
@@ -2057,6 +2406,23 @@ WorkerExtendedOpNode(MultiExtendedOp *originalOpNode,
 		 */
 		shouldPushdownDistinct = !queryHasAggregates &&
 								 distinctClauseSupersetofGroupClause;
+
+		/*
+		 * If the query is grouped by the partition column, workers return final
+		 * groups, so each worker can already pick its first row per DISTINCT ON
+		 * key. The master then picks the first among these rows, and since the
+		 * pushed down order starts with the DISTINCT ON keys, a limit on the
+		 * workers also keeps the rows the master needs. We only do this if the
+		 * workers compute the DISTINCT ON keys the same way as the master.
+		 */
+		if (!shouldPushdownDistinct && originalOpNode->hasDistinctOn &&
+			groupedByDisjointPartitionColumn &&
+			!HasDistinctOnAggregate(originalOpNode->distinctClause, targetEntryList))
+		{
+			shouldPushdownDistinct = true;
+			distinctPreventsLimitPushdown = false;
+		}
+
 		if (shouldPushdownDistinct)
 		{
 			workerExtendedOpNode->distinctClause = originalOpNode->distinctClause;
@@ -2446,6 +2812,84 @@ WorkerAggregateExpressionList(Aggref *originalAggregate,
 		workerAggregateList = lappend(workerAggregateList, sumAggregate);
 		workerAggregateList = lappend(workerAggregateList, countAggregate);
 	}
+	else if (aggregateType == AGGREGATE_TDIGEST ||
+			 aggregateType == AGGREGATE_TDIGEST_PERCENTILE)
+	{
+		/*
+		 * If the original aggregate is a t-digest aggregate, we want to compute
+		 * tdigest(value, compression) on worker nodes, or tdigest(tdigest) if
+		 * the aggregate's input already is a t-digest. topn aggregates on the
+		 * other hand are sent as they are.
+		 */
+		Oid tdigestType = ExtensionTypeOid(TDIGEST_EXTENSION_NAME, TDIGEST_TYPE_NAME);
+		TargetEntry *valueArgument = (TargetEntry *) linitial(originalAggregate->args);
+		Oid valueType = exprType((Node *) valueArgument->expr);
+		List *argumentList = list_make1(copyObject(valueArgument));
+		List *argumentTypeList = list_make1_oid(valueType);
+		Aggref *tdigestAggregate = copyObject(originalAggregate);
+
+		if (valueType != tdigestType)
+		{
+			TargetEntry *compressionArgument = lsecond(originalAggregate->args);
+			Oid compressionType = exprType((Node *) compressionArgument->expr);
+
+			argumentList = lappend(argumentList, copyObject(compressionArgument));
+			argumentTypeList = lappend_oid(argumentTypeList, compressionType);
+		}
+
+		tdigestAggregate->aggfnoid = ExtensionFunctionOid(TDIGEST_EXTENSION_NAME,
+														  TDIGEST_AGGREGATE_NAME,
+														  argumentTypeList);
+		tdigestAggregate->aggtype = tdigestType;
+		tdigestAggregate->args = argumentList;
+		tdigestAggregate->aggtranstype = InvalidOid;
+		tdigestAggregate->aggargtypes = argumentTypeList;
+		tdigestAggregate->aggsplit = AGGSPLIT_SIMPLE;
+
+		workerAggregateList = lappend(workerAggregateList, tdigestAggregate);
+	}
+	else if (aggregateType == AGGREGATE_CUSTOM_COMBINE)
+	{
+		/*
+		 * If the original aggregate has a combine function, we compute its
+		 * transition state on worker nodes through worker_partial_agg(agg, var).
+		 * We refer to the aggregate by its qualified signature, since its oid
+		 * may differ between the nodes.
+		 */
+		const int partialArgumentCount = 2;
+		Oid partialFunctionId = FunctionOid("pg_catalog", WORKER_PARTIAL_AGGREGATE_NAME,
+											partialArgumentCount);
+		Oid argumentType = AggregateArgumentType(originalAggregate);
+		TargetEntry *argument = (TargetEntry *) linitial(originalAggregate->args);
+		Oid aggregateId = originalAggregate->aggfnoid;
+		char *aggregateSignature = format_procedure_qualified(aggregateId);
+		Datum aggregateSignatureDatum = CStringGetTextDatum(aggregateSignature);
+		Const *aggregateSignatureConst = makeConst(TEXTOID, -1, DEFAULT_COLLATION_OID, -1,
+												   aggregateSignatureDatum, false, false);
+		CoerceViaIO *aggregateIdExpression = makeNode(CoerceViaIO);
+		RelabelType *aggregateIdArgument = NULL;
+
+		aggregateIdExpression->arg = (Expr *) aggregateSignatureConst;
+		aggregateIdExpression->resulttype = REGPROCEDUREOID;
+		aggregateIdExpression->resultcollid = InvalidOid;
+		aggregateIdExpression->coerceformat = COERCE_EXPLICIT_CAST;
+		aggregateIdExpression->location = -1;
+
+		aggregateIdArgument = makeRelabelType((Expr *) aggregateIdExpression, OIDOID, -1,
+											  InvalidOid, COERCE_IMPLICIT_CAST);
+
+		Aggref *partialAggregate = copyObject(originalAggregate);
+		partialAggregate->aggfnoid = partialFunctionId;
+		partialAggregate->aggtype = TEXTOID;
+		partialAggregate->args =
+			list_make2(makeTargetEntry((Expr *) aggregateIdArgument, 1, NULL, false),
+					   makeTargetEntry(copyObject(argument->expr), 2, NULL, false));
+		partialAggregate->aggtranstype = InvalidOid;
+		partialAggregate->aggargtypes = list_make2_oid(OIDOID, argumentType);
+		partialAggregate->aggsplit = AGGSPLIT_SIMPLE;
+
+		workerAggregateList = lappend(workerAggregateList, partialAggregate);
+	}
 	else
 	{
 		/*
@@ -2497,6 +2941,12 @@ GetAggregateType(Oid aggFunctionId)
 		}
 	}
 
+	/* aggregates we don't know by name may still have a combine function */
+	if (!found && AggregateEnabledCustom(aggFunctionId))
+	{
+		return AGGREGATE_CUSTOM_COMBINE;
+	}
+
 	if (!found)
 	{
 		ereport(ERROR, (errmsg("unsupported aggregate function %s", aggregateProcName)));
@@ -2506,6 +2956,56 @@ GetAggregateType(Oid aggFunctionId)
 }
 
 
+/*
+ * AggregateEnabledCustom returns whether we can push down the given aggregate
+ * using worker_partial_agg() and coord_combine_agg(). For that, the aggregate
+ * needs a combine function, and serialization functions if its transition
+ * state is of type internal. We also require a single argument and no
+ * polymorphic types, since we call the aggregate's support functions
+ * ourselves and cannot resolve polymorphic types for them.
+ */
+static bool
+AggregateEnabledCustom(Oid aggFunctionId)
+{
+	HeapTuple aggregateTuple = NULL;
+	Form_pg_aggregate aggregateForm = NULL;
+	Oid *argumentTypes = NULL;
+	int argumentCount = 0;
+	Oid returnType = InvalidOid;
+	bool supportsCombine = false;
+
+	aggregateTuple = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggFunctionId));
+	if (!HeapTupleIsValid(aggregateTuple))
+	{
+		return false;
+	}
+
+	aggregateForm = (Form_pg_aggregate) GETSTRUCT(aggregateTuple);
+	supportsCombine = aggregateForm->aggkind == AGGKIND_NORMAL &&
+					  aggregateForm->aggcombinefn != InvalidOid &&
+					  !IsPolymorphicType(aggregateForm->aggtranstype);
+
+	if (aggregateForm->aggtranstype == INTERNALOID &&
+		(aggregateForm->aggserialfn == InvalidOid ||
+		 aggregateForm->aggdeserialfn == InvalidOid))
+	{
+		supportsCombine = false;
+	}
+
+	ReleaseSysCache(aggregateTuple);
+
+	if (!supportsCombine)
+	{
+		return false;
+	}
+
+	returnType = get_func_signature(aggFunctionId, &argumentTypes, &argumentCount);
+
+	return argumentCount == 1 && !IsPolymorphicType(argumentTypes[0]) &&
+		   !IsPolymorphicType(returnType);
+}
+
+
 /* Extracts the type of the argument over which the aggregate is operating. */
 static Oid
 AggregateArgumentType(Aggref *aggregate)
@@ -2632,6 +3132,68 @@ TypeOid(Oid schemaId, const char *typeName)
 }
 
 
+/*
+ * ExtensionFunctionOid looks up the function with the given name and argument
+ * types in the schema of the given extension, and returns its oid. The
+ * function errors out if the extension or the function does not exist.
+ */
+static Oid
+ExtensionFunctionOid(const char *extensionName, const char *functionName,
+					 List *argumentTypeList)
+{
+	Oid extensionId = get_extension_oid(extensionName, false);
+	Oid schemaId = get_extension_schema(extensionId);
+	char *schemaName = get_namespace_name(schemaId);
+	List *qualifiedFunctionName = list_make2(makeString(schemaName),
+											 makeString(pstrdup(functionName)));
+	int argumentCount = list_length(argumentTypeList);
+	Oid *argumentTypes = palloc0(Max(argumentCount, 1) * sizeof(Oid));
+	ListCell *argumentTypeCell = NULL;
+	int argumentIndex = 0;
+	const bool missingOK = false;
+
+	foreach(argumentTypeCell, argumentTypeList)
+	{
+		argumentTypes[argumentIndex] = lfirst_oid(argumentTypeCell);
+		argumentIndex++;
+	}
+
+	return LookupFuncName(qualifiedFunctionName, argumentCount, argumentTypes,
+						  missingOK);
+}
+
+
+/*
+ * ExtensionTypeOid returns the oid of the type with the given name in the
+ * schema of the given extension.
+ */
+static Oid
+ExtensionTypeOid(const char *extensionName, const char *typeName)
+{
+	Oid extensionId = get_extension_oid(extensionName, false);
+	Oid schemaId = get_extension_schema(extensionId);
+
+	return TypeOid(schemaId, typeName);
+}
+
+
+/*
+ * WorkerAggregateIsPartial returns whether the worker nodes compute something
+ * other than the aggregate's value for the given aggregate type, such that
+ * ordering the worker results by the aggregate would be meaningless.
+ */
+static bool
+WorkerAggregateIsPartial(AggregateType aggregateType)
+{
+	return aggregateType == AGGREGATE_AVERAGE ||
+		   aggregateType == AGGREGATE_TOPN_ADD_AGG ||
+		   aggregateType == AGGREGATE_TOPN_UNION_AGG ||
+		   aggregateType == AGGREGATE_TDIGEST ||
+		   aggregateType == AGGREGATE_TDIGEST_PERCENTILE ||
+		   aggregateType == AGGREGATE_CUSTOM_COMBINE;
+}
+
+
 /*
  * GroupedByDisjointPartitionColumn returns true if the query is grouped by the
  * partition column of a table whose shards have disjoint sets of partition values.
@@ -2860,6 +3422,17 @@ ErrorIfContainsUnsupportedAggregate(MultiNode *logicalPlanNode)
 		{
 			ErrorIfUnsupportedJsonObjectAggregate(aggregateType, aggregateExpression);
 		}
+		else if (aggregateType == AGGREGATE_TOPN_ADD_AGG ||
+				 aggregateType == AGGREGATE_TOPN_UNION_AGG ||
+				 aggregateType == AGGREGATE_TDIGEST ||
+				 aggregateType == AGGREGATE_TDIGEST_PERCENTILE)
+		{
+			ErrorIfUnsupportedSketchAggregate(aggregateType, aggregateExpression);
+		}
+		else if (aggregateType == AGGREGATE_CUSTOM_COMBINE)
+		{
+			ErrorIfUnsupportedCustomAggregate(aggregateExpression);
+		}
 		else if (aggregateExpression->aggdistinct)
 		{
 			ErrorIfUnsupportedAggregateDistinct(aggregateExpression, logicalPlanNode);
@@ -2919,6 +3492,69 @@ ErrorIfUnsupportedJsonAggregate(AggregateType type,
 }
 
 
+/*
+ * ErrorIfUnsupportedCustomAggregate checks if we can push down the aggregate
+ * expression using the aggregate's combine function. Since the workers only
+ * send the transition states, we cannot apply orderings or distinct clauses
+ * across workers, and error out on those.
+ */
+static void
+ErrorIfUnsupportedCustomAggregate(Aggref *aggregateExpression)
+{
+	const char *name = get_func_name(aggregateExpression->aggfnoid);
+
+	if (aggregateExpression->aggorder)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("%s with order by is unsupported", name)));
+	}
+
+	if (aggregateExpression->aggdistinct)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("%s (distinct) is unsupported", name)));
+	}
+}
+
+
+/*
+ * ErrorIfUnsupportedSketchAggregate checks if we can push down the topn or
+ * t-digest aggregate expression. Since we union the sketches on the master, we
+ * cannot apply orderings or distinct clauses, and we need to be able to compute
+ * the quantile of tdigest_percentile() on the master.
+ */
+static void
+ErrorIfUnsupportedSketchAggregate(AggregateType type, Aggref *aggregateExpression)
+{
+	const char *name = AggregateNames[type];
+
+	if (aggregateExpression->aggorder)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("%s with order by is unsupported", name)));
+	}
+
+	if (aggregateExpression->aggdistinct)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("%s (distinct) is unsupported", name)));
+	}
+
+	if (type == AGGREGATE_TDIGEST_PERCENTILE)
+	{
+		TargetEntry *quantileArgument = llast(aggregateExpression->args);
+		List *columnList = pull_var_clause_default((Node *) quantileArgument->expr);
+
+		if (columnList != NIL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("%s with a quantile that references columns is "
+								   "unsupported", name)));
+		}
+	}
+}
+
+
 /*
  * ErrorIfUnsupportedJsonObjectAggregate checks if we can transform the
  * json object aggregate expression and push it down to the worker node.
@@ -3693,8 +4329,9 @@ GenerateNewTargetEntriesForSortClauses(List *originalTargetList,
 		 * Worker query mutates these target entries to have a naked target entry
 		 * per aggregate function. We want to use original target entries if this
 		 * the case.
-		 * If the original target expression is an avg aggref, we also want to use
-		 * original target entry.
+		 * If the original target expression is an avg aggref or an aggregate we
+		 * push down through its combine function, we also want to use original
+		 * target entry.
 		 */
 		if (!IsA(targetExpr, Aggref))
 		{
@@ -3704,7 +4341,7 @@ GenerateNewTargetEntriesForSortClauses(List *originalTargetList,
 		{
 			Aggref *aggNode = (Aggref *) targetExpr;
 			AggregateType aggregateType = GetAggregateType(aggNode->aggfnoid);
-			if (aggregateType == AGGREGATE_AVERAGE)
+			if (WorkerAggregateIsPartial(aggregateType))
 			{
 				createNewTargetEntry = true;
 			}
@@ -3797,7 +4434,8 @@ HasOrderByAggregate(List *sortClauseList, List *targetList)
 
 /*
  * HasOrderByAverage walks over the given order by clauses, and checks if we
- * have an order by an average. If we do, the function returns true.
+ * have an order by an average, or by another aggregate whose worker result is
+ * not the final value. If we do, the function returns true.
  */
 static bool
 HasOrderByAverage(List *sortClauseList, List *targetList)
@@ -3816,7 +4454,7 @@ HasOrderByAverage(List *sortClauseList, List *targetList)
 			Aggref *aggregate = (Aggref *) sortExpression;
 
 			AggregateType aggregateType = GetAggregateType(aggregate->aggfnoid);
-			if (aggregateType == AGGREGATE_AVERAGE)
+			if (WorkerAggregateIsPartial(aggregateType))
 			{
 				hasOrderByAverage = true;
 				break;
@@ -3903,6 +4541,31 @@ HasOrderByHllType(List *sortClauseList, List *targetList)
 }
 
 
+/*
+ * HasDistinctOnAggregate returns true if any of the given distinct clauses
+ * references a target entry that contains an aggregate. Workers return partial
+ * results for such entries, so they cannot evaluate the distinct clause.
+ */
+static bool
+HasDistinctOnAggregate(List *distinctClauseList, List *targetList)
+{
+	ListCell *distinctClauseCell = NULL;
+
+	foreach(distinctClauseCell, distinctClauseList)
+	{
+		SortGroupClause *distinctClause = (SortGroupClause *) lfirst(distinctClauseCell);
+		Node *distinctExpression = get_sortgroupclause_expr(distinctClause, targetList);
+
+		if (contain_agg_clause(distinctExpression))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 /*
  * IsGroupBySubsetOfDistinct checks whether each clause in group clauses also
  * exists in the distinct clauses. Note that, empty group clause is not a subset
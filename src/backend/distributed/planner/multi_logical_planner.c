@@ -72,6 +72,17 @@ typedef enum RecurringTuplesType
 } RecurringTuplesType;
 
 
+/*
+ * QueryAncestorContext is used to find the queries that contain a given
+ * subquery, from the top-level query down to the subquery's parent.
+ */
+typedef struct QueryAncestorContext
+{
+	Query *subquery;
+	List *ancestorList;
+} QueryAncestorContext;
+
+
 /* Function pointer type definition for apply join rule functions */
 typedef MultiNode *(*RuleApplyFunction) (MultiNode *leftNode, MultiNode *rightNode,
 										 Var *partitionColumn, JoinType joinType,
@@ -86,9 +97,16 @@ static DeferredErrorMessage * DeferErrorIfUnsupportedSubqueryPushdown(Query *
 																	  *
 																	  plannerRestrictionContext);
 static DeferredErrorMessage * DeferErrorIfFromClauseRecurs(Query *queryTree);
+static bool SubqueryCorrelatedOnPartitionColumn(Query *originalQuery,
+												Query *subqueryTree);
+static bool IsOuterQueryColumn(Node *node);
+static bool HashPartitionColumn(Var *column, List *parentQueryList, Query *query,
+								Oid *relationId);
+static bool FindQueryAncestorsWalker(Node *node, QueryAncestorContext *context);
 static bool ExtractSetOperationStatmentWalker(Node *node, List **setOperationList);
 static DeferredErrorMessage * DeferErrorIfUnsupportedTableCombination(Query *queryTree);
 static bool WindowPartitionOnDistributionColumn(Query *query);
+static bool TargetListEqualsPartitionColumn(Query *query, List *targetEntryList);
 static bool AllTargetExpressionsAreColumnReferences(List *targetEntryList);
 static FieldSelect * CompositeFieldRecursive(Expr *expression, Query *query);
 static bool FullCompositeFieldList(List *compositeFieldList);
@@ -631,8 +649,11 @@ DeferErrorIfUnsupportedSubqueryPushdown(Query *originalQuery,
 	foreach(subqueryCell, subqueryList)
 	{
 		Query *subquery = lfirst(subqueryCell);
-		error = DeferErrorIfCannotPushdownSubquery(subquery,
-												   outerMostQueryHasLimit);
+		bool correlatedOnPartitionColumn =
+			SubqueryCorrelatedOnPartitionColumn(originalQuery, subquery);
+
+		error = DeferErrorIfCannotPushdownSubquery(subquery, outerMostQueryHasLimit,
+												   correlatedOnPartitionColumn);
 		if (error)
 		{
 			return error;
@@ -761,9 +782,16 @@ DeferErrorIfFromClauseRecurs(Query *queryTree)
  * a subquery has a group by on another subquery which includes order by with
  * limit, we let this query to run, but results could be wrong depending on the
  * features of underlying tables.
+ *
+ * If correlatedOnPartitionColumn is set, the subquery filters its partition
+ * column by the partition column of a colocated table in an outer query. Each
+ * time it runs, it then only sees rows of a single distribution value, which
+ * are in the same shard as the outer row. The subquery can therefore apply
+ * limits, aggregates, grouping and window functions within the shard.
  */
 DeferredErrorMessage *
-DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLimit)
+DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLimit,
+								   bool correlatedOnPartitionColumn)
 {
 	bool preconditionsSatisfied = true;
 	char *errorDetail = NULL;
@@ -784,7 +812,7 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 					  "functions";
 	}
 
-	if (subqueryTree->limitOffset)
+	if (subqueryTree->limitOffset && !correlatedOnPartitionColumn)
 	{
 		preconditionsSatisfied = false;
 		errorDetail = "Offset clause is currently unsupported when a subquery "
@@ -792,7 +820,7 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 	}
 
 	/* limit is not supported when SubqueryPushdown is not set */
-	if (subqueryTree->limitCount && !SubqueryPushdown)
+	if (subqueryTree->limitCount && !SubqueryPushdown && !correlatedOnPartitionColumn)
 	{
 		preconditionsSatisfied = false;
 		errorDetail = "Limit in subquery is currently unsupported when a "
@@ -803,7 +831,8 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 	 * Limit is partially supported when SubqueryPushdown is set.
 	 * The outermost query must have a limit clause.
 	 */
-	if (subqueryTree->limitCount && SubqueryPushdown && !outerMostQueryHasLimit)
+	if (subqueryTree->limitCount && SubqueryPushdown && !outerMostQueryHasLimit &&
+		!correlatedOnPartitionColumn)
 	{
 		preconditionsSatisfied = false;
 		errorDetail = "Limit in subquery without limit in the outermost query is "
@@ -838,7 +867,7 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 	}
 
 	/* group clause list must include partition column */
-	if (subqueryTree->groupClause)
+	if (subqueryTree->groupClause && !correlatedOnPartitionColumn)
 	{
 		List *groupClauseList = subqueryTree->groupClause;
 		List *targetEntryList = subqueryTree->targetList;
@@ -859,15 +888,16 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 	 * We support window functions when the window function
 	 * is partitioned on distribution column.
 	 */
-	if (subqueryTree->hasWindowFuncs && !SafeToPushdownWindowFunction(subqueryTree,
-																	  &errorInfo))
+	if (subqueryTree->hasWindowFuncs && !correlatedOnPartitionColumn &&
+		!SafeToPushdownWindowFunction(subqueryTree, &errorInfo))
 	{
 		errorDetail = (char *) errorInfo->data;
 		preconditionsSatisfied = false;
 	}
 
 	/* we don't support aggregates without group by */
-	if (subqueryTree->hasAggs && (subqueryTree->groupClause == NULL))
+	if (subqueryTree->hasAggs && (subqueryTree->groupClause == NULL) &&
+		!correlatedOnPartitionColumn)
 	{
 		preconditionsSatisfied = false;
 		errorDetail = "Aggregates without group by are currently unsupported "
@@ -875,7 +905,8 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 	}
 
 	/* having clause without group by on partition column is not supported */
-	if (subqueryTree->havingQual && (subqueryTree->groupClause == NULL))
+	if (subqueryTree->havingQual && (subqueryTree->groupClause == NULL) &&
+		!correlatedOnPartitionColumn)
 	{
 		preconditionsSatisfied = false;
 		errorDetail = "Having qual without group by on partition column is "
@@ -884,7 +915,7 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 	}
 
 	/* distinct clause list must include partition column */
-	if (subqueryTree->distinctClause)
+	if (subqueryTree->distinctClause && !correlatedOnPartitionColumn)
 	{
 		List *distinctClauseList = subqueryTree->distinctClause;
 		List *targetEntryList = subqueryTree->targetList;
@@ -920,6 +951,193 @@ DeferErrorIfCannotPushdownSubquery(Query *subqueryTree, bool outerMostQueryHasLi
 }
 
 
+/*
+ * SubqueryCorrelatedOnPartitionColumn returns true if the WHERE clause of the
+ * given subquery requires the partition column of one of its tables to equal
+ * the partition column of a colocated table in an outer query, as in a LATERAL
+ * subquery that picks the last events of each user. The original query is the
+ * top-level query that contains the subquery.
+ */
+static bool
+SubqueryCorrelatedOnPartitionColumn(Query *originalQuery, Query *subqueryTree)
+{
+	QueryAncestorContext ancestorContext;
+	List *qualifierList = NIL;
+	ListCell *qualifierCell = NULL;
+
+	if (subqueryTree->jointree == NULL || subqueryTree->jointree->quals == NULL ||
+		subqueryTree->setOperations != NULL)
+	{
+		return false;
+	}
+
+	ancestorContext.subquery = subqueryTree;
+	ancestorContext.ancestorList = NIL;
+	if (!FindQueryAncestorsWalker((Node *) originalQuery, &ancestorContext))
+	{
+		return false;
+	}
+
+	qualifierList = make_ands_implicit((Expr *) subqueryTree->jointree->quals);
+
+	foreach(qualifierCell, qualifierList)
+	{
+		OpExpr *operatorExpression = NULL;
+		Node *leftArgument = NULL;
+		Node *rightArgument = NULL;
+		Var *innerColumn = NULL;
+		Var *outerColumn = NULL;
+		List *outerParentQueryList = NIL;
+		Query *outerQuery = NULL;
+		int outerQueryIndex = 0;
+		Oid innerRelationId = InvalidOid;
+		Oid outerRelationId = InvalidOid;
+
+		if (!IsA(lfirst(qualifierCell), OpExpr))
+		{
+			continue;
+		}
+
+		operatorExpression = (OpExpr *) lfirst(qualifierCell);
+		if (list_length(operatorExpression->args) != 2 ||
+			!OperatorImplementsEquality(operatorExpression->opno))
+		{
+			continue;
+		}
+
+		leftArgument = strip_implicit_coercions(linitial(operatorExpression->args));
+		rightArgument = strip_implicit_coercions(lsecond(operatorExpression->args));
+
+		if (IsOuterQueryColumn(leftArgument) && IsA(rightArgument, Var))
+		{
+			outerColumn = (Var *) leftArgument;
+			innerColumn = (Var *) rightArgument;
+		}
+		else if (IsOuterQueryColumn(rightArgument) && IsA(leftArgument, Var))
+		{
+			outerColumn = (Var *) rightArgument;
+			innerColumn = (Var *) leftArgument;
+		}
+		else
+		{
+			continue;
+		}
+
+		if (innerColumn->varlevelsup != 0 ||
+			outerColumn->varlevelsup > list_length(ancestorContext.ancestorList))
+		{
+			continue;
+		}
+
+		if (!HashPartitionColumn(innerColumn, list_copy(ancestorContext.ancestorList),
+								 subqueryTree, &innerRelationId))
+		{
+			continue;
+		}
+
+		/* resolve the outer column within the query it belongs to */
+		outerQueryIndex = list_length(ancestorContext.ancestorList) -
+						  outerColumn->varlevelsup;
+		outerQuery = (Query *) list_nth(ancestorContext.ancestorList, outerQueryIndex);
+		outerParentQueryList = list_truncate(list_copy(ancestorContext.ancestorList),
+											 outerQueryIndex);
+
+		outerColumn = copyObject(outerColumn);
+		outerColumn->varlevelsup = 0;
+
+		if (!HashPartitionColumn(outerColumn, outerParentQueryList, outerQuery,
+								 &outerRelationId))
+		{
+			continue;
+		}
+
+		if (TablesColocated(innerRelationId, outerRelationId))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * IsOuterQueryColumn returns true if the given node is a column of an outer
+ * query.
+ */
+static bool
+IsOuterQueryColumn(Node *node)
+{
+	return IsA(node, Var) && ((Var *) node)->varlevelsup > 0;
+}
+
+
+/*
+ * HashPartitionColumn returns true if the given column of the given query refers
+ * to the partition column of a hash distributed table, whose identifier it then
+ * returns in relationId.
+ */
+static bool
+HashPartitionColumn(Var *column, List *parentQueryList, Query *query, Oid *relationId)
+{
+	Var *referencedColumn = NULL;
+	Var *partitionColumn = NULL;
+
+	FindReferencedTableColumn((Expr *) column, parentQueryList, query, relationId,
+							  &referencedColumn);
+
+	if (*relationId == InvalidOid || referencedColumn == NULL ||
+		!IsDistributedTable(*relationId) ||
+		PartitionMethod(*relationId) != DISTRIBUTE_BY_HASH)
+	{
+		return false;
+	}
+
+	partitionColumn = DistPartitionKey(*relationId);
+
+	return partitionColumn->varattno == referencedColumn->varattno;
+}
+
+
+/*
+ * FindQueryAncestorsWalker walks the given query tree until it finds the
+ * subquery of the context, and keeps the queries that contain the current node
+ * in the ancestor list of the context. The function returns true if it found
+ * the subquery, in which case the ancestor list starts at the top-level query
+ * and ends at the subquery's parent.
+ */
+static bool
+FindQueryAncestorsWalker(Node *node, QueryAncestorContext *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Query))
+	{
+		Query *query = (Query *) node;
+		int ancestorCount = list_length(context->ancestorList);
+
+		if (query == context->subquery)
+		{
+			return true;
+		}
+
+		context->ancestorList = lappend(context->ancestorList, query);
+		if (query_tree_walker(query, FindQueryAncestorsWalker, context, 0))
+		{
+			return true;
+		}
+
+		context->ancestorList = list_truncate(context->ancestorList, ancestorCount);
+		return false;
+	}
+
+	return expression_tree_walker(node, FindQueryAncestorsWalker, context);
+}
+
+
 /*
  * DeferErrorIfUnsupportedUnionQuery is a helper function for ErrorIfCannotPushdownSubquery().
  * The function also errors out for set operations INTERSECT and EXCEPT.
@@ -1182,6 +1400,8 @@ SafeToPushdownWindowFunction(Query *query, StringInfo *errorDetail)
  * or more window functions and at least one of them is not partitioned by
  * distribution column. The function returns false if your window function does not
  * have a partition by clause or it does not include the distribution column.
+ * A partition by column that the query's filters set equal to the distribution
+ * column, such as a reference table column joined on it, counts as well.
  *
  * Please note that if the query does not have a window function, the function
  * returns true.
@@ -1204,7 +1424,8 @@ WindowPartitionOnDistributionColumn(Query *query)
 			GroupTargetEntryList(partitionClauseList, targetEntryList);
 
 		partitionOnDistributionColumn =
-			TargetListOnPartitionColumn(query, groupTargetEntryList);
+			TargetListOnPartitionColumn(query, groupTargetEntryList) ||
+			TargetListEqualsPartitionColumn(query, groupTargetEntryList);
 
 		if (!partitionOnDistributionColumn)
 		{
@@ -1216,6 +1437,114 @@ WindowPartitionOnDistributionColumn(Query *query)
 }
 
 
+/*
+ * TargetListEqualsPartitionColumn checks if at least one target list entry is
+ * a column that an equality filter of the query sets equal to a partition
+ * column. All rows that agree on such an entry then agree on the partition
+ * column, and therefore come from the same shard. We only look at the WHERE
+ * clause and inner join clauses, since outer joins may null out the column.
+ */
+static bool
+TargetListEqualsPartitionColumn(Query *query, List *targetEntryList)
+{
+	List *qualList = InnerJoinQualList((Node *) query->jointree);
+	ListCell *qualCell = NULL;
+
+	foreach(qualCell, qualList)
+	{
+		Node *qual = (Node *) lfirst(qualCell);
+		OpExpr *operatorExpression = NULL;
+		Expr *leftExpression = NULL;
+		Expr *rightExpression = NULL;
+		ListCell *targetEntryCell = NULL;
+
+		if (!IsA(qual, OpExpr) || list_length(((OpExpr *) qual)->args) != 2)
+		{
+			continue;
+		}
+
+		operatorExpression = (OpExpr *) qual;
+		if (!OperatorImplementsEquality(operatorExpression->opno))
+		{
+			continue;
+		}
+
+		leftExpression = (Expr *) strip_implicit_coercions(
+			linitial(operatorExpression->args));
+		rightExpression = (Expr *) strip_implicit_coercions(
+			lsecond(operatorExpression->args));
+
+		foreach(targetEntryCell, targetEntryList)
+		{
+			TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+			Node *targetExpression = strip_implicit_coercions((Node *) targetEntry->expr);
+
+			if (!IsA(targetExpression, Var))
+			{
+				continue;
+			}
+
+			if (equal(targetExpression, leftExpression) &&
+				IsPartitionColumn(rightExpression, query))
+			{
+				return true;
+			}
+
+			if (equal(targetExpression, rightExpression) &&
+				IsPartitionColumn(leftExpression, query))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * InnerJoinQualList returns the implicitly AND'd qualifiers of the given join
+ * tree node, together with the qualifiers of the inner joins below it.
+ */
+List *
+InnerJoinQualList(Node *joinTreeNode)
+{
+	List *qualList = NIL;
+
+	if (joinTreeNode == NULL)
+	{
+		return NIL;
+	}
+
+	if (IsA(joinTreeNode, FromExpr))
+	{
+		FromExpr *fromExpr = (FromExpr *) joinTreeNode;
+		ListCell *fromCell = NULL;
+
+		qualList = make_ands_implicit((Expr *) fromExpr->quals);
+
+		foreach(fromCell, fromExpr->fromlist)
+		{
+			Node *fromNode = (Node *) lfirst(fromCell);
+			qualList = list_concat(qualList, InnerJoinQualList(fromNode));
+		}
+	}
+	else if (IsA(joinTreeNode, JoinExpr))
+	{
+		JoinExpr *joinExpr = (JoinExpr *) joinTreeNode;
+
+		if (joinExpr->jointype == JOIN_INNER)
+		{
+			qualList = make_ands_implicit((Expr *) joinExpr->quals);
+			qualList = list_concat(qualList, InnerJoinQualList(joinExpr->larg));
+			qualList = list_concat(qualList, InnerJoinQualList(joinExpr->rarg));
+		}
+	}
+
+	return qualList;
+}
+
+
 /*
  * TargetListOnPartitionColumn checks if at least one target list entry is on
  * partition column.
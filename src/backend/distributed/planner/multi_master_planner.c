@@ -13,6 +13,7 @@
 
 #include "postgres.h"
 
+#include "distributed/citus_custom_scan.h"
 #include "distributed/multi_logical_optimizer.h"
 #include "distributed/multi_master_planner.h"
 #include "distributed/multi_physical_planner.h"
@@ -32,10 +33,24 @@
 #include "utils/syscache.h"
 
 
+/*
+ * We do not have statistics on the task results, so the number of groups the
+ * master aggregates is at least guessed to be this many, or the task count.
+ */
+#define MIN_MASTER_GROUP_ESTIMATE 10
+
+
+/* config variable managed via guc.c */
+bool EnableSortedMerge = false;
+
+
 static List * MasterTargetList(List *workerTargetList);
+static bool CanMergeSortedTaskResults(DistributedPlan *distributedPlan,
+									  CustomScan *remoteScan);
 static PlannedStmt * BuildSelectStatement(Query *masterQuery, List *masterTargetList,
-										  CustomScan *remoteScan);
-static Agg * BuildAggregatePlan(Query *masterQuery, Plan *subPlan);
+										  CustomScan *remoteScan, bool sortedMerge,
+										  long groupEstimate);
+static Agg * BuildAggregatePlan(Query *masterQuery, Plan *subPlan, long groupEstimate);
 static bool HasDistinctAggregate(Query *masterQuery);
 static Plan * BuildDistinctPlan(Query *masterQuery, Plan *subPlan);
 static List * PrepareTargetListForNextPlan(List *targetList);
@@ -48,6 +63,10 @@ static List * PrepareTargetListForNextPlan(List *targetList);
  * the tuples returned by remote scan on the master node. Note that this select
  * plan is executed after result files are retrieved from worker nodes and
  * filled into the tuple store inside provided custom scan.
+ *
+ * If the task results are already sorted in the order the master query needs,
+ * the function skips the sort plan and marks the distributed plan such that the
+ * executor merges the task results in sort order instead.
  */
 PlannedStmt *
 MasterNodeSelectPlan(DistributedPlan *distributedPlan, CustomScan *remoteScan)
@@ -58,8 +77,14 @@ MasterNodeSelectPlan(DistributedPlan *distributedPlan, CustomScan *remoteScan)
 	Job *workerJob = distributedPlan->workerJob;
 	List *workerTargetList = workerJob->jobQuery->targetList;
 	List *masterTargetList = MasterTargetList(workerTargetList);
+	bool sortedMerge = CanMergeSortedTaskResults(distributedPlan, remoteScan);
+	long groupEstimate = Max(list_length(workerJob->taskList),
+							 MIN_MASTER_GROUP_ESTIMATE);
+
+	distributedPlan->sortedMerge = sortedMerge;
 
-	masterSelectPlan = BuildSelectStatement(masterQuery, masterTargetList, remoteScan);
+	masterSelectPlan = BuildSelectStatement(masterQuery, masterTargetList, remoteScan,
+											sortedMerge, groupEstimate);
 
 	return masterSelectPlan;
 }
@@ -111,14 +136,99 @@ MasterTargetList(List *workerTargetList)
 }
 
 
+/*
+ * CanMergeSortedTaskResults returns true if the results of the tasks in the
+ * given plan are each sorted in the order required by the master query, and
+ * the master query only projects and limits the task results. In that case a
+ * merge of the task results gives the same rows as sorting all of them. We
+ * only merge for the executors that write task results to files, and limit
+ * the number of tasks since we keep all files open during the merge.
+ */
+static bool
+CanMergeSortedTaskResults(DistributedPlan *distributedPlan, CustomScan *remoteScan)
+{
+	Query *masterQuery = distributedPlan->masterQuery;
+	Job *workerJob = distributedPlan->workerJob;
+	Query *workerQuery = workerJob->jobQuery;
+	List *masterSortClauseList = masterQuery->sortClause;
+	List *workerSortClauseList = workerQuery->sortClause;
+	ListCell *masterSortCell = NULL;
+	ListCell *workerSortCell = NULL;
+
+	if (!EnableSortedMerge)
+	{
+		return false;
+	}
+
+	if (remoteScan->methods != &RealTimeCustomScanMethods &&
+		remoteScan->methods != &TaskTrackerCustomScanMethods)
+	{
+		return false;
+	}
+
+	if (workerJob->dependedJobList != NIL ||
+		list_length(workerJob->taskList) > MAX_SORTED_MERGE_TASK_COUNT)
+	{
+		return false;
+	}
+
+	if (masterSortClauseList == NIL || masterQuery->hasAggs ||
+		masterQuery->groupClause != NIL || masterQuery->distinctClause != NIL ||
+		masterQuery->hasDistinctOn)
+	{
+		return false;
+	}
+
+	/* the workers need to sort on at least the same keys as the master */
+	if (list_length(workerSortClauseList) < list_length(masterSortClauseList))
+	{
+		return false;
+	}
+
+	forboth(masterSortCell, masterSortClauseList, workerSortCell, workerSortClauseList)
+	{
+		SortGroupClause *masterSortClause = (SortGroupClause *) lfirst(masterSortCell);
+		SortGroupClause *workerSortClause = (SortGroupClause *) lfirst(workerSortCell);
+		TargetEntry *masterTargetEntry =
+			get_sortgroupclause_tle(masterSortClause, masterQuery->targetList);
+		TargetEntry *workerTargetEntry =
+			get_sortgroupclause_tle(workerSortClause, workerQuery->targetList);
+		Var *sortColumn = NULL;
+
+		if (masterSortClause->sortop != workerSortClause->sortop ||
+			masterSortClause->nulls_first != workerSortClause->nulls_first)
+		{
+			return false;
+		}
+
+		/* the master must sort on the task result column the workers sorted on */
+		if (!IsA(masterTargetEntry->expr, Var) || workerTargetEntry->resjunk)
+		{
+			return false;
+		}
+
+		sortColumn = (Var *) masterTargetEntry->expr;
+		if (sortColumn->varattno != workerTargetEntry->resno)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * BuildSelectStatement builds the final select statement to run on the master
  * node, before returning results to the user. The function first gets the custom
  * scan node for all results fetched to the master, and layers aggregation, sort
- * and limit plans on top of the scan statement if necessary.
+ * and limit plans on top of the scan statement if necessary. If sortedMerge is
+ * set, the executor returns the task results in sort order and we skip the sort.
+ * The group estimate sizes the hash table of a hashed aggregate.
  */
 static PlannedStmt *
-BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *remoteScan)
+BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *remoteScan,
+					 bool sortedMerge, long groupEstimate)
 {
 	PlannedStmt *selectStatement = NULL;
 	RangeTblEntry *customScanRangeTableEntry = NULL;
@@ -154,7 +264,8 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 	{
 		remoteScan->scan.plan.targetlist = masterTargetList;
 
-		aggregationPlan = BuildAggregatePlan(masterQuery, &remoteScan->scan.plan);
+		aggregationPlan = BuildAggregatePlan(masterQuery, &remoteScan->scan.plan,
+												 groupEstimate);
 		topLevelPlan = (Plan *) aggregationPlan;
 	}
 	else
@@ -203,7 +314,7 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 	}
 
 	/* (4) add a sorting plan if needed */
-	if (sortClauseList)
+	if (sortClauseList && !sortedMerge)
 	{
 		Sort *sortPlan = make_sort_from_sortclauses(sortClauseList, topLevelPlan);
 
@@ -248,9 +359,14 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
  * BuildAggregatePlan creates and returns an aggregate plan. This aggregate plan
  * builds aggreation and grouping operators (if any) that are to be executed on
  * the master node.
+ *
+ * Every task returns at least one row per group it saw, so for grouped queries
+ * the given group estimate is at least the task count. We hand that estimate to
+ * the hashed aggregate such that its hash table starts out sized for the merged
+ * task results instead of growing repeatedly while the results stream in.
  */
 static Agg *
-BuildAggregatePlan(Query *masterQuery, Plan *subPlan)
+BuildAggregatePlan(Query *masterQuery, Plan *subPlan, long groupEstimate)
 {
 	Agg *aggregatePlan = NULL;
 	AggStrategy aggregateStrategy = AGG_PLAIN;
@@ -265,7 +381,7 @@ BuildAggregatePlan(Query *masterQuery, Plan *subPlan)
 	Node *havingQual = NULL;
 	Oid *groupColumnOpArray = NULL;
 	uint32 groupColumnCount = 0;
-	const long rowEstimate = 10;
+	long rowEstimate = MIN_MASTER_GROUP_ESTIMATE;
 
 	/* assert that we need to build an aggregate plan */
 	Assert(masterQuery->hasAggs || masterQuery->groupClause);
@@ -338,6 +454,8 @@ BuildAggregatePlan(Query *masterQuery, Plan *subPlan)
 			aggregateStrategy = AGG_HASHED;
 		}
 
+		rowEstimate = groupEstimate;
+
 		/* get column indexes that are being grouped */
 		groupColumnIdArray = extract_grouping_cols(groupColumnList, subPlan->targetlist);
 		groupColumnOpArray = extract_grouping_ops(groupColumnList);
@@ -440,7 +558,7 @@ BuildDistinctPlan(Query *masterQuery, Plan *subPlan)
 
 	if (enable_hashagg && distinctClausesHashable && !hasDistinctAggregate)
 	{
-		const long rowEstimate = 10;  /* using the same value as BuildAggregatePlan() */
+		const long rowEstimate = MIN_MASTER_GROUP_ESTIMATE;
 		AttrNumber *distinctColumnIdArray = extract_grouping_cols(distinctClauseList,
 																  subPlan->targetlist);
 		Oid *distinctColumnOpArray = extract_grouping_ops(distinctClauseList);
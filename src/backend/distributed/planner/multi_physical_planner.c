@@ -15,6 +15,7 @@
 
 #include <math.h>
 
+#include "libpq-fe.h"
 #include "miscadmin.h"
 
 #include "access/genam.h"
@@ -24,6 +25,7 @@
 #include "access/skey.h"
 #include "access/xlog.h"
 #include "catalog/pg_am.h"
+#include "catalog/pg_namespace.h"
 #include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
 #include "commands/defrem.h"
@@ -33,6 +35,7 @@
 #include "distributed/citus_nodes.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/colocation_utils.h"
+#include "distributed/connection_management.h"
 #include "distributed/deparse_shard_query.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
@@ -42,6 +45,8 @@
 #include "distributed/multi_physical_planner.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
+#include "distributed/relay_utility.h"
+#include "distributed/remote_commands.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/shard_pruning.h"
 #include "distributed/task_tracker.h"
@@ -50,6 +55,7 @@
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/clauses.h"
+#include "optimizer/paths.h"
 #include "optimizer/predtest.h"
 #include "optimizer/restrictinfo.h"
 #include "optimizer/var.h"
@@ -68,6 +74,25 @@
 /* Policy to use when assigning tasks to worker nodes */
 int TaskAssignmentPolicy = TASK_ASSIGNMENT_GREEDY;
 bool EnableUniqueJobIds = true;
+bool CombineTasksPerWorker = false;
+bool CombineAggregatesPerWorker = true;
+int MaxParallelWorkersPerNode = 8;
+double RepartitionJoinSamplePercent = 0.0; /* sample used to split merge tasks */
+int RepartitionTargetMergeTaskSize = 0; /* in kilobytes, 0 to use node count */
+
+
+/* number of shards to sample when splitting range repartition merge tasks */
+#define REPARTITION_SAMPLE_SHARD_COUNT 4
+
+/* maximum number of merge tasks that join against the same base shard */
+#define MAX_MERGE_TASKS_PER_SHARD 8
+
+/* maximum number of hash partitions chosen from the estimated input size */
+#define MAX_SIZE_BASED_PARTITION_COUNT 4096
+
+/* query to sample join column values from a shard */
+#define SAMPLE_COLUMN_QUERY \
+	"SELECT (%s)::%s FROM %s TABLESAMPLE BERNOULLI (%g) WHERE %s IS NOT NULL"
 
 
 /*
@@ -115,9 +140,18 @@ static uint64 UniqueJobId(void);
 static Job * BuildJob(Query *jobQuery, List *dependedJobList);
 static MapMergeJob * BuildMapMergeJob(Query *jobQuery, List *dependedJobList,
 									  Var *partitionKey, PartitionType partitionType,
-									  Oid baseRelationId,
+									  uint32 hashPartitionCount, Oid baseRelationId,
 									  BoundaryNodeJobType boundaryNodeJobType);
-static uint32 HashPartitionCount(void);
+static uint32 HashPartitionCount(MultiNode *inputNode);
+static uint64 EstimatedInputSize(MultiNode *inputNode);
+static ShardInterval ** SampledMergeIntervalArray(Query *jobQuery, List *dependedJobList,
+												  Var *partitionKey,
+												  DistTableCacheEntry *baseCache,
+												  uint32 *mergeIntervalCount);
+static Datum * SampleColumnValues(Oid relationId, AttrNumber columnId, Oid valueTypeId,
+								  uint32 *sampleCount);
+static int CompareSampleValues(const void *leftElement, const void *rightElement,
+							   void *compareFunction);
 static ArrayType * SplitPointObject(ShardInterval **shardIntervalArray,
 									uint32 shardIntervalCount);
 
@@ -133,7 +167,7 @@ static bool ShardIntervalsEqual(FmgrInfo *comparisonFunction,
 								ShardInterval *secondInterval);
 static Task * SubqueryTaskCreate(Query *originalQuery, int shardIndex,
 								 RelationRestrictionContext *restrictionContext,
-								 uint32 taskId);
+								 uint32 taskId, ShardQueryTemplate **queryTemplate);
 static List * SqlTaskList(Job *job);
 static bool DependsOnHashPartitionJob(Job *job);
 static uint32 AnchorRangeTableId(List *rangeTableList);
@@ -160,20 +194,41 @@ static List * DataFetchTaskList(uint64 jobId, uint32 taskIdIndex, List *fragment
 static StringInfo DatumArrayString(Datum *datumArray, uint32 datumCount, Oid datumTypeId);
 static List * BuildRelationShardList(List *rangeTableList, List *fragmentList);
 static void UpdateRangeTableAlias(List *rangeTableList, List *fragmentList);
+static List * ShardFragmentRangeTableEntryList(List *rangeTableList,
+											   List *fragmentList);
+static uint64 * FragmentShardIdArray(List *fragmentList);
+static bool HasShardFilterableArrays(Query *jobQuery);
+static void FilterArraysForFragments(Query *taskQuery, List *fragmentList);
 static Alias * FragmentAlias(RangeTblEntry *rangeTableEntry,
 							 RangeTableFragment *fragment);
 static uint64 AnchorShardId(List *fragmentList, uint32 anchorRangeTableId);
 static List * PruneSqlTaskDependencies(List *sqlTaskList);
 static List * AssignTaskList(List *sqlTaskList);
+static bool CanCombineTaskList(Job *job);
+static List * CombineTaskListPerWorker(List *taskList, Query *aggregateQuery);
+static bool TaskPlacementListsEqual(List *leftPlacementList, List *rightPlacementList);
+static Task * CombineTasks(List *taskList, Query *aggregateQuery);
+static bool CanCombinePartialAggregates(Query *workerQuery);
+static bool IsGroupTargetEntry(TargetEntry *targetEntry, List *groupClauseList);
+static char * PartialAggregateCombineFunction(Expr *expression);
+static void AppendPartialAggregateCombine(StringInfo combinedQueryString,
+										  Query *aggregateQuery, char *unionQueryString);
 static bool HasMergeTaskDependencies(List *sqlTaskList);
 static List * GreedyAssignTaskList(List *taskList);
-static Task * GreedyAssignTask(WorkerNode *workerNode, List *taskList,
-							   List *activeShardPlacementLists);
+static Task * GreedyAssignTask(WorkerNode *workerNode, Task **taskArray,
+							   List **placementListArray, uint32 taskCount,
+							   uint32 *scanPositionArray, bool *rackTaskArray,
+							   bool workerInRack);
 static List * RoundRobinAssignTaskList(List *taskList);
 static List * RoundRobinReorder(Task *task, List *placementList);
+static List * RackReorder(Task *task, List *placementList);
 static List * ReorderAndAssignTaskList(List *taskList,
 									   List * (*reorderFunction)(Task *, List *));
 static int CompareTasksByShardId(const void *leftElement, const void *rightElement);
+static int PlacementNodeIndex(ShardPlacement *placement,
+							  ShardPlacement **nodePlacementArray, int nodeCount);
+static uint64 TaskShardLength(Task *task);
+static int ShardSizeParallelWorkers(uint64 shardLength);
 static List * ActiveShardPlacementLists(List *taskList);
 static List * ActivePlacementList(List *placementList);
 static List * LeftRotateList(List *list, uint32 rotateCount);
@@ -227,6 +282,24 @@ CreatePhysicalDistributedPlan(MultiTreeRoot *multiTree,
 	distributedPlan->routerExecutable = DistributedPlanRouterExecutable(distributedPlan);
 	distributedPlan->operation = CMD_SELECT;
 
+	/*
+	 * Tasks are combined after deciding on the router executor, since a plan
+	 * that hits several shards still needs the master query to merge them.
+	 */
+	if (CombineTasksPerWorker && CanCombineTaskList(workerJob))
+	{
+		Query *aggregateQuery = NULL;
+
+		if (CombineAggregatesPerWorker &&
+			CanCombinePartialAggregates(workerJob->jobQuery))
+		{
+			aggregateQuery = workerJob->jobQuery;
+		}
+
+		workerJob->taskList = CombineTaskListPerWorker(workerJob->taskList,
+													   aggregateQuery);
+	}
+
 	return distributedPlan;
 }
 
@@ -345,6 +418,7 @@ BuildJobTree(MultiTreeRoot *multiTree)
 			MultiNode *rightChildNode = joinNode->binaryNode.rightChildNode;
 
 			PartitionType partitionType = PARTITION_INVALID_FIRST;
+			uint32 hashPartitionCount = 0;
 			Oid baseRelationId = InvalidOid;
 
 			if (joinNode->joinRuleType == SINGLE_PARTITION_JOIN)
@@ -354,7 +428,9 @@ BuildJobTree(MultiTreeRoot *multiTree)
 			}
 			else if (joinNode->joinRuleType == DUAL_PARTITION_JOIN)
 			{
+				/* both sides need the same partition count to join partitions */
 				partitionType = HASH_PARTITION_TYPE;
+				hashPartitionCount = HashPartitionCount(currentNode);
 			}
 
 			if (CitusIsA(leftChildNode, MultiPartition))
@@ -369,6 +445,7 @@ BuildJobTree(MultiTreeRoot *multiTree)
 
 				MapMergeJob *mapMergeJob = BuildMapMergeJob(jobQuery, dependedJobList,
 															partitionKey, partitionType,
+															hashPartitionCount,
 															baseRelationId,
 															JOIN_MAP_MERGE_JOB);
 
@@ -390,6 +467,7 @@ BuildJobTree(MultiTreeRoot *multiTree)
 				Query *jobQuery = BuildJobQuery(queryNode, NIL);
 				MapMergeJob *mapMergeJob = BuildMapMergeJob(jobQuery, NIL,
 															partitionKey, partitionType,
+															hashPartitionCount,
 															baseRelationId,
 															JOIN_MAP_MERGE_JOB);
 
@@ -407,9 +485,10 @@ BuildJobTree(MultiTreeRoot *multiTree)
 			List *dependedJobList = list_copy(loopDependedJobList);
 			Query *jobQuery = BuildJobQuery(queryNode, dependedJobList);
 
+			uint32 hashPartitionCount = HashPartitionCount(currentNode);
 			MapMergeJob *mapMergeJob = BuildMapMergeJob(jobQuery, dependedJobList,
 														partitionKey, HASH_PARTITION_TYPE,
-														InvalidOid,
+														hashPartitionCount, InvalidOid,
 														SUBQUERY_MAP_MERGE_JOB);
 
 			Query *reduceQuery = BuildReduceQuery((MultiExtendedOp *) parentNode,
@@ -1819,8 +1898,8 @@ BuildJob(Query *jobQuery, List *dependedJobList)
  */
 static MapMergeJob *
 BuildMapMergeJob(Query *jobQuery, List *dependedJobList, Var *partitionKey,
-				 PartitionType partitionType, Oid baseRelationId,
-				 BoundaryNodeJobType boundaryNodeJobType)
+				 PartitionType partitionType, uint32 hashPartitionCount,
+				 Oid baseRelationId, BoundaryNodeJobType boundaryNodeJobType)
 {
 	MapMergeJob *mapMergeJob = NULL;
 	List *rangeTableList = jobQuery->rtable;
@@ -1848,10 +1927,8 @@ BuildMapMergeJob(Query *jobQuery, List *dependedJobList, Var *partitionKey,
 	 */
 	if (partitionType == HASH_PARTITION_TYPE)
 	{
-		uint32 partitionCount = HashPartitionCount();
-
 		mapMergeJob->partitionType = HASH_PARTITION_TYPE;
-		mapMergeJob->partitionCount = partitionCount;
+		mapMergeJob->partitionCount = hashPartitionCount;
 	}
 	else if (partitionType == RANGE_PARTITION_TYPE)
 	{
@@ -1874,6 +1951,15 @@ BuildMapMergeJob(Query *jobQuery, List *dependedJobList, Var *partitionKey,
 		/* this join-type currently doesn't work for hash partitioned tables */
 		Assert(basePartitionMethod != DISTRIBUTE_BY_HASH);
 
+		/* if enabled, split the intervals of shards that hold many join keys */
+		if (RepartitionJoinSamplePercent > 0.0)
+		{
+			sortedShardIntervalArray = SampledMergeIntervalArray(jobQuery,
+																 dependedJobList,
+																 partitionKey, cache,
+																 &shardCount);
+		}
+
 		mapMergeJob->partitionType = RANGE_PARTITION_TYPE;
 		mapMergeJob->partitionCount = shardCount;
 		mapMergeJob->sortedShardIntervalArray = sortedShardIntervalArray;
@@ -1886,22 +1972,333 @@ BuildMapMergeJob(Query *jobQuery, List *dependedJobList, Var *partitionKey,
 
 /*
  * HashPartitionCount returns the number of partition files we create for a hash
- * partition task. The function follows Hadoop's method for picking the number
- * of reduce tasks: 0.95 or 1.75 * node count * max reduces per node. We choose
- * the lower constant 0.95 so that all tasks can start immediately, but round it
- * to 1.0 so that we have a smooth number of partition tasks.
+ * partition task that reads the tables under the given node.
+ *
+ * If citus.repartition_target_merge_task_size is set and the shard lengths in
+ * the metadata tell the input size, we pick one partition per target merge
+ * task size of input, so that small repartitions do not write many tiny files
+ * and that large ones do not create oversized merge tasks. Otherwise, the
+ * function follows Hadoop's method for picking the number of reduce tasks:
+ * 0.95 or 1.75 * node count * max reduces per node. We choose the lower
+ * constant 0.95 so that all tasks can start immediately, but round it to 1.0
+ * so that we have a smooth number of partition tasks.
  */
 static uint32
-HashPartitionCount(void)
+HashPartitionCount(MultiNode *inputNode)
 {
-	uint32 groupCount = ActiveReadableNodeCount();
-	double maxReduceTasksPerNode = MaxRunningTasksPerNode / 2.0;
+	uint32 groupCount = 0;
+	double maxReduceTasksPerNode = 0.0;
+	uint32 partitionCount = 0;
+
+	if (RepartitionTargetMergeTaskSize > 0)
+	{
+		uint64 inputSize = EstimatedInputSize(inputNode);
+		uint64 targetMergeTaskSize = (uint64) RepartitionTargetMergeTaskSize * 1024L;
+
+		if (inputSize > 0)
+		{
+			uint64 sizeBasedCount = (inputSize + targetMergeTaskSize - 1) /
+									targetMergeTaskSize;
+
+			partitionCount = (uint32) Min(sizeBasedCount, MAX_SIZE_BASED_PARTITION_COUNT);
 
-	uint32 partitionCount = (uint32) rint(groupCount * maxReduceTasksPerNode);
+			ereport(DEBUG2, (errmsg("using %u hash partitions for an estimated input "
+									"of " UINT64_FORMAT " bytes", partitionCount,
+									inputSize)));
+
+			return partitionCount;
+		}
+	}
+
+	groupCount = ActiveReadableNodeCount();
+	maxReduceTasksPerNode = MaxRunningTasksPerNode / 2.0;
+
+	partitionCount = (uint32) rint(groupCount * maxReduceTasksPerNode);
 	return partitionCount;
 }
 
 
+/*
+ * EstimatedInputSize returns the sum of the shard lengths of the distributed
+ * tables under the given node, as recorded in the metadata. Rows that are
+ * filtered or projected away before partitioning are included, so the result
+ * is an upper bound for the size of the data that gets repartitioned.
+ */
+static uint64
+EstimatedInputSize(MultiNode *inputNode)
+{
+	List *tableNodeList = FindNodesOfType(inputNode, T_MultiTable);
+	ListCell *tableNodeCell = NULL;
+	uint64 inputSize = 0;
+
+	foreach(tableNodeCell, tableNodeList)
+	{
+		MultiTable *tableNode = (MultiTable *) lfirst(tableNodeCell);
+
+		if (tableNode->relationId == SUBQUERY_RELATION_ID)
+		{
+			continue;
+		}
+
+		inputSize += TableShardLength(tableNode->relationId);
+	}
+
+	return inputSize;
+}
+
+
+/*
+ * SampledMergeIntervalArray determines the intervals of the merge tasks for a
+ * range repartition join against the given base table. By default, there is
+ * one merge task per base shard. If the table that we repartition is a single
+ * distributed table, the function samples its join column to find how many
+ * rows fall into each base shard's interval, and splits the intervals that hold
+ * more than their share of rows into several merge intervals. Since all merge
+ * intervals that belong to one base shard only overlap with that shard, each
+ * of them joins against the same base shard, and we spread the join work of
+ * large shards over multiple tasks. Heavy join keys are split into intervals
+ * of their own, so that other keys do not pile up in the same merge task.
+ *
+ * The function returns the base table's shard intervals if it cannot sample,
+ * and otherwise sets mergeIntervalCount to the number of returned intervals.
+ */
+static ShardInterval **
+SampledMergeIntervalArray(Query *jobQuery, List *dependedJobList, Var *partitionKey,
+						  DistTableCacheEntry *baseCache, uint32 *mergeIntervalCount)
+{
+	ShardInterval **shardIntervalArray = baseCache->sortedShardIntervalArray;
+	uint32 shardCount = baseCache->shardIntervalArrayLength;
+	FmgrInfo *compareFunction = baseCache->shardIntervalCompareFunction;
+	ShardInterval **mergeIntervalArray = NULL;
+	uint32 mergeIntervalIndex = 0;
+	RangeTblEntry *rangeTableEntry = NULL;
+	Datum *sampleArray = NULL;
+	uint32 sampleCount = 0;
+	uint32 sampleIndex = 0;
+	uint32 samplesPerTask = 0;
+	uint32 shardIndex = 0;
+	Oid valueTypeId = InvalidOid;
+
+	/* we can only sample the join column if we repartition a single table */
+	if (dependedJobList != NIL || list_length(jobQuery->rtable) != 1 ||
+		shardCount == 0 || partitionKey->varattno <= 0)
+	{
+		return shardIntervalArray;
+	}
+
+	rangeTableEntry = (RangeTblEntry *) linitial(jobQuery->rtable);
+	if (GetRangeTblKind(rangeTableEntry) != CITUS_RTE_RELATION ||
+		!IsDistributedTable(rangeTableEntry->relid))
+	{
+		return shardIntervalArray;
+	}
+
+	valueTypeId = shardIntervalArray[0]->valueTypeId;
+	sampleArray = SampleColumnValues(rangeTableEntry->relid, partitionKey->varattno,
+									 valueTypeId, &sampleCount);
+	if (sampleCount == 0)
+	{
+		return shardIntervalArray;
+	}
+
+	qsort_arg(sampleArray, sampleCount, sizeof(Datum), CompareSampleValues,
+			  compareFunction);
+
+	/* number of sampled rows each merge task would get if data were uniform */
+	samplesPerTask = (sampleCount + shardCount - 1) / shardCount;
+
+	mergeIntervalArray = palloc0(shardCount * MAX_MERGE_TASKS_PER_SHARD *
+								 sizeof(ShardInterval *));
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = shardIntervalArray[shardIndex];
+		Datum lastMinValue = shardInterval->minValue;
+		uint32 shardSampleStart = 0;
+		uint32 shardSampleCount = 0;
+		uint32 splitCount = 0;
+		uint32 splitIndex = 0;
+
+		mergeIntervalArray[mergeIntervalIndex++] = shardInterval;
+
+		/* skip samples that fall before this shard's interval */
+		while (sampleIndex < sampleCount &&
+			   DatumGetInt32(CompareCall2(compareFunction, sampleArray[sampleIndex],
+										  shardInterval->minValue)) < 0)
+		{
+			sampleIndex++;
+		}
+
+		shardSampleStart = sampleIndex;
+		while (sampleIndex < sampleCount &&
+			   DatumGetInt32(CompareCall2(compareFunction, sampleArray[sampleIndex],
+										  shardInterval->maxValue)) <= 0)
+		{
+			sampleIndex++;
+		}
+
+		shardSampleCount = sampleIndex - shardSampleStart;
+		splitCount = (shardSampleCount + samplesPerTask - 1) / samplesPerTask;
+		splitCount = Min(splitCount, MAX_MERGE_TASKS_PER_SHARD);
+
+		/*
+		 * Split the interval at the quantiles of its samples. If a quantile
+		 * falls onto a value we already split at, that value is heavy; we then
+		 * split right after it to give it an interval of its own.
+		 */
+		for (splitIndex = 1; splitIndex < splitCount; splitIndex++)
+		{
+			uint32 splitSampleIndex = shardSampleStart +
+									  splitIndex * shardSampleCount / splitCount;
+			ShardInterval *mergeInterval = NULL;
+
+			while (splitSampleIndex < sampleIndex &&
+				   DatumGetInt32(CompareCall2(compareFunction,
+											  sampleArray[splitSampleIndex],
+											  lastMinValue)) <= 0)
+			{
+				splitSampleIndex++;
+			}
+
+			if (splitSampleIndex == sampleIndex)
+			{
+				break;
+			}
+
+			lastMinValue = sampleArray[splitSampleIndex];
+
+			mergeInterval = CitusMakeNode(ShardInterval);
+			CopyShardInterval(shardInterval, mergeInterval);
+			mergeInterval->minValue = lastMinValue;
+
+			mergeIntervalArray[mergeIntervalIndex++] = mergeInterval;
+		}
+	}
+
+	if (mergeIntervalIndex > shardCount)
+	{
+		ereport(DEBUG2, (errmsg("split %u shard intervals into %u merge intervals "
+								"based on %u sampled rows", shardCount,
+								mergeIntervalIndex, sampleCount)));
+	}
+
+	*mergeIntervalCount = mergeIntervalIndex;
+
+	return mergeIntervalArray;
+}
+
+
+/*
+ * SampleColumnValues samples the values of the given column from a few shards
+ * of the given distributed table, and returns the non-null values converted
+ * to the given type. Shards that we cannot sample are skipped.
+ */
+static Datum *
+SampleColumnValues(Oid relationId, AttrNumber columnId, Oid valueTypeId,
+				   uint32 *sampleCount)
+{
+	List *shardIntervalList = LoadShardIntervalList(relationId);
+	uint32 shardCount = (uint32) list_length(shardIntervalList);
+	uint32 sampledShardCount = Min(shardCount, REPARTITION_SAMPLE_SHARD_COUNT);
+	uint32 sampledShardIndex = 0;
+	char *columnName = quote_identifier(get_attname(relationId, columnId));
+	char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+	char *valueTypeName = format_type_be(valueTypeId);
+	uint32 sampleArraySize = 1024;
+	Datum *sampleArray = palloc0(sampleArraySize * sizeof(Datum));
+	uint32 sampleIndex = 0;
+	Oid inputFunctionId = InvalidOid;
+	Oid typeIOParam = InvalidOid;
+
+	getTypeInputInfo(valueTypeId, &inputFunctionId, &typeIOParam);
+
+	for (sampledShardIndex = 0; sampledShardIndex < sampledShardCount;
+		 sampledShardIndex++)
+	{
+		/* pick shards spread evenly over the table */
+		uint32 shardIndex = sampledShardIndex * shardCount / sampledShardCount;
+		ShardInterval *shardInterval = list_nth(shardIntervalList, shardIndex);
+		uint64 shardId = shardInterval->shardId;
+		List *placementList = FinalizedShardPlacementList(shardId);
+		ShardPlacement *placement = NULL;
+		MultiConnection *connection = NULL;
+		StringInfo sampleQuery = makeStringInfo();
+		char *shardName = get_rel_name(relationId);
+		PGresult *result = NULL;
+		bool raiseInterrupts = true;
+		int rowCount = 0;
+		int rowIndex = 0;
+
+		if (placementList == NIL)
+		{
+			continue;
+		}
+
+		AppendShardIdToName(&shardName, shardId);
+		appendStringInfo(sampleQuery, SAMPLE_COLUMN_QUERY, columnName, valueTypeName,
+						 quote_qualified_identifier(schemaName, shardName),
+						 RepartitionJoinSamplePercent, columnName);
+
+		placement = (ShardPlacement *) linitial(placementList);
+		connection = GetNodeConnection(FORCE_NEW_CONNECTION, placement->nodeName,
+									   placement->nodePort);
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, DEBUG1);
+			CloseConnection(connection);
+			continue;
+		}
+
+		SendRemoteCommand(connection, sampleQuery->data);
+		result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (PQresultStatus(result) != PGRES_TUPLES_OK)
+		{
+			ReportResultError(connection, result, DEBUG1);
+		}
+		else
+		{
+			rowCount = PQntuples(result);
+		}
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			char *valueString = PQgetvalue(result, rowIndex, 0);
+
+			if (sampleIndex == sampleArraySize)
+			{
+				sampleArraySize *= 2;
+				sampleArray = repalloc(sampleArray, sampleArraySize * sizeof(Datum));
+			}
+
+			sampleArray[sampleIndex++] = OidInputFunctionCall(inputFunctionId,
+															  valueString,
+															  typeIOParam, -1);
+		}
+
+		PQclear(result);
+		CloseConnection(connection);
+	}
+
+	*sampleCount = sampleIndex;
+
+	return sampleArray;
+}
+
+
+/* CompareSampleValues compares two sampled values using the given function. */
+static int
+CompareSampleValues(const void *leftElement, const void *rightElement,
+					void *compareFunction)
+{
+	Datum leftValue = *((const Datum *) leftElement);
+	Datum rightValue = *((const Datum *) rightElement);
+	Datum comparison = CompareCall2((FmgrInfo *) compareFunction, leftValue,
+									rightValue);
+
+	return DatumGetInt32(comparison);
+}
+
+
 /*
  * SplitPointObject walks over shard intervals in the given array, extracts each
  * shard interval's minimum value, sorts and inserts these minimum values into a
@@ -2035,6 +2432,8 @@ BuildJobTreeTaskList(Job *jobTree, PlannerRestrictionContext *plannerRestriction
 		}
 		else
 		{
+			AssignTaskParallelWorkers(assignedSqlTaskList);
+
 			job->taskList = assignedSqlTaskList;
 		}
 	}
@@ -2068,6 +2467,9 @@ SubquerySqlTaskList(Job *job, PlannerRestrictionContext *plannerRestrictionConte
 	List *prunedRelationShardList = NIL;
 	ListCell *prunedRelationShardCell = NULL;
 	bool isMultiShardQuery = false;
+	Query *taskQuery = NULL;
+	ShardQueryTemplate *queryTemplate = NULL;
+	ShardQueryTemplate **queryTemplatePointer = NULL;
 
 	/* error if shards are not co-partitioned */
 	ErrorIfUnsupportedShardDistribution(subquery);
@@ -2138,6 +2540,22 @@ SubquerySqlTaskList(Job *job, PlannerRestrictionContext *plannerRestrictionConte
 		}
 	}
 
+	/*
+	 * Ands are made implicit during shard pruning, as predicate comparison and
+	 * refutation depend on it being so. We need to make them explicit again so
+	 * that the query string is generated as (...) AND (...) as opposed to
+	 * (...), (...).
+	 */
+	taskQuery = copyObject(subquery);
+	taskQuery->jointree->quals =
+		(Node *) make_ands_explicit((List *) taskQuery->jointree->quals);
+
+	/* the tasks only differ in their shards, so share the deparsing work */
+	if (maxShardOffset > minShardOffset)
+	{
+		queryTemplatePointer = &queryTemplate;
+	}
+
 	/*
 	 * To avoid iterating through all shards indexes we keep the minimum and maximum
 	 * offsets of shards that were not pruned away. This optimisation is primarily
@@ -2159,8 +2577,9 @@ SubquerySqlTaskList(Job *job, PlannerRestrictionContext *plannerRestrictionConte
 			continue;
 		}
 
-		subqueryTask = SubqueryTaskCreate(subquery, shardOffset,
-										  relationRestrictionContext, taskIdIndex);
+		subqueryTask = SubqueryTaskCreate(taskQuery, shardOffset,
+										  relationRestrictionContext, taskIdIndex,
+										  queryTemplatePointer);
 		subqueryTask->jobId = jobId;
 		sqlTaskList = lappend(sqlTaskList, subqueryTask);
 
@@ -2421,15 +2840,15 @@ ShardIntervalsEqual(FmgrInfo *comparisonFunction, ShardInterval *firstInterval,
 
 /*
  * SubqueryTaskCreate creates a sql task by replacing the target
- * shardInterval's boundary value.
+ * shardInterval's boundary value. The query string is built using the given
+ * query template if it is not NULL, see DeparseRelationShardQuery.
  */
 static Task *
 SubqueryTaskCreate(Query *originalQuery, int shardIndex,
-				   RelationRestrictionContext *restrictionContext, uint32 taskId)
+				   RelationRestrictionContext *restrictionContext, uint32 taskId,
+				   ShardQueryTemplate **queryTemplate)
 {
-	Query *taskQuery = copyObject(originalQuery);
-
-	StringInfo queryString = makeStringInfo();
+	char *queryString = NULL;
 	ListCell *restrictionCell = NULL;
 	Task *subqueryTask = NULL;
 	List *taskShardList = NIL;
@@ -2488,24 +2907,14 @@ SubqueryTaskCreate(Query *originalQuery, int shardIndex,
 	}
 
 	/*
-	 * Augment the relations in the query with the shard IDs.
-	 */
-	UpdateRelationToShardNames((Node *) taskQuery, relationShardList);
-
-	/*
-	 * Ands are made implicit during shard pruning, as predicate comparison and
-	 * refutation depend on it being so. We need to make them explicit again so
-	 * that the query string is generated as (...) AND (...) as opposed to
-	 * (...), (...).
+	 * Augment the relations in the query with the shard IDs, and generate the
+	 * full query string.
 	 */
-	taskQuery->jointree->quals =
-		(Node *) make_ands_explicit((List *) taskQuery->jointree->quals);
-
-	/* and generate the full query string */
-	pg_get_query_def(taskQuery, queryString);
-	ereport(DEBUG4, (errmsg("distributed statement: %s", queryString->data)));
+	queryString = DeparseRelationShardQuery(originalQuery, relationShardList,
+											queryTemplate);
+	ereport(DEBUG4, (errmsg("distributed statement: %s", queryString)));
 
-	subqueryTask = CreateBasicTask(jobId, taskId, SQL_TASK, queryString->data);
+	subqueryTask = CreateBasicTask(jobId, taskId, SQL_TASK, queryString);
 	subqueryTask->dependedTaskList = NULL;
 	subqueryTask->anchorShardId = anchorShardId;
 	subqueryTask->taskPlacementList = selectPlacementList;
@@ -2536,6 +2945,8 @@ SqlTaskList(Job *job)
 	List *rangeTableFragmentsList = NIL;
 	List *fragmentCombinationList = NIL;
 	ListCell *fragmentCombinationCell = NULL;
+	ShardQueryTemplate *queryTemplate = NULL;
+	bool filterArrays = false;
 
 	Query *jobQuery = job->jobQuery;
 	List *rangeTableList = jobQuery->rtable;
@@ -2589,6 +3000,14 @@ SqlTaskList(Job *job)
 	fragmentCombinationList = FragmentCombinationList(rangeTableFragmentsList,
 													  jobQuery, dependedJobList);
 
+	/*
+	 * If the query filters the partition column of a hash-partitioned table
+	 * by an IN list, we give each task only the values that its shard of that
+	 * table can contain. The task queries then differ by more than their shard
+	 * names, so we cannot use a query template.
+	 */
+	filterArrays = HasShardFilterableArrays(jobQuery);
+
 	fragmentCombinationCell = NULL;
 	foreach(fragmentCombinationCell, fragmentCombinationList)
 	{
@@ -2605,14 +3024,51 @@ SqlTaskList(Job *job)
 		dataFetchTaskCount = list_length(dataFetchTaskList);
 		taskIdIndex += dataFetchTaskCount;
 
-		/* update range table entries with fragment aliases (in place) */
-		taskQuery = copyObject(jobQuery);
-		fragmentRangeTableList = taskQuery->rtable;
-		UpdateRangeTableAlias(fragmentRangeTableList, fragmentCombination);
-
-		/* transform the updated task query to a SQL query string */
 		sqlQueryString = makeStringInfo();
-		pg_get_query_def(taskQuery, sqlQueryString);
+
+		/*
+		 * Tasks that only scan shards differ only in the names of those shards,
+		 * so we deparse the first task's query into a template and fill in the
+		 * shard names for the remaining tasks.
+		 */
+		if (queryTemplate != NULL && queryTemplate->valid && !filterArrays)
+		{
+			uint64 *shardIdArray = FragmentShardIdArray(fragmentCombination);
+			char *taskQueryString = InstantiateShardQueryTemplate(queryTemplate,
+																  shardIdArray);
+
+			appendStringInfoString(sqlQueryString, taskQueryString);
+			fragmentRangeTableList = jobQuery->rtable;
+		}
+		else
+		{
+			/* update range table entries with fragment aliases (in place) */
+			taskQuery = copyObject(jobQuery);
+			fragmentRangeTableList = taskQuery->rtable;
+			UpdateRangeTableAlias(fragmentRangeTableList, fragmentCombination);
+
+			if (filterArrays)
+			{
+				FilterArraysForFragments(taskQuery, fragmentCombination);
+			}
+
+			/* transform the updated task query to a SQL query string */
+			if (queryTemplate == NULL && list_length(fragmentCombinationList) > 1 &&
+				!filterArrays)
+			{
+				List *shardRangeTableEntryList =
+					ShardFragmentRangeTableEntryList(fragmentRangeTableList,
+													 fragmentCombination);
+
+				queryTemplate = BuildShardQueryTemplate(taskQuery,
+														shardRangeTableEntryList,
+														sqlQueryString);
+			}
+			else
+			{
+				pg_get_query_def(taskQuery, sqlQueryString);
+			}
+		}
 
 		sqlTask = CreateBasicTask(jobId, taskIdIndex, SQL_TASK, sqlQueryString->data);
 		sqlTask->dependedTaskList = dataFetchTaskList;
@@ -3967,6 +4423,116 @@ UpdateRangeTableAlias(List *rangeTableList, List *fragmentList)
 }
 
 
+/*
+ * ShardFragmentRangeTableEntryList returns the range table entries of the
+ * fragments in the given list, or NIL if one of the fragments is not a shard.
+ */
+static List *
+ShardFragmentRangeTableEntryList(List *rangeTableList, List *fragmentList)
+{
+	List *shardRangeTableEntryList = NIL;
+	ListCell *fragmentCell = NULL;
+
+	foreach(fragmentCell, fragmentList)
+	{
+		RangeTableFragment *fragment = (RangeTableFragment *) lfirst(fragmentCell);
+		RangeTblEntry *rangeTableEntry = rt_fetch(fragment->rangeTableId,
+												  rangeTableList);
+
+		if (fragment->fragmentType != CITUS_RTE_RELATION)
+		{
+			return NIL;
+		}
+
+		shardRangeTableEntryList = lappend(shardRangeTableEntryList, rangeTableEntry);
+	}
+
+	return shardRangeTableEntryList;
+}
+
+
+/*
+ * FragmentShardIdArray returns the shard ids of the given shard fragments, in
+ * the order of the list. Since fragment combinations list their fragments in
+ * join sequence order, the shard ids line up with the slots of a template that
+ * was built using ShardFragmentRangeTableEntryList.
+ */
+static uint64 *
+FragmentShardIdArray(List *fragmentList)
+{
+	uint64 *shardIdArray = palloc0(list_length(fragmentList) * sizeof(uint64));
+	ListCell *fragmentCell = NULL;
+	int fragmentIndex = 0;
+
+	foreach(fragmentCell, fragmentList)
+	{
+		RangeTableFragment *fragment = (RangeTableFragment *) lfirst(fragmentCell);
+		ShardInterval *shardInterval = (ShardInterval *) fragment->fragmentReference;
+
+		Assert(fragment->fragmentType == CITUS_RTE_RELATION);
+
+		shardIdArray[fragmentIndex] = shardInterval->shardId;
+		fragmentIndex++;
+	}
+
+	return shardIdArray;
+}
+
+
+/*
+ * HasShardFilterableArrays returns whether the restrictions of the given job
+ * query filter the partition column of one of its relations by an array that
+ * FilterArraysForShard can filter for each shard.
+ */
+static bool
+HasShardFilterableArrays(Query *jobQuery)
+{
+	Node *quals = jobQuery->jointree->quals;
+	ListCell *rangeTableCell = NULL;
+	Index rangeTableId = 0;
+
+	foreach(rangeTableCell, jobQuery->rtable)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		rangeTableId++;
+
+		if (rangeTableEntry->rtekind == RTE_RELATION &&
+			HasShardFilterableArray(quals, rangeTableEntry->relid, rangeTableId))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * FilterArraysForFragments filters the partition column arrays in the
+ * restrictions of the given task query down to the values that the shards in
+ * the fragment list can contain.
+ */
+static void
+FilterArraysForFragments(Query *taskQuery, List *fragmentList)
+{
+	ListCell *fragmentCell = NULL;
+
+	foreach(fragmentCell, fragmentList)
+	{
+		RangeTableFragment *fragment = (RangeTableFragment *) lfirst(fragmentCell);
+
+		if (fragment->fragmentType == CITUS_RTE_RELATION)
+		{
+			ShardInterval *shardInterval = (ShardInterval *) fragment->fragmentReference;
+
+			FilterArraysForShard(taskQuery->jointree->quals, fragment->rangeTableId,
+								 shardInterval);
+		}
+	}
+}
+
+
 /*
  * FragmentAlias creates an alias structure that captures the table fragment's
  * name on the worker node. Each fragment represents either a regular shard, or
@@ -4471,6 +5037,386 @@ ColumnTypeArrayString(List *targetEntryList)
 }
 
 
+/*
+ * CanCombineTaskList returns true if the tasks of the given job are plain SQL
+ * tasks over shards that do not depend on any other job or task, such that
+ * the tasks that run on the same placements can be sent as a single query.
+ */
+static bool
+CanCombineTaskList(Job *job)
+{
+	ListCell *taskCell = NULL;
+
+	if (CitusIsA(job, MapMergeJob) || job->dependedJobList != NIL)
+	{
+		return false;
+	}
+
+	if (list_length(job->taskList) < 2)
+	{
+		return false;
+	}
+
+	foreach(taskCell, job->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (task->taskType != SQL_TASK || task->dependedTaskList != NIL ||
+			task->relationShardList == NIL || task->taskPlacementList == NIL)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * CombineTaskListPerWorker combines the tasks that are assigned to the same
+ * worker nodes into a single task whose query is the UNION ALL of the queries
+ * of the tasks. The worker then runs the queries over all of its shards in
+ * one round trip, and the executor needs one connection per worker. Tasks are
+ * only combined if their placement lists contain the same nodes in the same
+ * order, such that failing over to another replica remains possible.
+ *
+ * If aggregateQuery is not NULL, the combined tasks also merge the partial
+ * aggregates of the shards on the worker, see AppendPartialAggregateCombine.
+ */
+static List *
+CombineTaskListPerWorker(List *taskList, Query *aggregateQuery)
+{
+	List *taskGroupList = NIL;
+	List *combinedTaskList = NIL;
+	ListCell *taskCell = NULL;
+	ListCell *taskGroupCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		bool addedToGroup = false;
+
+		foreach(taskGroupCell, taskGroupList)
+		{
+			List *taskGroup = (List *) lfirst(taskGroupCell);
+			Task *firstTask = (Task *) linitial(taskGroup);
+
+			if (TaskPlacementListsEqual(firstTask->taskPlacementList,
+										task->taskPlacementList))
+			{
+				lfirst(taskGroupCell) = lappend(taskGroup, task);
+				addedToGroup = true;
+				break;
+			}
+		}
+
+		if (!addedToGroup)
+		{
+			taskGroupList = lappend(taskGroupList, list_make1(task));
+		}
+	}
+
+	foreach(taskGroupCell, taskGroupList)
+	{
+		List *taskGroup = (List *) lfirst(taskGroupCell);
+		Task *combinedTask = CombineTasks(taskGroup, aggregateQuery);
+
+		combinedTaskList = lappend(combinedTaskList, combinedTask);
+	}
+
+	return combinedTaskList;
+}
+
+
+/*
+ * TaskPlacementListsEqual returns true if the given placement lists are on the
+ * same nodes in the same order.
+ */
+static bool
+TaskPlacementListsEqual(List *leftPlacementList, List *rightPlacementList)
+{
+	ListCell *leftPlacementCell = NULL;
+	ListCell *rightPlacementCell = NULL;
+
+	if (list_length(leftPlacementList) != list_length(rightPlacementList))
+	{
+		return false;
+	}
+
+	forboth(leftPlacementCell, leftPlacementList, rightPlacementCell,
+			rightPlacementList)
+	{
+		ShardPlacement *leftPlacement = (ShardPlacement *) lfirst(leftPlacementCell);
+		ShardPlacement *rightPlacement = (ShardPlacement *) lfirst(rightPlacementCell);
+
+		if (leftPlacement->nodePort != rightPlacement->nodePort ||
+			strncmp(leftPlacement->nodeName, rightPlacement->nodeName,
+					WORKER_LENGTH) != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * CombineTasks returns a task that runs the queries of all given tasks as a
+ * single UNION ALL query. The task keeps the identifiers and placements of the
+ * first task, and accesses the shards of all tasks, which we track for the
+ * connection management of multi-statement transactions.
+ */
+static Task *
+CombineTasks(List *taskList, Query *aggregateQuery)
+{
+	Task *firstTask = (Task *) linitial(taskList);
+	Task *combinedTask = NULL;
+	StringInfo unionQueryString = NULL;
+	StringInfo combinedQueryString = NULL;
+	List *relationShardList = NIL;
+	ListCell *taskCell = NULL;
+
+	if (list_length(taskList) == 1)
+	{
+		return firstTask;
+	}
+
+	unionQueryString = makeStringInfo();
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (unionQueryString->len > 0)
+		{
+			appendStringInfoString(unionQueryString, " UNION ALL ");
+		}
+
+		appendStringInfo(unionQueryString, "(%s)", task->queryString);
+		relationShardList = list_concat(relationShardList,
+										list_copy(task->relationShardList));
+	}
+
+	combinedQueryString = unionQueryString;
+	if (aggregateQuery != NULL)
+	{
+		combinedQueryString = makeStringInfo();
+		AppendPartialAggregateCombine(combinedQueryString, aggregateQuery,
+									  unionQueryString->data);
+	}
+
+	combinedTask = CreateBasicTask(firstTask->jobId, firstTask->taskId, SQL_TASK,
+								   combinedQueryString->data);
+	combinedTask->anchorShardId = firstTask->anchorShardId;
+	combinedTask->taskPlacementList = firstTask->taskPlacementList;
+	combinedTask->relationShardList = relationShardList;
+
+	return combinedTask;
+}
+
+
+/*
+ * CanCombinePartialAggregates returns true if the results of the given worker
+ * query over several shards can be merged by aggregating them once more on
+ * the worker. This holds if every column of the worker query is either a
+ * grouping column or an aggregate whose partial results can be combined with
+ * a plain aggregate, and the query does not apply anything after grouping
+ * that would change when the groups of several shards are merged.
+ */
+static bool
+CanCombinePartialAggregates(Query *workerQuery)
+{
+	ListCell *targetEntryCell = NULL;
+
+	if (workerQuery == NULL || !workerQuery->hasAggs)
+	{
+		return false;
+	}
+
+	if (workerQuery->havingQual != NULL || workerQuery->sortClause != NIL ||
+		workerQuery->limitCount != NULL || workerQuery->limitOffset != NULL ||
+		workerQuery->distinctClause != NIL || workerQuery->groupingSets != NIL ||
+		workerQuery->hasWindowFuncs || workerQuery->hasTargetSRFs)
+	{
+		return false;
+	}
+
+	foreach(targetEntryCell, workerQuery->targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+
+		if (targetEntry->resjunk)
+		{
+			return false;
+		}
+
+		if (IsGroupTargetEntry(targetEntry, workerQuery->groupClause))
+		{
+			continue;
+		}
+
+		if (PartialAggregateCombineFunction(targetEntry->expr) == NULL)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * IsGroupTargetEntry returns true if the given target entry is referenced by
+ * one of the given group clauses.
+ */
+static bool
+IsGroupTargetEntry(TargetEntry *targetEntry, List *groupClauseList)
+{
+	ListCell *groupClauseCell = NULL;
+
+	if (targetEntry->ressortgroupref == 0)
+	{
+		return false;
+	}
+
+	foreach(groupClauseCell, groupClauseList)
+	{
+		SortGroupClause *groupClause = (SortGroupClause *) lfirst(groupClauseCell);
+
+		if (groupClause->tleSortGroupRef == targetEntry->ressortgroupref)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * PartialAggregateCombineFunction returns the name of the aggregate function
+ * that combines the partial results of the given worker aggregate, or NULL if
+ * the expression is not an aggregate we know how to combine. Counts are summed
+ * up, and the other built-in aggregates are their own combine functions.
+ */
+static char *
+PartialAggregateCombineFunction(Expr *expression)
+{
+	Aggref *aggregate = NULL;
+	char *aggregateName = NULL;
+	const char *const combinableAggregateNames[] = {
+		"sum", "min", "max", "bit_and", "bit_or", "bool_and", "bool_or", "every"
+	};
+	uint32 aggregateIndex = 0;
+
+	if (!IsA(expression, Aggref))
+	{
+		return NULL;
+	}
+
+	aggregate = (Aggref *) expression;
+	if (aggregate->aggdistinct != NIL ||
+		get_func_namespace(aggregate->aggfnoid) != PG_CATALOG_NAMESPACE)
+	{
+		return NULL;
+	}
+
+	aggregateName = get_func_name(aggregate->aggfnoid);
+	if (aggregateName == NULL)
+	{
+		return NULL;
+	}
+
+	if (strncmp(aggregateName, "count", NAMEDATALEN) == 0)
+	{
+		return "sum";
+	}
+
+	for (aggregateIndex = 0; aggregateIndex < lengthof(combinableAggregateNames);
+		 aggregateIndex++)
+	{
+		const char *combinableAggregateName = combinableAggregateNames[aggregateIndex];
+
+		if (strncmp(aggregateName, combinableAggregateName, NAMEDATALEN) == 0)
+		{
+			return aggregateName;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * AppendPartialAggregateCombine appends a query to the given string that groups
+ * the results of the given union of shard queries by the grouping columns of
+ * the worker query, and combines the partial aggregates of the shards. The
+ * worker thereby returns one partial result per group instead of one for each
+ * of its shards, and the master query has fewer rows to merge. The combined
+ * aggregates are cast back to the type of the partial aggregate, such that the
+ * master query reads the same columns as it would from the shard queries.
+ */
+static void
+AppendPartialAggregateCombine(StringInfo combinedQueryString, Query *aggregateQuery,
+							  char *unionQueryString)
+{
+	StringInfo columnListString = makeStringInfo();
+	StringInfo groupByString = makeStringInfo();
+	ListCell *targetEntryCell = NULL;
+	int columnIndex = 0;
+
+	appendStringInfoString(combinedQueryString, "SELECT ");
+
+	foreach(targetEntryCell, aggregateQuery->targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		Expr *expression = targetEntry->expr;
+		StringInfo columnName = makeStringInfo();
+
+		columnIndex++;
+		appendStringInfo(columnName, "worker_column_%d", columnIndex);
+
+		if (columnIndex > 1)
+		{
+			appendStringInfoString(combinedQueryString, ", ");
+			appendStringInfoString(columnListString, ", ");
+		}
+
+		appendStringInfoString(columnListString, columnName->data);
+
+		if (IsGroupTargetEntry(targetEntry, aggregateQuery->groupClause))
+		{
+			appendStringInfoString(combinedQueryString, columnName->data);
+
+			if (groupByString->len > 0)
+			{
+				appendStringInfoString(groupByString, ", ");
+			}
+
+			appendStringInfoString(groupByString, columnName->data);
+		}
+		else
+		{
+			char *combineFunction = PartialAggregateCombineFunction(expression);
+			Oid columnTypeId = exprType((Node *) expression);
+			int32 columnTypeMod = exprTypmod((Node *) expression);
+			char *columnTypeName = format_type_with_typemod(columnTypeId, columnTypeMod);
+
+			appendStringInfo(combinedQueryString, "%s(%s)::%s", combineFunction,
+							 columnName->data, columnTypeName);
+		}
+	}
+
+	appendStringInfo(combinedQueryString, " FROM (%s) worker_combined_tasks (%s)",
+					 unionQueryString, columnListString->data);
+
+	if (groupByString->len > 0)
+	{
+		appendStringInfo(combinedQueryString, " GROUP BY %s", groupByString->data);
+	}
+}
+
 /*
  * AssignTaskList assigns locations to given tasks based on dependencies between
  * tasks and configured task assignment policies. The function also handles the
@@ -4755,14 +5701,20 @@ AssignAnchorShardTaskList(List *taskList)
 {
 	List *assignedTaskList = NIL;
 
-	/* choose task assignment policy based on config value */
-	if (TaskAssignmentPolicy == TASK_ASSIGNMENT_GREEDY)
+	/*
+	 * Choose task assignment policy based on config value. The work-stealing
+	 * policy starts from a greedy assignment, which the real-time executor
+	 * revises at runtime.
+	 */
+	if (TaskAssignmentPolicy == TASK_ASSIGNMENT_GREEDY ||
+		TaskAssignmentPolicy == TASK_ASSIGNMENT_WORK_STEALING)
 	{
 		assignedTaskList = GreedyAssignTaskList(taskList);
 	}
 	else if (TaskAssignmentPolicy == TASK_ASSIGNMENT_FIRST_REPLICA)
 	{
-		assignedTaskList = FirstReplicaAssignTaskList(taskList);
+		/* reads use the first replica in the rack of the executing node */
+		assignedTaskList = ReorderAndAssignTaskList(taskList, RackReorder);
 	}
 	else if (TaskAssignmentPolicy == TASK_ASSIGNMENT_ROUND_ROBIN)
 	{
@@ -4780,6 +5732,15 @@ AssignAnchorShardTaskList(List *taskList)
  * properties: (a) determinism, (b) even load distribution, and (c) consistency
  * across similar task lists. To maintain these properties, the algorithm sorts
  * all its input lists.
+ *
+ * The tasks and their placement lists are kept in arrays, and each worker node
+ * remembers up to which task it already scanned each replica index. A worker
+ * therefore never rescans tasks it could not take, and assigning all tasks of
+ * a plan over many shards takes linear instead of quadratic time.
+ *
+ * If the rack of the executing node is known, tasks that have a placement in
+ * that rack are only assigned to worker nodes in the rack, which avoids reading
+ * across network locations when a nearby replica exists.
  */
 static List *
 GreedyAssignTaskList(List *taskList)
@@ -4788,9 +5749,19 @@ GreedyAssignTaskList(List *taskList)
 	List *activeShardPlacementLists = NIL;
 	uint32 assignedTaskCount = 0;
 	uint32 taskCount = list_length(taskList);
+	uint32 replicaCount = ShardReplicationFactor;
+	Task **taskArray = NULL;
+	List **placementListArray = NULL;
+	uint32 *scanPositionArray = NULL;
+	bool *rackTaskArray = NULL;
+	char *executingNodeRack = ExecutingNodeRack();
+	ListCell *taskCell = NULL;
+	ListCell *placementListCell = NULL;
+	uint32 taskIndex = 0;
 
 	/* get the worker node list and sort the list */
 	List *workerNodeList = ActiveReadableNodeList();
+	uint32 workerNodeCount = list_length(workerNodeList);
 	workerNodeList = SortList(workerNodeList, CompareWorkerNodes);
 
 	/*
@@ -4802,23 +5773,59 @@ GreedyAssignTaskList(List *taskList)
 	taskList = SortList(taskList, CompareTasksByShardId);
 	activeShardPlacementLists = ActiveShardPlacementLists(taskList);
 
+	taskArray = (Task **) palloc0(Max(taskCount, 1) * sizeof(Task *));
+	placementListArray = (List **) palloc0(Max(taskCount, 1) * sizeof(List *));
+	scanPositionArray = (uint32 *) palloc0(Max(workerNodeCount * replicaCount, 1) *
+										   sizeof(uint32));
+	rackTaskArray = (bool *) palloc0(Max(taskCount, 1) * sizeof(bool));
+
+	forboth(taskCell, taskList, placementListCell, activeShardPlacementLists)
+	{
+		List *placementList = (List *) lfirst(placementListCell);
+
+		/* placements in the rack of the executing node come first */
+		placementList = SortPlacementListByRack(placementList, executingNodeRack);
+		if (placementList != NIL)
+		{
+			ShardPlacement *firstPlacement = (ShardPlacement *) linitial(placementList);
+
+			rackTaskArray[taskIndex] = NodeInRack(firstPlacement->nodeName,
+												  firstPlacement->nodePort,
+												  executingNodeRack);
+		}
+
+		taskArray[taskIndex] = (Task *) lfirst(taskCell);
+		placementListArray[taskIndex] = placementList;
+		taskIndex++;
+	}
+
 	while (assignedTaskCount < taskCount)
 	{
 		ListCell *workerNodeCell = NULL;
 		uint32 loopStartTaskCount = assignedTaskCount;
+		uint32 workerNodeIndex = 0;
 
 		/* walk over each node and check if we can assign a task to it */
 		foreach(workerNodeCell, workerNodeList)
 		{
 			WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
-
-			Task *assignedTask = GreedyAssignTask(workerNode, taskList,
-												  activeShardPlacementLists);
+			uint32 *workerScanPositionArray =
+				&scanPositionArray[workerNodeIndex * replicaCount];
+			bool workerInRack = NodeInRack(workerNode->workerName,
+										   workerNode->workerPort,
+										   executingNodeRack);
+
+			Task *assignedTask = GreedyAssignTask(workerNode, taskArray,
+												  placementListArray, taskCount,
+												  workerScanPositionArray, rackTaskArray,
+												  workerInRack);
 			if (assignedTask != NULL)
 			{
 				assignedTaskList = lappend(assignedTaskList, assignedTask);
 				assignedTaskCount++;
 			}
+
+			workerNodeIndex++;
 		}
 
 		/* if we could not assign any new tasks, avoid looping forever */
@@ -4841,11 +5848,21 @@ GreedyAssignTaskList(List *taskList)
  * given worker node match, the corresponding task is assigned to that node. If
  * not, the function goes on to search the second set of replicas and so forth.
  *
+ * The scan position array holds, for each replica index, the first task the
+ * worker node has not yet looked at. Tasks before that position were either
+ * assigned already or have a different node at that replica index, which does
+ * not change while assigning tasks, so the function starts from there.
+ *
+ * Worker nodes outside the rack of the executing node skip the tasks marked in
+ * the rack task array, which have a placement in that rack.
+ *
  * Note that this function has side-effects; when the function assigns a new
- * task, it overwrites the corresponding task list pointer.
+ * task, it overwrites the corresponding task array pointer.
  */
 static Task *
-GreedyAssignTask(WorkerNode *workerNode, List *taskList, List *activeShardPlacementLists)
+GreedyAssignTask(WorkerNode *workerNode, Task **taskArray, List **placementListArray,
+				 uint32 taskCount, uint32 *scanPositionArray, bool *rackTaskArray,
+				 bool workerInRack)
 {
 	Task *assignedTask = NULL;
 	List *taskPlacementList = NIL;
@@ -4858,14 +5875,14 @@ GreedyAssignTask(WorkerNode *workerNode, List *taskList, List *activeShardPlacem
 
 	while ((assignedTask == NULL) && (replicaIndex < replicaCount))
 	{
-		/* walk over all tasks and try to assign one */
-		ListCell *taskCell = NULL;
-		ListCell *placementListCell = NULL;
+		/* walk over the remaining tasks and try to assign one */
+		uint32 taskIndex = 0;
 
-		forboth(taskCell, taskList, placementListCell, activeShardPlacementLists)
+		for (taskIndex = scanPositionArray[replicaIndex]; taskIndex < taskCount;
+			 taskIndex++)
 		{
-			Task *task = (Task *) lfirst(taskCell);
-			List *placementList = (List *) lfirst(placementListCell);
+			Task *task = taskArray[taskIndex];
+			List *placementList = placementListArray[taskIndex];
 			ShardPlacement *placement = NULL;
 			uint32 placementCount = 0;
 
@@ -4875,6 +5892,12 @@ GreedyAssignTask(WorkerNode *workerNode, List *taskList, List *activeShardPlacem
 				continue;
 			}
 
+			/* leave tasks with a nearby placement to the nodes in the rack */
+			if (rackTaskArray[taskIndex] && !workerInRack)
+			{
+				continue;
+			}
+
 			/* check if we have enough replicas */
 			placementCount = list_length(placementList);
 			if (placementCount <= replicaIndex)
@@ -4891,12 +5914,14 @@ GreedyAssignTask(WorkerNode *workerNode, List *taskList, List *activeShardPlacem
 				taskPlacementList = placementList;
 				rotatePlacementListBy = replicaIndex;
 
-				/* overwrite task list to signal that this task is assigned */
-				taskCell->data.ptr_value = NULL;
+				/* overwrite task array to signal that this task is assigned */
+				taskArray[taskIndex] = NULL;
 				break;
 			}
 		}
 
+		scanPositionArray[replicaIndex] = taskIndex;
+
 		/* go over the next set of shard replica placements */
 		replicaIndex++;
 	}
@@ -4959,7 +5984,9 @@ RoundRobinAssignTaskList(List *taskList)
 /*
  * RoundRobinReorder implements the core of the round-robin assignment policy.
  * It takes a task and placement list and rotates a copy of the placement list
- * based on the task's jobId. The rotated copy is returned.
+ * based on the task's jobId. The placements in the rack of the executing node
+ * are then moved to the front, such that the rotation only alternates between
+ * nearby placements if there are any. The reordered copy is returned.
  */
 static List *
 RoundRobinReorder(Task *task, List *placementList)
@@ -4969,11 +5996,23 @@ RoundRobinReorder(Task *task, List *placementList)
 	uint32 roundRobinIndex = (jobId % activePlacementCount);
 
 	placementList = LeftRotateList(placementList, roundRobinIndex);
+	placementList = SortPlacementListByRack(placementList, ExecutingNodeRack());
 
 	return placementList;
 }
 
 
+/*
+ * RackReorder moves the placements in the rack of the executing node to the
+ * front of the given placement list, and otherwise keeps their order.
+ */
+static List *
+RackReorder(Task *task, List *placementList)
+{
+	return SortPlacementListByRack(placementList, ExecutingNodeRack());
+}
+
+
 /*
  * ReorderAndAssignTaskList finds the placements for a task based on its anchor
  * shard id and then sorts them by insertion time. If reorderFunction is given,
@@ -5038,6 +6077,186 @@ ReorderAndAssignTaskList(List *taskList, List * (*reorderFunction)(Task *, List
 }
 
 
+/*
+ * AssignTaskParallelWorkers suggests the number of PostgreSQL parallel workers
+ * that each of the given tasks should use on the worker. The executors apply it
+ * as max_parallel_workers_per_gather of the task's connection, such that a
+ * query that hits few large shards uses more than one core per shard.
+ *
+ * The suggestion grows with the size of the shards the task reads, the same way
+ * PostgreSQL sizes the parallel scan of a table. Tasks that run on the same node
+ * share citus.max_parallel_workers_per_node, so that queries with many tasks per
+ * node keep the worker's default. Shard sizes come from the shard lengths in
+ * the metadata, so tasks on shards without statistics get no suggestion.
+ */
+void
+AssignTaskParallelWorkers(List *taskList)
+{
+	int taskCount = list_length(taskList);
+	ShardPlacement **nodePlacementArray = NULL;
+	int *nodeTaskCountArray = NULL;
+	int nodeCount = 0;
+	ListCell *taskCell = NULL;
+
+	if (MaxParallelWorkersPerNode <= 0 || taskCount == 0)
+	{
+		return;
+	}
+
+	/* count the tasks that run on each node, as given by their first placement */
+	nodePlacementArray = palloc0(taskCount * sizeof(ShardPlacement *));
+	nodeTaskCountArray = palloc0(taskCount * sizeof(int));
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		ShardPlacement *placement = NULL;
+		int nodeIndex = 0;
+
+		if (task->taskPlacementList == NIL)
+		{
+			continue;
+		}
+
+		placement = (ShardPlacement *) linitial(task->taskPlacementList);
+		nodeIndex = PlacementNodeIndex(placement, nodePlacementArray, nodeCount);
+		if (nodeIndex == nodeCount)
+		{
+			nodePlacementArray[nodeCount++] = placement;
+		}
+
+		nodeTaskCountArray[nodeIndex]++;
+	}
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		ShardPlacement *placement = NULL;
+		int nodeIndex = 0;
+		int nodeParallelWorkerCount = 0;
+		int shardParallelWorkerCount = 0;
+
+		if (task->taskPlacementList == NIL)
+		{
+			continue;
+		}
+
+		placement = (ShardPlacement *) linitial(task->taskPlacementList);
+		nodeIndex = PlacementNodeIndex(placement, nodePlacementArray, nodeCount);
+
+		nodeParallelWorkerCount = MaxParallelWorkersPerNode /
+								  nodeTaskCountArray[nodeIndex];
+		if (nodeParallelWorkerCount == 0)
+		{
+			continue;
+		}
+
+		shardParallelWorkerCount = ShardSizeParallelWorkers(TaskShardLength(task));
+
+		task->parallelWorkerCount = Min(shardParallelWorkerCount,
+										nodeParallelWorkerCount);
+	}
+
+	pfree(nodePlacementArray);
+	pfree(nodeTaskCountArray);
+}
+
+
+/*
+ * PlacementNodeIndex returns the index of the node of the given placement in
+ * the given array of placements, or the node count if no placement in the
+ * array is on the same node.
+ */
+static int
+PlacementNodeIndex(ShardPlacement *placement, ShardPlacement **nodePlacementArray,
+				   int nodeCount)
+{
+	int nodeIndex = 0;
+
+	for (nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++)
+	{
+		ShardPlacement *nodePlacement = nodePlacementArray[nodeIndex];
+
+		if (nodePlacement->nodePort == placement->nodePort &&
+			strncmp(nodePlacement->nodeName, placement->nodeName,
+					WORKER_LENGTH) == 0)
+		{
+			break;
+		}
+	}
+
+	return nodeIndex;
+}
+
+
+/*
+ * TaskShardLength returns the total length of the shards that the given task
+ * reads, as recorded in the metadata.
+ */
+static uint64
+TaskShardLength(Task *task)
+{
+	uint64 taskShardLength = 0;
+	ListCell *relationShardCell = NULL;
+
+	if (task->relationShardList == NIL)
+	{
+		if (task->anchorShardId != INVALID_SHARD_ID)
+		{
+			taskShardLength = ShardLength(task->anchorShardId);
+		}
+
+		return taskShardLength;
+	}
+
+	foreach(relationShardCell, task->relationShardList)
+	{
+		RelationShard *relationShard = (RelationShard *) lfirst(relationShardCell);
+
+		if (relationShard->shardId != INVALID_SHARD_ID)
+		{
+			taskShardLength += ShardLength(relationShard->shardId);
+		}
+	}
+
+	return taskShardLength;
+}
+
+
+/*
+ * ShardSizeParallelWorkers returns the number of parallel workers PostgreSQL
+ * would plan for a scan of a table of the given size: none below the minimum
+ * size of a parallel scan, and one more each time the size triples.
+ */
+static int
+ShardSizeParallelWorkers(uint64 shardLength)
+{
+#if (PG_VERSION_NUM >= 100000)
+	int minParallelScanBlocks = min_parallel_table_scan_size;
+#else
+	int minParallelScanBlocks = min_parallel_relation_size;
+#endif
+	uint64 threshold = (uint64) Max(minParallelScanBlocks, 1) * BLCKSZ;
+	int parallelWorkerCount = 0;
+
+	if (shardLength < threshold)
+	{
+		return 0;
+	}
+
+	parallelWorkerCount = 1;
+
+	while (shardLength >= threshold * 3 &&
+		   parallelWorkerCount < MaxParallelWorkersPerNode)
+	{
+		parallelWorkerCount++;
+		threshold *= 3;
+	}
+
+	return parallelWorkerCount;
+}
+
+
 /* Helper function to compare two tasks by their anchor shardId. */
 static int
 CompareTasksByShardId(const void *leftElement, const void *rightElement)
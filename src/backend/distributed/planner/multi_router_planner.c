@@ -26,6 +26,7 @@
 #include "distributed/deparse_shard_query.h"
 #include "distributed/distribution_column.h"
 #include "distributed/errormessage.h"
+#include "distributed/fast_path_router_planner.h"
 #include "distributed/insert_select_planner.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
@@ -43,6 +44,7 @@
 #include "distributed/resource_lock.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/shard_pruning.h"
+#include "distributed/worker_manager.h"
 #include "executor/execdesc.h"
 #include "lib/stringinfo.h"
 #include "nodes/makefuncs.h"
@@ -121,6 +123,10 @@ static Job * RouterInsertJob(Query *originalQuery, Query *query,
 							 DeferredErrorMessage **planningError);
 static void ErrorIfNoShardsExist(DistTableCacheEntry *cacheEntry);
 static bool CanShardPrune(Oid distributedTableId, Query *query);
+static bool FastPathRequiresDeferredPruning(Query *query,
+											RelationRestrictionContext *
+											restrictionContext);
+static List * TargetShardIntervalForFastPathQuery(Query *query, bool *multiShardQuery);
 static Job * CreateJob(Query *query);
 static Task * CreateTask(TaskType taskType);
 static Job * RouterJob(Query *originalQuery,
@@ -1412,6 +1418,19 @@ RouterJob(Query *originalQuery, RelationRestrictionContext *restrictionContext,
 	/* check if this query requires master evaluation */
 	requiresMasterEvaluation = RequiresMasterEvaluation(originalQuery);
 
+	/*
+	 * If we do not know the distribution key value yet, we postpone pruning to
+	 * the executor, see FastPathRouterTaskList(). That keeps the plan cacheable.
+	 */
+	if (FastPathRequiresDeferredPruning(originalQuery, restrictionContext))
+	{
+		job = CreateJob(originalQuery);
+		job->requiresMasterEvaluation = requiresMasterEvaluation;
+		job->deferredPruning = true;
+
+		return job;
+	}
+
 	(*planningError) = PlanRouterQuery(originalQuery, restrictionContext,
 									   &placementList, &shardId, &relationShardList,
 									   replacePrunedQueryWithDummy,
@@ -1460,6 +1479,61 @@ RouterJob(Query *originalQuery, RelationRestrictionContext *restrictionContext,
 }
 
 
+/*
+ * FastPathRequiresDeferredPruning returns true if the given query was planned
+ * through the fast path and compares its distribution key with an external
+ * parameter that had no value during planning, as in generic plans.
+ */
+static bool
+FastPathRequiresDeferredPruning(Query *query,
+								RelationRestrictionContext *restrictionContext)
+{
+	Node *distributionKeyValue = NULL;
+
+	if (!restrictionContext->fastPathRouterQuery)
+	{
+		return false;
+	}
+
+	distributionKeyValue = FastPathDistributionKeyValue(query);
+
+	return distributionKeyValue != NULL && IsA(distributionKeyValue, Param);
+}
+
+
+/*
+ * FastPathRouterTaskList generates the task list of a fast path query whose
+ * shard pruning was deferred to the executor. The caller should have replaced
+ * the external parameters in the filters of the query with their values. The
+ * query is modified to point to the pruned shard.
+ */
+List *
+FastPathRouterTaskList(Query *query, DeferredErrorMessage **planningError)
+{
+	RelationRestrictionContext *restrictionContext =
+		palloc0(sizeof(RelationRestrictionContext));
+	List *placementList = NIL;
+	List *relationShardList = NIL;
+	uint64 shardId = INVALID_SHARD_ID;
+	bool replacePrunedQueryWithDummy = true;
+	bool isMultiShardModifyQuery = false;
+
+	restrictionContext->fastPathRouterQuery = true;
+
+	(*planningError) = PlanRouterQuery(query, restrictionContext, &placementList,
+									   &shardId, &relationShardList,
+									   replacePrunedQueryWithDummy,
+									   &isMultiShardModifyQuery);
+	if (*planningError != NULL)
+	{
+		return NIL;
+	}
+
+	return SingleShardSelectTaskList(query, relationShardList, placementList,
+									 shardId);
+}
+
+
 /*
  * SingleShardSelectTaskList generates a task for single shard select query
  * and returns it as a list.
@@ -1470,6 +1544,7 @@ SingleShardSelectTaskList(Query *query, List *relationShardList, List *placement
 {
 	Task *task = CreateTask(ROUTER_TASK);
 	StringInfo queryString = makeStringInfo();
+	List *taskList = NIL;
 
 	pg_get_query_def(query, queryString);
 
@@ -1478,7 +1553,10 @@ SingleShardSelectTaskList(Query *query, List *relationShardList, List *placement
 	task->taskPlacementList = placementList;
 	task->relationShardList = relationShardList;
 
-	return list_make1(task);
+	taskList = list_make1(task);
+	AssignTaskParallelWorkers(taskList);
+
+	return taskList;
 }
 
 
@@ -1493,6 +1571,22 @@ MultiShardModifyTaskList(Query *originalQuery, List *relationShardList,
 	List *taskList = NIL;
 	ListCell *relationShardCell = NULL;
 	int taskId = 1;
+	ShardQueryTemplate *queryTemplate = NULL;
+	ShardQueryTemplate **queryTemplatePointer = NULL;
+	RangeTblEntry *resultRangeTableEntry = rt_fetch(originalQuery->resultRelation,
+													originalQuery->rtable);
+	bool filterArrays = HasShardFilterableArray(originalQuery->jointree->quals,
+												resultRangeTableEntry->relid,
+												originalQuery->resultRelation);
+
+	/*
+	 * Deparse the query once, and fill in the shard names of the other tasks,
+	 * unless we give each task only the IN list values that its shard contains.
+	 */
+	if (list_length(relationShardList) > 1 && !filterArrays)
+	{
+		queryTemplatePointer = &queryTemplate;
+	}
 
 	foreach(relationShardCell, relationShardList)
 	{
@@ -1502,13 +1596,19 @@ MultiShardModifyTaskList(Query *originalQuery, List *relationShardList,
 
 		if (!requiresMasterEvaluation)
 		{
-			Query *copiedQuery = copyObject(originalQuery);
-			StringInfo shardQueryString = makeStringInfo();
+			Query *taskQuery = originalQuery;
 
-			UpdateRelationToShardNames((Node *) copiedQuery, relationShardList);
-			pg_get_query_def(copiedQuery, shardQueryString);
+			if (filterArrays)
+			{
+				ShardInterval *shardInterval = LoadShardInterval(relationShard->shardId);
 
-			task->queryString = shardQueryString->data;
+				taskQuery = copyObject(originalQuery);
+				FilterArraysForShard(taskQuery->jointree->quals,
+									 taskQuery->resultRelation, shardInterval);
+			}
+
+			task->queryString = DeparseRelationShardQuery(taskQuery, relationShardList,
+														  queryTemplatePointer);
 		}
 
 		task->taskId = taskId++;
@@ -1759,6 +1859,12 @@ PlanRouterQuery(Query *originalQuery, RelationRestrictionContext *restrictionCon
 	if (shardsPresent)
 	{
 		workerList = WorkersContainingAllShards(prunedRelationShardList);
+
+		/* reads prefer the placements in the rack of the executing node */
+		if (originalQuery->commandType == CMD_SELECT)
+		{
+			workerList = SortPlacementListByRack(workerList, ExecutingNodeRack());
+		}
 	}
 	else if (replacePrunedQueryWithDummy)
 	{
@@ -1866,6 +1972,15 @@ TargetShardIntervalsForQuery(Query *query,
 
 	Assert(restrictionContext != NULL);
 
+	/* fast path queries skip the postgres planner, so there are no restrictions */
+	if (restrictionContext->fastPathRouterQuery)
+	{
+		List *prunedShardList = TargetShardIntervalForFastPathQuery(query,
+																	multiShardQuery);
+
+		return list_make1(prunedShardList);
+	}
+
 	foreach(restrictionCell, restrictionContext->relationRestrictionList)
 	{
 		RelationRestriction *relationRestriction =
@@ -1908,6 +2023,42 @@ TargetShardIntervalsForQuery(Query *query,
 }
 
 
+/*
+ * TargetShardIntervalForFastPathQuery prunes the shards of the single relation
+ * in a query that passed FastPathRouterQuery(), based on the filters of the
+ * query itself. The filters go through the same constant folding as they would
+ * in the postgres planner, such that contradictions like 'and false' prune all
+ * shards as they do on the regular code path.
+ */
+static List *
+TargetShardIntervalForFastPathQuery(Query *query, bool *multiShardQuery)
+{
+	RangeTblEntry *rangeTableEntry = (RangeTblEntry *) linitial(query->rtable);
+	Oid relationId = rangeTableEntry->relid;
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	Node *quals = copyObject(query->jointree->quals);
+	List *whereClauseList = NIL;
+	List *prunedShardList = NIL;
+
+	quals = eval_const_expressions(NULL, quals);
+	whereClauseList = make_ands_implicit((Expr *) quals);
+
+	if (shardCount == 0 || ContainsFalseClause(whereClauseList))
+	{
+		return NIL;
+	}
+
+	prunedShardList = PruneShards(relationId, 1, whereClauseList);
+	if (list_length(prunedShardList) > 1)
+	{
+		(*multiShardQuery) = true;
+	}
+
+	return prunedShardList;
+}
+
+
 /*
  * RelationPrunesToMultipleShards returns true if the given list of
  * relation-to-shard mappings contains at least two mappings with
@@ -2559,6 +2710,7 @@ CopyRelationRestrictionContext(RelationRestrictionContext *oldContext)
 	newContext->hasDistributedRelation = oldContext->hasDistributedRelation;
 	newContext->hasLocalRelation = oldContext->hasLocalRelation;
 	newContext->allReferenceTables = oldContext->allReferenceTables;
+	newContext->fastPathRouterQuery = oldContext->fastPathRouterQuery;
 	newContext->relationRestrictionList = NIL;
 
 	foreach(relationRestrictionCell, oldContext->relationRestrictionList)
@@ -0,0 +1,282 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_pruning.c
+ *
+ * Coordinator-side pruning of the partitions of distributed partitioned
+ * tables.
+ *
+ * A query on a distributed partitioned table is planned on the shards of the
+ * parent table, and the executor locks every partition on the coordinator
+ * before sending it. For tables with many partitions, such as time-partitioned
+ * tables, most queries only need one of them. When the filters of a query
+ * refute the partition bounds of all but one partition, we therefore replace
+ * the parent in the query by that partition before planning. The partition is
+ * a distributed table colocated with the parent, so the query is planned on
+ * its shards, and the other partitions are neither locked nor opened.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "access/heapam.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_partitioning_utils.h"
+#include "distributed/partition_pruning.h"
+#include "distributed/version_compat.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/pg_list.h"
+#include "optimizer/clauses.h"
+#include "optimizer/prep.h"
+#include "parser/parsetree.h"
+#include "utils/acl.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+
+
+/* Config variable managed via guc.c */
+bool EnablePartitionPruning = true;
+
+
+/* local function forward declarations */
+static bool ReplacePartitionedTablesWalker(Node *node, void *context);
+static void ReplacePartitionedTablesInQueryLevel(Query *query);
+static Oid SinglePrunedPartition(RangeTblEntry *rangeTableEntry,
+								 Index rangeTableIndex, List *restrictionClauseList);
+static bool PartitionCanReplaceParent(RangeTblEntry *rangeTableEntry,
+									  Oid partitionId);
+
+
+/*
+ * ReplacePartitionedTablesWithPrunedPartitions replaces the references to
+ * distributed partitioned tables in the SELECT queries of the given query
+ * tree by their only partition that can have rows passing the filters of the
+ * query, where there is one.
+ */
+void
+ReplacePartitionedTablesWithPrunedPartitions(Query *query)
+{
+	if (!EnablePartitionPruning)
+	{
+		return;
+	}
+
+	ReplacePartitionedTablesWalker((Node *) query, NULL);
+}
+
+
+/*
+ * ReplacePartitionedTablesWalker calls ReplacePartitionedTablesInQueryLevel
+ * for each SELECT query in the given query tree.
+ */
+static bool
+ReplacePartitionedTablesWalker(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Query))
+	{
+		Query *query = (Query *) node;
+
+		if (query->commandType == CMD_SELECT)
+		{
+			ReplacePartitionedTablesInQueryLevel(query);
+		}
+
+		return query_tree_walker(query, ReplacePartitionedTablesWalker, context, 0);
+	}
+
+	return expression_tree_walker(node, ReplacePartitionedTablesWalker, context);
+}
+
+
+/*
+ * ReplacePartitionedTablesInQueryLevel replaces the distributed partitioned
+ * tables in the FROM clause of the given query by their only partition that
+ * is not refuted by the WHERE clause. Multi-level partitioned tables are
+ * pruned level by level.
+ *
+ * Only queries whose FROM clause consists of relations separated by commas
+ * are considered. The WHERE clause does not restrict the relations on the
+ * nullable side of an outer join, and we do not look into join clauses.
+ * Queries with row marks are left alone, since those lock rows in the
+ * relation that they name.
+ */
+static void
+ReplacePartitionedTablesInQueryLevel(Query *query)
+{
+	Node *quals = NULL;
+	List *restrictionClauseList = NIL;
+	ListCell *fromCell = NULL;
+
+	if (query->jointree == NULL || query->jointree->quals == NULL ||
+		query->rowMarks != NIL)
+	{
+		return;
+	}
+
+	foreach(fromCell, query->jointree->fromlist)
+	{
+		if (!IsA(lfirst(fromCell), RangeTblRef))
+		{
+			return;
+		}
+	}
+
+	foreach(fromCell, query->jointree->fromlist)
+	{
+		RangeTblRef *rangeTableRef = (RangeTblRef *) lfirst(fromCell);
+		Index rangeTableIndex = rangeTableRef->rtindex;
+		RangeTblEntry *rangeTableEntry = rt_fetch(rangeTableIndex, query->rtable);
+
+		if (rangeTableEntry->rtekind != RTE_RELATION || !rangeTableEntry->inh)
+		{
+			continue;
+		}
+
+		while (IsDistributedTable(rangeTableEntry->relid) &&
+			   PartitionedTable(rangeTableEntry->relid))
+		{
+			Oid parentRelationId = rangeTableEntry->relid;
+			Oid partitionId = InvalidOid;
+
+			/* simplify the WHERE clause once, when it is first needed */
+			if (restrictionClauseList == NIL)
+			{
+				quals = eval_const_expressions(NULL, query->jointree->quals);
+				quals = (Node *) canonicalize_qual((Expr *) quals);
+				restrictionClauseList = make_ands_implicit((Expr *) quals);
+			}
+
+			partitionId = SinglePrunedPartition(rangeTableEntry, rangeTableIndex,
+												restrictionClauseList);
+			if (!OidIsValid(partitionId))
+			{
+				break;
+			}
+
+			ereport(DEBUG2, (errmsg("pruned the partitions of \"%s\" down to \"%s\"",
+									get_rel_name(parentRelationId),
+									get_rel_name(partitionId))));
+
+			rangeTableEntry->relid = partitionId;
+#if (PG_VERSION_NUM >= 100000)
+			rangeTableEntry->relkind = get_rel_relkind(partitionId);
+#endif
+		}
+	}
+}
+
+
+/*
+ * SinglePrunedPartition returns the only partition of the partitioned table
+ * of the given range table entry that the restriction clauses do not refute,
+ * if it can replace the table in the query, or InvalidOid otherwise.
+ */
+static Oid
+SinglePrunedPartition(RangeTblEntry *rangeTableEntry, Index rangeTableIndex,
+					  List *restrictionClauseList)
+{
+	List *prunedPartitionList = PrunedPartitionList(rangeTableEntry->relid,
+													rangeTableIndex,
+													restrictionClauseList);
+	Oid partitionId = InvalidOid;
+
+	if (list_length(prunedPartitionList) != 1)
+	{
+		return InvalidOid;
+	}
+
+	partitionId = linitial_oid(prunedPartitionList);
+
+	if (!IsDistributedTable(partitionId) ||
+		!PartitionCanReplaceParent(rangeTableEntry, partitionId))
+	{
+		return InvalidOid;
+	}
+
+	return partitionId;
+}
+
+
+/*
+ * PartitionCanReplaceParent returns whether the given partition can take the
+ * place of the relation of the given range table entry without changing the
+ * meaning of the query.
+ *
+ * Permissions are checked on the partition once it replaces the parent, so
+ * we require the user to have the permissions on both. The partition also
+ * needs the same attribute numbers as the parent, since the query refers to
+ * columns by number, which is not the case when they have different dropped
+ * columns.
+ */
+static bool
+PartitionCanReplaceParent(RangeTblEntry *rangeTableEntry, Oid partitionId)
+{
+	Oid parentRelationId = rangeTableEntry->relid;
+	Oid userId = OidIsValid(rangeTableEntry->checkAsUser) ?
+				 rangeTableEntry->checkAsUser : GetUserId();
+	Relation parentRelation = NULL;
+	Relation partitionRelation = NULL;
+	TupleDesc parentDescriptor = NULL;
+	TupleDesc partitionDescriptor = NULL;
+	bool canReplaceParent = true;
+	int attributeIndex = 0;
+
+	if ((rangeTableEntry->requiredPerms & ~ACL_SELECT) != 0)
+	{
+		return false;
+	}
+
+	if (rangeTableEntry->requiredPerms == ACL_SELECT &&
+		(pg_class_aclcheck(parentRelationId, userId, ACL_SELECT) != ACLCHECK_OK ||
+		 pg_class_aclcheck(partitionId, userId, ACL_SELECT) != ACLCHECK_OK))
+	{
+		return false;
+	}
+
+	parentRelation = heap_open(parentRelationId, AccessShareLock);
+	partitionRelation = heap_open(partitionId, AccessShareLock);
+
+	parentDescriptor = RelationGetDescr(parentRelation);
+	partitionDescriptor = RelationGetDescr(partitionRelation);
+
+	if (parentRelation->rd_rel->relrowsecurity ||
+		partitionRelation->rd_rel->relrowsecurity ||
+		parentDescriptor->natts != partitionDescriptor->natts)
+	{
+		canReplaceParent = false;
+	}
+
+	for (attributeIndex = 0; canReplaceParent &&
+		 attributeIndex < parentDescriptor->natts; attributeIndex++)
+	{
+		Form_pg_attribute parentAttribute = TupleDescAttr(parentDescriptor,
+														  attributeIndex);
+		Form_pg_attribute partitionAttribute = TupleDescAttr(partitionDescriptor,
+															 attributeIndex);
+
+		if (parentAttribute->attisdropped != partitionAttribute->attisdropped)
+		{
+			canReplaceParent = false;
+		}
+		else if (!parentAttribute->attisdropped &&
+				 (parentAttribute->atttypid != partitionAttribute->atttypid ||
+				  parentAttribute->atttypmod != partitionAttribute->atttypmod ||
+				  parentAttribute->attcollation != partitionAttribute->attcollation))
+		{
+			canReplaceParent = false;
+		}
+	}
+
+	/* keep the locks */
+	heap_close(partitionRelation, NoLock);
+	heap_close(parentRelation, NoLock);
+
+	return canReplaceParent;
+}
@@ -0,0 +1,371 @@
+/*-------------------------------------------------------------------------
+ *
+ * planner_stats.c
+ *   Tracks how often each stage of distributed planning runs and how much
+ *   time it takes, in the citus_stat_planner view.
+ *
+ *   The stages overlap: distributed planning covers the whole of
+ *   CreateDistributedPlan, while shard pruning and deparsing also run as part
+ *   of the router and logical planners, and during execution of queries that
+ *   deferred pruning to the executor. Recursive planning includes planning
+ *   the subplans, which are distributed plans of their own. When a stage is
+ *   entered again while it is already running, only the outermost call is
+ *   counted.
+ *
+ *   Executing a distributed plan that was created for an earlier execution,
+ *   such as the generic plan of a prepared statement, counts as a plan cache
+ *   hit. Each distributed plan in a session gets an increasing identifier, so
+ *   a plan is reused if another plan with the same or a later identifier was
+ *   executed before it.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "distributed/metadata_cache.h"
+#include "distributed/planner_stats.h"
+#include "portability/instr_time.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+
+#define CITUS_PLANNER_STATS_COLUMNS 5
+
+
+/* shared counters of the planner stages, protected by mutex */
+typedef struct PlannerStatsSharedData
+{
+	slock_t mutex;
+
+	uint64 calls[PLANNER_STAGE_COUNT];
+	double totalTime[PLANNER_STAGE_COUNT];
+	double maxTime[PLANNER_STAGE_COUNT];
+
+	uint64 planCacheHits;
+	uint64 planCacheMisses;
+
+	TimestampTz statsSince;
+} PlannerStatsSharedData;
+
+
+/* names of the planner stages as shown by citus_planner_stats */
+static const char *PlannerStageNames[] = {
+	"distributed planning", "fast path router planner", "router planner",
+	"logical planner", "recursive planning", "shard pruning", "deparsing"
+};
+
+
+/* config variable to enable the tracking */
+bool TrackPlannerStats = true;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static PlannerStatsSharedData *PlannerStats = NULL;
+
+/* number of nested calls of each stage in this backend and when they started */
+static int PlannerStageDepth[PLANNER_STAGE_COUNT];
+static instr_time PlannerStageStartTime[PLANNER_STAGE_COUNT];
+
+/* highest identifier of a distributed plan executed by this backend */
+static uint64 LastExecutedPlanId = 0;
+
+
+static size_t PlannerStatsShmemSize(void);
+static void PlannerStatsShmemInit(void);
+
+
+PG_FUNCTION_INFO_V1(citus_planner_stats);
+PG_FUNCTION_INFO_V1(citus_planner_stats_reset);
+
+
+/*
+ * citus_planner_stats returns the number of calls and the total and maximum
+ * time in milliseconds of each stage of distributed planning, followed by
+ * the number of plan cache hits and misses, which do not have a time.
+ */
+Datum
+citus_planner_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	PlannerStatsSharedData stats;
+	Datum values[CITUS_PLANNER_STATS_COLUMNS];
+	bool nulls[CITUS_PLANNER_STATS_COLUMNS];
+	int stageIndex = 0;
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	SpinLockAcquire(&PlannerStats->mutex);
+	memcpy(&stats, PlannerStats, sizeof(PlannerStatsSharedData));
+	SpinLockRelease(&PlannerStats->mutex);
+
+	for (stageIndex = 0; stageIndex < PLANNER_STAGE_COUNT; stageIndex++)
+	{
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(PlannerStageNames[stageIndex]);
+		values[1] = Int64GetDatum(stats.calls[stageIndex]);
+		values[2] = Float8GetDatum(stats.totalTime[stageIndex]);
+		values[3] = Float8GetDatum(stats.maxTime[stageIndex]);
+		values[4] = TimestampTzGetDatum(stats.statsSince);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+	}
+
+	memset(values, 0, sizeof(values));
+	memset(nulls, 0, sizeof(nulls));
+	nulls[2] = true;
+	nulls[3] = true;
+
+	values[0] = CStringGetTextDatum("plan cache hit");
+	values[1] = Int64GetDatum(stats.planCacheHits);
+	values[4] = TimestampTzGetDatum(stats.statsSince);
+	tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+
+	values[0] = CStringGetTextDatum("plan cache miss");
+	values[1] = Int64GetDatum(stats.planCacheMisses);
+	tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+
+	tuplestore_donestoring(tupleStore);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * citus_planner_stats_reset sets all counters of citus_stat_planner to 0.
+ */
+Datum
+citus_planner_stats_reset(PG_FUNCTION_ARGS)
+{
+	CheckCitusVersion(ERROR);
+
+	SpinLockAcquire(&PlannerStats->mutex);
+
+	memset(PlannerStats->calls, 0, sizeof(PlannerStats->calls));
+	memset(PlannerStats->totalTime, 0, sizeof(PlannerStats->totalTime));
+	memset(PlannerStats->maxTime, 0, sizeof(PlannerStats->maxTime));
+	PlannerStats->planCacheHits = 0;
+	PlannerStats->planCacheMisses = 0;
+	PlannerStats->statsSince = GetCurrentTimestamp();
+
+	SpinLockRelease(&PlannerStats->mutex);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * PlannerStatsStart marks that the backend enters the given planner stage.
+ * Every call needs to be followed by a call to PlannerStatsEnd for the same
+ * stage, unless an error is thrown in between.
+ */
+void
+PlannerStatsStart(PlannerStage stage)
+{
+	if (!TrackPlannerStats && PlannerStageDepth[stage] == 0)
+	{
+		return;
+	}
+
+	if (PlannerStageDepth[stage] == 0)
+	{
+		INSTR_TIME_SET_CURRENT(PlannerStageStartTime[stage]);
+	}
+
+	PlannerStageDepth[stage]++;
+}
+
+
+/*
+ * PlannerStatsEnd marks that the backend leaves the given planner stage and,
+ * if this ends the outermost call of the stage, adds the call and the time
+ * it took to the shared counters.
+ */
+void
+PlannerStatsEnd(PlannerStage stage)
+{
+	instr_time stageTime;
+	double stageMillis = 0.0;
+
+	if (PlannerStageDepth[stage] == 0)
+	{
+		/* stage started while tracking was disabled */
+		return;
+	}
+
+	PlannerStageDepth[stage]--;
+	if (PlannerStageDepth[stage] > 0 || PlannerStats == NULL)
+	{
+		return;
+	}
+
+	INSTR_TIME_SET_CURRENT(stageTime);
+	INSTR_TIME_SUBTRACT(stageTime, PlannerStageStartTime[stage]);
+	stageMillis = INSTR_TIME_GET_MILLISEC(stageTime);
+
+	SpinLockAcquire(&PlannerStats->mutex);
+
+	PlannerStats->calls[stage]++;
+	PlannerStats->totalTime[stage] += stageMillis;
+	if (stageMillis > PlannerStats->maxTime[stage])
+	{
+		PlannerStats->maxTime[stage] = stageMillis;
+	}
+
+	SpinLockRelease(&PlannerStats->mutex);
+}
+
+
+/*
+ * RecordDistributedPlanExecution counts the execution of the distributed
+ * plan with the given identifier as a plan cache hit if the plan was already
+ * executed before, and as a miss otherwise.
+ */
+void
+RecordDistributedPlanExecution(uint64 planId)
+{
+	bool planCacheHit = false;
+
+	if (planId <= LastExecutedPlanId)
+	{
+		planCacheHit = true;
+	}
+	else
+	{
+		LastExecutedPlanId = planId;
+	}
+
+	if (!TrackPlannerStats || PlannerStats == NULL)
+	{
+		return;
+	}
+
+	SpinLockAcquire(&PlannerStats->mutex);
+
+	if (planCacheHit)
+	{
+		PlannerStats->planCacheHits++;
+	}
+	else
+	{
+		PlannerStats->planCacheMisses++;
+	}
+
+	SpinLockRelease(&PlannerStats->mutex);
+}
+
+
+/*
+ * ResetPlannerStatsState forgets about the planner stages that an error
+ * interrupted, such that they are counted again by later queries.
+ */
+void
+ResetPlannerStatsState(void)
+{
+	memset(PlannerStageDepth, 0, sizeof(PlannerStageDepth));
+}
+
+
+/*
+ * InitializePlannerStats requests the necessary shared memory from Postgres
+ * and sets up the shared memory startup hook.
+ */
+void
+InitializePlannerStats(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(PlannerStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = PlannerStatsShmemInit;
+}
+
+
+/*
+ * PlannerStatsShmemSize computes how much shared memory is required.
+ */
+static size_t
+PlannerStatsShmemSize(void)
+{
+	return sizeof(PlannerStatsSharedData);
+}
+
+
+/*
+ * PlannerStatsShmemInit initializes the shared memory used for the counters
+ * of the planner stages.
+ */
+static void
+PlannerStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	PlannerStats =
+		(PlannerStatsSharedData *) ShmemInitStruct("Planner Stats Data",
+												   sizeof(PlannerStatsSharedData),
+												   &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(PlannerStats, 0, sizeof(PlannerStatsSharedData));
+		SpinLockInit(&PlannerStats->mutex);
+		PlannerStats->statsSince = GetCurrentTimestamp();
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
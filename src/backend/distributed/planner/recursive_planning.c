@@ -45,18 +45,25 @@
  * replaced then what remains is a router query which can use nearly all
  * SQL features.
  *
+ * The same mechanism lets us broadcast a small distributed table that is
+ * joined with a large one on a column other than the distribution column,
+ * rather than repartitioning both tables, and join local tables of the
+ * coordinator with distributed tables.
+ *
  * Copyright (c) 2017, Citus Data, Inc.
  *-------------------------------------------------------------------------
  */
 
 #include "postgres.h"
 
+#include "access/heapam.h"
 #include "catalog/pg_type.h"
 #include "catalog/pg_class.h"
 #include "distributed/citus_nodes.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/distributed_planner.h"
 #include "distributed/errormessage.h"
+#include "distributed/master_metadata_utility.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_copy.h"
 #include "distributed/multi_logical_planner.h"
@@ -67,8 +74,12 @@
 #include "distributed/recursive_planning.h"
 #include "distributed/relation_restriction_equivalence.h"
 #include "lib/stringinfo.h"
+#include "optimizer/clauses.h"
 #include "optimizer/planner.h"
 #include "optimizer/prep.h"
+#include "optimizer/var.h"
+#include "parser/parse_oper.h"
+#include "parser/parse_relation.h"
 #include "parser/parsetree.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
@@ -76,8 +87,18 @@
 #include "nodes/pg_list.h"
 #include "nodes/primnodes.h"
 #include "nodes/relation.h"
+#include "rewrite/rewriteManip.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/rel.h"
+
+
+/* Config variables managed via guc.c */
+int BroadcastJoinThreshold = 0; /* maximum size of broadcast tables in kB */
+int SemiJoinReductionThreshold = 0; /* maximum size of semi-join key tables in kB */
+bool EnableSubPlanFilterPushdown = false;
+bool EnableLocalTableJoins = true;
+bool EnableCTEInlining = false;
 
 
 /*
@@ -92,6 +113,7 @@ typedef struct RecursivePlanningContext
 	bool allDistributionKeysInQueryAreEqual; /* used for some optimizations */
 	List *subPlanList;
 	PlannerRestrictionContext *plannerRestrictionContext;
+	Query *currentQuery; /* query whose subqueries are being planned */
 } RecursivePlanningContext;
 
 
@@ -105,6 +127,16 @@ typedef struct CteReferenceWalkerContext
 	List *cteReferenceList;
 } CteReferenceWalkerContext;
 
+/*
+ * InlineCteWalkerContext is used to find the single reference to a CTE
+ * and replace it with a subquery in InlineCteWalker.
+ */
+typedef struct InlineCteWalkerContext
+{
+	int level;
+	CommonTableExpr *cte;
+} InlineCteWalkerContext;
+
 /*
  * VarLevelsUpWalkerContext is used to find Vars in a (sub)query that
  * refer to upper levels and therefore cannot be planned separately.
@@ -114,6 +146,19 @@ typedef struct VarLevelsUpWalkerContext
 	int level;
 } VarLevelsUpWalkerContext;
 
+/*
+ * ReferencedColumnsWalkerContext is used to collect the columns of a range
+ * table entry of a query that are referenced anywhere in the query.
+ */
+typedef struct ReferencedColumnsWalkerContext
+{
+	Query *query;
+	Index rangeTableIndex;
+	int levelsUp;
+	Bitmapset *columnSet;
+	bool allColumns;
+} ReferencedColumnsWalkerContext;
+
 
 /* local function forward declarations */
 static DeferredErrorMessage * RecursivelyPlanSubqueriesAndCTEs(Query *query,
@@ -153,14 +198,47 @@ static bool ShouldRecursivelyPlanSetOperation(Query *query,
 static void RecursivelyPlanSetOperations(Query *query, Node *node,
 										 RecursivePlanningContext *context);
 static bool IsLocalTableRTE(Node *node);
+static bool ShouldRecursivelyPlanLocalTables(Query *query,
+											 RecursivePlanningContext *context);
+static void RecursivelyPlanLocalTables(Query *query, RecursivePlanningContext *context);
+static void ReplaceUnreferencedColumnsWithNulls(Query *query, Index rangeTableIndex,
+												Query *subquery);
+static bool ReferencedColumnsWalker(Node *node, ReferencedColumnsWalkerContext *context);
+static bool NonColocatedTablePair(Query *query, Index *smallTableIndex,
+								  uint64 *smallTableSize, Index *largeTableIndex);
+static bool TableCanBeWrappedIntoSubquery(Query *query, Index rangeTableIndex);
+static void RecursivelyPlanSemiJoinReduction(Query *query,
+											 RecursivePlanningContext *context);
+static OpExpr * SemiJoinClause(Query *query, Index smallTableIndex,
+							   Index largeTableIndex, Var **smallTableColumn);
+static Query * SemiJoinKeyQuery(Query *query, Index smallTableIndex,
+								Var *smallTableColumn);
+static RangeTblEntry * SmallTableToBroadcast(Query *query,
+											 RecursivePlanningContext *context);
+static bool JoinTreeContainsOuterJoin(Node *joinTreeNode);
+static bool ContainsSpecialColumnReferenceWalker(Node *node, Index *rangeTableIndex);
+static Query * WrapRelationIntoSubquery(RangeTblEntry *rangeTableEntry);
+static void RecursivelyPlanRelation(RangeTblEntry *rangeTableEntry,
+									RecursivePlanningContext *planningContext);
 static void RecursivelyPlanSubquery(Query *subquery,
 									RecursivePlanningContext *planningContext);
 static DistributedSubPlan * CreateDistributedSubPlan(uint32 subPlanId,
 													 Query *subPlanQuery);
 static bool CteReferenceListWalker(Node *node, CteReferenceWalkerContext *context);
+static bool RecursivelyInlineCtesWalker(Node *node, void *context);
+static void InlineCtesInQuery(Query *query);
+static bool CteIsInlinable(Query *query, CommonTableExpr *cte);
+static bool InlineCteWalker(Node *node, InlineCteWalkerContext *context);
 static bool ContainsReferencesToOuterQuery(Query *query);
 static bool ContainsReferencesToOuterQueryWalker(Node *node,
 												 VarLevelsUpWalkerContext *context);
+static void PushDownFiltersIntoSubPlan(Query *outerQuery, Index rangeTableIndex,
+									   Query *subquery);
+static Index SubqueryRangeTableIndex(Query *outerQuery, Query *subquery);
+static Index CteRangeTableIndex(Query *outerQuery, char *cteName);
+static bool SubqueryIsFilterPushdownSafe(Query *subquery);
+static bool FilterIsPushdownSafe(Node *qual, Index rangeTableIndex, Query *subquery);
+static bool ContainsParamWalker(Node *node, void *context);
 static Query * BuildSubPlanResultQuery(Query *subquery, List *columnAliasList,
 									   uint64 planId, uint32 subPlanId);
 
@@ -187,6 +265,7 @@ GenerateSubplansForSubqueriesAndCTEs(uint64 planId, Query *originalQuery,
 	context.planId = planId;
 	context.subPlanList = NIL;
 	context.plannerRestrictionContext = plannerRestrictionContext;
+	context.currentQuery = NULL;
 
 	/*
 	 * Calculating the distribution key equality upfront is a trade-off for us.
@@ -242,6 +321,8 @@ static DeferredErrorMessage *
 RecursivelyPlanSubqueriesAndCTEs(Query *query, RecursivePlanningContext *context)
 {
 	DeferredErrorMessage *error = NULL;
+	RangeTblEntry *smallTableEntry = NULL;
+	Query *previousQuery = NULL;
 
 	error = RecursivelyPlanCTEs(query, context);
 	if (error != NULL)
@@ -264,9 +345,22 @@ RecursivelyPlanSubqueriesAndCTEs(Query *query, RecursivePlanningContext *context
 		return NULL;
 	}
 
+	/* all subqueries planned below are planned on behalf of this query */
+	previousQuery = context->currentQuery;
+	context->currentQuery = query;
+
 	/* descend into subqueries */
 	query_tree_walker(query, RecursivelyPlanSubqueryWalker, context, 0);
 
+	/*
+	 * Local tables cannot be read on the workers, so local tables that are
+	 * joined with distributed tables are replaced by intermediate results.
+	 */
+	if (ShouldRecursivelyPlanLocalTables(query, context))
+	{
+		RecursivelyPlanLocalTables(query, context);
+	}
+
 	/*
 	 * At this point, all CTEs, leaf subqueries containing local tables and
 	 * non-pushdownable subqueries have been replaced. We now check for
@@ -293,6 +387,25 @@ RecursivelyPlanSubqueriesAndCTEs(Query *query, RecursivePlanningContext *context
 		RecursivelyPlanAllSubqueries((Node *) query->jointree->quals, context);
 	}
 
+	/*
+	 * If the query joins a small distributed table with a large one on
+	 * columns other than the distribution keys, broadcast the small table as
+	 * an intermediate result instead of repartitioning.
+	 */
+	smallTableEntry = SmallTableToBroadcast(query, context);
+	if (smallTableEntry != NULL)
+	{
+		RecursivelyPlanRelation(smallTableEntry, context);
+	}
+	else
+	{
+		/*
+		 * Otherwise, we might still avoid repartitioning by only pulling the
+		 * rows of the large table that join with the small one.
+		 */
+		RecursivelyPlanSemiJoinReduction(query, context);
+	}
+
 	/*
 	 * If the query doesn't have distribution key equality,
 	 * recursively plan some of its subqueries.
@@ -302,6 +415,8 @@ RecursivelyPlanSubqueriesAndCTEs(Query *query, RecursivePlanningContext *context
 		RecursivelyPlanNonColocatedSubqueries(query, context);
 	}
 
+	context->currentQuery = previousQuery;
+
 	return NULL;
 }
 
@@ -710,6 +825,21 @@ RecursivelyPlanCTEs(Query *query, RecursivePlanningContext *planningContext)
 
 		subPlanId = list_length(planningContext->subPlanList) + 1;
 
+		/*
+		 * A CTE that is referenced once can be restricted by the filters on
+		 * that reference, such that we don't materialize the rows that the
+		 * outer query throws away anyway.
+		 */
+		if (EnableSubPlanFilterPushdown && cte->cterefcount == 1)
+		{
+			Index rangeTableIndex = CteRangeTableIndex(query, cteName);
+
+			if (rangeTableIndex != 0)
+			{
+				PushDownFiltersIntoSubPlan(query, rangeTableIndex, subquery);
+			}
+		}
+
 		if (log_min_messages <= DEBUG1 || client_min_messages <= DEBUG1)
 		{
 			StringInfo subPlanString = makeStringInfo();
@@ -849,7 +979,7 @@ ShouldRecursivelyPlanSubquery(Query *subquery, RecursivePlanningContext *context
 		 * do not contain any other local tables.
 		 */
 	}
-	else if (DeferErrorIfCannotPushdownSubquery(subquery, false) == NULL)
+	else if (DeferErrorIfCannotPushdownSubquery(subquery, false, false) == NULL)
 	{
 		/*
 		 * We should do one more check for the distribution key equality.
@@ -1062,145 +1192,1366 @@ IsLocalTableRTE(Node *node)
 
 
 /*
- * RecursivelyPlanQuery recursively plans a query, replaces it with a
- * result query and returns the subplan.
- *
- * Before we recursively plan the given subquery, we should ensure
- * that the subquery doesn't contain any references to the outer
- * queries (i.e., such queries cannot be separately planned). In
- * that case, the function doesn't recursively plan the input query
- * and immediately returns. Later, the planner decides on what to do
- * with the query.
+ * ShouldRecursivelyPlanLocalTables returns true if the given SELECT query has
+ * local tables in its FROM clause that need to be replaced by intermediate
+ * results to be joined with distributed tables. That is the case for the
+ * top-level query, and for subqueries that also read distributed tables.
+ * Subqueries that only read local tables are planned as a whole, since
+ * Postgres can plan them without our help.
  */
-static void
-RecursivelyPlanSubquery(Query *subquery, RecursivePlanningContext *planningContext)
+static bool
+ShouldRecursivelyPlanLocalTables(Query *query, RecursivePlanningContext *context)
 {
-	DistributedSubPlan *subPlan = NULL;
-	uint64 planId = planningContext->planId;
-	int subPlanId = 0;
-
-	Query *resultQuery = NULL;
-	Query *debugQuery = NULL;
-
-	if (ContainsReferencesToOuterQuery(subquery))
+	if (!EnableLocalTableJoins || query->commandType != CMD_SELECT)
 	{
-		elog(DEBUG2, "skipping recursive planning for the subquery since it "
-					 "contains references to outer queries");
+		return false;
+	}
 
-		return;
+	if (!FindNodeCheckInRangeTableList(query->rtable, IsLocalTableRTE))
+	{
+		return false;
 	}
 
-	/*
-	 * Subquery will go through the standard planner, thus to properly deparse it
-	 * we keep its copy: debugQuery.
-	 */
-	if (log_min_messages <= DEBUG1 || client_min_messages <= DEBUG1)
+	if (context->level == 0)
 	{
-		debugQuery = copyObject(subquery);
+		return true;
 	}
 
-	/*
-	 * Create the subplan and append it to the list in the planning context.
-	 */
-	subPlanId = list_length(planningContext->subPlanList) + 1;
+	return FindNodeCheck((Node *) query, IsDistributedTableRTE);
+}
 
-	subPlan = CreateDistributedSubPlan(subPlanId, subquery);
-	planningContext->subPlanList = lappend(planningContext->subPlanList, subPlan);
 
-	/*
-	 * BuildSubPlanResultQuery() can optionally use provided column aliases.
-	 * We do not need to send additional alias list for subqueries.
-	 */
-	resultQuery = BuildSubPlanResultQuery(subquery, NIL, planId, subPlanId);
+/*
+ * RecursivelyPlanLocalTables replaces the local tables in the range table of
+ * the given query by subqueries on intermediate results. Each local table is
+ * wrapped into a subquery that only selects the columns the query references,
+ * and the filters of the query on the table are applied within the subquery,
+ * such that only the rows and columns that are needed are sent to the workers.
+ * The results are only sent to the workers whose tasks read them.
+ *
+ * Tables whose system columns or whole rows are referenced are left alone, and
+ * the query then errors out like before.
+ */
+static void
+RecursivelyPlanLocalTables(Query *query, RecursivePlanningContext *context)
+{
+	Index rangeTableIndex = 0;
+	ListCell *rangeTableCell = NULL;
 
-	if (log_min_messages <= DEBUG1 || client_min_messages <= DEBUG1)
+	foreach(rangeTableCell, query->rtable)
 	{
-		StringInfo subqueryString = makeStringInfo();
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+		Query *subquery = NULL;
 
-		pg_get_query_def(debugQuery, subqueryString);
+		rangeTableIndex++;
 
-		ereport(DEBUG1, (errmsg("generating subplan " UINT64_FORMAT "_%u for "
-																	"subquery %s",
-								planId, subPlanId, subqueryString->data)));
-	}
+		if (!IsLocalTableRTE((Node *) rangeTableEntry) ||
+			!TableCanBeWrappedIntoSubquery(query, rangeTableIndex))
+		{
+			continue;
+		}
 
-	/* finally update the input subquery to point the result query */
-	memcpy(subquery, resultQuery, sizeof(Query));
+		ereport(DEBUG1, (errmsg("local table \"%s\" is planned as an intermediate "
+								"result", get_rel_name(rangeTableEntry->relid))));
+
+		subquery = WrapRelationIntoSubquery(rangeTableEntry);
+		ReplaceUnreferencedColumnsWithNulls(query, rangeTableIndex, subquery);
+
+		/* the filters on local tables are always applied before sending them */
+		if (!EnableSubPlanFilterPushdown &&
+			SubqueryRangeTableIndex(query, subquery) == rangeTableIndex)
+		{
+			PushDownFiltersIntoSubPlan(query, rangeTableIndex, subquery);
+		}
+
+		RecursivelyPlanSubquery(subquery, context);
+	}
 }
 
 
 /*
- * CreateDistributedSubPlan creates a distributed subplan by recursively calling
- * the planner from the top, which may either generate a local plan or another
- * distributed plan, which can itself contain subplans.
+ * ReplaceUnreferencedColumnsWithNulls replaces the columns in the target list
+ * of the given subquery, which wraps the relation with the given range table
+ * index, by NULL constants if the query does not reference them. The column
+ * numbers of the subquery stay the same, but the intermediate result of the
+ * subquery does not carry the values of the unused columns.
  */
-static DistributedSubPlan *
-CreateDistributedSubPlan(uint32 subPlanId, Query *subPlanQuery)
+static void
+ReplaceUnreferencedColumnsWithNulls(Query *query, Index rangeTableIndex,
+									Query *subquery)
 {
-	DistributedSubPlan *subPlan = NULL;
-	int cursorOptions = 0;
+	ReferencedColumnsWalkerContext walkerContext;
+	ListCell *targetEntryCell = NULL;
 
-	if (ContainsReadIntermediateResultFunction((Node *) subPlanQuery))
+	walkerContext.query = query;
+	walkerContext.rangeTableIndex = rangeTableIndex;
+	walkerContext.levelsUp = 0;
+	walkerContext.columnSet = NULL;
+	walkerContext.allColumns = false;
+
+	query_tree_walker(query, ReferencedColumnsWalker, &walkerContext,
+					  QTW_IGNORE_JOINALIASES);
+
+	if (walkerContext.allColumns)
 	{
-		/*
-		 * Make sure we go through distributed planning if there are
-		 * read_intermediate_result calls, even if there are no distributed
-		 * tables in the query anymore.
-		 *
-		 * We cannot perform this check in the planner itself, since that
-		 * would also cause the workers to attempt distributed planning.
-		 */
-		cursorOptions |= CURSOR_OPT_FORCE_DISTRIBUTED;
+		return;
 	}
 
-	subPlan = CitusMakeNode(DistributedSubPlan);
-	subPlan->plan = planner(subPlanQuery, cursorOptions, NULL);
-	subPlan->subPlanId = subPlanId;
+	foreach(targetEntryCell, subquery->targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		Var *column = NULL;
 
-	return subPlan;
+		if (!IsA(targetEntry->expr, Var))
+		{
+			/* dropped columns are already NULL */
+			continue;
+		}
+
+		column = (Var *) targetEntry->expr;
+		if (bms_is_member(targetEntry->resno, walkerContext.columnSet))
+		{
+			continue;
+		}
+
+		targetEntry->expr = (Expr *) makeNullConst(column->vartype, column->vartypmod,
+												   column->varcollid);
+	}
 }
 
 
 /*
- * CteReferenceListWalker finds all references to CTEs in the top level of a query
- * and adds them to context->cteReferenceList.
+ * ReferencedColumnsWalker collects the columns of the range table entry in the
+ * context that are referenced in the given node, including references from
+ * subqueries and references through join aliases. If a whole row of the entry,
+ * or of a join, is referenced, all columns are considered referenced.
  */
 static bool
-CteReferenceListWalker(Node *node, CteReferenceWalkerContext *context)
+ReferencedColumnsWalker(Node *node, ReferencedColumnsWalkerContext *context)
 {
 	if (node == NULL)
 	{
 		return false;
 	}
 
-	if (IsA(node, RangeTblEntry))
+	if (IsA(node, Var))
 	{
-		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) node;
+		Var *column = (Var *) node;
+		RangeTblEntry *rangeTableEntry = NULL;
 
-		if (rangeTableEntry->rtekind == RTE_CTE &&
-			rangeTableEntry->ctelevelsup == context->level)
+		if (column->varlevelsup != context->levelsUp)
 		{
-			context->cteReferenceList = lappend(context->cteReferenceList,
-												rangeTableEntry);
+			return false;
+		}
+
+		if (column->varno == context->rangeTableIndex)
+		{
+			if (column->varattno <= 0)
+			{
+				context->allColumns = true;
+			}
+			else
+			{
+				context->columnSet = bms_add_member(context->columnSet,
+													column->varattno);
+			}
+
+			return false;
+		}
+
+		rangeTableEntry = rt_fetch(column->varno, context->query->rtable);
+		if (rangeTableEntry->rtekind == RTE_JOIN)
+		{
+			if (column->varattno <= 0)
+			{
+				context->allColumns = true;
+			}
+			else
+			{
+				/* join aliases refer to the range table of the joining query */
+				Node *aliasNode = list_nth(rangeTableEntry->joinaliasvars,
+										   column->varattno - 1);
+				int levelsUp = context->levelsUp;
+
+				context->levelsUp = 0;
+				ReferencedColumnsWalker(aliasNode, context);
+				context->levelsUp = levelsUp;
+			}
 		}
 
-		/* caller will descend into range table entry */
 		return false;
 	}
 	else if (IsA(node, Query))
 	{
-		Query *query = (Query *) node;
+		bool result = false;
 
-		context->level += 1;
-		query_tree_walker(query, CteReferenceListWalker, context, QTW_EXAMINE_RTES);
-		context->level -= 1;
+		context->levelsUp++;
+		result = query_tree_walker((Query *) node, ReferencedColumnsWalker, context,
+								   QTW_IGNORE_JOINALIASES);
+		context->levelsUp--;
+
+		return result;
+	}
+
+	return expression_tree_walker(node, ReferencedColumnsWalker, context);
+}
+
+
+/*
+ * SmallTableToBroadcast returns the range table entry of the distributed table
+ * to broadcast if the given query joins exactly two distributed tables, which
+ * are not joined on their distribution keys, and the smaller of them is below
+ * citus.broadcast_join_threshold. Table sizes are taken from the shard lengths
+ * in the metadata; tables without shard statistics are never broadcast.
+ *
+ * To keep the remaining query pushdownable, we only consider queries without
+ * outer joins, subqueries, or local tables, and skip tables whose system
+ * columns or whole rows are referenced. The function returns NULL if we should
+ * not broadcast.
+ */
+static RangeTblEntry *
+SmallTableToBroadcast(Query *query, RecursivePlanningContext *context)
+{
+	RangeTblEntry *smallTableEntry = NULL;
+	Index smallTableIndex = 0;
+	Index largeTableIndex = 0;
+	uint64 smallTableSize = 0;
+	uint64 broadcastThresholdBytes = (uint64) BroadcastJoinThreshold * 1024;
+
+	if (BroadcastJoinThreshold <= 0 || context->allDistributionKeysInQueryAreEqual)
+	{
+		return NULL;
+	}
+
+	if (!NonColocatedTablePair(query, &smallTableIndex, &smallTableSize,
+							   &largeTableIndex))
+	{
+		return NULL;
+	}
+
+	if (smallTableSize == 0 || smallTableSize > broadcastThresholdBytes ||
+		!TableCanBeWrappedIntoSubquery(query, smallTableIndex))
+	{
+		return NULL;
+	}
+
+	/* the tables might still be joined on their distribution keys */
+	if (AllDistributionKeysInSubqueryAreEqual(query, context->plannerRestrictionContext))
+	{
+		return NULL;
+	}
+
+	smallTableEntry = rt_fetch(smallTableIndex, query->rtable);
+
+	ereport(DEBUG1, (errmsg("broadcasting table \"%s\" of " UINT64_FORMAT " bytes",
+							get_rel_name(smallTableEntry->relid), smallTableSize)));
+
+	return smallTableEntry;
+}
+
+
+/*
+ * NonColocatedTablePair returns true if the given query is a SELECT that joins
+ * exactly two distributed tables, and sets the range table indexes of the
+ * smaller and the larger one. Table sizes are taken from the shard lengths in
+ * the metadata, and the size of the smaller table is also returned.
+ *
+ * To keep the query pushdownable once one of the tables is replaced by an
+ * intermediate result, we only consider queries without outer joins,
+ * subqueries, or local tables. The caller should still check whether the
+ * tables are joined on their distribution keys.
+ */
+static bool
+NonColocatedTablePair(Query *query, Index *smallTableIndex, uint64 *smallTableSize,
+					  Index *largeTableIndex)
+{
+	RangeTblEntry *smallTableEntry = NULL;
+	int distributedTableCount = 0;
+	Index rangeTableIndex = 0;
+	ListCell *rangeTableCell = NULL;
 
+	if (query->commandType != CMD_SELECT || query->hasSubLinks ||
+		query->setOperations != NULL)
+	{
 		return false;
 	}
-	else
+
+	if (JoinTreeContainsOuterJoin((Node *) query->jointree) ||
+		ContainsReferencesToOuterQuery(query))
 	{
-		return expression_tree_walker(node, CteReferenceListWalker, context);
+		return false;
+	}
+
+	*smallTableIndex = 0;
+	*largeTableIndex = 0;
+	*smallTableSize = 0;
+
+	foreach(rangeTableCell, query->rtable)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+		uint64 tableSize = 0;
+
+		rangeTableIndex++;
+
+		if (rangeTableEntry->rtekind == RTE_SUBQUERY)
+		{
+			return false;
+		}
+		else if (rangeTableEntry->rtekind != RTE_RELATION)
+		{
+			continue;
+		}
+
+		if (IsLocalTableRTE((Node *) rangeTableEntry))
+		{
+			return false;
+		}
+
+		if (PartitionMethod(rangeTableEntry->relid) == DISTRIBUTE_BY_NONE)
+		{
+			/* reference tables are already available on all nodes */
+			continue;
+		}
+
+		distributedTableCount++;
+
+		tableSize = TableShardLength(rangeTableEntry->relid);
+		if (smallTableEntry == NULL || tableSize < *smallTableSize)
+		{
+			*largeTableIndex = *smallTableIndex;
+			smallTableEntry = rangeTableEntry;
+			*smallTableIndex = rangeTableIndex;
+			*smallTableSize = tableSize;
+		}
+		else
+		{
+			*largeTableIndex = rangeTableIndex;
+		}
+	}
+
+	return distributedTableCount == 2;
+}
+
+
+/*
+ * TableCanBeWrappedIntoSubquery returns true if the relation with the given
+ * range table index can be replaced by a subquery that selects all of its
+ * columns, which is not the case for sampled tables and for tables whose
+ * system columns or whole rows are referenced.
+ */
+static bool
+TableCanBeWrappedIntoSubquery(Query *query, Index rangeTableIndex)
+{
+	RangeTblEntry *rangeTableEntry = rt_fetch(rangeTableIndex, query->rtable);
+
+	if (rangeTableEntry->tablesample != NULL)
+	{
+		return false;
 	}
+
+	if (query_tree_walker(query, ContainsSpecialColumnReferenceWalker,
+						  &rangeTableIndex, 0))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * RecursivelyPlanSemiJoinReduction reduces the larger table of a join between
+ * two distributed tables that are not joined on their distribution keys. It
+ * first plans a subplan that collects the distinct join keys of the smaller
+ * table, after applying the filters of the query on that table. The larger
+ * table is then replaced by a subplan that joins it with those keys, such
+ * that only its rows that can join end up in the intermediate result and the
+ * remaining join can be pushed down to the shards of the smaller table.
+ *
+ * The keys are only collected when the smaller table is below
+ * citus.semi_join_reduction_threshold, since they are sent to every worker.
+ */
+static void
+RecursivelyPlanSemiJoinReduction(Query *query, RecursivePlanningContext *context)
+{
+	RangeTblEntry *smallTableEntry = NULL;
+	RangeTblEntry *largeTableEntry = NULL;
+	RangeTblEntry *keyEntry = NULL;
+	RangeTblRef *keyReference = NULL;
+	Index smallTableIndex = 0;
+	Index largeTableIndex = 0;
+	uint64 smallTableSize = 0;
+	uint64 thresholdBytes = (uint64) SemiJoinReductionThreshold * 1024;
+	Var *smallTableColumn = NULL;
+	OpExpr *joinClause = NULL;
+	Query *keyQuery = NULL;
+	Query *reducedQuery = NULL;
+	List *columnList = NIL;
+	ListCell *columnCell = NULL;
+
+	if (SemiJoinReductionThreshold <= 0 || context->allDistributionKeysInQueryAreEqual)
+	{
+		return;
+	}
+
+	if (!NonColocatedTablePair(query, &smallTableIndex, &smallTableSize,
+							   &largeTableIndex))
+	{
+		return;
+	}
+
+	if (smallTableSize == 0 || smallTableSize > thresholdBytes ||
+		!TableCanBeWrappedIntoSubquery(query, largeTableIndex))
+	{
+		return;
+	}
+
+	joinClause = SemiJoinClause(query, smallTableIndex, largeTableIndex,
+								&smallTableColumn);
+	if (joinClause == NULL)
+	{
+		return;
+	}
+
+	/* the tables might still be joined on their distribution keys */
+	if (AllDistributionKeysInSubqueryAreEqual(query, context->plannerRestrictionContext))
+	{
+		return;
+	}
+
+	keyQuery = SemiJoinKeyQuery(query, smallTableIndex, smallTableColumn);
+	if (keyQuery == NULL)
+	{
+		return;
+	}
+
+	smallTableEntry = rt_fetch(smallTableIndex, query->rtable);
+	largeTableEntry = rt_fetch(largeTableIndex, query->rtable);
+
+	ereport(DEBUG1, (errmsg("reducing table \"%s\" to the rows that join with "
+							"table \"%s\"", get_rel_name(largeTableEntry->relid),
+							get_rel_name(smallTableEntry->relid))));
+
+	/* the keys are replaced by a query on their intermediate result */
+	RecursivelyPlanSubquery(keyQuery, context);
+
+	keyEntry = makeNode(RangeTblEntry);
+	keyEntry->rtekind = RTE_SUBQUERY;
+	keyEntry->subquery = keyQuery;
+	keyEntry->eref = makeAlias("join_keys", list_make1(makeString("join_key")));
+	keyEntry->inFromCl = true;
+
+	keyReference = makeNode(RangeTblRef);
+	keyReference->rtindex = 2;
+
+	/*
+	 * The large table becomes SELECT * FROM large, join_keys WHERE <join clause>,
+	 * where the join clause now refers to the join key in place of the column
+	 * of the small table.
+	 */
+	reducedQuery = WrapRelationIntoSubquery(largeTableEntry);
+	reducedQuery->rtable = lappend(reducedQuery->rtable, keyEntry);
+	reducedQuery->jointree->fromlist = lappend(reducedQuery->jointree->fromlist,
+											   keyReference);
+
+	joinClause = copyObject(joinClause);
+	columnList = pull_var_clause_default((Node *) joinClause);
+	foreach(columnCell, columnList)
+	{
+		Var *column = (Var *) lfirst(columnCell);
+
+		if (column->varno == largeTableIndex)
+		{
+			column->varno = 1;
+			column->varnoold = 1;
+		}
+		else
+		{
+			column->varno = keyReference->rtindex;
+			column->varnoold = keyReference->rtindex;
+			column->varattno = 1;
+			column->varoattno = 1;
+		}
+	}
+
+	reducedQuery->jointree->quals = (Node *) joinClause;
+
+	RecursivelyPlanSubquery(reducedQuery, context);
+}
+
+
+/*
+ * SemiJoinClause returns an equality clause of the query between a column of
+ * the small table and an expression on the large table, and sets the column
+ * of the small table. The function returns NULL if there is no such clause.
+ */
+static OpExpr *
+SemiJoinClause(Query *query, Index smallTableIndex, Index largeTableIndex,
+			   Var **smallTableColumn)
+{
+	List *qualList = InnerJoinQualList((Node *) query->jointree);
+	ListCell *qualCell = NULL;
+
+	foreach(qualCell, qualList)
+	{
+		Node *qual = (Node *) lfirst(qualCell);
+		OpExpr *operatorExpression = NULL;
+		Node *leftArgument = NULL;
+		Node *rightArgument = NULL;
+		Node *largeTableArgument = NULL;
+		Var *column = NULL;
+
+		if (!IsA(qual, OpExpr) || list_length(((OpExpr *) qual)->args) != 2)
+		{
+			continue;
+		}
+
+		operatorExpression = (OpExpr *) qual;
+		if (!OperatorImplementsEquality(operatorExpression->opno))
+		{
+			continue;
+		}
+
+		leftArgument = strip_implicit_coercions(linitial(operatorExpression->args));
+		rightArgument = strip_implicit_coercions(lsecond(operatorExpression->args));
+
+		if (IsA(leftArgument, Var) && ((Var *) leftArgument)->varno == smallTableIndex)
+		{
+			column = (Var *) leftArgument;
+			largeTableArgument = rightArgument;
+		}
+		else if (IsA(rightArgument, Var) &&
+				 ((Var *) rightArgument)->varno == smallTableIndex)
+		{
+			column = (Var *) rightArgument;
+			largeTableArgument = leftArgument;
+		}
+		else
+		{
+			continue;
+		}
+
+		/* the other side should only depend on the large table */
+		if (column->varlevelsup != 0 || column->varattno <= 0 ||
+			!bms_equal(pull_varnos(largeTableArgument),
+					   bms_make_singleton(largeTableIndex)) ||
+			contain_volatile_functions(largeTableArgument))
+		{
+			continue;
+		}
+
+		*smallTableColumn = column;
+
+		return operatorExpression;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * SemiJoinKeyQuery builds SELECT DISTINCT column FROM small WHERE <filters>,
+ * where the filters are the ones of the query that only reference the small
+ * table and can be evaluated in a separate subplan. The function returns NULL
+ * if the type of the column cannot be made distinct.
+ */
+static Query *
+SemiJoinKeyQuery(Query *query, Index smallTableIndex, Var *smallTableColumn)
+{
+	Query *keyQuery = makeNode(Query);
+	RangeTblEntry *relationEntry = copyObject(rt_fetch(smallTableIndex, query->rtable));
+	RangeTblRef *relationReference = makeNode(RangeTblRef);
+	Var *keyColumn = copyObject(smallTableColumn);
+	TargetEntry *keyTargetEntry = NULL;
+	SortGroupClause *distinctClause = makeNode(SortGroupClause);
+	Oid lessThanOperator = InvalidOid;
+	Oid equalsOperator = InvalidOid;
+	bool hashable = false;
+	List *filterList = NIL;
+	List *qualList = InnerJoinQualList((Node *) query->jointree);
+	ListCell *qualCell = NULL;
+	VarLevelsUpWalkerContext levelsUpContext = { 0 };
+
+	get_sort_group_operators(keyColumn->vartype, false, true, false,
+							 &lessThanOperator, &equalsOperator, NULL, &hashable);
+	if (!OidIsValid(lessThanOperator) && !hashable)
+	{
+		return NULL;
+	}
+
+	foreach(qualCell, qualList)
+	{
+		Node *qual = (Node *) lfirst(qualCell);
+		Relids qualRangeTableIndexes = pull_varnos(qual);
+
+		if (!bms_equal(qualRangeTableIndexes, bms_make_singleton(smallTableIndex)))
+		{
+			continue;
+		}
+
+		/* subplans are planned without the bound parameters */
+		if (contain_volatile_functions(qual) || ContainsParamWalker(qual, NULL) ||
+			ContainsReferencesToOuterQueryWalker(qual, &levelsUpContext))
+		{
+			continue;
+		}
+
+		qual = copyObject(qual);
+		ChangeVarNodes(qual, smallTableIndex, 1, 0);
+
+		filterList = lappend(filterList, qual);
+	}
+
+	keyColumn->varno = 1;
+	keyColumn->varnoold = 1;
+
+	keyTargetEntry = makeTargetEntry((Expr *) keyColumn, 1, pstrdup("join_key"),
+									 false);
+	keyTargetEntry->ressortgroupref = 1;
+
+	distinctClause->tleSortGroupRef = 1;
+	distinctClause->eqop = equalsOperator;
+	distinctClause->sortop = lessThanOperator;
+	distinctClause->nulls_first = false;
+	distinctClause->hashable = hashable;
+
+	relationReference->rtindex = 1;
+
+	keyQuery->commandType = CMD_SELECT;
+	keyQuery->querySource = QSRC_ORIGINAL;
+	keyQuery->canSetTag = true;
+	keyQuery->rtable = list_make1(relationEntry);
+	keyQuery->jointree = makeFromExpr(list_make1(relationReference),
+									  filterList != NIL ?
+									  (Node *) make_ands_explicit(filterList) : NULL);
+	keyQuery->targetList = list_make1(keyTargetEntry);
+	keyQuery->distinctClause = list_make1(distinctClause);
+
+	return keyQuery;
+}
+
+
+/*
+ * JoinTreeContainsOuterJoin returns true if the given join tree node contains
+ * a join other than an inner join.
+ */
+static bool
+JoinTreeContainsOuterJoin(Node *joinTreeNode)
+{
+	if (joinTreeNode == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(joinTreeNode, FromExpr))
+	{
+		FromExpr *fromExpr = (FromExpr *) joinTreeNode;
+		ListCell *fromCell = NULL;
+
+		foreach(fromCell, fromExpr->fromlist)
+		{
+			if (JoinTreeContainsOuterJoin((Node *) lfirst(fromCell)))
+			{
+				return true;
+			}
+		}
+	}
+	else if (IsA(joinTreeNode, JoinExpr))
+	{
+		JoinExpr *joinExpr = (JoinExpr *) joinTreeNode;
+
+		if (joinExpr->jointype != JOIN_INNER)
+		{
+			return true;
+		}
+
+		return JoinTreeContainsOuterJoin(joinExpr->larg) ||
+			   JoinTreeContainsOuterJoin(joinExpr->rarg);
+	}
+
+	return false;
+}
+
+
+/*
+ * ContainsSpecialColumnReferenceWalker returns true if the given node refers to
+ * a system column or to the whole row of the range table entry with the given
+ * index. Such references do not survive replacing the relation with a subquery.
+ */
+static bool
+ContainsSpecialColumnReferenceWalker(Node *node, Index *rangeTableIndex)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Var))
+	{
+		Var *column = (Var *) node;
+
+		return column->varlevelsup == 0 && column->varno == *rangeTableIndex &&
+			   column->varattno <= 0;
+	}
+
+	return expression_tree_walker(node, ContainsSpecialColumnReferenceWalker,
+								  rangeTableIndex);
+}
+
+
+/*
+ * RecursivelyPlanRelation turns the given relation range table entry into a
+ * subquery that selects all of its columns, and recursively plans the
+ * subquery.
+ */
+static void
+RecursivelyPlanRelation(RangeTblEntry *rangeTableEntry,
+						RecursivePlanningContext *planningContext)
+{
+	Query *subquery = WrapRelationIntoSubquery(rangeTableEntry);
+
+	RecursivelyPlanSubquery(subquery, planningContext);
+}
+
+
+/*
+ * WrapRelationIntoSubquery turns the given relation range table entry into a
+ * subquery that selects all of its columns and returns the subquery. Dropped
+ * columns are kept as NULL placeholders, such that the column numbers of the
+ * outer query remain valid.
+ */
+static Query *
+WrapRelationIntoSubquery(RangeTblEntry *rangeTableEntry)
+{
+	Query *subquery = makeNode(Query);
+	RangeTblEntry *relationEntry = copyObject(rangeTableEntry);
+	RangeTblRef *relationReference = makeNode(RangeTblRef);
+	Relation relation = heap_open(rangeTableEntry->relid, NoLock);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	List *targetList = NIL;
+	int attributeIndex = 0;
+
+	for (attributeIndex = 0; attributeIndex < tupleDescriptor->natts; attributeIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, attributeIndex);
+		AttrNumber resultNumber = attributeIndex + 1;
+		TargetEntry *targetEntry = NULL;
+
+		if (attribute->attisdropped)
+		{
+			Const *nullConst = makeNullConst(INT4OID, -1, InvalidOid);
+
+			targetEntry = makeTargetEntry((Expr *) nullConst, resultNumber,
+										  pstrdup("dropped_column"), false);
+		}
+		else
+		{
+			Var *column = makeVar(1, resultNumber, attribute->atttypid,
+								  attribute->atttypmod, attribute->attcollation, 0);
+
+			targetEntry = makeTargetEntry((Expr *) column, resultNumber,
+										  pstrdup(NameStr(attribute->attname)), false);
+		}
+
+		targetList = lappend(targetList, targetEntry);
+	}
+
+	heap_close(relation, NoLock);
+
+	relationReference->rtindex = 1;
+
+	subquery->commandType = CMD_SELECT;
+	subquery->querySource = QSRC_ORIGINAL;
+	subquery->canSetTag = true;
+	subquery->rtable = list_make1(relationEntry);
+	subquery->jointree = makeFromExpr(list_make1(relationReference), NULL);
+	subquery->targetList = targetList;
+
+	/* permissions are checked on the relation inside the subquery */
+	rangeTableEntry->rtekind = RTE_SUBQUERY;
+	rangeTableEntry->subquery = subquery;
+	rangeTableEntry->relid = InvalidOid;
+	rangeTableEntry->relkind = 0;
+	rangeTableEntry->inh = false;
+	rangeTableEntry->requiredPerms = 0;
+	rangeTableEntry->checkAsUser = InvalidOid;
+	rangeTableEntry->selectedCols = NULL;
+	rangeTableEntry->insertedCols = NULL;
+	rangeTableEntry->updatedCols = NULL;
+
+	return subquery;
+}
+
+
+/*
+ * RecursivelyPlanQuery recursively plans a query, replaces it with a
+ * result query and returns the subplan.
+ *
+ * Before we recursively plan the given subquery, we should ensure
+ * that the subquery doesn't contain any references to the outer
+ * queries (i.e., such queries cannot be separately planned). In
+ * that case, the function doesn't recursively plan the input query
+ * and immediately returns. Later, the planner decides on what to do
+ * with the query.
+ */
+static void
+RecursivelyPlanSubquery(Query *subquery, RecursivePlanningContext *planningContext)
+{
+	DistributedSubPlan *subPlan = NULL;
+	uint64 planId = planningContext->planId;
+	int subPlanId = 0;
+
+	Query *resultQuery = NULL;
+	Query *debugQuery = NULL;
+
+	if (ContainsReferencesToOuterQuery(subquery))
+	{
+		elog(DEBUG2, "skipping recursive planning for the subquery since it "
+					 "contains references to outer queries");
+
+		return;
+	}
+
+	/* restrict the subquery in the FROM clause by the filters of the outer query */
+	if (EnableSubPlanFilterPushdown && planningContext->currentQuery != NULL)
+	{
+		Query *outerQuery = planningContext->currentQuery;
+		Index rangeTableIndex = SubqueryRangeTableIndex(outerQuery, subquery);
+
+		if (rangeTableIndex != 0)
+		{
+			PushDownFiltersIntoSubPlan(outerQuery, rangeTableIndex, subquery);
+		}
+	}
+
+	/*
+	 * Subquery will go through the standard planner, thus to properly deparse it
+	 * we keep its copy: debugQuery.
+	 */
+	if (log_min_messages <= DEBUG1 || client_min_messages <= DEBUG1)
+	{
+		debugQuery = copyObject(subquery);
+	}
+
+	/*
+	 * Create the subplan and append it to the list in the planning context.
+	 */
+	subPlanId = list_length(planningContext->subPlanList) + 1;
+
+	subPlan = CreateDistributedSubPlan(subPlanId, subquery);
+	planningContext->subPlanList = lappend(planningContext->subPlanList, subPlan);
+
+	/*
+	 * BuildSubPlanResultQuery() can optionally use provided column aliases.
+	 * We do not need to send additional alias list for subqueries.
+	 */
+	resultQuery = BuildSubPlanResultQuery(subquery, NIL, planId, subPlanId);
+
+	if (log_min_messages <= DEBUG1 || client_min_messages <= DEBUG1)
+	{
+		StringInfo subqueryString = makeStringInfo();
+
+		pg_get_query_def(debugQuery, subqueryString);
+
+		ereport(DEBUG1, (errmsg("generating subplan " UINT64_FORMAT "_%u for "
+																	"subquery %s",
+								planId, subPlanId, subqueryString->data)));
+	}
+
+	/* finally update the input subquery to point the result query */
+	memcpy(subquery, resultQuery, sizeof(Query));
+}
+
+
+/*
+ * PushDownFiltersIntoSubPlan copies the filters in the WHERE clause of the
+ * outer query that only reference the given range table entry into the
+ * subquery that the range table entry reads from, right before the subquery
+ * is planned as a subplan. The filters are kept in the outer query, they are
+ * merely duplicated to shrink the intermediate result.
+ *
+ * The caller should make sure that the range table entry is a top-level item
+ * of the FROM clause, such that it is not on the nullable side of an outer
+ * join and the filters apply to each of its rows.
+ */
+static void
+PushDownFiltersIntoSubPlan(Query *outerQuery, Index rangeTableIndex, Query *subquery)
+{
+	RangeTblEntry *rangeTableEntry = rt_fetch(rangeTableIndex, outerQuery->rtable);
+	List *qualList = NIL;
+	ListCell *qualCell = NULL;
+	bool filterIntoHaving = false;
+
+	if (outerQuery->jointree->quals == NULL || !SubqueryIsFilterPushdownSafe(subquery))
+	{
+		return;
+	}
+
+	/* filters of an aggregated subquery can only be applied on the groups */
+	filterIntoHaving = subquery->hasAggs || subquery->groupClause != NIL;
+
+	qualList = make_ands_implicit((Expr *) outerQuery->jointree->quals);
+	foreach(qualCell, qualList)
+	{
+		Node *qual = (Node *) lfirst(qualCell);
+		Node *subqueryQual = NULL;
+
+		if (!FilterIsPushdownSafe(qual, rangeTableIndex, subquery))
+		{
+			continue;
+		}
+
+		subqueryQual = ReplaceVarsFromTargetList(copyObject(qual), rangeTableIndex, 0,
+												 rangeTableEntry, subquery->targetList,
+												 REPLACEVARS_REPORT_ERROR, 0,
+												 &subquery->hasSubLinks);
+
+		if (filterIntoHaving)
+		{
+			subquery->havingQual = make_and_qual(subquery->havingQual, subqueryQual);
+		}
+		else
+		{
+			subquery->jointree->quals = make_and_qual(subquery->jointree->quals,
+													  subqueryQual);
+		}
+	}
+}
+
+
+/*
+ * SubqueryRangeTableIndex returns the range table index of the subquery range
+ * table entry that points to the given subquery, if the entry is a top-level
+ * item of the FROM clause of the outer query. Otherwise, the function
+ * returns 0.
+ */
+static Index
+SubqueryRangeTableIndex(Query *outerQuery, Query *subquery)
+{
+	ListCell *fromCell = NULL;
+
+	foreach(fromCell, outerQuery->jointree->fromlist)
+	{
+		Node *fromNode = (Node *) lfirst(fromCell);
+		RangeTblRef *rangeTableRef = NULL;
+		RangeTblEntry *rangeTableEntry = NULL;
+
+		if (!IsA(fromNode, RangeTblRef))
+		{
+			continue;
+		}
+
+		rangeTableRef = (RangeTblRef *) fromNode;
+		rangeTableEntry = rt_fetch(rangeTableRef->rtindex, outerQuery->rtable);
+
+		if (rangeTableEntry->rtekind == RTE_SUBQUERY &&
+			rangeTableEntry->subquery == subquery)
+		{
+			return rangeTableRef->rtindex;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * CteRangeTableIndex returns the range table index of the reference to the CTE
+ * with the given name, if the reference is a top-level item of the FROM
+ * clause of the outer query. Otherwise, the function returns 0.
+ */
+static Index
+CteRangeTableIndex(Query *outerQuery, char *cteName)
+{
+	ListCell *fromCell = NULL;
+
+	foreach(fromCell, outerQuery->jointree->fromlist)
+	{
+		Node *fromNode = (Node *) lfirst(fromCell);
+		RangeTblRef *rangeTableRef = NULL;
+		RangeTblEntry *rangeTableEntry = NULL;
+
+		if (!IsA(fromNode, RangeTblRef))
+		{
+			continue;
+		}
+
+		rangeTableRef = (RangeTblRef *) fromNode;
+		rangeTableEntry = rt_fetch(rangeTableRef->rtindex, outerQuery->rtable);
+
+		if (rangeTableEntry->rtekind == RTE_CTE &&
+			rangeTableEntry->ctelevelsup == 0 &&
+			strncmp(rangeTableEntry->ctename, cteName, NAMEDATALEN) == 0)
+		{
+			return rangeTableRef->rtindex;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * SubqueryIsFilterPushdownSafe returns true if a filter on the output of the
+ * given subquery gives the same rows when it is applied inside the subquery.
+ * That doesn't hold when the filter would change the input of a LIMIT, a
+ * window function, a DISTINCT ON or a grouping set, or when the subquery
+ * returns sets or locks rows.
+ */
+static bool
+SubqueryIsFilterPushdownSafe(Query *subquery)
+{
+	if (subquery->commandType != CMD_SELECT || subquery->setOperations != NULL)
+	{
+		return false;
+	}
+
+	if (subquery->limitCount != NULL || subquery->limitOffset != NULL)
+	{
+		return false;
+	}
+
+	if (subquery->hasWindowFuncs || subquery->hasDistinctOn ||
+		subquery->groupingSets != NIL || subquery->rowMarks != NIL)
+	{
+		return false;
+	}
+
+	if (expression_returns_set((Node *) subquery->targetList))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * FilterIsPushdownSafe returns true if the given filter of the outer query
+ * only references the output columns of the given subquery through the given
+ * range table entry, and can be evaluated within the subquery.
+ *
+ * We skip filters with parameters since the subplans are planned without the
+ * bound parameters, and filters on aggregated columns of the subquery since
+ * those cannot be inlined.
+ */
+static bool
+FilterIsPushdownSafe(Node *qual, Index rangeTableIndex, Query *subquery)
+{
+	VarLevelsUpWalkerContext levelsUpContext = { 0 };
+	Relids qualRangeTableIndexes = NULL;
+	List *columnList = NIL;
+	ListCell *columnCell = NULL;
+
+	if (contain_volatile_functions(qual) || checkExprHasSubLink(qual) ||
+		ContainsParamWalker(qual, NULL) ||
+		ContainsReferencesToOuterQueryWalker(qual, &levelsUpContext))
+	{
+		return false;
+	}
+
+	qualRangeTableIndexes = pull_varnos(qual);
+	if (bms_membership(qualRangeTableIndexes) != BMS_SINGLETON ||
+		!bms_is_member(rangeTableIndex, qualRangeTableIndexes))
+	{
+		return false;
+	}
+
+	columnList = pull_var_clause_default(qual);
+	foreach(columnCell, columnList)
+	{
+		Var *column = (Var *) lfirst(columnCell);
+		TargetEntry *targetEntry = NULL;
+
+		/* whole-row and system column references cannot be inlined */
+		if (column->varattno <= 0)
+		{
+			return false;
+		}
+
+		targetEntry = get_tle_by_resno(subquery->targetList, column->varattno);
+		if (targetEntry == NULL || targetEntry->resjunk)
+		{
+			return false;
+		}
+
+		if (contain_volatile_functions((Node *) targetEntry->expr) ||
+			contain_agg_clause((Node *) targetEntry->expr))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * ContainsParamWalker returns true if the given expression contains a Param.
+ */
+static bool
+ContainsParamWalker(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Param))
+	{
+		return true;
+	}
+
+	return expression_tree_walker(node, ContainsParamWalker, context);
+}
+
+
+/*
+ * CreateDistributedSubPlan creates a distributed subplan by recursively calling
+ * the planner from the top, which may either generate a local plan or another
+ * distributed plan, which can itself contain subplans.
+ */
+static DistributedSubPlan *
+CreateDistributedSubPlan(uint32 subPlanId, Query *subPlanQuery)
+{
+	DistributedSubPlan *subPlan = NULL;
+	int cursorOptions = 0;
+
+	if (ContainsReadIntermediateResultFunction((Node *) subPlanQuery))
+	{
+		/*
+		 * Make sure we go through distributed planning if there are
+		 * read_intermediate_result calls, even if there are no distributed
+		 * tables in the query anymore.
+		 *
+		 * We cannot perform this check in the planner itself, since that
+		 * would also cause the workers to attempt distributed planning.
+		 */
+		cursorOptions |= CURSOR_OPT_FORCE_DISTRIBUTED;
+	}
+
+	subPlan = CitusMakeNode(DistributedSubPlan);
+	subPlan->plan = planner(subPlanQuery, cursorOptions, NULL);
+	subPlan->subPlanId = subPlanId;
+
+	return subPlan;
+}
+
+
+/*
+ * CteReferenceListWalker finds all references to CTEs in the top level of a query
+ * and adds them to context->cteReferenceList.
+ */
+static bool
+CteReferenceListWalker(Node *node, CteReferenceWalkerContext *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, RangeTblEntry))
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) node;
+
+		if (rangeTableEntry->rtekind == RTE_CTE &&
+			rangeTableEntry->ctelevelsup == context->level)
+		{
+			context->cteReferenceList = lappend(context->cteReferenceList,
+												rangeTableEntry);
+		}
+
+		/* caller will descend into range table entry */
+		return false;
+	}
+	else if (IsA(node, Query))
+	{
+		Query *query = (Query *) node;
+
+		context->level += 1;
+		query_tree_walker(query, CteReferenceListWalker, context, QTW_EXAMINE_RTES);
+		context->level -= 1;
+
+		return false;
+	}
+	else
+	{
+		return expression_tree_walker(node, CteReferenceListWalker, context);
+	}
+}
+
+
+/*
+ * RecursivelyInlineCtesInQueryTree replaces the references to the CTEs that are
+ * referenced once and are free of side effects with subqueries, in the given
+ * query and all of its subqueries.
+ *
+ * Until PostgreSQL 12, CTEs are optimization fences and we plan each of them
+ * as a subplan that is written to an intermediate result. Once inlined, such
+ * CTEs are planned along with the rest of the query instead, which can then
+ * be router planned or pushed down as a whole.
+ */
+void
+RecursivelyInlineCtesInQueryTree(Query *query)
+{
+	InlineCtesInQuery(query);
+
+	query_tree_walker(query, RecursivelyInlineCtesWalker, NULL, 0);
+}
+
+
+/*
+ * RecursivelyInlineCtesWalker calls RecursivelyInlineCtesInQueryTree() for
+ * the subqueries and the CTE queries of a query.
+ */
+static bool
+RecursivelyInlineCtesWalker(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Query))
+	{
+		RecursivelyInlineCtesInQueryTree((Query *) node);
+
+		return false;
+	}
+
+	return expression_tree_walker(node, RecursivelyInlineCtesWalker, context);
+}
+
+
+/*
+ * InlineCtesInQuery inlines the inlinable CTEs in the cteList of the given
+ * query and removes them from the list. Since a CTE can only be referenced by
+ * the CTEs that follow it, inlining in list order also carries a CTE into the
+ * CTEs that are inlined after it.
+ */
+static void
+InlineCtesInQuery(Query *query)
+{
+	List *remainingCteList = NIL;
+	ListCell *cteCell = NULL;
+
+	foreach(cteCell, query->cteList)
+	{
+		CommonTableExpr *cte = (CommonTableExpr *) lfirst(cteCell);
+		InlineCteWalkerContext context = { -1, NULL };
+
+		if (!CteIsInlinable(query, cte))
+		{
+			remainingCteList = lappend(remainingCteList, cte);
+			continue;
+		}
+
+		context.cte = cte;
+		InlineCteWalker((Node *) query, &context);
+	}
+
+	query->cteList = remainingCteList;
+}
+
+
+/*
+ * CteIsInlinable returns true if the given CTE of the query is a side-effect
+ * free SELECT that is referenced exactly once. Such a CTE gives the same rows
+ * when it is evaluated as a subquery in place of the reference.
+ */
+static bool
+CteIsInlinable(Query *query, CommonTableExpr *cte)
+{
+	Query *cteQuery = (Query *) cte->ctequery;
+
+	if (query->hasRecursive || cte->cterecursive || cte->cterefcount != 1)
+	{
+		return false;
+	}
+
+	if (!IsA(cteQuery, Query) || cteQuery->commandType != CMD_SELECT ||
+		cteQuery->hasModifyingCTE || cteQuery->rowMarks != NIL)
+	{
+		return false;
+	}
+
+	if (contain_volatile_functions((Node *) cteQuery))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * InlineCteWalker finds the reference to context->cte and turns it into a
+ * subquery range table entry. The CTE query is copied into the reference and
+ * its references to the outer queries are adjusted by the number of levels
+ * between the CTE and the reference.
+ */
+static bool
+InlineCteWalker(Node *node, InlineCteWalkerContext *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, RangeTblEntry))
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) node;
+		CommonTableExpr *cte = context->cte;
+
+		if (rangeTableEntry->rtekind == RTE_CTE &&
+			rangeTableEntry->ctelevelsup == context->level &&
+			strncmp(rangeTableEntry->ctename, cte->ctename, NAMEDATALEN) == 0)
+		{
+			Query *subquery = copyObject((Query *) cte->ctequery);
+
+			if (context->level > 0)
+			{
+				IncrementVarSublevelsUp((Node *) subquery, context->level, 1);
+			}
+
+			rangeTableEntry->rtekind = RTE_SUBQUERY;
+			rangeTableEntry->subquery = subquery;
+			rangeTableEntry->security_barrier = false;
+
+			/* zero out the CTE specific fields */
+			rangeTableEntry->ctename = NULL;
+			rangeTableEntry->ctelevelsup = 0;
+			rangeTableEntry->self_reference = false;
+#if (PG_VERSION_NUM >= 100000)
+			rangeTableEntry->coltypes = NIL;
+			rangeTableEntry->coltypmods = NIL;
+			rangeTableEntry->colcollations = NIL;
+#else
+			rangeTableEntry->ctecoltypes = NIL;
+			rangeTableEntry->ctecoltypmods = NIL;
+			rangeTableEntry->ctecolcollations = NIL;
+#endif
+
+			/* the CTE is referenced once, we are done */
+			return true;
+		}
+
+		/* caller will descend into range table entry */
+		return false;
+	}
+	else if (IsA(node, Query))
+	{
+		Query *query = (Query *) node;
+		bool found = false;
+
+		context->level += 1;
+		found = query_tree_walker(query, InlineCteWalker, context, QTW_EXAMINE_RTES);
+		context->level -= 1;
+
+		return found;
+	}
+
+	return expression_tree_walker(node, InlineCteWalker, context);
 }
 
 
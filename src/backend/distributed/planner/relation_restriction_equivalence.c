@@ -22,6 +22,7 @@
 #include "nodes/relation.h"
 #include "parser/parsetree.h"
 #include "optimizer/pathnode.h"
+#include "utils/hsearch.h"
 
 static uint32 attributeEquivalenceId = 1;
 
@@ -62,6 +63,29 @@ typedef struct AttributeEquivalenceClassMember
 	AttrNumber varattno;
 } AttributeEquivalenceClassMember;
 
+/*
+ * AttributeEquivalenceMemberKey identifies an AttributeEquivalenceClassMember
+ * in the member hash used by GenerateCommonEquivalence(). Both fields are kept
+ * as int such that the key does not contain any padding bytes.
+ */
+typedef struct AttributeEquivalenceMemberKey
+{
+	int rteIdentity;
+	int varattno;
+} AttributeEquivalenceMemberKey;
+
+/*
+ * AttributeEquivalenceMemberEntry is the hash entry of a member. classIndex
+ * points to the first equivalence class that the member appears in, which is
+ * enough to union all the classes that share the member.
+ */
+typedef struct AttributeEquivalenceMemberEntry
+{
+	AttributeEquivalenceMemberKey key;
+	int classIndex;
+	bool addedToCommonClass;
+} AttributeEquivalenceMemberEntry;
+
 
 static bool ContextContainsLocalRelation(RelationRestrictionContext *restrictionContext);
 static Var * FindTranslatedVar(List *appendRelList, Oid relationOid,
@@ -102,17 +126,9 @@ static Var * GetVarFromAssignedParam(List *parentPlannerParamList,
 									 Param *plannerParam);
 static List * GenerateAttributeEquivalencesForJoinRestrictions(JoinRestrictionContext
 															   *joinRestrictionContext);
-static bool AttributeClassContainsAttributeClassMember(AttributeEquivalenceClassMember *
-													   inputMember,
-													   AttributeEquivalenceClass *
-													   attributeEquivalenceClass);
 static List * AddAttributeClassToAttributeClassList(List *attributeEquivalenceList,
 													AttributeEquivalenceClass *
 													attributeEquivalance);
-static bool AttributeEquivalancesAreEqual(AttributeEquivalenceClass *
-										  firstAttributeEquivalance,
-										  AttributeEquivalenceClass *
-										  secondAttributeEquivalance);
 static AttributeEquivalenceClass * GenerateCommonEquivalence(List *
 															 attributeEquivalenceList,
 															 RelationRestrictionContext *
@@ -121,10 +137,11 @@ static AttributeEquivalenceClass * GenerateEquivalanceClassForRelationRestrictio
 	RelationRestrictionContext
 	*
 	relationRestrictionContext);
-static void ListConcatUniqueAttributeClassMemberLists(AttributeEquivalenceClass **
-													  firstClass,
-													  AttributeEquivalenceClass *
-													  secondClass);
+static HTAB * CreateAttributeEquivalenceMemberHash(void);
+static AttributeEquivalenceMemberEntry * AttributeEquivalenceMemberHashSearch(
+	HTAB *memberHash, AttributeEquivalenceClassMember *member, HASHACTION action,
+	bool *found);
+static int FindEquivalenceClassRoot(int *parentClassIndex, int classIndex);
 static Index RelationRestrictionPartitionKeyIndex(RelationRestriction *
 												  relationRestriction);
 static RelationRestrictionContext * FilterRelationRestrictionContext(
@@ -552,6 +569,16 @@ GenerateAllAttributeEquivalences(PlannerRestrictionContext *plannerRestrictionCo
 	List *joinRestrictionAttributeEquivalenceList = NIL;
 	List *allAttributeEquivalenceList = NIL;
 
+	/*
+	 * The same restriction context is checked several times while planning
+	 * a query (e.g., by recursive planning and then by the logical planner),
+	 * so re-use the equivalences unless the restrictions changed meanwhile.
+	 */
+	if (plannerRestrictionContext->attributeEquivalencesGenerated)
+	{
+		return plannerRestrictionContext->attributeEquivalenceList;
+	}
+
 	/* reset the equivalence id counter per call to prevent overflows */
 	attributeEquivalenceId = 1;
 
@@ -563,6 +590,9 @@ GenerateAllAttributeEquivalences(PlannerRestrictionContext *plannerRestrictionCo
 	allAttributeEquivalenceList = list_concat(relationRestrictionAttributeEquivalenceList,
 											  joinRestrictionAttributeEquivalenceList);
 
+	plannerRestrictionContext->attributeEquivalenceList = allAttributeEquivalenceList;
+	plannerRestrictionContext->attributeEquivalencesGenerated = true;
+
 	return allAttributeEquivalenceList;
 }
 
@@ -836,16 +866,19 @@ GetVarFromAssignedParam(List *parentPlannerParamList, Param *plannerParam)
  * With the equivalence classes, the function follows the algorithm
  * outlined below:
  *
- *     - Add the first equivalence class to the common equivalence class
- *     - Then, iterate on the remaining equivalence classes
- *          - If any of the members equal to the common equivalence class
- *            add all the members of the equivalence class to the common
- *            class
- *          - Start the iteration from the beginning. The reason is that
- *            in case any of the classes we've passed is equivalent to the
- *            newly added one. To optimize the algorithm, we utilze the
- *            equivalence class ids and skip the ones that are already added.
+ *     - Seed the common equivalence class with the partition key of the
+ *       first distributed relation
+ *     - Iterate on the equivalence classes once and union the classes that
+ *       share a member. The members are tracked in a hash, and the classes
+ *       are kept in a union-find forest indexed by their list position.
+ *     - Iterate on the equivalence classes once more and add the members
+ *       of every class that ended up in the same set with the seed member
+ *       to the common class, skipping the members that are already added.
  *      - Finally, return the common equivalence class.
+ *
+ * The total cost is nearly linear in the number of members, whereas the
+ * transitive closure that restarts whenever a class is merged is quadratic
+ * in the number of classes.
  */
 static AttributeEquivalenceClass *
 GenerateCommonEquivalence(List *attributeEquivalenceList,
@@ -853,9 +886,14 @@ GenerateCommonEquivalence(List *attributeEquivalenceList,
 {
 	AttributeEquivalenceClass *commonEquivalenceClass = NULL;
 	AttributeEquivalenceClass *firstEquivalenceClass = NULL;
-	Bitmapset *addedEquivalenceIds = NULL;
+	AttributeEquivalenceClassMember *seedMember = NULL;
+	AttributeEquivalenceMemberEntry *seedEntry = NULL;
+	HTAB *memberHash = NULL;
+	ListCell *equivalenceClassCell = NULL;
+	int *parentClassIndex = NULL;
 	uint32 equivalenceListSize = list_length(attributeEquivalenceList);
-	uint32 equivalenceClassIndex = 0;
+	int equivalenceClassIndex = 0;
+	int commonClassRoot = 0;
 
 	commonEquivalenceClass = palloc0(sizeof(AttributeEquivalenceClass));
 	commonEquivalenceClass->equivalenceId = 0;
@@ -876,70 +914,166 @@ GenerateCommonEquivalence(List *attributeEquivalenceList,
 
 	commonEquivalenceClass->equivalentAttributes =
 		firstEquivalenceClass->equivalentAttributes;
-	addedEquivalenceIds = bms_add_member(addedEquivalenceIds,
-										 firstEquivalenceClass->equivalenceId);
+	seedMember = (AttributeEquivalenceClassMember *)
+				 linitial(firstEquivalenceClass->equivalentAttributes);
 
-	while (equivalenceClassIndex < equivalenceListSize)
+	memberHash = CreateAttributeEquivalenceMemberHash();
+	parentClassIndex = palloc0(equivalenceListSize * sizeof(int));
+
+	/* union the equivalence classes that share at least one member */
+	foreach(equivalenceClassCell, attributeEquivalenceList)
 	{
-		AttributeEquivalenceClass *currentEquivalenceClass = NULL;
+		AttributeEquivalenceClass *currentEquivalenceClass =
+			(AttributeEquivalenceClass *) lfirst(equivalenceClassCell);
 		ListCell *equivalenceMemberCell = NULL;
-		bool restartLoop = false;
 
-		currentEquivalenceClass = list_nth(attributeEquivalenceList,
-										   equivalenceClassIndex);
-
-		/*
-		 * This is an optimization. If we already added the same equivalence class,
-		 * we could skip it since we've already added all the relevant equivalence
-		 * members.
-		 */
-		if (bms_is_member(currentEquivalenceClass->equivalenceId, addedEquivalenceIds))
-		{
-			equivalenceClassIndex++;
-
-			continue;
-		}
+		parentClassIndex[equivalenceClassIndex] = equivalenceClassIndex;
 
 		foreach(equivalenceMemberCell, currentEquivalenceClass->equivalentAttributes)
 		{
-			AttributeEquivalenceClassMember *attributeEquialanceMember =
+			AttributeEquivalenceClassMember *attributeEquivalanceMember =
 				(AttributeEquivalenceClassMember *) lfirst(equivalenceMemberCell);
+			AttributeEquivalenceMemberEntry *memberEntry = NULL;
+			bool found = false;
 
-			if (AttributeClassContainsAttributeClassMember(attributeEquialanceMember,
-														   commonEquivalenceClass))
+			memberEntry = AttributeEquivalenceMemberHashSearch(memberHash,
+															   attributeEquivalanceMember,
+															   HASH_ENTER, &found);
+			if (!found)
 			{
-				ListConcatUniqueAttributeClassMemberLists(&commonEquivalenceClass,
-														  currentEquivalenceClass);
-
-				addedEquivalenceIds = bms_add_member(addedEquivalenceIds,
-													 currentEquivalenceClass->
-													 equivalenceId);
-
-				/*
-				 * It seems inefficient to start from the beginning.
-				 * But, we should somehow restart from the beginning to test that
-				 * whether the already skipped ones are equal or not.
-				 */
-				restartLoop = true;
+				memberEntry->classIndex = equivalenceClassIndex;
+				memberEntry->addedToCommonClass = false;
+			}
+			else
+			{
+				int memberClassRoot =
+					FindEquivalenceClassRoot(parentClassIndex, memberEntry->classIndex);
+				int currentClassRoot =
+					FindEquivalenceClassRoot(parentClassIndex, equivalenceClassIndex);
 
-				break;
+				parentClassIndex[currentClassRoot] = memberClassRoot;
 			}
 		}
 
-		if (restartLoop)
+		equivalenceClassIndex++;
+	}
+
+	/* the seed member is not equal to any other attribute */
+	seedEntry = AttributeEquivalenceMemberHashSearch(memberHash, seedMember,
+													 HASH_FIND, NULL);
+	if (seedEntry == NULL)
+	{
+		hash_destroy(memberHash);
+
+		return commonEquivalenceClass;
+	}
+
+	seedEntry->addedToCommonClass = true;
+	commonClassRoot = FindEquivalenceClassRoot(parentClassIndex, seedEntry->classIndex);
+
+	/* add the members of all classes that are in the same set with the seed */
+	equivalenceClassIndex = 0;
+	foreach(equivalenceClassCell, attributeEquivalenceList)
+	{
+		AttributeEquivalenceClass *currentEquivalenceClass =
+			(AttributeEquivalenceClass *) lfirst(equivalenceClassCell);
+		ListCell *equivalenceMemberCell = NULL;
+		int currentClassRoot =
+			FindEquivalenceClassRoot(parentClassIndex, equivalenceClassIndex);
+
+		equivalenceClassIndex++;
+
+		if (currentClassRoot != commonClassRoot)
 		{
-			equivalenceClassIndex = 0;
+			continue;
 		}
-		else
+
+		foreach(equivalenceMemberCell, currentEquivalenceClass->equivalentAttributes)
 		{
-			++equivalenceClassIndex;
+			AttributeEquivalenceClassMember *attributeEquivalanceMember =
+				(AttributeEquivalenceClassMember *) lfirst(equivalenceMemberCell);
+			AttributeEquivalenceMemberEntry *memberEntry =
+				AttributeEquivalenceMemberHashSearch(memberHash,
+													 attributeEquivalanceMember,
+													 HASH_FIND, NULL);
+
+			if (memberEntry->addedToCommonClass)
+			{
+				continue;
+			}
+
+			memberEntry->addedToCommonClass = true;
+			commonEquivalenceClass->equivalentAttributes =
+				lappend(commonEquivalenceClass->equivalentAttributes,
+						attributeEquivalanceMember);
 		}
 	}
 
+	hash_destroy(memberHash);
+
 	return commonEquivalenceClass;
 }
 
 
+/*
+ * CreateAttributeEquivalenceMemberHash creates a hash in the current memory
+ * context to track the attribute equivalence members by their rteIdentity
+ * and varattno.
+ */
+static HTAB *
+CreateAttributeEquivalenceMemberHash(void)
+{
+	HASHCTL info;
+	int hashFlags = (HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(AttributeEquivalenceMemberKey);
+	info.entrysize = sizeof(AttributeEquivalenceMemberEntry);
+	info.hcxt = CurrentMemoryContext;
+
+	return hash_create("Attribute Equivalence Member Hash", 32, &info, hashFlags);
+}
+
+
+/*
+ * AttributeEquivalenceMemberHashSearch looks up the given member in the member
+ * hash with the given action and returns the entry. Two members are considered
+ * equal if their rteIdentity and varattno are equal.
+ */
+static AttributeEquivalenceMemberEntry *
+AttributeEquivalenceMemberHashSearch(HTAB *memberHash,
+									 AttributeEquivalenceClassMember *member,
+									 HASHACTION action, bool *found)
+{
+	AttributeEquivalenceMemberKey memberKey;
+
+	memset(&memberKey, 0, sizeof(memberKey));
+	memberKey.rteIdentity = member->rteIdentity;
+	memberKey.varattno = member->varattno;
+
+	return (AttributeEquivalenceMemberEntry *) hash_search(memberHash, &memberKey,
+														   action, found);
+}
+
+
+/*
+ * FindEquivalenceClassRoot returns the index of the class that represents the
+ * set of the given class in the union-find forest. The path is halved while
+ * walking up, which keeps the trees shallow.
+ */
+static int
+FindEquivalenceClassRoot(int *parentClassIndex, int classIndex)
+{
+	while (parentClassIndex[classIndex] != classIndex)
+	{
+		parentClassIndex[classIndex] = parentClassIndex[parentClassIndex[classIndex]];
+		classIndex = parentClassIndex[classIndex];
+	}
+
+	return classIndex;
+}
+
+
 /*
  * GenerateEquivalanceClassForRelationRestriction generates an AttributeEquivalenceClass
  * with a single AttributeEquivalenceClassMember.
@@ -978,38 +1112,6 @@ GenerateEquivalanceClassForRelationRestriction(
 }
 
 
-/*
- * ListConcatUniqueAttributeClassMemberLists gets two attribute equivalence classes. It
- * basically concatenates attribute equivalence member lists uniquely and updates the
- * firstClass' member list with the list.
- *
- * Basically, the function iterates over the secondClass' member list and checks whether
- * it already exists in the firstClass' member list. If not, the member is added to the
- * firstClass.
- */
-static void
-ListConcatUniqueAttributeClassMemberLists(AttributeEquivalenceClass **firstClass,
-										  AttributeEquivalenceClass *secondClass)
-{
-	ListCell *equivalenceClassMemberCell = NULL;
-	List *equivalenceMemberList = secondClass->equivalentAttributes;
-
-	foreach(equivalenceClassMemberCell, equivalenceMemberList)
-	{
-		AttributeEquivalenceClassMember *newEqMember =
-			(AttributeEquivalenceClassMember *) lfirst(equivalenceClassMemberCell);
-
-		if (AttributeClassContainsAttributeClassMember(newEqMember, *firstClass))
-		{
-			continue;
-		}
-
-		(*firstClass)->equivalentAttributes = lappend((*firstClass)->equivalentAttributes,
-													  newEqMember);
-	}
-}
-
-
 /*
  * GenerateAttributeEquivalencesForJoinRestrictions gets a join restriction
  * context and returns a list of AttrributeEquivalenceClass.
@@ -1391,32 +1493,6 @@ AddRteRelationToAttributeEquivalenceClass(AttributeEquivalenceClass **
 }
 
 
-/*
- * AttributeClassContainsAttributeClassMember returns true if it the input class member
- * is already exists in the attributeEquivalenceClass. An equality is identified by the
- * varattno and rteIdentity.
- */
-static bool
-AttributeClassContainsAttributeClassMember(AttributeEquivalenceClassMember *inputMember,
-										   AttributeEquivalenceClass *
-										   attributeEquivalenceClass)
-{
-	ListCell *classCell = NULL;
-	foreach(classCell, attributeEquivalenceClass->equivalentAttributes)
-	{
-		AttributeEquivalenceClassMember *memberOfClass =
-			(AttributeEquivalenceClassMember *) lfirst(classCell);
-		if (memberOfClass->rteIdentity == inputMember->rteIdentity &&
-			memberOfClass->varattno == inputMember->varattno)
-		{
-			return true;
-		}
-	}
-
-	return false;
-}
-
-
 /*
  * AddAttributeClassToAttributeClassList checks for certain properties of the
  * input attributeEquivalance before adding it to the attributeEquivalenceList.
@@ -1424,15 +1500,16 @@ AttributeClassContainsAttributeClassMember(AttributeEquivalenceClassMember *inpu
  * Firstly, the function skips adding NULL attributeEquivalance to the list.
  * Secondly, since an attribute equivalence class with a single member does
  * not contribute to our purposes, we skip such classed adding to the list.
- * Finally, we don't want to add an equivalence class whose exact equivalent
- * already exists in the list.
+ *
+ * Note that we don't look for an exact equivalent of the class in the list,
+ * which is quadratic in the number of classes. Duplicate classes are merged
+ * cheaply by GenerateCommonEquivalence().
  */
 static List *
 AddAttributeClassToAttributeClassList(List *attributeEquivalenceList,
 									  AttributeEquivalenceClass *attributeEquivalance)
 {
 	List *equivalentAttributes = NULL;
-	ListCell *attributeEquivalanceCell = NULL;
 
 	if (attributeEquivalance == NULL)
 	{
@@ -1449,19 +1526,6 @@ AddAttributeClassToAttributeClassList(List *attributeEquivalenceList,
 		return attributeEquivalenceList;
 	}
 
-	/* we don't want to add an attributeEquivalance which already exists */
-	foreach(attributeEquivalanceCell, attributeEquivalenceList)
-	{
-		AttributeEquivalenceClass *currentAttributeEquivalance =
-			(AttributeEquivalenceClass *) lfirst(attributeEquivalanceCell);
-
-		if (AttributeEquivalancesAreEqual(currentAttributeEquivalance,
-										  attributeEquivalance))
-		{
-			return attributeEquivalenceList;
-		}
-	}
-
 	attributeEquivalenceList = lappend(attributeEquivalenceList,
 									   attributeEquivalance);
 
@@ -1469,58 +1533,6 @@ AddAttributeClassToAttributeClassList(List *attributeEquivalenceList,
 }
 
 
-/*
- *  AttributeEquivalancesAreEqual returns true if both input attribute equivalence
- *  classes contains exactly the same members.
- */
-static bool
-AttributeEquivalancesAreEqual(AttributeEquivalenceClass *firstAttributeEquivalance,
-							  AttributeEquivalenceClass *secondAttributeEquivalance)
-{
-	List *firstEquivalenceMemberList =
-		firstAttributeEquivalance->equivalentAttributes;
-	List *secondEquivalenceMemberList =
-		secondAttributeEquivalance->equivalentAttributes;
-	ListCell *firstAttributeEquivalanceCell = NULL;
-	ListCell *secondAttributeEquivalanceCell = NULL;
-
-	if (list_length(firstEquivalenceMemberList) != list_length(
-			secondEquivalenceMemberList))
-	{
-		return false;
-	}
-
-	foreach(firstAttributeEquivalanceCell, firstEquivalenceMemberList)
-	{
-		AttributeEquivalenceClassMember *firstEqMember =
-			(AttributeEquivalenceClassMember *) lfirst(firstAttributeEquivalanceCell);
-		bool foundAnEquivalentMember = false;
-
-		foreach(secondAttributeEquivalanceCell, secondEquivalenceMemberList)
-		{
-			AttributeEquivalenceClassMember *secondEqMember =
-				(AttributeEquivalenceClassMember *) lfirst(
-					secondAttributeEquivalanceCell);
-
-			if (firstEqMember->rteIdentity == secondEqMember->rteIdentity &&
-				firstEqMember->varattno == secondEqMember->varattno)
-			{
-				foundAnEquivalentMember = true;
-				break;
-			}
-		}
-
-		/* we couldn't find an equivalent member */
-		if (!foundAnEquivalentMember)
-		{
-			return false;
-		}
-	}
-
-	return true;
-}
-
-
 /*
  * ContainsUnionSubquery gets a queryTree and returns true if the query
  * contains
@@ -41,6 +41,10 @@
  * Finally, the union of the shards found by each pruning instance is
  * returned.
  *
+ * If citus.enable_shard_zone_map_pruning is enabled, we additionally remove
+ * shards whose zone maps show that no row in them passes one of the top-level
+ * filters on a non-distribution column.
+ *
  * Copyright (c) 2014-2017, Citus Data, Inc.
  *
  *-------------------------------------------------------------------------
@@ -59,6 +63,7 @@
 #include "distributed/multi_physical_planner.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/pg_dist_partition.h"
+#include "distributed/planner_stats.h"
 #include "distributed/worker_protocol.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/makefuncs.h"
@@ -67,6 +72,11 @@
 #include "utils/catcache.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/typcache.h"
+
+
+/* Config variable managed via guc.c */
+bool EnableShardZoneMapPruning = false;
 
 /*
  * A pruning instance is a set of ANDed constraints on a partition key.
@@ -100,6 +110,13 @@ typedef struct PruningInstance
 	 */
 	Const *hashedEqualConsts;
 
+	/*
+	 * Array of a partcol = ANY(array) constraint on a hash-partitioned table.
+	 * Instead of expanding the array into an ORed equality constraint per
+	 * element, all elements are hashed and looked up in a single pass.
+	 */
+	Const *equalArrayConsts;
+
 	/*
 	 * Types of constraints not understood.  We could theoretically try more
 	 * expensive methods of pruning if any such restrictions are found.
@@ -166,6 +183,50 @@ typedef struct ClauseWalkerContext
 	FunctionCallInfoData compareIntervalFunctionCall;
 } ClauseWalkerContext;
 
+
+/*
+ * A filter of the form column <op> constant on a column that may have zone
+ * maps, where <op> is a btree operator of the default operator class of the
+ * column's type.
+ */
+typedef struct ZoneMapRestriction
+{
+	AttrNumber attributeNumber;
+	StrategyNumber strategy;
+	Datum value;
+	Oid collation;
+	FmgrInfo *compareFunction;
+
+	/* hash of the value, for probing bloom filters on equality filters */
+	bool hasHashValue;
+	uint32 hashValue;
+} ZoneMapRestriction;
+
+
+/*
+ * Data necessary to filter the partcol = ANY(array) restrictions of a query
+ * down to the values that a single shard can contain.
+ */
+typedef struct ArrayFilterContext
+{
+	Var *partitionColumn;
+	DistTableCacheEntry *cacheEntry;
+
+	/* shard to filter for, NULL if we only look for arrays to filter */
+	ShardInterval *shardInterval;
+
+	bool foundArray;
+} ArrayFilterContext;
+
+
+static List * PruneShardIntervals(Oid relationId, Index rangeTableId,
+								  List *whereClauseList);
+static List * PruneShardsByZoneMaps(Oid relationId, Index rangeTableId,
+									List *whereClauseList, List *shardIntervalList);
+static ZoneMapRestriction * ZoneMapRestrictionForClause(Node *clause,
+														Index rangeTableId);
+static bool ZoneMapExcludesRestriction(ShardZoneMap *zoneMap,
+									   ZoneMapRestriction *restriction);
 static void PrunableExpressions(Node *originalNode, ClauseWalkerContext *context);
 static bool PrunableExpressionsWalker(Node *originalNode, ClauseWalkerContext *context);
 static void AddPartitionKeyRestrictionToInstance(ClauseWalkerContext *context,
@@ -186,9 +247,23 @@ static int PerformCompare(FunctionCallInfoData *compareFunctionCall);
 
 static List * PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 					   PruningInstance *prune);
+static void FilterArraysWalker(Node *clause, ArrayFilterContext *context);
+static bool IsShardFilterableArray(ScalarArrayOpExpr *arrayOperatorExpression,
+								   Var *partitionColumn);
+static Const * FilterArrayConstForShard(Const *arrayConst, ArrayFilterContext *context);
+static List * PruneWithEqualArray(DistTableCacheEntry *cacheEntry,
+								  ClauseWalkerContext *context,
+								  PruningInstance *prune);
 static List * PruneWithBoundaries(DistTableCacheEntry *cacheEntry,
 								  ClauseWalkerContext *context,
 								  PruningInstance *prune);
+static List * PruneWithOverlappingBoundaries(DistTableCacheEntry *cacheEntry,
+											 ClauseWalkerContext *context,
+											 PruningInstance *prune);
+static Const * GreaterBoundConst(FunctionCallInfoData *compareFunctionCall,
+								 Const *firstConst, Const *secondConst);
+static Const * LesserBoundConst(FunctionCallInfoData *compareFunctionCall,
+								Const *firstConst, Const *secondConst);
 static List * ExhaustivePrune(DistTableCacheEntry *cacheEntry,
 							  ClauseWalkerContext *context,
 							  PruningInstance *prune);
@@ -214,6 +289,29 @@ static int LowerShardBoundary(Datum partitionColumnValue,
  */
 List *
 PruneShards(Oid relationId, Index rangeTableId, List *whereClauseList)
+{
+	List *prunedList = NIL;
+
+	PlannerStatsStart(PLANNER_STAGE_SHARD_PRUNING);
+	prunedList = PruneShardIntervals(relationId, rangeTableId, whereClauseList);
+
+	if (EnableShardZoneMapPruning && prunedList != NIL)
+	{
+		prunedList = PruneShardsByZoneMaps(relationId, rangeTableId, whereClauseList,
+										   prunedList);
+	}
+	PlannerStatsEnd(PLANNER_STAGE_SHARD_PRUNING);
+
+	return prunedList;
+}
+
+
+/*
+ * PruneShardIntervals implements PruneShards, which additionally tracks the
+ * calls and time of shard pruning in citus_stat_planner.
+ */
+static List *
+PruneShardIntervals(Oid relationId, Index rangeTableId, List *whereClauseList)
 {
 	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
 	int shardCount = cacheEntry->shardIntervalArrayLength;
@@ -310,7 +408,8 @@ PruneShards(Oid relationId, Index rangeTableId, List *whereClauseList)
 		 * prune by, we're done.
 		 */
 		if (context.partitionMethod == DISTRIBUTE_BY_HASH &&
-			!prune->evaluatesToFalse && !prune->equalConsts && !prune->hashedEqualConsts)
+			!prune->evaluatesToFalse && !prune->equalConsts &&
+			!prune->hashedEqualConsts && !prune->equalArrayConsts)
 		{
 			foundRestriction = false;
 			break;
@@ -351,6 +450,235 @@ PruneShards(Oid relationId, Index rangeTableId, List *whereClauseList)
 }
 
 
+/*
+ * PruneShardsByZoneMaps returns the shards in the given list that the zone
+ * maps of the table cannot exclude for one of the top-level filters in the
+ * where clause list. Filters below OR expressions are not considered.
+ */
+static List *
+PruneShardsByZoneMaps(Oid relationId, Index rangeTableId, List *whereClauseList,
+					  List *shardIntervalList)
+{
+	ShardZoneMapCacheEntry *zoneMapCacheEntry = NULL;
+	List *restrictionList = NIL;
+	List *remainingShardList = NIL;
+	ListCell *clauseCell = NULL;
+	ListCell *shardIntervalCell = NULL;
+
+	zoneMapCacheEntry = LookupShardZoneMapCacheEntry(relationId);
+	if (zoneMapCacheEntry == NULL)
+	{
+		return shardIntervalList;
+	}
+
+	foreach(clauseCell, whereClauseList)
+	{
+		Node *clause = (Node *) lfirst(clauseCell);
+		ZoneMapRestriction *restriction = ZoneMapRestrictionForClause(clause,
+																	  rangeTableId);
+
+		if (restriction != NULL)
+		{
+			restrictionList = lappend(restrictionList, restriction);
+		}
+	}
+
+	if (restrictionList == NIL)
+	{
+		return shardIntervalList;
+	}
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		bool shardExcluded = false;
+		ListCell *restrictionCell = NULL;
+
+		foreach(restrictionCell, restrictionList)
+		{
+			ZoneMapRestriction *restriction =
+				(ZoneMapRestriction *) lfirst(restrictionCell);
+			ShardZoneMap *zoneMap = FindShardZoneMap(zoneMapCacheEntry,
+													 shardInterval->shardId,
+													 restriction->attributeNumber);
+
+			if (zoneMap != NULL && ZoneMapExcludesRestriction(zoneMap, restriction))
+			{
+				shardExcluded = true;
+				break;
+			}
+		}
+
+		if (!shardExcluded)
+		{
+			remainingShardList = lappend(remainingShardList, shardInterval);
+		}
+	}
+
+	return remainingShardList;
+}
+
+
+/*
+ * ZoneMapRestrictionForClause returns the zone map restriction that the given
+ * clause represents, or NULL if zone maps cannot be used to evaluate it. The
+ * operator needs to be a btree operator of the default operator class of the
+ * column's type for both sides, such that it orders values in the same way
+ * as the min() and max() aggregates that built the zone maps, and it needs
+ * to use the collation of the column for the same reason.
+ */
+static ZoneMapRestriction *
+ZoneMapRestrictionForClause(Node *clause, Index rangeTableId)
+{
+	OpExpr *opClause = NULL;
+	Node *leftOperand = NULL;
+	Node *rightOperand = NULL;
+	Var *column = NULL;
+	Const *constant = NULL;
+	Oid operatorId = InvalidOid;
+	TypeCacheEntry *typeEntry = NULL;
+	int strategy = 0;
+	Oid leftType = InvalidOid;
+	Oid rightType = InvalidOid;
+	ZoneMapRestriction *restriction = NULL;
+
+	if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2)
+	{
+		return NULL;
+	}
+
+	opClause = (OpExpr *) clause;
+	operatorId = opClause->opno;
+	leftOperand = get_leftop((Expr *) opClause);
+	rightOperand = get_rightop((Expr *) opClause);
+
+	if (IsA(leftOperand, Var) && IsA(rightOperand, Const))
+	{
+		column = (Var *) leftOperand;
+		constant = (Const *) rightOperand;
+	}
+	else if (IsA(leftOperand, Const) && IsA(rightOperand, Var))
+	{
+		column = (Var *) rightOperand;
+		constant = (Const *) leftOperand;
+		operatorId = get_commutator(operatorId);
+	}
+	else
+	{
+		return NULL;
+	}
+
+	if (column->varno != rangeTableId || column->varlevelsup != 0 ||
+		column->varattno <= 0 || constant->constisnull ||
+		!OidIsValid(operatorId) || opClause->inputcollid != column->varcollid)
+	{
+		return NULL;
+	}
+
+	typeEntry = lookup_type_cache(column->vartype, TYPECACHE_BTREE_OPFAMILY |
+								  TYPECACHE_CMP_PROC_FINFO |
+								  TYPECACHE_HASH_PROC_FINFO);
+	if (!OidIsValid(typeEntry->btree_opf) ||
+		!OidIsValid(typeEntry->cmp_proc_finfo.fn_oid) ||
+		!op_in_opfamily(operatorId, typeEntry->btree_opf))
+	{
+		return NULL;
+	}
+
+	get_op_opfamily_properties(operatorId, typeEntry->btree_opf, false, &strategy,
+							   &leftType, &rightType);
+	if (leftType != column->vartype || rightType != column->vartype ||
+		constant->consttype != column->vartype)
+	{
+		return NULL;
+	}
+
+	restriction = palloc0(sizeof(ZoneMapRestriction));
+	restriction->attributeNumber = column->varattno;
+	restriction->strategy = strategy;
+	restriction->value = constant->constvalue;
+	restriction->collation = column->varcollid;
+	restriction->compareFunction = &typeEntry->cmp_proc_finfo;
+
+	if (strategy == BTEqualStrategyNumber &&
+		OidIsValid(typeEntry->hash_proc_finfo.fn_oid))
+	{
+		Datum hashDatum = FunctionCall1Coll(&typeEntry->hash_proc_finfo,
+											column->varcollid, constant->constvalue);
+
+		restriction->hasHashValue = true;
+		restriction->hashValue = DatumGetUInt32(hashDatum);
+	}
+
+	return restriction;
+}
+
+
+/*
+ * ZoneMapExcludesRestriction returns whether the given zone map shows that no
+ * value of the column in the shard passes the given restriction.
+ */
+static bool
+ZoneMapExcludesRestriction(ShardZoneMap *zoneMap, ZoneMapRestriction *restriction)
+{
+	int minValueComparison = 0;
+	int maxValueComparison = 0;
+
+	if (restriction->hasHashValue && zoneMap->bloomFilter != NULL &&
+		!BloomFilterMightContain(zoneMap->bloomFilter, restriction->hashValue))
+	{
+		return true;
+	}
+
+	if (!zoneMap->hasMinMaxValues)
+	{
+		return false;
+	}
+
+	minValueComparison =
+		DatumGetInt32(FunctionCall2Coll(restriction->compareFunction,
+										restriction->collation, zoneMap->minValue,
+										restriction->value));
+	maxValueComparison =
+		DatumGetInt32(FunctionCall2Coll(restriction->compareFunction,
+										restriction->collation, zoneMap->maxValue,
+										restriction->value));
+
+	switch (restriction->strategy)
+	{
+		case BTLessStrategyNumber:
+		{
+			return minValueComparison >= 0;
+		}
+
+		case BTLessEqualStrategyNumber:
+		{
+			return minValueComparison > 0;
+		}
+
+		case BTEqualStrategyNumber:
+		{
+			return minValueComparison > 0 || maxValueComparison < 0;
+		}
+
+		case BTGreaterEqualStrategyNumber:
+		{
+			return maxValueComparison < 0;
+		}
+
+		case BTGreaterStrategyNumber:
+		{
+			return maxValueComparison <= 0;
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
 /*
  * ContainsFalseClause returns whether the flattened where clause list
  * contains false as a clause.
@@ -380,6 +708,210 @@ ContainsFalseClause(List *whereClauseList)
 }
 
 
+/*
+ * HasShardFilterableArray returns whether the given ANDed restrictions contain
+ * a partcol = ANY(array) restriction on the partition column of the given
+ * hash-partitioned relation, which FilterArraysForShard can filter for a shard.
+ */
+bool
+HasShardFilterableArray(Node *clause, Oid relationId, Index rangeTableId)
+{
+	ArrayFilterContext context = { 0 };
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+
+	if (cacheEntry->partitionMethod != DISTRIBUTE_BY_HASH)
+	{
+		return false;
+	}
+
+	context.partitionColumn = PartitionColumn(relationId, rangeTableId);
+	context.cacheEntry = cacheEntry;
+
+	FilterArraysWalker(clause, &context);
+
+	return context.foundArray;
+}
+
+
+/*
+ * FilterArraysForShard removes the values from the partcol = ANY(array)
+ * restrictions among the given ANDed restrictions that cannot be found in the
+ * given shard of a hash-partitioned relation, since their hash values fall
+ * into other shards. This leaves each task of a multi-shard query with only
+ * its own part of a long IN list. The restrictions are modified in place, and
+ * the function returns whether any array was found.
+ */
+bool
+FilterArraysForShard(Node *clause, Index rangeTableId, ShardInterval *shardInterval)
+{
+	ArrayFilterContext context = { 0 };
+	Oid relationId = shardInterval->relationId;
+	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+
+	if (cacheEntry->partitionMethod != DISTRIBUTE_BY_HASH)
+	{
+		return false;
+	}
+
+	context.partitionColumn = PartitionColumn(relationId, rangeTableId);
+	context.cacheEntry = cacheEntry;
+	context.shardInterval = shardInterval;
+
+	FilterArraysWalker(clause, &context);
+
+	return context.foundArray;
+}
+
+
+/*
+ * FilterArraysWalker walks over ANDed restrictions, and filters the arrays of
+ * the partcol = ANY(array) restrictions among them if the context specifies a
+ * shard. Restrictions below other boolean operators are left alone.
+ */
+static void
+FilterArraysWalker(Node *clause, ArrayFilterContext *context)
+{
+	if (clause == NULL)
+	{
+		return;
+	}
+
+	if (IsA(clause, List))
+	{
+		ListCell *clauseCell = NULL;
+
+		foreach(clauseCell, (List *) clause)
+		{
+			FilterArraysWalker((Node *) lfirst(clauseCell), context);
+		}
+	}
+	else if (and_clause(clause))
+	{
+		FilterArraysWalker((Node *) ((BoolExpr *) clause)->args, context);
+	}
+	else if (IsA(clause, ScalarArrayOpExpr))
+	{
+		ScalarArrayOpExpr *arrayOperatorExpression = (ScalarArrayOpExpr *) clause;
+
+		if (!IsShardFilterableArray(arrayOperatorExpression, context->partitionColumn))
+		{
+			return;
+		}
+
+		context->foundArray = true;
+
+		if (context->shardInterval != NULL)
+		{
+			ListCell *arrayCell = lnext(list_head(arrayOperatorExpression->args));
+			Const *arrayConst = (Const *) lfirst(arrayCell);
+
+			lfirst(arrayCell) = FilterArrayConstForShard(arrayConst, context);
+		}
+	}
+}
+
+
+/*
+ * IsShardFilterableArray returns whether the given array operator expression
+ * is of the form partcol = ANY(const array), with the elements of the array
+ * being of the partition column's type.
+ */
+static bool
+IsShardFilterableArray(ScalarArrayOpExpr *arrayOperatorExpression, Var *partitionColumn)
+{
+	Node *leftOpExpression = NULL;
+	Node *arrayArgument = NULL;
+	Const *arrayConst = NULL;
+	ArrayType *array = NULL;
+
+	if (!arrayOperatorExpression->useOr ||
+		list_length(arrayOperatorExpression->args) != 2 ||
+		!OperatorImplementsEquality(arrayOperatorExpression->opno))
+	{
+		return false;
+	}
+
+	leftOpExpression = strip_implicit_coercions(linitial(arrayOperatorExpression->args));
+	arrayArgument = (Node *) lsecond(arrayOperatorExpression->args);
+
+	if (!equal(leftOpExpression, partitionColumn) || !IsA(arrayArgument, Const))
+	{
+		return false;
+	}
+
+	arrayConst = (Const *) arrayArgument;
+	if (arrayConst->constisnull)
+	{
+		return false;
+	}
+
+	array = DatumGetArrayTypeP(arrayConst->constvalue);
+
+	return ARR_ELEMTYPE(array) == partitionColumn->vartype;
+}
+
+
+/*
+ * FilterArrayConstForShard returns an array constant that only contains the
+ * elements of the given array that hash into the shard of the context. NULL
+ * elements are removed as well, since partcol = NULL is never true. If all
+ * elements remain, the original constant is returned.
+ */
+static Const *
+FilterArrayConstForShard(Const *arrayConst, ArrayFilterContext *context)
+{
+	ArrayType *array = DatumGetArrayTypeP(arrayConst->constvalue);
+	Oid elementType = ARR_ELEMTYPE(array);
+	int16 typlen = 0;
+	bool typbyval = false;
+	char typalign = '\0';
+	Datum *elementArray = NULL;
+	bool *nullArray = NULL;
+	int elementCount = 0;
+	Datum *filteredElementArray = NULL;
+	int filteredElementCount = 0;
+	int elementIndex = 0;
+	ArrayType *filteredArray = NULL;
+	uint64 shardId = context->shardInterval->shardId;
+
+	get_typlenbyvalalign(elementType, &typlen, &typbyval, &typalign);
+	deconstruct_array(array, elementType, typlen, typbyval, typalign,
+					  &elementArray, &nullArray, &elementCount);
+
+	filteredElementArray = palloc0(Max(elementCount, 1) * sizeof(Datum));
+
+	for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+	{
+		ShardInterval *elementShardInterval = NULL;
+
+		if (nullArray[elementIndex])
+		{
+			continue;
+		}
+
+		elementShardInterval = FindShardInterval(elementArray[elementIndex],
+												 context->cacheEntry);
+		if (elementShardInterval != NULL && elementShardInterval->shardId == shardId)
+		{
+			filteredElementArray[filteredElementCount] = elementArray[elementIndex];
+			filteredElementCount++;
+		}
+	}
+
+	if (filteredElementCount == elementCount)
+	{
+		return arrayConst;
+	}
+
+	filteredArray = construct_array(filteredElementArray, filteredElementCount,
+									elementType, typlen, typbyval, typalign);
+
+	return makeConst(arrayConst->consttype, arrayConst->consttypmod,
+					 arrayConst->constcollid, -1, PointerGetDatum(filteredArray),
+					 false, false);
+}
+
+
 /*
  * PrunableExpressions builds a list of all prunable expressions in node,
  * storing them in context->pruningInstances.
@@ -608,8 +1140,29 @@ AddSAOPartitionKeyRestrictionToInstance(ClauseWalkerContext *context,
 
 		array = DatumGetArrayTypeP(((Const *) arrayArgument)->constvalue);
 
-		/* get the necessary information from array type to iterate over it */
+		/*
+		 * For hash-partitioned tables, we hash all elements of the array in
+		 * one go when pruning, as long as the elements can be hashed with the
+		 * partition column's hash function.
+		 */
 		elementType = ARR_ELEMTYPE(array);
+		if (context->partitionMethod == DISTRIBUTE_BY_HASH &&
+			elementType == context->partitionColumn->vartype &&
+			prune->equalArrayConsts == NULL)
+		{
+			prune->equalArrayConsts = (Const *) arrayArgument;
+			prune->hasValidConstraint = true;
+
+			if (!prune->addedToPruningInstances)
+			{
+				context->pruningInstances = lappend(context->pruningInstances, prune);
+				prune->addedToPruningInstances = true;
+			}
+
+			return;
+		}
+
+		/* get the necessary information from array type to iterate over it */
 		get_typlenbyvalalign(elementType,
 							 &typlen,
 							 &typbyval,
@@ -911,6 +1464,12 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 		return NIL;
 	}
 
+	/* with an IN list, only the shards of its elements can match */
+	if (prune->equalArrayConsts)
+	{
+		return PruneWithEqualArray(cacheEntry, context, prune);
+	}
+
 	/*
 	 * For an equal constraints, if there's no overlapping shards (always the
 	 * case for hash and range partitioning, sometimes for append), can
@@ -1000,9 +1559,6 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 	/*
 	 * Next method: binary search with fuzzy boundaries. Can't trivially do so
 	 * if shards have overlapping boundaries.
-	 *
-	 * TODO: If we kept shard intervals separately sorted by both upper and
-	 * lower boundaries, this should be possible?
 	 */
 	if (!cacheEntry->hasOverlappingShardInterval && (
 			prune->greaterConsts || prune->greaterEqualConsts ||
@@ -1011,6 +1567,18 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 		return PruneWithBoundaries(cacheEntry, context, prune);
 	}
 
+	/*
+	 * If shards do overlap, we can still use binary search to narrow down the
+	 * shards to check, using the greatest maxValue up to each shard.
+	 */
+	if (cacheEntry->greatestMaxValueIndexArray != NULL && (
+			prune->equalConsts ||
+			prune->greaterConsts || prune->greaterEqualConsts ||
+			prune->lessConsts || prune->lessEqualConsts))
+	{
+		return PruneWithOverlappingBoundaries(cacheEntry, context, prune);
+	}
+
 	/*
 	 * Brute force: Check each shard.
 	 */
@@ -1018,6 +1586,99 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 }
 
 
+/*
+ * PruneWithEqualArray returns the shards of a hash-partitioned table that
+ * contain at least one of the elements of the partcol = ANY(array) constraint
+ * of the given PruningInstance, in shard index order. Each element is hashed
+ * once and mapped to its shard index directly, instead of pruning for each
+ * element separately. If the instance also constrains the partition column to
+ * a single value, the result is intersected with the shard of that value.
+ */
+static List *
+PruneWithEqualArray(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
+					PruningInstance *prune)
+{
+	List *remainingShardList = NIL;
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	ShardInterval **sortedShardIntervalArray = cacheEntry->sortedShardIntervalArray;
+	ArrayType *array = DatumGetArrayTypeP(prune->equalArrayConsts->constvalue);
+	bool *shardIndexIncluded = palloc0(shardCount * sizeof(bool));
+	List *otherShardList = NIL;
+	FunctionCallInfoData hashFunctionCall;
+	ArrayIterator arrayIterator = NULL;
+	Datum arrayElement = 0;
+	bool isNull = false;
+	int shardIndex = 0;
+
+	Assert(context->partitionMethod == DISTRIBUTE_BY_HASH);
+
+	InitFunctionCallInfoData(hashFunctionCall, cacheEntry->hashFunction, 1,
+							 InvalidOid, NULL, NULL);
+
+	arrayIterator = array_create_iterator(array, 0, NULL);
+	while (array_iterate(arrayIterator, &arrayElement, &isNull))
+	{
+		Datum hashedValue = 0;
+
+		/* partcol = NULL is never true */
+		if (isNull)
+		{
+			continue;
+		}
+
+		hashFunctionCall.arg[0] = arrayElement;
+		hashFunctionCall.argnull[0] = false;
+		hashFunctionCall.isnull = false;
+
+		hashedValue = FunctionCallInvoke(&hashFunctionCall);
+		if (hashFunctionCall.isnull)
+		{
+			elog(ERROR, "function %u returned NULL", hashFunctionCall.flinfo->fn_oid);
+		}
+
+		shardIndex = FindShardIntervalIndex(hashedValue, cacheEntry);
+		if (shardIndex != INVALID_SHARD_INDEX)
+		{
+			shardIndexIncluded[shardIndex] = true;
+		}
+	}
+	array_free_iterator(arrayIterator);
+
+	/* prune using the remaining equality constraints, if any */
+	if (prune->equalConsts || prune->hashedEqualConsts)
+	{
+		PruningInstance singleValuePrune = *prune;
+		ListCell *shardCell = NULL;
+
+		singleValuePrune.equalArrayConsts = NULL;
+		otherShardList = PruneOne(cacheEntry, context, &singleValuePrune);
+
+		foreach(shardCell, otherShardList)
+		{
+			ShardInterval *shardInterval = (ShardInterval *) lfirst(shardCell);
+
+			if (shardIndexIncluded[shardInterval->shardIndex])
+			{
+				remainingShardList = lappend(remainingShardList, shardInterval);
+			}
+		}
+
+		return remainingShardList;
+	}
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		if (shardIndexIncluded[shardIndex])
+		{
+			remainingShardList = lappend(remainingShardList,
+										 sortedShardIntervalArray[shardIndex]);
+		}
+	}
+
+	return remainingShardList;
+}
+
+
 /*
  * PerformCompare invokes comparator with prepared values, check for
  * unexpected NULL returns.
@@ -1330,6 +1991,167 @@ PruneWithBoundaries(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *contex
 }
 
 
+/*
+ * PruneWithOverlappingBoundaries returns a list of shards matching the
+ * constraints of the PruningInstance for tables whose shards may overlap.
+ *
+ * Since shards are sorted by their minValue, the shards whose minValue is not
+ * bigger than the upper bound form a prefix of the sorted shard array, which
+ * we find using binary search. The greatest maxValue up to each shard only
+ * grows along the array, so we can also binary search for the first shard
+ * that may reach the lower bound. Only the shards in between are checked
+ * individually. Shards without min/max values are sorted last and can never
+ * be pruned.
+ */
+static List *
+PruneWithOverlappingBoundaries(DistTableCacheEntry *cacheEntry,
+							   ClauseWalkerContext *context, PruningInstance *prune)
+{
+	List *remainingShardList = NIL;
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	int initializedCount = cacheEntry->initializedShardIntervalCount;
+	ShardInterval **sortedShardIntervalArray = cacheEntry->sortedShardIntervalArray;
+	int *greatestMaxValueIndexArray = cacheEntry->greatestMaxValueIndexArray;
+	FunctionCallInfo compareFunctionCall = &context->compareIntervalFunctionCall;
+	Const *lowerBoundConst = NULL;
+	Const *upperBoundConst = NULL;
+	int lowerBoundIdx = 0;
+	int upperBoundIdx = initializedCount;
+	int curIdx = 0;
+
+	/* use the most restrictive bounds, boundary inclusion is checked below */
+	lowerBoundConst = GreaterBoundConst(compareFunctionCall, prune->equalConsts,
+										prune->greaterEqualConsts);
+	lowerBoundConst = GreaterBoundConst(compareFunctionCall, lowerBoundConst,
+										prune->greaterConsts);
+	upperBoundConst = LesserBoundConst(compareFunctionCall, prune->equalConsts,
+									   prune->lessEqualConsts);
+	upperBoundConst = LesserBoundConst(compareFunctionCall, upperBoundConst,
+									   prune->lessConsts);
+
+	/* find the end of the shards with minValue <= upper bound */
+	if (upperBoundConst != NULL)
+	{
+		int lowIdx = 0;
+		int highIdx = initializedCount;
+
+		while (lowIdx < highIdx)
+		{
+			int middleIdx = lowIdx + ((highIdx - lowIdx) / 2);
+			ShardInterval *middleInterval = sortedShardIntervalArray[middleIdx];
+
+			if (PerformValueCompare(compareFunctionCall, middleInterval->minValue,
+									upperBoundConst->constvalue) <= 0)
+			{
+				lowIdx = middleIdx + 1;
+			}
+			else
+			{
+				highIdx = middleIdx;
+			}
+		}
+
+		upperBoundIdx = lowIdx;
+	}
+
+	/* find the first shard up to which some maxValue >= lower bound */
+	if (lowerBoundConst != NULL)
+	{
+		int lowIdx = 0;
+		int highIdx = upperBoundIdx;
+
+		while (lowIdx < highIdx)
+		{
+			int middleIdx = lowIdx + ((highIdx - lowIdx) / 2);
+			int greatestIdx = greatestMaxValueIndexArray[middleIdx];
+			ShardInterval *greatestInterval = sortedShardIntervalArray[greatestIdx];
+
+			if (PerformValueCompare(compareFunctionCall, greatestInterval->maxValue,
+									lowerBoundConst->constvalue) < 0)
+			{
+				lowIdx = middleIdx + 1;
+			}
+			else
+			{
+				highIdx = middleIdx;
+			}
+		}
+
+		lowerBoundIdx = lowIdx;
+	}
+
+	for (curIdx = lowerBoundIdx; curIdx < upperBoundIdx; curIdx++)
+	{
+		ShardInterval *curInterval = sortedShardIntervalArray[curIdx];
+
+		if (!ExhaustivePruneOne(curInterval, context, prune))
+		{
+			remainingShardList = lappend(remainingShardList, curInterval);
+		}
+	}
+
+	for (curIdx = initializedCount; curIdx < shardCount; curIdx++)
+	{
+		remainingShardList = lappend(remainingShardList,
+									 sortedShardIntervalArray[curIdx]);
+	}
+
+	return remainingShardList;
+}
+
+
+/*
+ * GreaterBoundConst returns the one of the given constants with the greater
+ * value, ignoring NULL pointers.
+ */
+static Const *
+GreaterBoundConst(FunctionCallInfoData *compareFunctionCall, Const *firstConst,
+				  Const *secondConst)
+{
+	if (firstConst == NULL)
+	{
+		return secondConst;
+	}
+	else if (secondConst == NULL)
+	{
+		return firstConst;
+	}
+	else if (PerformValueCompare(compareFunctionCall, firstConst->constvalue,
+								 secondConst->constvalue) >= 0)
+	{
+		return firstConst;
+	}
+
+	return secondConst;
+}
+
+
+/*
+ * LesserBoundConst returns the one of the given constants with the lesser
+ * value, ignoring NULL pointers.
+ */
+static Const *
+LesserBoundConst(FunctionCallInfoData *compareFunctionCall, Const *firstConst,
+				 Const *secondConst)
+{
+	if (firstConst == NULL)
+	{
+		return secondConst;
+	}
+	else if (secondConst == NULL)
+	{
+		return firstConst;
+	}
+	else if (PerformValueCompare(compareFunctionCall, firstConst->constvalue,
+								 secondConst->constvalue) <= 0)
+	{
+		return firstConst;
+	}
+
+	return secondConst;
+}
+
+
 /*
  * ExhaustivePrune returns a list of shards matching PruningInstances
  * constraints, by simply checking them for each individual shard.
@@ -19,30 +19,71 @@
 #include "citus_version.h"
 #include "commands/explain.h"
 #include "executor/executor.h"
+#include "distributed/adaptive_executor.h"
 #include "distributed/backend_data.h"
+#include "distributed/batched_replication.h"
 #include "distributed/citus_nodefuncs.h"
+#include "distributed/column_statistics.h"
 #include "distributed/connection_management.h"
+#include "distributed/connection_wait_stats.h"
 #include "distributed/distributed_deadlock_detection.h"
+#include "distributed/fast_path_router_planner.h"
+#include "distributed/function_call_delegation.h"
+#include "distributed/insert_select_executor.h"
+#include "distributed/intermediate_result_scan.h"
+#include "distributed/intermediate_results.h"
+#include "distributed/job_cache_usage.h"
+#include "distributed/job_directory_cleanup.h"
+#include "distributed/local_executor.h"
 #include "distributed/maintenanced.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
+#include "distributed/memory_results.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/metadata_prewarm.h"
+#include "distributed/metadata_sync.h"
 #include "distributed/multi_copy.h"
 #include "distributed/multi_explain.h"
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_logical_optimizer.h"
+#include "distributed/multi_master_planner.h"
 #include "distributed/distributed_planner.h"
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_router_planner.h"
 #include "distributed/multi_server_executor.h"
 #include "distributed/multi_utility.h"
+#include "distributed/node_fanout.h"
+#include "distributed/node_health.h"
+#include "distributed/parallel_copy_to.h"
+#include "distributed/parallel_local_copy.h"
+#include "distributed/partition_cache.h"
+#include "distributed/partition_pruning.h"
+#include "distributed/recursive_planning.h"
+#include "distributed/reference_table_utils.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/placement_connection.h"
+#include "distributed/planner_stats.h"
+#include "distributed/query_stats.h"
+#include "distributed/query_trace.h"
 #include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
+#include "distributed/result_cache.h"
+#include "distributed/rollup_tables.h"
+#include "distributed/secondary_node_routing.h"
+#include "distributed/sequence_ranges.h"
+#include "distributed/shard_access_stats.h"
+#include "distributed/shard_invalidation_log.h"
+#include "distributed/shard_pruning.h"
+#include "distributed/shard_rebalancer.h"
+#include "distributed/shard_retention.h"
+#include "distributed/shard_statistics.h"
+#include "distributed/shared_connection_stats.h"
 #include "distributed/shared_library_init.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/statistics_collection.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/task_tracker.h"
+#include "distributed/tenant_admission.h"
 #include "distributed/transaction_management.h"
 #include "distributed/transaction_recovery.h"
 #include "distributed/worker_manager.h"
@@ -79,6 +120,14 @@ static const struct config_enum_entry task_assignment_policy_options[] = {
 	{ "greedy", TASK_ASSIGNMENT_GREEDY, false },
 	{ "first-replica", TASK_ASSIGNMENT_FIRST_REPLICA, false },
 	{ "round-robin", TASK_ASSIGNMENT_ROUND_ROBIN, false },
+	{ "work-stealing", TASK_ASSIGNMENT_WORK_STEALING, false },
+	{ NULL, 0, false }
+};
+
+static const struct config_enum_entry parallel_copy_to_options[] = {
+	{ "off", PARALLEL_COPY_TO_OFF, false },
+	{ "shard-order", PARALLEL_COPY_TO_SHARD_ORDER, false },
+	{ "interleaved", PARALLEL_COPY_TO_INTERLEAVED, false },
 	{ NULL, 0, false }
 };
 
@@ -91,6 +140,7 @@ static const struct config_enum_entry replication_model_options[] = {
 static const struct config_enum_entry task_executor_type_options[] = {
 	{ "real-time", MULTI_EXECUTOR_REAL_TIME, false },
 	{ "task-tracker", MULTI_EXECUTOR_TASK_TRACKER, false },
+	{ "adaptive", MULTI_EXECUTOR_ADAPTIVE, false },
 	{ NULL, 0, false }
 };
 
@@ -104,6 +154,7 @@ static const struct config_enum_entry shard_placement_policy_options[] = {
 static const struct config_enum_entry use_secondary_nodes_options[] = {
 	{ "never", USE_SECONDARY_NODES_NEVER, false },
 	{ "always", USE_SECONDARY_NODES_ALWAYS, false },
+	{ "read-only", USE_SECONDARY_NODES_READ_ONLY, false },
 	{ NULL, 0, false }
 };
 
@@ -123,6 +174,12 @@ static const struct config_enum_entry citus_ssl_mode_options[] = {
 	{ NULL, 0, false }
 };
 
+static const struct config_enum_entry intermediate_result_compression_options[] = {
+	{ "none", INTERMEDIATE_RESULT_COMPRESSION_NONE, false },
+	{ "pglz", INTERMEDIATE_RESULT_COMPRESSION_PGLZ, false },
+	{ NULL, 0, false }
+};
+
 static const struct config_enum_entry multi_task_query_log_level_options[] = {
 	{ "off", MULTI_TASK_QUERY_INFO_OFF, false },
 	{ "debug", DEBUG2, false },
@@ -139,6 +196,12 @@ static const struct config_enum_entry multi_shard_modify_connection_options[] =
 	{ NULL, 0, false }
 };
 
+static const struct config_enum_entry stat_statements_track_options[] = {
+	{ "none", STAT_STATEMENTS_TRACK_NONE, false },
+	{ "all", STAT_STATEMENTS_TRACK_ALL, false },
+	{ NULL, 0, false }
+};
+
 /* *INDENT-ON* */
 
 
@@ -220,6 +283,21 @@ _PG_init(void)
 	/* initialize coordinated transaction management */
 	InitializeTransactionManagement();
 	InitializeBackendManagement();
+	InitializeSharedConnectionStats();
+	InitializeTenantAdmission();
+	InitializeNodeHealth();
+	InitializeResultCache();
+	InitializeMemoryResults();
+	InitializeSharedMetadataCache();
+	InitializeShardInvalidationLog();
+	InitializeShardStatisticsQueue();
+	InitializeBatchedReplication();
+	InitializeCitusQueryStats();
+	InitializeShardAccessStats();
+	InitializeConnectionWaitStats();
+	InitializeJobCacheUsage();
+	InitializePlannerStats();
+	InitializeQueryTrace();
 	InitializeConnectionManagement();
 	InitPlacementConnectionManagement();
 
@@ -313,6 +391,125 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_MS,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_node_command_concurrency",
+		gettext_noop("Sets the maximum number of nodes that commands sent to all "
+					 "nodes run on at a time."),
+		gettext_noop("Metadata changes, propagated DDL commands and "
+					 "run_command_on_workers connect to this many nodes at "
+					 "a time and send each node its next command as soon as "
+					 "it finished the previous one. Once a node is done, the "
+					 "next node is started."),
+		&MaxNodeCommandConcurrency,
+		32, 1, 1024,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.prewarm_connections",
+		gettext_noop("Connects to all worker nodes on the first distributed query."),
+		gettext_noop("When enabled, the first distributed query of a session starts "
+					 "establishing connections to all worker nodes in the "
+					 "background, and keeps them open for the rest of the "
+					 "session, such that later queries do not need to wait for "
+					 "connection establishment."),
+		&EnableConnectionPrewarming,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.node_connection_keepalive_interval",
+		gettext_noop("Sets the TCP keepalive interval of connections to worker nodes."),
+		gettext_noop("Idle connections to worker nodes send a TCP keepalive after "
+					 "this many seconds without traffic, and repeat it at the same "
+					 "interval. This keeps cached connections from being dropped by "
+					 "firewalls. 0 uses the operating system default."),
+		&NodeConnectionKeepaliveInterval,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_S,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.unreachable_node_retry_interval",
+		gettext_noop("Sets how long connections to a worker node fail immediately "
+					 "after failing to connect to it."),
+		gettext_noop("When a connection attempt to a worker node fails, the node "
+					 "is marked as unreachable across all backends, and new "
+					 "connections to it fail without contacting the node until "
+					 "this interval has passed or the maintenance daemon finds "
+					 "the node reachable again. Executors then use other "
+					 "placements right away. Setting to 0 disables this."),
+		&UnreachableNodeRetryInterval,
+		0, 0, INT_MAX,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.node_health_check_interval",
+		gettext_noop("Sets how often the maintenance daemon probes worker nodes "
+					 "that are marked as unreachable."),
+		gettext_noop("Only used when citus.unreachable_node_retry_interval is "
+					 "set. Setting to -1 disables the probes."),
+		&NodeHealthCheckInterval,
+		10000, -1, INT_MAX,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_shared_pool_size",
+		gettext_noop("Sets the maximum number of connections allowed per worker node "
+					 "across all the backends of this node. Setting to 0 disables "
+					 "the limit."),
+		gettext_noop("When a backend needs a new connection to a worker node that "
+					 "already has this many connections from this node, it waits "
+					 "until another backend closes one of its connections to that "
+					 "worker. Backends that already have a connection to the worker "
+					 "node do not wait, and cached connections count towards the "
+					 "limit."),
+		&MaxSharedPoolSize,
+		0, 0, INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_tenant_concurrency",
+		gettext_noop("Sets the maximum number of queries that may run at once on "
+					 "the shards of one tenant across all the backends of this "
+					 "node. Setting to 0 disables the limit."),
+		gettext_noop("A tenant is the group of colocated shards that a router "
+					 "query is routed to by its distribution column value. "
+					 "Further queries of the tenant wait until one of its "
+					 "running queries finishes, such that a single tenant cannot "
+					 "occupy all connection slots of the worker that holds its "
+					 "shards. Multi-shard queries and queries on reference "
+					 "tables are not limited."),
+		&MaxTenantConcurrency,
+		0, 0, INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_tenant_queries_per_second",
+		gettext_noop("Sets the maximum rate at which queries on the shards of one "
+					 "tenant may start across all the backends of this node. "
+					 "Setting to 0 disables the limit."),
+		gettext_noop("Queries that exceed the rate wait until they may start. A "
+					 "tenant that was idle may start up to one second worth of "
+					 "queries at once."),
+		&MaxTenantQueriesPerSecond,
+		0, 0, INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
 	/* keeping temporarily for updates from pre-6.0 versions */
 	DefineCustomStringVariable(
 		"citus.worker_list_file",
@@ -349,6 +546,23 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.propagate_statement_timeout",
+		gettext_noop("Forwards the remaining statement_timeout to the tasks of "
+					 "multi-shard queries."),
+		gettext_noop("When enabled and statement_timeout is set, the real-time "
+					 "executor sets the time that is left of the timeout as the "
+					 "statement_timeout of each task on the workers, such that "
+					 "tasks stop when the statement times out, even if cancel "
+					 "requests from the coordinator do not reach the workers. "
+					 "This takes an additional round trip per task. Tasks in "
+					 "transaction blocks are not affected."),
+		&PropagateStatementTimeout,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.binary_worker_copy_format",
 		gettext_noop("Use the binary worker copy format."),
@@ -361,6 +575,172 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomEnumVariable(
+		"citus.partition_file_compression",
+		gettext_noop("Sets the compression method for repartition files."),
+		gettext_noop("When set, workers compress the partition files of "
+					 "repartition jobs in blocks before writing them to disk "
+					 "or sending them to other workers. Merge tasks detect "
+					 "compressed files and decompress them while reading."),
+		&PartitionFileCompression,
+		INTERMEDIATE_RESULT_COMPRESSION_NONE,
+		intermediate_result_compression_options,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_shared_copy_connections",
+		gettext_noop("Shares connections across shards when copying into "
+					 "hash-distributed tables."),
+		gettext_noop("By default, COPY and INSERT ... SELECT via the coordinator "
+					 "open a connection per shard placement, which may exhaust "
+					 "max_connections on the workers for tables with many shards. "
+					 "When enabled, rows are buffered per shard, and each shard's "
+					 "rows are sent in separate COPY commands that reuse the same "
+					 "connections to a worker. Parallel multi-shard commands later "
+					 "in the same transaction may then fail, since several "
+					 "placements were modified over one connection."),
+		&EnableSharedCopyConnections,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_copy_passthrough",
+		gettext_noop("Passes unparsed fields on to shards when copying into "
+					 "distributed tables."),
+		gettext_noop("By default, COPY FROM on the coordinator parses each row "
+					 "into values and serializes them again for the shards, "
+					 "which makes the coordinator the bottleneck of large loads. "
+					 "When enabled, COPY commands in text or csv format that "
+					 "copy all columns only parse the partition column, and "
+					 "pass the other fields on in text format, leaving it to "
+					 "the workers to parse them."),
+		&EnableCopyPassthrough,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomEnumVariable(
+		"citus.parallel_copy_to",
+		gettext_noop("Copies the shards of distributed tables concurrently in "
+					 "COPY ... TO STDOUT."),
+		gettext_noop("By default, COPY ... TO STDOUT on a distributed table runs "
+					 "a SELECT that collects all rows on the coordinator. When "
+					 "set, COPY commands in text or csv format instead copy all "
+					 "shards concurrently and pass the rows on to the client "
+					 "unparsed, either in shard order (shard-order) or in the "
+					 "order in which they arrive (interleaved)."),
+		&ParallelCopyTo,
+		PARALLEL_COPY_TO_OFF,
+		parallel_copy_to_options,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.append_copy_shard_count",
+		gettext_noop("Sets the number of shards that a COPY into an "
+					 "append-distributed table fills at the same time."),
+		gettext_noop("By default, COPY fills one new shard at a time, such that "
+					 "only one worker writes at any point of the load. When set "
+					 "higher, COPY creates this many shards, which are placed "
+					 "on different workers, and sends blocks of rows to them "
+					 "in turn."),
+		&AppendCopyShardCount,
+		1, 1, 100,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.track_copy_progress",
+		gettext_noop("Tracks the progress of COPY commands into distributed "
+					 "tables."),
+		gettext_noop("When enabled, the rows and bytes that a COPY into a "
+					 "distributed table sent to each shard are shown in the "
+					 "citus_stat_copy_progress view while the COPY runs, along "
+					 "with how often it had to wait for a slow worker."),
+		&TrackCopyProgress,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.parallel_local_copy_workers",
+		gettext_noop("Sets the number of parallel workers that read the data of "
+					 "a table that is being distributed."),
+		gettext_noop("When a table with data is distributed, the coordinator "
+					 "copies its rows into the new shards. By default, a single "
+					 "backend reads and serializes all rows. When set, up to "
+					 "this many parallel workers read ranges of blocks of the "
+					 "table and serialize the rows, and the coordinator only "
+					 "passes them on to the shards. Rows are then never "
+					 "inserted directly into local shards."),
+		&ParallelLocalCopyWorkers,
+		0, 0, 1024,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomRealVariable(
+		"citus.rebalance_load_weight",
+		gettext_noop("Sets the weight of the query load when rebalancing shards."),
+		gettext_noop("The rebalancer balances the cost of the shards on each node, "
+					 "which is the weighted sum of the share of the total disk "
+					 "size of the shards and the share of the total number of "
+					 "tuples read and written on them. Setting this to 0 only "
+					 "balances disk size, while setting it to 1 only balances "
+					 "query load."),
+		&RebalanceLoadWeight,
+		0.5, 0.0, 1.0,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.rebalance_max_concurrent_moves",
+		gettext_noop("Sets the maximum number of shard moves that "
+					 "rebalance_table_shards runs at the same time."),
+		gettext_noop("Each move runs in its own transaction over a separate "
+					 "connection to the coordinator. Moves of co-located shards "
+					 "always run one after the other."),
+		&RebalanceMaxConcurrentMoves,
+		1, 1, 64,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_concurrent_reference_table_copies",
+		gettext_noop("Sets the maximum number of reference tables that are "
+					 "copied to a node at the same time when it is activated."),
+		gettext_noop("Each reference table is streamed from an existing "
+					 "placement over its own pair of connections, and committed "
+					 "on the new node once it is copied."),
+		&MaxConcurrentReferenceTableCopies,
+		4, 1, 64,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_merge_function_scan",
+		gettext_noop("Reads merged files directly instead of through a merge table."),
+		gettext_noop("When enabled, merge tasks that run a query over files "
+					 "fetched from other workers create a temporary view that "
+					 "reads the files through a function scan, instead of "
+					 "first copying the files into a merge table."),
+		&EnableMergeFunctionScan,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.expire_cached_shards",
 		gettext_noop("This GUC variable has been deprecated."),
@@ -461,6 +841,39 @@ RegisterCitusConfigVariables(void)
 		0,
 		ErrorIfNotASuitableDeadlockFactor, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.multi_row_insert_copy_threshold",
+		gettext_noop("Sets the number of rows from which multi-row INSERTs are "
+					 "sent to the shards with COPY."),
+		gettext_noop("Multi-row INSERTs are deparsed into a statement for each "
+					 "shard they touch, which takes a long time for INSERTs with "
+					 "thousands of rows. Multi-row INSERTs without RETURNING "
+					 "or ON CONFLICT that have at least this many rows are "
+					 "instead evaluated on the coordinator, like INSERT ... "
+					 "SELECT, and the rows are sent to the shards with COPY. "
+					 "Set to 0 to disable."),
+		&MultiRowInsertCopyThreshold,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_repartitioned_insert_select",
+		gettext_noop("Enables repartitioning INSERT ... SELECT results on the "
+					 "workers."),
+		gettext_noop("INSERT ... SELECT commands that cannot be pushed down "
+					 "collect all rows of the SELECT on the coordinator. When "
+					 "enabled, simple SELECTs from a single distributed table "
+					 "into a hash-distributed table are instead partitioned by "
+					 "the target shard ranges on the workers, and the partitions "
+					 "are inserted into the target shards directly."),
+		&EnableRepartitionedInsertSelect,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.recover_2pc_interval",
 		gettext_noop("Sets the time to wait between recovering 2PCs."),
@@ -476,144 +889,721 @@ RegisterCitusConfigVariables(void)
 		NULL, NULL, NULL);
 
 	DefineCustomBoolVariable(
-		"citus.enable_deadlock_prevention",
-		gettext_noop("Prevents transactions from expanding to multiple nodes"),
-		gettext_noop("When enabled, consecutive DML statements that write to "
-					 "shards on different nodes are prevented to avoid creating "
-					 "undetectable distributed deadlocks when performed "
-					 "concurrently."),
-		&EnableDeadlockPrevention,
-		true,
+		"citus.defer_shard_statistics",
+		gettext_noop("Defers updating shard statistics after appends to the "
+					 "maintenance daemon."),
+		gettext_noop("When enabled, appending to a shard clears its min/max "
+					 "values instead of fetching its size and min/max values "
+					 "from one of its placements. The maintenance daemon "
+					 "then updates the statistics of the shard in the "
+					 "background, after the transaction commits."),
+		&DeferShardStatistics,
+		false,
 		PGC_USERSET,
-		GUC_NO_SHOW_ALL,
+		0,
 		NULL, NULL, NULL);
 
-	DefineCustomBoolVariable(
-		"citus.enable_ddl_propagation",
-		gettext_noop("Enables propagating DDL statements to worker shards"),
-		NULL,
-		&EnableDDLPropagation,
-		true,
-		PGC_USERSET,
-		0,
+	DefineCustomIntVariable(
+		"citus.shard_statistics_refresh_interval",
+		gettext_noop("Sets the time to wait between refreshing deferred shard "
+					 "statistics."),
+		gettext_noop("The maintenance daemon updates the statistics of shards "
+					 "that were appended to with citus.defer_shard_statistics "
+					 "enabled every so often. This setting determines how "
+					 "often that happens, use -1 to disable."),
+		&ShardStatisticsRefreshInterval,
+		1000, -1, 7 * 24 * 3600 * 1000,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
 		NULL, NULL, NULL);
 
-	DefineCustomBoolVariable(
-		"citus.enable_router_execution",
-		gettext_noop("Enables router execution"),
-		NULL,
-		&EnableRouterExecution,
-		true,
-		PGC_USERSET,
-		GUC_NO_SHOW_ALL,
+	DefineCustomIntVariable(
+		"citus.shard_retention_check_interval",
+		gettext_noop("Sets the time to wait between dropping expired shards."),
+		gettext_noop("The maintenance daemon drops the shards of tables with a "
+					 "retention policy whose rows are all older than the "
+					 "retention period every so often. This setting determines "
+					 "how often that happens, use -1 to disable."),
+		&ShardRetentionCheckInterval,
+		60 * 60 * 1000, -1, 7 * 24 * 3600 * 1000,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
 		NULL, NULL, NULL);
 
 	DefineCustomIntVariable(
-		"citus.shard_count",
-		gettext_noop("Sets the number of shards for a new hash-partitioned table"
-					 "created with create_distributed_table()."),
-		NULL,
-		&ShardCount,
-		32, 1, 64000,
-		PGC_USERSET,
+		"citus.shard_retention_batch_size",
+		gettext_noop("Sets the maximum number of expired shards dropped in a "
+					 "single transaction."),
+		gettext_noop("The maintenance daemon drops expired shards in batches of "
+					 "this many shards, each in its own transaction, sending the "
+					 "DROP commands of a batch to the workers in parallel."),
+		&ShardRetentionBatchSize,
+		1000, 1, INT_MAX,
+		PGC_SIGHUP,
 		0,
 		NULL, NULL, NULL);
 
 	DefineCustomIntVariable(
-		"citus.shard_replication_factor",
-		gettext_noop("Sets the replication factor for shards."),
-		gettext_noop("Shards are replicated across nodes according to this "
-					 "replication factor. Note that shards read this "
-					 "configuration value at sharded table creation time, "
-					 "and later reuse the initially read value."),
-		&ShardReplicationFactor,
-		1, 1, 100,
-		PGC_USERSET,
-		0,
+		"citus.rollup_interval",
+		gettext_noop("Sets the time to wait between runs of the rollup tables."),
+		gettext_noop("The maintenance daemon aggregates the rows that were added "
+					 "to the source tables of rollup tables every so often. This "
+					 "setting determines how often that happens, use -1 to "
+					 "disable."),
+		&RollupInterval,
+		60 * 1000, -1, 7 * 24 * 3600 * 1000,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
 		NULL, NULL, NULL);
 
 	DefineCustomIntVariable(
-		"citus.shard_max_size",
-		gettext_noop("Sets the maximum size a shard will grow before it gets split."),
-		gettext_noop("Shards store table and file data. When the source "
-					 "file's size for one shard exceeds this configuration "
-					 "value, the database ensures that either a new shard "
-					 "gets created, or the current one gets split. Note that "
-					 "shards read this configuration value at sharded table "
-					 "creation time, and later reuse the initially read value."),
-		&ShardMaxSize,
-		1048576, 256, INT_MAX, /* max allowed size not set to MAX_KILOBYTES on purpose */
-		PGC_USERSET,
-		GUC_UNIT_KB,
+		"citus.column_statistics_interval",
+		gettext_noop("Sets the time to wait between updates of the column "
+					 "statistics of distributed tables."),
+		gettext_noop("The maintenance daemon merges the column statistics of "
+					 "the shards of all distributed tables into the "
+					 "coordinator's catalog every so often, such that the "
+					 "planner can estimate the sizes of joins. This setting "
+					 "determines how often that happens, use -1 to disable."),
+		&ColumnStatisticsInterval,
+		-1, -1, 7 * 24 * 3600 * 1000,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
 		NULL, NULL, NULL);
 
 	DefineCustomIntVariable(
-		"citus.max_intermediate_result_size",
-		gettext_noop("Sets the maximum size of the intermediate results in KB for "
-					 "CTEs and complex subqueries."),
-		NULL,
-		&MaxIntermediateResult,
-		1048576, -1, MAX_KILOBYTES,
+		"citus.table_size_cache_ttl",
+		gettext_noop("Sets how long the citus size functions reuse table sizes."),
+		gettext_noop("The citus size functions query every node to compute "
+					 "the size of a distributed table. When this setting is "
+					 "positive, a session reuses the sizes it fetched for "
+					 "this long instead of querying the nodes again, even if "
+					 "the tables changed in the meantime. Use 0 to disable "
+					 "the cache."),
+		&TableSizeCacheTTL,
+		0, 0, INT_MAX,
 		PGC_USERSET,
-		GUC_UNIT_KB,
+		GUC_UNIT_MS,
 		NULL, NULL, NULL);
 
 	DefineCustomIntVariable(
-		"citus.max_worker_nodes_tracked",
-		gettext_noop("Sets the maximum number of worker nodes that are tracked."),
-		gettext_noop("Worker nodes' network locations, their membership and "
-					 "health status are tracked in a shared hash table on "
-					 "the master node. This configuration value limits the "
-					 "size of the hash table, and consequently the maximum "
-					 "number of worker nodes that can be tracked."),
-		&MaxWorkerNodesTracked,
-		2048, 8, INT_MAX,
+		"citus.stat_statements_max",
+		gettext_noop("Sets the maximum number of statements tracked in "
+					 "citus_stat_statements."),
+		gettext_noop("When more distinct distributed statements are executed, "
+					 "the statistics of the least executed statement are "
+					 "discarded."),
+		&StatStatementsMax,
+		1000, 100, INT_MAX,
 		PGC_POSTMASTER,
 		0,
 		NULL, NULL, NULL);
 
-	DefineCustomIntVariable(
-		"citus.remote_task_check_interval",
-		gettext_noop("Sets the frequency at which we check job statuses."),
-		gettext_noop("The master node assigns tasks to workers nodes, and "
-					 "then regularly checks with them about each task's "
-					 "progress. This configuration value sets the time "
-					 "interval between two consequent checks."),
-		&RemoteTaskCheckInterval,
-		10, 1, INT_MAX,
-		PGC_USERSET,
-		GUC_UNIT_MS,
+	DefineCustomEnumVariable(
+		"citus.stat_statements_track",
+		gettext_noop("Enables tracking of distributed statements in "
+					 "citus_stat_statements."),
+		gettext_noop("When set to 'all', the coordinator records for each "
+					 "distributed statement which executor ran it, how many "
+					 "shards it touched, where the time went and how many "
+					 "bytes were received from the workers. Statements are "
+					 "identified by the query id of pg_stat_statements when "
+					 "it is loaded, and by their query text otherwise."),
+		&StatStatementsTrack,
+		STAT_STATEMENTS_TRACK_NONE,
+		stat_statements_track_options,
+		PGC_SUSET,
+		0,
 		NULL, NULL, NULL);
 
-	DefineCustomIntVariable(
-		"citus.task_tracker_delay",
-		gettext_noop("Task tracker sleep time between task management rounds."),
-		gettext_noop("The task tracker process wakes up regularly, walks over "
-					 "all tasks assigned to it, and schedules and executes these "
-					 "tasks. Then, the task tracker sleeps for a time period "
-					 "before walking over these tasks again. This configuration "
-					 "value determines the length of that sleeping period."),
-		&TaskTrackerDelay,
-		200, 1, 100000,
-		PGC_SIGHUP,
-		GUC_UNIT_MS,
+	DefineCustomBoolVariable(
+		"citus.track_shard_access",
+		gettext_noop("Counts the reads and writes of shards by the router executor."),
+		gettext_noop("When enabled, each node counts how often the router "
+					 "executor reads and writes each shard and how long that "
+					 "takes, as shown in citus_shard_access. This helps to "
+					 "find hot shards."),
+		&TrackShardAccess,
+		true,
+		PGC_SUSET,
+		0,
 		NULL, NULL, NULL);
 
 	DefineCustomIntVariable(
-		"citus.max_assign_task_batch_size",
-		gettext_noop("Sets the maximum number of tasks to assign per round."),
-		gettext_noop("The master node synchronously assigns tasks to workers in "
-					 "batches. Bigger batches allow for faster task assignment, "
-					 "but it may take longer for all workers to get tasks "
-					 "if the number of workers is large. This configuration "
-					 "value controls the maximum batch size."),
-		&MaxAssignTaskBatchSize,
-		64, 1, INT_MAX,
-		PGC_USERSET,
+		"citus.shard_access_stats_max",
+		gettext_noop("Sets the maximum number of shards whose accesses are counted."),
+		gettext_noop("Accesses to shards beyond this number are not counted "
+					 "until citus_shard_access_stats_reset() is called."),
+		&ShardAccessStatsMax,
+		10000, 100, INT_MAX,
+		PGC_POSTMASTER,
 		0,
 		NULL, NULL, NULL);
 
-	DefineCustomIntVariable(
+	DefineCustomBoolVariable(
+		"citus.track_connection_latency",
+		gettext_noop("Tracks waits of backends on worker nodes."),
+		gettext_noop("When enabled, backends publish the worker node they are "
+					 "waiting on in citus_stat_worker_waits, and the time spent "
+					 "connecting, sending queries, waiting for results and "
+					 "flushing COPY data is added to the latency histograms "
+					 "of each worker node in citus_worker_latency_histogram()."),
+		&TrackConnectionLatency,
+		true,
+		PGC_SUSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.track_planner_stats",
+		gettext_noop("Tracks the calls and time of the stages of distributed "
+					 "planning."),
+		gettext_noop("When enabled, the number of calls and the time spent in "
+					 "the router, logical and fast path router planners, "
+					 "recursive planning, shard pruning and deparsing, as well "
+					 "as plan cache hits and misses, are shown in "
+					 "citus_stat_planner."),
+		&TrackPlannerStats,
+		true,
+		PGC_SUSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomRealVariable(
+		"citus.query_trace_sample_rate",
+		gettext_noop("Sets the fraction of statements whose distributed "
+					 "execution is traced."),
+		gettext_noop("Events of traced statements, such as planning, executing "
+					 "subplans, acquiring connections, sending queries, receiving "
+					 "the first and last row and committing, are recorded in a "
+					 "ring buffer that citus_query_trace_json() dumps in the "
+					 "format of chrome://tracing. 0 disables tracing."),
+		&QueryTraceSampleRate,
+		0.0, 0.0, 1.0,
+		PGC_SUSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.query_trace_buffer_size",
+		gettext_noop("Sets the number of query trace events kept in shared "
+					 "memory."),
+		gettext_noop("When more events are recorded, the oldest events are "
+					 "overwritten."),
+		&QueryTraceBufferSize,
+		10000, 0, INT_MAX / 1024,
+		PGC_POSTMASTER,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_deadlock_prevention",
+		gettext_noop("Prevents transactions from expanding to multiple nodes"),
+		gettext_noop("When enabled, consecutive DML statements that write to "
+					 "shards on different nodes are prevented to avoid creating "
+					 "undetectable distributed deadlocks when performed "
+					 "concurrently."),
+		&EnableDeadlockPrevention,
+		true,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_binary_protocol",
+		gettext_noop("Fetches the results of router queries in binary format."),
+		gettext_noop("When enabled, the coordinator requests the results of "
+					 "router queries in binary format if all result columns "
+					 "have binary send and receive functions. This avoids "
+					 "text conversion of the results on both the workers and "
+					 "the coordinator."),
+		&EnableBinaryProtocol,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_result_streaming",
+		gettext_noop("Returns rows of router queries as they arrive from the worker."),
+		gettext_noop("When enabled, rows of router SELECT queries that are only "
+					 "scanned forward are returned directly from the connection "
+					 "to the worker, instead of collecting all rows on the "
+					 "coordinator first. The same applies to the RETURNING rows "
+					 "of multi-shard modifications. The connection cannot be "
+					 "used by other commands until all rows are read."),
+		&EnableResultStreaming,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_copy_result_transfer",
+		gettext_noop("Fetches the results of router queries using COPY."),
+		gettext_noop("When enabled, router SELECT queries without parameters "
+					 "are wrapped in COPY .. TO STDOUT and their rows are "
+					 "parsed in bulk, which is cheaper than receiving a "
+					 "separate result for every row when queries return many "
+					 "rows. Only has an effect on PostgreSQL 10 and above."),
+		&EnableCopyResultTransfer,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_intermediate_result_streaming",
+		gettext_noop("Reads intermediate results row by row."),
+		gettext_noop("When enabled, read_intermediate_result calls with constant "
+					 "arguments are planned as a scan that parses the rows of "
+					 "the result as they are needed, instead of a function scan "
+					 "that stores all rows before returning the first one."),
+		&EnableIntermediateResultStreaming,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_sorted_merge",
+		gettext_noop("Merges sorted task results instead of sorting them again."),
+		gettext_noop("When the tasks of a multi-shard query already sort their "
+					 "results in the order of the query, the coordinator merges "
+					 "the task results in sort order instead of sorting all of "
+					 "them, and stops reading once the query's LIMIT is reached."),
+		&EnableSortedMerge,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_result_cache",
+		gettext_noop("Caches the results of read-only router queries on reference "
+					 "tables."),
+		gettext_noop("When enabled, results of router SELECT queries that only "
+					 "read a reference table are cached by each session on the "
+					 "coordinator, and reused until the table is modified through "
+					 "this coordinator. Modifications made directly on the worker "
+					 "nodes are not observed."),
+		&EnableResultCache,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_local_execution",
+		gettext_noop("Executes router queries and COPY on local placements "
+					 "without a connection."),
+		gettext_noop("When enabled, router SELECT queries whose shards have "
+					 "placements on the local node, such as queries on reference "
+					 "tables on a node with metadata, are planned and executed "
+					 "in the same backend instead of over a connection to the "
+					 "local node. Likewise, COPY on a node with metadata inserts "
+					 "rows for shards whose only placement is on the local node "
+					 "directly into the shard."),
+		&EnableLocalExecution,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.hedged_read_percentile",
+		gettext_noop("Sets the response time percentile after which router queries "
+					 "are also sent to another replica. Setting to 0 disables "
+					 "hedged reads."),
+		gettext_noop("When a router SELECT on a replicated shard did not respond "
+					 "within this percentile of the response times of recent "
+					 "router SELECTs in the session, the query is sent to the "
+					 "next placement as well. The result of whichever placement "
+					 "responds first is used and the other query is cancelled. "
+					 "Queries in transaction blocks are not hedged."),
+		&HedgedReadPercentile,
+		0, 0, 100,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_ddl_propagation",
+		gettext_noop("Enables propagating DDL statements to worker shards"),
+		NULL,
+		&EnableDDLPropagation,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.incremental_metadata_sync",
+		gettext_noop("Only sends metadata differences when syncing to a node that "
+					 "has the distributed tables."),
+		gettext_noop("start_metadata_sync_to_node normally drops all metadata on "
+					 "the worker and recreates the tables, shards and placements "
+					 "from scratch. When enabled, and the worker already has the "
+					 "same distributed tables, only the shards and placements "
+					 "that differ are deleted, inserted or updated."),
+		&IncrementalMetadataSync,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.sequence_range_size",
+		gettext_noop("Sets the number of sequence values that a metadata worker "
+					 "allocates from the coordinator at a time."),
+		gettext_noop("On metadata workers, the sequences of distributed tables "
+					 "only hand out values from a fixed range per node. When set, "
+					 "nextval() calls of such sequences in INSERT commands are "
+					 "served from ranges of this many values that each session "
+					 "takes from the sequence on the coordinator when it needs "
+					 "them. 0 uses the local sequence."),
+		&SequenceRangeSize,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_router_execution",
+		gettext_noop("Enables router execution"),
+		NULL,
+		&EnableRouterExecution,
+		true,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_fast_path_router_planner",
+		gettext_noop("Enables planning simple single-shard queries without "
+					 "the postgres planner"),
+		gettext_noop("SELECT queries on a single distributed table with an "
+					 "equality filter on the distribution column always target "
+					 "a single shard. When enabled, such queries skip the "
+					 "postgres planner and are planned directly by the router "
+					 "planner, which reduces their planning time."),
+		&EnableFastPathRouterPlanner,
+		true,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_partition_pruning",
+		gettext_noop("Enables replacing distributed partitioned tables by the "
+					 "partition that the filters of a query prune them to"),
+		gettext_noop("When the filters of a SELECT query refute the partition "
+					 "bounds of all but one partition of a distributed "
+					 "partitioned table, the query is planned on the shards of "
+					 "that partition and the other partitions are not locked."),
+		&EnablePartitionPruning,
+		true,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_function_call_delegation",
+		gettext_noop("Enables sending calls of distributed functions to the node "
+					 "that has the shard of their distribution argument."),
+		gettext_noop("Functions that were distributed using "
+					 "create_distributed_function() are called on the worker "
+					 "that has the shard of the value of their distribution "
+					 "argument, such that their statements run on local shards."),
+		&EnableFunctionCallDelegation,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_shard_zone_map_pruning",
+		gettext_noop("Enables pruning shards using the zone maps of their columns."),
+		gettext_noop("Shards whose minimum and maximum values or bloom filters in "
+					 "pg_dist_shard_zone_map show that no row passes a filter of "
+					 "the query are skipped. Zone maps are only refreshed when "
+					 "appending to a shard or calling update_shard_zone_maps(), "
+					 "so this should only be enabled for tables whose shards are "
+					 "not modified otherwise."),
+		&EnableShardZoneMapPruning,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.shard_count",
+		gettext_noop("Sets the number of shards for a new hash-partitioned table"
+					 "created with create_distributed_table()."),
+		NULL,
+		&ShardCount,
+		32, 1, 64000,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.shard_replication_factor",
+		gettext_noop("Sets the replication factor for shards."),
+		gettext_noop("Shards are replicated across nodes according to this "
+					 "replication factor. Note that shards read this "
+					 "configuration value at sharded table creation time, "
+					 "and later reuse the initially read value."),
+		&ShardReplicationFactor,
+		1, 1, 100,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.shard_max_size",
+		gettext_noop("Sets the maximum size a shard will grow before it gets split."),
+		gettext_noop("Shards store table and file data. When the source "
+					 "file's size for one shard exceeds this configuration "
+					 "value, the database ensures that either a new shard "
+					 "gets created, or the current one gets split. Note that "
+					 "shards read this configuration value at sharded table "
+					 "creation time, and later reuse the initially read value."),
+		&ShardMaxSize,
+		1048576, 256, INT_MAX, /* max allowed size not set to MAX_KILOBYTES on purpose */
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_intermediate_result_size",
+		gettext_noop("Sets the maximum size of the intermediate results in KB for "
+					 "CTEs and complex subqueries."),
+		NULL,
+		&MaxIntermediateResult,
+		1048576, -1, MAX_KILOBYTES,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_job_cache_size",
+		gettext_noop("Sets the maximum size in KB of the job cache of a node."),
+		gettext_noop("Intermediate results and the partitions of repartition "
+					 "jobs are stored in files in base/pgsql_job_cache. When "
+					 "writing these files would make the directory exceed this "
+					 "size, queries wait for up to "
+					 "citus.job_cache_quota_wait_timeout for other queries to "
+					 "free up space and then fail. -1 disables the limit."),
+		&MaxJobCacheSize,
+		-1, -1, MAX_KILOBYTES,
+		PGC_SUSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.job_cache_quota_wait_timeout",
+		gettext_noop("Sets the time to wait for space in a full job cache."),
+		gettext_noop("When the job cache exceeds citus.max_job_cache_size, "
+					 "queries that write intermediate results or partitions "
+					 "wait for up to this amount of time before failing. 0 "
+					 "makes them fail immediately."),
+		&JobCacheQuotaWaitTimeout,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomEnumVariable(
+		"citus.intermediate_result_compression",
+		gettext_noop("Sets the compression method for intermediate results."),
+		gettext_noop("Intermediate results of CTEs and complex subqueries are "
+					 "sent to the workers and stored in files. Setting this to "
+					 "'pglz' compresses the results in blocks, which reduces "
+					 "network traffic and disk usage for large results at the "
+					 "cost of extra CPU time on the coordinator and the workers."),
+		&IntermediateResultCompression,
+		INTERMEDIATE_RESULT_COMPRESSION_NONE,
+		intermediate_result_compression_options,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.shared_metadata_cache_size",
+		gettext_noop("Sets the size of the shared memory that caches the shards "
+					 "of distributed tables."),
+		gettext_noop("Backends fill their metadata cache for a distributed table "
+					 "by reading all its shards and shard placements from the "
+					 "catalogs, which takes long for tables with many shards. "
+					 "When set, the sorted shards and their placements are kept "
+					 "in shared memory of this size once a backend read them, "
+					 "and other backends copy them from there. While a COMMIT "
+					 "PREPARED runs, for example during metadata sync to "
+					 "workers, the cache is bypassed and the tables of its "
+					 "database are removed from it afterwards. Setting this to "
+					 "0 disables the cache."),
+		&SharedMetadataCacheSize,
+		0, 0, MAX_KILOBYTES,
+		PGC_POSTMASTER,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.metadata_prewarm_table_count",
+		gettext_noop("Sets the number of recently used distributed tables whose "
+					 "metadata is loaded into the shared metadata cache at start "
+					 "up."),
+		gettext_noop("When set along with citus.shared_metadata_cache_size, the "
+					 "maintenance daemon periodically records this many of the "
+					 "most recently used distributed tables in "
+					 "pg_dist_metadata_prewarm, which is replicated to standbys. "
+					 "After a restart or failover, it loads the shards and "
+					 "placements of these tables into the shared metadata cache "
+					 "before backends need them, and citus_prewarm_metadata_cache() "
+					 "does the same on demand. Setting this to 0 disables "
+					 "prewarming."),
+		&MetadataPrewarmTableCount,
+		0, 0, MAX_SHARED_SHARD_LISTS,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_shard_placement_invalidation",
+		gettext_noop("Enables invalidating the placements of individual shards."),
+		gettext_noop("When a shard placement of a distributed table changes, for "
+					 "example when it is marked inactive or repaired, backends "
+					 "normally rebuild their metadata for the whole table, "
+					 "which takes long for tables with many shards. When "
+					 "enabled, metadata changes are logged in shared memory and "
+					 "backends only read the placements of the changed shards "
+					 "again. Metadata changes of prepared transactions, for "
+					 "example during metadata sync to workers, make backends "
+					 "rebuild the metadata of all tables in the database."),
+		&EnableShardPlacementInvalidation,
+		false,
+		PGC_POSTMASTER,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.lazy_placement_loading",
+		gettext_noop("Reads the placements of a shard only when they are used."),
+		gettext_noop("By default, the metadata cache entry of a distributed "
+					 "table is built with the placements of all its shards, "
+					 "which requires one scan of pg_dist_placement per shard. "
+					 "When enabled, the placements of a shard are read when a "
+					 "query first needs them, which speeds up the first query "
+					 "on tables with many shards. Tables read this way are not "
+					 "stored in the shared metadata cache."),
+		&LazyPlacementLoading,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_memory_intermediate_result_size",
+		gettext_noop("Sets the maximum size of intermediate results that are "
+					 "kept in memory."),
+		gettext_noop("Intermediate results that are received by a node are "
+					 "kept in dynamic shared memory instead of a file when "
+					 "they are not larger than this size, which avoids file "
+					 "system calls for small results. Larger results are "
+					 "written to files. Setting this to 0 stores all "
+					 "intermediate results in files. This setting only has "
+					 "an effect on PostgreSQL 10 and above."),
+		&MaxMemoryIntermediateResultSize,
+		64, 0, MAX_KILOBYTES,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_worker_nodes_tracked",
+		gettext_noop("Sets the maximum number of worker nodes that are tracked."),
+		gettext_noop("Worker nodes' network locations, their membership and "
+					 "health status are tracked in a shared hash table on "
+					 "the master node. This configuration value limits the "
+					 "size of the hash table, and consequently the maximum "
+					 "number of worker nodes that can be tracked."),
+		&MaxWorkerNodesTracked,
+		2048, 8, INT_MAX,
+		PGC_POSTMASTER,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.remote_task_check_interval",
+		gettext_noop("Sets the frequency at which we check job statuses."),
+		gettext_noop("The master node assigns tasks to workers nodes, and "
+					 "then regularly checks with them about each task's "
+					 "progress. This configuration value sets the time "
+					 "interval between two consequent checks."),
+		&RemoteTaskCheckInterval,
+		10, 1, INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.task_tracker_delay",
+		gettext_noop("Task tracker sleep time between task management rounds."),
+		gettext_noop("The task tracker process wakes up regularly, walks over "
+					 "all tasks assigned to it, and schedules and executes these "
+					 "tasks. Then, the task tracker sleeps until a new task is "
+					 "assigned or a running task completes, or for at most a "
+					 "time period before walking over these tasks again. This "
+					 "configuration value determines the length of that "
+					 "sleeping period."),
+		&TaskTrackerDelay,
+		200, 1, 100000,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.defer_job_directory_removal",
+		gettext_noop("Leaves the removal of job directories to the task tracker."),
+		gettext_noop("Repartition jobs can write many thousands of files, and "
+					 "removing them when the job completes delays the completion "
+					 "of the query. When enabled, job directories are moved out "
+					 "of the job cache instead, and the task tracker removes "
+					 "their files in the background."),
+		&DeferJobDirectoryRemoval,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.job_directory_removal_rate",
+		gettext_noop("Sets the maximum number of files per second that the task "
+					 "tracker removes from deferred job directories."),
+		gettext_noop("Limits the disk activity of removing the files of completed "
+					 "jobs in the background. 0 removes files without a limit."),
+		&JobDirectoryRemovalRate,
+		10000, 0, INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_assign_task_batch_size",
+		gettext_noop("Sets the maximum number of tasks to assign per round."),
+		gettext_noop("The master node synchronously assigns tasks to workers in "
+					 "batches. Bigger batches allow for faster task assignment, "
+					 "but it may take longer for all workers to get tasks "
+					 "if the number of workers is large. This configuration "
+					 "value controls the maximum batch size."),
+		&MaxAssignTaskBatchSize,
+		64, 1, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
 		"citus.max_tracked_tasks_per_node",
 		gettext_noop("Sets the maximum number of tracked tasks per node."),
 		gettext_noop("The task tracker processes keeps all assigned tasks in "
@@ -640,6 +1630,22 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_active_backends_per_node",
+		gettext_noop("Sets the number of active backends above which the task "
+					 "tracker does not start new tasks."),
+		gettext_noop("The task tracker starts tasks as long as fewer than "
+					 "citus.max_running_tasks_per_node of them run. When this "
+					 "value is set, the task tracker also holds back new tasks "
+					 "while this many backends on the node are running queries, "
+					 "including the backends that run the tracker's own tasks. "
+					 "A value of 0 disables this check."),
+		&MaxActiveBackendsPerNode,
+		0, 0, INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.partition_buffer_size",
 		gettext_noop("Sets the buffer size to use for partition operations."),
@@ -667,6 +1673,21 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.join_order_search_limit",
+		gettext_noop("Sets the table count up to which all join orders are searched."),
+		gettext_noop("For joins between at most this many distributed tables, "
+					 "the planner compares all join orders by the amount of data "
+					 "they are estimated to transfer across the network, using "
+					 "the shard lengths as table sizes. Larger joins only use "
+					 "the rule-based join order. The search takes factorial "
+					 "time in the table count. 0 disables the search."),
+		&JoinOrderSearchLimit,
+		0, 0, 10,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.limit_clause_row_fetch_count",
 		gettext_noop("Number of rows to fetch per task for limit clause optimization."),
@@ -709,6 +1730,108 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_one_phase_commit",
+		gettext_noop("Commits transactions that only involve a single worker "
+					 "connection without two-phase commit."),
+		gettext_noop("Two-phase commit PREPAREs the transactions on all workers "
+					 "and records them on the coordinator before committing them. "
+					 "When the coordinated transaction consists of a single "
+					 "remote transaction and did not write anything on the "
+					 "coordinator, a plain COMMIT is just as safe and saves two "
+					 "round trips and a write on the coordinator."),
+		&EnableOnePhaseCommit,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.defer_commit_prepared",
+		gettext_noop("Leaves committing prepared transactions on the workers to "
+					 "the maintenance daemon."),
+		gettext_noop("Once a two-phase commit is recorded on the coordinator and "
+					 "the local transaction committed, the outcome is decided and "
+					 "COMMIT can return without waiting for COMMIT PREPARED on "
+					 "all workers. The maintenance daemon is woken up to commit "
+					 "the prepared transactions right after. Until then, they "
+					 "keep holding their locks on the workers and their changes "
+					 "are not yet visible there."),
+		&DeferCommitPrepared,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.reference_table_batch_size",
+		gettext_noop("Sets the maximum number of concurrent reference table "
+					 "modifications that are replicated together."),
+		gettext_noop("UPDATE, DELETE and upsert commands on a reference table "
+					 "wait for each other, and each of them is replicated to "
+					 "all nodes using 2PC. When set to more than 1, such "
+					 "commands that form a transaction by themselves hand "
+					 "their command to the session that currently modifies "
+					 "the table, which runs up to this many commands and "
+					 "commits them in a single round. 0 disables batching."),
+		&ReferenceTableBatchSize,
+		0, 0, 1000,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.lazy_savepoint_propagation",
+		gettext_noop("Sends savepoints only to connections that are used within "
+					 "them."),
+		gettext_noop("By default, SAVEPOINT, RELEASE SAVEPOINT and ROLLBACK TO "
+					 "SAVEPOINT are sent to all connections in the coordinated "
+					 "transaction. When enabled, a connection only gets the "
+					 "savepoints it lacks when it is next used, and connections "
+					 "that were not used within a savepoint are left alone "
+					 "when it is released or rolled back."),
+		&LazySavepointPropagation,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.skip_remote_begin_for_selects",
+		gettext_noop("Runs router SELECTs in transaction blocks on connections "
+					 "that are not part of the transaction without BEGIN."),
+		gettext_noop("Workers run remote transactions at READ COMMITTED, so a "
+					 "single SELECT sees the same data inside and outside of a "
+					 "transaction block. When enabled, router SELECTs that go "
+					 "over a connection that is not yet part of the coordinated "
+					 "transaction skip BEGIN, and the connection later needs no "
+					 "COMMIT or PREPARE TRANSACTION. Locks on the shards are then "
+					 "released right after the SELECT. Queries that lock rows, "
+					 "read intermediate results or call volatile functions, and "
+					 "queries in serializable transactions, always start a "
+					 "transaction block."),
+		&SkipRemoteBeginForSelects,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.transaction_number_batch_size",
+		gettext_noop("Sets the number of distributed transaction numbers a backend "
+					 "reserves at once."),
+		gettext_noop("Every coordinated transaction gets a number from a counter "
+					 "that is shared by all backends. On coordinators that start "
+					 "many transactions concurrently, reserving a batch of "
+					 "numbers per backend avoids contention on that counter. "
+					 "Transaction numbers are then no longer assigned in the "
+					 "order in which transactions start."),
+		&TransactionNumberBatchSize,
+		1, 1, 1000000,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomEnumVariable(
 		"citus.task_assignment_policy",
 		gettext_noop("Sets the policy to use when assigning tasks to worker nodes."),
@@ -717,8 +1840,11 @@ RegisterCitusConfigVariables(void)
 					 "use when making these assignments. The greedy policy aims to "
 					 "evenly distribute tasks across worker nodes, first-replica just "
 					 "assigns tasks in the order shard placements were created, "
-					 "and the round-robin policy assigns tasks to worker nodes in "
-					 "a round-robin fashion."),
+					 "the round-robin policy assigns tasks to worker nodes in "
+					 "a round-robin fashion, and the work-stealing policy lets "
+					 "the real-time executor start each task on the replica "
+					 "whose worker is expected to finish it first, based on "
+					 "the latencies observed during the query."),
 		&TaskAssignmentPolicy,
 		TASK_ASSIGNMENT_GREEDY,
 		task_assignment_policy_options,
@@ -726,6 +1852,64 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomStringVariable(
+		"citus.local_node_rack",
+		gettext_noop("Sets the network location of this node for reading placements."),
+		gettext_noop("Reads prefer shard placements on worker nodes whose noderack "
+					 "in pg_dist_node matches the network location of the node that "
+					 "runs the query, such as its availability zone. If not set, "
+					 "the location of this node in pg_dist_node is used, if any."),
+		&LocalNodeRack,
+		"",
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.combine_tasks_per_worker",
+		gettext_noop("Combines the tasks of a multi-shard query that run on the same "
+					 "worker into a single query."),
+		gettext_noop("When enabled, the planner combines the tasks of multi-shard "
+					 "SELECT queries whose shards have placements on the same "
+					 "worker nodes into a single UNION ALL query, such that each "
+					 "worker receives one query and needs one connection instead "
+					 "of one for each shard."),
+		&CombineTasksPerWorker,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.combine_aggregates_per_worker",
+		gettext_noop("Merges the partial aggregates of combined tasks on the workers."),
+		gettext_noop("When citus.combine_tasks_per_worker combines the tasks of an "
+					 "aggregate query, the worker groups the results of its shards "
+					 "and combines their partial aggregates, such that it returns "
+					 "one row per group instead of one per group and shard. This "
+					 "only applies when all partial aggregates can be combined."),
+		&CombineAggregatesPerWorker,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_parallel_workers_per_node",
+		gettext_noop("Sets the number of parallel workers the tasks of a query may "
+					 "use on each worker node."),
+		gettext_noop("When a query has few tasks on a node and the shards they read "
+					 "are large, the planner suggests PostgreSQL parallel workers for "
+					 "them, which the executors set as max_parallel_workers_per_gather "
+					 "on the workers. The tasks on a node share this number of "
+					 "parallel workers. Shard sizes are taken from the shard lengths "
+					 "in the metadata. Set to 0 to keep the workers' settings."),
+		&MaxParallelWorkersPerNode,
+		8, 0, 1024,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomEnumVariable(
 		"citus.replication_model",
 		gettext_noop("Sets the replication model to be used for distributed tables."),
@@ -749,7 +1933,9 @@ RegisterCitusConfigVariables(void)
 					 "involve aggregations and/or co-located joins on multiple shards. "
 					 "The task-tracker executor is optimal for long-running, complex "
 					 "queries that touch thousands of shards and/or that involve table "
-					 "repartitioning."),
+					 "repartitioning. The adaptive executor runs multi-shard queries "
+					 "over a small pool of connections per worker, which grows when "
+					 "tasks are waiting for a connection."),
 		&TaskExecutorType,
 		MULTI_EXECUTOR_REAL_TIME,
 		task_executor_type_options,
@@ -757,6 +1943,129 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_adaptive_executor_pool_size",
+		gettext_noop("Sets the maximum number of connections per worker node used by "
+					 "the adaptive executor to execute a distributed query."),
+		NULL,
+		&MaxAdaptiveExecutorPoolSize,
+		16, 1, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_prepared_statements_per_connection",
+		gettext_noop("Sets the maximum number of statements prepared on each "
+					 "connection to a worker node."),
+		gettext_noop("When set, router queries are prepared on the worker node the "
+					 "first time they are sent over a connection, and later "
+					 "executions of the same shard query only bind parameters, "
+					 "such that the worker does not parse and plan them again. "
+					 "Queries beyond the limit are sent as is. When 0, queries "
+					 "are never prepared."),
+		&MaxPreparedStatementsPerConnection,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_ddl_pool_size",
+		gettext_noop("Sets the maximum number of connections per worker node used "
+					 "to propagate DDL commands to shards."),
+		gettext_noop("When set, DDL commands outside of transaction blocks, "
+					 "including CREATE INDEX CONCURRENTLY, run over a pool of up "
+					 "to this many connections per worker node, such that each "
+					 "worker builds that many indexes at a time. When 0, DDL "
+					 "commands use a connection per shard placement, and "
+					 "CREATE INDEX CONCURRENTLY runs on one shard at a time."),
+		&MaxDDLPoolSize,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.parallel_foreign_key_validation",
+		gettext_noop("Validates foreign keys that are added to distributed tables "
+					 "in a separate step."),
+		gettext_noop("When enabled, ALTER TABLE .. ADD CONSTRAINT .. FOREIGN KEY "
+					 "outside of a transaction block first adds the constraint "
+					 "as NOT VALID to all shards and then validates it on the "
+					 "shards in parallel, using citus.max_ddl_pool_size "
+					 "connections per worker node, or one if it is 0. The "
+					 "validation only takes locks that allow concurrent reads "
+					 "and writes, but the shards are not changed atomically, "
+					 "so a failed command may leave the constraint behind on "
+					 "some of the shards."),
+		&ParallelForeignKeyValidation,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_vacuum_pool_size",
+		gettext_noop("Sets the maximum number of connections per worker node used "
+					 "to propagate VACUUM and ANALYZE commands to shards."),
+		gettext_noop("When set, VACUUM and ANALYZE commands outside of transaction "
+					 "blocks run over a pool of up to this many connections per "
+					 "worker node, such that each worker processes that many "
+					 "shards at a time. When 0, the commands use a connection "
+					 "per shard placement."),
+		&MaxVacuumPoolSize,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.vacuum_cost_delay",
+		gettext_noop("Sets vacuum_cost_delay on the worker nodes for propagated "
+					 "VACUUM and ANALYZE commands."),
+		gettext_noop("Throttles the I/O of VACUUM and ANALYZE commands on the "
+					 "shards when they run over the pools configured by "
+					 "citus.max_vacuum_pool_size. When -1, the default of the "
+					 "worker nodes is used."),
+		&VacuumCostDelay,
+		-1, -1, 100,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.update_shard_statistics_on_analyze",
+		gettext_noop("Records the sizes and column statistics of the shards "
+					 "after propagating ANALYZE commands."),
+		gettext_noop("When enabled, a distributed ANALYZE or VACUUM ANALYZE "
+					 "command queries the sizes of all shards of the table in "
+					 "parallel afterwards and stores them as the length of the "
+					 "shard placements, which the planner uses to estimate "
+					 "the sizes of distributed tables. It also merges the "
+					 "column statistics of the shards into the coordinator's "
+					 "catalog."),
+		&UpdateShardStatisticsOnAnalyze,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.executor_slow_start_interval",
+		gettext_noop("Time to wait before the adaptive executor opens additional "
+					 "connections to a worker node."),
+		gettext_noop("When tasks are waiting for a connection for longer than this "
+					 "interval, the adaptive executor doubles the number of "
+					 "connections to the worker node. Setting this to 0 opens as "
+					 "many connections as there are tasks, up to "
+					 "citus.max_adaptive_executor_pool_size."),
+		&ExecutorSlowStartInterval,
+		10, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.enable_repartition_joins",
 		gettext_noop("Allows Citus to use task-tracker executor when necessary."),
@@ -767,6 +2076,248 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_executor_selection",
+		gettext_noop("Allows Citus to pick the executor that suits a query best."),
+		gettext_noop("When enabled and citus.task_executor_type is set to "
+					 "real-time, queries that need more connections or file "
+					 "descriptors than the real-time executor can use, and "
+					 "queries that require repartitioning, are run by the "
+					 "task-tracker executor instead."),
+		&EnableExecutorSelection,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_repartitioned_group_by",
+		gettext_noop("Finishes grouping on the workers by repartitioning "
+					 "partial aggregates on a group by column."),
+		gettext_noop("By default, when a query groups by columns other than "
+					 "the distribution column, the workers return partial "
+					 "aggregates for every group of every shard, and the "
+					 "coordinator combines all of them. When enabled, the "
+					 "task-tracker executor instead hash repartitions the "
+					 "partial aggregates on the first group by column, so that "
+					 "merge tasks on the workers compute the final groups and "
+					 "only those reach the coordinator."),
+		&EnableRepartitionedGroupBy,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_repartition_push",
+		gettext_noop("Streams map task output directly to the merge task nodes."),
+		gettext_noop("By default, map tasks of repartition joins write their "
+					 "partitions to local files, and each merge task node then "
+					 "fetches its partitions in separate tasks. When enabled, "
+					 "map tasks instead stream each partition over COPY to the "
+					 "node that runs the merge task consuming it. Merge tasks "
+					 "cannot fail over to another node in this mode."),
+		&EnableRepartitionPush,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.repartition_bloom_filter_size",
+		gettext_noop("Sets the size of the bloom filters used to prune rows in "
+					 "dual partition joins."),
+		gettext_noop("When set above 0, map tasks of the first side of a dual "
+					 "partition join build a bloom filter of this size on their "
+					 "join keys. Map tasks of the second side wait for these "
+					 "filters, and drop rows whose join keys are not in any of "
+					 "them before repartitioning. A value of 0 disables the "
+					 "filters."),
+		&RepartitionBloomFilterSize,
+		0, 0, 256 * 1024,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomRealVariable(
+		"citus.speculative_map_task_factor",
+		gettext_noop("Sets how much slower than the median a map task may be "
+					 "before it is also started on another node."),
+		gettext_noop("When set above 0, the task tracker executor starts a "
+					 "copy of each map task that runs longer than this multiple "
+					 "of the median execution time of the completed map tasks "
+					 "on another node that has a replica of its shard, and uses "
+					 "the output of whichever copy completes first. Speculation "
+					 "starts once half of the map tasks completed, and is not "
+					 "used when citus.enable_repartition_push is on."),
+		&SpeculativeMapTaskFactor,
+		0.0, 0.0, 1000.0,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_locality_aware_merge",
+		gettext_noop("Runs merge tasks on the node with most of their input."),
+		gettext_noop("By default, merge tasks of repartition joins are assigned "
+					 "to nodes in a round-robin fashion, and fetch each "
+					 "partition from the node of the map task that wrote it. "
+					 "When enabled, the task tracker executor waits for the map "
+					 "tasks to complete, learns the sizes of their partition "
+					 "files, and runs each merge task on the node that holds "
+					 "the largest share of its input. Partitions on that node "
+					 "are then linked instead of fetched."),
+		&EnableLocalityAwareMerge,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_repartition_cache",
+		gettext_noop("Reuses the partition files of map tasks on unmodified shards."),
+		gettext_noop("When enabled, the task tracker executor asks workers to "
+					 "keep the partition files of map tasks that read shards, "
+					 "and to reuse them when the same map task runs again and "
+					 "the shards were not modified through this coordinator in "
+					 "the meantime. The cache is not used when "
+					 "citus.enable_repartition_push or "
+					 "citus.repartition_bloom_filter_size is set."),
+		&EnableRepartitionCache,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_repartition_cache_entries",
+		gettext_noop("Sets the number of map task outputs a worker keeps for reuse."),
+		gettext_noop("Workers evict the least recently used outputs beyond this "
+					 "number from the cache that citus.enable_repartition_cache "
+					 "uses. A value of 0 disables caching on the worker."),
+		&MaxRepartitionCacheEntries,
+		64, 0, INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomRealVariable(
+		"citus.repartition_join_sample_percent",
+		gettext_noop("Sets the percentage of rows to sample when planning range "
+					 "repartition joins."),
+		gettext_noop("Range repartition joins create one merge task per shard of "
+					 "the table that is not repartitioned. When set above 0, the "
+					 "planner samples this percentage of rows from a few shards "
+					 "of the repartitioned table, and splits the merge tasks of "
+					 "shards that receive many rows into several tasks."),
+		&RepartitionJoinSamplePercent,
+		0.0, 0.0, 100.0,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.repartition_target_merge_task_size",
+		gettext_noop("Sets the amount of input data per merge task of hash "
+					 "repartition jobs."),
+		gettext_noop("By default, hash repartition jobs create a number of "
+					 "partitions that depends on the number of worker nodes and "
+					 "citus.max_running_tasks_per_node. When set above 0, the "
+					 "planner instead estimates the size of the repartitioned "
+					 "tables from their shard lengths, and creates one partition "
+					 "for each this much input. Tables whose shard lengths are "
+					 "not known keep the default."),
+		&RepartitionTargetMergeTaskSize,
+		0, 0, MAX_KILOBYTES,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.broadcast_join_threshold",
+		gettext_noop("Sets the maximum size of a distributed table that is broadcast "
+					 "to all nodes in a join."),
+		gettext_noop("When a query joins two distributed tables on columns other "
+					 "than their distribution columns, and the smaller table is "
+					 "below this size, Citus broadcasts the smaller table as an "
+					 "intermediate result instead of repartitioning. Table sizes "
+					 "are taken from shard statistics, which can be updated "
+					 "using master_update_shard_statistics(). A value of 0 "
+					 "disables broadcasting."),
+		&BroadcastJoinThreshold,
+		0, 0, MAX_KILOBYTES,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.semi_join_reduction_threshold",
+		gettext_noop("Sets the maximum size of a distributed table whose join keys "
+					 "are used to reduce the other table in a join."),
+		gettext_noop("When a query joins two distributed tables on columns other "
+					 "than their distribution columns, and neither of them is "
+					 "broadcast, Citus can collect the distinct join keys of the "
+					 "smaller table, as long as it is below this size, and "
+					 "only pull the rows of the larger table that join with "
+					 "those keys into an intermediate result. A value of 0 "
+					 "disables the semi-join reduction."),
+		&SemiJoinReductionThreshold,
+		0, 0, MAX_KILOBYTES,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_subplan_filter_pushdown",
+		gettext_noop("Pushes filters of the outer query into subqueries and CTEs "
+					 "that are planned as subplans."),
+		gettext_noop("By default, subqueries and CTEs that cannot be pushed down "
+					 "are executed as they are and their results are written to "
+					 "intermediate results, even if the outer query only needs "
+					 "some of their rows. When enabled, filters in the WHERE "
+					 "clause that only reference such a subquery, or a CTE that "
+					 "is referenced once, are also applied within the subquery "
+					 "to reduce the size of the intermediate results."),
+		&EnableSubPlanFilterPushdown,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_local_table_joins",
+		gettext_noop("Allows SELECT queries to join local tables on the "
+					 "coordinator with distributed tables."),
+		gettext_noop("When enabled, local tables that appear in a distributed "
+					 "SELECT query are read on the coordinator, after applying "
+					 "the filters on them and keeping only the columns the "
+					 "query needs, and their rows are broadcast to the workers "
+					 "as intermediate results. When disabled, such queries "
+					 "error out."),
+		&EnableLocalTableJoins,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_cte_inlining",
+		gettext_noop("Inlines CTEs that are referenced once into distributed "
+					 "queries."),
+		gettext_noop("By default, each CTE in a distributed query is planned and "
+					 "executed separately, and its results are written to an "
+					 "intermediate result. When enabled, CTEs that are referenced "
+					 "once and do not have side effects are replaced by "
+					 "subqueries, such that the query can be planned as a whole, "
+					 "for instance as a router query or as a pushed down "
+					 "subquery. A subquery that cannot be pushed down is still "
+					 "planned separately."),
+		&EnableCTEInlining,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomEnumVariable(
 		"citus.shard_placement_policy",
 		gettext_noop("Sets the policy to use when choosing nodes for shard placement."),
@@ -793,6 +2344,33 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_secondary_replication_lag",
+		gettext_noop("Sets the maximum replay lag of secondary nodes that reads "
+					 "go to."),
+		gettext_noop("When reading from secondary nodes, secondaries whose "
+					 "replay lag exceeds this value are avoided, and reads go "
+					 "to the primary of the group if all of its secondaries lag "
+					 "behind. Use 0 to disable the check."),
+		&MaxSecondaryReplicationLag,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.secondary_lag_check_interval",
+		gettext_noop("Sets how often the replay lag of secondary nodes is "
+					 "measured."),
+		gettext_noop("Each backend measures the lag of a secondary node at most "
+					 "once per interval, and only when "
+					 "citus.max_secondary_replication_lag is set."),
+		&SecondaryLagCheckInterval,
+		1000, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
 	DefineCustomEnumVariable(
 		"citus.multi_task_query_log_level",
 		gettext_noop("Sets the level of multi task query execution log messages"),
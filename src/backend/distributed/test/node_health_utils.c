@@ -0,0 +1,41 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_health_utils.c
+ *
+ * This file contains functions to inspect the connection failures that are
+ * tracked for skipping unreachable worker nodes.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "distributed/metadata_cache.h"
+#include "distributed/node_health.h"
+#include "utils/builtins.h"
+
+
+PG_FUNCTION_INFO_V1(node_connection_failure_count);
+
+
+/*
+ * node_connection_failure_count returns the number of failed connection
+ * attempts to the given node since the last successful one.
+ */
+Datum
+node_connection_failure_count(PG_FUNCTION_ARGS)
+{
+	text *nodeNameText = PG_GETARG_TEXT_P(0);
+	int32 nodePort = PG_GETARG_INT32(1);
+	char *nodeName = text_to_cstring(nodeNameText);
+	int failureCount = 0;
+
+	CheckCitusVersion(ERROR);
+
+	failureCount = NodeConnectionFailureCount(nodeName, nodePort);
+
+	PG_RETURN_INT32(failureCount);
+}
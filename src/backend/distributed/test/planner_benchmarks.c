@@ -0,0 +1,471 @@
+/*-------------------------------------------------------------------------
+ *
+ * test/src/planner_benchmarks.c
+ *
+ * This file contains functions that repeatedly run hot paths of the
+ * distributed planner and return the average time per call in nanoseconds,
+ * such that planner performance work can be validated without a full
+ * cluster or client-side overhead.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "c.h"
+#include "fmgr.h"
+
+#include "access/stratnum.h"
+#include "catalog/pg_type.h"
+#include "distributed/citus_nodes.h"
+#include "distributed/deparse_shard_query.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/pg_dist_shard.h"
+#include "distributed/shard_pruning.h"
+#include "distributed/shardinterval_utils.h"
+#include "nodes/nodes.h"
+#include "nodes/pg_list.h"
+#include "nodes/plannodes.h"
+#include "nodes/primnodes.h"
+#include "optimizer/clauses.h"
+#include "optimizer/planner.h"
+#include "portability/instr_time.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+
+/* local function forward declarations */
+static void CheckIterationCount(int iterationCount);
+static DistTableCacheEntry * SyntheticHashCacheEntry(int shardCount, bool uniform);
+static Query * ParseSingleQuery(char *queryString);
+static DistributedPlan * TopLevelDistributedPlan(PlannedStmt *plannedStatement);
+static double NanosecondsPerIteration(instr_time startTime, int iterationCount);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(benchmark_find_shard_interval);
+PG_FUNCTION_INFO_V1(benchmark_prune_shards);
+PG_FUNCTION_INFO_V1(benchmark_rebuild_query_strings);
+PG_FUNCTION_INFO_V1(benchmark_distributed_planning);
+PG_FUNCTION_INFO_V1(benchmark_metadata_cache_build);
+
+
+/*
+ * benchmark_find_shard_interval finds the shard of a different integer value
+ * in each iteration, using synthetic metadata of a hash distributed table with
+ * the given number of shards. When uniform is false, the shards are searched
+ * using binary search, as for tables with non-uniform hash ranges.
+ */
+Datum
+benchmark_find_shard_interval(PG_FUNCTION_ARGS)
+{
+	int shardCount = PG_GETARG_INT32(0);
+	int iterationCount = PG_GETARG_INT32(1);
+	bool uniform = PG_GETARG_BOOL(2);
+	DistTableCacheEntry *cacheEntry = NULL;
+	volatile uint64 shardIdSum = 0;
+	instr_time startTime;
+	int iteration = 0;
+
+	CheckIterationCount(iterationCount);
+
+	if (shardCount <= 0)
+	{
+		ereport(ERROR, (errmsg("shard count must be positive")));
+	}
+
+	cacheEntry = SyntheticHashCacheEntry(shardCount, uniform);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iteration = 0; iteration < iterationCount; iteration++)
+	{
+		ShardInterval *shardInterval = FindShardInterval(Int32GetDatum(iteration),
+														 cacheEntry);
+
+		shardIdSum += shardInterval->shardId;
+	}
+
+	PG_RETURN_FLOAT8(NanosecondsPerIteration(startTime, iterationCount));
+}
+
+
+/*
+ * benchmark_prune_shards prunes the shards of the given distributed table
+ * using an equality filter on the partition column, or without filters if
+ * the value is NULL. The value is given as text and converted to the type
+ * of the partition column once, before the iterations.
+ */
+Datum
+benchmark_prune_shards(PG_FUNCTION_ARGS)
+{
+	Oid distributedTableId = InvalidOid;
+	int iterationCount = 0;
+	List *whereClauseList = NIL;
+	Index tableId = 1;
+	MemoryContext benchmarkContext = NULL;
+	MemoryContext oldContext = NULL;
+	instr_time startTime;
+	int iteration = 0;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errmsg("table and number of iterations cannot be NULL")));
+	}
+
+	distributedTableId = PG_GETARG_OID(0);
+	iterationCount = PG_GETARG_INT32(2);
+
+	CheckIterationCount(iterationCount);
+
+	if (!PG_ARGISNULL(1))
+	{
+		char *valueString = text_to_cstring(PG_GETARG_TEXT_P(1));
+		Var *partitionColumn = PartitionColumn(distributedTableId, tableId);
+		OpExpr *equalityExpr = MakeOpExpression(partitionColumn, BTEqualStrategyNumber);
+		Const *rightConst = (Const *) get_rightop((Expr *) equalityExpr);
+		Oid typeInputFunctionId = InvalidOid;
+		Oid typeIOParam = InvalidOid;
+
+		getTypeInputInfo(partitionColumn->vartype, &typeInputFunctionId, &typeIOParam);
+
+		rightConst->constvalue = OidInputFunctionCall(typeInputFunctionId, valueString,
+													  typeIOParam,
+													  partitionColumn->vartypmod);
+		rightConst->constisnull = false;
+
+		whereClauseList = list_make1(equalityExpr);
+	}
+
+	/* make sure the metadata cache entry is built before we start measuring */
+	DistributedTableCacheEntry(distributedTableId);
+
+	benchmarkContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "Benchmark Context",
+											 ALLOCSET_DEFAULT_SIZES);
+	oldContext = MemoryContextSwitchTo(benchmarkContext);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iteration = 0; iteration < iterationCount; iteration++)
+	{
+		PruneShards(distributedTableId, tableId, whereClauseList);
+
+		MemoryContextReset(benchmarkContext);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(benchmarkContext);
+
+	PG_RETURN_FLOAT8(NanosecondsPerIteration(startTime, iterationCount));
+}
+
+
+/*
+ * benchmark_rebuild_query_strings plans the given INSERT, UPDATE or DELETE
+ * query once, and then rebuilds the query strings of all of its tasks in each
+ * iteration, as the executor does for modifications.
+ */
+Datum
+benchmark_rebuild_query_strings(PG_FUNCTION_ARGS)
+{
+	char *queryString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	int iterationCount = PG_GETARG_INT32(1);
+	Query *query = NULL;
+	PlannedStmt *plannedStatement = NULL;
+	DistributedPlan *distributedPlan = NULL;
+	Job *workerJob = NULL;
+	char **taskQueryStrings = NULL;
+	ListCell *taskCell = NULL;
+	int taskIndex = 0;
+	MemoryContext benchmarkContext = NULL;
+	MemoryContext oldContext = NULL;
+	instr_time startTime;
+	int iteration = 0;
+
+	CheckIterationCount(iterationCount);
+
+	query = ParseSingleQuery(queryString);
+	if (!IsModifyCommand(query))
+	{
+		ereport(ERROR, (errmsg("query must be an INSERT, UPDATE or DELETE")));
+	}
+
+	plannedStatement = pg_plan_query(query, 0, NULL);
+	distributedPlan = TopLevelDistributedPlan(plannedStatement);
+	workerJob = distributedPlan->workerJob;
+
+	if (workerJob == NULL || workerJob->taskList == NIL)
+	{
+		ereport(ERROR, (errmsg("query does not have any tasks")));
+	}
+
+	/* remember the query strings to restore them after each iteration */
+	taskQueryStrings = palloc0(list_length(workerJob->taskList) * sizeof(char *));
+	foreach(taskCell, workerJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		taskQueryStrings[taskIndex++] = task->queryString;
+	}
+
+	benchmarkContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "Benchmark Context",
+											 ALLOCSET_DEFAULT_SIZES);
+	oldContext = MemoryContextSwitchTo(benchmarkContext);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iteration = 0; iteration < iterationCount; iteration++)
+	{
+		RebuildQueryStrings(workerJob->jobQuery, workerJob->taskList);
+
+		/* the rebuilt query strings live in the benchmark context */
+		MemoryContextReset(benchmarkContext);
+
+		taskIndex = 0;
+		foreach(taskCell, workerJob->taskList)
+		{
+			Task *task = (Task *) lfirst(taskCell);
+
+			task->queryString = taskQueryStrings[taskIndex++];
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(benchmarkContext);
+
+	PG_RETURN_FLOAT8(NanosecondsPerIteration(startTime, iterationCount));
+}
+
+
+/*
+ * benchmark_distributed_planning plans a copy of the given query in each
+ * iteration. Planning goes through distributed_planner, and hence includes
+ * standard planning of the query as well as CreateDistributedPlan.
+ */
+Datum
+benchmark_distributed_planning(PG_FUNCTION_ARGS)
+{
+	char *queryString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	int iterationCount = PG_GETARG_INT32(1);
+	Query *query = NULL;
+	MemoryContext benchmarkContext = NULL;
+	MemoryContext oldContext = NULL;
+	instr_time startTime;
+	int iteration = 0;
+
+	CheckIterationCount(iterationCount);
+
+	query = ParseSingleQuery(queryString);
+	if (!NeedsDistributedPlanning(query))
+	{
+		ereport(ERROR, (errmsg("query does not reference a distributed table")));
+	}
+
+	benchmarkContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "Benchmark Context",
+											 ALLOCSET_DEFAULT_SIZES);
+	oldContext = MemoryContextSwitchTo(benchmarkContext);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iteration = 0; iteration < iterationCount; iteration++)
+	{
+		/* planning scribbles on the query, so plan a copy */
+		Query *queryCopy = copyObject(query);
+
+		planner(queryCopy, 0, NULL);
+
+		MemoryContextReset(benchmarkContext);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(benchmarkContext);
+
+	PG_RETURN_FLOAT8(NanosecondsPerIteration(startTime, iterationCount));
+}
+
+
+/*
+ * benchmark_metadata_cache_build flushes the metadata cache and builds the
+ * cache entry of the given distributed table again in each iteration, which
+ * includes reading its shards and placements from the catalog.
+ */
+Datum
+benchmark_metadata_cache_build(PG_FUNCTION_ARGS)
+{
+	Oid distributedTableId = PG_GETARG_OID(0);
+	int iterationCount = PG_GETARG_INT32(1);
+	instr_time startTime;
+	int iteration = 0;
+
+	CheckIterationCount(iterationCount);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iteration = 0; iteration < iterationCount; iteration++)
+	{
+		FlushDistTableCache();
+		DistributedTableCacheEntry(distributedTableId);
+	}
+
+	PG_RETURN_FLOAT8(NanosecondsPerIteration(startTime, iterationCount));
+}
+
+
+/*
+ * CheckIterationCount errors out if the given number of iterations is not
+ * positive.
+ */
+static void
+CheckIterationCount(int iterationCount)
+{
+	if (iterationCount <= 0)
+	{
+		ereport(ERROR, (errmsg("number of iterations must be positive")));
+	}
+}
+
+
+/*
+ * SyntheticHashCacheEntry returns a metadata cache entry of an int4 hash
+ * distributed table that does not exist, with the given number of shards
+ * covering equally sized hash ranges.
+ */
+static DistTableCacheEntry *
+SyntheticHashCacheEntry(int shardCount, bool uniform)
+{
+	DistTableCacheEntry *cacheEntry = palloc0(sizeof(DistTableCacheEntry));
+	uint64 hashTokenIncrement = HASH_TOKEN_COUNT / shardCount;
+	int shardIndex = 0;
+
+	cacheEntry->isDistributedTable = true;
+	cacheEntry->isValid = true;
+	cacheEntry->partitionMethod = DISTRIBUTE_BY_HASH;
+	cacheEntry->hasUniformHashDistribution = uniform;
+	cacheEntry->shardIntervalArrayLength = shardCount;
+	cacheEntry->sortedShardIntervalArray = palloc0(shardCount * sizeof(ShardInterval *));
+	cacheEntry->shardMinHashArray = palloc0(shardCount * sizeof(int32));
+	cacheEntry->shardMaxHashArray = palloc0(shardCount * sizeof(int32));
+
+	cacheEntry->hashFunction = palloc0(sizeof(FmgrInfo));
+	fmgr_info(F_HASHINT4, cacheEntry->hashFunction);
+
+	cacheEntry->shardIntervalCompareFunction = palloc0(sizeof(FmgrInfo));
+	fmgr_info(F_BTINT4CMP, cacheEntry->shardIntervalCompareFunction);
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = CitusMakeNode(ShardInterval);
+		int32 shardMinHashToken = INT32_MIN + (shardIndex * hashTokenIncrement);
+		int32 shardMaxHashToken = shardMinHashToken + (hashTokenIncrement - 1);
+
+		/* the last shard covers the remainder of the hash range */
+		if (shardIndex == (shardCount - 1))
+		{
+			shardMaxHashToken = INT32_MAX;
+		}
+
+		shardInterval->relationId = InvalidOid;
+		shardInterval->storageType = SHARD_STORAGE_TABLE;
+		shardInterval->valueTypeId = INT4OID;
+		shardInterval->valueTypeLen = sizeof(int32);
+		shardInterval->valueByVal = true;
+		shardInterval->minValueExists = true;
+		shardInterval->maxValueExists = true;
+		shardInterval->minValue = Int32GetDatum(shardMinHashToken);
+		shardInterval->maxValue = Int32GetDatum(shardMaxHashToken);
+		shardInterval->shardId = shardIndex + 1;
+		shardInterval->shardIndex = shardIndex;
+
+		cacheEntry->sortedShardIntervalArray[shardIndex] = shardInterval;
+		cacheEntry->shardMinHashArray[shardIndex] = shardMinHashToken;
+		cacheEntry->shardMaxHashArray[shardIndex] = shardMaxHashToken;
+	}
+
+	return cacheEntry;
+}
+
+
+/*
+ * ParseSingleQuery parses, analyzes and rewrites the given query string, which
+ * must contain a single query.
+ */
+static Query *
+ParseSingleQuery(char *queryString)
+{
+	List *parseTreeList = pg_parse_query(queryString);
+	Node *parseTree = NULL;
+	List *queryTreeList = NIL;
+
+	if (list_length(parseTreeList) != 1)
+	{
+		ereport(ERROR, (errmsg("can only benchmark a single query")));
+	}
+
+	parseTree = (Node *) linitial(parseTreeList);
+
+#if (PG_VERSION_NUM >= 100000)
+	queryTreeList = pg_analyze_and_rewrite((RawStmt *) parseTree, queryString,
+										   NULL, 0, NULL);
+#else
+	queryTreeList = pg_analyze_and_rewrite(parseTree, queryString, NULL, 0);
+#endif
+
+	if (list_length(queryTreeList) != 1)
+	{
+		ereport(ERROR, (errmsg("can only benchmark a single query")));
+	}
+
+	return (Query *) linitial(queryTreeList);
+}
+
+
+/*
+ * TopLevelDistributedPlan returns the distributed plan of the given planned
+ * statement, which may be below the nodes that merge the results of a
+ * multi-shard query on the coordinator.
+ */
+static DistributedPlan *
+TopLevelDistributedPlan(PlannedStmt *plannedStatement)
+{
+	Plan *plan = plannedStatement->planTree;
+
+	while (plan != NULL && !IsA(plan, CustomScan))
+	{
+		plan = plan->lefttree;
+	}
+
+	if (plan == NULL)
+	{
+		ereport(ERROR, (errmsg("query does not have a distributed plan")));
+	}
+
+	return GetDistributedPlan((CustomScan *) plan);
+}
+
+
+/*
+ * NanosecondsPerIteration returns the average time in nanoseconds that the
+ * given number of iterations took since the given start time.
+ */
+static double
+NanosecondsPerIteration(instr_time startTime, int iterationCount)
+{
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	return INSTR_TIME_GET_DOUBLE(duration) * 1000000000.0 / iterationCount;
+}
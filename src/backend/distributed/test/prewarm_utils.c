@@ -0,0 +1,40 @@
+/*-------------------------------------------------------------------------
+ *
+ * prewarm_utils.c
+ *
+ * This file contains functions to exercise recording the recently used
+ * distributed tables for prewarming the shared metadata cache, which the
+ * maintenance daemon otherwise only does once a minute.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "distributed/metadata_cache.h"
+#include "distributed/metadata_prewarm.h"
+#include "utils/timestamp.h"
+
+
+PG_FUNCTION_INFO_V1(record_recently_used_tables);
+
+
+/*
+ * record_recently_used_tables records the tables that backends used after
+ * the given time in pg_dist_metadata_prewarm, and returns their number.
+ */
+Datum
+record_recently_used_tables(PG_FUNCTION_ARGS)
+{
+	TimestampTz usedAfter = PG_GETARG_TIMESTAMPTZ(0);
+	int usedTableCount = 0;
+
+	CheckCitusVersion(ERROR);
+
+	usedTableCount = RecordRecentlyUsedTables(usedAfter);
+
+	PG_RETURN_INT32(usedTableCount);
+}
@@ -0,0 +1,87 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_invalidation_utils.c
+ *
+ * This file contains functions to exercise the log of metadata changes that
+ * lets backends reload the placements of only the changed shards.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "catalog/pg_type.h"
+#include "distributed/listutils.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shard_invalidation_log.h"
+#include "nodes/pg_list.h"
+#include "utils/array.h"
+
+
+PG_FUNCTION_INFO_V1(shard_invalidation_log_position);
+PG_FUNCTION_INFO_V1(invalidated_shard_placements);
+
+
+/*
+ * shard_invalidation_log_position returns the position of the next record in
+ * the log of metadata changes.
+ */
+Datum
+shard_invalidation_log_position(PG_FUNCTION_ARGS)
+{
+	uint64 position = 0;
+
+	CheckCitusVersion(ERROR);
+
+	position = ShardInvalidationLogPosition();
+
+	PG_RETURN_INT64((int64) position);
+}
+
+
+/*
+ * invalidated_shard_placements returns the IDs of the shards of the given
+ * table whose placements changed since the given log position, including the
+ * changes of the current transaction. It returns NULL if any other metadata
+ * of the table changed.
+ */
+Datum
+invalidated_shard_placements(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	uint64 startPosition = (uint64) PG_GETARG_INT64(1);
+	uint64 endPosition = 0;
+	List *shardIdList = NIL;
+	ListCell *shardIdCell = NULL;
+	Datum *shardIdDatumArray = NULL;
+	ArrayType *shardIdArrayType = NULL;
+	int shardIdIndex = 0;
+
+	CheckCitusVersion(ERROR);
+
+	endPosition = ShardInvalidationLogPosition();
+
+	if (!InvalidatedShardPlacementList(relationId, startPosition, endPosition,
+									   &shardIdList))
+	{
+		PG_RETURN_NULL();
+	}
+
+	shardIdDatumArray = palloc0((list_length(shardIdList) + 1) * sizeof(Datum));
+
+	foreach(shardIdCell, shardIdList)
+	{
+		uint64 shardId = *((uint64 *) lfirst(shardIdCell));
+
+		shardIdDatumArray[shardIdIndex] = Int64GetDatum(shardId);
+		shardIdIndex++;
+	}
+
+	shardIdArrayType = DatumArrayToArrayType(shardIdDatumArray, shardIdIndex,
+											 INT8OID);
+
+	PG_RETURN_ARRAYTYPE_P(shardIdArrayType);
+}
@@ -0,0 +1,38 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_metadata_cache_utils.c
+ *
+ * This file contains functions to inspect which distributed tables are in
+ * the shared metadata cache.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "distributed/metadata_cache.h"
+#include "distributed/shared_metadata_cache.h"
+
+
+PG_FUNCTION_INFO_V1(shared_shard_list_cached);
+
+
+/*
+ * shared_shard_list_cached returns whether the shards of the given table are
+ * in the shared metadata cache.
+ */
+Datum
+shared_shard_list_cached(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	bool shardListCached = false;
+
+	CheckCitusVersion(ERROR);
+
+	shardListCached = SharedShardListCached(relationId);
+
+	PG_RETURN_BOOL(shardListCached);
+}
@@ -0,0 +1,292 @@
+/*-------------------------------------------------------------------------
+ *
+ * test/src/synthetic_metadata.c
+ *
+ * This file contains functions to populate the Citus metadata with synthetic
+ * nodes, shards and placements that do not exist, such that metadata cache
+ * builds, shard pruning and planning can be exercised at a scale that would
+ * be impractical to create for real. Queries on tables with synthetic shards
+ * can only be planned, for instance using EXPLAIN with
+ * citus.explain_distributed_queries disabled.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "c.h"
+#include "fmgr.h"
+
+#include <stdint.h>
+
+#include "catalog/pg_type.h"
+#include "distributed/citus_nodes.h"
+#include "distributed/listutils.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_protocol.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/pg_dist_shard.h"
+#include "distributed/relay_utility.h"
+#include "distributed/worker_manager.h"
+#include "executor/spi.h"
+#include "nodes/pg_list.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+
+
+/*
+ * Synthetic nodes get node and group identifiers from this value onwards, so
+ * they do not advance the sequences that regular nodes take them from.
+ */
+#define SYNTHETIC_NODE_ID_BASE 100000
+
+#define CREATE_SYNTHETIC_NODES_QUERY \
+	"INSERT INTO pg_catalog.pg_dist_node (nodeid, groupid, nodename, nodeport) " \
+	"SELECT base + i, base + i, $1, i + 1 " \
+	"FROM generate_series(0, $2 - 1) i, " \
+	"(SELECT greatest(max(nodeid), max(groupid), %d - 1) + 1 AS base " \
+	"FROM pg_catalog.pg_dist_node) node_ids"
+
+#define REMOVE_SYNTHETIC_SHARDS_QUERY \
+	"DELETE FROM pg_catalog.pg_dist_shard WHERE shardid IN (" \
+	"SELECT shardid FROM pg_catalog.pg_dist_placement WHERE groupid IN (" \
+	"SELECT groupid FROM pg_catalog.pg_dist_node WHERE nodename = $1))"
+
+#define REMOVE_SYNTHETIC_PLACEMENTS_QUERY \
+	"DELETE FROM pg_catalog.pg_dist_placement WHERE groupid IN (" \
+	"SELECT groupid FROM pg_catalog.pg_dist_node WHERE nodename = $1)"
+
+#define REMOVE_SYNTHETIC_NODES_QUERY \
+	"DELETE FROM pg_catalog.pg_dist_node WHERE nodename = $1"
+
+
+/* local function forward declarations */
+static List * SyntheticNodeList(char *nodeName);
+static uint64 ExecuteSyntheticMetadataQuery(char *query, int argumentCount,
+											Oid *argumentTypes, Datum *arguments,
+											int expectedResult);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(create_synthetic_nodes);
+PG_FUNCTION_INFO_V1(create_synthetic_shards);
+PG_FUNCTION_INFO_V1(remove_synthetic_metadata);
+
+
+/*
+ * create_synthetic_nodes adds the given number of primary nodes with the given
+ * name to pg_dist_node, using port numbers starting from 1. Each node is in a
+ * group of its own. The function does not connect to the nodes, and should be
+ * called only once for a given node name. It returns the number of added nodes.
+ */
+Datum
+create_synthetic_nodes(PG_FUNCTION_ARGS)
+{
+	text *nodeName = PG_GETARG_TEXT_P(0);
+	int32 nodeCount = PG_GETARG_INT32(1);
+	StringInfo query = makeStringInfo();
+	Oid argumentTypes[2] = { TEXTOID, INT4OID };
+	Datum arguments[2];
+	uint64 addedNodeCount = 0;
+
+	if (nodeCount <= 0)
+	{
+		ereport(ERROR, (errmsg("node count must be positive")));
+	}
+
+	arguments[0] = PointerGetDatum(nodeName);
+	arguments[1] = Int32GetDatum(nodeCount);
+
+	appendStringInfo(query, CREATE_SYNTHETIC_NODES_QUERY, SYNTHETIC_NODE_ID_BASE);
+
+	addedNodeCount = ExecuteSyntheticMetadataQuery(query->data, 2, argumentTypes,
+												   arguments, SPI_OK_INSERT);
+
+	PG_RETURN_INT32((int32) addedNodeCount);
+}
+
+
+/*
+ * create_synthetic_shards creates the given number of shards for a hash
+ * distributed table that does not have any shards yet, dividing the hash
+ * space equally as master_create_worker_shards does. The placements of the
+ * shards are distributed round-robin over the synthetic nodes with the given
+ * name. Only metadata is written; the shards are not created on any node.
+ */
+Datum
+create_synthetic_shards(PG_FUNCTION_ARGS)
+{
+	Oid distributedTableId = PG_GETARG_OID(0);
+	char *nodeName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	int32 shardCount = PG_GETARG_INT32(2);
+	int32 replicationFactor = PG_GETARG_INT32(3);
+	List *nodeList = NIL;
+	int nodeCount = 0;
+	List *shardIntervalList = NIL;
+	List *placementList = NIL;
+	uint64 hashTokenIncrement = 0;
+	int shardIndex = 0;
+
+	if (shardCount <= 0)
+	{
+		ereport(ERROR, (errmsg("shard count must be positive")));
+	}
+
+	if (PartitionMethod(distributedTableId) != DISTRIBUTE_BY_HASH)
+	{
+		ereport(ERROR, (errmsg("table \"%s\" is not distributed by hash",
+							   get_rel_name(distributedTableId))));
+	}
+
+	if (LoadShardIntervalList(distributedTableId) != NIL)
+	{
+		ereport(ERROR, (errmsg("table \"%s\" already has shards",
+							   get_rel_name(distributedTableId))));
+	}
+
+	nodeList = SyntheticNodeList(nodeName);
+	nodeCount = list_length(nodeList);
+
+	if (replicationFactor <= 0 || replicationFactor > nodeCount)
+	{
+		ereport(ERROR, (errmsg("replication factor must be between 1 and the number "
+							   "of synthetic nodes named \"%s\" (%d)", nodeName,
+							   nodeCount)));
+	}
+
+	hashTokenIncrement = HASH_TOKEN_COUNT / shardCount;
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = CitusMakeNode(ShardInterval);
+		int32 shardMinHashToken = INT32_MIN + (shardIndex * hashTokenIncrement);
+		int32 shardMaxHashToken = shardMinHashToken + (hashTokenIncrement - 1);
+		int placementIndex = 0;
+
+		/* if we are at the last shard, make sure the max token value is INT_MAX */
+		if (shardIndex == (shardCount - 1))
+		{
+			shardMaxHashToken = INT32_MAX;
+		}
+
+		shardInterval->relationId = distributedTableId;
+		shardInterval->storageType = SHARD_STORAGE_TABLE;
+		shardInterval->valueTypeId = INT4OID;
+		shardInterval->valueTypeLen = sizeof(int32);
+		shardInterval->valueByVal = true;
+		shardInterval->minValueExists = true;
+		shardInterval->maxValueExists = true;
+		shardInterval->minValue = Int32GetDatum(shardMinHashToken);
+		shardInterval->maxValue = Int32GetDatum(shardMaxHashToken);
+		shardInterval->shardId = GetNextShardId();
+
+		shardIntervalList = lappend(shardIntervalList, shardInterval);
+
+		for (placementIndex = 0; placementIndex < replicationFactor; placementIndex++)
+		{
+			int nodeIndex = (shardIndex + placementIndex) % nodeCount;
+			WorkerNode *workerNode = (WorkerNode *) list_nth(nodeList, nodeIndex);
+			GroupShardPlacement *placement = CitusMakeNode(GroupShardPlacement);
+
+			placement->placementId = INVALID_PLACEMENT_ID;
+			placement->shardId = shardInterval->shardId;
+			placement->shardLength = 0;
+			placement->shardState = FILE_FINALIZED;
+			placement->groupId = workerNode->groupId;
+
+			placementList = lappend(placementList, placement);
+		}
+	}
+
+	InsertShardRowList(shardIntervalList);
+	InsertShardPlacementRowList(distributedTableId, placementList);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * remove_synthetic_metadata removes the synthetic nodes with the given name,
+ * the placements on them and the shards that have such placements, such that
+ * the tables of the shards can be dropped without connecting to the nodes.
+ */
+Datum
+remove_synthetic_metadata(PG_FUNCTION_ARGS)
+{
+	text *nodeName = PG_GETARG_TEXT_P(0);
+	Oid argumentTypes[1] = { TEXTOID };
+	Datum arguments[1];
+
+	arguments[0] = PointerGetDatum(nodeName);
+
+	ExecuteSyntheticMetadataQuery(REMOVE_SYNTHETIC_SHARDS_QUERY, 1, argumentTypes,
+								  arguments, SPI_OK_DELETE);
+	ExecuteSyntheticMetadataQuery(REMOVE_SYNTHETIC_PLACEMENTS_QUERY, 1, argumentTypes,
+								  arguments, SPI_OK_DELETE);
+	ExecuteSyntheticMetadataQuery(REMOVE_SYNTHETIC_NODES_QUERY, 1, argumentTypes,
+								  arguments, SPI_OK_DELETE);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * SyntheticNodeList returns the primary nodes with the given name, sorted by
+ * their port numbers, which is the order in which they were created.
+ */
+static List *
+SyntheticNodeList(char *nodeName)
+{
+	List *nodeList = NIL;
+	List *workerNodeList = SortList(ActivePrimaryNodeList(), CompareWorkerNodes);
+	ListCell *workerNodeCell = NULL;
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+
+		if (strncmp(workerNode->workerName, nodeName, WORKER_LENGTH) == 0)
+		{
+			nodeList = lappend(nodeList, workerNode);
+		}
+	}
+
+	return nodeList;
+}
+
+
+/*
+ * ExecuteSyntheticMetadataQuery executes the given query with the given
+ * arguments through SPI, errors out if the result is not as expected, and
+ * returns the number of processed rows.
+ */
+static uint64
+ExecuteSyntheticMetadataQuery(char *query, int argumentCount, Oid *argumentTypes,
+							  Datum *arguments, int expectedResult)
+{
+	int spiConnectionResult = 0;
+	int spiQueryResult = 0;
+	bool readOnly = false;
+	uint64 processedRowCount = 0;
+
+	spiConnectionResult = SPI_connect();
+	if (spiConnectionResult != SPI_OK_CONNECT)
+	{
+		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+	}
+
+	spiQueryResult = SPI_execute_with_args(query, argumentCount, argumentTypes,
+										   arguments, NULL, readOnly, 0);
+	if (spiQueryResult != expectedResult)
+	{
+		ereport(ERROR, (errmsg("execution was not successful \"%s\"", query)));
+	}
+
+	processedRowCount = SPI_processed;
+
+	SPI_finish();
+
+	return processedRowCount;
+}
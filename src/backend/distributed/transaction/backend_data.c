@@ -23,6 +23,7 @@
 #include "distributed/metadata_cache.h"
 #include "distributed/transaction_identifier.h"
 #include "nodes/execnodes.h"
+#include "port/atomics.h"
 #include "storage/ipc.h"
 #include "storage/lwlock.h"
 #include "storage/proc.h"
@@ -56,18 +57,31 @@ typedef struct BackendManagementShmemData
 } BackendManagementShmemData;
 
 
+/* GUC, number of distributed transaction numbers a backend reserves at once */
+int TransactionNumberBatchSize = 1;
+
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 static BackendManagementShmemData *backendManagementShmemData = NULL;
 static BackendData *MyBackendData = NULL;
 
+/* range of reserved transaction numbers this backend did not yet use */
+static uint64 NextReservedTransactionNumber = 0;
+static uint64 EndReservedTransactionNumber = 0;
+
 
 static void BackendManagementShmemInit(void);
 static size_t BackendManagementShmemSize(void);
+static inline void BeginBackendDataChange(BackendData *backendData);
+static inline void EndBackendDataChange(BackendData *backendData);
+static void ReadBackendData(BackendData *backendData, BackendData *result);
+static uint64 NextDistributedTransactionNumber(void);
+static void ReturnActiveTransactions(FunctionCallInfo fcinfo, bool includeOriginator);
 
 
 PG_FUNCTION_INFO_V1(assign_distributed_transaction_id);
 PG_FUNCTION_INFO_V1(get_current_transaction_id);
 PG_FUNCTION_INFO_V1(get_all_active_transactions);
+PG_FUNCTION_INFO_V1(citus_backend_transactions);
 
 
 /*
@@ -107,6 +121,8 @@ assign_distributed_transaction_id(PG_FUNCTION_ARGS)
 							   "transaction id")));
 	}
 
+	BeginBackendDataChange(MyBackendData);
+
 	MyBackendData->databaseId = MyDatabaseId;
 
 	MyBackendData->transactionId.initiatorNodeIdentifier = PG_GETARG_INT32(0);
@@ -114,6 +130,8 @@ assign_distributed_transaction_id(PG_FUNCTION_ARGS)
 	MyBackendData->transactionId.timestamp = PG_GETARG_TIMESTAMPTZ(2);
 	MyBackendData->transactionId.transactionOriginator = false;
 
+	EndBackendDataChange(MyBackendData);
+
 	SpinLockRelease(&MyBackendData->mutex);
 
 	PG_RETURN_VOID();
@@ -186,6 +204,39 @@ get_current_transaction_id(PG_FUNCTION_ARGS)
  */
 Datum
 get_all_active_transactions(PG_FUNCTION_ARGS)
+{
+	bool includeOriginator = false;
+
+	ReturnActiveTransactions(fcinfo, includeOriginator);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * citus_backend_transactions returns the same information as
+ * get_all_active_transactions, and additionally whether the backend started
+ * the distributed transaction. This allows telling apart the sessions of
+ * clients from the backends that run parts of their transactions.
+ */
+Datum
+citus_backend_transactions(PG_FUNCTION_ARGS)
+{
+	bool includeOriginator = true;
+
+	ReturnActiveTransactions(fcinfo, includeOriginator);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * ReturnActiveTransactions fills the result set of the given function call
+ * with the distributed transactions of all active backends, optionally
+ * including whether the backend is the originator of the transaction.
+ */
+static void
+ReturnActiveTransactions(FunctionCallInfo fcinfo, bool includeOriginator)
 {
 	ReturnSetInfo *returnSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
 	TupleDesc tupleDescriptor = NULL;
@@ -195,8 +246,8 @@ get_all_active_transactions(PG_FUNCTION_ARGS)
 
 	int backendIndex = 0;
 
-	Datum values[5];
-	bool isNulls[5];
+	Datum values[6];
+	bool isNulls[6];
 
 	CheckCitusVersion(ERROR);
 
@@ -234,56 +285,43 @@ get_all_active_transactions(PG_FUNCTION_ARGS)
 
 	MemoryContextSwitchTo(oldContext);
 
-	/*
-	 * We don't want to initialize memory while spinlock is held so we
-	 * prefer to do it here. This initialization is done only for the first
-	 * row.
-	 */
-	memset(values, 0, sizeof(values));
-	memset(isNulls, false, sizeof(isNulls));
-
 	/* we're reading all distributed transactions, prevent new backends */
 	LockBackendSharedMemory(LW_SHARED);
 
 	for (backendIndex = 0; backendIndex < MaxBackends; ++backendIndex)
 	{
-		BackendData *currentBackend =
-			&backendManagementShmemData->backends[backendIndex];
+		BackendData currentBackend;
 
-		SpinLockAcquire(&currentBackend->mutex);
+		ReadBackendData(&backendManagementShmemData->backends[backendIndex],
+						&currentBackend);
 
 		/* we're only interested in active backends */
-		if (currentBackend->transactionId.transactionNumber == 0)
+		if (currentBackend.transactionId.transactionNumber == 0)
 		{
-			SpinLockRelease(&currentBackend->mutex);
 			continue;
 		}
 
-		values[0] = ObjectIdGetDatum(currentBackend->databaseId);
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = ObjectIdGetDatum(currentBackend.databaseId);
 		values[1] = Int32GetDatum(ProcGlobal->allProcs[backendIndex].pid);
-		values[2] = Int32GetDatum(currentBackend->transactionId.initiatorNodeIdentifier);
-		values[3] = UInt64GetDatum(currentBackend->transactionId.transactionNumber);
-		values[4] = TimestampTzGetDatum(currentBackend->transactionId.timestamp);
+		values[2] = Int32GetDatum(currentBackend.transactionId.initiatorNodeIdentifier);
+		values[3] = UInt64GetDatum(currentBackend.transactionId.transactionNumber);
+		values[4] = TimestampTzGetDatum(currentBackend.transactionId.timestamp);
 
-		SpinLockRelease(&currentBackend->mutex);
+		if (includeOriginator)
+		{
+			values[5] = BoolGetDatum(currentBackend.transactionId.transactionOriginator);
+		}
 
 		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
-
-		/*
-		 * We don't want to initialize memory while spinlock is held so we
-		 * prefer to do it here. This initialization is done for the rows
-		 * starting from the second one.
-		 */
-		memset(values, 0, sizeof(values));
-		memset(isNulls, false, sizeof(isNulls));
 	}
 
 	UnlockBackendSharedMemory();
 
 	/* clean up and return the tuplestore */
 	tuplestore_donestoring(tupleStore);
-
-	PG_RETURN_VOID();
 }
 
 
@@ -448,6 +486,7 @@ UnSetDistributedTransactionId(void)
 	if (MyBackendData)
 	{
 		SpinLockAcquire(&MyBackendData->mutex);
+		BeginBackendDataChange(MyBackendData);
 
 		MyBackendData->databaseId = 0;
 		MyBackendData->transactionId.initiatorNodeIdentifier = 0;
@@ -455,6 +494,7 @@ UnSetDistributedTransactionId(void)
 		MyBackendData->transactionId.transactionNumber = 0;
 		MyBackendData->transactionId.timestamp = 0;
 
+		EndBackendDataChange(MyBackendData);
 		SpinLockRelease(&MyBackendData->mutex);
 	}
 }
@@ -529,14 +569,12 @@ GetCurrentDistributedTransactionId(void)
 void
 AssignDistributedTransactionId(void)
 {
-	pg_atomic_uint64 *transactionNumberSequence =
-		&backendManagementShmemData->nextTransactionNumber;
-
-	uint64 nextTransactionNumber = pg_atomic_fetch_add_u64(transactionNumberSequence, 1);
+	uint64 nextTransactionNumber = NextDistributedTransactionNumber();
 	int localGroupId = GetLocalGroupId();
 	TimestampTz currentTimestamp = GetCurrentTimestamp();
 
 	SpinLockAcquire(&MyBackendData->mutex);
+	BeginBackendDataChange(MyBackendData);
 
 	MyBackendData->databaseId = MyDatabaseId;
 
@@ -546,10 +584,36 @@ AssignDistributedTransactionId(void)
 		nextTransactionNumber;
 	MyBackendData->transactionId.timestamp = currentTimestamp;
 
+	EndBackendDataChange(MyBackendData);
 	SpinLockRelease(&MyBackendData->mutex);
 }
 
 
+/*
+ * NextDistributedTransactionNumber returns a new distributed transaction
+ * number. Backends reserve citus.transaction_number_batch_size numbers from
+ * the shared counter at a time, such that busy coordinators do not all
+ * increment the same counter for every transaction. Numbers are unique, but
+ * not necessarily increasing across backends.
+ */
+static uint64
+NextDistributedTransactionNumber(void)
+{
+	if (NextReservedTransactionNumber == EndReservedTransactionNumber)
+	{
+		pg_atomic_uint64 *transactionNumberSequence =
+			&backendManagementShmemData->nextTransactionNumber;
+		uint64 batchSize = (uint64) TransactionNumberBatchSize;
+
+		NextReservedTransactionNumber =
+			pg_atomic_fetch_add_u64(transactionNumberSequence, batchSize);
+		EndReservedTransactionNumber = NextReservedTransactionNumber + batchSize;
+	}
+
+	return NextReservedTransactionNumber++;
+}
+
+
 /*
  * CurrentDistributedTransactionNumber returns the transaction number of the
  * current distributed transaction. The caller must make sure a distributed
@@ -567,7 +631,8 @@ CurrentDistributedTransactionNumber(void)
 /*
  * GetBackendDataForProc writes the backend data for the given process to
  * result. If the process is part of a lock group (parallel query) it
- * returns the leader data instead.
+ * returns the leader data instead. It never blocks the process from
+ * changing its backend data.
  */
 void
 GetBackendDataForProc(PGPROC *proc, BackendData *result)
@@ -582,11 +647,63 @@ GetBackendDataForProc(PGPROC *proc, BackendData *result)
 
 	backendData = &backendManagementShmemData->backends[pgprocno];
 
-	SpinLockAcquire(&backendData->mutex);
+	ReadBackendData(backendData, result);
+}
+
+
+/*
+ * BeginBackendDataChange marks the start of a change to the given backend
+ * data, which readers detect by the odd change count. The caller must hold
+ * the backend data's mutex.
+ */
+static inline void
+BeginBackendDataChange(BackendData *backendData)
+{
+	backendData->changeCount++;
+	pg_write_barrier();
+}
+
+
+/*
+ * EndBackendDataChange marks the end of a change started by
+ * BeginBackendDataChange.
+ */
+static inline void
+EndBackendDataChange(BackendData *backendData)
+{
+	pg_write_barrier();
+	backendData->changeCount++;
+}
 
-	memcpy(result, backendData, sizeof(BackendData));
 
-	SpinLockRelease(&backendData->mutex);
+/*
+ * ReadBackendData copies the given backend data into result without taking its
+ * mutex. If a change is in progress or happens while copying, which the change
+ * count tells us, the copy is retried.
+ */
+static void
+ReadBackendData(BackendData *backendData, BackendData *result)
+{
+	for (;;)
+	{
+		uint32 changeCountBefore = backendData->changeCount;
+		uint32 changeCountAfter = 0;
+
+		pg_read_barrier();
+
+		memcpy(result, (const void *) backendData, sizeof(BackendData));
+
+		pg_read_barrier();
+
+		changeCountAfter = backendData->changeCount;
+		if (changeCountBefore == changeCountAfter && (changeCountBefore & 1) == 0)
+		{
+			break;
+		}
+
+		/* changes only take a few instructions, so spin rather than sleep */
+		SPIN_DELAY();
+	}
 }
 
 
@@ -610,7 +727,9 @@ CancelTransactionDueToDeadlock(PGPROC *proc)
 	/* send a SIGINT only if the process is still in a distributed transaction */
 	if (backendData->transactionId.transactionNumber != 0)
 	{
+		BeginBackendDataChange(backendData);
 		backendData->cancelledDueToDeadlock = true;
+		EndBackendDataChange(backendData);
 		SpinLockRelease(&backendData->mutex);
 
 		if (kill(proc->pid, SIGINT) != 0)
@@ -704,3 +823,37 @@ ActiveDistributedTransactionNumbers(void)
 
 	return activeTransactionNumberList;
 }
+
+
+/*
+ * DatabaseHasDistributedTransactions returns whether a backend connected to
+ * the given database is in a distributed transaction that it started itself.
+ */
+bool
+DatabaseHasDistributedTransactions(Oid databaseId)
+{
+	int curBackend = 0;
+
+	for (curBackend = 0; curBackend < MaxBackends; curBackend++)
+	{
+		PGPROC *currentProc = &ProcGlobal->allProcs[curBackend];
+		BackendData currentBackendData;
+
+		if (currentProc->pid == 0)
+		{
+			/* unused PGPROC slot */
+			continue;
+		}
+
+		GetBackendDataForProc(currentProc, &currentBackendData);
+
+		if (currentBackendData.databaseId == databaseId &&
+			IsInDistributedTransaction(&currentBackendData) &&
+			currentBackendData.transactionId.transactionOriginator)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
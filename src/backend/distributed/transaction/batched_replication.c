@@ -0,0 +1,751 @@
+/*-------------------------------------------------------------------------
+ *
+ * batched_replication.c
+ *   Replication of concurrent reference table modifications in batches.
+ *
+ *   UPDATE, DELETE and upsert commands on a reference table take an
+ *   exclusive lock on its shard, which they hold while the command runs on
+ *   all nodes and while the transaction is committed on all nodes using
+ *   2PC. Concurrent modifications therefore wait for each other, and every
+ *   one of them pays for a full replication round.
+ *
+ *   When citus.reference_table_batch_size is set, single-statement
+ *   modifications that find the shard lock taken put their command into a
+ *   slot in shared memory before waiting for the lock. The backend that
+ *   holds the lock runs the commands it finds in the slots for the same
+ *   shard after its own command, each within a savepoint such that an error
+ *   only affects the command that caused it, and commits them along with
+ *   its own transaction. Once that transaction committed, the waiting
+ *   backends obtain the lock, find their command done and return its
+ *   result. If the transaction aborts, the commands are left in their slots
+ *   and the next holder of the lock runs them.
+ *
+ *   The modifications of a batch are applied in the same order on all
+ *   nodes and are committed atomically, so reference tables stay
+ *   consistent. Since a batched command commits along with another
+ *   transaction, only commands that form a transaction by themselves are
+ *   batched.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "libpq-fe.h"
+
+#include "access/xact.h"
+#include "distributed/batched_replication.h"
+#include "distributed/connection_management.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/multi_router_executor.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/query_stats.h"
+#include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
+#include "distributed/resource_lock.h"
+#include "distributed/transaction_management.h"
+#include "nodes/plannodes.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/portal.h"
+
+
+/* savepoint within which the leader runs each batched modification */
+#define BATCHED_MODIFICATION_SAVEPOINT "citus_batched_modification"
+
+
+/* state of the batched modification slot of a backend */
+typedef enum BatchedModificationState
+{
+	/* the slot is not in use */
+	BATCHED_MODIFICATION_FREE = 0,
+
+	/* the modification waits for the holder of the shard lock to run it */
+	BATCHED_MODIFICATION_PENDING,
+
+	/* the holder of the shard lock runs the modification */
+	BATCHED_MODIFICATION_CLAIMED,
+
+	/* the backend gave up waiting after the modification was claimed */
+	BATCHED_MODIFICATION_CANCELLED,
+
+	/* the modification was committed, or failed with the stored error */
+	BATCHED_MODIFICATION_DONE
+} BatchedModificationState;
+
+
+/*
+ * BatchedModification is the slot through which a backend hands its
+ * modification to the holder of the shard lock.
+ */
+typedef struct BatchedModification
+{
+	BatchedModificationState state;
+
+	/* only backends of the same user and database run each others commands */
+	Oid databaseId;
+	Oid userId;
+	uint64 shardId;
+
+	/* outcome of the modification, errorCode is 0 if it succeeded */
+	int64 affectedTupleCount;
+	int errorCode;
+	char errorMessage[BATCHED_MODIFICATION_ERROR_LENGTH];
+
+	char queryString[BATCHED_MODIFICATION_QUERY_LENGTH];
+} BatchedModification;
+
+
+/*
+ * BatchedReplicationControlData is the shared memory segment holding the
+ * batched modification slots of all backends, indexed by pgprocno.
+ */
+typedef struct BatchedReplicationControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+
+	BatchedModification modifications[FLEXIBLE_ARRAY_MEMBER];
+} BatchedReplicationControlData;
+
+
+/* config variable managed via guc.c, 0 disables batching */
+int ReferenceTableBatchSize = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static BatchedReplicationControlData *BatchedReplicationControl = NULL;
+
+/* indexes of the slots whose modifications this backend ran as leader */
+static List *ClaimedModificationList = NIL;
+
+/* whether this backend put its own modification into its slot */
+static bool ModificationRegistered = false;
+
+
+static size_t BatchedReplicationShmemSize(void);
+static void BatchedReplicationShmemInit(void);
+#if (PG_VERSION_NUM >= 100000)
+static bool IsSingleStatementTransaction(CmdType operation);
+#endif
+static List * ClaimPendingModifications(uint64 shardId, int maxModifications);
+static void ExecuteBatchedModification(BatchedModification *modification,
+									   List *connectionList, bool releaseSavepoint);
+static void RollbackBatchedModification(List *connectionList);
+
+
+/*
+ * CanBatchModifyTask returns whether the given modification task may be
+ * handed to the backend that holds the lock on its shard. These are UPDATE,
+ * DELETE and upsert commands on reference tables without parameters and
+ * without RETURNING that form a transaction by themselves. INSERTs do not
+ * wait for each other and are therefore not batched.
+ */
+bool
+CanBatchModifyTask(Task *task, CmdType operation, ParamListInfo paramListInfo,
+				   bool expectResults)
+{
+#if (PG_VERSION_NUM >= 100000)
+	ShardInterval *shardInterval = NULL;
+
+	if (ReferenceTableBatchSize <= 1 || BatchedReplicationControl == NULL)
+	{
+		return false;
+	}
+
+	if (task->replicationModel != REPLICATION_MODEL_2PC ||
+		task->taskType != MODIFY_TASK || task->insertSelectQuery ||
+		list_length(task->relationShardList) > 1)
+	{
+		return false;
+	}
+
+	if (AllModificationsCommutative ||
+		!(task->upsertQuery || operation == CMD_UPDATE || operation == CMD_DELETE))
+	{
+		/* these commands do not take an exclusive lock on the shard */
+		return false;
+	}
+
+	if (expectResults || (paramListInfo != NULL && paramListInfo->numParams > 0))
+	{
+		return false;
+	}
+
+	if (strlen(task->queryString) >= BATCHED_MODIFICATION_QUERY_LENGTH)
+	{
+		return false;
+	}
+
+	shardInterval = LoadShardInterval(task->anchorShardId);
+	if (PartitionMethod(shardInterval->relationId) != DISTRIBUTE_BY_NONE)
+	{
+		return false;
+	}
+
+	return IsSingleStatementTransaction(operation);
+#else
+
+	/* multi-statement query strings only form a transaction block as of 10 */
+	return false;
+#endif
+}
+
+
+#if (PG_VERSION_NUM >= 100000)
+
+/*
+ * IsSingleStatementTransaction returns whether the current statement is the
+ * only statement of its transaction, such that committing it along with the
+ * transaction of another backend does not break atomicity. Statements of
+ * transaction blocks, functions, DO blocks and multi-statement query strings
+ * are not.
+ */
+static bool
+IsSingleStatementTransaction(CmdType operation)
+{
+	PlannedStmt *plannedStatement = NULL;
+
+	if (IsTransactionBlock() || IsSubTransaction() || InCoordinatedTransaction() ||
+		XactModificationLevel != XACT_MODIFICATION_NONE || ExecutorNestingLevel > 1)
+	{
+		return false;
+	}
+
+	/* statements in DO blocks run within the portal of the DO command */
+	if (ActivePortal == NULL || list_length(ActivePortal->stmts) != 1)
+	{
+		return false;
+	}
+
+	plannedStatement = (PlannedStmt *) linitial(ActivePortal->stmts);
+	if (!IsA(plannedStatement, PlannedStmt) ||
+		plannedStatement->commandType != operation)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+#endif
+
+
+/*
+ * WaitForBatchedModification takes the exclusive lock on the shard of the
+ * given task. If the lock is taken by another backend, the modification is
+ * put into the slot of this backend before waiting, such that the holder
+ * of the lock can run it. The function returns true if the modification was
+ * committed by another backend, and errors out if it failed. It returns
+ * false if the caller should run the modification itself, and then holds
+ * the shard lock.
+ */
+bool
+WaitForBatchedModification(Task *task, int64 *affectedTupleCount)
+{
+	BatchedModification *modification = NULL;
+	uint64 shardId = task->anchorShardId;
+	int errorCode = 0;
+	char errorMessage[BATCHED_MODIFICATION_ERROR_LENGTH];
+
+	if (TryLockShardResource(shardId, ExclusiveLock))
+	{
+		return false;
+	}
+
+	modification = &BatchedReplicationControl->modifications[MyProc->pgprocno];
+
+	LWLockAcquire(&BatchedReplicationControl->lock, LW_EXCLUSIVE);
+
+	if (modification->state != BATCHED_MODIFICATION_FREE)
+	{
+		/* a leader still runs a modification we gave up on */
+		LWLockRelease(&BatchedReplicationControl->lock);
+
+		LockShardResource(shardId, ExclusiveLock);
+		return false;
+	}
+
+	modification->databaseId = MyDatabaseId;
+	modification->userId = GetUserId();
+	modification->shardId = shardId;
+	modification->affectedTupleCount = 0;
+	modification->errorCode = 0;
+	modification->errorMessage[0] = '\0';
+	strlcpy(modification->queryString, task->queryString,
+			BATCHED_MODIFICATION_QUERY_LENGTH);
+	modification->state = BATCHED_MODIFICATION_PENDING;
+
+	LWLockRelease(&BatchedReplicationControl->lock);
+
+	ModificationRegistered = true;
+
+	/* the holder of the lock runs pending modifications before it commits */
+	LockShardResource(shardId, ExclusiveLock);
+
+	LWLockAcquire(&BatchedReplicationControl->lock, LW_EXCLUSIVE);
+
+	if (modification->state == BATCHED_MODIFICATION_PENDING)
+	{
+		/* nobody ran the modification, we now hold the lock and run it ourselves */
+		modification->state = BATCHED_MODIFICATION_FREE;
+		LWLockRelease(&BatchedReplicationControl->lock);
+
+		ModificationRegistered = false;
+		return false;
+	}
+
+	Assert(modification->state == BATCHED_MODIFICATION_DONE);
+
+	*affectedTupleCount = modification->affectedTupleCount;
+	errorCode = modification->errorCode;
+	strlcpy(errorMessage, modification->errorMessage,
+			BATCHED_MODIFICATION_ERROR_LENGTH);
+
+	modification->state = BATCHED_MODIFICATION_FREE;
+
+	LWLockRelease(&BatchedReplicationControl->lock);
+
+	ModificationRegistered = false;
+
+	/* let the next waiting backend find out about its modification */
+	UnlockShardResource(shardId, ExclusiveLock);
+
+	if (errorCode != 0)
+	{
+		ereport(ERROR, (errcode(errorCode), errmsg("%s", errorMessage)));
+	}
+
+	return true;
+}
+
+
+/*
+ * ExecuteBatchedModifications runs the pending modifications of other
+ * backends on the shard of the given task over the given connections, on
+ * which the task itself was run in the current transaction. Each of them
+ * runs in a savepoint, which is rolled back if the modification fails on
+ * any of the placements. The outcome is passed on to the other backends
+ * once the transaction ends, in FinishBatchedModifications.
+ */
+void
+ExecuteBatchedModifications(Task *task, List *connectionList)
+{
+	ListCell *connectionCell = NULL;
+	bool releaseSavepoint = false;
+	int batchSize = 1;
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		if (connection->remoteTransaction.transactionFailed)
+		{
+			return;
+		}
+	}
+
+	while (batchSize < ReferenceTableBatchSize)
+	{
+		List *modificationList = ClaimPendingModifications(task->anchorShardId,
+														   ReferenceTableBatchSize -
+														   batchSize);
+		ListCell *modificationCell = NULL;
+
+		if (modificationList == NIL)
+		{
+			break;
+		}
+
+		foreach(modificationCell, modificationList)
+		{
+			int modificationIndex = lfirst_int(modificationCell);
+			BatchedModification *modification =
+				&BatchedReplicationControl->modifications[modificationIndex];
+
+			ExecuteBatchedModification(modification, connectionList,
+									   releaseSavepoint);
+
+			/* a failed modification leaves the savepoint in place, too */
+			releaseSavepoint = true;
+			batchSize++;
+		}
+	}
+
+	if (batchSize > 1)
+	{
+		ereport(DEBUG1, (errmsg("replicated %d modifications of shard " UINT64_FORMAT
+								" in one batch", batchSize, task->anchorShardId)));
+	}
+}
+
+
+/*
+ * ClaimPendingModifications marks at most the given number of pending
+ * modifications of the shard as claimed by this backend and returns the
+ * indexes of their slots.
+ */
+static List *
+ClaimPendingModifications(uint64 shardId, int maxModifications)
+{
+	List *modificationList = NIL;
+	Oid userId = GetUserId();
+	int modificationIndex = 0;
+
+	LWLockAcquire(&BatchedReplicationControl->lock, LW_EXCLUSIVE);
+
+	for (modificationIndex = 0; modificationIndex < MaxBackends; modificationIndex++)
+	{
+		BatchedModification *modification =
+			&BatchedReplicationControl->modifications[modificationIndex];
+		MemoryContext oldContext = NULL;
+
+		if (list_length(modificationList) >= maxModifications)
+		{
+			break;
+		}
+
+		if (modification->state != BATCHED_MODIFICATION_PENDING ||
+			modification->shardId != shardId ||
+			modification->databaseId != MyDatabaseId ||
+			modification->userId != userId)
+		{
+			continue;
+		}
+
+		modification->state = BATCHED_MODIFICATION_CLAIMED;
+
+		oldContext = MemoryContextSwitchTo(TopTransactionContext);
+		ClaimedModificationList = lappend_int(ClaimedModificationList,
+											  modificationIndex);
+		MemoryContextSwitchTo(oldContext);
+
+		modificationList = lappend_int(modificationList, modificationIndex);
+	}
+
+	LWLockRelease(&BatchedReplicationControl->lock);
+
+	return modificationList;
+}
+
+
+/*
+ * ExecuteBatchedModification runs the given claimed modification on all
+ * connections in parallel, within a new savepoint, and stores the affected
+ * tuple count or the error in its slot. Connection failures abort the
+ * whole batch.
+ */
+static void
+ExecuteBatchedModification(BatchedModification *modification, List *connectionList,
+						   bool releaseSavepoint)
+{
+	StringInfo command = makeStringInfo();
+	ListCell *connectionCell = NULL;
+	bool raiseInterrupts = true;
+	bool modificationFailed = false;
+	int64 affectedTupleCount = -1;
+
+	if (releaseSavepoint)
+	{
+		appendStringInfoString(command,
+							   "RELEASE SAVEPOINT " BATCHED_MODIFICATION_SAVEPOINT ";");
+	}
+
+	/* only the claiming backend reads the query until the slot is done */
+	appendStringInfo(command, "SAVEPOINT " BATCHED_MODIFICATION_SAVEPOINT ";%s",
+					 modification->queryString);
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		if (SendRemoteCommand(connection, command->data) == 0)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	WaitForAllConnections(connectionList, raiseInterrupts);
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		PGresult *result = NULL;
+
+		while ((result = GetRemoteCommandResult(connection, raiseInterrupts)) != NULL)
+		{
+			if (PQresultStatus(result) == PGRES_COMMAND_OK)
+			{
+				char *tupleCountString = PQcmdTuples(result);
+
+				/* SAVEPOINT and RELEASE do not report a tuple count */
+				if (tupleCountString[0] != '\0')
+				{
+					int64 currentTupleCount = pg_strtouint64(tupleCountString,
+															 NULL, 10);
+
+					if (affectedTupleCount == -1)
+					{
+						affectedTupleCount = currentTupleCount;
+					}
+					else if (affectedTupleCount != currentTupleCount)
+					{
+						ereport(WARNING,
+								(errmsg("modified "INT64_FORMAT " tuples, but "
+										"expected to modify "INT64_FORMAT,
+										currentTupleCount, affectedTupleCount),
+								 errdetail("modified placement on %s:%d",
+										   connection->hostname, connection->port)));
+					}
+				}
+			}
+			else if (PQstatus(connection->pgConn) != CONNECTION_OK)
+			{
+				ReportResultError(connection, result, ERROR);
+			}
+			else if (!modificationFailed)
+			{
+				char *sqlStateString = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+				char *messagePrimary = PQresultErrorField(result,
+														  PG_DIAG_MESSAGE_PRIMARY);
+
+				modification->errorCode = ERRCODE_INTERNAL_ERROR;
+				if (sqlStateString != NULL && strlen(sqlStateString) == 5)
+				{
+					modification->errorCode = MAKE_SQLSTATE(sqlStateString[0],
+															sqlStateString[1],
+															sqlStateString[2],
+															sqlStateString[3],
+															sqlStateString[4]);
+				}
+
+				if (messagePrimary == NULL)
+				{
+					messagePrimary = pchomp(PQerrorMessage(connection->pgConn));
+				}
+
+				strlcpy(modification->errorMessage, messagePrimary,
+						BATCHED_MODIFICATION_ERROR_LENGTH);
+
+				modificationFailed = true;
+			}
+
+			PQclear(result);
+		}
+	}
+
+	if (modificationFailed)
+	{
+		RollbackBatchedModification(connectionList);
+		affectedTupleCount = 0;
+	}
+
+	modification->affectedTupleCount = Max(affectedTupleCount, 0);
+}
+
+
+/*
+ * RollbackBatchedModification undoes a failed batched modification on all
+ * connections, including those on which it succeeded.
+ */
+static void
+RollbackBatchedModification(List *connectionList)
+{
+	ListCell *connectionCell = NULL;
+	bool raiseInterrupts = true;
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		if (SendRemoteCommand(connection, "ROLLBACK TO SAVEPOINT "
+										  BATCHED_MODIFICATION_SAVEPOINT) == 0)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	WaitForAllConnections(connectionList, raiseInterrupts);
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		bool raiseErrors = true;
+
+		ClearResults(connection, raiseErrors);
+	}
+}
+
+
+/*
+ * FinishBatchedModifications is called at the end of every transaction. If
+ * this backend ran the modifications of other backends, they are marked as
+ * done when the transaction commits, and left for the next holder of the
+ * shard lock otherwise. If this backend put its own modification into its
+ * slot and gave up waiting, the slot is freed, unless the modification was
+ * already claimed by another backend, which might still commit it.
+ */
+void
+FinishBatchedModifications(bool commit)
+{
+	ListCell *modificationCell = NULL;
+	bool modificationCancelled = false;
+
+	if (ClaimedModificationList == NIL && !ModificationRegistered)
+	{
+		return;
+	}
+
+	LWLockAcquire(&BatchedReplicationControl->lock, LW_EXCLUSIVE);
+
+	foreach(modificationCell, ClaimedModificationList)
+	{
+		int modificationIndex = lfirst_int(modificationCell);
+		BatchedModification *modification =
+			&BatchedReplicationControl->modifications[modificationIndex];
+
+		if (modification->state == BATCHED_MODIFICATION_CANCELLED)
+		{
+			modification->state = BATCHED_MODIFICATION_FREE;
+		}
+		else if (commit)
+		{
+			modification->state = BATCHED_MODIFICATION_DONE;
+		}
+		else
+		{
+			modification->affectedTupleCount = 0;
+			modification->errorCode = 0;
+			modification->errorMessage[0] = '\0';
+			modification->state = BATCHED_MODIFICATION_PENDING;
+		}
+	}
+
+	if (ModificationRegistered)
+	{
+		BatchedModification *modification =
+			&BatchedReplicationControl->modifications[MyProc->pgprocno];
+
+		if (modification->state == BATCHED_MODIFICATION_CLAIMED)
+		{
+			modification->state = BATCHED_MODIFICATION_CANCELLED;
+			modificationCancelled = true;
+		}
+		else
+		{
+			modification->state = BATCHED_MODIFICATION_FREE;
+		}
+	}
+
+	LWLockRelease(&BatchedReplicationControl->lock);
+
+	ClaimedModificationList = NIL;
+	ModificationRegistered = false;
+
+	if (modificationCancelled)
+	{
+		ereport(WARNING, (errmsg("canceled waiting for a batched modification, but "
+								 "it may still be committed by another backend")));
+	}
+}
+
+
+/*
+ * InitializeBatchedReplication requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeBatchedReplication(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(BatchedReplicationShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = BatchedReplicationShmemInit;
+}
+
+
+/*
+ * BatchedReplicationShmemSize computes how much shared memory is required.
+ */
+static size_t
+BatchedReplicationShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, offsetof(BatchedReplicationControlData, modifications));
+	size = add_size(size, mul_size(sizeof(BatchedModification), MaxBackends));
+
+	return size;
+}
+
+
+/*
+ * BatchedReplicationShmemInit initializes the shared memory holding the
+ * batched modification slots.
+ */
+static void
+BatchedReplicationShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	BatchedReplicationControl =
+		(BatchedReplicationControlData *) ShmemInitStruct("Batched Replication Data",
+														  BatchedReplicationShmemSize(),
+														  &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out all the memory, which frees all slots */
+		memset(BatchedReplicationControl, 0, BatchedReplicationShmemSize());
+
+#if (PG_VERSION_NUM >= 100000)
+		BatchedReplicationControl->trancheId = LWLockNewTrancheId();
+		BatchedReplicationControl->lockTrancheName = "Batched Replication";
+		LWLockRegisterTranche(BatchedReplicationControl->trancheId,
+							  BatchedReplicationControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &BatchedReplicationControl->lockTranche;
+
+			BatchedReplicationControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &BatchedReplicationControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Batched Replication";
+			LWLockRegisterTranche(BatchedReplicationControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&BatchedReplicationControl->lock,
+						 BatchedReplicationControl->trancheId);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
@@ -0,0 +1,302 @@
+/*-------------------------------------------------------------------------
+ *
+ * dist_stat_activity.c
+ *
+ *   Gathers the activity of backends that take part in distributed
+ *   transactions from all nodes, such that the sessions of clients can be
+ *   matched to the worker backends that run their queries using the
+ *   distributed transaction id. The citus_dist_stat_activity view performs
+ *   that match.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "funcapi.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+
+#include "executor/spi.h"
+#include "distributed/connection_management.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/remote_commands.h"
+#include "distributed/worker_manager.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+
+
+/* number of columns of the activity query, the result adds node name and port */
+#define ACTIVITY_QUERY_COLUMNS 13
+#define CITUS_CLUSTER_ACTIVITY_COLUMNS (ACTIVITY_QUERY_COLUMNS + 2)
+
+/*
+ * Query that returns the activity of backends in distributed transactions
+ * on a single node. It is sent to all other nodes, and run locally while they
+ * are executing it.
+ */
+#define ACTIVITY_QUERY \
+	"SELECT t.initiator_node_identifier, t.transaction_number, " \
+	"t.transaction_stamp, t.transaction_originator, a.pid, a.usename, " \
+	"a.application_name, a.state, a.wait_event_type, a.wait_event, " \
+	"a.query_start, clock_timestamp() - a.query_start, a.query " \
+	"FROM citus_backend_transactions() t " \
+	"JOIN pg_stat_activity a ON (a.pid = t.process_id) " \
+	"WHERE a.datname = current_database()"
+
+
+static void ReturnLocalActivity(Tuplestorestate *tupleStore,
+								AttInMetadata *attributeInputMetadata,
+								WorkerNode *localNode);
+static void ReturnRemoteActivity(Tuplestorestate *tupleStore,
+								 AttInMetadata *attributeInputMetadata,
+								 MultiConnection *connection);
+
+
+PG_FUNCTION_INFO_V1(citus_cluster_activity);
+
+
+/*
+ * citus_cluster_activity returns the activity of backends in distributed
+ * transactions on this node and on all other nodes, together with the name
+ * and port of the node. The query is sent to the other nodes at once, and
+ * the local activity is gathered while they are executing it. The node name
+ * and port are NULL for the local node if it is not in pg_dist_node, as is
+ * usually the case for the coordinator.
+ */
+Datum
+citus_cluster_activity(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	AttInMetadata *attributeInputMetadata = NULL;
+	MemoryContext oldContext = NULL;
+	List *workerNodeList = NIL;
+	ListCell *workerNodeCell = NULL;
+	List *connectionList = NIL;
+	ListCell *connectionCell = NULL;
+	WorkerNode *localNode = NULL;
+	int localGroupId = 0;
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	if (tupleDescriptor->natts != CITUS_CLUSTER_ACTIVITY_COLUMNS)
+	{
+		elog(ERROR, "unexpected number of columns in return type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	attributeInputMetadata = TupleDescGetAttInMetadata(tupleDescriptor);
+
+	workerNodeList = ActiveReadableNodeList();
+	localGroupId = GetLocalGroupId();
+
+	/*
+	 * Open connections in parallel. We connect as the current user, such that
+	 * the query text of other users' backends is only shown if this user is
+	 * allowed to see it locally as well.
+	 */
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		MultiConnection *connection = NULL;
+		int connectionFlags = 0;
+
+		if (workerNode->groupId == localGroupId)
+		{
+			/* we read the local activity directly */
+			localNode = workerNode;
+			continue;
+		}
+
+		connection = StartNodeUserDatabaseConnection(connectionFlags,
+													 workerNode->workerName,
+													 workerNode->workerPort,
+													 NULL, NULL);
+
+		connectionList = lappend(connectionList, connection);
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+
+	/* send commands in parallel */
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		int querySent = SendRemoteCommand(connection, ACTIVITY_QUERY);
+
+		if (querySent == 0)
+		{
+			ReportConnectionError(connection, WARNING);
+		}
+	}
+
+	/* gather local activity while the other nodes gather theirs */
+	ReturnLocalActivity(tupleStore, attributeInputMetadata, localNode);
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		ReturnRemoteActivity(tupleStore, attributeInputMetadata, connection);
+	}
+
+	tuplestore_donestoring(tupleStore);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * ReturnLocalActivity runs the activity query locally and adds its rows to
+ * the tuple store.
+ */
+static void
+ReturnLocalActivity(Tuplestorestate *tupleStore, AttInMetadata *attributeInputMetadata,
+					WorkerNode *localNode)
+{
+	char *values[CITUS_CLUSTER_ACTIVITY_COLUMNS];
+	char nodePortString[12];
+	bool readOnly = true;
+	uint64 rowIndex = 0;
+	int spiConnectionResult = 0;
+	int spiQueryResult = 0;
+
+	memset(values, 0, sizeof(values));
+
+	if (localNode != NULL)
+	{
+		pg_ltoa(localNode->workerPort, nodePortString);
+
+		values[0] = localNode->workerName;
+		values[1] = nodePortString;
+	}
+
+	spiConnectionResult = SPI_connect();
+	if (spiConnectionResult != SPI_OK_CONNECT)
+	{
+		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+	}
+
+	spiQueryResult = SPI_execute(ACTIVITY_QUERY, readOnly, 0);
+	if (spiQueryResult != SPI_OK_SELECT)
+	{
+		ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+							   ACTIVITY_QUERY)));
+	}
+
+	for (rowIndex = 0; rowIndex < SPI_processed; rowIndex++)
+	{
+		HeapTuple activityTuple = SPI_tuptable->vals[rowIndex];
+		HeapTuple heapTuple = NULL;
+		int columnIndex = 0;
+
+		for (columnIndex = 0; columnIndex < ACTIVITY_QUERY_COLUMNS; columnIndex++)
+		{
+			/* SPI_getvalue returns NULL for NULL values and uses 1-based numbers */
+			values[columnIndex + 2] = SPI_getvalue(activityTuple, SPI_tuptable->tupdesc,
+												   columnIndex + 1);
+		}
+
+		heapTuple = BuildTupleFromCStrings(attributeInputMetadata, values);
+		tuplestore_puttuple(tupleStore, heapTuple);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * ReturnRemoteActivity reads the result of the activity query from the given
+ * connection and adds its rows to the tuple store. Failures are reported as
+ * warnings, such that a single unavailable node does not hide the activity
+ * on the others.
+ */
+static void
+ReturnRemoteActivity(Tuplestorestate *tupleStore, AttInMetadata *attributeInputMetadata,
+					 MultiConnection *connection)
+{
+	char *values[CITUS_CLUSTER_ACTIVITY_COLUMNS];
+	char nodePortString[12];
+	PGresult *result = NULL;
+	bool raiseInterrupts = true;
+	int rowIndex = 0;
+	int rowCount = 0;
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (!IsResponseOK(result))
+	{
+		ReportResultError(connection, result, WARNING);
+		return;
+	}
+
+	if (PQnfields(result) != ACTIVITY_QUERY_COLUMNS)
+	{
+		ereport(WARNING, (errmsg("unexpected number of columns in activity of "
+								 "node %s:%d", connection->hostname,
+								 connection->port)));
+
+		PQclear(result);
+		ForgetResults(connection);
+		return;
+	}
+
+	pg_ltoa(connection->port, nodePortString);
+
+	values[0] = connection->hostname;
+	values[1] = nodePortString;
+
+	rowCount = PQntuples(result);
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		HeapTuple heapTuple = NULL;
+		int columnIndex = 0;
+
+		for (columnIndex = 0; columnIndex < ACTIVITY_QUERY_COLUMNS; columnIndex++)
+		{
+			if (PQgetisnull(result, rowIndex, columnIndex))
+			{
+				values[columnIndex + 2] = NULL;
+			}
+			else
+			{
+				values[columnIndex + 2] = PQgetvalue(result, rowIndex, columnIndex);
+			}
+		}
+
+		heapTuple = BuildTupleFromCStrings(attributeInputMetadata, values);
+		tuplestore_puttuple(tupleStore, heapTuple);
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+}
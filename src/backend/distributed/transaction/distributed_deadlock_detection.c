@@ -24,6 +24,7 @@
 #include "distributed/transaction_identifier.h"
 #include "nodes/pg_list.h"
 #include "utils/hsearch.h"
+#include "utils/memutils.h"
 #include "utils/timestamp.h"
 
 
@@ -39,6 +40,17 @@ typedef struct QueuedTransactionNode
 /* GUC, determining whether debug messages for deadlock detection sent to LOG */
 bool LogDistributedDeadlockDetection = false;
 
+/* number of wait edges in the wait graph of the last check, for monitoring */
+int LastWaitGraphEdgeCount = 0;
+
+/*
+ * Sorted wait edges of the last check that did not find any cycle, allocated in
+ * TopMemoryContext. The maintenance daemon runs the check periodically, and as
+ * long as the wait edges do not change, there cannot be a new deadlock.
+ */
+static WaitEdge *CycleFreeWaitEdges = NULL;
+static int CycleFreeWaitEdgeCount = 0;
+
 
 static bool CheckDeadlockForTransactionNode(TransactionNode *startingTransactionNode,
 											int maxStackDepth,
@@ -60,6 +72,10 @@ static int DistributedTransactionIdCompare(const void *a, const void *b, Size ke
 static void LogCancellingBackend(TransactionNode *transactionNode);
 static void LogTransactionNode(TransactionNode *transactionNode);
 static void LogDistributedDeadlockDebugMessage(const char *errorMessage);
+static WaitEdge * SortedWaitEdges(WaitGraph *waitGraph);
+static int CompareWaitEdges(const void *leftElement, const void *rightElement);
+static bool IsCycleFreeWaitGraph(WaitEdge *sortedEdges, int edgeCount);
+static void RememberCycleFreeWaitGraph(WaitEdge *sortedEdges, int edgeCount);
 
 PG_FUNCTION_INFO_V1(check_distributed_deadlocks);
 
@@ -108,6 +124,10 @@ CheckForDistributedDeadlocks(void)
 	int edgeCount = 0;
 	int localGroupId = GetLocalGroupId();
 	List *workerNodeList = ActiveReadableNodeList();
+	WaitEdge *sortedEdges = NULL;
+	bool cycleFound = false;
+
+	LastWaitGraphEdgeCount = 0;
 
 	/*
 	 * We don't need to do any distributed deadlock checking if there
@@ -121,9 +141,22 @@ CheckForDistributedDeadlocks(void)
 	}
 
 	waitGraph = BuildGlobalWaitGraph();
-	adjacencyLists = BuildAdjacencyListsForWaitGraph(waitGraph);
-
 	edgeCount = waitGraph->edgeCount;
+	LastWaitGraphEdgeCount = edgeCount;
+
+	/*
+	 * Every new deadlock adds at least one wait edge, so if we already searched
+	 * the same edges without finding a cycle, we can skip the search.
+	 */
+	sortedEdges = SortedWaitEdges(waitGraph);
+	if (IsCycleFreeWaitGraph(sortedEdges, edgeCount))
+	{
+		LogDistributedDeadlockDebugMessage("Wait graph did not change since the "
+										   "last check, skipping");
+		return false;
+	}
+
+	adjacencyLists = BuildAdjacencyListsForWaitGraph(waitGraph);
 
 	/*
 	 * We iterate on transaction nodes and search for deadlocks where the
@@ -164,6 +197,8 @@ CheckForDistributedDeadlocks(void)
 			 */
 			Assert(list_length(deadlockPath) >= 1);
 
+			cycleFound = true;
+
 			LogDistributedDeadlockDebugMessage("Distributed deadlock found among the "
 											   "following distributed transactions:");
 
@@ -220,10 +255,118 @@ CheckForDistributedDeadlocks(void)
 		}
 	}
 
+	/*
+	 * Only remember graphs without any cycles, such that we retry deadlocks
+	 * whose participants we could not cancel.
+	 */
+	if (!cycleFound)
+	{
+		RememberCycleFreeWaitGraph(sortedEdges, edgeCount);
+	}
+
 	return false;
 }
 
 
+/*
+ * SortedWaitEdges returns a sorted copy of the edges in the given wait graph,
+ * which does not depend on the order in which nodes returned their edges.
+ */
+static WaitEdge *
+SortedWaitEdges(WaitGraph *waitGraph)
+{
+	int edgeCount = waitGraph->edgeCount;
+	WaitEdge *sortedEdges = (WaitEdge *) palloc0(Max(edgeCount, 1) * sizeof(WaitEdge));
+
+	if (edgeCount > 0)
+	{
+		memcpy(sortedEdges, waitGraph->edges, edgeCount * sizeof(WaitEdge));
+		qsort(sortedEdges, edgeCount, sizeof(WaitEdge), CompareWaitEdges);
+	}
+
+	return sortedEdges;
+}
+
+
+/*
+ * CompareWaitEdges is a qsort comparator that orders wait edges by all their
+ * fields.
+ */
+static int
+CompareWaitEdges(const void *leftElement, const void *rightElement)
+{
+	const WaitEdge *leftEdge = (const WaitEdge *) leftElement;
+	const WaitEdge *rightEdge = (const WaitEdge *) rightElement;
+
+#define COMPARE_WAIT_EDGE_FIELD(field) \
+	if (leftEdge->field != rightEdge->field) \
+	{ \
+		return leftEdge->field < rightEdge->field ? -1 : 1; \
+	}
+
+	COMPARE_WAIT_EDGE_FIELD(waitingNodeId);
+	COMPARE_WAIT_EDGE_FIELD(waitingPid);
+	COMPARE_WAIT_EDGE_FIELD(waitingTransactionNum);
+	COMPARE_WAIT_EDGE_FIELD(waitingTransactionStamp);
+	COMPARE_WAIT_EDGE_FIELD(blockingNodeId);
+	COMPARE_WAIT_EDGE_FIELD(blockingPid);
+	COMPARE_WAIT_EDGE_FIELD(blockingTransactionNum);
+	COMPARE_WAIT_EDGE_FIELD(blockingTransactionStamp);
+	COMPARE_WAIT_EDGE_FIELD(isBlockingXactWaiting);
+
+#undef COMPARE_WAIT_EDGE_FIELD
+
+	return 0;
+}
+
+
+/*
+ * IsCycleFreeWaitGraph returns whether the given sorted wait edges are the
+ * same as the ones of the last check that did not find any cycle.
+ */
+static bool
+IsCycleFreeWaitGraph(WaitEdge *sortedEdges, int edgeCount)
+{
+	int edgeIndex = 0;
+
+	if (CycleFreeWaitEdges == NULL || edgeCount != CycleFreeWaitEdgeCount)
+	{
+		return false;
+	}
+
+	for (edgeIndex = 0; edgeIndex < edgeCount; edgeIndex++)
+	{
+		if (CompareWaitEdges(&sortedEdges[edgeIndex],
+							 &CycleFreeWaitEdges[edgeIndex]) != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * RememberCycleFreeWaitGraph keeps a copy of the given sorted wait edges for
+ * the next check of this backend.
+ */
+static void
+RememberCycleFreeWaitGraph(WaitEdge *sortedEdges, int edgeCount)
+{
+	if (CycleFreeWaitEdges != NULL)
+	{
+		pfree(CycleFreeWaitEdges);
+	}
+
+	CycleFreeWaitEdges = (WaitEdge *) MemoryContextAlloc(TopMemoryContext,
+														  Max(edgeCount, 1) *
+														  sizeof(WaitEdge));
+	memcpy(CycleFreeWaitEdges, sortedEdges, edgeCount * sizeof(WaitEdge));
+	CycleFreeWaitEdgeCount = edgeCount;
+}
+
+
 /*
  * CheckDeadlockForDistributedTransaction does a DFS starting with the given
  * transaction node and checks for a cycle (i.e., the node can be reached again
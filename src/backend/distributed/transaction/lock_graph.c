@@ -24,6 +24,8 @@
 #include "distributed/lock_graph.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/remote_commands.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
 #include "storage/proc.h"
 #include "utils/builtins.h"
 #include "utils/hsearch.h"
@@ -44,6 +46,8 @@ typedef struct PROCStack
 
 
 static void AddWaitEdgeFromResult(WaitGraph *waitGraph, PGresult *result, int rowIndex);
+static void InitBinaryField(StringInfo fieldBuffer, PGresult *result, int rowIndex,
+							int colIndex);
 static int64 ParseIntField(PGresult *result, int rowIndex, int colIndex);
 static bool ParseBoolField(PGresult *result, int rowIndex, int colIndex);
 static TimestampTz ParseTimestampTzField(PGresult *result, int rowIndex, int colIndex);
@@ -88,7 +92,8 @@ dump_global_wait_edges(PG_FUNCTION_ARGS)
 /*
  * BuildGlobalWaitGraph builds a wait graph for distributed transactions
  * that originate from this node, including edges from all (other) worker
- * nodes.
+ * nodes. The remote edges are requested from all nodes at once and returned
+ * in binary format, and we build the local wait graph while they are running.
  */
 WaitGraph *
 BuildGlobalWaitGraph(void)
@@ -99,8 +104,7 @@ BuildGlobalWaitGraph(void)
 	List *connectionList = NIL;
 	ListCell *connectionCell = NULL;
 	int localNodeId = GetLocalGroupId();
-
-	WaitGraph *waitGraph = BuildLocalWaitGraph();
+	WaitGraph *waitGraph = NULL;
 
 	/* open connections in parallel */
 	foreach(workerNodeCell, workerNodeList)
@@ -131,14 +135,19 @@ BuildGlobalWaitGraph(void)
 		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
 		int querySent = false;
 		const char *command = "SELECT * FROM dump_local_wait_edges()";
+		bool binaryResults = true;
 
-		querySent = SendRemoteCommand(connection, command);
+		querySent = SendRemoteCommandParams(connection, command, 0, NULL, NULL,
+											binaryResults);
 		if (querySent == 0)
 		{
 			ReportConnectionError(connection, WARNING);
 		}
 	}
 
+	/* gather local wait edges while the other nodes gather theirs */
+	waitGraph = BuildLocalWaitGraph();
+
 	/* receive dump_local_wait_edges results */
 	foreach(connectionCell, connectionList)
 	{
@@ -201,58 +210,72 @@ AddWaitEdgeFromResult(WaitGraph *waitGraph, PGresult *result, int rowIndex)
 
 
 /*
- * ParseIntField parses a int64 from a remote result or returns 0 if the
- * result is NULL.
+ * InitBinaryField points the given buffer at a binary field of a remote
+ * result, such that it can be read using the pq_getmsg functions.
+ */
+static void
+InitBinaryField(StringInfo fieldBuffer, PGresult *result, int rowIndex, int colIndex)
+{
+	fieldBuffer->data = PQgetvalue(result, rowIndex, colIndex);
+	fieldBuffer->len = PQgetlength(result, rowIndex, colIndex);
+	fieldBuffer->maxlen = fieldBuffer->len;
+	fieldBuffer->cursor = 0;
+}
+
+
+/*
+ * ParseIntField parses a binary int4 or int8 from a remote result or returns 0
+ * if the result is NULL.
  */
 static int64
 ParseIntField(PGresult *result, int rowIndex, int colIndex)
 {
-	char *resultString = NULL;
+	StringInfoData fieldBuffer;
 
 	if (PQgetisnull(result, rowIndex, colIndex))
 	{
 		return 0;
 	}
 
-	resultString = PQgetvalue(result, rowIndex, colIndex);
+	InitBinaryField(&fieldBuffer, result, rowIndex, colIndex);
+
+	if (fieldBuffer.len == sizeof(int64))
+	{
+		return pq_getmsgint64(&fieldBuffer);
+	}
 
-	return pg_strtouint64(resultString, NULL, 10);
+	return (int32) pq_getmsgint(&fieldBuffer, sizeof(int32));
 }
 
 
 /*
- * ParseBoolField parses a bool from a remote result or returns false if the
- * result is NULL.
+ * ParseBoolField parses a binary bool from a remote result or returns false if
+ * the result is NULL.
  */
 static bool
 ParseBoolField(PGresult *result, int rowIndex, int colIndex)
 {
-	char *resultString = NULL;
+	StringInfoData fieldBuffer;
 
 	if (PQgetisnull(result, rowIndex, colIndex))
 	{
 		return false;
 	}
 
-	resultString = PQgetvalue(result, rowIndex, colIndex);
-	if (strlen(resultString) != 1)
-	{
-		return false;
-	}
+	InitBinaryField(&fieldBuffer, result, rowIndex, colIndex);
 
-	return resultString[0] == 't';
+	return pq_getmsgbyte(&fieldBuffer) != 0;
 }
 
 
 /*
- * ParseTimestampTzField parses a timestamptz from a remote result or returns
- * 0 if the result is NULL.
+ * ParseTimestampTzField parses a binary timestamptz from a remote result or
+ * returns 0 if the result is NULL.
  */
 static TimestampTz
 ParseTimestampTzField(PGresult *result, int rowIndex, int colIndex)
 {
-	char *resultString = NULL;
-	Datum resultStringDatum = 0;
+	StringInfoData fieldBuffer;
 	Datum timestampDatum = 0;
 
 	if (PQgetisnull(result, rowIndex, colIndex))
@@ -260,9 +283,11 @@ ParseTimestampTzField(PGresult *result, int rowIndex, int colIndex)
 		return 0;
 	}
 
-	resultString = PQgetvalue(result, rowIndex, colIndex);
-	resultStringDatum = CStringGetDatum(resultString);
-	timestampDatum = DirectFunctionCall3(timestamptz_in, resultStringDatum, 0, -1);
+	InitBinaryField(&fieldBuffer, result, rowIndex, colIndex);
+	timestampDatum = DirectFunctionCall3(timestamptz_recv,
+										 PointerGetDatum(&fieldBuffer),
+										 ObjectIdGetDatum(InvalidOid),
+										 Int32GetDatum(-1));
 
 	return DatumGetTimestampTz(timestampDatum);
 }
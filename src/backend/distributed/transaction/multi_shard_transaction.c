@@ -20,6 +20,7 @@
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/placement_connection.h"
+#include "distributed/remote_commands.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/worker_manager.h"
 #include "nodes/pg_list.h"
@@ -35,7 +36,8 @@
  * taking into account which shards are read and modified by the task
  * to select the appopriate connection, or error out if no appropriate
  * connection can be found. The set of connections is returned as an
- * anchor shard ID -> ShardConnections hash.
+ * anchor shard ID -> ShardConnections hash. DML tasks whose placements
+ * were modified over the same connection share that connection.
  */
 HTAB *
 OpenTransactionsForAllTasks(List *taskList, int connectionFlags)
@@ -53,6 +55,7 @@ OpenTransactionsForAllTasks(List *taskList, int connectionFlags)
 	{
 		Task *task = (Task *) lfirst(taskCell);
 		ShardPlacementAccessType accessType = PLACEMENT_ACCESS_SELECT;
+		int taskConnectionFlags = connectionFlags;
 		uint64 shardId = task->anchorShardId;
 		ShardConnections *shardConnections = NULL;
 		bool shardConnectionsFound = false;
@@ -77,6 +80,13 @@ OpenTransactionsForAllTasks(List *taskList, int connectionFlags)
 		if (task->taskType == MODIFY_TASK)
 		{
 			accessType = PLACEMENT_ACCESS_DML;
+
+			/*
+			 * Placements that were modified over the same connection earlier in
+			 * the transaction need to keep using it, so let the tasks share the
+			 * connection. The caller runs one command at a time on it.
+			 */
+			taskConnectionFlags = connectionFlags | SHARE_MODIFYING_CONNECTION;
 		}
 		else
 		{
@@ -118,15 +128,28 @@ OpenTransactionsForAllTasks(List *taskList, int connectionFlags)
 			 * Find a connection that sees preceding writes and cannot self-deadlock,
 			 * or error out if no such connection exists.
 			 */
-			connection = StartPlacementListConnection(connectionFlags,
+			connection = StartPlacementListConnection(taskConnectionFlags,
 													  placementAccessList, NULL);
 
-			ClaimConnectionExclusively(connection);
+			if (!connection->claimedExclusively)
+			{
+				ClaimConnectionExclusively(connection);
+			}
+			else if (!list_member_ptr(newConnectionList, connection))
+			{
+				/* only share connections with the other tasks of this command */
+				ereport(ERROR,
+						(errcode(ERRCODE_ACTIVE_SQL_TRANSACTION),
+						 errmsg("cannot establish a new connection for "
+								"placement " UINT64_FORMAT
+								", since DML has been executed on a connection "
+								"that is in use", shardPlacement->placementId)));
+			}
 
 			shardConnections->connectionList = lappend(shardConnections->connectionList,
 													   connection);
 
-			newConnectionList = lappend(newConnectionList, connection);
+			newConnectionList = list_append_unique_ptr(newConnectionList, connection);
 
 			/*
 			 * Every individual failure should cause entire distributed
@@ -191,6 +214,9 @@ GetShardHashConnections(HTAB *connectionHash, int64 shardId, bool *connectionsFo
 	{
 		shardConnections->shardId = shardId;
 		shardConnections->connectionList = NIL;
+		shardConnections->copyDataBuffer = NULL;
+		shardConnections->localShardCopy = NULL;
+		shardConnections->copyProgress = NULL;
 	}
 
 	return shardConnections;
@@ -267,3 +293,79 @@ UnclaimAllShardConnections(HTAB *shardConnectionHash)
 		}
 	}
 }
+
+
+/*
+ * AppendConnectionCommand adds the given command to the batch of commands for
+ * the given connection in the given list, and appends a new batch to the list
+ * if the connection has none yet.
+ */
+void
+AppendConnectionCommand(List **commandBatchList, MultiConnection *connection,
+						const char *command)
+{
+	ConnectionCommandBatch *commandBatch = NULL;
+	ListCell *commandBatchCell = NULL;
+
+	foreach(commandBatchCell, *commandBatchList)
+	{
+		ConnectionCommandBatch *existingBatch =
+			(ConnectionCommandBatch *) lfirst(commandBatchCell);
+
+		if (existingBatch->connection == connection)
+		{
+			commandBatch = existingBatch;
+			break;
+		}
+	}
+
+	if (commandBatch == NULL)
+	{
+		commandBatch = palloc0(sizeof(ConnectionCommandBatch));
+		commandBatch->connection = connection;
+		commandBatch->commandString = makeStringInfo();
+
+		*commandBatchList = lappend(*commandBatchList, commandBatch);
+	}
+	else
+	{
+		appendStringInfoString(commandBatch->commandString, "; ");
+	}
+
+	appendStringInfoString(commandBatch->commandString, command);
+}
+
+
+/*
+ * ExecuteConnectionCommandBatches sends the batch of commands of each
+ * connection as a single multi-statement command, such that all connections
+ * run their commands in parallel, and then waits for all of them to finish.
+ * The commands are critical, so we error out if any of them fails.
+ */
+void
+ExecuteConnectionCommandBatches(List *commandBatchList)
+{
+	ListCell *commandBatchCell = NULL;
+
+	foreach(commandBatchCell, commandBatchList)
+	{
+		ConnectionCommandBatch *commandBatch =
+			(ConnectionCommandBatch *) lfirst(commandBatchCell);
+		MultiConnection *connection = commandBatch->connection;
+		int querySent = 0;
+
+		querySent = SendRemoteCommand(connection, commandBatch->commandString->data);
+		if (querySent == 0)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	foreach(commandBatchCell, commandBatchList)
+	{
+		ConnectionCommandBatch *commandBatch =
+			(ConnectionCommandBatch *) lfirst(commandBatchCell);
+
+		FinishCriticalRemoteCommand(commandBatch->connection);
+	}
+}
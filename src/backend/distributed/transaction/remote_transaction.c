@@ -30,6 +30,10 @@
 #define PREPARED_TRANSACTION_NAME_FORMAT "citus_%u_%u_"UINT64_FORMAT "_%u"
 
 
+/* GUC, whether to send SAVEPOINT only to connections used in the subtransaction */
+bool LazySavepointPropagation = false;
+
+
 static void StartRemoteTransactionSavepointBegin(MultiConnection *connection,
 												 SubTransactionId subId);
 static void FinishRemoteTransactionSavepointBegin(MultiConnection *connection,
@@ -43,8 +47,16 @@ static void StartRemoteTransactionSavepointRollback(MultiConnection *connection,
 static void FinishRemoteTransactionSavepointRollback(MultiConnection *connection,
 													 SubTransactionId subId);
 
+static StringInfo BuildRemoteTransactionBegin(MultiConnection *connection);
+static int AppendPendingSavepoints(RemoteTransaction *transaction, StringInfo command);
+static bool RemoteTransactionHasPendingSavepoints(MultiConnection *connection);
+static bool RemoteTransactionHasSavepoint(RemoteTransaction *transaction,
+										  SubTransactionId subId);
+static SubTransactionId InnermostActiveSubXact(void);
 static void CheckTransactionHealth(void);
 static void Assign2PCIdentifier(MultiConnection *connection);
+static void LogRemoteTransactionPrepares(List *connectionList);
+static void SendRemoteTransactionPrepare(MultiConnection *connection);
 static void WarnAboutLeakedPreparedTransaction(MultiConnection *connection, bool commit);
 
 
@@ -53,17 +65,75 @@ static void WarnAboutLeakedPreparedTransaction(MultiConnection *connection, bool
  * a non-blocking manner. The function sends "BEGIN" followed by
  * assign_distributed_transaction_id() to assign the distributed transaction
  * id on the remote node.
+ *
+ * With lazy savepoint propagation, the function can also be called for started
+ * transactions that lack savepoints for the current subtransactions, in which
+ * case only the missing SAVEPOINT commands are sent.
  */
 void
 StartRemoteTransactionBegin(struct MultiConnection *connection)
+{
+	StringInfo beginAndSetDistributedTransactionId = NULL;
+
+	beginAndSetDistributedTransactionId = BuildRemoteTransactionBegin(connection);
+
+	if (!SendRemoteCommand(connection, beginAndSetDistributedTransactionId->data))
+	{
+		ReportConnectionError(connection, WARNING);
+		MarkRemoteTransactionFailed(connection, true);
+	}
+}
+
+
+/*
+ * RemoteTransactionBeginCommand marks the remote transaction as starting and
+ * returns the commands that begin it, without sending them. The caller is
+ * expected to send the returned string together with its own query, so that
+ * the transaction is opened without a separate round trip, and to call
+ * FinishPipelinedRemoteTransactionBegin() before reading the results of its
+ * query.
+ */
+char *
+RemoteTransactionBeginCommand(struct MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+	StringInfo beginCommand = BuildRemoteTransactionBegin(connection);
+
+	transaction->transactionPipelined = true;
+
+	return beginCommand->data;
+}
+
+
+/*
+ * BuildRemoteTransactionBegin links the connection's transaction into the list
+ * of in-progress transactions, marks it as starting, and returns the BEGIN,
+ * assign_distributed_transaction_id() and SAVEPOINT commands that open the
+ * transaction on the remote node.
+ *
+ * For a started transaction with pending savepoints, it marks the transaction
+ * as starting again and only returns the SAVEPOINT commands.
+ */
+static StringInfo
+BuildRemoteTransactionBegin(MultiConnection *connection)
 {
 	RemoteTransaction *transaction = &connection->remoteTransaction;
 	StringInfo beginAndSetDistributedTransactionId = makeStringInfo();
 	DistributedTransactionId *distributedTransactionId = NULL;
-	ListCell *subIdCell = NULL;
-	List *activeSubXacts = NIL;
+	int savepointCount = 0;
 	const char *timestamp = NULL;
 
+	if (transaction->transactionState == REMOTE_TRANS_STARTED)
+	{
+		Assert(RemoteTransactionHasPendingSavepoints(connection));
+
+		transaction->transactionState = REMOTE_TRANS_STARTING;
+		transaction->beginCommandCount =
+			AppendPendingSavepoints(transaction, beginAndSetDistributedTransactionId);
+
+		return beginAndSetDistributedTransactionId;
+	}
+
 	Assert(transaction->transactionState == REMOTE_TRANS_INVALID);
 
 	/* remember transaction as being in-progress */
@@ -94,22 +164,112 @@ StartRemoteTransactionBegin(struct MultiConnection *connection)
 					 timestamp);
 
 	/* append in-progress savepoints for this transaction */
-	activeSubXacts = ActiveSubXacts();
 	transaction->lastSuccessfulSubXact = TopSubTransactionId;
 	transaction->lastQueuedSubXact = TopSubTransactionId;
+	savepointCount = AppendPendingSavepoints(transaction,
+											 beginAndSetDistributedTransactionId);
+
+	/* BEGIN and assign_distributed_transaction_id(), plus the savepoints */
+	transaction->beginCommandCount = 2 + savepointCount;
+
+	return beginAndSetDistributedTransactionId;
+}
+
+
+/*
+ * AppendPendingSavepoints appends SAVEPOINT commands for the active
+ * subtransactions that were not yet sent to the remote transaction, and
+ * returns how many it appended.
+ */
+static int
+AppendPendingSavepoints(RemoteTransaction *transaction, StringInfo command)
+{
+	List *activeSubXacts = ActiveSubXacts();
+	ListCell *subIdCell = NULL;
+	int savepointCount = 0;
+
 	foreach(subIdCell, activeSubXacts)
 	{
 		SubTransactionId subId = lfirst_int(subIdCell);
-		appendStringInfo(beginAndSetDistributedTransactionId,
-						 "SAVEPOINT savepoint_%u;", subId);
+
+		if (subId <= transaction->lastQueuedSubXact)
+		{
+			continue;
+		}
+
+		appendStringInfo(command, "SAVEPOINT savepoint_%u;", subId);
 		transaction->lastQueuedSubXact = subId;
+		savepointCount++;
 	}
 
-	if (!SendRemoteCommand(connection, beginAndSetDistributedTransactionId->data))
+	return savepointCount;
+}
+
+
+/*
+ * RemoteTransactionHasPendingSavepoints returns whether, with lazy savepoint
+ * propagation, the started transaction on the given connection still needs
+ * savepoints for the current subtransactions before it can be used.
+ */
+static bool
+RemoteTransactionHasPendingSavepoints(MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+
+	if (!LazySavepointPropagation ||
+		transaction->transactionState != REMOTE_TRANS_STARTED ||
+		transaction->transactionFailed)
 	{
-		ReportConnectionError(connection, WARNING);
-		MarkRemoteTransactionFailed(connection, true);
+		return false;
 	}
+
+	return InnermostActiveSubXact() > transaction->lastQueuedSubXact;
+}
+
+
+/*
+ * RemoteTransactionNeedsBegin returns whether BEGIN, or with lazy savepoint
+ * propagation pending SAVEPOINT commands, should be sent on the connection
+ * before using it in the coordinated transaction.
+ */
+bool
+RemoteTransactionNeedsBegin(MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+
+	return transaction->transactionState == REMOTE_TRANS_INVALID ||
+		   RemoteTransactionHasPendingSavepoints(connection);
+}
+
+
+/*
+ * RemoteTransactionHasSavepoint returns whether the savepoint for the given
+ * active subtransaction was sent to the remote transaction. Savepoints are
+ * always sent in order, so this is the case for all subtransactions up to
+ * the last queued savepoint.
+ */
+static bool
+RemoteTransactionHasSavepoint(RemoteTransaction *transaction, SubTransactionId subId)
+{
+	return !LazySavepointPropagation || subId <= transaction->lastQueuedSubXact;
+}
+
+
+/*
+ * InnermostActiveSubXact returns the id of the innermost active subtransaction,
+ * or TopSubTransactionId if there is none.
+ */
+static SubTransactionId
+InnermostActiveSubXact(void)
+{
+	List *activeSubXacts = ActiveSubXacts();
+
+	if (activeSubXacts == NIL)
+	{
+		return TopSubTransactionId;
+	}
+
+	return llast_int(activeSubXacts);
 }
 
 
@@ -140,6 +300,75 @@ FinishRemoteTransactionBegin(struct MultiConnection *connection)
 }
 
 
+/*
+ * FinishPipelinedRemoteTransactionBegin reads the results of the commands
+ * returned by RemoteTransactionBeginCommand(), which were sent ahead of a
+ * query on the same connection. Results of the query itself are left to the
+ * caller. The function returns false if the transaction could not be started,
+ * in which case the remaining results on the connection have been consumed.
+ * If no pipelined begin is pending, the function returns true right away.
+ */
+bool
+FinishPipelinedRemoteTransactionBegin(struct MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+	int resultIndex = 0;
+
+	if (transaction->transactionState != REMOTE_TRANS_STARTING ||
+		!transaction->transactionPipelined)
+	{
+		return true;
+	}
+
+	transaction->transactionPipelined = false;
+
+	/* sending the commands failed, there are no results to read */
+	if (transaction->transactionFailed)
+	{
+		return false;
+	}
+
+	while (resultIndex < transaction->beginCommandCount)
+	{
+		bool raiseInterrupts = true;
+		PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+
+		if (result == NULL)
+		{
+			ReportConnectionError(connection, WARNING);
+			MarkRemoteTransactionFailed(connection, true);
+			return false;
+		}
+
+		/* single-row mode returns the row of a SELECT before its terminator */
+		if (PQresultStatus(result) == PGRES_SINGLE_TUPLE)
+		{
+			PQclear(result);
+			continue;
+		}
+
+		if (!IsResponseOK(result))
+		{
+			ReportResultError(connection, result, WARNING);
+			PQclear(result);
+			MarkRemoteTransactionFailed(connection, true);
+
+			/* the server skips the rest of the query string after an error */
+			ForgetResults(connection);
+			return false;
+		}
+
+		PQclear(result);
+		resultIndex++;
+	}
+
+	transaction->transactionState = REMOTE_TRANS_STARTED;
+	transaction->lastSuccessfulSubXact = transaction->lastQueuedSubXact;
+
+	return true;
+}
+
+
 /*
  * RemoteTransactionBegin begins a remote transaction in a blocking manner.
  */
@@ -469,29 +698,65 @@ RemoteTransactionAbort(MultiConnection *connection)
 void
 StartRemoteTransactionPrepare(struct MultiConnection *connection)
 {
-	RemoteTransaction *transaction = &connection->remoteTransaction;
-	StringInfoData command;
-	const bool raiseErrors = true;
-	WorkerNode *workerNode = NULL;
+	LogRemoteTransactionPrepares(list_make1(connection));
+	SendRemoteTransactionPrepare(connection);
+}
 
-	/* can't prepare a nonexistant transaction */
-	Assert(transaction->transactionState != REMOTE_TRANS_INVALID);
 
-	/* can't prepare in a failed transaction */
-	Assert(!transaction->transactionFailed);
+/*
+ * LogRemoteTransactionPrepares assigns 2PC identifiers to the transactions on
+ * the given connections, and records them in pg_dist_transaction in one go.
+ */
+static void
+LogRemoteTransactionPrepares(List *connectionList)
+{
+	List *groupIdList = NIL;
+	List *transactionNameList = NIL;
+	ListCell *connectionCell = NULL;
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		RemoteTransaction *transaction = &connection->remoteTransaction;
+		WorkerNode *workerNode = NULL;
+
+		/* can't prepare a nonexistant transaction */
+		Assert(transaction->transactionState != REMOTE_TRANS_INVALID);
 
-	/* can't prepare if already started to prepare/abort/commit */
-	Assert(transaction->transactionState < REMOTE_TRANS_PREPARING);
+		/* can't prepare in a failed transaction */
+		Assert(!transaction->transactionFailed);
 
-	Assign2PCIdentifier(connection);
+		/* can't prepare if already started to prepare/abort/commit */
+		Assert(transaction->transactionState < REMOTE_TRANS_PREPARING);
 
-	/* log transactions to workers in pg_dist_transaction */
-	workerNode = FindWorkerNode(connection->hostname, connection->port);
-	if (workerNode != NULL)
-	{
-		LogTransactionRecord(workerNode->groupId, transaction->preparedName);
+		Assign2PCIdentifier(connection);
+
+		/* log transactions to workers in pg_dist_transaction */
+		workerNode = FindWorkerNode(connection->hostname, connection->port);
+		if (workerNode != NULL)
+		{
+			groupIdList = lappend_int(groupIdList, workerNode->groupId);
+			transactionNameList = lappend(transactionNameList,
+										  transaction->preparedName);
+			transaction->transactionLogged = true;
+		}
 	}
 
+	LogTransactionRecords(groupIdList, transactionNameList);
+}
+
+
+/*
+ * SendRemoteTransactionPrepare sends PREPARE TRANSACTION for the transaction
+ * on the given connection, which was logged by LogRemoteTransactionPrepares.
+ */
+static void
+SendRemoteTransactionPrepare(MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+	StringInfoData command;
+	const bool raiseErrors = true;
+
 	initStringInfo(&command);
 	appendStringInfo(&command, "PREPARE TRANSACTION '%s'",
 					 transaction->preparedName);
@@ -604,9 +869,9 @@ RemoteTransactionsBeginIfNecessary(List *connectionList)
 		/*
 		 * If a transaction already is in progress (including having failed),
 		 * don't start it again.  Thats quite normal if a piece of code allows
-		 * cached connections.
+		 * cached connections. We do send savepoints it lacks, if any.
 		 */
-		if (transaction->transactionState != REMOTE_TRANS_INVALID)
+		if (!RemoteTransactionNeedsBegin(connection))
 		{
 			continue;
 		}
@@ -724,10 +989,9 @@ CoordinatedRemoteTransactionsPrepare(void)
 	dlist_iter iter;
 	bool raiseInterrupts = false;
 	List *connectionList = NIL;
+	ListCell *connectionCell = NULL;
 
 	/* issue PREPARE TRANSACTION; to all relevant remote nodes */
-
-	/* asynchronously send PREPARE */
 	dlist_foreach(iter, &InProgressTransactions)
 	{
 		MultiConnection *connection = dlist_container(MultiConnection, transactionNode,
@@ -742,10 +1006,20 @@ CoordinatedRemoteTransactionsPrepare(void)
 			continue;
 		}
 
-		StartRemoteTransactionPrepare(connection);
 		connectionList = lappend(connectionList, connection);
 	}
 
+	/* record all transactions in pg_dist_transaction before preparing any */
+	LogRemoteTransactionPrepares(connectionList);
+
+	/* asynchronously send PREPARE */
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		SendRemoteTransactionPrepare(connection);
+	}
+
 	raiseInterrupts = true;
 	WaitForAllConnections(connectionList, raiseInterrupts);
 
@@ -811,6 +1085,18 @@ CoordinatedRemoteTransactionsCommit(void)
 			continue;
 		}
 
+		/*
+		 * The commit decision for a recorded prepared transaction is durable
+		 * once the local transaction committed, so with deferred commits we
+		 * leave COMMIT PREPARED to 2PC recovery in the maintenance daemon.
+		 */
+		if (DeferCommitPrepared && !transaction->transactionFailed &&
+			transaction->transactionState == REMOTE_TRANS_PREPARED &&
+			transaction->transactionLogged)
+		{
+			continue;
+		}
+
 		StartRemoteTransactionCommit(connection);
 		connectionList = lappend(connectionList, connection);
 	}
@@ -839,6 +1125,63 @@ CoordinatedRemoteTransactionsCommit(void)
 }
 
 
+/*
+ * CoordinatedRemoteTransactionsCommitOnePhase commits the only remote
+ * transaction of a coordinated transaction that would otherwise use 2PC with
+ * a plain COMMIT. It has to be called before the local transaction commits.
+ *
+ * Unlike CoordinatedRemoteTransactionsCommit, it raises an error if the
+ * COMMIT fails, such that the local transaction aborts as well. That keeps
+ * the behaviour of PREPARE TRANSACTION, which reports errors like deferred
+ * constraint violations and serialization failures to the client.
+ */
+void
+CoordinatedRemoteTransactionsCommitOnePhase(void)
+{
+	dlist_node *transactionNode = NULL;
+	MultiConnection *connection = NULL;
+	RemoteTransaction *transaction = NULL;
+	PGresult *result = NULL;
+	const bool dontRaiseErrors = false;
+	bool raiseInterrupts = true;
+
+	Assert(!dlist_is_empty(&InProgressTransactions));
+
+	transactionNode = dlist_head_node(&InProgressTransactions);
+	connection = dlist_container(MultiConnection, transactionNode, transactionNode);
+	transaction = &connection->remoteTransaction;
+
+	CheckTransactionHealth();
+
+	transaction->transactionState = REMOTE_TRANS_1PC_COMMITTING;
+
+	if (!SendRemoteCommand(connection, "COMMIT"))
+	{
+		MarkRemoteTransactionFailed(connection, dontRaiseErrors);
+		ReportConnectionError(connection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (!IsResponseOK(result))
+	{
+		/* the remote transaction rolled back if it could report an error */
+		if (PQstatus(connection->pgConn) == CONNECTION_OK)
+		{
+			ForgetResults(connection);
+			transaction->transactionState = REMOTE_TRANS_ABORTED;
+		}
+
+		MarkRemoteTransactionFailed(connection, dontRaiseErrors);
+		ReportResultError(connection, result, ERROR);
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	transaction->transactionState = REMOTE_TRANS_COMMITTED;
+}
+
+
 /*
  * CoordinatedRemoteTransactionsAbort performs distributed transactions
  * handling at abort time.
@@ -905,6 +1248,12 @@ CoordinatedRemoteTransactionsSavepointBegin(SubTransactionId subId)
 	const bool raiseInterrupts = true;
 	List *connectionList = NIL;
 
+	/* connections get the savepoint once they are used within it */
+	if (LazySavepointPropagation)
+	{
+		return;
+	}
+
 	/* asynchronously send SAVEPOINT */
 	dlist_foreach(iter, &InProgressTransactions)
 	{
@@ -917,6 +1266,7 @@ CoordinatedRemoteTransactionsSavepointBegin(SubTransactionId subId)
 		}
 
 		StartRemoteTransactionSavepointBegin(connection, subId);
+		transaction->lastQueuedSubXact = subId;
 		connectionList = lappend(connectionList, connection);
 	}
 
@@ -961,7 +1311,8 @@ CoordinatedRemoteTransactionsSavepointRelease(SubTransactionId subId)
 		MultiConnection *connection = dlist_container(MultiConnection, transactionNode,
 													  iter.cur);
 		RemoteTransaction *transaction = &connection->remoteTransaction;
-		if (transaction->transactionFailed)
+		if (transaction->transactionFailed ||
+			!RemoteTransactionHasSavepoint(transaction, subId))
 		{
 			continue;
 		}
@@ -978,12 +1329,19 @@ CoordinatedRemoteTransactionsSavepointRelease(SubTransactionId subId)
 		MultiConnection *connection = dlist_container(MultiConnection, transactionNode,
 													  iter.cur);
 		RemoteTransaction *transaction = &connection->remoteTransaction;
-		if (transaction->transactionFailed)
+		if (transaction->transactionFailed ||
+			!RemoteTransactionHasSavepoint(transaction, subId))
 		{
 			continue;
 		}
 
 		FinishRemoteTransactionSavepointRelease(connection, subId);
+
+		if (LazySavepointPropagation)
+		{
+			/* the remote transaction is back in the parent subtransaction */
+			transaction->lastQueuedSubXact = InnermostActiveSubXact();
+		}
 	}
 }
 
@@ -1006,6 +1364,13 @@ CoordinatedRemoteTransactionsSavepointRollback(SubTransactionId subId)
 		MultiConnection *connection = dlist_container(MultiConnection, transactionNode,
 													  iter.cur);
 		RemoteTransaction *transaction = &connection->remoteTransaction;
+
+		/* the connection was not used in the subtransaction, nothing to undo */
+		if (!RemoteTransactionHasSavepoint(transaction, subId))
+		{
+			continue;
+		}
+
 		if (transaction->transactionFailed)
 		{
 			if (transaction->lastSuccessfulSubXact <= subId)
@@ -1036,12 +1401,19 @@ CoordinatedRemoteTransactionsSavepointRollback(SubTransactionId subId)
 		MultiConnection *connection = dlist_container(MultiConnection, transactionNode,
 													  iter.cur);
 		RemoteTransaction *transaction = &connection->remoteTransaction;
-		if (transaction->transactionFailed && !transaction->transactionRecovering)
+		if (!RemoteTransactionHasSavepoint(transaction, subId) ||
+			(transaction->transactionFailed && !transaction->transactionRecovering))
 		{
 			continue;
 		}
 
 		FinishRemoteTransactionSavepointRollback(connection, subId);
+
+		if (LazySavepointPropagation)
+		{
+			/* the remote transaction is back in the parent subtransaction */
+			transaction->lastQueuedSubXact = InnermostActiveSubXact();
+		}
 	}
 }
 
@@ -20,13 +20,24 @@
 #include "access/twophase.h"
 #include "access/xact.h"
 #include "distributed/backend_data.h"
+#include "distributed/batched_replication.h"
 #include "distributed/connection_management.h"
+#include "distributed/connection_wait_stats.h"
 #include "distributed/hash_helpers.h"
 #include "distributed/intermediate_results.h"
+#include "distributed/maintenanced.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/transaction_management.h"
 #include "distributed/placement_connection.h"
+#include "distributed/planner_stats.h"
+#include "distributed/query_trace.h"
+#include "distributed/result_cache.h"
+#include "distributed/shard_invalidation_log.h"
+#include "distributed/shard_statistics.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/task_execution_stats.h"
+#include "distributed/tenant_admission.h"
 #include "utils/hsearch.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
@@ -38,6 +49,12 @@ CoordinatedTransactionState CurrentCoordinatedTransactionState = COORD_TRANS_NON
 int MultiShardCommitProtocol = COMMIT_PROTOCOL_2PC;
 int SavedMultiShardCommitProtocol = COMMIT_PROTOCOL_BARE;
 
+/* GUC, whether to skip 2PC for transactions that only involve a single connection */
+bool EnableOnePhaseCommit = false;
+
+/* GUC, whether to leave COMMIT PREPARED to the maintenance daemon */
+bool DeferCommitPrepared = false;
+
 /* state needed to keep track of operations used during a transaction */
 XactModificationType XactModificationLevel = XACT_MODIFICATION_NONE;
 
@@ -61,6 +78,7 @@ static void CoordinatedSubTransactionCallback(SubXactEvent event, SubTransaction
 
 /* remaining functions */
 static void AdjustMaxPreparedTransactions(void);
+static bool CanCommitRemoteTransactionInOnePhase(void);
 static void PushSubXact(SubTransactionId subId);
 static void PopSubXact(SubTransactionId subId);
 
@@ -151,18 +169,26 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 	{
 		case XACT_EVENT_COMMIT:
 		{
+			bool commitPreparedDeferred = false;
+
 			/*
 			 * Call other parts of citus that need to integrate into
 			 * transaction management. Do so before doing other work, so the
 			 * callbacks still can perform work if needed.
 			 */
 			RemoveIntermediateResultsDirectory();
+			FinishSessionIntermediateResults(true);
 			ResetShardPlacementTransactionState();
 
 			if (CurrentCoordinatedTransactionState == COORD_TRANS_PREPARED)
 			{
+				commitPreparedDeferred = DeferCommitPrepared &&
+										 CoordinatedTransactionUses2PC;
+
 				/* handles both already prepared and open transactions */
+				RecordQueryTraceEvent(QUERY_TRACE_COMMIT, QUERY_TRACE_BEGIN, NULL, 0);
 				CoordinatedRemoteTransactionsCommit();
+				RecordQueryTraceEvent(QUERY_TRACE_COMMIT, QUERY_TRACE_END, NULL, 0);
 			}
 
 			/* close connections etc. */
@@ -172,12 +198,34 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				AfterXactConnectionHandling(true);
 			}
 
+			/* changes are visible on the workers, invalidate cached results */
+			ResetResultCacheTransactionState();
+
+			/* metadata changes are committed, before others see invalidations */
+			ResetSharedMetadataCacheTransactionState();
+			ResetShardInvalidationLogTransactionState(true);
+			ResetShardStatisticsTransactionState(true);
+
+			/* batched modifications of other backends are committed now */
+			FinishBatchedModifications(true);
+			ResetTenantAdmissionState();
+
 			CurrentCoordinatedTransactionState = COORD_TRANS_NONE;
 			XactModificationLevel = XACT_MODIFICATION_NONE;
 			dlist_init(&InProgressTransactions);
 			CoordinatedTransactionUses2PC = false;
 
 			UnSetDistributedTransactionId();
+			ResetQueryTraceState();
+
+			/*
+			 * Only wake up the maintenance daemon once our distributed transaction
+			 * is no longer in progress, otherwise recovery would skip it.
+			 */
+			if (commitPreparedDeferred)
+			{
+				RequestTransactionRecovery(MyDatabaseId);
+			}
 			break;
 		}
 
@@ -195,12 +243,15 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 * callbacks still can perform work if needed.
 			 */
 			RemoveIntermediateResultsDirectory();
+			FinishSessionIntermediateResults(false);
 			ResetShardPlacementTransactionState();
 
 			/* handles both already prepared and open transactions */
 			if (CurrentCoordinatedTransactionState > COORD_TRANS_IDLE)
 			{
+				RecordQueryTraceEvent(QUERY_TRACE_ABORT, QUERY_TRACE_BEGIN, NULL, 0);
 				CoordinatedRemoteTransactionsAbort();
+				RecordQueryTraceEvent(QUERY_TRACE_ABORT, QUERY_TRACE_END, NULL, 0);
 			}
 
 			/* close connections etc. */
@@ -210,6 +261,17 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				AfterXactConnectionHandling(false);
 			}
 
+			ResetResultCacheTransactionState();
+			ResetSharedMetadataCacheTransactionState();
+			ResetShardInvalidationLogTransactionState(false);
+			ResetShardStatisticsTransactionState(false);
+			FinishBatchedModifications(false);
+			ResetTaskStatsCollection();
+			ResetTenantAdmissionState();
+			ResetConnectionWaitState();
+			ResetPlannerStatsState();
+			ResetQueryTraceState();
+
 			CurrentCoordinatedTransactionState = COORD_TRANS_NONE;
 			XactModificationLevel = XACT_MODIFICATION_NONE;
 			dlist_init(&InProgressTransactions);
@@ -236,6 +298,14 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 
 		case XACT_EVENT_PREPARE:
 		{
+			/*
+			 * COMMIT PREPARED cleans up once the changes are committed, but our
+			 * own cache entries contain the prepared changes, so we log them
+			 * like those of an aborted transaction.
+			 */
+			ResetSharedMetadataCacheTransactionState();
+			ResetShardInvalidationLogTransactionState(false);
+			ResetShardStatisticsTransactionState(false);
 			UnSetDistributedTransactionId();
 			break;
 		}
@@ -264,9 +334,25 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 */
 			MarkFailedShardPlacements();
 
-			if (CoordinatedTransactionUses2PC)
+			/*
+			 * A single remote transaction commits atomically on its own, as
+			 * long as we have nothing to commit locally. Errors on COMMIT
+			 * abort the local transaction, as they would on PREPARE.
+			 */
+			if (CoordinatedTransactionUses2PC && CanCommitRemoteTransactionInOnePhase())
+			{
+				CoordinatedTransactionUses2PC = false;
+
+				RecordQueryTraceEvent(QUERY_TRACE_COMMIT, QUERY_TRACE_BEGIN, NULL, 0);
+				CoordinatedRemoteTransactionsCommitOnePhase();
+				RecordQueryTraceEvent(QUERY_TRACE_COMMIT, QUERY_TRACE_END, NULL, 0);
+				CurrentCoordinatedTransactionState = COORD_TRANS_COMMITTED;
+			}
+			else if (CoordinatedTransactionUses2PC)
 			{
+				RecordQueryTraceEvent(QUERY_TRACE_PREPARE, QUERY_TRACE_BEGIN, NULL, 0);
 				CoordinatedRemoteTransactionsPrepare();
+				RecordQueryTraceEvent(QUERY_TRACE_PREPARE, QUERY_TRACE_END, NULL, 0);
 				CurrentCoordinatedTransactionState = COORD_TRANS_PREPARED;
 			}
 			else
@@ -276,7 +362,9 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				 * us to mark failed placements as invalid.  Better don't use
 				 * this for anything important (i.e. DDL/metadata).
 				 */
+				RecordQueryTraceEvent(QUERY_TRACE_COMMIT, QUERY_TRACE_BEGIN, NULL, 0);
 				CoordinatedRemoteTransactionsCommit();
+				RecordQueryTraceEvent(QUERY_TRACE_COMMIT, QUERY_TRACE_END, NULL, 0);
 				CurrentCoordinatedTransactionState = COORD_TRANS_COMMITTED;
 			}
 
@@ -336,6 +424,8 @@ CoordinatedSubTransactionCallback(SubXactEvent event, SubTransactionId subId,
 		case SUBXACT_EVENT_ABORT_SUB:
 		{
 			PopSubXact(subId);
+			ResetTaskStatsCollection();
+			ReleaseSubXactTenantAdmissions(subId);
 			if (InCoordinatedTransaction())
 			{
 				CoordinatedRemoteTransactionsSavepointRollback(subId);
@@ -423,3 +513,45 @@ ActiveSubXacts(void)
 
 	return activeSubXactsReversed;
 }
+
+
+/*
+ * CanCommitRemoteTransactionInOnePhase returns whether the coordinated
+ * transaction can be committed with a plain COMMIT even though it would use
+ * 2PC. That is the case if citus.enable_one_phase_commit is set, exactly one
+ * remote transaction participates, and the local transaction did not write
+ * anything that would need to commit atomically with it. Several connections
+ * to the same worker still need 2PC, since their transactions are separate on
+ * the worker.
+ */
+static bool
+CanCommitRemoteTransactionInOnePhase(void)
+{
+	MultiConnection *connection = NULL;
+	dlist_node *transactionNode = NULL;
+
+	if (!EnableOnePhaseCommit)
+	{
+		return false;
+	}
+
+	if (GetTopTransactionIdIfAny() != InvalidTransactionId)
+	{
+		return false;
+	}
+
+	if (dlist_is_empty(&InProgressTransactions))
+	{
+		return false;
+	}
+
+	transactionNode = dlist_head_node(&InProgressTransactions);
+	if (dlist_has_next(&InProgressTransactions, transactionNode))
+	{
+		return false;
+	}
+
+	connection = dlist_container(MultiConnection, transactionNode, transactionNode);
+
+	return !connection->remoteTransaction.transactionFailed;
+}
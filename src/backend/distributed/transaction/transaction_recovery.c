@@ -32,6 +32,7 @@
 #include "distributed/remote_commands.h"
 #include "distributed/transaction_recovery.h"
 #include "distributed/worker_manager.h"
+#include "executor/executor.h"
 #include "lib/stringinfo.h"
 #include "storage/lmgr.h"
 #include "storage/lock.h"
@@ -45,13 +46,44 @@
 PG_FUNCTION_INFO_V1(recover_prepared_transactions);
 
 
+/*
+ * PreparedTransactionRecovery describes how to recover a single prepared
+ * transaction on a worker.
+ */
+typedef struct PreparedTransactionRecovery
+{
+	char *transactionName;
+	bool shouldCommit;
+
+	/* recovery record to delete once the transaction is committed */
+	ItemPointerData recordId;
+} PreparedTransactionRecovery;
+
+
+/*
+ * WorkerTransactionRecovery holds the prepared transactions to recover on a
+ * worker, and how far we got.
+ */
+typedef struct WorkerTransactionRecovery
+{
+	MultiConnection *connection;
+	List *recoveryList;
+	ListCell *nextRecoveryCell;
+	bool commandSent;
+} WorkerTransactionRecovery;
+
+
 /* Local functions forward declarations */
-static int RecoverWorkerTransactions(WorkerNode *workerNode);
+static WorkerTransactionRecovery * PlanWorkerTransactionRecovery(WorkerNode *workerNode);
 static List * PendingWorkerTransactionList(MultiConnection *connection);
 static bool IsTransactionInProgress(HTAB *activeTransactionNumberSet,
 									char *preparedTransactionName);
-static bool RecoverPreparedTransactionOnWorker(MultiConnection *connection,
-											   char *transactionName, bool shouldCommit);
+static int ExecuteTransactionRecoveries(List *workerRecoveryList);
+static void AddPreparedTransactionRecovery(WorkerTransactionRecovery *workerRecovery,
+										   char *transactionName, bool shouldCommit,
+										   ItemPointer recordId);
+static char * PreparedTransactionRecoveryCommand(
+	PreparedTransactionRecovery *transactionRecovery);
 
 
 /*
@@ -78,27 +110,96 @@ recover_prepared_transactions(PG_FUNCTION_ARGS)
  */
 void
 LogTransactionRecord(int groupId, char *transactionName)
+{
+	LogTransactionRecords(list_make1_int(groupId), list_make1(transactionName));
+}
+
+
+/*
+ * LogTransactionRecords registers the transactions with the given names, which
+ * have been prepared on the workers of the given groups, in one go. The records
+ * of all workers of a distributed transaction are inserted into the same heap
+ * page where possible, which takes a single WAL record instead of one per
+ * worker.
+ */
+void
+LogTransactionRecords(List *groupIdList, List *transactionNameList)
 {
 	Relation pgDistTransaction = NULL;
 	TupleDesc tupleDescriptor = NULL;
-	HeapTuple heapTuple = NULL;
-	Datum values[Natts_pg_dist_transaction];
-	bool isNulls[Natts_pg_dist_transaction];
+	int recordCount = list_length(groupIdList);
+	HeapTuple *heapTupleArray = NULL;
+	EState *executorState = NULL;
+	ResultRelInfo *resultRelInfo = NULL;
+	TupleTableSlot *tupleTableSlot = NULL;
+	ListCell *groupIdCell = NULL;
+	ListCell *transactionNameCell = NULL;
+	int recordIndex = 0;
+
+	Assert(recordCount == list_length(transactionNameList));
+
+	if (recordCount == 0)
+	{
+		return;
+	}
+
+	/* open transaction relation and form the new transaction tuples */
+	pgDistTransaction = heap_open(DistTransactionRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistTransaction);
+
+	heapTupleArray = (HeapTuple *) palloc0(recordCount * sizeof(HeapTuple));
 
-	/* form new transaction tuple */
-	memset(values, 0, sizeof(values));
-	memset(isNulls, false, sizeof(isNulls));
+	forboth(groupIdCell, groupIdList, transactionNameCell, transactionNameList)
+	{
+		int groupId = lfirst_int(groupIdCell);
+		char *transactionName = (char *) lfirst(transactionNameCell);
+		Datum values[Natts_pg_dist_transaction];
+		bool isNulls[Natts_pg_dist_transaction];
 
-	values[Anum_pg_dist_transaction_groupid - 1] = Int32GetDatum(groupId);
-	values[Anum_pg_dist_transaction_gid - 1] = CStringGetTextDatum(transactionName);
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
 
-	/* open transaction relation and insert new tuple */
-	pgDistTransaction = heap_open(DistTransactionRelationId(), RowExclusiveLock);
+		values[Anum_pg_dist_transaction_groupid - 1] = Int32GetDatum(groupId);
+		values[Anum_pg_dist_transaction_gid - 1] = CStringGetTextDatum(transactionName);
 
-	tupleDescriptor = RelationGetDescr(pgDistTransaction);
-	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+		heapTupleArray[recordIndex++] = heap_form_tuple(tupleDescriptor, values,
+														 isNulls);
+	}
+
+	/* prepare to insert into the indexes, like COPY does */
+	executorState = CreateExecutorState();
+
+	resultRelInfo = makeNode(ResultRelInfo);
+#if (PG_VERSION_NUM >= 100000)
+	InitResultRelInfo(resultRelInfo, pgDistTransaction, 1, NULL, 0);
+#else
+	InitResultRelInfo(resultRelInfo, pgDistTransaction, 1, 0);
+#endif
+	ExecOpenIndices(resultRelInfo, false);
+
+	executorState->es_result_relations = resultRelInfo;
+	executorState->es_num_result_relations = 1;
+	executorState->es_result_relation_info = resultRelInfo;
+
+	tupleTableSlot = MakeSingleTupleTableSlot(tupleDescriptor);
 
-	CatalogTupleInsert(pgDistTransaction, heapTuple);
+	heap_multi_insert(pgDistTransaction, heapTupleArray, recordCount,
+					  GetCurrentCommandId(true), 0, NULL);
+
+	for (recordIndex = 0; recordIndex < recordCount; recordIndex++)
+	{
+		HeapTuple heapTuple = heapTupleArray[recordIndex];
+		List *recheckIndexList = NIL;
+
+		ExecStoreTuple(heapTuple, tupleTableSlot, InvalidBuffer, false);
+		recheckIndexList = ExecInsertIndexTuples(tupleTableSlot, &(heapTuple->t_self),
+												 executorState, false, NULL, NIL);
+		list_free(recheckIndexList);
+	}
+
+	ExecDropSingleTupleTableSlot(tupleTableSlot);
+	ExecCloseIndices(resultRelInfo);
+	FreeExecutorState(executorState);
 
 	CommandCounterIncrement();
 
@@ -110,35 +211,48 @@ LogTransactionRecord(int groupId, char *transactionName)
 /*
  * RecoverTwoPhaseCommits recovers any pending prepared
  * transactions started by this node on other nodes.
+ *
+ * We first decide which prepared transactions to commit or abort on each
+ * worker, and then send the COMMIT PREPARED and ROLLBACK PREPARED commands
+ * to all workers concurrently, such that the time it takes to recover after
+ * an outage does not add up across workers.
  */
 int
 RecoverTwoPhaseCommits(void)
 {
 	List *workerList = NIL;
 	ListCell *workerNodeCell = NULL;
-	int recoveredTransactionCount = 0;
+	List *workerRecoveryList = NIL;
 
 	workerList = ActivePrimaryNodeList();
 
 	foreach(workerNodeCell, workerList)
 	{
 		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		WorkerTransactionRecovery *workerRecovery =
+			PlanWorkerTransactionRecovery(workerNode);
 
-		recoveredTransactionCount += RecoverWorkerTransactions(workerNode);
+		if (workerRecovery != NULL)
+		{
+			workerRecoveryList = lappend(workerRecoveryList, workerRecovery);
+		}
 	}
 
-	return recoveredTransactionCount;
+	return ExecuteTransactionRecoveries(workerRecoveryList);
 }
 
 
 /*
- * RecoverWorkerTransactions recovers any pending prepared transactions
- * started by this node on the specified worker.
+ * PlanWorkerTransactionRecovery determines which pending prepared transactions
+ * started by this node on the specified worker should be committed or aborted.
+ * Recovery records of transactions that no longer have prepared transactions
+ * are removed right away. The function returns NULL if we cannot connect to
+ * the worker.
  */
-static int
-RecoverWorkerTransactions(WorkerNode *workerNode)
+static WorkerTransactionRecovery *
+PlanWorkerTransactionRecovery(WorkerNode *workerNode)
 {
-	int recoveredTransactionCount = 0;
+	WorkerTransactionRecovery *workerRecovery = NULL;
 
 	int groupId = workerNode->groupId;
 	char *nodeName = workerNode->workerName;
@@ -164,7 +278,7 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 
 	MemoryContext localContext = NULL;
 	MemoryContext oldContext = NULL;
-	bool recoveryFailed = false;
+	char *pendingTransactionName = NULL;
 
 	int connectionFlags = SESSION_LIFESPAN;
 	MultiConnection *connection = GetNodeConnection(connectionFlags, nodeName, nodePort);
@@ -173,9 +287,13 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 		ereport(WARNING, (errmsg("transaction recovery cannot connect to %s:%d",
 								 nodeName, nodePort)));
 
-		return 0;
+		return NULL;
 	}
 
+	/* the recovery plan outlives the lists and sets we build below */
+	workerRecovery = palloc0(sizeof(WorkerTransactionRecovery));
+	workerRecovery->connection = connection;
+
 	localContext = AllocSetContextCreate(CurrentMemoryContext,
 										 "RecoverWorkerTransactions",
 										 ALLOCSET_DEFAULT_MINSIZE,
@@ -279,33 +397,21 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 		{
 			/*
 			 * The transaction was committed, but the prepared transaction still exists
-			 * on the worker. Try committing it.
+			 * on the worker. Try committing it, and delete the recovery record once
+			 * that succeeded.
 			 *
 			 * We double check that the recovery record exists both before and after
 			 * checking ActiveDistributedTransactionNumbers(), since we may have
 			 * observed a prepared transaction that was committed immediately after.
 			 */
 			bool shouldCommit = true;
-			bool commitSucceeded = RecoverPreparedTransactionOnWorker(connection,
-																	  transactionName,
-																	  shouldCommit);
-			if (!commitSucceeded)
-			{
-				/*
-				 * Failed to commit on the current worker. Stop without throwing
-				 * an error to allow recover_prepared_transactions to continue with
-				 * other workers.
-				 */
-				recoveryFailed = true;
-				break;
-			}
 
-			recoveredTransactionCount++;
+			MemoryContextSwitchTo(oldContext);
+			AddPreparedTransactionRecovery(workerRecovery, transactionName,
+										   shouldCommit, &heapTuple->t_self);
+			MemoryContextSwitchTo(localContext);
 
-			/*
-			 * We successfully committed the prepared transaction, safe to delete
-			 * the recovery record.
-			 */
+			continue;
 		}
 		else if (foundPreparedTransactionAfterCommit)
 		{
@@ -356,51 +462,219 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 	systable_endscan(scanDescriptor);
 	heap_close(pgDistTransaction, NoLock);
 
-	if (!recoveryFailed)
+	/*
+	 * All remaining prepared transactions that are not part of an in-progress
+	 * distributed transaction should be aborted since we did not find a recovery
+	 * record, which implies the disributed transaction aborted. We abort them
+	 * after the commits, such that a failed commit also skips the aborts.
+	 */
+	hash_seq_init(&status, pendingTransactionSet);
+
+	while ((pendingTransactionName = hash_seq_search(&status)) != NULL)
 	{
-		char *pendingTransactionName = NULL;
-		bool abortSucceeded = true;
+		bool isTransactionInProgress = false;
+		bool shouldCommit = false;
 
-		/*
-		 * All remaining prepared transactions that are not part of an in-progress
-		 * distributed transaction should be aborted since we did not find a recovery
-		 * record, which implies the disributed transaction aborted.
-		 */
-		hash_seq_init(&status, pendingTransactionSet);
+		isTransactionInProgress = IsTransactionInProgress(activeTransactionNumberSet,
+														  pendingTransactionName);
+		if (isTransactionInProgress)
+		{
+			continue;
+		}
+
+		MemoryContextSwitchTo(oldContext);
+		AddPreparedTransactionRecovery(workerRecovery, pendingTransactionName,
+									   shouldCommit, NULL);
+		MemoryContextSwitchTo(localContext);
+	}
 
-		while ((pendingTransactionName = hash_seq_search(&status)) != NULL)
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(localContext);
+
+	workerRecovery->nextRecoveryCell = list_head(workerRecovery->recoveryList);
+
+	return workerRecovery;
+}
+
+
+/*
+ * AddPreparedTransactionRecovery adds a prepared transaction to commit or abort
+ * to the recovery plan of a worker. Commits need to come before aborts.
+ */
+static void
+AddPreparedTransactionRecovery(WorkerTransactionRecovery *workerRecovery,
+							   char *transactionName, bool shouldCommit,
+							   ItemPointer recordId)
+{
+	PreparedTransactionRecovery *transactionRecovery =
+		palloc0(sizeof(PreparedTransactionRecovery));
+
+	transactionRecovery->transactionName = pstrdup(transactionName);
+	transactionRecovery->shouldCommit = shouldCommit;
+
+	if (recordId != NULL)
+	{
+		ItemPointerCopy(recordId, &transactionRecovery->recordId);
+	}
+
+	workerRecovery->recoveryList = lappend(workerRecovery->recoveryList,
+										   transactionRecovery);
+}
+
+
+/*
+ * ExecuteTransactionRecoveries commits or aborts the prepared transactions in
+ * the given recovery plans. In each round, we send the next command to every
+ * worker that still has prepared transactions to recover, and then wait for
+ * all of them. Once a prepared transaction is committed, we delete its recovery
+ * record.
+ *
+ * If a command fails on a worker we stop recovering the transactions on that
+ * worker without throwing an error, to allow recover_prepared_transactions to
+ * continue with other workers. The function returns the number of recovered
+ * prepared transactions.
+ */
+static int
+ExecuteTransactionRecoveries(List *workerRecoveryList)
+{
+	int recoveredTransactionCount = 0;
+	Relation pgDistTransaction = NULL;
+	bool raiseInterrupts = true;
+
+	if (workerRecoveryList == NIL)
+	{
+		return 0;
+	}
+
+	/* we already hold this lock since planning the recovery */
+	pgDistTransaction = heap_open(DistTransactionRelationId(), ShareUpdateExclusiveLock);
+
+	for (;;)
+	{
+		List *connectionList = NIL;
+		ListCell *workerRecoveryCell = NULL;
+
+		/* send the next command to each worker in parallel */
+		foreach(workerRecoveryCell, workerRecoveryList)
 		{
-			bool isTransactionInProgress = false;
-			bool shouldCommit = false;
+			WorkerTransactionRecovery *workerRecovery =
+				(WorkerTransactionRecovery *) lfirst(workerRecoveryCell);
+			MultiConnection *connection = workerRecovery->connection;
+			PreparedTransactionRecovery *transactionRecovery = NULL;
+			char *command = NULL;
+			int querySent = 0;
 
-			isTransactionInProgress = IsTransactionInProgress(activeTransactionNumberSet,
-															  pendingTransactionName);
-			if (isTransactionInProgress)
+			workerRecovery->commandSent = false;
+
+			if (workerRecovery->nextRecoveryCell == NULL)
 			{
 				continue;
 			}
 
-			shouldCommit = false;
-			abortSucceeded = RecoverPreparedTransactionOnWorker(connection,
-																pendingTransactionName,
-																shouldCommit);
-			if (!abortSucceeded)
+			transactionRecovery = (PreparedTransactionRecovery *)
+								  lfirst(workerRecovery->nextRecoveryCell);
+			command = PreparedTransactionRecoveryCommand(transactionRecovery);
+
+			querySent = SendRemoteCommand(connection, command);
+			if (querySent == 0)
 			{
-				hash_seq_term(&status);
-				break;
+				ReportConnectionError(connection, WARNING);
+				workerRecovery->nextRecoveryCell = NULL;
+				continue;
+			}
+
+			workerRecovery->commandSent = true;
+			connectionList = lappend(connectionList, connection);
+		}
+
+		if (connectionList == NIL)
+		{
+			break;
+		}
+
+		WaitForAllConnections(connectionList, raiseInterrupts);
+
+		/* process the results of this round */
+		foreach(workerRecoveryCell, workerRecoveryList)
+		{
+			WorkerTransactionRecovery *workerRecovery =
+				(WorkerTransactionRecovery *) lfirst(workerRecoveryCell);
+			MultiConnection *connection = workerRecovery->connection;
+			PreparedTransactionRecovery *transactionRecovery = NULL;
+			PGresult *result = NULL;
+
+			if (!workerRecovery->commandSent)
+			{
+				continue;
+			}
+
+			transactionRecovery = (PreparedTransactionRecovery *)
+								  lfirst(workerRecovery->nextRecoveryCell);
+
+			result = GetRemoteCommandResult(connection, raiseInterrupts);
+			if (!IsResponseOK(result))
+			{
+				ReportResultError(connection, result, WARNING);
+				PQclear(result);
+				ClearResults(connection, raiseInterrupts);
+
+				workerRecovery->nextRecoveryCell = NULL;
+				continue;
+			}
+
+			PQclear(result);
+			ClearResults(connection, raiseInterrupts);
+
+			ereport(LOG, (errmsg("recovered a prepared transaction on %s:%d",
+								 connection->hostname, connection->port),
+						  errcontext("%s",
+									 PreparedTransactionRecoveryCommand(
+										 transactionRecovery))));
+
+			if (transactionRecovery->shouldCommit)
+			{
+				/* committed the prepared transaction, safe to delete the record */
+				simple_heap_delete(pgDistTransaction, &transactionRecovery->recordId);
 			}
 
 			recoveredTransactionCount++;
+
+			workerRecovery->nextRecoveryCell = lnext(workerRecovery->nextRecoveryCell);
 		}
 	}
 
-	MemoryContextSwitchTo(oldContext);
-	MemoryContextDelete(localContext);
+	heap_close(pgDistTransaction, NoLock);
 
 	return recoveredTransactionCount;
 }
 
 
+/*
+ * PreparedTransactionRecoveryCommand returns the COMMIT PREPARED or ROLLBACK
+ * PREPARED command to recover the given prepared transaction.
+ */
+static char *
+PreparedTransactionRecoveryCommand(PreparedTransactionRecovery *transactionRecovery)
+{
+	StringInfo command = makeStringInfo();
+
+	if (transactionRecovery->shouldCommit)
+	{
+		/* should have committed this prepared transaction */
+		appendStringInfo(command, "COMMIT PREPARED '%s'",
+						 transactionRecovery->transactionName);
+	}
+	else
+	{
+		/* should have aborted this prepared transaction */
+		appendStringInfo(command, "ROLLBACK PREPARED '%s'",
+						 transactionRecovery->transactionName);
+	}
+
+	return command->data;
+}
+
+
 /*
  * PendingWorkerTransactionList returns a list of pending prepared
  * transactions on a remote node that were started by this node.
@@ -476,48 +750,3 @@ IsTransactionInProgress(HTAB *activeTransactionNumberSet, char *preparedTransact
 
 	return isTransactionInProgress;
 }
-
-
-/*
- * RecoverPreparedTransactionOnWorker recovers a single prepared transaction over
- * the given connection. If shouldCommit is true we send
- */
-static bool
-RecoverPreparedTransactionOnWorker(MultiConnection *connection, char *transactionName,
-								   bool shouldCommit)
-{
-	StringInfo command = makeStringInfo();
-	PGresult *result = NULL;
-	int executeCommand = 0;
-	bool raiseInterrupts = false;
-
-	if (shouldCommit)
-	{
-		/* should have committed this prepared transaction */
-		appendStringInfo(command, "COMMIT PREPARED '%s'", transactionName);
-	}
-	else
-	{
-		/* should have aborted this prepared transaction */
-		appendStringInfo(command, "ROLLBACK PREPARED '%s'", transactionName);
-	}
-
-	executeCommand = ExecuteOptionalRemoteCommand(connection, command->data, &result);
-	if (executeCommand == QUERY_SEND_FAILED)
-	{
-		return false;
-	}
-	if (executeCommand == RESPONSE_NOT_OKAY)
-	{
-		return false;
-	}
-
-	PQclear(result);
-	ClearResults(connection, raiseInterrupts);
-
-	ereport(LOG, (errmsg("recovered a prepared transaction on %s:%d",
-						 connection->hostname, connection->port),
-				  errcontext("%s", command->data)));
-
-	return true;
-}
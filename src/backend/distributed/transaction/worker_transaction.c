@@ -22,6 +22,7 @@
 #include "distributed/connection_management.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_shard_transaction.h"
+#include "distributed/node_fanout.h"
 #include "distributed/resource_lock.h"
 #include "distributed/remote_commands.h"
 #include "distributed/pg_dist_node.h"
@@ -32,6 +33,12 @@
 #include "utils/memutils.h"
 
 
+static List * TargetWorkerCommandLists(TargetWorkerSet targetWorkerSet,
+									   List *commandList);
+static void RaiseWorkerCommandErrors(NodeCommandList *nodeCommandList,
+									 PGresult *result, void *callbackContext);
+
+
 /*
  * SendCommandToWorker sends a command to a particular worker as part of the
  * 2PC.
@@ -69,47 +76,46 @@ SendCommandToWorkers(TargetWorkerSet targetWorkerSet, char *command)
 
 
 /*
- * SendBareCommandListToWorkers sends a list of commands to a set of target
- * workers in serial. Commands are committed immediately: new connections are
- * always used and no transaction block is used (hence "bare"). The connections
+ * SendCommandListToWorkers sends a list of commands to a set of target workers
+ * in parallel. The commands are pipelined per worker, such that each worker
+ * gets its next command as soon as it finished the previous one. Commands are
+ * committed on the workers when the local transaction commits. The connections
  * are made as the extension owner to ensure write access to the Citus metadata
- * tables. Primarly useful for INDEX commands using CONCURRENTLY.
+ * tables.
  */
 void
-SendBareCommandListToWorkers(TargetWorkerSet targetWorkerSet, List *commandList)
+SendCommandListToWorkers(TargetWorkerSet targetWorkerSet, List *commandList)
 {
-	List *workerNodeList = ActivePrimaryNodeList();
-	ListCell *workerNodeCell = NULL;
+	List *nodeCommandListList = TargetWorkerCommandLists(targetWorkerSet, commandList);
 	char *nodeUser = CitusExtensionOwnerName();
-	ListCell *commandCell = NULL;
-
-	/* run commands serially */
-	foreach(workerNodeCell, workerNodeList)
-	{
-		MultiConnection *workerConnection = NULL;
-		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
-		char *nodeName = workerNode->workerName;
-		int nodePort = workerNode->workerPort;
-		int connectionFlags = FORCE_NEW_CONNECTION;
+	int connectionFlags = 0;
+	bool useTransaction = true;
 
-		if (targetWorkerSet == WORKERS_WITH_METADATA && !workerNode->hasMetadata)
-		{
-			continue;
-		}
+	BeginOrContinueCoordinatedTransaction();
+	CoordinatedTransactionUse2PC();
 
-		workerConnection = GetNodeUserDatabaseConnection(connectionFlags, nodeName,
-														 nodePort, nodeUser, NULL);
+	ExecuteNodeCommandLists(nodeCommandListList, connectionFlags, nodeUser,
+							useTransaction, RaiseWorkerCommandErrors, NULL);
+}
 
-		/* iterate over the commands and execute them in the same connection */
-		foreach(commandCell, commandList)
-		{
-			char *commandString = lfirst(commandCell);
 
-			ExecuteCriticalRemoteCommand(workerConnection, commandString);
-		}
+/*
+ * SendBareCommandListToWorkers sends a list of commands to a set of target
+ * workers in parallel. Commands are committed immediately: new connections are
+ * always used and no transaction block is used (hence "bare"). The connections
+ * are made as the extension owner to ensure write access to the Citus metadata
+ * tables. Primarly useful for INDEX commands using CONCURRENTLY.
+ */
+void
+SendBareCommandListToWorkers(TargetWorkerSet targetWorkerSet, List *commandList)
+{
+	List *nodeCommandListList = TargetWorkerCommandLists(targetWorkerSet, commandList);
+	char *nodeUser = CitusExtensionOwnerName();
+	int connectionFlags = FORCE_NEW_CONNECTION;
+	bool useTransaction = false;
 
-		CloseConnection(workerConnection);
-	}
+	ExecuteNodeCommandLists(nodeCommandListList, connectionFlags, nodeUser,
+							useTransaction, RaiseWorkerCommandErrors, NULL);
 }
 
 
@@ -126,74 +132,78 @@ SendCommandToWorkersParams(TargetWorkerSet targetWorkerSet, char *command,
 						   int parameterCount, const Oid *parameterTypes,
 						   const char *const *parameterValues)
 {
-	List *connectionList = NIL;
-	ListCell *connectionCell = NULL;
-	List *workerNodeList = ActivePrimaryNodeList();
-	ListCell *workerNodeCell = NULL;
+	List *nodeCommandListList = TargetWorkerCommandLists(targetWorkerSet,
+														 list_make1(command));
+	ListCell *nodeCommandListCell = NULL;
 	char *nodeUser = CitusExtensionOwnerName();
+	int connectionFlags = 0;
+	bool useTransaction = true;
+
+	foreach(nodeCommandListCell, nodeCommandListList)
+	{
+		NodeCommandList *nodeCommandList =
+			(NodeCommandList *) lfirst(nodeCommandListCell);
+
+		nodeCommandList->parameterCount = parameterCount;
+		nodeCommandList->parameterTypes = parameterTypes;
+		nodeCommandList->parameterValues = parameterValues;
+	}
 
 	BeginOrContinueCoordinatedTransaction();
 	CoordinatedTransactionUse2PC();
 
-	/* open connections in parallel */
+	ExecuteNodeCommandLists(nodeCommandListList, connectionFlags, nodeUser,
+							useTransaction, RaiseWorkerCommandErrors, NULL);
+}
+
+
+/*
+ * TargetWorkerCommandLists returns a node command list with the given commands
+ * for each of the target workers.
+ */
+static List *
+TargetWorkerCommandLists(TargetWorkerSet targetWorkerSet, List *commandList)
+{
+	List *nodeCommandListList = NIL;
+	List *workerNodeList = ActivePrimaryNodeList();
+	ListCell *workerNodeCell = NULL;
+
 	foreach(workerNodeCell, workerNodeList)
 	{
 		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
-		char *nodeName = workerNode->workerName;
-		int nodePort = workerNode->workerPort;
-		MultiConnection *connection = NULL;
-		int connectionFlags = 0;
+		NodeCommandList *nodeCommandList = NULL;
 
 		if (targetWorkerSet == WORKERS_WITH_METADATA && !workerNode->hasMetadata)
 		{
 			continue;
 		}
 
-		connection = StartNodeUserDatabaseConnection(connectionFlags, nodeName, nodePort,
-													 nodeUser, NULL);
-
-		MarkRemoteTransactionCritical(connection);
-
-		connectionList = lappend(connectionList, connection);
+		nodeCommandList = MakeNodeCommandList(workerNode->workerName,
+											  workerNode->workerPort, commandList);
+		nodeCommandListList = lappend(nodeCommandListList, nodeCommandList);
 	}
 
-	/* finish opening connections */
-	foreach(connectionCell, connectionList)
-	{
-		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+	return nodeCommandListList;
+}
 
-		FinishConnectionEstablishment(connection);
-	}
 
-	RemoteTransactionsBeginIfNecessary(connectionList);
+/*
+ * RaiseWorkerCommandErrors is the result callback of the commands sent to the
+ * workers, which errors out on the first failure.
+ */
+static void
+RaiseWorkerCommandErrors(NodeCommandList *nodeCommandList, PGresult *result,
+						 void *callbackContext)
+{
+	MultiConnection *connection = nodeCommandList->connection;
 
-	/* send commands in parallel */
-	foreach(connectionCell, connectionList)
+	if (result == NULL)
 	{
-		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
-
-		int querySent = SendRemoteCommandParams(connection, command, parameterCount,
-												parameterTypes, parameterValues);
-		if (querySent == 0)
-		{
-			ReportConnectionError(connection, ERROR);
-		}
+		ReportConnectionError(connection, ERROR);
 	}
-
-	/* get results */
-	foreach(connectionCell, connectionList)
+	else if (!IsResponseOK(result))
 	{
-		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
-
-		PGresult *result = GetRemoteCommandResult(connection, true);
-		if (!IsResponseOK(result))
-		{
-			ReportResultError(connection, result, ERROR);
-		}
-
-		PQclear(result);
-
-		ForgetResults(connection);
+		ReportResultError(connection, result, ERROR);
 	}
 }
 
@@ -0,0 +1,572 @@
+/*-------------------------------------------------------------------------
+ *
+ * aggregate_utils.c
+ *
+ * This file contains the aggregates that push down aggregates which have
+ * combine functions, but which Citus does not otherwise know how to split:
+ * worker_partial_agg() computes an aggregate's transition state on a worker,
+ * and returns the state as text. coord_combine_agg() then combines these
+ * states on the coordinator, and applies the aggregate's final function.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_type.h"
+#include "fmgr.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/expandeddatum.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
+
+
+/*
+ * StypeBox holds the transition state of the aggregate that we compute on
+ * behalf of worker_partial_agg() or coord_combine_agg(), along with what we
+ * need to know about the state's type.
+ */
+typedef struct StypeBox
+{
+	Datum value;
+	Oid aggregateId;
+	Oid transitionType;
+	int16 transitionTypeLength;
+	bool transitionTypeByValue;
+	bool valueNull;
+	bool valueInitialized;
+} StypeBox;
+
+
+/* local function forward declarations */
+static HeapTuple GetAggregateForm(Oid aggregateId, Form_pg_aggregate *aggregateForm);
+static void InitializeStypeBox(StypeBox *box, HeapTuple aggregateTuple,
+							   MemoryContext aggregateContext);
+static void HandleTransition(StypeBox *box, FunctionCallInfo innerFcinfo,
+							 MemoryContext aggregateContext);
+static Datum SerializeTransitionState(StypeBox *box, Form_pg_aggregate aggregateForm,
+									  FunctionCallInfo fcinfo);
+static Datum DeserializeTransitionState(text *stateText, StypeBox *box,
+										Form_pg_aggregate aggregateForm,
+										FunctionCallInfo fcinfo);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(worker_partial_agg_sfunc);
+PG_FUNCTION_INFO_V1(worker_partial_agg_ffunc);
+PG_FUNCTION_INFO_V1(coord_combine_agg_sfunc);
+PG_FUNCTION_INFO_V1(coord_combine_agg_ffunc);
+
+
+/*
+ * worker_partial_agg_sfunc is the transition function of worker_partial_agg().
+ * It applies the transition function of the aggregate given as its second
+ * argument to the aggregate's argument.
+ */
+Datum
+worker_partial_agg_sfunc(PG_FUNCTION_ARGS)
+{
+	StypeBox *box = NULL;
+	Form_pg_aggregate aggregateForm = NULL;
+	HeapTuple aggregateTuple = NULL;
+	FmgrInfo transitionFunction;
+	FunctionCallInfoData innerFcinfoData;
+	MemoryContext aggregateContext = NULL;
+	bool initialCall = PG_ARGISNULL(0);
+
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, (errmsg("worker_partial_agg_sfunc called from a "
+							   "non-aggregate context")));
+	}
+
+	if (initialCall)
+	{
+		if (PG_ARGISNULL(1))
+		{
+			ereport(ERROR, (errmsg("worker_partial_agg_sfunc could not identify "
+								   "the aggregate")));
+		}
+
+		box = MemoryContextAllocZero(aggregateContext, sizeof(StypeBox));
+		box->aggregateId = PG_GETARG_OID(1);
+	}
+	else
+	{
+		box = (StypeBox *) PG_GETARG_POINTER(0);
+	}
+
+	aggregateTuple = GetAggregateForm(box->aggregateId, &aggregateForm);
+
+	if (initialCall)
+	{
+		InitializeStypeBox(box, aggregateTuple, aggregateContext);
+	}
+
+	fmgr_info(aggregateForm->aggtransfn, &transitionFunction);
+	ReleaseSysCache(aggregateTuple);
+
+	/* a strict transition function starts out with the first non-null input */
+	if (transitionFunction.fn_strict)
+	{
+		if (PG_ARGISNULL(2) || (box->valueInitialized && box->valueNull))
+		{
+			PG_RETURN_POINTER(box);
+		}
+
+		if (!box->valueInitialized)
+		{
+			MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+			box->value = datumCopy(PG_GETARG_DATUM(2), box->transitionTypeByValue,
+								   box->transitionTypeLength);
+			box->valueNull = false;
+			box->valueInitialized = true;
+
+			MemoryContextSwitchTo(oldContext);
+
+			PG_RETURN_POINTER(box);
+		}
+	}
+
+	InitFunctionCallInfoData(innerFcinfoData, &transitionFunction, 2,
+							 fcinfo->fncollation, fcinfo->context, fcinfo->resultinfo);
+	innerFcinfoData.arg[0] = box->value;
+	innerFcinfoData.argnull[0] = box->valueNull;
+	innerFcinfoData.arg[1] = PG_GETARG_DATUM(2);
+	innerFcinfoData.argnull[1] = PG_ARGISNULL(2);
+
+	HandleTransition(box, &innerFcinfoData, aggregateContext);
+
+	PG_RETURN_POINTER(box);
+}
+
+
+/*
+ * worker_partial_agg_ffunc is the final function of worker_partial_agg(). It
+ * returns the aggregate's transition state in its text form, which is what
+ * coord_combine_agg() takes as input. States of type internal are serialized
+ * through the aggregate's serialization function first.
+ */
+Datum
+worker_partial_agg_ffunc(PG_FUNCTION_ARGS)
+{
+	StypeBox *box = NULL;
+	Form_pg_aggregate aggregateForm = NULL;
+	HeapTuple aggregateTuple = NULL;
+	Datum stateText = 0;
+
+	if (PG_ARGISNULL(0))
+	{
+		PG_RETURN_NULL();
+	}
+
+	box = (StypeBox *) PG_GETARG_POINTER(0);
+	if (box->valueNull)
+	{
+		PG_RETURN_NULL();
+	}
+
+	aggregateTuple = GetAggregateForm(box->aggregateId, &aggregateForm);
+	stateText = SerializeTransitionState(box, aggregateForm, fcinfo);
+	ReleaseSysCache(aggregateTuple);
+
+	if (fcinfo->isnull)
+	{
+		PG_RETURN_NULL();
+	}
+
+	PG_RETURN_DATUM(stateText);
+}
+
+
+/*
+ * coord_combine_agg_sfunc is the transition function of coord_combine_agg().
+ * It combines the transition state computed by worker_partial_agg() on a
+ * worker into the state it keeps, using the aggregate's combine function.
+ */
+Datum
+coord_combine_agg_sfunc(PG_FUNCTION_ARGS)
+{
+	StypeBox *box = NULL;
+	Form_pg_aggregate aggregateForm = NULL;
+	HeapTuple aggregateTuple = NULL;
+	FmgrInfo combineFunction;
+	FunctionCallInfoData innerFcinfoData;
+	MemoryContext aggregateContext = NULL;
+	Datum workerState = 0;
+	bool initialCall = PG_ARGISNULL(0);
+
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, (errmsg("coord_combine_agg_sfunc called from a "
+							   "non-aggregate context")));
+	}
+
+	if (initialCall)
+	{
+		if (PG_ARGISNULL(1))
+		{
+			ereport(ERROR, (errmsg("coord_combine_agg_sfunc could not identify "
+								   "the aggregate")));
+		}
+
+		box = MemoryContextAllocZero(aggregateContext, sizeof(StypeBox));
+		box->aggregateId = PG_GETARG_OID(1);
+	}
+	else
+	{
+		box = (StypeBox *) PG_GETARG_POINTER(0);
+	}
+
+	aggregateTuple = GetAggregateForm(box->aggregateId, &aggregateForm);
+
+	if (initialCall)
+	{
+		InitializeStypeBox(box, aggregateTuple, aggregateContext);
+	}
+
+	if (aggregateForm->aggcombinefn == InvalidOid)
+	{
+		ereport(ERROR, (errmsg("coord_combine_agg_sfunc expects an aggregate "
+							   "with a combine function")));
+	}
+
+	/* workers that saw no rows for this group send no state */
+	if (PG_ARGISNULL(2))
+	{
+		ReleaseSysCache(aggregateTuple);
+		PG_RETURN_POINTER(box);
+	}
+
+	workerState = DeserializeTransitionState(PG_GETARG_TEXT_PP(2), box,
+											 aggregateForm, fcinfo);
+
+	fmgr_info(aggregateForm->aggcombinefn, &combineFunction);
+	ReleaseSysCache(aggregateTuple);
+
+	/*
+	 * A strict combine function starts out with the first state. Combine
+	 * functions over internal states are never strict, and the deserialized
+	 * states of other types are ordinary datums that we copy.
+	 */
+	if (combineFunction.fn_strict && box->valueNull)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+		box->value = datumCopy(workerState, box->transitionTypeByValue,
+							   box->transitionTypeLength);
+		box->valueNull = false;
+		box->valueInitialized = true;
+
+		MemoryContextSwitchTo(oldContext);
+
+		PG_RETURN_POINTER(box);
+	}
+
+	InitFunctionCallInfoData(innerFcinfoData, &combineFunction, 2,
+							 fcinfo->fncollation, fcinfo->context, fcinfo->resultinfo);
+	innerFcinfoData.arg[0] = box->value;
+	innerFcinfoData.argnull[0] = box->valueNull;
+	innerFcinfoData.arg[1] = workerState;
+	innerFcinfoData.argnull[1] = false;
+
+	HandleTransition(box, &innerFcinfoData, aggregateContext);
+
+	PG_RETURN_POINTER(box);
+}
+
+
+/*
+ * coord_combine_agg_ffunc is the final function of coord_combine_agg(). It
+ * applies the aggregate's final function to the combined transition state.
+ * Its last argument is a null of the aggregate's result type, which we only
+ * have so that PostgreSQL knows the type that coord_combine_agg() returns.
+ */
+Datum
+coord_combine_agg_ffunc(PG_FUNCTION_ARGS)
+{
+	StypeBox *box = NULL;
+	Form_pg_aggregate aggregateForm = NULL;
+	HeapTuple aggregateTuple = NULL;
+	FmgrInfo finalFunction;
+	FunctionCallInfoData innerFcinfoData;
+	Oid finalFunctionId = InvalidOid;
+	bool finalFunctionExtra = false;
+	int argumentCount = 1;
+	Datum result = 0;
+
+	if (PG_ARGISNULL(0))
+	{
+		PG_RETURN_NULL();
+	}
+
+	box = (StypeBox *) PG_GETARG_POINTER(0);
+
+	aggregateTuple = GetAggregateForm(box->aggregateId, &aggregateForm);
+	finalFunctionId = aggregateForm->aggfinalfn;
+	finalFunctionExtra = aggregateForm->aggfinalextra;
+	ReleaseSysCache(aggregateTuple);
+
+	if (finalFunctionId == InvalidOid)
+	{
+		if (box->valueNull)
+		{
+			PG_RETURN_NULL();
+		}
+
+		PG_RETURN_DATUM(box->value);
+	}
+
+	fmgr_info(finalFunctionId, &finalFunction);
+	if (finalFunction.fn_strict && box->valueNull)
+	{
+		PG_RETURN_NULL();
+	}
+
+	/* we only push down aggregates with a single argument */
+	if (finalFunctionExtra)
+	{
+		argumentCount = 2;
+	}
+
+	InitFunctionCallInfoData(innerFcinfoData, &finalFunction, argumentCount,
+							 fcinfo->fncollation, fcinfo->context, fcinfo->resultinfo);
+	innerFcinfoData.arg[0] = box->value;
+	innerFcinfoData.argnull[0] = box->valueNull;
+	if (finalFunctionExtra)
+	{
+		innerFcinfoData.arg[1] = (Datum) 0;
+		innerFcinfoData.argnull[1] = true;
+	}
+
+	result = FunctionCallInvoke(&innerFcinfoData);
+	if (innerFcinfoData.isnull)
+	{
+		PG_RETURN_NULL();
+	}
+
+	PG_RETURN_DATUM(result);
+}
+
+
+/*
+ * GetAggregateForm looks up the pg_aggregate tuple of the given aggregate, and
+ * returns it along with its form. The caller releases the tuple.
+ */
+static HeapTuple
+GetAggregateForm(Oid aggregateId, Form_pg_aggregate *aggregateForm)
+{
+	HeapTuple aggregateTuple = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggregateId));
+	if (!HeapTupleIsValid(aggregateTuple))
+	{
+		ereport(ERROR, (errmsg("cache lookup failed for aggregate %u", aggregateId)));
+	}
+
+	*aggregateForm = (Form_pg_aggregate) GETSTRUCT(aggregateTuple);
+
+	return aggregateTuple;
+}
+
+
+/*
+ * InitializeStypeBox sets up the box for the aggregate's transition type, and
+ * sets its value to the aggregate's initial value, if the aggregate has one.
+ */
+static void
+InitializeStypeBox(StypeBox *box, HeapTuple aggregateTuple,
+				   MemoryContext aggregateContext)
+{
+	Form_pg_aggregate aggregateForm = (Form_pg_aggregate) GETSTRUCT(aggregateTuple);
+	Oid transitionType = aggregateForm->aggtranstype;
+	Datum initialValueText = 0;
+	bool initialValueNull = true;
+
+	box->transitionType = transitionType;
+	get_typlenbyval(transitionType, &box->transitionTypeLength,
+					&box->transitionTypeByValue);
+
+	initialValueText = SysCacheGetAttr(AGGFNOID, aggregateTuple,
+									   Anum_pg_aggregate_agginitval,
+									   &initialValueNull);
+	if (initialValueNull)
+	{
+		box->value = (Datum) 0;
+		box->valueNull = true;
+		box->valueInitialized = false;
+	}
+	else
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+		char *initialValueString = TextDatumGetCString(initialValueText);
+		Oid typeInputFunction = InvalidOid;
+		Oid typeIOParam = InvalidOid;
+
+		getTypeInputInfo(transitionType, &typeInputFunction, &typeIOParam);
+		box->value = OidInputFunctionCall(typeInputFunction, initialValueString,
+										  typeIOParam, -1);
+		box->valueNull = false;
+		box->valueInitialized = true;
+
+		MemoryContextSwitchTo(oldContext);
+	}
+}
+
+
+/*
+ * HandleTransition calls the given transition or combine function, and stores
+ * its result as the box's new value. As in PostgreSQL's nodeAgg.c, new values
+ * of pass-by-reference types are copied into the aggregate context, and the
+ * previous values are freed.
+ */
+static void
+HandleTransition(StypeBox *box, FunctionCallInfo innerFcinfo,
+				 MemoryContext aggregateContext)
+{
+	Datum newValue = FunctionCallInvoke(innerFcinfo);
+	bool newValueNull = innerFcinfo->isnull;
+
+	if (!box->transitionTypeByValue &&
+		DatumGetPointer(newValue) != DatumGetPointer(box->value))
+	{
+		if (!newValueNull)
+		{
+			MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+			if (!(DatumIsReadWriteExpandedObject(newValue, false,
+												 box->transitionTypeLength) &&
+				  MemoryContextGetParent(DatumGetEOHP(newValue)->eoh_context) ==
+				  CurrentMemoryContext))
+			{
+				newValue = datumCopy(newValue, box->transitionTypeByValue,
+									 box->transitionTypeLength);
+			}
+
+			MemoryContextSwitchTo(oldContext);
+		}
+
+		if (!box->valueNull)
+		{
+			if (DatumIsReadWriteExpandedObject(box->value, false,
+											   box->transitionTypeLength))
+			{
+				DeleteExpandedObject(box->value);
+			}
+			else
+			{
+				pfree(DatumGetPointer(box->value));
+			}
+		}
+	}
+
+	box->value = newValue;
+	box->valueNull = newValueNull;
+	box->valueInitialized = true;
+}
+
+
+/*
+ * SerializeTransitionState returns the text form of the box's value. Values of
+ * type internal go through the aggregate's serialization function and are
+ * then sent as the text form of the resulting bytea. The function sets
+ * fcinfo->isnull if the serialized state is null.
+ */
+static Datum
+SerializeTransitionState(StypeBox *box, Form_pg_aggregate aggregateForm,
+						 FunctionCallInfo fcinfo)
+{
+	char *stateString = NULL;
+
+	if (box->transitionType == INTERNALOID)
+	{
+		FmgrInfo serialFunction;
+		FunctionCallInfoData innerFcinfoData;
+		Datum serializedState = 0;
+
+		if (aggregateForm->aggserialfn == InvalidOid)
+		{
+			ereport(ERROR, (errmsg("worker_partial_agg_ffunc expects an aggregate "
+								   "with a serialization function")));
+		}
+
+		fmgr_info(aggregateForm->aggserialfn, &serialFunction);
+		InitFunctionCallInfoData(innerFcinfoData, &serialFunction, 1,
+								 fcinfo->fncollation, fcinfo->context,
+								 fcinfo->resultinfo);
+		innerFcinfoData.arg[0] = box->value;
+		innerFcinfoData.argnull[0] = box->valueNull;
+
+		serializedState = FunctionCallInvoke(&innerFcinfoData);
+		if (innerFcinfoData.isnull)
+		{
+			fcinfo->isnull = true;
+			return (Datum) 0;
+		}
+
+		stateString = DatumGetCString(DirectFunctionCall1(byteaout, serializedState));
+	}
+	else
+	{
+		Oid typeOutputFunction = InvalidOid;
+		bool typeIsVarlena = false;
+
+		getTypeOutputInfo(box->transitionType, &typeOutputFunction, &typeIsVarlena);
+		stateString = OidOutputFunctionCall(typeOutputFunction, box->value);
+	}
+
+	return CStringGetTextDatum(stateString);
+}
+
+
+/*
+ * DeserializeTransitionState reverses SerializeTransitionState, and returns
+ * the transition state that the given text represents.
+ */
+static Datum
+DeserializeTransitionState(text *stateText, StypeBox *box,
+						   Form_pg_aggregate aggregateForm, FunctionCallInfo fcinfo)
+{
+	char *stateString = text_to_cstring(stateText);
+	Datum workerState = 0;
+
+	if (box->transitionType == INTERNALOID)
+	{
+		FmgrInfo deserialFunction;
+		FunctionCallInfoData innerFcinfoData;
+		Datum serializedState = DirectFunctionCall1(byteain,
+													CStringGetDatum(stateString));
+
+		if (aggregateForm->aggdeserialfn == InvalidOid)
+		{
+			ereport(ERROR, (errmsg("coord_combine_agg_sfunc expects an aggregate "
+								   "with a deserialization function")));
+		}
+
+		fmgr_info(aggregateForm->aggdeserialfn, &deserialFunction);
+		InitFunctionCallInfoData(innerFcinfoData, &deserialFunction, 2,
+								 fcinfo->fncollation, fcinfo->context,
+								 fcinfo->resultinfo);
+		innerFcinfoData.arg[0] = serializedState;
+		innerFcinfoData.argnull[0] = false;
+		innerFcinfoData.arg[1] = PointerGetDatum(NULL);
+		innerFcinfoData.argnull[1] = false;
+
+		workerState = FunctionCallInvoke(&innerFcinfoData);
+	}
+	else
+	{
+		Oid typeInputFunction = InvalidOid;
+		Oid typeIOParam = InvalidOid;
+
+		getTypeInputInfo(box->transitionType, &typeInputFunction, &typeIOParam);
+		workerState = OidInputFunctionCall(typeInputFunction, stateString,
+										   typeIOParam, -1);
+	}
+
+	return workerState;
+}
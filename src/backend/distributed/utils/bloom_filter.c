@@ -0,0 +1,294 @@
+/*-------------------------------------------------------------------------
+ *
+ * bloom_filter.c
+ *   Fixed-size Bloom filters over 32-bit hash values, and routines to store
+ *   them in and load them from files.
+ *
+ * We derive the bit positions for a value from its hash through double
+ * hashing, so callers only need to compute one hash per value. We typically
+ * add the same hash values that repartitioning already computes.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "distributed/bloom_filter.h"
+#include "storage/fd.h"
+
+
+/* smallest filter we create, in bits */
+#define MIN_BLOOM_FILTER_BIT_COUNT 64
+#define MAX_BLOOM_FILTER_BIT_COUNT ((uint32) 1 << 31)
+
+
+static uint32 BloomFilterSize(uint32 bitCount);
+static bool BloomFilterHeaderIsValid(BloomFilter *filterHeader);
+static uint32 SecondaryHash(uint32 hashValue);
+
+
+/*
+ * CreateBloomFilter creates an empty Bloom filter that uses at most the given
+ * number of bytes for its bits. The bit count is rounded down to a power of
+ * two so that we can use masks to map hash values onto bits.
+ */
+BloomFilter *
+CreateBloomFilter(uint32 byteCount)
+{
+	BloomFilter *filter = NULL;
+	uint32 bitCount = MIN_BLOOM_FILTER_BIT_COUNT;
+	uint64 maxBitCount = Min((uint64) byteCount * 8, MAX_BLOOM_FILTER_BIT_COUNT);
+
+	while ((uint64) bitCount * 2 <= maxBitCount)
+	{
+		bitCount *= 2;
+	}
+
+	filter = (BloomFilter *) palloc0(BloomFilterSize(bitCount));
+	filter->bitCount = bitCount;
+	filter->hashCount = BLOOM_FILTER_HASH_COUNT;
+
+	return filter;
+}
+
+
+/*
+ * BloomFilterAdd sets the bits for the given hash value in the filter.
+ */
+void
+BloomFilterAdd(BloomFilter *filter, uint32 hashValue)
+{
+	uint32 bitMask = filter->bitCount - 1;
+	uint32 secondaryHash = SecondaryHash(hashValue);
+	uint32 bitIndex = hashValue;
+	uint32 hashIndex = 0;
+
+	for (hashIndex = 0; hashIndex < filter->hashCount; hashIndex++)
+	{
+		uint32 bitNumber = bitIndex & bitMask;
+
+		filter->bitArray[bitNumber / 8] |= (uint8) (1 << (bitNumber % 8));
+		bitIndex += secondaryHash;
+	}
+}
+
+
+/*
+ * BloomFilterMightContain returns false if the given hash value was certainly
+ * never added to the filter, and true if it may have been.
+ */
+bool
+BloomFilterMightContain(BloomFilter *filter, uint32 hashValue)
+{
+	uint32 bitMask = filter->bitCount - 1;
+	uint32 secondaryHash = SecondaryHash(hashValue);
+	uint32 bitIndex = hashValue;
+	uint32 hashIndex = 0;
+
+	for (hashIndex = 0; hashIndex < filter->hashCount; hashIndex++)
+	{
+		uint32 bitNumber = bitIndex & bitMask;
+
+		if ((filter->bitArray[bitNumber / 8] & (1 << (bitNumber % 8))) == 0)
+		{
+			return false;
+		}
+
+		bitIndex += secondaryHash;
+	}
+
+	return true;
+}
+
+
+/*
+ * BloomFilterUnion adds all values in the source filter to the target filter.
+ * Both filters need to have the same shape.
+ */
+void
+BloomFilterUnion(BloomFilter *targetFilter, BloomFilter *sourceFilter)
+{
+	uint32 byteCount = targetFilter->bitCount / 8;
+	uint32 byteIndex = 0;
+
+	if (targetFilter->bitCount != sourceFilter->bitCount ||
+		targetFilter->hashCount != sourceFilter->hashCount)
+	{
+		ereport(ERROR, (errmsg("cannot merge bloom filters of different sizes")));
+	}
+
+	for (byteIndex = 0; byteIndex < byteCount; byteIndex++)
+	{
+		targetFilter->bitArray[byteIndex] |= sourceFilter->bitArray[byteIndex];
+	}
+}
+
+
+/*
+ * WriteBloomFilter writes the given filter into a new file with the given name.
+ */
+void
+WriteBloomFilter(BloomFilter *filter, const char *filename)
+{
+	uint32 filterSize = BloomFilterSize(filter->bitCount);
+	FILE *filterFile = AllocateFile(filename, PG_BINARY_W);
+
+	if (filterFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", filename)));
+	}
+
+	if (fwrite(filter, 1, filterSize, filterFile) != filterSize)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not write to file \"%s\": %m", filename)));
+	}
+
+	if (FreeFile(filterFile) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not close file \"%s\": %m", filename)));
+	}
+}
+
+
+/*
+ * ReadBloomFilter reads a filter written by WriteBloomFilter back from the file
+ * with the given name, and checks that the filter is well formed.
+ */
+BloomFilter *
+ReadBloomFilter(const char *filename)
+{
+	BloomFilter filterHeader;
+	BloomFilter *filter = NULL;
+	uint32 headerSize = offsetof(BloomFilter, bitArray);
+	uint32 bitCount = 0;
+	FILE *filterFile = AllocateFile(filename, PG_BINARY_R);
+
+	if (filterFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", filename)));
+	}
+
+	if (fread(&filterHeader, 1, headerSize, filterFile) != headerSize)
+	{
+		ereport(ERROR, (errmsg("could not read bloom filter from file \"%s\"",
+							   filename)));
+	}
+
+	bitCount = filterHeader.bitCount;
+	if (!BloomFilterHeaderIsValid(&filterHeader))
+	{
+		ereport(ERROR, (errmsg("invalid bloom filter in file \"%s\"", filename)));
+	}
+
+	filter = (BloomFilter *) palloc(BloomFilterSize(bitCount));
+	filter->bitCount = bitCount;
+	filter->hashCount = filterHeader.hashCount;
+
+	if (fread(filter->bitArray, 1, bitCount / 8, filterFile) != bitCount / 8)
+	{
+		ereport(ERROR, (errmsg("could not read bloom filter from file \"%s\"",
+							   filename)));
+	}
+
+	FreeFile(filterFile);
+
+	return filter;
+}
+
+
+/*
+ * BloomFilterToBytea returns the given filter as a bytea value, in the same
+ * format in which WriteBloomFilter stores it in a file.
+ */
+bytea *
+BloomFilterToBytea(BloomFilter *filter)
+{
+	uint32 filterSize = BloomFilterSize(filter->bitCount);
+	bytea *filterBytes = (bytea *) palloc(filterSize + VARHDRSZ);
+
+	SET_VARSIZE(filterBytes, filterSize + VARHDRSZ);
+	memcpy(VARDATA(filterBytes), filter, filterSize);
+
+	return filterBytes;
+}
+
+
+/*
+ * ByteaToBloomFilter reads a filter from a bytea value created by
+ * BloomFilterToBytea, and checks that the filter is well formed.
+ */
+BloomFilter *
+ByteaToBloomFilter(bytea *filterBytes)
+{
+	BloomFilter filterHeader;
+	BloomFilter *filter = NULL;
+	uint32 headerSize = offsetof(BloomFilter, bitArray);
+	uint32 dataSize = VARSIZE_ANY_EXHDR(filterBytes);
+
+	if (dataSize < headerSize)
+	{
+		ereport(ERROR, (errmsg("invalid bloom filter")));
+	}
+
+	memcpy(&filterHeader, VARDATA_ANY(filterBytes), headerSize);
+
+	if (!BloomFilterHeaderIsValid(&filterHeader) ||
+		dataSize != BloomFilterSize(filterHeader.bitCount))
+	{
+		ereport(ERROR, (errmsg("invalid bloom filter")));
+	}
+
+	filter = (BloomFilter *) palloc(dataSize);
+	memcpy(filter, VARDATA_ANY(filterBytes), dataSize);
+
+	return filter;
+}
+
+
+/* BloomFilterSize returns the number of bytes a filter with bitCount bits uses. */
+static uint32
+BloomFilterSize(uint32 bitCount)
+{
+	return offsetof(BloomFilter, bitArray) + bitCount / 8;
+}
+
+
+/*
+ * BloomFilterHeaderIsValid returns whether the bit and hash counts of a filter
+ * that we read back are ones that CreateBloomFilter could have produced.
+ */
+static bool
+BloomFilterHeaderIsValid(BloomFilter *filterHeader)
+{
+	uint32 bitCount = filterHeader->bitCount;
+
+	if (bitCount < MIN_BLOOM_FILTER_BIT_COUNT || (bitCount & (bitCount - 1)) != 0)
+	{
+		return false;
+	}
+
+	if (filterHeader->hashCount == 0 || filterHeader->hashCount > 32)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * SecondaryHash derives the step between the bit positions of a hash value. We
+ * make the step odd, so that it never maps all positions onto the same bit.
+ */
+static uint32
+SecondaryHash(uint32 hashValue)
+{
+	return DatumGetUInt32(hash_uint32(hashValue)) | 1;
+}
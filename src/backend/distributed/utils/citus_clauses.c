@@ -12,6 +12,7 @@
 #include "distributed/insert_select_planner.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_router_planner.h"
+#include "distributed/sequence_ranges.h"
 
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
@@ -23,6 +24,7 @@
 #include "optimizer/clauses.h"
 #include "optimizer/planmain.h"
 #include "utils/datum.h"
+#include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 
 
@@ -33,9 +35,30 @@ typedef struct FunctionEvaluationContext
 } FunctionEvaluationContext;
 
 
+/*
+ * CompiledValuesExpression holds the executor state of an expression that was
+ * evaluated for a column of a VALUES RTE, such that other rows that have the
+ * same expression in that column, such as a column default that calls now()
+ * or nextval(), can be evaluated without compiling the expression again.
+ */
+typedef struct CompiledValuesExpression
+{
+	Expr *expression;
+	ExprState *expressionState;
+	int16 resultTypLen;
+	bool resultTypByVal;
+} CompiledValuesExpression;
+
+
 /* private function declarations */
 static void EvaluateValuesListsItems(List *valuesLists, PlanState *planState);
+static bool IsEvaluatedNodeType(Node *expression);
+static bool ContainsNodeEvaluatedOnlyInParts(Node *expression, void *context);
+static Expr * EvaluateCompiledValuesExpression(CompiledValuesExpression *compiledExpr,
+											   ExprContext *econtext);
 static Node * EvaluateNodeIfReferencesFunction(Node *expression, PlanState *planState);
+static Oid RangeAllocatedNextvalSequenceId(Node *expression);
+static bool ContainsRangeAllocatedNextval(Node *expression, void *context);
 static Node * PartiallyEvaluateExpressionMutator(Node *expression,
 												 FunctionEvaluationContext *context);
 static Expr * citus_evaluate_expr(Expr *expr, Oid result_type, int32 result_typmod,
@@ -168,30 +191,181 @@ ExecuteMasterEvaluableFunctions(Query *query, PlanState *planState)
  * in each value list contained in a multi-row INSERT's VALUES RTE. Basically
  * a nested for loop to perform an in-place replacement of expressions with
  * their ultimate values, should evaluation be necessary.
+ *
+ * Large multi-row INSERTs usually repeat the same expressions in every row,
+ * for instance the defaults of columns that call now() or nextval(). When an
+ * expression consists only of function calls and constants, evaluating it as
+ * a whole gives the same result as evaluating it bottom-up, so we compile it
+ * once per column and evaluate the compiled expression for every row that has
+ * an equal expression in that column. Volatile functions are still called
+ * once per row.
  */
 static void
 EvaluateValuesListsItems(List *valuesLists, PlanState *planState)
 {
 	ListCell *exprListCell = NULL;
+	CompiledValuesExpression *compiledExprArray = NULL;
+	int columnCount = 0;
+	EState *estate = NULL;
+	ExprContext *econtext = NULL;
+
+	if (valuesLists == NIL)
+	{
+		return;
+	}
+
+	columnCount = list_length((List *) linitial(valuesLists));
+	compiledExprArray = palloc0(columnCount * sizeof(CompiledValuesExpression));
+
+	/* the compiled expressions live in the estate's context until we are done */
+	estate = CreateExecutorState();
+
+	if (planState != NULL)
+	{
+		/* use executor's context to pass down parameters */
+		econtext = planState->ps_ExprContext;
+	}
+	else
+	{
+		/* when called from a function, use a default context */
+		econtext = GetPerTupleExprContext(estate);
+	}
 
 	foreach(exprListCell, valuesLists)
 	{
 		List *exprList = (List *) lfirst(exprListCell);
 		ListCell *exprCell = NULL;
+		int columnIndex = 0;
 
 		foreach(exprCell, exprList)
 		{
 			Expr *expr = (Expr *) lfirst(exprCell);
+			CompiledValuesExpression *compiledExpr = NULL;
 			Node *modifiedNode = NULL;
 
-			modifiedNode = PartiallyEvaluateExpression((Node *) expr, planState);
+			Assert(columnIndex < columnCount);
+			compiledExpr = &compiledExprArray[columnIndex];
+			columnIndex++;
+
+			if (IsA(expr, Const))
+			{
+				continue;
+			}
+
+			if (compiledExpr->expression != NULL &&
+				equal(expr, compiledExpr->expression))
+			{
+				modifiedNode = (Node *) EvaluateCompiledValuesExpression(compiledExpr,
+																		 econtext);
+			}
+			else if (IsEvaluatedNodeType((Node *) expr) &&
+					 !ContainsNodeEvaluatedOnlyInParts((Node *) expr, NULL) &&
+					 !ContainsRangeAllocatedNextval((Node *) expr, NULL))
+			{
+				MemoryContext oldContext = MemoryContextSwitchTo(estate->es_query_cxt);
+				Oid resultType = exprType((Node *) expr);
+
+				/* make sure any opfuncids are filled in */
+				fix_opfuncids((Node *) expr);
+
+				compiledExpr->expression = expr;
+				compiledExpr->expressionState = ExecInitExpr(expr, planState);
+				get_typlenbyval(resultType, &compiledExpr->resultTypLen,
+								&compiledExpr->resultTypByVal);
+
+				MemoryContextSwitchTo(oldContext);
+
+				modifiedNode = (Node *) EvaluateCompiledValuesExpression(compiledExpr,
+																		 econtext);
+			}
+			else
+			{
+				modifiedNode = PartiallyEvaluateExpression((Node *) expr, planState);
+			}
 
 			exprCell->data.ptr_value = (void *) modifiedNode;
 		}
 	}
+
+	FreeExecutorState(estate);
+	pfree(compiledExprArray);
+}
+
+
+/*
+ * ContainsNodeEvaluatedOnlyInParts returns true if the expression contains a
+ * node other than a constant that EvaluateNodeIfReferencesFunction does not
+ * evaluate, such as a Var or a CASE expression, in which case only parts of
+ * the expression are evaluated on the coordinator.
+ */
+static bool
+ContainsNodeEvaluatedOnlyInParts(Node *expression, void *context)
+{
+	if (expression == NULL || IsA(expression, Const))
+	{
+		return false;
+	}
+
+	if (IsA(expression, List))
+	{
+		return expression_tree_walker(expression, ContainsNodeEvaluatedOnlyInParts,
+									  context);
+	}
+
+	if (!IsEvaluatedNodeType(expression))
+	{
+		return true;
+	}
+
+	return expression_tree_walker(expression, ContainsNodeEvaluatedOnlyInParts,
+								  context);
+}
+
+
+/*
+ * EvaluateCompiledValuesExpression evaluates the compiled expression once and
+ * returns the result as a constant, which is allocated in the current memory
+ * context.
+ *
+ * *INDENT-OFF*
+ */
+static Expr *
+EvaluateCompiledValuesExpression(CompiledValuesExpression *compiledExpr,
+								 ExprContext *econtext)
+{
+	Expr	   *expr = compiledExpr->expression;
+	Datum		const_val;
+	bool		const_is_null;
+
+#if (PG_VERSION_NUM >= 100000)
+	const_val = ExecEvalExprSwitchContext(compiledExpr->expressionState, econtext,
+										  &const_is_null);
+#else
+	const_val = ExecEvalExprSwitchContext(compiledExpr->expressionState, econtext,
+										  &const_is_null, NULL);
+#endif
+
+	/* must copy result out of sub-context used by expression eval */
+	if (!const_is_null)
+	{
+		if (compiledExpr->resultTypLen == -1)
+			const_val = PointerGetDatum(PG_DETOAST_DATUM_COPY(const_val));
+		else
+			const_val = datumCopy(const_val, compiledExpr->resultTypByVal,
+								  compiledExpr->resultTypLen);
+	}
+
+	return (Expr *) makeConst(exprType((Node *) expr), exprTypmod((Node *) expr),
+							  exprCollation((Node *) expr),
+							  compiledExpr->resultTypLen,
+							  const_val, const_is_null,
+							  compiledExpr->resultTypByVal);
 }
 
 
+/* *INDENT-ON* */
+
+
 /*
  * Walks the expression evaluating any node which invokes a function as long as a Var
  * doesn't show up in the parameter list.
@@ -205,6 +379,32 @@ PartiallyEvaluateExpression(Node *expression, PlanState *planState)
 }
 
 
+/*
+ * EvaluateExternalParams replaces the external parameters in the given
+ * expression with constants holding their values. Unlike
+ * PartiallyEvaluateExpression(), it leaves function calls alone.
+ */
+Node *
+EvaluateExternalParams(Node *expression, PlanState *planState)
+{
+	if (expression == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(expression, Param) && ((Param *) expression)->paramkind == PARAM_EXTERN)
+	{
+		return (Node *) citus_evaluate_expr((Expr *) expression,
+											exprType(expression),
+											exprTypmod(expression),
+											exprCollation(expression),
+											planState);
+	}
+
+	return expression_tree_mutator(expression, EvaluateExternalParams, planState);
+}
+
+
 /*
  * When you find a function call evaluate it, the planner made sure there were no Vars.
  *
@@ -267,15 +467,115 @@ PartiallyEvaluateExpressionMutator(Node *expression, FunctionEvaluationContext *
  * change between invocations (the idea is to allow users to use functions but still have
  * consistent shard replicas, since we use statement replication). This means evaluating
  * all nodes which invoke functions which might not be IMMUTABLE.
+ *
+ * On metadata workers, nextval() calls of sequences that are allocated in ranges from
+ * the coordinator are replaced by the next value of the current range.
  */
 static Node *
 EvaluateNodeIfReferencesFunction(Node *expression, PlanState *planState)
 {
+	Oid sequenceId = InvalidOid;
+
 	if (expression == NULL || IsA(expression, Const))
 	{
 		return expression;
 	}
 
+	sequenceId = RangeAllocatedNextvalSequenceId(expression);
+	if (OidIsValid(sequenceId))
+	{
+		int64 sequenceValue = 0;
+
+		if (NextRangeAllocatedSequenceValue(sequenceId, &sequenceValue))
+		{
+			return (Node *) makeConst(INT8OID, -1, InvalidOid, sizeof(int64),
+									  Int64GetDatum(sequenceValue), false,
+									  FLOAT8PASSBYVAL);
+		}
+	}
+
+	if (IsEvaluatedNodeType(expression))
+	{
+		return (Node *) citus_evaluate_expr((Expr *) expression,
+											exprType(expression),
+											exprTypmod(expression),
+											exprCollation(expression),
+											planState);
+	}
+
+	return expression;
+}
+
+
+/*
+ * RangeAllocatedNextvalSequenceId returns the OID of the sequence if the given
+ * expression is a nextval() call with a constant sequence that is allocated in
+ * ranges from the coordinator, and InvalidOid otherwise.
+ */
+static Oid
+RangeAllocatedNextvalSequenceId(Node *expression)
+{
+	FuncExpr *funcExpr = NULL;
+	Const *sequenceConst = NULL;
+	Oid sequenceId = InvalidOid;
+
+	if (SequenceRangeSize <= 0 || !IsA(expression, FuncExpr))
+	{
+		return InvalidOid;
+	}
+
+	funcExpr = (FuncExpr *) expression;
+	if (funcExpr->funcid != F_NEXTVAL_OID || list_length(funcExpr->args) != 1 ||
+		!IsA(linitial(funcExpr->args), Const))
+	{
+		return InvalidOid;
+	}
+
+	sequenceConst = (Const *) linitial(funcExpr->args);
+	if (sequenceConst->constisnull)
+	{
+		return InvalidOid;
+	}
+
+	sequenceId = DatumGetObjectId(sequenceConst->constvalue);
+	if (!IsRangeAllocatedSequence(sequenceId))
+	{
+		return InvalidOid;
+	}
+
+	return sequenceId;
+}
+
+
+/*
+ * ContainsRangeAllocatedNextval returns true if the expression contains a
+ * nextval() call that is served from a range allocated on the coordinator,
+ * which the compiled evaluation of VALUES expressions would bypass.
+ */
+static bool
+ContainsRangeAllocatedNextval(Node *expression, void *context)
+{
+	if (expression == NULL)
+	{
+		return false;
+	}
+
+	if (OidIsValid(RangeAllocatedNextvalSequenceId(expression)))
+	{
+		return true;
+	}
+
+	return expression_tree_walker(expression, ContainsRangeAllocatedNextval, context);
+}
+
+
+/*
+ * IsEvaluatedNodeType returns whether EvaluateNodeIfReferencesFunction
+ * evaluates nodes of the type of the given node.
+ */
+static bool
+IsEvaluatedNodeType(Node *expression)
+{
 	switch (nodeTag(expression))
 	{
 		case T_FuncExpr:
@@ -290,20 +590,14 @@ EvaluateNodeIfReferencesFunction(Node *expression, PlanState *planState)
 		case T_RelabelType:
 		case T_CoerceToDomain:
 		{
-			return (Node *) citus_evaluate_expr((Expr *) expression,
-												exprType(expression),
-												exprTypmod(expression),
-												exprCollation(expression),
-												planState);
+			return true;
 		}
 
 		default:
 		{
-			break;
+			return false;
 		}
 	}
-
-	return expression;
 }
 
 
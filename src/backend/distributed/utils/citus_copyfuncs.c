@@ -108,6 +108,7 @@ CopyNodeDistributedPlan(COPYFUNC_ARGS)
 	COPY_NODE_FIELD(workerJob);
 	COPY_NODE_FIELD(masterQuery);
 	COPY_SCALAR_FIELD(routerExecutable);
+	COPY_SCALAR_FIELD(sortedMerge);
 	COPY_NODE_FIELD(relationIdList);
 
 	COPY_NODE_FIELD(insertSelectSubquery);
@@ -248,6 +249,7 @@ CopyNodeTask(COPYFUNC_ARGS)
 	COPY_SCALAR_FIELD(insertSelectQuery);
 	COPY_NODE_FIELD(relationShardList);
 	COPY_NODE_FIELD(rowValuesLists);
+	COPY_SCALAR_FIELD(parallelWorkerCount);
 }
 
 
@@ -268,7 +270,17 @@ CopyNodeTaskExecution(COPYFUNC_ARGS)
 	COPY_SCALAR_FIELD(connectStartTime);
 	COPY_SCALAR_FIELD(currentNodeIndex);
 	COPY_SCALAR_FIELD(querySourceNodeIndex);
+	COPY_SCALAR_FIELD(pushedNodeIndex);
+
+	/* filter tasks are part of the same task graph, so we don't copy them */
+	newnode->bloomFilterTaskList = list_copy(from->bloomFilterTaskList);
+	COPY_STRING_FIELD(partitionCommand);
 	COPY_SCALAR_FIELD(failureCount);
+	COPY_SCALAR_FIELD(queueTime);
+	COPY_SCALAR_FIELD(executionTime);
+	COPY_SCALAR_FIELD(speculativeNodeIndex);
+	COPY_SCALAR_FIELD(speculativeCopyStarted);
+	COPY_SCALAR_FIELD(awaitingPlacement);
 }
 
 
@@ -182,6 +182,7 @@ OutDistributedPlan(OUTFUNC_ARGS)
 	WRITE_NODE_FIELD(workerJob);
 	WRITE_NODE_FIELD(masterQuery);
 	WRITE_BOOL_FIELD(routerExecutable);
+	WRITE_BOOL_FIELD(sortedMerge);
 	WRITE_NODE_FIELD(relationIdList);
 
 	WRITE_NODE_FIELD(insertSelectSubquery);
@@ -457,6 +458,7 @@ OutTask(OUTFUNC_ARGS)
 	WRITE_BOOL_FIELD(insertSelectQuery);
 	WRITE_NODE_FIELD(relationShardList);
 	WRITE_NODE_FIELD(rowValuesLists);
+	WRITE_INT_FIELD(parallelWorkerCount);
 }
 
 
@@ -478,7 +480,14 @@ OutTaskExecution(OUTFUNC_ARGS)
 	WRITE_INT64_FIELD(connectStartTime);
 	WRITE_UINT_FIELD(currentNodeIndex);
 	WRITE_UINT_FIELD(querySourceNodeIndex);
+	WRITE_INT_FIELD(pushedNodeIndex);
+	WRITE_STRING_FIELD(partitionCommand);
 	WRITE_UINT_FIELD(failureCount);
+	WRITE_INT64_FIELD(queueTime);
+	WRITE_FLOAT_FIELD(executionTime, "%.2f");
+	WRITE_INT_FIELD(speculativeNodeIndex);
+	WRITE_BOOL_FIELD(speculativeCopyStarted);
+	WRITE_BOOL_FIELD(awaitingPlacement);
 }
 
 
@@ -207,6 +207,7 @@ ReadDistributedPlan(READFUNC_ARGS)
 	READ_NODE_FIELD(workerJob);
 	READ_NODE_FIELD(masterQuery);
 	READ_BOOL_FIELD(routerExecutable);
+	READ_BOOL_FIELD(sortedMerge);
 	READ_NODE_FIELD(relationIdList);
 
 	READ_NODE_FIELD(insertSelectSubquery);
@@ -370,6 +371,7 @@ ReadTask(READFUNC_ARGS)
 	READ_BOOL_FIELD(insertSelectQuery);
 	READ_NODE_FIELD(relationShardList);
 	READ_NODE_FIELD(rowValuesLists);
+	READ_INT_FIELD(parallelWorkerCount);
 
 	READ_DONE();
 }
@@ -48,7 +48,6 @@ static bool HashPartitionedShardIntervalsEqual(ShardInterval *leftShardInterval,
 static int CompareShardPlacementsByNode(const void *leftElement,
 										const void *rightElement);
 static void UpdateRelationColocationGroup(Oid distributedRelationId, uint32 colocationId);
-static List * ColocationGroupTableList(Oid colocationId);
 static void DeleteColocationGroup(uint32 colocationId);
 
 
@@ -803,7 +802,7 @@ ColocatedTableList(Oid distributedTableId)
 		return colocatedTableList;
 	}
 
-	colocatedTableList = ColocationGroupTableList(tableColocationId);
+	colocatedTableList = CachedColocationGroupTableList(tableColocationId);
 
 	return colocatedTableList;
 }
@@ -813,7 +812,7 @@ ColocatedTableList(Oid distributedTableId)
  * ColocationGroupTableList returns the list of tables in the given colocation
  * group. If the colocation group is INVALID_COLOCATION_ID, it returns NIL.
  */
-static List *
+List *
 ColocationGroupTableList(Oid colocationId)
 {
 	List *colocatedTableList = NIL;
@@ -7,7 +7,16 @@
  * This file provides infrastructure for launching exactly one a background
  * worker for every database in which citus is used.  That background worker
  * can then perform work like deadlock detection, prepared transaction
- * recovery, and cleanup.
+ * recovery, and cleanup. The daemons publish how long each kind of work
+ * takes in shared memory, so that it can be seen in
+ * citus_stat_maintenance_daemon whether they keep up.
+ *
+ * A backend stays connected to one database, so every database needs its own
+ * daemon. To keep many of them from loading the cluster in lockstep, each
+ * daemon shifts its periodic work by a phase derived from its database, only
+ * runs the distributed deadlock detection while backends of its database
+ * have distributed transactions in progress, and closes its connections to
+ * the workers while its database has none.
  *
  * Copyright (c) 2017, Citus Data, Inc.
  *
@@ -18,9 +27,12 @@
 
 #include <time.h>
 
+#include "fmgr.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 
+#include "access/hash.h"
 #include "access/xact.h"
 #include "access/xlog.h"
 #include "catalog/pg_extension.h"
@@ -29,10 +41,18 @@
 #include "commands/extension.h"
 #include "libpq/pqsignal.h"
 #include "catalog/namespace.h"
+#include "distributed/backend_data.h"
+#include "distributed/column_statistics.h"
+#include "distributed/connection_management.h"
 #include "distributed/distributed_deadlock_detection.h"
 #include "distributed/maintenanced.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/metadata_prewarm.h"
+#include "distributed/node_health.h"
+#include "distributed/rollup_tables.h"
+#include "distributed/shard_retention.h"
+#include "distributed/shard_statistics.h"
 #include "distributed/statistics_collection.h"
 #include "distributed/transaction_recovery.h"
 #include "nodes/makefuncs.h"
@@ -44,8 +64,11 @@
 #include "storage/lmgr.h"
 #include "storage/lwlock.h"
 #include "tcop/tcopprot.h"
+#include "utils/builtins.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 
 
 /*
@@ -68,6 +91,42 @@ typedef struct MaintenanceDaemonControlData
 } MaintenanceDaemonControlData;
 
 
+/*
+ * Workload metrics of a maintenance daemon. Times are in milliseconds.
+ */
+typedef struct MaintenanceDaemonStats
+{
+	/* iterations of the main loop, not counting the time spent waiting */
+	uint64 cycleCount;
+	double lastCycleTime;
+	double maxCycleTime;
+	TimestampTz lastCycleStart;
+
+	/* distributed deadlock detection */
+	uint64 deadlockCheckCount;
+	double lastDeadlockCheckTime;
+	double maxDeadlockCheckTime;
+	double totalDeadlockCheckTime;
+	int lastWaitEdgeCount;
+	uint64 totalWaitEdgeCount;
+	uint64 deadlocksFound;
+
+	/* time by which the last check started later than the deadlock timeout */
+	double deadlockCheckLag;
+
+	/* 2PC recovery */
+	uint64 recoveryCount;
+	double lastRecoveryTime;
+	double totalRecoveryTime;
+	uint64 recoveredTransactionCount;
+
+	/* refreshing deferred shard statistics */
+	uint64 statisticsRefreshCount;
+	double lastStatisticsRefreshTime;
+	uint64 refreshedShardCount;
+} MaintenanceDaemonStats;
+
+
 /*
  * Per database worker state.
  */
@@ -81,6 +140,8 @@ typedef struct MaintenanceDaemonDBData
 	bool daemonStarted;
 	pid_t workerPid;
 	Latch *latch; /* pointer to the background worker's latch */
+	bool recoveryRequested; /* whether to run 2PC recovery right away */
+	MaintenanceDaemonStats stats; /* published at the end of every cycle */
 } MaintenanceDaemonDBData;
 
 /* config variable for distributed deadlock detection timeout */
@@ -103,6 +164,11 @@ static size_t MaintenanceDaemonShmemSize(void);
 static void MaintenanceDaemonShmemInit(void);
 static void MaintenanceDaemonErrorContext(void *arg);
 static bool LockCitusExtension(void);
+static double MillisecondsBetween(TimestampTz startTime, TimestampTz endTime);
+static TimestampTz StaggeredLastRunTime(Oid databaseOid, int interval);
+
+
+PG_FUNCTION_INFO_V1(citus_maintenance_daemon_stats);
 
 
 /*
@@ -154,6 +220,12 @@ InitializeMaintenanceDaemonBackend(void)
 		int pid = 0;
 
 		dbData->userOid = extensionOwner;
+		dbData->recoveryRequested = false;
+
+		if (!found)
+		{
+			memset(&dbData->stats, 0, sizeof(MaintenanceDaemonStats));
+		}
 
 		memset(&worker, 0, sizeof(worker));
 
@@ -228,6 +300,16 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 	bool retryStatsCollection USED_WITH_LIBCURL_ONLY = false;
 	ErrorContextCallback errorCallback;
 	TimestampTz lastRecoveryTime = 0;
+	TimestampTz lastStatisticsRefreshTime = 0;
+	TimestampTz lastNodeHealthCheckTime = 0;
+	TimestampTz lastRetentionCheckTime = 0;
+	TimestampTz lastRollupTime = 0;
+	TimestampTz lastColumnStatisticsTime = 0;
+	TimestampTz lastMetadataPrewarmRecordTime = 0;
+	bool metadataCachePrewarmed = false;
+	TimestampTz lastDeadlockCheckStart = 0;
+	double deadlockCheckTarget = 0.0;
+	MaintenanceDaemonStats daemonStats;
 
 	/*
 	 * Look up this worker's configuration.
@@ -257,6 +339,9 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 
 	myDbData->latch = MyLatch;
 
+	/* continue counting where a previous daemon for the database stopped */
+	memcpy(&daemonStats, &myDbData->stats, sizeof(MaintenanceDaemonStats));
+
 	LWLockRelease(&MaintenanceDaemonControl->lock);
 
 	/*
@@ -281,6 +366,16 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 	/* make worker recognizable in pg_stat_activity */
 	pgstat_report_appname("Citus Maintenance Daemon");
 
+	/* spread the periodic work of the daemons of different databases */
+	lastRecoveryTime = StaggeredLastRunTime(databaseOid, Recover2PCInterval);
+	lastStatisticsRefreshTime = StaggeredLastRunTime(databaseOid,
+													 ShardStatisticsRefreshInterval);
+	lastRetentionCheckTime = StaggeredLastRunTime(databaseOid,
+												  ShardRetentionCheckInterval);
+	lastRollupTime = StaggeredLastRunTime(databaseOid, RollupInterval);
+	lastColumnStatisticsTime = StaggeredLastRunTime(databaseOid,
+													ColumnStatisticsInterval);
+
 	/* enter main loop */
 	for (;;)
 	{
@@ -288,6 +383,10 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 		int latchFlags = WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH;
 		double timeout = 10000.0; /* use this if the deadlock detection is disabled */
 		bool foundDeadlock = false;
+		bool recoveryRequested = false;
+		bool hasDistributedTransactions = false;
+		TimestampTz cycleStart = GetCurrentTimestamp();
+		double cycleTime = 0.0;
 
 		CHECK_FOR_INTERRUPTS();
 
@@ -306,6 +405,61 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 		 * tasks should do their own time math about whether to re-run checks.
 		 */
 
+		/*
+		 * Load the recently used distributed tables into the shared metadata
+		 * cache once after start up, before backends read them from the
+		 * catalogs all at once, and periodically record the tables that were
+		 * used since, for the next start up.
+		 */
+		if (MetadataPrewarmEnabled() &&
+			(!metadataCachePrewarmed ||
+			 TimestampDifferenceExceeds(lastMetadataPrewarmRecordTime,
+										GetCurrentTimestamp(),
+										METADATA_PREWARM_RECORD_INTERVAL)))
+		{
+			TimestampTz recordStartTime = GetCurrentTimestamp();
+			int prewarmedTableCount = 0;
+
+			InvalidateMetadataSystemCache();
+			StartTransactionCommand();
+
+			if (!LockCitusExtension())
+			{
+				ereport(DEBUG1, (errmsg("could not lock the citus extension, "
+										"skipping metadata prewarming")));
+			}
+			else if (CheckCitusVersion(DEBUG1) && CitusHasBeenLoaded())
+			{
+				if (!metadataCachePrewarmed)
+				{
+					prewarmedTableCount = PrewarmMetadataCache();
+					metadataCachePrewarmed = true;
+				}
+
+				if (!RecoveryInProgress())
+				{
+					RecordRecentlyUsedTables(lastMetadataPrewarmRecordTime);
+				}
+			}
+
+			CommitTransactionCommand();
+
+			if (prewarmedTableCount > 0)
+			{
+				ereport(DEBUG1, (errmsg("maintenance daemon prewarmed the metadata "
+										"of %d distributed tables",
+										prewarmedTableCount)));
+			}
+
+			lastMetadataPrewarmRecordTime = recordStartTime;
+		}
+
+		/* make sure we don't wait too long */
+		if (MetadataPrewarmEnabled())
+		{
+			timeout = Min(timeout, METADATA_PREWARM_RECORD_INTERVAL);
+		}
+
 #ifdef HAVE_LIBCURL
 		if (EnableStatisticsCollection &&
 			GetCurrentTimestamp() >= nextStatsCollectionTime)
@@ -368,13 +522,21 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 		}
 #endif
 
+		/* check whether a backend left committing prepared transactions to us */
+		LWLockAcquire(&MaintenanceDaemonControl->lock, LW_EXCLUSIVE);
+		recoveryRequested = myDbData->recoveryRequested;
+		myDbData->recoveryRequested = false;
+		LWLockRelease(&MaintenanceDaemonControl->lock);
+
 		/*
-		 * If enabled, run 2PC recovery on primary nodes (where !RecoveryInProgress()),
-		 * since we'll write to the pg_dist_transaction log.
+		 * If enabled or requested, run 2PC recovery on primary nodes (where
+		 * !RecoveryInProgress()), since we'll write to the pg_dist_transaction log.
 		 */
-		if (Recover2PCInterval > 0 && !RecoveryInProgress() &&
-			TimestampDifferenceExceeds(lastRecoveryTime, GetCurrentTimestamp(),
-									   Recover2PCInterval))
+		if (!RecoveryInProgress() &&
+			(recoveryRequested ||
+			 (Recover2PCInterval > 0 &&
+			  TimestampDifferenceExceeds(lastRecoveryTime, GetCurrentTimestamp(),
+										 Recover2PCInterval))))
 		{
 			int recoveredTransactionCount = 0;
 
@@ -392,9 +554,18 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 				 * Record last recovery time at start to ensure we run once per
 				 * Recover2PCInterval even if RecoverTwoPhaseCommits takes some time.
 				 */
+				double recoveryTime = 0.0;
+
 				lastRecoveryTime = GetCurrentTimestamp();
 
 				recoveredTransactionCount = RecoverTwoPhaseCommits();
+
+				recoveryTime = MillisecondsBetween(lastRecoveryTime,
+												   GetCurrentTimestamp());
+				daemonStats.recoveryCount++;
+				daemonStats.lastRecoveryTime = recoveryTime;
+				daemonStats.totalRecoveryTime += recoveryTime;
+				daemonStats.recoveredTransactionCount += recoveredTransactionCount;
 			}
 
 			CommitTransactionCommand();
@@ -407,11 +578,237 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 			}
 
 			/* make sure we don't wait too long */
-			timeout = Min(timeout, Recover2PCInterval);
+			if (Recover2PCInterval > 0)
+			{
+				timeout = Min(timeout, Recover2PCInterval);
+			}
+		}
+
+		/*
+		 * Update the statistics of shards that were appended to with
+		 * citus.defer_shard_statistics enabled. This writes to pg_dist_shard,
+		 * so only do it on primary nodes.
+		 */
+		if (!RecoveryInProgress() && ShardStatisticsRefreshInterval > 0 &&
+			TimestampDifferenceExceeds(lastStatisticsRefreshTime, GetCurrentTimestamp(),
+									   ShardStatisticsRefreshInterval) &&
+			HasStaleShardStatistics(MyDatabaseId))
+		{
+			int refreshedShardCount = 0;
+
+			InvalidateMetadataSystemCache();
+			StartTransactionCommand();
+
+			if (!LockCitusExtension())
+			{
+				ereport(DEBUG1, (errmsg("could not lock the citus extension, "
+										"skipping shard statistics refresh")));
+			}
+			else if (CheckCitusVersion(DEBUG1) && CitusHasBeenLoaded())
+			{
+				lastStatisticsRefreshTime = GetCurrentTimestamp();
+
+				refreshedShardCount = RefreshStaleShardStatistics();
+
+				daemonStats.statisticsRefreshCount++;
+				daemonStats.lastStatisticsRefreshTime =
+					MillisecondsBetween(lastStatisticsRefreshTime, GetCurrentTimestamp());
+				daemonStats.refreshedShardCount += refreshedShardCount;
+			}
+
+			CommitTransactionCommand();
+
+			if (refreshedShardCount > 0)
+			{
+				ereport(DEBUG1, (errmsg("maintenance daemon refreshed the statistics "
+										"of %d shards", refreshedShardCount)));
+			}
+		}
+
+		/* make sure we don't wait too long */
+		if (ShardStatisticsRefreshInterval > 0)
+		{
+			timeout = Min(timeout, ShardStatisticsRefreshInterval);
+		}
+
+		/*
+		 * Drop the shards of tables with a retention policy that have expired.
+		 * Shards are dropped in batches of citus.shard_retention_batch_size,
+		 * one transaction each, and the next batch follows right away when
+		 * there are more expired shards.
+		 */
+		if (!RecoveryInProgress() && ShardRetentionCheckInterval > 0 &&
+			TimestampDifferenceExceeds(lastRetentionCheckTime, GetCurrentTimestamp(),
+									   ShardRetentionCheckInterval))
+		{
+			int droppedShardCount = 0;
+			bool moreShardsExpired = false;
+
+			InvalidateMetadataSystemCache();
+			StartTransactionCommand();
+
+			if (!LockCitusExtension())
+			{
+				ereport(DEBUG1, (errmsg("could not lock the citus extension, "
+										"skipping shard retention")));
+			}
+			else if (CheckCitusVersion(DEBUG1) && CitusHasBeenLoaded())
+			{
+				droppedShardCount = ApplyRetentionPolicies(&moreShardsExpired);
+
+				if (!moreShardsExpired)
+				{
+					lastRetentionCheckTime = GetCurrentTimestamp();
+				}
+			}
+
+			CommitTransactionCommand();
+
+			if (droppedShardCount > 0)
+			{
+				ereport(LOG, (errmsg("maintenance daemon dropped %d expired shards",
+									 droppedShardCount)));
+			}
+
+			if (moreShardsExpired)
+			{
+				timeout = 0;
+			}
+		}
+
+		/* make sure we don't wait too long */
+		if (ShardRetentionCheckInterval > 0)
+		{
+			timeout = Min(timeout, ShardRetentionCheckInterval);
+		}
+
+		/*
+		 * Aggregate the rows that were added to the source tables of rollup
+		 * tables since the last run. A rollup whose aggregation fails only
+		 * logs a warning and is retried on the next run.
+		 */
+		if (!RecoveryInProgress() && RollupInterval > 0 &&
+			TimestampDifferenceExceeds(lastRollupTime, GetCurrentTimestamp(),
+									   RollupInterval))
+		{
+			int aggregatedRollupCount = 0;
+
+			InvalidateMetadataSystemCache();
+			StartTransactionCommand();
+
+			if (!LockCitusExtension())
+			{
+				ereport(DEBUG1, (errmsg("could not lock the citus extension, "
+										"skipping rollups")));
+			}
+			else if (CheckCitusVersion(DEBUG1) && CitusHasBeenLoaded())
+			{
+				aggregatedRollupCount = RunRollups();
+			}
+
+			CommitTransactionCommand();
+
+			if (aggregatedRollupCount > 0)
+			{
+				ereport(DEBUG1, (errmsg("maintenance daemon aggregated new rows into "
+										"%d rollup tables", aggregatedRollupCount)));
+			}
+
+			lastRollupTime = GetCurrentTimestamp();
+		}
+
+		/* make sure we don't wait too long */
+		if (RollupInterval > 0)
+		{
+			timeout = Min(timeout, RollupInterval);
+		}
+
+		/*
+		 * Merge the column statistics of the shards of all distributed tables
+		 * into the coordinator's catalog, for the planner.
+		 */
+		if (!RecoveryInProgress() && ColumnStatisticsInterval > 0 &&
+			TimestampDifferenceExceeds(lastColumnStatisticsTime, GetCurrentTimestamp(),
+									   ColumnStatisticsInterval))
+		{
+			int updatedTableCount = 0;
+
+			InvalidateMetadataSystemCache();
+			StartTransactionCommand();
+
+			if (!LockCitusExtension())
+			{
+				ereport(DEBUG1, (errmsg("could not lock the citus extension, "
+										"skipping column statistics")));
+			}
+			else if (CheckCitusVersion(DEBUG1) && CitusHasBeenLoaded())
+			{
+				updatedTableCount = UpdateAllColumnStatistics();
+			}
+
+			CommitTransactionCommand();
+
+			if (updatedTableCount > 0)
+			{
+				ereport(DEBUG1, (errmsg("maintenance daemon updated the column "
+										"statistics of %d tables", updatedTableCount)));
+			}
+
+			lastColumnStatisticsTime = GetCurrentTimestamp();
+		}
+
+		/* make sure we don't wait too long */
+		if (ColumnStatisticsInterval > 0)
+		{
+			timeout = Min(timeout, ColumnStatisticsInterval);
+		}
+
+		/*
+		 * Probe the worker nodes that connections are skipped for, such that
+		 * backends use them again as soon as they are back.
+		 */
+		if (NodeHealthTrackingEnabled() && NodeHealthCheckInterval > 0)
+		{
+			if (TimestampDifferenceExceeds(lastNodeHealthCheckTime,
+										   GetCurrentTimestamp(),
+										   NodeHealthCheckInterval))
+			{
+				StartTransactionCommand();
+
+				lastNodeHealthCheckTime = GetCurrentTimestamp();
+				ProbeUnreachableNodes();
+
+				CommitTransactionCommand();
+			}
+
+			/* make sure we don't wait too long */
+			timeout = Min(timeout, NodeHealthCheckInterval);
+		}
+
+		/*
+		 * Deadlocks are only resolved by the node that started one of the
+		 * transactions involved, so there is nothing for us to find while no
+		 * backend of our database runs a distributed transaction. Skipping the
+		 * check saves a round trip to every worker node.
+		 */
+		hasDistributedTransactions = DatabaseHasDistributedTransactions(databaseOid);
+		if (!hasDistributedTransactions)
+		{
+			lastDeadlockCheckStart = 0;
 		}
 
 		/* the config value -1 disables the distributed deadlock detection  */
-		if (DistributedDeadlockDetectionTimeoutFactor != -1.0)
+		if (DistributedDeadlockDetectionTimeoutFactor != -1.0 &&
+			!hasDistributedTransactions)
+		{
+			double deadlockTimeout =
+				DistributedDeadlockDetectionTimeoutFactor * (double) DeadlockTimeout;
+
+			/* check again soon, distributed transactions may start any time */
+			timeout = Min(timeout, deadlockTimeout);
+			deadlockCheckTarget = deadlockTimeout;
+		}
+		else if (DistributedDeadlockDetectionTimeoutFactor != -1.0)
 		{
 			double deadlockTimeout =
 				DistributedDeadlockDetectionTimeoutFactor * (double) DeadlockTimeout;
@@ -434,7 +831,36 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 			}
 			else if (CheckCitusVersion(DEBUG1) && CitusHasBeenLoaded())
 			{
+				TimestampTz deadlockCheckStart = GetCurrentTimestamp();
+				double deadlockCheckTime = 0.0;
+
+				if (lastDeadlockCheckStart != 0)
+				{
+					double checkInterval = MillisecondsBetween(lastDeadlockCheckStart,
+															   deadlockCheckStart);
+
+					daemonStats.deadlockCheckLag =
+						Max(checkInterval - deadlockCheckTarget, 0.0);
+				}
+
+				lastDeadlockCheckStart = deadlockCheckStart;
+
 				foundDeadlock = CheckForDistributedDeadlocks();
+
+				deadlockCheckTime = MillisecondsBetween(deadlockCheckStart,
+														GetCurrentTimestamp());
+				daemonStats.deadlockCheckCount++;
+				daemonStats.lastDeadlockCheckTime = deadlockCheckTime;
+				daemonStats.maxDeadlockCheckTime =
+					Max(daemonStats.maxDeadlockCheckTime, deadlockCheckTime);
+				daemonStats.totalDeadlockCheckTime += deadlockCheckTime;
+				daemonStats.lastWaitEdgeCount = LastWaitGraphEdgeCount;
+				daemonStats.totalWaitEdgeCount += LastWaitGraphEdgeCount;
+
+				if (foundDeadlock)
+				{
+					daemonStats.deadlocksFound++;
+				}
 			}
 
 			CommitTransactionCommand();
@@ -456,6 +882,30 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 
 			/* make sure we don't wait too long */
 			timeout = Min(timeout, deadlockTimeout);
+
+			/* the next check is late if it starts after this */
+			deadlockCheckTarget = deadlockTimeout;
+		}
+
+		/* publish how long this cycle took */
+		cycleTime = MillisecondsBetween(cycleStart, GetCurrentTimestamp());
+		daemonStats.cycleCount++;
+		daemonStats.lastCycleTime = cycleTime;
+		daemonStats.maxCycleTime = Max(daemonStats.maxCycleTime, cycleTime);
+		daemonStats.lastCycleStart = cycleStart;
+
+		LWLockAcquire(&MaintenanceDaemonControl->lock, LW_EXCLUSIVE);
+		memcpy(&myDbData->stats, &daemonStats, sizeof(MaintenanceDaemonStats));
+		LWLockRelease(&MaintenanceDaemonControl->lock);
+
+		/*
+		 * Without distributed transactions, the next use of our connections
+		 * is typically a periodic task that is far away. Rather than holding
+		 * a connection to every worker for each database, we reconnect then.
+		 */
+		if (!hasDistributedTransactions)
+		{
+			CloseAllConnections();
 		}
 
 		/*
@@ -505,6 +955,152 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 }
 
 
+/*
+ * MillisecondsBetween returns the number of milliseconds between the given
+ * timestamps.
+ */
+static double
+MillisecondsBetween(TimestampTz startTime, TimestampTz endTime)
+{
+	long seconds = 0;
+	int microseconds = 0;
+
+	TimestampDifference(startTime, endTime, &seconds, &microseconds);
+
+	return seconds * 1000.0 + microseconds / 1000.0;
+}
+
+
+/*
+ * StaggeredLastRunTime returns the time of a made-up previous run of a task
+ * that runs every interval milliseconds, such that its first run happens at
+ * a point within the interval that depends on the database. That way, the
+ * daemons of different databases that start at the same time, for instance
+ * after a restart, do not all run the task at once.
+ */
+static TimestampTz
+StaggeredLastRunTime(Oid databaseOid, int interval)
+{
+	double phase = 0.0;
+	int offset = 0;
+
+	if (interval <= 0)
+	{
+		return 0;
+	}
+
+	phase = (DatumGetUInt32(hash_uint32(databaseOid)) % 1000) / 1000.0;
+	offset = (int) ((1.0 - phase) * interval);
+
+	return TimestampTzPlusMilliseconds(GetCurrentTimestamp(), -offset);
+}
+
+
+/*
+ * citus_maintenance_daemon_stats returns the workload metrics of the
+ * maintenance daemon of each database on this node: how often and for how
+ * long it ran its main loop, distributed deadlock detection, 2PC recovery and
+ * the refresh of shard statistics. Times are in milliseconds.
+ */
+Datum
+citus_maintenance_daemon_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	HASH_SEQ_STATUS status;
+	MaintenanceDaemonDBData *dbData = NULL;
+
+	Datum values[21];
+	bool isNulls[21];
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&MaintenanceDaemonControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, MaintenanceDaemonDBHash);
+
+	dbData = (MaintenanceDaemonDBData *) hash_seq_search(&status);
+	while (dbData != NULL)
+	{
+		MaintenanceDaemonStats *stats = &dbData->stats;
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = ObjectIdGetDatum(dbData->databaseOid);
+		values[1] = Int32GetDatum(dbData->workerPid);
+		values[2] = Int64GetDatum((int64) stats->cycleCount);
+		values[3] = Float8GetDatum(stats->lastCycleTime);
+		values[4] = Float8GetDatum(stats->maxCycleTime);
+
+		if (stats->cycleCount > 0)
+		{
+			values[5] = TimestampTzGetDatum(stats->lastCycleStart);
+		}
+		else
+		{
+			isNulls[5] = true;
+		}
+
+		values[6] = Int64GetDatum((int64) stats->deadlockCheckCount);
+		values[7] = Float8GetDatum(stats->lastDeadlockCheckTime);
+		values[8] = Float8GetDatum(stats->maxDeadlockCheckTime);
+		values[9] = Float8GetDatum(stats->totalDeadlockCheckTime);
+		values[10] = Int32GetDatum(stats->lastWaitEdgeCount);
+		values[11] = Int64GetDatum((int64) stats->totalWaitEdgeCount);
+		values[12] = Int64GetDatum((int64) stats->deadlocksFound);
+		values[13] = Float8GetDatum(stats->deadlockCheckLag);
+		values[14] = Int64GetDatum((int64) stats->recoveryCount);
+		values[15] = Float8GetDatum(stats->lastRecoveryTime);
+		values[16] = Float8GetDatum(stats->totalRecoveryTime);
+		values[17] = Int64GetDatum((int64) stats->recoveredTransactionCount);
+		values[18] = Int64GetDatum((int64) stats->statisticsRefreshCount);
+		values[19] = Float8GetDatum(stats->lastStatisticsRefreshTime);
+		values[20] = Int64GetDatum((int64) stats->refreshedShardCount);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+		dbData = (MaintenanceDaemonDBData *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&MaintenanceDaemonControl->lock);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
 /*
  * MaintenanceDaemonShmemSize computes how much shared memory is required.
  */
@@ -661,6 +1257,35 @@ LockCitusExtension(void)
 }
 
 
+/*
+ * RequestTransactionRecovery wakes up the maintenance daemon of the given
+ * database and asks it to run 2PC recovery right away, independent of
+ * citus.recover_2pc_interval. It is used to commit prepared transactions
+ * whose COMMIT PREPARED was left to the daemon.
+ */
+void
+RequestTransactionRecovery(Oid databaseId)
+{
+	MaintenanceDaemonDBData *dbData = NULL;
+
+	LWLockAcquire(&MaintenanceDaemonControl->lock, LW_EXCLUSIVE);
+
+	dbData = (MaintenanceDaemonDBData *) hash_search(MaintenanceDaemonDBHash,
+													 &databaseId, HASH_FIND, NULL);
+	if (dbData != NULL)
+	{
+		dbData->recoveryRequested = true;
+
+		if (dbData->latch)
+		{
+			SetLatch(dbData->latch);
+		}
+	}
+
+	LWLockRelease(&MaintenanceDaemonControl->lock);
+}
+
+
 /*
  * StopMaintenanceDaemon stops the maintenance daemon for the
  * given database and removes it from the maintenance daemon
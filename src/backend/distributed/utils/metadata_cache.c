@@ -31,13 +31,18 @@
 #include "distributed/master_metadata_utility.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_logical_optimizer.h"
+#include "distributed/pg_dist_function.h"
 #include "distributed/pg_dist_local_group.h"
 #include "distributed/pg_dist_node_metadata.h"
 #include "distributed/pg_dist_node.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
+#include "distributed/pg_dist_shard_zone_map.h"
 #include "distributed/pg_dist_placement.h"
+#include "distributed/secondary_node_routing.h"
 #include "distributed/shared_library_init.h"
+#include "distributed/shard_invalidation_log.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
@@ -90,6 +95,24 @@ typedef struct ShardCacheEntry
 } ShardCacheEntry;
 
 
+/*
+ * ColocationGroupCacheEntry represents an entry in the colocationId -> tables
+ * cache. The shards of the tables are found through their DistTableCacheEntry,
+ * in which colocated shards have the same index.
+ */
+typedef struct ColocationGroupCacheEntry
+{
+	/* hash key, needs to be first */
+	uint32 colocationId;
+
+	bool isValid;
+
+	/* tables in the colocation group, in pg_dist_partition index order */
+	int tableCount;
+	Oid *relationIdArray;
+} ColocationGroupCacheEntry;
+
+
 /*
  * State which should be cleared upon DROP EXTENSION.  When the configuration
  * changes, e.g. because the extension is dropped, these summarily get set to
@@ -103,6 +126,15 @@ typedef struct MetadataCacheData
 	Oid distNodeRelationId;
 	Oid distNodeNodeIdIndexId;
 	Oid distLocalGroupRelationId;
+	Oid distFunctionRelationId;
+	Oid distFunctionFuncidIndexId;
+	Oid distShardZoneMapRelationId;
+	Oid distShardZoneMapPrimaryKeyIndexId;
+	Oid distShardZoneMapLogicalRelidIndexId;
+	Oid distRetentionPolicyRelationId;
+	Oid distRetentionPolicyPrimaryKeyIndexId;
+	Oid distRollupRelationId;
+	Oid distRollupPrimaryKeyIndexId;
 	Oid distColocationRelationId;
 	Oid distColocationConfigurationIndexId;
 	Oid distColocationColocationidIndexId;
@@ -136,6 +168,9 @@ static MetadataCacheData MetadataCache;
 /* Citus extension version variables */
 bool EnableVersionChecks = true; /* version checks are enabled */
 
+/* whether to read the placements of a shard only once they are used */
+bool LazyPlacementLoading = false;
+
 static bool citusVersionKnownCompatible = false;
 
 /* Hash table for informations about each partition */
@@ -144,12 +179,32 @@ static HTAB *DistTableCacheHash = NULL;
 /* Hash table for informations about each shard */
 static HTAB *DistShardCacheHash = NULL;
 
+/* Hash table for the tables in each colocation group */
+static HTAB *ColocationGroupCacheHash = NULL;
+
+/* Hash table for the pg_dist_function metadata of functions */
+static HTAB *DistFunctionCacheHash = NULL;
+
+/* Hash table for the zone maps of the shards of each table */
+static HTAB *ShardZoneMapCacheHash = NULL;
+
 /* Hash table for informations about worker nodes */
 static HTAB *WorkerNodeHash = NULL;
 static WorkerNode **WorkerNodeArray = NULL;
 static int WorkerNodeCount = 0;
 static bool workerNodeHashValid = false;
 
+/* largest group ID for which we build the array of node groups, plus one */
+#define MAX_NODE_GROUP_ARRAY_LENGTH (1 << 16)
+
+/*
+ * Nodes of each node group in WorkerNodeHash, indexed by group ID, such that
+ * resolving a placement to its node does not need to search all nodes. NULL
+ * if the group IDs are too sparse, see MAX_NODE_GROUP_ARRAY_LENGTH.
+ */
+static WorkerNodeGroup *NodeGroupArray = NULL;
+static uint32 NodeGroupArrayLength = 0;
+
 /* default value is -1, for coordinator it's 0 and for worker nodes > 0 */
 static int LocalGroupId = -1;
 
@@ -163,7 +218,21 @@ static bool IsDistributedTableViaCatalog(Oid relationId);
 static ShardCacheEntry * LookupShardCacheEntry(int64 shardId);
 static DistTableCacheEntry * LookupDistTableCacheEntry(Oid relationId);
 static void BuildDistTableCacheEntry(DistTableCacheEntry *cacheEntry);
+static void BuildColocationGroupCacheEntry(ColocationGroupCacheEntry *cacheEntry);
+static void InvalidateColocationGroupCache(void);
+static void BuildDistFunctionCacheEntry(DistFunctionCacheEntry *cacheEntry);
+static void InvalidateDistFunctionCache(void);
+static void BuildShardZoneMapCacheEntry(ShardZoneMapCacheEntry *cacheEntry);
+static bool TupleToShardZoneMap(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+								ShardZoneMap *zoneMap);
+static void ResetShardZoneMapCacheEntry(ShardZoneMapCacheEntry *cacheEntry);
+static void InvalidateShardZoneMapCache(Oid relationId);
+static int CompareShardZoneMaps(const void *leftElement, const void *rightElement);
 static void BuildCachedShardList(DistTableCacheEntry *cacheEntry);
+static void BuildCachedShardPlacements(DistTableCacheEntry *cacheEntry,
+									   ShardInterval *shardInterval);
+static bool RevalidateDistTableCacheEntry(DistTableCacheEntry *cacheEntry);
+static void BuildShardHashArrays(DistTableCacheEntry *cacheEntry);
 static ShardInterval ** SortShardIntervalArray(ShardInterval **shardIntervalArray,
 											   int shardCount,
 											   FmgrInfo *
@@ -179,20 +248,28 @@ static char * InstalledExtensionVersion(void);
 static bool HasOverlappingShardInterval(ShardInterval **shardIntervalArray,
 										int shardIntervalArrayLength,
 										FmgrInfo *shardIntervalSortCompareFunction);
+static int * GreatestMaxValueIndexArray(ShardInterval **sortedShardIntervalArray,
+										int shardCount,
+										FmgrInfo *shardIntervalSortCompareFunction);
 static void InitializeCaches(void);
 static void InitializeDistTableCache(void);
 static void InitializeWorkerNodeCache(void);
 static void RegisterWorkerNodeCacheCallbacks(void);
 static void RegisterLocalGroupIdCacheCallbacks(void);
 static uint32 WorkerNodeHashCode(const void *key, Size keySize);
+static WorkerNodeGroup * BuildNodeGroupArray(WorkerNode **workerNodeArray,
+											 int workerNodeCount,
+											 uint32 *nodeGroupArrayLength);
+static void AddNodeToGroup(WorkerNodeGroup *nodeGroup, WorkerNode *workerNode);
 static void ResetDistTableCacheEntry(DistTableCacheEntry *cacheEntry);
 static void CreateDistTableCache(void);
 static void InvalidateDistRelationCacheCallback(Datum argument, Oid relationId);
+static void RegisterDistTableInvalidation(Oid relationId);
 static void InvalidateNodeRelationCacheCallback(Datum argument, Oid relationId);
 static void InvalidateLocalGroupIdRelationCacheCallback(Datum argument, Oid relationId);
 static HeapTuple LookupDistPartitionTuple(Relation pgDistPartition, Oid relationId);
 static List * LookupDistShardTuples(Oid relationId);
-static Oid LookupShardRelation(int64 shardId);
+static Oid LookupShardRelation(int64 shardId, bool missingOk);
 static void GetPartitionTypeInputInfo(char *partitionKeyString, char partitionMethod,
 									  Oid *columnTypeId, int32 *columnTypeMod,
 									  Oid *intervalTypeId, int32 *intervalTypeMod);
@@ -202,7 +279,6 @@ static ShardInterval * TupleToShardInterval(HeapTuple heapTuple,
 static void CachedRelationLookup(const char *relationName, Oid *cachedOid);
 static ShardPlacement * ResolveGroupShardPlacement(
 	GroupShardPlacement *groupShardPlacement, ShardCacheEntry *shardEntry);
-static WorkerNode * LookupNodeForGroup(uint32 groupid);
 static Oid LookupEnumValueId(Oid typeId, char *valueName);
 
 
@@ -216,7 +292,8 @@ PG_FUNCTION_INFO_V1(master_dist_local_group_cache_invalidate);
 
 /*
  * EnsureModificationsCanRun checks if the current node is in recovery mode or
- * citus.use_secondary_nodes is 'alwaus'. If either is true the function errors out.
+ * citus.use_secondary_nodes is 'always'. If either is true the function errors out.
+ * In 'read-only' mode, read-write transactions write to the primaries.
  */
 void
 EnsureModificationsCanRun(void)
@@ -383,8 +460,8 @@ LoadGroupShardPlacement(uint64 shardId, uint64 placementId)
 	/* the offset better be in a valid range */
 	Assert(shardEntry->shardIndex < tableEntry->shardIntervalArrayLength);
 
-	placementArray = tableEntry->arrayOfPlacementArrays[shardEntry->shardIndex];
-	numberOfPlacements = tableEntry->arrayOfPlacementArrayLengths[shardEntry->shardIndex];
+	placementArray = CachedShardPlacementArray(tableEntry, shardEntry->shardIndex,
+											   &numberOfPlacements);
 
 	for (i = 0; i < numberOfPlacements; i++)
 	{
@@ -438,8 +515,8 @@ FindShardPlacementOnGroup(uint32 groupId, uint64 shardId)
 
 	shardEntry = LookupShardCacheEntry(shardId);
 	tableEntry = shardEntry->tableEntry;
-	placementArray = tableEntry->arrayOfPlacementArrays[shardEntry->shardIndex];
-	numberOfPlacements = tableEntry->arrayOfPlacementArrayLengths[shardEntry->shardIndex];
+	placementArray = CachedShardPlacementArray(tableEntry, shardEntry->shardIndex,
+											   &numberOfPlacements);
 
 	for (placementIndex = 0; placementIndex < numberOfPlacements; placementIndex++)
 	{
@@ -506,61 +583,42 @@ ResolveGroupShardPlacement(GroupShardPlacement *groupShardPlacement,
 
 
 /*
- * LookupNodeForGroup searches the WorkerNodeHash for a worker which is a member of the
- * given group and also readable (a primary if we're reading from primaries, a secondary
- * if we're reading from secondaries). If such a node does not exist it emits an
- * appropriate error message.
+ * LookupNodeForGroup returns the node of the given group that the current
+ * transaction reads from: the primary, or when reading from secondaries the
+ * secondary chosen by SecondaryReadNodeForGroup. If there is no such node it
+ * emits an appropriate error message.
  */
-static WorkerNode *
+WorkerNode *
 LookupNodeForGroup(uint32 groupId)
 {
-	bool foundAnyNodes = false;
-	int workerNodeIndex = 0;
-
-	PrepareWorkerNodeCache();
+	WorkerNodeGroup *nodeGroup = LookupNodeGroup(groupId);
+	WorkerNode *workerNode = NULL;
 
-	for (workerNodeIndex = 0; workerNodeIndex < WorkerNodeCount; workerNodeIndex++)
-	{
-		WorkerNode *workerNode = WorkerNodeArray[workerNodeIndex];
-		uint32 workerNodeGroupId = workerNode->groupId;
-		if (workerNodeGroupId != groupId)
-		{
-			continue;
-		}
-
-		foundAnyNodes = true;
-
-		if (WorkerNodeIsReadable(workerNode))
-		{
-			return workerNode;
-		}
-	}
-
-	if (!foundAnyNodes)
+	if (nodeGroup == NULL)
 	{
 		ereport(ERROR, (errmsg("there is a shard placement in node group %u but "
 							   "there are no nodes in that group", groupId)));
 	}
 
-	switch (ReadFromSecondaries)
+	if (!ReadFromSecondaryNodes())
 	{
-		case USE_SECONDARY_NODES_NEVER:
+		if (nodeGroup->primaryNode != NULL)
 		{
-			ereport(ERROR, (errmsg("node group %u does not have a primary node",
-								   groupId)));
+			return nodeGroup->primaryNode;
 		}
 
-		case USE_SECONDARY_NODES_ALWAYS:
-		{
-			ereport(ERROR, (errmsg("node group %u does not have a secondary node",
-								   groupId)));
-		}
+		ereport(ERROR, (errmsg("node group %u does not have a primary node",
+							   groupId)));
+	}
 
-		default:
-		{
-			ereport(FATAL, (errmsg("unrecognized value for use_secondary_nodes")));
-		}
+	workerNode = SecondaryReadNodeForGroup(nodeGroup);
+	if (workerNode == NULL)
+	{
+		ereport(ERROR, (errmsg("node group %u does not have a secondary node",
+							   groupId)));
 	}
+
+	return workerNode;
 }
 
 
@@ -587,8 +645,8 @@ ShardPlacementList(uint64 shardId)
 	/* the offset better be in a valid range */
 	Assert(shardEntry->shardIndex < tableEntry->shardIntervalArrayLength);
 
-	placementArray = tableEntry->arrayOfPlacementArrays[shardEntry->shardIndex];
-	numberOfPlacements = tableEntry->arrayOfPlacementArrayLengths[shardEntry->shardIndex];
+	placementArray = CachedShardPlacementArray(tableEntry, shardEntry->shardIndex,
+											   &numberOfPlacements);
 
 	for (i = 0; i < numberOfPlacements; i++)
 	{
@@ -610,6 +668,31 @@ ShardPlacementList(uint64 shardId)
 }
 
 
+/*
+ * CachedShardPlacementArray returns the placements of the shard at the given
+ * index of the cache entry, and sets placementCount to their number. If the
+ * placements were not loaded when the entry was built, they are read from
+ * pg_dist_placement now.
+ */
+GroupShardPlacement *
+CachedShardPlacementArray(DistTableCacheEntry *cacheEntry, int shardIndex,
+						  int *placementCount)
+{
+	Assert(shardIndex < cacheEntry->shardIntervalArrayLength);
+
+	if (cacheEntry->arrayOfPlacementArrays[shardIndex] == NULL)
+	{
+		ShardInterval *shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+
+		BuildCachedShardPlacements(cacheEntry, shardInterval);
+	}
+
+	*placementCount = cacheEntry->arrayOfPlacementArrayLengths[shardIndex];
+
+	return cacheEntry->arrayOfPlacementArrays[shardIndex];
+}
+
+
 /*
  * LookupShardCacheEntry returns the cache entry belonging to a shard, or
  * errors out if that shard is unknown.
@@ -637,7 +720,7 @@ LookupShardCacheEntry(int64 shardId)
 		 * know that the shard has to be in the cache if it exists.  If the
 		 * shard does *not* exist LookupShardRelation() will error out.
 		 */
-		Oid relationId = LookupShardRelation(shardId);
+		Oid relationId = LookupShardRelation(shardId, false);
 
 		/* trigger building the cache for the shard id */
 		LookupDistTableCacheEntry(relationId);
@@ -655,7 +738,7 @@ LookupShardCacheEntry(int64 shardId)
 		if (!shardEntry->tableEntry->isValid)
 		{
 			Oid oldRelationId = shardEntry->tableEntry->relationId;
-			Oid currentRelationId = LookupShardRelation(shardId);
+			Oid currentRelationId = LookupShardRelation(shardId, false);
 
 			/*
 			 * The relation OID to which the shard belongs could have changed,
@@ -767,35 +850,467 @@ LookupDistTableCacheEntry(Oid relationId)
 
 	cacheEntry = hash_search(DistTableCacheHash, hashKey, HASH_ENTER, &foundInCache);
 
-	/* return valid matches */
-	if (foundInCache)
+	/* return valid matches */
+	if (foundInCache)
+	{
+		/*
+		 * We might have some concurrent metadata changes. In order to get the changes,
+		 * we first need to accept the cache invalidation messages.
+		 */
+		AcceptInvalidationMessages();
+
+		if (cacheEntry->isValid)
+		{
+			return cacheEntry;
+		}
+
+		/* only shard placements might have changed */
+		if (RevalidateDistTableCacheEntry(cacheEntry))
+		{
+			cacheEntry->isValid = true;
+			return cacheEntry;
+		}
+
+		/* free the content of old, invalid, entries */
+		ResetDistTableCacheEntry(cacheEntry);
+	}
+
+	/* zero out entry, but not the key part */
+	memset(((char *) cacheEntry) + sizeof(Oid), 0,
+		   sizeof(DistTableCacheEntry) - sizeof(Oid));
+
+	/* actually fill out entry */
+	BuildDistTableCacheEntry(cacheEntry);
+
+	/* and finally mark as valid */
+	cacheEntry->isValid = true;
+
+	return cacheEntry;
+}
+
+
+/*
+ * CachedColocationGroupTableList returns the list of tables in the given
+ * colocation group, like ColocationGroupTableList, but only scans
+ * pg_dist_partition again after a relcache invalidation.
+ */
+List *
+CachedColocationGroupTableList(uint32 colocationId)
+{
+	ColocationGroupCacheEntry *cacheEntry = NULL;
+	List *colocatedTableList = NIL;
+	bool foundInCache = false;
+	int tableIndex = 0;
+
+	if (colocationId == INVALID_COLOCATION_ID)
+	{
+		return NIL;
+	}
+
+	InitializeCaches();
+
+	cacheEntry = hash_search(ColocationGroupCacheHash, &colocationId, HASH_ENTER,
+							 &foundInCache);
+	if (foundInCache)
+	{
+		/* as in LookupDistTableCacheEntry, see concurrent metadata changes */
+		AcceptInvalidationMessages();
+	}
+	else
+	{
+		cacheEntry->isValid = false;
+		cacheEntry->tableCount = 0;
+		cacheEntry->relationIdArray = NULL;
+	}
+
+	if (!cacheEntry->isValid)
+	{
+		BuildColocationGroupCacheEntry(cacheEntry);
+	}
+
+	for (tableIndex = 0; tableIndex < cacheEntry->tableCount; tableIndex++)
+	{
+		colocatedTableList = lappend_oid(colocatedTableList,
+										 cacheEntry->relationIdArray[tableIndex]);
+	}
+
+	return colocatedTableList;
+}
+
+
+/*
+ * BuildColocationGroupCacheEntry reads the tables of a colocation group from
+ * pg_dist_partition into the given cache entry, and marks it as valid.
+ */
+static void
+BuildColocationGroupCacheEntry(ColocationGroupCacheEntry *cacheEntry)
+{
+	List *colocatedTableList = ColocationGroupTableList(cacheEntry->colocationId);
+	ListCell *colocatedTableCell = NULL;
+	int tableCount = list_length(colocatedTableList);
+	Oid *relationIdArray = NULL;
+	int tableIndex = 0;
+
+	if (tableCount > 0)
+	{
+		relationIdArray = MemoryContextAlloc(CacheMemoryContext,
+											 tableCount * sizeof(Oid));
+	}
+
+	foreach(colocatedTableCell, colocatedTableList)
+	{
+		relationIdArray[tableIndex++] = lfirst_oid(colocatedTableCell);
+	}
+
+	if (cacheEntry->relationIdArray != NULL)
+	{
+		pfree(cacheEntry->relationIdArray);
+	}
+
+	cacheEntry->tableCount = tableCount;
+	cacheEntry->relationIdArray = relationIdArray;
+	cacheEntry->isValid = true;
+}
+
+
+/*
+ * LookupDistFunctionCacheEntry returns the pg_dist_function metadata of the
+ * given function, or NULL if calls of the function are not delegated. The
+ * metadata is only read again after pg_dist_function was changed.
+ */
+DistFunctionCacheEntry *
+LookupDistFunctionCacheEntry(Oid functionId)
+{
+	DistFunctionCacheEntry *cacheEntry = NULL;
+	bool foundInCache = false;
+
+	InitializeCaches();
+
+	cacheEntry = hash_search(DistFunctionCacheHash, &functionId, HASH_ENTER,
+							 &foundInCache);
+	if (foundInCache)
+	{
+		/* as in LookupDistTableCacheEntry, see concurrent metadata changes */
+		AcceptInvalidationMessages();
+	}
+	else
+	{
+		cacheEntry->isValid = false;
+	}
+
+	if (!cacheEntry->isValid)
+	{
+		BuildDistFunctionCacheEntry(cacheEntry);
+	}
+
+	if (!cacheEntry->isDistributedFunction)
+	{
+		return NULL;
+	}
+
+	return cacheEntry;
+}
+
+
+/*
+ * BuildDistFunctionCacheEntry reads the pg_dist_function row of a function
+ * into the given cache entry, and marks it as valid.
+ */
+static void
+BuildDistFunctionCacheEntry(DistFunctionCacheEntry *cacheEntry)
+{
+	Relation pgDistFunction = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+
+	pgDistFunction = heap_open(DistFunctionRelationId(), AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_function_funcid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(cacheEntry->functionId));
+
+	scanDescriptor = systable_beginscan(pgDistFunction, DistFunctionFuncidIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		Form_pg_dist_function functionForm =
+			(Form_pg_dist_function) GETSTRUCT(heapTuple);
+
+		cacheEntry->isDistributedFunction = true;
+		cacheEntry->distributionArgIndex = functionForm->distribution_argument_index;
+		cacheEntry->colocationId = functionForm->colocationid;
+	}
+	else
+	{
+		cacheEntry->isDistributedFunction = false;
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistFunction, NoLock);
+
+	cacheEntry->isValid = true;
+}
+
+
+/*
+ * LookupShardZoneMapCacheEntry returns the zone maps of the shards of the
+ * given table, or NULL if the table has none.
+ */
+ShardZoneMapCacheEntry *
+LookupShardZoneMapCacheEntry(Oid relationId)
+{
+	ShardZoneMapCacheEntry *cacheEntry = NULL;
+	bool foundInCache = false;
+
+	InitializeCaches();
+
+	cacheEntry = hash_search(ShardZoneMapCacheHash, &relationId, HASH_ENTER,
+							 &foundInCache);
+	if (foundInCache)
+	{
+		/* as in LookupDistTableCacheEntry, see concurrent metadata changes */
+		AcceptInvalidationMessages();
+	}
+	else
+	{
+		cacheEntry->isValid = false;
+		cacheEntry->zoneMapCount = 0;
+		cacheEntry->zoneMapArray = NULL;
+	}
+
+	if (!cacheEntry->isValid)
+	{
+		BuildShardZoneMapCacheEntry(cacheEntry);
+	}
+
+	if (cacheEntry->zoneMapCount == 0)
+	{
+		return NULL;
+	}
+
+	return cacheEntry;
+}
+
+
+/*
+ * FindShardZoneMap returns the zone map of the given column in the given
+ * shard, or NULL if there is none.
+ */
+ShardZoneMap *
+FindShardZoneMap(ShardZoneMapCacheEntry *cacheEntry, uint64 shardId,
+				 AttrNumber attributeNumber)
+{
+	ShardZoneMap searchKey;
+
+	searchKey.shardId = shardId;
+	searchKey.attributeNumber = attributeNumber;
+
+	return (ShardZoneMap *) bsearch(&searchKey, cacheEntry->zoneMapArray,
+									cacheEntry->zoneMapCount, sizeof(ShardZoneMap),
+									CompareShardZoneMaps);
+}
+
+
+/*
+ * BuildShardZoneMapCacheEntry reads the pg_dist_shard_zone_map rows of a table
+ * into the given cache entry, and marks it as valid. Zone maps of columns that
+ * were dropped or changed their type since the zone map was built are left
+ * out, since their values can no longer be compared to the column.
+ */
+static void
+BuildShardZoneMapCacheEntry(ShardZoneMapCacheEntry *cacheEntry)
+{
+	Relation pgDistShardZoneMap = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+	List *zoneMapList = NIL;
+	ListCell *zoneMapCell = NULL;
+	int zoneMapCount = 0;
+	int zoneMapIndex = 0;
+	ShardZoneMap *zoneMapArray = NULL;
+
+	ResetShardZoneMapCacheEntry(cacheEntry);
+
+	pgDistShardZoneMap = heap_open(DistShardZoneMapRelationId(), AccessShareLock);
+	tupleDescriptor = RelationGetDescr(pgDistShardZoneMap);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_shard_zone_map_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(cacheEntry->relationId));
+
+	scanDescriptor = systable_beginscan(pgDistShardZoneMap,
+										DistShardZoneMapLogicalRelidIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		ShardZoneMap *zoneMap = palloc0(sizeof(ShardZoneMap));
+
+		if (TupleToShardZoneMap(heapTuple, tupleDescriptor, zoneMap))
+		{
+			zoneMapList = lappend(zoneMapList, zoneMap);
+		}
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistShardZoneMap, NoLock);
+
+	zoneMapCount = list_length(zoneMapList);
+	if (zoneMapCount > 0)
+	{
+		zoneMapArray = MemoryContextAllocZero(CacheMemoryContext,
+											  zoneMapCount * sizeof(ShardZoneMap));
+	}
+
+	foreach(zoneMapCell, zoneMapList)
+	{
+		ShardZoneMap *zoneMap = (ShardZoneMap *) lfirst(zoneMapCell);
+
+		zoneMapArray[zoneMapIndex++] = *zoneMap;
+	}
+
+	if (zoneMapCount > 1)
+	{
+		qsort(zoneMapArray, zoneMapCount, sizeof(ShardZoneMap), CompareShardZoneMaps);
+	}
+
+	cacheEntry->zoneMapCount = zoneMapCount;
+	cacheEntry->zoneMapArray = zoneMapArray;
+	cacheEntry->isValid = true;
+}
+
+
+/*
+ * TupleToShardZoneMap fills the given zone map from a pg_dist_shard_zone_map
+ * tuple, with the min/max values and the bloom filter allocated in the cache
+ * memory context. It returns false if the column no longer has the type with
+ * which the zone map was built.
+ */
+static bool
+TupleToShardZoneMap(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+					ShardZoneMap *zoneMap)
+{
+	Form_pg_dist_shard_zone_map zoneMapForm =
+		(Form_pg_dist_shard_zone_map) GETSTRUCT(heapTuple);
+	Oid valueTypeId = zoneMapForm->atttypid;
+	bool minValueNull = false;
+	bool maxValueNull = false;
+	bool bloomFilterNull = false;
+	Datum minValueDatum = heap_getattr(heapTuple, Anum_pg_dist_shard_zone_map_minvalue,
+									   tupleDescriptor, &minValueNull);
+	Datum maxValueDatum = heap_getattr(heapTuple, Anum_pg_dist_shard_zone_map_maxvalue,
+									   tupleDescriptor, &maxValueNull);
+	Datum bloomFilterDatum = heap_getattr(heapTuple,
+										  Anum_pg_dist_shard_zone_map_bloomfilter,
+										  tupleDescriptor, &bloomFilterNull);
+	MemoryContext oldContext = NULL;
+
+	if (get_atttype(zoneMapForm->logicalrelid, zoneMapForm->attnum) != valueTypeId)
+	{
+		return false;
+	}
+
+	zoneMap->shardId = zoneMapForm->shardid;
+	zoneMap->attributeNumber = zoneMapForm->attnum;
+	zoneMap->hasMinMaxValues = !minValueNull && !maxValueNull;
+
+	if (zoneMap->hasMinMaxValues)
+	{
+		Oid inputFunctionId = InvalidOid;
+		Oid typeIoParam = InvalidOid;
+		int16 valueTypeLength = 0;
+		Datum minValue = 0;
+		Datum maxValue = 0;
+
+		getTypeInputInfo(valueTypeId, &inputFunctionId, &typeIoParam);
+		get_typlenbyval(valueTypeId, &valueTypeLength, &zoneMap->valueByVal);
+
+		minValue = OidInputFunctionCall(inputFunctionId,
+										TextDatumGetCString(minValueDatum),
+										typeIoParam, -1);
+		maxValue = OidInputFunctionCall(inputFunctionId,
+										TextDatumGetCString(maxValueDatum),
+										typeIoParam, -1);
+
+		oldContext = MemoryContextSwitchTo(CacheMemoryContext);
+
+		zoneMap->minValue = datumCopy(minValue, zoneMap->valueByVal, valueTypeLength);
+		zoneMap->maxValue = datumCopy(maxValue, zoneMap->valueByVal, valueTypeLength);
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	if (!bloomFilterNull)
+	{
+		oldContext = MemoryContextSwitchTo(CacheMemoryContext);
+
+		zoneMap->bloomFilter = ByteaToBloomFilter(DatumGetByteaP(bloomFilterDatum));
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	return true;
+}
+
+
+/*
+ * ResetShardZoneMapCacheEntry frees the zone maps of the given cache entry.
+ */
+static void
+ResetShardZoneMapCacheEntry(ShardZoneMapCacheEntry *cacheEntry)
+{
+	int zoneMapIndex = 0;
+
+	for (zoneMapIndex = 0; zoneMapIndex < cacheEntry->zoneMapCount; zoneMapIndex++)
 	{
-		/*
-		 * We might have some concurrent metadata changes. In order to get the changes,
-		 * we first need to accept the cache invalidation messages.
-		 */
-		AcceptInvalidationMessages();
+		ShardZoneMap *zoneMap = &cacheEntry->zoneMapArray[zoneMapIndex];
 
-		if (cacheEntry->isValid)
+		if (zoneMap->hasMinMaxValues && !zoneMap->valueByVal)
 		{
-			return cacheEntry;
+			pfree(DatumGetPointer(zoneMap->minValue));
+			pfree(DatumGetPointer(zoneMap->maxValue));
 		}
 
-		/* free the content of old, invalid, entries */
-		ResetDistTableCacheEntry(cacheEntry);
+		if (zoneMap->bloomFilter != NULL)
+		{
+			pfree(zoneMap->bloomFilter);
+		}
 	}
 
-	/* zero out entry, but not the key part */
-	memset(((char *) cacheEntry) + sizeof(Oid), 0,
-		   sizeof(DistTableCacheEntry) - sizeof(Oid));
+	if (cacheEntry->zoneMapArray != NULL)
+	{
+		pfree(cacheEntry->zoneMapArray);
+	}
 
-	/* actually fill out entry */
-	BuildDistTableCacheEntry(cacheEntry);
+	cacheEntry->zoneMapCount = 0;
+	cacheEntry->zoneMapArray = NULL;
+}
 
-	/* and finally mark as valid */
-	cacheEntry->isValid = true;
 
-	return cacheEntry;
+/*
+ * CompareShardZoneMaps orders zone maps by shard ID and column number, for use
+ * with qsort and bsearch.
+ */
+static int
+CompareShardZoneMaps(const void *leftElement, const void *rightElement)
+{
+	const ShardZoneMap *leftZoneMap = (const ShardZoneMap *) leftElement;
+	const ShardZoneMap *rightZoneMap = (const ShardZoneMap *) rightElement;
+
+	if (leftZoneMap->shardId != rightZoneMap->shardId)
+	{
+		return (leftZoneMap->shardId < rightZoneMap->shardId) ? -1 : 1;
+	}
+
+	return leftZoneMap->attributeNumber - rightZoneMap->attributeNumber;
 }
 
 
@@ -816,6 +1331,9 @@ BuildDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 	bool isNull = false;
 	bool partitionKeyIsNull = false;
 
+	/* remember which metadata changes the entry reflects */
+	cacheEntry->shardInvalidationLogPosition = ShardInvalidationLogPosition();
+
 	pgDistPartition = heap_open(DistPartitionRelationId(), AccessShareLock);
 	distPartitionTuple =
 		LookupDistPartitionTuple(pgDistPartition, cacheEntry->relationId);
@@ -905,6 +1423,12 @@ BuildDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 		cacheEntry->hasUniformHashDistribution =
 			HasUniformHashDistribution(cacheEntry->sortedShardIntervalArray,
 									   cacheEntry->shardIntervalArrayLength);
+
+		/* otherwise, shards are found by a binary search over their hash ranges */
+		if (!cacheEntry->hasUniformHashDistribution)
+		{
+			BuildShardHashArrays(cacheEntry);
+		}
 	}
 	else
 	{
@@ -933,6 +1457,8 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 	int32 columnTypeMod = -1;
 	Oid intervalTypeId = InvalidOid;
 	int32 intervalTypeMod = -1;
+	bool loadedFromSharedCache = false;
+	uint64 sharedCacheBuildCounter = 0;
 
 	GetPartitionTypeInputInfo(cacheEntry->partitionKeyString,
 							  cacheEntry->partitionMethod,
@@ -941,9 +1467,28 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 							  &intervalTypeId,
 							  &intervalTypeMod);
 
-	distShardTupleList = LookupDistShardTuples(cacheEntry->relationId);
-	shardIntervalArrayLength = list_length(distShardTupleList);
-	if (shardIntervalArrayLength > 0)
+	/* another backend might already have read the shards and placements */
+	if (SharedMetadataCacheEnabled())
+	{
+		loadedFromSharedCache =
+			LoadSharedShardList(cacheEntry->relationId, intervalTypeId,
+								&shardIntervalArray, &shardIntervalArrayLength,
+								&cacheEntry->arrayOfPlacementArrays,
+								&cacheEntry->arrayOfPlacementArrayLengths);
+
+		if (!loadedFromSharedCache)
+		{
+			sharedCacheBuildCounter = BeginSharedShardListBuild();
+		}
+	}
+
+	if (!loadedFromSharedCache)
+	{
+		distShardTupleList = LookupDistShardTuples(cacheEntry->relationId);
+		shardIntervalArrayLength = list_length(distShardTupleList);
+	}
+
+	if (distShardTupleList != NIL)
 	{
 		Relation distShardRelation = heap_open(DistShardRelationId(), AccessShareLock);
 		TupleDesc distShardTupleDesc = RelationGetDescr(distShardRelation);
@@ -1041,10 +1586,17 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 	}
 	else
 	{
-		/* sort the interval array */
-		sortedShardIntervalArray = SortShardIntervalArray(shardIntervalArray,
-														  shardIntervalArrayLength,
-														  shardIntervalCompareFunction);
+		/* sort the interval array, unless it comes sorted from the shared cache */
+		if (loadedFromSharedCache)
+		{
+			sortedShardIntervalArray = shardIntervalArray;
+		}
+		else
+		{
+			sortedShardIntervalArray =
+				SortShardIntervalArray(shardIntervalArray, shardIntervalArrayLength,
+									   shardIntervalCompareFunction);
+		}
 
 		/* check if there exists any shard intervals with no min/max values */
 		cacheEntry->hasUninitializedShardInterval =
@@ -1079,6 +1631,28 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 		{
 			ereport(ERROR, (errmsg("hash partitioned table has overlapping shards")));
 		}
+
+		/*
+		 * Overlapping shards cannot be found using a plain binary search, so
+		 * we keep track of the greatest maxValue up to each shard to still be
+		 * able to do so during shard pruning.
+		 */
+		if (cacheEntry->hasOverlappingShardInterval)
+		{
+			int initializedCount = 0;
+
+			while (initializedCount < shardIntervalArrayLength &&
+				   sortedShardIntervalArray[initializedCount]->minValueExists &&
+				   sortedShardIntervalArray[initializedCount]->maxValueExists)
+			{
+				initializedCount++;
+			}
+
+			cacheEntry->initializedShardIntervalCount = initializedCount;
+			cacheEntry->greatestMaxValueIndexArray =
+				GreatestMaxValueIndexArray(sortedShardIntervalArray, initializedCount,
+										   shardIntervalCompareFunction);
+		}
 	}
 
 
@@ -1088,12 +1662,6 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 		ShardCacheEntry *shardEntry = NULL;
 		ShardInterval *shardInterval = sortedShardIntervalArray[shardIndex];
 		bool foundInCache = false;
-		List *placementList = NIL;
-		MemoryContext oldContext = NULL;
-		ListCell *placementCell = NULL;
-		GroupShardPlacement *placementArray = NULL;
-		int placementOffset = 0;
-		int numberOfPlacements = 0;
 
 		shardEntry = hash_search(DistShardCacheHash, &shardInterval->shardId, HASH_ENTER,
 								 &foundInCache);
@@ -1108,29 +1676,28 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 		shardEntry->shardIndex = shardIndex;
 		shardEntry->tableEntry = cacheEntry;
 
-		/* build list of shard placements */
-		placementList = BuildShardPlacementList(shardInterval);
-		numberOfPlacements = list_length(placementList);
+		/* store the shard index in the ShardInterval */
+		shardInterval->shardIndex = shardIndex;
 
-		/* and copy that list into the cache entry */
-		oldContext = MemoryContextSwitchTo(CacheMemoryContext);
-		placementArray = palloc0(numberOfPlacements * sizeof(GroupShardPlacement));
-		foreach(placementCell, placementList)
+		/*
+		 * Placements copied from the shared cache are already in place, and
+		 * when loading them lazily they are read on first use.
+		 */
+		if (loadedFromSharedCache || LazyPlacementLoading)
 		{
-			GroupShardPlacement *srcPlacement =
-				(GroupShardPlacement *) lfirst(placementCell);
-			GroupShardPlacement *dstPlacement = &placementArray[placementOffset];
-
-			memcpy(dstPlacement, srcPlacement, sizeof(GroupShardPlacement));
-			placementOffset++;
+			continue;
 		}
-		MemoryContextSwitchTo(oldContext);
 
-		cacheEntry->arrayOfPlacementArrays[shardIndex] = placementArray;
-		cacheEntry->arrayOfPlacementArrayLengths[shardIndex] = numberOfPlacements;
+		BuildCachedShardPlacements(cacheEntry, shardInterval);
+	}
 
-		/* store the shard index in the ShardInterval */
-		shardInterval->shardIndex = shardIndex;
+	/* let other backends copy what we read from the catalogs */
+	if (SharedMetadataCacheEnabled() && !loadedFromSharedCache && !LazyPlacementLoading)
+	{
+		StoreSharedShardList(cacheEntry->relationId, sharedCacheBuildCounter,
+							 sortedShardIntervalArray, shardIntervalArrayLength,
+							 cacheEntry->arrayOfPlacementArrays,
+							 cacheEntry->arrayOfPlacementArrayLengths);
 	}
 
 	cacheEntry->shardIntervalArrayLength = shardIntervalArrayLength;
@@ -1140,6 +1707,150 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 }
 
 
+/*
+ * BuildCachedShardPlacements reads the placements of the given shard from
+ * pg_dist_placement, and copies them into the cache entry at the index of
+ * the shard.
+ */
+static void
+BuildCachedShardPlacements(DistTableCacheEntry *cacheEntry,
+						   ShardInterval *shardInterval)
+{
+	int shardIndex = shardInterval->shardIndex;
+	List *placementList = NIL;
+	MemoryContext oldContext = NULL;
+	ListCell *placementCell = NULL;
+	GroupShardPlacement *placementArray = NULL;
+	int placementOffset = 0;
+	int numberOfPlacements = 0;
+
+	/* build list of shard placements */
+	placementList = BuildShardPlacementList(shardInterval);
+	numberOfPlacements = list_length(placementList);
+
+	/* and copy that list into the cache entry */
+	oldContext = MemoryContextSwitchTo(CacheMemoryContext);
+	placementArray = palloc0(numberOfPlacements * sizeof(GroupShardPlacement));
+	foreach(placementCell, placementList)
+	{
+		GroupShardPlacement *srcPlacement =
+			(GroupShardPlacement *) lfirst(placementCell);
+		GroupShardPlacement *dstPlacement = &placementArray[placementOffset];
+
+		memcpy(dstPlacement, srcPlacement, sizeof(GroupShardPlacement));
+		placementOffset++;
+	}
+	MemoryContextSwitchTo(oldContext);
+
+	cacheEntry->arrayOfPlacementArrays[shardIndex] = placementArray;
+	cacheEntry->arrayOfPlacementArrayLengths[shardIndex] = numberOfPlacements;
+}
+
+
+/*
+ * BuildShardHashArrays copies the min and max hash values of the shards of a
+ * hash partitioned table into contiguous arrays in the cache entry.
+ */
+static void
+BuildShardHashArrays(DistTableCacheEntry *cacheEntry)
+{
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	int shardIndex = 0;
+
+	if (shardCount == 0)
+	{
+		return;
+	}
+
+	cacheEntry->shardMinHashArray =
+		MemoryContextAlloc(CacheMemoryContext, shardCount * sizeof(int32));
+	cacheEntry->shardMaxHashArray =
+		MemoryContextAlloc(CacheMemoryContext, shardCount * sizeof(int32));
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+
+		cacheEntry->shardMinHashArray[shardIndex] =
+			DatumGetInt32(shardInterval->minValue);
+		cacheEntry->shardMaxHashArray[shardIndex] =
+			DatumGetInt32(shardInterval->maxValue);
+	}
+}
+
+
+/*
+ * RevalidateDistTableCacheEntry brings an invalidated cache entry of a
+ * distributed table up to date by reading the placements of only those shards
+ * whose placements changed since the entry was built, according to the shard
+ * invalidation log. The function returns false if other metadata of the table
+ * might have changed, in which case the entry needs to be rebuilt.
+ */
+static bool
+RevalidateDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
+{
+	uint64 logPosition = 0;
+	List *shardIdList = NIL;
+	List *shardEntryList = NIL;
+	ListCell *shardIdCell = NULL;
+	ListCell *shardEntryCell = NULL;
+
+	if (!ShardInvalidationLogEnabled() || !cacheEntry->isDistributedTable)
+	{
+		return false;
+	}
+
+	logPosition = ShardInvalidationLogPosition();
+
+	if (!InvalidatedShardPlacementList(cacheEntry->relationId,
+									   cacheEntry->shardInvalidationLogPosition,
+									   logPosition, &shardIdList))
+	{
+		return false;
+	}
+
+	/* check that all shards are known before changing the entry */
+	foreach(shardIdCell, shardIdList)
+	{
+		uint64 shardId = *((uint64 *) lfirst(shardIdCell));
+		ShardCacheEntry *shardEntry = NULL;
+		bool foundInCache = false;
+
+		shardEntry = hash_search(DistShardCacheHash, &shardId, HASH_FIND,
+								 &foundInCache);
+		if (!foundInCache || shardEntry->tableEntry != cacheEntry)
+		{
+			return false;
+		}
+
+		shardEntryList = lappend(shardEntryList, shardEntry);
+	}
+
+	foreach(shardEntryCell, shardEntryList)
+	{
+		ShardCacheEntry *shardEntry = (ShardCacheEntry *) lfirst(shardEntryCell);
+		int shardIndex = shardEntry->shardIndex;
+		ShardInterval *shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+		GroupShardPlacement *oldPlacementArray =
+			cacheEntry->arrayOfPlacementArrays[shardIndex];
+
+		/* placements that were not loaded yet are read on first use */
+		if (oldPlacementArray == NULL)
+		{
+			continue;
+		}
+
+		/* replace the placements first, in case reading them errors out */
+		BuildCachedShardPlacements(cacheEntry, shardInterval);
+		pfree(oldPlacementArray);
+	}
+
+	cacheEntry->shardInvalidationLogPosition = logPosition;
+
+	return true;
+}
+
+
 /*
  * SortedShardIntervalArray sorts the input shardIntervalArray. Shard intervals with
  * no min/max values are placed at the end of the array.
@@ -1289,6 +2000,52 @@ HasOverlappingShardInterval(ShardInterval **shardIntervalArray,
 }
 
 
+/*
+ * GreatestMaxValueIndexArray returns an array that contains, for each position
+ * in the given sorted shard interval array, the index of the interval with the
+ * greatest maxValue among the intervals up to and including that position. The
+ * intervals are expected to have min/max values. The array is allocated in
+ * CacheMemoryContext, and is NULL if there are no intervals.
+ */
+static int *
+GreatestMaxValueIndexArray(ShardInterval **sortedShardIntervalArray, int shardCount,
+						   FmgrInfo *shardIntervalSortCompareFunction)
+{
+	int *greatestMaxValueIndexArray = NULL;
+	int greatestMaxValueIndex = 0;
+	int shardIndex = 0;
+
+	if (shardCount == 0)
+	{
+		return NULL;
+	}
+
+	greatestMaxValueIndexArray = MemoryContextAllocZero(CacheMemoryContext,
+														shardCount * sizeof(int));
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = sortedShardIntervalArray[shardIndex];
+		ShardInterval *greatestShardInterval =
+			sortedShardIntervalArray[greatestMaxValueIndex];
+		Datum comparisonDatum = CompareCall2(shardIntervalSortCompareFunction,
+											 shardInterval->maxValue,
+											 greatestShardInterval->maxValue);
+
+		Assert(shardInterval->minValueExists && shardInterval->maxValueExists);
+
+		if (DatumGetInt32(comparisonDatum) > 0)
+		{
+			greatestMaxValueIndex = shardIndex;
+		}
+
+		greatestMaxValueIndexArray[shardIndex] = greatestMaxValueIndex;
+	}
+
+	return greatestMaxValueIndexArray;
+}
+
+
 /*
  * CitusHasBeenLoaded returns true if the citus extension has been created
  * in the current database and the extension script has been executed. Otherwise,
@@ -1614,79 +2371,177 @@ InstalledExtensionVersion(void)
 							errmsg("citus extension version is null")));
 		}
 
-		/* we will cache the result of citus version to prevent catalog access */
-		oldMemoryContext = MemoryContextSwitchTo(CacheMemoryContext);
+		/* we will cache the result of citus version to prevent catalog access */
+		oldMemoryContext = MemoryContextSwitchTo(CacheMemoryContext);
+
+		installedExtensionVersion = text_to_cstring(DatumGetTextPP(installedVersion));
+
+		MemoryContextSwitchTo(oldMemoryContext);
+	}
+	else
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("citus extension is not loaded")));
+	}
+
+	systable_endscan(scandesc);
+
+	heap_close(relation, AccessShareLock);
+
+	return installedExtensionVersion;
+}
+
+
+/* return oid of pg_dist_shard relation */
+Oid
+DistShardRelationId(void)
+{
+	CachedRelationLookup("pg_dist_shard",
+						 &MetadataCache.distShardRelationId);
+
+	return MetadataCache.distShardRelationId;
+}
+
+
+/* return oid of pg_dist_placement relation */
+Oid
+DistPlacementRelationId(void)
+{
+	CachedRelationLookup("pg_dist_placement",
+						 &MetadataCache.distPlacementRelationId);
+
+	return MetadataCache.distPlacementRelationId;
+}
+
+
+/* return oid of pg_dist_node relation */
+Oid
+DistNodeRelationId(void)
+{
+	CachedRelationLookup("pg_dist_node",
+						 &MetadataCache.distNodeRelationId);
+
+	return MetadataCache.distNodeRelationId;
+}
+
+
+/* return oid of pg_dist_node's primary key index */
+Oid
+DistNodeNodeIdIndexId(void)
+{
+	CachedRelationLookup("pg_dist_node_pkey",
+						 &MetadataCache.distNodeNodeIdIndexId);
+
+	return MetadataCache.distNodeNodeIdIndexId;
+}
+
+
+/* return oid of pg_dist_local_group relation */
+Oid
+DistLocalGroupIdRelationId(void)
+{
+	CachedRelationLookup("pg_dist_local_group",
+						 &MetadataCache.distLocalGroupRelationId);
+
+	return MetadataCache.distLocalGroupRelationId;
+}
+
+
+/* return oid of pg_dist_function relation */
+Oid
+DistFunctionRelationId(void)
+{
+	CachedRelationLookup("pg_dist_function",
+						 &MetadataCache.distFunctionRelationId);
+
+	return MetadataCache.distFunctionRelationId;
+}
+
+
+/* return oid of pg_dist_function_pkey index */
+Oid
+DistFunctionFuncidIndexId(void)
+{
+	CachedRelationLookup("pg_dist_function_pkey",
+						 &MetadataCache.distFunctionFuncidIndexId);
+
+	return MetadataCache.distFunctionFuncidIndexId;
+}
+
 
-		installedExtensionVersion = text_to_cstring(DatumGetTextPP(installedVersion));
+/* return oid of pg_dist_shard_zone_map relation */
+Oid
+DistShardZoneMapRelationId(void)
+{
+	CachedRelationLookup("pg_dist_shard_zone_map",
+						 &MetadataCache.distShardZoneMapRelationId);
 
-		MemoryContextSwitchTo(oldMemoryContext);
-	}
-	else
-	{
-		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
-						errmsg("citus extension is not loaded")));
-	}
+	return MetadataCache.distShardZoneMapRelationId;
+}
 
-	systable_endscan(scandesc);
 
-	heap_close(relation, AccessShareLock);
+/* return oid of pg_dist_shard_zone_map_pkey index */
+Oid
+DistShardZoneMapPrimaryKeyIndexId(void)
+{
+	CachedRelationLookup("pg_dist_shard_zone_map_pkey",
+						 &MetadataCache.distShardZoneMapPrimaryKeyIndexId);
 
-	return installedExtensionVersion;
+	return MetadataCache.distShardZoneMapPrimaryKeyIndexId;
 }
 
 
-/* return oid of pg_dist_shard relation */
+/* return oid of pg_dist_shard_zone_map_logicalrelid_index index */
 Oid
-DistShardRelationId(void)
+DistShardZoneMapLogicalRelidIndexId(void)
 {
-	CachedRelationLookup("pg_dist_shard",
-						 &MetadataCache.distShardRelationId);
+	CachedRelationLookup("pg_dist_shard_zone_map_logicalrelid_index",
+						 &MetadataCache.distShardZoneMapLogicalRelidIndexId);
 
-	return MetadataCache.distShardRelationId;
+	return MetadataCache.distShardZoneMapLogicalRelidIndexId;
 }
 
 
-/* return oid of pg_dist_placement relation */
+/* return oid of pg_dist_retention_policy relation */
 Oid
-DistPlacementRelationId(void)
+DistRetentionPolicyRelationId(void)
 {
-	CachedRelationLookup("pg_dist_placement",
-						 &MetadataCache.distPlacementRelationId);
+	CachedRelationLookup("pg_dist_retention_policy",
+						 &MetadataCache.distRetentionPolicyRelationId);
 
-	return MetadataCache.distPlacementRelationId;
+	return MetadataCache.distRetentionPolicyRelationId;
 }
 
 
-/* return oid of pg_dist_node relation */
+/* return oid of pg_dist_retention_policy_pkey index */
 Oid
-DistNodeRelationId(void)
+DistRetentionPolicyPrimaryKeyIndexId(void)
 {
-	CachedRelationLookup("pg_dist_node",
-						 &MetadataCache.distNodeRelationId);
+	CachedRelationLookup("pg_dist_retention_policy_pkey",
+						 &MetadataCache.distRetentionPolicyPrimaryKeyIndexId);
 
-	return MetadataCache.distNodeRelationId;
+	return MetadataCache.distRetentionPolicyPrimaryKeyIndexId;
 }
 
 
-/* return oid of pg_dist_node's primary key index */
+/* return oid of pg_dist_rollup relation */
 Oid
-DistNodeNodeIdIndexId(void)
+DistRollupRelationId(void)
 {
-	CachedRelationLookup("pg_dist_node_pkey",
-						 &MetadataCache.distNodeNodeIdIndexId);
+	CachedRelationLookup("pg_dist_rollup", &MetadataCache.distRollupRelationId);
 
-	return MetadataCache.distNodeNodeIdIndexId;
+	return MetadataCache.distRollupRelationId;
 }
 
 
-/* return oid of pg_dist_local_group relation */
+/* return oid of pg_dist_rollup_pkey index */
 Oid
-DistLocalGroupIdRelationId(void)
+DistRollupPrimaryKeyIndexId(void)
 {
-	CachedRelationLookup("pg_dist_local_group",
-						 &MetadataCache.distLocalGroupRelationId);
+	CachedRelationLookup("pg_dist_rollup_pkey",
+						 &MetadataCache.distRollupPrimaryKeyIndexId);
 
-	return MetadataCache.distLocalGroupRelationId;
+	return MetadataCache.distRollupPrimaryKeyIndexId;
 }
 
 
@@ -2460,6 +3315,33 @@ InitializeDistTableCache(void)
 		hash_create("Shard Cache", 32 * 64, &info,
 					HASH_ELEM | HASH_FUNCTION);
 
+	/* initialize the per-colocation group hash table */
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint32);
+	info.entrysize = sizeof(ColocationGroupCacheEntry);
+	info.hash = tag_hash;
+	ColocationGroupCacheHash =
+		hash_create("Colocation Group Cache", 32, &info,
+					HASH_ELEM | HASH_FUNCTION);
+
+	/* initialize the per-function hash table */
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(Oid);
+	info.entrysize = sizeof(DistFunctionCacheEntry);
+	info.hash = tag_hash;
+	DistFunctionCacheHash =
+		hash_create("Function Cache", 32, &info,
+					HASH_ELEM | HASH_FUNCTION);
+
+	/* initialize the per-table zone map hash table */
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(Oid);
+	info.entrysize = sizeof(ShardZoneMapCacheEntry);
+	info.hash = tag_hash;
+	ShardZoneMapCacheHash =
+		hash_create("Shard Zone Map Cache", 32, &info,
+					HASH_ELEM | HASH_FUNCTION);
+
 	/* Watch for invalidation events. */
 	CacheRegisterRelcacheCallback(InvalidateDistRelationCacheCallback,
 								  (Datum) 0);
@@ -2482,6 +3364,50 @@ GetWorkerNodeHash(void)
 }
 
 
+/*
+ * LookupNodeGroup returns the nodes of the given node group in the worker node
+ * cache, or NULL if there are no nodes in the group.
+ */
+WorkerNodeGroup *
+LookupNodeGroup(uint32 groupId)
+{
+	static WorkerNodeGroup scannedNodeGroup;
+	int workerNodeIndex = 0;
+
+	PrepareWorkerNodeCache();
+
+	if (NodeGroupArray != NULL)
+	{
+		if (groupId >= NodeGroupArrayLength || !NodeGroupArray[groupId].hasNodes)
+		{
+			return NULL;
+		}
+
+		return &NodeGroupArray[groupId];
+	}
+
+	/* the group IDs are too sparse for an array, search all nodes */
+	memset(&scannedNodeGroup, 0, sizeof(scannedNodeGroup));
+
+	for (workerNodeIndex = 0; workerNodeIndex < WorkerNodeCount; workerNodeIndex++)
+	{
+		WorkerNode *workerNode = WorkerNodeArray[workerNodeIndex];
+
+		if (workerNode->groupId == groupId)
+		{
+			AddNodeToGroup(&scannedNodeGroup, workerNode);
+		}
+	}
+
+	if (!scannedNodeGroup.hasNodes)
+	{
+		return NULL;
+	}
+
+	return &scannedNodeGroup;
+}
+
+
 /*
  * PrepareWorkerNodeCache makes sure the worker node data from pg_dist_node is cached,
  * if it is not already cached.
@@ -2529,6 +3455,8 @@ InitializeWorkerNodeCache(void)
 	bool includeNodesFromOtherClusters = false;
 	int newWorkerNodeCount = 0;
 	WorkerNode **newWorkerNodeArray = NULL;
+	WorkerNodeGroup *newNodeGroupArray = NULL;
+	uint32 newNodeGroupArrayLength = 0;
 	int workerNodeIndex = 0;
 
 	InitializeCaches();
@@ -2592,6 +3520,9 @@ InitializeWorkerNodeCache(void)
 		pfree(currentNode);
 	}
 
+	newNodeGroupArray = BuildNodeGroupArray(newWorkerNodeArray, newWorkerNodeCount,
+											&newNodeGroupArrayLength);
+
 	/* now, safe to destroy the old hash */
 	hash_destroy(WorkerNodeHash);
 
@@ -2600,9 +3531,80 @@ InitializeWorkerNodeCache(void)
 		pfree(WorkerNodeArray);
 	}
 
+	if (NodeGroupArray != NULL)
+	{
+		pfree(NodeGroupArray);
+	}
+
 	WorkerNodeCount = newWorkerNodeCount;
 	WorkerNodeArray = newWorkerNodeArray;
 	WorkerNodeHash = newWorkerNodeHash;
+	NodeGroupArray = newNodeGroupArray;
+	NodeGroupArrayLength = newNodeGroupArrayLength;
+}
+
+
+/*
+ * BuildNodeGroupArray returns an array in CacheMemoryContext which holds the
+ * nodes of each node group at the index of the group ID, and sets
+ * nodeGroupArrayLength to its length. Group IDs are usually assigned from a
+ * sequence, but if the largest one exceeds MAX_NODE_GROUP_ARRAY_LENGTH we
+ * return NULL, and groups are looked up by searching all nodes.
+ */
+static WorkerNodeGroup *
+BuildNodeGroupArray(WorkerNode **workerNodeArray, int workerNodeCount,
+					uint32 *nodeGroupArrayLength)
+{
+	WorkerNodeGroup *nodeGroupArray = NULL;
+	uint32 maxGroupId = 0;
+	int workerNodeIndex = 0;
+
+	for (workerNodeIndex = 0; workerNodeIndex < workerNodeCount; workerNodeIndex++)
+	{
+		maxGroupId = Max(maxGroupId, workerNodeArray[workerNodeIndex]->groupId);
+	}
+
+	if (maxGroupId >= MAX_NODE_GROUP_ARRAY_LENGTH)
+	{
+		*nodeGroupArrayLength = 0;
+		return NULL;
+	}
+
+	*nodeGroupArrayLength = maxGroupId + 1;
+	nodeGroupArray = MemoryContextAllocZero(CacheMemoryContext,
+											*nodeGroupArrayLength *
+											sizeof(WorkerNodeGroup));
+
+	for (workerNodeIndex = 0; workerNodeIndex < workerNodeCount; workerNodeIndex++)
+	{
+		WorkerNode *workerNode = workerNodeArray[workerNodeIndex];
+
+		AddNodeToGroup(&nodeGroupArray[workerNode->groupId], workerNode);
+	}
+
+	return nodeGroupArray;
+}
+
+
+/*
+ * AddNodeToGroup adds the given node to the given node group, keeping the
+ * first primary node and the first MAX_SECONDARY_NODES_PER_GROUP secondary
+ * nodes of the group.
+ */
+static void
+AddNodeToGroup(WorkerNodeGroup *nodeGroup, WorkerNode *workerNode)
+{
+	nodeGroup->hasNodes = true;
+
+	if (nodeGroup->primaryNode == NULL && WorkerNodeIsPrimary(workerNode))
+	{
+		nodeGroup->primaryNode = workerNode;
+	}
+	else if (nodeGroup->secondaryNodeCount < MAX_SECONDARY_NODES_PER_GROUP &&
+			 WorkerNodeIsSecondary(workerNode))
+	{
+		nodeGroup->secondaryNodes[nodeGroup->secondaryNodeCount++] = workerNode;
+	}
 }
 
 
@@ -2749,6 +3751,24 @@ ResetDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 		cacheEntry->hashFunction = NULL;
 	}
 
+	if (cacheEntry->greatestMaxValueIndexArray != NULL)
+	{
+		pfree(cacheEntry->greatestMaxValueIndexArray);
+		cacheEntry->greatestMaxValueIndexArray = NULL;
+	}
+	cacheEntry->initializedShardIntervalCount = 0;
+
+	if (cacheEntry->shardMinHashArray != NULL)
+	{
+		pfree(cacheEntry->shardMinHashArray);
+		cacheEntry->shardMinHashArray = NULL;
+	}
+	if (cacheEntry->shardMaxHashArray != NULL)
+	{
+		pfree(cacheEntry->shardMaxHashArray);
+		cacheEntry->shardMaxHashArray = NULL;
+	}
+
 	if (cacheEntry->shardIntervalArrayLength == 0)
 	{
 		return;
@@ -2763,8 +3783,11 @@ ResetDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 		bool valueByVal = shardInterval->valueByVal;
 		bool foundInCache = false;
 
-		/* delete the shard's placements */
-		pfree(placementArray);
+		/* delete the shard's placements, unless they were never loaded */
+		if (placementArray != NULL)
+		{
+			pfree(placementArray);
+		}
 
 		/* delete per-shard cache-entry */
 		hash_search(DistShardCacheHash, &shardInterval->shardId, HASH_REMOVE,
@@ -2845,6 +3868,22 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 		}
 	}
 
+	/*
+	 * Tables join or leave a colocation group through pg_dist_partition
+	 * changes, which invalidate the relcache of the table. The table might
+	 * not be in DistTableCacheHash yet, so we don't know its colocation group.
+	 */
+	InvalidateColocationGroupCache();
+
+	/* functions are added to pg_dist_function by create_distributed_function */
+	if (relationId == InvalidOid || relationId == MetadataCache.distFunctionRelationId)
+	{
+		InvalidateDistFunctionCache();
+	}
+
+	/* changes of the zone maps of a table invalidate the relcache of the table */
+	InvalidateShardZoneMapCache(relationId);
+
 	/*
 	 * If pg_dist_partition is being invalidated drop all state
 	 * This happens pretty rarely, but most importantly happens during
@@ -2852,11 +3891,96 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 	 */
 	if (relationId != InvalidOid && relationId == MetadataCache.distPartitionRelationId)
 	{
+		DistTableCacheEntry *cacheEntry = NULL;
+		HASH_SEQ_STATUS status;
+
+		/* the shard invalidation log does not cover such changes */
+		hash_seq_init(&status, DistTableCacheHash);
+
+		while ((cacheEntry = (DistTableCacheEntry *) hash_seq_search(&status)) != NULL)
+		{
+			cacheEntry->shardInvalidationLogPosition = 0;
+		}
+
+		InvalidateDistFunctionCache();
+		InvalidateShardZoneMapCache(InvalidOid);
 		InvalidateMetadataSystemCache();
 	}
 }
 
 
+/*
+ * InvalidateDistFunctionCache marks all entries of the function cache as
+ * invalid.
+ */
+static void
+InvalidateDistFunctionCache(void)
+{
+	DistFunctionCacheEntry *cacheEntry = NULL;
+	HASH_SEQ_STATUS status;
+
+	hash_seq_init(&status, DistFunctionCacheHash);
+
+	while ((cacheEntry = hash_seq_search(&status)) != NULL)
+	{
+		cacheEntry->isValid = false;
+	}
+}
+
+
+/*
+ * InvalidateShardZoneMapCache marks the zone maps of the given table as
+ * invalid, or those of all tables if relationId is InvalidOid.
+ */
+static void
+InvalidateShardZoneMapCache(Oid relationId)
+{
+	ShardZoneMapCacheEntry *cacheEntry = NULL;
+
+	if (relationId == InvalidOid)
+	{
+		HASH_SEQ_STATUS status;
+
+		hash_seq_init(&status, ShardZoneMapCacheHash);
+
+		while ((cacheEntry = hash_seq_search(&status)) != NULL)
+		{
+			cacheEntry->isValid = false;
+		}
+	}
+	else
+	{
+		bool foundInCache = false;
+
+		cacheEntry = hash_search(ShardZoneMapCacheHash, &relationId, HASH_FIND,
+								 &foundInCache);
+		if (foundInCache)
+		{
+			cacheEntry->isValid = false;
+		}
+	}
+}
+
+
+/*
+ * InvalidateColocationGroupCache marks all entries of the colocation group
+ * cache as invalid.
+ */
+static void
+InvalidateColocationGroupCache(void)
+{
+	ColocationGroupCacheEntry *cacheEntry = NULL;
+	HASH_SEQ_STATUS status;
+
+	hash_seq_init(&status, ColocationGroupCacheHash);
+
+	while ((cacheEntry = hash_seq_search(&status)) != NULL)
+	{
+		cacheEntry->isValid = false;
+	}
+}
+
+
 /*
  * FlushDistTableCache flushes the entire distributed relation cache, frees
  * all entries, and recreates the cache.
@@ -2876,6 +4000,8 @@ FlushDistTableCache(void)
 
 	hash_destroy(DistTableCacheHash);
 	CreateDistTableCache();
+
+	InvalidateColocationGroupCache();
 }
 
 
@@ -3060,10 +4186,11 @@ LookupDistShardTuples(Oid relationId)
 /*
  * LookupShardRelation returns the logical relation oid a shard belongs to.
  *
- * Errors out if the shardId does not exist.
+ * Errors out if the shardId does not exist and missingOk is false, returns
+ * InvalidOid otherwise.
  */
 static Oid
-LookupShardRelation(int64 shardId)
+LookupShardRelation(int64 shardId, bool missingOk)
 {
 	SysScanDesc scanDescriptor = NULL;
 	ScanKeyData scanKey[1];
@@ -3081,14 +4208,17 @@ LookupShardRelation(int64 shardId)
 										NULL, scanKeyCount, scanKey);
 
 	heapTuple = systable_getnext(scanDescriptor);
-	if (!HeapTupleIsValid(heapTuple))
+	if (!HeapTupleIsValid(heapTuple) && !missingOk)
 	{
 		ereport(ERROR, (errmsg("could not find valid entry for shard "
 							   UINT64_FORMAT, shardId)));
 	}
 
-	shardForm = (Form_pg_dist_shard) GETSTRUCT(heapTuple);
-	relationId = shardForm->logicalrelid;
+	if (HeapTupleIsValid(heapTuple))
+	{
+		shardForm = (Form_pg_dist_shard) GETSTRUCT(heapTuple);
+		relationId = shardForm->logicalrelid;
+	}
 
 	systable_endscan(scanDescriptor);
 	heap_close(pgDistShard, NoLock);
@@ -3097,6 +4227,62 @@ LookupShardRelation(int64 shardId)
 }
 
 
+/*
+ * ShardRelationId returns the distributed table the given shard belongs to,
+ * or InvalidOid if pg_dist_shard does not contain the shard. Unlike
+ * LoadShardInterval it does not error out on unknown shards, which allows it
+ * to be used on workers for shards that are not in the metadata.
+ */
+Oid
+ShardRelationId(int64 shardId)
+{
+	ShardCacheEntry *shardEntry = NULL;
+	bool foundInCache = false;
+
+	InitializeCaches();
+
+	shardEntry = hash_search(DistShardCacheHash, &shardId, HASH_FIND, &foundInCache);
+	if (foundInCache && shardEntry->tableEntry->isValid)
+	{
+		return shardEntry->tableEntry->relationId;
+	}
+
+	return LookupShardRelation(shardId, true);
+}
+
+
+/*
+ * ShardExists returns whether pg_dist_shard contains the given shard. Unlike
+ * LoadShardInterval it reads the catalog directly, and does not error out on
+ * shards that were dropped.
+ */
+bool
+ShardExists(int64 shardId)
+{
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	HeapTuple heapTuple = NULL;
+	Relation pgDistShard = heap_open(DistShardRelationId(), AccessShareLock);
+	bool shardExists = false;
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_shard_shardid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(shardId));
+
+	scanDescriptor = systable_beginscan(pgDistShard,
+										DistShardShardidIndexId(), true,
+										NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	shardExists = HeapTupleIsValid(heapTuple);
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistShard, NoLock);
+
+	return shardExists;
+}
+
+
 /*
  * GetPartitionTypeInputInfo populates output parameters with the interval type
  * identifier and modifier for the specified partition key/method combination.
@@ -3258,9 +4444,23 @@ CachedRelationLookup(const char *relationName, Oid *cachedOid)
  * pg_dist_partition deletion) after the relation has been dropped. That's ok,
  * because in those cases we're guaranteed to already have registered an
  * invalidation for the target relation.
+ *
+ * The shards of the relation are also removed from the shared metadata cache.
  */
 void
 CitusInvalidateRelcacheByRelid(Oid relationId)
+{
+	RegisterDistTableInvalidation(relationId);
+	LogRelationInvalidation(relationId);
+}
+
+
+/*
+ * RegisterDistTableInvalidation registers a relcache invalidation for the
+ * given relation, and removes its shards from the shared metadata cache.
+ */
+static void
+RegisterDistTableInvalidation(Oid relationId)
 {
 	HeapTuple classTuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relationId));
 
@@ -3269,12 +4469,16 @@ CitusInvalidateRelcacheByRelid(Oid relationId)
 		CacheInvalidateRelcacheByTuple(classTuple);
 		ReleaseSysCache(classTuple);
 	}
+
+	InvalidateSharedShardList(relationId);
 }
 
 
 /*
  * Register a relcache invalidation for the distributed relation associated
- * with the shard.
+ * with the shard. The shard invalidation log records that only the placements
+ * of the shard changed, such that other backends do not need to rebuild the
+ * whole cache entry of the relation.
  */
 void
 CitusInvalidateRelcacheByShardId(int64 shardId)
@@ -3304,7 +4508,8 @@ CitusInvalidateRelcacheByShardId(int64 shardId)
 	if (HeapTupleIsValid(heapTuple))
 	{
 		shardForm = (Form_pg_dist_shard) GETSTRUCT(heapTuple);
-		CitusInvalidateRelcacheByRelid(shardForm->logicalrelid);
+		RegisterDistTableInvalidation(shardForm->logicalrelid);
+		LogShardPlacementInvalidation(shardForm->logicalrelid, shardId);
 	}
 	else
 	{
@@ -0,0 +1,270 @@
+/*-------------------------------------------------------------------------
+ *
+ * metadata_prewarm.c
+ *   Records the recently used distributed tables and loads their metadata
+ *   into the shared metadata cache after a restart or failover.
+ *
+ *   After a restart, every backend reads the shards and placements of the
+ *   distributed tables it uses from the catalogs at the same time, which is
+ *   slow for tables with many shards. When citus.metadata_prewarm_table_count
+ *   and citus.shared_metadata_cache_size are set, the maintenance daemon
+ *   periodically records the tables that backends loaded from the shared
+ *   metadata cache, along with the time of their last use, in
+ *   pg_dist_metadata_prewarm. Since that is a regular table, it survives
+ *   restarts and is replicated to standbys. When the maintenance daemon
+ *   starts, it loads the most recently used of these tables into the shared
+ *   metadata cache once, such that backends copy them from there.
+ *   citus_prewarm_metadata_cache() does the same on demand, for instance
+ *   before a restarted coordinator is put back behind a load balancer.
+ *
+ *   Loading a table for prewarming does not count as using it, such that
+ *   tables that are no longer used drop out of the list over time.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "catalog/pg_type.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/metadata_prewarm.h"
+#include "distributed/shared_metadata_cache.h"
+#include "executor/spi.h"
+#include "nodes/pg_list.h"
+#include "utils/snapmgr.h"
+
+
+/* Config variables managed via guc.c */
+int MetadataPrewarmTableCount = 0;
+
+
+static List * RecentlyUsedTableList(int tableCount);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(citus_prewarm_metadata_cache);
+
+
+/*
+ * citus_prewarm_metadata_cache loads the metadata of the most recently used
+ * distributed tables into the shared metadata cache, and returns the number
+ * of tables that were loaded.
+ */
+Datum
+citus_prewarm_metadata_cache(PG_FUNCTION_ARGS)
+{
+	int prewarmedTableCount = 0;
+
+	CheckCitusVersion(ERROR);
+
+	prewarmedTableCount = PrewarmMetadataCache();
+
+	PG_RETURN_INT32(prewarmedTableCount);
+}
+
+
+/*
+ * MetadataPrewarmEnabled returns whether the recently used tables should be
+ * recorded and prewarmed.
+ */
+bool
+MetadataPrewarmEnabled(void)
+{
+	return MetadataPrewarmTableCount > 0 && SharedMetadataCacheEnabled();
+}
+
+
+/*
+ * PrewarmMetadataCache builds the metadata cache entries of the most recently
+ * used distributed tables, which stores their shards and placements in the
+ * shared metadata cache, and returns the number of tables that were loaded.
+ * Tables whose entry is already in the cache of the current backend are not
+ * read again.
+ */
+int
+PrewarmMetadataCache(void)
+{
+	List *relationIdList = NIL;
+	ListCell *relationIdCell = NULL;
+	bool savedLazyPlacementLoading = LazyPlacementLoading;
+	bool savedTrackSharedShardListUse = TrackSharedShardListUse;
+	int prewarmedTableCount = 0;
+
+	if (!MetadataPrewarmEnabled())
+	{
+		return 0;
+	}
+
+	relationIdList = RecentlyUsedTableList(MetadataPrewarmTableCount);
+
+	/* placements are only stored in the shared cache when read right away */
+	LazyPlacementLoading = false;
+	TrackSharedShardListUse = false;
+
+	PG_TRY();
+	{
+		foreach(relationIdCell, relationIdList)
+		{
+			Oid relationId = lfirst_oid(relationIdCell);
+
+			/* tables may have been dropped since they were recorded */
+			if (IsDistributedTable(relationId))
+			{
+				prewarmedTableCount++;
+			}
+
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		LazyPlacementLoading = savedLazyPlacementLoading;
+		TrackSharedShardListUse = savedTrackSharedShardListUse;
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	LazyPlacementLoading = savedLazyPlacementLoading;
+	TrackSharedShardListUse = savedTrackSharedShardListUse;
+
+	return prewarmedTableCount;
+}
+
+
+/*
+ * RecordRecentlyUsedTables records the tables of the current database that
+ * backends used after the given time in pg_dist_metadata_prewarm, and
+ * removes the tables that are no longer distributed or no longer among the
+ * most recently used ones. It returns the number of tables that were used.
+ */
+int
+RecordRecentlyUsedTables(TimestampTz usedAfter)
+{
+	List *useList = NIL;
+	ListCell *useCell = NULL;
+	Oid recordArgumentTypes[2] = { REGCLASSOID, TIMESTAMPTZOID };
+	Oid trimArgumentTypes[1] = { INT4OID };
+	Datum trimArguments[1];
+	int spiResult = 0;
+
+	if (!MetadataPrewarmEnabled())
+	{
+		return 0;
+	}
+
+	useList = RecentlyUsedSharedShardLists(usedAfter);
+	if (useList == NIL)
+	{
+		return 0;
+	}
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "could not connect to SPI manager");
+	}
+
+	foreach(useCell, useList)
+	{
+		SharedShardListUse *listUse = (SharedShardListUse *) lfirst(useCell);
+		Datum recordArguments[2];
+
+		recordArguments[0] = ObjectIdGetDatum(listUse->relationId);
+		recordArguments[1] = TimestampTzGetDatum(listUse->lastUseTime);
+
+		spiResult = SPI_execute_with_args("INSERT INTO pg_catalog.pg_dist_metadata_prewarm "
+										  "AS prewarm (logicalrelid, lastusedtime) "
+										  "VALUES ($1, $2) "
+										  "ON CONFLICT (logicalrelid) DO UPDATE "
+										  "SET lastusedtime = greatest(prewarm.lastusedtime, "
+										  "excluded.lastusedtime)",
+										  2, recordArgumentTypes, recordArguments, NULL,
+										  false, 0);
+		if (spiResult != SPI_OK_INSERT)
+		{
+			elog(ERROR, "could not record the use of distributed table %u",
+				 listUse->relationId);
+		}
+	}
+
+	trimArguments[0] = Int32GetDatum(MetadataPrewarmTableCount);
+
+	spiResult = SPI_execute_with_args("DELETE FROM pg_catalog.pg_dist_metadata_prewarm "
+									  "WHERE logicalrelid NOT IN ("
+									  "SELECT logicalrelid FROM pg_catalog.pg_dist_partition) "
+									  "OR logicalrelid NOT IN ("
+									  "SELECT logicalrelid "
+									  "FROM pg_catalog.pg_dist_metadata_prewarm "
+									  "ORDER BY lastusedtime DESC LIMIT $1)",
+									  1, trimArgumentTypes, trimArguments, NULL,
+									  false, 0);
+	if (spiResult != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not remove tables from pg_dist_metadata_prewarm");
+	}
+
+	SPI_finish();
+
+	PopActiveSnapshot();
+
+	return list_length(useList);
+}
+
+
+/*
+ * RecentlyUsedTableList returns the IDs of up to the given number of tables
+ * in pg_dist_metadata_prewarm, most recently used first.
+ */
+static List *
+RecentlyUsedTableList(int tableCount)
+{
+	List *relationIdList = NIL;
+	MemoryContext callerContext = CurrentMemoryContext;
+	Oid argumentTypes[1] = { INT4OID };
+	Datum arguments[1];
+	uint64 rowIndex = 0;
+	int spiResult = 0;
+
+	arguments[0] = Int32GetDatum(tableCount);
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "could not connect to SPI manager");
+	}
+
+	spiResult = SPI_execute_with_args("SELECT logicalrelid "
+									  "FROM pg_catalog.pg_dist_metadata_prewarm "
+									  "ORDER BY lastusedtime DESC LIMIT $1",
+									  1, argumentTypes, arguments, NULL, true, 0);
+	if (spiResult != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not read pg_dist_metadata_prewarm");
+	}
+
+	for (rowIndex = 0; rowIndex < SPI_processed; rowIndex++)
+	{
+		bool isNull = false;
+		Oid relationId = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[rowIndex],
+														SPI_tuptable->tupdesc, 1,
+														&isNull));
+		MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
+
+		relationIdList = lappend_oid(relationIdList, relationId);
+
+		MemoryContextSwitchTo(spiContext);
+	}
+
+	SPI_finish();
+
+	PopActiveSnapshot();
+
+	return relationIdList;
+}
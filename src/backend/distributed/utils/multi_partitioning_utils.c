@@ -20,6 +20,10 @@
 #include "distributed/multi_partitioning_utils.h"
 #include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
+#if (PG_VERSION_NUM >= 100000)
+#include "optimizer/predtest.h"
+#include "rewrite/rewriteManip.h"
+#endif
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
@@ -28,6 +32,7 @@
 
 #if (PG_VERSION_NUM >= 100000)
 static char * PartitionBound(Oid partitionId);
+static List * PartitionConstraint(Relation parentRelation, Oid partitionId);
 #endif
 
 
@@ -217,6 +222,49 @@ PartitionList(Oid parentRelationId)
 }
 
 
+/*
+ * PrunedPartitionList returns the partitions of the given partitioned table
+ * whose partition constraint is not refuted by the given restriction clauses,
+ * in which the table is referenced by the range table entry at the given
+ * index. The partition constraints are built from the partition bounds in
+ * pg_class, such that partitions are neither opened nor locked.
+ */
+List *
+PrunedPartitionList(Oid parentRelationId, Index rangeTableIndex,
+					List *restrictionClauseList)
+{
+	List *prunedPartitionList = NIL;
+
+#if (PG_VERSION_NUM >= 100000)
+	Relation parentRelation = heap_open(parentRelationId, AccessShareLock);
+	List *partitionList = PartitionList(parentRelationId);
+	ListCell *partitionCell = NULL;
+
+	foreach(partitionCell, partitionList)
+	{
+		Oid partitionId = lfirst_oid(partitionCell);
+		List *partitionConstraint = PartitionConstraint(parentRelation, partitionId);
+
+		/* partition constraints refer to the parent as the first relation */
+		if (rangeTableIndex != 1)
+		{
+			ChangeVarNodes((Node *) partitionConstraint, 1, rangeTableIndex, 0);
+		}
+
+		if (!predicate_refuted_by(partitionConstraint, restrictionClauseList, false))
+		{
+			prunedPartitionList = lappend_oid(prunedPartitionList, partitionId);
+		}
+	}
+
+	/* keep the lock */
+	heap_close(parentRelation, NoLock);
+#endif
+
+	return prunedPartitionList;
+}
+
+
 /*
  * GenerateDetachPartitionCommand gets a partition table and returns
  * "ALTER TABLE parent_table DETACH PARTITION partitionName" command.
@@ -371,4 +419,44 @@ PartitionBound(Oid partitionId)
 }
 
 
+/*
+ * PartitionConstraint returns the implicitly ANDed list of clauses that the
+ * rows of the given partition satisfy according to its partition bound. The
+ * clauses refer to the columns of the parent by their attribute numbers in
+ * the parent. Only the parent is used to build them, so we pass it in place
+ * of the partition.
+ */
+static List *
+PartitionConstraint(Relation parentRelation, Oid partitionId)
+{
+	List *partitionConstraint = NIL;
+	PartitionBoundSpec *partitionBoundSpec = NULL;
+	HeapTuple tuple = NULL;
+	Datum datum = 0;
+	bool isnull = false;
+
+	tuple = SearchSysCache1(RELOID, partitionId);
+	if (!HeapTupleIsValid(tuple))
+	{
+		elog(ERROR, "cache lookup failed for relation %u", partitionId);
+	}
+
+	datum = SysCacheGetAttr(RELOID, tuple, Anum_pg_class_relpartbound, &isnull);
+	if (isnull)
+	{
+		ReleaseSysCache(tuple);
+		return NIL;
+	}
+
+	partitionBoundSpec = (PartitionBoundSpec *) stringToNode(TextDatumGetCString(datum));
+
+	ReleaseSysCache(tuple);
+
+	partitionConstraint = get_qual_from_partbound(parentRelation, parentRelation,
+												  partitionBoundSpec);
+
+	return partitionConstraint;
+}
+
+
 #endif
@@ -31,6 +31,7 @@
 #include "distributed/pg_dist_node.h"
 #include "distributed/reference_table_utils.h"
 #include "distributed/resource_lock.h"
+#include "distributed/secondary_node_routing.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_transaction.h"
@@ -364,24 +365,33 @@ WorkerNodeIsSecondary(WorkerNode *worker)
 
 /*
  * WorkerNodeIsReadable returns whether we're allowed to send SELECT queries to this
- * node.
+ * node. When reading from secondaries, that is only the node of its group that
+ * SecondaryReadNodeForGroup chooses for the current transaction.
  */
 bool
 WorkerNodeIsReadable(WorkerNode *workerNode)
 {
-	if (ReadFromSecondaries == USE_SECONDARY_NODES_NEVER &&
-		WorkerNodeIsPrimary(workerNode))
+	WorkerNodeGroup *nodeGroup = NULL;
+	WorkerNode *readNode = NULL;
+
+	if (!ReadFromSecondaryNodes())
 	{
-		return true;
+		return WorkerNodeIsPrimary(workerNode);
 	}
 
-	if (ReadFromSecondaries == USE_SECONDARY_NODES_ALWAYS &&
-		WorkerNodeIsSecondary(workerNode))
+	nodeGroup = LookupNodeGroup(workerNode->groupId);
+	if (nodeGroup == NULL)
 	{
-		return true;
+		return false;
 	}
 
-	return false;
+	readNode = SecondaryReadNodeForGroup(nodeGroup);
+	if (readNode == NULL)
+	{
+		return false;
+	}
+
+	return readNode->nodeId == workerNode->nodeId;
 }
 
 
@@ -394,33 +404,19 @@ WorkerNodeIsReadable(WorkerNode *workerNode)
 WorkerNode *
 PrimaryNodeForGroup(uint32 groupId, bool *groupContainsNodes)
 {
-	WorkerNode *workerNode = NULL;
-	HASH_SEQ_STATUS status;
-	HTAB *workerNodeHash = GetWorkerNodeHash();
-
-	hash_seq_init(&status, workerNodeHash);
+	WorkerNodeGroup *nodeGroup = LookupNodeGroup(groupId);
 
-	while ((workerNode = hash_seq_search(&status)) != NULL)
+	if (nodeGroup == NULL)
 	{
-		uint32 workerNodeGroupId = workerNode->groupId;
-		if (workerNodeGroupId != groupId)
-		{
-			continue;
-		}
-
-		if (groupContainsNodes != NULL)
-		{
-			*groupContainsNodes = true;
-		}
+		return NULL;
+	}
 
-		if (WorkerNodeIsPrimary(workerNode))
-		{
-			hash_seq_term(&status);
-			return workerNode;
-		}
+	if (groupContainsNodes != NULL)
+	{
+		*groupContainsNodes = true;
 	}
 
-	return NULL;
+	return nodeGroup->primaryNode;
 }
 
 
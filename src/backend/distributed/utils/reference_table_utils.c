@@ -39,8 +39,16 @@ static void ReplicateSingleShardTableToAllWorkers(Oid relationId);
 static void ReplicateShardToAllWorkers(ShardInterval *shardInterval);
 static void ReplicateShardToNode(ShardInterval *shardInterval, char *nodeName,
 								 int nodePort);
+static bool ShardNeedsReplicationToNode(ShardInterval *shardInterval, char *nodeName,
+										int nodePort, ShardPlacement **targetPlacement);
+static void FinalizeReplicatedPlacement(ShardInterval *shardInterval,
+										ShardPlacement *targetPlacement,
+										char *nodeName, int nodePort);
 static void ConvertToReferenceTableMetadata(Oid relationId, uint64 shardId);
 
+/* config variable managed via guc.c */
+int MaxConcurrentReferenceTableCopies = 4;
+
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(upgrade_to_reference_table);
 
@@ -122,6 +130,11 @@ upgrade_to_reference_table(PG_FUNCTION_ARGS)
  * table to update the replication factor column when necessary. This function
  * skips reference tables if that node already has healthy placement of that
  * reference table to prevent unnecessary data transfer.
+ *
+ * The reference tables are streamed from their existing placements, with up to
+ * citus.max_concurrent_reference_table_copies tables being copied at the same
+ * time, and only writes to the reference tables are blocked while they are
+ * copied.
  */
 void
 ReplicateAllReferenceTablesToNode(char *nodeName, int nodePort)
@@ -129,6 +142,11 @@ ReplicateAllReferenceTablesToNode(char *nodeName, int nodePort)
 	List *referenceTableList = ReferenceTableOidList();
 	ListCell *referenceTableCell = NULL;
 	List *workerNodeList = ActivePrimaryNodeList();
+	List *shardIntervalList = NIL;
+	List *sourcePlacementList = NIL;
+	List *targetPlacementList = NIL;
+	ListCell *shardIntervalCell = NULL;
+	ListCell *targetPlacementCell = NULL;
 	uint32 workerCount = 0;
 	Oid firstReferenceTableId = InvalidOid;
 	uint32 referenceTableColocationId = INVALID_COLOCATION_ID;
@@ -147,13 +165,42 @@ ReplicateAllReferenceTablesToNode(char *nodeName, int nodePort)
 	foreach(referenceTableCell, referenceTableList)
 	{
 		Oid referenceTableId = lfirst_oid(referenceTableCell);
-		List *shardIntervalList = LoadShardIntervalList(referenceTableId);
-		ShardInterval *shardInterval = (ShardInterval *) linitial(shardIntervalList);
+		List *referenceShardList = LoadShardIntervalList(referenceTableId);
+		ShardInterval *shardInterval = (ShardInterval *) linitial(referenceShardList);
 		uint64 shardId = shardInterval->shardId;
+		ShardPlacement *targetPlacement = NULL;
+		ShardPlacement *sourcePlacement = NULL;
+		bool missingOk = false;
 
 		LockShardDistributionMetadata(shardId, ExclusiveLock);
 
-		ReplicateShardToNode(shardInterval, nodeName, nodePort);
+		if (!ShardNeedsReplicationToNode(shardInterval, nodeName, nodePort,
+										 &targetPlacement))
+		{
+			continue;
+		}
+
+		ereport(NOTICE, (errmsg("Replicating reference table \"%s\" to the node %s:%d",
+								get_rel_name(referenceTableId), nodeName,
+								nodePort)));
+
+		sourcePlacement = FinalizedShardPlacement(shardId, missingOk);
+
+		shardIntervalList = lappend(shardIntervalList, shardInterval);
+		sourcePlacementList = lappend(sourcePlacementList, sourcePlacement);
+		targetPlacementList = lappend(targetPlacementList, targetPlacement);
+	}
+
+	StreamShardPlacementsToNode(sourcePlacementList, nodeName, nodePort,
+								MaxConcurrentReferenceTableCopies);
+
+	forboth(shardIntervalCell, shardIntervalList, targetPlacementCell,
+			targetPlacementList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		ShardPlacement *targetPlacement = (ShardPlacement *) lfirst(targetPlacementCell);
+
+		FinalizeReplicatedPlacement(shardInterval, targetPlacement, nodeName, nodePort);
 	}
 
 	/*
@@ -262,67 +309,103 @@ static void
 ReplicateShardToNode(ShardInterval *shardInterval, char *nodeName, int nodePort)
 {
 	uint64 shardId = shardInterval->shardId;
-
+	ShardPlacement *targetPlacement = NULL;
+	ShardPlacement *sourceShardPlacement = NULL;
+	char *srcNodeName = NULL;
+	uint32 srcNodePort = 0;
+	List *ddlCommandList = NIL;
+	char *tableOwner = NULL;
 	bool missingOk = false;
-	ShardPlacement *sourceShardPlacement = FinalizedShardPlacement(shardId, missingOk);
-	char *srcNodeName = sourceShardPlacement->nodeName;
-	uint32 srcNodePort = sourceShardPlacement->nodePort;
-	List *ddlCommandList = CopyShardCommandList(shardInterval, srcNodeName, srcNodePort);
 
-	List *shardPlacementList = ShardPlacementList(shardId);
+	if (!ShardNeedsReplicationToNode(shardInterval, nodeName, nodePort,
+									 &targetPlacement))
+	{
+		return;
+	}
+
+	sourceShardPlacement = FinalizedShardPlacement(shardId, missingOk);
+	srcNodeName = sourceShardPlacement->nodeName;
+	srcNodePort = sourceShardPlacement->nodePort;
+	ddlCommandList = CopyShardCommandList(shardInterval, srcNodeName, srcNodePort);
+	tableOwner = TableOwner(shardInterval->relationId);
+
+	ereport(NOTICE, (errmsg("Replicating reference table \"%s\" to the node %s:%d",
+							get_rel_name(shardInterval->relationId), nodeName,
+							nodePort)));
+
+	SendCommandListToWorkerInSingleTransaction(nodeName, nodePort, tableOwner,
+											   ddlCommandList);
+
+	FinalizeReplicatedPlacement(shardInterval, targetPlacement, nodeName, nodePort);
+}
+
+
+/*
+ * ShardNeedsReplicationToNode returns whether the given node lacks a healthy
+ * placement of the given shard, and sets targetPlacement to the placement on
+ * the node if there is one.
+ *
+ * Although reference table shard placements always have shardState =
+ * FILE_FINALIZED, in case of an upgrade of a non-reference table to reference
+ * table, unhealty placements may exist. In this case, we repair the shard
+ * placement and update its state in pg_dist_placement table.
+ */
+static bool
+ShardNeedsReplicationToNode(ShardInterval *shardInterval, char *nodeName, int nodePort,
+							ShardPlacement **targetPlacement)
+{
+	List *shardPlacementList = ShardPlacementList(shardInterval->shardId);
 	bool missingWorkerOk = true;
-	ShardPlacement *targetPlacement = SearchShardPlacementInList(shardPlacementList,
-																 nodeName, nodePort,
-																 missingWorkerOk);
-	char *tableOwner = TableOwner(shardInterval->relationId);
 
-	/*
-	 * Although this function is used for reference tables and reference table shard
-	 * placements always have shardState = FILE_FINALIZED, in case of an upgrade of
-	 * a non-reference table to reference table, unhealty placements may exist. In
-	 * this case, we repair the shard placement and update its state in
-	 * pg_dist_placement table.
-	 */
-	if (targetPlacement == NULL || targetPlacement->shardState != FILE_FINALIZED)
-	{
-		uint64 placementId = 0;
-		uint32 groupId = 0;
+	*targetPlacement = SearchShardPlacementInList(shardPlacementList, nodeName,
+												  nodePort, missingWorkerOk);
 
-		ereport(NOTICE, (errmsg("Replicating reference table \"%s\" to the node %s:%d",
-								get_rel_name(shardInterval->relationId), nodeName,
-								nodePort)));
+	return *targetPlacement == NULL ||
+		   (*targetPlacement)->shardState != FILE_FINALIZED;
+}
 
-		SendCommandListToWorkerInSingleTransaction(nodeName, nodePort, tableOwner,
-												   ddlCommandList);
-		if (targetPlacement == NULL)
-		{
-			groupId = GroupForNode(nodeName, nodePort);
 
-			placementId = GetNextPlacementId();
-			InsertShardPlacementRow(shardId, placementId, FILE_FINALIZED, 0, groupId);
-		}
-		else
-		{
-			groupId = targetPlacement->groupId;
-			placementId = targetPlacement->placementId;
-			UpdateShardPlacementState(placementId, FILE_FINALIZED);
-		}
+/*
+ * FinalizeReplicatedPlacement records the placement of the given shard on the
+ * node it was just replicated to, by inserting a healthy placement or marking
+ * the existing one healthy in pg_dist_placement.
+ */
+static void
+FinalizeReplicatedPlacement(ShardInterval *shardInterval, ShardPlacement *targetPlacement,
+							char *nodeName, int nodePort)
+{
+	uint64 shardId = shardInterval->shardId;
+	uint64 placementId = 0;
+	uint32 groupId = 0;
 
-		/*
-		 * Although ReplicateShardToAllWorkers is used only for reference tables,
-		 * during the upgrade phase, the placements are created before the table is
-		 * marked as a reference table. All metadata (including the placement
-		 * metadata) will be copied to workers after all reference table changed
-		 * are finished.
-		 */
-		if (ShouldSyncTableMetadata(shardInterval->relationId))
-		{
-			char *placementCommand = PlacementUpsertCommand(shardId, placementId,
-															FILE_FINALIZED, 0,
-															groupId);
+	if (targetPlacement == NULL)
+	{
+		groupId = GroupForNode(nodeName, nodePort);
 
-			SendCommandToWorkers(WORKERS_WITH_METADATA, placementCommand);
-		}
+		placementId = GetNextPlacementId();
+		InsertShardPlacementRow(shardId, placementId, FILE_FINALIZED, 0, groupId);
+	}
+	else
+	{
+		groupId = targetPlacement->groupId;
+		placementId = targetPlacement->placementId;
+		UpdateShardPlacementState(placementId, FILE_FINALIZED);
+	}
+
+	/*
+	 * Although ReplicateShardToAllWorkers is used only for reference tables,
+	 * during the upgrade phase, the placements are created before the table is
+	 * marked as a reference table. All metadata (including the placement
+	 * metadata) will be copied to workers after all reference table changed
+	 * are finished.
+	 */
+	if (ShouldSyncTableMetadata(shardInterval->relationId))
+	{
+		char *placementCommand = PlacementUpsertCommand(shardId, placementId,
+														FILE_FINALIZED, 0,
+														groupId);
+
+		SendCommandToWorkers(WORKERS_WITH_METADATA, placementCommand);
 	}
 }
 
@@ -33,6 +33,8 @@
 
 /* local function forward declarations */
 static LOCKMODE IntToLockMode(int mode);
+static void LockTableShardsIntention(uint64 shardId, LOCKMODE lockMode);
+static Oid ShardListTable(List *shardIntervalList);
 
 
 /* exports for SQL callable functions */
@@ -191,6 +193,9 @@ TryLockShardDistributionMetadata(int64 shardId, LOCKMODE lockMode)
  * This task may be assigned to multiple backends at the same time, so the lock
  * manages any concurrency issues associated with shard file fetching and DML
  * command execution.
+ *
+ * Before locking the shard, an intention lock is taken on the shards of its
+ * table as a whole, such that it conflicts with LockTableShardResources.
  */
 void
 LockShardResource(uint64 shardId, LOCKMODE lockmode)
@@ -201,12 +206,122 @@ LockShardResource(uint64 shardId, LOCKMODE lockmode)
 
 	AssertArg(shardId != INVALID_SHARD_ID);
 
+	LockTableShardsIntention(shardId, lockmode);
+
 	SET_LOCKTAG_SHARD_RESOURCE(tag, MyDatabaseId, shardId);
 
 	(void) LockAcquire(&tag, lockmode, sessionLock, dontWait);
 }
 
 
+/*
+ * TryLockShardResource is like LockShardResource, but returns false instead
+ * of waiting when the shard lock is held in a conflicting mode.
+ */
+bool
+TryLockShardResource(uint64 shardId, LOCKMODE lockmode)
+{
+	LOCKTAG tag;
+	const bool sessionLock = false;
+	const bool dontWait = true;
+
+	AssertArg(shardId != INVALID_SHARD_ID);
+
+	LockTableShardsIntention(shardId, lockmode);
+
+	SET_LOCKTAG_SHARD_RESOURCE(tag, MyDatabaseId, shardId);
+
+	return LockAcquire(&tag, lockmode, sessionLock, dontWait) !=
+		   LOCKACQUIRE_NOT_AVAIL;
+}
+
+
+/*
+ * LockTableShardResources locks all shards of the given table with a single
+ * lock, which conflicts with LockShardResource on any shard of the table in
+ * the same way as taking lockMode on every shard would. Since the intention
+ * locks taken by LockShardResource only come in two modes, this is only
+ * possible for lock modes that conflict with ShareUpdateExclusiveLock. For
+ * other lock modes the function returns false without taking a lock, and the
+ * caller should lock the shards individually.
+ *
+ * Shard locks in modes weaker than ShareUpdateExclusiveLock take intention
+ * locks in AccessShareLock, and stronger ones take them in RowShareLock,
+ * neither of which conflict with each other. ShareUpdateExclusiveLock on all
+ * shards therefore becomes ExclusiveLock, which only conflicts with the
+ * latter, and stronger modes become AccessExclusiveLock, which conflicts
+ * with both.
+ */
+bool
+LockTableShardResources(Oid relationId, LOCKMODE lockMode)
+{
+	LOCKTAG tag;
+	const bool sessionLock = false;
+	const bool dontWait = false;
+	LOCKMODE tableLockMode = NoLock;
+
+	if (lockMode < ShareUpdateExclusiveLock || lockMode == ShareLock)
+	{
+		return false;
+	}
+	else if (lockMode == ShareUpdateExclusiveLock)
+	{
+		tableLockMode = ExclusiveLock;
+	}
+	else
+	{
+		tableLockMode = AccessExclusiveLock;
+	}
+
+	SET_LOCKTAG_TABLE_SHARDS_RESOURCE(tag, MyDatabaseId, relationId);
+
+	(void) LockAcquire(&tag, tableLockMode, sessionLock, dontWait);
+
+	return true;
+}
+
+
+/*
+ * LockTableShardsIntention takes the intention lock on the shards of the table
+ * of the given shard that goes with locking the shard in the given mode. No
+ * lock is taken for shards that are not in the metadata, such as the shards
+ * that workers lock while fetching them.
+ */
+static void
+LockTableShardsIntention(uint64 shardId, LOCKMODE lockMode)
+{
+	LOCKTAG tag;
+	const bool sessionLock = false;
+	const bool dontWait = false;
+	LOCKMODE intentionLockMode = NoLock;
+	Oid relationId = InvalidOid;
+
+	if (!CitusHasBeenLoaded())
+	{
+		return;
+	}
+
+	relationId = ShardRelationId(shardId);
+	if (!OidIsValid(relationId))
+	{
+		return;
+	}
+
+	if (lockMode < ShareUpdateExclusiveLock)
+	{
+		intentionLockMode = AccessShareLock;
+	}
+	else
+	{
+		intentionLockMode = RowShareLock;
+	}
+
+	SET_LOCKTAG_TABLE_SHARDS_RESOURCE(tag, MyDatabaseId, relationId);
+
+	(void) LockAcquire(&tag, intentionLockMode, sessionLock, dontWait);
+}
+
+
 /* Releases the lock associated with the relay file fetching/DML task. */
 void
 UnlockShardResource(uint64 shardId, LOCKMODE lockmode)
@@ -275,12 +390,20 @@ LockShardListMetadata(List *shardIntervalList, LOCKMODE lockMode)
 
 /*
  * LockShardListResources takes locks on all shards in shardIntervalList to
- * prevent concurrent DML statements on those shards.
+ * prevent concurrent DML statements on those shards. When the list contains
+ * all shards of a table, a single lock is taken on the table's shards as a
+ * whole if the lock mode allows it.
  */
 void
 LockShardListResources(List *shardIntervalList, LOCKMODE lockMode)
 {
 	ListCell *shardIntervalCell = NULL;
+	Oid relationId = ShardListTable(shardIntervalList);
+
+	if (OidIsValid(relationId) && LockTableShardResources(relationId, lockMode))
+	{
+		return;
+	}
 
 	/* lock shards in order of shard id to prevent deadlock */
 	shardIntervalList = SortList(shardIntervalList, CompareShardIntervalsById);
@@ -295,6 +418,49 @@ LockShardListResources(List *shardIntervalList, LOCKMODE lockMode)
 }
 
 
+/*
+ * ShardListTable returns the table of the shards in shardIntervalList if the
+ * list contains all shards of a single table that is not a partition, and
+ * InvalidOid otherwise. Writes to partitions also lock the shards of their
+ * parent, which a lock on the shards of the partition as a whole does not.
+ */
+static Oid
+ShardListTable(List *shardIntervalList)
+{
+	ListCell *shardIntervalCell = NULL;
+	ShardInterval *firstShardInterval = NULL;
+	DistTableCacheEntry *cacheEntry = NULL;
+	Oid relationId = InvalidOid;
+
+	if (list_length(shardIntervalList) < 2)
+	{
+		return InvalidOid;
+	}
+
+	firstShardInterval = (ShardInterval *) linitial(shardIntervalList);
+	relationId = firstShardInterval->relationId;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+
+		if (shardInterval->relationId != relationId)
+		{
+			return InvalidOid;
+		}
+	}
+
+	cacheEntry = DistributedTableCacheEntry(relationId);
+	if (cacheEntry->shardIntervalArrayLength != list_length(shardIntervalList) ||
+		PartitionTable(relationId))
+	{
+		return InvalidOid;
+	}
+
+	return relationId;
+}
+
+
 /*
  * LockRelationShardResources takes locks on all shards in a list of RelationShards
  * to prevent concurrent DML statements on those shards.
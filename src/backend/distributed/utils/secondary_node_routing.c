@@ -0,0 +1,268 @@
+/*-------------------------------------------------------------------------
+ *
+ * secondary_node_routing.c
+ *
+ * Routing of reads to the secondary nodes of node groups.
+ *
+ * With citus.use_secondary_nodes set to 'always', all reads go to secondary
+ * nodes, and with 'read-only' only the reads of read-only transactions do,
+ * such that a session can read from followers and write to the primaries.
+ *
+ * A node group can have several secondaries. The reads of a transaction are
+ * spread over them by a per-transaction choice, which stays the same during
+ * the transaction such that its reads see a single secondary per group.
+ * When citus.max_secondary_replication_lag is set, secondaries whose replay
+ * lag exceeds it are avoided. The lag of a secondary is measured over a new
+ * connection at most once per citus.secondary_lag_check_interval in each
+ * backend. If all secondaries of a group lag behind, reads go to the primary
+ * of the group, or to the secondary that lags the least if there is none.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+
+#include "access/xact.h"
+#include "distributed/connection_management.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/remote_commands.h"
+#include "distributed/secondary_node_routing.h"
+#include "distributed/worker_manager.h"
+#include "storage/proc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * Replay lag of a secondary in milliseconds. A secondary that has replayed
+ * all WAL it received is not lagging, even if the primary has been idle
+ * since the last replayed transaction.
+ */
+#if (PG_VERSION_NUM >= 100000)
+#define SECONDARY_REPLICATION_LAG_QUERY \
+	"SELECT CASE WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() " \
+	"THEN 0 ELSE COALESCE(GREATEST(extract(epoch FROM now() - " \
+	"pg_last_xact_replay_timestamp()) * 1000, 0), 0)::bigint END"
+#else
+#define SECONDARY_REPLICATION_LAG_QUERY \
+	"SELECT CASE WHEN pg_last_xlog_receive_location() = " \
+	"pg_last_xlog_replay_location() " \
+	"THEN 0 ELSE COALESCE(GREATEST(extract(epoch FROM now() - " \
+	"pg_last_xact_replay_timestamp()) * 1000, 0), 0)::bigint END"
+#endif
+
+
+/*
+ * SecondaryLagEntry is the last measured replay lag of a secondary node,
+ * keyed by its node ID.
+ */
+typedef struct SecondaryLagEntry
+{
+	uint32 nodeId;
+	TimestampTz checkTime;
+	bool lagIsKnown;
+	uint64 replicationLag;
+} SecondaryLagEntry;
+
+
+/* Config variables managed via guc.c */
+int MaxSecondaryReplicationLag = 0; /* in milliseconds, 0 to disable */
+int SecondaryLagCheckInterval = 1000; /* in milliseconds */
+
+static HTAB *SecondaryLagHash = NULL;
+
+
+/* local function forward declarations */
+static SecondaryLagEntry * SecondaryLag(WorkerNode *workerNode);
+static bool FetchSecondaryReplicationLag(WorkerNode *workerNode,
+										 uint64 *replicationLag);
+
+
+/*
+ * ReadFromSecondaryNodes returns whether the reads of the current transaction
+ * go to secondary nodes.
+ */
+bool
+ReadFromSecondaryNodes(void)
+{
+	if (ReadFromSecondaries == USE_SECONDARY_NODES_ALWAYS)
+	{
+		return true;
+	}
+
+	if (ReadFromSecondaries == USE_SECONDARY_NODES_READ_ONLY && XactReadOnly)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * SecondaryReadNodeForGroup returns the node of the given group that the
+ * reads of the current transaction go to when reading from secondary nodes.
+ * That is one of the secondaries that do not lag behind, the primary when
+ * there are none, or the least lagging secondary if the group does not have
+ * a primary either. In 'read-only' mode, groups without secondaries are read
+ * from their primary. NULL is returned if there is no node to read from.
+ */
+WorkerNode *
+SecondaryReadNodeForGroup(WorkerNodeGroup *nodeGroup)
+{
+	WorkerNode *eligibleNodeArray[MAX_SECONDARY_NODES_PER_GROUP];
+	int eligibleNodeCount = 0;
+	WorkerNode *leastLaggingNode = NULL;
+	uint64 leastReplicationLag = 0;
+	uint32 transactionSeed = 0;
+	int secondaryIndex = 0;
+
+	for (secondaryIndex = 0; secondaryIndex < nodeGroup->secondaryNodeCount;
+		 secondaryIndex++)
+	{
+		WorkerNode *secondaryNode = nodeGroup->secondaryNodes[secondaryIndex];
+		SecondaryLagEntry *lagEntry = NULL;
+
+		if (MaxSecondaryReplicationLag <= 0)
+		{
+			eligibleNodeArray[eligibleNodeCount++] = secondaryNode;
+			continue;
+		}
+
+		lagEntry = SecondaryLag(secondaryNode);
+		if (!lagEntry->lagIsKnown)
+		{
+			continue;
+		}
+
+		if (lagEntry->replicationLag <= (uint64) MaxSecondaryReplicationLag)
+		{
+			eligibleNodeArray[eligibleNodeCount++] = secondaryNode;
+		}
+		else if (leastLaggingNode == NULL ||
+				 lagEntry->replicationLag < leastReplicationLag)
+		{
+			leastLaggingNode = secondaryNode;
+			leastReplicationLag = lagEntry->replicationLag;
+		}
+	}
+
+	if (eligibleNodeCount > 0)
+	{
+		/* the reads of a transaction go to the same secondary */
+		transactionSeed = (uint32) MyProcPid;
+		if (MyProc != NULL)
+		{
+			transactionSeed += MyProc->lxid;
+		}
+
+		return eligibleNodeArray[transactionSeed % eligibleNodeCount];
+	}
+
+	if (nodeGroup->primaryNode != NULL &&
+		(nodeGroup->secondaryNodeCount > 0 ||
+		 ReadFromSecondaries == USE_SECONDARY_NODES_READ_ONLY))
+	{
+		if (nodeGroup->secondaryNodeCount > 0)
+		{
+			ereport(DEBUG2, (errmsg("reading from primary node %s:%d since the "
+									"secondary nodes of its group are not usable",
+									nodeGroup->primaryNode->workerName,
+									nodeGroup->primaryNode->workerPort)));
+		}
+
+		return nodeGroup->primaryNode;
+	}
+
+	return leastLaggingNode;
+}
+
+
+/*
+ * SecondaryLag returns the replay lag of the given secondary node, measuring
+ * it when it was not measured within citus.secondary_lag_check_interval.
+ */
+static SecondaryLagEntry *
+SecondaryLag(WorkerNode *workerNode)
+{
+	SecondaryLagEntry *lagEntry = NULL;
+	TimestampTz currentTime = GetCurrentTimestamp();
+	bool found = false;
+
+	if (SecondaryLagHash == NULL)
+	{
+		HASHCTL info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(uint32);
+		info.entrysize = sizeof(SecondaryLagEntry);
+		info.hcxt = CacheMemoryContext;
+
+		SecondaryLagHash = hash_create("Secondary Lag Hash", 32, &info,
+									   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	lagEntry = hash_search(SecondaryLagHash, &workerNode->nodeId, HASH_ENTER, &found);
+	if (!found)
+	{
+		lagEntry->checkTime = 0;
+		lagEntry->lagIsKnown = false;
+		lagEntry->replicationLag = 0;
+	}
+
+	if (lagEntry->checkTime == 0 ||
+		TimestampDifferenceExceeds(lagEntry->checkTime, currentTime,
+								   SecondaryLagCheckInterval))
+	{
+		lagEntry->lagIsKnown = FetchSecondaryReplicationLag(workerNode,
+															&lagEntry->replicationLag);
+		lagEntry->checkTime = currentTime;
+	}
+
+	return lagEntry;
+}
+
+
+/*
+ * FetchSecondaryReplicationLag measures the replay lag of the given secondary
+ * node in milliseconds. It returns false if the node could not be reached.
+ */
+static bool
+FetchSecondaryReplicationLag(WorkerNode *workerNode, uint64 *replicationLag)
+{
+	MultiConnection *connection = GetNodeConnection(FORCE_NEW_CONNECTION,
+													workerNode->workerName,
+													workerNode->workerPort);
+	PGresult *result = NULL;
+	bool lagIsKnown = false;
+	int executeResult = 0;
+
+	if (PQstatus(connection->pgConn) != CONNECTION_OK)
+	{
+		CloseConnection(connection);
+		return false;
+	}
+
+	executeResult = ExecuteOptionalRemoteCommand(connection,
+												 SECONDARY_REPLICATION_LAG_QUERY,
+												 &result);
+	if (executeResult == 0)
+	{
+		if (PQntuples(result) == 1 && !PQgetisnull(result, 0, 0))
+		{
+			*replicationLag = pg_strtouint64(PQgetvalue(result, 0, 0), NULL, 10);
+			lagIsKnown = true;
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+	}
+
+	CloseConnection(connection);
+
+	return lagIsKnown;
+}
@@ -0,0 +1,522 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_invalidation_log.c
+ *   Keeps a log of recent metadata changes of distributed tables in shared
+ *   memory, such that a backend that receives a relcache invalidation for a
+ *   distributed table can reload the placements of only the shards whose
+ *   placements changed, instead of rebuilding its whole cache entry.
+ *
+ *   A relcache invalidation only carries the OID of the table. Hence, every
+ *   transaction that changes metadata appends a record for each changed
+ *   table to the log when it commits, before other backends receive its
+ *   invalidations. A record either names a shard whose placements changed,
+ *   or stands for any other change of the table. Aborted transactions log
+ *   the latter for all tables they changed, since their own cache entries
+ *   contain the aborted changes.
+ *
+ *   A prepared transaction is committed by COMMIT PREPARED, possibly from
+ *   another backend, without the transaction callbacks of the backend that
+ *   prepared it. While a COMMIT PREPARED runs, backends therefore rebuild
+ *   their whole cache entries, and once it is done a record for all tables
+ *   of its database is logged.
+ *
+ *   The log is a ring of SHARD_INVALIDATION_LOG_SIZE records. Cache entries
+ *   remember the log position at which they were read from the catalogs,
+ *   and need to be rebuilt if the log wrapped around since then.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/relay_utility.h"
+#include "distributed/shard_invalidation_log.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+
+/*
+ * ShardInvalidation describes a change of the metadata of a table. The shard
+ * ID is INVALID_SHARD_ID for changes other than those of shard placements,
+ * and the relation ID is InvalidOid for changes of any table.
+ */
+typedef struct ShardInvalidation
+{
+	Oid databaseId;
+	Oid relationId;
+	uint64 shardId;
+} ShardInvalidation;
+
+
+/* shared memory holding the log */
+typedef struct ShardInvalidationLogControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+
+	/* position of the next record, positions start at 1 */
+	uint64 nextPosition;
+
+	/* number of COMMIT PREPARED commands in progress */
+	int commitPreparedCount;
+
+	ShardInvalidation records[SHARD_INVALIDATION_LOG_SIZE];
+} ShardInvalidationLogControlData;
+
+
+/* config variable that enables the log */
+bool EnableShardPlacementInvalidation = false;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ShardInvalidationLogControlData *ShardInvalidationLogControl = NULL;
+
+/* metadata changes of the current transaction, not yet in the log */
+static List *PendingInvalidationList = NIL;
+
+
+static size_t ShardInvalidationLogShmemSize(void);
+static void ShardInvalidationLogShmemInit(void);
+static void AddPendingInvalidation(Oid relationId, uint64 shardId);
+static List * PendingRelationIdList(void);
+static void AppendShardInvalidations(List *invalidationList, bool endCommitPrepared);
+
+
+/*
+ * ShardInvalidationLogEnabled returns whether the log was allocated at server
+ * start.
+ */
+bool
+ShardInvalidationLogEnabled(void)
+{
+	return ShardInvalidationLogControl != NULL;
+}
+
+
+/*
+ * ShardInvalidationLogPosition returns the position of the next record in the
+ * log, or 0 if the log is disabled. It is called before reading metadata from
+ * the catalogs, and also makes sure the catalogs are read with a new snapshot,
+ * which sees all changes that were logged before the returned position.
+ */
+uint64
+ShardInvalidationLogPosition(void)
+{
+	uint64 position = 0;
+
+	if (!ShardInvalidationLogEnabled())
+	{
+		return 0;
+	}
+
+	LWLockAcquire(&ShardInvalidationLogControl->lock, LW_SHARED);
+	position = ShardInvalidationLogControl->nextPosition;
+	LWLockRelease(&ShardInvalidationLogControl->lock);
+
+	InvalidateCatalogSnapshot();
+
+	return position;
+}
+
+
+/*
+ * InvalidatedShardPlacementList finds the shards of the given table whose
+ * placements were changed by records between the given log positions, or by
+ * the current transaction, and returns their IDs in shardIdList. The function
+ * returns false if any other metadata of the table changed, or if the records
+ * are no longer in the log, in which case the caller should read all metadata
+ * of the table again.
+ */
+bool
+InvalidatedShardPlacementList(Oid relationId, uint64 startPosition,
+							  uint64 endPosition, List **shardIdList)
+{
+	uint64 position = 0;
+	bool relationChanged = false;
+	ListCell *invalidationCell = NULL;
+
+	*shardIdList = NIL;
+
+	if (!ShardInvalidationLogEnabled() || startPosition == 0)
+	{
+		return false;
+	}
+
+	LWLockAcquire(&ShardInvalidationLogControl->lock, LW_SHARED);
+
+	/*
+	 * Records might have been overwritten, and the changes of a prepared
+	 * transaction that is being committed are not in the log yet.
+	 */
+	if (ShardInvalidationLogControl->nextPosition - startPosition >
+		SHARD_INVALIDATION_LOG_SIZE ||
+		ShardInvalidationLogControl->commitPreparedCount > 0)
+	{
+		LWLockRelease(&ShardInvalidationLogControl->lock);
+		return false;
+	}
+
+	for (position = startPosition; position < endPosition; position++)
+	{
+		ShardInvalidation *invalidation =
+			&ShardInvalidationLogControl->records[position %
+												  SHARD_INVALIDATION_LOG_SIZE];
+		uint64 *shardIdPointer = NULL;
+
+		if (invalidation->databaseId != MyDatabaseId ||
+			(invalidation->relationId != relationId &&
+			 invalidation->relationId != InvalidOid))
+		{
+			continue;
+		}
+
+		if (invalidation->shardId == INVALID_SHARD_ID)
+		{
+			relationChanged = true;
+			break;
+		}
+
+		shardIdPointer = (uint64 *) palloc0(sizeof(uint64));
+		*shardIdPointer = invalidation->shardId;
+		*shardIdList = lappend(*shardIdList, shardIdPointer);
+	}
+
+	LWLockRelease(&ShardInvalidationLogControl->lock);
+
+	if (relationChanged)
+	{
+		return false;
+	}
+
+	/* our own changes are not in the log yet */
+	foreach(invalidationCell, PendingInvalidationList)
+	{
+		ShardInvalidation *invalidation = (ShardInvalidation *) lfirst(invalidationCell);
+		uint64 *shardIdPointer = NULL;
+
+		if (invalidation->relationId != relationId)
+		{
+			continue;
+		}
+
+		if (invalidation->shardId == INVALID_SHARD_ID)
+		{
+			relationChanged = true;
+			break;
+		}
+
+		shardIdPointer = (uint64 *) palloc0(sizeof(uint64));
+		*shardIdPointer = invalidation->shardId;
+		*shardIdList = lappend(*shardIdList, shardIdPointer);
+	}
+
+	return !relationChanged;
+}
+
+
+/*
+ * LogRelationInvalidation remembers that the current transaction changed the
+ * metadata of the given table, other than its shard placements.
+ */
+void
+LogRelationInvalidation(Oid relationId)
+{
+	if (!ShardInvalidationLogEnabled())
+	{
+		return;
+	}
+
+	AddPendingInvalidation(relationId, INVALID_SHARD_ID);
+}
+
+
+/*
+ * LogShardPlacementInvalidation remembers that the current transaction changed
+ * the placements of the given shard of the given table.
+ */
+void
+LogShardPlacementInvalidation(Oid relationId, uint64 shardId)
+{
+	if (!ShardInvalidationLogEnabled())
+	{
+		return;
+	}
+
+	AddPendingInvalidation(relationId, shardId);
+}
+
+
+/*
+ * ResetShardInvalidationLogTransactionState appends the metadata changes of
+ * the current transaction to the log. It is called at the end of the
+ * transaction, after the changes were committed or aborted, but before other
+ * backends process the invalidations.
+ */
+void
+ResetShardInvalidationLogTransactionState(bool isCommit)
+{
+	if (PendingInvalidationList == NIL)
+	{
+		return;
+	}
+
+	/*
+	 * Our own cache entries may contain aborted changes, and a long list of
+	 * shards would only push all other records out of the log.
+	 */
+	if (!isCommit ||
+		list_length(PendingInvalidationList) > SHARD_INVALIDATION_LOG_SIZE / 2)
+	{
+		List *relationIdList = PendingRelationIdList();
+		ListCell *relationIdCell = NULL;
+
+		PendingInvalidationList = NIL;
+
+		foreach(relationIdCell, relationIdList)
+		{
+			AddPendingInvalidation(lfirst_oid(relationIdCell), INVALID_SHARD_ID);
+		}
+	}
+
+	AppendShardInvalidations(PendingInvalidationList, false);
+
+	/* the list is allocated in the transaction context */
+	PendingInvalidationList = NIL;
+}
+
+
+/*
+ * BeginShardInvalidationLogCommitPrepared is called before COMMIT PREPARED,
+ * and makes backends rebuild their whole cache entries until
+ * EndShardInvalidationLogCommitPrepared is called. The prepared transaction
+ * may have changed metadata, and other backends may process its
+ * invalidations before its changes are logged.
+ */
+void
+BeginShardInvalidationLogCommitPrepared(void)
+{
+	if (!ShardInvalidationLogEnabled())
+	{
+		return;
+	}
+
+	LWLockAcquire(&ShardInvalidationLogControl->lock, LW_EXCLUSIVE);
+	ShardInvalidationLogControl->commitPreparedCount++;
+	LWLockRelease(&ShardInvalidationLogControl->lock);
+}
+
+
+/*
+ * EndShardInvalidationLogCommitPrepared is called after COMMIT PREPARED, also
+ * when it failed. Since we do not know which tables the prepared transaction
+ * changed, it logs a change of all tables of the current database.
+ */
+void
+EndShardInvalidationLogCommitPrepared(void)
+{
+	ShardInvalidation databaseInvalidation;
+
+	if (!ShardInvalidationLogEnabled())
+	{
+		return;
+	}
+
+	memset(&databaseInvalidation, 0, sizeof(ShardInvalidation));
+	databaseInvalidation.databaseId = MyDatabaseId;
+	databaseInvalidation.relationId = InvalidOid;
+	databaseInvalidation.shardId = INVALID_SHARD_ID;
+
+	AppendShardInvalidations(list_make1(&databaseInvalidation), true);
+}
+
+
+/*
+ * AddPendingInvalidation adds a change of the current transaction to the
+ * list of pending changes, unless it repeats the last change.
+ */
+static void
+AddPendingInvalidation(Oid relationId, uint64 shardId)
+{
+	ShardInvalidation *invalidation = NULL;
+	MemoryContext oldContext = NULL;
+
+	if (PendingInvalidationList != NIL)
+	{
+		ShardInvalidation *lastInvalidation =
+			(ShardInvalidation *) llast(PendingInvalidationList);
+
+		if (lastInvalidation->relationId == relationId &&
+			lastInvalidation->shardId == shardId)
+		{
+			return;
+		}
+	}
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	invalidation = (ShardInvalidation *) palloc0(sizeof(ShardInvalidation));
+	invalidation->databaseId = MyDatabaseId;
+	invalidation->relationId = relationId;
+	invalidation->shardId = shardId;
+
+	PendingInvalidationList = lappend(PendingInvalidationList, invalidation);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * PendingRelationIdList returns the distinct tables that the current
+ * transaction changed.
+ */
+static List *
+PendingRelationIdList(void)
+{
+	List *relationIdList = NIL;
+	ListCell *invalidationCell = NULL;
+
+	foreach(invalidationCell, PendingInvalidationList)
+	{
+		ShardInvalidation *invalidation = (ShardInvalidation *) lfirst(invalidationCell);
+
+		relationIdList = list_append_unique_oid(relationIdList,
+												invalidation->relationId);
+	}
+
+	return relationIdList;
+}
+
+
+/*
+ * AppendShardInvalidations appends the given changes to the log, overwriting
+ * the oldest records. If endCommitPrepared is true, it also marks the end of
+ * a COMMIT PREPARED while holding the lock.
+ */
+static void
+AppendShardInvalidations(List *invalidationList, bool endCommitPrepared)
+{
+	ListCell *invalidationCell = NULL;
+
+	LWLockAcquire(&ShardInvalidationLogControl->lock, LW_EXCLUSIVE);
+
+	foreach(invalidationCell, invalidationList)
+	{
+		ShardInvalidation *invalidation = (ShardInvalidation *) lfirst(invalidationCell);
+		uint64 position = ShardInvalidationLogControl->nextPosition;
+
+		ShardInvalidationLogControl->records[position % SHARD_INVALIDATION_LOG_SIZE] =
+			*invalidation;
+		ShardInvalidationLogControl->nextPosition++;
+	}
+
+	if (endCommitPrepared)
+	{
+		Assert(ShardInvalidationLogControl->commitPreparedCount > 0);
+		ShardInvalidationLogControl->commitPreparedCount--;
+	}
+
+	LWLockRelease(&ShardInvalidationLogControl->lock);
+}
+
+
+/*
+ * InitializeShardInvalidationLog requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeShardInvalidationLog(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster && EnableShardPlacementInvalidation)
+	{
+		RequestAddinShmemSpace(ShardInvalidationLogShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = ShardInvalidationLogShmemInit;
+}
+
+
+/*
+ * ShardInvalidationLogShmemSize computes how much shared memory is required.
+ */
+static size_t
+ShardInvalidationLogShmemSize(void)
+{
+	return sizeof(ShardInvalidationLogControlData);
+}
+
+
+/*
+ * ShardInvalidationLogShmemInit initializes the shared memory that holds the
+ * log, if the log is enabled.
+ */
+static void
+ShardInvalidationLogShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	if (!EnableShardPlacementInvalidation)
+	{
+		if (prev_shmem_startup_hook != NULL)
+		{
+			prev_shmem_startup_hook();
+		}
+
+		return;
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ShardInvalidationLogControl =
+		(ShardInvalidationLogControlData *) ShmemInitStruct(
+			"Shard Invalidation Log", ShardInvalidationLogShmemSize(),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(ShardInvalidationLogControl, 0, ShardInvalidationLogShmemSize());
+
+#if (PG_VERSION_NUM >= 100000)
+		ShardInvalidationLogControl->trancheId = LWLockNewTrancheId();
+		ShardInvalidationLogControl->lockTrancheName = "Shard Invalidation Log";
+		LWLockRegisterTranche(ShardInvalidationLogControl->trancheId,
+							  ShardInvalidationLogControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &ShardInvalidationLogControl->lockTranche;
+
+			ShardInvalidationLogControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &ShardInvalidationLogControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Shard Invalidation Log";
+			LWLockRegisterTranche(ShardInvalidationLogControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&ShardInvalidationLogControl->lock,
+						 ShardInvalidationLogControl->trancheId);
+		ShardInvalidationLogControl->nextPosition = 1;
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
@@ -0,0 +1,428 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_statistics.c
+ *   Defers updating the size and min/max values of shards after appends to
+ *   the maintenance daemon, when citus.defer_shard_statistics is enabled.
+ *
+ *   Fetching the statistics of a shard takes a round trip to one of its
+ *   placements, which adds up for high-frequency appends. Instead, the append
+ *   only clears the min/max values of the shard, which stops the planner from
+ *   pruning it and keeps query results correct. When the transaction commits,
+ *   the shard is added to a queue in shared memory, from which the
+ *   maintenance daemon of the database takes shards to update their
+ *   statistics in the background.
+ *
+ *   The queue is not crash safe. If it is lost or full, the shards keep empty
+ *   min/max values until the next append to them, or until their statistics
+ *   are updated by master_update_shard_statistics.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_protocol.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/resource_lock.h"
+#include "distributed/shard_statistics.h"
+#include "distributed/shard_zone_maps.h"
+#include "storage/ipc.h"
+#include "storage/lmgr.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/memutils.h"
+
+
+/* StaleShard identifies a shard whose statistics need to be updated */
+typedef struct StaleShard
+{
+	Oid databaseId;
+	uint64 shardId;
+} StaleShard;
+
+
+/* shared memory holding the queue */
+typedef struct StaleShardQueueControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+
+	int staleShardCount;
+	StaleShard staleShards[STALE_SHARD_QUEUE_SIZE];
+} StaleShardQueueControlData;
+
+
+/* config variables */
+bool DeferShardStatistics = false;
+int ShardStatisticsRefreshInterval = 1000;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static StaleShardQueueControlData *StaleShardQueueControl = NULL;
+
+/* shards appended to by the current transaction, not yet in the queue */
+static List *PendingStaleShardList = NIL;
+
+
+static size_t StaleShardQueueShmemSize(void);
+static void StaleShardQueueShmemInit(void);
+static bool StaleShardQueueFull(void);
+static void AppendStaleShards(List *shardIdList);
+static List * TakeStaleShards(Oid databaseId);
+
+
+/*
+ * MarkShardStatisticsStale records that rows were appended to the given shard,
+ * such that the maintenance daemon updates its statistics once the current
+ * transaction commits. The min/max values of shards of append distributed
+ * tables are cleared right away. If the queue is full, the statistics are
+ * updated immediately instead.
+ *
+ * The caller is expected to hold a lock that serializes appends to the shard.
+ */
+void
+MarkShardStatisticsStale(uint64 shardId)
+{
+	ShardInterval *shardInterval = NULL;
+	Oid relationId = InvalidOid;
+	ListCell *shardIdCell = NULL;
+	uint64 *shardIdPointer = NULL;
+	MemoryContext oldContext = NULL;
+
+	foreach(shardIdCell, PendingStaleShardList)
+	{
+		uint64 *pendingShardId = (uint64 *) lfirst(shardIdCell);
+
+		if (*pendingShardId == shardId)
+		{
+			return;
+		}
+	}
+
+	if (StaleShardQueueControl == NULL || StaleShardQueueFull())
+	{
+		UpdateShardStatistics(shardId);
+		return;
+	}
+
+	shardInterval = LoadShardInterval(shardId);
+	relationId = shardInterval->relationId;
+
+	/* shards without min/max values are never pruned */
+	if (PartitionMethod(relationId) == DISTRIBUTE_BY_APPEND)
+	{
+		text *minValue = NULL;
+		text *maxValue = NULL;
+
+		DeleteShardRow(shardId);
+		InsertShardRow(relationId, shardId, shardInterval->storageType, minValue,
+					   maxValue);
+	}
+
+	ClearShardZoneMaps(shardId);
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	shardIdPointer = (uint64 *) palloc0(sizeof(uint64));
+	*shardIdPointer = shardId;
+	PendingStaleShardList = lappend(PendingStaleShardList, shardIdPointer);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * HasStaleShardStatistics returns whether the queue contains shards of the
+ * given database.
+ */
+bool
+HasStaleShardStatistics(Oid databaseId)
+{
+	bool hasStaleShards = false;
+	int shardIndex = 0;
+
+	if (StaleShardQueueControl == NULL)
+	{
+		return false;
+	}
+
+	LWLockAcquire(&StaleShardQueueControl->lock, LW_SHARED);
+
+	for (shardIndex = 0; shardIndex < StaleShardQueueControl->staleShardCount;
+		 shardIndex++)
+	{
+		if (StaleShardQueueControl->staleShards[shardIndex].databaseId == databaseId)
+		{
+			hasStaleShards = true;
+			break;
+		}
+	}
+
+	LWLockRelease(&StaleShardQueueControl->lock);
+
+	return hasStaleShards;
+}
+
+
+/*
+ * RefreshStaleShardStatistics takes the shards of the current database from
+ * the queue and updates their statistics, skipping shards that were dropped
+ * in the meantime. It returns the number of updated shards. Shards that were
+ * taken from the queue are not added back if the transaction fails.
+ */
+int
+RefreshStaleShardStatistics(void)
+{
+	List *shardIdList = TakeStaleShards(MyDatabaseId);
+	ListCell *shardIdCell = NULL;
+	int refreshedShardCount = 0;
+
+	foreach(shardIdCell, shardIdList)
+	{
+		uint64 *shardIdPointer = (uint64 *) lfirst(shardIdCell);
+		uint64 shardId = *shardIdPointer;
+
+		if (!ShardExists(shardId))
+		{
+			continue;
+		}
+
+		/* take the same locks as master_append_table_to_shard */
+		LockShardDistributionMetadata(shardId, ShareLock);
+		LockShardResource(shardId, ExclusiveLock);
+
+		/* the shard might have been dropped while we waited for the lock */
+		if (!ShardExists(shardId))
+		{
+			continue;
+		}
+
+		UpdateShardStatistics(shardId);
+		refreshedShardCount++;
+	}
+
+	return refreshedShardCount;
+}
+
+
+/*
+ * ResetShardStatisticsTransactionState adds the shards that the current
+ * transaction appended to to the queue if it committed. It is called at the
+ * end of the transaction.
+ */
+void
+ResetShardStatisticsTransactionState(bool isCommit)
+{
+	if (PendingStaleShardList == NIL)
+	{
+		return;
+	}
+
+	if (isCommit)
+	{
+		AppendStaleShards(PendingStaleShardList);
+	}
+
+	/* the list is allocated in the transaction context */
+	PendingStaleShardList = NIL;
+}
+
+
+/*
+ * StaleShardQueueFull returns whether the queue has no room for another
+ * shard. Concurrent transactions may still fill it before we commit.
+ */
+static bool
+StaleShardQueueFull(void)
+{
+	bool queueFull = false;
+	int pendingShardCount = list_length(PendingStaleShardList);
+
+	LWLockAcquire(&StaleShardQueueControl->lock, LW_SHARED);
+	queueFull = StaleShardQueueControl->staleShardCount + pendingShardCount >=
+				STALE_SHARD_QUEUE_SIZE;
+	LWLockRelease(&StaleShardQueueControl->lock);
+
+	return queueFull;
+}
+
+
+/*
+ * AppendStaleShards adds the given shards of the current database to the
+ * queue, unless they are already in it. Shards that do not fit into the queue
+ * are skipped.
+ */
+static void
+AppendStaleShards(List *shardIdList)
+{
+	ListCell *shardIdCell = NULL;
+
+	LWLockAcquire(&StaleShardQueueControl->lock, LW_EXCLUSIVE);
+
+	foreach(shardIdCell, shardIdList)
+	{
+		uint64 *shardIdPointer = (uint64 *) lfirst(shardIdCell);
+		int staleShardCount = StaleShardQueueControl->staleShardCount;
+		bool alreadyQueued = false;
+		int shardIndex = 0;
+
+		for (shardIndex = 0; shardIndex < staleShardCount; shardIndex++)
+		{
+			StaleShard *staleShard = &StaleShardQueueControl->staleShards[shardIndex];
+
+			if (staleShard->databaseId == MyDatabaseId &&
+				staleShard->shardId == *shardIdPointer)
+			{
+				alreadyQueued = true;
+				break;
+			}
+		}
+
+		if (alreadyQueued || staleShardCount >= STALE_SHARD_QUEUE_SIZE)
+		{
+			continue;
+		}
+
+		StaleShardQueueControl->staleShards[staleShardCount].databaseId = MyDatabaseId;
+		StaleShardQueueControl->staleShards[staleShardCount].shardId = *shardIdPointer;
+		StaleShardQueueControl->staleShardCount++;
+	}
+
+	LWLockRelease(&StaleShardQueueControl->lock);
+}
+
+
+/*
+ * TakeStaleShards removes the shards of the given database from the queue and
+ * returns their IDs.
+ */
+static List *
+TakeStaleShards(Oid databaseId)
+{
+	List *shardIdList = NIL;
+	int shardIndex = 0;
+	int remainingShardCount = 0;
+
+	if (StaleShardQueueControl == NULL)
+	{
+		return NIL;
+	}
+
+	LWLockAcquire(&StaleShardQueueControl->lock, LW_EXCLUSIVE);
+
+	for (shardIndex = 0; shardIndex < StaleShardQueueControl->staleShardCount;
+		 shardIndex++)
+	{
+		StaleShard *staleShard = &StaleShardQueueControl->staleShards[shardIndex];
+
+		if (staleShard->databaseId == databaseId)
+		{
+			uint64 *shardIdPointer = (uint64 *) palloc0(sizeof(uint64));
+			*shardIdPointer = staleShard->shardId;
+
+			shardIdList = lappend(shardIdList, shardIdPointer);
+		}
+		else
+		{
+			/* keep the shards of other databases at the front */
+			StaleShardQueueControl->staleShards[remainingShardCount++] = *staleShard;
+		}
+	}
+
+	StaleShardQueueControl->staleShardCount = remainingShardCount;
+
+	LWLockRelease(&StaleShardQueueControl->lock);
+
+	return shardIdList;
+}
+
+
+/*
+ * InitializeShardStatisticsQueue requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeShardStatisticsQueue(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(StaleShardQueueShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = StaleShardQueueShmemInit;
+}
+
+
+/*
+ * StaleShardQueueShmemSize computes how much shared memory is required.
+ */
+static size_t
+StaleShardQueueShmemSize(void)
+{
+	return sizeof(StaleShardQueueControlData);
+}
+
+
+/*
+ * StaleShardQueueShmemInit initializes the shared memory that holds the queue.
+ */
+static void
+StaleShardQueueShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	StaleShardQueueControl =
+		(StaleShardQueueControlData *) ShmemInitStruct(
+			"Stale Shard Statistics Queue", StaleShardQueueShmemSize(),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(StaleShardQueueControl, 0, StaleShardQueueShmemSize());
+
+#if (PG_VERSION_NUM >= 100000)
+		StaleShardQueueControl->trancheId = LWLockNewTrancheId();
+		StaleShardQueueControl->lockTrancheName = "Stale Shard Statistics Queue";
+		LWLockRegisterTranche(StaleShardQueueControl->trancheId,
+							  StaleShardQueueControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &StaleShardQueueControl->lockTranche;
+
+			StaleShardQueueControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &StaleShardQueueControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Stale Shard Statistics Queue";
+			LWLockRegisterTranche(StaleShardQueueControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&StaleShardQueueControl->lock,
+						 StaleShardQueueControl->trancheId);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
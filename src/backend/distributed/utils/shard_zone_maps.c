@@ -0,0 +1,759 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_zone_maps.c
+ *   Routines for maintaining zone maps, which summarize the values of
+ *   non-distribution columns in each shard of a table.
+ *
+ *   pg_dist_shard only holds the range of the distribution column in each
+ *   shard, so filters on other columns, such as a range of timestamps, cannot
+ *   prune any shards. update_shard_zone_maps records the min/max values of
+ *   chosen columns in each shard in pg_dist_shard_zone_map, optionally along
+ *   with a bloom filter over the hashes of the values, and shard pruning skips
+ *   shards whose zone maps show that they have no matching rows when
+ *   citus.enable_shard_zone_map_pruning is enabled.
+ *
+ *   Zone maps describe the shards as of the time they were built. They are
+ *   updated after appends along with the other shard statistics, but other
+ *   modifications of the shards require calling update_shard_zone_maps again.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "libpq-fe.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/tupdesc.h"
+#include "access/xact.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_type.h"
+#include "distributed/adaptive_executor.h"
+#include "distributed/bloom_filter.h"
+#include "distributed/citus_ruleutils.h"
+#include "distributed/connection_management.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/pg_dist_shard_zone_map.h"
+#include "distributed/placement_connection.h"
+#include "distributed/relay_utility.h"
+#include "distributed/remote_commands.h"
+#include "distributed/shard_zone_maps.h"
+#include "distributed/worker_manager.h"
+#include "executor/tuptable.h"
+#include "storage/lmgr.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/tuplestore.h"
+#include "utils/typcache.h"
+
+
+/* query that summarizes a column of a shard, see ShardZoneMapQuery */
+#define SHARD_ZONE_MAP_QUERY \
+	"SELECT " UINT64_FORMAT "::bigint, %d::smallint, min(%s), max(%s), %s FROM %s"
+#define SHARD_ZONE_MAP_BLOOM_FILTER "pg_catalog.citus_bloom_filter_agg(%s, %d)"
+
+
+/* transition state of citus_bloom_filter_agg */
+typedef struct BloomFilterAggState
+{
+	BloomFilter *filter;
+	FmgrInfo hashFunction;
+} BloomFilterAggState;
+
+
+static ZoneMapColumn * ParseZoneMapColumn(Oid relationId, char *columnName,
+										  int bloomFilterSize);
+static char * ShardZoneMapQuery(ShardInterval *shardInterval, List *zoneMapColumnList);
+static void StoreShardZoneMap(Relation pgDistShardZoneMap, Oid relationId,
+							  uint64 shardId, AttrNumber attributeNumber,
+							  int bloomFilterSize, text *minValue, text *maxValue,
+							  bytea *bloomFilter);
+static int ZoneMapColumnBloomFilterSize(List *zoneMapColumnList,
+										AttrNumber attributeNumber);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(update_shard_zone_maps);
+PG_FUNCTION_INFO_V1(citus_bloom_filter_agg_sfunc);
+PG_FUNCTION_INFO_V1(citus_bloom_filter_agg_ffunc);
+
+
+/*
+ * update_shard_zone_maps replaces the zone maps of the shards of the given
+ * table by zone maps of the given columns, which are computed on a placement
+ * of each shard in parallel. If bloom_filter_size is positive, the zone maps
+ * include bloom filters of that many bytes, which allow pruning shards on
+ * equality filters on values between the min and max values of the shard.
+ * Passing an empty array of columns removes the zone maps of the table. The
+ * function returns the number of shards whose zone maps were updated.
+ */
+Datum
+update_shard_zone_maps(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	ArrayType *columnNameArray = PG_GETARG_ARRAYTYPE_P(1);
+	int32 bloomFilterSize = PG_GETARG_INT32(2);
+	Datum *columnNameDatumArray = NULL;
+	int columnCount = 0;
+	int columnIndex = 0;
+	List *zoneMapColumnList = NIL;
+	List *shardIntervalList = NIL;
+	ListCell *shardIntervalCell = NULL;
+	List *taskList = NIL;
+	uint32 taskId = 1;
+	TaskListResult *taskListResult = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	TupleTableSlot *tupleSlot = NULL;
+	Relation pgDistShardZoneMap = NULL;
+	bool hasOid = false;
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+	EnsureTableOwner(relationId);
+
+	LockRelationOid(relationId, AccessShareLock);
+
+	if (!IsDistributedTable(relationId))
+	{
+		ereport(ERROR, (errmsg("relation \"%s\" is not a distributed table",
+							   get_rel_name(relationId))));
+	}
+
+	if (PartitionMethod(relationId) == DISTRIBUTE_BY_NONE)
+	{
+		ereport(ERROR, (errmsg("cannot build zone maps for reference table \"%s\"",
+							   get_rel_name(relationId))));
+	}
+
+	if (bloomFilterSize < 0 || bloomFilterSize > MAX_ZONE_MAP_BLOOM_FILTER_SIZE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("bloom filter size must be between 0 and %d bytes",
+							   MAX_ZONE_MAP_BLOOM_FILTER_SIZE)));
+	}
+
+	deconstruct_array(columnNameArray, TEXTOID, -1, false, 'i',
+					  &columnNameDatumArray, NULL, &columnCount);
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		char *columnName = TextDatumGetCString(columnNameDatumArray[columnIndex]);
+		ZoneMapColumn *zoneMapColumn = ParseZoneMapColumn(relationId, columnName,
+														  bloomFilterSize);
+
+		zoneMapColumnList = lappend(zoneMapColumnList, zoneMapColumn);
+	}
+
+	DeleteShardZoneMapRows(relationId);
+
+	shardIntervalList = LoadShardIntervalList(relationId);
+	if (zoneMapColumnList == NIL || shardIntervalList == NIL)
+	{
+		PG_RETURN_INT32(0);
+	}
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		char *zoneMapQuery = ShardZoneMapQuery(shardInterval, zoneMapColumnList);
+		Task *task = CreateBasicTask(INVALID_JOB_ID, taskId++, ROUTER_TASK,
+									 zoneMapQuery);
+
+		task->anchorShardId = shardId;
+		task->taskPlacementList = FinalizedShardPlacementList(shardId);
+
+		taskList = lappend(taskList, task);
+	}
+
+	tupleDescriptor = CreateTemplateTupleDesc(5, hasOid);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 1, "shardid", INT8OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 2, "attnum", INT2OID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 3, "minvalue", TEXTOID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 4, "maxvalue", TEXTOID, -1, 0);
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 5, "bloomfilter", BYTEAOID, -1, 0);
+
+	taskListResult = palloc0(sizeof(TaskListResult));
+	taskListResult->taskList = taskList;
+	taskListResult->tupleDescriptor = tupleDescriptor;
+	taskListResult->tupleStore = NULL;
+
+	ExecuteTaskListsIntoTupleStores(list_make1(taskListResult));
+
+	pgDistShardZoneMap = heap_open(DistShardZoneMapRelationId(), RowExclusiveLock);
+	tupleSlot = MakeSingleTupleTableSlot(tupleDescriptor);
+
+	while (tuplestore_gettupleslot(taskListResult->tupleStore, true, false, tupleSlot))
+	{
+		bool isNull[5];
+		Datum shardIdDatum = slot_getattr(tupleSlot, 1, &isNull[0]);
+		Datum attributeNumberDatum = slot_getattr(tupleSlot, 2, &isNull[1]);
+		Datum minValueDatum = slot_getattr(tupleSlot, 3, &isNull[2]);
+		Datum maxValueDatum = slot_getattr(tupleSlot, 4, &isNull[3]);
+		Datum bloomFilterDatum = slot_getattr(tupleSlot, 5, &isNull[4]);
+		AttrNumber attributeNumber = DatumGetInt16(attributeNumberDatum);
+
+		if (isNull[0] || isNull[1])
+		{
+			continue;
+		}
+
+		StoreShardZoneMap(pgDistShardZoneMap, relationId, DatumGetInt64(shardIdDatum),
+						  attributeNumber,
+						  ZoneMapColumnBloomFilterSize(zoneMapColumnList,
+													   attributeNumber),
+						  isNull[2] ? NULL : DatumGetTextP(minValueDatum),
+						  isNull[3] ? NULL : DatumGetTextP(maxValueDatum),
+						  isNull[4] ? NULL : DatumGetByteaP(bloomFilterDatum));
+	}
+
+	ExecDropSingleTupleTableSlot(tupleSlot);
+	tuplestore_end(taskListResult->tupleStore);
+
+	/* queries on the table are pruned differently from now on */
+	CitusInvalidateRelcacheByRelid(relationId);
+
+	CommandCounterIncrement();
+	heap_close(pgDistShardZoneMap, NoLock);
+
+	PG_RETURN_INT32(list_length(shardIntervalList));
+}
+
+
+/*
+ * citus_bloom_filter_agg_sfunc is the transition function of
+ * citus_bloom_filter_agg(). It adds the hash of each non-null value to a bloom
+ * filter with the size given as the second argument, using the default hash
+ * function of the type of the value.
+ */
+Datum
+citus_bloom_filter_agg_sfunc(PG_FUNCTION_ARGS)
+{
+	BloomFilterAggState *state = NULL;
+	MemoryContext aggregateContext = NULL;
+
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, (errmsg("citus_bloom_filter_agg_sfunc called from a "
+							   "non-aggregate context")));
+	}
+
+	if (PG_ARGISNULL(0))
+	{
+		Oid valueTypeId = get_fn_expr_argtype(fcinfo->flinfo, 1);
+		TypeCacheEntry *typeEntry = lookup_type_cache(valueTypeId,
+													  TYPECACHE_HASH_PROC_FINFO);
+		MemoryContext oldContext = NULL;
+
+		if (!OidIsValid(typeEntry->hash_proc_finfo.fn_oid))
+		{
+			ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
+							errmsg("could not identify a hash function for type %s",
+								   format_type_be(valueTypeId))));
+		}
+
+		if (PG_ARGISNULL(2) || PG_GETARG_INT32(2) <= 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("bloom filter size must be positive")));
+		}
+
+		oldContext = MemoryContextSwitchTo(aggregateContext);
+
+		state = palloc0(sizeof(BloomFilterAggState));
+		state->filter = CreateBloomFilter(PG_GETARG_INT32(2));
+		fmgr_info_copy(&state->hashFunction, &typeEntry->hash_proc_finfo,
+					   aggregateContext);
+
+		MemoryContextSwitchTo(oldContext);
+	}
+	else
+	{
+		state = (BloomFilterAggState *) PG_GETARG_POINTER(0);
+	}
+
+	if (!PG_ARGISNULL(1))
+	{
+		Datum hashDatum = FunctionCall1Coll(&state->hashFunction, PG_GET_COLLATION(),
+											PG_GETARG_DATUM(1));
+
+		BloomFilterAdd(state->filter, DatumGetUInt32(hashDatum));
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+
+/*
+ * citus_bloom_filter_agg_ffunc is the final function of
+ * citus_bloom_filter_agg(). It returns the bloom filter as a bytea, or NULL
+ * if there were no input rows.
+ */
+Datum
+citus_bloom_filter_agg_ffunc(PG_FUNCTION_ARGS)
+{
+	BloomFilterAggState *state = NULL;
+
+	if (PG_ARGISNULL(0))
+	{
+		PG_RETURN_NULL();
+	}
+
+	state = (BloomFilterAggState *) PG_GETARG_POINTER(0);
+
+	PG_RETURN_BYTEA_P(BloomFilterToBytea(state->filter));
+}
+
+
+/*
+ * ShardZoneMapColumnList returns the columns of the given table for which its
+ * shards have zone maps, along with the size of their bloom filters, such
+ * that the zone maps can be built for shards that changed.
+ */
+List *
+ShardZoneMapColumnList(Oid relationId)
+{
+	List *zoneMapColumnList = NIL;
+	Relation pgDistShardZoneMap = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+
+	pgDistShardZoneMap = heap_open(DistShardZoneMapRelationId(), AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_shard_zone_map_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDescriptor = systable_beginscan(pgDistShardZoneMap,
+										DistShardZoneMapLogicalRelidIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		Form_pg_dist_shard_zone_map zoneMapForm =
+			(Form_pg_dist_shard_zone_map) GETSTRUCT(heapTuple);
+		AttrNumber attributeNumber = zoneMapForm->attnum;
+
+		/* skip columns that we already found and columns that were dropped */
+		if (ZoneMapColumnBloomFilterSize(zoneMapColumnList, attributeNumber) < 0 &&
+			OidIsValid(get_atttype(relationId, attributeNumber)))
+		{
+			ZoneMapColumn *zoneMapColumn = palloc0(sizeof(ZoneMapColumn));
+
+			zoneMapColumn->attributeNumber = attributeNumber;
+			zoneMapColumn->bloomFilterSize = zoneMapForm->bloomfiltersize;
+
+			zoneMapColumnList = lappend(zoneMapColumnList, zoneMapColumn);
+		}
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistShardZoneMap, NoLock);
+
+	return zoneMapColumnList;
+}
+
+
+/*
+ * UpdatePlacementShardZoneMaps computes the zone maps of the given columns of
+ * a shard on the given placement, over the placement's connection such that
+ * rows appended in the current transaction are included, and stores them. It
+ * returns false if the zone maps could not be computed, in which case the
+ * caller is expected to clear the zone maps of the shard.
+ */
+bool
+UpdatePlacementShardZoneMaps(ShardPlacement *placement, ShardInterval *shardInterval,
+							 List *zoneMapColumnList)
+{
+	Oid relationId = shardInterval->relationId;
+	char *zoneMapQuery = ShardZoneMapQuery(shardInterval, zoneMapColumnList);
+	int connectionFlags = 0;
+	MultiConnection *connection = GetPlacementConnection(connectionFlags, placement,
+														 NULL);
+	PGresult *queryResult = NULL;
+	Relation pgDistShardZoneMap = NULL;
+	int rowCount = 0;
+	int rowIndex = 0;
+	int executeCommand = 0;
+
+	executeCommand = ExecuteOptionalRemoteCommand(connection, zoneMapQuery,
+												  &queryResult);
+	if (executeCommand != 0)
+	{
+		return false;
+	}
+
+	pgDistShardZoneMap = heap_open(DistShardZoneMapRelationId(), RowExclusiveLock);
+
+	rowCount = PQntuples(queryResult);
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		AttrNumber attributeNumber = pg_atoi(PQgetvalue(queryResult, rowIndex, 1),
+											 sizeof(int16), 0);
+		text *minValue = NULL;
+		text *maxValue = NULL;
+		bytea *bloomFilter = NULL;
+
+		if (!PQgetisnull(queryResult, rowIndex, 2))
+		{
+			minValue = cstring_to_text(PQgetvalue(queryResult, rowIndex, 2));
+		}
+
+		if (!PQgetisnull(queryResult, rowIndex, 3))
+		{
+			maxValue = cstring_to_text(PQgetvalue(queryResult, rowIndex, 3));
+		}
+
+		if (!PQgetisnull(queryResult, rowIndex, 4))
+		{
+			char *bloomFilterString = PQgetvalue(queryResult, rowIndex, 4);
+
+			bloomFilter = DatumGetByteaP(DirectFunctionCall1(byteain,
+															 CStringGetDatum(
+																 bloomFilterString)));
+		}
+
+		StoreShardZoneMap(pgDistShardZoneMap, relationId, shardInterval->shardId,
+						  attributeNumber,
+						  ZoneMapColumnBloomFilterSize(zoneMapColumnList,
+													   attributeNumber),
+						  minValue, maxValue, bloomFilter);
+	}
+
+	PQclear(queryResult);
+	ForgetResults(connection);
+
+	CitusInvalidateRelcacheByRelid(relationId);
+
+	CommandCounterIncrement();
+	heap_close(pgDistShardZoneMap, NoLock);
+
+	return true;
+}
+
+
+/*
+ * ClearShardZoneMaps removes the min/max values and bloom filters from the
+ * zone maps of the given shard, such that the shard is no longer pruned by
+ * them. The rows are kept, since they also record which columns of the
+ * table have zone maps.
+ */
+void
+ClearShardZoneMaps(uint64 shardId)
+{
+	Relation pgDistShardZoneMap = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+	Oid relationId = InvalidOid;
+	Datum values[Natts_pg_dist_shard_zone_map];
+	bool isNull[Natts_pg_dist_shard_zone_map];
+	bool replace[Natts_pg_dist_shard_zone_map];
+
+	memset(values, 0, sizeof(values));
+	memset(isNull, false, sizeof(isNull));
+	memset(replace, false, sizeof(replace));
+
+	isNull[Anum_pg_dist_shard_zone_map_minvalue - 1] = true;
+	replace[Anum_pg_dist_shard_zone_map_minvalue - 1] = true;
+	isNull[Anum_pg_dist_shard_zone_map_maxvalue - 1] = true;
+	replace[Anum_pg_dist_shard_zone_map_maxvalue - 1] = true;
+	isNull[Anum_pg_dist_shard_zone_map_bloomfilter - 1] = true;
+	replace[Anum_pg_dist_shard_zone_map_bloomfilter - 1] = true;
+
+	pgDistShardZoneMap = heap_open(DistShardZoneMapRelationId(), RowExclusiveLock);
+	tupleDescriptor = RelationGetDescr(pgDistShardZoneMap);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_shard_zone_map_shardid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(shardId));
+
+	scanDescriptor = systable_beginscan(pgDistShardZoneMap,
+										DistShardZoneMapPrimaryKeyIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		Form_pg_dist_shard_zone_map zoneMapForm =
+			(Form_pg_dist_shard_zone_map) GETSTRUCT(heapTuple);
+		HeapTuple newHeapTuple = heap_modify_tuple(heapTuple, tupleDescriptor, values,
+												   isNull, replace);
+
+		relationId = zoneMapForm->logicalrelid;
+
+		CatalogTupleUpdate(pgDistShardZoneMap, &heapTuple->t_self, newHeapTuple);
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+
+	if (OidIsValid(relationId))
+	{
+		CitusInvalidateRelcacheByRelid(relationId);
+		CommandCounterIncrement();
+	}
+
+	heap_close(pgDistShardZoneMap, NoLock);
+}
+
+
+/*
+ * DeleteShardZoneMapRows removes the zone maps of all shards of the given
+ * table.
+ */
+void
+DeleteShardZoneMapRows(Oid relationId)
+{
+	Relation pgDistShardZoneMap = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+	bool deletedRows = false;
+
+	pgDistShardZoneMap = heap_open(DistShardZoneMapRelationId(), RowExclusiveLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_shard_zone_map_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDescriptor = systable_beginscan(pgDistShardZoneMap,
+										DistShardZoneMapLogicalRelidIndexId(),
+										true, NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(pgDistShardZoneMap, &heapTuple->t_self);
+		deletedRows = true;
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+
+	if (deletedRows)
+	{
+		CitusInvalidateRelcacheByRelid(relationId);
+		CommandCounterIncrement();
+	}
+
+	heap_close(pgDistShardZoneMap, NoLock);
+}
+
+
+/*
+ * ParseZoneMapColumn looks up the column with the given name for which zone
+ * maps are to be built, and errors out if zone maps of it cannot be used for
+ * pruning.
+ */
+static ZoneMapColumn *
+ParseZoneMapColumn(Oid relationId, char *columnName, int bloomFilterSize)
+{
+	ZoneMapColumn *zoneMapColumn = NULL;
+	AttrNumber attributeNumber = get_attnum(relationId, columnName);
+	Var *partitionColumn = DistPartitionKey(relationId);
+	Oid columnTypeId = InvalidOid;
+	TypeCacheEntry *typeEntry = NULL;
+
+	if (attributeNumber == InvalidAttrNumber || attributeNumber < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+						errmsg("column \"%s\" of relation \"%s\" does not exist",
+							   columnName, get_rel_name(relationId))));
+	}
+
+	if (partitionColumn != NULL && partitionColumn->varattno == attributeNumber)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("cannot build zone maps for distribution column \"%s\"",
+							   columnName),
+						errdetail("Shards are already pruned by the values of the "
+								  "distribution column.")));
+	}
+
+	columnTypeId = get_atttype(relationId, attributeNumber);
+	typeEntry = lookup_type_cache(columnTypeId, TYPECACHE_CMP_PROC |
+								  TYPECACHE_HASH_PROC);
+
+	/* the text form of floating point values may not round trip */
+	if (!OidIsValid(typeEntry->cmp_proc) || columnTypeId == FLOAT4OID ||
+		columnTypeId == FLOAT8OID)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot build zone maps for column \"%s\" of type %s",
+							   columnName, format_type_be(columnTypeId))));
+	}
+
+	if (bloomFilterSize > 0 && !OidIsValid(typeEntry->hash_proc))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot build bloom filters for column \"%s\" of "
+							   "type %s", columnName, format_type_be(columnTypeId))));
+	}
+
+	zoneMapColumn = palloc0(sizeof(ZoneMapColumn));
+	zoneMapColumn->attributeNumber = attributeNumber;
+	zoneMapColumn->bloomFilterSize = bloomFilterSize;
+
+	return zoneMapColumn;
+}
+
+
+/*
+ * ShardZoneMapQuery returns a query that returns a row with the shard ID, the
+ * column number, the min/max values and the bloom filter for each of the given
+ * columns of the given shard.
+ */
+static char *
+ShardZoneMapQuery(ShardInterval *shardInterval, List *zoneMapColumnList)
+{
+	Oid relationId = shardInterval->relationId;
+	uint64 shardId = shardInterval->shardId;
+	char *shardName = get_rel_name(relationId);
+	char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+	char *shardQualifiedName = NULL;
+	StringInfo zoneMapQuery = makeStringInfo();
+	ListCell *zoneMapColumnCell = NULL;
+
+	AppendShardIdToName(&shardName, shardId);
+	shardQualifiedName = quote_qualified_identifier(schemaName, shardName);
+
+	foreach(zoneMapColumnCell, zoneMapColumnList)
+	{
+		ZoneMapColumn *zoneMapColumn = (ZoneMapColumn *) lfirst(zoneMapColumnCell);
+		AttrNumber attributeNumber = zoneMapColumn->attributeNumber;
+		const char *columnName = quote_identifier(get_attname(relationId,
+															  attributeNumber));
+		StringInfo bloomFilterExpression = makeStringInfo();
+
+		if (zoneMapColumn->bloomFilterSize > 0)
+		{
+			appendStringInfo(bloomFilterExpression, SHARD_ZONE_MAP_BLOOM_FILTER,
+							 columnName, zoneMapColumn->bloomFilterSize);
+		}
+		else
+		{
+			appendStringInfoString(bloomFilterExpression, "NULL::bytea");
+		}
+
+		if (zoneMapQuery->len > 0)
+		{
+			appendStringInfoString(zoneMapQuery, " UNION ALL ");
+		}
+
+		appendStringInfo(zoneMapQuery, SHARD_ZONE_MAP_QUERY, shardId, attributeNumber,
+						 columnName, columnName, bloomFilterExpression->data,
+						 shardQualifiedName);
+	}
+
+	return zoneMapQuery->data;
+}
+
+
+/*
+ * StoreShardZoneMap replaces the zone map of the given column of a shard by
+ * a zone map with the given values. Shards without non-null values in the
+ * column get NULL min/max values, with which they are never pruned.
+ */
+static void
+StoreShardZoneMap(Relation pgDistShardZoneMap, Oid relationId, uint64 shardId,
+				  AttrNumber attributeNumber, int bloomFilterSize, text *minValue,
+				  text *maxValue, bytea *bloomFilter)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(pgDistShardZoneMap);
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[2];
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_pg_dist_shard_zone_map];
+	bool isNull[Natts_pg_dist_shard_zone_map];
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_shard_zone_map_shardid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(shardId));
+	ScanKeyInit(&scanKey[1], Anum_pg_dist_shard_zone_map_attnum,
+				BTEqualStrategyNumber, F_INT2EQ, Int16GetDatum(attributeNumber));
+
+	scanDescriptor = systable_beginscan(pgDistShardZoneMap,
+										DistShardZoneMapPrimaryKeyIndexId(),
+										true, NULL, 2, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(pgDistShardZoneMap, &heapTuple->t_self);
+	}
+
+	systable_endscan(scanDescriptor);
+
+	memset(values, 0, sizeof(values));
+	memset(isNull, false, sizeof(isNull));
+
+	values[Anum_pg_dist_shard_zone_map_logicalrelid - 1] = ObjectIdGetDatum(relationId);
+	values[Anum_pg_dist_shard_zone_map_shardid - 1] = Int64GetDatum(shardId);
+	values[Anum_pg_dist_shard_zone_map_attnum - 1] = Int16GetDatum(attributeNumber);
+	values[Anum_pg_dist_shard_zone_map_atttypid - 1] =
+		ObjectIdGetDatum(get_atttype(relationId, attributeNumber));
+	values[Anum_pg_dist_shard_zone_map_bloomfiltersize - 1] =
+		Int32GetDatum(Max(bloomFilterSize, 0));
+
+	if (minValue != NULL && maxValue != NULL)
+	{
+		values[Anum_pg_dist_shard_zone_map_minvalue - 1] = PointerGetDatum(minValue);
+		values[Anum_pg_dist_shard_zone_map_maxvalue - 1] = PointerGetDatum(maxValue);
+	}
+	else
+	{
+		isNull[Anum_pg_dist_shard_zone_map_minvalue - 1] = true;
+		isNull[Anum_pg_dist_shard_zone_map_maxvalue - 1] = true;
+	}
+
+	if (bloomFilter != NULL)
+	{
+		values[Anum_pg_dist_shard_zone_map_bloomfilter - 1] = PointerGetDatum(bloomFilter);
+	}
+	else
+	{
+		isNull[Anum_pg_dist_shard_zone_map_bloomfilter - 1] = true;
+	}
+
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNull);
+
+	CatalogTupleInsert(pgDistShardZoneMap, heapTuple);
+}
+
+
+/*
+ * ZoneMapColumnBloomFilterSize returns the bloom filter size of the given
+ * column in the list of zone map columns, or -1 if the column is not in it.
+ */
+static int
+ZoneMapColumnBloomFilterSize(List *zoneMapColumnList, AttrNumber attributeNumber)
+{
+	ListCell *zoneMapColumnCell = NULL;
+
+	foreach(zoneMapColumnCell, zoneMapColumnList)
+	{
+		ZoneMapColumn *zoneMapColumn = (ZoneMapColumn *) lfirst(zoneMapColumnCell);
+
+		if (zoneMapColumn->attributeNumber == attributeNumber)
+		{
+			return zoneMapColumn->bloomFilterSize;
+		}
+	}
+
+	return -1;
+}
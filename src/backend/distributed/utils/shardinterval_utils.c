@@ -11,6 +11,7 @@
 #include "stdint.h"
 #include "postgres.h"
 
+#include "access/hash.h"
 #include "access/nbtree.h"
 #include "catalog/pg_am.h"
 #include "catalog/pg_collation.h"
@@ -22,12 +23,18 @@
 #include "distributed/pg_dist_partition.h"
 #include "distributed/worker_protocol.h"
 #include "utils/catcache.h"
+#include "utils/fmgroids.h"
 #include "utils/memutils.h"
+#include "utils/uuid.h"
 
 
+static int SearchCachedHashRange(int32 hashedValue, int32 *shardMinHashArray,
+								 int32 *shardMaxHashArray, int shardCount);
 static int SearchCachedShardInterval(Datum partitionColumnValue,
 									 ShardInterval **shardIntervalCache,
 									 int shardCount, FmgrInfo *compareFunction);
+static inline Datum HashPartitionValue(Datum partitionColumnValue,
+									   FmgrInfo *hashFunction);
 
 
 /*
@@ -229,7 +236,8 @@ FindShardInterval(Datum partitionColumnValue, DistTableCacheEntry *cacheEntry)
 
 	if (cacheEntry->partitionMethod == DISTRIBUTE_BY_HASH)
 	{
-		searchedValue = FunctionCall1(cacheEntry->hashFunction, partitionColumnValue);
+		searchedValue = HashPartitionValue(partitionColumnValue,
+										   cacheEntry->hashFunction);
 	}
 
 	shardIndex = FindShardIntervalIndex(searchedValue, cacheEntry);
@@ -243,6 +251,63 @@ FindShardInterval(Datum partitionColumnValue, DistTableCacheEntry *cacheEntry)
 }
 
 
+/*
+ * HashPartitionValue returns the hash of the given partition column value.
+ * FindShardInterval is called for every row of a COPY or multi-row INSERT,
+ * so we compute the hash of the most common partition column types inline,
+ * the same way their hash functions do, instead of going through fmgr.
+ */
+static inline Datum
+HashPartitionValue(Datum partitionColumnValue, FmgrInfo *hashFunction)
+{
+	switch (hashFunction->fn_oid)
+	{
+		case F_HASHINT4:
+		{
+			return hash_uint32((uint32) DatumGetInt32(partitionColumnValue));
+		}
+
+		case F_HASHINT8:
+		{
+			/* fold the high half in, such that hashint8(x) equals hashint4(x) */
+			int64 value = DatumGetInt64(partitionColumnValue);
+			uint32 lowHalf = (uint32) value;
+			uint32 highHalf = (uint32) (value >> 32);
+
+			lowHalf ^= (value >= 0) ? highHalf : ~highHalf;
+
+			return hash_uint32(lowHalf);
+		}
+
+		case F_HASHTEXT:
+		{
+			text *textValue = DatumGetTextPP(partitionColumnValue);
+			Datum hashValue = hash_any((unsigned char *) VARDATA_ANY(textValue),
+									   VARSIZE_ANY_EXHDR(textValue));
+
+			if ((Pointer) textValue != DatumGetPointer(partitionColumnValue))
+			{
+				pfree(textValue);
+			}
+
+			return hashValue;
+		}
+
+		case F_UUID_HASH:
+		{
+			pg_uuid_t *uuidValue = DatumGetUUIDP(partitionColumnValue);
+
+			return hash_any(uuidValue->data, UUID_LEN);
+		}
+
+		default:
+		{
+			return FunctionCall1(hashFunction, partitionColumnValue);
+		}
+	}
+}
+
+
 /*
  * FindShardIntervalIndex finds the index of the shard interval which covers
  * the searched value. Note that the searched value must be the hashed value
@@ -275,10 +340,12 @@ FindShardIntervalIndex(Datum searchedValue, DistTableCacheEntry *cacheEntry)
 	{
 		if (useBinarySearch)
 		{
-			Assert(compareFunction != NULL);
+			Assert(cacheEntry->shardMinHashArray != NULL);
 
-			shardIndex = SearchCachedShardInterval(searchedValue, shardIntervalCache,
-												   shardCount, compareFunction);
+			shardIndex = SearchCachedHashRange(DatumGetInt32(searchedValue),
+											   cacheEntry->shardMinHashArray,
+											   cacheEntry->shardMaxHashArray,
+											   shardCount);
 
 			/* we should always return a valid shard index for hash partitioned tables */
 			if (shardIndex == INVALID_SHARD_INDEX)
@@ -374,6 +441,41 @@ SearchCachedShardInterval(Datum partitionColumnValue, ShardInterval **shardInter
 }
 
 
+/*
+ * SearchCachedHashRange performs a binary search for the shard whose hash range
+ * contains the given hash value, using the contiguous arrays of min and max
+ * hash values of the sorted shards. It returns INVALID_SHARD_INDEX if no shard
+ * covers the value.
+ */
+static int
+SearchCachedHashRange(int32 hashedValue, int32 *shardMinHashArray,
+					  int32 *shardMaxHashArray, int shardCount)
+{
+	int lowerBoundIndex = 0;
+	int upperBoundIndex = shardCount;
+
+	while (lowerBoundIndex < upperBoundIndex)
+	{
+		int middleIndex = (lowerBoundIndex + upperBoundIndex) / 2;
+
+		if (hashedValue < shardMinHashArray[middleIndex])
+		{
+			upperBoundIndex = middleIndex;
+		}
+		else if (hashedValue <= shardMaxHashArray[middleIndex])
+		{
+			return middleIndex;
+		}
+		else
+		{
+			lowerBoundIndex = middleIndex + 1;
+		}
+	}
+
+	return INVALID_SHARD_INDEX;
+}
+
+
 /*
  * SingleReplicatedTable checks whether all shards of a distributed table, do not have
  * more than one replica. If even one shard has more than one replica, this function
@@ -0,0 +1,841 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_metadata_cache.c
+ *   Keeps the sorted shard intervals and shard placements of distributed
+ *   tables in shared memory, such that backends can fill their metadata
+ *   cache without reading pg_dist_shard and pg_dist_placement and without
+ *   sorting the shards again.
+ *
+ *   The shards of a table are stored in a fixed-size area of shared memory,
+ *   sized by citus.shared_metadata_cache_size. When the area or the hash of
+ *   tables is full, all tables are removed and the area is reused. Only
+ *   tables whose shard min/max values are passed by value are stored.
+ *
+ *   A table is removed whenever CitusInvalidateRelcacheByRelid() registers
+ *   an invalidation for it, and once more when the invalidating transaction
+ *   ends, before other backends receive the invalidation. Every removal
+ *   increments a shared counter, and a backend only stores the shards it
+ *   read from the catalogs if the counter did not change in the meantime.
+ *   Backends that changed metadata in their current transaction do not
+ *   store any shards, as they see uncommitted changes.
+ *
+ *   A prepared transaction is committed by COMMIT PREPARED, possibly from
+ *   another backend, without the transaction callbacks of the backend that
+ *   prepared it. The cache is therefore bypassed while a COMMIT PREPARED
+ *   runs, and all tables of its database are removed once it is done.
+ *
+ *   Every table also remembers when a backend last loaded it, such that the
+ *   recently used tables can be recorded and the cache prewarmed with them
+ *   after a restart (see metadata_prewarm.c).
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/citus_nodes.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shared_metadata_cache.h"
+#include "nodes/pg_list.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * SharedMetadataCacheControlData is the header of the shared memory area,
+ * followed by the data of the cached tables.
+ */
+typedef struct SharedMetadataCacheControlData
+{
+	int trancheId;
+#if (PG_VERSION_NUM >= 100000)
+	char *lockTrancheName;
+#else
+	LWLockTranche lockTranche;
+#endif
+	LWLock lock;
+
+	/* incremented whenever a table is removed from the cache */
+	pg_atomic_uint64 invalidationCounter;
+
+	/* number of COMMIT PREPARED commands in progress, which bypass the cache */
+	int commitPreparedCount;
+
+	/* size of the data area, and the number of bytes in use */
+	Size dataSize;
+	Size usedSize;
+	char data[FLEXIBLE_ARRAY_MEMBER];
+} SharedMetadataCacheControlData;
+
+
+/* tables are cached per database */
+typedef struct SharedShardListKey
+{
+	Oid databaseId;
+	Oid relationId;
+} SharedShardListKey;
+
+
+/* hash entry of a cached table */
+typedef struct SharedShardListEntry
+{
+	SharedShardListKey key;
+
+	/* pg_dist_partition of the extension the shards were read for */
+	Oid distPartitionRelationId;
+
+	int shardCount;
+	int placementCount;
+
+	/* offset of the shards, followed by their placements, in the data area */
+	Size dataOffset;
+
+	/* time a backend last loaded the table, or 0 if it was only prewarmed */
+	pg_atomic_uint64 lastUseTime;
+} SharedShardListEntry;
+
+
+/* shard interval as stored in shared memory */
+typedef struct SharedShardInterval
+{
+	uint64 shardId;
+	Datum minValue;
+	Datum maxValue;
+	int valueTypeLen;
+	char storageType;
+	bool valueByVal;
+	bool minValueExists;
+	bool maxValueExists;
+	int placementCount;
+} SharedShardInterval;
+
+
+/* shard placement as stored in shared memory, following its shard */
+typedef struct SharedShardPlacement
+{
+	uint64 placementId;
+	uint64 shardLength;
+	RelayFileState shardState;
+	uint32 groupId;
+} SharedShardPlacement;
+
+
+/* config variable for the size of the shared metadata cache in kB */
+int SharedMetadataCacheSize = 0;
+
+/* whether loading a table counts as using it, false while prewarming */
+bool TrackSharedShardListUse = true;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static SharedMetadataCacheControlData *SharedMetadataCacheControl = NULL;
+
+/* hash of (database, relation) -> shards of the table in the data area */
+static HTAB *SharedShardListHash = NULL;
+
+/* tables invalidated in the current transaction */
+static List *InvalidatedRelationList = NIL;
+
+
+static size_t SharedMetadataCacheShmemSize(void);
+static void SharedMetadataCacheShmemInit(void);
+static void BuildSharedShardListKey(SharedShardListKey *key, Oid relationId);
+static Size SharedShardListDataSize(int shardCount, int placementCount);
+static void RemoveSharedShardList(Oid relationId);
+static void RemoveDatabaseSharedShardLists(void);
+static void RemoveAllSharedShardLists(void);
+
+
+/*
+ * SharedMetadataCacheEnabled returns whether the shared metadata cache was
+ * allocated at server start.
+ */
+bool
+SharedMetadataCacheEnabled(void)
+{
+	return SharedMetadataCacheControl != NULL;
+}
+
+
+/*
+ * LoadSharedShardList copies the sorted shard intervals of the given table
+ * and the placements of each shard from shared memory into the cache memory
+ * context. The function returns false if the table is not cached, or while
+ * a COMMIT PREPARED is in progress.
+ */
+bool
+LoadSharedShardList(Oid relationId, Oid intervalTypeId,
+					ShardInterval ***shardIntervalArray, int *shardCount,
+					GroupShardPlacement ***placementArrays, int **placementArrayLengths)
+{
+	SharedShardListKey key;
+	SharedShardListEntry *listEntry = NULL;
+	SharedShardInterval *sharedIntervalArray = NULL;
+	SharedShardPlacement *sharedPlacement = NULL;
+	GroupShardPlacement *placementTemplate = NULL;
+	Oid distPartitionRelationId = InvalidOid;
+	MemoryContext oldContext = NULL;
+	char *data = NULL;
+	int intervalCount = 0;
+	int shardIndex = 0;
+	bool entryFound = false;
+	uint64 useTime = 0;
+
+	if (!SharedMetadataCacheEnabled())
+	{
+		return false;
+	}
+
+	distPartitionRelationId = DistPartitionRelationId();
+	BuildSharedShardListKey(&key, relationId);
+
+	if (TrackSharedShardListUse)
+	{
+		useTime = (uint64) GetCurrentTimestamp();
+	}
+
+	LWLockAcquire(&SharedMetadataCacheControl->lock, LW_SHARED);
+
+	listEntry = (SharedShardListEntry *) hash_search(SharedShardListHash, &key,
+													 HASH_FIND, &entryFound);
+	if (entryFound && listEntry->distPartitionRelationId == distPartitionRelationId &&
+		SharedMetadataCacheControl->commitPreparedCount == 0)
+	{
+		Size dataSize = SharedShardListDataSize(listEntry->shardCount,
+												listEntry->placementCount);
+
+		/* copy the data at once, to keep the lock only briefly */
+		intervalCount = listEntry->shardCount;
+		data = palloc(dataSize);
+		memcpy(data, SharedMetadataCacheControl->data + listEntry->dataOffset,
+			   dataSize);
+
+		if (useTime != 0)
+		{
+			pg_atomic_write_u64(&listEntry->lastUseTime, useTime);
+		}
+	}
+
+	LWLockRelease(&SharedMetadataCacheControl->lock);
+
+	if (data == NULL)
+	{
+		return false;
+	}
+
+	sharedIntervalArray = (SharedShardInterval *) data;
+	sharedPlacement = (SharedShardPlacement *)
+					  (data + MAXALIGN(intervalCount * sizeof(SharedShardInterval)));
+
+	*shardIntervalArray = NULL;
+	*placementArrays = NULL;
+	*placementArrayLengths = NULL;
+	*shardCount = intervalCount;
+
+	oldContext = MemoryContextSwitchTo(CacheMemoryContext);
+
+	if (intervalCount > 0)
+	{
+		*shardIntervalArray = palloc0(intervalCount * sizeof(ShardInterval *));
+		*placementArrays = palloc0(intervalCount * sizeof(GroupShardPlacement *));
+		*placementArrayLengths = palloc0(intervalCount * sizeof(int));
+	}
+
+	placementTemplate = CitusMakeNode(GroupShardPlacement);
+
+	for (shardIndex = 0; shardIndex < intervalCount; shardIndex++)
+	{
+		SharedShardInterval *sharedInterval = &sharedIntervalArray[shardIndex];
+		ShardInterval *shardInterval = CitusMakeNode(ShardInterval);
+		int placementCount = sharedInterval->placementCount;
+		GroupShardPlacement *placementArray = NULL;
+		int placementIndex = 0;
+
+		shardInterval->relationId = relationId;
+		shardInterval->storageType = sharedInterval->storageType;
+		shardInterval->valueTypeId = intervalTypeId;
+		shardInterval->valueTypeLen = sharedInterval->valueTypeLen;
+		shardInterval->valueByVal = sharedInterval->valueByVal;
+		shardInterval->minValueExists = sharedInterval->minValueExists;
+		shardInterval->maxValueExists = sharedInterval->maxValueExists;
+		shardInterval->minValue = sharedInterval->minValue;
+		shardInterval->maxValue = sharedInterval->maxValue;
+		shardInterval->shardId = sharedInterval->shardId;
+
+		placementArray = palloc0(placementCount * sizeof(GroupShardPlacement));
+		for (placementIndex = 0; placementIndex < placementCount; placementIndex++)
+		{
+			GroupShardPlacement *placement = &placementArray[placementIndex];
+
+			*placement = *placementTemplate;
+			placement->placementId = sharedPlacement->placementId;
+			placement->shardId = sharedInterval->shardId;
+			placement->shardLength = sharedPlacement->shardLength;
+			placement->shardState = sharedPlacement->shardState;
+			placement->groupId = sharedPlacement->groupId;
+
+			sharedPlacement++;
+		}
+
+		(*shardIntervalArray)[shardIndex] = shardInterval;
+		(*placementArrays)[shardIndex] = placementArray;
+		(*placementArrayLengths)[shardIndex] = placementCount;
+	}
+
+	pfree(placementTemplate);
+
+	MemoryContextSwitchTo(oldContext);
+
+	pfree(data);
+
+	return true;
+}
+
+
+/*
+ * SharedShardListCached returns whether the shards of the given table are in
+ * the shared metadata cache.
+ */
+bool
+SharedShardListCached(Oid relationId)
+{
+	SharedShardListKey key;
+	bool entryFound = false;
+
+	if (!SharedMetadataCacheEnabled())
+	{
+		return false;
+	}
+
+	BuildSharedShardListKey(&key, relationId);
+
+	LWLockAcquire(&SharedMetadataCacheControl->lock, LW_SHARED);
+	hash_search(SharedShardListHash, &key, HASH_FIND, &entryFound);
+	LWLockRelease(&SharedMetadataCacheControl->lock);
+
+	return entryFound;
+}
+
+
+/*
+ * BeginSharedShardListBuild is called before reading the shards of a table
+ * from the catalogs, and returns the value of the invalidation counter that
+ * needs to be passed to StoreSharedShardList. It also makes sure the catalogs
+ * are read with a new snapshot, which sees all changes that were committed
+ * before the counter was read.
+ */
+uint64
+BeginSharedShardListBuild(void)
+{
+	uint64 buildCounter = 0;
+
+	if (!SharedMetadataCacheEnabled())
+	{
+		return 0;
+	}
+
+	buildCounter = pg_atomic_read_u64(&SharedMetadataCacheControl->invalidationCounter);
+
+	InvalidateCatalogSnapshot();
+
+	return buildCounter;
+}
+
+
+/*
+ * StoreSharedShardList copies the sorted shard intervals of the given table and
+ * their placements into shared memory, unless any table was invalidated since
+ * BeginSharedShardListBuild returned the given counter.
+ */
+void
+StoreSharedShardList(Oid relationId, uint64 buildCounter,
+					 ShardInterval **sortedShardIntervalArray, int shardCount,
+					 GroupShardPlacement **placementArrays, int *placementArrayLengths)
+{
+	SharedShardListKey key;
+	SharedShardListEntry *listEntry = NULL;
+	SharedShardInterval *sharedIntervalArray = NULL;
+	SharedShardPlacement *sharedPlacement = NULL;
+	Oid distPartitionRelationId = InvalidOid;
+	Size dataSize = 0;
+	int placementCount = 0;
+	int shardIndex = 0;
+	bool entryFound = false;
+
+	/* our own metadata changes are not committed yet */
+	if (!SharedMetadataCacheEnabled() || InvalidatedRelationList != NIL)
+	{
+		return;
+	}
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = sortedShardIntervalArray[shardIndex];
+
+		if ((shardInterval->minValueExists || shardInterval->maxValueExists) &&
+			!shardInterval->valueByVal)
+		{
+			return;
+		}
+
+		placementCount += placementArrayLengths[shardIndex];
+	}
+
+	dataSize = SharedShardListDataSize(shardCount, placementCount);
+	if (dataSize > SharedMetadataCacheControl->dataSize)
+	{
+		return;
+	}
+
+	distPartitionRelationId = DistPartitionRelationId();
+	BuildSharedShardListKey(&key, relationId);
+
+	LWLockAcquire(&SharedMetadataCacheControl->lock, LW_EXCLUSIVE);
+
+	/* the shards might have changed after we read them */
+	if (pg_atomic_read_u64(&SharedMetadataCacheControl->invalidationCounter) !=
+		buildCounter || SharedMetadataCacheControl->commitPreparedCount > 0)
+	{
+		LWLockRelease(&SharedMetadataCacheControl->lock);
+		return;
+	}
+
+	if (SharedMetadataCacheControl->usedSize + dataSize >
+		SharedMetadataCacheControl->dataSize)
+	{
+		RemoveAllSharedShardLists();
+	}
+
+	listEntry = (SharedShardListEntry *) hash_search(SharedShardListHash, &key,
+													 HASH_ENTER_NULL, &entryFound);
+	if (listEntry == NULL)
+	{
+		RemoveAllSharedShardLists();
+
+		listEntry = (SharedShardListEntry *) hash_search(SharedShardListHash, &key,
+														 HASH_ENTER_NULL, &entryFound);
+		if (listEntry == NULL)
+		{
+			LWLockRelease(&SharedMetadataCacheControl->lock);
+			return;
+		}
+	}
+
+	listEntry->distPartitionRelationId = distPartitionRelationId;
+	listEntry->shardCount = shardCount;
+	listEntry->placementCount = placementCount;
+	listEntry->dataOffset = SharedMetadataCacheControl->usedSize;
+	pg_atomic_init_u64(&listEntry->lastUseTime,
+					   TrackSharedShardListUse ? (uint64) GetCurrentTimestamp() : 0);
+
+	sharedIntervalArray = (SharedShardInterval *)
+						  (SharedMetadataCacheControl->data + listEntry->dataOffset);
+	sharedPlacement = (SharedShardPlacement *)
+					  ((char *) sharedIntervalArray +
+					   MAXALIGN(shardCount * sizeof(SharedShardInterval)));
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = sortedShardIntervalArray[shardIndex];
+		SharedShardInterval *sharedInterval = &sharedIntervalArray[shardIndex];
+		GroupShardPlacement *placementArray = placementArrays[shardIndex];
+		int placementIndex = 0;
+
+		sharedInterval->shardId = shardInterval->shardId;
+		sharedInterval->minValue = shardInterval->minValue;
+		sharedInterval->maxValue = shardInterval->maxValue;
+		sharedInterval->valueTypeLen = shardInterval->valueTypeLen;
+		sharedInterval->storageType = shardInterval->storageType;
+		sharedInterval->valueByVal = shardInterval->valueByVal;
+		sharedInterval->minValueExists = shardInterval->minValueExists;
+		sharedInterval->maxValueExists = shardInterval->maxValueExists;
+		sharedInterval->placementCount = placementArrayLengths[shardIndex];
+
+		for (placementIndex = 0; placementIndex < sharedInterval->placementCount;
+			 placementIndex++)
+		{
+			GroupShardPlacement *placement = &placementArray[placementIndex];
+
+			sharedPlacement->placementId = placement->placementId;
+			sharedPlacement->shardLength = placement->shardLength;
+			sharedPlacement->shardState = placement->shardState;
+			sharedPlacement->groupId = placement->groupId;
+
+			sharedPlacement++;
+		}
+	}
+
+	SharedMetadataCacheControl->usedSize += dataSize;
+
+	LWLockRelease(&SharedMetadataCacheControl->lock);
+}
+
+
+/*
+ * RecentlyUsedSharedShardLists returns the tables of the current database in
+ * the shared metadata cache that a backend loaded after the given time, as a
+ * list of SharedShardListUse.
+ */
+List *
+RecentlyUsedSharedShardLists(TimestampTz usedAfter)
+{
+	List *useList = NIL;
+	HASH_SEQ_STATUS status;
+	SharedShardListEntry *listEntry = NULL;
+
+	if (!SharedMetadataCacheEnabled())
+	{
+		return NIL;
+	}
+
+	LWLockAcquire(&SharedMetadataCacheControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, SharedShardListHash);
+
+	while ((listEntry = (SharedShardListEntry *) hash_seq_search(&status)) != NULL)
+	{
+		TimestampTz lastUseTime = 0;
+		SharedShardListUse *listUse = NULL;
+
+		if (listEntry->key.databaseId != MyDatabaseId)
+		{
+			continue;
+		}
+
+		lastUseTime = (TimestampTz) pg_atomic_read_u64(&listEntry->lastUseTime);
+		if (lastUseTime == 0 || lastUseTime <= usedAfter)
+		{
+			continue;
+		}
+
+		listUse = (SharedShardListUse *) palloc0(sizeof(SharedShardListUse));
+		listUse->relationId = listEntry->key.relationId;
+		listUse->lastUseTime = lastUseTime;
+
+		useList = lappend(useList, listUse);
+	}
+
+	LWLockRelease(&SharedMetadataCacheControl->lock);
+
+	return useList;
+}
+
+
+/*
+ * InvalidateSharedShardList removes the given table from the shared metadata
+ * cache. Since other backends may still store shards that they read before
+ * the changes of the current transaction are committed, the table is removed
+ * again when the transaction ends.
+ */
+void
+InvalidateSharedShardList(Oid relationId)
+{
+	MemoryContext oldContext = NULL;
+
+	if (!SharedMetadataCacheEnabled())
+	{
+		return;
+	}
+
+	RemoveSharedShardList(relationId);
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+	InvalidatedRelationList = list_append_unique_oid(InvalidatedRelationList,
+													 relationId);
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * ResetSharedMetadataCacheTransactionState removes the tables that were
+ * invalidated in the current transaction from the shared metadata cache once
+ * more. It is called at the end of the transaction, after the changes were
+ * committed or aborted, but before other backends process the invalidations.
+ */
+void
+ResetSharedMetadataCacheTransactionState(void)
+{
+	ListCell *relationIdCell = NULL;
+
+	foreach(relationIdCell, InvalidatedRelationList)
+	{
+		Oid relationId = lfirst_oid(relationIdCell);
+
+		RemoveSharedShardList(relationId);
+	}
+
+	/* the list is allocated in the transaction context */
+	InvalidatedRelationList = NIL;
+}
+
+
+/*
+ * BeginSharedMetadataCacheCommitPrepared is called before COMMIT PREPARED, and
+ * makes backends bypass the cache until EndSharedMetadataCacheCommitPrepared
+ * is called. The prepared transaction may have changed metadata, and other
+ * backends may process its invalidations before the cache is cleaned up.
+ */
+void
+BeginSharedMetadataCacheCommitPrepared(void)
+{
+	if (!SharedMetadataCacheEnabled())
+	{
+		return;
+	}
+
+	LWLockAcquire(&SharedMetadataCacheControl->lock, LW_EXCLUSIVE);
+	SharedMetadataCacheControl->commitPreparedCount++;
+	LWLockRelease(&SharedMetadataCacheControl->lock);
+}
+
+
+/*
+ * EndSharedMetadataCacheCommitPrepared is called after COMMIT PREPARED, also
+ * when it failed. It removes all tables of the current database from the
+ * cache, since any of them might have been changed by the prepared
+ * transaction, and stops bypassing the cache.
+ */
+void
+EndSharedMetadataCacheCommitPrepared(void)
+{
+	if (!SharedMetadataCacheEnabled())
+	{
+		return;
+	}
+
+	LWLockAcquire(&SharedMetadataCacheControl->lock, LW_EXCLUSIVE);
+
+	RemoveDatabaseSharedShardLists();
+
+	Assert(SharedMetadataCacheControl->commitPreparedCount > 0);
+	SharedMetadataCacheControl->commitPreparedCount--;
+
+	LWLockRelease(&SharedMetadataCacheControl->lock);
+}
+
+
+/*
+ * RemoveSharedShardList removes the given table of the current database from
+ * the shared metadata cache, and increments the invalidation counter such
+ * that concurrent backends do not store shards they read before.
+ */
+static void
+RemoveSharedShardList(Oid relationId)
+{
+	SharedShardListKey key;
+	bool entryFound = false;
+
+	BuildSharedShardListKey(&key, relationId);
+
+	LWLockAcquire(&SharedMetadataCacheControl->lock, LW_EXCLUSIVE);
+
+	pg_atomic_fetch_add_u64(&SharedMetadataCacheControl->invalidationCounter, 1);
+	hash_search(SharedShardListHash, &key, HASH_REMOVE, &entryFound);
+
+	LWLockRelease(&SharedMetadataCacheControl->lock);
+}
+
+
+/*
+ * RemoveDatabaseSharedShardLists removes all tables of the current database
+ * from the shared metadata cache, and increments the invalidation counter.
+ * The caller should hold the lock in exclusive mode.
+ */
+static void
+RemoveDatabaseSharedShardLists(void)
+{
+	HASH_SEQ_STATUS status;
+	SharedShardListEntry *listEntry = NULL;
+
+	pg_atomic_fetch_add_u64(&SharedMetadataCacheControl->invalidationCounter, 1);
+
+	hash_seq_init(&status, SharedShardListHash);
+
+	while ((listEntry = (SharedShardListEntry *) hash_seq_search(&status)) != NULL)
+	{
+		bool entryFound = false;
+
+		if (listEntry->key.databaseId != MyDatabaseId)
+		{
+			continue;
+		}
+
+		hash_search(SharedShardListHash, &listEntry->key, HASH_REMOVE, &entryFound);
+	}
+}
+
+
+/*
+ * RemoveAllSharedShardLists removes all tables from the shared metadata cache
+ * such that the data area can be reused. The caller should hold the lock in
+ * exclusive mode.
+ */
+static void
+RemoveAllSharedShardLists(void)
+{
+	HASH_SEQ_STATUS status;
+	SharedShardListEntry *listEntry = NULL;
+
+	hash_seq_init(&status, SharedShardListHash);
+
+	while ((listEntry = (SharedShardListEntry *) hash_seq_search(&status)) != NULL)
+	{
+		bool entryFound = false;
+
+		hash_search(SharedShardListHash, &listEntry->key, HASH_REMOVE, &entryFound);
+	}
+
+	SharedMetadataCacheControl->usedSize = 0;
+}
+
+
+/*
+ * BuildSharedShardListKey fills the key of the given table in the current
+ * database.
+ */
+static void
+BuildSharedShardListKey(SharedShardListKey *key, Oid relationId)
+{
+	memset(key, 0, sizeof(SharedShardListKey));
+	key->databaseId = MyDatabaseId;
+	key->relationId = relationId;
+}
+
+
+/*
+ * SharedShardListDataSize returns the number of bytes the given number of
+ * shards and placements use in the data area.
+ */
+static Size
+SharedShardListDataSize(int shardCount, int placementCount)
+{
+	return MAXALIGN(shardCount * sizeof(SharedShardInterval)) +
+		   MAXALIGN(placementCount * sizeof(SharedShardPlacement));
+}
+
+
+/*
+ * InitializeSharedMetadataCache requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeSharedMetadataCache(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster && SharedMetadataCacheSize > 0)
+	{
+		RequestAddinShmemSpace(SharedMetadataCacheShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedMetadataCacheShmemInit;
+}
+
+
+/*
+ * SharedMetadataCacheShmemSize computes how much shared memory is required.
+ */
+static size_t
+SharedMetadataCacheShmemSize(void)
+{
+	Size size = 0;
+	Size hashSize = 0;
+
+	size = add_size(size, offsetof(SharedMetadataCacheControlData, data));
+	size = add_size(size, mul_size(SharedMetadataCacheSize, 1024));
+
+	hashSize = hash_estimate_size(MAX_SHARED_SHARD_LISTS,
+								  sizeof(SharedShardListEntry));
+	size = add_size(size, hashSize);
+
+	return size;
+}
+
+
+/*
+ * SharedMetadataCacheShmemInit initializes the shared memory that holds the
+ * cached shards, if the cache is enabled.
+ */
+static void
+SharedMetadataCacheShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	Size dataSize = mul_size(SharedMetadataCacheSize, 1024);
+	HASHCTL hashInfo;
+	int hashFlags = 0;
+
+	if (SharedMetadataCacheSize <= 0)
+	{
+		if (prev_shmem_startup_hook != NULL)
+		{
+			prev_shmem_startup_hook();
+		}
+
+		return;
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedMetadataCacheControl =
+		(SharedMetadataCacheControlData *) ShmemInitStruct(
+			"Shared Metadata Cache",
+			add_size(offsetof(SharedMetadataCacheControlData, data), dataSize),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		/* start by zeroing out the header, the data area is written on use */
+		memset(SharedMetadataCacheControl, 0,
+			   offsetof(SharedMetadataCacheControlData, data));
+
+#if (PG_VERSION_NUM >= 100000)
+		SharedMetadataCacheControl->trancheId = LWLockNewTrancheId();
+		SharedMetadataCacheControl->lockTrancheName = "Shared Metadata Cache";
+		LWLockRegisterTranche(SharedMetadataCacheControl->trancheId,
+							  SharedMetadataCacheControl->lockTrancheName);
+#else
+		{
+			LWLockTranche *tranche = &SharedMetadataCacheControl->lockTranche;
+
+			SharedMetadataCacheControl->trancheId = LWLockNewTrancheId();
+			tranche->array_base = &SharedMetadataCacheControl->lock;
+			tranche->array_stride = sizeof(LWLock);
+			tranche->name = "Shared Metadata Cache";
+			LWLockRegisterTranche(SharedMetadataCacheControl->trancheId, tranche);
+		}
+#endif
+
+		LWLockInitialize(&SharedMetadataCacheControl->lock,
+						 SharedMetadataCacheControl->trancheId);
+		pg_atomic_init_u64(&SharedMetadataCacheControl->invalidationCounter, 0);
+		SharedMetadataCacheControl->dataSize = dataSize;
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(SharedShardListKey);
+	hashInfo.entrysize = sizeof(SharedShardListEntry);
+	hashFlags = HASH_ELEM | HASH_BLOBS;
+
+	SharedShardListHash = ShmemInitHash("Shared Metadata Cache Hash",
+										MAX_SHARED_SHARD_LISTS, MAX_SHARED_SHARD_LISTS,
+										&hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
@@ -0,0 +1,647 @@
+/*-------------------------------------------------------------------------
+ *
+ * job_cache_usage.c
+ *   Accounts for the disk space used by intermediate results and by the
+ *   directories of repartition jobs in base/pgsql_job_cache, and enforces a
+ *   node-wide quota on it.
+ *
+ *   citus.max_intermediate_result_size only limits the results of a single
+ *   query, so many concurrent queries can still fill the disk of a node. The
+ *   backends of a node therefore reserve the bytes they write to the job
+ *   cache in a shared counter. Files are removed in many places, so rather
+ *   than tracking removals, the counter is periodically set to the size of
+ *   the directory, and immediately when a reservation would exceed
+ *   citus.max_job_cache_size. If the job cache is still full, the backend
+ *   waits for up to citus.job_cache_quota_wait_timeout for space to become
+ *   available before raising an error.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include <ctype.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "distributed/job_cache_usage.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/worker_protocol.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+
+/* the counter is set to the size of the job cache at least this often (ms) */
+#define JOB_CACHE_REFRESH_INTERVAL 10000
+
+/* when the job cache is full, its size is measured at most this often (ms) */
+#define JOB_CACHE_FULL_REFRESH_INTERVAL 1000
+
+/* interval (ms) at which a backend checks whether space became available */
+#define JOB_CACHE_QUOTA_POLL_INTERVAL 100
+
+#define RESULT_FILE_SUFFIX ".data"
+
+
+/* shared memory state of the job cache quota */
+typedef struct JobCacheUsageControlData
+{
+	slock_t mutex;
+
+	/* size of the job cache when last measured, plus the reservations since */
+	int64 usedBytes;
+
+	TimestampTz lastRefreshTime;
+	bool refreshInProgress;
+} JobCacheUsageControlData;
+
+
+/* config variables */
+int MaxJobCacheSize = -1;
+int JobCacheQuotaWaitTimeout = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static JobCacheUsageControlData *JobCacheUsageControl = NULL;
+
+
+static bool TryReserveJobCacheSpace(int64 byteCount, int64 maxBytes);
+static int64 JobCacheDirectorySize(void);
+static int64 DirectoryContentsSize(const char *path, int64 *fileCount);
+static void AddJobCacheEntry(Tuplestorestate *tupleStore, TupleDesc tupleDescriptor,
+							 const char *kind, const char *directoryName, int64 jobId,
+							 const char *resultId, int64 fileCount, int64 byteCount);
+static void AddIntermediateResultEntries(Tuplestorestate *tupleStore,
+										 TupleDesc tupleDescriptor,
+										 const char *directoryName,
+										 const char *directoryPath);
+static size_t JobCacheUsageShmemSize(void);
+static void JobCacheUsageShmemInit(void);
+
+
+PG_FUNCTION_INFO_V1(citus_job_cache_entries);
+PG_FUNCTION_INFO_V1(citus_job_cache_reserved_size);
+
+
+/*
+ * citus_job_cache_entries returns the disk space used by each job and each
+ * intermediate result in the job cache directory of this node. Job
+ * directories are returned as a whole, with the job id parsed from their
+ * name. The directories of intermediate results are per transaction, so a
+ * row is returned for each result file in them.
+ */
+Datum
+citus_job_cache_entries(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	StringInfo jobCacheDirectory = makeStringInfo();
+	DIR *directory = NULL;
+	struct dirent *directoryEntry = NULL;
+	int masterPrefixLength = strlen(MASTER_JOB_DIRECTORY_PREFIX);
+	int jobPrefixLength = strlen(JOB_DIRECTORY_PREFIX);
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	/* use the default tablespace in {datadir}/base */
+	appendStringInfo(jobCacheDirectory, "base/%s", PG_JOB_CACHE_DIR);
+
+	directory = AllocateDir(jobCacheDirectory->data);
+	if (directory == NULL)
+	{
+		/* no job ran on this node yet */
+		tuplestore_donestoring(tupleStore);
+
+		PG_RETURN_VOID();
+	}
+
+	directoryEntry = ReadDir(directory, jobCacheDirectory->data);
+	for (; directoryEntry != NULL;
+		 directoryEntry = ReadDir(directory, jobCacheDirectory->data))
+	{
+		const char *baseFilename = directoryEntry->d_name;
+		StringInfo fullFilename = NULL;
+		int64 fileCount = 0;
+		int64 byteCount = 0;
+
+		/* if system file, skip it */
+		if (strncmp(baseFilename, ".", MAXPGPATH) == 0 ||
+			strncmp(baseFilename, "..", MAXPGPATH) == 0)
+		{
+			continue;
+		}
+
+		fullFilename = makeStringInfo();
+		appendStringInfo(fullFilename, "%s/%s", jobCacheDirectory->data, baseFilename);
+
+		if (strncmp(baseFilename, MASTER_JOB_DIRECTORY_PREFIX, masterPrefixLength) == 0)
+		{
+			int64 jobId = (int64) pg_strtouint64(baseFilename + masterPrefixLength,
+												 NULL, 10);
+
+			byteCount = DirectoryContentsSize(fullFilename->data, &fileCount);
+			AddJobCacheEntry(tupleStore, tupleDescriptor, "master_job", baseFilename,
+							 jobId, NULL, fileCount, byteCount);
+		}
+		else if (strncmp(baseFilename, JOB_DIRECTORY_PREFIX, jobPrefixLength) == 0)
+		{
+			int64 jobId = (int64) pg_strtouint64(baseFilename + jobPrefixLength,
+												 NULL, 10);
+
+			byteCount = DirectoryContentsSize(fullFilename->data, &fileCount);
+			AddJobCacheEntry(tupleStore, tupleDescriptor, "job", baseFilename,
+							 jobId, NULL, fileCount, byteCount);
+		}
+		else if (isdigit((unsigned char) baseFilename[0]))
+		{
+			/* directories of intermediate results start with the user id */
+			AddIntermediateResultEntries(tupleStore, tupleDescriptor, baseFilename,
+										 fullFilename->data);
+		}
+		else
+		{
+			byteCount = DirectoryContentsSize(fullFilename->data, &fileCount);
+			AddJobCacheEntry(tupleStore, tupleDescriptor, "other", baseFilename,
+							 0, NULL, fileCount, byteCount);
+		}
+
+		FreeStringInfo(fullFilename);
+	}
+
+	FreeDir(directory);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * citus_job_cache_reserved_size returns the number of bytes which the
+ * backends of this node account to the job cache, and to which
+ * citus.max_job_cache_size applies.
+ */
+Datum
+citus_job_cache_reserved_size(PG_FUNCTION_ARGS)
+{
+	int64 usedBytes = 0;
+
+	CheckCitusVersion(ERROR);
+
+	SpinLockAcquire(&JobCacheUsageControl->mutex);
+	usedBytes = JobCacheUsageControl->usedBytes;
+	SpinLockRelease(&JobCacheUsageControl->mutex);
+
+	PG_RETURN_INT64(usedBytes);
+}
+
+
+/*
+ * AddIntermediateResultEntries adds a row for each result file in the given
+ * intermediate result directory to the tuple store.
+ */
+static void
+AddIntermediateResultEntries(Tuplestorestate *tupleStore, TupleDesc tupleDescriptor,
+							 const char *directoryName, const char *directoryPath)
+{
+	DIR *directory = NULL;
+	struct dirent *directoryEntry = NULL;
+	int suffixLength = strlen(RESULT_FILE_SUFFIX);
+
+	directory = AllocateDir(directoryPath);
+	if (directory == NULL)
+	{
+		/* the transaction ended while we were looking */
+		return;
+	}
+
+	directoryEntry = ReadDir(directory, directoryPath);
+	for (; directoryEntry != NULL; directoryEntry = ReadDir(directory, directoryPath))
+	{
+		const char *baseFilename = directoryEntry->d_name;
+		int filenameLength = strlen(baseFilename);
+		StringInfo fullFilename = NULL;
+		char *resultId = NULL;
+		int64 fileCount = 0;
+		int64 byteCount = 0;
+
+		if (strncmp(baseFilename, ".", MAXPGPATH) == 0 ||
+			strncmp(baseFilename, "..", MAXPGPATH) == 0)
+		{
+			continue;
+		}
+
+		fullFilename = makeStringInfo();
+		appendStringInfo(fullFilename, "%s/%s", directoryPath, baseFilename);
+
+		resultId = pstrdup(baseFilename);
+		if (filenameLength > suffixLength &&
+			strcmp(baseFilename + filenameLength - suffixLength, RESULT_FILE_SUFFIX) == 0)
+		{
+			resultId[filenameLength - suffixLength] = '\0';
+		}
+
+		byteCount = DirectoryContentsSize(fullFilename->data, &fileCount);
+		if (fileCount > 0)
+		{
+			AddJobCacheEntry(tupleStore, tupleDescriptor, "result", directoryName,
+							 0, resultId, fileCount, byteCount);
+		}
+
+		pfree(resultId);
+		FreeStringInfo(fullFilename);
+	}
+
+	FreeDir(directory);
+}
+
+
+/*
+ * AddJobCacheEntry adds a row to the result of citus_job_cache_entries. A
+ * job id of 0 and a NULL result id are returned as NULL.
+ */
+static void
+AddJobCacheEntry(Tuplestorestate *tupleStore, TupleDesc tupleDescriptor,
+				 const char *kind, const char *directoryName, int64 jobId,
+				 const char *resultId, int64 fileCount, int64 byteCount)
+{
+	Datum values[6];
+	bool isNulls[6];
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = PointerGetDatum(cstring_to_text(kind));
+	values[1] = PointerGetDatum(cstring_to_text(directoryName));
+
+	if (jobId != 0)
+	{
+		values[2] = Int64GetDatum(jobId);
+	}
+	else
+	{
+		isNulls[2] = true;
+	}
+
+	if (resultId != NULL)
+	{
+		values[3] = PointerGetDatum(cstring_to_text(resultId));
+	}
+	else
+	{
+		isNulls[3] = true;
+	}
+
+	values[4] = Int64GetDatum(fileCount);
+	values[5] = Int64GetDatum(byteCount);
+
+	tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+}
+
+
+/*
+ * ReserveJobCacheSpace accounts for byteCount bytes that the backend is about
+ * to write to the job cache. If this would make the job cache exceed
+ * citus.max_job_cache_size, the function waits for up to
+ * citus.job_cache_quota_wait_timeout for other jobs to free up space, and
+ * errors out if they do not.
+ */
+void
+ReserveJobCacheSpace(int64 byteCount)
+{
+	int64 maxBytes = 0;
+	TimestampTz waitStart = 0;
+
+	if (MaxJobCacheSize < 0 || JobCacheUsageControl == NULL)
+	{
+		return;
+	}
+
+	maxBytes = MaxJobCacheSize * 1024L;
+
+	if (TryReserveJobCacheSpace(byteCount, maxBytes))
+	{
+		return;
+	}
+
+	waitStart = GetCurrentTimestamp();
+
+	if (JobCacheQuotaWaitTimeout > 0)
+	{
+		ereport(DEBUG1, (errmsg("waiting for space in the job cache, "
+								"citus.max_job_cache_size is %d kB",
+								MaxJobCacheSize)));
+	}
+
+	while (JobCacheQuotaWaitTimeout > 0 &&
+		   !TimestampDifferenceExceeds(waitStart, GetCurrentTimestamp(),
+									   JobCacheQuotaWaitTimeout))
+	{
+		int latchFlags = WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH;
+		int rc = 0;
+
+#if (PG_VERSION_NUM >= 100000)
+		rc = WaitLatch(MyLatch, latchFlags, JOB_CACHE_QUOTA_POLL_INTERVAL,
+					   PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatch(MyLatch, latchFlags, JOB_CACHE_QUOTA_POLL_INTERVAL);
+#endif
+
+		if (rc & WL_POSTMASTER_DEATH)
+		{
+			proc_exit(1);
+		}
+
+		if (rc & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (TryReserveJobCacheSpace(byteCount, maxBytes))
+		{
+			return;
+		}
+	}
+
+	ereport(ERROR, (errcode(ERRCODE_DISK_FULL),
+					errmsg("the job cache of this node is full"),
+					errdetail("Intermediate results and repartition jobs would "
+							  "exceed citus.max_job_cache_size."),
+					errhint("Wait for other queries to finish, or increase "
+							"citus.max_job_cache_size or "
+							"citus.job_cache_quota_wait_timeout.")));
+}
+
+
+/*
+ * CheckJobCacheQuota waits for the job cache to drop below
+ * citus.max_job_cache_size before new work is started, and errors out if it
+ * does not.
+ */
+void
+CheckJobCacheQuota(void)
+{
+	ReserveJobCacheSpace(0);
+}
+
+
+/*
+ * TryReserveJobCacheSpace adds byteCount to the shared counter if the result
+ * does not exceed maxBytes, and returns whether it did so. If the size of the
+ * job cache was not measured recently, or if the counter indicates that the
+ * job cache is full, the counter is set to the actual size first. Only one
+ * backend measures the size at a time.
+ */
+static bool
+TryReserveJobCacheSpace(int64 byteCount, int64 maxBytes)
+{
+	TimestampTz currentTime = GetCurrentTimestamp();
+	bool spaceAvailable = false;
+	bool refreshNeeded = false;
+	int64 measuredBytes = 0;
+
+	SpinLockAcquire(&JobCacheUsageControl->mutex);
+
+	spaceAvailable = (JobCacheUsageControl->usedBytes + byteCount <= maxBytes);
+
+	if (!JobCacheUsageControl->refreshInProgress &&
+		TimestampDifferenceExceeds(JobCacheUsageControl->lastRefreshTime, currentTime,
+								   spaceAvailable ? JOB_CACHE_REFRESH_INTERVAL :
+								   JOB_CACHE_FULL_REFRESH_INTERVAL))
+	{
+		JobCacheUsageControl->refreshInProgress = true;
+		refreshNeeded = true;
+	}
+	else if (spaceAvailable)
+	{
+		JobCacheUsageControl->usedBytes += byteCount;
+	}
+
+	SpinLockRelease(&JobCacheUsageControl->mutex);
+
+	if (!refreshNeeded)
+	{
+		return spaceAvailable;
+	}
+
+	PG_TRY();
+	{
+		measuredBytes = JobCacheDirectorySize();
+	}
+	PG_CATCH();
+	{
+		SpinLockAcquire(&JobCacheUsageControl->mutex);
+		JobCacheUsageControl->refreshInProgress = false;
+		SpinLockRelease(&JobCacheUsageControl->mutex);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	SpinLockAcquire(&JobCacheUsageControl->mutex);
+
+	JobCacheUsageControl->usedBytes = measuredBytes;
+	JobCacheUsageControl->lastRefreshTime = currentTime;
+	JobCacheUsageControl->refreshInProgress = false;
+
+	spaceAvailable = (JobCacheUsageControl->usedBytes + byteCount <= maxBytes);
+	if (spaceAvailable)
+	{
+		JobCacheUsageControl->usedBytes += byteCount;
+	}
+
+	SpinLockRelease(&JobCacheUsageControl->mutex);
+
+	return spaceAvailable;
+}
+
+
+/*
+ * JobCacheDirectorySize returns the total size of the files in the job cache
+ * directory of this node.
+ */
+static int64
+JobCacheDirectorySize(void)
+{
+	StringInfo jobCacheDirectory = makeStringInfo();
+	int64 fileCount = 0;
+	int64 byteCount = 0;
+
+	appendStringInfo(jobCacheDirectory, "base/%s", PG_JOB_CACHE_DIR);
+
+	byteCount = DirectoryContentsSize(jobCacheDirectory->data, &fileCount);
+
+	FreeStringInfo(jobCacheDirectory);
+
+	return byteCount;
+}
+
+
+/*
+ * DirectoryContentsSize returns the total size of the regular files in the
+ * given directory and its subdirectories, or the size of the given file, and
+ * adds the number of files to fileCount. Files and directories that are
+ * removed concurrently are skipped, and symbolic links are not followed.
+ */
+static int64
+DirectoryContentsSize(const char *path, int64 *fileCount)
+{
+	struct stat fileStat;
+	int64 byteCount = 0;
+	DIR *directory = NULL;
+	struct dirent *directoryEntry = NULL;
+
+	if (lstat(path, &fileStat) < 0)
+	{
+		return 0;
+	}
+
+	if (S_ISREG(fileStat.st_mode))
+	{
+		(*fileCount)++;
+
+		return (int64) fileStat.st_size;
+	}
+
+	if (!S_ISDIR(fileStat.st_mode))
+	{
+		return 0;
+	}
+
+	directory = AllocateDir(path);
+	if (directory == NULL)
+	{
+		return 0;
+	}
+
+	directoryEntry = ReadDir(directory, path);
+	for (; directoryEntry != NULL; directoryEntry = ReadDir(directory, path))
+	{
+		const char *baseFilename = directoryEntry->d_name;
+		StringInfo fullFilename = NULL;
+
+		if (strncmp(baseFilename, ".", MAXPGPATH) == 0 ||
+			strncmp(baseFilename, "..", MAXPGPATH) == 0)
+		{
+			continue;
+		}
+
+		fullFilename = makeStringInfo();
+		appendStringInfo(fullFilename, "%s/%s", path, baseFilename);
+
+		byteCount += DirectoryContentsSize(fullFilename->data, fileCount);
+
+		FreeStringInfo(fullFilename);
+	}
+
+	FreeDir(directory);
+
+	return byteCount;
+}
+
+
+/*
+ * InitializeJobCacheUsage requests the necessary shared memory from Postgres
+ * and sets up the shared memory startup hook.
+ */
+void
+InitializeJobCacheUsage(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(JobCacheUsageShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = JobCacheUsageShmemInit;
+}
+
+
+/*
+ * JobCacheUsageShmemSize computes how much shared memory is required.
+ */
+static size_t
+JobCacheUsageShmemSize(void)
+{
+	return sizeof(JobCacheUsageControlData);
+}
+
+
+/*
+ * JobCacheUsageShmemInit initializes the shared counter of the job cache
+ * quota. The job cache is emptied when the server starts, so the counter
+ * starts at 0.
+ */
+static void
+JobCacheUsageShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	JobCacheUsageControl =
+		(JobCacheUsageControlData *) ShmemInitStruct("Job Cache Usage Data",
+													 sizeof(JobCacheUsageControlData),
+													 &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(JobCacheUsageControl, 0, sizeof(JobCacheUsageControlData));
+		SpinLockInit(&JobCacheUsageControl->mutex);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
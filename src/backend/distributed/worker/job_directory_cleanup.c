@@ -0,0 +1,245 @@
+/*-------------------------------------------------------------------------
+ *
+ * job_directory_cleanup.c
+ *   Removal of job directories in the background.
+ *
+ *   The directories of repartition jobs can hold tens of thousands of
+ *   partition files, and removing them one by one at the end of a job delays
+ *   the completion of the query. Job directories are therefore renamed into
+ *   base/pgsql_job_cache_removed, which takes a single system call, and the
+ *   task tracker removes their contents in its main loop, removing at most
+ *   citus.job_directory_removal_rate files per second such that the removal
+ *   neither competes with running tasks for disk bandwidth nor stalls task
+ *   scheduling.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "distributed/job_directory_cleanup.h"
+#include "distributed/transmit.h"
+#include "distributed/worker_protocol.h"
+#include "storage/fd.h"
+#include "utils/timestamp.h"
+
+
+/* Config variables managed via guc.c */
+bool DeferJobDirectoryRemoval = true;
+int JobDirectoryRemovalRate = 10000; /* files per second, 0 removes without limit */
+
+/* time at which the task tracker last removed files */
+static TimestampTz LastRemovalTime = 0;
+
+/* distinguishes the directories that this process moves */
+static uint32 RemovedDirectoryCounter = 0;
+
+
+/* local function forward declarations */
+static bool RemoveDirectoryContents(const char *directoryName, int64 *removalBudget);
+
+
+/*
+ * RemoveJobCacheDirectory removes the given directory in the job cache. When
+ * citus.defer_job_directory_removal is enabled, the directory is moved out of
+ * the job cache and left for the task tracker to remove, such that the caller
+ * does not wait for all files in the directory to be removed. If the directory
+ * cannot be moved, it is removed right away.
+ */
+void
+RemoveJobCacheDirectory(StringInfo directoryName)
+{
+	StringInfo removedDirectoryName = NULL;
+	const char *baseDirectoryName = NULL;
+	struct stat fileStat;
+
+	if (!DeferJobDirectoryRemoval)
+	{
+		CitusRemoveDirectory(directoryName);
+		return;
+	}
+
+	if (stat(directoryName->data, &fileStat) < 0 && errno == ENOENT)
+	{
+		return;
+	}
+
+	removedDirectoryName = makeStringInfo();
+	appendStringInfo(removedDirectoryName, "base/%s", PG_JOB_CACHE_REMOVED_DIR);
+
+	if (mkdir(removedDirectoryName->data, S_IRWXU) != 0 && errno != EEXIST)
+	{
+		ereport(DEBUG1, (errcode_for_file_access(),
+						 errmsg("could not create directory \"%s\": %m",
+								removedDirectoryName->data)));
+
+		CitusRemoveDirectory(directoryName);
+		FreeStringInfo(removedDirectoryName);
+		return;
+	}
+
+	baseDirectoryName = strrchr(directoryName->data, '/');
+	baseDirectoryName = (baseDirectoryName != NULL) ? baseDirectoryName + 1 :
+						directoryName->data;
+
+	appendStringInfo(removedDirectoryName, "/%s.%d.%u", baseDirectoryName,
+					 MyProcPid, RemovedDirectoryCounter++);
+
+	if (rename(directoryName->data, removedDirectoryName->data) != 0)
+	{
+		ereport(DEBUG1, (errcode_for_file_access(),
+						 errmsg("could not rename directory \"%s\" to \"%s\": %m",
+								directoryName->data, removedDirectoryName->data)));
+
+		CitusRemoveDirectory(directoryName);
+	}
+
+	FreeStringInfo(removedDirectoryName);
+}
+
+
+/*
+ * RemoveDeferredJobDirectories removes the contents of the directories that
+ * were moved out of the job cache, and is called by the task tracker in every
+ * round. The number of files removed in a round is limited by the time since
+ * the previous round and citus.job_directory_removal_rate, such that a round
+ * never takes long and the removal of a large directory is spread out.
+ */
+void
+RemoveDeferredJobDirectories(void)
+{
+	StringInfo removedDirectoryName = NULL;
+	TimestampTz currentTime = GetCurrentTimestamp();
+	int64 removalBudget = PG_INT64_MAX;
+
+	if (JobDirectoryRemovalRate > 0)
+	{
+		long elapsedSeconds = 0;
+		int elapsedMicroseconds = 0;
+		int64 elapsedMilliseconds = 0;
+
+		TimestampDifference(LastRemovalTime, currentTime, &elapsedSeconds,
+							&elapsedMicroseconds);
+
+		/* do not save up removals across idle periods */
+		elapsedMilliseconds = Min((int64) elapsedSeconds * 1000 +
+								  elapsedMicroseconds / 1000, 1000);
+
+		removalBudget = JobDirectoryRemovalRate * elapsedMilliseconds / 1000;
+		if (removalBudget <= 0)
+		{
+			return;
+		}
+	}
+
+	LastRemovalTime = currentTime;
+
+	removedDirectoryName = makeStringInfo();
+	appendStringInfo(removedDirectoryName, "base/%s", PG_JOB_CACHE_REMOVED_DIR);
+
+	RemoveDirectoryContents(removedDirectoryName->data, &removalBudget);
+
+	FreeStringInfo(removedDirectoryName);
+}
+
+
+/*
+ * RemoveDirectoryContents removes the files and directories in the given
+ * directory until the removal budget is used up, and returns whether the
+ * directory is empty afterwards. Each removed file or directory uses up one
+ * unit of the budget. Symbolic links are removed rather than followed.
+ */
+static bool
+RemoveDirectoryContents(const char *directoryName, int64 *removalBudget)
+{
+	DIR *directory = NULL;
+	struct dirent *directoryEntry = NULL;
+	bool directoryEmpty = true;
+
+	directory = AllocateDir(directoryName);
+	if (directory == NULL)
+	{
+		if (errno == ENOENT)
+		{
+			return true;
+		}
+
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open directory \"%s\": %m", directoryName)));
+	}
+
+	directoryEntry = ReadDir(directory, directoryName);
+	for (; directoryEntry != NULL; directoryEntry = ReadDir(directory, directoryName))
+	{
+		const char *baseFilename = directoryEntry->d_name;
+		StringInfo fullFilename = NULL;
+		struct stat fileStat;
+		int removed = 0;
+
+		/* if system file, skip it */
+		if (strncmp(baseFilename, ".", MAXPGPATH) == 0 ||
+			strncmp(baseFilename, "..", MAXPGPATH) == 0)
+		{
+			continue;
+		}
+
+		if (*removalBudget <= 0)
+		{
+			directoryEmpty = false;
+			break;
+		}
+
+		fullFilename = makeStringInfo();
+		appendStringInfo(fullFilename, "%s/%s", directoryName, baseFilename);
+
+		if (lstat(fullFilename->data, &fileStat) < 0)
+		{
+			if (errno != ENOENT)
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not stat file \"%s\": %m",
+									   fullFilename->data)));
+			}
+
+			FreeStringInfo(fullFilename);
+			continue;
+		}
+
+		if (S_ISDIR(fileStat.st_mode))
+		{
+			if (!RemoveDirectoryContents(fullFilename->data, removalBudget))
+			{
+				FreeStringInfo(fullFilename);
+				directoryEmpty = false;
+				break;
+			}
+
+			removed = rmdir(fullFilename->data);
+		}
+		else
+		{
+			removed = unlink(fullFilename->data);
+		}
+
+		if (removed != 0 && errno != ENOENT)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not remove file \"%s\": %m",
+								   fullFilename->data)));
+		}
+
+		(*removalBudget)--;
+
+		FreeStringInfo(fullFilename);
+	}
+
+	FreeDir(directory);
+
+	return directoryEmpty;
+}
@@ -0,0 +1,464 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_cache.c
+ *   Reuse of the partition files that map tasks wrote for earlier queries.
+ *
+ *   Dashboards often run the same repartition join again and again, while
+ *   the tables it reads rarely change. When citus.enable_repartition_cache
+ *   is on, the coordinator wraps the command of each map task that reads a
+ *   shard in worker_cached_partition_table(), together with a version that
+ *   consists of the modification counters of the shards it reads. The worker
+ *   keeps the partition files of a map task under a hash of the version, the
+ *   user and the partition command without job and task ids, and links them
+ *   into the task directory when the same map task runs again. Entries are
+ *   never modified; entries of older versions are evicted once there are more
+ *   than citus.max_repartition_cache_entries, and all entries are removed when
+ *   the task tracker starts.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#if (PG_VERSION_NUM >= 100000)
+#include "common/md5.h"
+#else
+#include "libpq/md5.h"
+#endif
+#include "distributed/job_directory_cleanup.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/partition_cache.h"
+#include "distributed/worker_protocol.h"
+#include "executor/spi.h"
+#include "storage/copydir.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+
+
+/* cached partition files of an entry that is a candidate for eviction */
+typedef struct PartitionCacheEntry
+{
+	char *entryName;
+	time_t lastUsedTime;
+} PartitionCacheEntry;
+
+
+/* config variable managed via guc.c */
+int MaxRepartitionCacheEntries = 64;
+
+
+static char * PartitionCacheKey(uint64 jobId, uint32 taskId, const char *version,
+								const char *partitionCommand);
+static StringInfo PartitionCacheDirectoryName(void);
+static StringInfo PartitionCacheEntryName(const char *cacheKey);
+static bool LoadCachedPartitionFiles(StringInfo entryDirectoryName, uint64 jobId,
+									 uint32 taskId);
+static void StorePartitionFiles(StringInfo entryDirectoryName, uint64 jobId,
+								uint32 taskId);
+static bool LinkPartitionFiles(StringInfo sourceDirectoryName,
+							   StringInfo targetDirectoryName);
+static void EvictPartitionCacheEntries(void);
+static int CompareEntriesByLastUsedTime(const void *leftElement,
+										const void *rightElement);
+static void ExecutePartitionCommand(const char *partitionCommand);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(worker_cached_partition_table);
+
+
+/*
+ * worker_cached_partition_table writes the partition files of the given map
+ * task into its task directory. If the partition files of the same partition
+ * command and version were cached before, the function links them into the
+ * task directory. Otherwise, the function runs the partition command, and
+ * adds the partition files it wrote to the cache.
+ */
+Datum
+worker_cached_partition_table(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 taskId = PG_GETARG_UINT32(1);
+	char *version = text_to_cstring(PG_GETARG_TEXT_P(2));
+	char *partitionCommand = text_to_cstring(PG_GETARG_TEXT_P(3));
+	char *cacheKey = NULL;
+	StringInfo entryDirectoryName = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	cacheKey = PartitionCacheKey(jobId, taskId, version, partitionCommand);
+	entryDirectoryName = PartitionCacheEntryName(cacheKey);
+
+	if (MaxRepartitionCacheEntries > 0 &&
+		LoadCachedPartitionFiles(entryDirectoryName, jobId, taskId))
+	{
+		PG_RETURN_VOID();
+	}
+
+	ExecutePartitionCommand(partitionCommand);
+
+	if (MaxRepartitionCacheEntries > 0)
+	{
+		StorePartitionFiles(entryDirectoryName, jobId, taskId);
+		EvictPartitionCacheEntries();
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * PartitionCacheKey checks that the given command partitions the output of
+ * the given map task, and returns the key under which its partition files are
+ * cached. The key leaves out the job and task ids, which differ between runs
+ * of the same query, and includes the user, since row level security policies
+ * may give users different rows.
+ */
+static char *
+PartitionCacheKey(uint64 jobId, uint32 taskId, const char *version,
+				  const char *partitionCommand)
+{
+	StringInfo taskArguments = makeStringInfo();
+	StringInfo cacheKey = makeStringInfo();
+	const char *taskArgumentsStart = NULL;
+
+	if (strncmp(partitionCommand, "SELECT worker_hash_partition_table ",
+				strlen("SELECT worker_hash_partition_table ")) != 0 &&
+		strncmp(partitionCommand, "SELECT worker_range_partition_table ",
+				strlen("SELECT worker_range_partition_table ")) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("only partition commands can be cached")));
+	}
+
+	appendStringInfo(taskArguments, "(" UINT64_FORMAT ", %u, ", jobId, taskId);
+
+	taskArgumentsStart = strstr(partitionCommand, taskArguments->data);
+	if (taskArgumentsStart == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("partition command is not for task %u of job "
+							   UINT64_FORMAT, taskId, jobId)));
+	}
+
+	appendStringInfo(cacheKey, "%u %u %s\n", MyDatabaseId, GetUserId(), version);
+	appendBinaryStringInfo(cacheKey, partitionCommand,
+						   taskArgumentsStart - partitionCommand);
+	appendStringInfo(cacheKey, "(%s", taskArgumentsStart + taskArguments->len);
+
+	return cacheKey->data;
+}
+
+
+/* Constructs the path of the directory that holds the cache entries. */
+static StringInfo
+PartitionCacheDirectoryName(void)
+{
+	StringInfo cacheDirectoryName = makeStringInfo();
+	appendStringInfo(cacheDirectoryName, "base/%s/%s", PG_JOB_CACHE_DIR,
+					 PARTITION_CACHE_DIRECTORY);
+
+	return cacheDirectoryName;
+}
+
+
+/*
+ * PartitionCacheEntryName constructs the path of the cache entry for the given
+ * key, which is named after the MD5 hash of the key.
+ */
+static StringInfo
+PartitionCacheEntryName(const char *cacheKey)
+{
+	StringInfo entryDirectoryName = PartitionCacheDirectoryName();
+	char cacheKeyHash[33];
+
+	if (!pg_md5_hash(cacheKey, strlen(cacheKey), cacheKeyHash))
+	{
+		ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+						errmsg("out of memory")));
+	}
+
+	appendStringInfo(entryDirectoryName, "/%s", cacheKeyHash);
+
+	return entryDirectoryName;
+}
+
+
+/*
+ * LoadCachedPartitionFiles links the partition files of the given cache entry
+ * into the directory of the given task, and returns true. If there is no such
+ * entry, or it is evicted while we link its files, the function returns false.
+ */
+static bool
+LoadCachedPartitionFiles(StringInfo entryDirectoryName, uint64 jobId, uint32 taskId)
+{
+	StringInfo taskDirectoryName = NULL;
+	StringInfo taskAttemptDirectoryName = NULL;
+	uint32 randomId = (uint32) random();
+
+	if (!DirectoryExists(entryDirectoryName))
+	{
+		return false;
+	}
+
+	taskDirectoryName = InitTaskDirectory(jobId, taskId);
+
+	taskAttemptDirectoryName = makeStringInfo();
+	appendStringInfo(taskAttemptDirectoryName, "%s_%0*u",
+					 taskDirectoryName->data, MIN_TASK_FILENAME_WIDTH, randomId);
+
+	CitusCreateDirectory(taskAttemptDirectoryName);
+
+	if (!LinkPartitionFiles(entryDirectoryName, taskAttemptDirectoryName))
+	{
+		CitusRemoveDirectory(taskAttemptDirectoryName);
+		return false;
+	}
+
+	/* commit the partition files like worker_hash_partition_table does */
+	CitusRemoveDirectory(taskDirectoryName);
+	if (rename(taskAttemptDirectoryName->data, taskDirectoryName->data) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename directory \"%s\" to \"%s\": %m",
+							   taskAttemptDirectoryName->data,
+							   taskDirectoryName->data)));
+	}
+
+	/* the modification time of an entry tells when it was last used */
+	if (utime(entryDirectoryName->data, NULL) != 0)
+	{
+		ereport(DEBUG1, (errcode_for_file_access(),
+						 errmsg("could not update time of directory \"%s\": %m",
+								entryDirectoryName->data)));
+	}
+
+	ereport(DEBUG1, (errmsg("reused cached partition files for task %u of job "
+							UINT64_FORMAT, taskId, jobId)));
+
+	return true;
+}
+
+
+/*
+ * StorePartitionFiles adds the partition files in the directory of the given
+ * task to the cache. The files are linked into an attempt directory that is
+ * renamed to the entry, such that other tasks never see incomplete entries.
+ * If another task added the same entry in the meantime, we keep its files.
+ */
+static void
+StorePartitionFiles(StringInfo entryDirectoryName, uint64 jobId, uint32 taskId)
+{
+	StringInfo cacheDirectoryName = PartitionCacheDirectoryName();
+	StringInfo taskDirectoryName = TaskDirectoryName(jobId, taskId);
+	StringInfo entryAttemptDirectoryName = makeStringInfo();
+	uint32 randomId = (uint32) random();
+
+	if (mkdir(cacheDirectoryName->data, S_IRWXU) != 0 && errno != EEXIST)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not create directory \"%s\": %m",
+							   cacheDirectoryName->data)));
+	}
+
+	appendStringInfo(entryAttemptDirectoryName, "%s_%0*u",
+					 entryDirectoryName->data, MIN_TASK_FILENAME_WIDTH, randomId);
+
+	CitusCreateDirectory(entryAttemptDirectoryName);
+
+	if (!LinkPartitionFiles(taskDirectoryName, entryAttemptDirectoryName) ||
+		rename(entryAttemptDirectoryName->data, entryDirectoryName->data) != 0)
+	{
+		CitusRemoveDirectory(entryAttemptDirectoryName);
+	}
+}
+
+
+/*
+ * LinkPartitionFiles hard links the partition files in the source directory
+ * into the target directory, or copies them if they cannot be linked. The
+ * function returns false if a file disappeared before we could link it.
+ */
+static bool
+LinkPartitionFiles(StringInfo sourceDirectoryName, StringInfo targetDirectoryName)
+{
+	int prefixLength = strlen(PARTITION_FILE_PREFIX);
+	struct dirent *directoryEntry = NULL;
+	bool filesLinked = true;
+
+	DIR *directory = AllocateDir(sourceDirectoryName->data);
+	if (directory == NULL)
+	{
+		return false;
+	}
+
+	directoryEntry = ReadDir(directory, sourceDirectoryName->data);
+	for (; directoryEntry != NULL;
+		 directoryEntry = ReadDir(directory, sourceDirectoryName->data))
+	{
+		const char *baseFilename = directoryEntry->d_name;
+		StringInfo sourceFilename = NULL;
+		StringInfo targetFilename = NULL;
+
+		if (strncmp(baseFilename, PARTITION_FILE_PREFIX, prefixLength) != 0 ||
+			strstr(baseFilename, ATTEMPT_FILE_SUFFIX) != NULL)
+		{
+			continue;
+		}
+
+		sourceFilename = makeStringInfo();
+		appendStringInfo(sourceFilename, "%s/%s", sourceDirectoryName->data,
+						 baseFilename);
+
+		targetFilename = makeStringInfo();
+		appendStringInfo(targetFilename, "%s/%s", targetDirectoryName->data,
+						 baseFilename);
+
+		if (link(sourceFilename->data, targetFilename->data) != 0)
+		{
+			if (errno == ENOENT)
+			{
+				filesLinked = false;
+				break;
+			}
+
+			copy_file(sourceFilename->data, targetFilename->data);
+		}
+
+		FreeStringInfo(sourceFilename);
+		FreeStringInfo(targetFilename);
+	}
+
+	FreeDir(directory);
+
+	return filesLinked;
+}
+
+
+/*
+ * EvictPartitionCacheEntries removes the least recently used entries of the
+ * cache, until there are no more than citus.max_repartition_cache_entries.
+ * Attempt directories, whose names contain an underscore, are left alone.
+ */
+static void
+EvictPartitionCacheEntries(void)
+{
+	StringInfo cacheDirectoryName = PartitionCacheDirectoryName();
+	PartitionCacheEntry *entryArray = NULL;
+	int entryCount = 0;
+	int entryArraySize = 16;
+	int entryIndex = 0;
+	struct dirent *directoryEntry = NULL;
+
+	DIR *directory = AllocateDir(cacheDirectoryName->data);
+	if (directory == NULL)
+	{
+		return;
+	}
+
+	entryArray = palloc0(entryArraySize * sizeof(PartitionCacheEntry));
+
+	directoryEntry = ReadDir(directory, cacheDirectoryName->data);
+	for (; directoryEntry != NULL;
+		 directoryEntry = ReadDir(directory, cacheDirectoryName->data))
+	{
+		const char *baseFilename = directoryEntry->d_name;
+		StringInfo entryDirectoryName = NULL;
+		struct stat fileStat;
+
+		if (baseFilename[0] == '.' || strchr(baseFilename, '_') != NULL)
+		{
+			continue;
+		}
+
+		entryDirectoryName = makeStringInfo();
+		appendStringInfo(entryDirectoryName, "%s/%s", cacheDirectoryName->data,
+						 baseFilename);
+
+		if (stat(entryDirectoryName->data, &fileStat) != 0)
+		{
+			FreeStringInfo(entryDirectoryName);
+			continue;
+		}
+
+		if (entryCount == entryArraySize)
+		{
+			entryArraySize *= 2;
+			entryArray = repalloc(entryArray,
+								  entryArraySize * sizeof(PartitionCacheEntry));
+		}
+
+		entryArray[entryCount].entryName = entryDirectoryName->data;
+		entryArray[entryCount].lastUsedTime = fileStat.st_mtime;
+		entryCount++;
+	}
+
+	FreeDir(directory);
+
+	if (entryCount <= MaxRepartitionCacheEntries)
+	{
+		return;
+	}
+
+	qsort(entryArray, entryCount, sizeof(PartitionCacheEntry),
+		  CompareEntriesByLastUsedTime);
+
+	for (entryIndex = 0; entryIndex < entryCount - MaxRepartitionCacheEntries;
+		 entryIndex++)
+	{
+		StringInfo entryDirectoryName = makeStringInfo();
+		appendStringInfoString(entryDirectoryName, entryArray[entryIndex].entryName);
+
+		RemoveJobCacheDirectory(entryDirectoryName);
+	}
+}
+
+
+/* Comparison function to order cache entries from least to most recently used. */
+static int
+CompareEntriesByLastUsedTime(const void *leftElement, const void *rightElement)
+{
+	const PartitionCacheEntry *leftEntry = (const PartitionCacheEntry *) leftElement;
+	const PartitionCacheEntry *rightEntry = (const PartitionCacheEntry *) rightElement;
+
+	if (leftEntry->lastUsedTime < rightEntry->lastUsedTime)
+	{
+		return -1;
+	}
+	else if (leftEntry->lastUsedTime > rightEntry->lastUsedTime)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* ExecutePartitionCommand runs the given partition command through SPI. */
+static void
+ExecutePartitionCommand(const char *partitionCommand)
+{
+	int spiResult = 0;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+	}
+
+	spiResult = SPI_execute(partitionCommand, false, 0);
+	if (spiResult != SPI_OK_SELECT)
+	{
+		ereport(ERROR, (errmsg("could not run partition command: %s",
+							   partitionCommand)));
+	}
+
+	SPI_finish();
+}
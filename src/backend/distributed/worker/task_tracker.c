@@ -26,12 +26,16 @@
  */
 
 #include "postgres.h"
+#include "libpq-fe.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include <unistd.h>
 
 #include "commands/dbcommands.h"
+#include "distributed/job_directory_cleanup.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/remote_commands.h"
 #include "distributed/task_tracker.h"
 #include "distributed/transmit.h"
 #include "distributed/worker_protocol.h"
@@ -42,16 +46,19 @@
 #include "postmaster/postmaster.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
+#include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/pmsignal.h"
 #include "storage/proc.h"
 #include "storage/shmem.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
+#include "utils/timestamp.h"
 
 
 int TaskTrackerDelay = 200;       /* process sleep interval in millisecs */
 int MaxRunningTasksPerNode = 16;  /* max number of running tasks */
+int MaxActiveBackendsPerNode = 0; /* no new tasks above this load; 0 disables */
 int MaxTrackedTasksPerNode = 1024; /* max number of tracked tasks */
 int MaxTaskStringSize = 12288; /* max size of a worker task call string in bytes */
 WorkerTasksSharedStateData *WorkerTasksSharedState; /* shared memory state */
@@ -61,6 +68,18 @@ HTAB *TaskTrackerTaskHash = NULL; /* shared memory */
 
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
+
+/*
+ * JobTaskCount counts the tasks of one job that run or are about to run, such
+ * that the scheduler can share the running task slots fairly between jobs.
+ */
+typedef struct JobTaskCount
+{
+	uint64 jobId;       /* job id; hash table key */
+	uint32 taskCount;
+} JobTaskCount;
+
+
 /* Flags set by interrupt handlers for later service in the main loop */
 static volatile sig_atomic_t got_SIGHUP = false;
 static volatile sig_atomic_t got_SIGTERM = false;
@@ -78,9 +97,14 @@ static void TrackerCleanupJobDirectories(void);
 static void TrackerCleanupJobSchemas(void);
 static void TrackerCleanupConnections(HTAB *WorkerTasksHash);
 static void TrackerRegisterShutDown(HTAB *WorkerTasksHash);
-static void TrackerDelayLoop(void);
+static void TrackerWaitForActivity(HTAB *WorkerTasksHash);
 static List * SchedulableTaskList(HTAB *WorkerTasksHash);
 static WorkerTask * SchedulableTaskPriorityQueue(HTAB *WorkerTasksHash);
+static uint32 AdmittedTaskCount(uint32 taskCount, uint32 runningTaskCount);
+static int ActiveBackendCount(void);
+static HTAB * RunningJobTaskCountHash(HTAB *WorkerTasksHash);
+static WorkerTask * NextFairQueuedTask(WorkerTask *taskQueue, uint32 queueSize,
+									   HTAB *jobTaskCountHash);
 static uint32 CountTasksMatchingCriteria(HTAB *WorkerTasksHash,
 										 bool (*CriteriaFunction)(WorkerTask *));
 static bool RunningTask(WorkerTask *workerTask);
@@ -88,8 +112,12 @@ static bool SchedulableTask(WorkerTask *workerTask);
 static int CompareTasksByTime(const void *first, const void *second);
 static void ScheduleWorkerTasks(HTAB *WorkerTasksHash, List *schedulableTaskList);
 static void ManageWorkerTasksHash(HTAB *WorkerTasksHash);
-static void ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash);
+static void ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash,
+							 List **cancelConnectionList);
 static void RemoveWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash);
+static void NotifyTaskCompletion(WorkerTask *workerTask);
+static void RecordTaskStart(WorkerTask *workerTask);
+static void RecordTaskEnd(WorkerTask *workerTask);
 static void CreateJobDirectoryIfNotExists(uint64 jobId);
 static int32 ConnectToLocalBackend(const char *databaseName, const char *userName);
 
@@ -220,17 +248,17 @@ TaskTrackerMain(Datum main_arg)
 		TrackerCleanupJobSchemas();
 	}
 
+	/* let the task tracker protocol functions wake us up on new work */
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_EXCLUSIVE);
+	WorkerTasksSharedState->taskTrackerLatch = MyLatch;
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
 	/* Loop forever */
 	for (;;)
 	{
 		/*
 		 * Emergency bailout if postmaster has died. This is to avoid the
 		 * necessity for manual cleanup of all postmaster children.
-		 *
-		 * XXX: Note that PostgreSQL background processes no longer nap between
-		 * their loops, but instead uses latches to wake up when necessary. We
-		 * should switch to using latches in here too, and have the task tracker
-		 * assign function notify us when there is a new task.
 		 */
 		if (!PostmasterIsAlive())
 		{
@@ -266,8 +294,11 @@ TaskTrackerMain(Datum main_arg)
 		/* Call the function that does the actual work */
 		ManageWorkerTasksHash(TaskTrackerTaskHash);
 
-		/* Sleep for the configured time */
-		TrackerDelayLoop();
+		/* remove some of the files of jobs that completed */
+		RemoveDeferredJobDirectories();
+
+		/* Wait for new tasks, task completions, or the configured time */
+		TrackerWaitForActivity(TaskTrackerTaskHash);
 	}
 }
 
@@ -405,6 +436,12 @@ TrackerCleanupJobSchemas(void)
 		/* zero out all other fields */
 		cleanupTask->connectionId = INVALID_CONNECTION_ID;
 		cleanupTask->failureCount = 0;
+		cleanupTask->queuedAt = GetCurrentTimestamp();
+		cleanupTask->startedAt = 0;
+		cleanupTask->finishedAt = 0;
+		cleanupTask->backendPid = 0;
+
+		WorkerTasksSharedState->taskStats.assignedTaskCount++;
 
 		taskIndex++;
 	}
@@ -467,30 +504,70 @@ TrackerRegisterShutDown(HTAB *WorkerTasksHash)
 }
 
 
-/* Sleeps either for the configured time or until a signal is received. */
+/*
+ * TrackerWaitForActivity waits until our latch is set, until one of the local
+ * backends running a task sends us data, or until the configured delay passes.
+ * The task tracker protocol functions and our signal handlers set the latch,
+ * so that we respond to new task assignments and signals immediately. The
+ * delay only remains as a fallback for retrying failed tasks.
+ */
 static void
-TrackerDelayLoop(void)
+TrackerWaitForActivity(HTAB *WorkerTasksHash)
 {
-	const long SignalCheckInterval = 1000000L; /* check signal every second */
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+	WaitEventSet *waitEventSet = NULL;
+	WaitEvent event;
+	int eventCount = 0;
 
-	/*
-	 * On some platforms, signals do not interrupt the sleep. To ensure we
-	 * respond promptly when someone signals us, we break down the sleep into
-	 * 1-second increments, and check for interrupts after each nap.
-	 */
-	long trackerDelay = TaskTrackerDelay * 1000L;
-	while (trackerDelay > (SignalCheckInterval - 1))
+	/* make room for the latch and postmaster death events */
+	waitEventSet = CreateWaitEventSet(CurrentMemoryContext,
+									  MaxRunningTasksPerNode + 2);
+
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+	/* only we change task connections, but others may change the hash */
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+
+	hash_seq_init(&status, WorkerTasksHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
 	{
-		if (got_SIGHUP || got_SIGTERM)
+		if (currentTask->taskStatus == TASK_RUNNING &&
+			currentTask->connectionId != INVALID_CONNECTION_ID)
 		{
-			break;
+			MultiConnection *connection =
+				MultiClientGetConnection(currentTask->connectionId);
+
+			AddWaitEventToSet(waitEventSet, WL_SOCKET_READABLE,
+							  PQsocket(connection->pgConn), NULL, NULL);
 		}
-		pg_usleep(SignalCheckInterval);
-		trackerDelay -= SignalCheckInterval;
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
 	}
-	if (!(got_SIGHUP || got_SIGTERM))
+
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+#if (PG_VERSION_NUM >= 100000)
+	eventCount = WaitEventSetWait(waitEventSet, TaskTrackerDelay, &event, 1,
+								  PG_WAIT_EXTENSION);
+#else
+	eventCount = WaitEventSetWait(waitEventSet, TaskTrackerDelay, &event, 1);
+#endif
+
+	FreeWaitEventSet(waitEventSet);
+
+	if (eventCount > 0 && (event.events & WL_POSTMASTER_DEATH))
+	{
+		exit(1);
+	}
+
+	/* the main loop checks for signals and new tasks after we return */
+	if (eventCount > 0 && (event.events & WL_LATCH_SET))
 	{
-		pg_usleep(trackerDelay);
+		ResetLatch(MyLatch);
 	}
 }
 
@@ -606,6 +683,11 @@ TaskTrackerShmemInit(void)
 
 		LWLockInitialize(&WorkerTasksSharedState->taskHashLock,
 						 WorkerTasksSharedState->taskHashTrancheId);
+
+		WorkerTasksSharedState->taskTrackerLatch = NULL;
+
+		memset(&WorkerTasksSharedState->taskStats, 0, sizeof(TaskTrackerStats));
+		WorkerTasksSharedState->taskStats.statsSince = GetCurrentTimestamp();
 	}
 
 	/*  allocate hash table */
@@ -631,20 +713,23 @@ TaskTrackerShmemInit(void)
 
 /*
  * SchedulableTaskList calculates the number of tasks to schedule at this given
- * moment, and creates a deep-copied list containing that many tasks. The tasks
- * in the list are sorted according to a priority criteria, currently the task's
- * assignment time. Note that this function expects the caller to hold a read
- * lock over the shared hash.
+ * moment, and creates a deep-copied list containing that many tasks. The number
+ * of tasks is bounded by the running task limit and, if configured, by the
+ * number of active backends on the node. The tasks are picked in a priority
+ * order, currently the task's assignment time, while sharing the running task
+ * slots fairly between jobs. Note that this function expects the caller to hold
+ * a read lock over the shared hash.
  */
 static List *
 SchedulableTaskList(HTAB *WorkerTasksHash)
 {
 	List *schedulableTaskList = NIL;
 	WorkerTask *schedulableTaskQueue = NULL;
+	HTAB *jobTaskCountHash = NULL;
 	uint32 runningTaskCount = 0;
 	uint32 schedulableTaskCount = 0;
 	uint32 tasksToScheduleCount = 0;
-	uint32 queueIndex = 0;
+	uint32 scheduledTaskCount = 0;
 
 	runningTaskCount = CountTasksMatchingCriteria(WorkerTasksHash, &RunningTask);
 	if (runningTaskCount >= MaxRunningTasksPerNode)
@@ -664,26 +749,224 @@ SchedulableTaskList(HTAB *WorkerTasksHash)
 		tasksToScheduleCount = schedulableTaskCount;
 	}
 
+	tasksToScheduleCount = AdmittedTaskCount(tasksToScheduleCount, runningTaskCount);
+	if (tasksToScheduleCount == 0)
+	{
+		return NIL;  /* the node is too busy to start new tasks */
+	}
+
 	/* get all schedulable tasks ordered according to a priority criteria */
 	schedulableTaskQueue = SchedulableTaskPriorityQueue(WorkerTasksHash);
+	jobTaskCountHash = RunningJobTaskCountHash(WorkerTasksHash);
 
-	for (queueIndex = 0; queueIndex < tasksToScheduleCount; queueIndex++)
+	for (scheduledTaskCount = 0; scheduledTaskCount < tasksToScheduleCount;
+		 scheduledTaskCount++)
 	{
 		WorkerTask *schedulableTask = (WorkerTask *) palloc0(WORKER_TASK_SIZE);
-		WorkerTask *queuedTask = WORKER_TASK_AT(schedulableTaskQueue, queueIndex);
+		WorkerTask *queuedTask = NextFairQueuedTask(schedulableTaskQueue,
+													schedulableTaskCount,
+													jobTaskCountHash);
+		JobTaskCount *jobTaskCount = NULL;
+		bool handleFound = false;
+
 		schedulableTask->jobId = queuedTask->jobId;
 		schedulableTask->taskId = queuedTask->taskId;
 
 		schedulableTaskList = lappend(schedulableTaskList, schedulableTask);
+
+		/* mark the task as picked, and charge it to its job */
+		queuedTask->taskStatus = TASK_SCHEDULED;
+
+		jobTaskCount = (JobTaskCount *) hash_search(jobTaskCountHash,
+													&queuedTask->jobId,
+													HASH_ENTER, &handleFound);
+		if (!handleFound)
+		{
+			jobTaskCount->taskCount = 0;
+		}
+
+		jobTaskCount->taskCount++;
 	}
 
-	/* free priority queue */
+	/* free priority queue and job task counts */
 	pfree(schedulableTaskQueue);
+	hash_destroy(jobTaskCountHash);
 
 	return schedulableTaskList;
 }
 
 
+/*
+ * AdmittedTaskCount returns how many of the given number of tasks we can start
+ * without exceeding citus.max_active_backends_per_node. Local backends that are
+ * busy running our tasks or other queries count towards this limit. When none
+ * of our tasks is running, we still start one task to make progress.
+ */
+static uint32
+AdmittedTaskCount(uint32 taskCount, uint32 runningTaskCount)
+{
+	int activeBackendCount = 0;
+	int admittedTaskCount = 0;
+
+	if (MaxActiveBackendsPerNode <= 0)
+	{
+		return taskCount;
+	}
+
+	activeBackendCount = ActiveBackendCount();
+	admittedTaskCount = MaxActiveBackendsPerNode - activeBackendCount;
+
+	if (admittedTaskCount < 1 && runningTaskCount == 0)
+	{
+		admittedTaskCount = 1;
+	}
+
+	if (admittedTaskCount <= 0)
+	{
+		return 0;
+	}
+
+	if ((uint32) admittedTaskCount > taskCount)
+	{
+		return taskCount;
+	}
+
+	return (uint32) admittedTaskCount;
+}
+
+
+/*
+ * ActiveBackendCount returns the number of backends on this node that are
+ * currently running a query, according to the statistics collector's backend
+ * status array.
+ */
+static int
+ActiveBackendCount(void)
+{
+	int activeBackendCount = 0;
+	int backendCount = pgstat_fetch_stat_numbackends();
+	int backendIndex = 0;
+
+	/* backend status entries are numbered starting from 1 */
+	for (backendIndex = 1; backendIndex <= backendCount; backendIndex++)
+	{
+		PgBackendStatus *backendStatus = pgstat_fetch_stat_beentry(backendIndex);
+		if (backendStatus != NULL && backendStatus->st_state == STATE_RUNNING)
+		{
+			activeBackendCount++;
+		}
+	}
+
+	/* we read the status array again on the next call */
+	pgstat_clear_snapshot();
+
+	return activeBackendCount;
+}
+
+
+/*
+ * RunningJobTaskCountHash creates a hash that maps each job with running tasks
+ * in the shared hash to the number of its running tasks.
+ */
+static HTAB *
+RunningJobTaskCountHash(HTAB *WorkerTasksHash)
+{
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+	HTAB *jobTaskCountHash = NULL;
+	HASHCTL info;
+	int hashFlags = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint64);
+	info.entrysize = sizeof(JobTaskCount);
+	info.hash = tag_hash;
+	info.hcxt = CurrentMemoryContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	jobTaskCountHash = hash_create("Job Task Count Hash", 32, &info, hashFlags);
+
+	hash_seq_init(&status, WorkerTasksHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
+	{
+		if (RunningTask(currentTask))
+		{
+			bool handleFound = false;
+			JobTaskCount *jobTaskCount =
+				(JobTaskCount *) hash_search(jobTaskCountHash, &currentTask->jobId,
+											 HASH_ENTER, &handleFound);
+			if (!handleFound)
+			{
+				jobTaskCount->taskCount = 0;
+			}
+
+			jobTaskCount->taskCount++;
+		}
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
+	}
+
+	return jobTaskCountHash;
+}
+
+
+/*
+ * NextFairQueuedTask walks over the tasks in the given priority queue that have
+ * not been picked yet, and returns the first task of the job that has the least
+ * running and picked tasks. This way, a large repartition job that queued many
+ * tasks cannot keep a small job from running, while tasks of one job still run
+ * in priority order. High priority tasks such as job cleanups are returned
+ * before all others.
+ */
+static WorkerTask *
+NextFairQueuedTask(WorkerTask *taskQueue, uint32 queueSize, HTAB *jobTaskCountHash)
+{
+	WorkerTask *nextTask = NULL;
+	uint32 nextTaskJobCount = 0;
+	uint32 queueIndex = 0;
+
+	for (queueIndex = 0; queueIndex < queueSize; queueIndex++)
+	{
+		WorkerTask *queuedTask = WORKER_TASK_AT(taskQueue, queueIndex);
+		JobTaskCount *jobTaskCount = NULL;
+		uint32 jobCount = 0;
+		bool handleFound = false;
+
+		/* skip tasks that we already picked */
+		if (queuedTask->taskStatus == TASK_SCHEDULED)
+		{
+			continue;
+		}
+
+		if (queuedTask->assignedAt == HIGH_PRIORITY_TASK_TIME)
+		{
+			return queuedTask;
+		}
+
+		jobTaskCount = (JobTaskCount *) hash_search(jobTaskCountHash,
+													&queuedTask->jobId,
+													HASH_FIND, &handleFound);
+		if (jobTaskCount != NULL)
+		{
+			jobCount = jobTaskCount->taskCount;
+		}
+
+		/* the queue is ordered, so we keep the earliest task on ties */
+		if (nextTask == NULL || jobCount < nextTaskJobCount)
+		{
+			nextTask = queuedTask;
+			nextTaskJobCount = jobCount;
+		}
+	}
+
+	Assert(nextTask != NULL);
+
+	return nextTask;
+}
+
+
 /*
  * SchedulableTaskPriorityQueue allocates an array containing all schedulable
  * tasks in the shared hash, orders these tasks according to a sorting criteria,
@@ -859,6 +1142,7 @@ ManageWorkerTasksHash(HTAB *WorkerTasksHash)
 {
 	HASH_SEQ_STATUS status;
 	List *schedulableTaskList = NIL;
+	List *cancelConnectionList = NIL;
 	WorkerTask *currentTask = NULL;
 
 	/* ask the scheduler if we have new tasks to schedule */
@@ -881,7 +1165,7 @@ ManageWorkerTasksHash(HTAB *WorkerTasksHash)
 	currentTask = (WorkerTask *) hash_seq_search(&status);
 	while (currentTask != NULL)
 	{
-		ManageWorkerTask(currentTask, WorkerTasksHash);
+		ManageWorkerTask(currentTask, WorkerTasksHash, &cancelConnectionList);
 
 		/*
 		 * Typically, we delete worker tasks in the task tracker protocol
@@ -897,6 +1181,13 @@ ManageWorkerTasksHash(HTAB *WorkerTasksHash)
 	}
 
 	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	/*
+	 * Cancel the queries of canceled tasks together, and without holding the
+	 * lock. Their connections are only closed in the next round.
+	 */
+	MultiClientCancelList(cancelConnectionList);
+	list_free(cancelConnectionList);
 }
 
 
@@ -904,10 +1195,13 @@ ManageWorkerTasksHash(HTAB *WorkerTasksHash)
  * ManageWorkerTask manages the execution of the worker task. More specifically,
  * the function connects to a local backend, sends the query associated with the
  * task, and oversees the query's execution. Note that this function expects the
- * caller to hold an exclusive lock over the shared hash.
+ * caller to hold an exclusive lock over the shared hash. Connections whose
+ * queries need to be canceled are appended to cancelConnectionList, such that
+ * the caller can cancel them together.
  */
 static void
-ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
+ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash,
+				 List **cancelConnectionList)
 {
 	switch (workerTask->taskStatus)
 	{
@@ -932,6 +1226,8 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 				if (taskSent)
 				{
 					workerTask->taskStatus = TASK_RUNNING;
+
+					RecordTaskStart(workerTask);
 				}
 				else
 				{
@@ -963,6 +1259,9 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 				if (queryStatus == CLIENT_QUERY_DONE)
 				{
 					workerTask->taskStatus = TASK_SUCCEEDED;
+					WorkerTasksSharedState->taskStats.succeededTaskCount++;
+
+					NotifyTaskCompletion(workerTask);
 				}
 				else if (queryStatus == CLIENT_QUERY_FAILED)
 				{
@@ -987,8 +1286,13 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 			/* clean up the connection if we are done with the task */
 			if (resultStatus != CLIENT_RESULT_BUSY)
 			{
+				RecordTaskEnd(workerTask);
+
 				MultiClientDisconnect(workerTask->connectionId);
 				workerTask->connectionId = INVALID_CONNECTION_ID;
+
+				/* schedule the next task without waiting */
+				SetLatch(MyLatch);
 			}
 
 			break;
@@ -996,13 +1300,18 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 
 		case TASK_FAILED:
 		{
+			WorkerTasksSharedState->taskStats.failedTaskCount++;
+
 			if (workerTask->failureCount < MAX_TASK_FAILURE_COUNT)
 			{
+				/* the retry queues up behind the other tasks again */
 				workerTask->taskStatus = TASK_ASSIGNED;
+				workerTask->queuedAt = GetCurrentTimestamp();
 			}
 			else
 			{
 				workerTask->taskStatus = TASK_PERMANENTLY_FAILED;
+				WorkerTasksSharedState->taskStats.permanentlyFailedTaskCount++;
 			}
 
 			break;
@@ -1035,10 +1344,15 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 				ResultStatus status = MultiClientResultStatus(connectionId);
 				if (status == CLIENT_RESULT_BUSY)
 				{
-					MultiClientCancel(connectionId);
+					*cancelConnectionList = lappend_int(*cancelConnectionList,
+														connectionId);
 				}
+
+				RecordTaskEnd(workerTask);
 			}
 
+			WorkerTasksSharedState->taskStats.canceledTaskCount++;
+
 			/* give the backend some time to flush its response */
 			workerTask->taskStatus = TASK_CANCELED;
 			break;
@@ -1083,6 +1397,83 @@ RemoveWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 }
 
 
+/*
+ * NotifyTaskCompletion notifies the master nodes that listen for task status
+ * changes that a task of the given job succeeded, such that they check the
+ * statuses of the job's tasks right away instead of at their next periodic
+ * check. The notification is sent over the task's connection to the local
+ * backend, which is still open at this point.
+ */
+static void
+NotifyTaskCompletion(WorkerTask *workerTask)
+{
+	MultiConnection *connection = MultiClientGetConnection(workerTask->connectionId);
+	StringInfo notifyCommand = makeStringInfo();
+	PGresult *result = NULL;
+
+	appendStringInfo(notifyCommand, TASK_STATUS_NOTIFY_COMMAND, workerTask->jobId);
+
+	/* master nodes fall back to their periodic checks if this fails */
+	ExecuteOptionalRemoteCommand(connection, notifyCommand->data, &result);
+	PQclear(result);
+	ForgetResults(connection);
+
+	FreeStringInfo(notifyCommand);
+}
+
+
+/*
+ * RecordTaskStart records that the given task was sent to a local backend,
+ * along with the pid of that backend and the time the task was queued.
+ */
+static void
+RecordTaskStart(WorkerTask *workerTask)
+{
+	MultiConnection *connection = MultiClientGetConnection(workerTask->connectionId);
+	TaskTrackerStats *taskStats = &WorkerTasksSharedState->taskStats;
+
+	workerTask->startedAt = GetCurrentTimestamp();
+	workerTask->finishedAt = 0;
+	workerTask->backendPid = PQbackendPID(connection->pgConn);
+
+	taskStats->startedTaskCount++;
+	taskStats->totalQueueTime += TaskTrackerMillisBetween(workerTask->queuedAt,
+														  workerTask->startedAt);
+}
+
+
+/*
+ * RecordTaskEnd records that the current run of the given task ended, and adds
+ * its duration to the total run time of tasks.
+ */
+static void
+RecordTaskEnd(WorkerTask *workerTask)
+{
+	TaskTrackerStats *taskStats = &WorkerTasksSharedState->taskStats;
+
+	workerTask->finishedAt = GetCurrentTimestamp();
+
+	taskStats->totalRunTime += TaskTrackerMillisBetween(workerTask->startedAt,
+														workerTask->finishedAt);
+}
+
+
+/*
+ * TaskTrackerMillisBetween returns the number of milliseconds between the
+ * given timestamps.
+ */
+double
+TaskTrackerMillisBetween(TimestampTz startTime, TimestampTz endTime)
+{
+	long seconds = 0;
+	int microseconds = 0;
+
+	TimestampDifference(startTime, endTime, &seconds, &microseconds);
+
+	return seconds * 1000.0 + microseconds / 1000.0;
+}
+
+
 /* Wrapper function to create the job directory if it does not already exist. */
 static void
 CreateJobDirectoryIfNotExists(uint64 jobId)
@@ -19,9 +19,11 @@
 
 #include <time.h>
 
+#include "access/htup_details.h"
 #include "access/xact.h"
 #include "commands/dbcommands.h"
 #include "commands/schemacmds.h"
+#include "distributed/job_directory_cleanup.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_server_executor.h"
@@ -29,23 +31,31 @@
 #include "distributed/task_tracker.h"
 #include "distributed/task_tracker_protocol.h"
 #include "distributed/worker_protocol.h"
+#include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/pmsignal.h"
 #include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 
 
 /* Local functions forward declarations */
 static bool TaskTrackerRunning(void);
+static void WakeUpTaskTracker(void);
 static void CreateJobSchema(StringInfo schemaName);
 static void CreateTask(uint64 jobId, uint32 taskId, char *taskCallString);
 static void UpdateTask(WorkerTask *workerTask, char *taskCallString);
 static void CleanupTask(WorkerTask *workerTask);
+static const char * TaskStatusName(TaskStatus taskStatus);
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(task_tracker_assign_task);
 PG_FUNCTION_INFO_V1(task_tracker_task_status);
+PG_FUNCTION_INFO_V1(task_tracker_job_status);
 PG_FUNCTION_INFO_V1(task_tracker_cleanup_job);
+PG_FUNCTION_INFO_V1(task_tracker_tasks);
+PG_FUNCTION_INFO_V1(task_tracker_stats);
 
 
 /*
@@ -121,6 +131,9 @@ task_tracker_assign_task(PG_FUNCTION_ARGS)
 
 	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
 
+	/* have the task tracker schedule the task without waiting for its delay */
+	WakeUpTaskTracker();
+
 	PG_RETURN_VOID();
 }
 
@@ -167,6 +180,99 @@ task_tracker_task_status(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * task_tracker_job_status returns the task id and status of all tasks of the
+ * given job, such that the master node can check the statuses of a job's tasks
+ * with a single call.
+ */
+Datum
+task_tracker_job_status(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+
+	ReturnSetInfo *returnSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext perQueryContext = NULL;
+	MemoryContext oldContext = NULL;
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+
+	Datum values[2];
+	bool isNulls[2];
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (returnSetInfo == NULL || !IsA(returnSetInfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context " \
+						"that cannot accept a set")));
+	}
+
+	if (!(returnSetInfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+	}
+
+	if (!TaskTrackerRunning())
+	{
+		ereport(ERROR, (errcode(ERRCODE_CANNOT_CONNECT_NOW),
+						errmsg("the task tracker has been disabled or shut down")));
+	}
+
+	/* build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	perQueryContext = returnSetInfo->econtext->ecxt_per_query_memory;
+
+	oldContext = MemoryContextSwitchTo(perQueryContext);
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	returnSetInfo->returnMode = SFRM_Materialize;
+	returnSetInfo->setResult = tupleStore;
+	returnSetInfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+
+	hash_seq_init(&status, TaskTrackerTaskHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
+	{
+		if (currentTask->jobId == jobId)
+		{
+			memset(values, 0, sizeof(values));
+			memset(isNulls, false, sizeof(isNulls));
+
+			values[0] = UInt32GetDatum(currentTask->taskId);
+			values[1] = UInt32GetDatum((uint32) currentTask->taskStatus);
+
+			tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+		}
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
 /*
  * task_tracker_cleanup_job finds all tasks for the given job, and cleans up
  * files, connections, and shared hash enties associated with these tasks.
@@ -204,14 +310,18 @@ task_tracker_cleanup_job(PG_FUNCTION_ARGS)
 
 	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
 
+	/* tasks canceled mid-query are removed and free up slots in the tracker */
+	WakeUpTaskTracker();
+
 	/*
 	 * We then delete the job directory and schema, if they exist. This cleans
-	 * up all intermediate files and tables allocated for the job. Note that the
-	 * schema drop call can block if another process is creating the schema or
-	 * writing to a table within the schema.
+	 * up all intermediate files and tables allocated for the job. The files are
+	 * removed by the task tracker in the background. Note that the schema drop
+	 * call can block if another process is creating the schema or writing to a
+	 * table within the schema.
 	 */
 	jobDirectoryName = JobDirectoryName(jobId);
-	CitusRemoveDirectory(jobDirectoryName);
+	RemoveJobCacheDirectory(jobDirectoryName);
 
 	LockJobResource(jobId, AccessExclusiveLock);
 	jobSchemaName = JobSchemaName(jobId);
@@ -222,6 +332,211 @@ task_tracker_cleanup_job(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * task_tracker_tasks returns the tasks in the shared hash of the task tracker,
+ * along with their status, the time they spent queued and running, the pid of
+ * the local backend that ran them, and the number of times they failed. The
+ * queue time of a task is counted from when it was last (re)queued, and its
+ * run time is that of its last run.
+ */
+Datum
+task_tracker_tasks(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *returnSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext perQueryContext = NULL;
+	MemoryContext oldContext = NULL;
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+	TimestampTz currentTime = GetCurrentTimestamp();
+
+	Datum values[9];
+	bool isNulls[9];
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (returnSetInfo == NULL || !IsA(returnSetInfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context " \
+						"that cannot accept a set")));
+	}
+
+	if (!(returnSetInfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+	}
+
+	/* build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	perQueryContext = returnSetInfo->econtext->ecxt_per_query_memory;
+
+	oldContext = MemoryContextSwitchTo(perQueryContext);
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	returnSetInfo->returnMode = SFRM_Materialize;
+	returnSetInfo->setResult = tupleStore;
+	returnSetInfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldContext);
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+
+	hash_seq_init(&status, TaskTrackerTaskHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
+	{
+		bool started = (currentTask->startedAt != 0 &&
+						currentTask->startedAt >= currentTask->queuedAt);
+
+		/* the shutdown marker is not a real task */
+		if (currentTask->jobId == RESERVED_JOB_ID &&
+			currentTask->taskId == SHUTDOWN_MARKER_TASK_ID)
+		{
+			currentTask = (WorkerTask *) hash_seq_search(&status);
+			continue;
+		}
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int64GetDatum((int64) currentTask->jobId);
+		values[1] = UInt32GetDatum(currentTask->taskId);
+		values[2] = PointerGetDatum(
+			cstring_to_text(TaskStatusName(currentTask->taskStatus)));
+		values[3] = TimestampTzGetDatum(currentTask->queuedAt);
+
+		if (started)
+		{
+			TimestampTz endTime = currentTask->finishedAt;
+
+			if (endTime < currentTask->startedAt)
+			{
+				endTime = currentTime;
+			}
+
+			values[4] = Float8GetDatum(TaskTrackerMillisBetween(currentTask->queuedAt,
+																currentTask->startedAt));
+			values[5] = Float8GetDatum(TaskTrackerMillisBetween(currentTask->startedAt,
+																endTime));
+		}
+		else
+		{
+			values[4] = Float8GetDatum(TaskTrackerMillisBetween(currentTask->queuedAt,
+																currentTime));
+			isNulls[5] = true;
+		}
+
+		if (currentTask->backendPid != 0)
+		{
+			values[6] = Int32GetDatum(currentTask->backendPid);
+		}
+		else
+		{
+			isNulls[6] = true;
+		}
+
+		values[7] = UInt32GetDatum(currentTask->failureCount);
+		values[8] = PointerGetDatum(cstring_to_text(currentTask->databaseName));
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * task_tracker_stats returns the number of tasks that the task tracker started,
+ * completed and retried since the server started, the total time they spent
+ * queued and running, and the number of tasks that are currently queued and
+ * running.
+ */
+Datum
+task_tracker_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	TaskTrackerStats taskStats;
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+	int64 queuedTaskCount = 0;
+	int64 runningTaskCount = 0;
+
+	Datum values[12];
+	bool isNulls[12];
+
+	CheckCitusVersion(ERROR);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+
+	memcpy(&taskStats, &WorkerTasksSharedState->taskStats, sizeof(TaskTrackerStats));
+
+	hash_seq_init(&status, TaskTrackerTaskHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
+	{
+		if (currentTask->taskStatus == TASK_ASSIGNED)
+		{
+			queuedTaskCount++;
+		}
+		else if (currentTask->taskStatus == TASK_SCHEDULED ||
+				 currentTask->taskStatus == TASK_RUNNING)
+		{
+			runningTaskCount++;
+		}
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int64GetDatum((int64) taskStats.assignedTaskCount);
+	values[1] = Int64GetDatum((int64) taskStats.startedTaskCount);
+	values[2] = Int64GetDatum((int64) taskStats.succeededTaskCount);
+	values[3] = Int64GetDatum((int64) taskStats.failedTaskCount);
+	values[4] = Int64GetDatum((int64) taskStats.permanentlyFailedTaskCount);
+	values[5] = Int64GetDatum((int64) taskStats.canceledTaskCount);
+	values[6] = Float8GetDatum(taskStats.totalQueueTime);
+	values[7] = Float8GetDatum(taskStats.totalRunTime);
+	values[8] = Int64GetDatum(queuedTaskCount);
+	values[9] = Int64GetDatum(runningTaskCount);
+	values[10] = Int32GetDatum(MaxRunningTasksPerNode);
+	values[11] = TimestampTzGetDatum(taskStats.statsSince);
+
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heapTuple));
+}
+
+
 /*
  * TaskTrackerRunning checks if the task tracker process is running. To do this,
  * the function checks if the task tracker is configured to start up, and infers
@@ -260,6 +575,24 @@ TaskTrackerRunning(void)
 }
 
 
+/*
+ * WakeUpTaskTracker sets the latch of the task tracker process, if it has
+ * started up, so that it manages its tasks right away. The latch pointer only
+ * changes when the task tracker starts up, and setting the latch of a process
+ * that already exited merely causes a spurious wakeup.
+ */
+static void
+WakeUpTaskTracker(void)
+{
+	Latch *taskTrackerLatch = WorkerTasksSharedState->taskTrackerLatch;
+
+	if (taskTrackerLatch != NULL)
+	{
+		SetLatch(taskTrackerLatch);
+	}
+}
+
+
 /*
  * CreateJobSchema creates a job schema with the given schema name. Note that
  * this function ensures that our pg_ prefixed schema names can be created.
@@ -340,8 +673,14 @@ CreateTask(uint64 jobId, uint32 taskId, char *taskCallString)
 	workerTask->taskStatus = TASK_ASSIGNED;
 	workerTask->connectionId = INVALID_CONNECTION_ID;
 	workerTask->failureCount = 0;
+	workerTask->queuedAt = GetCurrentTimestamp();
+	workerTask->startedAt = 0;
+	workerTask->finishedAt = 0;
+	workerTask->backendPid = 0;
 	strlcpy(workerTask->databaseName, databaseName, NAMEDATALEN);
 	strlcpy(workerTask->userName, userName, NAMEDATALEN);
+
+	WorkerTasksSharedState->taskStats.assignedTaskCount++;
 }
 
 
@@ -375,6 +714,7 @@ UpdateTask(WorkerTask *workerTask, char *taskCallString)
 		strlcpy(workerTask->taskCallString, taskCallString, MaxTaskStringSize);
 		workerTask->failureCount = 0;
 		workerTask->taskStatus = TASK_ASSIGNED;
+		workerTask->queuedAt = GetCurrentTimestamp();
 	}
 	else
 	{
@@ -384,6 +724,65 @@ UpdateTask(WorkerTask *workerTask, char *taskCallString)
 }
 
 
+/* TaskStatusName returns the name of the given task status. */
+static const char *
+TaskStatusName(TaskStatus taskStatus)
+{
+	switch (taskStatus)
+	{
+		case TASK_ASSIGNED:
+		{
+			return "assigned";
+		}
+
+		case TASK_SCHEDULED:
+		{
+			return "scheduled";
+		}
+
+		case TASK_RUNNING:
+		{
+			return "running";
+		}
+
+		case TASK_FAILED:
+		{
+			return "failed";
+		}
+
+		case TASK_PERMANENTLY_FAILED:
+		{
+			return "permanently failed";
+		}
+
+		case TASK_SUCCEEDED:
+		{
+			return "succeeded";
+		}
+
+		case TASK_CANCEL_REQUESTED:
+		{
+			return "cancel requested";
+		}
+
+		case TASK_CANCELED:
+		{
+			return "canceled";
+		}
+
+		case TASK_TO_REMOVE:
+		{
+			return "to remove";
+		}
+
+		default:
+		{
+			return "unknown";
+		}
+	}
+}
+
+
 /* Cleans up connection and shared hash entry associated with the given task. */
 static void
 CleanupTask(WorkerTask *workerTask)
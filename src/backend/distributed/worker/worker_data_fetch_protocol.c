@@ -41,11 +41,14 @@
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
 #include "nodes/makefuncs.h"
+#include "storage/copydir.h"
+#include "storage/fd.h"
 #include "storage/lmgr.h"
 #include "tcop/tcopprot.h"
 #include "tcop/utility.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
+#include "utils/tuplestore.h"
 #if (PG_VERSION_NUM >= 100000)
 #include "utils/regproc.h"
 #include "utils/varlena.h"
@@ -53,9 +56,6 @@
 
 
 /* Local functions forward declarations */
-static void FetchRegularFileAsSuperUser(const char *nodeName, uint32 nodePort,
-										StringInfo remoteFilename,
-										StringInfo localFilename);
 static bool ReceiveRegularFile(const char *nodeName, uint32 nodePort,
 							   const char *nodeUser, StringInfo transmitCommand,
 							   StringInfo filePath);
@@ -71,6 +71,8 @@ static void SetDefElemArg(AlterSeqStmt *statement, const char *name, Node *arg);
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_fetch_partition_file);
 PG_FUNCTION_INFO_V1(worker_fetch_query_results_file);
+PG_FUNCTION_INFO_V1(worker_link_partition_file);
+PG_FUNCTION_INFO_V1(worker_partition_file_sizes);
 PG_FUNCTION_INFO_V1(worker_apply_shard_ddl_command);
 PG_FUNCTION_INFO_V1(worker_apply_inter_shard_ddl_command);
 PG_FUNCTION_INFO_V1(worker_apply_sequence_command);
@@ -190,12 +192,175 @@ TaskFilename(StringInfo directoryName, uint32 taskId)
 }
 
 
+/*
+ * worker_link_partition_file makes a partition file that was written by a map
+ * task on this node available to the upstream task that depends on it, like
+ * worker_fetch_partition_file does for partition files on other nodes. The
+ * file is hard linked into the upstream task's directory, or copied if that
+ * is not possible.
+ */
+Datum
+worker_link_partition_file(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 partitionTaskId = PG_GETARG_UINT32(1);
+	uint32 partitionFileId = PG_GETARG_UINT32(2);
+	uint32 upstreamTaskId = PG_GETARG_UINT32(3);
+
+	/* source filename is <jobId>/<partitionTaskId>/<partitionFileId> */
+	StringInfo sourceDirectoryName = TaskDirectoryName(jobId, partitionTaskId);
+	StringInfo sourceFilename = PartitionFilename(sourceDirectoryName, partitionFileId);
+
+	/* local filename is <jobId>/<upstreamTaskId>/<partitionTaskId> */
+	StringInfo taskDirectoryName = TaskDirectoryName(jobId, upstreamTaskId);
+	StringInfo taskFilename = TaskFilename(taskDirectoryName, partitionTaskId);
+	StringInfo attemptFilename = makeStringInfo();
+	uint32 randomId = (uint32) random();
+	int renamed = 0;
+
+	CheckCitusVersion(ERROR);
+
+	if (!DirectoryExists(taskDirectoryName))
+	{
+		InitTaskDirectory(jobId, upstreamTaskId);
+	}
+
+	/* as in FetchRegularFileAsSuperUser, the file appears atomically */
+	appendStringInfo(attemptFilename, "%s_%0*u%s", taskFilename->data,
+					 MIN_TASK_FILENAME_WIDTH, randomId, ATTEMPT_FILE_SUFFIX);
+
+	if (link(sourceFilename->data, attemptFilename->data) != 0)
+	{
+		copy_file(sourceFilename->data, attemptFilename->data);
+	}
+
+	renamed = rename(attemptFilename->data, taskFilename->data);
+	if (renamed != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   attemptFilename->data, taskFilename->data)));
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * worker_partition_file_sizes returns the size of each partition file that
+ * the given map tasks of a job wrote on this node. The task tracker executor
+ * uses these sizes to run merge tasks on the node that has most of their input.
+ */
+Datum
+worker_partition_file_sizes(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	ArrayType *taskIdObject = PG_GETARG_ARRAYTYPE_P(1);
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	Datum *taskIdArray = NULL;
+	int32 taskCount = 0;
+	int32 taskIndex = 0;
+	int prefixLength = strlen(PARTITION_FILE_PREFIX);
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (resultSet == NULL || !IsA(resultSet, ReturnSetInfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (!(resultSet->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("materialize mode required, but it is not allowed "
+							   "in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldContext = MemoryContextSwitchTo(resultSet->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	taskIdArray = DeconstructArrayObject(taskIdObject);
+	taskCount = ArrayObjectCount(taskIdObject);
+
+	for (taskIndex = 0; taskIndex < taskCount; taskIndex++)
+	{
+		uint32 taskId = DatumGetUInt32(taskIdArray[taskIndex]);
+		StringInfo taskDirectoryName = TaskDirectoryName(jobId, taskId);
+		const char *directoryName = taskDirectoryName->data;
+		StringInfo fullFilename = makeStringInfo();
+		struct dirent *directoryEntry = NULL;
+		DIR *directory = AllocateDir(directoryName);
+
+		if (directory == NULL)
+		{
+			/* the map task did not run on this node */
+			continue;
+		}
+
+		directoryEntry = ReadDir(directory, directoryName);
+		for (; directoryEntry != NULL; directoryEntry = ReadDir(directory, directoryName))
+		{
+			const char *baseFilename = directoryEntry->d_name;
+			struct stat fileStat;
+			Datum values[3];
+			bool isNulls[3];
+
+			if (strncmp(baseFilename, PARTITION_FILE_PREFIX, prefixLength) != 0 ||
+				strstr(baseFilename, ATTEMPT_FILE_SUFFIX) != NULL)
+			{
+				continue;
+			}
+
+			resetStringInfo(fullFilename);
+			appendStringInfo(fullFilename, "%s/%s", directoryName, baseFilename);
+
+			if (stat(fullFilename->data, &fileStat) < 0)
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not stat file \"%s\": %m",
+									   fullFilename->data)));
+			}
+
+			memset(isNulls, false, sizeof(isNulls));
+			values[0] = UInt32GetDatum(taskId);
+			values[1] = UInt32GetDatum((uint32) strtoul(baseFilename + prefixLength,
+														NULL, 10));
+			values[2] = Int64GetDatum((int64) fileStat.st_size);
+
+			tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+		}
+
+		FreeDir(directory);
+	}
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
 /*
  * FetchRegularFileAsSuperUser copies a file from a remote node in an idempotent
  * manner. It connects to the remote node as superuser to give file access.
  * Callers must make sure that the file names are sanitized.
  */
-static void
+void
 FetchRegularFileAsSuperUser(const char *nodeName, uint32 nodePort,
 							StringInfo remoteFilename, StringInfo localFilename)
 {
@@ -332,7 +497,8 @@ ReceiveRegularFile(const char *nodeName, uint32 nodePort, const char *nodeUser,
 	/* loop until we receive and append all the data from remote node */
 	while (!copyDone)
 	{
-		CopyStatus copyStatus = MultiClientCopyData(connectionId, fileDescriptor, NULL);
+		CopyStatus copyStatus = MultiClientCopyData(connectionId, fileDescriptor, NULL,
+													NULL);
 		if (copyStatus == CLIENT_COPY_DONE)
 		{
 			copyDone = true;
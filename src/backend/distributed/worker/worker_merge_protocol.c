@@ -23,7 +23,9 @@
 #include "catalog/pg_namespace.h"
 #include "commands/copy.h"
 #include "commands/tablecmds.h"
+#include "distributed/intermediate_results.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
 #include "distributed/worker_protocol.h"
 #include "executor/spi.h"
 #include "nodes/makefuncs.h"
@@ -34,6 +36,20 @@
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
 #include "utils/tqual.h"
+#include "utils/tuplestore.h"
+
+
+/* the view created instead of a merge table reads the task's files directly */
+#define CREATE_MERGE_VIEW_COMMAND "CREATE TEMPORARY VIEW %s AS SELECT * FROM \
+ pg_catalog.worker_read_merge_files(" UINT64_FORMAT ", %u) AS %s (%s)"
+#define DROP_MERGE_VIEW_COMMAND "DROP VIEW pg_temp.%s"
+
+
+/* Config variables managed via guc.c */
+bool EnableMergeFunctionScan = false; /* read merge files without a merge table */
+
+/* Local variables */
+static bool MergeFileReadAllowed = false; /* only set while running a merge query */
 
 
 /* Local functions forward declarations */
@@ -42,11 +58,17 @@ static void CreateTaskTable(StringInfo schemaName, StringInfo relationName,
 							List *columnNameList, List *columnTypeList);
 static void CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 									   StringInfo sourceDirectoryName);
+static bool IsTaskInputFile(const char *baseFilename);
+static StringInfo MergeViewQueryString(uint64 jobId, uint32 taskId,
+									   const char *createMergeTableQuery,
+									   StringInfo mergeViewName);
+static void ExecuteMergeQueryOverView(const char *createIntermediateTableQuery);
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_merge_files_into_table);
 PG_FUNCTION_INFO_V1(worker_merge_files_and_run_query);
+PG_FUNCTION_INFO_V1(worker_read_merge_files);
 PG_FUNCTION_INFO_V1(worker_cleanup_job_schema_cache);
 
 
@@ -130,6 +152,11 @@ worker_merge_files_into_table(PG_FUNCTION_ARGS)
  * two approaches. For this purpose creating a directory_fdw extension and using
  * it would make sense. Then we can merge files with a query or without query
  * through directory_fdw.
+ *
+ * If citus.enable_merge_function_scan is on, we do not create the merge table.
+ * Instead, we create a temporary view of the same name that reads the task's
+ * files through worker_read_merge_files(), and the final query scans the files
+ * directly. This skips writing the merge data to a table, and WAL, a second time.
  */
 Datum
 worker_merge_files_and_run_query(PG_FUNCTION_ARGS)
@@ -186,31 +213,259 @@ worker_merge_files_and_run_query(PG_FUNCTION_ARGS)
 							   setSearchPathString->data)));
 	}
 
-	createMergeTableResult = SPI_exec(createMergeTableQuery, 0);
-	if (createMergeTableResult < 0)
+	if (EnableMergeFunctionScan)
 	{
-		ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+		StringInfo mergeViewName = makeStringInfo();
+		StringInfo createMergeViewQuery = MergeViewQueryString(jobId, taskId,
+															   createMergeTableQuery,
+															   mergeViewName);
+		StringInfo dropMergeViewQuery = makeStringInfo();
+		int createMergeViewResult = 0;
+		int dropMergeViewResult = 0;
+
+		createMergeViewResult = SPI_exec(createMergeViewQuery->data, 0);
+		if (createMergeViewResult < 0)
+		{
+			ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+								   createMergeViewQuery->data)));
+		}
+
+		ExecuteMergeQueryOverView(createIntermediateTableQuery);
+
+		appendStringInfo(dropMergeViewQuery, DROP_MERGE_VIEW_COMMAND,
+						 mergeViewName->data);
+
+		dropMergeViewResult = SPI_exec(dropMergeViewQuery->data, 0);
+		if (dropMergeViewResult < 0)
+		{
+			ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+								   dropMergeViewQuery->data)));
+		}
+	}
+	else
+	{
+		createMergeTableResult = SPI_exec(createMergeTableQuery, 0);
+		if (createMergeTableResult < 0)
+		{
+			ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+								   createMergeTableQuery)));
+		}
+
+		appendStringInfo(mergeTableName, "%s%s", intermediateTableName->data,
+						 MERGE_TABLE_SUFFIX);
+		CopyTaskFilesFromDirectory(jobSchemaName, mergeTableName, taskDirectoryName);
+
+		createIntermediateTableResult = SPI_exec(createIntermediateTableQuery, 0);
+		if (createIntermediateTableResult < 0)
+		{
+			ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+								   createIntermediateTableQuery)));
+		}
+	}
+
+	finished = SPI_finish();
+	if (finished != SPI_OK_FINISH)
+	{
+		ereport(ERROR, (errmsg("could not disconnect from SPI manager")));
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * MergeViewQueryString builds a query string which creates a temporary view with
+ * the name and columns of the merge table that the given create merge table query
+ * would create. The view reads the given task's files by calling
+ * worker_read_merge_files(). The function also returns the view's name.
+ */
+static StringInfo
+MergeViewQueryString(uint64 jobId, uint32 taskId, const char *createMergeTableQuery,
+					 StringInfo mergeViewName)
+{
+	StringInfo mergeViewQueryString = makeStringInfo();
+	StringInfo columnsString = makeStringInfo();
+	Node *parseTree = ParseTreeNode(createMergeTableQuery);
+	CreateStmt *createStatement = NULL;
+	ListCell *columnDefinitionCell = NULL;
+	const char *quotedViewName = NULL;
+
+	if (!IsA(parseTree, CreateStmt))
+	{
+		ereport(ERROR, (errmsg("unexpected merge table query \"%s\"",
 							   createMergeTableQuery)));
 	}
 
-	appendStringInfo(mergeTableName, "%s%s", intermediateTableName->data,
-					 MERGE_TABLE_SUFFIX);
-	CopyTaskFilesFromDirectory(jobSchemaName, mergeTableName, taskDirectoryName);
+	createStatement = (CreateStmt *) parseTree;
+
+	foreach(columnDefinitionCell, createStatement->tableElts)
+	{
+		ColumnDef *columnDefinition = (ColumnDef *) lfirst(columnDefinitionCell);
+		Oid columnTypeId = InvalidOid;
+		int32 columnTypeMod = -1;
+
+		typenameTypeIdAndMod(NULL, columnDefinition->typeName, &columnTypeId,
+							 &columnTypeMod);
+
+		if (columnsString->len > 0)
+		{
+			appendStringInfoString(columnsString, ", ");
+		}
+
+		appendStringInfo(columnsString, "%s %s",
+						 quote_identifier(columnDefinition->colname),
+						 format_type_with_typemod(columnTypeId, columnTypeMod));
+	}
+
+	appendStringInfoString(mergeViewName, createStatement->relation->relname);
+	quotedViewName = quote_identifier(mergeViewName->data);
+
+	appendStringInfo(mergeViewQueryString, CREATE_MERGE_VIEW_COMMAND, quotedViewName,
+					 jobId, taskId, quotedViewName, columnsString->data);
+
+	return mergeViewQueryString;
+}
+
+
+/*
+ * ExecuteMergeQueryOverView runs the given create intermediate table query over
+ * the merge view. worker_read_merge_files() may read task files only while this
+ * function runs, so that the function cannot be used to read arbitrary files.
+ */
+static void
+ExecuteMergeQueryOverView(const char *createIntermediateTableQuery)
+{
+	int createIntermediateTableResult = 0;
+
+	MergeFileReadAllowed = true;
+
+	PG_TRY();
+	{
+		createIntermediateTableResult = SPI_exec(createIntermediateTableQuery, 0);
+	}
+	PG_CATCH();
+	{
+		MergeFileReadAllowed = false;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	MergeFileReadAllowed = false;
 
-	createIntermediateTableResult = SPI_exec(createIntermediateTableQuery, 0);
 	if (createIntermediateTableResult < 0)
 	{
 		ereport(ERROR, (errmsg("execution was not successful \"%s\"",
 							   createIntermediateTableQuery)));
 	}
+}
 
-	finished = SPI_finish();
-	if (finished != SPI_OK_FINISH)
+
+/*
+ * worker_read_merge_files reads all files in the given task's directory, except
+ * for those having an attempt suffix, and returns their rows as a set of records.
+ * The function is used by the merge view of worker_merge_files_and_run_query()
+ * and errors out if called in any other context.
+ */
+Datum
+worker_read_merge_files(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 taskId = PG_GETARG_UINT32(1);
+
+	StringInfo taskDirectoryName = TaskDirectoryName(jobId, taskId);
+	const char *directoryName = taskDirectoryName->data;
+	char *copyFormat = BinaryWorkerCopyFormat ? "binary" : "text";
+	struct dirent *directoryEntry = NULL;
+	DIR *directory = NULL;
+
+	Tuplestorestate *tupstore = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	MemoryContext oldcontext = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	if (!MergeFileReadAllowed)
 	{
-		ereport(ERROR, (errmsg("could not disconnect from SPI manager")));
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("worker_read_merge_files can only be called from "
+							   "worker_merge_files_and_run_query")));
 	}
 
-	PG_RETURN_VOID();
+	/* check to see if query supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg(
+					 "set-valued function called in context that cannot accept a set")));
+	}
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg(
+					 "materialize mode required, but it is not allowed in this context")));
+	}
+
+	/* get a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	}
+
+	tupleDescriptor = CreateTupleDescCopy(tupleDescriptor);
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldcontext);
+
+	directory = AllocateDir(directoryName);
+	if (directory == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open directory \"%s\": %m", directoryName)));
+	}
+
+	directoryEntry = ReadDir(directory, directoryName);
+	for (; directoryEntry != NULL; directoryEntry = ReadDir(directory, directoryName))
+	{
+		const char *baseFilename = directoryEntry->d_name;
+		StringInfo fullFilename = NULL;
+
+		if (!IsTaskInputFile(baseFilename))
+		{
+			continue;
+		}
+
+		fullFilename = makeStringInfo();
+		appendStringInfo(fullFilename, "%s/%s", directoryName, baseFilename);
+
+		if (IsCompressedResultFile(fullFilename->data))
+		{
+			ReadCompressedFileIntoTupleStore(fullFilename->data, copyFormat,
+											 tupleDescriptor, tupstore);
+		}
+		else
+		{
+			ReadFileIntoTupleStore(fullFilename->data, copyFormat, tupleDescriptor,
+								   tupstore);
+		}
+	}
+
+	FreeDir(directory);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
 }
 
 
@@ -480,7 +735,8 @@ CreateStatement(RangeVar *relation, List *columnDefinitionList)
 /*
  * CopyTaskFilesFromDirectory finds all files in the given directory, except for
  * those having an attempt suffix. The function then copies these files into the
- * database table identified by the given schema and table name.
+ * database table identified by the given schema and table name. Compressed
+ * partition files are first decompressed into a temporary file.
  */
 static void
 CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
@@ -506,11 +762,9 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 		RangeVar *relation = NULL;
 		CopyStmt *copyStatement = NULL;
 		uint64 copiedRowCount = 0;
+		File decompressedFile = -1;
 
-		/* if system file or lingering task file, skip it */
-		if (strncmp(baseFilename, ".", MAXPGPATH) == 0 ||
-			strncmp(baseFilename, "..", MAXPGPATH) == 0 ||
-			strstr(baseFilename, ATTEMPT_FILE_SUFFIX) != NULL)
+		if (!IsTaskInputFile(baseFilename))
 		{
 			continue;
 		}
@@ -518,6 +772,14 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 		fullFilename = makeStringInfo();
 		appendStringInfo(fullFilename, "%s/%s", directoryName, baseFilename);
 
+		if (IsCompressedResultFile(fullFilename->data))
+		{
+			decompressedFile = DecompressResultFile(fullFilename->data);
+
+			resetStringInfo(fullFilename);
+			appendStringInfoString(fullFilename, FilePathName(decompressedFile));
+		}
+
 		/* build relation object and copy statement */
 		relation = makeRangeVar(schemaName->data, relationName->data, -1);
 		copyStatement = CopyStatement(relation, fullFilename->data);
@@ -544,6 +806,11 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 #else
 		DoCopy(copyStatement, queryString, &copiedRowCount);
 #endif
+		if (decompressedFile >= 0)
+		{
+			FileClose(decompressedFile);
+		}
+
 		copiedRowTotal += copiedRowCount;
 		CommandCounterIncrement();
 	}
@@ -555,6 +822,24 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 }
 
 
+/*
+ * IsTaskInputFile returns whether the given file in a task directory holds data
+ * for the task. System files and lingering attempt files do not.
+ */
+static bool
+IsTaskInputFile(const char *baseFilename)
+{
+	if (strncmp(baseFilename, ".", MAXPGPATH) == 0 ||
+		strncmp(baseFilename, "..", MAXPGPATH) == 0 ||
+		strstr(baseFilename, ATTEMPT_FILE_SUFFIX) != NULL)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
 /*
  * CopyStatement creates and initializes a copy statement to read the given
  * file's contents into the given table, using copy's standard text format.
@@ -16,12 +16,12 @@
 
 #include "postgres.h"
 #include "funcapi.h"
+#include "libpq-fe.h"
 #include "pgstat.h"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/stat.h>
-#include <math.h>
 #include <unistd.h>
 
 #include "access/hash.h"
@@ -31,7 +31,13 @@
 #include "catalog/pg_collation.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
+#include "distributed/connection_management.h"
+#include "distributed/intermediate_results.h"
+#include "distributed/job_cache_usage.h"
+#include "distributed/metadata_cache.h"
 #include "distributed/multi_copy.h"
+#include "distributed/multi_executor.h"
+#include "distributed/remote_commands.h"
 #include "distributed/resource_lock.h"
 #include "distributed/transmit.h"
 #include "distributed/worker_protocol.h"
@@ -47,32 +53,121 @@
 /* Config variables managed via guc.c */
 bool BinaryWorkerCopyFormat = false;   /* binary format for copying between workers */
 int PartitionBufferSize = 16384; /* total partitioning buffer size in KB */
+int PartitionFileCompression = INTERMEDIATE_RESULT_COMPRESSION_NONE;
 
 /* Local variables */
-static uint32 FileBufferSizeInBytes = 0; /* file buffer size to init later */
+static uint64 PartitionBufferLimit = 0; /* total buffer size across all files */
+static uint64 PartitionBufferRetainSize = 0; /* buffer capacity kept after a flush */
+static uint64 PartitionBufferedBytes = 0; /* bytes currently buffered */
+
+/* number of rows to partition at once */
+#define PARTITION_BATCH_SIZE 1024
+
+/* partition identifier for rows that cannot contribute to the join */
+#define PRUNED_PARTITION_ID 0xFFFFFFFF
+
+
+/* function that determines the partitions of a batch of partition keys */
+typedef void (*PartitionIdFunc)(Datum *, bool *, uint32, uint32 *, const void *);
+
+
+/*
+ * PartitionDestReceiver writes the tuples it receives into partition files.
+ * Tuples are collected into batches, so that the partition function can be
+ * applied to many partition keys at once.
+ */
+typedef struct PartitionDestReceiver
+{
+	/* public DestReceiver interface */
+	DestReceiver pub;
+
+	/* partition column, and partitioning of its values */
+	const char *partitionColumnName;
+	Oid partitionColumnType;
+	int partitionColumnIndex;
+	PartitionIdFunc partitionIdFunction;
+	const void *partitionIdContext;
+
+	/* partition files to write tuples into */
+	FileOutputStream *partitionFileArray;
+	uint32 fileCount;
+
+	/* descriptor of the tuples, and state on how to copy them out */
+	TupleDesc tupleDescriptor;
+	CopyOutState rowOutputState;
+	FmgrInfo *columnOutputFunctions;
+
+	/* tuples of the current batch, allocated in the batch context */
+	MemoryContext batchContext;
+	HeapTuple *rowArray;
+	uint32 rowCount;
+
+	/* buffers for partitioning and writing out a batch */
+	Datum *valueArray;
+	bool *isNullArray;
+	Datum *partitionKeyArray;
+	bool *partitionKeyNullArray;
+	uint32 *partitionIdArray;
+} PartitionDestReceiver;
 
 
 /* Local functions forward declarations */
 static StringInfo InitTaskAttemptDirectory(uint64 jobId, uint32 taskId);
-static uint32 FileBufferSize(int partitionBufferSizeInKB, uint32 fileCount);
-static FileOutputStream * OpenPartitionFiles(StringInfo directoryName, uint32 fileCount);
+static bool ArrayObjectIsEmpty(ArrayType *arrayObject);
+static BloomFilter * FetchBloomFilters(uint64 filterJobId, ArrayType *filterTaskIdObject,
+									   ArrayType *nodeNameObject,
+									   ArrayType *nodePortObject,
+									   StringInfo directoryName);
+static StringInfo BloomFilterFilename(StringInfo directoryName);
+static void InitPartitionBufferLimit(int partitionBufferSizeInKB, uint32 fileCount);
+static MultiConnection ** OpenPartitionConnections(uint64 jobId, uint32 taskId,
+												   uint32 fileCount,
+												   ArrayType *upstreamTaskIdObject,
+												   ArrayType *nodeNameObject,
+												   ArrayType *nodePortObject);
+static FileOutputStream * OpenPartitionFiles(StringInfo directoryName, uint32 fileCount,
+											 MultiConnection **connectionArray);
 static void ClosePartitionFiles(FileOutputStream *partitionFileArray, uint32 fileCount);
 static void RenameDirectory(StringInfo oldDirectoryName, StringInfo newDirectoryName);
-static void FileOutputStreamWrite(FileOutputStream file, StringInfo dataToWrite);
-static void FileOutputStreamFlush(FileOutputStream file);
+static void FileOutputStreamWrite(FileOutputStream *file, StringInfo dataToWrite);
+static void FlushPartitionFilesIfFull(FileOutputStream *partitionFileArray,
+									  uint32 fileCount);
+static void FileOutputStreamFlush(FileOutputStream *file);
 static void FilterAndPartitionTable(const char *filterQuery,
 									const char *columnName, Oid columnType,
-									uint32 (*PartitionIdFunction)(Datum, const void *),
+									void (*PartitionIdFunction)(Datum *, bool *, uint32,
+																uint32 *, const void *),
 									const void *partitionIdContext,
 									FileOutputStream *partitionFileArray,
 									uint32 fileCount);
+static void FilterQueryErrorCallback(void *arg);
+static DestReceiver * CreatePartitionDestReceiver(const char *partitionColumnName,
+												  Oid partitionColumnType,
+												  PartitionIdFunc partitionIdFunction,
+												  const void *partitionIdContext,
+												  FileOutputStream *partitionFileArray,
+												  uint32 fileCount,
+												  CopyOutState rowOutputState);
+static void PartitionDestReceiverStartup(DestReceiver *dest, int operation,
+										 TupleDesc inputTupleDescriptor);
+static bool PartitionDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest);
+static void PartitionRowBatch(PartitionDestReceiver *partitionDest);
+static void PartitionDestReceiverShutdown(DestReceiver *dest);
+static void PartitionDestReceiverDestroy(DestReceiver *dest);
 static int ColumnIndex(TupleDesc rowDescriptor, const char *columnName);
 static CopyOutState InitRowOutputState(void);
 static void ClearRowOutputState(CopyOutState copyState);
 static void OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount);
 static void OutputBinaryFooters(FileOutputStream *partitionFileArray, uint32 fileCount);
-static uint32 RangePartitionId(Datum partitionValue, const void *context);
-static uint32 HashPartitionId(Datum partitionValue, const void *context);
+static void RangePartitionIds(Datum *partitionValues, bool *partitionNulls,
+							  uint32 valueCount, uint32 *partitionIds,
+							  const void *context);
+static uint32 RangePartitionId(Datum partitionValue,
+							   RangePartitionContext *rangePartitionContext,
+							   FunctionCallInfo compareCallInfo);
+static void HashPartitionIds(Datum *partitionValues, bool *partitionNulls,
+							 uint32 valueCount, uint32 *partitionIds,
+							 const void *context);
 static bool FileIsLink(char *filename, struct stat filestat);
 
 
@@ -88,8 +183,12 @@ PG_FUNCTION_INFO_V1(worker_hash_partition_table);
  * renames the directory in which the text files live to ensure deterministic
  * behavior.
  *
+ * When called with the three optional partition destination arrays, partitions
+ * that have a destination are instead streamed to the node running the merge
+ * task that consumes them; see OpenPartitionConnections().
+ *
  * This function applies range partitioning through the use of a function
- * pointer and a range context object; for details, see RangePartitionId().
+ * pointer and a range context object; for details, see RangePartitionIds().
  */
 Datum
 worker_range_partition_table(PG_FUNCTION_ARGS)
@@ -112,6 +211,7 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
 	StringInfo taskDirectory = NULL;
 	StringInfo taskAttemptDirectory = NULL;
 	FileOutputStream *partitionFileArray = NULL;
+	MultiConnection **connectionArray = NULL;
 
 	/* first check that array element's and partition column's types match */
 	Oid splitPointType = ARR_ELEMTYPE(splitPointObject);
@@ -143,12 +243,25 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
 	taskDirectory = InitTaskDirectory(jobId, taskId);
 	taskAttemptDirectory = InitTaskAttemptDirectory(jobId, taskId);
 
-	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount);
-	FileBufferSizeInBytes = FileBufferSize(PartitionBufferSize, fileCount);
+	/* optionally stream partitions straight to the nodes running merge tasks */
+	if (PG_NARGS() > 6)
+	{
+		ArrayType *upstreamTaskIdObject = PG_GETARG_ARRAYTYPE_P(6);
+		ArrayType *nodeNameObject = PG_GETARG_ARRAYTYPE_P(7);
+		ArrayType *nodePortObject = PG_GETARG_ARRAYTYPE_P(8);
+
+		connectionArray = OpenPartitionConnections(jobId, taskId, fileCount,
+												   upstreamTaskIdObject,
+												   nodeNameObject, nodePortObject);
+	}
+
+	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount,
+											connectionArray);
+	InitPartitionBufferLimit(PartitionBufferSize, fileCount);
 
 	/* call the partitioning function that does the actual work */
 	FilterAndPartitionTable(filterQuery, partitionColumn, partitionColumnType,
-							&RangePartitionId, (const void *) partitionContext,
+							&RangePartitionIds, (const void *) partitionContext,
 							partitionFileArray, fileCount);
 
 	/* close partition files and atomically rename (commit) them */
@@ -165,10 +278,17 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
  * filter query's results on a partitioning column, and writes the resulting
  * rows to a set of text files on local disk. The function then atomically
  * renames the directory in which the text files live to ensure deterministic
- * behavior.
+ * behavior. Like worker_range_partition_table, it optionally streams partitions
+ * to the nodes that consume them.
+ *
+ * When repartitioning the two sides of a join, the function may also take the
+ * size of a Bloom filter to build over the partition keys of the first side,
+ * and the locations of the first side's filters to drop rows of the second side
+ * whose keys cannot have a match. The filter is written into the task directory
+ * together with the partition files.
  *
  * This function applies hash partitioning through the use of a function pointer
- * and a hash context object; for details, see HashPartitionId().
+ * and a hash context object; for details, see HashPartitionIds().
  */
 Datum
 worker_hash_partition_table(PG_FUNCTION_ARGS)
@@ -188,6 +308,7 @@ worker_hash_partition_table(PG_FUNCTION_ARGS)
 	StringInfo taskDirectory = NULL;
 	StringInfo taskAttemptDirectory = NULL;
 	FileOutputStream *partitionFileArray = NULL;
+	MultiConnection **connectionArray = NULL;
 	uint32 fileCount = partitionCount;
 
 	CheckCitusVersion(ERROR);
@@ -204,16 +325,60 @@ worker_hash_partition_table(PG_FUNCTION_ARGS)
 	taskDirectory = InitTaskDirectory(jobId, taskId);
 	taskAttemptDirectory = InitTaskAttemptDirectory(jobId, taskId);
 
-	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount);
-	FileBufferSizeInBytes = FileBufferSize(PartitionBufferSize, fileCount);
+	/* optionally stream partitions straight to the nodes running merge tasks */
+	if (PG_NARGS() > 6 && !ArrayObjectIsEmpty(PG_GETARG_ARRAYTYPE_P(6)))
+	{
+		ArrayType *upstreamTaskIdObject = PG_GETARG_ARRAYTYPE_P(6);
+		ArrayType *nodeNameObject = PG_GETARG_ARRAYTYPE_P(7);
+		ArrayType *nodePortObject = PG_GETARG_ARRAYTYPE_P(8);
+
+		connectionArray = OpenPartitionConnections(jobId, taskId, fileCount,
+												   upstreamTaskIdObject,
+												   nodeNameObject, nodePortObject);
+	}
+
+	/* optionally build a bloom filter on our keys, or probe the other side's */
+	if (PG_NARGS() > 9)
+	{
+		uint32 bloomFilterSize = PG_GETARG_UINT32(9);
+		uint64 filterJobId = PG_GETARG_INT64(10);
+		ArrayType *filterTaskIdObject = PG_GETARG_ARRAYTYPE_P(11);
+		ArrayType *filterNodeNameObject = PG_GETARG_ARRAYTYPE_P(12);
+		ArrayType *filterNodePortObject = PG_GETARG_ARRAYTYPE_P(13);
+
+		if (bloomFilterSize > 0)
+		{
+			partitionContext->buildFilter = CreateBloomFilter(bloomFilterSize);
+		}
+
+		if (!ArrayObjectIsEmpty(filterTaskIdObject))
+		{
+			partitionContext->probeFilter = FetchBloomFilters(filterJobId,
+															  filterTaskIdObject,
+															  filterNodeNameObject,
+															  filterNodePortObject,
+															  taskAttemptDirectory);
+		}
+	}
+
+	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount,
+											connectionArray);
+	InitPartitionBufferLimit(PartitionBufferSize, fileCount);
 
 	/* call the partitioning function that does the actual work */
 	FilterAndPartitionTable(filterQuery, partitionColumn, partitionColumnType,
-							&HashPartitionId, (const void *) partitionContext,
+							&HashPartitionIds, (const void *) partitionContext,
 							partitionFileArray, fileCount);
 
 	/* close partition files and atomically rename (commit) them */
 	ClosePartitionFiles(partitionFileArray, fileCount);
+	if (partitionContext->buildFilter != NULL)
+	{
+		StringInfo filterFilename = BloomFilterFilename(taskAttemptDirectory);
+
+		WriteBloomFilter(partitionContext->buildFilter, filterFilename->data);
+	}
+
 	CitusRemoveDirectory(taskDirectory);
 	RenameDirectory(taskAttemptDirectory, taskDirectory);
 
@@ -311,6 +476,98 @@ ArrayObjectCount(ArrayType *arrayObject)
 }
 
 
+/*
+ * ArrayObjectIsEmpty returns whether the given array has no elements. Callers
+ * pass empty arrays for optional arguments that they do not use.
+ */
+static bool
+ArrayObjectIsEmpty(ArrayType *arrayObject)
+{
+	return ArrayGetNItems(ARR_NDIM(arrayObject), ARR_DIMS(arrayObject)) == 0;
+}
+
+
+/*
+ * FetchBloomFilters fetches the bloom filters of the given tasks from the nodes
+ * they ran on into the given directory, and returns the union of these filters.
+ * The arrays are indexed in parallel, and must all have the same length.
+ */
+static BloomFilter *
+FetchBloomFilters(uint64 filterJobId, ArrayType *filterTaskIdObject,
+				  ArrayType *nodeNameObject, ArrayType *nodePortObject,
+				  StringInfo directoryName)
+{
+	BloomFilter *unionFilter = NULL;
+	int32 filterCount = ArrayObjectCount(filterTaskIdObject);
+	Datum *filterTaskIdArray = NULL;
+	Datum *nodeNameArray = NULL;
+	Datum *nodePortArray = NULL;
+	int32 filterIndex = 0;
+
+	if (ArrayObjectCount(nodeNameObject) != filterCount ||
+		ArrayObjectCount(nodePortObject) != filterCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("bloom filter location arrays must have the same "
+							   "length")));
+	}
+
+	filterTaskIdArray = DeconstructArrayObject(filterTaskIdObject);
+	nodeNameArray = DeconstructArrayObject(nodeNameObject);
+	nodePortArray = DeconstructArrayObject(nodePortObject);
+
+	for (filterIndex = 0; filterIndex < filterCount; filterIndex++)
+	{
+		uint32 filterTaskId = DatumGetUInt32(filterTaskIdArray[filterIndex]);
+		char *nodeName = TextDatumGetCString(nodeNameArray[filterIndex]);
+		uint32 nodePort = DatumGetUInt32(nodePortArray[filterIndex]);
+		BloomFilter *filter = NULL;
+
+		/* remote filename is <filterJobId>/<filterTaskId>/bloom_filter */
+		StringInfo remoteDirectoryName = TaskDirectoryName(filterJobId, filterTaskId);
+		StringInfo remoteFilename = BloomFilterFilename(remoteDirectoryName);
+
+		/* local filename is <directoryName>/bloom_filter */
+		StringInfo localFilename = BloomFilterFilename(directoryName);
+
+		/* we've made sure the file names are sanitized, safe to fetch as superuser */
+		FetchRegularFileAsSuperUser(nodeName, nodePort, remoteFilename, localFilename);
+
+		filter = ReadBloomFilter(localFilename->data);
+		if (unlink(localFilename->data) != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not remove file \"%s\": %m",
+								   localFilename->data)));
+		}
+
+		if (unionFilter == NULL)
+		{
+			unionFilter = filter;
+		}
+		else
+		{
+			BloomFilterUnion(unionFilter, filter);
+			pfree(filter);
+		}
+	}
+
+	return unionFilter;
+}
+
+
+/* Constructs a standardized bloom filter file path for given directory. */
+static StringInfo
+BloomFilterFilename(StringInfo directoryName)
+{
+	StringInfo filterFilename = makeStringInfo();
+	appendStringInfo(filterFilename, "%s/%s", directoryName->data,
+					 BLOOM_FILTER_FILENAME);
+
+	return filterFilename;
+}
+
+
 /*
  * InitTaskDirectory creates a job and task directory using given identifiers,
  * if these directories do not already exist. The function then returns the task
@@ -329,6 +586,9 @@ InitTaskDirectory(uint64 jobId, uint32 taskId)
 	StringInfo jobDirectoryName = JobDirectoryName(jobId);
 	StringInfo taskDirectoryName = TaskDirectoryName(jobId, taskId);
 
+	/* do not start new tasks while the job cache is full */
+	CheckJobCacheQuota();
+
 	LockJobResource(jobId, AccessExclusiveLock);
 
 	jobDirectoryExists = DirectoryExists(jobDirectoryName);
@@ -378,14 +638,180 @@ InitTaskAttemptDirectory(uint64 jobId, uint32 taskId)
 }
 
 
-/* Calculates and returns the buffer size to use for each file. */
-static uint32
-FileBufferSize(int partitionBufferSizeInKB, uint32 fileCount)
+/*
+ * InitPartitionBufferLimit sets the total amount of memory that partition files
+ * may buffer. Files share this budget rather than splitting it evenly, so that
+ * partitions receiving many rows build up larger buffers and are written out in
+ * larger chunks; see FlushPartitionFilesIfFull().
+ */
+static void
+InitPartitionBufferLimit(int partitionBufferSizeInKB, uint32 fileCount)
 {
-	double partitionBufferSize = (double) partitionBufferSizeInKB * 1024.0;
-	uint32 fileBufferSize = (uint32) rint(partitionBufferSize / fileCount);
+	PartitionBufferLimit = (uint64) partitionBufferSizeInKB * 1024;
+	PartitionBufferRetainSize = PartitionBufferLimit / fileCount;
+	PartitionBufferedBytes = 0;
+}
+
+
+/*
+ * ReceivePushedPartitionFile handles COPY "<jobId>_<upstreamTaskId>_<partitionTaskId>"
+ * FROM STDIN WITH (format 'partition') commands, through which a map task on
+ * another node streams one of its partitions to us. The function stores the
+ * partition under the same name worker_fetch_partition_file() would have used,
+ * so that the merge task finds it without a separate fetch.
+ */
+void
+ReceivePushedPartitionFile(const char *partitionName)
+{
+	uint64 jobId = 0;
+	uint32 upstreamTaskId = 0;
+	uint32 partitionTaskId = 0;
+	StringInfo taskDirectoryName = NULL;
+	StringInfo taskFilename = NULL;
+	StringInfo attemptFilename = NULL;
+	uint32 randomId = (uint32) random();
+	int renamed = 0;
 
-	return fileBufferSize;
+	int scanned = sscanf(partitionName, UINT64_FORMAT "_%u_%u", &jobId,
+						 &upstreamTaskId, &partitionTaskId);
+	if (scanned != 3)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid partition name \"%s\"", partitionName)));
+	}
+
+	taskDirectoryName = TaskDirectoryName(jobId, upstreamTaskId);
+	if (!DirectoryExists(taskDirectoryName))
+	{
+		InitTaskDirectory(jobId, upstreamTaskId);
+	}
+
+	/* receive into an attempt file so that partial partitions are never seen */
+	taskFilename = TaskFilename(taskDirectoryName, partitionTaskId);
+
+	attemptFilename = makeStringInfo();
+	appendStringInfo(attemptFilename, "%s_%0*u%s", taskFilename->data,
+					 MIN_TASK_FILENAME_WIDTH, randomId, ATTEMPT_FILE_SUFFIX);
+
+	RedirectCopyDataToRegularFile(attemptFilename->data);
+
+	renamed = rename(attemptFilename->data, taskFilename->data);
+	if (renamed != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   attemptFilename->data, taskFilename->data)));
+	}
+}
+
+
+/*
+ * OpenPartitionConnections opens a connection for each partition that has a
+ * destination in the given arrays, and starts a COPY on it that streams the
+ * partition into the directory of its merge task on that node. The arrays are
+ * indexed by partition file id; an upstream task id of 0, or an index past the
+ * end of the arrays, means the partition is written to a local file instead.
+ * The function returns an array of connections indexed by partition file id.
+ */
+static MultiConnection **
+OpenPartitionConnections(uint64 jobId, uint32 taskId, uint32 fileCount,
+						 ArrayType *upstreamTaskIdObject, ArrayType *nodeNameObject,
+						 ArrayType *nodePortObject)
+{
+	MultiConnection **connectionArray = NULL;
+	Datum *upstreamTaskIdArray = NULL;
+	Datum *nodeNameArray = NULL;
+	Datum *nodePortArray = NULL;
+	int32 destinationCount = ArrayObjectCount(upstreamTaskIdObject);
+	char *nodeUser = CitusExtensionOwnerName();
+	int32 fileIndex = 0;
+
+	if ((uint32) destinationCount > fileCount ||
+		ArrayObjectCount(nodeNameObject) != destinationCount ||
+		ArrayObjectCount(nodePortObject) != destinationCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("partition destination arrays must have the same "
+							   "length of at most %u", fileCount)));
+	}
+
+	connectionArray = palloc0(fileCount * sizeof(MultiConnection *));
+	if (destinationCount == 0)
+	{
+		return connectionArray;
+	}
+
+	upstreamTaskIdArray = DeconstructArrayObject(upstreamTaskIdObject);
+	nodeNameArray = DeconstructArrayObject(nodeNameObject);
+	nodePortArray = DeconstructArrayObject(nodePortObject);
+
+	/* start all connections first, so that they are established in parallel */
+	for (fileIndex = 0; fileIndex < destinationCount; fileIndex++)
+	{
+		uint32 upstreamTaskId = DatumGetUInt32(upstreamTaskIdArray[fileIndex]);
+		char *nodeName = NULL;
+		int32 nodePort = 0;
+
+		if (upstreamTaskId == 0)
+		{
+			continue;
+		}
+
+		/* each partition has its own COPY, so we cannot share connections */
+		nodeName = TextDatumGetCString(nodeNameArray[fileIndex]);
+		nodePort = DatumGetInt32(nodePortArray[fileIndex]);
+
+		connectionArray[fileIndex] =
+			StartNodeUserDatabaseConnection(FORCE_NEW_CONNECTION, nodeName, nodePort,
+											nodeUser, NULL);
+	}
+
+	for (fileIndex = 0; fileIndex < destinationCount; fileIndex++)
+	{
+		MultiConnection *connection = connectionArray[fileIndex];
+		uint32 upstreamTaskId = DatumGetUInt32(upstreamTaskIdArray[fileIndex]);
+		StringInfo copyCommand = NULL;
+		bool querySent = false;
+
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		FinishConnectionEstablishment(connection);
+
+		copyCommand = makeStringInfo();
+		appendStringInfo(copyCommand, PUSH_PARTITION_COMMAND, jobId, upstreamTaskId,
+						 taskId);
+
+		querySent = SendRemoteCommand(connection, copyCommand->data);
+		if (!querySent)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	for (fileIndex = 0; fileIndex < destinationCount; fileIndex++)
+	{
+		MultiConnection *connection = connectionArray[fileIndex];
+		PGresult *result = NULL;
+		bool raiseInterrupts = true;
+
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (PQresultStatus(result) != PGRES_COPY_IN)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+	}
+
+	return connectionArray;
 }
 
 
@@ -395,9 +821,13 @@ FileBufferSize(int partitionBufferSizeInKB, uint32 fileCount)
  * after Hadoop's naming conventions for map files. These file names, virtual
  * file descriptors, and file buffers are stored together in file output stream
  * objects. These objects are then returned in an array from this function.
+ *
+ * If connectionArray is not NULL, partitions that have a connection are sent
+ * over it rather than written to a local file.
  */
 static FileOutputStream *
-OpenPartitionFiles(StringInfo directoryName, uint32 fileCount)
+OpenPartitionFiles(StringInfo directoryName, uint32 fileCount,
+				   MultiConnection **connectionArray)
 {
 	FileOutputStream *partitionFileArray = NULL;
 	File fileDescriptor = 0;
@@ -411,6 +841,15 @@ OpenPartitionFiles(StringInfo directoryName, uint32 fileCount)
 	{
 		StringInfo filePath = PartitionFilename(directoryName, fileIndex);
 
+		if (connectionArray != NULL && connectionArray[fileIndex] != NULL)
+		{
+			partitionFileArray[fileIndex].fileDescriptor = -1;
+			partitionFileArray[fileIndex].fileBuffer = makeStringInfo();
+			partitionFileArray[fileIndex].filePath = filePath;
+			partitionFileArray[fileIndex].connection = connectionArray[fileIndex];
+			continue;
+		}
+
 		fileDescriptor = PathNameOpenFilePerm(filePath->data, fileFlags, fileMode);
 		if (fileDescriptor < 0)
 		{
@@ -430,21 +869,72 @@ OpenPartitionFiles(StringInfo directoryName, uint32 fileCount)
 /*
  * ClosePartitionFiles walks over each file output stream object, and flushes
  * any remaining data in the file's buffer. The function then closes the file,
- * and deletes any allocated memory for the file stream object.
+ * and deletes any allocated memory for the file stream object. For streamed
+ * partitions, it ends the COPY and waits for the remote node to store the
+ * partition before closing the connection.
  */
 static void
 ClosePartitionFiles(FileOutputStream *partitionFileArray, uint32 fileCount)
 {
 	uint32 fileIndex = 0;
+	uint64 totalBytesWritten = 0;
+	uint64 totalFlushCount = 0;
+
 	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
 	{
-		FileOutputStream partitionFile = partitionFileArray[fileIndex];
+		FileOutputStream *partitionFile = &partitionFileArray[fileIndex];
+		MultiConnection *connection = partitionFile->connection;
 
 		FileOutputStreamFlush(partitionFile);
 
-		FileClose(partitionFile.fileDescriptor);
-		FreeStringInfo(partitionFile.fileBuffer);
-		FreeStringInfo(partitionFile.filePath);
+		ereport(DEBUG3, (errmsg("wrote " UINT64_FORMAT " bytes in %u flushes to "
+								"partition %u", partitionFile->bytesWritten,
+								partitionFile->flushCount, fileIndex)));
+
+		totalBytesWritten += partitionFile->bytesWritten;
+		totalFlushCount += partitionFile->flushCount;
+
+		if (connection != NULL)
+		{
+			if (!PutRemoteCopyEnd(connection, NULL))
+			{
+				ReportConnectionError(connection, ERROR);
+			}
+		}
+		else
+		{
+			FileClose(partitionFile->fileDescriptor);
+		}
+
+		FreeStringInfo(partitionFile->fileBuffer);
+		FreeStringInfo(partitionFile->filePath);
+	}
+
+	ereport(DEBUG2, (errmsg("wrote " UINT64_FORMAT " bytes in " UINT64_FORMAT
+							" flushes to %u partitions", totalBytesWritten,
+							totalFlushCount, fileCount)));
+
+	/* wait for remote nodes to finish storing the streamed partitions */
+	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
+	{
+		MultiConnection *connection = partitionFileArray[fileIndex].connection;
+		PGresult *result = NULL;
+		bool raiseInterrupts = true;
+
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (PQresultStatus(result) != PGRES_COMMAND_OK)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+		CloseConnection(connection);
 	}
 
 	pfree(partitionFileArray);
@@ -736,193 +1226,458 @@ RenameDirectory(StringInfo oldDirectoryName, StringInfo newDirectoryName)
 
 /*
  * FileOutputStreamWrite appends given data to file stream's internal buffers.
- * The function then checks if buffered data exceeds preconfigured buffer size;
- * if so, the function flushes the buffer to the underlying file.
+ * Callers then use FlushPartitionFilesIfFull() to keep the total amount of
+ * buffered data within the preconfigured limit.
  */
 static void
-FileOutputStreamWrite(FileOutputStream file, StringInfo dataToWrite)
+FileOutputStreamWrite(FileOutputStream *file, StringInfo dataToWrite)
 {
-	StringInfo fileBuffer = file.fileBuffer;
-	uint32 newBufferSize = fileBuffer->len + dataToWrite->len;
+	StringInfo fileBuffer = file->fileBuffer;
 
 	appendBinaryStringInfo(fileBuffer, dataToWrite->data, dataToWrite->len);
 
-	if (newBufferSize > FileBufferSizeInBytes)
+	PartitionBufferedBytes += dataToWrite->len;
+}
+
+
+/*
+ * FlushPartitionFilesIfFull checks if the data buffered across all partition
+ * files exceeds the preconfigured buffer size. If so, the function flushes the
+ * largest buffers until we are within the limit again. Flushing the largest
+ * buffer first frees the most memory per write and keeps writes large, while
+ * buffers of partitions that receive few rows stay in memory.
+ */
+static void
+FlushPartitionFilesIfFull(FileOutputStream *partitionFileArray, uint32 fileCount)
+{
+	while (PartitionBufferedBytes > PartitionBufferLimit)
 	{
-		FileOutputStreamFlush(file);
+		uint32 largestFileIndex = 0;
+		uint32 fileIndex = 0;
 
-		resetStringInfo(fileBuffer);
+		for (fileIndex = 1; fileIndex < fileCount; fileIndex++)
+		{
+			if (partitionFileArray[fileIndex].fileBuffer->len >
+				partitionFileArray[largestFileIndex].fileBuffer->len)
+			{
+				largestFileIndex = fileIndex;
+			}
+		}
+
+		if (partitionFileArray[largestFileIndex].fileBuffer->len == 0)
+		{
+			break;
+		}
+
+		FileOutputStreamFlush(&partitionFileArray[largestFileIndex]);
 	}
 }
 
 
-/* Flushes data buffered in the file stream object to the underlying file. */
+/*
+ * Flushes data buffered in the file stream object to the underlying file, or
+ * to the remote node if the partition is streamed. The function then empties
+ * the buffer, and releases its memory if it grew beyond its share of the total
+ * buffer size.
+ *
+ * When citus.partition_file_compression is set, the buffer is written as a
+ * compressed block in the format of compressed intermediate results. Such
+ * files start with a magic header, from which the merge stage recognizes
+ * that it needs to decompress them.
+ */
 static void
-FileOutputStreamFlush(FileOutputStream file)
+FileOutputStreamFlush(FileOutputStream *file)
 {
-	StringInfo fileBuffer = file.fileBuffer;
+	StringInfo fileBuffer = file->fileBuffer;
+	StringInfo compressedBuffer = NULL;
+	char *data = fileBuffer->data;
+	int dataLength = fileBuffer->len;
 	int written = 0;
 
-	errno = 0;
+	if (fileBuffer->len == 0)
+	{
+		return;
+	}
+
+	if (file->bytesWritten == 0)
+	{
+		/* the format of a partition file is decided by its first flush */
+		file->compressed =
+			(PartitionFileCompression != INTERMEDIATE_RESULT_COMPRESSION_NONE);
+	}
+
+	if (file->compressed)
+	{
+		compressedBuffer = makeStringInfo();
+
+		if (file->bytesWritten == 0)
+		{
+			AppendCompressedResultMagic(compressedBuffer);
+		}
+
+		AppendCompressedBlock(compressedBuffer, fileBuffer->data, fileBuffer->len);
+
+		data = compressedBuffer->data;
+		dataLength = compressedBuffer->len;
+	}
+
+	if (file->connection != NULL)
+	{
+		if (!PutRemoteCopyData(file->connection, data, dataLength))
+		{
+			ReportConnectionError(file->connection, ERROR);
+		}
+	}
+	else
+	{
+		ReserveJobCacheSpace(dataLength);
+
+		errno = 0;
 #if (PG_VERSION_NUM >= 100000)
-	written = FileWrite(file.fileDescriptor, fileBuffer->data, fileBuffer->len,
-						PG_WAIT_IO);
+		written = FileWrite(file->fileDescriptor, data, dataLength, PG_WAIT_IO);
 #else
-	written = FileWrite(file.fileDescriptor, fileBuffer->data, fileBuffer->len);
+		written = FileWrite(file->fileDescriptor, data, dataLength);
 #endif
-	if (written != fileBuffer->len)
+		if (written != dataLength)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not write %d bytes to partition file \"%s\"",
+								   dataLength, file->filePath->data)));
+		}
+	}
+
+	if (compressedBuffer != NULL)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not write %d bytes to partition file \"%s\"",
-							   fileBuffer->len, file.filePath->data)));
+		pfree(compressedBuffer->data);
+		pfree(compressedBuffer);
+	}
+
+	file->bytesWritten += fileBuffer->len;
+	file->flushCount++;
+	PartitionBufferedBytes -= fileBuffer->len;
+
+	if (fileBuffer->maxlen > PartitionBufferRetainSize)
+	{
+		pfree(fileBuffer->data);
+		initStringInfo(fileBuffer);
+	}
+	else
+	{
+		resetStringInfo(fileBuffer);
 	}
 }
 
 
 /*
- * FilterAndPartitionTable executes a given SQL query, and iterates over query
- * results in a read-only fashion. For each resulting row, the function applies
- * the partitioning function and determines the partition identifier. Then, the
- * function chooses the partition file corresponding to this identifier, and
- * serializes the row into this file using the copy command's text format.
+ * FilterAndPartitionTable executes a given SQL query, and partitions the query
+ * results into the given partition files. The query runs to completion into a
+ * PartitionDestReceiver, which lets the planner choose a parallel plan; in that
+ * case parallel workers scan and filter the table, and this backend partitions
+ * the rows it gathers from them.
  */
 static void
 FilterAndPartitionTable(const char *filterQuery,
 						const char *partitionColumnName, Oid partitionColumnType,
-						uint32 (*PartitionIdFunction)(Datum, const void *),
+						void (*PartitionIdFunction)(Datum *, bool *, uint32,
+													uint32 *, const void *),
 						const void *partitionIdContext,
 						FileOutputStream *partitionFileArray,
 						uint32 fileCount)
 {
-	CopyOutState rowOutputState = NULL;
-	FmgrInfo *columnOutputFunctions = NULL;
+	CopyOutState rowOutputState = InitRowOutputState();
+	DestReceiver *partitionDest = NULL;
+	ParamListInfo noParams = NULL;
+	ErrorContextCallback errorCallback;
+
+	partitionDest = CreatePartitionDestReceiver(partitionColumnName,
+												partitionColumnType,
+												PartitionIdFunction,
+												partitionIdContext,
+												partitionFileArray, fileCount,
+												rowOutputState);
+
+	/* report positions of syntax errors relative to the filter query */
+	errorCallback.callback = FilterQueryErrorCallback;
+	errorCallback.arg = (void *) filterQuery;
+	errorCallback.previous = error_context_stack;
+	error_context_stack = &errorCallback;
+
+	ExecuteQueryStringIntoDestReceiver(filterQuery, noParams, partitionDest);
+
+	error_context_stack = errorCallback.previous;
+
+	partitionDest->rDestroy(partitionDest);
+
+	/* delete row output memory context */
+	ClearRowOutputState(rowOutputState);
+}
+
+
+/*
+ * FilterQueryErrorCallback makes errors that point to a position in the filter
+ * query show the filter query rather than the outer query, similar to errors
+ * in queries executed through SPI.
+ */
+static void
+FilterQueryErrorCallback(void *arg)
+{
+	const char *filterQuery = (const char *) arg;
+	int syntaxErrorPosition = geterrposition();
+
+	if (syntaxErrorPosition > 0)
+	{
+		errposition(0);
+		internalerrposition(syntaxErrorPosition);
+		internalerrquery(filterQuery);
+	}
+}
+
+
+/*
+ * CreatePartitionDestReceiver creates a DestReceiver that writes the tuples it
+ * receives into the given partition files, using the given partition function
+ * to determine the partition of each tuple.
+ */
+static DestReceiver *
+CreatePartitionDestReceiver(const char *partitionColumnName, Oid partitionColumnType,
+							PartitionIdFunc partitionIdFunction,
+							const void *partitionIdContext,
+							FileOutputStream *partitionFileArray, uint32 fileCount,
+							CopyOutState rowOutputState)
+{
+	PartitionDestReceiver *partitionDest = NULL;
+
+	partitionDest = (PartitionDestReceiver *) palloc0(sizeof(PartitionDestReceiver));
+
+	/* set up the DestReceiver function pointers */
+	partitionDest->pub.receiveSlot = PartitionDestReceiverReceive;
+	partitionDest->pub.rStartup = PartitionDestReceiverStartup;
+	partitionDest->pub.rShutdown = PartitionDestReceiverShutdown;
+	partitionDest->pub.rDestroy = PartitionDestReceiverDestroy;
+	partitionDest->pub.mydest = DestCopyOut;
+
+	/* set up output parameters */
+	partitionDest->partitionColumnName = partitionColumnName;
+	partitionDest->partitionColumnType = partitionColumnType;
+	partitionDest->partitionIdFunction = partitionIdFunction;
+	partitionDest->partitionIdContext = partitionIdContext;
+	partitionDest->partitionFileArray = partitionFileArray;
+	partitionDest->fileCount = fileCount;
+	partitionDest->rowOutputState = rowOutputState;
+
+	partitionDest->batchContext = AllocSetContextCreate(CurrentMemoryContext,
+														"Partition Batch Context",
+														ALLOCSET_DEFAULT_MINSIZE,
+														ALLOCSET_DEFAULT_INITSIZE,
+														ALLOCSET_DEFAULT_MAXSIZE);
+
+	return (DestReceiver *) partitionDest;
+}
+
+
+/*
+ * PartitionDestReceiverStartup implements the rStartup interface of
+ * PartitionDestReceiver. It looks up the partition column and the output
+ * functions for the rows, and writes the binary headers if applicable.
+ */
+static void
+PartitionDestReceiverStartup(DestReceiver *dest, int operation,
+							 TupleDesc inputTupleDescriptor)
+{
+	PartitionDestReceiver *partitionDest = (PartitionDestReceiver *) dest;
+	CopyOutState rowOutputState = partitionDest->rowOutputState;
+	uint32 columnCount = (uint32) inputTupleDescriptor->natts;
 	int partitionColumnIndex = 0;
 	Oid partitionColumnTypeId = InvalidOid;
-	Portal queryPortal = NULL;
-	int connected = 0;
-	int finished = 0;
-	uint32 columnCount = 0;
-	Datum *valueArray = NULL;
-	bool *isNullArray = NULL;
-
-	const char *noPortalName = NULL;
-	const bool readOnly = true;
-	const bool fetchForward = true;
-	const int noCursorOptions = 0;
-	const int prefetchCount = ROW_PREFETCH_COUNT;
-
-	connected = SPI_connect();
-	if (connected != SPI_OK_CONNECT)
+
+	partitionColumnIndex = ColumnIndex(inputTupleDescriptor,
+									   partitionDest->partitionColumnName);
+
+	partitionColumnTypeId = SPI_gettypeid(inputTupleDescriptor, partitionColumnIndex);
+	if (partitionDest->partitionColumnType != partitionColumnTypeId)
 	{
-		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+		ereport(ERROR, (errmsg("partition column types %u and %u do not match",
+							   partitionColumnTypeId,
+							   partitionDest->partitionColumnType)));
 	}
 
-	queryPortal = SPI_cursor_open_with_args(noPortalName, filterQuery,
-											0, NULL, NULL, NULL, /* no arguments */
-											readOnly, noCursorOptions);
-	if (queryPortal == NULL)
+	partitionDest->tupleDescriptor = inputTupleDescriptor;
+	partitionDest->partitionColumnIndex = partitionColumnIndex;
+	partitionDest->columnOutputFunctions =
+		ColumnOutputFunctions(inputTupleDescriptor, rowOutputState->binary);
+
+	partitionDest->rowArray = (HeapTuple *) palloc0(PARTITION_BATCH_SIZE *
+													sizeof(HeapTuple));
+	partitionDest->valueArray = (Datum *) palloc0(columnCount * sizeof(Datum));
+	partitionDest->isNullArray = (bool *) palloc0(columnCount * sizeof(bool));
+	partitionDest->partitionKeyArray = (Datum *) palloc0(PARTITION_BATCH_SIZE *
+														 sizeof(Datum));
+	partitionDest->partitionKeyNullArray = (bool *) palloc0(PARTITION_BATCH_SIZE *
+															sizeof(bool));
+	partitionDest->partitionIdArray = (uint32 *) palloc0(PARTITION_BATCH_SIZE *
+														 sizeof(uint32));
+
+	if (BinaryWorkerCopyFormat)
 	{
-		ereport(ERROR, (errmsg("could not open implicit cursor for query \"%s\"",
-							   filterQuery)));
+		OutputBinaryHeaders(partitionDest->partitionFileArray,
+							partitionDest->fileCount);
 	}
+}
 
-	rowOutputState = InitRowOutputState();
 
-	SPI_cursor_fetch(queryPortal, fetchForward, prefetchCount);
-	if (SPI_processed > 0)
-	{
-		TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
-		partitionColumnIndex = ColumnIndex(rowDescriptor, partitionColumnName);
+/*
+ * PartitionDestReceiverReceive implements the receiveSlot function of
+ * PartitionDestReceiver. It copies the tuple into the current batch, and
+ * partitions the batch once it is full.
+ */
+static bool
+PartitionDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
+{
+	PartitionDestReceiver *partitionDest = (PartitionDestReceiver *) dest;
+	MemoryContext oldContext = MemoryContextSwitchTo(partitionDest->batchContext);
 
-		partitionColumnTypeId = SPI_gettypeid(rowDescriptor, partitionColumnIndex);
-		if (partitionColumnType != partitionColumnTypeId)
-		{
-			ereport(ERROR, (errmsg("partition column types %u and %u do not match",
-								   partitionColumnTypeId, partitionColumnType)));
-		}
+	partitionDest->rowArray[partitionDest->rowCount] = ExecCopySlotTuple(slot);
+	partitionDest->rowCount++;
+
+	MemoryContextSwitchTo(oldContext);
 
-		columnOutputFunctions = ColumnOutputFunctions(rowDescriptor,
-													  rowOutputState->binary);
+	if (partitionDest->rowCount == PARTITION_BATCH_SIZE)
+	{
+		PartitionRowBatch(partitionDest);
 	}
 
-	if (BinaryWorkerCopyFormat)
+	return true;
+}
+
+
+/*
+ * PartitionRowBatch applies the partitioning function to the partition keys of
+ * all rows in the current batch at once to determine their partition
+ * identifiers. Then, the function serializes each row directly into the buffer
+ * of the partition file corresponding to its identifier, using the copy
+ * command's text or binary format.
+ */
+static void
+PartitionRowBatch(PartitionDestReceiver *partitionDest)
+{
+	TupleDesc rowDescriptor = partitionDest->tupleDescriptor;
+	CopyOutState rowOutputState = partitionDest->rowOutputState;
+	FileOutputStream *partitionFileArray = partitionDest->partitionFileArray;
+	uint32 fileCount = partitionDest->fileCount;
+	HeapTuple *rowArray = partitionDest->rowArray;
+	uint32 rowCount = partitionDest->rowCount;
+	uint32 *partitionIdArray = partitionDest->partitionIdArray;
+	uint32 rowIndex = 0;
+
+	/* rows are serialized straight into partition buffers, remember our own */
+	StringInfo rowOutputBuffer = rowOutputState->fe_msgbuf;
+
+	/* first compute the partition identifiers for the whole batch */
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
 	{
-		OutputBinaryHeaders(partitionFileArray, fileCount);
+		HeapTuple row = rowArray[rowIndex];
+
+		partitionDest->partitionKeyArray[rowIndex] =
+			heap_getattr(row, partitionDest->partitionColumnIndex, rowDescriptor,
+						 &partitionDest->partitionKeyNullArray[rowIndex]);
 	}
 
-	columnCount = (uint32) SPI_tuptable->tupdesc->natts;
-	valueArray = (Datum *) palloc0(columnCount * sizeof(Datum));
-	isNullArray = (bool *) palloc0(columnCount * sizeof(bool));
+	(*partitionDest->partitionIdFunction)(partitionDest->partitionKeyArray,
+										  partitionDest->partitionKeyNullArray,
+										  rowCount, partitionIdArray,
+										  partitionDest->partitionIdContext);
 
-	while (SPI_processed > 0)
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
 	{
-		int rowIndex = 0;
-		for (rowIndex = 0; rowIndex < SPI_processed; rowIndex++)
+		HeapTuple row = rowArray[rowIndex];
+		uint32 partitionId = partitionIdArray[rowIndex];
+		FileOutputStream *partitionFile = NULL;
+		StringInfo fileBuffer = NULL;
+		int bufferedLength = 0;
+
+		/* the row's key has no match on the other side of the join */
+		if (partitionId == PRUNED_PARTITION_ID)
 		{
-			HeapTuple row = SPI_tuptable->vals[rowIndex];
-			TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
-			FileOutputStream partitionFile = { 0, 0, 0 };
-			StringInfo rowText = NULL;
-			Datum partitionKey = 0;
-			bool partitionKeyNull = false;
-			uint32 partitionId = 0;
-
-			partitionKey = SPI_getbinval(row, rowDescriptor,
-										 partitionColumnIndex, &partitionKeyNull);
-
-			/*
-			 * If we have a partition key, we compute its bucket. Else if we have
-			 * a null key, we then put this tuple into the 0th bucket. Note that
-			 * the 0th bucket may hold other tuples as well, such as tuples whose
-			 * partition keys hash to the value 0.
-			 */
-			if (!partitionKeyNull)
-			{
-				partitionId = (*PartitionIdFunction)(partitionKey, partitionIdContext);
-			}
-			else
-			{
-				partitionId = 0;
-			}
-
-			/* deconstruct the tuple; this is faster than repeated heap_getattr */
-			heap_deform_tuple(row, rowDescriptor, valueArray, isNullArray);
+			continue;
+		}
 
-			AppendCopyRowData(valueArray, isNullArray, rowDescriptor,
-							  rowOutputState, columnOutputFunctions, NULL);
+		partitionFile = &partitionFileArray[partitionId];
+		fileBuffer = partitionFile->fileBuffer;
+		bufferedLength = fileBuffer->len;
 
-			rowText = rowOutputState->fe_msgbuf;
+		/* deconstruct the tuple; this is faster than repeated heap_getattr */
+		heap_deform_tuple(row, rowDescriptor, partitionDest->valueArray,
+						  partitionDest->isNullArray);
 
-			partitionFile = partitionFileArray[partitionId];
-			FileOutputStreamWrite(partitionFile, rowText);
+		rowOutputState->fe_msgbuf = fileBuffer;
 
-			resetStringInfo(rowText);
-			MemoryContextReset(rowOutputState->rowcontext);
-		}
+		AppendCopyRowData(partitionDest->valueArray, partitionDest->isNullArray,
+						  rowDescriptor, rowOutputState,
+						  partitionDest->columnOutputFunctions, NULL);
 
-		SPI_freetuptable(SPI_tuptable);
+		PartitionBufferedBytes += fileBuffer->len - bufferedLength;
+		FlushPartitionFilesIfFull(partitionFileArray, fileCount);
 
-		SPI_cursor_fetch(queryPortal, fetchForward, prefetchCount);
+		MemoryContextReset(rowOutputState->rowcontext);
 	}
 
-	pfree(valueArray);
-	pfree(isNullArray);
+	rowOutputState->fe_msgbuf = rowOutputBuffer;
+
+	MemoryContextReset(partitionDest->batchContext);
+	partitionDest->rowCount = 0;
+}
 
-	SPI_cursor_close(queryPortal);
+
+/*
+ * PartitionDestReceiverShutdown implements the rShutdown interface of
+ * PartitionDestReceiver. It partitions the remaining rows, and writes the
+ * binary footers if applicable.
+ */
+static void
+PartitionDestReceiverShutdown(DestReceiver *dest)
+{
+	PartitionDestReceiver *partitionDest = (PartitionDestReceiver *) dest;
+
+	if (partitionDest->rowCount > 0)
+	{
+		PartitionRowBatch(partitionDest);
+	}
 
 	if (BinaryWorkerCopyFormat)
 	{
-		OutputBinaryFooters(partitionFileArray, fileCount);
+		OutputBinaryFooters(partitionDest->partitionFileArray,
+							partitionDest->fileCount);
 	}
+}
 
-	/* delete row output memory context */
-	ClearRowOutputState(rowOutputState);
 
-	finished = SPI_finish();
-	if (finished != SPI_OK_FINISH)
+/*
+ * PartitionDestReceiverDestroy frees memory allocated as part of the
+ * PartitionDestReceiver.
+ */
+static void
+PartitionDestReceiverDestroy(DestReceiver *dest)
+{
+	PartitionDestReceiver *partitionDest = (PartitionDestReceiver *) dest;
+
+	if (partitionDest->rowArray != NULL)
+	{
+		pfree(partitionDest->rowArray);
+		pfree(partitionDest->valueArray);
+		pfree(partitionDest->isNullArray);
+		pfree(partitionDest->partitionKeyArray);
+		pfree(partitionDest->partitionKeyNullArray);
+		pfree(partitionDest->partitionIdArray);
+	}
+
+	if (partitionDest->columnOutputFunctions != NULL)
 	{
-		ereport(ERROR, (errmsg("could not disconnect from SPI manager")));
+		pfree(partitionDest->columnOutputFunctions);
 	}
+
+	MemoryContextDelete(partitionDest->batchContext);
+
+	pfree(partitionDest);
 }
 
 
@@ -1041,7 +1796,7 @@ OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount)
 	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
 	{
 		/* Generate header for a binary copy */
-		FileOutputStream partitionFile = { 0, 0, 0 };
+		FileOutputStream *partitionFile = NULL;
 		CopyOutStateData headerOutputStateData;
 		CopyOutState headerOutputState = (CopyOutState) & headerOutputStateData;
 
@@ -1050,9 +1805,11 @@ OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount)
 
 		AppendCopyBinaryHeaders(headerOutputState);
 
-		partitionFile = partitionFileArray[fileIndex];
+		partitionFile = &partitionFileArray[fileIndex];
 		FileOutputStreamWrite(partitionFile, headerOutputState->fe_msgbuf);
 	}
+
+	FlushPartitionFilesIfFull(partitionFileArray, fileCount);
 }
 
 
@@ -1067,7 +1824,7 @@ OutputBinaryFooters(FileOutputStream *partitionFileArray, uint32 fileCount)
 	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
 	{
 		/* Generate footer for a binary copy */
-		FileOutputStream partitionFile = { 0, 0, 0 };
+		FileOutputStream *partitionFile = NULL;
 		CopyOutStateData footerOutputStateData;
 		CopyOutState footerOutputState = (CopyOutState) & footerOutputStateData;
 
@@ -1076,9 +1833,11 @@ OutputBinaryFooters(FileOutputStream *partitionFileArray, uint32 fileCount)
 
 		AppendCopyBinaryFooters(footerOutputState);
 
-		partitionFile = partitionFileArray[fileIndex];
+		partitionFile = &partitionFileArray[fileIndex];
 		FileOutputStreamWrite(partitionFile, footerOutputState->fe_msgbuf);
 	}
+
+	FlushPartitionFilesIfFull(partitionFileArray, fileCount);
 }
 
 
@@ -1092,6 +1851,40 @@ CompareCall2(FmgrInfo *functionInfo, Datum leftArgument, Datum rightArgument)
 }
 
 
+/*
+ * RangePartitionIds determines the partition numbers for a batch of values
+ * using range partitioning. Null values fall into the zeroth bucket. The
+ * function sets up the comparison function call once for the whole batch, and
+ * then finds each value's bucket through RangePartitionId().
+ */
+static void
+RangePartitionIds(Datum *partitionValues, bool *partitionNulls, uint32 valueCount,
+				  uint32 *partitionIds, const void *context)
+{
+	RangePartitionContext *rangePartitionContext = (RangePartitionContext *) context;
+	FunctionCallInfoData compareCallInfo;
+	uint32 valueIndex = 0;
+
+	InitFunctionCallInfoData(compareCallInfo, rangePartitionContext->comparisonFunction,
+							 2, DEFAULT_COLLATION_OID, NULL, NULL);
+	compareCallInfo.argnull[0] = false;
+	compareCallInfo.argnull[1] = false;
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (partitionNulls[valueIndex])
+		{
+			partitionIds[valueIndex] = 0;
+			continue;
+		}
+
+		partitionIds[valueIndex] = RangePartitionId(partitionValues[valueIndex],
+													rangePartitionContext,
+													&compareCallInfo);
+	}
+}
+
+
 /*
  * RangePartitionId determines the partition number for the given data value
  * by applying range partitioning. More specifically, the function takes in a
@@ -1104,10 +1897,9 @@ CompareCall2(FmgrInfo *functionInfo, Datum leftArgument, Datum rightArgument)
  * full compatibility with the semantics of Hadoop's TotalOrderPartitioner.
  */
 static uint32
-RangePartitionId(Datum partitionValue, const void *context)
+RangePartitionId(Datum partitionValue, RangePartitionContext *rangePartitionContext,
+				 FunctionCallInfo compareCallInfo)
 {
-	RangePartitionContext *rangePartitionContext = (RangePartitionContext *) context;
-	FmgrInfo *comparisonFunction = rangePartitionContext->comparisonFunction;
 	Datum *pointArray = rangePartitionContext->splitPointArray;
 	int32 currentLength = rangePartitionContext->splitPointCount;
 	int32 halfLength = 0;
@@ -1133,7 +1925,18 @@ RangePartitionId(Datum partitionValue, const void *context)
 
 		middlePoint = pointArray[middleIndex];
 
-		comparisonDatum = CompareCall2(comparisonFunction, partitionValue, middlePoint);
+		/* reuse the prepared call to avoid per-comparison setup */
+		compareCallInfo->arg[0] = partitionValue;
+		compareCallInfo->arg[1] = middlePoint;
+		compareCallInfo->isnull = false;
+
+		comparisonDatum = FunctionCallInvoke(compareCallInfo);
+		if (compareCallInfo->isnull)
+		{
+			ereport(ERROR, (errmsg("function %u returned NULL",
+								   compareCallInfo->flinfo->fn_oid)));
+		}
+
 		comparisonResult = DatumGetInt32(comparisonDatum);
 
 		/* if partition value is less than middle point */
@@ -1154,31 +1957,69 @@ RangePartitionId(Datum partitionValue, const void *context)
 
 
 /*
- * HashPartitionId determines the partition number for the given data value
- * using hash partitioning. More specifically, the function returns zero if the
- * given data value is null. If not, the function applies the standard Postgres
+ * HashPartitionIds determines the partition numbers for a batch of data values
+ * using hash partitioning. More specifically, the partition number is zero if
+ * the data value is null. If not, the function applies the standard Postgres
  * hashing function for the given data type, and mods the hashed result with the
- * number of partitions. The function then returns the modded number as the
- * partition number.
+ * number of partitions. The modded number is then the partition number. The
+ * hash function call is set up once for the whole batch.
+ *
+ * The hashed results are also what we add to and look up in the context's
+ * bloom filters. Rows that miss the probe filter get PRUNED_PARTITION_ID.
  *
  * Note that any changes to PostgreSQL's hashing functions will reshuffle the
  * entire distribution created by this function. For a discussion of this issue,
  * see Google "PL/Proxy Users: Hash Functions Have Changed in PostgreSQL 8.4."
  */
-static uint32
-HashPartitionId(Datum partitionValue, const void *context)
+static void
+HashPartitionIds(Datum *partitionValues, bool *partitionNulls, uint32 valueCount,
+				 uint32 *partitionIds, const void *context)
 {
 	HashPartitionContext *hashPartitionContext = (HashPartitionContext *) context;
 	FmgrInfo *hashFunction = hashPartitionContext->hashFunction;
 	uint32 partitionCount = hashPartitionContext->partitionCount;
-	Datum hashDatum = 0;
-	uint32 hashResult = 0;
-	uint32 hashPartitionId = 0;
+	BloomFilter *buildFilter = hashPartitionContext->buildFilter;
+	BloomFilter *probeFilter = hashPartitionContext->probeFilter;
+	FunctionCallInfoData hashCallInfo;
+	uint32 valueIndex = 0;
+
+	InitFunctionCallInfoData(hashCallInfo, hashFunction, 1, InvalidOid, NULL, NULL);
+	hashCallInfo.argnull[0] = false;
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		Datum hashDatum = 0;
+		uint32 hashResult = 0;
+
+		/* null keys never satisfy the equi-join we probe the filter for */
+		if (partitionNulls[valueIndex])
+		{
+			partitionIds[valueIndex] = (probeFilter != NULL) ? PRUNED_PARTITION_ID : 0;
+			continue;
+		}
 
-	/* hash functions return unsigned 32-bit integers */
-	hashDatum = FunctionCall1(hashFunction, partitionValue);
-	hashResult = DatumGetUInt32(hashDatum);
-	hashPartitionId = (hashResult % partitionCount);
+		hashCallInfo.arg[0] = partitionValues[valueIndex];
+		hashCallInfo.isnull = false;
 
-	return hashPartitionId;
+		hashDatum = FunctionCallInvoke(&hashCallInfo);
+		if (hashCallInfo.isnull)
+		{
+			ereport(ERROR, (errmsg("function %u returned NULL",
+								   hashFunction->fn_oid)));
+		}
+
+		/* hash functions return unsigned 32-bit integers */
+		hashResult = DatumGetUInt32(hashDatum);
+		partitionIds[valueIndex] = (hashResult % partitionCount);
+
+		if (buildFilter != NULL)
+		{
+			BloomFilterAdd(buildFilter, hashResult);
+		}
+
+		if (probeFilter != NULL && !BloomFilterMightContain(probeFilter, hashResult))
+		{
+			partitionIds[valueIndex] = PRUNED_PARTITION_ID;
+		}
+	}
 }
@@ -0,0 +1,50 @@
+/*-------------------------------------------------------------------------
+ *
+ * adaptive_executor.h
+ *	  Function declarations for the adaptive executor, which runs tasks over
+ *	  a pool of connections per worker node.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef ADAPTIVE_EXECUTOR_H
+#define ADAPTIVE_EXECUTOR_H
+
+#include "executor/tuptable.h"
+#include "nodes/execnodes.h"
+#include "nodes/pg_list.h"
+#include "utils/tuplestore.h"
+
+
+/* GUC, determining the maximum number of connections per worker in a pool */
+extern int MaxAdaptiveExecutorPoolSize;
+
+/* GUC, number of milliseconds to wait before opening additional connections */
+extern int ExecutorSlowStartInterval;
+
+
+/*
+ * TaskListResult pairs a list of SELECT tasks with the tuple store into which
+ * their results are written by ExecuteTaskListsIntoTupleStores.
+ */
+typedef struct TaskListResult
+{
+	/* tasks to execute */
+	List *taskList;
+
+	/* descriptor of the rows returned by the tasks */
+	TupleDesc tupleDescriptor;
+
+	/* tuple store that holds the results, created on demand if NULL */
+	Tuplestorestate *tupleStore;
+} TaskListResult;
+
+
+extern TupleTableSlot * AdaptiveExecutorExecScan(CustomScanState *node);
+extern void ExecuteTaskListsIntoTupleStores(List *taskListResultList);
+extern void ExecuteUtilityTaskListWithoutResults(List *taskList, int poolSize,
+												 char *sessionSetupCommand);
+
+
+#endif /* ADAPTIVE_EXECUTOR_H */
@@ -24,16 +24,26 @@
 /*
  * Each backend's active distributed transaction information is tracked via
  * BackendData in shared memory.
+ *
+ * Writers serialize using the mutex and increment changeCount before and
+ * after each change, so the count is odd while a change is in progress.
+ * Readers copy the data without taking the mutex, and retry if the count
+ * changed in the meantime.
  */
 typedef struct BackendData
 {
 	Oid databaseId;
 	slock_t mutex;
+	volatile uint32 changeCount;
 	bool cancelledDueToDeadlock;
 	DistributedTransactionId transactionId;
 } BackendData;
 
 
+/* config variable managed via guc.c */
+extern int TransactionNumberBatchSize;
+
+
 extern void InitializeBackendManagement(void);
 extern void InitializeBackendData(void);
 extern void LockBackendSharedMemory(LWLockMode lockMode);
@@ -44,5 +54,6 @@ extern void GetBackendDataForProc(PGPROC *proc, BackendData *result);
 extern void CancelTransactionDueToDeadlock(PGPROC *proc);
 extern bool MyBackendGotCancelledDueToDeadlock(void);
 extern List * ActiveDistributedTransactionNumbers(void);
+extern bool DatabaseHasDistributedTransactions(Oid databaseId);
 
 #endif /* BACKEND_DATA_H */
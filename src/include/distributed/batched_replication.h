@@ -0,0 +1,39 @@
+/*-------------------------------------------------------------------------
+ *
+ * batched_replication.h
+ *   Function declarations for replicating concurrent modifications of
+ *   reference tables in batches.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BATCHED_REPLICATION_H
+#define BATCHED_REPLICATION_H
+
+#include "distributed/multi_physical_planner.h"
+#include "nodes/params.h"
+#include "nodes/pg_list.h"
+
+
+/* maximum length of a modification that can be batched, including NUL */
+#define BATCHED_MODIFICATION_QUERY_LENGTH 1024
+
+/* maximum length of the error message of a batched modification */
+#define BATCHED_MODIFICATION_ERROR_LENGTH 256
+
+
+/* config variables */
+extern int ReferenceTableBatchSize;
+
+
+extern void InitializeBatchedReplication(void);
+extern bool CanBatchModifyTask(Task *task, CmdType operation,
+							   ParamListInfo paramListInfo, bool expectResults);
+extern bool WaitForBatchedModification(Task *task, int64 *affectedTupleCount);
+extern void ExecuteBatchedModifications(Task *task, List *connectionList);
+extern void FinishBatchedModifications(bool commit);
+
+
+#endif /* BATCHED_REPLICATION_H */
@@ -0,0 +1,42 @@
+/*-------------------------------------------------------------------------
+ *
+ * bloom_filter.h
+ *	  Declarations for fixed-size Bloom filters over 32-bit hash values.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+
+/* number of bits we set per added hash value */
+#define BLOOM_FILTER_HASH_COUNT 3
+
+
+/*
+ * BloomFilter is a bit array into which we add 32-bit hash values. The bit
+ * count is always a power of two, so that filters of the same size can be
+ * merged by OR'ing their bits.
+ */
+typedef struct BloomFilter
+{
+	uint32 bitCount;
+	uint32 hashCount;
+	uint8 bitArray[FLEXIBLE_ARRAY_MEMBER];
+} BloomFilter;
+
+
+extern BloomFilter * CreateBloomFilter(uint32 byteCount);
+extern void BloomFilterAdd(BloomFilter *filter, uint32 hashValue);
+extern bool BloomFilterMightContain(BloomFilter *filter, uint32 hashValue);
+extern void BloomFilterUnion(BloomFilter *targetFilter, BloomFilter *sourceFilter);
+extern void WriteBloomFilter(BloomFilter *filter, const char *filename);
+extern BloomFilter * ReadBloomFilter(const char *filename);
+extern bytea * BloomFilterToBytea(BloomFilter *filter);
+extern BloomFilter * ByteaToBloomFilter(bytea *filterBytes);
+
+
+#endif   /* BLOOM_FILTER_H */
@@ -23,6 +23,10 @@ typedef struct CitusScanState
 	MultiExecutorType executorType;   /* distributed executor type */
 	bool finishedRemoteScan;          /* flag to check if remote scan is finished */
 	Tuplestorestate *tuplestorestate; /* tuple store to store distributed results */
+	struct RouterSelectStream *resultStream; /* rows streamed from a connection */
+	struct MultiModifyStream *modifyStream; /* RETURNING rows streamed from tasks */
+	struct TenantAdmission *tenantAdmission; /* admission under tenant limits */
+	List *taskStatsList;              /* task statistics for EXPLAIN ANALYZE */
 } CitusScanState;
 
 
@@ -31,6 +35,7 @@ extern CustomScanMethods RealTimeCustomScanMethods;
 extern CustomScanMethods TaskTrackerCustomScanMethods;
 extern CustomScanMethods RouterCustomScanMethods;
 extern CustomScanMethods CoordinatorInsertSelectCustomScanMethods;
+extern CustomScanMethods AdaptiveExecutorCustomScanMethods;
 extern CustomScanMethods DelayedErrorCustomScanMethods;
 
 
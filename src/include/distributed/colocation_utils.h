@@ -22,6 +22,7 @@ extern bool TablesColocated(Oid leftDistributedTableId, Oid rightDistributedTabl
 extern bool ShardsColocated(ShardInterval *leftShardInterval,
 							ShardInterval *rightShardInterval);
 extern List * ColocatedTableList(Oid distributedTableId);
+extern List * ColocationGroupTableList(Oid colocationId);
 extern List * ColocatedShardIntervalList(ShardInterval *shardInterval);
 extern Oid ColocatedTableId(Oid colocationId);
 extern uint64 ColocatedShardIdInRelation(Oid relationId, int shardIndex);
@@ -0,0 +1,30 @@
+/*-------------------------------------------------------------------------
+ *
+ * column_statistics.h
+ *   Function declarations for merging the column statistics of the shards
+ *   of distributed tables into the coordinator's catalog.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef COLUMN_STATISTICS_H
+#define COLUMN_STATISTICS_H
+
+#include "fmgr.h"
+
+
+/* Config variables managed via guc.c */
+extern int ColumnStatisticsInterval;
+
+
+extern Datum master_update_column_statistics(PG_FUNCTION_ARGS);
+
+extern void UpdateColumnStatistics(Oid relationId);
+extern int UpdateAllColumnStatistics(void);
+extern double RelationRowCount(Oid relationId);
+extern double ColumnDistinctCount(Oid relationId, AttrNumber attributeNumber);
+
+
+#endif /* COLUMN_STATISTICS_H */
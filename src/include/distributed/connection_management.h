@@ -41,7 +41,22 @@ enum MultiConnectionMode
 	FOR_DML = 1 << 3,
 
 	/* open a connection per (co-located set of) placement(s) */
-	CONNECTION_PER_PLACEMENT = 1 << 4
+	CONNECTION_PER_PLACEMENT = 1 << 4,
+
+	/*
+	 * return NULL instead of waiting when citus.max_shared_pool_size
+	 * connections to the node are already open
+	 */
+	OPTIONAL_CONNECTION = 1 << 5,
+
+	/*
+	 * return the connection that modified the placements even if it is
+	 * claimed, such that the caller can run commands on it one at a time
+	 */
+	SHARE_MODIFYING_CONNECTION = 1 << 6,
+
+	/* attempt the connection even if the node is known to be unreachable */
+	IGNORE_NODE_HEALTH = 1 << 7
 };
 
 
@@ -68,6 +83,15 @@ typedef struct MultiConnection
 	/* time connection establishment was started, for timeout */
 	TimestampTz connectionStart;
 
+	/* was the connection establishment time added to the latency histograms */
+	bool connectionLatencyRecorded;
+
+	/* does the connection hold a slot in the shared connection counters */
+	bool sharedConnectionCounterIncremented;
+
+	/* was establishment skipped since the node is known to be unreachable */
+	bool unreachableNodeSkipped;
+
 	/* membership in list of list of connections in ConnectionHashEntry */
 	dlist_node connectionNode;
 
@@ -82,6 +106,31 @@ typedef struct MultiConnection
 
 	/* number of bytes sent to PQputCopyData() since last flush */
 	uint64 copyBytesWrittenSinceLastFlush;
+
+	/* number of times PQputCopyData() had to wait for the worker to catch up */
+	uint64 copyBackPressureCount;
+
+	/* statements prepared on the connection, keyed by query text, or NULL */
+	struct HTAB *preparedStatementHash;
+	MemoryContext preparedStatementContext;
+
+	/* number of statements prepared so far, used to name them */
+	uint64 preparedStatementCounter;
+
+	/* value of the invalidation counter when the statements were prepared */
+	uint64 preparedStatementGeneration;
+
+	/* whether the connection is still being established by prewarming */
+	bool prewarming;
+
+	/* PostgresPollingStatusType the prewarming connection waits for */
+	int prewarmPollMode;
+
+	/* whether the statement_timeout of the current statement was forwarded */
+	bool statementTimeoutSet;
+
+	/* max_parallel_workers_per_gather set on the connection, 0 if not changed */
+	int parallelWorkerCount;
 } MultiConnection;
 
 
@@ -130,6 +179,12 @@ extern int CitusSSLMode;
 /* maximum duration to wait for connection */
 extern int NodeConnectionTimeout;
 
+/* whether to establish connections to the workers on the first distributed query */
+extern bool EnableConnectionPrewarming;
+
+/* TCP keepalive idle time and interval of worker connections, in seconds */
+extern int NodeConnectionKeepaliveInterval;
+
 /* the hash table */
 extern HTAB *ConnectionHash;
 
@@ -156,10 +211,12 @@ extern MultiConnection * StartNodeUserDatabaseConnection(uint32 flags,
 														 const char *database);
 extern char * CitusSSLModeString(void);
 extern void CloseNodeConnectionsAfterTransaction(char *nodeName, int nodePort);
+extern void CloseAllConnections(void);
 extern void CloseConnection(MultiConnection *connection);
 extern void ShutdownConnection(MultiConnection *connection);
 
 /* dealing with a connection */
+extern void PrewarmNodeConnections(void);
 extern void FinishConnectionListEstablishment(List *multiConnectionList);
 extern void FinishConnectionEstablishment(MultiConnection *connection);
 extern void ClaimConnectionExclusively(MultiConnection *connection);
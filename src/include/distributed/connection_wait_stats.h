@@ -0,0 +1,47 @@
+/*-------------------------------------------------------------------------
+ *
+ * connection_wait_stats.h
+ *   Function declarations for tracking waits of backends on worker nodes
+ *   and the latency histograms of connections to each worker node.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CONNECTION_WAIT_STATS_H
+#define CONNECTION_WAIT_STATS_H
+
+#include "distributed/connection_management.h"
+#include "utils/timestamp.h"
+
+
+/* kinds of waits on a worker node */
+typedef enum ConnectionWaitEvent
+{
+	CONNECTION_WAIT_NONE = 0,
+	CONNECTION_WAIT_CONNECT = 1,
+	CONNECTION_WAIT_SEND = 2,
+	CONNECTION_WAIT_RESULT = 3,
+	CONNECTION_WAIT_COPY_FLUSH = 4
+} ConnectionWaitEvent;
+
+#define CONNECTION_WAIT_EVENT_COUNT 5
+
+
+/* config variable */
+extern bool TrackConnectionLatency;
+
+
+extern void InitializeConnectionWaitStats(void);
+extern TimestampTz ConnectionWaitStart(MultiConnection *connection,
+									   ConnectionWaitEvent waitEvent);
+extern void ConnectionWaitEnd(void);
+extern void RecordConnectionLatency(MultiConnection *connection,
+									ConnectionWaitEvent waitEvent,
+									TimestampTz startTime);
+extern void RecordConnectionEstablished(MultiConnection *connection);
+extern void ResetConnectionWaitState(void);
+
+
+#endif /* CONNECTION_WAIT_STATS_H */
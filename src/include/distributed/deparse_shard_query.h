@@ -15,13 +15,39 @@
 
 #include "c.h"
 
+#include "lib/stringinfo.h"
 #include "nodes/nodes.h"
 #include "nodes/parsenodes.h"
 #include "nodes/pg_list.h"
 
 
+/*
+ * ShardQueryTemplate is a deparsed query string in which the names of the
+ * shards are left out. Tasks whose queries only differ in the shards they
+ * access can build their query strings from the template by filling in the
+ * shard names, instead of deparsing the query again for every task.
+ */
+typedef struct ShardQueryTemplate
+{
+	bool valid;             /* whether the template reproduces the query */
+	int slotCount;          /* number of distinct shard range table entries */
+	Oid *relationIds;       /* relation of the shard in each slot */
+	char **relationNames;   /* unqualified name of that relation */
+	List *textList;         /* query text before, between and after placeholders */
+	List *slotIndexList;    /* slot that each placeholder refers to */
+} ShardQueryTemplate;
+
+
 extern void RebuildQueryStrings(Query *originalQuery, List *taskList);
 extern bool UpdateRelationToShardNames(Node *node, List *relationShardList);
+extern List * ShardRangeTableEntryList(Query *query);
+extern ShardQueryTemplate * BuildShardQueryTemplate(Query *query,
+													List *shardRangeTableEntryList,
+													StringInfo queryString);
+extern char * InstantiateShardQueryTemplate(ShardQueryTemplate *queryTemplate,
+											uint64 *shardIdArray);
+extern char * DeparseRelationShardQuery(Query *query, List *relationShardList,
+										ShardQueryTemplate **queryTemplate);
 
 
 #endif /* DEPARSE_SHARD_QUERY_H */
@@ -37,6 +37,9 @@ typedef struct TransactionNode
 /* GUC, determining whether debug messages for deadlock detection sent to LOG */
 extern bool LogDistributedDeadlockDetection;
 
+/* number of wait edges in the wait graph of the last check */
+extern int LastWaitGraphEdgeCount;
+
 
 extern bool CheckForDistributedDeadlocks(void);
 extern HTAB * BuildAdjacencyListsForWaitGraph(WaitGraph *waitGraph);
@@ -29,6 +29,7 @@ typedef struct RelationRestrictionContext
 	bool hasDistributedRelation;
 	bool hasLocalRelation;
 	bool allReferenceTables;
+	bool fastPathRouterQuery;
 	List *relationRestrictionList;
 } RelationRestrictionContext;
 
@@ -64,6 +65,10 @@ typedef struct PlannerRestrictionContext
 	RelationRestrictionContext *relationRestrictionContext;
 	JoinRestrictionContext *joinRestrictionContext;
 	MemoryContext memoryContext;
+
+	/* attribute equivalences cached by GenerateAllAttributeEquivalences() */
+	List *attributeEquivalenceList;
+	bool attributeEquivalencesGenerated;
 } PlannerRestrictionContext;
 
 typedef struct RelationShard
@@ -93,5 +98,7 @@ extern bool IsMultiTaskPlan(struct DistributedPlan *distributedPlan);
 extern bool IsMultiShardModifyPlan(struct DistributedPlan *distributedPlan);
 extern RangeTblEntry * RemoteScanRangeTableEntry(List *columnNameList);
 extern int GetRTEIdentity(RangeTblEntry *rte);
+extern Node * ResolveExternalParams(Node *inputNode, ParamListInfo boundParams);
+extern bool HasUnresolvedExternParamsWalker(Node *expression, ParamListInfo boundParams);
 
 #endif /* DISTRIBUTED_PLANNER_H */
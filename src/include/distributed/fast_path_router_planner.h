@@ -0,0 +1,30 @@
+/*-------------------------------------------------------------------------
+ *
+ * fast_path_router_planner.h
+ *	  Planning of simple single-shard queries without calling into the
+ *	  postgres planner.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef FAST_PATH_ROUTER_PLANNER_H
+#define FAST_PATH_ROUTER_PLANNER_H
+
+
+#include "nodes/params.h"
+#include "nodes/parsenodes.h"
+#include "nodes/plannodes.h"
+
+
+/* Config variable managed via guc.c */
+extern bool EnableFastPathRouterPlanner;
+
+
+extern bool FastPathRouterQuery(Query *query);
+extern Node * FastPathDistributionKeyValue(Query *query);
+extern PlannedStmt * FastPathPlanner(Query *originalQuery, Query *parse,
+									 ParamListInfo boundParams);
+
+
+#endif /* FAST_PATH_ROUTER_PLANNER_H */
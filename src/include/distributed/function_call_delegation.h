@@ -0,0 +1,28 @@
+/*-------------------------------------------------------------------------
+ *
+ * function_call_delegation.h
+ *	  Planning of calls of distributed functions on the node that has the
+ *	  shard of their distribution argument.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef FUNCTION_CALL_DELEGATION_H
+#define FUNCTION_CALL_DELEGATION_H
+
+
+#include "distributed/multi_physical_planner.h"
+#include "nodes/params.h"
+#include "nodes/parsenodes.h"
+
+
+/* Config variable managed via guc.c */
+extern bool EnableFunctionCallDelegation;
+
+
+extern DistributedPlan * TryToDelegateFunctionCall(Query *query,
+												   ParamListInfo boundParams);
+
+
+#endif /* FUNCTION_CALL_DELEGATION_H */
@@ -14,10 +14,16 @@
 #define INSERT_SELECT_EXECUTOR_H
 
 
+#include "distributed/multi_physical_planner.h"
 #include "executor/execdesc.h"
 
 
+/* config variable managed via guc.c */
+extern bool EnableRepartitionedInsertSelect;
+
+
 extern TupleTableSlot * CoordinatorInsertSelectExecScan(CustomScanState *node);
+extern bool IsRepartitionedInsertSelect(DistributedPlan *distributedPlan);
 
 
 #endif /* INSERT_SELECT_EXECUTOR_H */
@@ -23,6 +23,10 @@
 #include "nodes/plannodes.h"
 
 
+/* config variable managed via guc.c */
+extern int MultiRowInsertCopyThreshold;
+
+
 extern bool InsertSelectIntoDistributedTable(Query *query);
 extern bool InsertSelectIntoLocalTable(Query *query);
 extern Query * ReorderInsertSelectTargetLists(Query *originalQuery,
@@ -33,6 +37,8 @@ extern void CoordinatorInsertSelectExplainScan(CustomScanState *node, List *ance
 extern DistributedPlan * CreateInsertSelectPlan(Query *originalQuery,
 												PlannerRestrictionContext *
 												plannerRestrictionContext);
+extern bool MultiRowInsertViaCopy(Query *query);
+extern DistributedPlan * CreateMultiRowInsertCopyPlan(Query *originalQuery);
 
 
 #endif /* INSERT_SELECT_PLANNER_H */
@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * intermediate_result_scan.h
+ *	  Custom scan that reads an intermediate result row by row.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef INTERMEDIATE_RESULT_SCAN_H
+#define INTERMEDIATE_RESULT_SCAN_H
+
+#include "nodes/extensible.h"
+#include "nodes/parsenodes.h"
+#include "nodes/relation.h"
+
+
+/* Config variable managed via guc.c */
+extern bool EnableIntermediateResultStreaming;
+
+extern CustomScanMethods IntermediateResultCustomScanMethods;
+
+
+extern void UseIntermediateResultScan(RelOptInfo *relOptInfo,
+									  RangeTblEntry *rangeTableEntry,
+									  char *resultId, char *copyFormat);
+
+
+#endif /* INTERMEDIATE_RESULT_SCAN_H */
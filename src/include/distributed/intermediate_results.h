@@ -15,18 +15,55 @@
 #include "fmgr.h"
 
 #include "distributed/multi_copy.h"
+#include "lib/stringinfo.h"
 #include "nodes/execnodes.h"
 #include "nodes/pg_list.h"
+#include "storage/fd.h"
 #include "tcop/dest.h"
 #include "utils/palloc.h"
 
 
+/* compression methods for intermediate result files and their broadcast */
+typedef enum IntermediateResultCompressionType
+{
+	INTERMEDIATE_RESULT_COMPRESSION_NONE = 0,
+	INTERMEDIATE_RESULT_COMPRESSION_PGLZ = 1
+} IntermediateResultCompressionType;
+
+
+/* reading state of an intermediate result that is read row by row */
+typedef struct IntermediateResultStream IntermediateResultStream;
+
+
+/* config variable managed via guc.c */
+extern int IntermediateResultCompression;
+
+
 extern DestReceiver * CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
 												   List *initialNodeList, bool
 												   writeLocalFile);
 extern void ReceiveQueryResultViaCopy(const char *resultId);
 extern void RemoveIntermediateResultsDirectory(void);
+extern char * SessionIntermediateResultKey(const char *resultId);
+extern bool HasSessionIntermediateResults(void);
+extern void FinishSessionIntermediateResults(bool isCommit);
 extern int64 IntermediateResultSize(char *resultId);
+extern void AppendCompressedResultMagic(StringInfo buffer);
+extern void AppendCompressedBlock(StringInfo buffer, const char *data, int32 rawLength);
+extern bool IsCompressedResultFile(const char *fileName);
+extern void ReadCompressedFileIntoTupleStore(char *fileName, char *copyFormat,
+											 TupleDesc tupleDescriptor,
+											 Tuplestorestate *tupstore);
+extern File DecompressResultFile(char *fileName);
+extern IntermediateResultStream * BeginIntermediateResultStream(char *resultId,
+																char *copyFormat,
+																TupleDesc tupleDescriptor);
+extern bool NextIntermediateResultRow(IntermediateResultStream *stream,
+									  ExprContext *econtext, Datum *columnValues,
+									  bool *columnNulls);
+extern void EndIntermediateResultStream(IntermediateResultStream *stream);
+extern void RecordIntermediateResultRowCount(const char *resultId, uint64 rowCount);
+extern bool IntermediateResultRowCount(const char *resultId, uint64 *rowCount);
 
 
 #endif /* INTERMEDIATE_RESULTS_H */
@@ -0,0 +1,26 @@
+/*-------------------------------------------------------------------------
+ *
+ * job_cache_usage.h
+ *   Function declarations for accounting the disk space used by
+ *   intermediate results and repartition jobs in the job cache directory.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef JOB_CACHE_USAGE_H
+#define JOB_CACHE_USAGE_H
+
+
+/* config variables */
+extern int MaxJobCacheSize;
+extern int JobCacheQuotaWaitTimeout;
+
+
+extern void InitializeJobCacheUsage(void);
+extern void ReserveJobCacheSpace(int64 byteCount);
+extern void CheckJobCacheQuota(void);
+
+
+#endif /* JOB_CACHE_USAGE_H */
@@ -0,0 +1,30 @@
+/*-------------------------------------------------------------------------
+ *
+ * job_directory_cleanup.h
+ *   Function declarations for removing job directories in the background.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef JOB_DIRECTORY_CLEANUP_H
+#define JOB_DIRECTORY_CLEANUP_H
+
+#include "lib/stringinfo.h"
+
+
+/* directory that job directories are moved into until they are removed */
+#define PG_JOB_CACHE_REMOVED_DIR "pgsql_job_cache_removed"
+
+
+/* config variables */
+extern bool DeferJobDirectoryRemoval;
+extern int JobDirectoryRemovalRate;
+
+
+extern void RemoveJobCacheDirectory(StringInfo directoryName);
+extern void RemoveDeferredJobDirectories(void);
+
+
+#endif /* JOB_DIRECTORY_CLEANUP_H */
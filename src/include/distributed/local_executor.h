@@ -0,0 +1,27 @@
+/*-------------------------------------------------------------------------
+ *
+ * local_executor.h
+ *	  Function declarations for executing tasks on placements of the local
+ *	  node without a connection.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef LOCAL_EXECUTOR_H
+#define LOCAL_EXECUTOR_H
+
+#include "distributed/citus_custom_scan.h"
+#include "distributed/multi_physical_planner.h"
+
+
+/* config variable managed via guc.c */
+extern bool EnableLocalExecution;
+
+
+extern List * LocalTaskPlacementAccessList(DistributedPlan *distributedPlan, Task *task);
+extern void ExecuteLocalSelectTask(CitusScanState *scanState, Task *task);
+
+
+#endif /* LOCAL_EXECUTOR_H */
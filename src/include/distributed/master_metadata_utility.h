@@ -51,6 +51,16 @@ CatalogTupleInsert(Relation heapRel, HeapTuple tup)
 }
 
 
+static inline Oid
+CatalogTupleInsertWithInfo(Relation heapRel, HeapTuple tup, CatalogIndexState indstate)
+{
+	Oid oid = simple_heap_insert(heapRel, tup);
+	CatalogIndexInsert(indstate, tup);
+
+	return oid;
+}
+
+
 #endif
 
 /* In-memory representation of a typed tuple in pg_dist_shard. */
@@ -107,11 +117,14 @@ typedef struct ShardPlacement
 
 /* Config variable managed via guc.c */
 extern int ReplicationModel;
+extern int TableSizeCacheTTL;
 
 /* Size functions */
 extern Datum citus_table_size(PG_FUNCTION_ARGS);
 extern Datum citus_total_relation_size(PG_FUNCTION_ARGS);
 extern Datum citus_relation_size(PG_FUNCTION_ARGS);
+extern Datum citus_table_sizes(PG_FUNCTION_ARGS);
+extern Datum citus_total_relation_sizes(PG_FUNCTION_ARGS);
 
 /* Function declarations to read shard and shard placement data */
 extern uint32 TableShardReplicationFactor(Oid relationId);
@@ -122,6 +135,7 @@ extern void CopyShardInterval(ShardInterval *srcInterval, ShardInterval *destInt
 extern void CopyShardPlacement(ShardPlacement *srcPlacement,
 							   ShardPlacement *destPlacement);
 extern uint64 ShardLength(uint64 shardId);
+extern uint64 TableShardLength(Oid relationId);
 extern bool NodeGroupHasShardPlacements(uint32 groupId,
 										bool onlyConsiderActivePlacements);
 extern List * FinalizedShardPlacementList(uint64 shardId);
@@ -132,19 +146,25 @@ extern List * GroupShardPlacementsForTableOnGroup(Oid relationId, uint32 groupId
 /* Function declarations to modify shard and shard placement data */
 extern void InsertShardRow(Oid relationId, uint64 shardId, char storageType,
 						   text *shardMinValue, text *shardMaxValue);
+extern void InsertShardRowList(List *shardIntervalList);
 extern void DeleteShardRow(uint64 shardId);
 extern uint64 InsertShardPlacementRow(uint64 shardId, uint64 placementId,
 									  char shardState, uint64 shardLength,
 									  uint32 groupId);
+extern void InsertShardPlacementRowList(Oid relationId, List *placementList);
 extern void InsertIntoPgDistPartition(Oid relationId, char distributionMethod,
 									  Var *distributionColumn, uint32 colocationId,
 									  char replicationModel);
 extern void DeletePartitionRow(Oid distributedRelationId);
 extern void DeleteShardRow(uint64 shardId);
 extern void UpdateShardPlacementState(uint64 placementId, char shardState);
+extern void UpdateShardPlacementLength(uint64 placementId, uint64 shardLength);
+extern void UpdateShardStorageType(uint64 shardId, char storageType);
+extern void UpdatePlacementGroupId(uint64 placementId, uint32 groupId);
 extern void DeleteShardPlacementRow(uint64 placementId);
 extern void UpdateColocationGroupReplicationFactor(uint32 colocationId,
 												   int replicationFactor);
+extern void UpdateColocationGroupShardCount(uint32 colocationId, int shardCount);
 extern void CreateDistributedTable(Oid relationId, Var *distributionColumn,
 								   char distributionMethod, char *colocateWithTableName,
 								   bool viaDeprecatedAPI);
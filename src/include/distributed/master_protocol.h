@@ -67,6 +67,9 @@
 #define SHARD_RANGE_QUERY "SELECT min(%s), max(%s) FROM %s"
 #define SHARD_TABLE_SIZE_QUERY "SELECT pg_table_size(%s)"
 #define SHARD_CSTORE_TABLE_SIZE_QUERY "SELECT cstore_table_size(%s)"
+#define SHARD_TABLE_LENGTH_QUERY "SELECT " UINT64_FORMAT ", pg_table_size(%s)"
+#define SHARD_CSTORE_TABLE_LENGTH_QUERY \
+	"SELECT " UINT64_FORMAT ", cstore_table_size(%s)"
 #define DROP_REGULAR_TABLE_COMMAND "DROP TABLE IF EXISTS %s CASCADE"
 #define DROP_FOREIGN_TABLE_COMMAND "DROP FOREIGN TABLE IF EXISTS %s CASCADE"
 #define CREATE_SCHEMA_COMMAND "CREATE SCHEMA IF NOT EXISTS %s AUTHORIZATION %s"
@@ -107,6 +110,7 @@ extern Oid ResolveRelationId(text *relationName);
 extern List * GetTableDDLEvents(Oid relationId, bool forShardCreation);
 extern List * GetTableCreationCommands(Oid relationId, bool forShardCreation);
 extern List * GetTableIndexAndConstraintCommands(Oid relationId);
+extern List * GetTableReplicaIdentityCommand(Oid relationId);
 extern List * GetTableForeignConstraintCommands(Oid relationId);
 extern char ShardStorageType(Oid relationId);
 extern void CheckDistributedTable(Oid relationId);
@@ -115,17 +119,24 @@ extern void CreateAppendDistributedShardPlacements(Oid relationId, int64 shardId
 												   replicationFactor);
 extern void CreateShardsOnWorkers(Oid distributedRelationId, List *shardPlacements,
 								  bool useExclusiveConnection,
-								  bool colocatedShard);
+								  bool colocatedShard, bool deferIndexCreation);
+extern void CreateShardIndexesOnWorkers(Oid distributedRelationId);
 extern List * InsertShardPlacementRows(Oid relationId, int64 shardId,
 									   List *workerNodeList, int workerStartIndex,
 									   int replicationFactor);
+extern List * NewShardPlacementList(int64 shardId, List *workerNodeList,
+									int workerStartIndex, int replicationFactor);
 extern uint64 UpdateShardStatistics(int64 shardId);
+extern void UpdateShardPlacementLengths(Oid relationId);
 extern void CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
 											 int32 replicationFactor,
-											 bool useExclusiveConnections);
+											 bool useExclusiveConnections,
+											 bool deferIndexCreation);
 extern void CreateColocatedShards(Oid targetRelationId, Oid sourceRelationId,
-								  bool useExclusiveConnections);
-extern void CreateReferenceTableShard(Oid distributedTableId);
+								  bool useExclusiveConnections,
+								  bool deferIndexCreation);
+extern void CreateReferenceTableShard(Oid distributedTableId,
+									  bool deferIndexCreation);
 extern void WorkerCreateShard(Oid relationId, int shardIndex, uint64 shardId,
 							  List *ddlCommandList, List *foreignConstraintCommandList,
 							  char *alterTableAttachPartitionCommand,
@@ -134,6 +145,8 @@ extern Oid ForeignConstraintGetReferencedTableId(char *queryString);
 extern void CheckHashPartitionedTable(Oid distributedTableId);
 extern void CheckTableSchemaNameForDrop(Oid relationId, char **schemaName,
 										char **tableName);
+extern int DropShards(Oid relationId, char *schemaName, char *relationName,
+					  List *deletableShardIntervalList);
 extern text * IntegerToText(int32 value);
 
 /* Function declarations for generating metadata for shard and placement creation */
@@ -163,6 +176,9 @@ extern Datum isolate_tenant_to_new_shard(PG_FUNCTION_ARGS);
 extern Datum master_copy_shard_placement(PG_FUNCTION_ARGS);
 
 /* function declarations for shard copy functinality */
+extern void StreamShardPlacementsToNode(List *sourcePlacementList,
+										char *targetNodeName, int32 targetNodePort,
+										int maxConcurrentCopies);
 extern List * CopyShardCommandList(ShardInterval *shardInterval, char *sourceNodeName,
 								   int32 sourceNodePort);
 extern List * CopyShardForeignConstraintCommandList(ShardInterval *shardInterval);
@@ -0,0 +1,55 @@
+/*-------------------------------------------------------------------------
+ *
+ * memory_results.h
+ *   Function declarations for keeping small intermediate results in
+ *   dynamic shared memory instead of files.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef MEMORY_RESULTS_H
+#define MEMORY_RESULTS_H
+
+#include "storage/dsm.h"
+
+
+/* maximum number of memory-resident results across all backends */
+#define MAX_MEMORY_RESULTS 1024
+
+/* maximum length of the key of a memory-resident result, including NUL */
+#define MEMORY_RESULT_KEY_LENGTH 128
+
+
+/*
+ * MemoryResult describes a memory-resident result that is mapped into the
+ * address space of the current backend.
+ */
+typedef struct MemoryResult
+{
+	dsm_segment *segment;
+
+	/* whether the segment was attached for reading and has to be detached */
+	bool attached;
+
+	char *data;
+	Size size;
+} MemoryResult;
+
+
+/* config variable managed via guc.c */
+extern int MaxMemoryIntermediateResultSize;
+
+
+extern void InitializeMemoryResults(void);
+extern bool MemoryResultsEnabled(void);
+extern bool StoreMemoryResult(const char *resultKey, const char *data, Size size);
+extern MemoryResult * OpenMemoryResult(const char *resultKey);
+extern void CloseMemoryResult(MemoryResult *memoryResult);
+extern int64 MemoryResultSize(const char *resultKey);
+extern void RemoveMemoryResult(const char *resultKey);
+extern void ReleaseMemoryResults(void);
+
+
+#endif /* MEMORY_RESULTS_H */
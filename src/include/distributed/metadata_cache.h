@@ -12,18 +12,21 @@
 #define METADATA_CACHE_H
 
 #include "fmgr.h"
+#include "distributed/bloom_filter.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/worker_manager.h"
 #include "utils/hsearch.h"
 
 extern bool EnableVersionChecks;
+extern bool LazyPlacementLoading;
 
 /* managed via guc.c */
 typedef enum
 {
 	USE_SECONDARY_NODES_NEVER = 0,
-	USE_SECONDARY_NODES_ALWAYS = 1
+	USE_SECONDARY_NODES_ALWAYS = 1,
+	USE_SECONDARY_NODES_READ_ONLY = 2
 } ReadFromSecondariesType;
 extern int ReadFromSecondaries;
 
@@ -57,6 +60,25 @@ typedef struct
 	int shardIntervalArrayLength;
 	ShardInterval **sortedShardIntervalArray;
 
+	/*
+	 * For range and append partitioned tables with overlapping shards, the
+	 * index of the interval with the greatest maxValue among the intervals in
+	 * sortedShardIntervalArray up to each position, which allows searching for
+	 * overlapping intervals in O(log n). Only covers the leading intervals that
+	 * have min/max values; NULL if not built.
+	 */
+	int *greatestMaxValueIndexArray;
+	int initializedShardIntervalCount;
+
+	/*
+	 * For hash partitioned tables without a uniform hash distribution, the
+	 * min and max hash values of the intervals in sortedShardIntervalArray,
+	 * stored contiguously such that finding the shard of a hash value needs
+	 * neither pointer lookups nor comparison function calls. NULL otherwise.
+	 */
+	int32 *shardMinHashArray;
+	int32 *shardMaxHashArray;
+
 	/* comparator for partition column's type, NULL if DISTRIBUTE_BY_NONE */
 	FmgrInfo *shardColumnCompareFunction;
 
@@ -68,22 +90,112 @@ typedef struct
 	FmgrInfo *shardIntervalCompareFunction;
 	FmgrInfo *hashFunction; /* NULL if table is not distributed by hash */
 
-	/* pg_dist_placement metadata */
+	/*
+	 * pg_dist_placement metadata, the placement array of a shard is NULL
+	 * until first used if citus.lazy_placement_loading was set
+	 */
 	GroupShardPlacement **arrayOfPlacementArrays;
 	int *arrayOfPlacementArrayLengths;
+
+	/* position in the shard invalidation log when the entry was built */
+	uint64 shardInvalidationLogPosition;
 } DistTableCacheEntry;
 
 
+/* maximum number of secondary nodes of a node group that reads are spread over */
+#define MAX_SECONDARY_NODES_PER_GROUP 16
+
+
+/*
+ * The nodes of a node group in the worker node cache. The primary node is the
+ * first one of its role, NULL if the group has none. The secondary nodes are
+ * the first MAX_SECONDARY_NODES_PER_GROUP secondaries of the group.
+ */
+typedef struct WorkerNodeGroup
+{
+	bool hasNodes;
+	WorkerNode *primaryNode;
+	int secondaryNodeCount;
+	WorkerNode *secondaryNodes[MAX_SECONDARY_NODES_PER_GROUP];
+} WorkerNodeGroup;
+
+
+/*
+ * Representation of a function whose calls are delegated to the node that has
+ * the shard of its distribution argument, as recorded in pg_dist_function.
+ */
+typedef struct DistFunctionCacheEntry
+{
+	/* lookup key - must be first. A pg_proc.oid oid. */
+	Oid functionId;
+
+	bool isValid;
+	bool isDistributedFunction;
+
+	/* pg_dist_function metadata for this function */
+	int distributionArgIndex;
+	uint32 colocationId;
+} DistFunctionCacheEntry;
+
+
+/*
+ * Summary of the values of a non-distribution column in a shard, as recorded
+ * in pg_dist_shard_zone_map, which allows pruning shards on filters on the
+ * column.
+ */
+typedef struct ShardZoneMap
+{
+	uint64 shardId;
+	AttrNumber attributeNumber;
+
+	/* min/max values of the column, unless the shard has no non-null values */
+	bool hasMinMaxValues;
+	bool valueByVal;
+	Datum minValue;
+	Datum maxValue;
+
+	/* bloom filter over the hashes of the values, NULL if not built */
+	BloomFilter *bloomFilter;
+} ShardZoneMap;
+
+
+/*
+ * Representation of the zone maps of the shards of a distributed table. The
+ * zone maps are only read again after they were changed.
+ */
+typedef struct ShardZoneMapCacheEntry
+{
+	/* lookup key - must be first. A pg_class.oid oid. */
+	Oid relationId;
+
+	bool isValid;
+
+	/* zone maps whose column still has its type, sorted by shard and column */
+	int zoneMapCount;
+	ShardZoneMap *zoneMapArray;
+} ShardZoneMapCacheEntry;
+
+
 extern bool IsDistributedTable(Oid relationId);
 extern List * DistributedTableList(void);
 extern ShardInterval * LoadShardInterval(uint64 shardId);
+extern Oid ShardRelationId(int64 shardId);
+extern bool ShardExists(int64 shardId);
 extern ShardPlacement * FindShardPlacementOnGroup(uint32 groupId, uint64 shardId);
 extern GroupShardPlacement * LoadGroupShardPlacement(uint64 shardId, uint64 placementId);
 extern ShardPlacement * LoadShardPlacement(uint64 shardId, uint64 placementId);
 extern DistTableCacheEntry * DistributedTableCacheEntry(Oid distributedRelationId);
+extern List * CachedColocationGroupTableList(uint32 colocationId);
+extern DistFunctionCacheEntry * LookupDistFunctionCacheEntry(Oid functionId);
+extern ShardZoneMapCacheEntry * LookupShardZoneMapCacheEntry(Oid relationId);
+extern ShardZoneMap * FindShardZoneMap(ShardZoneMapCacheEntry *cacheEntry,
+									   uint64 shardId, AttrNumber attributeNumber);
 extern int GetLocalGroupId(void);
 extern List * DistTableOidList(void);
 extern List * ShardPlacementList(uint64 shardId);
+extern GroupShardPlacement * CachedShardPlacementArray(DistTableCacheEntry *cacheEntry,
+													   int shardIndex,
+													   int *placementCount);
 extern void CitusInvalidateRelcacheByRelid(Oid relationId);
 extern void CitusInvalidateRelcacheByShardId(int64 shardId);
 extern void FlushDistTableCache(void);
@@ -99,6 +211,8 @@ extern void EnsureModificationsCanRun(void);
 
 /* access WorkerNodeHash */
 extern HTAB * GetWorkerNodeHash(void);
+extern WorkerNodeGroup * LookupNodeGroup(uint32 groupId);
+extern WorkerNode * LookupNodeForGroup(uint32 groupId);
 
 /* relation oids */
 extern Oid DistColocationRelationId(void);
@@ -109,6 +223,10 @@ extern Oid DistShardRelationId(void);
 extern Oid DistPlacementRelationId(void);
 extern Oid DistNodeRelationId(void);
 extern Oid DistLocalGroupIdRelationId(void);
+extern Oid DistFunctionRelationId(void);
+extern Oid DistShardZoneMapRelationId(void);
+extern Oid DistRetentionPolicyRelationId(void);
+extern Oid DistRollupRelationId(void);
 
 /* index oids */
 extern Oid DistNodeNodeIdIndexId(void);
@@ -122,6 +240,11 @@ extern Oid DistTransactionRelationId(void);
 extern Oid DistTransactionGroupIndexId(void);
 extern Oid DistTransactionRecordIndexId(void);
 extern Oid DistPlacementGroupidIndexId(void);
+extern Oid DistFunctionFuncidIndexId(void);
+extern Oid DistShardZoneMapPrimaryKeyIndexId(void);
+extern Oid DistShardZoneMapLogicalRelidIndexId(void);
+extern Oid DistRetentionPolicyPrimaryKeyIndexId(void);
+extern Oid DistRollupPrimaryKeyIndexId(void);
 
 /* type oids */
 extern Oid CitusCopyFormatTypeId(void);
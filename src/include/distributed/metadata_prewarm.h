@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * metadata_prewarm.h
+ *   Function declarations for recording the recently used distributed
+ *   tables and loading them into the shared metadata cache at start up.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef METADATA_PREWARM_H
+#define METADATA_PREWARM_H
+
+#include "fmgr.h"
+#include "utils/timestamp.h"
+
+
+/* interval in milliseconds at which the recently used tables are recorded */
+#define METADATA_PREWARM_RECORD_INTERVAL (60 * 1000)
+
+
+/* Config variables managed via guc.c */
+extern int MetadataPrewarmTableCount;
+
+
+extern Datum citus_prewarm_metadata_cache(PG_FUNCTION_ARGS);
+
+extern bool MetadataPrewarmEnabled(void);
+extern int PrewarmMetadataCache(void);
+extern int RecordRecentlyUsedTables(TimestampTz usedAfter);
+
+
+#endif /* METADATA_PREWARM_H */
@@ -17,6 +17,10 @@
 #include "nodes/pg_list.h"
 
 
+/* config variable to only send metadata differences to workers that have metadata */
+extern bool IncrementalMetadataSync;
+
+
 /* Functions declarations for metadata syncing */
 extern bool ShouldSyncTableMetadata(Oid relationId);
 extern List * MetadataCreateCommands(void);
@@ -90,22 +90,38 @@ typedef enum TaskExecutionStatus
 } TaskExecutionStatus;
 
 
-struct pollfd; /* forward declared, to avoid having to include poll.h */
-
+/* forward declared, to avoid having to include storage/latch.h */
+struct WaitEventSet;
+struct WaitEvent;
+
+/*
+ * WaitInfo keeps track of what the connections of an execution are waiting
+ * for. The sockets are kept in a WaitEventSet that persists across rounds of
+ * the executor, such that only changes in what a connection waits for have
+ * to be passed to the kernel.
+ */
 typedef struct WaitInfo
 {
 	int maxWaiters;
-#ifdef HAVE_POLL
-	struct pollfd *pollfds;
-#else
-	fd_set readFileDescriptorSet;
-	fd_set writeFileDescriptorSet;
-	fd_set exceptionFileDescriptorSet;
-	int maxConnectionFileDescriptor;
-#endif /* HAVE_POLL*/
+	MemoryContext memoryContext;
+
+	/* connections registered in the current round, and their wait flags */
 	int registeredWaiters;
+	int32 *registeredConnectionIds;
+	int *registeredWaitFlags;
 	bool haveReadyWaiter;
 	bool haveFailedWaiter;
+
+	/* wait event set and the connections that are currently part of it */
+	struct WaitEventSet *waitEventSet;
+	struct WaitEvent *events;
+	int eventSetSize;
+	int socketEventCount;
+	int *eventConnectionIds;
+	int *eventSockets;
+	int *eventWaitFlags;
+	int *connectionEventPositions;
+	uint64 connectionGeneration;
 } WaitInfo;
 
 
@@ -125,10 +141,14 @@ extern bool MultiClientExecute(int32 connectionId, const char *query, void **que
 							   int *rowCount, int *columnCount);
 extern bool MultiClientSendQuery(int32 connectionId, const char *query);
 extern bool MultiClientCancel(int32 connectionId);
+extern void MultiClientCancelList(List *connectionIdList);
+extern char * MultiClientTaskSettingsCommand(int32 connectionId, int parallelWorkerCount);
+extern void MultiClientTaskSettingsSet(int32 connectionId, int parallelWorkerCount);
 extern ResultStatus MultiClientResultStatus(int32 connectionId);
 extern QueryStatus MultiClientQueryStatus(int32 connectionId);
 extern CopyStatus MultiClientCopyData(int32 connectionId, int32 fileDescriptor,
-									  uint64 *returnBytesReceived);
+									  uint64 *returnBytesReceived,
+									  uint64 *returnRowsReceived);
 extern bool MultiClientQueryResult(int32 connectionId, void **queryResult,
 								   int *rowCount, int *columnCount);
 extern BatchQueryStatus MultiClientBatchResult(int32 connectionId, void **queryResult,
@@ -23,6 +23,9 @@
 
 #define INVALID_PARTITION_COLUMN_INDEX -1
 
+/* identifies the progress monitors of COPY commands into distributed tables */
+#define COPY_PROGRESS_MAGIC_NUMBER 0x434f505950524f47
+
 
 /*
  * A smaller version of copy.c's CopyStateData, trimmed to the elements
@@ -63,6 +66,35 @@ typedef struct CopyCoercionData
 	Oid typioparam; /* inputFunction has an extra param */
 } CopyCoercionData;
 
+/*
+ * CopyConflictAction determines what happens to copied rows whose primary
+ * key already exists in the distributed table.
+ */
+typedef enum CopyConflictAction
+{
+	COPY_CONFLICT_ERROR = 0,
+	COPY_CONFLICT_DO_NOTHING = 1,
+	COPY_CONFLICT_DO_UPDATE = 2
+} CopyConflictAction;
+
+/*
+ * CopyShardProgress keeps track of the rows sent to a shard by a COPY into a
+ * distributed table. It lives in the dynamic shared memory of the progress
+ * monitor of the COPY, such that other backends can read it.
+ */
+typedef struct CopyShardProgress
+{
+	uint64 shardId;
+	uint64 rowsSent;
+	uint64 bytesSent;
+
+	/* bytes that are buffered for the shard, but not yet sent to the workers */
+	uint64 bufferedBytes;
+
+	/* number of times sending rows had to wait for a worker to catch up */
+	uint64 backPressureCount;
+} CopyShardProgress;
+
 /* CopyDestReceiver can be used to stream results into a distributed table */
 typedef struct CitusCopyDestReceiver
 {
@@ -105,15 +137,59 @@ typedef struct CitusCopyDestReceiver
 
 	/* number of tuples sent */
 	int64 tuplesSent;
+
+	/* whether shards share connections, and the bytes buffered for them */
+	bool sharedConnections;
+	int64 bufferedCopyDataBytes;
+
+	/*
+	 * Whether rows arrive as unparsed text fields, and how to parse the field
+	 * that holds the partition column.
+	 */
+	bool rawFieldInput;
+	int partitionFieldIndex;
+	FmgrInfo partitionInputFunction;
+	Oid partitionTypeIOParam;
+	int32 partitionTypeMod;
+
+	/* whether rows arrive already serialized in the format of the COPY */
+	bool serializedRowInput;
+
+	/*
+	 * Whether rows are upserted rather than inserted, the names of the primary
+	 * key columns that identify conflicting rows, and the names of the copied
+	 * columns that are updated on conflict.
+	 */
+	CopyConflictAction conflictAction;
+	List *conflictColumnList;
+	List *updateColumnList;
+
+	/* progress monitor with a step for each shard, if progress is tracked */
+	struct ProgressMonitorData *progressMonitor;
+	int progressStepsUsed;
 } CitusCopyDestReceiver;
 
 
+/* config variables managed via guc.c */
+extern bool EnableSharedCopyConnections;
+extern bool EnableCopyPassthrough;
+extern bool TrackCopyProgress;
+extern int AppendCopyShardCount;
+
+
 /* function declarations for copying into a distributed table */
 extern CitusCopyDestReceiver * CreateCitusCopyDestReceiver(Oid relationId,
 														   List *columnNameList,
 														   int partitionColumnIndex,
 														   EState *executorState,
 														   bool stopOnFailure);
+extern void CitusCopyDestReceiverReceiveRawFields(CitusCopyDestReceiver *copyDest,
+												  char **fieldArray, int fieldCount);
+extern void CitusCopyDestReceiverReceiveSerializedRow(CitusCopyDestReceiver *copyDest,
+													  int shardIndex,
+													  const char *rowData,
+													  int rowLength);
+extern void ReportNullPartitionColumn(Oid relationId);
 extern FmgrInfo * ColumnOutputFunctions(TupleDesc rowDescriptor, bool binaryFormat);
 extern bool CanUseBinaryCopyFormat(TupleDesc tupleDescription);
 extern bool CanUseBinaryCopyFormatForType(Oid typeId);
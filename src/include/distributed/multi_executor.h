@@ -10,6 +10,7 @@
 #ifndef MULTI_EXECUTOR_H
 #define MULTI_EXECUTOR_H
 
+#include "commands/copy.h"
 #include "executor/execdesc.h"
 #include "nodes/parsenodes.h"
 #include "nodes/execnodes.h"
@@ -32,6 +33,16 @@ extern TupleTableSlot * ReturnTupleFromTuplestore(CitusScanState *scanState);
 extern void LoadTuplesIntoTupleStore(CitusScanState *citusScanState, Job *workerJob);
 extern void ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc
 								   tupleDescriptor, Tuplestorestate *tupstore);
+extern CopyState BeginFileCopy(char *fileName, char *copyFormat,
+							   TupleDesc tupleDescriptor);
+#if (PG_VERSION_NUM >= 100000)
+extern void ReadCopyDataIntoTupleStore(copy_data_source_cb dataSource, char *copyFormat,
+									   TupleDesc tupleDescriptor,
+									   Tuplestorestate *tupstore);
+extern CopyState BeginDataSourceCopy(copy_data_source_cb dataSource, char *copyFormat,
+									 TupleDesc tupleDescriptor);
+#endif
+extern int64 MasterQueryRowLimit(Query *masterQuery);
 extern void ExecuteQueryStringIntoDestReceiver(const char *queryString, ParamListInfo
 											   params,
 											   DestReceiver *dest);
@@ -76,6 +76,7 @@ typedef struct JoinOrderNode
 /* Config variables managed via guc.c */
 extern int LargeTableShardCount;
 extern bool LogMultiJoinOrder;
+extern int JoinOrderSearchLimit;
 
 
 /* Function declaration for determining table join orders */
@@ -39,6 +39,18 @@
 #define HLL_UNION_AGGREGATE_NAME "hll_union_agg"
 #define HLL_CARDINALITY_FUNC_NAME "hll_cardinality"
 
+/* Definitions related to approximate top-k and percentile aggregates */
+#define TOPN_EXTENSION_NAME "topn"
+#define TOPN_UNION_AGGREGATE_NAME "topn_union_agg"
+#define TDIGEST_EXTENSION_NAME "tdigest"
+#define TDIGEST_TYPE_NAME "tdigest"
+#define TDIGEST_AGGREGATE_NAME "tdigest"
+#define TDIGEST_PERCENTILE_AGGREGATE_NAME "tdigest_percentile"
+
+/* Definitions local to the aggregates that push down combinable aggregates */
+#define WORKER_PARTIAL_AGGREGATE_NAME "worker_partial_agg"
+#define COORD_COMBINE_AGGREGATE_NAME "coord_combine_agg"
+
 
 /*
  * AggregateType represents an aggregate function's type, where the function is
@@ -66,7 +78,12 @@ typedef enum
 	AGGREGATE_BIT_OR = 12,
 	AGGREGATE_BOOL_AND = 13,
 	AGGREGATE_BOOL_OR = 14,
-	AGGREGATE_EVERY = 15
+	AGGREGATE_EVERY = 15,
+	AGGREGATE_TOPN_ADD_AGG = 16,
+	AGGREGATE_TOPN_UNION_AGG = 17,
+	AGGREGATE_TDIGEST = 18,
+	AGGREGATE_TDIGEST_PERCENTILE = 19,
+	AGGREGATE_CUSTOM_COMBINE = 20
 } AggregateType;
 
 
@@ -111,13 +128,18 @@ static const char *const AggregateNames[] = {
 	"sum", "count", "array_agg",
 	"jsonb_agg", "jsonb_object_agg",
 	"json_agg", "json_object_agg",
-	"bit_and", "bit_or", "bool_and", "bool_or", "every"
+	"bit_and", "bit_or", "bool_and", "bool_or", "every",
+	"topn_add_agg", "topn_union_agg", "tdigest", "tdigest_percentile",
+
+	/* aggregates that we push down using their combine functions have no name */
+	""
 };
 
 
 /* Config variable managed via guc.c */
 extern int LimitClauseRowFetchCount;
 extern double CountDistinctErrorRate;
+extern bool EnableRepartitionedGroupBy;
 
 
 /* Function declaration for optimizing logical plans */
@@ -19,6 +19,14 @@
 #include "nodes/plannodes.h"
 
 
+/* maximum number of task results that are merged in sort order */
+#define MAX_SORTED_MERGE_TASK_COUNT 64
+
+
+/* config variable managed via guc.c */
+extern bool EnableSortedMerge;
+
+
 /* Function declarations for building local plans on the master node */
 struct DistributedPlan;
 struct CustomScan;
@@ -35,6 +35,8 @@
 #define MERGE_COLUMN_FORMAT "merge_column_%u"
 #define MAP_OUTPUT_FETCH_COMMAND "SELECT worker_fetch_partition_file \
  (" UINT64_FORMAT ", %u, %u, %u, '%s', %u)"
+#define MAP_OUTPUT_LINK_COMMAND "SELECT worker_link_partition_file \
+ (" UINT64_FORMAT ", %u, %u, %u)"
 #define RANGE_PARTITION_COMMAND "SELECT worker_range_partition_table \
  (" UINT64_FORMAT ", %d, %s, '%s', '%s'::regtype, %s)"
 #define HASH_PARTITION_COMMAND "SELECT worker_hash_partition_table \
@@ -94,7 +96,8 @@ typedef enum
 	TASK_ASSIGNMENT_INVALID_FIRST = 0,
 	TASK_ASSIGNMENT_GREEDY = 1,
 	TASK_ASSIGNMENT_ROUND_ROBIN = 2,
-	TASK_ASSIGNMENT_FIRST_REPLICA = 3
+	TASK_ASSIGNMENT_FIRST_REPLICA = 3,
+	TASK_ASSIGNMENT_WORK_STEALING = 4
 } TaskAssignmentPolicyType;
 
 
@@ -183,6 +186,8 @@ typedef struct Task
 	List *relationShardList;
 
 	List *rowValuesLists;          /* rows to use when building multi-row INSERT */
+
+	int parallelWorkerCount;       /* suggested parallel workers, 0 if none */
 } Task;
 
 
@@ -236,6 +241,9 @@ typedef struct DistributedPlan
 	/* a router executable query is executed entirely on a worker */
 	bool routerExecutable;
 
+	/* task results are merged in the sort order of the master query */
+	bool sortedMerge;
+
 	/* which relations are accessed by this distributed plan */
 	List *relationIdList;
 
@@ -291,6 +299,11 @@ typedef struct OperatorCacheEntry
 /* Config variable managed via guc.c */
 extern int TaskAssignmentPolicy;
 extern bool EnableUniqueJobIds;
+extern bool CombineTasksPerWorker;
+extern bool CombineAggregatesPerWorker;
+extern int MaxParallelWorkersPerNode;
+extern double RepartitionJoinSamplePercent;
+extern int RepartitionTargetMergeTaskSize;
 
 
 /* Function declarations for building physical plans and constructing queries */
@@ -327,6 +340,7 @@ extern bool TaskListMember(const List *taskList, const Task *task);
 extern List * TaskListDifference(const List *list1, const List *list2);
 extern List * AssignAnchorShardTaskList(List *taskList);
 extern List * FirstReplicaAssignTaskList(List *taskList);
+extern void AssignTaskParallelWorkers(List *taskList);
 
 
 #endif   /* MULTI_PHYSICAL_PLANNER_H */
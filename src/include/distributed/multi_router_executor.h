@@ -14,11 +14,19 @@
 #include "access/sdir.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/placement_connection.h"
 #include "executor/execdesc.h"
 #include "executor/tuptable.h"
 #include "nodes/pg_list.h"
 
 
+/* number of recent router SELECT response times kept for hedging */
+#define HEDGED_READ_HISTORY_SIZE 128
+
+/* minimum number of recent response times before hedging starts */
+#define HEDGED_READ_MIN_HISTORY_SIZE 16
+
+
 /*
  * XactShardConnSet keeps track of the mapping from shard to the set of nodes
  * involved in multi-statement transaction-wrapped modifications of that shard.
@@ -34,15 +42,35 @@ typedef struct XactShardConnSet
 /* Config variables managed via guc.c */
 extern bool AllModificationsCommutative;
 extern bool EnableDeadlockPrevention;
+extern bool EnableBinaryProtocol;
+extern bool EnableResultStreaming;
+extern bool EnableCopyResultTransfer;
+extern bool SkipRemoteBeginForSelects;
+extern int HedgedReadPercentile;
 
 extern void CitusModifyBeginScan(CustomScanState *node, EState *estate, int eflags);
 extern TupleTableSlot * RouterSequentialModifyExecScan(CustomScanState *node);
+extern void PruneDeferredRouterSelect(CitusScanState *scanState);
+extern void ResolveReadPlacementNodes(CitusScanState *scanState);
+extern void RouterSelectBeginScan(CustomScanState *node, EState *estate, int eflags);
 extern TupleTableSlot * RouterSelectExecScan(CustomScanState *node);
+extern void RouterSelectEndScan(CustomScanState *node);
+extern void RouterMultiModifyBeginScan(CustomScanState *node, EState *estate,
+									   int eflags);
 extern TupleTableSlot * RouterMultiModifyExecScan(CustomScanState *node);
+extern void RouterMultiModifyEndScan(CustomScanState *node);
 
 extern int64 ExecuteModifyTasksWithoutResults(List *taskList);
 extern void ExecuteTasksSequentiallyWithoutResults(List *taskList);
+extern void ExecuteBatchedModifyTasksWithoutResults(List *taskList);
 
 extern List * BuildPlacementSelectList(uint32 groupId, List *relationShardList);
+extern ShardPlacementAccess * CreatePlacementAccess(ShardPlacement *placement,
+													ShardPlacementAccessType accessType);
+extern void AcquireExecutorShardLock(Task *task, CmdType commandType);
+extern void AcquireExecutorMultiShardLocks(List *taskList);
+extern void ExtractParametersFromParamListInfo(ParamListInfo paramListInfo,
+											   Oid **parameterTypes,
+											   const char ***parameterValues);
 
 #endif /* MULTI_ROUTER_EXECUTOR_H_ */
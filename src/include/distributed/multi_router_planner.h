@@ -39,6 +39,7 @@ extern DeferredErrorMessage * PlanRouterQuery(Query *originalQuery,
 											  replacePrunedQueryWithDummy,
 											  bool *multiShardModifyQuery);
 extern List * RouterInsertTaskList(Query *query, DeferredErrorMessage **planningError);
+extern List * FastPathRouterTaskList(Query *query, DeferredErrorMessage **planningError);
 extern List * TargetShardIntervalsForQuery(Query *query,
 										   RelationRestrictionContext *restrictionContext,
 										   bool *multiShardQuery);
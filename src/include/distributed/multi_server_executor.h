@@ -32,8 +32,11 @@
 /* Task tracker executor related defines */
 #define TASK_ASSIGNMENT_QUERY "SELECT task_tracker_assign_task \
  ("UINT64_FORMAT ", %u, %s);"
-#define TASK_STATUS_QUERY "SELECT task_tracker_task_status("UINT64_FORMAT ", %u);"
+#define JOB_STATUS_QUERY "SELECT task_id, task_status FROM \
+ task_tracker_job_status("UINT64_FORMAT ") ORDER BY task_id;"
 #define JOB_CLEANUP_QUERY "SELECT task_tracker_cleanup_job("UINT64_FORMAT ")"
+#define TASK_STATUS_LISTEN_COMMAND "LISTEN citus_task_status"
+#define TASK_STATUS_NOTIFY_COMMAND "NOTIFY citus_task_status, '"UINT64_FORMAT "'"
 #define JOB_CLEANUP_TASK_ID INT_MAX
 
 
@@ -59,7 +62,10 @@ typedef enum
 
 	/* transactional operations */
 	EXEC_BEGIN_START = 20,
-	EXEC_BEGIN_RUNNING = 21
+	EXEC_BEGIN_RUNNING = 21,
+
+	/* applying statement_timeout and parallel workers before the task */
+	EXEC_SET_TASK_SETTINGS_RUNNING = 30
 } TaskExecStatus;
 
 
@@ -94,7 +100,8 @@ typedef enum
 	MULTI_EXECUTOR_REAL_TIME = 1,
 	MULTI_EXECUTOR_TASK_TRACKER = 2,
 	MULTI_EXECUTOR_ROUTER = 3,
-	MULTI_EXECUTOR_COORDINATOR_INSERT_SELECT = 4
+	MULTI_EXECUTOR_COORDINATOR_INSERT_SELECT = 4,
+	MULTI_EXECUTOR_ADAPTIVE = 5
 } MultiExecutorType;
 
 
@@ -113,10 +120,16 @@ typedef enum
  * totalIntermediateResultSize is a counter to keep the size
  * of the intermediate results of complex subqueries and CTEs
  * so that we can put a limit on the size.
+ *
+ * completedTaskRowCount counts the rows returned by completed
+ * tasks, such that the real-time executor can stop once it
+ * has enough rows for a LIMIT.
  */
 typedef struct DistributedExecutionStats
 {
 	uint64 totalIntermediateResultSize;
+	uint64 completedTaskRowCount;
+	uint64 totalBytesReceived;
 } DistributedExecutionStats;
 
 
@@ -137,11 +150,25 @@ struct TaskExecution
 	int32 *connectionIdArray;
 	int32 *fileDescriptorArray;
 	TimestampTz connectStartTime;
+	TimestampTz queryStartTime;  /* only set for EXPLAIN ANALYZE */
+	uint64 bytesReceived;
 	uint32 nodeCount;
 	uint32 currentNodeIndex;
 	uint32 querySourceNodeIndex; /* only applies to map fetch tasks */
+	int32 pushedNodeIndex;       /* map fetch tasks whose partition was pushed */
+	List *bloomFilterTaskList;   /* map tasks whose bloom filters we probe */
+	char *partitionCommand;      /* only applies to map tasks probing filters */
 	uint32 failureCount;
 	bool criticalErrorOccurred;
+
+	/* only apply to map tasks of the task tracker executor */
+	TimestampTz queueTime;        /* when the task was queued on its node */
+	double executionTime;         /* in ms once the task is done, -1 before */
+	int32 speculativeNodeIndex;   /* node running a speculative copy, or -1 */
+	bool speculativeCopyStarted;
+
+	/* map fetch tasks wait until their merge task is placed near its input */
+	bool awaitingPlacement;
 };
 
 
@@ -181,18 +208,23 @@ typedef struct TaskTracker
 	bool connectionBusy;
 	TrackerTaskState *connectionBusyOnTask;
 	List *connectionBusyOnTaskList;
+	TimestampTz statusCheckTime;    /* when task statuses were last checked */
+	bool taskCompletionNotified;    /* tracker notified us of a completed task */
 } TaskTracker;
 
 
 /*
  * WorkerNodeState keeps state for a worker node. The real-time executor uses this to
- * keep track of the number of open connections to a worker node.
+ * keep track of the number of open connections to a worker node, and of the time
+ * tasks took to complete on that node.
  */
 typedef struct WorkerNodeState
 {
 	uint32 workerPort;
 	char workerName[WORKER_LENGTH];
 	uint32 openConnectionCount;
+	uint32 completedTaskCount;
+	double averageTaskTime;     /* moving average of task durations in ms */
 } WorkerNodeState;
 
 
@@ -201,12 +233,19 @@ extern int RemoteTaskCheckInterval;
 extern int MaxAssignTaskBatchSize;
 extern int TaskExecutorType;
 extern bool EnableRepartitionJoins;
+extern bool EnableExecutorSelection;
+extern bool EnableRepartitionPush;
+extern int RepartitionBloomFilterSize;
+extern double SpeculativeMapTaskFactor;
+extern bool EnableLocalityAwareMerge;
+extern bool EnableRepartitionCache;
 extern bool BinaryMasterCopyFormat;
+extern bool PropagateStatementTimeout;
 extern int MultiTaskQueryLogLevel;
 
 
 /* Function declarations for distributed execution */
-extern void MultiRealTimeExecute(Job *job);
+extern void MultiRealTimeExecute(Job *job, int64 taskRowLimit);
 extern void MultiTaskTrackerExecute(Job *job);
 
 /* Function declarations common to more than one executor */
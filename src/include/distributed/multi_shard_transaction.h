@@ -14,6 +14,7 @@
 
 
 #include "utils/hsearch.h"
+#include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
 
 
@@ -24,9 +25,29 @@ typedef struct ShardConnections
 
 	/* list of MultiConnection structs */
 	List *connectionList;
+
+	/* COPY data that is buffered before being sent to all connections */
+	StringInfo copyDataBuffer;
+
+	/* state for copying into the placement on the local node, if not NULL */
+	struct LocalShardCopy *localShardCopy;
+
+	/* progress of the COPY into the shard, if progress is tracked */
+	struct CopyShardProgress *copyProgress;
 } ShardConnections;
 
 
+/*
+ * ConnectionCommandBatch collects the commands that are sent over a single
+ * connection as one multi-statement command.
+ */
+typedef struct ConnectionCommandBatch
+{
+	struct MultiConnection *connection;
+	StringInfo commandString;
+} ConnectionCommandBatch;
+
+
 extern HTAB * OpenTransactionsForAllTasks(List *taskList, int connectionFlags);
 extern HTAB * CreateShardConnectionHash(MemoryContext memoryContext);
 extern ShardConnections * GetShardHashConnections(HTAB *connectionHash, int64 shardId,
@@ -34,6 +55,10 @@ extern ShardConnections * GetShardHashConnections(HTAB *connectionHash, int64 sh
 extern List * ShardConnectionList(HTAB *connectionHash);
 extern void ResetShardPlacementTransactionState(void);
 extern void UnclaimAllShardConnections(HTAB *shardConnectionHash);
+extern void AppendConnectionCommand(List **commandBatchList,
+									struct MultiConnection *connection,
+									const char *command);
+extern void ExecuteConnectionCommandBatches(List *commandBatchList);
 
 
 #endif /* MULTI_SHARD_TRANSACTION_H */
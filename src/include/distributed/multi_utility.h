@@ -13,6 +13,11 @@
 #include "tcop/utility.h"
 
 extern bool EnableDDLPropagation;
+extern int MaxDDLPoolSize;
+extern int MaxVacuumPoolSize;
+extern int VacuumCostDelay;
+extern bool UpdateShardStatisticsOnAnalyze;
+extern bool ParallelForeignKeyValidation;
 extern bool EnableVersionChecks;
 
 /*
@@ -27,6 +32,10 @@ typedef struct DDLJob
 	bool concurrentIndexCmd;   /* related to a CONCURRENTLY index command? */
 	const char *commandString; /* initial (coordinator) DDL command string */
 	List *taskList;            /* worker DDL tasks to execute */
+
+	/* foreign key to add as NOT VALID and validate afterwards, if any */
+	char *foreignConstraintName;
+	Oid referencedRelationId;
 } DDLJob;
 
 #if (PG_VERSION_NUM < 100000)
@@ -0,0 +1,84 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_fanout.h
+ *	  Type and function declarations for running lists of commands on many
+ *	  nodes at once, with a bounded number of nodes in progress.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef NODE_FANOUT_H
+#define NODE_FANOUT_H
+
+#include "distributed/connection_management.h"
+#include "nodes/pg_list.h"
+
+
+struct pg_result; /* target of the PGresult typedef */
+
+
+/* Config variables managed via guc.c */
+extern int MaxNodeCommandConcurrency;
+
+
+/* NodeCommandState represents the progress of the commands on a node */
+typedef enum NodeCommandState
+{
+	NODE_COMMAND_PENDING,
+	NODE_COMMAND_CONNECTING,
+	NODE_COMMAND_BEGINNING,
+	NODE_COMMAND_RUNNING,
+	NODE_COMMAND_FINISHED
+} NodeCommandState;
+
+
+/*
+ * NodeCommandList holds the commands to run on a single node during a fan-out,
+ * and tracks their progress. The commands run in order over one connection;
+ * the next command is sent as soon as the result of the previous one arrived,
+ * and no further commands are sent after a command failed. The parameters, if
+ * any, are used for all commands.
+ */
+typedef struct NodeCommandList
+{
+	char *nodeName;
+	int32 nodePort;
+	List *commandList;
+	int parameterCount;
+	const Oid *parameterTypes;
+	const char *const *parameterValues;
+
+	/* position of the node in the fan-out */
+	int nodeIndex;
+
+	/* execution state, pollMode tells whether the socket should become writable */
+	NodeCommandState state;
+	MultiConnection *connection;
+	int pollMode;
+	bool connectionEstablished;
+	int commandIndex;
+	bool success;
+} NodeCommandList;
+
+
+/*
+ * NodeCommandResultCallback is called for every result of a command as soon
+ * as it arrives, and with a NULL result if the connection to the node failed.
+ * The connection of the node is valid during the call.
+ */
+typedef void (*NodeCommandResultCallback)(NodeCommandList *nodeCommandList,
+										  struct pg_result *result,
+										  void *callbackContext);
+
+
+extern NodeCommandList * MakeNodeCommandList(char *nodeName, int32 nodePort,
+											 List *commandList);
+extern void ExecuteNodeCommandLists(List *nodeCommandListList, uint32 connectionFlags,
+									char *userName, bool useTransaction,
+									NodeCommandResultCallback resultCallback,
+									void *callbackContext);
+
+
+#endif /* NODE_FANOUT_H */
@@ -0,0 +1,32 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_health.h
+ *   Tracking of worker nodes that could not be connected to, shared across
+ *   the backends of the coordinator.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef NODE_HEALTH_H
+#define NODE_HEALTH_H
+
+#include "distributed/connection_management.h"
+
+
+/* Config variables managed via guc.c */
+extern int UnreachableNodeRetryInterval;
+extern int NodeHealthCheckInterval;
+
+
+extern void InitializeNodeHealth(void);
+extern bool NodeHealthTrackingEnabled(void);
+extern bool NodeIsKnownUnreachable(const char *hostname, int port);
+extern int NodeConnectionFailureCount(const char *hostname, int port);
+extern void RecordConnectionEstablishmentResult(MultiConnection *connection);
+extern void RecordConnectionEstablishmentFailure(MultiConnection *connection);
+extern int ProbeUnreachableNodes(void);
+
+
+#endif /* NODE_HEALTH_H */
@@ -0,0 +1,35 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_copy_to.h
+ *   Function declarations for exporting distributed tables by running
+ *   COPY ... TO STDOUT on all shards concurrently.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARALLEL_COPY_TO_H
+#define PARALLEL_COPY_TO_H
+
+#include "nodes/parsenodes.h"
+
+
+/* order in which the rows of the shards are sent to the client */
+typedef enum
+{
+	PARALLEL_COPY_TO_OFF = 0,
+	PARALLEL_COPY_TO_SHARD_ORDER = 1,
+	PARALLEL_COPY_TO_INTERLEAVED = 2
+} ParallelCopyToMode;
+
+
+/* config variables */
+extern int ParallelCopyTo;
+
+
+extern bool CanParallelCopyTo(CopyStmt *copyStatement);
+extern void CitusCopyTo(CopyStmt *copyStatement, char *completionTag);
+
+
+#endif /* PARALLEL_COPY_TO_H */
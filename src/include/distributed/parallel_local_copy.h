@@ -0,0 +1,31 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_local_copy.h
+ *   Function declarations for copying the data of a local table into the
+ *   shards of the distributed table using parallel workers.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARALLEL_LOCAL_COPY_H
+#define PARALLEL_LOCAL_COPY_H
+
+#include "distributed/multi_copy.h"
+#include "storage/dsm.h"
+#include "storage/shm_toc.h"
+#include "utils/relcache.h"
+
+
+/* config variable for the number of workers that read the local table */
+extern int ParallelLocalCopyWorkers;
+
+
+extern bool ParallelCopyLocalDataIntoShards(Relation distributedRelation,
+											CitusCopyDestReceiver *copyDest,
+											uint64 *rowsCopied);
+extern void ParallelLocalCopyWorkerMain(dsm_segment *segment, shm_toc *toc);
+
+
+#endif /* PARALLEL_LOCAL_COPY_H */
@@ -0,0 +1,33 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_cache.h
+ *   Function declarations for reusing the partition files of map tasks that
+ *   read unmodified shards.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARTITION_CACHE_H
+#define PARTITION_CACHE_H
+
+#include "fmgr.h"
+
+
+/* directory in the job cache that holds the cached partition files */
+#define PARTITION_CACHE_DIRECTORY "partition_cache"
+
+/* wraps a partition command; the version identifies the contents of the shard */
+#define CACHED_PARTITION_COMMAND "SELECT worker_cached_partition_table \
+ (" UINT64_FORMAT ", %u, %s, %s)"
+
+
+/* config variable managed via guc.c */
+extern int MaxRepartitionCacheEntries;
+
+
+extern Datum worker_cached_partition_table(PG_FUNCTION_ARGS);
+
+
+#endif /* PARTITION_CACHE_H */
@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_pruning.h
+ *	  Replacing references to distributed partitioned tables by their only
+ *	  partition that can have matching rows.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARTITION_PRUNING_H
+#define PARTITION_PRUNING_H
+
+
+#include "nodes/parsenodes.h"
+
+
+/* Config variable managed via guc.c */
+extern bool EnablePartitionPruning;
+
+
+extern void ReplacePartitionedTablesWithPrunedPartitions(Query *query);
+
+
+#endif /* PARTITION_PRUNING_H */
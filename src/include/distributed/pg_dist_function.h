@@ -0,0 +1,43 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_dist_function.h
+ *	  definition of the relation that holds the functions whose calls are
+ *	  delegated to the node of their distribution argument (pg_dist_function).
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PG_DIST_FUNCTION_H
+#define PG_DIST_FUNCTION_H
+
+/* ----------------
+ *		pg_dist_function definition.
+ * ----------------
+ */
+typedef struct FormData_pg_dist_function
+{
+	Oid funcid;
+	int32 distribution_argument_index;
+	uint32 colocationid;
+} FormData_pg_dist_function;
+
+/* ----------------
+ *      Form_pg_dist_function corresponds to a pointer to a tuple with
+ *      the format of pg_dist_function relation.
+ * ----------------
+ */
+typedef FormData_pg_dist_function *Form_pg_dist_function;
+
+/* ----------------
+ *      compiler constants for pg_dist_function
+ * ----------------
+ */
+#define Natts_pg_dist_function 3
+#define Anum_pg_dist_function_funcid 1
+#define Anum_pg_dist_function_distribution_argument_index 2
+#define Anum_pg_dist_function_colocationid 3
+
+
+#endif /* PG_DIST_FUNCTION_H */
@@ -0,0 +1,43 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_dist_retention_policy.h
+ *	  definition of the relation that holds how long the shards of
+ *	  time-partitioned tables are kept (pg_dist_retention_policy).
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PG_DIST_RETENTION_POLICY_H
+#define PG_DIST_RETENTION_POLICY_H
+
+#include "datatype/timestamp.h"
+
+/* ----------------
+ *		pg_dist_retention_policy definition.
+ * ----------------
+ */
+typedef struct FormData_pg_dist_retention_policy
+{
+	Oid logicalrelid;         /* logical relation id; references pg_class oid */
+	Interval retentionperiod; /* age after which shards are dropped */
+} FormData_pg_dist_retention_policy;
+
+/* ----------------
+ *      Form_pg_dist_retention_policy corresponds to a pointer to a tuple with
+ *      the format of pg_dist_retention_policy relation.
+ * ----------------
+ */
+typedef FormData_pg_dist_retention_policy *Form_pg_dist_retention_policy;
+
+/* ----------------
+ *      compiler constants for pg_dist_retention_policy
+ * ----------------
+ */
+#define Natts_pg_dist_retention_policy 2
+#define Anum_pg_dist_retention_policy_logicalrelid 1
+#define Anum_pg_dist_retention_policy_retentionperiod 2
+
+
+#endif /* PG_DIST_RETENTION_POLICY_H */
@@ -0,0 +1,49 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_dist_rollup.h
+ *	  definition of the relation that holds the incrementally maintained
+ *	  rollup tables and how far they have been aggregated (pg_dist_rollup).
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PG_DIST_ROLLUP_H
+#define PG_DIST_ROLLUP_H
+
+/* ----------------
+ *		pg_dist_rollup definition.
+ * ----------------
+ */
+typedef struct FormData_pg_dist_rollup
+{
+	Oid rollupid;           /* rollup relation id; references pg_class oid */
+	Oid sourceid;           /* aggregated relation id; references pg_class oid */
+	Oid sequenceid;         /* sequence of the source relation's sequence column */
+	int64 lastaggregatedid; /* last sequence value that was aggregated */
+#ifdef CATALOG_VARLEN           /* variable-length fields start here */
+	text aggregatequery;    /* INSERT ... SELECT that aggregates a window */
+#endif
+} FormData_pg_dist_rollup;
+
+/* ----------------
+ *      Form_pg_dist_rollup corresponds to a pointer to a tuple with
+ *      the format of pg_dist_rollup relation.
+ * ----------------
+ */
+typedef FormData_pg_dist_rollup *Form_pg_dist_rollup;
+
+/* ----------------
+ *      compiler constants for pg_dist_rollup
+ * ----------------
+ */
+#define Natts_pg_dist_rollup 5
+#define Anum_pg_dist_rollup_rollupid 1
+#define Anum_pg_dist_rollup_sourceid 2
+#define Anum_pg_dist_rollup_sequenceid 3
+#define Anum_pg_dist_rollup_lastaggregatedid 4
+#define Anum_pg_dist_rollup_aggregatequery 5
+
+
+#endif /* PG_DIST_ROLLUP_H */
@@ -52,12 +52,13 @@ typedef FormData_pg_dist_shard *Form_pg_dist_shard;
 #define Anum_pg_dist_shard_shardmaxvalue 6
 
 /*
- * Valid values for shard storage types include foreign table, (standard) table
- * and columnar table.
+ * Valid values for shard storage types include foreign table, (standard) table,
+ * columnar table, and (standard) table in cold storage.
  */
 #define SHARD_STORAGE_FOREIGN 'f'
 #define SHARD_STORAGE_TABLE 't'
 #define SHARD_STORAGE_COLUMNAR 'c'
+#define SHARD_STORAGE_COLD 'a'
 
 
 #endif   /* PG_DIST_SHARD_H */
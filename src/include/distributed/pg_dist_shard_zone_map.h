@@ -0,0 +1,55 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_dist_shard_zone_map.h
+ *	  definition of the relation that holds summaries of the values of
+ *	  non-distribution columns in each shard (pg_dist_shard_zone_map).
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PG_DIST_SHARD_ZONE_MAP_H
+#define PG_DIST_SHARD_ZONE_MAP_H
+
+/* ----------------
+ *		pg_dist_shard_zone_map definition.
+ * ----------------
+ */
+typedef struct FormData_pg_dist_shard_zone_map
+{
+	Oid logicalrelid;         /* logical relation id; references pg_class oid */
+	int64 shardid;            /* shard the zone map summarizes */
+	int16 attnum;             /* column of the logical relation */
+	Oid atttypid;             /* type of the column when the zone map was built */
+	int32 bloomfiltersize;    /* size of the bloom filter in bytes, 0 if none */
+#ifdef CATALOG_VARLEN           /* variable-length fields start here */
+	text minvalue;            /* column's minimum value in shard */
+	text maxvalue;            /* column's maximum value in shard */
+	bytea bloomfilter;        /* bloom filter over the hashes of the values */
+#endif
+} FormData_pg_dist_shard_zone_map;
+
+/* ----------------
+ *      Form_pg_dist_shard_zone_map corresponds to a pointer to a tuple with
+ *      the format of pg_dist_shard_zone_map relation.
+ * ----------------
+ */
+typedef FormData_pg_dist_shard_zone_map *Form_pg_dist_shard_zone_map;
+
+/* ----------------
+ *      compiler constants for pg_dist_shard_zone_map
+ * ----------------
+ */
+#define Natts_pg_dist_shard_zone_map 8
+#define Anum_pg_dist_shard_zone_map_logicalrelid 1
+#define Anum_pg_dist_shard_zone_map_shardid 2
+#define Anum_pg_dist_shard_zone_map_attnum 3
+#define Anum_pg_dist_shard_zone_map_atttypid 4
+#define Anum_pg_dist_shard_zone_map_bloomfiltersize 5
+#define Anum_pg_dist_shard_zone_map_minvalue 6
+#define Anum_pg_dist_shard_zone_map_maxvalue 7
+#define Anum_pg_dist_shard_zone_map_bloomfilter 8
+
+
+#endif /* PG_DIST_SHARD_ZONE_MAP_H */
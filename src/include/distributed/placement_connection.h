@@ -53,6 +53,18 @@ extern MultiConnection * StartPlacementListConnection(uint32 flags,
 													  List *placementAccessList,
 													  const char *userName);
 
+extern MultiConnection * GetConnectionIfPlacementAccessedInXact(int flags,
+																List *placementAccessList,
+																const char *userName);
+extern void RecordPlacementListAccess(List *placementAccessList,
+									  MultiConnection *connection,
+									  const char *userName);
+extern bool PlacementAccessedInXact(struct ShardPlacement *placement);
+extern bool CanReadPlacementListLocally(List *placementAccessList);
+extern void RecordPlacementListLocalAccess(List *placementAccessList);
+extern bool CanModifyPlacementLocally(struct ShardPlacement *placement);
+extern void RecordPlacementLocalModification(struct ShardPlacement *placement);
+
 extern void ResetPlacementConnectionManagement(void);
 extern void MarkFailedShardPlacements(void);
 extern void PostCommitMarkFailedShardPlacements(bool using2PC);
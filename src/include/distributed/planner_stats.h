@@ -0,0 +1,42 @@
+/*-------------------------------------------------------------------------
+ *
+ * planner_stats.h
+ *   Function declarations for tracking how often each stage of distributed
+ *   planning runs and how much time it takes.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PLANNER_STATS_H
+#define PLANNER_STATS_H
+
+
+/* stages of distributed planning for which calls and time are tracked */
+typedef enum PlannerStage
+{
+	PLANNER_STAGE_DISTRIBUTED_PLAN = 0,
+	PLANNER_STAGE_FAST_PATH = 1,
+	PLANNER_STAGE_ROUTER = 2,
+	PLANNER_STAGE_LOGICAL = 3,
+	PLANNER_STAGE_RECURSIVE = 4,
+	PLANNER_STAGE_SHARD_PRUNING = 5,
+	PLANNER_STAGE_DEPARSE = 6
+} PlannerStage;
+
+#define PLANNER_STAGE_COUNT 7
+
+
+/* config variable */
+extern bool TrackPlannerStats;
+
+
+extern void InitializePlannerStats(void);
+extern void PlannerStatsStart(PlannerStage stage);
+extern void PlannerStatsEnd(PlannerStage stage);
+extern void RecordDistributedPlanExecution(uint64 planId);
+extern void ResetPlannerStatsState(void);
+
+
+#endif /* PLANNER_STATS_H */
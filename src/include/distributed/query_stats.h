@@ -0,0 +1,47 @@
+/*-------------------------------------------------------------------------
+ *
+ * query_stats.h
+ *   Function declarations for tracking execution statistics of distributed
+ *   queries in citus_stat_statements.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include "distributed/citus_custom_scan.h"
+
+
+/* maximum length of the query text kept for each statement */
+#define QUERY_STATS_TEXT_LENGTH 1024
+
+
+/* which distributed queries are tracked in citus_stat_statements */
+typedef enum
+{
+	STAT_STATEMENTS_TRACK_NONE = 0,
+	STAT_STATEMENTS_TRACK_ALL = 1
+} StatStatementsTrackType;
+
+
+/* config variables */
+extern int StatStatementsMax;
+extern int StatStatementsTrack;
+
+extern int ExecutorNestingLevel;
+
+
+extern void InitializeCitusQueryStats(void);
+extern void QueryStatsRecordPlanningTime(double planningTime);
+extern void QueryStatsRemoteExecutionStart(CitusScanState *scanState);
+extern void QueryStatsRemoteExecutionEnd(void);
+extern void QueryStatsSubPlanExecutionStart(void);
+extern void QueryStatsSubPlanExecutionEnd(void);
+extern void QueryStatsAddBytesReceived(uint64 byteCount);
+extern void QueryStatsAddIntermediateResultBytes(uint64 byteCount);
+
+
+#endif /* QUERY_STATS_H */
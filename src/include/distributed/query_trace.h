@@ -0,0 +1,56 @@
+/*-------------------------------------------------------------------------
+ *
+ * query_trace.h
+ *   Function declarations for recording timestamped events of sampled
+ *   distributed queries in a shared ring buffer.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef QUERY_TRACE_H
+#define QUERY_TRACE_H
+
+
+/* kinds of events in a query trace */
+typedef enum QueryTraceEventType
+{
+	QUERY_TRACE_PLAN = 0,
+	QUERY_TRACE_SUBPLANS = 1,
+	QUERY_TRACE_REMOTE_EXECUTION = 2,
+	QUERY_TRACE_CONNECTION_ACQUIRED = 3,
+	QUERY_TRACE_QUERY_SENT = 4,
+	QUERY_TRACE_FIRST_ROW = 5,
+	QUERY_TRACE_LAST_ROW = 6,
+	QUERY_TRACE_PREPARE = 7,
+	QUERY_TRACE_COMMIT = 8,
+	QUERY_TRACE_ABORT = 9
+} QueryTraceEventType;
+
+#define QUERY_TRACE_EVENT_TYPE_COUNT 10
+
+/* phases of an event, as in the chrome://tracing format */
+#define QUERY_TRACE_BEGIN 'B'
+#define QUERY_TRACE_END 'E'
+#define QUERY_TRACE_INSTANT 'i'
+
+
+/* config variables */
+extern double QueryTraceSampleRate;
+extern int QueryTraceBufferSize;
+
+
+extern void InitializeQueryTrace(void);
+extern void QueryTraceStatementStart(bool planned);
+extern void RecordQueryTraceEvent(QueryTraceEventType eventType, char phase,
+								  const char *label, int64 detail);
+extern void RecordQueryTraceNodeEvent(QueryTraceEventType eventType,
+									  const char *hostname, int port, int64 detail);
+extern void QueryTraceRemoteExecutionStart(void);
+extern void QueryTraceRemoteExecutionEnd(void);
+extern void QueryTraceRowReceived(void);
+extern void ResetQueryTraceState(void);
+
+
+#endif /* QUERY_TRACE_H */
@@ -18,10 +18,19 @@
 #include "nodes/relation.h"
 
 
+/* Config variables managed via guc.c */
+extern int BroadcastJoinThreshold;
+extern int SemiJoinReductionThreshold;
+extern bool EnableSubPlanFilterPushdown;
+extern bool EnableLocalTableJoins;
+extern bool EnableCTEInlining;
+
+
 extern List * GenerateSubplansForSubqueriesAndCTEs(uint64 planId, Query *originalQuery,
 												   PlannerRestrictionContext *
 												   plannerRestrictionContext);
 extern char * GenerateResultId(uint64 planId, uint32 subPlanId);
+extern void RecursivelyInlineCtesInQueryTree(Query *query);
 
 
 #endif /* RECURSIVE_PLANNING_H */
@@ -12,6 +12,9 @@
 #ifndef REFERENCE_TABLE_UTILS_H_
 #define REFERENCE_TABLE_UTILS_H_
 
+/* config variable managed via guc.c */
+extern int MaxConcurrentReferenceTableCopies;
+
 extern uint32 CreateReferenceTableColocationId(void);
 extern void ReplicateAllReferenceTablesToNode(char *nodeName, int nodePort);
 extern void DeleteAllReferenceTablePlacementsFromNodeGroup(uint32 groupId);
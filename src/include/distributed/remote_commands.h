@@ -22,6 +22,9 @@ struct pg_result; /* target of the PGresult typedef */
 /* GUC, determining whether statements sent to remote nodes are logged */
 extern bool LogRemoteCommands;
 
+/* GUC, maximum number of statements prepared on a remote connection */
+extern int MaxPreparedStatementsPerConnection;
+
 
 /* simple helpers */
 extern bool IsResponseOK(struct pg_result *result);
@@ -40,19 +43,31 @@ extern void LogRemoteCommand(MultiConnection *connection, const char *command);
 /* wrappers around libpq functions, with command logging support */
 extern void ExecuteCriticalRemoteCommand(MultiConnection *connection,
 										 const char *command);
+extern void FinishCriticalRemoteCommand(MultiConnection *connection);
 extern int ExecuteOptionalRemoteCommand(MultiConnection *connection,
 										const char *command,
 										struct pg_result **result);
 extern int SendRemoteCommand(MultiConnection *connection, const char *command);
 extern int SendRemoteCommandParams(MultiConnection *connection, const char *command,
 								   int parameterCount, const Oid *parameterTypes,
-								   const char *const *parameterValues);
+								   const char *const *parameterValues,
+								   bool binaryResults);
+extern int SendRemoteCommandPrepared(MultiConnection *connection, const char *command,
+									 int parameterCount, const Oid *parameterTypes,
+									 const char *const *parameterValues,
+									 bool binaryResults);
+extern void InvalidatePreparedStatements(void);
+extern void ResetPreparedStatements(MultiConnection *connection);
+extern char * ParallelWorkersCommand(MultiConnection *connection,
+									 int parallelWorkerCount);
 extern List * ReadFirstColumnAsText(struct pg_result *queryResult);
 extern struct pg_result * GetRemoteCommandResult(MultiConnection *connection,
 												 bool raiseInterrupts);
 extern bool PutRemoteCopyData(MultiConnection *connection, const char *buffer,
 							  int nbytes);
 extern bool PutRemoteCopyEnd(MultiConnection *connection, const char *errormsg);
+extern int GetRemoteCopyData(MultiConnection *connection, char **buffer,
+							 bool raiseInterrupts);
 
 /* waiting for multiple command results */
 extern void WaitForAllConnections(List *connectionList, bool raiseInterrupts);
@@ -68,17 +68,33 @@ typedef struct RemoteTransaction
 	 */
 	SubTransactionId lastSuccessfulSubXact;
 
-	/* Id of last savepoint queued before first query of transaction */
+	/*
+	 * Id of last savepoint sent to the remote transaction. Without lazy savepoint
+	 * propagation, savepoints are sent to all connections as they begin.
+	 */
 	SubTransactionId lastQueuedSubXact;
 
+	/* begin commands were sent along with a query, results not yet read */
+	bool transactionPipelined;
+
+	/* number of statements sent to begin the transaction */
+	int beginCommandCount;
+
 	/* waiting for the result of a recovering ROLLBACK TO SAVEPOINT command */
 	bool transactionRecovering;
 
 	/* 2PC transaction name currently associated with connection */
 	char preparedName[NAMEDATALEN];
+
+	/* 2PC transaction was recorded in pg_dist_transaction */
+	bool transactionLogged;
 } RemoteTransaction;
 
 
+/* GUC, sending savepoints only to connections used within them */
+extern bool LazySavepointPropagation;
+
+
 /* utility functions for dealing with remote transactions */
 extern bool ParsePreparedTransactionName(char *preparedTransactionName, int *groupId,
 										 int *procId, uint64 *transactionNumber,
@@ -88,6 +104,8 @@ extern bool ParsePreparedTransactionName(char *preparedTransactionName, int *gro
 extern void StartRemoteTransactionBegin(struct MultiConnection *connection);
 extern void FinishRemoteTransactionBegin(struct MultiConnection *connection);
 extern void RemoteTransactionBegin(struct MultiConnection *connection);
+extern char * RemoteTransactionBeginCommand(struct MultiConnection *connection);
+extern bool FinishPipelinedRemoteTransactionBegin(struct MultiConnection *connection);
 extern void RemoteTransactionListBegin(List *connectionList);
 
 extern void StartRemoteTransactionPrepare(struct MultiConnection *connection);
@@ -105,6 +123,7 @@ extern void RemoteTransactionAbort(struct MultiConnection *connection);
 /* start transaction if necessary */
 extern void RemoteTransactionBeginIfNecessary(struct MultiConnection *connection);
 extern void RemoteTransactionsBeginIfNecessary(List *connectionList);
+extern bool RemoteTransactionNeedsBegin(struct MultiConnection *connection);
 
 /* other public functionality */
 extern void MarkRemoteTransactionFailed(struct MultiConnection *connection,
@@ -123,6 +142,7 @@ extern void ResetRemoteTransaction(struct MultiConnection *connection);
 /* perform handling for all in-progress transactions */
 extern void CoordinatedRemoteTransactionsPrepare(void);
 extern void CoordinatedRemoteTransactionsCommit(void);
+extern void CoordinatedRemoteTransactionsCommitOnePhase(void);
 extern void CoordinatedRemoteTransactionsAbort(void);
 
 /* remote savepoint commands */
@@ -34,7 +34,8 @@ typedef enum AdvisoryLocktagClass
 	/* Citus lock types */
 	ADV_LOCKTAG_CLASS_CITUS_SHARD_METADATA = 4,
 	ADV_LOCKTAG_CLASS_CITUS_SHARD = 5,
-	ADV_LOCKTAG_CLASS_CITUS_JOB = 6
+	ADV_LOCKTAG_CLASS_CITUS_JOB = 6,
+	ADV_LOCKTAG_CLASS_CITUS_TABLE_SHARDS = 7
 } AdvisoryLocktagClass;
 
 
@@ -62,6 +63,14 @@ typedef enum AdvisoryLocktagClass
 						 (uint32) (jobid), \
 						 ADV_LOCKTAG_CLASS_CITUS_JOB)
 
+/* reuse advisory lock, but with different, unused field 4 (7) */
+#define SET_LOCKTAG_TABLE_SHARDS_RESOURCE(tag, db, relationid) \
+	SET_LOCKTAG_ADVISORY(tag, \
+						 db, \
+						 0, \
+						 (uint32) (relationid), \
+						 ADV_LOCKTAG_CLASS_CITUS_TABLE_SHARDS)
+
 
 /* Lock shard/relation metadata for safe modifications */
 extern void LockShardDistributionMetadata(int64 shardId, LOCKMODE lockMode);
@@ -69,6 +78,7 @@ extern bool TryLockShardDistributionMetadata(int64 shardId, LOCKMODE lockMode);
 
 /* Lock shard data, for DML commands or remote fetches */
 extern void LockShardResource(uint64 shardId, LOCKMODE lockmode);
+extern bool TryLockShardResource(uint64 shardId, LOCKMODE lockmode);
 extern void UnlockShardResource(uint64 shardId, LOCKMODE lockmode);
 
 /* Lock a job schema or partition task directory */
@@ -79,6 +89,7 @@ extern void UnlockJobResource(uint64 jobId, LOCKMODE lockmode);
 extern void LockShardListMetadata(List *shardIntervalList, LOCKMODE lockMode);
 extern void LockShardListResources(List *shardIntervalList, LOCKMODE lockMode);
 extern void LockRelationShardResources(List *relationShardList, LOCKMODE lockMode);
+extern bool LockTableShardResources(Oid relationId, LOCKMODE lockMode);
 
 /* Lock partitions of partitioned table */
 extern void LockPartitionsInRelationList(List *relationIdList, LOCKMODE lockmode);
@@ -0,0 +1,46 @@
+/*-------------------------------------------------------------------------
+ *
+ * result_cache.h
+ *	  Function declarations for caching the results of read-only router
+ *	  queries on reference tables on the coordinator.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "distributed/citus_custom_scan.h"
+#include "distributed/multi_physical_planner.h"
+#include "nodes/params.h"
+
+
+/* number of shared modification counters that shards are mapped onto */
+#define RESULT_CACHE_COUNTER_COUNT 1024
+
+/* maximum number of results cached by a backend */
+#define RESULT_CACHE_MAX_ENTRIES 1024
+
+/* maximum size of a single cached result in bytes */
+#define RESULT_CACHE_MAX_RESULT_SIZE (64 * 1024)
+
+
+/* config variable managed via guc.c */
+extern bool EnableResultCache;
+
+
+extern void InitializeResultCache(void);
+extern char * TaskResultCacheKey(DistributedPlan *distributedPlan, Task *task,
+								 ParamListInfo paramListInfo);
+extern bool LoadCachedTaskResult(CitusScanState *scanState, char *cacheKey,
+								 Task *task, uint64 *modificationCounter);
+extern void CacheTaskResult(CitusScanState *scanState, char *cacheKey, Task *task,
+							uint64 modificationCounter);
+extern void InvalidateCachedShardResults(uint64 shardId);
+extern uint64 ShardModificationCounter(uint64 shardId);
+extern void ResetResultCacheTransactionState(void);
+
+
+#endif /* RESULT_CACHE_H */
@@ -0,0 +1,24 @@
+/*-------------------------------------------------------------------------
+ *
+ * rollup_tables.h
+ *   Function declarations for incrementally aggregating new rows of
+ *   distributed tables into colocated rollup tables.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef ROLLUP_TABLES_H
+#define ROLLUP_TABLES_H
+
+
+/* Config variables managed via guc.c */
+extern int RollupInterval;
+
+
+extern int RunRollups(void);
+extern void DeleteRollups(Oid relationId);
+
+
+#endif /* ROLLUP_TABLES_H */
@@ -0,0 +1,27 @@
+/*-------------------------------------------------------------------------
+ *
+ * secondary_node_routing.h
+ *	  Choosing the secondary node of a node group that reads go to.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SECONDARY_NODE_ROUTING_H
+#define SECONDARY_NODE_ROUTING_H
+
+
+#include "distributed/metadata_cache.h"
+#include "distributed/worker_manager.h"
+
+
+/* Config variables managed via guc.c */
+extern int MaxSecondaryReplicationLag;
+extern int SecondaryLagCheckInterval;
+
+
+extern bool ReadFromSecondaryNodes(void);
+extern WorkerNode * SecondaryReadNodeForGroup(WorkerNodeGroup *nodeGroup);
+
+
+#endif /* SECONDARY_NODE_ROUTING_H */
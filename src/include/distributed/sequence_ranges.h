@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * sequence_ranges.h
+ *   Function declarations for allocating ranges of sequence values to
+ *   metadata workers.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SEQUENCE_RANGES_H
+#define SEQUENCE_RANGES_H
+
+
+#define ALLOCATE_SEQUENCE_RANGE_QUERY \
+	"SELECT first_value, last_value, increment_by " \
+	"FROM pg_catalog.master_allocate_sequence_range(%s::regclass, %d)"
+
+
+/* config variables */
+extern int SequenceRangeSize;
+
+
+extern bool IsRangeAllocatedSequence(Oid sequenceId);
+extern bool NextRangeAllocatedSequenceValue(Oid sequenceId, int64 *sequenceValue);
+
+
+#endif /* SEQUENCE_RANGES_H */
@@ -0,0 +1,37 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_access_stats.h
+ *   Function declarations for counting reads and writes of shards by the
+ *   router executor.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARD_ACCESS_STATS_H
+#define SHARD_ACCESS_STATS_H
+
+#include "distributed/multi_physical_planner.h"
+#include "portability/instr_time.h"
+
+
+/* kind of access to a shard */
+typedef enum ShardAccessType
+{
+	SHARD_ACCESS_READ = 0,
+	SHARD_ACCESS_WRITE = 1
+} ShardAccessType;
+
+
+/* config variables */
+extern bool TrackShardAccess;
+extern int ShardAccessStatsMax;
+
+
+extern void InitializeShardAccessStats(void);
+extern void RecordTaskShardAccess(Task *task, ShardAccessType accessType,
+								  instr_time *startTime);
+
+
+#endif /* SHARD_ACCESS_STATS_H */
@@ -0,0 +1,38 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_invalidation_log.h
+ *   Function declarations for the shared log of metadata changes, which
+ *   allows backends to invalidate the placements of individual shards.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARD_INVALIDATION_LOG_H
+#define SHARD_INVALIDATION_LOG_H
+
+#include "nodes/pg_list.h"
+
+
+/* number of metadata changes kept in the log */
+#define SHARD_INVALIDATION_LOG_SIZE 1024
+
+
+/* config variable that enables the log */
+extern bool EnableShardPlacementInvalidation;
+
+
+extern void InitializeShardInvalidationLog(void);
+extern bool ShardInvalidationLogEnabled(void);
+extern uint64 ShardInvalidationLogPosition(void);
+extern bool InvalidatedShardPlacementList(Oid relationId, uint64 startPosition,
+										  uint64 endPosition, List **shardIdList);
+extern void LogRelationInvalidation(Oid relationId);
+extern void LogShardPlacementInvalidation(Oid relationId, uint64 shardId);
+extern void ResetShardInvalidationLogTransactionState(bool isCommit);
+extern void BeginShardInvalidationLogCommitPrepared(void);
+extern void EndShardInvalidationLogCommitPrepared(void);
+
+
+#endif /* SHARD_INVALIDATION_LOG_H */
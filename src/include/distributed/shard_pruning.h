@@ -16,8 +16,14 @@
 
 #define INVALID_SHARD_INDEX -1
 
+/* Config variable managed via guc.c */
+extern bool EnableShardZoneMapPruning;
+
 /* Function declarations for shard pruning */
 extern List * PruneShards(Oid relationId, Index rangeTableId, List *whereClauseList);
 extern bool ContainsFalseClause(List *whereClauseList);
+extern bool HasShardFilterableArray(Node *clause, Oid relationId, Index rangeTableId);
+extern bool FilterArraysForShard(Node *clause, Index rangeTableId,
+								 ShardInterval *shardInterval);
 
 #endif /* SHARD_PRUNING_H_ */
@@ -0,0 +1,21 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_rebalancer.h
+ *   Configuration variables for computing and executing a plan of shard
+ *   moves that balances the shards of distributed tables across workers.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARD_REBALANCER_H
+#define SHARD_REBALANCER_H
+
+
+/* config variables for the rebalancer */
+extern double RebalanceLoadWeight;
+extern int RebalanceMaxConcurrentMoves;
+
+
+#endif /* SHARD_REBALANCER_H */
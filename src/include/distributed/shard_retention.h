@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_retention.h
+ *   Function declarations for dropping the shards of time-partitioned
+ *   tables once they are older than a retention period.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARD_RETENTION_H
+#define SHARD_RETENTION_H
+
+#include "datatype/timestamp.h"
+
+
+/* Config variables managed via guc.c */
+extern int ShardRetentionCheckInterval;
+extern int ShardRetentionBatchSize;
+
+
+extern int DropExpiredShards(Oid relationId, Interval *retentionPeriod,
+							 int maxShardCount);
+extern int ApplyRetentionPolicies(bool *moreShardsExpired);
+extern void DeleteRetentionPolicy(Oid relationId);
+
+
+#endif /* SHARD_RETENTION_H */
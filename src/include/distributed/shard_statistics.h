@@ -0,0 +1,32 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_statistics.h
+ *   Function declarations for deferring shard statistics updates after
+ *   appends to the maintenance daemon.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARD_STATISTICS_H
+#define SHARD_STATISTICS_H
+
+
+/* number of shards with stale statistics that the queue can hold */
+#define STALE_SHARD_QUEUE_SIZE 4096
+
+
+/* config variables */
+extern bool DeferShardStatistics;
+extern int ShardStatisticsRefreshInterval;
+
+
+extern void InitializeShardStatisticsQueue(void);
+extern void MarkShardStatisticsStale(uint64 shardId);
+extern bool HasStaleShardStatistics(Oid databaseId);
+extern int RefreshStaleShardStatistics(void);
+extern void ResetShardStatisticsTransactionState(bool isCommit);
+
+
+#endif /* SHARD_STATISTICS_H */
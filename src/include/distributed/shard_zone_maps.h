@@ -0,0 +1,39 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_zone_maps.h
+ *   Function declarations for maintaining summaries of the values of
+ *   non-distribution columns in each shard.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARD_ZONE_MAPS_H
+#define SHARD_ZONE_MAPS_H
+
+#include "distributed/master_metadata_utility.h"
+#include "nodes/pg_list.h"
+
+
+/* largest bloom filter we build for a column of a shard, in bytes */
+#define MAX_ZONE_MAP_BLOOM_FILTER_SIZE (1024 * 1024)
+
+
+/* ZoneMapColumn is a column of a table for which its shards have zone maps */
+typedef struct ZoneMapColumn
+{
+	AttrNumber attributeNumber;
+	int bloomFilterSize;
+} ZoneMapColumn;
+
+
+extern List * ShardZoneMapColumnList(Oid relationId);
+extern bool UpdatePlacementShardZoneMaps(ShardPlacement *placement,
+										 ShardInterval *shardInterval,
+										 List *zoneMapColumnList);
+extern void ClearShardZoneMaps(uint64 shardId);
+extern void DeleteShardZoneMapRows(Oid relationId);
+
+
+#endif /* SHARD_ZONE_MAPS_H */
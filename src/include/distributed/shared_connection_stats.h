@@ -0,0 +1,33 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.h
+ *   Central management of connections to the worker nodes shared across
+ *   the backends of the coordinator.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_CONNECTION_STATS_H
+#define SHARED_CONNECTION_STATS_H
+
+
+/* value of citus.max_shared_pool_size that disables the shared limit */
+#define DISABLE_SHARED_CONNECTION_LIMIT 0
+
+
+/* config variable for the maximum number of connections to a worker */
+extern int MaxSharedPoolSize;
+
+
+extern void InitializeSharedConnectionStats(void);
+extern bool SharedConnectionLimitEnabled(void);
+extern bool TryToIncrementSharedConnectionCounter(const char *hostname, int port);
+extern void WaitLoopForSharedConnection(const char *hostname, int port);
+extern int SharedConnectionCount(const char *hostname, int port);
+extern void IncrementSharedConnectionCounter(const char *hostname, int port);
+extern void DecrementSharedConnectionCounter(const char *hostname, int port);
+
+
+#endif /* SHARED_CONNECTION_STATS_H */
@@ -0,0 +1,57 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_metadata_cache.h
+ *   Function declarations for keeping the shards and shard placements of
+ *   distributed tables in shared memory.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_METADATA_CACHE_H
+#define SHARED_METADATA_CACHE_H
+
+#include "distributed/master_metadata_utility.h"
+#include "utils/timestamp.h"
+
+
+/* maximum number of tables in the shared metadata cache */
+#define MAX_SHARED_SHARD_LISTS 4096
+
+
+/* config variable for the size of the shared metadata cache in kB */
+extern int SharedMetadataCacheSize;
+
+/* whether loading a table counts as using it, see metadata_prewarm.c */
+extern bool TrackSharedShardListUse;
+
+
+/* SharedShardListUse is the time a cached table was last used by a backend */
+typedef struct SharedShardListUse
+{
+	Oid relationId;
+	TimestampTz lastUseTime;
+} SharedShardListUse;
+
+
+extern void InitializeSharedMetadataCache(void);
+extern bool SharedMetadataCacheEnabled(void);
+extern bool LoadSharedShardList(Oid relationId, Oid intervalTypeId,
+								ShardInterval ***shardIntervalArray, int *shardCount,
+								GroupShardPlacement ***placementArrays,
+								int **placementArrayLengths);
+extern bool SharedShardListCached(Oid relationId);
+extern uint64 BeginSharedShardListBuild(void);
+extern void StoreSharedShardList(Oid relationId, uint64 buildCounter,
+								 ShardInterval **sortedShardIntervalArray,
+								 int shardCount, GroupShardPlacement **placementArrays,
+								 int *placementArrayLengths);
+extern List * RecentlyUsedSharedShardLists(TimestampTz usedAfter);
+extern void InvalidateSharedShardList(Oid relationId);
+extern void ResetSharedMetadataCacheTransactionState(void);
+extern void BeginSharedMetadataCacheCommitPrepared(void);
+extern void EndSharedMetadataCacheCommitPrepared(void);
+
+
+#endif /* SHARED_METADATA_CACHE_H */
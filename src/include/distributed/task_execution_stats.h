@@ -0,0 +1,41 @@
+/*-------------------------------------------------------------------------
+ *
+ * task_execution_stats.h
+ *   Function declarations for collecting the execution statistics of
+ *   individual tasks for EXPLAIN ANALYZE.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef TASK_EXECUTION_STATS_H
+#define TASK_EXECUTION_STATS_H
+
+#include "distributed/citus_custom_scan.h"
+#include "distributed/multi_physical_planner.h"
+#include "utils/timestamp.h"
+
+
+/* execution statistics of a single task, as shown by EXPLAIN ANALYZE */
+typedef struct TaskExecutionStats
+{
+	uint32 taskId;
+	int placementIndex;        /* placement on which the task completed */
+	double executionTime;      /* milliseconds from starting until finishing */
+	double connectionWaitTime; /* milliseconds until the query could be sent */
+	uint64 rowCount;
+	uint64 bytesReceived;
+} TaskExecutionStats;
+
+
+extern CitusScanState * BeginTaskStatsCollection(CitusScanState *scanState);
+extern void EndTaskStatsCollection(CitusScanState *previousScanState);
+extern bool CollectingTaskStats(void);
+extern void RecordTaskExecutionStats(Task *task, int placementIndex,
+									 TimestampTz startTime, TimestampTz queryStartTime,
+									 uint64 rowCount, uint64 bytesReceived);
+extern void ResetTaskStatsCollection(void);
+
+
+#endif /* TASK_EXECUTION_STATS_H */
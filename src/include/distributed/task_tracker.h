@@ -15,6 +15,8 @@
 #ifndef TASK_TRACKER_H
 #define TASK_TRACKER_H
 
+#include "datatype/timestamp.h"
+#include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "utils/hsearch.h"
 
@@ -87,6 +89,10 @@ typedef struct WorkerTask
 	char userName[NAMEDATALEN]; /* user to use for local backend connection */
 	int32 connectionId;     /* connection id to local backend */
 	uint32 failureCount;    /* number of task failures */
+	TimestampTz queuedAt;   /* time at which the task was last queued */
+	TimestampTz startedAt;  /* time at which the task was last started */
+	TimestampTz finishedAt; /* time at which the last run of the task ended */
+	int32 backendPid;       /* pid of the local backend that last ran the task */
 	char taskCallString[FLEXIBLE_ARRAY_MEMBER]; /* query or function call string */
 } WorkerTask;
 
@@ -95,6 +101,25 @@ typedef struct WorkerTask
 #define WORKER_TASK_AT(workerTasks, index) \
 	((WorkerTask *) (((char *) (workerTasks)) + (index) * WORKER_TASK_SIZE))
 
+/*
+ * TaskTrackerStats counts the tasks that went through the task tracker since
+ * the server started, such that their throughput and the time they spent
+ * queued behind citus.max_running_tasks_per_node can be derived.
+ */
+typedef struct TaskTrackerStats
+{
+	uint64 assignedTaskCount;
+	uint64 startedTaskCount;
+	uint64 succeededTaskCount;
+	uint64 failedTaskCount;
+	uint64 permanentlyFailedTaskCount;
+	uint64 canceledTaskCount;
+	double totalQueueTime;  /* in milliseconds */
+	double totalRunTime;    /* in milliseconds */
+	TimestampTz statsSince;
+} TaskTrackerStats;
+
+
 /*
  * WorkerTasksControlData contains task tracker state shared between
  * processes.
@@ -109,6 +134,12 @@ typedef struct WorkerTasksSharedStateData
 	LWLockTranche taskHashLockTranche;
 #endif
 	LWLock taskHashLock;
+
+	/* latch of the task tracker process, set to wake it up on new work */
+	Latch *taskTrackerLatch;
+
+	/* counters of task tracker activity, protected by taskHashLock */
+	TaskTrackerStats taskStats;
 } WorkerTasksSharedStateData;
 
 
@@ -116,6 +147,7 @@ typedef struct WorkerTasksSharedStateData
 extern int TaskTrackerDelay;
 extern int MaxTrackedTasksPerNode;
 extern int MaxRunningTasksPerNode;
+extern int MaxActiveBackendsPerNode;
 extern int MaxTaskStringSize;
 
 /* State shared by the task tracker and task tracker protocol functions */
@@ -128,6 +160,7 @@ extern void TaskTrackerMain(Datum main_arg);
 /* Function declarations local to the worker module */
 extern WorkerTask * WorkerTasksHashEnter(uint64 jobId, uint32 taskId);
 extern WorkerTask * WorkerTasksHashFind(uint64 jobId, uint32 taskId);
+extern double TaskTrackerMillisBetween(TimestampTz startTime, TimestampTz endTime);
 
 /* Function declarations for starting up and running the task tracker */
 extern void TaskTrackerRegister(void);
@@ -22,6 +22,7 @@
 extern Datum task_tracker_assign_task(PG_FUNCTION_ARGS);
 extern Datum task_tracker_update_data_fetch_task(PG_FUNCTION_ARGS);
 extern Datum task_tracker_task_status(PG_FUNCTION_ARGS);
+extern Datum task_tracker_job_status(PG_FUNCTION_ARGS);
 extern Datum task_tracker_cleanup_job(PG_FUNCTION_ARGS);
 
 
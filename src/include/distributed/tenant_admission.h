@@ -0,0 +1,39 @@
+/*-------------------------------------------------------------------------
+ *
+ * tenant_admission.h
+ *   Limits on the number of concurrent queries and the query rate per
+ *   tenant, where a tenant is a group of colocated shards.
+ *
+ * Copyright (c) 2018, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef TENANT_ADMISSION_H
+#define TENANT_ADMISSION_H
+
+#include "distributed/multi_physical_planner.h"
+
+
+/* value of the tenant limits that disables them */
+#define DISABLE_TENANT_LIMIT 0
+
+
+/* config variables managed via guc.c */
+extern int MaxTenantConcurrency;
+extern int MaxTenantQueriesPerSecond;
+
+
+/* TenantAdmission is a query's admission to run against a tenant's shards */
+typedef struct TenantAdmission TenantAdmission;
+
+
+extern void InitializeTenantAdmission(void);
+extern bool TenantLimitsEnabled(void);
+extern TenantAdmission * AdmitTenantQuery(Task *task);
+extern void ReleaseTenantAdmission(TenantAdmission *admission);
+extern void ReleaseSubXactTenantAdmissions(SubTransactionId subId);
+extern void ResetTenantAdmissionState(void);
+
+
+#endif /* TENANT_ADMISSION_H */
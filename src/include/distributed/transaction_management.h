@@ -56,6 +56,12 @@ typedef enum
 /* config variable managed via guc.c */
 extern int MultiShardCommitProtocol;
 
+/* config variable managed via guc.c */
+extern bool EnableOnePhaseCommit;
+
+/* config variable managed via guc.c */
+extern bool DeferCommitPrepared;
+
 /* state needed to restore multi-shard commit protocol during VACUUM/ANALYZE */
 extern int SavedMultiShardCommitProtocol;
 
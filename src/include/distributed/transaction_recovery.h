@@ -11,6 +11,7 @@
 #ifndef TRANSACTION_RECOVERY_H
 #define TRANSACTION_RECOVERY_H
 
+#include "nodes/pg_list.h"
 
 /* GUC to configure interval for 2PC auto-recovery */
 extern int Recover2PCInterval;
@@ -18,6 +19,7 @@ extern int Recover2PCInterval;
 
 /* Functions declarations for worker transactions */
 extern void LogTransactionRecord(int groupId, char *transactionName);
+extern void LogTransactionRecords(List *groupIdList, List *transactionNameList);
 extern int RecoverTwoPhaseCommits(void);
 
 
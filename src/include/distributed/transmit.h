@@ -15,11 +15,23 @@
 #include "storage/fd.h"
 
 
+/*
+ * Size of the chunks in which files are read and sent as CopyData messages.
+ * Larger chunks mean fewer system calls on both the sending and the receiving
+ * node, which matters for repartition fetches of large partition files.
+ */
+#define TRANSMIT_BUFFER_SIZE (256 * 1024)
+
+
 /* Function declarations for transmitting files between two nodes */
 extern void RedirectCopyDataToRegularFile(const char *filename);
 extern void SendRegularFile(const char *filename);
 extern File FileOpenForTransmit(const char *filename, int fileFlags, int fileMode);
 
+/* Function declarations for receiving data with the copy protocol */
+extern void SendCopyInStart(void);
+extern bool ReceiveCopyData(StringInfo copyData);
+
 /* Function declaration local to commands and worker modules */
 extern void FreeStringInfo(StringInfo stringInfo);
 
@@ -54,6 +54,7 @@ typedef struct WorkerNode
 extern int MaxWorkerNodesTracked;
 extern char *WorkerListFileName;
 extern char *CurrentCluster;
+extern char *LocalNodeRack;
 
 
 /* Function declarations for finding worker nodes to place shards on */
@@ -66,6 +67,9 @@ extern uint32 ActivePrimaryNodeCount(void);
 extern List * ActivePrimaryNodeList(void);
 extern uint32 ActiveReadableNodeCount(void);
 extern List * ActiveReadableNodeList(void);
+extern char * ExecutingNodeRack(void);
+extern bool NodeInRack(char *nodeName, int32 nodePort, const char *nodeRack);
+extern List * SortPlacementListByRack(List *placementList, const char *nodeRack);
 extern WorkerNode * FindWorkerNode(char *nodeName, int32 nodePort);
 extern WorkerNode * FindWorkerNodeAnyCluster(char *nodeName, int32 nodePort);
 extern List * ReadWorkerNodes(bool includeNodesFromOtherClusters);
@@ -15,6 +15,7 @@
 #define WORKER_PROTOCOL_H
 
 #include "fmgr.h"
+#include "distributed/bloom_filter.h"
 #include "lib/stringinfo.h"
 #include "nodes/parsenodes.h"
 #include "storage/fd.h"
@@ -33,6 +34,7 @@
 #define TASK_TABLE_PREFIX "task_"
 #define TABLE_FILE_PREFIX "table_"
 #define PARTITION_FILE_PREFIX "p_"
+#define BLOOM_FILTER_FILENAME "bloom_filter"
 #define ATTEMPT_FILE_SUFFIX ".attempt"
 #define MERGE_TABLE_SUFFIX "_merge"
 #define MIN_JOB_DIRNAME_WIDTH 4
@@ -44,6 +46,10 @@
 /* Defines used for fetching files and tables */
 /* the tablename in the overloaded COPY statement is the to-be-transferred file */
 #define TRANSMIT_REGULAR_COMMAND "COPY \"%s\" TO STDOUT WITH (format 'transmit')"
+
+/* the tablename in this COPY statement is <jobId>_<upstreamTaskId>_<partitionTaskId> */
+#define PUSH_PARTITION_COMMAND "COPY \"" UINT64_FORMAT "_%u_%u\" FROM STDIN WITH \
+ (format 'partition')"
 #define COPY_OUT_COMMAND "COPY %s TO STDOUT"
 #define COPY_IN_COMMAND "COPY %s FROM '%s'"
 
@@ -68,12 +74,16 @@ typedef struct RangePartitionContext
 
 /*
  * HashPartitionContext keeps hash re-partitioning related data. The hashing
- * function is set according to the partitioned column's data type.
+ * function is set according to the partitioned column's data type. When
+ * repartitioning for a join, we may add the hashes of all partition keys to a
+ * build filter, or drop rows whose keys are not in a probe filter.
  */
 typedef struct HashPartitionContext
 {
 	FmgrInfo *hashFunction;
 	uint32 partitionCount;
+	BloomFilter *buildFilter;
+	BloomFilter *probeFilter;
 } HashPartitionContext;
 
 
@@ -81,19 +91,32 @@ typedef struct HashPartitionContext
  * FileOutputStream helps buffer write operations to a file; these writes are
  * then regularly flushed to the underlying file. This structure differs from
  * standard file output streams in that it keeps a larger buffer, and only
- * supports appending data to virtual file descriptors.
+ * supports appending data to virtual file descriptors. Partition files share
+ * one buffer budget, and the largest buffers are flushed first.
  */
 typedef struct FileOutputStream
 {
 	File fileDescriptor;
 	StringInfo fileBuffer;
 	StringInfo filePath;
+
+	/* if set, data is streamed over this connection instead of a local file */
+	struct MultiConnection *connection;
+
+	/* whether the buffer is written as compressed blocks */
+	bool compressed;
+
+	/* statistics on flushes of the buffer */
+	uint64 bytesWritten;
+	uint32 flushCount;
 } FileOutputStream;
 
 
 /* Config variables managed via guc.c */
 extern int PartitionBufferSize;
+extern int PartitionFileCompression;
 extern bool BinaryWorkerCopyFormat;
+extern bool EnableMergeFunctionScan;
 
 
 /* Function declarations local to the worker module */
@@ -110,6 +133,10 @@ extern bool DirectoryExists(StringInfo directoryName);
 extern void CitusCreateDirectory(StringInfo directoryName);
 extern void CitusRemoveDirectory(StringInfo filename);
 extern StringInfo InitTaskDirectory(uint64 jobId, uint32 taskId);
+extern void FetchRegularFileAsSuperUser(const char *nodeName, uint32 nodePort,
+										StringInfo remoteFilename,
+										StringInfo localFilename);
+extern void ReceivePushedPartitionFile(const char *partitionName);
 extern void RemoveJobSchema(StringInfo schemaName);
 extern Datum * DeconstructArrayObject(ArrayType *arrayObject);
 extern int32 ArrayObjectCount(ArrayType *arrayObject);
@@ -138,6 +165,7 @@ extern Datum worker_range_partition_table(PG_FUNCTION_ARGS);
 extern Datum worker_hash_partition_table(PG_FUNCTION_ARGS);
 extern Datum worker_merge_files_into_table(PG_FUNCTION_ARGS);
 extern Datum worker_merge_files_and_run_query(PG_FUNCTION_ARGS);
+extern Datum worker_read_merge_files(PG_FUNCTION_ARGS);
 extern Datum worker_cleanup_job_schema_cache(PG_FUNCTION_ARGS);
 
 /* Function declarations for fetching regular and foreign tables */
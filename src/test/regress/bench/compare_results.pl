@@ -0,0 +1,75 @@
+#!/usr/bin/perl -w
+#----------------------------------------------------------------------
+#
+# compare_results.pl - compare the results of two benchmark runs
+#
+# Reads two results.json files written by make bench or make bench-tpch,
+# typically from runs on different commits, and prints the throughput and
+# latencies of each workload in both runs with the relative change.
+#
+# Usage: compare_results.pl <baseline results.json> <results.json>
+#
+#----------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+sub ReadResults
+{
+    my ($file) = @_;
+    my %results = ();
+    my @workloads = ();
+
+    open(my $fh, "<", $file) or die "Could not open $file";
+    while (my $line = <$fh>)
+    {
+        my %result = ($line =~ /"(\w+)": "?([^",}]*)"?/g);
+
+        next unless defined $result{workload};
+
+        push(@workloads, $result{workload});
+        $results{$result{workload}} = \%result;
+    }
+    close($fh);
+
+    return (\@workloads, \%results);
+}
+
+sub Change
+{
+    my ($old, $new) = @_;
+
+    return "n/a" if (!defined $old || !defined $new || $old == 0);
+
+    return sprintf("%+.1f%%", 100.0 * ($new - $old) / $old);
+}
+
+die "Usage: $0 <baseline results.json> <results.json>\n" unless (@ARGV == 2);
+
+my ($baseWorkloads, $baseResults) = ReadResults($ARGV[0]);
+my ($workloads, $results) = ReadResults($ARGV[1]);
+my @metrics = ('tps', 'latency_avg', 'latency_p50', 'latency_p95', 'latency_p99');
+
+printf("%-28s %-14s %12s %12s %9s\n", "workload", "metric",
+       $baseResults->{$baseWorkloads->[0]}{commit} // "baseline",
+       $results->{$workloads->[0]}{commit} // "current", "change")
+    if (@$baseWorkloads && @$workloads);
+
+for my $workload (@$workloads)
+{
+    my $base = $baseResults->{$workload};
+    my $result = $results->{$workload};
+
+    if (!defined $base)
+    {
+        printf("%-28s not in baseline\n", $workload);
+        next;
+    }
+
+    for my $metric (@metrics)
+    {
+        printf("%-28s %-14s %12.3f %12.3f %9s\n", $workload, $metric,
+               $base->{$metric}, $result->{$metric},
+               Change($base->{$metric}, $result->{$metric}));
+    }
+}
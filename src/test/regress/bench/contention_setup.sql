@@ -0,0 +1,17 @@
+--
+-- Tables used by the lock contention workloads
+--
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+
+-- table that concurrent multi-shard modifications all lock every shard of
+CREATE TABLE bench_counters (key bigint PRIMARY KEY, counter_group int, counter bigint);
+SELECT create_distributed_table('bench_counters', 'key');
+INSERT INTO bench_counters SELECT s, s % 100, 0 FROM generate_series(1, 10000) s;
+
+-- reference table, of which every modification locks its shard on all nodes
+CREATE TABLE bench_reference_counters (key bigint PRIMARY KEY, counter bigint);
+SELECT create_reference_table('bench_reference_counters');
+INSERT INTO bench_reference_counters SELECT s, 0 FROM generate_series(1, 100) s;
+
+VACUUM ANALYZE bench_counters, bench_reference_counters;
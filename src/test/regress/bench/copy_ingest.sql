@@ -0,0 +1 @@
+COPY bench_events (key, payload) FROM PROGRAM 'seq 1 1000 | sed ''s/.*/&,&/''' WITH (format csv);
@@ -0,0 +1,3 @@
+\set start random(1, 99000)
+INSERT INTO bench_event_counts
+SELECT key, count(*) FROM bench_events WHERE key BETWEEN :start AND :start + 999 GROUP BY key;
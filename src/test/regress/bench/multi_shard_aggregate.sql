@@ -0,0 +1 @@
+SELECT count(*), sum(payload), max(event_time) FROM bench_events;
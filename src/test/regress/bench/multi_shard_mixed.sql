@@ -0,0 +1,6 @@
+\set group random(0, 99)
+\set key random(1, 10000)
+UPDATE bench_counters SET counter = counter + 1 WHERE key = :key;
+UPDATE bench_counters SET counter = counter + 1 WHERE counter_group = :group;
+DELETE FROM bench_counters WHERE key = :key;
+INSERT INTO bench_counters VALUES (:key, :key % 100, 0);
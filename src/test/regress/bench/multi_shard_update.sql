@@ -0,0 +1,2 @@
+\set group random(0, 99)
+UPDATE bench_counters SET counter = counter + 1 WHERE counter_group = :group;
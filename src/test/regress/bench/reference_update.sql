@@ -0,0 +1,2 @@
+\set key random(1, 100)
+UPDATE bench_reference_counters SET counter = counter + 1 WHERE key = :key;
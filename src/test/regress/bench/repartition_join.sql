@@ -0,0 +1 @@
+SELECT c.region, sum(o.amount) FROM bench_orders o JOIN bench_customers c ON (o.customer_id = c.customer_id) GROUP BY c.region;
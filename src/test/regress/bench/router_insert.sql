@@ -0,0 +1,2 @@
+\set key random(1, 100000)
+INSERT INTO bench_events (key, payload) VALUES (:key, :key);
@@ -0,0 +1,2 @@
+\set key random(1, 100000)
+SELECT value FROM bench_kv WHERE key = :key;
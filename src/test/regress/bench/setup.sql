@@ -0,0 +1,30 @@
+--
+-- Tables and data used by the benchmark workloads
+--
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+
+-- key-value table for single-shard reads
+CREATE TABLE bench_kv (key bigint PRIMARY KEY, value text);
+SELECT create_distributed_table('bench_kv', 'key');
+INSERT INTO bench_kv SELECT s, md5(s::text) FROM generate_series(1, 100000) s;
+
+-- append-heavy table for single-row inserts and COPY
+CREATE TABLE bench_events (key bigint, event_time timestamptz DEFAULT now(), payload int);
+SELECT create_distributed_table('bench_events', 'key');
+INSERT INTO bench_events (key, payload) SELECT s % 100000, s FROM generate_series(1, 100000) s;
+
+-- co-located target of INSERT ... SELECT
+CREATE TABLE bench_event_counts (key bigint, event_count bigint);
+SELECT create_distributed_table('bench_event_counts', 'key', colocate_with => 'bench_events');
+
+-- tables that are not joined on their distribution columns
+CREATE TABLE bench_orders (order_id bigint, customer_id bigint, amount int);
+SELECT create_distributed_table('bench_orders', 'order_id');
+INSERT INTO bench_orders SELECT s, s % 1000, s % 100 FROM generate_series(1, 20000) s;
+
+CREATE TABLE bench_customers (customer_id bigint, region int);
+SELECT create_distributed_table('bench_customers', 'region');
+INSERT INTO bench_customers SELECT s, s % 10 FROM generate_series(1, 1000) s;
+
+VACUUM ANALYZE bench_kv, bench_events, bench_orders, bench_customers;
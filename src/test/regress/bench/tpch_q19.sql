@@ -0,0 +1,29 @@
+SELECT
+	sum(l_extendedprice* (1 - l_discount)) as revenue
+FROM
+	lineitem,
+	part
+WHERE
+	(
+		p_partkey = l_partkey
+		AND (p_brand = 'Brand#12' OR p_brand= 'Brand#14' OR p_brand='Brand#15')
+		AND l_quantity >= 10
+		AND l_shipmode in ('AIR', 'AIR REG', 'TRUCK')
+		AND l_shipinstruct = 'DELIVER IN PERSON'
+	)
+	OR
+	(
+		p_partkey = l_partkey
+		AND (p_brand = 'Brand#23' OR p_brand='Brand#24')
+		AND l_quantity >= 20
+		AND l_shipmode in ('AIR', 'AIR REG', 'TRUCK')
+		AND l_shipinstruct = 'DELIVER IN PERSON'
+	)
+	OR
+	(
+		p_partkey = l_partkey
+		AND (p_brand = 'Brand#33' OR p_brand = 'Brand#34' OR p_brand = 'Brand#35')
+		AND l_quantity >= 1
+		AND l_shipmode in ('AIR', 'AIR REG', 'TRUCK')
+		AND l_shipinstruct = 'DELIVER IN PERSON'
+	);
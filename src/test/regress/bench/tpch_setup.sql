@@ -0,0 +1,197 @@
+--
+-- TPC-H tables generated at scale factor :scale, used by the tpch_q* workloads
+--
+-- The data follows the value ranges of the TPC-H specification closely enough
+-- for the selectivities of the benchmark queries to be realistic, but is
+-- generated deterministically from the keys rather than by dbgen, such that
+-- runs on different commits use identical data. Customer, part and orders are
+-- distributed on their keys, with lineitem co-located with orders, such that
+-- queries joining on other columns require the task-tracker executor.
+--
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+
+SELECT (10000 * :scale)::int AS supplier_count,
+       (150000 * :scale)::int AS customer_count,
+       (200000 * :scale)::int AS part_count,
+       (1500000 * :scale)::int AS order_count \gset
+
+-- deterministic pseudo-random integer in [0, range) for a key and a salt
+CREATE FUNCTION pg_temp.tpch_random(key bigint, salt int, range int)
+RETURNS int
+AS $$ SELECT ((hashint8(key * 31 + salt)::bigint & 2147483647) % range)::int $$
+LANGUAGE sql IMMUTABLE;
+
+-- retail price of a part as defined by the specification
+CREATE FUNCTION pg_temp.tpch_retailprice(partkey bigint)
+RETURNS decimal(15,2)
+AS $$ SELECT ((90000 + ((partkey / 10) % 20001) + 100 * (partkey % 1000)) / 100.0)::decimal(15,2) $$
+LANGUAGE sql IMMUTABLE;
+
+-- order date of an order, which lineitem derives its dates from
+CREATE FUNCTION pg_temp.tpch_orderdate(orderkey bigint)
+RETURNS date
+AS $$ SELECT date '1992-01-01' + pg_temp.tpch_random(orderkey, 1, 2406) $$
+LANGUAGE sql IMMUTABLE;
+
+CREATE TABLE nation (
+	n_nationkey integer not null,
+	n_name char(25) not null,
+	n_regionkey integer not null,
+	n_comment varchar(152));
+SELECT create_reference_table('nation');
+
+INSERT INTO nation
+SELECT n - 1, name, region, 'nation ' || name
+FROM unnest(ARRAY['ALGERIA', 'ARGENTINA', 'BRAZIL', 'CANADA', 'EGYPT', 'ETHIOPIA',
+                  'FRANCE', 'GERMANY', 'INDIA', 'INDONESIA', 'IRAN', 'IRAQ', 'JAPAN',
+                  'JORDAN', 'KENYA', 'MOROCCO', 'MOZAMBIQUE', 'PERU', 'CHINA',
+                  'ROMANIA', 'SAUDI ARABIA', 'VIETNAM', 'RUSSIA', 'UNITED KINGDOM',
+                  'UNITED STATES'],
+            ARRAY[0, 1, 1, 1, 4, 0, 3, 3, 2, 2, 4, 4, 2, 4, 0, 0, 0, 1, 2, 3, 4, 2, 3, 3, 1])
+     WITH ORDINALITY AS nations(name, region, n);
+
+CREATE TABLE supplier (
+	s_suppkey integer not null,
+	s_name char(25) not null,
+	s_address varchar(40) not null,
+	s_nationkey integer,
+	s_phone char(15) not null,
+	s_acctbal decimal(15,2) not null,
+	s_comment varchar(101) not null);
+SELECT create_reference_table('supplier');
+
+INSERT INTO supplier
+SELECT s, 'Supplier#' || lpad(s::text, 9, '0'), md5(s::text),
+       pg_temp.tpch_random(s, 1, 25),
+       (10 + pg_temp.tpch_random(s, 1, 25)) || '-' || lpad(pg_temp.tpch_random(s, 2, 1000)::text, 3, '0') ||
+       '-' || lpad(pg_temp.tpch_random(s, 3, 1000)::text, 3, '0') ||
+       '-' || lpad(pg_temp.tpch_random(s, 4, 10000)::text, 4, '0'),
+       (pg_temp.tpch_random(s, 5, 1099998) - 99999) / 100.0, 'supplier ' || s
+FROM generate_series(1, :supplier_count) s;
+
+CREATE TABLE customer (
+	c_custkey integer not null,
+	c_name varchar(25) not null,
+	c_address varchar(40) not null,
+	c_nationkey integer not null,
+	c_phone char(15) not null,
+	c_acctbal decimal(15,2) not null,
+	c_mktsegment char(10) not null,
+	c_comment varchar(117) not null);
+SELECT create_distributed_table('customer', 'c_custkey');
+
+INSERT INTO customer
+SELECT c, 'Customer#' || lpad(c::text, 9, '0'), md5(c::text),
+       pg_temp.tpch_random(c, 1, 25),
+       (10 + pg_temp.tpch_random(c, 1, 25)) || '-' || lpad(pg_temp.tpch_random(c, 2, 1000)::text, 3, '0') ||
+       '-' || lpad(pg_temp.tpch_random(c, 3, 1000)::text, 3, '0') ||
+       '-' || lpad(pg_temp.tpch_random(c, 4, 10000)::text, 4, '0'),
+       (pg_temp.tpch_random(c, 5, 1099998) - 99999) / 100.0,
+       (ARRAY['AUTOMOBILE', 'BUILDING', 'FURNITURE', 'HOUSEHOLD', 'MACHINERY'])[1 + pg_temp.tpch_random(c, 6, 5)],
+       'customer ' || c
+FROM generate_series(1, :customer_count) c;
+
+CREATE TABLE part (
+	p_partkey integer not null,
+	p_name varchar(55) not null,
+	p_mfgr char(25) not null,
+	p_brand char(10) not null,
+	p_type varchar(25) not null,
+	p_size integer not null,
+	p_container char(10) not null,
+	p_retailprice decimal(15,2) not null,
+	p_comment varchar(23) not null);
+SELECT create_distributed_table('part', 'p_partkey');
+
+INSERT INTO part
+SELECT p, 'part ' || p, 'Manufacturer#' || (1 + pg_temp.tpch_random(p, 1, 5)),
+       'Brand#' || (1 + pg_temp.tpch_random(p, 1, 5)) || (1 + pg_temp.tpch_random(p, 2, 5)),
+       (ARRAY['STANDARD', 'SMALL', 'MEDIUM', 'LARGE', 'ECONOMY', 'PROMO'])[1 + pg_temp.tpch_random(p, 3, 6)] || ' ' ||
+       (ARRAY['ANODIZED', 'BURNISHED', 'PLATED', 'POLISHED', 'BRUSHED'])[1 + pg_temp.tpch_random(p, 4, 5)] || ' ' ||
+       (ARRAY['TIN', 'NICKEL', 'BRASS', 'STEEL', 'COPPER'])[1 + pg_temp.tpch_random(p, 5, 5)],
+       1 + pg_temp.tpch_random(p, 6, 50),
+       (ARRAY['SM', 'LG', 'MED', 'JUMBO', 'WRAP'])[1 + pg_temp.tpch_random(p, 7, 5)] || ' ' ||
+       (ARRAY['CASE', 'BOX', 'BAG', 'JAR', 'PKG', 'PACK', 'CAN', 'DRUM'])[1 + pg_temp.tpch_random(p, 8, 8)],
+       pg_temp.tpch_retailprice(p), 'part ' || p
+FROM generate_series(1, :part_count) p;
+
+CREATE TABLE orders (
+	o_orderkey bigint not null,
+	o_custkey integer not null,
+	o_orderstatus char(1) not null,
+	o_totalprice decimal(15,2) not null,
+	o_orderdate date not null,
+	o_orderpriority char(15) not null,
+	o_clerk char(15) not null,
+	o_shippriority integer not null,
+	o_comment varchar(79) not null,
+	PRIMARY KEY(o_orderkey) );
+SELECT create_distributed_table('orders', 'o_orderkey');
+
+INSERT INTO orders
+SELECT o, 1 + pg_temp.tpch_random(o, 2, :customer_count),
+       CASE WHEN pg_temp.tpch_orderdate(o) < date '1995-03-01' THEN 'F'
+            WHEN pg_temp.tpch_orderdate(o) > date '1995-07-01' THEN 'O'
+            ELSE 'P' END,
+       (100000 + pg_temp.tpch_random(o, 3, 50000000)) / 100.0,
+       pg_temp.tpch_orderdate(o),
+       (ARRAY['1-URGENT', '2-HIGH', '3-MEDIUM', '4-NOT SPECIFIED', '5-LOW'])[1 + pg_temp.tpch_random(o, 4, 5)],
+       'Clerk#' || lpad((1 + pg_temp.tpch_random(o, 5, greatest(1000 * :scale, 1)::int))::text, 9, '0'),
+       0, 'order ' || o
+FROM generate_series(1, :order_count) o;
+
+CREATE TABLE lineitem (
+	l_orderkey bigint not null,
+	l_partkey integer not null,
+	l_suppkey integer not null,
+	l_linenumber integer not null,
+	l_quantity decimal(15, 2) not null,
+	l_extendedprice decimal(15, 2) not null,
+	l_discount decimal(15, 2) not null,
+	l_tax decimal(15, 2) not null,
+	l_returnflag char(1) not null,
+	l_linestatus char(1) not null,
+	l_shipdate date not null,
+	l_commitdate date not null,
+	l_receiptdate date not null,
+	l_shipinstruct char(25) not null,
+	l_shipmode char(10) not null,
+	l_comment varchar(44) not null,
+	PRIMARY KEY(l_orderkey, l_linenumber) );
+SELECT create_distributed_table('lineitem', 'l_orderkey', colocate_with => 'orders');
+
+INSERT INTO lineitem
+SELECT o, partkey, 1 + pg_temp.tpch_random(line_key, 2, :supplier_count), l,
+       quantity, quantity * pg_temp.tpch_retailprice(partkey),
+       pg_temp.tpch_random(line_key, 3, 11) / 100.0,
+       pg_temp.tpch_random(line_key, 4, 9) / 100.0,
+       CASE WHEN receiptdate > date '1995-06-17' THEN 'N'
+            WHEN pg_temp.tpch_random(line_key, 5, 2) = 0 THEN 'R'
+            ELSE 'A' END,
+       CASE WHEN shipdate > date '1995-06-17' THEN 'O' ELSE 'F' END,
+       shipdate, commitdate, receiptdate,
+       (ARRAY['DELIVER IN PERSON', 'COLLECT COD', 'NONE', 'TAKE BACK RETURN'])[1 + pg_temp.tpch_random(line_key, 6, 4)],
+       (ARRAY['REG AIR', 'AIR', 'RAIL', 'SHIP', 'TRUCK', 'MAIL', 'FOB'])[1 + pg_temp.tpch_random(line_key, 7, 7)],
+       'line ' || l
+FROM (
+	SELECT o, l, line_key,
+	       1 + pg_temp.tpch_random(line_key, 1, :part_count) AS partkey,
+	       1 + pg_temp.tpch_random(line_key, 8, 50) AS quantity,
+	       shipdate,
+	       pg_temp.tpch_orderdate(o) + 30 + pg_temp.tpch_random(line_key, 9, 61) AS commitdate,
+	       shipdate + 1 + pg_temp.tpch_random(line_key, 10, 30) AS receiptdate
+	FROM (
+		SELECT o, l, o * 8 + l AS line_key,
+		       pg_temp.tpch_orderdate(o) + 1 + pg_temp.tpch_random(o * 8 + l, 11, 121) AS shipdate
+		FROM generate_series(1, :order_count) o,
+		     generate_series(1, 1 + pg_temp.tpch_random(o, 6, 7)) l
+	) lines
+) lines;
+
+ANALYZE nation;
+ANALYZE supplier;
+ANALYZE customer;
+ANALYZE part;
+ANALYZE orders;
+ANALYZE lineitem;
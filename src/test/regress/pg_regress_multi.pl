@@ -30,6 +30,11 @@ sub Usage()
     print "Multi Options:\n";
     print "  --isolationtester   	Run isolationtester tests instead of plain tests\n";
     print "  --vanillatest       	Run postgres tests with citus loaded as shared preload library\n";
+    print "  --benchmark-dir     	Run the pgbench workloads in this directory instead of tests\n";
+    print "  --benchmark-duration	Duration of each benchmark workload in seconds\n";
+    print "  --benchmark-clients 	Number of concurrent clients of each benchmark workload\n";
+    print "  --benchmark-schedule	Benchmark schedule in the benchmark directory to run\n";
+    print "  --benchmark-variable	Variable (name=value) for the setup and workload scripts\n";
     print "  --bindir            	Path to postgres binary directory\n";
     print "  --libdir            	Path to postgres library directory\n";
     print "  --postgres-builddir 	Path to postgres build directory\n";
@@ -49,6 +54,11 @@ sub Usage()
 my $isolationtester = 0;
 my $vanillatest = 0;
 my $followercluster = 0;
+my $benchmarkDir = undef;
+my $benchmarkDuration = 10;
+my $benchmarkClients = 4;
+my $benchmarkSchedule = "bench_schedule";
+my @benchmarkVariables = ();
 my $bindir = "";
 my $libdir = undef;
 my $pgxsdir = "";
@@ -80,6 +90,11 @@ GetOptions(
     'isolationtester' => \$isolationtester,
     'vanillatest' => \$vanillatest,
     'follower-cluster' => \$followercluster,
+    'benchmark-dir=s' => \$benchmarkDir,
+    'benchmark-duration=i' => \$benchmarkDuration,
+    'benchmark-clients=i' => \$benchmarkClients,
+    'benchmark-schedule=s' => \$benchmarkSchedule,
+    'benchmark-variable=s' => \@benchmarkVariables,
     'bindir=s' => \$bindir,
     'libdir=s' => \$libdir,
     'pgxsdir=s' => \$pgxsdir,
@@ -265,6 +280,8 @@ push(@pgOptions, '-c', "citus.expire_cached_shards=on");
 push(@pgOptions, '-c', "citus.task_tracker_delay=10ms");
 push(@pgOptions, '-c', "citus.remote_task_check_interval=1ms");
 push(@pgOptions, '-c', "citus.shard_replication_factor=2");
+push(@pgOptions, '-c', "citus.shared_metadata_cache_size=1MB");
+push(@pgOptions, '-c', "citus.enable_shard_placement_invalidation=on");
 push(@pgOptions, '-c', "citus.node_connection_timeout=${connectionTimeout}");
 
 if ($followercluster)
@@ -638,6 +655,167 @@ for my $port (@workerPorts)
     }
 }
 
+###
+# Benchmarks run against a regression database on the master that has the
+# workers added, which pg_regress would otherwise set up in the first tests.
+###
+sub RunBenchmarks()
+{
+    my $resultDir = catfile("tmp_check", "bench");
+    my $resultFile = catfile($resultDir, "results.json");
+    my $commit = `git -C "$benchmarkDir" rev-parse --short HEAD 2>/dev/null` || "unknown";
+    my @psqlVariables = map { ('-v', $_) } @benchmarkVariables;
+    my @pgbenchVariables = map { ('-D', $_) } @benchmarkVariables;
+    my @workloads = ();
+    my $setup = undef;
+
+    chomp($commit);
+
+    remove_tree($resultDir) if (-e $resultDir);
+    make_path($resultDir) or die "Could not create benchmark result directory";
+
+    system(catfile($bindir, "psql"),
+           ('-X', '-h', $host, '-p', $masterPort, '-U', $user, "-d", "postgres",
+            '-c', "CREATE DATABASE regression;")) == 0
+        or die "Could not create regression database on master";
+
+    for my $extension (@extensions)
+    {
+        system(catfile($bindir, "psql"),
+               ('-X', '-h', $host, '-p', $masterPort, '-U', $user, "-d", "regression",
+                '-c', "CREATE EXTENSION IF NOT EXISTS $extension;")) == 0
+            or die "Could not create extension on master";
+    }
+
+    for my $port (@workerPorts)
+    {
+        system(catfile($bindir, "psql"),
+               ('-X', '-h', $host, '-p', $masterPort, '-U', $user, "-d", "regression",
+                '-c', "SELECT master_add_node('$host', $port);")) == 0
+            or die "Could not add worker $port to the cluster";
+    }
+
+    # a schedule names its setup script and the workloads, each optionally
+    # followed by the executor and name=value settings to run it with
+    open(my $schedule, "<", catfile($benchmarkDir, $benchmarkSchedule))
+        or die "Could not open benchmark schedule $benchmarkSchedule";
+    while (my $line = <$schedule>)
+    {
+        if ($line =~ /^setup:\s*(\S+)/)
+        {
+            $setup = $1;
+        }
+        elsif ($line =~ /^bench:\s*(\S+)(.*)$/)
+        {
+            my $workload = $1;
+            my @settings = map { /=/ ? $_ : "citus.task_executor_type=$_" }
+                           split(' ', $2);
+
+            push(@workloads, [$workload, \@settings]);
+        }
+    }
+    close($schedule);
+
+    if (defined $setup)
+    {
+        system(catfile($bindir, "psql"),
+               ('-X', '-q', '-h', $host, '-p', $masterPort, '-U', $user, "-d", "regression",
+                '-v', 'ON_ERROR_STOP=1', @psqlVariables,
+                '-f', catfile($benchmarkDir, "$setup.sql"))) == 0
+            or die "Could not set up benchmark tables";
+    }
+
+    open(my $results, ">", $resultFile) or die "Could not create $resultFile";
+
+    for my $workloadEntry (@workloads)
+    {
+        my ($workload, $settings) = @$workloadEntry;
+        my $name = join('-', $workload, map { (split('=', $_, 2))[1] } @$settings);
+        my $logPrefix = catfile($resultDir, $name);
+        my $output = catfile($resultDir, "$name.out");
+
+        print "running benchmark $name ... ";
+
+        local $ENV{PGOPTIONS} = join(' ', $ENV{PGOPTIONS} || '',
+                                     map { "-c $_" } @$settings);
+
+        open(my $pgbench, "-|", catfile($bindir, "pgbench"),
+             ('-n', '-h', $host, '-p', $masterPort, '-U', $user,
+              '-c', $benchmarkClients, '-j', $benchmarkClients,
+              '-T', $benchmarkDuration, '-l', "--log-prefix=$logPrefix",
+              @pgbenchVariables, '-f', catfile($benchmarkDir, "$workload.sql"),
+              'regression'))
+            or die "Could not run pgbench";
+        open(my $outputFile, ">", $output) or die "Could not create $output";
+        print $outputFile $_ while (<$pgbench>);
+        close($outputFile);
+        close($pgbench) or die "Could not run benchmark $name, see $output";
+
+        my $line = BenchmarkResult($name, $commit, $logPrefix, $output);
+        print $results "$line\n";
+        print "$line\n";
+    }
+
+    close($results);
+
+    print "Benchmark results written to $resultFile\n";
+}
+
+# BenchmarkResult summarizes the output and per-transaction logs of a pgbench
+# run in a single line of JSON, with latencies in milliseconds.
+sub BenchmarkResult
+{
+    my ($workload, $commit, $logPrefix, $output) = @_;
+    my $tps = 0;
+    my @latencies = ();
+
+    open(my $outputFile, "<", $output) or die "Could not open $output";
+    while (my $line = <$outputFile>)
+    {
+        # report the throughput without the time to establish connections
+        if ($line =~ /^tps = ([0-9.]+) \((excluding|without)/)
+        {
+            $tps = $1;
+        }
+    }
+    close($outputFile);
+
+    # pgbench writes a log per thread, with the latency in microseconds in the third field
+    for my $logFile (glob("$logPrefix.[0-9]*"))
+    {
+        open(my $log, "<", $logFile) or die "Could not open $logFile";
+        while (my $line = <$log>)
+        {
+            my @fields = split(' ', $line);
+            push(@latencies, $fields[2] / 1000.0) if ($fields[2] =~ /^[0-9]+$/);
+        }
+        close($log);
+    }
+
+    @latencies = sort { $a <=> $b } @latencies;
+
+    my $count = scalar(@latencies);
+    my $sum = 0;
+    $sum += $_ for @latencies;
+
+    my $percentile = sub {
+        my ($fraction) = @_;
+        return 0 if ($count == 0);
+        my $index = int($fraction * $count + 0.5) - 1;
+        $index = 0 if ($index < 0);
+        return $latencies[$index];
+    };
+
+    return sprintf('{"workload": "%s", "commit": "%s", "clients": %d, "duration": %d, ' .
+                   '"transactions": %d, "tps": %.3f, "latency_avg": %.3f, ' .
+                   '"latency_p50": %.3f, "latency_p90": %.3f, "latency_p95": %.3f, ' .
+                   '"latency_p99": %.3f, "latency_max": %.3f}',
+                   $workload, $commit, $benchmarkClients, $benchmarkDuration, $count, $tps,
+                   $count > 0 ? $sum / $count : 0, $percentile->(0.50),
+                   $percentile->(0.90), $percentile->(0.95), $percentile->(0.99),
+                   $count > 0 ? $latencies[-1] : 0);
+}
+
 # Prepare pg_regress arguments
 my @arguments = (
     "--host", $host,
@@ -659,7 +837,11 @@ push(@arguments, @ARGV);
 my $startTime = time();
 
 # Finally run the tests
-if ($vanillatest)
+if (defined $benchmarkDir)
+{
+    RunBenchmarks();
+}
+elsif ($vanillatest)
 {
     $ENV{PGHOST} = $host;
     $ENV{PGPORT} = $masterPort;
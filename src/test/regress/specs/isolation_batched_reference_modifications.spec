@@ -0,0 +1,40 @@
+#
+# Tests citus.reference_table_batch_size, which lets the session that holds
+# the lock on a reference table shard run the modifications of the sessions
+# that wait for it.
+#
+setup
+{
+	CREATE TABLE batched_reference (id int PRIMARY KEY, value int);
+	SELECT create_reference_table('batched_reference');
+	INSERT INTO batched_reference VALUES (1, 1), (2, 2);
+}
+
+teardown
+{
+	DROP TABLE IF EXISTS batched_reference CASCADE;
+}
+
+session "s1"
+step "s1-begin" { BEGIN; }
+step "s1-update" { UPDATE batched_reference SET value = value + 1 WHERE id = 1; }
+step "s1-commit" { COMMIT; }
+
+session "s2"
+setup { SET citus.reference_table_batch_size TO 10; }
+step "s2-update" { UPDATE batched_reference SET value = value * 10 WHERE id = 1; }
+step "s2-delete" { DELETE FROM batched_reference WHERE id = 2; }
+
+session "s3"
+setup { SET citus.reference_table_batch_size TO 10; }
+step "s3-begin" { BEGIN; }
+step "s3-update" { UPDATE batched_reference SET value = value + 5 WHERE id = 1; }
+step "s3-commit" { COMMIT; }
+step "s3-select" { SELECT * FROM batched_reference ORDER BY id; }
+
+# waiting modifications are applied in the order in which they arrived
+permutation "s1-begin" "s1-update" "s2-update" "s3-update" "s1-commit" "s3-select"
+permutation "s1-begin" "s1-update" "s2-delete" "s3-update" "s1-commit" "s3-select"
+
+# modifications in transaction blocks are not batched
+permutation "s1-begin" "s1-update" "s2-update" "s3-begin" "s3-update" "s1-commit" "s3-commit" "s3-select"
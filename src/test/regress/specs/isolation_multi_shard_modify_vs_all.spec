@@ -102,6 +102,11 @@ step "s2-insert-into-select"
 	INSERT INTO users_test_table SELECT * FROM events_test_table;
 }
 
+step "s2-update_value_1_of_1_to_9"
+{
+	UPDATE users_test_table SET value_1 = 9 WHERE user_id = 1;
+}
+
 step "s2-update_all_value_1"
 {
 	UPDATE users_test_table SET value_1 = 6;
@@ -129,6 +134,8 @@ permutation "s1-begin" "s1-update_value_1_of_1_or_3_to_5" "s2-begin" "s2-update_
 permutation "s1-begin" "s1-update_value_1_of_1_or_3_to_5" "s2-begin" "s2-update_value_1_of_1_or_3_to_8" "s1-commit" "s2-commit" "s2-select" 
 permutation "s1-begin" "s1-update_all_value_1" "s2-begin" "s2-insert-to-table" "s1-commit" "s2-commit" "s2-select" 
 permutation "s1-begin" "s1-update_all_value_1" "s2-begin" "s2-insert-into-select" "s1-commit" "s2-commit" "s2-select"
+# router update of a row that a multi-shard update on all shards modifies
+permutation "s1-begin" "s1-update_all_value_1" "s2-begin" "s2-update_value_1_of_1_to_9" "s1-commit" "s2-commit" "s2-select"
 # multi-shard update affecting the same rows
 permutation "s1-begin" "s2-begin" "s1-update_value_1_of_1_or_3_to_5" "s2-update_value_1_of_1_or_3_to_8" "s1-commit" "s2-commit"
 # multi-shard update affecting the different rows
@@ -0,0 +1,148 @@
+# Tests for citus.max_tenant_concurrency and citus.max_tenant_queries_per_second.
+# Waits for tenant admission are not lock waits, replace_isolation_tester_func
+# makes them visible to the isolation tester.
+
+setup
+{
+	SELECT citus.replace_isolation_tester_func();
+	SELECT citus.refresh_isolation_tester_prepared_statement();
+
+	SET citus.shard_replication_factor TO 1;
+	CREATE TABLE tenant_events (tenant_id int, value int);
+	SELECT create_distributed_table('tenant_events', 'tenant_id');
+	INSERT INTO tenant_events VALUES (1, 1), (2, 1);
+}
+
+setup
+{
+	ALTER SYSTEM SET citus.max_tenant_concurrency TO 1;
+}
+
+setup
+{
+	SELECT pg_reload_conf();
+	SELECT pg_sleep(0.1);
+}
+
+teardown
+{
+	DROP TABLE tenant_events;
+	SELECT citus.restore_isolation_tester_func();
+}
+
+session "s1"
+
+step "s1-begin"
+{
+	BEGIN;
+}
+
+step "s1-update-1"
+{
+	UPDATE tenant_events SET value = value + 1 WHERE tenant_id = 1;
+}
+
+step "s1-select-1"
+{
+	SELECT value FROM tenant_events WHERE tenant_id = 1;
+}
+
+step "s1-select-2"
+{
+	SELECT value FROM tenant_events WHERE tenant_id = 2;
+}
+
+step "s1-sleep"
+{
+	SELECT pg_sleep(1);
+}
+
+step "s1-commit"
+{
+	COMMIT;
+}
+
+session "s2"
+
+step "s2-begin"
+{
+	BEGIN;
+}
+
+step "s2-update-1"
+{
+	UPDATE tenant_events SET value = value + 1 WHERE tenant_id = 1;
+}
+
+step "s2-commit"
+{
+	COMMIT;
+}
+
+step "s2-timed-select-2"
+{
+	BEGIN;
+	SELECT value FROM tenant_events WHERE tenant_id = 2;
+	SELECT clock_timestamp() - now() > interval '500ms' AS waited;
+	COMMIT;
+}
+
+session "s3"
+
+step "s3-timeout"
+{
+	SET statement_timeout TO '100ms';
+}
+
+step "s3-reset-timeout"
+{
+	RESET statement_timeout;
+}
+
+step "s3-select-1"
+{
+	SELECT value FROM tenant_events WHERE tenant_id = 1;
+}
+
+step "s3-admission-stats"
+{
+	SELECT active_queries, waiting_queries
+	FROM citus_tenant_admission_stats()
+	WHERE colocation_id = (SELECT colocationid FROM pg_dist_partition
+						   WHERE logicalrelid = 'tenant_events'::regclass)
+	AND active_queries + waiting_queries > 0;
+}
+
+step "s3-set-rate-limit"
+{
+	ALTER SYSTEM SET citus.max_tenant_queries_per_second TO 1;
+}
+
+step "s3-reset-rate-limit"
+{
+	ALTER SYSTEM RESET citus.max_tenant_queries_per_second;
+}
+
+step "s3-reset-concurrency-limit"
+{
+	ALTER SYSTEM RESET citus.max_tenant_concurrency;
+}
+
+step "s3-reload"
+{
+	SELECT pg_reload_conf();
+	SELECT pg_sleep(0.1);
+}
+
+# s3 waits for the admission of s2, which waits for the row lock of s1
+permutation "s1-begin" "s1-update-1" "s2-begin" "s2-update-1" "s3-select-1" "s1-commit" "s2-commit" "s3-reset-concurrency-limit" "s3-reload"
+
+# s1 already accessed the tenant's shard, so it does not wait for the admission of s2,
+# which would be a deadlock that no deadlock detector can see
+permutation "s1-begin" "s1-update-1" "s2-begin" "s2-update-1" "s1-select-1" "s1-commit" "s2-commit" "s3-reset-concurrency-limit" "s3-reload"
+
+# a cancelled wait is no longer counted
+permutation "s1-begin" "s1-update-1" "s2-begin" "s2-update-1" "s3-timeout" "s3-select-1" "s1-sleep" "s3-admission-stats" "s3-reset-timeout" "s1-commit" "s2-commit" "s3-reset-concurrency-limit" "s3-reload"
+
+# s2 waits for the next query of tenant 2 to be allowed
+permutation "s3-set-rate-limit" "s3-reload" "s1-select-2" "s2-timed-select-2" "s3-reset-rate-limit" "s3-reset-concurrency-limit" "s3-reload"
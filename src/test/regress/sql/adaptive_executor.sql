@@ -0,0 +1,83 @@
+--
+-- ADAPTIVE_EXECUTOR
+--
+-- Tests for the adaptive executor, which runs tasks over a pool of
+-- connections per worker node
+SET citus.next_shard_id TO 1650000;
+CREATE SCHEMA adaptive_executor;
+SET search_path TO adaptive_executor;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (x int, y int);
+SELECT create_distributed_table('test', 'x');
+INSERT INTO test VALUES (1,1), (2,2), (3,3), (4,4), (5,5);
+
+SET citus.task_executor_type TO 'adaptive';
+SET citus.max_adaptive_executor_pool_size TO 2;
+
+-- multi-shard queries run over at most 2 connections per worker
+SELECT count(*) FROM test;
+SELECT x, y FROM test ORDER BY x;
+
+-- router queries are handled by the adaptive executor as well
+SELECT y FROM test WHERE x = 3;
+
+-- multi-shard modifications
+UPDATE test SET y = y + 1;
+SELECT sum(y) FROM test;
+
+-- multi-shard modifications and reads in a transaction block
+BEGIN;
+DELETE FROM test WHERE x > 3;
+SELECT count(*) FROM test;
+UPDATE test SET y = 0;
+SELECT sum(y) FROM test;
+ROLLBACK;
+SELECT count(*), sum(y) FROM test;
+
+BEGIN;
+UPDATE test SET y = y - 1 WHERE x = 1;
+UPDATE test SET y = y - 1;
+SELECT x, y FROM test ORDER BY x;
+COMMIT;
+
+-- open all connections at once
+SET citus.executor_slow_start_interval TO 0;
+SELECT count(*) FROM test WHERE y > 0;
+
+-- reads fail over to the next placement and return all rows
+SET citus.shard_replication_factor TO 2;
+SET citus.shard_count TO 2;
+SET citus.task_assignment_policy TO 'first-replica';
+CREATE TABLE replicated (x int, y int);
+SELECT create_distributed_table('replicated', 'x');
+INSERT INTO replicated VALUES (1,1), (2,2), (3,3), (4,4), (5,5), (6,6), (7,7), (8,8);
+
+\c - - - :worker_1_port
+ALTER TABLE adaptive_executor.replicated_1650004 RENAME TO replicated_broken;
+\c - - - :master_port
+SET search_path TO adaptive_executor;
+SET citus.task_executor_type TO 'adaptive';
+SET citus.task_assignment_policy TO 'first-replica';
+
+SELECT count(*), sum(y) FROM replicated;
+SELECT x AS broken_x FROM replicated WHERE worker_hash(x) < 0 ORDER BY x LIMIT 1
+\gset
+
+-- modifications continue on the other placement and mark the failed one inactive
+UPDATE replicated SET y = y + 1 WHERE x = :broken_x;
+SELECT y = x + 1 AS updated FROM replicated WHERE x = :broken_x;
+SELECT nodeport, shardstate FROM pg_dist_shard_placement
+WHERE shardid = 1650004 ORDER BY placementid;
+
+\c - - - :worker_1_port
+ALTER TABLE adaptive_executor.replicated_broken RENAME TO replicated_1650004;
+\c - - - :master_port
+SET search_path TO adaptive_executor;
+DROP TABLE replicated;
+
+RESET citus.executor_slow_start_interval;
+RESET citus.max_adaptive_executor_pool_size;
+RESET citus.task_executor_type;
+DROP SCHEMA adaptive_executor CASCADE;
@@ -0,0 +1,38 @@
+--
+-- APPEND_COPY_PARALLEL
+--
+-- Tests for COPY into append-distributed tables that fills several shards at once
+SET citus.next_shard_id TO 1900000;
+CREATE SCHEMA append_copy_parallel;
+SET search_path TO append_copy_parallel;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_placement_policy TO 'round-robin';
+
+CREATE TABLE loads (id int);
+SELECT create_distributed_table('loads', 'id', 'append');
+
+-- rows are sent to two shards in turn, which are placed on different workers
+SET citus.append_copy_shard_count TO 2;
+COPY loads FROM PROGRAM 'seq 1 30000' WITH (FORMAT csv);
+
+SELECT count(*) AS shard_count, count(DISTINCT nodeport) AS node_count
+FROM pg_dist_shard JOIN pg_dist_shard_placement USING (shardid)
+WHERE logicalrelid = 'loads'::regclass;
+
+SELECT count(*), min(id), max(id) FROM loads;
+
+-- small loads only fill the first shard
+COPY loads FROM PROGRAM 'seq 30001 30010' WITH (FORMAT csv);
+
+SELECT count(*) FROM pg_dist_shard WHERE logicalrelid = 'loads'::regclass;
+
+-- by default, a COPY fills a single shard
+RESET citus.append_copy_shard_count;
+SHOW citus.append_copy_shard_count;
+COPY loads FROM PROGRAM 'seq 30011 60000' WITH (FORMAT csv);
+
+SELECT count(*) FROM pg_dist_shard WHERE logicalrelid = 'loads'::regclass;
+SELECT count(*), min(id), max(id) FROM loads;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA append_copy_parallel CASCADE;
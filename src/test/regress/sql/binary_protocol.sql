@@ -0,0 +1,58 @@
+--
+-- BINARY_PROTOCOL
+--
+-- Tests for citus.enable_binary_protocol, which fetches the results of
+-- router queries in binary format
+SET citus.next_shard_id TO 1680000;
+CREATE SCHEMA binary_protocol;
+SET search_path TO binary_protocol;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 2;
+
+CREATE TABLE test (key int, ts timestamp, amount numeric, data jsonb, tags text[]);
+SELECT create_distributed_table('test', 'key');
+
+SET citus.enable_binary_protocol TO on;
+
+INSERT INTO test VALUES (1, '2018-01-01 10:00:00', 1.5, '{"a": 1}', '{x,y}')
+RETURNING *;
+INSERT INTO test VALUES (2, NULL, NULL, NULL, NULL) RETURNING *;
+
+SELECT * FROM test WHERE key = 1;
+SELECT * FROM test WHERE key = 2;
+SELECT key, amount * 2 AS double_amount, data->'a' AS a FROM test WHERE key = 1;
+
+-- also within a transaction block and for prepared statements
+BEGIN;
+SELECT * FROM test WHERE key = 1;
+UPDATE test SET amount = amount + 1 WHERE key = 1 RETURNING key, amount;
+COMMIT;
+
+PREPARE select_by_key(int) AS SELECT * FROM test WHERE key = $1;
+EXECUTE select_by_key(1);
+EXECUTE select_by_key(2);
+
+SET citus.enable_binary_protocol TO off;
+SELECT * FROM test WHERE key = 1;
+
+-- citus.enable_copy_result_transfer fetches the rows via COPY
+SET citus.enable_copy_result_transfer TO on;
+SELECT * FROM test WHERE key = 1;
+SELECT * FROM test WHERE key = 2;
+
+SET citus.enable_binary_protocol TO on;
+SELECT * FROM test WHERE key = 1;
+SELECT key, amount * 2 AS double_amount, data->'a' AS a FROM test WHERE key = 1;
+
+BEGIN;
+SELECT * FROM test WHERE key = 2;
+COMMIT;
+
+-- parameterized queries are not wrapped in COPY
+EXECUTE select_by_key(1);
+
+RESET citus.enable_binary_protocol;
+RESET citus.enable_copy_result_transfer;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA binary_protocol CASCADE;
@@ -0,0 +1,54 @@
+--
+-- BROADCAST_JOIN
+--
+-- Tests for broadcasting small distributed tables in joins that are not on
+-- the distribution columns
+SET citus.next_shard_id TO 1800000;
+CREATE SCHEMA broadcast_join;
+SET search_path TO broadcast_join;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE orders (order_id int, customer_id int);
+SELECT create_distributed_table('orders', 'order_id');
+INSERT INTO orders SELECT i, i % 25 FROM generate_series(1, 4000) i;
+
+CREATE TABLE customers (id int, region int);
+SELECT create_distributed_table('customers', 'region');
+INSERT INTO customers SELECT i, i % 3 FROM generate_series(0, 24) i;
+
+-- the join requires repartitioning by default
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+-- tables without shard statistics are not broadcast
+SET citus.broadcast_join_threshold TO '1MB';
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+SELECT count(master_update_shard_statistics(shardid)) FROM pg_dist_shard
+WHERE logicalrelid IN ('orders'::regclass, 'customers'::regclass);
+
+-- now customers is broadcast, and the join runs on the orders shards
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+SELECT c.region, count(*)
+FROM orders o JOIN customers c ON (o.customer_id = c.id)
+WHERE o.order_id > 100
+GROUP BY c.region
+ORDER BY c.region;
+
+-- outer joins are not broadcast
+SELECT count(*) FROM orders o LEFT JOIN customers c ON (o.customer_id = c.id);
+
+-- neither are tables above the threshold
+SET citus.broadcast_join_threshold TO '1kB';
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+-- instead, orders can be reduced to the rows that join with the customers
+SET citus.semi_join_reduction_threshold TO '1MB';
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id AND c.region = 1;
+RESET citus.semi_join_reduction_threshold;
+
+RESET citus.broadcast_join_threshold;
+SET client_min_messages TO WARNING;
+DROP SCHEMA broadcast_join CASCADE;
@@ -0,0 +1,44 @@
+--
+-- COLUMN_STATISTICS
+--
+-- Tests for merging the column statistics of shards into the coordinator's
+-- catalog
+SET citus.next_shard_id TO 2060000;
+CREATE SCHEMA column_statistics;
+SET search_path TO column_statistics;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE events (event_id int, category int, note text);
+SELECT create_distributed_table('events', 'event_id');
+INSERT INTO events
+SELECT i, i % 4, CASE WHEN i % 10 = 0 THEN NULL ELSE 'note' END
+FROM generate_series(1, 1000) i;
+
+-- without the setting, ANALYZE leaves the coordinator without statistics
+ANALYZE events;
+SELECT reltuples FROM pg_class WHERE oid = 'events'::regclass;
+SELECT count(*) FROM pg_stats WHERE schemaname = 'column_statistics';
+
+SET citus.update_shard_statistics_on_analyze TO on;
+ANALYZE events;
+SELECT reltuples FROM pg_class WHERE oid = 'events'::regclass;
+SELECT attname, null_frac, n_distinct, most_common_vals IS NOT NULL AS has_mcv
+FROM pg_stats WHERE schemaname = 'column_statistics' AND tablename = 'events'
+ORDER BY attname;
+RESET citus.update_shard_statistics_on_analyze;
+
+-- statistics can also be updated on demand
+DELETE FROM events WHERE event_id > 500;
+ANALYZE events;
+SELECT master_update_column_statistics('events');
+SELECT reltuples FROM pg_class WHERE oid = 'events'::regclass;
+SELECT attname, n_distinct FROM pg_stats
+WHERE schemaname = 'column_statistics' AND tablename = 'events'
+ORDER BY attname;
+
+CREATE TABLE local_table (id int);
+SELECT master_update_column_statistics('local_table');
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA column_statistics CASCADE;
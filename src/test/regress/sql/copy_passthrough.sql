@@ -0,0 +1,79 @@
+--
+-- COPY_PASSTHROUGH
+--
+-- Tests for COPY into distributed tables in which only the partition column
+-- is parsed on the coordinator, and the other fields are passed on to shards
+SET citus.next_shard_id TO 1860000;
+CREATE SCHEMA copy_passthrough;
+SET search_path TO copy_passthrough;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+-- the partition column follows a dropped column
+CREATE TABLE events (dropped int, value text, id int, visits int);
+ALTER TABLE events DROP COLUMN dropped;
+SELECT create_distributed_table('events', 'id');
+
+CREATE TABLE countries (code text, name text);
+SELECT create_reference_table('countries');
+
+SET citus.enable_copy_passthrough TO on;
+
+COPY events FROM STDIN;
+one	1	1
+tab\there	2	2
+back\\slash	3	\N
+\N	4	4
+\.
+
+COPY events FROM STDIN WITH (format csv, header true);
+value,id,visits
+"quoted, comma",5,5
+,6,6
+"",7,
+\.
+
+COPY countries FROM STDIN WITH (format csv);
+nl,Netherlands
+tr,Turkey
+\.
+
+SELECT id, replace(value, E'\t', '<tab>') AS value, visits FROM events ORDER BY id;
+SELECT * FROM countries ORDER BY code;
+
+-- rows need a field for each column
+COPY events FROM STDIN;
+eight	8
+\.
+
+COPY events FROM STDIN;
+eight	8	8	extra
+\.
+
+-- the partition column is still parsed and checked on the coordinator
+COPY events FROM STDIN;
+eight	\N	8
+\.
+
+COPY events FROM STDIN;
+eight	eight	8
+\.
+
+-- the columns may be listed in any order
+COPY events (visits, id, value) FROM STDIN WITH (format csv);
+10,10,ten
+11,11,"eleven, again"
+\.
+
+SELECT * FROM events WHERE id >= 10 ORDER BY id;
+
+-- copying a subset of the columns parses all rows on the coordinator
+COPY events (id, value) FROM STDIN;
+9	nine
+\.
+
+SELECT count(*), count(visits) FROM events;
+
+RESET citus.enable_copy_passthrough;
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_passthrough CASCADE;
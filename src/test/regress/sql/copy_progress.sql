@@ -0,0 +1,36 @@
+--
+-- COPY_PROGRESS
+--
+-- Tests for tracking the progress of COPY into distributed tables
+SET citus.next_shard_id TO 1890000;
+CREATE SCHEMA copy_progress;
+SET search_path TO copy_progress;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE loads (id int, payload text);
+SELECT create_distributed_table('loads', 'id');
+
+SET citus.track_copy_progress TO on;
+
+COPY loads FROM STDIN WITH (FORMAT csv);
+1,one
+2,two
+3,three
+4,four
+5,five
+\.
+
+-- INSERT ... SELECT via the coordinator also tracks its progress
+INSERT INTO loads SELECT s, 'generated' FROM generate_series(6, 100) s;
+
+SELECT count(*) FROM loads;
+
+-- finished commands no longer show up
+SELECT count(*) FROM citus_stat_copy_progress;
+
+RESET citus.track_copy_progress;
+SHOW citus.track_copy_progress;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_progress CASCADE;
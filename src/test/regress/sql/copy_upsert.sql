@@ -0,0 +1,65 @@
+--
+-- COPY_UPSERT
+--
+-- Tests for COPY ... WITH (on_conflict ...), which upserts the copied rows
+-- into distributed tables
+SET citus.next_shard_id TO 2030000;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+CREATE TABLE copy_upsert_table (key int PRIMARY KEY, value text, counter int DEFAULT 0);
+SELECT create_distributed_table('copy_upsert_table', 'key');
+COPY copy_upsert_table (key, value) FROM STDIN WITH (on_conflict update);
+1	one
+2	two
+3	three
+\.
+-- existing keys are updated, and the last row with a key wins
+COPY copy_upsert_table (key, value) FROM STDIN WITH (on_conflict update);
+2	deux
+4	four
+4	quatre
+\.
+SELECT * FROM copy_upsert_table ORDER BY key;
+-- columns that are not copied keep their value
+UPDATE copy_upsert_table SET counter = 5 WHERE key = 1;
+COPY copy_upsert_table (value, key) FROM STDIN WITH (on_conflict update, format csv);
+uno,1
+\.
+SELECT * FROM copy_upsert_table WHERE key = 1;
+-- rows with existing keys are skipped, and the first row with a key wins
+COPY copy_upsert_table FROM STDIN WITH (on_conflict nothing, format csv);
+1,ein,1
+5,five,1
+5,cinq,2
+\.
+SELECT * FROM copy_upsert_table ORDER BY key;
+-- upserts are part of the transaction
+BEGIN;
+COPY copy_upsert_table (key, value) FROM STDIN WITH (on_conflict update);
+3	drei
+\.
+SELECT value FROM copy_upsert_table WHERE key = 3;
+ROLLBACK;
+SELECT value FROM copy_upsert_table WHERE key = 3;
+-- upserts into reference tables are applied to all placements
+CREATE TABLE copy_upsert_reference (key text PRIMARY KEY, value int);
+SELECT create_reference_table('copy_upsert_reference');
+COPY copy_upsert_reference FROM STDIN WITH (on_conflict update);
+a	1
+b	2
+\.
+COPY copy_upsert_reference FROM STDIN WITH (on_conflict update);
+b	3
+c	4
+\.
+SELECT * FROM copy_upsert_reference ORDER BY key;
+-- errors
+COPY copy_upsert_table (value) FROM STDIN WITH (on_conflict update);
+COPY copy_upsert_table FROM STDIN WITH (on_conflict replace);
+CREATE TABLE copy_upsert_no_key (key int, value text);
+SELECT create_distributed_table('copy_upsert_no_key', 'key');
+COPY copy_upsert_no_key FROM STDIN WITH (on_conflict update);
+CREATE TABLE copy_upsert_append (key int PRIMARY KEY, value text);
+SELECT create_distributed_table('copy_upsert_append', 'key', 'append');
+COPY copy_upsert_append FROM STDIN WITH (on_conflict update);
+DROP TABLE copy_upsert_table, copy_upsert_reference, copy_upsert_no_key, copy_upsert_append;
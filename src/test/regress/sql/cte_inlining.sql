@@ -0,0 +1,46 @@
+--
+-- CTE_INLINING
+--
+-- Tests for inlining CTEs that are referenced once into distributed queries
+SET citus.next_shard_id TO 1830000;
+CREATE SCHEMA cte_inlining;
+SET search_path TO cte_inlining;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE cte_table (a int, b int);
+SELECT create_distributed_table('cte_table', 'a');
+INSERT INTO cte_table VALUES (1, 1), (2, 2), (3, 3), (4, 4), (5, 0),
+							(6, 1), (7, 2), (8, 3), (9, 4), (10, 0);
+
+SET client_min_messages TO DEBUG1;
+
+-- by default, the CTE is planned separately
+WITH cte AS (SELECT a, b FROM cte_table)
+SELECT count(*) FROM cte WHERE a = 5;
+
+SET citus.enable_cte_inlining TO on;
+
+-- once inlined, the query becomes a router query
+WITH cte AS (SELECT a, b FROM cte_table)
+SELECT count(*) FROM cte WHERE a = 5;
+
+-- CTEs that are referenced more than once are not inlined
+WITH cte AS (SELECT a, b FROM cte_table)
+SELECT count(*) FROM cte c1, cte c2 WHERE c1.a = c2.a;
+
+-- an inlined CTE that groups by the distribution column is pushed down
+WITH cte AS (SELECT a, count(*) FROM cte_table GROUP BY a)
+SELECT count(*) FROM cte;
+
+-- CTEs are also inlined into the subqueries that reference them
+WITH cte AS (SELECT a FROM cte_table)
+SELECT count(*) FROM (SELECT * FROM cte WHERE a > 5) AS foo;
+
+-- CTEs with volatile functions are not inlined
+WITH cte AS (SELECT a, random() AS r FROM cte_table)
+SELECT count(*) FROM cte WHERE a = 5;
+
+SET client_min_messages TO WARNING;
+RESET citus.enable_cte_inlining;
+DROP SCHEMA cte_inlining CASCADE;
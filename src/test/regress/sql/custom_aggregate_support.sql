@@ -0,0 +1,37 @@
+-- Tests for pushing down aggregates through their combine functions
+CREATE SCHEMA custom_aggregate;
+SET search_path TO custom_aggregate;
+
+CREATE TABLE agg_test (id int, val int, kind int);
+SELECT create_distributed_table('custom_aggregate.agg_test','id');
+INSERT INTO agg_test VALUES (1, 1, 99), (2, 2, 99), (2, 4, 88), (3, NULL, 88);
+
+-- an aggregate with an ordinary transition type, and one with an internal one
+CREATE AGGREGATE my_sum(int) (
+    SFUNC = int4pl, STYPE = int, COMBINEFUNC = int4pl, INITCOND = '0'
+);
+SELECT run_command_on_workers($$CREATE AGGREGATE custom_aggregate.my_sum(int) (
+    SFUNC = int4pl, STYPE = int, COMBINEFUNC = int4pl, INITCOND = '0'
+)$$);
+CREATE AGGREGATE my_avg(numeric) (
+    SFUNC = numeric_avg_accum, STYPE = internal, FINALFUNC = numeric_avg,
+    COMBINEFUNC = numeric_avg_combine, SERIALFUNC = numeric_avg_serialize,
+    DESERIALFUNC = numeric_avg_deserialize
+);
+SELECT run_command_on_workers($$CREATE AGGREGATE custom_aggregate.my_avg(numeric) (
+    SFUNC = numeric_avg_accum, STYPE = internal, FINALFUNC = numeric_avg,
+    COMBINEFUNC = numeric_avg_combine, SERIALFUNC = numeric_avg_serialize,
+    DESERIALFUNC = numeric_avg_deserialize
+)$$);
+
+SELECT my_sum(val), my_avg(val) FROM agg_test;
+SELECT kind, my_sum(val), my_avg(val) FROM agg_test GROUP BY kind ORDER BY 2;
+
+-- filters, and workers without rows
+SELECT my_sum(val) FILTER (WHERE id > 1) FROM agg_test;
+SELECT my_sum(val), my_avg(val) FROM agg_test WHERE id > 10;
+
+-- distinct cannot be combined across workers
+SELECT my_sum(DISTINCT val) FROM agg_test;
+
+DROP SCHEMA custom_aggregate CASCADE;
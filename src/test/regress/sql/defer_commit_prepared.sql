@@ -0,0 +1,63 @@
+--
+-- DEFER_COMMIT_PREPARED
+--
+-- Tests for leaving COMMIT PREPARED to the maintenance daemon
+SET citus.next_shard_id TO 1920000;
+CREATE SCHEMA defer_commit_prepared;
+SET search_path TO defer_commit_prepared;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.multi_shard_commit_protocol TO '2pc';
+
+-- waits until the maintenance daemon committed all prepared transactions
+CREATE FUNCTION wait_for_prepared_transactions()
+RETURNS bool
+LANGUAGE plpgsql
+AS $function$
+DECLARE
+	remaining int;
+BEGIN
+	FOR i IN 1 .. 300 LOOP
+		SELECT sum(result::int) INTO remaining
+		FROM run_command_on_workers($$SELECT count(*) FROM pg_prepared_xacts
+									  WHERE gid LIKE 'citus\_%'$$);
+		IF remaining = 0 THEN
+			RETURN true;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+	RETURN false;
+END;
+$function$;
+
+CREATE TABLE items (id int, value int);
+SELECT create_distributed_table('items', 'id');
+
+SET citus.defer_commit_prepared TO on;
+
+COPY items FROM STDIN WITH (FORMAT csv);
+1,1
+2,2
+3,3
+4,4
+5,5
+\.
+SELECT wait_for_prepared_transactions();
+SELECT count(*), sum(value) FROM items;
+
+UPDATE items SET value = value * 10;
+SELECT wait_for_prepared_transactions();
+SELECT count(*), sum(value) FROM items;
+
+-- a transaction that failed on the coordinator leaves nothing behind
+BEGIN;
+DELETE FROM items;
+SELECT 1/0;
+COMMIT;
+SELECT wait_for_prepared_transactions();
+SELECT count(*), sum(value) FROM items;
+
+RESET citus.defer_commit_prepared;
+RESET citus.multi_shard_commit_protocol;
+SET client_min_messages TO WARNING;
+DROP SCHEMA defer_commit_prepared CASCADE;
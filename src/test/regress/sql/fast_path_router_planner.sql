@@ -0,0 +1,86 @@
+--
+-- FAST_PATH_ROUTER_PLANNER
+--
+-- Tests for planning simple single-shard queries without the postgres planner
+SET citus.next_shard_id TO 1810000;
+CREATE SCHEMA fast_path_router;
+SET search_path TO fast_path_router;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE users (user_id int, name text, score int);
+SELECT create_distributed_table('users', 'user_id');
+INSERT INTO users SELECT i, 'user_' || i, i % 7 FROM generate_series(1, 100) i;
+
+CREATE TABLE countries (code text, name text);
+SELECT create_reference_table('countries');
+INSERT INTO countries VALUES ('nl', 'Netherlands'), ('tr', 'Turkey');
+
+-- equality filters on the distribution column
+SELECT * FROM users WHERE user_id = 15;
+SELECT name, score FROM users WHERE 43 = user_id AND score > 0;
+SELECT count(*), max(score) FROM users WHERE user_id = 7;
+SELECT user_id FROM users WHERE user_id = 20 ORDER BY score DESC, name LIMIT 1;
+
+-- filters that prune all shards
+SELECT * FROM users WHERE user_id = 15 AND false;
+SELECT * FROM users WHERE user_id = 15 AND user_id = 16;
+SELECT * FROM users WHERE user_id = 1000;
+
+-- null values take the regular code path
+SELECT * FROM users WHERE user_id = NULL;
+
+-- reference tables
+SELECT name FROM countries WHERE code = 'tr';
+SELECT count(*) FROM countries;
+
+-- prepared statements, executed often enough to use a generic plan, which
+-- defers shard pruning to the executor
+PREPARE user_by_id(int) AS SELECT name FROM users WHERE user_id = $1;
+EXECUTE user_by_id(1);
+EXECUTE user_by_id(2);
+EXECUTE user_by_id(3);
+EXECUTE user_by_id(4);
+EXECUTE user_by_id(5);
+EXECUTE user_by_id(6);
+EXECUTE user_by_id(7);
+
+PREPARE user_score(int, int) AS SELECT score + $2 FROM users WHERE user_id = $1;
+EXECUTE user_score(1, 100);
+EXECUTE user_score(2, 100);
+EXECUTE user_score(3, 100);
+EXECUTE user_score(4, 100);
+EXECUTE user_score(5, 100);
+EXECUTE user_score(6, 100);
+EXECUTE user_score(7, 100);
+
+-- a null parameter prunes all shards
+EXECUTE user_by_id(NULL);
+
+-- parameters in SQL functions only get their values during execution
+CREATE FUNCTION user_score_sql(int) RETURNS int AS $$
+	SELECT score FROM users WHERE user_id = $1;
+$$ LANGUAGE sql;
+SELECT user_score_sql(10);
+SELECT user_score_sql(11);
+
+-- parameters in PL/pgSQL functions
+CREATE FUNCTION user_name(int) RETURNS text AS $$
+DECLARE
+	result text;
+BEGIN
+	SELECT name INTO result FROM users WHERE user_id = $1;
+	RETURN result;
+END;
+$$ LANGUAGE plpgsql;
+SELECT user_name(3);
+SELECT user_name(4);
+
+-- the regular planner gives the same results
+SET citus.enable_fast_path_router_planner TO off;
+SELECT * FROM users WHERE user_id = 15;
+SELECT * FROM users WHERE user_id = 15 AND false;
+RESET citus.enable_fast_path_router_planner;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA fast_path_router CASCADE;
@@ -0,0 +1,39 @@
+--
+-- FOREIGN_KEY_VALIDATION
+--
+-- Tests for citus.parallel_foreign_key_validation, which adds foreign keys to
+-- the shards as NOT VALID and validates them afterwards
+SET citus.next_shard_id TO 2100000;
+CREATE SCHEMA foreign_key_validation;
+SET search_path TO foreign_key_validation;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE referenced (id int PRIMARY KEY);
+CREATE TABLE referencing (id int, ref_id int);
+SELECT create_distributed_table('referenced', 'id', colocate_with => 'none');
+SELECT create_distributed_table('referencing', 'ref_id', colocate_with => 'referenced');
+INSERT INTO referenced SELECT s FROM generate_series(1, 100) s;
+INSERT INTO referencing SELECT s, s FROM generate_series(1, 100) s;
+
+SET citus.parallel_foreign_key_validation TO on;
+ALTER TABLE referencing ADD CONSTRAINT referencing_ref_id_fkey
+	FOREIGN KEY (ref_id) REFERENCES referenced (id);
+
+-- the constraint is valid on all shards
+SELECT DISTINCT success, result FROM run_command_on_placements('referencing',
+	$$SELECT bool_and(convalidated) FROM pg_constraint
+	  WHERE conrelid = '%s'::regclass AND contype = 'f'$$);
+
+ALTER TABLE referencing DROP CONSTRAINT referencing_ref_id_fkey;
+
+-- constraints that are added as NOT VALID remain so
+ALTER TABLE referencing ADD CONSTRAINT referencing_ref_id_fkey
+	FOREIGN KEY (ref_id) REFERENCES referenced (id) NOT VALID;
+SELECT DISTINCT success, result FROM run_command_on_placements('referencing',
+	$$SELECT bool_and(convalidated) FROM pg_constraint
+	  WHERE conrelid = '%s'::regclass AND contype = 'f'$$);
+
+RESET citus.parallel_foreign_key_validation;
+SET client_min_messages TO WARNING;
+DROP SCHEMA foreign_key_validation CASCADE;
@@ -0,0 +1,60 @@
+--
+-- HEDGED_READS
+--
+-- Tests for citus.hedged_read_percentile, which sends slow router queries
+-- on replicated shards to another placement as well
+SET citus.next_shard_id TO 1740000;
+CREATE SCHEMA hedged_reads;
+SET search_path TO hedged_reads;
+SET citus.shard_replication_factor TO 2;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (key int, value int);
+SELECT create_distributed_table('test', 'key');
+INSERT INTO test SELECT i, i * 10 FROM generate_series(1, 10) i;
+
+CREATE TABLE ref (key int, name text);
+SELECT create_reference_table('ref');
+INSERT INTO ref SELECT i, 'name ' || i FROM generate_series(1, 10) i;
+
+CREATE FUNCTION run_lookups(lookup_count int)
+RETURNS bigint AS $$
+DECLARE
+	total bigint := 0;
+	i int;
+BEGIN
+	FOR i IN 1..lookup_count LOOP
+		total := total + (SELECT value FROM test WHERE key = i % 10 + 1);
+		total := total + (SELECT length(name) FROM ref WHERE key = i % 10 + 1);
+	END LOOP;
+	RETURN total;
+END;
+$$ LANGUAGE plpgsql;
+
+-- a low percentile hedges most queries once enough history is collected
+SET citus.hedged_read_percentile TO 1;
+SELECT run_lookups(40);
+SELECT value FROM test WHERE key = 3;
+SELECT name FROM ref WHERE key = 7;
+
+PREPARE lookup(int) AS SELECT value FROM test WHERE key = $1;
+EXECUTE lookup(1);
+EXECUTE lookup(2);
+EXECUTE lookup(3);
+EXECUTE lookup(4);
+EXECUTE lookup(5);
+EXECUTE lookup(6);
+
+-- the first placement is used in transaction blocks
+BEGIN;
+SELECT run_lookups(20);
+UPDATE test SET value = value + 1 WHERE key = 5;
+SELECT value FROM test WHERE key = 5;
+ROLLBACK;
+
+SET citus.hedged_read_percentile TO 90;
+SELECT run_lookups(40);
+
+RESET citus.hedged_read_percentile;
+SET client_min_messages TO WARNING;
+DROP SCHEMA hedged_reads CASCADE;
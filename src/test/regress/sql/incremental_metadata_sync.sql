@@ -0,0 +1,44 @@
+--
+-- INCREMENTAL_METADATA_SYNC
+--
+-- Tests for only sending metadata differences to workers that have metadata
+SET citus.next_shard_id TO 1960000;
+CREATE SCHEMA incremental_metadata_sync;
+SET search_path TO incremental_metadata_sync;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.replication_model TO 'streaming';
+
+CREATE TABLE mx_items (id int, value int);
+SELECT create_distributed_table('mx_items', 'id');
+SELECT start_metadata_sync_to_node('localhost', :worker_1_port);
+
+-- let the metadata on the worker diverge
+\c - - - :worker_1_port
+DELETE FROM pg_dist_placement WHERE shardid = 1960000;
+UPDATE pg_dist_shard SET shardmaxvalue = '0' WHERE shardid = 1960001;
+UPDATE pg_dist_placement SET shardlength = 100 WHERE shardid = 1960002;
+INSERT INTO pg_dist_shard (logicalrelid, shardid, shardstorage, shardminvalue, shardmaxvalue)
+  VALUES ('incremental_metadata_sync.mx_items'::regclass, 1969999, 't', '1', '2');
+INSERT INTO pg_dist_placement (placementid, shardid, shardstate, shardlength, groupid)
+  VALUES (1969999, 1969999, 1, 0, 0);
+
+-- only the differences are sent
+\c - - - :master_port
+SET citus.incremental_metadata_sync TO on;
+SELECT start_metadata_sync_to_node('localhost', :worker_1_port);
+
+\c - - - :worker_1_port
+SELECT shardid, shardstorage, shardminvalue, shardmaxvalue FROM pg_dist_shard
+WHERE logicalrelid = 'incremental_metadata_sync.mx_items'::regclass ORDER BY shardid;
+SELECT shardid, shardstate, shardlength FROM pg_dist_placement
+WHERE shardid BETWEEN 1960000 AND 1969999 ORDER BY shardid;
+
+-- the worker can still run queries on the table
+INSERT INTO incremental_metadata_sync.mx_items VALUES (1, 1), (2, 2);
+SELECT count(*) FROM incremental_metadata_sync.mx_items;
+
+\c - - - :master_port
+DROP TABLE incremental_metadata_sync.mx_items;
+SELECT stop_metadata_sync_to_node('localhost', :worker_1_port);
+DROP SCHEMA incremental_metadata_sync CASCADE;
@@ -0,0 +1,37 @@
+--
+-- INTERMEDIATE_RESULT_PRUNING
+--
+-- Tests for sending the results of subplans only to the workers that
+-- hold a placement of a task reading them
+SET citus.next_shard_id TO 1770000;
+CREATE SCHEMA intermediate_result_pruning;
+SET search_path TO intermediate_result_pruning;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (x int, y int);
+SELECT create_distributed_table('test', 'x');
+INSERT INTO test VALUES (1, 10), (2, 20), (3, 30), (4, 40);
+
+-- the result is only read by a router query on a single shard
+WITH a AS (SELECT y FROM test WHERE x = 1)
+SELECT count(*) FROM test WHERE x = 2 AND y > (SELECT y FROM a);
+
+-- the result is read by the tasks on all shards
+WITH a AS (SELECT y FROM test WHERE x = 1)
+SELECT count(*) FROM test WHERE y > (SELECT y FROM a);
+
+-- the result of a is only read by the task of b
+WITH a AS (SELECT y FROM test WHERE x = 1),
+     b AS (SELECT x FROM test WHERE x = 2 AND y > (SELECT y FROM a))
+SELECT count(*) FROM test JOIN b USING (x);
+
+-- the same inside a transaction block
+BEGIN;
+UPDATE test SET y = y + 1 WHERE x = 2;
+WITH a AS (SELECT y FROM test WHERE x = 1)
+SELECT y FROM test WHERE x = 2 AND y > (SELECT y FROM a);
+ROLLBACK;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA intermediate_result_pruning CASCADE;
@@ -119,4 +119,99 @@ WITH (FORMAT text);
 
 SELECT * FROM squares ORDER BY x;
 
+-- compressed intermediate results
+BEGIN;
+SET LOCAL citus.intermediate_result_compression TO 'pglz';
+SELECT create_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int);
+
+-- results that span several compressed blocks
+SELECT create_intermediate_result('hellos', $$SELECT s, 'hello-'||s FROM generate_series(1,100000) s$$);
+SELECT count(*), sum(x), count(DISTINCT y) FROM read_intermediate_result('hellos', 'binary') AS res (x int, y text);
+
+-- compressed results are also understood by the workers
+SELECT broadcast_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT x, x2
+FROM interesting_squares JOIN (SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int)) squares ON (x::text = interested_in)
+WHERE user_id = 'jon'
+ORDER BY x;
+END;
+
+SET citus.intermediate_result_compression TO 'pglz';
+WITH users AS (SELECT DISTINCT user_id FROM interesting_squares)
+SELECT count(*) FROM interesting_squares WHERE user_id IN (SELECT user_id FROM users);
+RESET citus.intermediate_result_compression;
+
+-- small results are kept in memory, larger ones are written to a file
+BEGIN;
+SET LOCAL citus.max_memory_intermediate_result_size TO '1kB';
+SELECT create_intermediate_result('small', 'SELECT s FROM generate_series(1,10) s');
+SELECT create_intermediate_result('large', 'SELECT s FROM generate_series(1,1000) s');
+SELECT sum(x) FROM read_intermediate_result('small', 'binary') AS res (x int);
+SELECT sum(x) FROM read_intermediate_result('large', 'binary') AS res (x int);
+-- a result that is created again replaces the earlier one, wherever it was stored
+SELECT create_intermediate_result('small', 'SELECT s FROM generate_series(1,2000) s');
+SELECT sum(x) FROM read_intermediate_result('small', 'binary') AS res (x int);
+SELECT create_intermediate_result('small', 'SELECT s FROM generate_series(1,3) s');
+SELECT sum(x) FROM read_intermediate_result('small', 'binary') AS res (x int);
+-- memory-resident results can be compressed
+SET LOCAL citus.intermediate_result_compression TO 'pglz';
+SELECT create_intermediate_result('small', 'SELECT s FROM generate_series(1,50) s');
+SELECT sum(x) FROM read_intermediate_result('small', 'binary') AS res (x int);
+SELECT broadcast_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT x, x2
+FROM interesting_squares JOIN (SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int)) squares ON (x::text = interested_in)
+WHERE user_id = 'jon'
+ORDER BY x;
+END;
+
+-- with memory-resident results disabled, all results are written to files
+SET citus.max_memory_intermediate_result_size TO 0;
+WITH users AS (SELECT DISTINCT user_id FROM interesting_squares)
+SELECT count(*) FROM interesting_squares WHERE user_id IN (SELECT user_id FROM users);
+RESET citus.max_memory_intermediate_result_size;
+
+-- intermediate result files are accounted in the job cache of the node
+BEGIN;
+SET LOCAL citus.max_memory_intermediate_result_size TO 0;
+SELECT create_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT kind, result_id, file_count, total_bytes > 0 AS has_data
+FROM citus_job_cache_usage WHERE result_id = 'squares';
+-- writes fail once the job cache exceeds the node-wide quota
+SET LOCAL citus.max_job_cache_size TO '1kB';
+SELECT create_intermediate_result('large', 'SELECT s FROM generate_series(1,1000) s');
+END;
+
+-- intermediate results are read row by row, also when rescanned
+BEGIN;
+SELECT create_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,10) s');
+SELECT x, x2 FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int) WHERE x2 > 50 ORDER BY x;
+SET LOCAL enable_hashjoin TO off;
+SET LOCAL enable_mergejoin TO off;
+SET LOCAL enable_material TO off;
+SELECT count(*) FROM generate_series(1,3) g, read_intermediate_result('squares', 'binary') AS res (x int, x2 int) WHERE x = g;
+-- whole-row references are read by a function scan
+SELECT res FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int) WHERE x = 3;
+SET LOCAL citus.enable_intermediate_result_streaming TO off;
+EXPLAIN (COSTS OFF) SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int);
+END;
+
+-- results with a session lifetime outlive the transaction that created them
+SELECT create_intermediate_result('session_squares', 'SELECT s, s*s FROM generate_series(1,5) s', session_lifetime := true);
+SELECT sum(x2) FROM read_intermediate_result('session_squares', 'binary') AS res (x int, x2 int);
+SELECT broadcast_intermediate_result('session_cubes', 'SELECT s, s*s*s FROM generate_series(1,5) s', session_lifetime := true);
+SELECT x, x3
+FROM interesting_squares JOIN (SELECT * FROM read_intermediate_result('session_cubes', 'binary') AS res (x int, x3 int)) cubes ON (x::text = interested_in)
+WHERE user_id = 'jon'
+ORDER BY x;
+-- results created by an aborted transaction are dropped
+BEGIN;
+SELECT create_intermediate_result('session_aborted', 'SELECT s FROM generate_series(1,5) s', true);
+ROLLBACK;
+SELECT * FROM read_intermediate_result('session_aborted', 'binary') AS res (x int);
+SELECT drop_intermediate_result('session_squares');
+SELECT drop_intermediate_result('session_squares');
+SELECT * FROM read_intermediate_result('session_squares', 'binary') AS res (x int, x2 int);
+SELECT drop_intermediate_result('session_cubes');
+
 DROP SCHEMA intermediate_results CASCADE;
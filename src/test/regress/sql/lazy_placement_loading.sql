@@ -0,0 +1,35 @@
+--
+-- LAZY_PLACEMENT_LOADING
+--
+-- Tests for reading the placements of a shard only when they are used
+SET citus.next_shard_id TO 1950000;
+CREATE SCHEMA lazy_placement_loading;
+SET search_path TO lazy_placement_loading;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 2;
+
+CREATE TABLE events (id int, value int);
+SELECT create_distributed_table('events', 'id');
+INSERT INTO events VALUES (1, 1), (2, 2), (3, 3), (4, 4);
+
+-- start with an empty metadata cache
+\c - - - :master_port
+SET search_path TO lazy_placement_loading;
+SET citus.lazy_placement_loading TO on;
+
+-- router queries only read the placements of their shard
+SELECT value FROM events WHERE id = 1;
+UPDATE events SET value = 20 WHERE id = 2;
+SELECT value FROM events WHERE id = 2;
+
+-- multi-shard queries read the remaining placements on first use
+SELECT count(*), sum(value) FROM events;
+
+-- placement changes are seen by the cache
+UPDATE pg_dist_placement SET shardstate = 3 WHERE shardid = 1950000
+  AND groupid = (SELECT groupid FROM pg_dist_node WHERE nodeport = :worker_2_port);
+SELECT count(*), sum(value) FROM events;
+UPDATE pg_dist_placement SET shardstate = 1 WHERE shardid = 1950000;
+
+RESET citus.lazy_placement_loading;
+DROP SCHEMA lazy_placement_loading CASCADE;
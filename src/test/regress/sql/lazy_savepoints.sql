@@ -0,0 +1,56 @@
+--
+-- LAZY_SAVEPOINTS
+--
+-- Tests for sending savepoints only to connections used within them
+SET citus.next_shard_id TO 1930000;
+CREATE SCHEMA lazy_savepoints;
+SET search_path TO lazy_savepoints;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE items (id int, value int);
+SELECT create_distributed_table('items', 'id');
+
+SET citus.lazy_savepoint_propagation TO on;
+
+-- connections opened before the savepoint get it once they are used in it
+BEGIN;
+INSERT INTO items VALUES (1, 1);
+INSERT INTO items VALUES (2, 2);
+SAVEPOINT s1;
+INSERT INTO items VALUES (3, 3);
+INSERT INTO items VALUES (4, 4);
+ROLLBACK TO SAVEPOINT s1;
+INSERT INTO items VALUES (5, 5);
+COMMIT;
+SELECT * FROM items ORDER BY id;
+
+-- nested savepoints, only the inner one is rolled back
+BEGIN;
+SAVEPOINT s1;
+INSERT INTO items VALUES (6, 6);
+SAVEPOINT s2;
+UPDATE items SET value = value * 10;
+ROLLBACK TO SAVEPOINT s2;
+RELEASE SAVEPOINT s1;
+INSERT INTO items VALUES (7, 7);
+COMMIT;
+SELECT * FROM items ORDER BY id;
+
+-- an error on the coordinator rolls back the work done on the workers
+BEGIN;
+SAVEPOINT s1;
+DELETE FROM items WHERE id = 1;
+SAVEPOINT s2;
+DELETE FROM items;
+SELECT 1/0;
+ROLLBACK TO SAVEPOINT s2;
+SELECT count(*) FROM items;
+ROLLBACK TO SAVEPOINT s1;
+SELECT count(*) FROM items;
+COMMIT;
+SELECT * FROM items ORDER BY id;
+
+RESET citus.lazy_savepoint_propagation;
+SET client_min_messages TO WARNING;
+DROP SCHEMA lazy_savepoints CASCADE;
@@ -0,0 +1,90 @@
+--
+-- METADATA_PREWARM
+--
+-- Tests for citus.metadata_prewarm_table_count, which records the recently used
+-- distributed tables and loads them into the shared metadata cache
+SET citus.next_shard_id TO 2110000;
+CREATE SCHEMA metadata_prewarm;
+SET search_path TO metadata_prewarm;
+SET citus.shard_replication_factor TO 1;
+
+-- the maintenance daemon records the used tables once a minute
+CREATE FUNCTION record_recently_used_tables(used_after timestamptz)
+	RETURNS int
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE TABLE first_table (a int);
+SELECT create_distributed_table('first_table', 'a');
+CREATE TABLE second_table (a int);
+SELECT create_distributed_table('second_table', 'a');
+
+-- nothing is recorded or prewarmed by default
+SELECT clock_timestamp() AS start_time
+\gset
+SELECT count(*) FROM first_table;
+SELECT record_recently_used_tables(:'start_time');
+SELECT citus_prewarm_metadata_cache();
+SELECT count(*) FROM pg_dist_metadata_prewarm;
+
+ALTER SYSTEM SET citus.metadata_prewarm_table_count TO 1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+-- tables are used when a new backend loads them through the shared metadata cache
+\c - - - :master_port
+SET search_path TO metadata_prewarm;
+SELECT clock_timestamp() AS start_time
+\gset
+SELECT count(*) FROM first_table;
+SELECT record_recently_used_tables(:'start_time');
+SELECT logicalrelid FROM pg_dist_metadata_prewarm ORDER BY lastusedtime DESC;
+
+-- only the most recently used tables are kept
+\c - - - :master_port
+SET search_path TO metadata_prewarm;
+SELECT clock_timestamp() AS start_time
+\gset
+SELECT count(*) FROM second_table;
+SELECT record_recently_used_tables(:'start_time');
+SELECT logicalrelid FROM pg_dist_metadata_prewarm ORDER BY lastusedtime DESC;
+
+ALTER SYSTEM SET citus.metadata_prewarm_table_count TO 2;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+\c - - - :master_port
+SET search_path TO metadata_prewarm;
+SELECT clock_timestamp() AS start_time
+\gset
+SELECT count(*) FROM first_table;
+SELECT record_recently_used_tables(:'start_time');
+SELECT logicalrelid FROM pg_dist_metadata_prewarm ORDER BY lastusedtime DESC;
+
+-- only recorded tables that are still distributed are prewarmed
+DROP TABLE second_table;
+SELECT citus_prewarm_metadata_cache();
+
+-- prewarming does not count as using a table
+\c - - - :master_port
+SET search_path TO metadata_prewarm;
+SELECT clock_timestamp() AS start_time
+\gset
+SELECT citus_prewarm_metadata_cache();
+SELECT record_recently_used_tables(:'start_time');
+
+-- tables that are no longer distributed are removed
+\c - - - :master_port
+SET search_path TO metadata_prewarm;
+SELECT clock_timestamp() AS start_time
+\gset
+SELECT count(*) FROM first_table;
+SELECT record_recently_used_tables(:'start_time');
+SELECT logicalrelid FROM pg_dist_metadata_prewarm ORDER BY lastusedtime DESC;
+
+ALTER SYSTEM RESET citus.metadata_prewarm_table_count;
+SELECT pg_reload_conf();
+
+DELETE FROM pg_dist_metadata_prewarm;
+SET client_min_messages TO WARNING;
+DROP SCHEMA metadata_prewarm CASCADE;
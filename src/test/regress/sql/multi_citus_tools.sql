@@ -141,6 +141,15 @@ SELECT * FROM master_run_on_worker(ARRAY[:node_name, :node_name]::text[],
 								   		 'select a from generate_series(2,2) a']::text[],
 								   true);
 
+-- send multiple queries, one node at a time
+SET citus.max_node_command_concurrency TO 1;
+SELECT * FROM master_run_on_worker(ARRAY[:node_name, :node_name]::text[],
+								   ARRAY[:node_port, :node_port]::int[],
+								   ARRAY['select a from generate_series(1,1) a',
+								   		 'select a from generate_series(2,2) a']::text[],
+								   true);
+RESET citus.max_node_command_concurrency;
+
 -- send multiple queries, one fails
 SELECT * FROM master_run_on_worker(ARRAY[:node_name, :node_name]::text[],
 								   ARRAY[:node_port, :node_port]::int[],
@@ -562,3 +562,22 @@ SELECT true AS valid FROM explain_xml($$
   )
   SELECT * FROM result JOIN series ON (s = l_quantity) JOIN orders_hash_part ON (s = o_orderkey)
 $$);
+
+-- Test EXPLAIN ANALYZE shows the statistics collected while executing the tasks
+CREATE FUNCTION explain_analyze_without_times(query text)
+RETURNS SETOF text AS $$
+DECLARE
+  explain_line text;
+BEGIN
+  FOR explain_line IN EXECUTE 'EXPLAIN (ANALYZE, COSTS FALSE, TIMING FALSE) ' || query LOOP
+    IF explain_line NOT LIKE 'Planning time:%' AND explain_line NOT LIKE 'Execution time:%' THEN
+      RETURN NEXT explain_line;
+    END IF;
+  END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT explain_analyze_without_times($$
+	SELECT l_quantity FROM lineitem WHERE l_orderkey = 5$$);
+
+DROP FUNCTION explain_analyze_without_times(text);
@@ -134,6 +134,40 @@ ALTER EXTENSION citus UPDATE TO '7.2-2';
 ALTER EXTENSION citus UPDATE TO '7.2-3';
 ALTER EXTENSION citus UPDATE TO '7.3-3';
 ALTER EXTENSION citus UPDATE TO '7.4-1';
+ALTER EXTENSION citus UPDATE TO '7.4-2';
+ALTER EXTENSION citus UPDATE TO '7.4-3';
+ALTER EXTENSION citus UPDATE TO '7.4-4';
+ALTER EXTENSION citus UPDATE TO '7.4-5';
+ALTER EXTENSION citus UPDATE TO '7.4-6';
+ALTER EXTENSION citus UPDATE TO '7.4-7';
+ALTER EXTENSION citus UPDATE TO '7.4-8';
+ALTER EXTENSION citus UPDATE TO '7.4-9';
+ALTER EXTENSION citus UPDATE TO '7.4-10';
+ALTER EXTENSION citus UPDATE TO '7.4-11';
+ALTER EXTENSION citus UPDATE TO '7.4-12';
+ALTER EXTENSION citus UPDATE TO '7.4-13';
+ALTER EXTENSION citus UPDATE TO '7.4-14';
+ALTER EXTENSION citus UPDATE TO '7.4-15';
+ALTER EXTENSION citus UPDATE TO '7.4-16';
+ALTER EXTENSION citus UPDATE TO '7.4-17';
+ALTER EXTENSION citus UPDATE TO '7.4-18';
+ALTER EXTENSION citus UPDATE TO '7.4-19';
+ALTER EXTENSION citus UPDATE TO '7.4-20';
+ALTER EXTENSION citus UPDATE TO '7.4-21';
+ALTER EXTENSION citus UPDATE TO '7.4-22';
+ALTER EXTENSION citus UPDATE TO '7.4-23';
+ALTER EXTENSION citus UPDATE TO '7.4-24';
+ALTER EXTENSION citus UPDATE TO '7.4-25';
+ALTER EXTENSION citus UPDATE TO '7.4-26';
+ALTER EXTENSION citus UPDATE TO '7.4-27';
+ALTER EXTENSION citus UPDATE TO '7.4-28';
+ALTER EXTENSION citus UPDATE TO '7.4-29';
+ALTER EXTENSION citus UPDATE TO '7.4-30';
+ALTER EXTENSION citus UPDATE TO '7.4-31';
+ALTER EXTENSION citus UPDATE TO '7.4-32';
+ALTER EXTENSION citus UPDATE TO '7.4-33';
+ALTER EXTENSION citus UPDATE TO '7.4-34';
+ALTER EXTENSION citus UPDATE TO '7.4-35';
 
 -- show running version
 SHOW citus.version;
@@ -90,6 +90,19 @@ SELECT count(*) FROM lineitem_hash_part
 SELECT count(*) FROM lineitem_hash_part
 	WHERE l_orderkey = ANY (NULL) OR TRUE;	
 
+-- Check that IN lists are combined with other restrictions on the column
+SELECT count(*) FROM lineitem_hash_part
+	WHERE l_orderkey = ANY ('{1,2,3}') AND l_orderkey = 2;
+
+SELECT count(*) FROM lineitem_hash_part
+	WHERE l_orderkey = ANY ('{1,2}') AND l_orderkey = ANY ('{2,3}');
+
+SELECT count(*) FROM lineitem_hash_part
+	WHERE l_orderkey = ANY ('{1,NULL,2}');
+
+SELECT count(*) FROM lineitem_hash_part
+	WHERE l_orderkey = ANY ('{}');
+
 -- Check whether we support IN/ANY in subquery
 SELECT count(*) FROM lineitem_hash_part WHERE l_orderkey IN (SELECT l_orderkey FROM lineitem_hash_part);
 SELECT count(*) FROM lineitem_hash_part WHERE l_orderkey = ANY (SELECT l_orderkey FROM lineitem_hash_part);
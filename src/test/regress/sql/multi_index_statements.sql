@@ -182,6 +182,19 @@ SELECT indisvalid AS "Index Valid?" FROM pg_index WHERE indexrelid='ith_b_idx'::
 -- final clean up
 DROP INDEX CONCURRENTLY IF EXISTS ith_b_idx;
 
+-- create indexes over a limited pool of connections per worker
+SET citus.max_ddl_pool_size TO 2;
+CREATE INDEX ith_pool_a_idx ON index_test_hash(a);
+CREATE INDEX CONCURRENTLY ith_pool_b_idx ON index_test_hash(b);
+SELECT indisvalid AS "Index Valid?" FROM pg_index WHERE indexrelid='ith_pool_b_idx'::regclass;
+\c - - - :worker_1_port
+SELECT count(*) FROM pg_indexes WHERE indexname LIKE 'ith_pool_%';
+\c - - - :master_port
+SET citus.max_ddl_pool_size TO 2;
+DROP INDEX ith_pool_a_idx;
+DROP INDEX CONCURRENTLY ith_pool_b_idx;
+RESET citus.max_ddl_pool_size;
+
 -- Drop created tables
 DROP TABLE index_test_range;
 DROP TABLE index_test_hash;
@@ -1359,9 +1359,8 @@ INSERT INTO raw_events_first SELECT * FROM raw_events_second WHERE user_id = 100
 ROLLBACK;
 
 -- Altering a reference table and then performing an INSERT ... SELECT which
--- joins with the reference table is not allowed, since the INSERT ... SELECT
--- would read from the reference table over others connections than the ones
--- that performed the DDL.
+-- joins with the reference table is allowed, since the INSERT ... SELECT tasks
+-- share the connections that performed the DDL.
 BEGIN;
 ALTER TABLE reference_table ADD COLUMN z int;
 INSERT INTO raw_events_first (user_id)
@@ -697,7 +697,7 @@ SELECT * FROM (
       w2 as (PARTITION BY user_id, time)
 ) a;
 
-  -- Subquery in where with unsupported window function
+  -- Subquery in where with window function, correlated on the distribution column
 INSERT INTO agg_results_window(user_id)
 SELECT
   user_id
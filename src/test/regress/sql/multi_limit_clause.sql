@@ -110,7 +110,8 @@ SELECT
 	ORDER BY l_orderkey, l_linenumber
 	LIMIT 5;
 
--- Don't push down limit when group by clause not included in distinct on
+-- Push down distinct on and limit even when group by clause is not included
+-- in distinct on, since the query is grouped by the distribution column
 SELECT
 	DISTINCT ON (l_linenumber) l_orderkey, l_linenumber
 	FROM lineitem_hash
@@ -128,10 +129,10 @@ SELECT
 	ORDER BY l_linenumber, l_orderkey
 	LIMIT 5;
 
--- Don't push down limit when there is const expression in distinct on
--- even if there is a group by on the expression
--- This is due to fact that postgres removes (1+1) from distinct on
--- clause but keeps it in group by list.
+-- Push down limit when there is const expression in distinct on
+-- even though postgres removes (1+1) from distinct on clause but
+-- keeps it in group by list, since the query is grouped by the
+-- distribution column.
 SELECT
 	DISTINCT ON (l_linenumber, 1+1, l_linenumber) l_orderkey, l_linenumber
 	FROM lineitem_hash
@@ -139,9 +140,9 @@ SELECT
 	ORDER BY l_linenumber, (1+1), l_orderkey
 	LIMIT 5;
 
--- Don't push down limit when there is const reference
--- does not point to a column to make distinct clause superset
--- of group by
+-- Push down limit when there is const reference that does not
+-- point to a column, since the query is grouped by the distribution
+-- column
 SELECT
 	DISTINCT ON (l_linenumber, 2) l_orderkey, l_linenumber
 	FROM lineitem_hash
@@ -223,4 +224,9 @@ SELECT
 	LIMIT 5;
 
 SET client_min_messages TO NOTICE;
+-- the executor stops once enough rows arrived for a LIMIT without ORDER BY
+SELECT count(*) FROM (SELECT l_orderkey FROM lineitem_hash LIMIT 10) limited;
+SELECT count(*) FROM (SELECT l_orderkey FROM lineitem_hash LIMIT 10 OFFSET 5) limited;
+SELECT count(*) FROM (SELECT l_orderkey FROM lineitem_hash LIMIT 0) limited;
+
 DROP TABLE lineitem_hash;
@@ -496,6 +496,17 @@ VALUES (99, 'Wayz'), (98, 'Mynt') RETURNING name, app_id;
 SELECT * FROM app_analytics_events ORDER BY id;
 DROP TABLE app_analytics_events;
 
+-- Test multi-row insert that evaluates the same defaults in every row
+CREATE TABLE app_analytics_events (id int, app_id serial, created_at timestamptz default now(), name text);
+SELECT create_distributed_table('app_analytics_events', 'id');
+
+INSERT INTO app_analytics_events (id, name)
+VALUES (1, 'a'), (2, 'b'), (3, 'c'), (4, 'd'), (5, 'e'), (6, 'f');
+
+SELECT count(DISTINCT app_id), min(app_id), max(app_id), count(DISTINCT created_at)
+FROM app_analytics_events;
+DROP TABLE app_analytics_events;
+
 -- test UPDATE with subqueries
 CREATE TABLE raw_table (id bigint, value bigint);
 CREATE TABLE summary_table (
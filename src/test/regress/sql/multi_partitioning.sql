@@ -804,6 +804,20 @@ ORDER BY
     1, 2, 3;
 COMMIT;
 
+-- test locks on SELECT whose filters prune all but one partition
+BEGIN;
+SELECT * FROM partitioning_locks WHERE time > '2010-01-01';
+SELECT relation::regclass, locktype, mode FROM pg_locks WHERE relation::regclass::text LIKE 'partitioning_locks%' AND pid = pg_backend_pid() ORDER BY 1, 2, 3;
+COMMIT;
+
+-- all partitions are locked when partition pruning is disabled
+SET citus.enable_partition_pruning TO off;
+BEGIN;
+SELECT * FROM partitioning_locks WHERE time > '2010-01-01';
+SELECT relation::regclass, locktype, mode FROM pg_locks WHERE relation::regclass::text LIKE 'partitioning_locks%' AND pid = pg_backend_pid() ORDER BY 1, 2, 3;
+COMMIT;
+RESET citus.enable_partition_pruning;
+
 DROP TABLE
 IF EXISTS
     partitioning_test_2009,
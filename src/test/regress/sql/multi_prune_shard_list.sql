@@ -121,3 +121,61 @@ SELECT print_sorted_shard_intervals('pruning_range');
 -- all shard placements are uninitialized
 UPDATE pg_dist_shard set shardminvalue = NULL, shardmaxvalue = NULL WHERE shardid = 103077;
 SELECT print_sorted_shard_intervals('pruning_range');
+
+-- create append distributed table with overlapping shards
+CREATE TABLE pruning_append ( species text, last_pruned date, plant_id integer );
+SELECT master_create_distributed_table('pruning_append', 'species', 'append');
+
+SELECT master_create_empty_shard('pruning_append');
+SELECT master_create_empty_shard('pruning_append');
+SELECT master_create_empty_shard('pruning_append');
+SELECT master_create_empty_shard('pruning_append');
+
+-- the first shard overlaps with the next two, the last one has no min/max values
+UPDATE pg_dist_shard SET shardminvalue = 'a', shardmaxvalue = 'm' WHERE shardid = 800008;
+UPDATE pg_dist_shard SET shardminvalue = 'b', shardmaxvalue = 'c' WHERE shardid = 800009;
+UPDATE pg_dist_shard SET shardminvalue = 'd', shardmaxvalue = 'e' WHERE shardid = 800010;
+SELECT print_sorted_shard_intervals('pruning_append');
+
+-- uninitialized shards are never pruned, overlapping shards are checked
+SELECT prune_using_single_value('pruning_append', 'a');
+SELECT prune_using_single_value('pruning_append', 'c');
+SELECT prune_using_single_value('pruning_append', 'e');
+SELECT prune_using_single_value('pruning_append', 'n');
+SELECT prune_using_either_value('pruning_append', 'c', 'e');
+SELECT prune_using_both_values('pruning_append', 'c', 'e');
+
+-- ===================================================================
+-- test planner micro-benchmarks
+-- ===================================================================
+
+CREATE FUNCTION benchmark_find_shard_interval(shard_count int, iterations int,
+											  uniform bool DEFAULT true)
+	RETURNS float8
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION benchmark_prune_shards(regclass, text, iterations int)
+	RETURNS float8
+	AS 'citus'
+	LANGUAGE C;
+
+CREATE FUNCTION benchmark_rebuild_query_strings(query text, iterations int)
+	RETURNS float8
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION benchmark_distributed_planning(query text, iterations int)
+	RETURNS float8
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+-- the benchmarks return the time per iteration in nanoseconds
+SELECT benchmark_find_shard_interval(32, 1000) > 0 AS uniform_32,
+	   benchmark_find_shard_interval(100000, 1000) > 0 AS uniform_100000,
+	   benchmark_find_shard_interval(100000, 1000, false) > 0 AS binary_search_100000;
+SELECT benchmark_prune_shards('pruning', 'ginkgo', 100) > 0 AS single_value,
+	   benchmark_prune_shards('pruning', NULL, 100) > 0 AS no_values;
+SELECT benchmark_rebuild_query_strings('UPDATE pruning SET plant_id = plant_id + 1', 10) > 0;
+SELECT benchmark_distributed_planning('SELECT count(*) FROM pruning WHERE species = ''ginkgo''', 10) > 0;
+SELECT benchmark_find_shard_interval(32, 0);
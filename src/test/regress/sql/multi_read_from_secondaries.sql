@@ -55,6 +55,27 @@ SET client_min_messages TO DEFAULT;
 INSERT INTO dest_table (a, b)
   SELECT a, b FROM source_table;
 
+-- in read-only mode, read-only transactions read from the secondaries
+\c "dbname=regression options='-c\ citus.use_secondary_nodes=read-only'"
+BEGIN READ ONLY;
+SELECT a FROM dest_table WHERE a = 1;
+SELECT a FROM dest_table ORDER BY a;
+END;
+
+SET default_transaction_read_only TO on;
+SELECT a FROM dest_table WHERE a = 2;
+RESET default_transaction_read_only;
+
 \c "dbname=regression options='-c\ citus.use_secondary_nodes=never'"
 UPDATE pg_dist_node SET noderole = 'primary';
+
+-- read-write transactions use the primaries, and read-only transactions read
+-- from the primaries of groups without secondaries
+\c "dbname=regression options='-c\ citus.use_secondary_nodes=read-only'"
+INSERT INTO dest_table (a, b) VALUES (3, 3);
+BEGIN READ ONLY;
+SELECT a FROM dest_table ORDER BY a;
+END;
+
+\c "dbname=regression options='-c\ citus.use_secondary_nodes=never'"
 DROP TABLE dest_table;
@@ -464,6 +464,28 @@ SELECT master_add_node('invalid-node-name', 9999);
 
 SET client_min_messages to DEFAULT;
 
+-- test replicating several reference tables to a node one table at a time
+SELECT master_remove_node('localhost', :worker_2_port);
+
+CREATE TABLE replicate_reference_table_first (key int PRIMARY KEY, value text);
+SELECT create_reference_table('replicate_reference_table_first');
+INSERT INTO replicate_reference_table_first SELECT i, i::text FROM generate_series(1, 100) i;
+
+CREATE TABLE replicate_reference_table_second (key int, value text);
+CREATE INDEX replicate_reference_table_second_value ON replicate_reference_table_second (value);
+SELECT create_reference_table('replicate_reference_table_second');
+INSERT INTO replicate_reference_table_second SELECT i, i::text FROM generate_series(1, 50) i;
+
+SET citus.max_concurrent_reference_table_copies TO 1;
+SELECT 1 FROM master_add_node('localhost', :worker_2_port);
+RESET citus.max_concurrent_reference_table_copies;
+
+-- both placements of each table should have all rows
+SELECT nodeport, result FROM run_command_on_placements('replicate_reference_table_first', 'SELECT count(*) FROM %s') ORDER BY 1;
+SELECT nodeport, result FROM run_command_on_placements('replicate_reference_table_second', 'SELECT count(*) FROM %s') ORDER BY 1;
+
+DROP TABLE replicate_reference_table_first, replicate_reference_table_second;
+
 -- drop unnecassary tables
 DROP TABLE initially_not_replicated_reference_table;
 
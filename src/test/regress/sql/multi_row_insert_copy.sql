@@ -0,0 +1,45 @@
+--
+-- MULTI_ROW_INSERT_COPY
+--
+-- Tests for multi-row INSERTs that are sent to the shards with COPY
+SET citus.next_shard_id TO 1870000;
+CREATE SCHEMA multi_row_insert_copy;
+SET search_path TO multi_row_insert_copy;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE visits (id int, page text, visited_at int DEFAULT 0);
+SELECT create_distributed_table('visits', 'id');
+
+SET citus.multi_row_insert_copy_threshold TO 3;
+
+-- fewer rows than the threshold are routed to the shards
+INSERT INTO visits VALUES (1, 'home'), (2, 'about');
+
+-- rows at the threshold are evaluated locally and copied
+EXPLAIN (COSTS OFF) INSERT INTO visits VALUES (3, 'home'), (4, 'news'), (5, 'home');
+INSERT INTO visits VALUES (3, 'home'), (4, 'news'), (5, 'home');
+
+-- columns can be listed in any order, and missing columns get defaults
+INSERT INTO visits (page, id) VALUES ('news', 6), ('home', 7), (upper('about'), 8);
+
+-- expressions and parameters are evaluated before copying
+PREPARE insert_visits(int) AS
+  INSERT INTO visits VALUES ($1, 'home', $1 * 10), ($1 + 1, 'news', 1), ($1 + 2, 'about', 2);
+EXECUTE insert_visits(9);
+
+-- INSERTs with RETURNING or ON CONFLICT still go through the router planner
+INSERT INTO visits VALUES (12, 'home'), (13, 'news'), (14, 'home') RETURNING visited_at;
+
+-- the partition column cannot be NULL
+INSERT INTO visits VALUES (15, 'home'), (NULL, 'news'), (16, 'home');
+
+SELECT id, page, visited_at FROM visits ORDER BY id;
+
+-- the threshold is off by default
+RESET citus.multi_row_insert_copy_threshold;
+SHOW citus.multi_row_insert_copy_threshold;
+
+DEALLOCATE insert_visits;
+SET client_min_messages TO WARNING;
+DROP SCHEMA multi_row_insert_copy CASCADE;
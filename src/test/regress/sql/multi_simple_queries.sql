@@ -145,10 +145,10 @@ RESET citus.large_table_shard_count;
 SELECT a.title AS name, (SELECT a2.id FROM articles_single_shard a2 WHERE a.id = a2.id  LIMIT 1)
 						 AS special_price FROM articles a;
 
--- joins are not supported between local and distributed tables
+-- joins between local and distributed tables are planned via intermediate results
 SELECT title, authors.name FROM authors, articles WHERE authors.id = articles.author_id;
 
--- inner joins are not supported (I think)
+-- as are explicit inner joins on other columns
 SELECT * FROM  (articles INNER JOIN authors ON articles.id = authors.id);
 
 -- test use of EXECUTE statements within plpgsql
@@ -302,3 +302,43 @@ SELECT count(*) FROM (
 ) x;
 
 SET client_min_messages to 'NOTICE';
+
+-- router queries can run as statements prepared on the worker connections
+CREATE TABLE prepared_statement_test (key int, value int);
+SELECT create_distributed_table('prepared_statement_test', 'key');
+INSERT INTO prepared_statement_test VALUES (1, 10), (2, 20);
+SET citus.max_prepared_statements_per_connection TO 1;
+SELECT value FROM prepared_statement_test WHERE key = 1;
+SELECT value FROM prepared_statement_test WHERE key = 1;
+SELECT value FROM prepared_statement_test WHERE key = 2;
+
+-- statements are prepared again after the column type changed
+ALTER TABLE prepared_statement_test ALTER COLUMN value TYPE bigint;
+SELECT value FROM prepared_statement_test WHERE key = 1;
+RESET citus.max_prepared_statements_per_connection;
+DROP TABLE prepared_statement_test;
+
+-- tasks on the same workers can be combined into a single query
+SET citus.shard_count TO 8;
+CREATE TABLE combined_tasks_test (key int, value int);
+SELECT create_distributed_table('combined_tasks_test', 'key');
+INSERT INTO combined_tasks_test SELECT i, i FROM generate_series(1, 100) i;
+SET citus.combine_tasks_per_worker TO on;
+SELECT count(*), sum(value) FROM combined_tasks_test;
+SELECT key % 3 AS remainder, count(*) FROM combined_tasks_test GROUP BY 1 ORDER BY 1;
+SELECT key FROM combined_tasks_test ORDER BY key DESC LIMIT 3;
+-- partial aggregates of combined tasks are merged on the workers
+CREATE TABLE combined_tasks_dimension (remainder int, name text);
+SELECT create_reference_table('combined_tasks_dimension');
+INSERT INTO combined_tasks_dimension VALUES (0, 'zero'), (1, 'one'), (2, 'two');
+SELECT name, count(*), sum(value), min(value), max(value)
+FROM combined_tasks_test JOIN combined_tasks_dimension ON (key % 3 = remainder)
+GROUP BY name ORDER BY name;
+SET citus.combine_aggregates_per_worker TO off;
+SELECT name, count(*) FROM combined_tasks_test JOIN combined_tasks_dimension ON (key % 3 = remainder)
+GROUP BY name ORDER BY name;
+RESET citus.combine_aggregates_per_worker;
+DROP TABLE combined_tasks_dimension;
+RESET citus.combine_tasks_per_worker;
+RESET citus.shard_count;
+DROP TABLE combined_tasks_test;
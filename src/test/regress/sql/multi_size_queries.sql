@@ -65,5 +65,17 @@ ALTER TABLE supplier ALTER COLUMN s_suppkey SET NOT NULL;
 select citus_table_size('supplier');
 END;
 
-DROP INDEX index_1;
+-- Tests of the multi-table size functions
+SELECT * FROM citus_table_sizes(ARRAY['customer_copy_hash', 'supplier']::regclass[]);
+SELECT * FROM citus_total_relation_sizes(ARRAY['customer_copy_hash', 'supplier']::regclass[]);
+SELECT * FROM citus_table_sizes(ARRAY['customer_copy_hash', 'lineitem_hash_part']::regclass[]);
+
+-- Sizes are reused within the TTL of the cache
+SET citus.table_size_cache_ttl TO '1h';
+SELECT citus_total_relation_size('supplier');
 DROP INDEX index_2;
+SELECT citus_total_relation_size('supplier');
+RESET citus.table_size_cache_ttl;
+SELECT citus_total_relation_size('supplier');
+
+DROP INDEX index_1;
@@ -144,7 +144,8 @@ $$ LANGUAGE SQL STABLE;
 
 INSERT INTO test_parameterized_sql VALUES(1, 1);
 
--- all of them should fail
+-- all of them should fail, except for the single-shard query whose shard is
+-- pruned during execution
 SELECT * FROM test_parameterized_sql_function(1);
 SELECT test_parameterized_sql_function(1);
 SELECT test_parameterized_sql_function_in_subquery_where(1);
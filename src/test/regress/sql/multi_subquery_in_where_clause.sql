@@ -500,7 +500,7 @@ WHERE
 ORDER BY 1 ASC
 LIMIT 2;
 
--- OFFSET is not supported in the subquey
+-- OFFSET is supported in subqueries correlated on the distribution column
 SELECT 
   user_id
 FROM 
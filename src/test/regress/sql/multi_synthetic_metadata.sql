@@ -0,0 +1,66 @@
+--
+-- MULTI_SYNTHETIC_METADATA
+--
+-- Tests that tables with many synthetic shards on many synthetic nodes can be
+-- planned without the shards and nodes existing.
+
+SET citus.next_shard_id TO 14000000;
+SET citus.next_placement_id TO 14000000;
+
+-- ===================================================================
+-- create test functions
+-- ===================================================================
+
+CREATE FUNCTION create_synthetic_nodes(text, int)
+	RETURNS int
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION create_synthetic_shards(regclass, text, int, int DEFAULT 1)
+	RETURNS void
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION remove_synthetic_metadata(text)
+	RETURNS void
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION benchmark_metadata_cache_build(regclass, iterations int)
+	RETURNS float8
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+-- ===================================================================
+-- test synthetic metadata
+-- ===================================================================
+
+SELECT create_synthetic_nodes('synthetic.invalid', 100);
+
+CREATE TABLE synthetic_events (key int, value text);
+SELECT master_create_distributed_table('synthetic_events', 'key', 'hash');
+
+-- placements need to go to synthetic nodes, and only once per table
+SELECT create_synthetic_shards('synthetic_events', 'synthetic.invalid', 10000, 101);
+SELECT create_synthetic_shards('synthetic_events', 'synthetic.invalid', 10000, 2);
+SELECT create_synthetic_shards('synthetic_events', 'synthetic.invalid', 10000, 2);
+
+SELECT count(*), min(shardminvalue::int), max(shardmaxvalue::int)
+FROM pg_dist_shard WHERE logicalrelid = 'synthetic_events'::regclass;
+
+SELECT count(DISTINCT groupid) AS groups, count(*) AS placements
+FROM pg_dist_placement JOIN pg_dist_shard USING (shardid)
+WHERE logicalrelid = 'synthetic_events'::regclass;
+
+-- the metadata can be loaded, pruned and planned with
+SELECT benchmark_metadata_cache_build('synthetic_events', 3) > 0 AS built;
+SELECT benchmark_prune_shards('synthetic_events', '42', 10) > 0 AS pruned;
+
+SET citus.explain_distributed_queries TO off;
+EXPLAIN (COSTS FALSE) SELECT value FROM synthetic_events WHERE key = 42;
+RESET citus.explain_distributed_queries;
+
+-- remove the metadata before dropping the table, which would connect to the nodes
+SELECT remove_synthetic_metadata('synthetic.invalid');
+SELECT count(*) FROM pg_dist_node WHERE nodename = 'synthetic.invalid';
+DROP TABLE synthetic_events;
@@ -58,6 +58,9 @@ INSERT INTO pg_dist_shard_placement (shardid, shardstate, shardlength, nodename,
 
 BEGIN;
 
+-- Put the second worker into another network location
+UPDATE pg_dist_node SET noderack = 'zone-b' WHERE nodeport = :worker_2_port;
+
 -- Increase log level to see which worker nodes tasks are assigned to. Note that
 -- the following log messages print node name and port numbers; and node numbers
 -- in regression tests depend upon PG_VERSION_NUM.
@@ -90,7 +93,26 @@ EXPLAIN SELECT count(*) FROM task_assignment_test_table;
 
 EXPLAIN SELECT count(*) FROM task_assignment_test_table;
 
+-- All policies prefer the placements in the rack of the executing node
+
+SET citus.local_node_rack TO 'zone-b';
+
+SET citus.task_assignment_policy TO 'greedy';
+
+EXPLAIN SELECT count(*) FROM task_assignment_test_table;
+
+SET citus.task_assignment_policy TO 'first-replica';
+
+EXPLAIN SELECT count(*) FROM task_assignment_test_table;
+
+SET citus.task_assignment_policy TO 'round-robin';
+
+EXPLAIN SELECT count(*) FROM task_assignment_test_table;
+
+RESET citus.local_node_rack;
 RESET citus.task_assignment_policy;
 RESET client_min_messages;
 
+UPDATE pg_dist_node SET noderack = 'default' WHERE nodeport = :worker_2_port;
+
 COMMIT;
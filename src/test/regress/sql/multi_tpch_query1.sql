@@ -30,3 +30,33 @@ GROUP BY
 ORDER BY
 	l_returnflag,
 	l_linestatus;
+
+-- Run the same query with the groups computed on the workers by repartitioning
+
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.enable_repartitioned_group_by TO on;
+
+SELECT
+	l_returnflag,
+	l_linestatus,
+	sum(l_quantity) as sum_qty,
+	sum(l_extendedprice) as sum_base_price,
+	sum(l_extendedprice * (1 - l_discount)) as sum_disc_price,
+	sum(l_extendedprice * (1 - l_discount) * (1 + l_tax)) as sum_charge,
+	avg(l_quantity) as avg_qty,
+	avg(l_extendedprice) as avg_price,
+	avg(l_discount) as avg_disc,
+	count(*) as count_order
+FROM
+	lineitem
+WHERE
+	l_shipdate <= date '1998-12-01' - interval '90 days'
+GROUP BY
+	l_returnflag,
+	l_linestatus
+ORDER BY
+	l_returnflag,
+	l_linestatus;
+
+RESET citus.enable_repartitioned_group_by;
+RESET citus.task_executor_type;
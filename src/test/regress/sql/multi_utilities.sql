@@ -271,6 +271,25 @@ SELECT run_command_on_workers($$SELECT wait_for_stats()$$);
 SELECT run_command_on_workers($$SELECT pg_stat_get_vacuum_count(tablename::regclass) from pg_tables where tablename LIKE 'dustbunnies_%' limit 1$$);
 SELECT run_command_on_workers($$SELECT pg_stat_get_analyze_count(tablename::regclass) from pg_tables where tablename LIKE 'dustbunnies_%' limit 1$$);
 
+-- propagate VACUUM ANALYZE over a throttled pool of connections per worker
+SET citus.max_vacuum_pool_size TO 1;
+SET citus.vacuum_cost_delay TO 1;
+SET citus.update_shard_statistics_on_analyze TO on;
+UPDATE pg_dist_placement SET shardlength = 0
+WHERE shardid IN (SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'dustbunnies'::regclass);
+VACUUM ANALYZE dustbunnies;
+
+-- the shard sizes are recorded in the metadata
+SELECT bool_and(shardlength > 0) AS shard_lengths_updated FROM pg_dist_placement
+WHERE shardid IN (SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'dustbunnies'::regclass);
+
+SELECT run_command_on_workers($$SELECT wait_for_stats()$$);
+SELECT run_command_on_workers($$SELECT pg_stat_get_vacuum_count(tablename::regclass) from pg_tables where tablename LIKE 'dustbunnies_%' limit 1$$);
+SELECT run_command_on_workers($$SELECT pg_stat_get_analyze_count(tablename::regclass) from pg_tables where tablename LIKE 'dustbunnies_%' limit 1$$);
+RESET citus.max_vacuum_pool_size;
+RESET citus.vacuum_cost_delay;
+RESET citus.update_shard_statistics_on_analyze;
+
 -- test worker_hash
 SELECT worker_hash(123);
 SELECT worker_hash('1997-08-08'::date);
@@ -102,7 +102,7 @@ AS SELECT l_shipmode, count(*) FROM temp_lineitem GROUP BY l_shipmode;
 
 SELECT * FROM mode_counts WHERE l_shipmode = 'AIR' ORDER BY 2 DESC, 1 LIMIT 10;
 
--- materialized views are local, cannot join with distributed tables
+-- materialized views are local, but can be joined with distributed tables
 SELECT count(*) FROM mode_counts JOIN temp_lineitem USING (l_shipmode);
 
 -- new data is not immediately reflected in the view
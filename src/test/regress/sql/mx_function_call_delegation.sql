@@ -0,0 +1,92 @@
+--
+-- MX_FUNCTION_CALL_DELEGATION
+--
+-- Tests for create_distributed_function, which makes the coordinator delegate
+-- calls of a function to the worker that has the shard of its distribution
+-- argument
+\c - - - :master_port
+SET citus.next_shard_id TO 1730000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+SET citus.replication_model TO streaming;
+CREATE TABLE delegation_table (key int, value int);
+SELECT create_distributed_table('delegation_table', 'key');
+INSERT INTO delegation_table SELECT i, i FROM generate_series(1, 10) i;
+
+CREATE FUNCTION add_to_value(key_arg int, amount int) RETURNS int LANGUAGE plpgsql AS $fn$
+DECLARE
+    new_value int;
+BEGIN
+    UPDATE delegation_table SET value = value + amount WHERE key = key_arg
+    RETURNING value INTO new_value;
+    RETURN new_value;
+END;
+$fn$;
+SELECT run_command_on_workers($$CREATE FUNCTION add_to_value(key_arg int, amount int) RETURNS int LANGUAGE plpgsql AS $fn$
+DECLARE
+    new_value int;
+BEGIN
+    UPDATE delegation_table SET value = value + amount WHERE key = key_arg
+    RETURNING value INTO new_value;
+    RETURN new_value;
+END;
+$fn$;$$);
+
+CREATE FUNCTION key_node_port(key_arg int) RETURNS int LANGUAGE sql AS $fn$
+    SELECT inet_server_port();
+$fn$;
+SELECT run_command_on_workers($$CREATE FUNCTION key_node_port(key_arg int) RETURNS int LANGUAGE sql AS $fn$
+    SELECT inet_server_port();
+$fn$;$$);
+
+CREATE FUNCTION text_argument(key_arg text) RETURNS int LANGUAGE sql AS $fn$
+    SELECT 1;
+$fn$;
+
+-- the distribution argument must exist and match the distribution column
+SELECT create_distributed_function('add_to_value(int,int)', 'no_such_arg', 'delegation_table');
+SELECT create_distributed_function('text_argument(text)', 'key_arg', 'delegation_table');
+
+SELECT create_distributed_function('add_to_value(int,int)', 'key_arg', 'delegation_table');
+SELECT create_distributed_function('key_node_port(int)', '$1', 'delegation_table');
+SELECT funcid::regprocedure, distribution_argument_index FROM pg_dist_function ORDER BY 1;
+
+-- calls run on the node that has the shard of the argument
+SELECT key_node_port(3) AS delegated_port \gset
+SELECT :delegated_port = nodeport
+FROM pg_dist_placement JOIN pg_dist_node USING (groupid)
+WHERE shardid = get_shard_id_for_distribution_column('delegation_table', 3);
+
+SELECT add_to_value(3, 100);
+SELECT value FROM delegation_table WHERE key = 3;
+
+-- parameters are resolved before delegating the call
+PREPARE call_key_node_port(int) AS SELECT key_node_port($1) AS prepared_port;
+EXECUTE call_key_node_port(3) \gset
+SELECT :prepared_port = :delegated_port;
+
+-- calls that are not delegated run on the coordinator
+SELECT key_node_port(NULL) AS null_port \gset
+SELECT :null_port = :master_port;
+
+BEGIN;
+SELECT key_node_port(3) AS transaction_port \gset
+SELECT add_to_value(3, 100);
+COMMIT;
+SELECT :transaction_port = :master_port;
+SELECT value FROM delegation_table WHERE key = 3;
+
+SET citus.enable_function_call_delegation TO off;
+SELECT key_node_port(3) AS disabled_port \gset
+SELECT :disabled_port = :master_port;
+RESET citus.enable_function_call_delegation;
+
+-- dropping a function removes its metadata
+DROP FUNCTION key_node_port(int);
+SELECT funcid::regprocedure FROM pg_dist_function ORDER BY 1;
+
+DROP FUNCTION add_to_value(int,int);
+DROP FUNCTION text_argument(text);
+SELECT run_command_on_workers($$DROP FUNCTION key_node_port(int)$$);
+SELECT run_command_on_workers($$DROP FUNCTION add_to_value(int,int)$$);
+DROP TABLE delegation_table;
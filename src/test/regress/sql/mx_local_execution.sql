@@ -0,0 +1,62 @@
+--
+-- MX_LOCAL_EXECUTION
+--
+-- Tests for citus.enable_local_execution, which executes router queries on
+-- placements of the local node in the same backend
+\c - - - :master_port
+SET citus.next_shard_id TO 1720000;
+CREATE TABLE local_ref (key int, value text);
+SELECT create_reference_table('local_ref');
+INSERT INTO local_ref VALUES (1, 'one'), (2, 'two'), (3, 'three');
+
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+SET citus.replication_model TO streaming;
+CREATE TABLE local_dist (key int, value text);
+SELECT create_distributed_table('local_dist', 'key');
+INSERT INTO local_dist SELECT i, i::text FROM generate_series(1, 10) i;
+
+\c - - - :worker_1_port
+SET citus.enable_local_execution TO on;
+
+SELECT * FROM local_ref ORDER BY key;
+SELECT value FROM local_ref WHERE key = 2;
+SELECT count(*) FROM local_dist WHERE key = 3;
+
+PREPARE lookup(int) AS SELECT value FROM local_ref WHERE key = $1;
+EXECUTE lookup(1);
+EXECUTE lookup(3);
+
+SELECT local_dist.value, local_ref.value
+FROM local_dist JOIN local_ref USING (key)
+WHERE local_dist.key = 2;
+
+-- reads see the changes made over connections in the same transaction
+BEGIN;
+INSERT INTO local_dist VALUES (3, 'three');
+SELECT value FROM local_dist WHERE key = 3 ORDER BY value;
+ROLLBACK;
+SELECT value FROM local_dist WHERE key = 3;
+
+-- COPY on a worker inserts rows for local shards directly
+COPY local_dist FROM STDIN WITH (format csv);
+11,eleven
+12,twelve
+13,thirteen
+14,fourteen
+\.
+SELECT count(*) FROM local_dist WHERE key > 10;
+
+-- rows copied in a transaction are seen by later reads in it
+BEGIN;
+COPY local_dist FROM STDIN WITH (format csv);
+15,fifteen
+16,sixteen
+\.
+SELECT value FROM local_dist WHERE key = 15;
+SELECT value FROM local_dist WHERE key = 16;
+COMMIT;
+SELECT count(*) FROM local_dist WHERE key > 10;
+
+\c - - - :master_port
+DROP TABLE local_ref, local_dist;
@@ -0,0 +1,45 @@
+--
+-- MX_SEQUENCE_RANGES
+--
+-- Tests for master_allocate_sequence_range, which hands out ranges of
+-- sequence values to metadata workers
+\c - - - :master_port
+SET citus.next_shard_id TO 1740000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+SET citus.replication_model TO streaming;
+CREATE TABLE sequence_range_table (key bigserial, value int);
+SELECT create_distributed_table('sequence_range_table', 'key');
+
+-- ranges are consecutive and advance the sequence
+SELECT * FROM master_allocate_sequence_range('sequence_range_table_key_seq', 100);
+SELECT * FROM master_allocate_sequence_range('sequence_range_table_key_seq', 10);
+SELECT nextval('sequence_range_table_key_seq');
+
+-- ranges stop at the maximum value of the sequence
+CREATE SEQUENCE small_sequence INCREMENT BY 5 MAXVALUE 30;
+SELECT * FROM master_allocate_sequence_range('small_sequence', 4);
+SELECT * FROM master_allocate_sequence_range('small_sequence', 4);
+SELECT * FROM master_allocate_sequence_range('small_sequence', 4);
+
+-- invalid arguments
+SELECT * FROM master_allocate_sequence_range('sequence_range_table_key_seq', 0);
+SELECT * FROM master_allocate_sequence_range('sequence_range_table', 10);
+CREATE SEQUENCE descending_sequence INCREMENT BY -1;
+SELECT * FROM master_allocate_sequence_range('descending_sequence', 10);
+
+-- ranges can only be allocated on the coordinator
+\c - - - :worker_1_port
+SELECT * FROM master_allocate_sequence_range('sequence_range_table_key_seq', 10);
+
+-- without the coordinator in the metadata, workers use their local sequence
+SET citus.sequence_range_size TO 1000;
+INSERT INTO sequence_range_table (value) VALUES (1), (2), (3);
+SELECT count(*), count(DISTINCT key), min(key) > (1::bigint << 48)
+FROM sequence_range_table;
+RESET citus.sequence_range_size;
+
+\c - - - :master_port
+DROP SEQUENCE small_sequence;
+DROP SEQUENCE descending_sequence;
+DROP TABLE sequence_range_table;
@@ -0,0 +1,70 @@
+--
+-- NODE_HEALTH
+--
+-- Tests for citus.unreachable_node_retry_interval, which skips connections to
+-- worker nodes that recently could not be connected to
+SET citus.next_shard_id TO 2120000;
+CREATE SCHEMA node_health;
+SET search_path TO node_health;
+SET citus.shard_replication_factor TO 2;
+SET citus.shard_count TO 2;
+
+CREATE FUNCTION node_connection_failure_count(node_name text, node_port int)
+	RETURNS int
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+-- the maintenance daemon should not probe the node in between
+ALTER SYSTEM SET citus.unreachable_node_retry_interval TO 2000;
+ALTER SYSTEM SET citus.node_health_check_interval TO -1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+CREATE TABLE events (key int, value int);
+SELECT create_distributed_table('events', 'key');
+INSERT INTO events VALUES (1, 1), (2, 2), (3, 3), (4, 4);
+
+-- move the first placement of a shard to a node that is down
+SELECT 1 FROM master_add_inactive_node('localhost', 57699);
+UPDATE pg_dist_node SET isactive = true WHERE nodeport = 57699;
+SELECT groupid AS dead_group FROM pg_dist_node WHERE nodeport = 57699
+\gset
+SELECT placementid AS moved_placement, groupid AS original_group
+FROM pg_dist_placement WHERE shardid = 2120000 ORDER BY placementid LIMIT 1
+\gset
+UPDATE pg_dist_placement SET groupid = :dead_group WHERE placementid = :moved_placement;
+
+SET citus.task_executor_type TO 'adaptive';
+SET citus.task_assignment_policy TO 'first-replica';
+
+-- the first query fails to connect to the node and uses the other placement
+SET client_min_messages TO error;
+SELECT count(*), sum(value) FROM events;
+RESET client_min_messages;
+SELECT node_connection_failure_count('localhost', 57699);
+
+-- the next query skips the node without trying to connect to it
+SELECT clock_timestamp() AS start_time
+\gset
+SELECT count(*), sum(value) FROM events;
+SELECT clock_timestamp() - :'start_time' < '1s'::interval AS skipped_quickly;
+SELECT node_connection_failure_count('localhost', 57699);
+
+-- after the retry interval, the node is tried again
+SELECT pg_sleep(2.5);
+SET client_min_messages TO error;
+SELECT count(*), sum(value) FROM events;
+RESET client_min_messages;
+SELECT node_connection_failure_count('localhost', 57699);
+
+UPDATE pg_dist_placement SET groupid = :original_group WHERE placementid = :moved_placement;
+SELECT master_remove_node('localhost', 57699);
+
+RESET citus.task_assignment_policy;
+RESET citus.task_executor_type;
+ALTER SYSTEM RESET citus.unreachable_node_retry_interval;
+ALTER SYSTEM RESET citus.node_health_check_interval;
+SELECT pg_reload_conf();
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA node_health CASCADE;
@@ -0,0 +1,78 @@
+--
+-- ONE_PHASE_COMMIT
+--
+-- Tests for committing transactions that involve a single worker connection
+-- without 2PC
+SET citus.next_shard_id TO 1910000;
+CREATE SCHEMA one_phase_commit;
+SET search_path TO one_phase_commit;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.multi_shard_commit_protocol TO '2pc';
+
+-- disable auto-recovery, such that we can count the 2PC records
+ALTER SYSTEM SET citus.recover_2pc_interval TO -1;
+SELECT pg_reload_conf();
+
+CREATE TABLE items (id int, value int);
+SELECT create_distributed_table('items', 'id');
+
+SELECT recover_prepared_transactions();
+
+SET citus.enable_one_phase_commit TO on;
+
+-- a COPY into a single shard commits without PREPARE
+COPY items FROM STDIN WITH (FORMAT csv);
+1,1
+1,2
+1,3
+\.
+SELECT count(*) FROM pg_dist_transaction;
+
+-- a COPY into shards on several connections still uses 2PC
+COPY items FROM STDIN WITH (FORMAT csv);
+1,4
+2,5
+3,6
+4,7
+5,8
+\.
+SELECT count(*) > 1 FROM pg_dist_transaction;
+SELECT recover_prepared_transactions();
+
+-- so does a transaction that also wrote on the coordinator
+BEGIN;
+CREATE TABLE local_items (id int);
+COPY items FROM STDIN WITH (FORMAT csv);
+1,9
+\.
+COMMIT;
+SELECT count(*) FROM pg_dist_transaction;
+SELECT recover_prepared_transactions();
+
+-- errors on COMMIT are reported like errors on PREPARE
+CREATE TABLE deferred_items (id int UNIQUE DEFERRABLE INITIALLY DEFERRED);
+SELECT create_distributed_table('deferred_items', 'id');
+COPY deferred_items FROM STDIN WITH (FORMAT csv);
+1
+1
+\.
+SELECT count(*) FROM deferred_items;
+SELECT count(*) FROM pg_dist_transaction;
+
+-- without the setting, 2PC is used for a single connection as well
+RESET citus.enable_one_phase_commit;
+COPY items FROM STDIN WITH (FORMAT csv);
+1,10
+\.
+SELECT count(*) FROM pg_dist_transaction;
+SELECT recover_prepared_transactions();
+
+SELECT count(*), sum(value) FROM items;
+
+ALTER SYSTEM RESET citus.recover_2pc_interval;
+SELECT pg_reload_conf();
+
+RESET citus.multi_shard_commit_protocol;
+SET client_min_messages TO WARNING;
+DROP SCHEMA one_phase_commit CASCADE;
@@ -0,0 +1,42 @@
+--
+-- PARALLEL_COPY_TO
+--
+-- Tests for citus.parallel_copy_to, which copies all shards concurrently in
+-- COPY distributed_table TO STDOUT
+SET citus.next_shard_id TO 2020000;
+
+-- every COPY into an append distributed table creates a shard
+CREATE TABLE copy_to_table (key int, value text);
+SELECT create_distributed_table('copy_to_table', 'key', 'append');
+COPY copy_to_table FROM STDIN;
+1	one
+2	two
+\.
+COPY copy_to_table FROM STDIN;
+3	three
+4	\N
+\.
+
+SET citus.parallel_copy_to TO 'shard-order';
+COPY copy_to_table TO STDOUT;
+COPY copy_to_table (value, key) TO STDOUT WITH (FORMAT csv, FORCE_QUOTE *);
+COPY copy_to_table TO STDOUT WITH (FORMAT csv, DELIMITER '|', NULL 'null');
+
+-- the shards are copied over the connections of the transaction
+BEGIN;
+DELETE FROM copy_to_table WHERE key = 2;
+COPY copy_to_table TO STDOUT;
+ROLLBACK;
+
+-- commands whose output cannot be concatenated run as a SELECT
+COPY copy_to_table TO STDOUT WITH (FORMAT csv, HEADER);
+
+SET citus.parallel_copy_to TO 'interleaved';
+CREATE TABLE copy_to_reference (key int, value text);
+SELECT create_reference_table('copy_to_reference');
+INSERT INTO copy_to_reference VALUES (1, 'one'), (2, 'two');
+COPY copy_to_reference TO STDOUT;
+
+RESET citus.parallel_copy_to;
+DROP TABLE copy_to_table;
+DROP TABLE copy_to_reference;
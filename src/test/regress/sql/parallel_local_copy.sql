@@ -0,0 +1,37 @@
+--
+-- PARALLEL_LOCAL_COPY
+--
+-- Tests for copying the data of local tables into their shards using parallel
+-- workers
+SET citus.next_shard_id TO 1970000;
+CREATE SCHEMA parallel_local_copy;
+SET search_path TO parallel_local_copy;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.parallel_local_copy_workers TO 2;
+
+-- spread the rows over many blocks, such that every worker gets some
+CREATE TABLE items (id int, value text, filler text);
+INSERT INTO items SELECT i, 'value-' || i, repeat('x', 500) FROM generate_series(1, 10000) i;
+INSERT INTO items VALUES (10001, NULL, NULL);
+SELECT create_distributed_table('items', 'id');
+SELECT count(*), count(DISTINCT id), sum(id), count(value) FROM items;
+SELECT value FROM items WHERE id = 4242;
+
+-- rows with a NULL partition column are rejected
+CREATE TABLE null_items (id int, value text);
+INSERT INTO null_items VALUES (NULL, 'none'), (1, 'one');
+\set VERBOSITY terse
+SELECT create_distributed_table('null_items', 'id');
+\set VERBOSITY default
+
+-- reference tables and tables with dropped columns
+CREATE TABLE ref_items (id int, dropped int, value text);
+INSERT INTO ref_items SELECT i, i, 'ref-' || i FROM generate_series(1, 1000) i;
+ALTER TABLE ref_items DROP COLUMN dropped;
+SELECT create_reference_table('ref_items');
+SELECT count(*), sum(id), max(value) FROM ref_items;
+
+RESET citus.parallel_local_copy_workers;
+DROP TABLE items, null_items, ref_items;
+DROP SCHEMA parallel_local_copy;
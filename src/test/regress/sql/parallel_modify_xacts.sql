@@ -0,0 +1,46 @@
+--
+-- PARALLEL_MODIFY_XACTS
+--
+-- Tests for multi-shard modifications in transaction blocks, which use the
+-- connections that modified the shards earlier in the transaction
+SET citus.next_shard_id TO 1750000;
+CREATE SCHEMA parallel_modify_xacts;
+SET search_path TO parallel_modify_xacts;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (x int, y int);
+SELECT create_distributed_table('test', 'x');
+INSERT INTO test VALUES (1, 1), (2, 2), (3, 3), (4, 4);
+
+-- consecutive multi-shard modifications reuse their connections
+BEGIN;
+UPDATE test SET y = y + 1;
+UPDATE test SET y = y + 1;
+DELETE FROM test WHERE y = 3;
+SELECT x, y FROM test ORDER BY x;
+COMMIT;
+
+SELECT x, y FROM test ORDER BY x;
+
+-- a multi-row INSERT modifies the shards of a node over one connection,
+-- which the tasks of the following multi-shard modifications share
+BEGIN;
+INSERT INTO test VALUES (5, 5), (6, 6), (7, 7), (8, 8);
+UPDATE test SET y = y * 10;
+DELETE FROM test WHERE x > 6;
+SELECT x, y FROM test ORDER BY x;
+COMMIT;
+
+SELECT x, y FROM test ORDER BY x;
+
+-- the same holds for single-shard modifications
+BEGIN;
+UPDATE test SET y = 0 WHERE x = 1;
+UPDATE test SET y = 0 WHERE x = 4;
+UPDATE test SET y = y + 1;
+SELECT x, y FROM test ORDER BY x;
+ROLLBACK;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA parallel_modify_xacts CASCADE;
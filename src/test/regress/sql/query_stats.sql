@@ -0,0 +1,124 @@
+--
+-- QUERY_STATS
+--
+-- Tests for citus_stat_statements and citus_shard_access, which track the
+-- execution statistics of distributed statements and of shards
+SET citus.next_shard_id TO 2000000;
+CREATE SCHEMA query_stats;
+SET search_path TO query_stats;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (x int, y int);
+SELECT create_distributed_table('test', 'x');
+INSERT INTO test VALUES (1,1), (2,2), (3,3), (4,4), (5,5);
+
+-- statements are not tracked by default
+SELECT citus_stat_statements_reset();
+SELECT count(*) FROM test;
+SELECT count(*) FROM citus_stat_statements;
+
+SET citus.stat_statements_track TO 'all';
+
+SELECT count(*) FROM test;
+SELECT count(*) FROM test;
+SELECT y FROM test WHERE x = 1;
+INSERT INTO test VALUES (6,6);
+
+SELECT query, executor, calls, shards,
+       planning_time >= 0 AS planned, remote_time > 0 AS remote,
+       merge_time >= 0 AS merged, total_time >= remote_time AS total,
+       bytes_received > 0 AS received
+FROM citus_stat_statements
+ORDER BY query;
+
+-- subplans write intermediate results
+WITH cte AS (SELECT x FROM test ORDER BY x LIMIT 2)
+SELECT count(*) FROM test JOIN cte USING (x);
+
+SELECT executor, calls, subplan_time > 0 AS subplan, intermediate_result_bytes > 0 AS written
+FROM citus_stat_statements
+WHERE query LIKE 'WITH cte%';
+
+-- resetting discards all statistics
+SELECT citus_stat_statements_reset();
+SELECT count(*) FROM citus_stat_statements;
+
+RESET citus.stat_statements_track;
+
+-- router queries count the reads and writes of each shard
+SELECT citus_shard_access_stats_reset();
+SELECT y FROM test WHERE x = 1;
+SELECT y FROM test WHERE x = 1;
+UPDATE test SET y = 2 WHERE x = 1;
+
+SELECT shardid, reads, writes, execution_time > 0 AS timed
+FROM citus_shard_access
+WHERE table_name = 'test'::regclass
+ORDER BY shardid;
+
+SET citus.track_shard_access TO off;
+SELECT y FROM test WHERE x = 1;
+SELECT sum(reads) FROM citus_shard_access WHERE table_name = 'test'::regclass;
+RESET citus.track_shard_access;
+
+-- waits on worker nodes are added to the latency histograms, other backends
+-- wait on worker nodes as well so compare the number of waits
+SELECT citus_worker_latency_histogram_reset();
+SELECT coalesce(sum(wait_count), 0) AS result_waits
+FROM citus_worker_latency_histogram() WHERE wait_event = 'Result'
+\gset
+SELECT y FROM test WHERE x = 1;
+SELECT sum(wait_count) > :result_waits AS waited
+FROM citus_worker_latency_histogram() WHERE wait_event = 'Result';
+
+-- this backend is not waiting on a worker node while running the query
+SELECT count(*) FROM citus_stat_worker_waits WHERE pid = pg_backend_pid();
+
+-- the maintenance daemon of this database publishes its workload, and checks
+-- for deadlocks while distributed transactions are in progress
+SELECT cycles, deadlock_checks
+FROM citus_stat_maintenance_daemon WHERE datname = current_database()
+\gset
+BEGIN;
+UPDATE test SET y = y;
+SELECT pg_sleep(3);
+COMMIT;
+SELECT cycles > :cycles AS ran, deadlock_checks > :deadlock_checks AS checked_deadlocks
+FROM citus_stat_maintenance_daemon WHERE datname = current_database();
+
+-- the stages of distributed planning are counted, other backends plan as well
+-- so compare the number of calls
+SELECT citus_planner_stats_reset();
+CREATE TEMP TABLE planner_calls AS SELECT stage, calls FROM citus_stat_planner;
+SELECT y FROM test WHERE x = 1;
+SELECT count(*) FROM test;
+SELECT stage, after.calls > before.calls AS called
+FROM citus_stat_planner after JOIN planner_calls before USING (stage)
+WHERE stage IN ('fast path router planner', 'logical planner', 'shard pruning', 'plan cache miss')
+ORDER BY stage;
+
+-- sampled statements record their events in the trace buffer, which other
+-- backends may add to as well
+SET citus.query_trace_sample_rate TO 1.0;
+SELECT citus_query_trace_reset();
+SELECT y FROM test WHERE x = 1;
+RESET citus.query_trace_sample_rate;
+SELECT event, phase, count(*)
+FROM citus_query_trace_events()
+WHERE pid = pg_backend_pid() AND event IN ('plan', 'remote execution', 'first row', 'last row')
+GROUP BY event, phase
+ORDER BY event, phase;
+SELECT json_array_length(citus_query_trace_json(trace_id)->'traceEvents') = count(*) AS dumped
+FROM citus_query_trace_events() WHERE pid = pg_backend_pid()
+GROUP BY trace_id;
+
+-- distributed transactions of this session show up with their worker backends
+BEGIN;
+UPDATE test SET y = y;
+SELECT count(DISTINCT worker_node_port) AS worker_nodes, bool_and(query_node_name IS NULL) AS local
+FROM citus_dist_stat_activity WHERE pid = pg_backend_pid();
+ROLLBACK;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA query_stats CASCADE;
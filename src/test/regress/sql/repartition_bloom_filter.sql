@@ -0,0 +1,48 @@
+--
+-- REPARTITION_BLOOM_FILTER
+--
+-- Tests for dual partition joins in which the map tasks of one side drop rows
+-- whose join keys are not in the bloom filters built by the other side
+SET citus.next_shard_id TO 1840000;
+CREATE SCHEMA repartition_bloom_filter;
+SET search_path TO repartition_bloom_filter;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE orders (order_id int, customer_id int);
+SELECT create_distributed_table('orders', 'order_id');
+INSERT INTO orders SELECT i, i % 25 FROM generate_series(1, 200) i;
+INSERT INTO orders VALUES (201, NULL), (202, 100);
+
+CREATE TABLE customers (id int, region int);
+SELECT create_distributed_table('customers', 'region');
+INSERT INTO customers SELECT i, i % 3 FROM generate_series(0, 24) i;
+
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.repartition_bloom_filter_size TO '8kB';
+
+-- rows without a join partner, including null keys, do not change the result
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+-- filters on one side prune the rows of the other side
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id AND c.id < 5;
+
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id AND o.order_id <= 100
+GROUP BY c.region
+ORDER BY c.region;
+
+-- bloom filters also work when map tasks push their partitions
+SET citus.enable_repartition_push TO on;
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id AND c.region = 1;
+
+-- results match those without bloom filters
+RESET citus.enable_repartition_push;
+SET citus.repartition_bloom_filter_size TO 0;
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id AND c.region = 1;
+
+RESET citus.repartition_bloom_filter_size;
+RESET citus.task_executor_type;
+SET client_min_messages TO WARNING;
+DROP SCHEMA repartition_bloom_filter CASCADE;
@@ -0,0 +1,64 @@
+--
+-- REPARTITION_CACHE
+--
+-- Tests for repartition joins that reuse the partition files of map tasks
+-- on unmodified shards
+SET citus.next_shard_id TO 2050000;
+CREATE SCHEMA repartition_cache;
+SET search_path TO repartition_cache;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE orders (order_id int, customer_id int);
+SELECT create_distributed_table('orders', 'order_id');
+INSERT INTO orders SELECT i, i % 25 FROM generate_series(1, 200) i;
+
+CREATE TABLE customers (id int, region int);
+SELECT create_distributed_table('customers', 'region');
+INSERT INTO customers SELECT i, i % 3 FROM generate_series(0, 24) i;
+
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.enable_repartition_cache TO on;
+
+-- the first run caches the partition files, the second reuses them
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id
+GROUP BY c.region
+ORDER BY c.region;
+
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id
+GROUP BY c.region
+ORDER BY c.region;
+
+-- modifications invalidate the cached partition files of their shards
+UPDATE customers SET id = id + 100 WHERE region = 0;
+
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id
+GROUP BY c.region
+ORDER BY c.region;
+
+DELETE FROM orders WHERE customer_id = 1;
+
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id
+GROUP BY c.region
+ORDER BY c.region;
+
+-- results match those without the cache
+SET citus.enable_repartition_cache TO off;
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id
+GROUP BY c.region
+ORDER BY c.region;
+
+RESET citus.enable_repartition_cache;
+RESET citus.task_executor_type;
+SET client_min_messages TO WARNING;
+DROP SCHEMA repartition_cache CASCADE;
@@ -0,0 +1,51 @@
+--
+-- REPARTITION_JOIN_SAMPLING
+--
+-- Tests for splitting the merge tasks of range repartition joins based on a
+-- sample of the repartitioned table
+SET citus.next_shard_id TO 1790000;
+CREATE SCHEMA repartition_join_sampling;
+SET search_path TO repartition_join_sampling;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE customers (id int, name text);
+SELECT create_distributed_table('customers', 'id', 'range');
+SELECT master_create_empty_shard('customers') AS shardid \gset
+UPDATE pg_dist_shard SET shardminvalue = 0, shardmaxvalue = 499 WHERE shardid = :shardid;
+SELECT master_create_empty_shard('customers') AS shardid \gset
+UPDATE pg_dist_shard SET shardminvalue = 500, shardmaxvalue = 999 WHERE shardid = :shardid;
+INSERT INTO customers SELECT i, 'customer ' || i FROM generate_series(0, 999) i;
+
+-- most orders belong to a few customers in the first shard
+CREATE TABLE orders (order_id int, customer_id int);
+SELECT create_distributed_table('orders', 'order_id');
+INSERT INTO orders
+SELECT i, CASE WHEN i % 10 < 8 THEN i % 50 ELSE i % 1000 END
+FROM generate_series(1, 2000) i;
+
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.large_table_shard_count TO 1;
+
+-- one merge task per customers shard
+EXPLAIN (COSTS FALSE)
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+-- sampling all rows splits the interval of the first shard
+SET citus.repartition_join_sample_percent TO 100;
+EXPLAIN (COSTS FALSE)
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+SELECT c.id / 10 AS bucket, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id AND c.id < 50
+GROUP BY 1
+ORDER BY 1;
+
+RESET citus.repartition_join_sample_percent;
+RESET citus.large_table_shard_count;
+RESET citus.task_executor_type;
+SET client_min_messages TO WARNING;
+DROP SCHEMA repartition_join_sampling CASCADE;
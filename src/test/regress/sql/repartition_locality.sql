@@ -0,0 +1,44 @@
+--
+-- REPARTITION_LOCALITY
+--
+-- Tests for repartition joins in which merge tasks run on the node that has
+-- most of their input
+SET citus.next_shard_id TO 2010000;
+CREATE SCHEMA repartition_locality;
+SET search_path TO repartition_locality;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE orders (order_id int, customer_id int);
+SELECT create_distributed_table('orders', 'order_id');
+INSERT INTO orders SELECT i, i % 25 FROM generate_series(1, 200) i;
+
+CREATE TABLE customers (id int, region int);
+SELECT create_distributed_table('customers', 'region');
+INSERT INTO customers SELECT i, i % 3 FROM generate_series(0, 24) i;
+
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.enable_locality_aware_merge TO on;
+
+-- repartition join on non-distribution columns
+SELECT count(*) FROM orders o, customers c WHERE o.customer_id = c.id;
+
+-- repartition join with a grouped merge step on the coordinator
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id
+GROUP BY c.region
+ORDER BY c.region;
+
+-- results match those of the round-robin assignment
+SET citus.enable_locality_aware_merge TO off;
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id
+GROUP BY c.region
+ORDER BY c.region;
+
+RESET citus.enable_locality_aware_merge;
+RESET citus.task_executor_type;
+SET client_min_messages TO WARNING;
+DROP SCHEMA repartition_locality CASCADE;
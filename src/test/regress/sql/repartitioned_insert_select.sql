@@ -0,0 +1,59 @@
+--
+-- REPARTITIONED_INSERT_SELECT
+--
+-- Tests for INSERT ... SELECT commands whose results are repartitioned on the
+-- workers instead of being collected on the coordinator
+SET citus.next_shard_id TO 1880000;
+CREATE SCHEMA repartitioned_insert_select;
+SET search_path TO repartitioned_insert_select;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE source_table (user_id int, event_id int, value int);
+SELECT create_distributed_table('source_table', 'user_id');
+
+CREATE TABLE target_table (event_id int, user_id int, value int);
+SELECT create_distributed_table('target_table', 'event_id');
+
+INSERT INTO source_table SELECT s % 10, s % 7, s FROM generate_series(1, 100) s;
+
+SET citus.enable_repartitioned_insert_select TO on;
+
+EXPLAIN (COSTS OFF)
+INSERT INTO target_table SELECT event_id, user_id, value FROM source_table WHERE value > 0;
+INSERT INTO target_table SELECT event_id, user_id, value FROM source_table WHERE value > 0;
+
+SELECT count(*), sum(value) FROM target_table;
+
+-- rows are inserted into the shards that the router planner prunes to
+SELECT count(*) FROM target_table WHERE event_id = 3;
+SELECT event_id, count(*) FROM target_table GROUP BY event_id ORDER BY event_id;
+
+-- columns can be listed in any order
+INSERT INTO target_table (user_id, value, event_id)
+SELECT user_id, value * 2, event_id FROM source_table WHERE value <= 10;
+
+SELECT count(*), sum(value) FROM target_table;
+
+-- parameters are resolved before the SELECT is sent to the workers
+PREPARE insert_value(int) AS
+  INSERT INTO target_table SELECT event_id, user_id, value FROM source_table WHERE value = $1;
+EXECUTE insert_value(5);
+
+SELECT * FROM target_table WHERE value = 5 ORDER BY user_id;
+
+-- the partition column cannot be NULL
+\set VERBOSITY terse
+INSERT INTO source_table VALUES (1, NULL, 1000);
+INSERT INTO target_table SELECT event_id, user_id, value FROM source_table;
+\set VERBOSITY default
+
+SELECT count(*), sum(value) FROM target_table;
+
+-- repartitioning is off by default
+RESET citus.enable_repartitioned_insert_select;
+SHOW citus.enable_repartitioned_insert_select;
+
+DEALLOCATE insert_value;
+SET client_min_messages TO WARNING;
+DROP SCHEMA repartitioned_insert_select CASCADE;
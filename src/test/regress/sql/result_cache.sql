@@ -0,0 +1,46 @@
+--
+-- RESULT_CACHE
+--
+-- Tests for citus.enable_result_cache, which caches the results of router
+-- queries on reference tables on the coordinator
+SET citus.next_shard_id TO 1710000;
+CREATE SCHEMA result_cache;
+SET search_path TO result_cache;
+
+CREATE TABLE ref (key int, value text);
+SELECT create_reference_table('ref');
+INSERT INTO ref VALUES (1, 'one'), (2, 'two');
+
+SET citus.enable_result_cache TO on;
+
+SELECT value FROM ref WHERE key = 1;
+
+-- changes made directly on the workers are not observed, so the cached row is returned
+SELECT success, result FROM run_command_on_placements('ref', 'UPDATE %s SET value = ''uno'' WHERE key = 1') ORDER BY nodeport;
+SELECT value FROM ref WHERE key = 1;
+
+-- other queries and parameter values are not served from the cache
+SELECT value FROM ref WHERE key = 1 AND value IS NOT NULL;
+PREPARE lookup(int) AS SELECT value FROM ref WHERE key = $1;
+EXECUTE lookup(2);
+
+-- modifications through the coordinator invalidate the cached results
+UPDATE ref SET value = 'two' WHERE key = 2;
+SELECT value FROM ref WHERE key = 1;
+EXECUTE lookup(1);
+
+BEGIN;
+INSERT INTO ref VALUES (3, 'three');
+SELECT value FROM ref WHERE key = 3;
+ROLLBACK;
+SELECT value FROM ref WHERE key = 3;
+
+-- queries with volatile functions are never cached
+SELECT success, result FROM run_command_on_placements('ref', 'UPDATE %s SET value = ''eins'' WHERE key = 1') ORDER BY nodeport;
+SELECT value, random() < 2 AS lucky FROM ref WHERE key = 1;
+
+RESET citus.enable_result_cache;
+SELECT value FROM ref WHERE key = 1;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA result_cache CASCADE;
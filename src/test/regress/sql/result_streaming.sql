@@ -0,0 +1,51 @@
+--
+-- RESULT_STREAMING
+--
+-- Tests for citus.enable_result_streaming, which returns rows of router
+-- queries directly from the connection
+SET citus.next_shard_id TO 1690000;
+CREATE SCHEMA result_streaming;
+SET search_path TO result_streaming;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 2;
+
+CREATE TABLE test (key int, value int);
+SELECT create_distributed_table('test', 'key');
+INSERT INTO test SELECT 1, i FROM generate_series(1, 5) i;
+
+SET citus.enable_result_streaming TO on;
+
+SELECT * FROM test WHERE key = 1 ORDER BY value;
+SELECT * FROM test WHERE key = 2 ORDER BY value;
+SELECT count(*) FROM test WHERE key = 1;
+
+-- rows that are not fetched are consumed when the cursor is closed
+BEGIN;
+DECLARE test_cursor NO SCROLL CURSOR FOR SELECT * FROM test WHERE key = 1 ORDER BY value;
+FETCH 2 FROM test_cursor;
+CLOSE test_cursor;
+SELECT count(*) FROM test WHERE key = 1;
+COMMIT;
+
+-- scrollable cursors use a tuple store
+BEGIN;
+DECLARE test_cursor SCROLL CURSOR FOR SELECT * FROM test WHERE key = 1 ORDER BY value;
+FETCH 2 FROM test_cursor;
+FETCH BACKWARD 1 FROM test_cursor;
+CLOSE test_cursor;
+COMMIT;
+
+-- errors after the first row cannot be retried
+SELECT value, 10 / (3 - value) FROM test WHERE key = 1;
+
+-- the connection can be used again afterwards
+SELECT count(*) FROM test WHERE key = 1;
+
+-- RETURNING rows of multi-shard modifications are streamed as well
+INSERT INTO test SELECT 2, i FROM generate_series(1, 5) i;
+UPDATE test SET value = value + 10 WHERE value = 3 RETURNING value;
+DELETE FROM test WHERE value = 13 RETURNING value;
+SELECT count(*) FROM test;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA result_streaming CASCADE;
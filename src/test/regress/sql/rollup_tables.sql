@@ -0,0 +1,67 @@
+--
+-- ROLLUP_TABLES
+--
+-- Tests for rollup tables, which incrementally aggregate the new rows of a
+-- distributed table
+SET citus.next_shard_id TO 2040000;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+CREATE TABLE rollup_events (event_id bigserial, site_id int, event_type text);
+SELECT create_distributed_table('rollup_events', 'site_id');
+CREATE TABLE rollup_counts (
+    site_id int,
+    event_type text,
+    event_count bigint,
+    PRIMARY KEY (site_id, event_type)
+);
+SELECT create_distributed_table('rollup_counts', 'site_id');
+INSERT INTO rollup_events (site_id, event_type)
+VALUES (1, 'click'), (1, 'view'), (2, 'click'), (1, 'click');
+SELECT master_create_rollup('rollup_counts', 'rollup_events', 'event_id', $$
+    INSERT INTO rollup_counts
+    SELECT site_id, event_type, count(*) FROM rollup_events
+    WHERE event_id BETWEEN $1 AND $2
+    GROUP BY site_id, event_type
+    ON CONFLICT (site_id, event_type)
+    DO UPDATE SET event_count = rollup_counts.event_count + EXCLUDED.event_count
+$$);
+SELECT rollupid, sourceid, sequenceid, lastaggregatedid FROM pg_dist_rollup;
+-- the first run aggregates the existing rows
+SELECT master_run_rollup('rollup_counts');
+SELECT * FROM rollup_counts ORDER BY site_id, event_type;
+-- later runs only aggregate the new rows
+INSERT INTO rollup_events (site_id, event_type)
+VALUES (1, 'click'), (2, 'view'), (3, 'click');
+SELECT master_run_rollup('rollup_counts');
+SELECT * FROM rollup_counts ORDER BY site_id, event_type;
+-- runs without new rows change nothing
+SELECT master_run_rollup('rollup_counts');
+SELECT * FROM rollup_counts ORDER BY site_id, event_type;
+-- rows of aborted runs are aggregated again
+INSERT INTO rollup_events (site_id, event_type) VALUES (2, 'click');
+BEGIN;
+SELECT master_run_rollup('rollup_counts');
+ROLLBACK;
+SELECT lastaggregatedid FROM pg_dist_rollup;
+SELECT master_run_rollup('rollup_counts');
+SELECT * FROM rollup_counts WHERE site_id = 2 ORDER BY event_type;
+-- errors
+SELECT master_create_rollup('rollup_counts', 'rollup_events', 'event_id',
+                            'INSERT INTO rollup_counts SELECT 1, ''x'', 1');
+CREATE TABLE rollup_other (site_id int PRIMARY KEY, event_count bigint);
+SELECT create_distributed_table('rollup_other', 'site_id');
+SELECT master_create_rollup('rollup_other', 'rollup_events', 'site_id',
+                            'INSERT INTO rollup_other SELECT 1, 1');
+SELECT master_create_rollup('rollup_other', 'rollup_events', 'event_id',
+                            'SELECT 1');
+SELECT master_create_rollup('rollup_other', 'rollup_events', 'event_id',
+                            'INSERT INTO rollup_counts SELECT 1, ''x'', 1');
+SELECT master_run_rollup('rollup_other');
+-- dropping a table removes its rollups
+SELECT master_drop_rollup('rollup_counts');
+SELECT count(*) FROM pg_dist_rollup;
+SELECT master_create_rollup('rollup_other', 'rollup_events', 'event_id',
+                            'INSERT INTO rollup_other SELECT site_id, count(*) FROM rollup_events WHERE event_id BETWEEN $1 AND $2 GROUP BY site_id');
+DROP TABLE rollup_events;
+SELECT count(*) FROM pg_dist_rollup;
+DROP TABLE rollup_counts, rollup_other;
@@ -76,7 +76,7 @@ SELECT * FROM test a WHERE x IN (SELECT x FROM test b UNION SELECT y FROM test c
 -- same query with subquery in where is wrapped in CTE
 SELECT * FROM test a WHERE x IN (WITH cte AS (SELECT x FROM test b UNION SELECT y FROM test c UNION SELECT y FROM local_test d) SELECT * FROM cte) ORDER BY 1,2;
 
--- not supported since local table is joined with a set operation
+-- the local table joined with a set operation is planned as an intermediate result
 SELECT * FROM ((SELECT * FROM test) EXCEPT (SELECT * FROM test ORDER BY x LIMIT 1)) u JOIN local_test USING (x) ORDER BY 1,2;
 
 -- though we replace some queries including the local query, the intermediate result is on the outer part of an outer join 
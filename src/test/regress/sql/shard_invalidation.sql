@@ -0,0 +1,70 @@
+--
+-- SHARD_INVALIDATION
+--
+-- Tests for citus.enable_shard_placement_invalidation, which logs metadata
+-- changes such that backends only reload the placements of changed shards
+SET citus.next_shard_id TO 2140000;
+CREATE SCHEMA shard_invalidation;
+SET search_path TO shard_invalidation;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 2;
+
+CREATE FUNCTION shard_invalidation_log_position()
+	RETURNS bigint
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION invalidated_shard_placements(table_name regclass, start_position bigint)
+	RETURNS bigint[]
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION load_shard_placement_array(bigint, bool)
+	RETURNS text[]
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE TABLE events (key int, value int);
+SELECT create_distributed_table('events', 'key');
+SELECT shard_invalidation_log_position() AS start_position
+\gset
+
+-- placement changes of the current transaction are pending until it ends
+BEGIN;
+UPDATE pg_dist_placement SET shardstate = 3 WHERE shardid = 2140000;
+SELECT invalidated_shard_placements('events', :start_position);
+SELECT load_shard_placement_array(2140000, true);
+ROLLBACK;
+
+-- aborted changes are logged as changes of the whole table
+SELECT invalidated_shard_placements('events', :start_position);
+SELECT load_shard_placement_array(2140000, true);
+
+-- committed placement changes are logged per shard
+SELECT shard_invalidation_log_position() AS start_position
+\gset
+UPDATE pg_dist_placement SET shardstate = 3 WHERE shardid = 2140001;
+SELECT invalidated_shard_placements('events', :start_position);
+SELECT load_shard_placement_array(2140001, true);
+
+-- logged changes are combined with the pending ones
+BEGIN;
+UPDATE pg_dist_placement SET shardstate = 3 WHERE shardid = 2140000;
+SELECT invalidated_shard_placements('events', :start_position);
+ROLLBACK;
+
+-- prepared changes are logged as changes of the whole table, and committing
+-- them logs a change of all tables in the database
+BEGIN;
+UPDATE pg_dist_placement SET shardstate = 1 WHERE shardid = 2140001;
+PREPARE TRANSACTION 'shard_invalidation';
+SELECT invalidated_shard_placements('events', :start_position);
+SELECT shard_invalidation_log_position() AS start_position
+\gset
+COMMIT PREPARED 'shard_invalidation';
+SELECT invalidated_shard_placements('events', :start_position);
+SELECT load_shard_placement_array(2140001, true);
+SELECT count(*) FROM events;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shard_invalidation CASCADE;
@@ -0,0 +1,85 @@
+--
+-- SHARD_MOVE_PLACEMENT
+--
+-- Tests for moving shards and their co-located shards between nodes
+SET citus.next_shard_id TO 1980000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 2;
+
+SHOW server_version \gset
+SELECT substring(:'server_version', '\d+')::int > 9 AS version_above_nine;
+
+CREATE TABLE move_items (id int PRIMARY KEY, value text);
+SELECT create_distributed_table('move_items', 'id');
+
+CREATE TABLE move_events (id int PRIMARY KEY, item_id int);
+SELECT create_distributed_table('move_events', 'id');
+
+INSERT INTO move_items SELECT i, 'item ' || i FROM generate_series(1, 100) i;
+INSERT INTO move_events SELECT i, i FROM generate_series(1, 50) i;
+
+SELECT shardid, nodeport FROM pg_dist_shard_placement
+WHERE shardid BETWEEN 1980000 AND 1980003 ORDER BY shardid;
+
+-- source and target must be different nodes with and without a placement
+SELECT master_move_shard_placement(1980000, 'localhost', :worker_1_port,
+								   'localhost', :worker_1_port, 'block_writes');
+SELECT master_move_shard_placement(1980000, 'localhost', :worker_2_port,
+								   'localhost', :worker_1_port, 'block_writes');
+
+-- reference tables have a placement on every node
+CREATE TABLE move_reference (id int);
+SELECT create_reference_table('move_reference');
+SELECT master_move_shard_placement(1980004, 'localhost', :worker_1_port,
+								   'localhost', :worker_2_port, 'block_writes');
+
+-- move the shards of both tables, while blocking writes
+SELECT master_move_shard_placement(1980000, 'localhost', :worker_1_port,
+								   'localhost', :worker_2_port, 'block_writes');
+
+SELECT shardid, nodeport FROM pg_dist_shard_placement
+WHERE shardid BETWEEN 1980000 AND 1980003 ORDER BY shardid;
+
+SELECT count(*) FROM move_items;
+SELECT count(*) FROM move_events;
+
+-- the shards are dropped on the source node
+\c - - - :worker_1_port
+SELECT count(*) FROM pg_class WHERE relname IN ('move_items_1980000', 'move_events_1980002');
+\c - - - :master_port
+
+-- move them back using logical replication
+SELECT master_move_shard_placement(1980000, 'localhost', :worker_2_port,
+								   'localhost', :worker_1_port, 'force_logical');
+
+SELECT shardid, nodeport FROM pg_dist_shard_placement
+WHERE shardid BETWEEN 1980000 AND 1980003 ORDER BY shardid;
+
+SELECT count(*) FROM move_items;
+SELECT count(*) FROM move_events;
+
+UPDATE move_items SET value = 'moved' WHERE id = 1;
+DELETE FROM move_events WHERE id = 1;
+SELECT value FROM move_items WHERE id = 1;
+SELECT count(*) FROM move_events;
+
+-- the subscription dropped its replication slot
+\c - - - :worker_2_port
+SELECT count(*) FROM pg_replication_slots;
+\c - - - :master_port
+SET citus.next_shard_id TO 1980005;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 2;
+
+-- logical replication cannot replicate updates of tables without replica identity
+CREATE TABLE move_no_key (id int);
+SELECT create_distributed_table('move_no_key', 'id', colocate_with => 'none');
+SELECT master_move_shard_placement(1980005, 'localhost', :worker_1_port,
+								   'localhost', :worker_2_port, 'force_logical');
+SELECT master_move_shard_placement(1980005, 'localhost', :worker_1_port,
+								   'localhost', :worker_2_port, 'auto');
+
+SELECT shardid, nodeport FROM pg_dist_shard_placement
+WHERE shardid BETWEEN 1980005 AND 1980006 ORDER BY shardid;
+
+DROP TABLE move_items, move_events, move_reference, move_no_key;
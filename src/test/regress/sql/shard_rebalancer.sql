@@ -0,0 +1,60 @@
+--
+-- SHARD_REBALANCER
+--
+-- Tests for planning and executing shard moves that balance the shards
+-- of distributed tables across the workers
+SET citus.next_shard_id TO 1990000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+-- only balance disk size, which is the same for the empty shards
+SET citus.rebalance_load_weight TO 0;
+
+CREATE TABLE rebalance_items (id int, value text);
+SELECT create_distributed_table('rebalance_items', 'id');
+
+-- a balanced table does not need any moves
+SELECT table_name, shardid, sourceport, targetport
+FROM get_rebalance_table_shards_plan('rebalance_items');
+
+-- put all shards on the first worker
+SELECT master_move_shard_placement(1990001, 'localhost', :worker_2_port,
+								   'localhost', :worker_1_port, 'block_writes');
+SELECT master_move_shard_placement(1990003, 'localhost', :worker_2_port,
+								   'localhost', :worker_1_port, 'block_writes');
+
+SELECT table_name, shardid, sourceport, targetport
+FROM get_rebalance_table_shards_plan('rebalance_items');
+
+SELECT table_name, shardid, sourceport, targetport
+FROM get_rebalance_table_shards_plan('rebalance_items', max_shard_moves := 1);
+
+SELECT table_name, shardid, sourceport, targetport
+FROM get_rebalance_table_shards_plan('rebalance_items',
+									 excluded_shard_list := '{1990000}');
+
+-- a larger threshold accepts a larger imbalance
+SELECT table_name, shardid, sourceport, targetport
+FROM get_rebalance_table_shards_plan('rebalance_items', threshold := 0.6);
+
+SELECT get_rebalance_table_shards_plan('rebalance_items', threshold := 2);
+
+-- moves cannot be rolled back
+BEGIN;
+SELECT rebalance_table_shards('rebalance_items');
+ROLLBACK;
+
+SELECT rebalance_table_shards('rebalance_items', shard_transfer_mode := 'block_writes');
+
+SELECT shardid, nodeport FROM pg_dist_shard_placement
+WHERE shardid BETWEEN 1990000 AND 1990003 ORDER BY shardid;
+
+SELECT table_name, shardid, sourceport, targetport
+FROM get_rebalance_table_shards_plan('rebalance_items');
+
+-- reference tables have a placement on every node
+CREATE TABLE rebalance_reference (id int);
+SELECT create_reference_table('rebalance_reference');
+SELECT rebalance_table_shards('rebalance_reference');
+
+DROP TABLE rebalance_items, rebalance_reference;
@@ -0,0 +1,43 @@
+--
+-- SHARD_REPAIR_STREAM
+--
+-- Tests for repairing all inactive placements on a node, streaming the shards
+-- from their healthy placements
+SET citus.next_shard_id TO 1990200;
+SET citus.shard_replication_factor TO 2;
+SET citus.shard_count TO 4;
+
+CREATE TABLE repair_items (id int PRIMARY KEY, value text);
+SELECT create_distributed_table('repair_items', 'id');
+
+INSERT INTO repair_items SELECT i, 'item ' || i FROM generate_series(1, 100) i;
+
+-- lose the rows of a placement and mark the placements on the node inactive
+\c - - - :worker_2_port
+TRUNCATE repair_items_1990201;
+\c - - - :master_port
+
+UPDATE pg_dist_placement SET shardstate = 3
+WHERE shardid BETWEEN 1990200 AND 1990203 AND groupid =
+	(SELECT groupid FROM pg_dist_node WHERE nodeport = :worker_2_port);
+
+SELECT master_repair_node_placements('localhost', :worker_2_port, 0);
+SELECT master_repair_node_placements('localhost', 1);
+
+SELECT master_repair_node_placements('localhost', :worker_2_port, 2);
+
+SELECT shardid, nodeport, shardstate FROM pg_dist_shard_placement
+WHERE shardid BETWEEN 1990200 AND 1990203 ORDER BY shardid, nodeport;
+
+-- the placements of each shard have the same rows and indexes
+SELECT shardid, count(DISTINCT result) FROM run_command_on_placements('repair_items',
+	'SELECT count(*) FROM %s') GROUP BY shardid ORDER BY shardid;
+SELECT DISTINCT result FROM run_command_on_placements('repair_items',
+	'SELECT count(*) FROM pg_index WHERE indrelid = ''%s''::regclass');
+
+SELECT count(*) FROM repair_items;
+
+-- nothing left to repair
+SELECT master_repair_node_placements('localhost', :worker_2_port);
+
+DROP TABLE repair_items;
@@ -0,0 +1,52 @@
+--
+-- SHARD_RETENTION
+--
+-- Tests for dropping the expired shards of time-partitioned tables
+SET citus.next_shard_id TO 1970000;
+CREATE SCHEMA shard_retention;
+SET search_path TO shard_retention;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE events (event_time timestamptz, payload text);
+SELECT create_distributed_table('events', 'event_time', 'append');
+COPY events FROM STDIN WITH (FORMAT csv);
+2000-01-01 00:00:00+00,old
+2000-01-02 00:00:00+00,old
+\.
+COPY events FROM STDIN WITH (FORMAT csv);
+2100-01-01 00:00:00+00,new
+\.
+
+-- tables that cannot have a retention policy
+CREATE TABLE hash_events (event_time timestamptz, payload text);
+SELECT create_distributed_table('hash_events', 'event_time');
+SELECT master_set_retention_policy('hash_events', '30 days');
+CREATE TABLE numbered_events (id int, payload text);
+SELECT create_distributed_table('numbered_events', 'id', 'append');
+SELECT master_set_retention_policy('numbered_events', '30 days');
+SELECT master_set_retention_policy('events', '-1 day');
+
+-- expired shards are only dropped for tables with a policy
+SELECT master_drop_expired_shards('events');
+
+SELECT master_set_retention_policy('events', '30 days');
+SELECT logicalrelid, retentionperiod = '30 days' AS has_period
+FROM pg_dist_retention_policy;
+
+-- the shard with rows from 2000 is dropped, the one from 2100 is kept
+SELECT master_drop_expired_shards('events');
+SELECT count(*) FROM pg_dist_shard WHERE logicalrelid = 'events'::regclass;
+SELECT payload FROM events;
+SELECT master_drop_expired_shards('events');
+
+-- NULL removes the policy
+SELECT master_set_retention_policy('events', NULL);
+SELECT count(*) FROM pg_dist_retention_policy;
+
+-- dropping the table removes its policy
+SELECT master_set_retention_policy('events', '1 year');
+DROP TABLE events;
+SELECT count(*) FROM pg_dist_retention_policy;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shard_retention CASCADE;
@@ -0,0 +1,59 @@
+--
+-- SHARD_SPLIT
+--
+-- Tests for splitting a shard and its co-located shards into shards with
+-- smaller hash ranges
+SET citus.next_shard_id TO 1990100;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 2;
+
+CREATE TABLE split_items (id int PRIMARY KEY, value text);
+SELECT create_distributed_table('split_items', 'id');
+
+CREATE TABLE split_events (id serial, item_id int);
+SELECT create_distributed_table('split_events', 'item_id');
+
+INSERT INTO split_items SELECT i, 'item ' || i FROM generate_series(1, 100) i;
+INSERT INTO split_events (item_id) SELECT i FROM generate_series(1, 50) i;
+
+SELECT master_split_shard(1990100, 2);
+
+SELECT logicalrelid, shardid, shardminvalue, shardmaxvalue FROM pg_dist_shard
+WHERE logicalrelid IN ('split_items'::regclass, 'split_events'::regclass)
+ORDER BY shardid;
+
+SELECT shardid, nodeport FROM pg_dist_shard_placement
+WHERE shardid BETWEEN 1990100 AND 1990107 ORDER BY shardid;
+
+-- the rows are in the shards of their hash ranges
+SELECT shardid, result FROM run_command_on_placements('split_items',
+													  'SELECT count(*) FROM %s')
+ORDER BY shardid;
+SELECT shardid, result FROM run_command_on_placements('split_events',
+													  'SELECT count(*) FROM %s')
+ORDER BY shardid;
+
+SELECT count(*) FROM split_items;
+SELECT value FROM split_items WHERE id = 8;
+SELECT count(*) FROM split_items JOIN split_events ON (split_items.id = item_id);
+
+INSERT INTO split_items VALUES (101, 'item 101');
+SELECT value FROM split_items WHERE id = 101;
+
+-- the colocation group now has three shards
+SELECT shardcount FROM pg_dist_colocation
+WHERE colocationid = (SELECT colocationid FROM pg_dist_partition
+					  WHERE logicalrelid = 'split_items'::regclass);
+
+SELECT master_split_shard(1990101, 1);
+
+CREATE TABLE split_reference (id int);
+SELECT create_reference_table('split_reference');
+SELECT master_split_shard(1990108);
+
+-- the original shards are dropped
+\c - - - :worker_1_port
+SELECT count(*) FROM pg_class WHERE relname IN ('split_items_1990100', 'split_events_1990102');
+\c - - - :master_port
+
+DROP TABLE split_items, split_events, split_reference;
@@ -0,0 +1,78 @@
+--
+-- SHARD_ZONE_MAPS
+--
+-- Tests for pruning shards by the zone maps of non-distribution columns
+SET citus.next_shard_id TO 1960000;
+CREATE SCHEMA shard_zone_maps;
+SET search_path TO shard_zone_maps;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE events (id int, day int, kind text, score float8);
+SELECT create_distributed_table('events', 'id', 'append');
+COPY events FROM STDIN WITH (FORMAT csv);
+1,1,click,1.0
+2,3,view,2.0
+3,5,click,3.0
+\.
+COPY events FROM STDIN WITH (FORMAT csv);
+4,11,view,1.0
+5,13,view,2.0
+6,15,buy,3.0
+\.
+
+-- columns that cannot have zone maps
+SELECT update_shard_zone_maps('events', '{id}');
+SELECT update_shard_zone_maps('events', '{score}');
+SELECT update_shard_zone_maps('events', '{missing}');
+SELECT update_shard_zone_maps('events', '{day}', -1);
+
+SELECT update_shard_zone_maps('events', '{day,kind}', 64);
+SELECT shardid, attnum, minvalue, maxvalue, bloomfilter IS NOT NULL AS has_bloom_filter
+FROM pg_dist_shard_zone_map
+WHERE logicalrelid = 'events'::regclass
+ORDER BY shardid, attnum;
+
+SET client_min_messages TO DEBUG2;
+
+-- zone maps are not used unless enabled
+SELECT count(*) FROM events WHERE day = 13;
+
+SET citus.enable_shard_zone_map_pruning TO on;
+
+-- filters that exclude one of the shards lead to a router plan
+SELECT count(*) FROM events WHERE day = 13;
+SELECT count(*) FROM events WHERE day < 11;
+SELECT count(*) FROM events WHERE 11 <= day;
+SELECT count(*) FROM events WHERE kind = 'buy';
+
+-- values within the min/max range of both shards are filtered by bloom filters
+SELECT count(*) FROM events WHERE kind = 'click';
+
+-- filters that no shard passes
+SELECT count(*) FROM events WHERE day > 15;
+
+-- filters below OR expressions do not prune
+SELECT count(*) FROM events WHERE day = 13 OR kind = 'click';
+
+RESET client_min_messages;
+
+-- appending to a shard refreshes its zone maps
+SELECT shardid AS last_shard_id FROM pg_dist_shard
+WHERE logicalrelid = 'events'::regclass ORDER BY shardid DESC LIMIT 1 \gset
+CREATE TABLE local_events (id int, day int, kind text, score float8);
+INSERT INTO local_events VALUES (7, 20, 'view', 1.0);
+SELECT master_append_table_to_shard(:last_shard_id, 'shard_zone_maps.local_events',
+                                    'localhost', :master_port) > 0 AS appended;
+SELECT shardid, attnum, minvalue, maxvalue
+FROM pg_dist_shard_zone_map
+WHERE logicalrelid = 'events'::regclass
+ORDER BY shardid, attnum;
+SELECT count(*) FROM events WHERE day = 20;
+
+-- zone maps are removed with their table
+DROP TABLE events;
+SELECT count(*) FROM pg_dist_shard_zone_map;
+
+RESET citus.enable_shard_zone_map_pruning;
+SET client_min_messages TO WARNING;
+DROP SCHEMA shard_zone_maps CASCADE;
@@ -0,0 +1,67 @@
+--
+-- SHARED_CONNECTION_STATS
+--
+-- Tests for citus.max_shared_pool_size, which limits the number of
+-- connections to each worker node across all backends
+SET citus.next_shard_id TO 1670000;
+CREATE SCHEMA shared_connection_stats;
+SET search_path TO shared_connection_stats;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (x int, y int);
+SELECT create_distributed_table('test', 'x');
+INSERT INTO test VALUES (1,1), (2,2), (3,3), (4,4), (5,5);
+
+ALTER SYSTEM SET citus.max_shared_pool_size TO 1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+-- start a new session, such that no connections are cached
+\c - - - :master_port
+SET search_path TO shared_connection_stats;
+SHOW citus.max_shared_pool_size;
+
+-- connections are counted while they are open
+BEGIN;
+SELECT count(*) FROM test;
+SELECT hostname, port, connection_count_to_node
+FROM citus_remote_connection_stats()
+WHERE port IN (:worker_1_port, :worker_2_port)
+ORDER BY 1, 2;
+COMMIT;
+
+-- and released once they are closed
+SELECT hostname, port, connection_count_to_node
+FROM citus_remote_connection_stats()
+WHERE port IN (:worker_1_port, :worker_2_port)
+ORDER BY 1, 2;
+
+-- the real-time executor waits for its own connections instead of exceeding the limit
+SELECT count(*) FROM test;
+SELECT hostname, port, connection_count_to_node
+FROM citus_remote_connection_stats()
+WHERE port IN (:worker_1_port, :worker_2_port)
+ORDER BY 1, 2;
+
+-- the adaptive executor does not open additional connections beyond the limit
+SET citus.task_executor_type TO 'adaptive';
+SET citus.executor_slow_start_interval TO 0;
+BEGIN;
+SELECT count(*) FROM test;
+SELECT hostname, port, connection_count_to_node
+FROM citus_remote_connection_stats()
+WHERE port IN (:worker_1_port, :worker_2_port)
+ORDER BY 1, 2;
+UPDATE test SET y = y + 1;
+SELECT sum(y) FROM test;
+COMMIT;
+
+RESET citus.executor_slow_start_interval;
+RESET citus.task_executor_type;
+
+ALTER SYSTEM RESET citus.max_shared_pool_size;
+SELECT pg_reload_conf();
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shared_connection_stats CASCADE;
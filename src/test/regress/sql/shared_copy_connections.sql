@@ -0,0 +1,47 @@
+--
+-- SHARED_COPY_CONNECTIONS
+--
+-- Tests for COPY into hash-distributed tables in which shards share
+-- connections, and each shard's rows are sent in separate COPY commands
+SET citus.next_shard_id TO 1850000;
+CREATE SCHEMA shared_copy_connections;
+SET search_path TO shared_copy_connections;
+SET citus.shard_count TO 32;
+
+SET citus.shard_replication_factor TO 1;
+CREATE TABLE events (id int, value text);
+SELECT create_distributed_table('events', 'id');
+
+SET citus.shard_replication_factor TO 2;
+CREATE TABLE replicated_events (id int, value text);
+SELECT create_distributed_table('replicated_events', 'id');
+
+SET citus.enable_shared_copy_connections TO on;
+
+COPY events FROM STDIN WITH (format csv);
+1,one
+2,two
+3,three
+4,four
+5,five
+\.
+
+-- INSERT ... SELECT via the coordinator also copies into the shards
+INSERT INTO events SELECT i, i::text FROM generate_series(6, 1000) i;
+SELECT count(*), count(DISTINCT id), min(id), max(id) FROM events;
+
+-- shards of a transaction block share connections as well
+BEGIN;
+INSERT INTO replicated_events SELECT * FROM events WHERE id <= 500;
+COPY replicated_events FROM STDIN WITH (format csv);
+1001,a
+1002,b
+\.
+COMMIT;
+SELECT count(*) FROM replicated_events;
+
+SELECT count(*) FROM replicated_events WHERE id > 1000;
+
+RESET citus.enable_shared_copy_connections;
+SET client_min_messages TO WARNING;
+DROP SCHEMA shared_copy_connections CASCADE;
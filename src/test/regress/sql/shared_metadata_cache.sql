@@ -0,0 +1,59 @@
+--
+-- SHARED_METADATA_CACHE
+--
+-- Tests for citus.shared_metadata_cache_size, which keeps the shards and
+-- placements of distributed tables in shared memory
+SET citus.next_shard_id TO 2130000;
+CREATE SCHEMA shared_metadata_cache;
+SET search_path TO shared_metadata_cache;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 2;
+
+CREATE FUNCTION shared_shard_list_cached(table_name regclass)
+	RETURNS bool
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE FUNCTION load_shard_placement_array(bigint, bool)
+	RETURNS text[]
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE TABLE events (key int, value int);
+SELECT create_distributed_table('events', 'key');
+
+-- reading the shards stores them in the cache
+SELECT count(*) FROM events;
+SELECT shared_shard_list_cached('events');
+
+-- other backends copy the shards from the cache instead of the catalogs,
+-- which we show by changing a placement without invalidating the cache
+SET session_replication_role TO replica;
+UPDATE pg_dist_placement SET shardstate = 3 WHERE shardid = 2130000;
+RESET session_replication_role;
+\c - - - :master_port
+SET search_path TO shared_metadata_cache;
+SELECT load_shard_placement_array(2130000, true);
+
+-- metadata changes remove the table from the cache
+UPDATE pg_dist_placement SET shardstate = 3 WHERE shardid = 2130000;
+SELECT shared_shard_list_cached('events');
+SELECT load_shard_placement_array(2130000, true);
+SELECT shared_shard_list_cached('events');
+
+-- metadata changes of prepared transactions are seen once committed
+BEGIN;
+UPDATE pg_dist_placement SET shardstate = 1 WHERE shardid = 2130000;
+PREPARE TRANSACTION 'shared_metadata_cache';
+SELECT load_shard_placement_array(2130000, true);
+SELECT shared_shard_list_cached('events');
+COMMIT PREPARED 'shared_metadata_cache';
+SELECT shared_shard_list_cached('events');
+SELECT load_shard_placement_array(2130000, true);
+\c - - - :master_port
+SET search_path TO shared_metadata_cache;
+SELECT load_shard_placement_array(2130000, true);
+SELECT count(*) FROM events;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shared_metadata_cache CASCADE;
@@ -0,0 +1,48 @@
+--
+-- SKIP_REMOTE_BEGIN
+--
+-- Tests for running router SELECTs in transaction blocks without remote BEGIN
+SET citus.next_shard_id TO 1940000;
+CREATE SCHEMA skip_remote_begin;
+SET search_path TO skip_remote_begin;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE items (id int, value int);
+SELECT create_distributed_table('items', 'id');
+INSERT INTO items VALUES (1, 1), (2, 2), (3, 3), (4, 4);
+
+SET citus.skip_remote_begin_for_selects TO on;
+
+-- reads see the writes of the transaction
+BEGIN;
+SELECT value FROM items WHERE id = 1;
+UPDATE items SET value = 10 WHERE id = 1;
+SELECT value FROM items WHERE id = 1;
+SELECT value FROM items WHERE id = 2;
+DELETE FROM items WHERE id = 2;
+SELECT value FROM items WHERE id = 2;
+ROLLBACK;
+SELECT * FROM items ORDER BY id;
+
+-- statements that need the transaction block still get it
+BEGIN;
+SELECT value FROM items WHERE id = 3 FOR UPDATE;
+SELECT value, random() < 2 AS volatile FROM items WHERE id = 4;
+UPDATE items SET value = 30 WHERE id = 3;
+COMMIT;
+SELECT * FROM items ORDER BY id;
+
+-- two-phase commit only involves the connections that wrote
+SET citus.multi_shard_commit_protocol TO '2pc';
+BEGIN;
+INSERT INTO items VALUES (5, 5);
+SELECT value FROM items WHERE id = 1;
+SELECT value FROM items WHERE id = 2;
+COMMIT;
+SELECT * FROM items ORDER BY id;
+
+RESET citus.multi_shard_commit_protocol;
+RESET citus.skip_remote_begin_for_selects;
+SET client_min_messages TO WARNING;
+DROP SCHEMA skip_remote_begin CASCADE;
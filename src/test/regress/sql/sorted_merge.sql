@@ -0,0 +1,42 @@
+--
+-- SORTED_MERGE
+--
+-- Tests for citus.enable_sorted_merge, which merges sorted task results on
+-- the coordinator instead of sorting them again
+SET citus.next_shard_id TO 1700000;
+CREATE SCHEMA sorted_merge;
+SET search_path TO sorted_merge;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (key int, value int);
+SELECT create_distributed_table('test', 'key');
+INSERT INTO test SELECT i, (i * 7) % 20 FROM generate_series(1, 20) i;
+INSERT INTO test VALUES (21, NULL);
+
+SET citus.enable_sorted_merge TO on;
+
+\a\t
+-- the coordinator merges the task results when the workers sort them
+EXPLAIN (COSTS FALSE) SELECT * FROM test ORDER BY value LIMIT 5;
+
+-- without a limit the workers do not sort, so the coordinator does
+EXPLAIN (COSTS FALSE) SELECT * FROM test ORDER BY value;
+\a\t
+
+SELECT * FROM test ORDER BY value LIMIT 5;
+SELECT * FROM test ORDER BY value DESC LIMIT 3 OFFSET 2;
+SELECT * FROM test ORDER BY value NULLS FIRST LIMIT 2;
+
+-- merged results can be scanned backward
+BEGIN;
+DECLARE test_cursor SCROLL CURSOR FOR SELECT * FROM test ORDER BY value LIMIT 4;
+FETCH 3 FROM test_cursor;
+FETCH BACKWARD 1 FROM test_cursor;
+CLOSE test_cursor;
+COMMIT;
+
+RESET citus.enable_sorted_merge;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA sorted_merge CASCADE;
@@ -0,0 +1,79 @@
+--
+-- SPECULATIVE_MAP_TASKS
+--
+-- Tests for citus.speculative_map_task_factor, which starts a copy of a slow
+-- map task on another node that has a replica of its shard
+SET citus.next_shard_id TO 2150000;
+CREATE SCHEMA speculative_map_tasks;
+SET search_path TO speculative_map_tasks;
+SET citus.shard_replication_factor TO 2;
+SET citus.shard_count TO 2;
+
+-- slows down map tasks that read the given row on worker_1 only, such that a
+-- copy of the map task on worker_2 completes first
+CREATE FUNCTION public.delay_map_task_row(key int, slow_key int)
+	RETURNS bool
+	AS $$
+BEGIN
+	IF key = slow_key AND inet_server_port() = 57637 THEN
+		PERFORM pg_sleep(3);
+	END IF;
+	RETURN true;
+END;
+$$ LANGUAGE plpgsql;
+SELECT * FROM run_command_on_workers($cmd$
+CREATE FUNCTION public.delay_map_task_row(key int, slow_key int)
+	RETURNS bool
+	AS $$
+BEGIN
+	IF key = slow_key AND inet_server_port() = 57637 THEN
+		PERFORM pg_sleep(3);
+	END IF;
+	RETURN true;
+END;
+$$ LANGUAGE plpgsql;
+$cmd$)
+ORDER BY 1, 2;
+
+CREATE TABLE orders (order_id int, customer_id int);
+SELECT create_distributed_table('orders', 'order_id');
+INSERT INTO orders SELECT i, i % 25 FROM generate_series(1, 200) i;
+
+CREATE TABLE customers (id int, region int);
+SELECT create_distributed_table('customers', 'region');
+INSERT INTO customers SELECT i, i % 3 FROM generate_series(0, 24) i;
+
+-- a row in the first shard, whose map task runs on worker_1 with first-replica
+SELECT order_id AS slow_order_id FROM orders WHERE worker_hash(order_id) < 0
+ORDER BY order_id LIMIT 1
+\gset
+
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.task_assignment_policy TO 'first-replica';
+
+-- results without speculation
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id AND delay_map_task_row(o.order_id, :slow_order_id)
+GROUP BY c.region
+ORDER BY c.region;
+
+-- the copy on worker_2 completes first and the output of the original map
+-- task is not fetched, so the results do not change
+SET citus.speculative_map_task_factor TO 10;
+SET client_min_messages TO DEBUG1;
+SELECT c.region, count(*)
+FROM orders o, customers c
+WHERE o.customer_id = c.id AND delay_map_task_row(o.order_id, :slow_order_id)
+GROUP BY c.region
+ORDER BY c.region;
+RESET client_min_messages;
+
+RESET citus.speculative_map_task_factor;
+RESET citus.task_assignment_policy;
+RESET citus.task_executor_type;
+SELECT * FROM run_command_on_workers('DROP FUNCTION public.delay_map_task_row(int, int)')
+ORDER BY 1, 2;
+DROP FUNCTION public.delay_map_task_row(int, int);
+SET client_min_messages TO WARNING;
+DROP SCHEMA speculative_map_tasks CASCADE;
@@ -0,0 +1,31 @@
+--
+-- STATEMENT_TIMEOUT_PROPAGATION
+--
+-- Tests for forwarding statement_timeout to the tasks of multi-shard queries
+SET citus.next_shard_id TO 2070000;
+CREATE SCHEMA statement_timeout_propagation;
+SET search_path TO statement_timeout_propagation;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE items (item_id int, value int);
+SELECT create_distributed_table('items', 'item_id');
+INSERT INTO items SELECT i, i % 10 FROM generate_series(1, 100) i;
+
+-- tasks get the remaining time of the statement as their timeout
+SET statement_timeout TO '1min';
+SELECT count(*), sum(value) FROM items;
+SELECT value, count(*) FROM items GROUP BY value ORDER BY value LIMIT 3;
+
+SET citus.propagate_statement_timeout TO off;
+SELECT count(*), sum(value) FROM items;
+RESET citus.propagate_statement_timeout;
+
+-- tasks in transaction blocks rely on the coordinator to cancel them
+BEGIN;
+SELECT count(*), sum(value) FROM items;
+COMMIT;
+RESET statement_timeout;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA statement_timeout_propagation CASCADE;
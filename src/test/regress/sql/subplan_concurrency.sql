@@ -0,0 +1,39 @@
+--
+-- SUBPLAN_CONCURRENCY
+--
+-- Tests for executing subplans that do not depend on each other at the same
+-- time, while subplans that read other results still wait for them
+SET citus.next_shard_id TO 1760000;
+CREATE SCHEMA subplan_concurrency;
+SET search_path TO subplan_concurrency;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE test (x int, y int);
+SELECT create_distributed_table('test', 'x');
+INSERT INTO test VALUES (1, 10), (2, 20), (3, 30), (4, 40);
+
+-- independent router CTEs are executed together
+WITH a AS (SELECT y FROM test WHERE x = 1),
+     b AS (SELECT y FROM test WHERE x = 2),
+     c AS (SELECT y FROM test WHERE x = 3)
+SELECT a.y, b.y, c.y FROM a, b, c;
+
+-- b reads the result of a and c needs a master query, so both run afterwards
+WITH a AS (SELECT x, y FROM test WHERE x = 1),
+     b AS (SELECT y FROM test WHERE x = 2 AND y > (SELECT y FROM a)),
+     c AS (SELECT count(*) AS cnt FROM test)
+SELECT a.y, b.y, c.cnt FROM a, b, c;
+
+-- concurrent subplans see the writes of the transaction
+BEGIN;
+UPDATE test SET y = y + 1 WHERE x = 1;
+UPDATE test SET y = y + 1 WHERE x = 2;
+WITH a AS (SELECT y FROM test WHERE x = 1),
+     b AS (SELECT y FROM test WHERE x = 2),
+     c AS (SELECT y FROM test WHERE x = 3)
+SELECT a.y, b.y, c.y FROM a, b, c;
+COMMIT;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA subplan_concurrency CASCADE;
@@ -0,0 +1,38 @@
+--
+-- SUBPLAN_FILTER_PUSHDOWN
+--
+-- Tests for pushing the filters of the outer query into recursively planned
+-- subqueries and CTEs
+SET citus.next_shard_id TO 1820000;
+CREATE SCHEMA subplan_filter_pushdown;
+SET search_path TO subplan_filter_pushdown;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE filter_table (a int, b int);
+SELECT create_distributed_table('filter_table', 'a');
+INSERT INTO filter_table VALUES (1, 1), (2, 2), (3, 3), (4, 4), (5, 0),
+							   (6, 1), (7, 2), (8, 3), (9, 4), (10, 0);
+
+SET citus.enable_subplan_filter_pushdown TO on;
+SET client_min_messages TO DEBUG1;
+
+-- the filter on the group by column is applied on the groups of the subplan
+SELECT * FROM (SELECT b, count(*) AS cnt FROM filter_table GROUP BY b) AS foo
+WHERE b > 2 ORDER BY 1;
+
+-- filters on aggregates are only applied in the outer query
+SELECT * FROM (SELECT b, count(*) AS cnt FROM filter_table GROUP BY b) AS foo
+WHERE b > 2 AND cnt > 1 ORDER BY 1;
+
+-- a CTE that is referenced once is filtered before it is materialized
+WITH cte AS (SELECT a, b FROM filter_table)
+SELECT count(*) FROM cte WHERE b = 3 AND a > 5;
+
+-- volatile filters are not pushed down
+WITH cte AS (SELECT a, b FROM filter_table)
+SELECT count(*) FROM cte WHERE b = 3 AND random() >= 0;
+
+SET client_min_messages TO WARNING;
+RESET citus.enable_subplan_filter_pushdown;
+DROP SCHEMA subplan_filter_pushdown CASCADE;
@@ -8,7 +8,9 @@ SET client_min_messages TO DEBUG1;
 
 CREATE TABLE users_table_local AS SELECT * FROM users_table;
 
--- we don't support subqueries with local tables when they are not leaf queries
+-- we don't support subqueries with local tables when they are not leaf queries,
+-- unless the local tables are planned as intermediate results
+SET citus.enable_local_table_joins TO off;
 SELECT 
 	* 
 FROM
@@ -19,6 +21,7 @@ FROM
 			users_table_local, (SELECT user_id FROM events_table) as evs
 		WHERE users_table_local.user_id = evs.user_id
 	) as foo;
+RESET citus.enable_local_table_joins;
 
 -- we don't support subqueries with local tables when they are not leaf queries
 SELECT user_id FROM users_table WHERE user_id IN 
@@ -107,8 +110,8 @@ FROM
 	ON(foo.value_2 = bar.value_2);
 
 
--- Aggregates in subquery without partition column can be planned recursively
--- unless there is a reference to an outer query
+-- Aggregates in subquery without partition column can be pushed down when
+-- the subquery is correlated on the distribution column
 SELECT
     * 
 FROM
@@ -126,8 +129,8 @@ WHERE
 ;
 
 
--- Having qual without group by on partition column can be planned recursively
--- unless there is a reference to an outer query
+-- Having qual without group by on partition column can be pushed down when
+-- the subquery is correlated on the distribution column
 SELECT
     * 
 FROM
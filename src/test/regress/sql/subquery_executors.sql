@@ -109,5 +109,21 @@ WHERE foo.value_2 = bar.user_id;
 
 SET client_min_messages TO DEFAULT;
 
+-- repartition jobs are allowed when Citus picks the executor
+SET citus.enable_executor_selection TO on;
+
+SELECT 
+	count(*) 
+FROM
+(
+	SELECT DISTINCT users_table.value_2 FROM users_table, events_table WHERE users_table.user_id = events_table.value_2 AND users_table.user_id < 2
+) as foo, 
+(
+	SELECT user_id FROM users_table
+) as bar
+WHERE foo.value_2 = bar.user_id; 
+
+RESET citus.enable_executor_selection;
+
 DROP SCHEMA subquery_executor CASCADE;
 SET search_path TO public;
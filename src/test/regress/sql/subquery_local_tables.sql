@@ -198,6 +198,16 @@ GROUP BY user_id
 HAVING count(*) > 1 AND sum(value_2) > 29
 ORDER BY 1;
 
+-- local tables that are joined with distributed tables are planned as
+-- intermediate results, which only contain the filtered rows and the
+-- columns that the query needs
+SELECT
+	count(*), sum(e.value_2)
+FROM
+	users_table_local u, events_table e
+WHERE
+	u.user_id = e.user_id AND u.value_1 = 1;
+
 SET client_min_messages TO DEFAULT;
 
 DROP SCHEMA subquery_local_tables CASCADE;
@@ -0,0 +1,36 @@
+--
+-- TASK_PARALLEL_WORKERS
+--
+-- Tests for suggesting parallel workers to tasks on large shards
+SET citus.next_shard_id TO 2080000;
+CREATE SCHEMA task_parallel_workers;
+SET search_path TO task_parallel_workers;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE items (item_id int, value int);
+SELECT create_distributed_table('items', 'item_id');
+INSERT INTO items SELECT i, i % 10 FROM generate_series(1, 100) i;
+
+-- pretend the shards are large, such that tasks get parallel workers
+UPDATE pg_dist_placement SET shardlength = 100000000
+WHERE shardid IN (SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'items'::regclass);
+
+SELECT count(*), sum(value) FROM items WHERE item_id = 5;
+SELECT count(*), sum(value) FROM items;
+SELECT value, count(*) FROM items GROUP BY value ORDER BY value LIMIT 3;
+
+-- connections forget the setting for tasks without parallel workers
+SET citus.max_parallel_workers_per_node TO 0;
+SELECT count(*), sum(value) FROM items WHERE item_id = 5;
+SELECT count(*), sum(value) FROM items;
+RESET citus.max_parallel_workers_per_node;
+
+-- tasks in transaction blocks keep the settings of the workers
+BEGIN;
+SELECT count(*), sum(value) FROM items WHERE item_id = 5;
+SELECT count(*), sum(value) FROM items;
+COMMIT;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA task_parallel_workers CASCADE;
@@ -32,6 +32,17 @@ SELECT pg_sleep(3.0);
 SELECT task_tracker_task_status(:JobId, :SimpleTaskId);
 SELECT task_tracker_task_status(:JobId, :RecoverableTaskId);
 
+-- The statuses of all tasks of the job can also be checked with one call.
+
+SELECT * FROM task_tracker_job_status(:JobId) ORDER BY task_id;
+
+-- The task tracker also shows how long tasks were queued and ran, which
+-- backend ran them, and how often they were retried.
+
+SELECT task_id, task_status, retries, queue_time >= 0 AS queued,
+       run_time >= 0 AS ran, backend_pid IS NOT NULL AS has_backend
+FROM citus_task_tracker_tasks WHERE job_id = :JobId ORDER BY task_id;
+
 COPY :SimpleTaskTable FROM 'base/pgsql_job_cache/job_401010/task_101101';
 
 SELECT COUNT(*) FROM :SimpleTaskTable;
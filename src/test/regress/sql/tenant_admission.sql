@@ -0,0 +1,65 @@
+--
+-- TENANT_ADMISSION
+--
+-- Tests for citus.max_tenant_concurrency, which limits the number of
+-- concurrent router queries per tenant across all backends
+SET citus.next_shard_id TO 2090000;
+CREATE SCHEMA tenant_admission;
+SET search_path TO tenant_admission;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE events (tenant_id int, value int);
+SELECT create_distributed_table('events', 'tenant_id', colocate_with => 'none');
+INSERT INTO events VALUES (1, 1), (1, 2), (2, 3);
+
+ALTER SYSTEM SET citus.max_tenant_concurrency TO 1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+\c - - - :master_port
+SET search_path TO tenant_admission;
+SHOW citus.max_tenant_concurrency;
+
+-- router queries are admitted per tenant
+SELECT count(*) FROM events WHERE tenant_id = 1;
+UPDATE events SET value = value + 1 WHERE tenant_id = 1;
+SELECT sum(value) FROM events WHERE tenant_id = 2;
+
+-- multi-shard queries are not limited
+SELECT count(*) FROM events;
+
+-- admissions are released at the end of each statement, also in transactions
+BEGIN;
+SELECT sum(value) FROM events WHERE tenant_id = 1;
+SELECT active_queries, waiting_queries, admitted_queries
+FROM citus_tenant_admission_stats()
+WHERE colocation_id = (SELECT colocationid FROM pg_dist_partition
+					   WHERE logicalrelid = 'events'::regclass)
+ORDER BY admitted_queries;
+COMMIT;
+
+-- queries on a tenant whose admission the backend holds are admitted right away
+SET citus.enable_result_streaming TO on;
+BEGIN;
+DECLARE events_cursor NO SCROLL CURSOR FOR
+SELECT value FROM events WHERE tenant_id = 1 ORDER BY value;
+FETCH 1 FROM events_cursor;
+SELECT count(*) FROM events WHERE tenant_id = 1;
+SELECT active_queries, waiting_queries, admitted_queries
+FROM citus_tenant_admission_stats()
+WHERE colocation_id = (SELECT colocationid FROM pg_dist_partition
+					   WHERE logicalrelid = 'events'::regclass)
+ORDER BY admitted_queries;
+CLOSE events_cursor;
+COMMIT;
+RESET citus.enable_result_streaming;
+
+-- nobody waits for an admission
+SELECT count(*) FROM citus_tenant_admission_waits();
+
+ALTER SYSTEM RESET citus.max_tenant_concurrency;
+SELECT pg_reload_conf();
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA tenant_admission CASCADE;
@@ -136,6 +136,19 @@ ORDER BY
 	rnk DESC, 1 DESC
 LIMIT 10;
 
+-- the same query with the reference table column joined on the distribution column
+SELECT 
+	DISTINCT ON (events_table.user_id, rnk) events_table.user_id, rank() OVER my_win AS rnk
+FROM 
+	events_table, users_ref_test_table uref
+WHERE 
+	uref.id = events_table.user_id
+WINDOW
+	my_win AS (PARTITION BY uref.id, uref.k_no ORDER BY events_table.time DESC)
+ORDER BY 
+	rnk DESC, 1 DESC
+LIMIT 10;
+
 -- similar query with no distribution column is on the partition by clause
 -- is not supported
 SELECT 
@@ -222,7 +222,7 @@ WITH cte AS (
 SELECT DISTINCT uid_1, val_3 FROM cte join events_table on cte.val_3=events_table.event_type ORDER BY 1, 2;
 
 
--- CTEs should not be able to terminate (the last SELECT) in a local query
+-- CTEs can be joined with local tables in the last SELECT
 WITH cte AS (
 	SELECT * FROM users_table
 )
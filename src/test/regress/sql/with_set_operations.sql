@@ -186,8 +186,8 @@ WHERE
 )
 ORDER BY 1 DESC;
 
--- unions and ctes inside subqueries in where clause with a not pushdownable correlated subquery
--- should error out
+-- unions and ctes inside subqueries in where clause with a correlated subquery
+-- that has a limit, which is pushed down since it is correlated on the distribution column
 SELECT 
 	DISTINCT user_id 
 FROM 
@@ -0,0 +1,37 @@
+--
+-- WORK_STEALING
+--
+-- Tests for the work-stealing task assignment policy, which lets the
+-- real-time executor choose among the replicas of a task at runtime
+SET citus.next_shard_id TO 1730000;
+CREATE SCHEMA work_stealing;
+SET search_path TO work_stealing;
+SET citus.shard_replication_factor TO 2;
+SET citus.shard_count TO 8;
+
+CREATE TABLE test (key int, value int);
+SELECT create_distributed_table('test', 'key');
+INSERT INTO test SELECT i, i % 10 FROM generate_series(1, 100) i;
+
+SET citus.task_assignment_policy TO 'work-stealing';
+SET citus.task_executor_type TO 'real-time';
+
+SELECT count(*), sum(value) FROM test;
+SELECT value, count(*) FROM test GROUP BY value ORDER BY value LIMIT 3;
+SELECT key FROM test WHERE value = 0 ORDER BY key;
+SELECT count(*) FROM test WHERE value > 4;
+
+-- in transaction blocks the planned assignment is used
+BEGIN;
+INSERT INTO test VALUES (101, 1);
+SELECT count(*), sum(value) FROM test;
+ROLLBACK;
+
+-- the task-tracker executor uses the greedy assignment
+SET citus.task_executor_type TO 'task-tracker';
+SELECT count(*), sum(value) FROM test;
+
+RESET citus.task_executor_type;
+RESET citus.task_assignment_policy;
+SET client_min_messages TO WARNING;
+DROP SCHEMA work_stealing CASCADE;